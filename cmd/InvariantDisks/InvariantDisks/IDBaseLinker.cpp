@@ -21,7 +21,11 @@ namespace ID
 		DiskArbitrationHandler(logger),
 		m_base(std::move(base))
 	{
-		createCleanPath(m_base);
+		// Keep the links of a previous instance until DiskArbitration has reported
+		// all disks, so that links that are still valid are never missing.
+		createPath(m_base);
+		for (auto const & entry: listDirectory(m_base))
+			m_staleLinks.insert(entry);
 	}
 
 	void BaseLinker::diskDisappeared(DADiskRef disk, DiskInformation const & di)
@@ -29,6 +33,23 @@ namespace ID
 		removeLinksForDisk(di);
 	}
 
+	void BaseLinker::diskArbitrationIdle()
+	{
+		for (auto const & link: m_staleLinks)
+		{
+			try
+			{
+				logger().log(ASL_LEVEL_NOTICE, "Removing stale symlink: ", link);
+				removeFSObject(link);
+			}
+			catch (std::exception const & e)
+			{
+				logger().log(ASL_LEVEL_ERR, "Could not remove symlink: ", e.what());
+			}
+		}
+		m_staleLinks.clear();
+	}
+
 	void BaseLinker::addLinkForDisk(std::string const & link, DiskInformation const & di)
 	{
 		try
@@ -36,8 +57,22 @@ namespace ID
 			if (link.empty())
 				return;
 			std::string devicePath = "/dev/" + di.mediaBSDName;
+			auto found = m_links.find(link);
+			if (found != m_links.end())
+			{
+				// Repeated events for a disk don't touch the file system
+				if (found->second.target() == devicePath)
+					return;
+				logger().log(ASL_LEVEL_NOTICE, "Replacing symlink: ", link, " -> ",
+							 found->second.target());
+				removeDeviceLink(found->second.target(), link);
+				m_links.erase(found);
+			}
+			// An identical symlink left by a previous instance is adopted as is
+			m_staleLinks.erase(link);
 			logger().log(ASL_LEVEL_NOTICE, "Creating symlink: ", link, " -> ", devicePath);
-			m_links.emplace(devicePath, SymlinkHandle(link, devicePath));
+			m_links.emplace(link, SymlinkHandle(link, devicePath));
+			m_deviceLinks.emplace(devicePath, link);
 		}
 		catch (std::exception const & e)
 		{
@@ -50,13 +85,13 @@ namespace ID
 		try
 		{
 			std::string devicePath = "/dev/" + di.mediaBSDName;
-			auto found = m_links.equal_range(devicePath);
+			auto found = m_deviceLinks.equal_range(devicePath);
 			for (auto it = found.first; it != found.second; ++it)
 			{
-				logger().log(ASL_LEVEL_NOTICE, "Removing symlink: ", it->second.link());
-				it->second.reset();
+				logger().log(ASL_LEVEL_NOTICE, "Removing symlink: ", it->second);
+				m_links.erase(it->second);
 			}
-			m_links.erase(found.first, found.second);
+			m_deviceLinks.erase(found.first, found.second);
 		}
 		catch (std::exception const & e)
 		{
@@ -64,6 +99,19 @@ namespace ID
 		}
 	}
 
+	void BaseLinker::removeDeviceLink(std::string const & devicePath, std::string const & link)
+	{
+		auto found = m_deviceLinks.equal_range(devicePath);
+		for (auto it = found.first; it != found.second; ++it)
+		{
+			if (it->second == link)
+			{
+				m_deviceLinks.erase(it);
+				return;
+			}
+		}
+	}
+
 	std::string const & BaseLinker::base() const
 	{
 		return m_base;
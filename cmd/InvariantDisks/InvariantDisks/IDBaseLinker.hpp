@@ -19,6 +19,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 
 namespace ID
 {
@@ -29,15 +30,21 @@ namespace ID
 
 	public:
 		virtual void diskDisappeared(DADiskRef disk, DiskInformation const & info) override;
+		virtual void diskArbitrationIdle() override;
 
 	protected:
 		void addLinkForDisk(std::string const & link, DiskInformation const & di);
 		void removeLinksForDisk(DiskInformation const & di);
 		std::string const & base() const;
 
+	private:
+		void removeDeviceLink(std::string const & devicePath, std::string const & link);
+
 	private:
 		std::string m_base;
-		std::multimap<std::string,SymlinkHandle> m_links;
+		std::map<std::string,SymlinkHandle> m_links;	// by link path
+		std::multimap<std::string,std::string> m_deviceLinks;	// device path to link paths
+		std::set<std::string> m_staleLinks;	// left over from a previous instance
 	};
 }
 
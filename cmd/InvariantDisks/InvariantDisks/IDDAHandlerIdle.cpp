@@ -14,8 +14,15 @@
 
 #include "IDFileUtils.hpp"
 
+#include <algorithm>
+
+#include <notify.h>
+
 namespace ID
 {
+	static char const * const idleNotification = "net.the-color-black.InvariantDisks.idle";
+	static int64_t const idleSettleNS = 250000000;
+
 	DAHandlerIdle::DAHandlerIdle(std::string base, int64_t idleTimeoutNS,
 								 ASLClient const & logger) :
 		DiskArbitrationHandler(logger),
@@ -23,6 +30,7 @@ namespace ID
 		m_idleTimer(createSourceTimer(this, [](void * ctx){ static_cast<DAHandlerIdle*>(ctx)->idle(); }))
 	{
 		createPath(m_base);
+		removeFSObject(m_base + "/invariant.idle");
 		busy();
 	}
 
@@ -36,14 +44,31 @@ namespace ID
 		busy();
 	}
 
+	void DAHandlerIdle::diskArbitrationIdle()
+	{
+		// DiskArbitration has caught up, only wait for stragglers of the current burst
+		scheduleSingleshot(m_idleTimer, std::min(m_idleTimeout, idleSettleNS));
+	}
+
 	void DAHandlerIdle::idle()
 	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_idle)
+			return;
 		createFile(m_base + "/invariant.idle");
+		notify_post(idleNotification);
+		m_idle = true;
 	}
 
 	void DAHandlerIdle::busy()
 	{
-		removeFSObject(m_base + "/invariant.idle");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Only the first event of a burst touches the idle file
+		if (m_idle)
+		{
+			removeFSObject(m_base + "/invariant.idle");
+			m_idle = false;
+		}
 		scheduleSingleshot(m_idleTimer, m_idleTimeout);
 	}
 }
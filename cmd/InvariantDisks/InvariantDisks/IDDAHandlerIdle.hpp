@@ -17,6 +17,7 @@
 #include "IDDispatchUtils.hpp"
 
 #include <string>
+#include <mutex>
 
 namespace ID
 {
@@ -29,6 +30,7 @@ namespace ID
 	public:
 		virtual void diskAppeared(DADiskRef disk, DiskInformation const & info) override;
 		virtual void diskDisappeared(DADiskRef disk, DiskInformation const & info) override;
+		virtual void diskArbitrationIdle() override;
 
 	private:
 		void idle();
@@ -38,6 +40,8 @@ namespace ID
 		std::string m_base;
 		int64_t m_idleTimeout;
 		DispatchSource m_idleTimer;
+		std::mutex m_mutex;
+		bool m_idle = false;
 	};
 }
 
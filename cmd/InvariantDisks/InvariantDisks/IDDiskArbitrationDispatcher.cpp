@@ -39,6 +39,8 @@ namespace ID
 			{ static_cast<DiskArbitrationDispatcher*>(ctx)->diskAppeared(disk); }, this);
 		DARegisterDiskDisappearedCallback(m_impl->session, nullptr, [](DADiskRef disk, void * ctx)
 			{ static_cast<DiskArbitrationDispatcher*>(ctx)->diskDisappeared(disk); }, this);
+		DARegisterIdleCallback(m_impl->session, [](void * ctx)
+			{ static_cast<DiskArbitrationDispatcher*>(ctx)->diskArbitrationIdle(); }, this);
 	}
 
 	DiskArbitrationDispatcher::~DiskArbitrationDispatcher()
@@ -103,4 +105,11 @@ namespace ID
 		for (auto const & handler: m_impl->handler)
 			handler->diskDisappeared(disk, info);
 	}
+
+	void DiskArbitrationDispatcher::diskArbitrationIdle() const
+	{
+		std::lock_guard<std::mutex> lock(m_impl->mutex);
+		for (auto const & handler: m_impl->handler)
+			handler->diskArbitrationIdle();
+	}
 }
@@ -45,6 +45,7 @@ namespace ID
 	private:
 		void diskAppeared(DADiskRef disk) const;
 		void diskDisappeared(DADiskRef disk) const;
+		void diskArbitrationIdle() const;
 
 	private:
 		struct Impl;
@@ -30,6 +30,10 @@ namespace ID
 	public:
 		virtual void diskAppeared(DADiskRef disk, DiskInformation const & info) = 0;
 		virtual void diskDisappeared(DADiskRef disk, DiskInformation const & info) = 0;
+		/*!
+		 Called whenever DiskArbitration has delivered all pending disk events.
+		 */
+		virtual void diskArbitrationIdle() {}
 
 	protected:
 		ASLClient const & logger() const { return m_logger; }
@@ -14,6 +14,7 @@
 #define ID_FILEUTILS_HPP
 
 #include <string>
+#include <vector>
 
 namespace ID
 {
@@ -22,6 +23,8 @@ namespace ID
 	void createFile(std::string const & path);
 	void createSymlink(std::string const & link, std::string const & target);
 	void removeFSObject(std::string const & path);
+	std::string readSymlink(std::string const & link);
+	std::vector<std::string> listDirectory(std::string const & path);
 }
 
 #endif
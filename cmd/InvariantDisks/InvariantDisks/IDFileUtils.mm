@@ -59,6 +59,9 @@ namespace ID
 	{
 		if (link.empty() || target.empty())
 			throw Exception("Can not create symlink with empty path");
+		// Leave an existing, identical symlink alone
+		if (readSymlink(link) == target)
+			return;
 		removeFSObject(link);
 		NSError * error = nullptr;
 		NSFileManager * manager = [NSFileManager defaultManager];
@@ -89,4 +92,31 @@ namespace ID
 			e << "Error removing file system object " << path << ": " << [[error description] UTF8String];
 		}
 	}
+
+	std::string readSymlink(std::string const & link)
+	{
+		NSFileManager * manager = [NSFileManager defaultManager];
+		NSString * target = [manager destinationOfSymbolicLinkAtPath:[NSString stringWithUTF8String:link.c_str()]
+															   error:nullptr];
+		if (!target)
+			return std::string();
+		return [target UTF8String];
+	}
+
+	std::vector<std::string> listDirectory(std::string const & path)
+	{
+		NSError * error = nullptr;
+		NSFileManager * manager = [NSFileManager defaultManager];
+		NSArray * contents = [manager contentsOfDirectoryAtPath:[NSString stringWithUTF8String:path.c_str()]
+														  error:&error];
+		if (!contents)
+		{
+			Throw<Exception> e;
+			e << "Error listing directory " << path << ": " << [[error description] UTF8String];
+		}
+		std::vector<std::string> entries;
+		for (NSString * entry in contents)
+			entries.push_back(path + "/" + [entry UTF8String]);
+		return entries;
+	}
 }
@@ -57,6 +57,35 @@ alternate_tunable_layout = False
 kstat_pobj = re.compile("^([^:]+):\s+(.+)\s*$", flags=re.M)
 
 
+def get_darwin_snapshot():
+    # All of arcstats, zfetchstats and vdev_cache_stats in one sysctl(3),
+    # copied by the kernel at once; see arcstat.py.
+    import ctypes
+    import errno
+
+    libc = ctypes.CDLL("libc.dylib", use_errno=True)
+    name = b"kstat.zfs.misc.stats_snapshot"
+    size = 65536
+
+    while True:
+        buf = ctypes.create_string_buffer(size)
+        length = ctypes.c_size_t(size)
+        if libc.sysctlbyname(name, buf, ctypes.byref(length), None, 0) == 0:
+            break
+        if ctypes.get_errno() != errno.ENOMEM:
+            sys.stderr.write("Cannot read %s\n" % name.decode())
+            sys.exit(1)
+        size *= 2
+
+    Kstat = {}
+    for line in buf.raw[:length.value].decode("ascii", "ignore").splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[0] != "hrtime":
+            Kstat["kstat.zfs.misc." + fields[0]] = D(fields[1])
+
+    return Kstat
+
+
 def get_Kstat():
     def load_proc_kstats(fn, namespace):
         kstats = [line.strip() for line in open(fn)]
@@ -82,6 +111,9 @@ def get_Kstat():
         "kstat.zfs",
         "vfs.zfs"
     ]
+    if sys.platform == "darwin":
+        return get_darwin_snapshot()
+
     Kstat = {}
     load_proc_kstats('/proc/spl/kstat/zfs/arcstats',
             'kstat.zfs.misc.arcstats.')
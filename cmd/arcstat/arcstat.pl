@@ -66,6 +66,9 @@ my %cols = (# HDR => [Size, Description]
 	"mfug" 	=>[5, "MFU Ghost List hits per second"],
 	"mrug" 	=>[5, "MRU Ghost List hits per second"],
 	"eskip"	=>[5, "evict_skip per second"],
+	"pevict"=>[6, "Bytes evicted for memory pressure per second"],
+	"sevict"=>[6, "Bytes evicted to stay within size per second"],
+	"press"	=>[5, "Memory pressure level (0 to 3)"],
 	"mtxmis"=>[6, "mutex_miss per second"],
 	"rmis"	=>[5, "recycle_miss per second"],
 	"dread"	=>[5, "Demand data accesses per second"],
@@ -278,6 +281,9 @@ sub calculate {
 	$v{"mrug"} = $d{"mru_ghost_hits"}/$int;
 	$v{"mfug"} = $d{"mru_ghost_hits"}/$int;
 	$v{"eskip"} = $d{"evict_skip"}/$int;
+	$v{"pevict"} = $d{"evict_pressure"}/$int;
+	$v{"sevict"} = $d{"evict_size"}/$int;
+	$v{"press"} = $cur{"pressure_level"};
 	$v{"rmiss"} = $d{"recycle_miss"}/$int;
 	$v{"mtxmis"} = $d{"mutex_miss"}/$int;
 
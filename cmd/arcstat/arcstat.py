@@ -45,6 +45,7 @@
 
 
 import sys
+import os
 import time
 import getopt
 import re
@@ -81,6 +82,9 @@ cols = {
     "mfug":       [4, 1000, "MFU Ghost List hits per second"],
     "mrug":       [4, 1000, "MRU Ghost List hits per second"],
     "eskip":      [5, 1000, "evict_skip per second"],
+    "pevict":     [6, 1024, "Bytes evicted for memory pressure per second"],
+    "sevict":     [6, 1024, "Bytes evicted to stay within size per second"],
+    "press":      [5, 1000, "Memory pressure level (0 to 3)"],
     "mtxmis":     [6, 1000, "mutex_miss per second"],
     "dread":      [5, 1000, "Demand accesses per second"],
     "pread":      [5, 1000, "Prefetch accesses per second"],
@@ -92,6 +96,18 @@ cols = {
     "l2asize":    [7, 1024, "Actual (compressed) size of the L2ARC"],
     "l2size":     [6, 1024, "Size of the L2ARC"],
     "l2bytes":    [7, 1024, "bytes read per second from the L2ARC"],
+    "l2wbytes":   [8, 1024, "bytes written per second to the L2ARC"],
+    "l2feeds":    [7, 1000, "L2ARC feed thread runs per second"],
+    "l2cksum":    [7, 1000, "L2ARC checksum errors per second"],
+    "dbsz":       [4, 1024, "Dbuf cache size"],
+    "dbc":        [4, 1024, "Dbuf cache target size"],
+    "dbevict":    [7, 1000, "Dbuf cache evictions per second"],
+    "zfhit":      [5, 1000, "Prefetch stream hits per second"],
+    "zfmiss":     [6, 1000, "Prefetch stream misses per second"],
+    "vchit":      [5, 1000, "Vdev cache hits per second"],
+    "vcmiss":     [6, 1000, "Vdev cache inflated reads per second"],
+    "vcwaste":    [7, 1024, "Vdev cache bytes evicted unread per second"],
+    "vcsz":       [4, 1024, "Vdev cache size"],
 }
 
 v = {}
@@ -112,6 +128,8 @@ cur = {}
 d = {}
 out = None
 kstat = None
+snaptime = None        # Time of the current snapshot, in seconds
+elapsed = None         # Seconds between the last two snapshots
 float_pobj = re.compile("^[0-9]+(\.[0-9]+)?$")
 
 
@@ -145,32 +163,93 @@ def usage():
     sys.exit(1)
 
 
+def darwin_snapshot():
+    # Read all counters with one sysctl(3) call rather than one sysctl(8)
+    # run per field, which costs tens of milliseconds.  The kernel copies
+    # them all at once and stamps the copy with gethrtime().
+    import ctypes
+    import errno
+
+    libc = ctypes.CDLL("libc.dylib", use_errno=True)
+    name = b"kstat.zfs.misc.stats_snapshot"
+    size = 65536
+
+    while True:
+        buf = ctypes.create_string_buffer(size)
+        length = ctypes.c_size_t(size)
+        if libc.sysctlbyname(name, buf, ctypes.byref(length), None, 0) == 0:
+            break
+        if ctypes.get_errno() != errno.ENOMEM:
+            sys.stderr.write("Cannot read %s\n" % name.decode())
+            sys.exit(1)
+        size *= 2
+
+    return buf.raw[:length.value].decode("ascii", "ignore").splitlines()
+
+
 def kstat_update():
     global kstat
+    global snaptime
 
-    k = [line.strip() for line in open('/proc/spl/kstat/zfs/arcstats')]
+    kstat = {}
 
-    if not k:
-        sys.exit(1)
+    if sys.platform == "darwin":
+        for s in darwin_snapshot():
+            fields = s.split()
+            if len(fields) != 2:
+                continue
 
-    del k[0:2]
-    kstat = {}
+            name, value = fields
+            if name == "hrtime":
+                snaptime = Decimal(value) / 1000000000
+                continue
+
+            # arcstats are used without their prefix
+            if name.startswith("arcstats."):
+                name = name[len("arcstats."):]
+            kstat[name] = Decimal(value)
 
-    for s in k:
-        if not s:
+        if not kstat:
+            sys.exit(1)
+        return
+
+    snaptime = Decimal(repr(time.time()))
+    for f in ["arcstats", "zfetchstats", "dbufcachestats",
+              "vdev_cache_stats"]:
+        fn = "/proc/spl/kstat/zfs/" + f
+        if not os.path.exists(fn):
+            if f == "arcstats":
+                sys.exit(1)
             continue
 
-        name, unused, value = s.split()
-        kstat[name] = Decimal(value)
+        k = [line.strip() for line in open(fn)]
+        del k[0:2]
+        prefix = "" if f == "arcstats" else f + "."
+
+        for s in k:
+            if not s:
+                continue
+
+            name, unused, value = s.split()
+            kstat[prefix + name] = Decimal(value)
 
 
 def snap_stats():
     global cur
     global kstat
+    global elapsed
 
     prev = copy.deepcopy(cur)
+    prevtime = snaptime
     kstat_update()
 
+    # Rates are over the actual time between the two snapshots, which is
+    # longer than the interval by the time taken to print and sleep.
+    if prevtime is not None and snaptime > prevtime:
+        elapsed = snaptime - prevtime
+    else:
+        elapsed = sint
+
     cur = kstat
     for key in cur:
         if re.match(key, "class"):
@@ -368,31 +447,34 @@ def calculate():
 
     v = dict()
     v["time"] = time.strftime("%H:%M:%S", time.localtime())
-    v["hits"] = d["hits"] / sint
-    v["miss"] = d["misses"] / sint
+    v["hits"] = d["hits"] / elapsed
+    v["miss"] = d["misses"] / elapsed
     v["read"] = v["hits"] + v["miss"]
     v["hit%"] = 100 * v["hits"] / v["read"] if v["read"] > 0 else 0
     v["miss%"] = 100 - v["hit%"] if v["read"] > 0 else 0
 
-    v["dhit"] = (d["demand_data_hits"] + d["demand_metadata_hits"]) / sint
-    v["dmis"] = (d["demand_data_misses"] + d["demand_metadata_misses"]) / sint
+    v["dhit"] = (d["demand_data_hits"] +
+                 d["demand_metadata_hits"]) / elapsed
+    v["dmis"] = (d["demand_data_misses"] +
+                 d["demand_metadata_misses"]) / elapsed
 
     v["dread"] = v["dhit"] + v["dmis"]
     v["dh%"] = 100 * v["dhit"] / v["dread"] if v["dread"] > 0 else 0
     v["dm%"] = 100 - v["dh%"] if v["dread"] > 0 else 0
 
-    v["phit"] = (d["prefetch_data_hits"] + d["prefetch_metadata_hits"]) / sint
+    v["phit"] = (d["prefetch_data_hits"] +
+                 d["prefetch_metadata_hits"]) / elapsed
     v["pmis"] = (d["prefetch_data_misses"] +
-                 d["prefetch_metadata_misses"]) / sint
+                 d["prefetch_metadata_misses"]) / elapsed
 
     v["pread"] = v["phit"] + v["pmis"]
     v["ph%"] = 100 * v["phit"] / v["pread"] if v["pread"] > 0 else 0
     v["pm%"] = 100 - v["ph%"] if v["pread"] > 0 else 0
 
     v["mhit"] = (d["prefetch_metadata_hits"] +
-                 d["demand_metadata_hits"]) / sint
+                 d["demand_metadata_hits"]) / elapsed
     v["mmis"] = (d["prefetch_metadata_misses"] +
-                 d["demand_metadata_misses"]) / sint
+                 d["demand_metadata_misses"]) / elapsed
 
     v["mread"] = v["mhit"] + v["mmis"]
     v["mh%"] = 100 * v["mhit"] / v["mread"] if v["mread"] > 0 else 0
@@ -400,23 +482,39 @@ def calculate():
 
     v["arcsz"] = cur["size"]
     v["c"] = cur["c"]
-    v["mfu"] = d["mfu_hits"] / sint
-    v["mru"] = d["mru_hits"] / sint
-    v["mrug"] = d["mru_ghost_hits"] / sint
-    v["mfug"] = d["mfu_ghost_hits"] / sint
-    v["eskip"] = d["evict_skip"] / sint
-    v["mtxmis"] = d["mutex_miss"] / sint
+    v["mfu"] = d["mfu_hits"] / elapsed
+    v["mru"] = d["mru_hits"] / elapsed
+    v["mrug"] = d["mru_ghost_hits"] / elapsed
+    v["mfug"] = d["mfu_ghost_hits"] / elapsed
+    v["eskip"] = d["evict_skip"] / elapsed
+    v["pevict"] = d["evict_pressure"] / elapsed
+    v["sevict"] = d["evict_size"] / elapsed
+    v["press"] = cur["pressure_level"]
+    v["mtxmis"] = d["mutex_miss"] / elapsed
 
     if l2exist:
-        v["l2hits"] = d["l2_hits"] / sint
-        v["l2miss"] = d["l2_misses"] / sint
+        v["l2hits"] = d["l2_hits"] / elapsed
+        v["l2miss"] = d["l2_misses"] / elapsed
         v["l2read"] = v["l2hits"] + v["l2miss"]
         v["l2hit%"] = 100 * v["l2hits"] / v["l2read"] if v["l2read"] > 0 else 0
 
         v["l2miss%"] = 100 - v["l2hit%"] if v["l2read"] > 0 else 0
         v["l2asize"] = cur["l2_asize"]
         v["l2size"] = cur["l2_size"]
-        v["l2bytes"] = d["l2_read_bytes"] / sint
+        v["l2bytes"] = d["l2_read_bytes"] / elapsed
+        v["l2wbytes"] = d["l2_write_bytes"] / elapsed
+        v["l2feeds"] = d["l2_feeds"] / elapsed
+        v["l2cksum"] = d["l2_cksum_bad"] / elapsed
+
+    v["dbsz"] = cur.get("dbufcachestats.cache_size", 0)
+    v["dbc"] = cur.get("dbufcachestats.cache_target", 0)
+    v["dbevict"] = d.get("dbufcachestats.cache_evicts", 0) / elapsed
+    v["zfhit"] = d.get("zfetchstats.hits", 0) / elapsed
+    v["zfmiss"] = d.get("zfetchstats.misses", 0) / elapsed
+    v["vchit"] = d.get("vdev_cache_stats.hits", 0) / elapsed
+    v["vcmiss"] = d.get("vdev_cache_stats.misses", 0) / elapsed
+    v["vcwaste"] = d.get("vdev_cache_stats.waste_bytes", 0) / elapsed
+    v["vcsz"] = cur.get("vdev_cache_stats.size", 0)
 
 
 def main():
@@ -2,7 +2,9 @@
 #
 # Print out statistics for all cached dmu buffers.  This information
 # is available through the dbufs kstat and may be post-processed as
-# needed by the script.
+# needed by the script.  The dbufs kstat is empty unless the
+# zfs_dbuf_stats_dump module parameter is set; the totals by dnode type
+# and by objset come from the cheaper dbuftypes and dbufobjsets kstats.
 #
 # CDDL HEADER START
 #
@@ -38,7 +40,8 @@ bxhdr = ["pool", "objset", "object", "level", "blkid", "offset", "dbsize",
          "count", "asize", "access", "mru", "gmru", "mfu", "gmfu", "l2",
          "l2_dattr", "l2_asize", "l2_comp", "aholds", "dtype", "btype",
          "data_bs", "meta_bs", "bsize", "lvls", "dholds", "blocks", "dsize"]
-bincompat = ["cached", "direct", "indirect", "bonus", "spill"]
+bincompat = ["cached", "direct", "indirect", "bonus", "spill", "hits",
+             "reholds", "misses", "hit%", "rehold%"]
 
 dhdr = ["pool", "objset", "object", "dtype", "cached"]
 dxhdr = ["pool", "objset", "object", "dtype", "btype", "data_bs", "meta_bs",
@@ -47,7 +50,8 @@ dxhdr = ["pool", "objset", "object", "dtype", "btype", "data_bs", "meta_bs",
 dincompat = ["level", "blkid", "offset", "dbsize", "meta", "state", "dbholds",
              "list", "atype", "index", "flags", "count", "asize", "access",
              "mru", "gmru", "mfu", "gmfu", "l2", "l2_dattr", "l2_asize",
-             "l2_comp", "aholds"]
+             "l2_comp", "aholds", "hits", "reholds", "misses", "hit%",
+             "rehold%"]
 
 thdr = ["pool", "objset", "dtype", "cached"]
 txhdr = ["pool", "objset", "dtype", "cached", "direct", "indirect",
@@ -56,7 +60,8 @@ tincompat = ["object", "level", "blkid", "offset", "dbsize", "meta", "state",
              "dbholds", "list", "atype", "index", "flags", "count", "asize",
              "access", "mru", "gmru", "mfu", "gmfu", "l2", "l2_dattr",
              "l2_asize", "l2_comp", "aholds", "btype", "data_bs", "meta_bs",
-             "bsize", "lvls", "dholds", "blocks", "dsize"]
+             "bsize", "lvls", "dholds", "blocks", "dsize", "hits", "reholds",
+             "misses", "hit%", "rehold%"]
 
 cols = {
     # hdr:        [size, scale, description]
@@ -100,12 +105,33 @@ cols = {
     "indirect":   [8,  1024, "bytes cached for indirect blocks"],
     "bonus":      [5,  1024, "bytes cached for bonus buffer"],
     "spill":      [5,  1024, "bytes cached for spill block"],
+    "hits":       [6,  1000, "holds that found the dbuf"],
+    "reholds":    [7,  1000, "holds that found it idle in the dbuf cache"],
+    "misses":     [6,  1000, "holds that created the dbuf"],
+    "hit%":       [4,   100, "percentage of holds that found the dbuf"],
+    "rehold%":    [7,   100, "percentage of the holds of idle or new "
+                             "dbufs that found them in the dbuf cache"],
+    "dbufs":      [6,  1000, "number of dbufs"],
+    "dbbytes":    [7,  1024, "size of the dbufs"],
+    "dbind":      [6,  1000, "number of dbufs of indirect blocks"],
+    "dbidle":     [6,  1000, "number of dbufs idle in the dbuf cache"],
+    "dbidlesz":   [8,  1024, "size of the dbufs idle in the dbuf cache"],
 }
 
+yhdr = ["dtype", "dbufs", "dbbytes", "hits", "misses", "hit%"]
+yxhdr = ["dtype", "dbufs", "dbbytes", "dbind", "dbidle", "dbidlesz",
+         "hits", "reholds", "misses", "hit%", "rehold%"]
+yincompat = [c for c in cols if c not in yxhdr]
+
+ahdr = ["pool", "objset", "dbufs", "dbbytes"]
+axhdr = ["pool", "objset", "dbufs", "dbbytes", "dbind", "dbidle",
+         "dbidlesz"]
+aincompat = [c for c in cols if c not in axhdr]
+
 hdr = None
 xhdr = None
 sep = "  "  # Default separator is 2 spaces
-cmd = ("Usage: dbufstat.py [-bdhrtvx] [-i file] [-f fields] [-o file] "
+cmd = ("Usage: dbufstat.py [-abdhrtvxy] [-i file] [-f fields] [-o file] "
        "[-s string]\n")
 raw = 0
 
@@ -139,6 +165,12 @@ def detailed_usage():
     sys.stderr.write("Field definitions incompatible with '-t' option:\n")
     print_incompat_helper(tincompat)
 
+    sys.stderr.write("Field definitions incompatible with '-y' option:\n")
+    print_incompat_helper(yincompat)
+
+    sys.stderr.write("Field definitions incompatible with '-a' option:\n")
+    print_incompat_helper(aincompat)
+
     sys.stderr.write("Field definitions are as follows:\n")
     for key in sorted(cols.keys()):
         sys.stderr.write("%11s : %s\n" % (key, cols[key][2]))
@@ -149,6 +181,7 @@ def detailed_usage():
 
 def usage():
     sys.stderr.write("%s\n" % cmd)
+    sys.stderr.write("\t -a : Print table of dbuf totals for each objset\n")
     sys.stderr.write("\t -b : Print table of information for each dbuf\n")
     sys.stderr.write("\t -d : Print table of information for each dnode\n")
     sys.stderr.write("\t -h : Print this help message\n")
@@ -158,6 +191,8 @@ def usage():
     sys.stderr.write("\t -v : List all possible field headers and definitions"
                      "\n")
     sys.stderr.write("\t -x : Print extended stats\n")
+    sys.stderr.write("\t -y : Print table of dbuf totals and hold hit ratios "
+                     "for each dnode type\n")
     sys.stderr.write("\t -i : Redirect input from the specified file\n")
     sys.stderr.write("\t -f : Specify specific fields to print (see -v)\n")
     sys.stderr.write("\t -o : Redirect output to the specified file\n")
@@ -168,6 +203,10 @@ def usage():
     sys.stderr.write("\tdbufstat.py -t -s \",\" -o /tmp/t.log\n")
     sys.stderr.write("\tdbufstat.py -v\n")
     sys.stderr.write("\tdbufstat.py -d -f pool,object,objset,dsize,cached\n")
+    sys.stderr.write("\tdbufstat.py -y -x\n")
+    sys.stderr.write("\tdbufstat.py -a -f pool,objset,dbufs,dbidle\n")
+    sys.stderr.write("\nThe -b, -d and -t tables are only filled in while "
+                     "the zfs_dbuf_stats_dump\nmodule parameter is set.\n")
     sys.stderr.write("\n")
 
     sys.exit(1)
@@ -431,6 +470,58 @@ def types_build_dict(filehandle):
     return types
 
 
+def holds_print_all(filehandle):
+    labels = dict()
+
+    # The first line is header information, skip it
+    next(filehandle)
+
+    # The second line contains the labels and index locations
+    for i, v in enumerate(next(filehandle).split()):
+        labels[v] = i
+
+    print_header()
+
+    # The rest of the file holds the counters of each dnode type
+    for line in filehandle:
+        line = line.split()
+        v = dict()
+        v['dtype'] = get_typestring(int(line[labels['dtype']]))
+        for col in ['hits', 'reholds', 'misses', 'dbufs', 'dbbytes',
+                    'dbind', 'dbidle', 'dbidlesz']:
+            v[col] = int(line[labels[col]])
+        holds = v['hits'] + v['misses']
+        if holds == 0 and v['dbufs'] == 0:
+            continue
+        v['hit%'] = 100 * v['hits'] / holds if holds > 0 else 0
+        idle = v['reholds'] + v['misses']
+        v['rehold%'] = 100 * v['reholds'] / idle if idle > 0 else 0
+        print_values(v)
+
+
+def objsets_print_all(filehandle):
+    labels = dict()
+
+    # The first line is header information, skip it
+    next(filehandle)
+
+    # The second line contains the labels and index locations
+    for i, v in enumerate(next(filehandle).split()):
+        labels[v] = i
+
+    print_header()
+
+    # The rest of the file holds the counters of each objset
+    for line in filehandle:
+        line = line.split()
+        v = dict()
+        v['pool'] = str(line[labels['pool']])
+        for col in ['objset', 'dbufs', 'dbbytes', 'dbind', 'dbidle',
+                    'dbidlesz']:
+            v[col] = int(line[labels[col]])
+        print_values(v)
+
+
 def buffers_print_all(filehandle):
     labels = dict()
 
@@ -455,6 +546,7 @@ def main():
     global raw
 
     desired_cols = None
+    aflag = False
     bflag = False
     dflag = False
     hflag = False
@@ -463,12 +555,14 @@ def main():
     tflag = False
     vflag = False
     xflag = False
+    yflag = False
 
     try:
         opts, args = getopt.getopt(
             sys.argv[1:],
-            "bdf:hi:o:rs:tvx",
+            "abdf:hi:o:rs:tvxy",
             [
+                "objsets",
                 "buffers",
                 "dnodes",
                 "columns",
@@ -478,7 +572,8 @@ def main():
                 "seperator",
                 "types",
                 "verbose",
-                "extended"
+                "extended",
+                "holds"
             ]
         )
     except getopt.error:
@@ -486,6 +581,8 @@ def main():
         opts = None
 
     for opt, arg in opts:
+        if opt in ('-a', '--objsets'):
+            aflag = True
         if opt in ('-b', '--buffers'):
             bflag = True
         if opt in ('-d', '--dnodes'):
@@ -508,6 +605,8 @@ def main():
             vflag = True
         if opt in ('-x', '--extended'):
             xflag = True
+        if opt in ('-y', '--holds'):
+            yflag = True
 
     if hflag or (xflag and desired_cols):
         usage()
@@ -515,14 +614,18 @@ def main():
     if vflag:
         detailed_usage()
 
-    # Ensure at most only one of b, d, or t flags are set
-    if (bflag and dflag) or (bflag and tflag) or (dflag and tflag):
+    # Ensure at most only one of a, b, d, t, or y flags are set
+    if len([f for f in [aflag, bflag, dflag, tflag, yflag] if f]) > 1:
         usage()
 
-    if bflag:
+    if aflag:
+        hdr = axhdr if xflag else ahdr
+    elif bflag:
         hdr = bxhdr if xflag else bhdr
     elif tflag:
         hdr = txhdr if xflag else thdr
+    elif yflag:
+        hdr = yxhdr if xflag else yhdr
     else:  # Even if dflag is False, it's the default if none set
         dflag = True
         hdr = dxhdr if xflag else dhdr
@@ -535,9 +638,11 @@ def main():
         for ele in hdr:
             if ele not in cols:
                 invalid.append(ele)
-            elif ((bflag and bincompat and ele in bincompat) or
+            elif ((aflag and aincompat and ele in aincompat) or
+                  (bflag and bincompat and ele in bincompat) or
                   (dflag and dincompat and ele in dincompat) or
-                  (tflag and tincompat and ele in tincompat)):
+                  (tflag and tincompat and ele in tincompat) or
+                  (yflag and yincompat and ele in yincompat)):
                     incompat.append(ele)
 
         if len(invalid) > 0:
@@ -558,7 +663,11 @@ def main():
             sys.stderr.write("Cannot open %s for writing\n" % ofile)
             sys.exit(1)
 
-    if not ifile:
+    if not ifile and aflag:
+        ifile = '/proc/spl/kstat/zfs/dbufobjsets'
+    elif not ifile and yflag:
+        ifile = '/proc/spl/kstat/zfs/dbuftypes'
+    elif not ifile:
         ifile = '/proc/spl/kstat/zfs/dbufs'
 
     if ifile is not "-":
@@ -569,6 +678,9 @@ def main():
             sys.stderr.write("Cannot open %s for reading\n" % ifile)
             sys.exit(1)
 
+    if aflag:
+        objsets_print_all(sys.stdin)
+
     if bflag:
         buffers_print_all(sys.stdin)
 
@@ -578,5 +690,8 @@ def main():
     if tflag:
         print_dict(types_build_dict(sys.stdin))
 
+    if yflag:
+        holds_print_all(sys.stdin)
+
 if __name__ == '__main__':
     main()
@@ -0,0 +1,183 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zbench runs the checksum, compression, RAID-Z parity and encryption
+ * microbenchmarks of zfs_bench.c through libzpool, so that the kernels can
+ * be compared without loading the module.  The same suite is run in the
+ * kernel by writing a block size to the zfs_bench_blocksize tunable.
+ * With -l it instead shows how taking spa_config_lock and the teardown
+ * lock of a filesystem as reader scales with the number of threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/zfs_bench.h>
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr,
+	    "Usage: zbench [-b blocksize[,blocksize]...] [-t msec]\n"
+	    "       zbench -l [-t msec]\n"
+	    "\n"
+	    "    -b  block sizes to run the suite over (default 4k,128k)\n"
+	    "    -l  run the reader lock benchmarks on 1, 2, 4, ... threads,\n"
+	    "        up to the number of online CPUs\n"
+	    "    -t  minimum run time of each test in milliseconds "
+	    "(default %d)\n", (int)NSEC2MSEC(ZFS_BENCH_NS_DEFAULT));
+	exit(1);
+}
+
+/*
+ * Parse a block size such as "4096", "4k" or "1m".
+ */
+static uint64_t
+parse_size(const char *str)
+{
+	char *end;
+	uint64_t val;
+
+	errno = 0;
+	val = strtoull(str, &end, 0);
+	if (errno != 0 || end == str)
+		return (0);
+
+	switch (tolower(*end)) {
+	case 'k':
+		val <<= 10;
+		end++;
+		break;
+	case 'm':
+		val <<= 20;
+		end++;
+		break;
+	default:
+		break;
+	}
+
+	return (*end == '\0' ? val : 0);
+}
+
+/*
+ * Print the rate of reader enter and exit pairs of all threads, in
+ * millions per second, of SCL_ZIO and of a teardown lock.  A rate stays
+ * flat with the number of threads while they contend on one cache line
+ * and grows with them when they do not.
+ */
+static void
+lock_bench(hrtime_t ns)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads;
+
+	(void) printf("%7s %12s %12s\n", "THREADS", "spa_config", "teardown");
+
+	for (threads = 1; threads <= MAX(ncpus, 1); threads *= 2) {
+		uint64_t scl = zfs_bench_lock(ZFS_BENCH_LOCK_SPA_CONFIG,
+		    threads, ns);
+		uint64_t td = zfs_bench_lock(ZFS_BENCH_LOCK_TEARDOWN,
+		    threads, ns);
+
+		(void) printf("%7d %12.2f %12.2f\n", threads,
+		    (double)scl / 1e6, (double)td / 1e6);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	char *sizes = strdup("4k,128k");
+	char *size, *next;
+	zfs_bench_result_t *results;
+	hrtime_t ns = ZFS_BENCH_NS_DEFAULT;
+	boolean_t lock_bench = B_FALSE;
+	int c, i, n, error = 0;
+
+	while ((c = getopt(argc, argv, "b:lt:")) != -1) {
+		switch (c) {
+		case 'b':
+			free(sizes);
+			sizes = strdup(optarg);
+			break;
+		case 'l':
+			lock_bench = B_TRUE;
+			break;
+		case 't':
+			ns = MSEC2NSEC(strtoll(optarg, NULL, 0));
+			if (ns <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	results = umem_alloc(ZFS_BENCH_RESULTS_MAX * sizeof (*results),
+	    UMEM_NOFAIL);
+
+	kernel_init(FREAD);
+
+	if (lock_bench) {
+		lock_bench(ns);
+	} else {
+		(void) printf("%-11s %-17s %-12s %9s %10s\n", "GROUP",
+		    "IMPLEMENTATION", "OPERATION", "BLOCKSIZE", "GB/s");
+	}
+
+	for (size = lock_bench ? NULL : sizes; size != NULL; size = next) {
+		uint64_t blksz;
+
+		if ((next = strchr(size, ',')) != NULL)
+			*next++ = '\0';
+
+		blksz = parse_size(size);
+		if ((error = zfs_bench_run(blksz, ns)) != 0) {
+			(void) fprintf(stderr, "zbench: invalid block "
+			    "size '%s': %s\n", size, strerror(error));
+			break;
+		}
+
+		n = zfs_bench_results(results, ZFS_BENCH_RESULTS_MAX);
+		for (i = 0; i < n; i++) {
+			(void) printf("%-11s %-17s %-12s %9llu %10.2f\n",
+			    results[i].zbr_group, results[i].zbr_name,
+			    results[i].zbr_op,
+			    (u_longlong_t)results[i].zbr_blksz,
+			    (double)results[i].zbr_rate / 1e9);
+		}
+	}
+
+	kernel_fini();
+
+	umem_free(results, ZFS_BENCH_RESULTS_MAX * sizeof (*results));
+	free(sizes);
+
+	return (error != 0);
+}
@@ -55,10 +55,12 @@
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <sys/dmu_traverse.h>
+#include <sys/dmu_sample.h>
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
 #include <sys/zfs_fuid.h>
 #include <sys/arc.h>
+#include <sys/abd.h>
 #include <sys/ddt.h>
 #include <sys/zfeature.h>
 #include <zfs_comutil.h>
@@ -97,6 +99,10 @@ uint64_t *zopt_object = NULL;
 int zopt_objects = 0;
 libzfs_handle_t *g_zfs;
 uint64_t max_inflight = 1000;
+int zdb_threads = 1;
+char *zdb_checkpoint = NULL;
+uint64_t zdb_sample_rate = 0;
+extern int32_t zfs_pd_bytes_max;
 
 static void snprintf_blkptr_compact(char *, size_t, const blkptr_t *);
 
@@ -122,10 +128,12 @@ usage(void)
 	(void) fprintf(stderr,
 	    "Usage:\t%s [-AbcdDFGhiLMPsvX] [-e [-p <path> ...]] "
 	    "[-I <inflight I/Os>]\n"
+	    "\t\t[-j <threads>] [-K <checkpoint>] [-W <prefetch bytes>]\n"
+	    "\t\t[-z <sample ppm>]\n"
 	    "\t\t[-o <var>=<value>]... [-t <txg>] [-U <cache>] [-x <dumpdir>]\n"
 	    "\t\t[<poolname> [<object> ...]]\n"
-	    "\t%s [-AdiPv] [-e [-p <path> ...]] [-U <cache>] <dataset> "
-	    "[<object> ...]\n"
+	    "\t%s [-AdiPv] [-e [-p <path> ...]] [-U <cache>] "
+	    "[-z <sample ppm>] <dataset> [<object> ...]\n"
 	    "\t%s -C [-A] [-U <cache>]\n"
 	    "\t%s -l [-Aqu] <device>\n"
 	    "\t%s -m [-AFLPX] [-e [-p <path> ...]] [-t <txg>] [-U <cache>]\n"
@@ -162,6 +170,8 @@ usage(void)
 	    "device\n");
 	(void) fprintf(stderr, "        -s report stats on zdb's I/O\n");
 	(void) fprintf(stderr, "        -S simulate dedup to measure effect\n");
+	(void) fprintf(stderr, "        -z <sample ppm> -- block size and "
+	    "compression histograms from a sample of each dataset\n");
 	(void) fprintf(stderr, "        -v verbose (applies to all "
 	    "others)\n\n");
 	(void) fprintf(stderr, "    Below options are intended for use "
@@ -180,6 +190,12 @@ usage(void)
 	(void) fprintf(stderr, "        -I <number of inflight I/Os> -- "
 	    "specify the maximum number of checksumming I/Os "
 	    "[default is 200]\n");
+	(void) fprintf(stderr, "        -j <threads> -- traverse datasets "
+	    "in parallel for -b and -c\n");
+	(void) fprintf(stderr, "        -K <checkpoint> -- save and resume "
+	    "the -b traversal, requires -L\n");
+	(void) fprintf(stderr, "        -W <prefetch bytes> -- prefetch "
+	    "window of each traversal [default is 50M]\n");
 	(void) fprintf(stderr, "        -G dump zfs_dbgmsg buffer before "
 	    "exiting\n");
 	(void) fprintf(stderr, "        -F attempt automatic rewind within "
@@ -757,13 +773,13 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	zdb_nicenum(metaslab_block_maxsize(msp), maxbuf);
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", zfs_btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 	(void) printf("\tIn-memory histogram:\n");
 	dump_histogram(rt->rt_histogram, RANGE_TREE_HISTOGRAM_SIZE, 0);
@@ -2482,6 +2498,111 @@ dump_one_dir(const char *dsname, void *arg)
 	return (0);
 }
 
+/*
+ * Sampled block size and compression histograms (-z), see dmu_sample.c.
+ */
+static void
+dump_sample(objset_t *os)
+{
+	dmu_sample_stats_t *dss;
+	char osname[ZFS_MAX_DATASET_NAME_LEN];
+	char lbuf[32], pbuf[32], abuf[32], sbuf[32];
+	double scale;
+	int error, b, c;
+
+	dss = umem_alloc(sizeof (*dss), UMEM_NOFAIL);
+	dmu_objset_name(os, osname);
+	error = dmu_sample_dataset(dmu_objset_ds(os), zdb_sample_rate, dss);
+	if (error != 0) {
+		(void) printf("\nSampling %s failed: %s\n", osname,
+		    strerror(error));
+		umem_free(dss, sizeof (*dss));
+		return;
+	}
+
+	(void) printf("\nSampled blocks of %s\n", osname);
+	(void) printf("\t%llu of %llu L1 blocks and small objects sampled, "
+	    "%llu blocks (%llu embedded)\n",
+	    (u_longlong_t)dss->dss_units_sampled, (u_longlong_t)dss->dss_units,
+	    (u_longlong_t)dss->dss_blocks, (u_longlong_t)dss->dss_embedded);
+	if (dss->dss_blocks == 0) {
+		umem_free(dss, sizeof (*dss));
+		return;
+	}
+
+	scale = (double)dss->dss_units / dss->dss_units_sampled;
+	zdb_nicenum(dss->dss_lsize * scale, lbuf);
+	zdb_nicenum(dss->dss_psize * scale, pbuf);
+	zdb_nicenum(dss->dss_asize * scale, abuf);
+	(void) printf("\testimated %llu blocks, %s logical, %s physical, "
+	    "%s allocated, compression %.2fx\n",
+	    (u_longlong_t)(dss->dss_blocks * scale), lbuf, pbuf, abuf,
+	    (double)dss->dss_lsize / MAX(dss->dss_psize, 1));
+	if (dss->dss_special_blocks != 0) {
+		zdb_nicenum(dss->dss_special_asize * scale, abuf);
+		(void) printf("	estimated %llu blocks, %s allocated on "
+		    "special vdevs\n",
+		    (u_longlong_t)(dss->dss_special_blocks * scale), abuf);
+	}
+
+	(void) printf("\n\t%6s  %10s %10s %10s\n",
+	    "size", "lsize", "psize", "asize");
+	for (b = 0; b < DMU_SAMPLE_SIZE_BUCKETS; b++) {
+		if (dss->dss_lsize_hist[b] == 0 &&
+		    dss->dss_psize_hist[b] == 0 &&
+		    dss->dss_asize_hist[b] == 0)
+			continue;
+		zdb_nicenum(1ULL << (b + SPA_MINBLOCKSHIFT), sbuf);
+		(void) printf("\t%6s%s %10llu %10llu %10llu\n", sbuf,
+		    b == DMU_SAMPLE_SIZE_BUCKETS - 1 ? "+" : " ",
+		    (u_longlong_t)dss->dss_lsize_hist[b],
+		    (u_longlong_t)dss->dss_psize_hist[b],
+		    (u_longlong_t)dss->dss_asize_hist[b]);
+	}
+
+	(void) printf("\n\t%8s  %10s\n", "ratio", "blocks");
+	for (b = 0; b < DMU_SAMPLE_RATIO_BUCKETS; b++) {
+		uint64_t lim = (b == DMU_SAMPLE_RATIO_BUCKETS - 1) ?
+		    dmu_sample_ratio_limits[b - 1] : dmu_sample_ratio_limits[b];
+
+		if (dss->dss_ratio_hist[b] == 0)
+			continue;
+		(void) printf("\t%s%2llu.%02llux  %10llu\n",
+		    b == DMU_SAMPLE_RATIO_BUCKETS - 1 ? ">= " : " < ",
+		    (u_longlong_t)(lim / 100), (u_longlong_t)(lim % 100),
+		    (u_longlong_t)dss->dss_ratio_hist[b]);
+	}
+
+	(void) printf("\n\t%-10s %10s %10s %10s %6s\n",
+	    "compress", "blocks", "lsize", "psize", "ratio");
+	for (c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		if (dss->dss_comp_blocks[c] == 0)
+			continue;
+		zdb_nicenum(dss->dss_comp_lsize[c], lbuf);
+		zdb_nicenum(dss->dss_comp_psize[c], pbuf);
+		(void) printf("\t%-10s %10llu %10s %10s %5.2fx\n",
+		    zio_compress_table[c].ci_name,
+		    (u_longlong_t)dss->dss_comp_blocks[c], lbuf, pbuf,
+		    (double)dss->dss_comp_lsize[c] /
+		    MAX(dss->dss_comp_psize[c], 1));
+	}
+
+	umem_free(dss, sizeof (*dss));
+}
+
+/* ARGSUSED */
+static int
+dump_one_sample(const char *dsname, void *arg)
+{
+	objset_t *os;
+
+	if (open_objset(dsname, DMU_OST_ANY, FTAG, &os) != 0)
+		return (0);
+	dump_sample(os);
+	close_objset(os, FTAG);
+	return (0);
+}
+
 /*
  * Block statistics.
  */
@@ -2527,6 +2648,7 @@ typedef struct zdb_cb {
 	int		zcb_readfails;
 	int		zcb_haderrors;
 	spa_t		*zcb_spa;
+	uint64_t	*zcb_progress;	/* shared asize count of -j threads */
 } zdb_cb_t;
 
 static void
@@ -2627,7 +2749,7 @@ zdb_blkptr_done(zio_t *zio)
 	zdb_cb_t *zcb = zio->io_private;
 	zbookmark_phys_t *zb = &zio->io_bookmark;
 
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
@@ -2657,6 +2779,31 @@ zdb_blkptr_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+static void
+zdb_print_progress(zdb_cb_t *zcb, uint64_t bytes)
+{
+	uint64_t now = gethrtime();
+	char buf[10];
+	int kb_per_sec, sec_remaining;
+
+	if (now <= zcb->zcb_lastprint + NANOSEC)
+		return;
+
+	kb_per_sec = 1 + bytes / (1 + ((now - zcb->zcb_start) / 1000 / 1000));
+	sec_remaining = (zcb->zcb_totalasize - bytes) / 1024 / kb_per_sec;
+
+	zfs_nicenum(bytes, buf, sizeof (buf));
+	(void) fprintf(stderr,
+	    "\r%5s completed (%4dMB/s) "
+	    "estimated time remaining: %uhr %02umin %02usec        ",
+	    buf, kb_per_sec / 1024,
+	    sec_remaining / 60 / 60,
+	    sec_remaining / 60 % 60,
+	    sec_remaining % 60);
+
+	zcb->zcb_lastprint = now;
+}
+
 static int
 zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
     const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
@@ -2693,7 +2840,7 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	if (!BP_IS_EMBEDDED(bp) &&
 	    (dump_opt['c'] > 1 || (dump_opt['c'] && is_metadata))) {
 		size_t size = BP_GET_PSIZE(bp);
-		void *data = zio_data_buf_alloc(size);
+		abd_t *abd = abd_alloc(size, B_FALSE);
 		int flags = ZIO_FLAG_CANFAIL | ZIO_FLAG_SCRUB | ZIO_FLAG_RAW;
 
 		/* If it's an intent log block, failure is expected. */
@@ -2706,12 +2853,18 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 		spa->spa_scrub_inflight++;
 		mutex_exit(&spa->spa_scrub_lock);
 
-		zio_nowait(zio_read(NULL, spa, bp, data, size,
+		zio_nowait(zio_read(NULL, spa, bp, abd, size,
 		    zdb_blkptr_done, zcb, ZIO_PRIORITY_ASYNC_READ, flags, zb));
 	}
 
 	zcb->zcb_readfails = 0;
 
+	/* the main thread reports progress for all -j threads */
+	if (zcb->zcb_progress != NULL) {
+		atomic_add_64(zcb->zcb_progress, BP_GET_ASIZE(bp));
+		return (0);
+	}
+
 	/* only call gethrtime() every 100 blocks */
 	static int iters;
 	if (++iters > 100)
@@ -2719,25 +2872,9 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	else
 		return (0);
 
-	if (dump_opt['b'] < 5 && gethrtime() > zcb->zcb_lastprint + NANOSEC) {
-		uint64_t now = gethrtime();
-		char buf[10];
-		uint64_t bytes = zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
-		int kb_per_sec =
-		    1 + bytes / (1 + ((now - zcb->zcb_start) / 1000 / 1000));
-		int sec_remaining =
-		    (zcb->zcb_totalasize - bytes) / 1024 / kb_per_sec;
-
-		zfs_nicenum(bytes, buf, sizeof (buf));
-		(void) fprintf(stderr,
-		    "\r%5s completed (%4dMB/s) "
-		    "estimated time remaining: %uhr %02umin %02usec        ",
-		    buf, kb_per_sec / 1024,
-		    sec_remaining / 60 / 60,
-		    sec_remaining / 60 % 60,
-		    sec_remaining % 60);
-
-		zcb->zcb_lastprint = now;
+	if (dump_opt['b'] < 5) {
+		zdb_print_progress(zcb,
+		    zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize);
 	}
 
 	return (0);
@@ -2920,6 +3057,343 @@ count_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 	return (0);
 }
 
+/*
+ * Count the blocks waiting on the deferred-free bplists.
+ */
+static void
+zdb_count_deferred(spa_t *spa, zdb_cb_t *zcb)
+{
+	(void) bpobj_iterate_nofree(&spa->spa_deferred_bpobj,
+	    count_block_cb, zcb, NULL);
+	if (spa_version(spa) >= SPA_VERSION_DEADLISTS) {
+		(void) bpobj_iterate_nofree(&spa->spa_dsl_pool->dp_free_bpobj,
+		    count_block_cb, zcb, NULL);
+	}
+	if (spa_feature_is_active(spa, SPA_FEATURE_ASYNC_DESTROY)) {
+		VERIFY3U(0, ==, bptree_iterate(spa->spa_meta_objset,
+		    spa->spa_dsl_pool->dp_bptree_obj, B_FALSE, count_block_cb,
+		    zcb, NULL));
+	}
+}
+
+/*
+ * Parallel block traversal (-j).  The MOS and each dataset are handed
+ * out to a pool of threads.  Each dataset is counted into a zdb_cb_t
+ * of its own, which is merged into the totals once it is done, so no
+ * lock is taken per block.  Claiming blocks for leak detection only
+ * takes the metaslab and DDT locks it takes anyway.
+ *
+ * With -K the totals and the list of finished datasets are written to
+ * a checkpoint file after every dataset, and a later run given the
+ * same file skips them.  That is only meaningful without leak
+ * detection, since the claims made against the space maps are not
+ * saved, so -K requires -L.
+ */
+#define	ZDB_CKPT_MAGIC	0x7a6462636b707431ULL	/* "zdbckpt1" */
+
+typedef struct zdb_ckpt_hdr {
+	uint64_t	zch_magic;
+	uint64_t	zch_cbsize;	/* sizeof (zdb_cb_t) of the writer */
+	uint64_t	zch_guid;
+	uint64_t	zch_txg;
+	uint64_t	zch_ndone;
+} zdb_ckpt_hdr_t;
+
+typedef struct zdb_traverse {
+	spa_t		*zt_spa;
+	int		zt_flags;
+	kmutex_t	zt_lock;
+	kcondvar_t	zt_cv;
+	int		zt_running;
+	uint64_t	*zt_objs;	/* work list, 0 is the MOS */
+	uint64_t	zt_nobjs;
+	uint64_t	zt_next;	/* next entry of zt_objs to hand out */
+	uint64_t	*zt_done;	/* finished, kept for the checkpoint */
+	uint64_t	zt_ndone;
+	uint64_t	zt_ndone_max;
+	uint64_t	zt_progress;	/* asize counted by unfinished work */
+	zdb_cb_t	*zt_total;
+	int		zt_err;
+} zdb_traverse_t;
+
+static int
+zdb_obj_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static void
+zdb_cb_merge(zdb_cb_t *dst, const zdb_cb_t *src)
+{
+	int l, t, i, j;
+
+	for (l = 0; l <= ZB_TOTAL; l++) {
+		for (t = 0; t <= ZDB_OT_TOTAL; t++) {
+			zdb_blkstats_t *d = &dst->zcb_type[l][t];
+			const zdb_blkstats_t *s = &src->zcb_type[l][t];
+
+			d->zb_asize += s->zb_asize;
+			d->zb_lsize += s->zb_lsize;
+			d->zb_psize += s->zb_psize;
+			d->zb_count += s->zb_count;
+			d->zb_gangs += s->zb_gangs;
+			d->zb_ditto_samevdev += s->zb_ditto_samevdev;
+			for (i = 0; i < PSIZE_HISTO_SIZE; i++) {
+				d->zb_psize_histogram[i] +=
+				    s->zb_psize_histogram[i];
+			}
+		}
+	}
+
+	for (i = 0; i < NUM_BP_EMBEDDED_TYPES; i++) {
+		dst->zcb_embedded_blocks[i] += src->zcb_embedded_blocks[i];
+		for (j = 0; j < BPE_PAYLOAD_SIZE; j++) {
+			dst->zcb_embedded_histogram[i][j] +=
+			    src->zcb_embedded_histogram[i][j];
+		}
+	}
+
+	for (i = 0; i < 256; i++)
+		dst->zcb_errors[i] += src->zcb_errors[i];
+	dst->zcb_haderrors |= src->zcb_haderrors;
+}
+
+/*
+ * Replace the totals and the list of finished datasets with those of
+ * the checkpoint.  Returns B_FALSE if there is no checkpoint yet.
+ */
+static boolean_t
+zdb_ckpt_load(zdb_traverse_t *zt)
+{
+	spa_t *spa = zt->zt_spa;
+	zdb_ckpt_hdr_t hdr;
+	FILE *fp;
+
+	if ((fp = fopen(zdb_checkpoint, "r")) == NULL) {
+		if (errno == ENOENT)
+			return (B_FALSE);
+		fatal("cannot open checkpoint %s: %s", zdb_checkpoint,
+		    strerror(errno));
+	}
+
+	if (fread(&hdr, sizeof (hdr), 1, fp) != 1 ||
+	    hdr.zch_magic != ZDB_CKPT_MAGIC ||
+	    hdr.zch_cbsize != sizeof (zdb_cb_t))
+		fatal("%s is not a checkpoint of this zdb", zdb_checkpoint);
+	if (hdr.zch_guid != spa_guid(spa) ||
+	    hdr.zch_txg != spa->spa_uberblock.ub_txg)
+		fatal("checkpoint %s is of pool guid %llu txg %llu",
+		    zdb_checkpoint, (u_longlong_t)hdr.zch_guid,
+		    (u_longlong_t)hdr.zch_txg);
+	if (hdr.zch_ndone > zt->zt_ndone_max)
+		fatal("checkpoint %s is corrupt", zdb_checkpoint);
+
+	if (fread(zt->zt_total, sizeof (zdb_cb_t), 1, fp) != 1 ||
+	    fread(zt->zt_done, sizeof (uint64_t), hdr.zch_ndone, fp) !=
+	    hdr.zch_ndone)
+		fatal("checkpoint %s is truncated", zdb_checkpoint);
+	(void) fclose(fp);
+
+	zt->zt_total->zcb_spa = spa;
+	zt->zt_total->zcb_progress = NULL;
+	zt->zt_ndone = hdr.zch_ndone;
+
+	return (B_TRUE);
+}
+
+/*
+ * Write the checkpoint next to the old one and rename it into place, so
+ * an interruption leaves one or the other.  Called with zt_lock held.
+ */
+static void
+zdb_ckpt_save(zdb_traverse_t *zt)
+{
+	char tmp[MAXPATHLEN];
+	zdb_ckpt_hdr_t hdr;
+	FILE *fp;
+
+	hdr.zch_magic = ZDB_CKPT_MAGIC;
+	hdr.zch_cbsize = sizeof (zdb_cb_t);
+	hdr.zch_guid = spa_guid(zt->zt_spa);
+	hdr.zch_txg = zt->zt_spa->spa_uberblock.ub_txg;
+	hdr.zch_ndone = zt->zt_ndone;
+
+	(void) snprintf(tmp, sizeof (tmp), "%s.tmp", zdb_checkpoint);
+	if ((fp = fopen(tmp, "w")) == NULL ||
+	    fwrite(&hdr, sizeof (hdr), 1, fp) != 1 ||
+	    fwrite(zt->zt_total, sizeof (zdb_cb_t), 1, fp) != 1 ||
+	    fwrite(zt->zt_done, sizeof (uint64_t), zt->zt_ndone, fp) !=
+	    zt->zt_ndone || fclose(fp) != 0 || rename(tmp, zdb_checkpoint) != 0)
+		fatal("cannot write checkpoint %s: %s", zdb_checkpoint,
+		    strerror(errno));
+}
+
+static int
+zdb_traverse_one(zdb_traverse_t *zt, uint64_t obj, zdb_cb_t *zcb)
+{
+	dsl_pool_t *dp = spa_get_dsl(zt->zt_spa);
+	dsl_dataset_t *ds;
+	uint64_t txg;
+	int err;
+
+	if (obj == 0) {
+		return (traverse_mos(zt->zt_spa, 0, zt->zt_flags,
+		    zdb_blkptr_cb, zcb));
+	}
+
+	dsl_pool_config_enter(dp, FTAG);
+	err = dsl_dataset_hold_obj(dp, obj, FTAG, &ds);
+	dsl_pool_config_exit(dp, FTAG);
+	if (err != 0)
+		return (err);
+
+	/* as in traverse_pool(), older blocks are the snapshot's */
+	txg = dsl_dataset_phys(ds)->ds_prev_snap_txg;
+	err = traverse_dataset(ds, txg, zt->zt_flags, zdb_blkptr_cb, zcb);
+	dsl_dataset_rele(ds, FTAG);
+
+	return (err);
+}
+
+static void
+zdb_traverse_thread(void *arg)
+{
+	zdb_traverse_t *zt = arg;
+	zdb_cb_t *zcb = umem_alloc(sizeof (zdb_cb_t), UMEM_NOFAIL);
+	uint64_t obj;
+	int err;
+
+	mutex_enter(&zt->zt_lock);
+	while (zt->zt_next < zt->zt_nobjs) {
+		obj = zt->zt_objs[zt->zt_next++];
+		mutex_exit(&zt->zt_lock);
+
+		bzero(zcb, sizeof (zdb_cb_t));
+		zcb->zcb_spa = zt->zt_spa;
+		zcb->zcb_progress = &zt->zt_progress;
+		err = zdb_traverse_one(zt, obj, zcb);
+
+		mutex_enter(&zt->zt_lock);
+		zdb_cb_merge(zt->zt_total, zcb);
+		atomic_add_64(&zt->zt_progress,
+		    -zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize);
+		if (err != 0) {
+			if (zt->zt_err == 0)
+				zt->zt_err = err;
+			continue;
+		}
+		zt->zt_done[zt->zt_ndone++] = obj;
+		if (zdb_checkpoint != NULL)
+			zdb_ckpt_save(zt);
+	}
+	zt->zt_running--;
+	cv_broadcast(&zt->zt_cv);
+	mutex_exit(&zt->zt_lock);
+
+	umem_free(zcb, sizeof (zdb_cb_t));
+	thread_exit();
+}
+
+/*
+ * Traverse the pool with zdb_threads threads, counting into zcb.
+ * The checkpoint, if any, has to be loaded before the deferred frees
+ * are counted, so that is done here as well.
+ */
+static int
+zdb_traverse_parallel(spa_t *spa, int flags, zdb_cb_t *zcb)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	objset_t *mos = dp->dp_meta_objset;
+	kthread_t **threads;
+	zdb_traverse_t zt;
+	uint64_t obj, nalloc;
+	dmu_object_info_t doi;
+	int t, err;
+
+	bzero(&zt, sizeof (zt));
+	zt.zt_spa = spa;
+	zt.zt_flags = flags;
+	zt.zt_total = zcb;
+	mutex_init(&zt.zt_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zt.zt_cv, NULL, CV_DEFAULT, NULL);
+
+	/* the MOS, then every dataset, as traverse_pool() visits them */
+	nalloc = 64;
+	zt.zt_objs = umem_alloc(nalloc * sizeof (uint64_t), UMEM_NOFAIL);
+	zt.zt_objs[zt.zt_nobjs++] = 0;
+	for (obj = 1; dmu_object_next(mos, &obj, B_FALSE, 0) == 0; ) {
+		if (dmu_object_info(mos, obj, &doi) != 0 ||
+		    doi.doi_bonus_type != DMU_OT_DSL_DATASET)
+			continue;
+		if (zt.zt_nobjs == nalloc) {
+			uint64_t *objs = umem_alloc(2 * nalloc *
+			    sizeof (uint64_t), UMEM_NOFAIL);
+			bcopy(zt.zt_objs, objs, nalloc * sizeof (uint64_t));
+			umem_free(zt.zt_objs, nalloc * sizeof (uint64_t));
+			zt.zt_objs = objs;
+			nalloc *= 2;
+		}
+		zt.zt_objs[zt.zt_nobjs++] = obj;
+	}
+	zt.zt_ndone_max = zt.zt_nobjs;
+	zt.zt_done = umem_alloc(zt.zt_ndone_max * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+
+	if (zdb_checkpoint != NULL && zdb_ckpt_load(&zt)) {
+		uint64_t i, n = 0;
+
+		qsort(zt.zt_done, zt.zt_ndone, sizeof (uint64_t),
+		    zdb_obj_compare);
+		for (i = 0; i < zt.zt_nobjs; i++) {
+			if (bsearch(&zt.zt_objs[i], zt.zt_done, zt.zt_ndone,
+			    sizeof (uint64_t), zdb_obj_compare) == NULL)
+				zt.zt_objs[n++] = zt.zt_objs[i];
+		}
+		(void) printf("Resuming from %s, %llu of %llu done\n",
+		    zdb_checkpoint, (u_longlong_t)(zt.zt_nobjs - n),
+		    (u_longlong_t)zt.zt_nobjs);
+		zt.zt_nobjs = n;
+	} else {
+		zdb_count_deferred(spa, zcb);
+	}
+
+	zcb->zcb_start = zcb->zcb_lastprint = gethrtime();
+
+	threads = umem_alloc(zdb_threads * sizeof (kthread_t *), UMEM_NOFAIL);
+	zt.zt_running = zdb_threads;
+	for (t = 0; t < zdb_threads; t++) {
+		VERIFY3P(threads[t] = zk_thread_create(NULL, 0,
+		    (thread_func_t)zdb_traverse_thread, &zt, TS_RUN, NULL,
+		    0, 0, PTHREAD_CREATE_JOINABLE), !=, NULL);
+	}
+
+	mutex_enter(&zt.zt_lock);
+	while (zt.zt_running > 0) {
+		(void) cv_timedwait(&zt.zt_cv, &zt.zt_lock,
+		    ddi_get_lbolt() + hz);
+		if (dump_opt['b'] < 5) {
+			zdb_print_progress(zcb, zt.zt_progress +
+			    zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize);
+		}
+	}
+	mutex_exit(&zt.zt_lock);
+
+	for (t = 0; t < zdb_threads; t++)
+		thread_join(threads[t]->t_tid);
+
+	err = zt.zt_err;
+	umem_free(threads, zdb_threads * sizeof (kthread_t *));
+	umem_free(zt.zt_done, zt.zt_ndone_max * sizeof (uint64_t));
+	umem_free(zt.zt_objs, nalloc * sizeof (uint64_t));
+	cv_destroy(&zt.zt_cv);
+	mutex_destroy(&zt.zt_lock);
+
+	return (err);
+}
+
 static int
 dump_block_stats(spa_t *spa)
 {
@@ -2949,27 +3423,23 @@ dump_block_stats(spa_t *spa)
 	bzero(&zcb, sizeof (zdb_cb_t));
 	zdb_leak_init(spa, &zcb);
 
-	/*
-	 * If there's a deferred-free bplist, process that first.
-	 */
-	(void) bpobj_iterate_nofree(&spa->spa_deferred_bpobj,
-	    count_block_cb, &zcb, NULL);
-	if (spa_version(spa) >= SPA_VERSION_DEADLISTS) {
-		(void) bpobj_iterate_nofree(&spa->spa_dsl_pool->dp_free_bpobj,
-		    count_block_cb, &zcb, NULL);
-	}
-	if (spa_feature_is_active(spa, SPA_FEATURE_ASYNC_DESTROY)) {
-		VERIFY3U(0, ==, bptree_iterate(spa->spa_meta_objset,
-		    spa->spa_dsl_pool->dp_bptree_obj, B_FALSE, count_block_cb,
-		    &zcb, NULL));
-	}
-
 	if (dump_opt['c'] > 1)
 		flags |= TRAVERSE_PREFETCH_DATA;
 
 	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa));
-	zcb.zcb_start = zcb.zcb_lastprint = gethrtime();
-	zcb.zcb_haderrors |= traverse_pool(spa, 0, flags, zdb_blkptr_cb, &zcb);
+
+	if (zdb_threads > 1 || zdb_checkpoint != NULL) {
+		zcb.zcb_haderrors |= zdb_traverse_parallel(spa, flags, &zcb);
+	} else {
+		/*
+		 * If there's a deferred-free bplist, process that first.
+		 */
+		zdb_count_deferred(spa, &zcb);
+
+		zcb.zcb_start = zcb.zcb_lastprint = gethrtime();
+		zcb.zcb_haderrors |= traverse_pool(spa, 0, flags,
+		    zdb_blkptr_cb, &zcb);
+	}
 
 	/*
 	 * If we've traversed the data blocks then we need to wait for those
@@ -3350,6 +3820,11 @@ dump_zpool(spa_t *spa)
 	if (rc == 0 && (dump_opt['b'] || dump_opt['c']))
 		rc = dump_block_stats(spa);
 
+	if (dump_opt['z']) {
+		(void) dmu_objset_find(spa_name(spa), dump_one_sample,
+		    NULL, DS_FIND_SNAPSHOTS | DS_FIND_CHILDREN);
+	}
+
 	if (rc == 0)
 		rc = verify_spacemap_refcounts(spa);
 
@@ -3530,6 +4005,7 @@ zdb_read_block(char *thing, spa_t *spa)
 	zio_t *zio;
 	vdev_t *vd;
 	void *pbuf, *lbuf, *buf;
+	abd_t *pabd;
 	char *s, *p, *dup, *vdev, *flagstr;
 	int i, error;
 
@@ -3603,6 +4079,7 @@ zdb_read_block(char *thing, spa_t *spa)
 	lsize = size;
 
 	pbuf = umem_alloc_aligned(SPA_MAXBLOCKSIZE, 512, UMEM_NOFAIL);
+	pabd = abd_get_from_buf(pbuf, SPA_MAXBLOCKSIZE);
 	lbuf = umem_alloc(SPA_MAXBLOCKSIZE, UMEM_NOFAIL);
 
 	BP_ZERO(bp);
@@ -3630,14 +4107,14 @@ zdb_read_block(char *thing, spa_t *spa)
 		/*
 		 * Treat this as a normal block read.
 		 */
-		zio_nowait(zio_read(zio, spa, bp, pbuf, psize, NULL, NULL,
+		zio_nowait(zio_read(zio, spa, bp, pabd, psize, NULL, NULL,
 		    ZIO_PRIORITY_SYNC_READ,
 		    ZIO_FLAG_CANFAIL | ZIO_FLAG_RAW, NULL));
 	} else {
 		/*
 		 * Treat this as a vdev child I/O.
 		 */
-		zio_nowait(zio_vdev_child_io(zio, bp, vd, offset, pbuf, psize,
+		zio_nowait(zio_vdev_child_io(zio, bp, vd, offset, pabd, psize,
 		    ZIO_TYPE_READ, ZIO_PRIORITY_SYNC_READ,
 		    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE |
 		    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
@@ -3672,9 +4149,9 @@ zdb_read_block(char *thing, spa_t *spa)
 		for (lsize = SPA_MAXBLOCKSIZE; lsize > psize;
 		    lsize -= SPA_MINBLOCKSIZE) {
 			for (c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
-				if (zio_decompress_data(c, pbuf, lbuf,
+				if (zio_decompress_data_buf(c, pbuf, lbuf,
 				    psize, lsize) == 0 &&
-				    zio_decompress_data(c, pbuf2, lbuf2,
+				    zio_decompress_data_buf(c, pbuf2, lbuf2,
 				    psize, lsize) == 0 &&
 				    bcmp(lbuf, lbuf2, lsize) == 0)
 					break;
@@ -3712,6 +4189,7 @@ zdb_read_block(char *thing, spa_t *spa)
 		zdb_dump_block(thing, buf, size, flags);
 
 out:
+	abd_put(pabd);
 	umem_free(pbuf, SPA_MAXBLOCKSIZE);
 	umem_free(lbuf, SPA_MAXBLOCKSIZE);
 	free(dup);
@@ -3835,7 +4313,7 @@ main(int argc, char **argv)
 		spa_config_path = spa_config_path_env;
 
 	while ((c = getopt(argc, argv,
-	    "AbcCdDeFGhiI:lLmMo:Op:PqRsSt:uU:vX")) != -1) {
+	    "AbcCdDeFGhiI:j:K:lLmMo:Op:PqRsSt:uU:vW:Xz:")) != -1) {
 		switch (c) {
 		case 'b':
 		case 'c':
@@ -3878,6 +4356,35 @@ main(int argc, char **argv)
 				usage();
 			}
 			break;
+		case 'j':
+			zdb_threads = strtoul(optarg, NULL, 0);
+			if (zdb_threads <= 0) {
+				(void) fprintf(stderr, "number of traversal "
+				    "threads must be greater than 0\n");
+				usage();
+			}
+			break;
+		case 'K':
+			zdb_checkpoint = optarg;
+			break;
+		case 'z':
+			zdb_sample_rate = strtoull(optarg, NULL, 0);
+			if (zdb_sample_rate == 0) {
+				(void) fprintf(stderr, "block sample rate "
+				    "must be greater than 0\n");
+				usage();
+			}
+			dump_opt[c]++;
+			dump_all = 0;
+			break;
+		case 'W':
+			zfs_pd_bytes_max = strtoul(optarg, NULL, 0);
+			if (zfs_pd_bytes_max <= 0) {
+				(void) fprintf(stderr, "traversal prefetch "
+				    "bytes must be greater than 0\n");
+				usage();
+			}
+			break;
 		case 'p':
 			if (searchdirs == NULL) {
 				searchdirs = umem_alloc(sizeof (char *),
@@ -3922,6 +4429,11 @@ main(int argc, char **argv)
 		usage();
 	}
 
+	if (zdb_checkpoint != NULL && !dump_opt['L']) {
+		(void) fprintf(stderr, "-K option requires use of -L\n");
+		usage();
+	}
+
 #if defined(_LP64)
 	/*
 	 * ZDB does not typically re-read blocks; therefore limit the ARC
@@ -3952,7 +4464,7 @@ main(int argc, char **argv)
 		verbose = MAX(verbose, 1);
 
 	for (c = 0; c < 256; c++) {
-		if (dump_all && strchr("AeFlLOPRSX", c) == NULL)
+		if (dump_all && strchr("AeFlLOPRSXz", c) == NULL)
 			dump_opt[c] = 1;
 		if (dump_opt[c])
 			dump_opt[c] += verbose;
@@ -4078,6 +4590,8 @@ main(int argc, char **argv)
 		}
 		if (os != NULL) {
 			dump_dir(os);
+			if (dump_opt['z'])
+				dump_sample(os);
 		} else if (zopt_objects > 0 && !dump_opt['m']) {
 			dump_dir(spa->spa_meta_objset);
 		} else {
@@ -24,6 +24,7 @@
 #include "zed.h"
 #include "zed_conf.h"
 #include "zed_event.h"
+#include "zed_exec.h"
 #include "zed_file.h"
 #include "zed_log.h"
 
@@ -263,6 +264,10 @@ main(int argc, char *argv[])
 	if (zed_conf_read_state(zcp, &saved_eid, saved_etime) < 0)
 		exit(EXIT_FAILURE);
 
+	if (zed_exec_init(zcp->max_jobs) < 0)
+		zed_log_die("Failed to initialize zedlet jobs: %s",
+		    strerror(errno));
+
  retry:
 	if (zed_event_init(zcp)) {
 		/*
@@ -291,6 +296,7 @@ main(int argc, char *argv[])
 	if (zcp->do_force && !_got_exit) {
 		goto retry;
 	}
+	zed_exec_fini();
 	zed_conf_destroy(zcp);
 	zed_log_fini();
 	exit(EXIT_SUCCESS);
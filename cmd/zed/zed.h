@@ -45,6 +45,24 @@
  */
 #define	ZED_MIN_EVENTS		0
 
+/*
+ * Default maximum number of zedlets run concurrently.
+ */
+#define	ZED_MAX_JOBS		16
+
+/*
+ * Maximum number of zevents read from the kernel before the state file
+ * is updated.
+ */
+#define	ZED_EVENT_BATCH		64
+
+/*
+ * Default maximum number of zevents of a given class for a given vdev that
+ * are passed to zedlets each second; the rest are counted and dropped.
+ * Zero disables the limit.
+ */
+#define	ZED_EVENT_RATE		10
+
 /*
  * String prefix for ZED variables passed via environment variables.
  */
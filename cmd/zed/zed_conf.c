@@ -46,6 +46,8 @@ zed_conf_create(void)
 	zcp->syslog_facility = LOG_DAEMON;
 	zcp->min_events = ZED_MIN_EVENTS;
 	zcp->max_events = ZED_MAX_EVENTS;
+	zcp->max_jobs = ZED_MAX_JOBS;
+	zcp->event_rate = ZED_EVENT_RATE;
 	zcp->pid_fd = -1;
 	zcp->zedlets = NULL;		/* created via zed_conf_scan_dir() */
 	zcp->state_fd = -1;		/* opened via zed_conf_open_state() */
@@ -168,6 +170,10 @@ _zed_conf_display_help(const char *prog, int got_err)
 	    "Write daemon's PID to FILE.", ZED_PID_FILE);
 	fprintf(fp, "%*c%*s %s [%s]\n", w1, 0x20, -w2, "-s FILE",
 	    "Write daemon's state to FILE.", ZED_STATE_FILE);
+	fprintf(fp, "%*c%*s %s [%d]\n", w1, 0x20, -w2, "-j JOBS",
+	    "Run at most JOBS ZEDLETs at once.", ZED_MAX_JOBS);
+	fprintf(fp, "%*c%*s %s [%d]\n", w1, 0x20, -w2, "-R RATE",
+	    "Limit events per vdev and class to RATE/sec.", ZED_EVENT_RATE);
 	fprintf(fp, "\n");
 
 	exit(got_err ? EXIT_FAILURE : EXIT_SUCCESS);
@@ -241,13 +247,34 @@ _zed_conf_parse_path(char **resultp, const char *path)
 		zed_log_die("Failed to copy path: %s", strerror(ENOMEM));
 }
 
+/*
+ * Parse the integer argument [arg] of option [opt], which must be at least
+ * [min].  Display help and exit if it is not a valid integer.
+ */
+static int
+_zed_conf_parse_int(const char *prog, int opt, const char *arg, int min)
+{
+	char *end;
+	long val;
+
+	errno = 0;
+	val = strtol(arg, &end, 10);
+	if ((errno != 0) || (end == arg) || (*end != '\0') ||
+	    (val < min) || (val > INT_MAX)) {
+		fprintf(stderr, "%s: %s '-%c %s'\n\n", prog,
+		    "Invalid argument", opt, arg);
+		_zed_conf_display_help(prog, EXIT_FAILURE);
+	}
+	return ((int) val);
+}
+
 /*
  * Parse the command-line options into the configuration [zcp].
  */
 void
 zed_conf_parse_opts(struct zed_conf *zcp, int argc, char **argv)
 {
-	const char * const opts = ":hLVc:d:p:s:vfFMZ";
+	const char * const opts = ":hLVc:d:p:s:j:R:vfFMZ";
 	int opt;
 
 	if (!zcp || !argv || !argv[0])
@@ -278,6 +305,14 @@ zed_conf_parse_opts(struct zed_conf *zcp, int argc, char **argv)
 		case 's':
 			_zed_conf_parse_path(&zcp->state_file, optarg);
 			break;
+		case 'j':
+			zcp->max_jobs = _zed_conf_parse_int(argv[0], opt,
+			    optarg, 1);
+			break;
+		case 'R':
+			zcp->event_rate = _zed_conf_parse_int(argv[0], opt,
+			    optarg, 0);
+			break;
 		case 'v':
 			zcp->do_verbose = 1;
 			break;
@@ -672,13 +707,19 @@ zed_conf_read_state(struct zed_conf *zcp, uint64_t *eidp, int64_t etime[])
 /*
  * Write the [eid] & [etime] of the last processed event to the opened
  * [zcp] state_file.  Note that etime[] is an array of size 2.
+ *
+ * These are followed by the event lag metrics: the lag (in milliseconds)
+ * between the last event being posted and it being serviced, the maximum
+ * such lag, and the number of events serviced and suppressed by the rate
+ * limit.  zed_conf_read_state() only reads back the eid & etime.
+ *
  * Return 0 on success, -1 on error.
  */
 int
 zed_conf_write_state(struct zed_conf *zcp, uint64_t eid, int64_t etime[])
 {
 	ssize_t len;
-	struct iovec iov[3];
+	struct iovec iov[7];
 	ssize_t n;
 
 	if (!zcp) {
@@ -700,8 +741,16 @@ zed_conf_write_state(struct zed_conf *zcp, uint64_t eid, int64_t etime[])
 	len += iov[1].iov_len = sizeof (etime[0]);
 	iov[2].iov_base = &etime[1];
 	len += iov[2].iov_len = sizeof (etime[1]);
-
-	n = writev(zcp->state_fd, iov, 3);
+	iov[3].iov_base = &zcp->lag_ms;
+	len += iov[3].iov_len = sizeof (zcp->lag_ms);
+	iov[4].iov_base = &zcp->lag_max_ms;
+	len += iov[4].iov_len = sizeof (zcp->lag_max_ms);
+	iov[5].iov_base = &zcp->events;
+	len += iov[5].iov_len = sizeof (zcp->events);
+	iov[6].iov_base = &zcp->suppressed;
+	len += iov[6].iov_len = sizeof (zcp->suppressed);
+
+	n = writev(zcp->state_fd, iov, 7);
 	if (n < 0) {
 		zed_log_msg(LOG_WARNING,
 		    "Failed to write state file \"%s\": %s",
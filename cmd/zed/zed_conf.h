@@ -28,6 +28,8 @@ struct zed_conf {
 	int		syslog_facility;	/* syslog facility value */
 	int		min_events;		/* RESERVED FOR FUTURE USE */
 	int		max_events;		/* RESERVED FOR FUTURE USE */
+	int		max_jobs;		/* max concurrent zedlets */
+	int		event_rate;		/* max vdev events per sec */
 	char		*conf_file;		/* abs path to config file */
 	char		*pid_file;		/* abs path to pid file */
 	int		pid_fd;			/* fd to pid file for lock */
@@ -37,6 +39,10 @@ struct zed_conf {
 	int		state_fd;		/* fd to state file */
 	libzfs_handle_t	*zfs_hdl;		/* handle to libzfs */
 	int		zevent_fd;		/* fd for access to zevents */
+	int64_t		lag_ms;			/* lag of last event */
+	int64_t		lag_max_ms;		/* max lag of any event */
+	uint64_t	events;			/* events serviced */
+	uint64_t	suppressed;		/* events rate limited */
 };
 
 struct zed_conf *zed_conf_create(void);
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/fm/fs/zfs.h>
 #include <sys/zfs_ioctl.h>
 #include <time.h>
 #include <unistd.h>
@@ -808,86 +809,239 @@ _zed_event_add_time_strings(uint64_t eid, zed_strings_t *zsp, int64_t etime[])
 }
 
 /*
- * Service the next zevent, blocking until one is available.
+ * Per-vdev rate limit state for a zevent class.  Events from the same vdev
+ * with the same class typically arrive in storms (e.g. checksum or io
+ * errors); beyond [event_rate] per second, they are coalesced into a
+ * suppressed count that is logged when the next second begins.
  */
-int
-zed_event_service(struct zed_conf *zcp)
+typedef struct zed_event_rate {
+	uint64_t	pool_guid;
+	uint64_t	vdev_guid;
+	time_t		sec;
+	int		count;
+	int		suppressed;
+	char		class[64];
+} zed_event_rate_t;
+
+#define	ZED_EVENT_RATE_SLOTS	64
+
+static zed_event_rate_t _zed_event_rates[ZED_EVENT_RATE_SLOTS];
+
+/*
+ * Return nonzero if the [class] event [eid] from the vdev in [nvl] exceeds
+ * the [zcp] event_rate for the second [now] and should be suppressed.
+ * Events that do not name a vdev are never suppressed.
+ */
+static int
+_zed_event_rate_limit(struct zed_conf *zcp, uint64_t eid, const char *class,
+    nvlist_t *nvl, time_t now)
+{
+	zed_event_rate_t *rp;
+	uint64_t pool_guid = 0;
+	uint64_t vdev_guid;
+	uint64_t h;
+	const char *p;
+
+	if (zcp->event_rate <= 0)
+		return (0);
+
+	if (nvlist_lookup_uint64(nvl, FM_EREPORT_PAYLOAD_ZFS_VDEV_GUID,
+	    &vdev_guid) != 0)
+		return (0);
+
+	(void) nvlist_lookup_uint64(nvl, FM_EREPORT_PAYLOAD_ZFS_POOL_GUID,
+	    &pool_guid);
+
+	h = pool_guid ^ vdev_guid;
+	for (p = class; *p; p++)
+		h = (h * 31) + (unsigned char) *p;
+	rp = &_zed_event_rates[h % ZED_EVENT_RATE_SLOTS];
+
+	if ((rp->pool_guid != pool_guid) || (rp->vdev_guid != vdev_guid) ||
+	    (strncmp(rp->class, class, sizeof (rp->class) - 1) != 0) ||
+	    (rp->sec != now)) {
+		if (rp->suppressed > 0)
+			zed_log_msg(LOG_NOTICE,
+			    "Suppressed %d \"%s\" events for vdev %llu",
+			    rp->suppressed, rp->class, rp->vdev_guid);
+		rp->pool_guid = pool_guid;
+		rp->vdev_guid = vdev_guid;
+		(void) strlcpy(rp->class, class, sizeof (rp->class));
+		rp->sec = now;
+		rp->count = 0;
+		rp->suppressed = 0;
+	}
+	if (rp->count < zcp->event_rate) {
+		rp->count++;
+		return (0);
+	}
+	if (rp->suppressed++ == 0)
+		zed_log_msg(LOG_INFO,
+		    "Rate limiting \"%s\" events for vdev %llu at eid=%llu",
+		    class, vdev_guid, eid);
+	return (1);
+}
+
+/*
+ * Update the [zcp] lag metrics for an event posted at [etime] and
+ * serviced at [now].
+ */
+static void
+_zed_event_update_lag(struct zed_conf *zcp, int64_t etime[],
+    const struct timespec *now)
+{
+	int64_t lag_ms;
+
+	lag_ms = ((int64_t) now->tv_sec - etime[0]) * 1000 +
+	    ((int64_t) now->tv_nsec - etime[1]) / 1000000;
+	if (lag_ms < 0)
+		lag_ms = 0;
+
+	zcp->lag_ms = lag_ms;
+	if (lag_ms > zcp->lag_max_ms)
+		zcp->lag_max_ms = lag_ms;
+}
+
+/*
+ * Service the zevent [nvl] by invoking its zedlets.
+ * Return 0 if the event was serviced or suppressed, with its eid & etime
+ * written to [eidp] & [etime]; or -1 if the event is malformed.
+ */
+static int
+_zed_event_service_one(struct zed_conf *zcp, nvlist_t *nvl,
+    uint64_t *eidp, int64_t etime[])
 {
-	nvlist_t *nvl;
 	nvpair_t *nvp;
-	int n_dropped;
 	zed_strings_t *zsp;
 	uint64_t eid;
-	int64_t *etime;
+	int64_t *tp;
 	uint_t nelem;
 	char *class;
 	const char *subclass;
-	int rv;
+	struct timespec now;
 
-	if (!zcp) {
-		errno = EINVAL;
-		zed_log_msg(LOG_ERR, "Failed to service zevent: %s",
-		    strerror(errno));
-		return EINVAL;
-	}
-	rv = zpool_events_next(zcp->zfs_hdl, &nvl, &n_dropped, ZEVENT_NONE,
-	    zcp->zevent_fd);
-
-#ifdef	__APPLE__
-	if (rv == ENODEV) {
-		return ENODEV;
-	}
-#endif
-
-	if ((rv != 0) || !nvl)
-		return 0;
-
-	if (n_dropped > 0) {
-		zed_log_msg(LOG_WARNING, "Missed %d events", n_dropped);
-		/*
-		 * FIXME: Increase max size of event nvlist in
-		 * /sys/module/zfs/parameters/zfs_zevent_len_max ?
-		 */
-	}
 	if (nvlist_lookup_uint64(nvl, "eid", &eid) != 0) {
 		zed_log_msg(LOG_WARNING, "Failed to lookup zevent eid");
+		return (-1);
 	} else if (nvlist_lookup_int64_array(
-	    nvl, "time", &etime, &nelem) != 0) {
+	    nvl, "time", &tp, &nelem) != 0) {
 		zed_log_msg(LOG_WARNING,
 		    "Failed to lookup zevent time (eid=%llu)", eid);
+		return (-1);
 	} else if (nelem != 2) {
 		zed_log_msg(LOG_WARNING,
 		    "Failed to lookup zevent time (eid=%llu, nelem=%u)",
 		    eid, nelem);
+		return (-1);
 	} else if (nvlist_lookup_string(nvl, "class", &class) != 0) {
 		zed_log_msg(LOG_WARNING,
 		    "Failed to lookup zevent class (eid=%llu)", eid);
-	} else {
-		zsp = zed_strings_create();
+		return (-1);
+	}
+	*eidp = eid;
+	etime[0] = tp[0];
+	etime[1] = tp[1];
 
-		nvp = NULL;
-		while ((nvp = nvlist_next_nvpair(nvl, nvp)))
-			_zed_event_add_nvpair(eid, zsp, nvp);
+	(void) clock_gettime(CLOCK_REALTIME, &now);
+	_zed_event_update_lag(zcp, etime, &now);
+	zcp->events++;
 
-		_zed_event_add_env_restrict(eid, zsp);
-		_zed_event_add_env_preserve(eid, zsp);
+	if (_zed_event_rate_limit(zcp, eid, class, nvl, now.tv_sec)) {
+		zcp->suppressed++;
+		return (0);
+	}
+	zsp = zed_strings_create();
 
-		_zed_event_add_var(eid, zsp, ZED_VAR_PREFIX, "PID",
-		    "%d", (int) getpid());
-		_zed_event_add_var(eid, zsp, ZED_VAR_PREFIX, "ZEDLET_DIR",
-		    "%s", zcp->zedlet_dir);
-		subclass = _zed_event_get_subclass(class);
-		_zed_event_add_var(eid, zsp, ZEVENT_VAR_PREFIX, "SUBCLASS",
-		    "%s", (subclass ? subclass : class));
-		_zed_event_add_time_strings(eid, zsp, etime);
+	nvp = NULL;
+	while ((nvp = nvlist_next_nvpair(nvl, nvp)))
+		_zed_event_add_nvpair(eid, zsp, nvp);
 
-		zed_exec_process(eid, class, subclass,
-		    zcp->zedlet_dir, zcp->zedlets, zsp, zcp->zevent_fd);
+	_zed_event_add_env_restrict(eid, zsp);
+	_zed_event_add_env_preserve(eid, zsp);
 
-		zed_conf_write_state(zcp, eid, etime);
+	_zed_event_add_var(eid, zsp, ZED_VAR_PREFIX, "PID",
+	    "%d", (int) getpid());
+	_zed_event_add_var(eid, zsp, ZED_VAR_PREFIX, "ZEDLET_DIR",
+	    "%s", zcp->zedlet_dir);
+	subclass = _zed_event_get_subclass(class);
+	_zed_event_add_var(eid, zsp, ZEVENT_VAR_PREFIX, "SUBCLASS",
+	    "%s", (subclass ? subclass : class));
+	_zed_event_add_time_strings(eid, zsp, etime);
+
+	zed_exec_process(eid, class, subclass,
+	    zcp->zedlet_dir, zcp->zedlets, zsp, zcp->zevent_fd);
+
+	zed_strings_destroy(zsp);
+	return (0);
+}
 
-		zed_strings_destroy(zsp);
+/*
+ * Service the next batch of zevents.
+ *
+ * This blocks until an event is available, then services up to
+ * ZED_EVENT_BATCH events that are already queued before updating the
+ * state file once for the whole batch.  While zedlets are still running,
+ * it polls for events instead of blocking so that finished zedlets are
+ * reaped promptly.
+ */
+int
+zed_event_service(struct zed_conf *zcp)
+{
+	nvlist_t *nvl;
+	int n_dropped;
+	uint64_t eid;
+	int64_t etime[2];
+	unsigned flags;
+	struct timespec ts;
+	int serviced;
+	int rv;
+	int i;
+
+	if (!zcp) {
+		errno = EINVAL;
+		zed_log_msg(LOG_ERR, "Failed to service zevent: %s",
+		    strerror(errno));
+		return EINVAL;
+	}
+	flags = (zed_exec_reap() > 0) ? ZEVENT_NONBLOCK : ZEVENT_NONE;
+	serviced = 0;
+
+	for (i = 0; i < ZED_EVENT_BATCH; i++) {
+		rv = zpool_events_next(zcp->zfs_hdl, &nvl, &n_dropped,
+		    flags, zcp->zevent_fd);
+
+#ifdef	__APPLE__
+		if (rv == ENODEV) {
+			if (serviced > 0)
+				zed_conf_write_state(zcp, eid, etime);
+			return ENODEV;
+		}
+#endif
+
+		if ((rv != 0) || !nvl)
+			break;
+
+		if (n_dropped > 0) {
+			zed_log_msg(LOG_WARNING, "Missed %d events", n_dropped);
+			/*
+			 * FIXME: Increase max size of event nvlist in
+			 * /sys/module/zfs/parameters/zfs_zevent_len_max ?
+			 */
+		}
+		if (_zed_event_service_one(zcp, nvl, &eid, etime) == 0)
+			serviced++;
+
+		nvlist_free(nvl);
+		flags = ZEVENT_NONBLOCK;
+	}
+	if (serviced > 0) {
+		zed_conf_write_state(zcp, eid, etime);
+		(void) zed_exec_reap();
+	} else if ((i == 0) && (flags & ZEVENT_NONBLOCK)) {
+		/* Nothing queued; give running zedlets time to finish. */
+		ts.tv_sec = 0;
+		ts.tv_nsec = 10 * 1000 * 1000;
+		(void) nanosleep(&ts, NULL);
 	}
-	nvlist_free(nvl);
 	return 0;
 }
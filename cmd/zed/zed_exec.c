@@ -27,6 +27,19 @@
 
 #define	ZEVENT_FILENO	3
 
+/*
+ * A zedlet that has been forked but not yet reaped.
+ */
+typedef struct zed_exec_job {
+	pid_t		pid;
+	uint64_t	eid;
+	char		*prog;
+} zed_exec_job_t;
+
+static zed_exec_job_t *_zed_exec_jobs;
+static int _zed_exec_max_jobs;
+static int _zed_exec_num_jobs;
+
 /*
  * Create an environment string array for passing to execve() using the
  * NAME=VALUE strings in container [zsp].
@@ -68,12 +81,76 @@ _zed_exec_create_env(zed_strings_t *zsp)
 	return ((char **) buf);
 }
 
+/*
+ * Log the exit [status] of the reaped zedlet [jp] and release its slot.
+ */
+static void
+_zed_exec_job_done(zed_exec_job_t *jp, int status)
+{
+	if (WIFEXITED(status)) {
+		zed_log_msg(LOG_INFO,
+		    "Finished \"%s\" eid=%llu pid=%d exit=%d",
+		    jp->prog, jp->eid, jp->pid, WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status)) {
+		zed_log_msg(LOG_INFO,
+		    "Finished \"%s\" eid=%llu pid=%d sig=%d/%s",
+		    jp->prog, jp->eid, jp->pid, WTERMSIG(status),
+		    strsignal(WTERMSIG(status)));
+	} else {
+		zed_log_msg(LOG_INFO,
+		    "Finished \"%s\" eid=%llu pid=%d status=0x%X",
+		    jp->prog, jp->eid, jp->pid, (unsigned int) status);
+	}
+	free(jp->prog);
+	*jp = _zed_exec_jobs[--_zed_exec_num_jobs];
+}
+
+/*
+ * Reap finished zedlets, blocking until at least one has finished if
+ * [block] is set and any are running.
+ * Return the number of zedlets still running.
+ */
+static int
+_zed_exec_reap(int block)
+{
+	pid_t wpid;
+	int status;
+	int i;
+
+	while (_zed_exec_num_jobs > 0) {
+		wpid = waitpid(-1, &status, block ? 0 : WNOHANG);
+		if (wpid == 0)
+			break;
+		if (wpid == (pid_t) -1) {
+			if (errno == EINTR)
+				continue;
+			zed_log_msg(LOG_WARNING,
+			    "Failed to wait for %d zedlets: %s",
+			    _zed_exec_num_jobs, strerror(errno));
+			while (_zed_exec_num_jobs > 0)
+				free(_zed_exec_jobs[--_zed_exec_num_jobs].prog);
+			break;
+		}
+		for (i = 0; i < _zed_exec_num_jobs; i++) {
+			if (_zed_exec_jobs[i].pid == wpid) {
+				_zed_exec_job_done(&_zed_exec_jobs[i], status);
+				break;
+			}
+		}
+		block = 0;
+	}
+	return (_zed_exec_num_jobs);
+}
+
 /*
  * Fork a child process to handle event [eid].  The program [prog]
  * in directory [dir] is executed with the envionment [env].
  *
  * The file descriptor [zfd] is the zevent_fd used to track the
  * current cursor location within the zevent nvlist.
+ *
+ * The child is not waited for; if the maximum number of zedlets are
+ * already running, this blocks until one of them finishes.
  */
 static void
 _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
@@ -83,8 +160,7 @@ _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
 	int n;
 	pid_t pid;
 	int fd;
-	pid_t wpid;
-	int status;
+	zed_exec_job_t *jp;
 
 	assert(dir != NULL);
 	assert(prog != NULL);
@@ -98,6 +174,9 @@ _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
 		    prog, eid, strerror(ENAMETOOLONG));
 		return;
 	}
+	if (_zed_exec_num_jobs >= _zed_exec_max_jobs)
+		(void) _zed_exec_reap(1);
+
 	pid = fork();
 	if (pid < 0) {
 		zed_log_msg(LOG_WARNING,
@@ -118,34 +197,68 @@ _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
 		zed_log_msg(LOG_INFO, "Invoking \"%s\" eid=%llu pid=%d",
 		    prog, eid, pid);
 		/* FIXME: Timeout rogue child processes with sigalarm? */
-restart:
-		wpid = waitpid(pid, &status, 0);
-		if (wpid == (pid_t) -1) {
-			if (errno == EINTR)
-				goto restart;
+		jp = &_zed_exec_jobs[_zed_exec_num_jobs++];
+		jp->pid = pid;
+		jp->eid = eid;
+		if (!(jp->prog = strdup(prog))) {
 			zed_log_msg(LOG_WARNING,
-			    "Failed to wait for \"%s\" eid=%llu pid=%d",
-			    prog, eid, pid);
-		} else if (WIFEXITED(status)) {
-			zed_log_msg(LOG_INFO,
-			    "Finished \"%s\" eid=%llu pid=%d exit=%d",
-			    prog, eid, pid, WEXITSTATUS(status));
-		} else if (WIFSIGNALED(status)) {
-			zed_log_msg(LOG_INFO,
-			    "Finished \"%s\" eid=%llu pid=%d sig=%d/%s",
-			    prog, eid, pid, WTERMSIG(status),
-			    strsignal(WTERMSIG(status)));
-		} else {
-			zed_log_msg(LOG_INFO,
-			    "Finished \"%s\" eid=%llu pid=%d status=0x%X",
-			    prog, eid, (unsigned int) status);
+			    "Failed to track \"%s\" eid=%llu pid=%d: %s",
+			    prog, eid, pid, strerror(errno));
+			_zed_exec_num_jobs--;
 		}
 	}
 }
 
 /*
- * Process the event [eid] by synchronously invoking all zedlets with a
- * matching class prefix.
+ * Allow up to [max_jobs] zedlets to run at once.
+ * Return 0 on success, -1 on error.
+ */
+int
+zed_exec_init(int max_jobs)
+{
+	if (max_jobs < 1) {
+		errno = EINVAL;
+		return (-1);
+	}
+	_zed_exec_jobs = calloc(max_jobs, sizeof (zed_exec_job_t));
+	if (!_zed_exec_jobs)
+		return (-1);
+
+	_zed_exec_max_jobs = max_jobs;
+	_zed_exec_num_jobs = 0;
+	return (0);
+}
+
+/*
+ * Wait for all running zedlets to finish.
+ */
+void
+zed_exec_fini(void)
+{
+	if (_zed_exec_num_jobs > 0)
+		zed_log_msg(LOG_INFO, "Waiting for %d zedlets",
+		    _zed_exec_num_jobs);
+
+	while (_zed_exec_reap(1) > 0)
+		;
+	free(_zed_exec_jobs);
+	_zed_exec_jobs = NULL;
+	_zed_exec_max_jobs = 0;
+}
+
+/*
+ * Reap any zedlets that have finished without blocking.
+ * Return the number of zedlets still running.
+ */
+int
+zed_exec_reap(void)
+{
+	return (_zed_exec_reap(0));
+}
+
+/*
+ * Process the event [eid] by invoking all zedlets with a matching class
+ * prefix.  The zedlets run asynchronously; see zed_exec_reap().
  *
  * Each executable in [zedlets] from the directory [dir] is matched against
  * the event's [class], [subclass], and the "all" class (which matches
@@ -17,6 +17,12 @@
 
 #include <stdint.h>
 
+int zed_exec_init(int max_jobs);
+
+void zed_exec_fini(void);
+
+int zed_exec_reap(void);
+
 int zed_exec_process(uint64_t eid, const char *class, const char *subclass,
     const char *dir, zed_strings_t *zedlets, zed_strings_t *envs,
     int zevent_fd);
@@ -56,6 +56,7 @@
 #include <sys/fs/zfs.h>
 #include <sys/types.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <libzfs.h>
 #include <libzfs_core.h>
@@ -74,6 +75,7 @@
 
 #ifdef __APPLE__
 #include <sys/zfs_mount.h>
+#include <sys/sysctl.h>
 #include <syslog.h>
 #endif /* __APPLE__ */
 
@@ -108,7 +110,11 @@ static int zfs_do_hold(int argc, char **argv);
 static int zfs_do_holds(int argc, char **argv);
 static int zfs_do_release(int argc, char **argv);
 static int zfs_do_diff(int argc, char **argv);
+static int zfs_do_iostat(int argc, char **argv);
+static int zfs_do_recompress(int argc, char **argv);
 static int zfs_do_bookmark(int argc, char **argv);
+static int zfs_do_load_key(int argc, char **argv);
+static int zfs_do_unload_key(int argc, char **argv);
 
 /*
  * Enable a reasonable set of defaults for libumem debugging on DEBUG builds.
@@ -155,7 +161,11 @@ typedef enum {
 	HELP_HOLDS,
 	HELP_RELEASE,
 	HELP_DIFF,
+	HELP_IOSTAT,
+	HELP_RECOMPRESS,
 	HELP_BOOKMARK,
+	HELP_LOAD_KEY,
+	HELP_UNLOAD_KEY,
 } zfs_help_t;
 
 typedef struct zfs_command {
@@ -209,6 +219,11 @@ static zfs_command_t command_table[] = {
 	{ "holds",	zfs_do_holds,		HELP_HOLDS		},
 	{ "release",	zfs_do_release,		HELP_RELEASE		},
 	{ "diff",	zfs_do_diff,		HELP_DIFF		},
+	{ "iostat",	zfs_do_iostat,		HELP_IOSTAT		},
+	{ "recompress",	zfs_do_recompress,	HELP_RECOMPRESS		},
+	{ NULL },
+	{ "load-key",	zfs_do_load_key,	HELP_LOAD_KEY		},
+	{ "unload-key",	zfs_do_unload_key,	HELP_UNLOAD_KEY		},
 };
 
 #define	NCOMMAND	(sizeof (command_table) / sizeof (command_table[0]))
@@ -267,11 +282,13 @@ get_usage(zfs_help_t idx)
 	case HELP_ROLLBACK:
 		return (gettext("\trollback [-rRf] <snapshot>\n"));
 	case HELP_SEND:
-		return (gettext("\tsend [-DnPpRvLec] [-[iI] snapshot] "
-		    "<snapshot>\n"
+		return (gettext("\tsend [-DnPpRvLec] [-B size] "
+		    "[-X exclude] ...\n"
+		    "\t    [-[iI] snapshot] <snapshot>\n"
 		    "\tsend [-Le] [-i snapshot|bookmark] "
 		    "<filesystem|volume|snapshot>\n"
-		    "\tsend [-nvPe] -t <receive_resume_token>\n"));
+		    "\tsend [-nvPe] [-B size] [-X exclude] ... "
+		    "-t <receive_resume_token>\n"));
 	case HELP_SET:
 		return (gettext("\tset <property=value> ... "
 			"<filesystem|volume|snapshot> ...\n"));
@@ -325,8 +342,20 @@ get_usage(zfs_help_t idx)
 	case HELP_DIFF:
 		return (gettext("\tdiff [-FHt] <snapshot> "
 		    "[snapshot|filesystem]\n"));
+	case HELP_IOSTAT:
+		return (gettext("\tiostat [-Hpr] [filesystem|volume] ... "
+		    "[interval [count]]\n"));
+	case HELP_RECOMPRESS:
+		return (gettext("\trecompress [-v] [-a txgs] [-r rate] "
+		    "-c <compression>\n"
+		    "\t    <filesystem|volume>\n"));
 	case HELP_BOOKMARK:
 		return (gettext("\tbookmark <snapshot> <bookmark>\n"));
+	case HELP_LOAD_KEY:
+		return (gettext("\tload-key [-L <keylocation>] "
+		    "<filesystem|volume>\n"));
+	case HELP_UNLOAD_KEY:
+		return (gettext("\tunload-key <filesystem|volume>\n"));
 	}
 
 	abort();
@@ -3720,6 +3749,63 @@ usage:
 	return (-1);
 }
 
+/*
+ * Add the comma-separated entries of a "zfs send -X" argument to *excludep:
+ * those starting with '/' are paths, the rest are object numbers.
+ */
+static void
+send_add_exclude(nvlist_t **excludep, char *arg)
+{
+	uint64_t *objs, *nobjs;
+	char **paths, **npaths;
+	uint_t nobj = 0, npath = 0;
+	char *tok, *end;
+
+	if (*excludep == NULL)
+		*excludep = fnvlist_alloc();
+	if (nvlist_lookup_uint64_array(*excludep, "exclude_objs",
+	    &objs, &nobj) != 0)
+		objs = NULL;
+	if (nvlist_lookup_string_array(*excludep, "exclude_paths",
+	    &paths, &npath) != 0)
+		paths = NULL;
+
+	nobjs = safe_malloc((nobj + strlen(arg) / 2 + 1) * sizeof (uint64_t));
+	npaths = safe_malloc((npath + strlen(arg) / 2 + 1) * sizeof (char *));
+	if (nobj != 0)
+		bcopy(objs, nobjs, nobj * sizeof (uint64_t));
+	if (npath != 0)
+		bcopy(paths, npaths, npath * sizeof (char *));
+
+	while ((tok = strsep(&arg, ",")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		if (*tok == '/') {
+			npaths[npath++] = tok;
+			continue;
+		}
+		errno = 0;
+		nobjs[nobj++] = strtoull(tok, &end, 0);
+		if (errno != 0 || *end != '\0') {
+			(void) fprintf(stderr, gettext("bad object to "
+			    "exclude '%s'\n"), tok);
+			usage(B_FALSE);
+		}
+	}
+
+	/* the new arrays are copied in before the old ones are freed */
+	if (nobj != 0) {
+		fnvlist_add_uint64_array(*excludep, "exclude_objs", nobjs,
+		    nobj);
+	}
+	if (npath != 0) {
+		fnvlist_add_string_array(*excludep, "exclude_paths", npaths,
+		    npath);
+	}
+	free(nobjs);
+	free(npaths);
+}
+
 /*
  * Send a backup stream to stdout.
  */
@@ -3735,6 +3821,7 @@ zfs_do_send(int argc, char **argv)
 	int c, err;
 	nvlist_t *dbgnv = NULL;
 	boolean_t extraverbose = B_FALSE;
+	uint64_t intval;
 
 	struct option long_options[] = {
 		{"replicate",	no_argument,		NULL, 'R'},
@@ -3747,12 +3834,14 @@ zfs_do_send(int argc, char **argv)
 		{"embed",	no_argument,		NULL, 'e'},
 		{"resume",	required_argument,	NULL, 't'},
 		{"compressed",	no_argument,		NULL, 'c'},
+		{"buffer",	required_argument,	NULL, 'B'},
+		{"exclude",	required_argument,	NULL, 'X'},
 		{0, 0, 0, 0}
 	};
 
 	/* check options */
-	while ((c = getopt_long(argc, argv, ":i:I:RbDpvnPLet:c", long_options,
-	    NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, ":i:I:RbDpvnPLet:cB:X:",
+	    long_options, NULL)) != -1) {
 		switch (c) {
 		case 'i':
 			if (fromname)
@@ -3799,6 +3888,18 @@ zfs_do_send(int argc, char **argv)
 		case 'c':
 			flags.compress = B_TRUE;
 			break;
+		case 'B':
+			if (zfs_nicestrtonum(g_zfs, optarg, &intval) != 0 ||
+			    intval == 0) {
+				(void) fprintf(stderr, gettext("bad buffer "
+				    "size '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			flags.buffer_size = intval;
+			break;
+		case 'X':
+			send_add_exclude(&flags.exclude, optarg);
+			break;
 		case ':':
 			/*
 			 * If a parameter was not passed, optopt contains the
@@ -3889,7 +3990,8 @@ zfs_do_send(int argc, char **argv)
 
 		if (flags.replicate || flags.doall || flags.props ||
 		    flags.dedup || flags.dryrun || flags.verbose ||
-		    flags.progress) {
+		    flags.progress || flags.buffer_size != 0 ||
+		    flags.exclude != NULL) {
 			(void) fprintf(stderr,
 			    gettext("Error: "
 			    "Unsupported flag with filesystem or bookmark.\n"));
@@ -4151,6 +4253,7 @@ zfs_do_receive(int argc, char **argv)
 #define	ZFS_DELEG_PERM_RELEASE		"release"
 #define	ZFS_DELEG_PERM_DIFF		"diff"
 #define	ZFS_DELEG_PERM_BOOKMARK		"bookmark"
+#define	ZFS_DELEG_PERM_LOAD_KEY		"load-key"
 
 #define	ZFS_NUM_DELEG_NOTES ZFS_DELEG_NOTE_NONE
 
@@ -4161,6 +4264,7 @@ static zfs_deleg_perm_tab_t zfs_deleg_perm_tbl[] = {
 	{ ZFS_DELEG_PERM_DESTROY, ZFS_DELEG_NOTE_DESTROY },
 	{ ZFS_DELEG_PERM_DIFF, ZFS_DELEG_NOTE_DIFF},
 	{ ZFS_DELEG_PERM_HOLD, ZFS_DELEG_NOTE_HOLD },
+	{ ZFS_DELEG_PERM_LOAD_KEY, ZFS_DELEG_NOTE_LOAD_KEY },
 	{ ZFS_DELEG_PERM_MOUNT, ZFS_DELEG_NOTE_MOUNT },
 	{ ZFS_DELEG_PERM_PROMOTE, ZFS_DELEG_NOTE_PROMOTE },
 	{ ZFS_DELEG_PERM_RECEIVE, ZFS_DELEG_NOTE_RECEIVE },
@@ -4704,6 +4808,10 @@ deleg_perm_comment(zfs_deleg_note_t note)
 	case ZFS_DELEG_NOTE_HOLD:
 		str = gettext("Allows adding a user hold to a snapshot");
 		break;
+	case ZFS_DELEG_NOTE_LOAD_KEY:
+		str = gettext("Allows loading and unloading the key of an"
+		    "\n\t\t\t\tencrypted dataset");
+		break;
 	case ZFS_DELEG_NOTE_MOUNT:
 		str = gettext("Allows mount/umount of ZFS datasets");
 		break;
@@ -6087,6 +6195,41 @@ report_mount_progress(int current, int total)
 		update_progress(info);
 }
 
+typedef struct share_mount_state {
+	boolean_t	sm_verbose;
+	int		sm_op;
+	int		sm_flags;
+	char		*sm_proto;
+	char		*sm_options;
+	int		sm_status;	/* zero: success, 1: failure */
+	int		sm_done;	/* number of datasets processed */
+	int		sm_total;
+	pthread_mutex_t	sm_lock;	/* protects the remaining fields */
+} share_mount_state_t;
+
+/*
+ * zfs_foreach_mountpoint() callback for share_mount(); may run in several
+ * threads at once.
+ */
+static int
+share_mount_one_cb(zfs_handle_t *zhp, void *arg)
+{
+	share_mount_state_t *sms = arg;
+	int ret;
+
+	ret = share_mount_one(zhp, sms->sm_op, sms->sm_flags, sms->sm_proto,
+	    B_FALSE, sms->sm_options);
+
+	(void) pthread_mutex_lock(&sms->sm_lock);
+	if (ret != 0)
+		sms->sm_status = ret;
+	if (sms->sm_verbose)
+		report_mount_progress(sms->sm_done, sms->sm_total);
+	sms->sm_done++;
+	(void) pthread_mutex_unlock(&sms->sm_lock);
+	return (ret);
+}
+
 static void
 append_options(char *mntopts, char *newopts)
 {
@@ -6186,18 +6329,28 @@ share_mount(int op, int argc, char **argv)
 		if (count == 0)
 			return (0);
 
-		qsort(dslist, count, sizeof (void *), libzfs_dataset_cmp);
+		share_mount_state_t share_mount_state = { 0 };
+		share_mount_state.sm_op = op;
+		share_mount_state.sm_verbose = verbose;
+		share_mount_state.sm_flags = flags;
+		share_mount_state.sm_options = options;
+		share_mount_state.sm_proto = protocol;
+		share_mount_state.sm_total = count;
+		(void) pthread_mutex_init(&share_mount_state.sm_lock, NULL);
 
-		for (i = 0; i < count; i++) {
-			if (verbose)
-				report_mount_progress(i, count);
+		/*
+		 * Mounts of independent parts of the mountpoint hierarchy
+		 * are done in parallel; sharing is done one at a time.
+		 */
+		if (zfs_foreach_mountpoint(g_zfs, dslist, count,
+		    share_mount_one_cb, &share_mount_state,
+		    op == OP_MOUNT) != 0 || share_mount_state.sm_status != 0)
+			ret = 1;
 
-			if (share_mount_one(dslist[i], op, flags, protocol,
-			    B_FALSE, options) != 0)
-				ret = 1;
-			zfs_close(dslist[i]);
-		}
+		(void) pthread_mutex_destroy(&share_mount_state.sm_lock);
 
+		for (i = 0; i < count; i++)
+			zfs_close(dslist[i]);
 		free(dslist);
 	} else if (argc == 0) {
 		struct mnttab entry;
@@ -7098,6 +7251,466 @@ zfs_do_diff(int argc, char **argv)
 	return (err != 0);
 }
 
+/*
+ * zfs iostat [-Hpr] [filesystem|volume] ... [interval [count]]
+ *
+ * Prints the I/O statistics the kernel keeps for each mounted
+ * filesystem and open volume: operations, bytes and mean latency of
+ * reads and writes.  Without an interval the totals since the dataset
+ * was mounted or opened are printed; with one, rates over each
+ * interval.
+ */
+enum {
+	IOSTAT_READS,
+	IOSTAT_NREAD,
+	IOSTAT_READ_NSECS,
+	IOSTAT_WRITES,
+	IOSTAT_NWRITTEN,
+	IOSTAT_WRITE_NSECS,
+	IOSTAT_NSTATS
+};
+
+static const char *iostat_stat_names[IOSTAT_NSTATS] = {
+	"reads", "nread", "read_nsecs", "writes", "nwritten", "write_nsecs"
+};
+
+typedef struct iostat_ds {
+	char		ids_name[ZFS_MAX_DATASET_NAME_LEN];
+	char		ids_pool[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t	ids_objsetid;
+	boolean_t	ids_valid;
+	uint64_t	ids_prev[IOSTAT_NSTATS];
+	uint64_t	ids_cur[IOSTAT_NSTATS];
+} iostat_ds_t;
+
+typedef struct iostat_cbdata {
+	iostat_ds_t	*cb_ds;
+	int		cb_count;
+	int		cb_alloc;
+} iostat_cbdata_t;
+
+/*
+ * Read the dataset's kstat, kstat.zfs.<pool>.dataset.objset-0x<id>.
+ * Fails if the dataset is not mounted or open.
+ */
+static int
+iostat_read(iostat_ds_t *ids, uint64_t *vals)
+{
+#ifdef __APPLE__
+	char name[MAXPATHLEN];
+	size_t len;
+	int i;
+
+	for (i = 0; i < IOSTAT_NSTATS; i++) {
+		(void) snprintf(name, sizeof (name),
+		    "kstat.zfs.%s.dataset.objset-0x%llx.%s", ids->ids_pool,
+		    (u_longlong_t)ids->ids_objsetid, iostat_stat_names[i]);
+		len = sizeof (uint64_t);
+		if (sysctlbyname(name, &vals[i], &len, NULL, 0) != 0)
+			return (-1);
+	}
+
+	return (0);
+#else
+	char path[MAXPATHLEN], line[256], stat[64];
+	u_longlong_t value;
+	int i, found = 0;
+	FILE *fp;
+
+	(void) snprintf(path, sizeof (path),
+	    "/proc/spl/kstat/zfs/%s/objset-0x%llx", ids->ids_pool,
+	    (u_longlong_t)ids->ids_objsetid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return (-1);
+
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "%63s %*d %llu", stat, &value) != 2)
+			continue;
+		for (i = 0; i < IOSTAT_NSTATS; i++) {
+			if (strcmp(stat, iostat_stat_names[i]) == 0) {
+				vals[i] = value;
+				found++;
+			}
+		}
+	}
+	(void) fclose(fp);
+
+	return (found == IOSTAT_NSTATS ? 0 : -1);
+#endif
+}
+
+static int
+iostat_callback(zfs_handle_t *zhp, void *data)
+{
+	iostat_cbdata_t *cb = data;
+	iostat_ds_t *ids;
+
+	if (cb->cb_count == cb->cb_alloc) {
+		cb->cb_alloc = MAX(cb->cb_alloc * 2, 16);
+		cb->cb_ds = realloc(cb->cb_ds,
+		    cb->cb_alloc * sizeof (iostat_ds_t));
+		if (cb->cb_ds == NULL)
+			nomem();
+	}
+	ids = &cb->cb_ds[cb->cb_count++];
+	bzero(ids, sizeof (iostat_ds_t));
+
+	(void) strlcpy(ids->ids_name, zfs_get_name(zhp),
+	    sizeof (ids->ids_name));
+	(void) strlcpy(ids->ids_pool, zfs_get_pool_name(zhp),
+	    sizeof (ids->ids_pool));
+	ids->ids_objsetid = zfs_prop_get_int(zhp, ZFS_PROP_OBJSETID);
+
+	return (0);
+}
+
+static void
+iostat_nicenum(uint64_t num, boolean_t parsable, char *buf, size_t len)
+{
+	if (parsable)
+		(void) snprintf(buf, len, "%llu", (u_longlong_t)num);
+	else
+		zfs_nicenum(num, buf, len);
+}
+
+static void
+iostat_nicetime(uint64_t nsecs, boolean_t parsable, char *buf, size_t len)
+{
+	if (parsable)
+		(void) snprintf(buf, len, "%llu", (u_longlong_t)nsecs);
+	else if (nsecs < 1000)
+		(void) snprintf(buf, len, "%lluns", (u_longlong_t)nsecs);
+	else if (nsecs < 1000000)
+		(void) snprintf(buf, len, "%.1fus", nsecs / 1000.0);
+	else if (nsecs < 1000000000)
+		(void) snprintf(buf, len, "%.1fms", nsecs / 1000000.0);
+	else
+		(void) snprintf(buf, len, "%.1fs", nsecs / 1000000000.0);
+}
+
+static void
+iostat_print(iostat_cbdata_t *cb, uint64_t interval, boolean_t scripted,
+    boolean_t parsable)
+{
+	const char *fmt = scripted ? "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" :
+	    "%-30s %6s %6s %6s %6s %6s %6s\n";
+	char buf[6][32];
+	int i, s;
+
+	if (!scripted) {
+		(void) printf(fmt, gettext("NAME"), gettext("READS"),
+		    gettext("WRITES"), gettext("RBYTES"), gettext("WBYTES"),
+		    gettext("RLAT"), gettext("WLAT"));
+	}
+
+	for (i = 0; i < cb->cb_count; i++) {
+		iostat_ds_t *ids = &cb->cb_ds[i];
+		uint64_t d[IOSTAT_NSTATS];
+		uint64_t secs = MAX(interval, 1);
+
+		if (!ids->ids_valid)
+			continue;
+
+		for (s = 0; s < IOSTAT_NSTATS; s++)
+			d[s] = ids->ids_cur[s] - ids->ids_prev[s];
+
+		iostat_nicenum(d[IOSTAT_READS] / secs, parsable,
+		    buf[0], sizeof (buf[0]));
+		iostat_nicenum(d[IOSTAT_WRITES] / secs, parsable,
+		    buf[1], sizeof (buf[1]));
+		iostat_nicenum(d[IOSTAT_NREAD] / secs, parsable,
+		    buf[2], sizeof (buf[2]));
+		iostat_nicenum(d[IOSTAT_NWRITTEN] / secs, parsable,
+		    buf[3], sizeof (buf[3]));
+		iostat_nicetime(d[IOSTAT_READS] == 0 ? 0 :
+		    d[IOSTAT_READ_NSECS] / d[IOSTAT_READS], parsable,
+		    buf[4], sizeof (buf[4]));
+		iostat_nicetime(d[IOSTAT_WRITES] == 0 ? 0 :
+		    d[IOSTAT_WRITE_NSECS] / d[IOSTAT_WRITES], parsable,
+		    buf[5], sizeof (buf[5]));
+
+		(void) printf(fmt, ids->ids_name, buf[0], buf[1], buf[2],
+		    buf[3], buf[4], buf[5]);
+	}
+}
+
+static int
+zfs_do_iostat(int argc, char **argv)
+{
+	iostat_cbdata_t cb = { 0 };
+	boolean_t scripted = B_FALSE;
+	boolean_t parsable = B_FALSE;
+	unsigned long interval = 0, count = 0;
+	int flags = 0;
+	char *end;
+	int c, i, ret;
+
+	while ((c = getopt(argc, argv, "Hpr")) != -1) {
+		switch (c) {
+		case 'H':
+			scripted = B_TRUE;
+			break;
+		case 'p':
+			parsable = B_TRUE;
+			break;
+		case 'r':
+			flags |= ZFS_ITER_RECURSE;
+			break;
+		case '?':
+			(void) fprintf(stderr,
+			    gettext("invalid option '%c'\n"), optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	/*
+	 * Like zpool iostat, trailing numbers are the interval and count.
+	 */
+	if (argc > 0 && isdigit(argv[argc - 1][0])) {
+		interval = strtoul(argv[argc - 1], &end, 10);
+		if (*end != '\0' || interval == 0) {
+			(void) fprintf(stderr,
+			    gettext("invalid interval '%s'\n"), argv[argc - 1]);
+			usage(B_FALSE);
+		}
+		argc--;
+		if (argc > 0 && isdigit(argv[argc - 1][0])) {
+			count = interval;
+			interval = strtoul(argv[argc - 1], &end, 10);
+			if (*end != '\0' || interval == 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid interval '%s'\n"),
+				    argv[argc - 1]);
+				usage(B_FALSE);
+			}
+			argc--;
+		}
+	}
+
+	ret = zfs_for_each(argc, argv, flags,
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME, NULL, NULL, 0,
+	    iostat_callback, &cb);
+	if (cb.cb_count == 0) {
+		free(cb.cb_ds);
+		return (ret != 0);
+	}
+
+	for (i = 0; i < cb.cb_count; i++) {
+		iostat_ds_t *ids = &cb.cb_ds[i];
+
+		ids->ids_valid = (iostat_read(ids, ids->ids_cur) == 0);
+	}
+
+	if (interval == 0) {
+		iostat_print(&cb, 0, scripted, parsable);
+		free(cb.cb_ds);
+		return (ret != 0);
+	}
+
+	for (;;) {
+		(void) sleep(interval);
+
+		for (i = 0; i < cb.cb_count; i++) {
+			iostat_ds_t *ids = &cb.cb_ds[i];
+			boolean_t was_valid = ids->ids_valid;
+
+			bcopy(ids->ids_cur, ids->ids_prev,
+			    sizeof (ids->ids_prev));
+			ids->ids_valid = (iostat_read(ids, ids->ids_cur) == 0);
+			/* mounted during the interval: no baseline yet */
+			if (!was_valid && ids->ids_valid)
+				bzero(ids->ids_prev, sizeof (ids->ids_prev));
+		}
+
+		iostat_print(&cb, interval, scripted, parsable);
+
+		if (count != 0 && --count == 0)
+			break;
+		if (!scripted)
+			(void) printf("\n");
+		(void) fflush(stdout);
+	}
+
+	free(cb.cb_ds);
+	return (ret != 0);
+}
+
+/*
+ * zfs recompress [-v] [-a txgs] [-r rate] -c <compression> <fs|vol>
+ *
+ *	-a	Leave blocks written in the last 'txgs' txgs alone.
+ *	-c	The algorithm to rewrite cold blocks with.
+ *	-r	Rewrite at most 'rate' bytes per second.
+ *	-v	Report progress after each step.
+ *
+ * Rewrite the blocks of a filesystem or volume that were written with a
+ * faster compression algorithm, in steps of ZFS_IOC_RECOMPRESS.  Blocks
+ * still shared with a snapshot are skipped, since rewriting them would
+ * only take more space.
+ */
+static int
+zfs_do_recompress(int argc, char **argv)
+{
+	const char *dsname;
+	zfs_handle_t *zhp;
+	nvlist_t *args, *result;
+	boolean_t verbose = B_FALSE;
+	uint64_t compress = 0, age = 0, rate = 0;
+	uint64_t object = 0, offset = 0, used_before, used_after;
+	uint64_t objects = 0, bytes = 0, rewritten = 0, lsize = 0, psize = 0;
+	uint64_t skipped_snap = 0, skipped_young = 0, errors = 0;
+	hrtime_t start;
+	char *end;
+	char buf[3][32];
+	int c, err = 0;
+
+	while ((c = getopt(argc, argv, "a:c:r:v")) != -1) {
+		switch (c) {
+		case 'a':
+			errno = 0;
+			age = strtoull(optarg, &end, 10);
+			if (errno != 0 || *end != '\0') {
+				(void) fprintf(stderr,
+				    gettext("invalid age '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case 'c':
+			/* "on" and "off" are refused by the kernel */
+			if (zfs_prop_string_to_index(ZFS_PROP_COMPRESSION,
+			    optarg, &compress) != 0) {
+				(void) fprintf(stderr, gettext("invalid "
+				    "compression '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case 'r':
+			if (zfs_nicestrtonum(g_zfs, optarg, &rate) != 0 ||
+			    rate == 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid rate '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case 'v':
+			verbose = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr,
+			    gettext("invalid option '%c'\n"), optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (compress == 0) {
+		(void) fprintf(stderr, gettext("missing compression (-c)\n"));
+		usage(B_FALSE);
+	}
+	if (argc != 1) {
+		(void) fprintf(stderr, argc == 0 ?
+		    gettext("missing filesystem or volume argument\n") :
+		    gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+	dsname = argv[0];
+
+	if ((zhp = zfs_open(g_zfs, dsname,
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME)) == NULL)
+		return (1);
+	used_before = zfs_prop_get_int(zhp, ZFS_PROP_USED);
+	zfs_close(zhp);
+
+	start = gethrtime();
+	do {
+		args = fnvlist_alloc();
+		fnvlist_add_uint64(args, "compress", compress);
+		fnvlist_add_uint64(args, "age", age);
+		fnvlist_add_uint64(args, "object", object);
+		fnvlist_add_uint64(args, "offset", offset);
+		/* with a rate, take steps of about a second */
+		if (rate != 0)
+			fnvlist_add_uint64(args, "budget",
+			    MAX(rate, 1ULL << 20));
+
+		result = NULL;
+		err = lzc_recompress(dsname, args, &result);
+		fnvlist_free(args);
+		if (result != NULL) {
+			(void) nvlist_lookup_uint64(result, "object", &object);
+			(void) nvlist_lookup_uint64(result, "offset", &offset);
+			objects += fnvlist_lookup_uint64(result, "objects");
+			bytes += fnvlist_lookup_uint64(result, "bytes");
+			rewritten += fnvlist_lookup_uint64(result,
+			    "rewritten");
+			lsize += fnvlist_lookup_uint64(result,
+			    "rewritten_lsize");
+			psize += fnvlist_lookup_uint64(result,
+			    "rewritten_psize");
+			skipped_snap += fnvlist_lookup_uint64(result,
+			    "skipped_snapshot");
+			skipped_young += fnvlist_lookup_uint64(result,
+			    "skipped_young");
+			errors += fnvlist_lookup_uint64(result, "errors");
+			fnvlist_free(result);
+		}
+		if (err != 0)
+			break;
+
+		if (verbose) {
+			zfs_nicenum(bytes, buf[0], sizeof (buf[0]));
+			zfs_nicenum(lsize, buf[1], sizeof (buf[1]));
+			(void) printf(gettext("object %llu: examined %s, "
+			    "rewritten %s\n"), (u_longlong_t)object, buf[0],
+			    buf[1]);
+			(void) fflush(stdout);
+		}
+
+		if (rate != 0 && object != 0) {
+			hrtime_t due = start + (hrtime_t)(lsize * NANOSEC /
+			    rate);
+			hrtime_t now = gethrtime();
+
+			if (due > now)
+				(void) usleep((due - now) / 1000);
+		}
+	} while (object != 0);
+
+	if (err != 0) {
+		(void) fprintf(stderr, gettext("cannot recompress '%s': %s\n"),
+		    dsname, strerror(err));
+	}
+
+	zfs_nicenum(bytes, buf[0], sizeof (buf[0]));
+	zfs_nicenum(lsize, buf[1], sizeof (buf[1]));
+	zfs_nicenum(psize, buf[2], sizeof (buf[2]));
+	(void) printf(gettext("%llu objects, %s examined; rewrote %llu "
+	    "blocks, %s logical, %s before\n"), (u_longlong_t)objects,
+	    buf[0], (u_longlong_t)rewritten, buf[1], buf[2]);
+	(void) printf(gettext("%llu blocks still in a snapshot, %llu too "
+	    "recent, %llu unreadable\n"), (u_longlong_t)skipped_snap,
+	    (u_longlong_t)skipped_young, (u_longlong_t)errors);
+
+	/* the last steps may not have synced yet */
+	if ((zhp = zfs_open(g_zfs, dsname,
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME)) != NULL) {
+		used_after = zfs_prop_get_int(zhp, ZFS_PROP_USED);
+		zfs_close(zhp);
+		if (used_after < used_before) {
+			zfs_nicenum(used_before - used_after, buf[0],
+			    sizeof (buf[0]));
+			(void) printf(gettext("%s saved so far\n"), buf[0]);
+		}
+	}
+
+	return (err != 0);
+}
+
 extern char *basename(char *path);
 
 /*
@@ -7205,6 +7818,109 @@ usage:
 	return (-1);
 }
 
+/*
+ * zfs load-key [-L keylocation] <fs|vol>
+ *
+ * Loads the key of an encryption root, reading it from its keylocation
+ * property or from the location given by -L.
+ */
+static int
+zfs_do_load_key(int argc, char **argv)
+{
+	zfs_handle_t *zhp;
+	char *keylocation = NULL;
+	int ret;
+	int c;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "L:")) != -1) {
+		switch (c) {
+		case 'L':
+			keylocation = optarg;
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
+		case '?':
+			(void) fprintf(stderr,
+			    gettext("invalid option '%c'\n"), optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	/* check number of arguments */
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing dataset argument\n"));
+		usage(B_FALSE);
+	}
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	zhp = zfs_open(g_zfs, argv[0],
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME);
+	if (zhp == NULL)
+		return (1);
+
+	ret = zfs_crypto_load_key(zhp, keylocation);
+	zfs_close(zhp);
+
+	return (ret != 0);
+}
+
+/*
+ * zfs unload-key <fs|vol>
+ *
+ * Unloads the key of an encryption root.  Every dataset using the key
+ * must be unmounted (or closed, for volumes) first.
+ */
+static int
+zfs_do_unload_key(int argc, char **argv)
+{
+	zfs_handle_t *zhp;
+	int ret;
+	int c;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "")) != -1) {
+		switch (c) {
+		case '?':
+			(void) fprintf(stderr,
+			    gettext("invalid option '%c'\n"), optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	/* check number of arguments */
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing dataset argument\n"));
+		usage(B_FALSE);
+	}
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	zhp = zfs_open(g_zfs, argv[0],
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME);
+	if (zhp == NULL)
+		return (1);
+
+	ret = zfs_crypto_unload_key(zhp);
+	zfs_close(zhp);
+
+	return (ret != 0);
+}
+
 int
 main(int argc, char **argv)
 {
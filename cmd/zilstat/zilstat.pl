@@ -0,0 +1,271 @@
+#!/usr/bin/perl
+#
+# Print out ZFS Intent Log statistics of a pool, exported via kstat(1)
+# For a definition of fields, or usage, use zilstat.pl -v
+#
+# CDDL HEADER START
+#
+# The contents of this file are subject to the terms of the
+# Common Development and Distribution License, Version 1.0 only
+# (the "License").  You may not use this file except in compliance
+# with the License.
+#
+# You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+# or http://www.opensolaris.org/os/licensing.
+# See the License for the specific language governing permissions
+# and limitations under the License.
+#
+# When distributing Covered Code, include this CDDL HEADER in each
+# file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+# If applicable, add the following below this CDDL HEADER, with the
+# fields enclosed by brackets "[]" replaced with your own identifying
+# information: Portions Copyright [yyyy] [name of copyright owner]
+#
+# CDDL HEADER END
+#
+#
+# Works like arcstat.pl: every interval the "zil" kstat of the pool is
+# read, the "v" hash is filled with each field's value using calculate(),
+# and the fields of @hdr are printed with the pretty printer.  With -l the
+# commit and lwb latency histograms of the interval are printed instead.
+
+use strict;
+use POSIX qw(strftime);
+use Getopt::Long;
+use IO::Handle;
+
+my %cols = (# HDR => [Size, Description]
+	"Time"	=>[8, "Time"],
+	"cmt"	=>[5, "zil_commit() calls per second"],
+	"wrtr"	=>[5, "Commit list passes per second"],
+	"cmt/w"	=>[5, "Commits merged into each commit list pass"],
+	"clat"	=>[5, "Average zil_commit() latency (us)"],
+	"itx"	=>[5, "Log records written per second"],
+	"itx/c"	=>[5, "Log records written per commit"],
+	"lwb"	=>[5, "Log blocks written per second"],
+	"slog"	=>[5, "Log blocks meant for the log devices per second"],
+	"norm"	=>[5, "Log blocks kept off the log devices per second"],
+	"slog%"	=>[5, "Percentage of log blocks meant for the log devices"],
+	"lwbsz"	=>[5, "Average bytes used in each log block"],
+	"bytes"	=>[5, "Log block bytes written per second"],
+	"llat"	=>[5, "Average log block write and flush latency (us)"],
+	"tmout"	=>[5, "Log blocks issued by a commit timeout per second"],
+	"stall"	=>[5, "Log block allocation failures per second"],
+	"flush"	=>[5, "Log device cache flushes issued per second"],
+	"fskip"	=>[5, "Log device cache flushes elided per second"],
+	"flat"	=>[5, "Average wait for log block flushes (us)"],
+);
+my %v=();
+my @hdr = qw(Time cmt wrtr cmt/w clat itx/c lwb slog% lwbsz llat);
+my @xhdr = qw(Time cmt itx lwb slog norm bytes tmout stall flush fskip flat);
+my $int = 1;		# Print stats every 1 second by default
+my $count = 0;		# Print stats forever
+my $hdr_intr = 20;	# Print header every 20 lines of output
+my $opfile = "";
+my $sep = "  ";		# Default seperator is 2 spaces
+my $rflag = 0;		# Do not display pretty print by default
+my $lflag = 0;		# Do not display latency histograms by default
+my $pool;
+my $version = "0.1";
+my $cmd = "Usage: zilstat.pl [-hlvx] [-f fields] [-o file] -p pool " .
+    "[interval [count]]\n";
+my %cur;
+my %d;
+my $out;
+STDOUT->autoflush;
+
+sub kstat_update {
+	my @k = `/usr/sbin/sysctl 'kstat.zfs.$pool.misc.zil'`;
+	if (!@k) { exit 1 };
+
+	%cur = ();
+	foreach my $k (@k) {
+		chomp $k;
+		my ($name,$value) = split /:\s*/, $k;
+		my @z = split /\./, $name;
+		my $n = pop @z;
+		$cur{$n} = $value;
+	}
+}
+
+sub detailed_usage {
+	print STDERR "Zilstat version $version\n$cmd";
+	print STDERR "Field definitions are as follows\n";
+	foreach my $hdr (sort keys %cols) {
+		print STDERR sprintf("%6s : %s\n", $hdr, $cols{$hdr}[1]);
+	}
+	print STDERR "\nNote: K=10^3 M=10^6 G=10^9 and so on\n";
+	exit(1);
+}
+
+sub usage {
+	print STDERR "Zilstat version $version\n$cmd";
+	print STDERR "\t -p : Pool whose log statistics are printed\n";
+	print STDERR "\t -x : Print extended stats\n";
+	print STDERR "\t -l : Print the latency histograms of each interval\n";
+	print STDERR "\t -f : Specify specific fields to print (see -v)\n";
+	print STDERR "\t -o : Print stats to file\n";
+	print STDERR "\t -r : Raw output\n";
+	print STDERR "\t -s : Specify a seperator\n\nExamples:\n";
+	print STDERR "\tzilstat -p tank 2 10\n";
+	print STDERR "\tzilstat -p tank -l 10\n";
+	print STDERR "\tzilstat -v\n";
+	print STDERR "\tzilstat -p tank -f Time,cmt,clat,slog%\n";
+	print STDERR "\nPer dataset counters are in " .
+	    "kstat.zfs.<pool>.misc.zil_datasets\n";
+	exit(1);
+}
+
+sub init {
+	my $desired_cols;
+	my $xflag = '';
+	my $hflag = '';
+	my $vflag;
+	my $res = GetOptions('x' => \$xflag,
+		'o=s' => \$opfile,
+		'help|h|?' => \$hflag,
+		'v' => \$vflag,
+		'l' => \$lflag,
+		'r' => \$rflag,
+		'p=s' => \$pool,
+		's=s' => \$sep,
+		'f=s' => \$desired_cols);
+	$int = $ARGV[0] || $int;
+	$count = $ARGV[1] || $count;
+	detailed_usage() if $vflag;
+	usage() if !$res or $hflag or !defined $pool or
+	    ($xflag and $desired_cols);
+	@hdr = @xhdr if $xflag;		#reset headers to xhdr
+	if ($desired_cols) {
+		@hdr = split(/[ ,]+/, $desired_cols);
+		# Now check if they are valid fields
+		my @invalid = ();
+		foreach my $ele (@hdr) {
+			push(@invalid, $ele) if not exists($cols{$ele});
+		}
+		if (scalar @invalid > 0) {
+			print STDERR "Invalid column definition! -- "
+				. "@invalid\n\n";
+			usage();
+		}
+	}
+	if ($opfile) {
+		open($out, ">$opfile") ||die "Cannot open $opfile for writing";
+		$out->autoflush;
+		select $out;
+	}
+}
+
+# Capture kstat statistics. We maintain 3 hashes, prev, cur, and
+# d (delta). As their names imply they maintain the previous, current,
+# and delta (cur - prev) statistics.
+sub snap_stats {
+	my %prev = %cur;
+	kstat_update();
+
+	foreach my $key (keys %cur) {
+		if (defined $prev{$key}) {
+			$d{$key} = $cur{$key} - $prev{$key};
+		} else {
+			$d{$key} = $cur{$key};
+		}
+	}
+}
+
+# Pretty print num. Arguments are width and num
+sub prettynum {
+	my @suffix=(' ','K', 'M', 'G', 'T', 'P', 'E', 'Z');
+	my $num = $_[1] || 0;
+	my $sz = $_[0];
+	my $index = 0;
+	return sprintf("%*s", $sz, $num) if ($rflag or not $num =~ /^[0-9\.]+$/);
+	while ($num >= 10000 and $index < 8) {
+		$num = $num/1000;
+		$index++;
+	}
+	return sprintf("%*d", $sz, $num) if ($index == 0);
+	return sprintf("%*d%s", $sz - 1, $num,$suffix[$index]);
+}
+
+sub print_values {
+	foreach my $col (@hdr) {
+		printf("%s%s", prettynum($cols{$col}[0], $v{$col}), $sep);
+	}
+	printf("\n");
+}
+
+sub print_header {
+	foreach my $col (@hdr) {
+		printf("%*s%s", $cols{$col}[0], $col, $sep);
+	}
+	printf("\n");
+}
+
+# Print the buckets of the interval's commit and lwb latency histograms
+# that have entries, from the kstat's <type>_<N>_ns counters.
+sub print_histograms {
+	printf("%s\n", strftime("%H:%M:%S", localtime));
+	printf("%12s%s%8s%s%8s\n", "latency(ns)", $sep, "commit", $sep, "lwb");
+	for (my $i = 0; $i < 30; $i++) {
+		my $ns = 1 << $i;
+		my $c = $d{"commit_${ns}_ns"} || 0;
+		my $l = $d{"lwb_${ns}_ns"} || 0;
+		next if ($c == 0 and $l == 0);
+		printf("%12s%s%s%s%s\n", prettynum(12, $ns), $sep,
+		    prettynum(8, $c), $sep, prettynum(8, $l));
+	}
+	printf("\n");
+}
+
+sub calculate {
+	%v=();
+	my $lwbs = $d{"lwbs_slog"} + $d{"lwbs_normal"};
+	my $bytes = $d{"lwbs_slog_bytes"} + $d{"lwbs_normal_bytes"};
+
+	$v{"Time"} = strftime("%H:%M:%S", localtime);
+	$v{"cmt"} = $d{"commits"}/$int;
+	$v{"wrtr"} = $d{"commit_writers"}/$int;
+	$v{"cmt/w"} = $d{"commits"}/$d{"commit_writers"}
+	    if $d{"commit_writers"} > 0;
+	$v{"clat"} = $d{"commit_nsecs"}/$d{"commits"}/1000
+	    if $d{"commits"} > 0;
+	$v{"itx"} = $d{"itxs"}/$int;
+	$v{"itx/c"} = $d{"itxs"}/$d{"commits"} if $d{"commits"} > 0;
+	$v{"lwb"} = $lwbs/$int;
+	$v{"slog"} = $d{"lwbs_slog"}/$int;
+	$v{"norm"} = $d{"lwbs_normal"}/$int;
+	$v{"slog%"} = 100*$d{"lwbs_slog"}/$lwbs if $lwbs > 0;
+	$v{"lwbsz"} = $bytes/$lwbs if $lwbs > 0;
+	$v{"bytes"} = $bytes/$int;
+	$v{"llat"} = $d{"lwb_nsecs"}/$lwbs/1000 if $lwbs > 0;
+	$v{"tmout"} = $d{"lwb_timeouts"}/$int;
+	$v{"stall"} = $d{"stalls"}/$int;
+	$v{"flush"} = $d{"flushes"}/$int;
+	$v{"fskip"} = $d{"flushes_elided"}/$int;
+	$v{"flat"} = $d{"flush_nsecs"}/$lwbs/1000 if $lwbs > 0;
+}
+
+sub main {
+	my $i = 0;
+	my $count_flag = 0;
+
+	init();
+	if ($count > 0) { $count_flag = 1; }
+	snap_stats();
+	while (1) {
+		sleep($int);
+		snap_stats();
+		if ($lflag) {
+			print_histograms();
+		} else {
+			print_header() if ($i == 0);
+			calculate();
+			print_values();
+		}
+		last if ($count_flag == 1 && $count-- <= 1);
+		$i = ($i == $hdr_intr) ? 0 : $i+1;
+	}
+	close($out) if defined $out;
+}
+
+&main;
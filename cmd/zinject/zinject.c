@@ -278,6 +278,23 @@ usage(void)
 		"\t\tcreate 3 lanes on the device; one lane with a latency\n"
 		"\t\tof 10 ms and two lanes with a 25 ms latency.\n"
 		"\n"
+		"\tzinject -d device -D latency:lanes -P profile pool\n"
+		"\n"
+		"\t\tAs above, but model a real device more closely.\n"
+		"\t\t'profile' is a comma-separated list of:\n"
+		"\n"
+		"\t\tjitter=ms\tadd a random latency, averaging 1.5 times\n"
+		"\t\t\t\t'ms' with an exponential tail\n"
+		"\t\tbw=MB/s\t\tadd the transfer time of each request at\n"
+		"\t\t\t\tthis bandwidth per lane\n"
+		"\t\tqdelay=us\tadd 'us' for every other busy lane\n"
+		"\t\tstall=ms/ms\tstall the device for the second\n"
+		"\t\t\t\tduration once every first duration\n"
+		"\t\tseed=n\t\tseed the jitter, for repeatable runs\n"
+		"\n"
+		"\t\tFor example:\n"
+		"\t\t-D 5:4 -P jitter=2,bw=150,stall=10000/500\n"
+		"\n"
 	    "\tzinject -I [-s <seconds> | -g <txgs>] pool\n"
 	    "\n"
 	    "\t\tCause the pool to stop writing blocks yet not\n"
@@ -656,6 +673,58 @@ parse_delay(char *str, uint64_t *delay, uint64_t *nlanes)
 	return (0);
 }
 
+/*
+ * Parse a '-P' latency profile, "key=value[,key=value...]", into the
+ * ZINJECT_DELAY_IO fields of the record. Times are converted to
+ * nanoseconds and bandwidth to bytes per second.
+ */
+static int
+parse_profile(char *str, zinject_record_t *record)
+{
+	char *tok, *val, *end;
+	unsigned long long n, m;
+
+	for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if ((val = strchr(tok, '=')) == NULL)
+			return (1);
+		*val++ = '\0';
+
+		errno = 0;
+		n = strtoull(val, &end, 10);
+		if (errno != 0 || end == val)
+			return (1);
+
+		if (strcmp(tok, "stall") == 0) {
+			if (*end != '/')
+				return (1);
+			val = end + 1;
+			m = strtoull(val, &end, 10);
+			if (errno != 0 || end == val || *end != '\0' ||
+			    m == 0 || m >= n)
+				return (1);
+			record->zi_stall_period = MSEC2NSEC(n);
+			record->zi_stall_len = MSEC2NSEC(m);
+			continue;
+		}
+
+		if (*end != '\0')
+			return (1);
+
+		if (strcmp(tok, "jitter") == 0)
+			record->zi_jitter = MSEC2NSEC(n);
+		else if (strcmp(tok, "bw") == 0)
+			record->zi_bandwidth = n << 20;
+		else if (strcmp(tok, "qdelay") == 0)
+			record->zi_qdelay = n * NSEC_PER_USEC;
+		else if (strcmp(tok, "seed") == 0)
+			record->zi_seed = n;
+		else
+			return (1);
+	}
+
+	return (0);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -665,6 +734,7 @@ main(int argc, char **argv)
 	char *end;
 	char *raw = NULL;
 	char *device = NULL;
+	char *profile = NULL;
 	int level = 0;
 	int quiet = 0;
 	int error = 0;
@@ -711,7 +781,7 @@ main(int argc, char **argv)
 	}
 
 	while ((c = getopt(argc, argv,
-	    ":aA:b:d:D:f:Fg:qhIc:t:T:l:mr:s:e:uL:p:")) != -1) {
+	    ":aA:b:d:D:f:Fg:qhIc:t:T:l:mr:s:e:uL:p:P:")) != -1) {
 		switch (c) {
 		case 'a':
 			flags |= ZINJECT_FLUSH_ARC;
@@ -814,6 +884,16 @@ main(int argc, char **argv)
 			    sizeof (record.zi_func));
 			record.zi_cmd = ZINJECT_PANIC;
 			break;
+		case 'P':
+			profile = strdup(optarg);
+			if (profile == NULL ||
+			    parse_profile(profile, &record) != 0) {
+				(void) fprintf(stderr, "invalid latency "
+				    "profile: '%s'\n", optarg);
+				usage();
+				return (1);
+			}
+			break;
 		case 'q':
 			quiet = 1;
 			break;
@@ -886,6 +966,13 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if (profile != NULL && record.zi_timer == 0) {
+		(void) fprintf(stderr, "latency profile (-P) requires an "
+		    "i/o delay (-D)\n");
+		usage();
+		return (1);
+	}
+
 	if (record.zi_duration != 0)
 		record.zi_cmd = ZINJECT_IGNORED_WRITES;
 
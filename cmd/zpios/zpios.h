@@ -93,6 +93,7 @@ typedef struct cmd_args {
 	uint64_t regionnoise;		/* Region noise */
 	uint64_t chunknoise;		/* Chunk noise */
 	uint64_t thread_delay;		/* Thread delay */
+	uint64_t read_pct;		/* Mixed phase reads (%) */
 
 	char pre[ZPIOS_PATH_SIZE];	/* Pre-exec hook */
 	char post[ZPIOS_PATH_SIZE];	/* Post-exec hook */
@@ -118,5 +119,6 @@ int set_load_params(cmd_args_t *args, char *optarg);
 int check_mutual_exclusive_command_lines(uint32_t flag, char *arg);
 void print_stats_header(cmd_args_t *args);
 void print_stats(cmd_args_t *args, zpios_cmd_t *cmd);
+void print_latency(cmd_args_t *args, zpios_lat_t *lat);
 
 #endif /* _ZPIOS_H */
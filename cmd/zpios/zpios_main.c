@@ -40,11 +40,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#ifdef __APPLE__
+#include <libzfs_core.h>
+#endif
 #include "zpios.h"
 
 static const char short_opt[] =
 	"t:l:h:e:n:i:j:k:o:m:q:r:c:a:b:g:s:A:B:C:"
-	"L:p:M:xP:R:G:I:N:T:VzOfHv?";
+	"L:p:M:xP:R:G:I:N:T:X:VzOfHv?";
 static const struct option long_opt[] = {
 	{"threadcount",		required_argument,	0,	't' },
 	{"threadcount_low",	required_argument,	0,	'l' },
@@ -76,6 +79,7 @@ static const struct option long_opt[] = {
 	{"regionnoise",		required_argument,	0,	'I' },
 	{"chunknoise",		required_argument,	0,	'N' },
 	{"threaddelay",		required_argument,	0,	'T' },
+	{"mixed",		required_argument,	0,	'X' },
 	{"verify",		no_argument,		0,	'V' },
 	{"zerocopy",		no_argument,		0,	'z' },
 	{"nowait",		no_argument,		0,	'O' },
@@ -86,10 +90,12 @@ static const struct option long_opt[] = {
 	{ 0,			0,			0,	0 },
 };
 
-static int zpiosctl_fd;				/* Control file descriptor */
 static char zpios_version[VERSION_SIZE];	/* Kernel version string */
+#ifndef __APPLE__
+static int zpiosctl_fd;				/* Control file descriptor */
 static char *zpios_buffer = NULL;		/* Scratch space area */
 static int zpios_buffer_size = 0;		/* Scratch space size */
+#endif
 
 static int
 usage(void)
@@ -126,6 +132,7 @@ usage(void)
 		"	--regionnoise       -I    =shift\n"
 		"	--chunknoise        -N    =bytes\n"
 		"	--threaddelay       -T    =jiffies\n"
+		"	--mixed             -X    =read percentage (OS X)\n"
 		"	--verify            -V\n"
 		"	--zerocopy          -z\n"
 		"	--nowait            -O\n"
@@ -282,6 +289,15 @@ args_init(int argc, char **argv)
 			rc = set_noise(&args->thread_delay, optarg,
 			    "threaddelay");
 			break;
+		case 'X': /* --mixed */
+			rc = set_noise(&args->read_pct, optarg, "mixed");
+			if (rc == 0 && args->read_pct > 100) {
+				fprintf(stderr, "Error: mixed read percentage "
+				    "must be at most 100\n");
+				rc = EINVAL;
+			}
+			args->flags |= DMU_MIXED;
+			break;
 		case 'V': /* --verify */
 			args->flags |= DMU_VERIFY;
 			break;
@@ -339,9 +355,49 @@ args_init(int argc, char **argv)
 		return (NULL);
 	}
 
+#ifndef __APPLE__
+	if (args->flags & DMU_MIXED) {
+		fprintf(stderr, "Error, --mixed is only supported on OS X\n");
+		usage();
+		args_fini(args);
+		return (NULL);
+	}
+#endif
+
 	return (args);
 }
 
+#ifdef __APPLE__
+/*
+ * On OS X the runs are done by the ZFS_IOC_ZPIOS ioctl of /dev/zfs, which
+ * returns the text log with the results, so there is no device of our own
+ * nor a buffer to manage.
+ */
+static int
+dev_clear(void)
+{
+	return (0);
+}
+
+static void
+dev_fini(void)
+{
+	libzfs_core_fini();
+}
+
+static int
+dev_init(void)
+{
+	int rc;
+
+	if ((rc = libzfs_core_init()) != 0)
+		fprintf(stderr, "Unable to open /dev/zfs: %d\n"
+		    "Is the zfs kext loaded?\n", rc);
+
+	return (rc);
+}
+#else
+
 static int
 dev_clear(void)
 {
@@ -437,6 +493,7 @@ error:
 
 	return (rc);
 }
+#endif /* __APPLE__ */
 
 static int
 get_next(uint64_t *val, range_repeat_t *range)
@@ -478,12 +535,66 @@ get_next(uint64_t *val, range_repeat_t *range)
 	return (0);
 }
 
+#ifdef __APPLE__
+/*
+ * The whole command, including its zeroed data region, is passed so that
+ * libzfs_core sizes the result buffer for the returned stats up front;
+ * retrying with a larger buffer would repeat the run.
+ */
+static int
+run_one_ioctl(cmd_args_t *args, zpios_cmd_t *cmd, int cmd_size)
+{
+	nvlist_t *innvl, *outnvl = NULL;
+	zpios_lat_t *lat = NULL;
+	uchar_t *data;
+	char *log;
+	uint_t size;
+	int rc;
+
+	innvl = fnvlist_alloc();
+	fnvlist_add_uint8_array(innvl, ZPIOS_NVL_CMD, (uchar_t *)cmd,
+	    cmd_size);
+	if (args->flags & DMU_MIXED)
+		fnvlist_add_uint64(innvl, ZPIOS_NVL_READ_PCT, args->read_pct);
+
+	rc = lzc_zpios(args->pool, innvl, &outnvl);
+	fnvlist_free(innvl);
+	if (rc)
+		args->rc = rc;
+
+	if (outnvl != NULL) {
+		if (nvlist_lookup_uint8_array(outnvl, ZPIOS_NVL_STATS,
+		    &data, &size) == 0 && size <= cmd->cmd_data_size)
+			memcpy(cmd->cmd_data_str, data, size);
+		if (nvlist_lookup_uint8_array(outnvl, ZPIOS_NVL_LATENCY,
+		    &data, &size) == 0 && size == sizeof (zpios_lat_t))
+			lat = (zpios_lat_t *)data;
+	}
+
+	print_stats(args, cmd);
+	if (rc == 0 && lat != NULL)
+		print_latency(args, lat);
+
+	if (args->verbose && outnvl != NULL &&
+	    nvlist_lookup_string(outnvl, ZPIOS_NVL_LOG, &log) == 0 &&
+	    strlen(log) > 0) {
+		fprintf(stdout, "\n%s\n", log);
+		fflush(stdout);
+	}
+
+	if (outnvl != NULL)
+		fnvlist_free(outnvl);
+
+	return (rc);
+}
+#endif
+
 static int
 run_one(cmd_args_t *args, uint32_t id, uint32_t T, uint32_t N,
     uint64_t C, uint64_t S, uint64_t O)
 {
 	zpios_cmd_t *cmd;
-	int rc, rc2, cmd_size;
+	int rc, cmd_size;
 
 	dev_clear();
 
@@ -512,6 +623,9 @@ run_one(cmd_args_t *args, uint32_t id, uint32_t T, uint32_t N,
 	cmd->cmd_flags = args->flags;
 	cmd->cmd_data_size = (T + N + 1) * sizeof (zpios_stats_t);
 
+#ifdef __APPLE__
+	rc = run_one_ioctl(args, cmd, cmd_size);
+#else
 	rc = ioctl(zpiosctl_fd, ZPIOS_CMD, cmd);
 	if (rc)
 		args->rc = errno;
@@ -519,6 +633,8 @@ run_one(cmd_args_t *args, uint32_t id, uint32_t T, uint32_t N,
 	print_stats(args, cmd);
 
 	if (args->verbose) {
+		int rc2;
+
 		rc2 = read(zpiosctl_fd, zpios_buffer, zpios_buffer_size - 1);
 		if (rc2 < 0) {
 			fprintf(stdout, "Error reading results: %d\n", rc2);
@@ -527,6 +643,7 @@ run_one(cmd_args_t *args, uint32_t id, uint32_t T, uint32_t N,
 			fflush(stdout);
 		}
 	}
+#endif
 
 	free(cmd);
 
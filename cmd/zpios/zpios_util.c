@@ -124,7 +124,8 @@ print_flags(char *str, uint32_t flags)
 	str[4] = (flags & DMU_FPP)    ? 'p' : 's';
 	str[5] = (flags & (DMU_WRITE_ZC | DMU_READ_ZC)) ? 'z' : '-';
 	str[6] = (flags & DMU_WRITE_NOWAIT) ? 'O' : '-';
-	str[7] = '\0';
+	str[7] = (flags & DMU_MIXED) ? 'X' : '-';
+	str[8] = '\0';
 
 	return (str);
 }
@@ -461,3 +462,107 @@ print_stats(cmd_args_t *args, zpios_cmd_t *cmd)
 	else
 		print_stats_table(args, cmd);
 }
+
+/*
+ * Latency at or below which ppt thousandths of the histogram's operations
+ * completed, rounded up to the end of its bucket.
+ */
+static uint64_t
+lat_percentile(uint64_t *hist, uint64_t ppt)
+{
+	uint64_t total = 0, sum = 0, target;
+	int i;
+
+	for (i = 0; i < ZPIOS_LAT_BUCKETS; i++)
+		total += hist[i];
+
+	target = (total * ppt + 999) / 1000;
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < ZPIOS_LAT_BUCKETS; i++) {
+		sum += hist[i];
+		if (sum >= target)
+			return (zpios_lat_bucket_max(i));
+	}
+
+	return (0);
+}
+
+static char *
+lat_to_str(char *str, uint64_t ns)
+{
+	if (ns >= 1000000000ULL)
+		(void) snprintf(str, KMGT_SIZE-1, "%.2fs", (double)ns / 1e9);
+	else if (ns >= 1000000ULL)
+		(void) snprintf(str, KMGT_SIZE-1, "%.2fms", (double)ns / 1e6);
+	else
+		(void) snprintf(str, KMGT_SIZE-1, "%.2fus", (double)ns / 1e3);
+
+	return (str);
+}
+
+static void
+print_latency_one(cmd_args_t *args, const char *phase, uint64_t *hist)
+{
+	uint64_t ppts[] = { 500, 990, 999 };
+	char str[KMGT_SIZE];
+	uint64_t ns;
+	int i, n = 0;
+
+	for (i = 0; i < ZPIOS_LAT_BUCKETS; i++)
+		n += (hist[i] != 0);
+	if (n == 0)
+		return;
+
+	printf("%-10s%-12s", "", phase);
+	for (i = 0; i < sizeof (ppts) / sizeof (ppts[0]); i++) {
+		ns = lat_percentile(hist, ppts[i]);
+		if (args->human_readable)
+			printf("\t%s", lat_to_str(str, ns));
+		else
+			printf("\t%llu", (long long unsigned)ns);
+	}
+	printf("\n");
+}
+
+/*
+ * Print the p50/p99/p999 latencies of each kind of operation of a run,
+ * and the throughput of its mixed phase when it had one.
+ */
+void
+print_latency(cmd_args_t *args, zpios_lat_t *lat)
+{
+	zpios_stats_t *mixed = &lat->lat_mixed;
+	double mix_time;
+	char str[KMGT_SIZE];
+
+	printf("%-22s\tp50\tp99\tp999%s\n", "",
+	    args->human_readable ? "" : " (ns)");
+	print_latency_one(args, "wr-lat", lat->lat_wr);
+	print_latency_one(args, "rd-lat", lat->lat_rd);
+	print_latency_one(args, "mix-wr-lat", lat->lat_mix_wr);
+	print_latency_one(args, "mix-rd-lat", lat->lat_mix_rd);
+
+	if (!(args->flags & DMU_MIXED))
+		return;
+
+	mix_time = zpios_timespec_to_double(mixed->total_time.delta);
+	printf("%-10smixed %3u%%r\t", "", lat->lat_read_pct);
+	if (args->human_readable) {
+		printf("%s\t", uint64_to_kmgt(str, mixed->wr_data));
+		printf("%s\t", uint64_to_kmgt(str, mixed->wr_chunks));
+		printf("%s\t", kmgt_per_sec(str, mixed->wr_data, mix_time));
+		printf("%s\t", uint64_to_kmgt(str, mixed->rd_data));
+		printf("%s\t", uint64_to_kmgt(str, mixed->rd_chunks));
+		printf("%s\n", kmgt_per_sec(str, mixed->rd_data, mix_time));
+	} else {
+		printf("%lld\t", (long long unsigned)mixed->wr_data);
+		printf("%lld\t", (long long unsigned)mixed->wr_chunks);
+		printf("%.4f\t", (double)mixed->wr_data / mix_time);
+		printf("%lld\t", (long long unsigned)mixed->rd_data);
+		printf("%lld\t", (long long unsigned)mixed->rd_chunks);
+		printf("%.4f\n", (double)mixed->rd_data / mix_time);
+	}
+	fflush(stdout);
+}
@@ -53,6 +53,9 @@
 #include <sys/zfs_ioctl.h>
 #include <math.h>
 #include <sys/stropts.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
 
 #include <libzfs.h>
 #include <libdiskmgt.h>
@@ -74,6 +77,7 @@ static int zpool_do_remove(int, char **);
 static int zpool_do_labelclear(int, char **);
 
 static int zpool_do_list(int, char **);
+static int zpool_do_frag(int, char **);
 static int zpool_do_iostat(int, char **);
 static int zpool_do_status(int, char **);
 
@@ -90,6 +94,7 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_scrub(int, char **);
+static int zpool_do_trim(int, char **);
 
 static int zpool_do_import(int, char **);
 static int zpool_do_export(int, char **);
@@ -129,6 +134,7 @@ typedef enum {
 	HELP_DESTROY,
 	HELP_DETACH,
 	HELP_EXPORT,
+	HELP_FRAG,
 	HELP_HISTORY,
 	HELP_IMPORT,
 	HELP_IOSTAT,
@@ -146,7 +152,8 @@ typedef enum {
 	HELP_SET,
 	HELP_SPLIT,
 	HELP_REGUID,
-	HELP_REOPEN
+	HELP_REOPEN,
+	HELP_TRIM
 } zpool_help_t;
 
 
@@ -249,6 +256,7 @@ static zpool_command_t command_table[] = {
 	{ "labelclear",	zpool_do_labelclear,	HELP_LABELCLEAR		},
 	{ NULL },
 	{ "list",	zpool_do_list,		HELP_LIST		},
+	{ "frag",	zpool_do_frag,		HELP_FRAG		},
 	{ "iostat",	zpool_do_iostat,	HELP_IOSTAT		},
 	{ "status",	zpool_do_status,	HELP_STATUS		},
 	{ NULL },
@@ -263,6 +271,7 @@ static zpool_command_t command_table[] = {
 	{ "split",	zpool_do_split,		HELP_SPLIT		},
 	{ NULL },
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -287,7 +296,7 @@ static const char *
 get_usage(zpool_help_t idx) {
 	switch (idx) {
 	case HELP_ADD:
-		return (gettext("\tadd [-fgLnP] [-o property=value] "
+		return (gettext("\tadd [-fgLnPS] [-o property=value] "
 		    "<pool> <vdev> ...\n"));
 	case HELP_ATTACH:
 		return (gettext("\tattach [-f] [-o property=value] "
@@ -295,7 +304,7 @@ get_usage(zpool_help_t idx) {
 	case HELP_CLEAR:
 		return (gettext("\tclear [-nF] <pool> [device]\n"));
 	case HELP_CREATE:
-		return (gettext("\tcreate [-fnd] [-o property=value] ... \n"
+		return (gettext("\tcreate [-fndS] [-o property=value] ... \n"
 		    "\t    [-O file-system-property=value] ... \n"
 		    "\t    [-m mountpoint] [-R root] <pool> <vdev> ...\n"));
 	case HELP_DESTROY:
@@ -304,6 +313,8 @@ get_usage(zpool_help_t idx) {
 		return (gettext("\tdetach <pool> <device>\n"));
 	case HELP_EXPORT:
 		return (gettext("\texport [-af] <pool> ...\n"));
+	case HELP_FRAG:
+		return (gettext("\tfrag [-p] [pool] ...\n"));
 	case HELP_HISTORY:
 		return (gettext("\thistory [-il] [<pool>] ...\n"));
 	case HELP_IMPORT:
@@ -338,7 +349,10 @@ get_usage(zpool_help_t idx) {
 	case HELP_REOPEN:
 		return (gettext("\treopen <pool>\n"));
 	case HELP_SCRUB:
-		return (gettext("\tscrub [-s] <pool> ...\n"));
+		return (gettext("\tscrub [-s] [-t [first]:[last]] "
+		    "[-d dataset] ... <pool> ...\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-s] [-r rate] <pool> ...\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-gLPvxD] [-T d|u] [pool] ... "
 		    "[interval [count]]\n"));
@@ -451,9 +465,66 @@ usage(boolean_t requested)
 	exit(requested ? 0 : 2);
 }
 
+/*
+ * The separate allocation classes, in the order their vdevs are listed
+ * after the ordinary data vdevs of a pool.
+ */
+static const struct {
+	const char	*vc_flag;	/* config flag of its top-level vdevs */
+	const char	*vc_title;	/* heading of its section */
+} vdev_classes[] = {
+	{ ZPOOL_CONFIG_IS_DEDUP,	"dedup" },
+	{ ZPOOL_CONFIG_IS_SPECIAL,	"special" },
+	{ ZPOOL_CONFIG_IS_LOG,		"logs" },
+};
+
+/*
+ * Return whether a top-level vdev has the given class flag (such as
+ * ZPOOL_CONFIG_IS_LOG) set, or with a NULL class, whether it is an ordinary
+ * data vdev that belongs to no separate class.
+ */
+static boolean_t
+vdev_in_class(nvlist_t *nv, const char *class)
+{
+	uint64_t flag = B_FALSE;
+	int i;
+
+	if (class != NULL) {
+		(void) nvlist_lookup_uint64(nv, class, &flag);
+		return (flag != 0);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(vdev_classes); i++) {
+		if (vdev_in_class(nv, vdev_classes[i].vc_flag))
+			return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Mark the normal top-level vdevs of a new vdev specification sequential,
+ * for SMR disks.  Their metaslabs are only ever written front to back.
+ */
+static void
+set_sequential(nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t c, children;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return;
+
+	for (c = 0; c < children; c++) {
+		if (vdev_in_class(child[c], NULL))
+			verify(nvlist_add_uint64(child[c],
+			    ZPOOL_CONFIG_SEQUENTIAL, B_TRUE) == 0);
+	}
+}
+
 void
 print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
-    boolean_t print_logs, int name_flags)
+    const char *class, int name_flags)
 {
 	nvlist_t **child;
 	uint_t c, children;
@@ -467,16 +538,12 @@ print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if ((is_log && !print_logs) || (!is_log && print_logs))
+		if (!vdev_in_class(child[c], class))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c], name_flags);
 		print_vdev_tree(zhp, vname, child[c], indent + 2,
-		    B_FALSE, name_flags);
+		    NULL, name_flags);
 		free(vname);
 	}
 }
@@ -584,7 +651,7 @@ add_prop_list_default(const char *propname, char *propval, nvlist_t **props,
 }
 
 /*
- * zpool add [-fgLnP] [-o property=value] <pool> <vdev> ...
+ * zpool add [-fgLnPS] [-o property=value] <pool> <vdev> ...
  *
  *	-f	Force addition of devices, even if they appear in use
  *	-g	Display guid for individual vdev name.
@@ -593,6 +660,7 @@ add_prop_list_default(const char *propname, char *propval, nvlist_t **props,
  *		they were to be added.
  *	-o	Set property=value.
  *	-P	Display full path for vdev name.
+ *	-S	Allocate sequentially from the new vdevs (SMR disks).
  *
  * Adds the given vdevs to 'pool'.  As with create, the bulk of this work is
  * handled by get_vdev_spec(), which constructs the nvlist needed to pass to
@@ -603,8 +671,9 @@ zpool_do_add(int argc, char **argv)
 {
 	boolean_t force = B_FALSE;
 	boolean_t dryrun = B_FALSE;
+	boolean_t sequential = B_FALSE;
 	int name_flags = 0;
-	int c;
+	int c, i;
 	nvlist_t *nvroot;
 	char *poolname;
 	int ret;
@@ -614,7 +683,7 @@ zpool_do_add(int argc, char **argv)
 	char *propval;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "fgLno:P")) != -1) {
+	while ((c = getopt(argc, argv, "fgLno:PS")) != -1) {
 		switch (c) {
 		case 'f':
 			force = B_TRUE;
@@ -644,6 +713,9 @@ zpool_do_add(int argc, char **argv)
 		case 'P':
 			name_flags |= VDEV_NAME_PATH;
 			break;
+		case 'S':
+			sequential = B_TRUE;
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -686,6 +758,8 @@ zpool_do_add(int argc, char **argv)
 		zpool_close(zhp);
 		return (1);
 	}
+	if (sequential)
+		set_sequential(nvroot);
 
 	if (dryrun) {
 		nvlist_t *poolnvroot;
@@ -701,19 +775,24 @@ zpool_do_add(int argc, char **argv)
 		    "configuration:\n"), zpool_get_name(zhp));
 
 		/* print original main pool and new tree */
-		print_vdev_tree(zhp, poolname, poolnvroot, 0, B_FALSE,
+		print_vdev_tree(zhp, poolname, poolnvroot, 0, NULL,
 		    name_flags);
-		print_vdev_tree(zhp, NULL, nvroot, 0, B_FALSE, name_flags);
-
-		/* Do the same for the logs */
-		if (num_logs(poolnvroot) > 0) {
-			print_vdev_tree(zhp, "logs", poolnvroot, 0, B_TRUE,
-			    name_flags);
-			print_vdev_tree(zhp, NULL, nvroot, 0, B_TRUE,
-			    name_flags);
-		} else if (num_logs(nvroot) > 0) {
-			print_vdev_tree(zhp, "logs", nvroot, 0, B_TRUE,
-			    name_flags);
+		print_vdev_tree(zhp, NULL, nvroot, 0, NULL, name_flags);
+
+		/* Do the same for the dedup, special and log vdevs */
+		for (i = 0; i < ARRAY_SIZE(vdev_classes); i++) {
+			const char *class = vdev_classes[i].vc_flag;
+			const char *title = vdev_classes[i].vc_title;
+
+			if (num_in_class(poolnvroot, class) > 0) {
+				print_vdev_tree(zhp, title, poolnvroot, 0,
+				    class, name_flags);
+				print_vdev_tree(zhp, NULL, nvroot, 0,
+				    class, name_flags);
+			} else if (num_in_class(nvroot, class) > 0) {
+				print_vdev_tree(zhp, title, nvroot, 0,
+				    class, name_flags);
+			}
 		}
 
 		/* Do the same for the caches */
@@ -935,7 +1014,7 @@ errout:
 }
 
 /*
- * zpool create [-fnd] [-o property=value] ...
+ * zpool create [-fndS] [-o property=value] ...
  *		[-O file-system-property=value] ...
  *		[-R root] [-m mountpoint] <pool> <dev> ...
  *
@@ -949,6 +1028,7 @@ errout:
  *	-d	Don't automatically enable all supported pool features
  *		(individual features can be enabled with -o).
  *	-O	Set fsproperty=value in the pool's root file system
+ *	-S	Allocate sequentially from the data vdevs (SMR disks).
  *
  * Creates the named pool according to the given vdev specification.  The
  * bulk of the vdev processing is done in get_vdev_spec() in zpool_vdev.c.  Once
@@ -961,7 +1041,8 @@ zpool_do_create(int argc, char **argv)
 	boolean_t force = B_FALSE;
 	boolean_t dryrun = B_FALSE;
 	boolean_t enable_all_pool_feat = B_TRUE;
-	int c;
+	boolean_t sequential = B_FALSE;
+	int c, i;
 	nvlist_t *nvroot = NULL;
 	char *poolname;
 	char *tname = NULL;
@@ -973,7 +1054,7 @@ zpool_do_create(int argc, char **argv)
 	char *propval;
 
 	/* check options */
-	while ((c = getopt(argc, argv, ":fndR:m:o:O:t:")) != -1) {
+	while ((c = getopt(argc, argv, ":fndR:m:o:O:St:")) != -1) {
 		switch (c) {
 		case 'f':
 			force = B_TRUE;
@@ -984,6 +1065,9 @@ zpool_do_create(int argc, char **argv)
 		case 'd':
 			enable_all_pool_feat = B_FALSE;
 			break;
+		case 'S':
+			sequential = B_TRUE;
+			break;
 		case 'R':
 			altroot = optarg;
 			if (add_prop_list(zpool_prop_to_name(
@@ -1110,6 +1194,8 @@ zpool_do_create(int argc, char **argv)
 	    argc - 1, argv + 1);
 	if (nvroot == NULL)
 		goto errout;
+	if (sequential)
+		set_sequential(nvroot);
 
 	/* make_root_vdev() allows 0 toplevel children if there are spares */
 	if (!zfs_allocatable_devs(nvroot)) {
@@ -1208,9 +1294,12 @@ zpool_do_create(int argc, char **argv)
 		(void) printf(gettext("would create '%s' with the "
 		    "following layout:\n\n"), poolname);
 
-		print_vdev_tree(NULL, poolname, nvroot, 0, B_FALSE, 0);
-		if (num_logs(nvroot) > 0)
-			print_vdev_tree(NULL, "logs", nvroot, 0, B_TRUE, 0);
+		print_vdev_tree(NULL, poolname, nvroot, 0, NULL, 0);
+		for (i = 0; i < ARRAY_SIZE(vdev_classes); i++) {
+			if (num_in_class(nvroot, vdev_classes[i].vc_flag) > 0)
+				print_vdev_tree(NULL, vdev_classes[i].vc_title,
+				    nvroot, 0, vdev_classes[i].vc_flag, 0);
+		}
 
 		ret = 0;
 	} else {
@@ -1656,14 +1745,12 @@ print_status_config(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 	(void) printf("\n");
 
 	for (c = 0; c < children; c++) {
-		uint64_t islog = B_FALSE, ishole = B_FALSE;
+		uint64_t ishole = B_FALSE;
 
-		/* Don't print logs or holes here */
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
+		/* Don't print logs, special vdevs or holes here */
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
-		if (islog || ishole)
+		if (!vdev_in_class(child[c], NULL) || ishole)
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    name_flags | VDEV_NAME_TYPE_ID);
@@ -1738,11 +1825,7 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (is_log)
+		if (!vdev_in_class(child[c], NULL))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c],
@@ -1776,16 +1859,16 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 }
 
 /*
- * Print log vdevs.
- * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * Print log or special vdevs.
+ * Both are recorded as top level vdevs in the main pool child array
+ * but with "is_log" or "is_special" set to 1. We use either
+ * print_status_config() or print_import_config() to print the top level
+ * vdevs then any children (eg mirrored slogs) are printed recursively -
+ * which works because only the top level vdev is marked.
  */
 static void
-print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose,
-    int name_flags)
+print_class_vdevs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth,
+    boolean_t verbose, int name_flags, const char *class, const char *title)
 {
 	uint_t c, children;
 	nvlist_t **child;
@@ -1794,15 +1877,12 @@ print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose,
 	    &children) != 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
+	(void) printf("\t%s\n", title);
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
 		char *name;
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (!is_log)
+		if (!vdev_in_class(child[c], class))
 			continue;
 		name = zpool_vdev_name(g_zfs, zhp, child[c],
 		    name_flags | VDEV_NAME_TYPE_ID);
@@ -1833,7 +1913,7 @@ show_import(nvlist_t *config)
 	zpool_errata_t errata;
 	const char *health;
 	uint_t vsc;
-	int namewidth;
+	int namewidth, i;
 	char *comment;
 
 	verify(nvlist_lookup_string(config, ZPOOL_CONFIG_POOL_NAME,
@@ -2066,8 +2146,12 @@ show_import(nvlist_t *config)
 		namewidth = 10;
 
 	print_import_config(name, nvroot, namewidth, 0, 0);
-	if (num_logs(nvroot) > 0)
-		print_logs(NULL, nvroot, namewidth, B_FALSE, 0);
+	for (i = 0; i < ARRAY_SIZE(vdev_classes); i++) {
+		if (num_in_class(nvroot, vdev_classes[i].vc_flag) > 0)
+			print_class_vdevs(NULL, nvroot, namewidth, B_FALSE, 0,
+			    vdev_classes[i].vc_flag,
+			    gettext(vdev_classes[i].vc_title));
+	}
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -3351,7 +3435,7 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
     nvlist_t *newnv, iostat_cbdata_t *cb, int depth)
 {
 	nvlist_t **oldchild, **newchild;
-	uint_t c, children;
+	uint_t c, n, children;
 	vdev_stat_t *oldvs, *newvs, *calcvs;
 	vdev_stat_t zerovs = { 0 };
 	char *vname;
@@ -3457,15 +3541,12 @@ children:
 		return (ret);
 
 	for (c = 0; c < children; c++) {
-		uint64_t ishole = B_FALSE, islog = B_FALSE;
+		uint64_t ishole = B_FALSE;
 
 		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
 
-		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
-
-		if (ishole || islog)
+		if (ishole || !vdev_in_class(newchild[c], NULL))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
@@ -3476,30 +3557,29 @@ children:
 	}
 
 	/*
-	 * Log device section
+	 * Dedup, special and log device sections
 	 */
-
-	if (num_logs(newnv) > 0) {
-		if ((!(cb->cb_flags & IOS_ANYHISTO_M)) && !cb->cb_scripted &&
-		    !cb->cb_vdev_names) {
-			print_iostat_dashes(cb, 0, "logs");
-		}
+	for (n = 0; n < ARRAY_SIZE(vdev_classes); n++) {
+		const char *class = vdev_classes[n].vc_flag;
+		boolean_t printed = B_FALSE;
 
 		for (c = 0; c < children; c++) {
-			uint64_t islog = B_FALSE;
-			(void) nvlist_lookup_uint64(newchild[c],
-			    ZPOOL_CONFIG_IS_LOG, &islog);
-
-			if (islog) {
-				vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
-				    cb->cb_name_flags);
-				ret += print_vdev_stats(zhp, vname, oldnv ?
-				    oldchild[c] : NULL, newchild[c],
-				    cb, depth + 2);
-				free(vname);
+			if (!vdev_in_class(newchild[c], class))
+				continue;
+
+			if (!printed && (!(cb->cb_flags & IOS_ANYHISTO_M)) &&
+			    !cb->cb_scripted && !cb->cb_vdev_names) {
+				print_iostat_dashes(cb, 0,
+				    vdev_classes[n].vc_title);
 			}
-		}
+			printed = B_TRUE;
 
+			vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
+			    cb->cb_name_flags);
+			ret += print_vdev_stats(zhp, vname, oldnv ?
+			    oldchild[c] : NULL, newchild[c], cb, depth + 2);
+			free(vname);
+		}
 	}
 
 	/*
@@ -4473,11 +4553,12 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 {
 	nvlist_t **child;
 	vdev_stat_t *vs;
-	uint_t c, children;
+	uint_t c, n, children;
 	char *vname;
 	boolean_t scripted = cb->cb_scripted;
 	uint64_t islog = B_FALSE;
 	boolean_t haslog = B_FALSE;
+	boolean_t hasclass = B_FALSE;
 	char *dashes = "%-*s      -      -      -         -      -      -\n";
 
 	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
@@ -4535,12 +4616,37 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 			continue;
 		}
 
+		if (!vdev_in_class(child[c], NULL)) {
+			hasclass = B_TRUE;
+			continue;
+		}
+
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags);
 		print_list_stats(zhp, vname, child[c], cb, depth + 2);
 		free(vname);
 	}
 
+	for (n = 0; hasclass && n < ARRAY_SIZE(vdev_classes); n++) {
+		const char *class = vdev_classes[n].vc_flag;
+
+		if (strcmp(class, ZPOOL_CONFIG_IS_LOG) == 0 ||
+		    num_in_class(nv, class) == 0)
+			continue;
+
+		/* LINTED E_SEC_PRINTF_VAR_FMT */
+		(void) printf(dashes, cb->cb_namewidth,
+		    vdev_classes[n].vc_title);
+		for (c = 0; c < children; c++) {
+			if (!vdev_in_class(child[c], class))
+				continue;
+			vname = zpool_vdev_name(g_zfs, zhp, child[c],
+			    cb->cb_name_flags);
+			print_list_stats(zhp, vname, child[c], cb, depth + 2);
+			free(vname);
+		}
+	}
+
 	if (haslog == B_TRUE) {
 		/* LINTED E_SEC_PRINTF_VAR_FMT */
 		(void) printf(dashes, cb->cb_namewidth, "log");
@@ -5040,8 +5146,14 @@ zpool_do_split(int argc, char **argv)
 		if (flags.dryrun) {
 			(void) printf(gettext("would create '%s' with the "
 			    "following layout:\n\n"), newpool);
-			print_vdev_tree(NULL, newpool, config, 0, B_FALSE,
+			print_vdev_tree(NULL, newpool, config, 0, NULL,
 			    flags.name_flags);
+			if (num_in_class(config, ZPOOL_CONFIG_IS_DEDUP) > 0)
+				print_vdev_tree(NULL, "dedup", config, 0,
+				    ZPOOL_CONFIG_IS_DEDUP, flags.name_flags);
+			if (num_in_class(config, ZPOOL_CONFIG_IS_SPECIAL) > 0)
+				print_vdev_tree(NULL, "special", config, 0,
+				    ZPOOL_CONFIG_IS_SPECIAL, flags.name_flags);
 		}
 	}
 
@@ -5391,8 +5503,51 @@ typedef struct scrub_cbdata {
 	int	cb_type;
 	int	cb_argc;
 	char	**cb_argv;
+	uint64_t cb_min_txg;
+	uint64_t cb_max_txg;
+	nvlist_t *cb_datasets;
 } scrub_cbdata_t;
 
+/*
+ * The restrictions of the scrub of a pool, NULL for a plain scrub.  Of the
+ * datasets given with -d, those of the pool are passed on.
+ */
+static nvlist_t *
+scrub_opts(zpool_handle_t *zhp, scrub_cbdata_t *cb)
+{
+	const char *pool = zpool_get_name(zhp);
+	size_t len = strlen(pool);
+	nvlist_t *opts, *datasets;
+	nvpair_t *pair;
+
+	if (cb->cb_min_txg == 0 && cb->cb_max_txg == 0 &&
+	    cb->cb_datasets == NULL)
+		return (NULL);
+
+	opts = fnvlist_alloc();
+	if (cb->cb_min_txg != 0)
+		fnvlist_add_uint64(opts, ZPOOL_SCAN_MIN_TXG, cb->cb_min_txg);
+	if (cb->cb_max_txg != 0)
+		fnvlist_add_uint64(opts, ZPOOL_SCAN_MAX_TXG, cb->cb_max_txg);
+
+	if (cb->cb_datasets != NULL) {
+		datasets = fnvlist_alloc();
+		for (pair = nvlist_next_nvpair(cb->cb_datasets, NULL);
+		    pair != NULL;
+		    pair = nvlist_next_nvpair(cb->cb_datasets, pair)) {
+			const char *name = nvpair_name(pair);
+
+			if (strncmp(name, pool, len) == 0 &&
+			    (name[len] == '\0' || name[len] == '/'))
+				fnvlist_add_boolean(datasets, name);
+		}
+		fnvlist_add_nvlist(opts, ZPOOL_SCAN_DATASETS, datasets);
+		fnvlist_free(datasets);
+	}
+
+	return (opts);
+}
+
 int
 scrub_callback(zpool_handle_t *zhp, void *data)
 {
@@ -5408,30 +5563,101 @@ scrub_callback(zpool_handle_t *zhp, void *data)
 		return (1);
 	}
 
-	err = zpool_scan(zhp, cb->cb_type);
+	if (cb->cb_type == POOL_SCAN_SCRUB) {
+		nvlist_t *opts = scrub_opts(zhp, cb);
+		nvlist_t *datasets;
+
+		if (opts != NULL && nvlist_lookup_nvlist(opts,
+		    ZPOOL_SCAN_DATASETS, &datasets) == 0 &&
+		    nvlist_empty(datasets)) {
+			(void) fprintf(stderr, gettext("cannot scrub '%s': no "
+			    "datasets of the pool given\n"),
+			    zpool_get_name(zhp));
+			nvlist_free(opts);
+			return (1);
+		}
+
+		err = zpool_scan_restricted(zhp, cb->cb_type, opts);
+		nvlist_free(opts);
+	} else {
+		err = zpool_scan(zhp, cb->cb_type);
+	}
 
 	return (err != 0);
 }
 
 /*
- * zpool scrub [-s] <pool> ...
+ * Parse the [first]:[last] txg range of zpool scrub -t.
+ */
+static int
+scrub_parse_txgs(const char *arg, uint64_t *minp, uint64_t *maxp)
+{
+	const char *sep = strchr(arg, ':');
+	char *end;
+
+	if (sep == NULL)
+		return (-1);
+
+	*minp = *maxp = 0;
+	if (sep != arg) {
+		*minp = strtoull(arg, &end, 10);
+		if (end != sep)
+			return (-1);
+	}
+	if (sep[1] != '\0') {
+		*maxp = strtoull(sep + 1, &end, 10);
+		if (*end != '\0' || *maxp == 0)
+			return (-1);
+	}
+	if (*maxp != 0 && *minp > *maxp)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * zpool scrub [-s] [-t [first]:[last]] [-d dataset] ... <pool> ...
  *
+ *	-d	Only scrub the dataset and its snapshots.  May be repeated.
  *	-s	Stop.  Stops any in-progress scrub.
+ *	-t	Only scrub the blocks born from txg first to txg last.
  */
 int
 zpool_do_scrub(int argc, char **argv)
 {
-	int c;
+	int c, ret;
 	scrub_cbdata_t cb;
 
 	cb.cb_type = POOL_SCAN_SCRUB;
+	cb.cb_min_txg = 0;
+	cb.cb_max_txg = 0;
+	cb.cb_datasets = NULL;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "s")) != -1) {
+	while ((c = getopt(argc, argv, "d:st:")) != -1) {
 		switch (c) {
+		case 'd':
+			if (cb.cb_datasets == NULL)
+				cb.cb_datasets = fnvlist_alloc();
+			fnvlist_add_boolean(cb.cb_datasets, optarg);
+			break;
 		case 's':
 			cb.cb_type = POOL_SCAN_NONE;
 			break;
+		case 't':
+			if (scrub_parse_txgs(optarg, &cb.cb_min_txg,
+			    &cb.cb_max_txg) != 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid txg range '%s'\n"),
+				    optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -5449,7 +5675,94 @@ zpool_do_scrub(int argc, char **argv)
 		usage(B_FALSE);
 	}
 
-	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
+	if (cb.cb_type == POOL_SCAN_NONE &&
+	    (cb.cb_datasets != NULL || cb.cb_min_txg != 0 ||
+	    cb.cb_max_txg != 0)) {
+		(void) fprintf(stderr, gettext("-s cannot be combined with "
+		    "-d or -t\n"));
+		usage(B_FALSE);
+	}
+
+	ret = for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb);
+	nvlist_free(cb.cb_datasets);
+
+	return (ret);
+}
+
+typedef struct trim_cbdata {
+	pool_trim_func_t cb_func;
+	uint64_t	cb_rate;
+} trim_cbdata_t;
+
+int
+trim_callback(zpool_handle_t *zhp, void *data)
+{
+	trim_cbdata_t *cb = data;
+	int err;
+
+	/*
+	 * Ignore faulted pools.
+	 */
+	if (zpool_get_state(zhp) == POOL_STATE_UNAVAIL) {
+		(void) fprintf(stderr, gettext("cannot trim '%s': pool is "
+		    "currently unavailable\n"), zpool_get_name(zhp));
+		return (1);
+	}
+
+	err = zpool_trim(zhp, cb->cb_func, cb->cb_rate);
+
+	return (err != 0);
+}
+
+/*
+ * zpool trim [-s] [-r rate] <pool> ...
+ *
+ *	-r	Unmap at most rate bytes per second.
+ *	-s	Stop.  Stops any in-progress trim.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	int c;
+	trim_cbdata_t cb;
+
+	cb.cb_func = POOL_TRIM_START;
+	cb.cb_rate = 0;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "r:s")) != -1) {
+		switch (c) {
+		case 'r':
+			if (zfs_nicestrtonum(g_zfs, optarg, &cb.cb_rate) != 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid rate '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case 's':
+			cb.cb_func = POOL_TRIM_STOP;
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+
+	return (for_each_pool(argc, argv, B_TRUE, NULL, trim_callback, &cb));
 }
 
 typedef struct status_cbdata {
@@ -5656,6 +5969,7 @@ print_dedup_stats(nvlist_t *config)
 	ddt_histogram_t *ddh;
 	ddt_stat_t *dds;
 	ddt_object_t *ddo;
+	uint64_t pruned;
 	uint_t c;
 
 	/*
@@ -5679,6 +5993,12 @@ print_dedup_stats(nvlist_t *config)
 	    (u_longlong_t)ddo->ddo_dspace,
 	    (u_longlong_t)ddo->ddo_mspace);
 
+	if (nvlist_lookup_uint64(config, ZPOOL_CONFIG_DDT_PRUNED,
+	    &pruned) == 0) {
+		(void) printf(gettext("        %llu unique entries pruned\n"),
+		    (u_longlong_t)pruned);
+	}
+
 	verify(nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_DDT_STATS,
 	    (uint64_t **)&dds, &c) == 0);
 	verify(nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_DDT_HISTOGRAM,
@@ -5977,7 +6297,7 @@ status_callback(zpool_handle_t *zhp, void *data)
 		    msgid);
 
 	if (config != NULL) {
-		int namewidth;
+		int namewidth, i;
 		uint64_t nerr;
 		nvlist_t **spares, **l2cache;
 		uint_t nspares, nl2cache;
@@ -5997,9 +6317,14 @@ status_callback(zpool_handle_t *zhp, void *data)
 		print_status_config(zhp, zpool_get_name(zhp), nvroot,
 		    namewidth, 0, B_FALSE, cbp->cb_name_flags);
 
-		if (num_logs(nvroot) > 0)
-			print_logs(zhp, nvroot, namewidth, B_TRUE,
-			    cbp->cb_name_flags);
+		for (i = 0; i < ARRAY_SIZE(vdev_classes); i++) {
+			const char *class = vdev_classes[i].vc_flag;
+
+			if (num_in_class(nvroot, class) > 0)
+				print_class_vdevs(zhp, nvroot, namewidth,
+				    B_TRUE, cbp->cb_name_flags, class,
+				    gettext(vdev_classes[i].vc_title));
+		}
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, l2cache, nl2cache, namewidth,
@@ -6815,6 +7140,272 @@ zpool_do_history(int argc, char **argv)
 	return (ret);
 }
 
+/*
+ * Free segment size buckets shown by "zpool frag", each covering two powers
+ * of two from SPA_MINBLOCKSIZE; the last one counts everything larger.
+ */
+#define	FRAG_MIN_SHIFT		9
+#define	FRAG_BUCKETS		8
+
+typedef struct frag_row {
+	uint64_t	fr_space;
+	uint64_t	fr_alloc;
+	uint64_t	fr_frag_space;	/* space with a valid fragmentation */
+	uint64_t	fr_frag_sum;	/* fragmentation times that space */
+	uint64_t	fr_histo[FRAG_BUCKETS];
+} frag_row_t;
+
+typedef struct frag_cbdata {
+	boolean_t	cb_literal;
+	boolean_t	cb_first;
+} frag_cbdata_t;
+
+static const char *frag_gang_names[] = {
+	"gang_blocks",
+	"gang_bytes",
+	"gang_fragmented"
+};
+
+#define	FRAG_GANG_STATS		ARRAY_SIZE(frag_gang_names)
+
+/*
+ * Read the gang block counters of the pool's fragmentation kstat,
+ * kstat.zfs.<pool>.misc.fragmentation.
+ */
+static int
+frag_read_gangs(const char *pool, uint64_t *vals)
+{
+#ifdef __APPLE__
+	char name[MAXPATHLEN];
+	size_t len;
+	int i;
+
+	for (i = 0; i < FRAG_GANG_STATS; i++) {
+		(void) snprintf(name, sizeof (name),
+		    "kstat.zfs.%s.misc.fragmentation.%s", pool,
+		    frag_gang_names[i]);
+		len = sizeof (uint64_t);
+		if (sysctlbyname(name, &vals[i], &len, NULL, 0) != 0)
+			return (-1);
+	}
+
+	return (0);
+#else
+	char path[MAXPATHLEN], line[256], stat[64];
+	u_longlong_t value;
+	int i, found = 0;
+	FILE *fp;
+
+	(void) snprintf(path, sizeof (path),
+	    "/proc/spl/kstat/zfs/%s/fragmentation", pool);
+	if ((fp = fopen(path, "r")) == NULL)
+		return (-1);
+
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "%63s %*d %llu", stat, &value) != 2)
+			continue;
+		for (i = 0; i < FRAG_GANG_STATS; i++) {
+			if (strcmp(stat, frag_gang_names[i]) == 0) {
+				vals[i] = value;
+				found++;
+			}
+		}
+	}
+	(void) fclose(fp);
+
+	return (found == FRAG_GANG_STATS ? 0 : -1);
+#endif
+}
+
+/*
+ * Add the space, fragmentation and free segment histogram of the
+ * top-level vdev nv to fr.
+ */
+static void
+frag_row_add(nvlist_t *nv, frag_row_t *fr)
+{
+	nvlist_t *nvx;
+	vdev_stat_t *vs;
+	uint64_t *histo;
+	uint_t c, n;
+	int b;
+
+	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
+	    (uint64_t **)&vs, &c) == 0);
+	fr->fr_space += vs->vs_space;
+	fr->fr_alloc += vs->vs_alloc;
+	if (vs->vs_fragmentation != ZFS_FRAG_INVALID) {
+		fr->fr_frag_space += vs->vs_space;
+		fr->fr_frag_sum += vs->vs_fragmentation * vs->vs_space;
+	}
+
+	if (nvlist_lookup_nvlist(nv, ZPOOL_CONFIG_VDEV_STATS_EX, &nvx) != 0 ||
+	    nvlist_lookup_uint64_array(nvx, ZPOOL_CONFIG_VDEV_FREE_HISTO,
+	    &histo, &n) != 0)
+		return;
+
+	for (c = 0; c < n; c++) {
+		b = (c < FRAG_MIN_SHIFT) ? 0 : (c - FRAG_MIN_SHIFT) / 2;
+		fr->fr_histo[MIN(b, FRAG_BUCKETS - 1)] += histo[c];
+	}
+}
+
+static void
+frag_print_num(frag_cbdata_t *cb, uint64_t num, int width)
+{
+	char buf[32];
+
+	if (cb->cb_literal)
+		(void) snprintf(buf, sizeof (buf), "%llu", (u_longlong_t)num);
+	else
+		zfs_nicenum(num, buf, sizeof (buf));
+	(void) printf(" %*s", width, buf);
+}
+
+static void
+frag_print_row(frag_cbdata_t *cb, const char *name, int depth,
+    frag_row_t *fr)
+{
+	int b;
+
+	(void) printf("%*s%-*s", depth * 2, "", 20 - depth * 2, name);
+	if (fr->fr_frag_space == 0) {
+		(void) printf(" %4s", "-");
+	} else {
+		(void) printf(" %3llu%%", (u_longlong_t)
+		    (fr->fr_frag_sum / fr->fr_frag_space));
+	}
+	frag_print_num(cb, fr->fr_space - fr->fr_alloc, 6);
+	for (b = 0; b < FRAG_BUCKETS; b++)
+		frag_print_num(cb, fr->fr_histo[b], 5);
+	(void) printf("\n");
+}
+
+/*
+ * Print the free space of each allocation class of a pool, and of each
+ * of their top-level vdevs.
+ */
+static int
+frag_callback(zpool_handle_t *zhp, void *data)
+{
+	frag_cbdata_t *cb = data;
+	nvlist_t *config, *nvroot, **child;
+	static const char *class_flags[] = { NULL, ZPOOL_CONFIG_IS_DEDUP,
+		ZPOOL_CONFIG_IS_SPECIAL, ZPOOL_CONFIG_IS_LOG };
+	static const char *class_names[] = {
+		"normal", "dedup", "special", "log" };
+	uint64_t is_hole, gangs[FRAG_GANG_STATS];
+	uint_t c, children;
+	boolean_t missing;
+	frag_row_t fr;
+	char *vname;
+	int n, b;
+
+	if (zpool_refresh_stats(zhp, &missing) != 0 || missing)
+		return (0);
+
+	config = zpool_get_config(zhp, NULL);
+	verify(nvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE,
+	    &nvroot) == 0);
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		children = 0;
+
+	if (!cb->cb_first)
+		(void) printf("\n");
+	cb->cb_first = B_FALSE;
+
+	(void) printf(gettext("pool: %s\n"), zpool_get_name(zhp));
+	(void) printf("%-20s %4s %6s", gettext("NAME"), gettext("FRAG"),
+	    gettext("FREE"));
+	for (b = 0; b < FRAG_BUCKETS; b++) {
+		char buf[32];
+
+		zfs_nicenum(1ULL << (FRAG_MIN_SHIFT + 2 * b), buf,
+		    sizeof (buf));
+		if (b == FRAG_BUCKETS - 1)
+			(void) strlcat(buf, "+", sizeof (buf));
+		(void) printf(" %5s", buf);
+	}
+	(void) printf("\n");
+
+	for (n = 0; n < ARRAY_SIZE(class_flags); n++) {
+		boolean_t found = B_FALSE;
+
+		bzero(&fr, sizeof (fr));
+		for (c = 0; c < children; c++) {
+			is_hole = 0;
+			(void) nvlist_lookup_uint64(child[c],
+			    ZPOOL_CONFIG_IS_HOLE, &is_hole);
+			if (is_hole || !vdev_in_class(child[c], class_flags[n]))
+				continue;
+			frag_row_add(child[c], &fr);
+			found = B_TRUE;
+		}
+		if (!found)
+			continue;
+		frag_print_row(cb, class_names[n], 0, &fr);
+
+		for (c = 0; c < children; c++) {
+			is_hole = 0;
+			(void) nvlist_lookup_uint64(child[c],
+			    ZPOOL_CONFIG_IS_HOLE, &is_hole);
+			if (is_hole || !vdev_in_class(child[c], class_flags[n]))
+				continue;
+			bzero(&fr, sizeof (fr));
+			frag_row_add(child[c], &fr);
+			vname = zpool_vdev_name(g_zfs, zhp, child[c], 0);
+			frag_print_row(cb, vname, 1, &fr);
+			free(vname);
+		}
+	}
+
+	if (frag_read_gangs(zpool_get_name(zhp), gangs) == 0) {
+		(void) printf(gettext("gang blocks:"));
+		frag_print_num(cb, gangs[0], 0);
+		(void) printf(gettext(", bytes:"));
+		frag_print_num(cb, gangs[1], 0);
+		(void) printf(gettext(", due to fragmentation:"));
+		frag_print_num(cb, gangs[2], 0);
+		(void) printf("\n");
+	}
+
+	return (0);
+}
+
+/*
+ * zpool frag [-p] [pool] ...
+ *
+ *	-p	Display values in parsable (exact) format.
+ *
+ * Displays the fragmentation, free space and free segment size histogram
+ * of each allocation class and top-level vdev of the given pools, and the
+ * number of gang blocks written for lack of large enough free segments.
+ */
+int
+zpool_do_frag(int argc, char **argv)
+{
+	frag_cbdata_t cb = { 0 };
+	int c;
+
+	cb.cb_first = B_TRUE;
+	while ((c = getopt(argc, argv, "p")) != -1) {
+		switch (c) {
+		case 'p':
+			cb.cb_literal = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	return (for_each_pool(argc, argv, B_TRUE, NULL, frag_callback, &cb));
+}
+
 typedef struct ev_opts {
 	int verbose;
 	int scripted;
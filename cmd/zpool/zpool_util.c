@@ -86,6 +86,31 @@ num_logs(nvlist_t *nv)
 	return (nlogs);
 }
 
+/*
+ * Count the top-level vdevs with the given class flag, such as
+ * ZPOOL_CONFIG_IS_SPECIAL, set.
+ */
+uint_t
+num_in_class(nvlist_t *nv, const char *class)
+{
+	uint_t nclass = 0;
+	uint_t c, children;
+	nvlist_t **child;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (0);
+
+	for (c = 0; c < children; c++) {
+		uint64_t in_class = B_FALSE;
+
+		(void) nvlist_lookup_uint64(child[c], class, &in_class);
+		if (in_class)
+			nclass++;
+	}
+	return (nclass);
+}
+
 /* Find the max element in an array of uint64_t values */
 uint64_t
 array64_max(uint64_t array[], unsigned int len) {
@@ -863,16 +863,21 @@ get_replication(nvlist_t *nvroot, boolean_t fatal)
 	    &top, &toplevels) == 0);
 
 	for (t = 0; t < toplevels; t++) {
-		uint64_t is_log = B_FALSE;
+		uint64_t is_log = B_FALSE, is_special = B_FALSE;
+		uint64_t is_dedup = B_FALSE;
 
 		nv = top[t];
 
 		/*
-		 * For separate logs we ignore the top level vdev replication
-		 * constraints.
+		 * For separate logs, special and dedup vdevs we ignore the
+		 * top level vdev replication constraints.
 		 */
 		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG, &is_log);
-		if (is_log)
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL,
+		    &is_special);
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_DEDUP,
+		    &is_dedup);
+		if (is_log || is_special || is_dedup)
 			continue;
 
 		verify(nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE,
@@ -1472,6 +1477,18 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_LOG);
 	}
 
+	if (strcmp(type, "special") == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_TYPE_SPECIAL);
+	}
+
+	if (strcmp(type, "dedup") == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_TYPE_DEDUP);
+	}
+
 	if (strcmp(type, "cache") == 0) {
 		if (mindev != NULL)
 			*mindev = 1;
@@ -1492,9 +1509,10 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 {
 	nvlist_t *nvroot, *nv, **top, **spares, **l2cache;
 	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache;
+	int nspecial, ndedup;
 	const char *type;
-	uint64_t is_log;
-	boolean_t seen_logs;
+	uint64_t is_log, is_special, is_dedup;
+	boolean_t seen_logs, seen_special, seen_dedup;
 
 	top = NULL;
 	toplevels = 0;
@@ -1503,8 +1521,14 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	nspares = 0;
 	nlogs = 0;
 	nl2cache = 0;
+	nspecial = 0;
+	ndedup = 0;
 	is_log = B_FALSE;
+	is_special = B_FALSE;
+	is_dedup = B_FALSE;
 	seen_logs = B_FALSE;
+	seen_special = B_FALSE;
+	seen_dedup = B_FALSE;
 
 	while (argc > 0) {
 		nv = NULL;
@@ -1526,6 +1550,8 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					return (NULL);
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
+				is_dedup = B_FALSE;
 			}
 
 			if (strcmp(type, VDEV_TYPE_LOG) == 0) {
@@ -1538,6 +1564,8 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				}
 				seen_logs = B_TRUE;
 				is_log = B_TRUE;
+				is_special = B_FALSE;
+				is_dedup = B_FALSE;
 				argc--;
 				argv++;
 				/*
@@ -1547,6 +1575,45 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				continue;
 			}
 
+			if (strcmp(type, VDEV_TYPE_SPECIAL) == 0) {
+				if (seen_special) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: 'special' can be "
+					    "specified only once\n"));
+					return (NULL);
+				}
+				seen_special = B_TRUE;
+				is_special = B_TRUE;
+				is_log = B_FALSE;
+				is_dedup = B_FALSE;
+				argc--;
+				argv++;
+				/*
+				 * Like a log, special is not a real grouping
+				 * device.  We just set is_special and continue.
+				 */
+				continue;
+			}
+
+			if (strcmp(type, VDEV_TYPE_DEDUP) == 0) {
+				if (seen_dedup) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: 'dedup' can be "
+					    "specified only once\n"));
+					return (NULL);
+				}
+				seen_dedup = B_TRUE;
+				is_dedup = B_TRUE;
+				is_log = B_FALSE;
+				is_special = B_FALSE;
+				argc--;
+				argv++;
+				/* Nor is dedup.  We just set is_dedup. */
+				continue;
+			}
+
 			if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
 				if (l2cache != NULL) {
 					(void) fprintf(stderr,
@@ -1556,6 +1623,8 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					return (NULL);
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
+				is_dedup = B_FALSE;
 			}
 
 			if (is_log) {
@@ -1569,6 +1638,28 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				nlogs++;
 			}
 
+			if (is_special) {
+				if (strcmp(type, VDEV_TYPE_MIRROR) != 0) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: unsupported "
+					    "'special' device: %s\n"), type);
+					return (NULL);
+				}
+				nspecial++;
+			}
+
+			if (is_dedup) {
+				if (strcmp(type, VDEV_TYPE_MIRROR) != 0) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: unsupported "
+					    "'dedup' device: %s\n"), type);
+					return (NULL);
+				}
+				ndedup++;
+			}
+
 			for (c = 1; c < argc; c++) {
 				if (is_grouping(argv[c], NULL, NULL) != NULL)
 					break;
@@ -1615,6 +1706,16 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				    type) == 0);
 				verify(nvlist_add_uint64(nv,
 				    ZPOOL_CONFIG_IS_LOG, is_log) == 0);
+				if (is_special) {
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_IS_SPECIAL,
+					    is_special) == 0);
+				}
+				if (is_dedup) {
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_IS_DEDUP,
+					    is_dedup) == 0);
+				}
 				if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
 					verify(nvlist_add_uint64(nv,
 					    ZPOOL_CONFIG_NPARITY,
@@ -1638,6 +1739,16 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				return (NULL);
 			if (is_log)
 				nlogs++;
+			if (is_special) {
+				verify(nvlist_add_uint64(nv,
+				    ZPOOL_CONFIG_IS_SPECIAL, is_special) == 0);
+				nspecial++;
+			}
+			if (is_dedup) {
+				verify(nvlist_add_uint64(nv,
+				    ZPOOL_CONFIG_IS_DEDUP, is_dedup) == 0);
+				ndedup++;
+			}
 			argc--;
 			argv++;
 		}
@@ -1662,6 +1773,18 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		return (NULL);
 	}
 
+	if (seen_special && nspecial == 0) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "special requires at least 1 device\n"));
+		return (NULL);
+	}
+
+	if (seen_dedup && ndedup == 0) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "dedup requires at least 1 device\n"));
+		return (NULL);
+	}
+
 	/*
 	 * Finally, create nvroot and add all top-level vdevs to it.
 	 */
@@ -29,16 +29,22 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libnvpair.h>
+#include <libzfs.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <sys/dmu.h>
 #include <sys/zfs_ioctl.h>
 #include <sys/zio.h>
+#include <sys/zio_compress.h>
 #include <zfs_fletcher.h>
 
 /*
@@ -50,6 +56,14 @@
  * by newlines or spaces
  */
 #define	DUMP_GROUPING	4
+/*
+ * Size of the stdio buffer used when the stream can not be mapped
+ */
+#define	STREAM_BUFSIZE	(1024 * 1024)
+/*
+ * Buckets of the compressibility histogram, in tenths of the logical size
+ */
+#define	RATIO_BUCKETS	11
 
 uint64_t total_write_size = 0;
 uint64_t total_stream_len = 0;
@@ -57,14 +71,37 @@ FILE *send_stream = 0;
 boolean_t do_byteswap = B_FALSE;
 boolean_t do_cksum = B_TRUE;
 
+/*
+ * If the stream is a regular file named on the command line, it is mapped
+ * and records are checksummed and examined in place.
+ */
+char *stream_map = NULL;
+size_t stream_map_len = 0;
+size_t stream_map_off = 0;
+
+/*
+ * Statistics gathered in stats mode
+ */
+boolean_t do_stats = B_FALSE;
+uint64_t write_size_histo[SPA_MAXBLOCKSHIFT + 1] = { 0 };
+uint64_t write_ratio_histo[RATIO_BUCKETS] = { 0 };
+uint64_t object_blksz_histo[SPA_MAXBLOCKSHIFT + 1] = { 0 };
+uint64_t object_type_count[DMU_OT_NUMTYPES + 1] = { 0 };
+uint64_t total_logical_size = 0;
+uint64_t total_est_psize = 0;
+char *compress_buf = NULL;
+
 static void
 usage(void)
 {
-	(void) fprintf(stderr, "usage: zstreamdump [-v] [-C] [-d] < file\n");
+	(void) fprintf(stderr,
+	    "usage: zstreamdump [-v] [-C] [-d] [-s] [file] < file\n");
 	(void) fprintf(stderr, "\t -v -- verbose\n");
 	(void) fprintf(stderr, "\t -C -- suppress checksum verification\n");
 	(void) fprintf(stderr, "\t -d -- dump contents of blocks modified, "
 	    "implies verbose\n");
+	(void) fprintf(stderr, "\t -s -- print histograms of the stream "
+	    "contents\n");
 	exit(1);
 }
 
@@ -80,6 +117,40 @@ safe_malloc(size_t size)
 	return (rv);
 }
 
+/*
+ * ssget - send stream get.
+ *
+ * Return the next len bytes of the stream while computing incremental
+ * checksum.  If the stream is mapped they are returned in place, otherwise
+ * they are read into buf, which must have room for them.  Returns NULL at
+ * the end of the stream.
+ */
+static void *
+ssget(void *buf, size_t len, zio_cksum_t *cksum)
+{
+	void *data = buf;
+
+	if (stream_map != NULL) {
+		if (stream_map_len - stream_map_off < len) {
+			stream_map_off = stream_map_len;
+			return (NULL);
+		}
+		data = stream_map + stream_map_off;
+		stream_map_off += len;
+	} else if (fread(buf, len, 1, send_stream) == 0) {
+		return (NULL);
+	}
+
+	if (do_cksum) {
+		if (do_byteswap)
+			fletcher_4_incremental_byteswap(data, len, cksum);
+		else
+			fletcher_4_incremental_native(data, len, cksum);
+	}
+	total_stream_len += len;
+	return (data);
+}
+
 /*
  * ssread - send stream read.
  *
@@ -88,19 +159,171 @@ safe_malloc(size_t size)
 static size_t
 ssread(void *buf, size_t len, zio_cksum_t *cksum)
 {
-	size_t outlen;
+	void *data;
 
-	if ((outlen = fread(buf, len, 1, send_stream)) == 0)
+	if ((data = ssget(buf, len, cksum)) == NULL)
 		return (0);
+	if (data != buf)
+		bcopy(data, buf, len);
+	return (1);
+}
 
-	if (do_cksum) {
-		if (do_byteswap)
-			fletcher_4_incremental_byteswap(buf, len, cksum);
+/*
+ * Open the stream named on the command line, mapping it if it is a
+ * regular file.
+ */
+static void
+open_stream(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if ((send_stream = fopen(path, "r")) == NULL) {
+		(void) fprintf(stderr, "Error: can not open %s: %s\n",
+		    path, strerror(errno));
+		exit(1);
+	}
+	fd = fileno(send_stream);
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0 || (uint64_t)st.st_size > SIZE_MAX)
+		return;
+
+	stream_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (stream_map == MAP_FAILED) {
+		stream_map = NULL;
+		return;
+	}
+	stream_map_len = st.st_size;
+	(void) madvise(stream_map, stream_map_len, MADV_SEQUENTIAL);
+}
+
+/*
+ * Index of the power of two histogram bucket holding size
+ */
+static int
+size_bucket(uint64_t size)
+{
+	int b = 0;
+
+	while (b < SPA_MAXBLOCKSHIFT && (2ULL << b) <= size)
+		b++;
+	return (b);
+}
+
+/*
+ * Account a data block in the stats.  If the stream did not carry it
+ * compressed, estimate how well it would compress with lz4 the same way
+ * zio_compress_data() would, requiring a 12.5% saving.
+ */
+static void
+stats_add_write(void *data, uint64_t lsize, uint64_t psize)
+{
+	if (lsize == 0)
+		return;
+
+	if (psize == 0) {
+		size_t d_len = lsize - (lsize >> 3);
+
+		psize = lz4_compress_zfs(data, compress_buf, lsize, d_len, 0);
+		if (psize > d_len)
+			psize = lsize;
+	}
+
+	write_size_histo[size_bucket(lsize)]++;
+	write_ratio_histo[MIN(psize * 10 / lsize, RATIO_BUCKETS - 1)]++;
+	total_logical_size += lsize;
+	total_est_psize += psize;
+}
+
+const char histo_stars[] = "****************************************";
+const int histo_width = sizeof (histo_stars) - 1;
+
+/*
+ * Print a histogram, labelling bucket i as a size of 2^i bytes if sizes is
+ * set, or as a percentage of i * scale otherwise.
+ */
+static void
+print_histogram(const char *title, const uint64_t *histo, int size,
+    boolean_t sizes, int scale)
+{
+	int i;
+	int minidx = size - 1;
+	int maxidx = 0;
+	uint64_t max = 0;
+
+	for (i = 0; i < size; i++) {
+		if (histo[i] > max)
+			max = histo[i];
+		if (histo[i] > 0 && i > maxidx)
+			maxidx = i;
+		if (histo[i] > 0 && i < minidx)
+			minidx = i;
+	}
+	if (max == 0)
+		return;
+
+	(void) printf("\t%s:\n", title);
+	if (max < histo_width)
+		max = histo_width;
+
+	for (i = minidx; i <= maxidx; i++) {
+		char label[32];
+
+		if (sizes)
+			zfs_nicenum(1ULL << i, label, sizeof (label));
 		else
-			fletcher_4_incremental_native(buf, len, cksum);
+			(void) snprintf(label, sizeof (label), "%d%%",
+			    i * scale);
+		(void) printf("\t\t%6s: %10llu %s\n", label,
+		    (u_longlong_t)histo[i],
+		    &histo_stars[(max - histo[i]) * histo_width / max]);
+	}
+}
+
+static void
+print_stats(const uint64_t *drr_record_count)
+{
+	static const char *drr_names[DRR_NUMTYPES] = {
+		"BEGIN", "OBJECT", "FREEOBJECTS", "WRITE", "FREE", "END",
+		"WRITE_BYREF", "SPILL", "WRITE_EMBEDDED"
+	};
+	uint64_t max = 0;
+	int i;
+
+	(void) printf("STATISTICS:\n");
+	(void) printf("\tRecords by type:\n");
+	for (i = 0; i < DRR_NUMTYPES; i++)
+		max = MAX(max, drr_record_count[i]);
+	if (max < histo_width)
+		max = histo_width;
+	for (i = 0; i < DRR_NUMTYPES; i++) {
+		if (drr_record_count[i] == 0)
+			continue;
+		(void) printf("\t\t%14s: %10llu %s\n", drr_names[i],
+		    (u_longlong_t)drr_record_count[i],
+		    &histo_stars[(max - drr_record_count[i]) *
+		    histo_width / max]);
+	}
+
+	(void) printf("\tObjects by type:\n");
+	for (i = 0; i <= DMU_OT_NUMTYPES; i++) {
+		if (object_type_count[i] == 0)
+			continue;
+		(void) printf("\t\t%10llu %s\n",
+		    (u_longlong_t)object_type_count[i],
+		    i < DMU_OT_NUMTYPES ? dmu_ot[i].ot_name : "other");
+	}
+
+	print_histogram("Object block sizes", object_blksz_histo,
+	    SPA_MAXBLOCKSHIFT + 1, B_TRUE, 0);
+	print_histogram("Write logical sizes", write_size_histo,
+	    SPA_MAXBLOCKSHIFT + 1, B_TRUE, 0);
+	print_histogram("Write compressed/logical size", write_ratio_histo,
+	    RATIO_BUCKETS, B_FALSE, 10);
+	if (total_est_psize != 0) {
+		(void) printf("\tEstimated compression ratio = %.2fx\n",
+		    (double)total_logical_size / total_est_psize);
 	}
-	total_stream_len += len;
-	return (outlen);
 }
 
 static size_t
@@ -213,6 +436,7 @@ main(int argc, char *argv[])
 	struct drr_spill *drrs = &thedrr.drr_u.drr_spill;
 	struct drr_write_embedded *drrwe = &thedrr.drr_u.drr_write_embedded;
 	struct drr_checksum *drrc = &thedrr.drr_u.drr_checksum;
+	void *data;
 	char c;
 	boolean_t verbose = B_FALSE;
 	boolean_t very_verbose = B_FALSE;
@@ -227,7 +451,7 @@ main(int argc, char *argv[])
 	zio_cksum_t zc = { { 0 } };
 	zio_cksum_t pcksum = { { 0 } };
 
-	while ((c = getopt(argc, argv, ":vCd")) != -1) {
+	while ((c = getopt(argc, argv, ":vCds")) != -1) {
 		switch (c) {
 		case 'C':
 			do_cksum = B_FALSE;
@@ -242,6 +466,9 @@ main(int argc, char *argv[])
 			verbose = B_TRUE;
 			very_verbose = B_TRUE;
 			break;
+		case 's':
+			do_stats = B_TRUE;
+			break;
 		case ':':
 			(void) fprintf(stderr,
 			    "missing argument for '%c' option\n", optopt);
@@ -255,15 +482,30 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (isatty(STDIN_FILENO)) {
+	if (argc - optind > 1) {
+		(void) fprintf(stderr, "too many arguments\n");
+		usage();
+	}
+
+	if (optind < argc) {
+		open_stream(argv[optind]);
+	} else if (isatty(STDIN_FILENO)) {
 		(void) fprintf(stderr,
 		    "Error: Backup stream can not be read "
 		    "from a terminal.\n"
 		    "You must redirect standard input.\n");
 		exit(1);
+	} else {
+		send_stream = stdin;
+	}
+	if (stream_map == NULL)
+		(void) setvbuf(send_stream, NULL, _IOFBF, STREAM_BUFSIZE);
+
+	if (do_stats) {
+		lz4_init();
+		compress_buf = safe_malloc(SPA_MAXBLOCKSIZE);
 	}
 
-	send_stream = stdin;
 	pcksum = zc;
 	while (read_hdr(drr, &zc)) {
 
@@ -416,18 +658,26 @@ main(int argc, char *argv[])
 			}
 			if (verbose) {
 				(void) printf("OBJECT object = %llu type = %u "
-				    "bonustype = %u blksz = %u bonuslen = %u\n",
+				    "bonustype = %u blksz = %u bonuslen = %u "
+				    "dn_slots = %u\n",
 				    (u_longlong_t)drro->drr_object,
 				    drro->drr_type,
 				    drro->drr_bonustype,
 				    drro->drr_blksz,
-				    drro->drr_bonuslen);
+				    drro->drr_bonuslen,
+				    drro->drr_dn_slots);
+			}
+			if (do_stats) {
+				object_type_count[MIN(drro->drr_type,
+				    DMU_OT_NUMTYPES)]++;
+				object_blksz_histo[
+				    size_bucket(drro->drr_blksz)]++;
 			}
 			if (drro->drr_bonuslen > 0) {
-				(void) ssread(buf,
+				data = ssget(buf,
 				    P2ROUNDUP(drro->drr_bonuslen, 8), &zc);
-				if (dump) {
-					print_block(buf,
+				if (dump && data != NULL) {
+					print_block(data,
 					    P2ROUNDUP(drro->drr_bonuslen, 8));
 				}
 			}
@@ -490,12 +740,17 @@ main(int argc, char *argv[])
 			/*
 			 * Read the contents of the block in from STDIN to buf
 			 */
-			(void) ssread(buf, payload_size, &zc);
+			data = ssget(buf, payload_size, &zc);
 			/*
 			 * If in dump mode
 			 */
-			if (dump) {
-				print_block(buf, payload_size);
+			if (dump && data != NULL) {
+				print_block(data, payload_size);
+			}
+			if (do_stats && data != NULL) {
+				stats_add_write(data, drrw->drr_logical_size,
+				    DRR_WRITE_COMPRESSED(drrw) ?
+				    drrw->drr_compressed_size : 0);
 			}
 			total_write_size += payload_size;
 			break;
@@ -561,9 +816,9 @@ main(int argc, char *argv[])
 				    "length = %llu\n", drrs->drr_object,
 				    drrs->drr_length);
 			}
-			(void) ssread(buf, drrs->drr_length, &zc);
-			if (dump) {
-				print_block(buf, drrs->drr_length);
+			data = ssget(buf, drrs->drr_length, &zc);
+			if (dump && data != NULL) {
+				print_block(data, drrs->drr_length);
 			}
 			break;
 		case DRR_WRITE_EMBEDDED:
@@ -595,8 +850,12 @@ main(int argc, char *argv[])
 				    drrwe->drr_lsize,
 				    drrwe->drr_psize);
 			}
-			(void) ssread(buf,
+			(void) ssget(buf,
 			    P2ROUNDUP(drrwe->drr_psize, 8), &zc);
+			if (do_stats) {
+				stats_add_write(NULL, drrwe->drr_lsize,
+				    drrwe->drr_psize);
+			}
 			break;
 		case DRR_NUMTYPES:
 				break;
@@ -611,6 +870,10 @@ main(int argc, char *argv[])
 		pcksum = zc;
 	}
 	free(buf);
+	if (stream_map != NULL)
+		(void) munmap(stream_map, stream_map_len);
+	if (send_stream != stdin)
+		(void) fclose(send_stream);
 
 	/* Print final summary */
 
@@ -639,5 +902,11 @@ main(int argc, char *argv[])
 	    (u_longlong_t)total_write_size, (u_longlong_t)total_write_size);
 	(void) printf("\tTotal stream length = %lld (0x%llx)\n",
 	    (u_longlong_t)total_stream_len, (u_longlong_t)total_stream_len);
+
+	if (do_stats) {
+		print_stats(drr_record_count);
+		free(compress_buf);
+		lz4_fini();
+	}
 	return (0);
 }
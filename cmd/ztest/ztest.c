@@ -99,10 +99,12 @@
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zil.h>
 #include <sys/zil_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
+#include <sys/vdev_raidz.h>
 #include <sys/spa_impl.h>
 #include <sys/metaslab_impl.h>
 #include <sys/dsl_prop.h>
@@ -164,6 +166,8 @@ typedef struct ztest_shared_opts {
 	uint64_t zo_time;
 	uint64_t zo_maxloops;
 	uint64_t zo_metaslab_gang_bang;
+	uint64_t zo_perf_rate;
+	uint64_t zo_seed;
 } ztest_shared_opts_t;
 
 static const ztest_shared_opts_t ztest_opts_defaults = {
@@ -185,7 +189,9 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_init = 1,
 	.zo_time = 300,			/* 5 minutes */
 	.zo_maxloops = 50,		/* max loops during spa_freeze() */
-	.zo_metaslab_gang_bang = 32 << 10
+	.zo_metaslab_gang_bang = 32 << 10,
+	.zo_perf_rate = 0,		/* correctness mode */
+	.zo_seed = 0			/* pick one */
 };
 
 extern uint64_t metaslab_gang_bang;
@@ -339,6 +345,7 @@ ztest_func_t ztest_vdev_aux_add_remove;
 ztest_func_t ztest_split_pool;
 ztest_func_t ztest_reguid;
 ztest_func_t ztest_spa_upgrade;
+ztest_func_t ztest_vdev_raidz_math;
 
 uint64_t zopt_always = 0ULL * NANOSEC;		/* all the time */
 uint64_t zopt_incessant = 1ULL * NANOSEC / 10;	/* every 1/10 second */
@@ -379,6 +386,7 @@ ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_spa_rename, 1, &zopt_rarely),
 	ZTI_INIT(ztest_scrub, 1, &zopt_rarely),
 	ZTI_INIT(ztest_spa_upgrade, 1, &zopt_rarely),
+	ZTI_INIT(ztest_vdev_raidz_math, 1, &zopt_rarely),
 	ZTI_INIT(ztest_dsl_dataset_promote_busy, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_attach_detach, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_vdev_LUN_growth, 1, &zopt_rarely),
@@ -639,6 +647,9 @@ usage(boolean_t requested)
 	    "\t[-F freezeloops (default: %llu)] max loops in spa_freeze()\n"
 	    "\t[-P passtime (default: %llu sec)] time per pass\n"
 	    "\t[-B alt_ztest (default: <none>)] alternate ztest path\n"
+	    "\t[-X ops_per_sec (default: off)] run the performance mode\n"
+	    "\t    at a fixed rate instead of the correctness tests\n"
+	    "\t[-S seed (default: random)] seed for the performance mode\n"
 	    "\t[-o variable=value] ... set global variable to an unsigned\n"
 	    "\t    32-bit integer value\n"
 	    "\t[-h] (print help)\n"
@@ -676,7 +687,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:hF:B:o:"
+	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:hF:B:o:X:S:"
 	    )) != EOF) {
 		value = 0;
 		switch (opt) {
@@ -694,6 +705,8 @@ process_options(int argc, char **argv)
 		case 'T':
 		case 'P':
 		case 'F':
+		case 'X':
+		case 'S':
 			value = nicenumtoull(optarg);
 		}
 		switch (opt) {
@@ -764,6 +777,12 @@ process_options(int argc, char **argv)
 		case 'B':
 			(void) strlcpy(altdir, optarg, sizeof (altdir));
 			break;
+		case 'X':
+			zo->zo_perf_rate = MAX(1, value);
+			break;
+		case 'S':
+			zo->zo_seed = value;
+			break;
 		case 'o':
 			if (set_global_var(optarg) != 0)
 				usage(B_FALSE);
@@ -1918,14 +1937,14 @@ ztest_get_done(zgd_t *zgd, int error)
 	ztest_object_unlock(zd, object);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	umem_free(zgd, sizeof (*zgd));
 }
 
 static int
-ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
-			   struct znode *zp, struct rl *rl)
+ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio, struct znode *zp, struct rl *rl)
 {
 	ztest_ds_t *zd = arg;
 	objset_t *os = zd->zd_os;
@@ -1960,7 +1979,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 	db = NULL;
 
 	zgd = umem_zalloc(sizeof (*zgd), UMEM_NOFAIL);
-	zgd->zgd_zilog = zd->zd_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zd;
 
 	if (buf != NULL) {	/* immediate write */
@@ -3293,7 +3312,7 @@ static int
 ztest_dataset_create(char *dsname)
 {
 	uint64_t zilset = ztest_random(100);
-	int err = dmu_objset_create(dsname, DMU_OST_OTHER, 0,
+	int err = dmu_objset_create(dsname, DMU_OST_OTHER, 0, NULL,
 	    ztest_objset_create_cb, NULL);
 
 	if (err || zilset < 80)
@@ -3458,7 +3477,7 @@ ztest_dmu_objset_create_destroy(ztest_ds_t *zd, uint64_t id)
 	 * Verify that we cannot create an existing dataset.
 	 */
 	VERIFY3U(EEXIST, ==,
-	    dmu_objset_create(name, DMU_OST_OTHER, 0, NULL, NULL));
+	    dmu_objset_create(name, DMU_OST_OTHER, 0, NULL, NULL, NULL));
 
 	/*
 	 * Verify that we can hold an objset that is also owned.
@@ -5262,7 +5281,7 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	enum zio_checksum checksum = spa_dedup_checksum(spa);
 	dmu_buf_t *db;
 	dmu_tx_t *tx;
-	void *buf;
+	abd_t *abd;
 	blkptr_t blk;
 	int copies = 2 * ZIO_DEDUPDITTO_MIN;
 	int i;
@@ -5348,14 +5367,14 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	 * Damage the block.  Dedup-ditto will save us when we read it later.
 	 */
 	psize = BP_GET_PSIZE(&blk);
-	buf = zio_buf_alloc(psize);
-	ztest_pattern_set(buf, psize, ~pattern);
+	abd = abd_alloc_linear(psize, B_TRUE);
+	ztest_pattern_set(abd_to_buf(abd), psize, ~pattern);
 
 	(void) zio_wait(zio_rewrite(NULL, spa, 0, &blk,
-	    buf, psize, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
+	    abd, psize, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
 	    ZIO_FLAG_CANFAIL | ZIO_FLAG_INDUCE_DAMAGE, NULL));
 
-	zio_buf_free(buf, psize);
+	abd_free(abd);
 
 	(void) rw_unlock(&ztest_name_lock);
 	umem_free(od, sizeof (ztest_od_t));
@@ -5375,6 +5394,22 @@ ztest_scrub(ztest_ds_t *zd, uint64_t id)
 	(void) spa_scan(spa, POOL_SCAN_SCRUB);
 }
 
+/*
+ * Cross check every RAID-Z math implementation against the scalar code.
+ */
+/* ARGSUSED */
+void
+ztest_vdev_raidz_math(ztest_ds_t *zd, uint64_t id)
+{
+	uint64_t seed = ztest_random(-1ULL) | 1;
+	int error;
+
+	error = vdev_raidz_math_selftest(seed);
+	if (error != 0)
+		fatal(0, "vdev_raidz_math_selftest(%llu) = %d",
+		    (u_longlong_t)seed, error);
+}
+
 /*
  * Change the guid for the pool.
  */
@@ -6400,6 +6435,372 @@ ztest_run_init(void)
 	}
 }
 
+/*
+ * Performance mode (-X).  Instead of the randomized correctness tests,
+ * run a fixed mix of DMU writes, reads and frees against one dataset at
+ * a fixed aggregate rate and report throughput and latency percentiles
+ * for each operation type.  Every choice an I/O thread makes is drawn
+ * from its own generator seeded from -S, so two runs with the same
+ * options issue the same sequence of operations and their numbers can
+ * be compared across libzpool builds.
+ *
+ * Latency is measured from the time an operation was scheduled to
+ * start, not from when it was issued, so an operation which stalls
+ * also charges the operations queued up behind it.
+ */
+enum ztest_perf_op {
+	ZTEST_PERF_WRITE,
+	ZTEST_PERF_READ,
+	ZTEST_PERF_FREE,
+	ZTEST_PERF_OPS
+};
+
+static const char *ztest_perf_op_names[ZTEST_PERF_OPS] = {
+	"write", "read", "free"
+};
+
+/* percentage of the mix given to each operation type */
+static const int ztest_perf_op_mix[ZTEST_PERF_OPS] = { 50, 40, 10 };
+
+#define	ZTEST_PERF_MINSHIFT	12	/* 4K */
+#define	ZTEST_PERF_MAXSHIFT	SPA_OLD_MAXBLOCKSHIFT
+#define	ZTEST_PERF_RANGE	(8ULL << 20)	/* per-thread object size */
+
+/*
+ * Latencies are kept in logarithmic buckets with four linear steps per
+ * power of two, which bounds the error of a reported percentile to 25%.
+ */
+#define	ZTEST_PERF_BUCKETS	256
+
+typedef struct ztest_perf_stats {
+	uint64_t	zps_count;
+	uint64_t	zps_bytes;
+	uint64_t	zps_errors;
+	hrtime_t	zps_nsecs;
+	uint64_t	zps_hist[ZTEST_PERF_BUCKETS];
+} ztest_perf_stats_t;
+
+typedef struct ztest_perf_thread {
+	objset_t	*zpt_os;
+	uint64_t	zpt_object;
+	uint64_t	zpt_rand;
+	uint64_t	zpt_rate;
+	hrtime_t	zpt_start;
+	hrtime_t	zpt_stop;
+	uint64_t	zpt_late;
+	ztest_perf_stats_t zpt_stats[ZTEST_PERF_OPS];
+} ztest_perf_thread_t;
+
+/*
+ * xorshift64*; deterministic for a given seed, unlike ztest_random().
+ */
+static uint64_t
+ztest_perf_random(ztest_perf_thread_t *zpt, uint64_t range)
+{
+	uint64_t x = zpt->zpt_rand;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	zpt->zpt_rand = x;
+
+	if (range == 0)
+		return (0);
+
+	return ((x * 2685821657736338717ULL) % range);
+}
+
+static int
+ztest_perf_bucket(hrtime_t ns)
+{
+	int hb;
+
+	if (ns < 4)
+		return (MAX(ns, 0));
+
+	hb = highbit64(ns);
+	return (MIN(((hb - 3) << 2) + (ns >> (hb - 3)),
+	    ZTEST_PERF_BUCKETS - 1));
+}
+
+/* smallest latency which falls into bucket b + 1 */
+static hrtime_t
+ztest_perf_bucket_limit(int b)
+{
+	b++;
+	if (b < 4)
+		return (b);
+
+	return ((hrtime_t)((b & 3) + 4) << ((b >> 2) - 1));
+}
+
+static hrtime_t
+ztest_perf_percentile(const ztest_perf_stats_t *zps, int permille)
+{
+	uint64_t want, seen = 0;
+	int b;
+
+	if (zps->zps_count == 0)
+		return (0);
+
+	want = (zps->zps_count * permille + 999) / 1000;
+	for (b = 0; b < ZTEST_PERF_BUCKETS; b++) {
+		seen += zps->zps_hist[b];
+		if (seen >= want)
+			break;
+	}
+
+	return (ztest_perf_bucket_limit(MIN(b, ZTEST_PERF_BUCKETS - 1)));
+}
+
+static int
+ztest_perf_write(ztest_perf_thread_t *zpt, uint64_t offset, uint64_t size,
+    void *buf)
+{
+	dmu_tx_t *tx;
+	int error;
+
+	tx = dmu_tx_create(zpt->zpt_os);
+	dmu_tx_hold_write(tx, zpt->zpt_object, offset, size);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error != 0) {
+		dmu_tx_abort(tx);
+		return (error);
+	}
+	dmu_write(zpt->zpt_os, zpt->zpt_object, offset, size, buf, tx);
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+static void
+ztest_perf_thread(void *arg)
+{
+	ztest_perf_thread_t *zpt = arg;
+	void *buf = umem_alloc(1ULL << ZTEST_PERF_MAXSHIFT, UMEM_NOFAIL);
+	hrtime_t interval = MAX(NANOSEC / zpt->zpt_rate, 1);
+	hrtime_t next = zpt->zpt_start;
+	uint64_t i;
+
+	for (i = 0; i < (1ULL << ZTEST_PERF_MAXSHIFT) / sizeof (uint64_t); i++)
+		((uint64_t *)buf)[i] = ztest_perf_random(zpt, 0);
+
+	while (next < zpt->zpt_stop) {
+		ztest_perf_stats_t *zps;
+		uint64_t shift, size, offset, pick;
+		hrtime_t now, lat;
+		int op, error;
+
+		/*
+		 * Draw every choice before looking at the clock, so the
+		 * sequence of operations does not depend on timing.
+		 */
+		pick = ztest_perf_random(zpt, 100);
+		for (op = 0; op < ZTEST_PERF_OPS - 1; op++) {
+			if (pick < ztest_perf_op_mix[op])
+				break;
+			pick -= ztest_perf_op_mix[op];
+		}
+		shift = ZTEST_PERF_MINSHIFT + ztest_perf_random(zpt,
+		    ZTEST_PERF_MAXSHIFT - ZTEST_PERF_MINSHIFT + 1);
+		size = 1ULL << shift;
+		offset = ztest_perf_random(zpt, ZTEST_PERF_RANGE >> shift) <<
+		    shift;
+
+		now = gethrtime();
+		if (now < next) {
+			struct timespec ts;
+
+			ts.tv_sec = (next - now) / NANOSEC;
+			ts.tv_nsec = (next - now) % NANOSEC;
+			(void) nanosleep(&ts, NULL);
+		} else if (now - next > interval) {
+			zpt->zpt_late++;
+		}
+
+		switch (op) {
+		case ZTEST_PERF_WRITE:
+			error = ztest_perf_write(zpt, offset, size, buf);
+			break;
+		case ZTEST_PERF_READ:
+			error = dmu_read(zpt->zpt_os, zpt->zpt_object, offset,
+			    size, buf, DMU_READ_NO_PREFETCH);
+			break;
+		default:
+			error = dmu_free_long_range(zpt->zpt_os,
+			    zpt->zpt_object, offset, size);
+			break;
+		}
+
+		lat = gethrtime() - next;
+		zps = &zpt->zpt_stats[op];
+		if (error != 0) {
+			zps->zps_errors++;
+		} else {
+			zps->zps_count++;
+			zps->zps_bytes += size;
+			zps->zps_nsecs += lat;
+			zps->zps_hist[ztest_perf_bucket(lat)]++;
+		}
+
+		next += interval;
+	}
+
+	umem_free(buf, 1ULL << ZTEST_PERF_MAXSHIFT);
+	thread_exit();
+}
+
+static void
+ztest_perf_report(ztest_perf_thread_t *zpts, hrtime_t elapsed)
+{
+	ztest_perf_stats_t total;
+	uint64_t late = 0;
+	double secs = (double)MAX(elapsed, 1) / NANOSEC;
+	int t, op, b;
+
+	(void) printf("%-6s %10s %10s %10s %10s %10s %10s %10s %7s\n",
+	    "op", "count", "ops/s", "MB/s", "mean(us)", "p50(us)",
+	    "p99(us)", "p99.9(us)", "errors");
+
+	for (t = 0; t < ztest_opts.zo_threads; t++)
+		late += zpts[t].zpt_late;
+
+	for (op = 0; op < ZTEST_PERF_OPS; op++) {
+		bzero(&total, sizeof (total));
+		for (t = 0; t < ztest_opts.zo_threads; t++) {
+			ztest_perf_stats_t *zps = &zpts[t].zpt_stats[op];
+
+			total.zps_count += zps->zps_count;
+			total.zps_bytes += zps->zps_bytes;
+			total.zps_errors += zps->zps_errors;
+			total.zps_nsecs += zps->zps_nsecs;
+			for (b = 0; b < ZTEST_PERF_BUCKETS; b++)
+				total.zps_hist[b] += zps->zps_hist[b];
+		}
+
+		(void) printf("%-6s %10llu %10.1f %10.2f %10.1f %10.1f "
+		    "%10.1f %10.1f %7llu\n", ztest_perf_op_names[op],
+		    (u_longlong_t)total.zps_count,
+		    total.zps_count / secs,
+		    total.zps_bytes / secs / (1 << 20),
+		    total.zps_count == 0 ? 0.0 :
+		    (double)total.zps_nsecs / total.zps_count / 1000,
+		    (double)ztest_perf_percentile(&total, 500) / 1000,
+		    (double)ztest_perf_percentile(&total, 990) / 1000,
+		    (double)ztest_perf_percentile(&total, 999) / 1000,
+		    (u_longlong_t)total.zps_errors);
+	}
+
+	(void) printf("%llu operations started more than one interval late\n",
+	    (u_longlong_t)late);
+}
+
+static void
+ztest_perf(void)
+{
+	ztest_perf_thread_t *zpts;
+	kthread_t **threads;
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t rate;
+	objset_t *os;
+	spa_t *spa;
+	hrtime_t start;
+	int t;
+
+	if (ztest_opts.zo_seed == 0)
+		ztest_opts.zo_seed = ztest_random(UINT64_MAX - 1) + 1;
+	rate = MAX(ztest_opts.zo_perf_rate / ztest_opts.zo_threads, 1);
+
+	(void) printf("seed %llu, %d threads, %llu ops/s, %llu seconds\n",
+	    (u_longlong_t)ztest_opts.zo_seed, ztest_opts.zo_threads,
+	    (u_longlong_t)(rate * ztest_opts.zo_threads),
+	    (u_longlong_t)ztest_opts.zo_time);
+
+	kernel_init(FREAD | FWRITE);
+
+	/*
+	 * Unlike ztest_init() the pool is created without random
+	 * properties, so that every run starts from the same layout.
+	 */
+	if (ztest_opts.zo_init != 0) {
+		nvlist_t *nvroot;
+
+		(void) spa_destroy(ztest_opts.zo_pool);
+		ztest_shared->zs_vdev_next_leaf = 0;
+		nvroot = make_vdev_root(NULL, NULL, NULL,
+		    ztest_opts.zo_vdev_size, 0, 0, ztest_opts.zo_raidz,
+		    ztest_opts.zo_mirrors, 1);
+		VERIFY0(spa_create(ztest_opts.zo_pool, nvroot, NULL, NULL));
+		nvlist_free(nvroot);
+	}
+	VERIFY0(spa_open(ztest_opts.zo_pool, &spa, FTAG));
+
+	(void) snprintf(name, sizeof (name), "%s/perf", ztest_opts.zo_pool);
+	(void) dmu_objset_find(name, ztest_objset_destroy_cb, NULL,
+	    DS_FIND_SNAPSHOTS | DS_FIND_CHILDREN);
+	VERIFY0(dmu_objset_create(name, DMU_OST_OTHER, 0, NULL,
+	    ztest_objset_create_cb, NULL));
+	VERIFY0(dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, FTAG, &os));
+
+	zpts = umem_zalloc(ztest_opts.zo_threads * sizeof (*zpts),
+	    UMEM_NOFAIL);
+	threads = umem_zalloc(ztest_opts.zo_threads * sizeof (*threads),
+	    UMEM_NOFAIL);
+
+	/*
+	 * Give each thread its own object, fully written and synced out
+	 * so the first reads find data on disk rather than holes.
+	 */
+	for (t = 0; t < ztest_opts.zo_threads; t++) {
+		ztest_perf_thread_t *zpt = &zpts[t];
+		uint64_t size = 1ULL << ZTEST_PERF_MAXSHIFT;
+		uint64_t offset;
+		void *buf;
+		dmu_tx_t *tx;
+
+		zpt->zpt_os = os;
+		zpt->zpt_rate = rate;
+		zpt->zpt_rand = (ztest_opts.zo_seed + t) *
+		    0x9e3779b97f4a7c15ULL;
+		if (zpt->zpt_rand == 0)
+			zpt->zpt_rand = 1;
+
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		zpt->zpt_object = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+		    size, DMU_OT_NONE, 0, tx);
+		dmu_tx_commit(tx);
+
+		buf = umem_zalloc(size, UMEM_NOFAIL);
+		for (offset = 0; offset < ZTEST_PERF_RANGE; offset += size)
+			VERIFY0(ztest_perf_write(zpt, offset, size, buf));
+		umem_free(buf, size);
+	}
+	txg_wait_synced(spa_get_dsl(spa), 0);
+
+	start = gethrtime();
+	for (t = 0; t < ztest_opts.zo_threads; t++) {
+		zpts[t].zpt_start = start;
+		zpts[t].zpt_stop = start + ztest_opts.zo_time * NANOSEC;
+		VERIFY3P(threads[t] = zk_thread_create(NULL, 0,
+		    (thread_func_t)ztest_perf_thread, &zpts[t], TS_RUN, NULL,
+		    0, 0, PTHREAD_CREATE_JOINABLE), !=, NULL);
+	}
+	for (t = 0; t < ztest_opts.zo_threads; t++)
+		thread_join(threads[t]->t_tid);
+
+	ztest_perf_report(zpts, gethrtime() - start);
+
+	umem_free(threads, ztest_opts.zo_threads * sizeof (*threads));
+	umem_free(zpts, ztest_opts.zo_threads * sizeof (*zpts));
+
+	dmu_objset_disown(os, FTAG);
+	txg_wait_synced(spa_get_dsl(spa), 0);
+	spa_close(spa, FTAG);
+	kernel_fini();
+}
+
 int
 main(int argc, char **argv)
 {
@@ -6479,6 +6880,11 @@ main(int argc, char **argv)
 		exit(0);
 	}
 
+	if (ztest_opts.zo_perf_rate != 0) {
+		ztest_perf();
+		exit(0);
+	}
+
 	hasalt = (strlen(ztest_opts.zo_alt_ztest) != 0);
 
 	if (ztest_opts.zo_verbose >= 1) {
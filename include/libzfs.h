@@ -156,6 +156,7 @@ typedef enum zfs_error {
 	EZFS_POOLREADONLY,	/* pool is in read-only mode */
 	EZFS_UNSHAREAFPFAILED,	/* failed to unshare over afp */
 	EZFS_SHAREAFPFAILED,	/* failed to share over afp */
+	EZFS_CRYPTOFAILED,	/* failed to setup encryption */
 	EZFS_UNKNOWN
 } zfs_error_t;
 
@@ -276,6 +277,9 @@ typedef struct splitflags {
  * Functions to manipulate pool and vdev state
  */
 extern int zpool_scan(zpool_handle_t *, pool_scan_func_t);
+extern int zpool_scan_restricted(zpool_handle_t *, pool_scan_func_t,
+    nvlist_t *);
+extern int zpool_trim(zpool_handle_t *, pool_trim_func_t, uint64_t);
 extern int zpool_clear(zpool_handle_t *, const char *, nvlist_t *);
 extern int zpool_reguid(zpool_handle_t *);
 extern int zpool_reopen(zpool_handle_t *);
@@ -603,6 +607,8 @@ typedef struct get_all_cb {
 
 void libzfs_add_handle(get_all_cb_t *, zfs_handle_t *);
 int libzfs_dataset_cmp(const void *, const void *);
+int zfs_foreach_mountpoint(libzfs_handle_t *, zfs_handle_t **, size_t,
+    zfs_iter_f, void *, boolean_t);
 
 /*
  * Functions to create and destroy datasets.
@@ -620,6 +626,12 @@ extern int zfs_snapshot_nvl(libzfs_handle_t *hdl, nvlist_t *snaps,
 extern int zfs_rollback(zfs_handle_t *, zfs_handle_t *, boolean_t);
 extern int zfs_rename(zfs_handle_t *, const char *, boolean_t, boolean_t);
 
+/*
+ * Functions to manage the keys of encrypted datasets.
+ */
+extern int zfs_crypto_load_key(zfs_handle_t *, char *);
+extern int zfs_crypto_unload_key(zfs_handle_t *);
+
 typedef struct sendflags {
 	/* print informational messages (ie, -v was specified) */
 	boolean_t verbose;
@@ -656,6 +668,12 @@ typedef struct sendflags {
 
 	/* compressed WRITE records are permitted */
 	boolean_t compress;
+
+	/* bytes of ring buffer before the output fd, 0 for none (ie. -B) */
+	uint64_t buffer_size;
+
+	/* objects to leave out of each stream, or NULL (ie. -X) */
+	nvlist_t *exclude;
 } sendflags_t;
 
 typedef boolean_t (snapfilter_cb_t)(zfs_handle_t *, void *);
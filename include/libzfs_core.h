@@ -46,11 +46,17 @@ enum lzc_dataset_type {
 };
 
 int lzc_snapshot(nvlist_t *, nvlist_t *, nvlist_t **);
-int lzc_create(const char *, enum lzc_dataset_type, nvlist_t *);
+int lzc_create(const char *, enum lzc_dataset_type, nvlist_t *, uint8_t *,
+    uint_t);
 int lzc_clone(const char *, const char *, nvlist_t *);
 int lzc_destroy_snaps(nvlist_t *, boolean_t, nvlist_t **);
 int lzc_bookmark(nvlist_t *, nvlist_t **);
 int lzc_get_bookmarks(const char *, nvlist_t *, nvlist_t **);
+int lzc_list_batch(const char *, nvlist_t *, nvlist_t **);
+int lzc_zpios(const char *, nvlist_t *, nvlist_t **);
+int lzc_block_sample(const char *, nvlist_t *, nvlist_t **);
+int lzc_obj_to_stats_batch(const char *, nvlist_t *, nvlist_t **);
+int lzc_recompress(const char *, nvlist_t *, nvlist_t **);
 int lzc_destroy_bookmarks(nvlist_t *, nvlist_t **);
 
 int lzc_snaprange_space(const char *, const char *, uint64_t *);
@@ -59,6 +65,9 @@ int lzc_hold(nvlist_t *, int, nvlist_t **);
 int lzc_release(nvlist_t *, nvlist_t **);
 int lzc_get_holds(const char *, nvlist_t **);
 
+int lzc_load_key(const char *, uint8_t *, uint_t);
+int lzc_unload_key(const char *);
+
 enum lzc_send_flags {
 	LZC_SEND_FLAG_EMBED_DATA = 1 << 0,
 	LZC_SEND_FLAG_LARGE_BLOCK = 1 << 1,
@@ -68,7 +77,11 @@ enum lzc_send_flags {
 int lzc_send(const char *, const char *, int, enum lzc_send_flags);
 int lzc_send_resume(const char *, const char *, int,
     enum lzc_send_flags, uint64_t, uint64_t);
+int lzc_send_exclude(const char *, const char *, int,
+    enum lzc_send_flags, uint64_t, uint64_t, nvlist_t *);
 int lzc_send_space(const char *, const char *, enum lzc_send_flags, uint64_t *);
+int lzc_send_space_error(const char *, const char *, enum lzc_send_flags,
+    uint64_t *, uint64_t *);
 
 struct dmu_replay_record;
 
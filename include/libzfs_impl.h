@@ -33,6 +33,7 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/spa.h>
 #include <sys/nvpair.h>
+#include <pthread.h>
 
 #include <libuutil.h>
 #include <libzfs.h>
@@ -80,6 +81,11 @@ struct libzfs_handle {
 	void *libzfs_sharehdl; /* libshare handle */
 	uint_t libzfs_shareflags;
 	boolean_t libzfs_mnttab_enable;
+	/*
+	 * We need a lock to handle the case where parallel mount
+	 * threads are populating the mnttab cache simultaneously.
+	 */
+	pthread_mutex_t libzfs_mnttab_cache_lock;
 	avl_tree_t libzfs_mnttab_cache;
 	int libzfs_pool_iter;
 #if defined(HAVE_LIBTOPO)
@@ -161,6 +167,9 @@ int get_dependents(libzfs_handle_t *, boolean_t, const char *, char ***,
     size_t *);
 zfs_handle_t *make_dataset_handle_zc(libzfs_handle_t *, zfs_cmd_t *);
 zfs_handle_t *make_dataset_simple_handle_zc(zfs_handle_t *, zfs_cmd_t *);
+zfs_handle_t *make_dataset_handle_nvl(libzfs_handle_t *, const char *,
+    nvlist_t *);
+zfs_handle_t *make_dataset_simple_handle(zfs_handle_t *, const char *);
 
 int zprop_parse_value(libzfs_handle_t *, nvpair_t *, int, zfs_type_t,
     nvlist_t *, char **, uint64_t *, const char *);
@@ -210,6 +219,9 @@ int zfs_validate_name(libzfs_handle_t *hdl, const char *path, int type,
 
 void namespace_clear(libzfs_handle_t *);
 
+int zfs_crypto_create(libzfs_handle_t *, const char *, nvlist_t *,
+    uint8_t **, uint_t *);
+
 /*
  * libshare (sharemgr) interfaces used internally.
  */
@@ -105,6 +105,25 @@ typedef enum arc_flags
 	ARC_FLAG_COMPRESSED_ARC         = 1 << 17,
 	ARC_FLAG_SHARED_DATA            = 1 << 18,
 
+	/*
+	 * The buffer was read for a long sequential stream (passed in by
+	 * zfetch, kept in b_flags).  It is not promoted to the MFU state and
+	 * is evicted ahead of the rest of the MRU state.
+	 */
+	ARC_FLAG_SEQUENTIAL             = 1 << 19,
+
+	/*
+	 * If the buffer was lz4-compressed on its way to the L2ARC (see
+	 * l2arc_compress), the size of the copy on the device, in
+	 * sixteenths of the logical size, is stored in these 4 bits of
+	 * the flags field.  These dummy flags are included so that MDB
+	 * can interpret the enum properly.
+	 */
+	ARC_FLAG_L2COMPRESS_0		= 1 << 20,
+	ARC_FLAG_L2COMPRESS_1		= 1 << 21,
+	ARC_FLAG_L2COMPRESS_2		= 1 << 22,
+	ARC_FLAG_L2COMPRESS_3		= 1 << 23,
+
 	/*
 	 * The arc buffer's compression mode is stored in the top 7 bits of the
 	 * flags field, so these dummy flags are included so that MDB can
@@ -199,10 +218,13 @@ zio_t *arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 void arc_freed(spa_t *spa, const blkptr_t *bp);
 
 void arc_flush(spa_t *spa, boolean_t retry);
+void arc_ds_set_quota(spa_t *spa, uint64_t objset, uint64_t quota);
+void arc_ds_set_l2prefetch(spa_t *spa, uint64_t objset, boolean_t l2prefetch);
 void arc_tempreserve_clear(uint64_t reserve);
 int arc_tempreserve_space(uint64_t reserve, uint64_t txg);
 
 uint64_t arc_max_bytes(void);
+uint64_t arc_prefetch_late(void);
 void arc_init(void);
 void arc_fini(void);
 
@@ -143,6 +143,8 @@ typedef struct l1arc_buf_hdr {
 
 	arc_buf_t		*b_buf;
 	uint32_t		b_datacnt;
+	/* sublist of b_arc_node, protected by arc state mutex */
+	uint32_t		b_arc_sublist;
 	/* for waiting on writes to complete */
 	kcondvar_t		b_cv;
 
@@ -0,0 +1,136 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_BTREE_H
+#define	_SYS_BTREE_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * An in-memory B-tree of fixed size elements.  Unlike the AVL tree the
+ * elements are not linked into the tree through an embedded node; they
+ * are copied by value into the tree's nodes, so many small elements share
+ * one allocation and are laid out contiguously in memory.
+ *
+ * This has two consequences for consumers:
+ *
+ *  - An element pointer returned by the tree (and any zfs_btree_index_t)
+ *    is only valid until the next zfs_btree_add*() or zfs_btree_remove*()
+ *    on that tree.  Elements may be modified in place, provided that their
+ *    order relative to the rest of the tree is unchanged.
+ *
+ *  - Insertions and removals take a copy of an element, never a pointer
+ *    to storage owned by the caller.
+ *
+ * Leaves are BTREE_LEAF_SIZE bytes and are allocated from a kmem cache.
+ * Core (interior) nodes hold BTREE_CORE_ELEMS elements and their
+ * children.  Every element is stored exactly once, either in a leaf or in
+ * a core node, so a lookup can stop early at a core node.
+ */
+#define	BTREE_LEAF_SIZE		512
+#define	BTREE_CORE_ELEMS	32
+#define	BTREE_ELEM_MAX		64
+
+struct zfs_btree_core;
+
+typedef struct zfs_btree_hdr {
+	struct zfs_btree_core	*bth_parent;
+	boolean_t		bth_core;	/* children follow elements */
+	uint32_t		bth_count;	/* number of elements */
+} zfs_btree_hdr_t;
+
+typedef struct zfs_btree_core {
+	zfs_btree_hdr_t		btc_hdr;
+	zfs_btree_hdr_t		*btc_children[BTREE_CORE_ELEMS + 1];
+	uint8_t			btc_elems[];
+} zfs_btree_core_t;
+
+typedef struct zfs_btree_leaf {
+	zfs_btree_hdr_t		btl_hdr;
+	uint8_t			btl_elems[];
+} zfs_btree_leaf_t;
+
+/*
+ * A position in the tree.  A lookup that misses returns the position the
+ * element would be inserted at, with bti_before set: the element at
+ * bti_offset (if any) is the one after the missing element.
+ */
+typedef struct zfs_btree_index {
+	zfs_btree_hdr_t		*bti_node;
+	uint32_t		bti_offset;
+	boolean_t		bti_before;
+} zfs_btree_index_t;
+
+typedef struct btree {
+	zfs_btree_hdr_t		*bt_root;
+	int			bt_height;	/* -1 when empty */
+	size_t			bt_elem_size;
+	uint32_t		bt_leaf_cap;	/* elements per leaf */
+	uint64_t		bt_num_elems;
+	uint64_t		bt_num_nodes;
+	int			(*bt_compar)(const void *, const void *);
+} zfs_btree_t;
+
+void zfs_btree_init(void);
+void zfs_btree_fini(void);
+
+void zfs_btree_create(zfs_btree_t *tree,
+    int (*compar)(const void *, const void *), size_t size);
+void zfs_btree_destroy(zfs_btree_t *tree);
+
+void *zfs_btree_find(zfs_btree_t *tree, const void *value,
+    zfs_btree_index_t *where);
+void zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where);
+void zfs_btree_add(zfs_btree_t *tree, const void *value);
+void zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where);
+void zfs_btree_remove(zfs_btree_t *tree, const void *value);
+
+/*
+ * Iteration.  "where" may be NULL for zfs_btree_first()/zfs_btree_last(),
+ * and the input and output indexes of zfs_btree_next()/zfs_btree_prev()
+ * may be the same.  Each returns NULL when there is no such element.
+ */
+void *zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where);
+void *zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where);
+void *zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx);
+void *zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx);
+void *zfs_btree_get(zfs_btree_t *tree, const zfs_btree_index_t *idx);
+
+ulong_t zfs_btree_numnodes(zfs_btree_t *tree);
+
+/*
+ * Remove every element.  Much cheaper than removing the elements one at
+ * a time, since no rebalancing is done.
+ */
+void zfs_btree_clear(zfs_btree_t *tree);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BTREE_H */
@@ -0,0 +1,80 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_SYS_DATASET_KSTATS_H
+#define	_SYS_DATASET_KSTATS_H
+
+#include <sys/zfs_context.h>
+#include <sys/dmu.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-dataset I/O statistics, kstat.zfs.<pool>.dataset.objset-0x<id>,
+ * counted at the ZPL and zvol entry points.
+ */
+typedef struct dataset_kstat_values {
+	kstat_named_t	dkv_ds_name;
+	kstat_named_t	dkv_writes;
+	kstat_named_t	dkv_nwritten;
+	kstat_named_t	dkv_write_nsecs;
+	kstat_named_t	dkv_reads;
+	kstat_named_t	dkv_nread;
+	kstat_named_t	dkv_read_nsecs;
+} dataset_kstat_values_t;
+
+/*
+ * The hot path only touches the shard of the cpu it runs on, so that
+ * busy datasets do not bounce one cache line between all cpus.  The
+ * shards are summed when the kstat is read.
+ */
+typedef struct dataset_kstats_shard {
+	uint64_t	dks_writes;
+	uint64_t	dks_nwritten;
+	uint64_t	dks_write_nsecs;
+	uint64_t	dks_reads;
+	uint64_t	dks_nread;
+	uint64_t	dks_read_nsecs;
+	char		dks_pad[16];	/* pad to fill a cache line */
+} dataset_kstats_shard_t;
+
+typedef struct dataset_kstats {
+	dataset_kstats_shard_t	*dk_shards;
+	kstat_t			*dk_kstats;
+	kmutex_t		dk_lock;	/* protects dk_values */
+	dataset_kstat_values_t	dk_values;
+	char			dk_ds_name[ZFS_MAX_DATASET_NAME_LEN];
+} dataset_kstats_t;
+
+void dataset_kstats_create(dataset_kstats_t *, objset_t *);
+void dataset_kstats_destroy(dataset_kstats_t *);
+
+void dataset_kstats_update_write(dataset_kstats_t *, uint64_t, hrtime_t);
+void dataset_kstats_update_read(dataset_kstats_t *, uint64_t, hrtime_t);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DATASET_KSTATS_H */
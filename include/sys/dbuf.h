@@ -37,6 +37,7 @@
 #include <sys/refcount.h>
 #include <sys/zrlock.h>
 #include <sys/multilist.h>
+#include <sys/zfs_lockstat.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -146,6 +147,17 @@ typedef struct dbuf_dirty_record {
 			override_states_t dr_override_state;
 			uint8_t dr_copies;
 			boolean_t dr_nopwrite;
+			/* see dmu_buf_will_recompress() */
+			uint8_t dr_recompress;
+			/*
+			 * A deferred read-modify-write, see
+			 * dmu_buf_will_dirty_range(): the ranges written
+			 * so far, the writers still copying in, and the
+			 * old block once it was read while they were.
+			 */
+			struct range_tree *dr_written;
+			uint32_t dr_rmw_writers;
+			arc_buf_t *dr_rmw_buf;
 		} dl;
 	} dt;
 } dbuf_dirty_record_t;
@@ -259,17 +271,112 @@ typedef struct dmu_buf_impl {
 	uint8_t db_pending_evict;
 
 	uint8_t db_dirtycnt;
+
+	/*
+	 * The old contents of this DB_FILL dbuf are being read in to be
+	 * merged with a partial write, see dmu_buf_will_dirty_range().
+	 */
+	uint8_t db_rmw_pending;
+
+	/* index of this dbuf's counters in dbuf_type_stats[] */
+	uint8_t db_stat_type;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
-#define	DBUF_MUTEXES 8192
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module
+ *
+ * The table is split into hash_nshards shards, picked by the top bits of
+ * a dbuf's hash, so that lookups on different CPUs rarely share a lock or
+ * a counter.  Each shard has its own bucket array and stripe of mutexes.
+ * The stripe a hash value maps to does not depend on the size of the
+ * bucket array (which is never smaller than the stripe), so a shard can
+ * double its array once it averages DBUF_HASH_LOAD dbufs per bucket by
+ * taking every mutex of that shard alone.
+ */
+#define	DBUF_SHARD_MUTEXES	512
+#define	DBUF_HASH_MAX_SHARDS	64
+#define	DBUF_HASH_LOAD		2
+#define	DBUF_HASH_MUTEX(hs, hv)	\
+	(&(hs)->hs_mutexes[(hv) & (DBUF_SHARD_MUTEXES - 1)])
+typedef struct dbuf_hash_shard {
+	kmutex_t	hs_mutexes[DBUF_SHARD_MUTEXES];
+	dmu_buf_impl_t	**hs_table;
+	uint64_t	hs_mask;	/* number of buckets - 1 */
+	uint64_t	hs_count;	/* dbufs in this shard */
+	uint64_t	hs_collisions;	/* inserts into a non-empty bucket */
+	uint64_t	hs_chains;	/* buckets holding more than one dbuf */
+	uint64_t	hs_chain_max;	/* longest chain since the last grow */
+	uint64_t	hs_resizes;	/* times the bucket array doubled */
+	uint32_t	hs_growing;	/* a grow is queued or running */
+} dbuf_hash_shard_t;
+
 typedef struct dbuf_hash_table {
-	uint64_t hash_table_mask;
-	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	dbuf_hash_shard_t *hash_shards;
+	int		hash_nshards;
+	uint64_t	hash_shard_max;	/* most buckets a shard may have */
 } dbuf_hash_table_t;
 
+typedef struct dbuf_hash_stats {
+	uint64_t	dht_shards;
+	uint64_t	dht_buckets;
+	uint64_t	dht_elements;
+	uint64_t	dht_collisions;
+	uint64_t	dht_chains;
+	uint64_t	dht_chain_max;
+	uint64_t	dht_resizes;
+} dbuf_hash_stats_t;
+
+void dbuf_hash_stats_get(dbuf_hash_stats_t *dht);
+
+/*
+ * What dbuf_hold_impl() found, by the type of the object held.  Objects
+ * of the new-style types are counted under DMU_OT_NUMTYPES.  Updated
+ * atomically, and exported by dbuf_stats.c.
+ */
+typedef struct dbuf_hold_stats {
+	uint64_t	dhs_hits;	/* the dbuf existed */
+	uint64_t	dhs_reholds;	/* ... idle, in the dbuf cache */
+	uint64_t	dhs_misses;	/* the dbuf was created */
+} dbuf_hold_stats_t;
+
+extern dbuf_hold_stats_t dbuf_hold_stats[DMU_OT_NUMTYPES + 1];
+
+/*
+ * The dbufs in existence, by the type of their object, as they are
+ * created and destroyed.  The same counters are kept for each objset in
+ * objset_t, so that neither needs a walk of the dbuf hash table.
+ */
+typedef struct dbuf_type_stats {
+	uint64_t	dts_dbufs;	/* dbufs of this type */
+	uint64_t	dts_bytes;	/* ... and their size */
+	uint64_t	dts_indirect;	/* ... of them indirect blocks */
+	uint64_t	dts_idle;	/* ... of them in the dbuf cache */
+	uint64_t	dts_idle_bytes;	/* ... and their size */
+} dbuf_type_stats_t;
+
+extern dbuf_type_stats_t dbuf_type_stats[DMU_OT_NUMTYPES + 1];
+
+/* see dmu_buf_will_dirty_range() */
+extern int dbuf_deferred_rmw;
+
+typedef struct dbuf_cache_stats {
+	uint64_t	dcs_size;	/* bytes in the dbuf cache */
+	uint64_t	dcs_target;	/* its adaptive target size */
+	uint64_t	dcs_evicts;	/* dbufs aged out of it */
+} dbuf_cache_stats_t;
+
+void dbuf_cache_stats_get(dbuf_cache_stats_t *dcs);
+
+typedef struct dbuf_evict_user_stats {
+	uint64_t	deus_queues;	/* async user eviction queues */
+	uint64_t	deus_queued;	/* users waiting to be evicted */
+	uint64_t	deus_queued_max; /* most users ever waiting */
+	uint64_t	deus_evicts;	/* async callbacks run */
+	uint64_t	deus_batches;	/* batches they were run in */
+} dbuf_evict_user_stats_t;
+
+void dbuf_evict_user_stats_get(dbuf_evict_user_stats_t *deus);
+
 
 uint64_t dbuf_whichblock(struct dnode *di, int64_t level, uint64_t offset);
 
@@ -284,6 +391,8 @@ dmu_buf_impl_t *dbuf_hold_level(struct dnode *dn, int level, uint64_t blkid,
 int dbuf_hold_impl(struct dnode *dn, uint8_t level, uint64_t blkid,
    boolean_t fail_sparse, boolean_t fail_uncached,
     void *tag, dmu_buf_impl_t **dbp);
+int dbuf_hold_range(struct dnode *dn, uint64_t blkid, uint64_t nblks,
+    void *tag, dmu_buf_impl_t **dbp);
 
 void dbuf_prefetch(struct dnode *dn, int64_t level, uint64_t blkid,
     zio_priority_t prio, arc_flags_t aflags);
@@ -301,6 +410,8 @@ dmu_buf_impl_t *dbuf_find(struct objset *os, uint64_t object, uint8_t level,
 
 int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
 void dmu_buf_will_not_fill(dmu_buf_t *db, dmu_tx_t *tx);
+void dmu_buf_will_recompress(dmu_buf_t *db, enum zio_compress compress,
+    dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
 void dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx);
@@ -323,6 +434,8 @@ void dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx);
 
 void dbuf_stats_init(dbuf_hash_table_t *hash);
 void dbuf_stats_destroy(void);
+void dbuf_stats_objset_register(objset_t *os);
+void dbuf_stats_objset_unregister(objset_t *os);
 
 #define	DB_DNODE(_db)		((_db)->db_dnode_handle->dnh_dnode)
 #define	DB_DNODE_LOCK(_db)	((_db)->db_dnode_handle->dnh_zrlock)
@@ -108,7 +108,7 @@ struct ddt_entry {
 	ddt_key_t	dde_key;
 	ddt_phys_t	dde_phys[DDT_PHYS_TYPES];
 	zio_t		*dde_lead_zio[DDT_PHYS_TYPES];
-	void		*dde_repair_data;
+	abd_t		*dde_repair_abd;
 	enum ddt_type	dde_type;
 	enum ddt_class	dde_class;
 	uint8_t		dde_loading;
@@ -117,6 +117,29 @@ struct ddt_entry {
 	avl_node_t	dde_node;
 };
 
+/*
+ * DDT entry cache entry: a compact copy of an on-disk entry which is not
+ * being modified in the syncing txg.  Only entries with a single phys in
+ * use are cached, and only that phys is kept.
+ */
+typedef struct ddt_cache_entry {
+	ddt_key_t	dce_key;
+	ddt_phys_t	dce_phys;
+	uint8_t		dce_phys_type;	/* enum ddt_phys_type */
+	uint8_t		dce_type;	/* enum ddt_type */
+	uint8_t		dce_class;	/* enum ddt_class */
+	avl_node_t	dce_node;
+	list_node_t	dce_lru;
+} ddt_cache_entry_t;
+
+#define	DDT_CACHE_SHARDS	16
+
+typedef struct ddt_cache_shard {
+	kmutex_t	dcs_lock;
+	avl_tree_t	dcs_tree;
+	list_t		dcs_lru;	/* most recently used first */
+} ddt_cache_shard_t;
+
 /*
  * In-core ddt
  */
@@ -132,6 +155,8 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	ddt_cache_shard_t ddt_dce_shard[DDT_CACHE_SHARDS];
+	uint64_t	ddt_prune_cursor;	/* unique entry pruning walk */
 	avl_node_t	ddt_node;
 };
 
@@ -167,6 +192,11 @@ typedef struct ddt_ops {
 
 #define	DDT_NAMELEN	80
 
+/*
+ * Entry of the DDT statistics object counting the unique entries pruned
+ */
+#define	DDT_PRUNED_ENTRIES	"pruned_entries"
+
 extern void ddt_object_name(ddt_t *ddt, enum ddt_type type,
     enum ddt_class _class, char *name);
 extern int ddt_object_walk(ddt_t *ddt, enum ddt_type type,
@@ -220,10 +250,13 @@ extern void ddt_init(void);
 extern void ddt_fini(void);
 extern ddt_entry_t *ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add);
 extern void ddt_prefetch(spa_t *spa, const blkptr_t *bp);
+extern boolean_t ddt_prefetch_entry(spa_t *spa, const blkptr_t *bp);
 extern void ddt_remove(ddt_t *ddt, ddt_entry_t *dde);
 
 extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
     const blkptr_t *bp);
+extern boolean_t ddt_over_quota(spa_t *spa);
+extern boolean_t ddt_pruned(spa_t *spa);
 
 extern ddt_entry_t *ddt_repair_start(ddt_t *ddt, const blkptr_t *bp);
 extern void ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde);
@@ -240,6 +273,10 @@ extern int ddt_object_update(ddt_t *ddt, enum ddt_type type,
 
 extern const ddt_ops_t ddt_zap_ops;
 
+extern uint64_t zfs_ddt_cache_max;
+extern uint64_t zfs_ddt_prune_age;
+extern int zfs_ddt_prune_batch;
+
 #ifdef	__cplusplus
 }
 #endif
@@ -63,6 +63,7 @@ struct blkptr;
 struct zap_cursor;
 struct dsl_dataset;
 struct dsl_pool;
+struct dsl_crypto_params;
 struct dnode;
 struct drr_begin;
 struct drr_end;
@@ -131,6 +132,13 @@ typedef enum dmu_object_byteswap {
 #define	DMU_OT_HAS_FILL(ot) \
 	((ot) == DMU_OT_DNODE || (ot) == DMU_OT_OBJSET)
 
+/*
+ * Object types whose level 0 blocks are encrypted in an encrypted dataset.
+ * Everything else, including all metadata, is written in the clear.
+ */
+#define	DMU_OT_IS_ENCRYPTED(ot) \
+	((ot) == DMU_OT_PLAIN_FILE_CONTENTS || (ot) == DMU_OT_ZVOL)
+
 #define	DMU_OT_BYTESWAP(ot) (((ot) & DMU_OT_NEWTYPE) ? \
 	((ot) & DMU_OT_BYTESWAP_MASK) : \
 	dmu_ot[(int)(ot)].ot_byteswap)
@@ -287,6 +295,7 @@ int dmu_objset_open_ds(struct dsl_dataset *ds, objset_t **osp);
 
 void dmu_objset_evict_dbufs(objset_t *os);
 int dmu_objset_create(const char *name, dmu_objset_type_t type, uint64_t flags,
+    struct dsl_crypto_params *dcp,
     void (*func)(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx), void *arg);
 int dmu_objset_destroy(const char *name, boolean_t defer);
 int dmu_objset_snapshot(char *fsname, char *snapname, char *tag,
@@ -336,11 +345,13 @@ typedef struct dmu_buf {
 #define	DMU_POOL_DDT_STATS		"DDT-statistics"
 #define	DMU_POOL_CREATION_VERSION	"creation_version"
 #define	DMU_POOL_SCAN			"scan"
+#define	DMU_POOL_SCAN_PATH		"org.openzfsonosx:scan_path"
 #define	DMU_POOL_FREE_BPOBJ		"free_bpobj"
 #define	DMU_POOL_BPTREE_OBJ		"bptree_obj"
 #define	DMU_POOL_EMPTY_BPOBJ		"empty_bpobj"
 #define	DMU_POOL_CHECKSUM_SALT		"org.illumos:checksum_salt"
 #define	DMU_POOL_VDEV_ZAP_MAP		"com.delphix:vdev_zap_map"
+#define	DMU_POOL_WARM_LOG		"org.openzfsonosx:arc_warm_log"
 
 /*
  * Allocate an object from this objset.  The range of object numbers
@@ -355,14 +366,28 @@ typedef struct dmu_buf {
  * dmu_object_claim() allocates a specific object number.  If that
  * number is already allocated, it fails and returns EEXIST.
  *
+ * The _dnsize() variants take the size in bytes of the dnode to allocate,
+ * a multiple of DNODE_MIN_SIZE up to DNODE_MAX_SIZE; a size of 0 selects
+ * the legacy DNODE_MIN_SIZE.  Larger dnodes occupy several consecutive
+ * object numbers and have a correspondingly larger bonus buffer.
+ *
  * Return 0 on success, or ENOSPC or EEXIST as specified above.
  */
 uint64_t dmu_object_alloc(objset_t *os, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonus_type, int bonus_len, dmu_tx_t *tx);
+uint64_t dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot,
+    int blocksize, dmu_object_type_t bonus_type, int bonus_len,
+    int dnodesize, dmu_tx_t *tx);
 int dmu_object_claim(objset_t *os, uint64_t object, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonus_type, int bonus_len, dmu_tx_t *tx);
+int dmu_object_claim_dnsize(objset_t *os, uint64_t object,
+    dmu_object_type_t ot, int blocksize, dmu_object_type_t bonus_type,
+    int bonus_len, int dnodesize, dmu_tx_t *tx);
 int dmu_object_reclaim(objset_t *os, uint64_t object, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *txp);
+int dmu_object_reclaim_dnsize(objset_t *os, uint64_t object,
+    dmu_object_type_t ot, int blocksize, dmu_object_type_t bonustype,
+    int bonuslen, int dnodesize, dmu_tx_t *txp);
 
 /*
  * Free an object from this objset.
@@ -550,9 +575,10 @@ typedef void dmu_buf_evict_func_t(void *user_ptr);
  */
 typedef struct dmu_buf_user {
 	/*
-	 * Asynchronous user eviction callback state.
+	 * Asynchronous user eviction callback state: the link on the
+	 * dbuf user eviction queue the user is waiting on.
 	 */
-	taskq_ent_t	dbu_tqent;
+	list_node_t	dbu_evict_node;
 
 	/*
 	 * This instance's eviction function pointers.
@@ -660,6 +686,18 @@ struct blkptr *dmu_buf_get_blkptr(dmu_buf_t *db);
  */
 void dmu_buf_will_dirty(dmu_buf_t *db, dmu_tx_t *tx);
 
+/*
+ * Like dmu_buf_will_dirty(), before writing len bytes at offset off into
+ * the buffer.  The old contents of the rest of the buffer may not have
+ * been read in yet, so the buffer must not be read from, and the write
+ * must be finished with dmu_buf_dirty_range_done() giving the bytes
+ * actually copied in.
+ */
+void dmu_buf_will_dirty_range(dmu_buf_t *db, uint64_t off, uint64_t len,
+    dmu_tx_t *tx);
+void dmu_buf_dirty_range_done(dmu_buf_t *db, uint64_t off, uint64_t len,
+    dmu_tx_t *tx);
+
 /*
  * You must create a transaction, then hold the objects which you will
  * (or might) modify as part of this transaction.  Then you must assign
@@ -812,6 +850,7 @@ typedef struct dmu_object_info {
 	uint8_t doi_compress;
 	uint8_t doi_nblkptr;
 	uint8_t doi_pad[4];
+	uint64_t doi_dnodesize;
 	uint64_t doi_physical_blocks_512;	/* data + metadata, 512b blks */
 	uint64_t doi_max_offset;
 	uint64_t doi_fill_count;		/* number of non-empty blocks */
@@ -855,6 +894,11 @@ void dmu_object_info_from_db(dmu_buf_t *db, dmu_object_info_t *doi);
 void dmu_object_size_from_db(dmu_buf_t *db, uint32_t *blksize,
     u_longlong_t *nblk512);
 
+/*
+ * Return the size in bytes of the dnode backing a bonus buffer.
+ */
+void dmu_object_dnsize_from_db(dmu_buf_t *db, int *dnsize);
+
 typedef struct dmu_objset_stats {
 	uint64_t dds_num_clones; /* number of clones of this */
 	uint64_t dds_creation_txg;
@@ -914,6 +958,7 @@ extern dmu_objset_type_t dmu_objset_type(objset_t *os);
 extern uint64_t dmu_objset_id(objset_t *os);
 extern zfs_sync_type_t dmu_objset_syncprop(objset_t *os);
 extern zfs_logbias_op_t dmu_objset_logbias(objset_t *os);
+extern int dmu_objset_dnodesize(objset_t *os);
 extern int dmu_snapshot_list_next(objset_t *os, int namelen, char *name,
     uint64_t *id, uint64_t *offp, boolean_t *case_conflict);
 extern int dmu_snapshot_lookup(objset_t *os, const char *name, uint64_t *val);
@@ -949,7 +994,7 @@ uint64_t dmu_tx_get_txg(dmu_tx_t *tx);
  * {zfs,zvol,ztest}_get_done() args
  */
 typedef struct zgd {
-	struct zilog	*zgd_zilog;
+	struct lwb	*zgd_lwb;
 	struct blkptr	*zgd_bp;
 	dmu_buf_t	*zgd_db;
 	struct rl	*zgd_rl;
@@ -958,6 +1003,8 @@ typedef struct zgd {
 
 typedef void dmu_sync_cb_t(zgd_t *arg, int error);
 int dmu_sync(struct zio *zio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd);
+int dmu_write_early(struct zio *zio, uint64_t txg, dmu_sync_cb_t *done,
+    zgd_t *zgd);
 
 /*
  * Find the next hole or data block in file starting at *off
@@ -70,7 +70,7 @@ extern "C" {
  * os_obj_lock
  *   must be held before:
  *   	everything except dp_config_rwlock
- *   protects os_obj_next
+ *   protects os_obj_next_chunk
  *   held from:
  *   	dmu_object_alloc: dn_dbufs_mtx, db_mtx, hash_mutexes, dn_struct_rwlock
  *
@@ -114,10 +114,10 @@ extern "C" {
  *    	dbuf_create: hash_mutexes, db_mtx (dn_dbufs)
  *    	dnode_set_blksz: (dn_dbufs)
  *
- * hash_mutexes (global)
+ * hash_mutexes (per dbuf hash shard)
  *   must be held before:
  *   	db_mtx
- *   protects dbuf_hash_table (global) and db_hash_next
+ *   protects the shard's bucket array and db_hash_next
  *   held from:
  *   	dbuf_find: db_mtx
  *   	dbuf_hash_insert: db_mtx
@@ -277,6 +277,12 @@ typedef struct dmu_sendarg {
 	uint64_t dsa_resume_offset;
 	boolean_t dsa_sent_begin;
 	boolean_t dsa_sent_end;
+	uint64_t dsa_traversed_bytes;	/* data queued by the traversal */
+	uint64_t dsa_read_bytes;	/* data read by the send readers */
+	char *dsa_buf;			/* records not yet written out */
+	int dsa_buf_size;
+	int dsa_buf_len;
+	struct dmu_send_filter *dsa_filter; /* objects to leave out */
 } dmu_sendarg_t;
 
 void dmu_object_zapify(objset_t *, uint64_t, dmu_object_type_t, dmu_tx_t *);
@@ -69,6 +69,20 @@ typedef struct objset_phys {
 	dnode_phys_t os_groupused_dnode;
 } objset_phys_t;
 
+/*
+ * Remembers the dnode handle that last satisfied a hold on an object, so
+ * that holds on objects which are already instantiated can skip the
+ * meta dnode and the shared dnode block dbuf (see dnode_hold_impl()).
+ * Entries are cleared by dnode_destroy().
+ */
+#define	OS_DNODE_HINTS	64
+
+typedef struct os_dnode_hint {
+	kmutex_t odh_lock;
+	uint64_t odh_object;
+	dnode_handle_t *odh_dnh;
+} os_dnode_hint_t;
+
 struct objset {
 	/* Immutable: */
 	struct dsl_dataset *os_dsl_dataset;
@@ -100,6 +114,10 @@ struct objset {
 	zfs_sync_type_t os_sync;
 	zfs_redundant_metadata_type_t os_redundant_metadata;
 	int os_recordsize;
+	int os_dnodesize;		/* default dnode size of new objects */
+	uint64_t os_special_smallblk;	/* largest data block on special */
+	uint64_t os_dirty_weight;	/* share of the write throttle */
+	boolean_t os_encrypted;		/* dataset has a key object */
 
 	/*
 	 * Pointer is constant; the blkptr it points to is protected by
@@ -114,10 +132,15 @@ struct objset {
 	uint64_t os_flags;
 	uint64_t os_freed_dnodes;
 	boolean_t os_rescan_dnodes;
+	uint32_t os_compress_streak;	/* incompressible blocks in a row */
 
 	/* Protected by os_obj_lock */
 	kmutex_t os_obj_lock;
-	uint64_t os_obj_next;
+	uint64_t os_obj_next_chunk;
+
+	/* Per-CPU next object to allocate, protected by atomic ops */
+	uint64_t *os_obj_next_percpu;
+	int os_obj_next_percpu_len;
 
 	/* Protected by os_lock */
 	kmutex_t os_lock;
@@ -132,6 +155,31 @@ struct objset {
 	kmutex_t os_user_ptr_lock;
 	void *os_user_ptr;
 	sa_os_t *os_sa;
+
+	/* Each protected by its odh_lock */
+	os_dnode_hint_t os_dnode_hints[OS_DNODE_HINTS];
+
+	/*
+	 * Dirty data of each txg, see dmu_objset_dirty_under_share().  Updated
+	 * atomically; rounding can take a slot below zero until it syncs.
+	 */
+	uint64_t os_dirty_pertxg[TXG_SIZE];
+
+	/* Atomic counters of write throttle waits */
+	uint64_t os_throttle_passes;
+	uint64_t os_throttle_delays;
+	uint64_t os_throttle_delay_time;
+	uint64_t os_throttle_stalls;
+	uint64_t os_throttle_stall_time;
+	struct dmu_objset_throttle *os_throttle;	/* kstat, heads only */
+
+	/* Atomic counters of this objset's dbufs, see dbuf_type_stats_t */
+	uint64_t os_dbufs;
+	uint64_t os_dbuf_bytes;
+	uint64_t os_dbuf_indirect;
+	uint64_t os_dbuf_idle;
+	uint64_t os_dbuf_idle_bytes;
+	list_node_t os_dbuf_stats_node;	/* on the dbufobjsets kstat */
 };
 
 #define	DMU_META_OBJSET		0
@@ -186,6 +234,10 @@ int dmu_fsname(const char *snapname, char *buf);
 
 void dmu_objset_evict_done(objset_t *os);
 void dmu_objset_willuse_space(objset_t *os, int64_t space, dmu_tx_t *tx);
+void dmu_objset_undirty_space(objset_t *os, int64_t space, uint64_t txg);
+void dmu_objset_dirty_done(objset_t *os, uint64_t txg);
+uint64_t dmu_objset_dirty(objset_t *os);
+boolean_t dmu_objset_dirty_under_share(objset_t *os);
 
 void dmu_objset_init(void);
 void dmu_objset_fini(void);
@@ -0,0 +1,61 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+
+#ifndef	_SYS_DMU_RECOMPRESS_H
+#define	_SYS_DMU_RECOMPRESS_H
+
+#include <sys/dmu.h>
+#include <sys/zio_compress.h>
+#include <sys/nvpair.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * What one dmu_recompress() call did; callers add these up across calls.
+ */
+typedef struct dmu_recompress_stats {
+	uint64_t	drs_objects;	/* data objects visited */
+	uint64_t	drs_blocks;	/* L0 blocks examined */
+	uint64_t	drs_bytes;	/* their logical size */
+	uint64_t	drs_rewritten;	/* blocks dirtied for rewrite */
+	uint64_t	drs_rewritten_lsize;
+	uint64_t	drs_rewritten_psize; /* physical size before rewrite */
+	uint64_t	drs_skipped_snap; /* born before the last snapshot */
+	uint64_t	drs_skipped_young; /* born too recently */
+	uint64_t	drs_skipped_done; /* already at the target */
+	uint64_t	drs_errors;	/* blocks that could not be read */
+} dmu_recompress_stats_t;
+
+int dmu_recompress(objset_t *os, enum zio_compress compress, uint64_t age,
+    uint64_t budget, uint64_t *objectp, uint64_t *offsetp,
+    dmu_recompress_stats_t *drs);
+void dmu_recompress_to_nvlist(const dmu_recompress_stats_t *drs,
+    nvlist_t *nvl);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DMU_RECOMPRESS_H */
@@ -0,0 +1,80 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_SYS_DMU_SAMPLE_H
+#define	_SYS_DMU_SAMPLE_H
+
+#include <sys/spa.h>
+#include <sys/zio_compress.h>
+#include <sys/nvpair.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct dsl_dataset;
+
+/*
+ * Sampled block statistics of a dataset, see dmu_sample_dataset().
+ *
+ * The size histograms are indexed by power of two, bucket 0 holding
+ * blocks of up to SPA_MINBLOCKSIZE and the last bucket everything of
+ * SPA_MAXBLOCKSIZE and up.  The ratio histogram is indexed by lsize/psize
+ * against dmu_sample_ratio_limits[], in hundredths.
+ */
+#define	DMU_SAMPLE_SIZE_BUCKETS	(SPA_MAXBLOCKSHIFT - SPA_MINBLOCKSHIFT + 1)
+#define	DMU_SAMPLE_RATIO_BUCKETS	8
+
+/* one million parts per million: visit every block */
+#define	DMU_SAMPLE_RATE_ALL	1000000ULL
+
+typedef struct dmu_sample_stats {
+	uint64_t	dss_rate;	/* parts per million sampled */
+	uint64_t	dss_units;	/* sampling units seen */
+	uint64_t	dss_units_sampled; /* sampling units followed */
+	uint64_t	dss_blocks;	/* L0 data blocks counted */
+	uint64_t	dss_embedded;	/* of which embedded in their bp */
+	uint64_t	dss_lsize;
+	uint64_t	dss_psize;
+	uint64_t	dss_asize;
+	uint64_t	dss_special_blocks; /* allocated on special vdevs */
+	uint64_t	dss_special_asize;
+	uint64_t	dss_lsize_hist[DMU_SAMPLE_SIZE_BUCKETS];
+	uint64_t	dss_psize_hist[DMU_SAMPLE_SIZE_BUCKETS];
+	uint64_t	dss_asize_hist[DMU_SAMPLE_SIZE_BUCKETS];
+	uint64_t	dss_ratio_hist[DMU_SAMPLE_RATIO_BUCKETS];
+	uint64_t	dss_comp_blocks[ZIO_COMPRESS_FUNCTIONS];
+	uint64_t	dss_comp_lsize[ZIO_COMPRESS_FUNCTIONS];
+	uint64_t	dss_comp_psize[ZIO_COMPRESS_FUNCTIONS];
+} dmu_sample_stats_t;
+
+extern const uint64_t dmu_sample_ratio_limits[DMU_SAMPLE_RATIO_BUCKETS];
+
+int dmu_sample_dataset(struct dsl_dataset *ds, uint64_t rate,
+    dmu_sample_stats_t *dss);
+void dmu_sample_to_nvlist(const dmu_sample_stats_t *dss, nvlist_t *nvl);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DMU_SAMPLE_H */
@@ -40,17 +40,22 @@ struct dmu_replay_record;
 
 extern const char *recv_clone_name;
 
+/* Objects to leave out of a send stream; see dmu_send_filter_create(). */
+typedef struct dmu_send_filter dmu_send_filter_t;
+
+int dmu_send_filter_create(nvlist_t *nvl, dmu_send_filter_t **dsfp);
+void dmu_send_filter_destroy(dmu_send_filter_t *dsf);
 int dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
-    boolean_t large_block_ok, boolean_t compressok, int outfd,
-    uint64_t resumeobj, uint64_t resumeoff,
+    boolean_t large_block_ok, boolean_t compressok, dmu_send_filter_t *filter,
+    int outfd, uint64_t resumeobj, uint64_t resumeoff,
     struct vnode *vp, offset_t *off);
 int dmu_send_estimate(struct dsl_dataset *ds, struct dsl_dataset *fromds,
-    boolean_t stream_compressed, uint64_t *sizep);
+    boolean_t stream_compressed, uint64_t *sizep, uint64_t *errorp);
 int dmu_send_estimate_from_txg(struct dsl_dataset *ds, uint64_t fromtxg,
-    boolean_t stream_compressed, uint64_t *sizep);
+    boolean_t stream_compressed, uint64_t *sizep, uint64_t *errorp);
 int dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    int outfd, struct vnode *vp, offset_t *off);
+    dmu_send_filter_t *filter, int outfd, struct vnode *vp, offset_t *off);
 
 typedef struct dmu_recv_cookie {
 	struct dsl_dataset *drc_ds;
@@ -62,6 +67,8 @@ typedef struct dmu_recv_cookie {
 	boolean_t drc_byteswap;
 	boolean_t drc_force;
 	boolean_t drc_resumable;
+	boolean_t drc_readahead;
+	boolean_t drc_filtered;
 	struct avl_tree *drc_guid_to_ds_map;
 	zio_cksum_t drc_cksum;
 	uint64_t drc_newsnapobj;
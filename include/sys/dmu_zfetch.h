@@ -37,12 +37,30 @@ extern "C" {
 #endif
 
 extern uint64_t	zfetch_array_rd_sz;
+extern uint64_t	zfetch_sequential_min;
 
 struct dnode;				/* so we can reference dnode */
 
+/*
+ * Access patterns a stream can follow.  A forward stream reads contiguous
+ * blocks in ascending order.  A strided stream reads zs_len blocks every
+ * zs_stride blocks, and a reverse stream does the same with a negative
+ * zs_stride (a contiguous backwards read has zs_stride == -zs_len).
+ */
+typedef enum zfetch_pattern {
+	ZFETCH_FORWARD,
+	ZFETCH_STRIDE,
+	ZFETCH_REVERSE
+} zfetch_pattern_t;
+
 typedef struct zstream {
 	uint64_t        zs_blkid;       /* expect next access at this blkid */
 	uint64_t        zs_pf_blkid;    /* next block to prefetch */
+	uint64_t	zs_start_blkid;	/* blkid the stream was created at */
+	int64_t		zs_stride;	/* blocks between strided accesses */
+	uint32_t	zs_len;		/* blocks per access */
+	uint32_t	zs_hits;	/* accesses that matched the stream */
+	zfetch_pattern_t zs_pattern;	/* access pattern followed */
 
 	/*
 	 * We will next prefetch the L1 indirect block of this level-0
@@ -36,6 +36,7 @@
 #include <sys/dmu_zfetch.h>
 #include <sys/zrlock.h>
 #include <sys/multilist.h>
+#include <sys/zfs_lockstat.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -57,7 +58,7 @@ extern "C" {
 /*
  * Fixed constants.
  */
-#define	DNODE_SHIFT		9	/* 512 bytes */
+#define	DNODE_SHIFT		9	/* 512 bytes, the size of a slot */
 #define	DN_MIN_INDBLKSHIFT	12	/* 4k */
 /*
  * If we ever increase this value beyond 20, we need to revisit all logic that
@@ -85,17 +86,42 @@ extern "C" {
 
 /*
  * Derived constants.
+ *
+ * With the large_dnode feature a dnode may occupy several consecutive
+ * 512-byte slots of a dnode block (dn_extra_slots records how many beyond
+ * the first); the extra space goes to the bonus buffer.  DN_MAX_BONUSLEN
+ * is the bonus space of a legacy, single slot dnode.
  */
 #define	DNODE_SIZE	(1 << DNODE_SHIFT)
+#define	DNODE_MIN_SIZE	DNODE_SIZE
+#define	DNODE_MAX_SIZE	(1 << DNODE_BLOCK_SHIFT)
+#define	DNODE_BLOCK_SIZE	(1 << DNODE_BLOCK_SHIFT)
+#define	DNODE_MIN_SLOTS	(DNODE_MIN_SIZE >> DNODE_SHIFT)
+#define	DNODE_MAX_SLOTS	(DNODE_MAX_SIZE >> DNODE_SHIFT)
+#define	DN_BONUS_SIZE(dnsize)	((dnsize) - DNODE_CORE_SIZE - \
+	(1 << SPA_BLKPTRSHIFT))
+#define	DN_SLOTS_TO_BONUSLEN(slots)	DN_BONUS_SIZE((slots) << DNODE_SHIFT)
 #define	DN_MAX_NBLKPTR	((DNODE_SIZE - DNODE_CORE_SIZE) >> SPA_BLKPTRSHIFT)
-#define	DN_MAX_BONUSLEN	(DNODE_SIZE - DNODE_CORE_SIZE - (1 << SPA_BLKPTRSHIFT))
+#define	DN_MAX_BONUSLEN	(DN_BONUS_SIZE(DNODE_MIN_SIZE))
+#define	DN_MAX_SLOTS_BONUSLEN	(DN_BONUS_SIZE(DNODE_MAX_SIZE))
 #define	DN_MAX_OBJECT	(1ULL << DN_MAX_OBJECT_SHIFT)
-#define	DN_ZERO_BONUSLEN	(DN_MAX_BONUSLEN + 1)
+#define	DN_ZERO_BONUSLEN	(DN_MAX_SLOTS_BONUSLEN + 1)
 #define	DN_KILL_SPILLBLK (1)
 
 #define	DNODES_PER_BLOCK_SHIFT	(DNODE_BLOCK_SHIFT - DNODE_SHIFT)
 #define	DNODES_PER_BLOCK	(1ULL << DNODES_PER_BLOCK_SHIFT)
 
+/*
+ * States of the slots of a dnode block, held in dnh_dnode when it does not
+ * point at a dnode_t.  An interior slot is covered by a preceding
+ * multi-slot dnode and cannot be held or allocated on its own.
+ */
+#define	DN_SLOT_UNINIT		((void *)NULL)	/* not yet initialized */
+#define	DN_SLOT_FREE		((void *)1UL)	/* free slot */
+#define	DN_SLOT_ALLOCATED	((void *)2UL)	/* allocated, no dnode_t */
+#define	DN_SLOT_INTERIOR	((void *)3UL)	/* inside a larger dnode */
+#define	DN_SLOT_IS_PTR(dn)	((void *)(dn) > DN_SLOT_INTERIOR)
+
 /*
  * This is inaccurate if the indblkshift of the particular object is not the
  * max.  But it's only used by userland to calculate the zvol reservation.
@@ -110,6 +136,16 @@ extern "C" {
 #define	DN_BONUS(dnp)	((void*)((dnp)->dn_bonus + \
 	(((dnp)->dn_nblkptr - 1) * sizeof (blkptr_t))))
 
+/* the spill block pointer is at the very end of the dnode's last slot */
+#define	DN_SPILL_BLKPTR(dnp)	((blkptr_t *)((char *)(dnp) + \
+	(((dnp)->dn_extra_slots + 1) << DNODE_SHIFT) - (1 << SPA_BLKPTRSHIFT)))
+
+#define	DN_MAX_BONUS_LEN(dnp) \
+	(((dnp)->dn_flags & DNODE_FLAG_SPILL_BLKPTR) ? \
+	(uint8_t *)DN_SPILL_BLKPTR(dnp) - (uint8_t *)DN_BONUS(dnp) : \
+	(uint8_t *)((dnp) + (dnp)->dn_extra_slots + 1) - \
+	(uint8_t *)DN_BONUS(dnp))
+
 #define	DN_USED_BYTES(dnp) (((dnp)->dn_flags & DNODE_FLAG_USED_BYTES) ? \
 	(dnp)->dn_used : (dnp)->dn_used << SPA_MINBLOCKSHIFT)
 
@@ -143,7 +179,8 @@ typedef struct dnode_phys {
 	uint8_t dn_flags;		/* DNODE_FLAG_* */
 	uint16_t dn_datablkszsec;	/* data block size in 512b sectors */
 	uint16_t dn_bonuslen;		/* length of dn_bonus */
-	uint8_t dn_pad2[4];
+	uint8_t dn_extra_slots;		/* # of subsequent slots consumed */
+	uint8_t dn_pad2[3];
 
 	/* accounting is protected by dn_dirty_mtx */
 	uint64_t dn_maxblkid;		/* largest allocated block ID */
@@ -152,8 +189,10 @@ typedef struct dnode_phys {
 	uint64_t dn_pad3[4];
 
 	/*
-	 * The tail region is 448 bytes, and there are three ways to
-	 * look at it.
+	 * The tail region is 448 bytes for a dnode of one slot, and there
+	 * are three ways to look at it.  A dnode of more slots extends the
+	 * bonus buffer into them, and keeps dn_spill at the end of its last
+	 * slot (see DN_SPILL_BLKPTR()).
 	 *
 	 * 0       64      128     192     256     320     384     448 (offset)
 	 * +---------------+---------------+---------------+-------+
@@ -210,6 +249,7 @@ struct dnode {
 	uint8_t dn_indblkshift;
 	uint8_t dn_datablkshift;	/* zero if blksz not power of 2! */
 	uint8_t dn_moved;		/* Has this dnode been moved? */
+	uint8_t dn_num_slots;		/* metadnode slots consumed on disk */
 	uint16_t dn_datablkszsec;	/* in 512b sectors */
 	uint32_t dn_datablksz;		/* in bytes */
 	uint64_t dn_maxblkid;
@@ -309,7 +349,7 @@ void dnode_rm_spill(dnode_t *dn, dmu_tx_t *tx);
 
 int dnode_hold(struct objset *dd, uint64_t object,
     void *ref, dnode_t **dnp);
-int dnode_hold_impl(struct objset *dd, uint64_t object, int flag,
+int dnode_hold_impl(struct objset *dd, uint64_t object, int flag, int dn_slots,
     void *ref, dnode_t **dnp);
 boolean_t dnode_add_ref(dnode_t *dn, void *ref);
 void dnode_rele(dnode_t *dn, void *ref);
@@ -317,10 +357,11 @@ void dnode_rele_and_unlock(dnode_t *dn, void *tag);
 void dnode_setdirty(dnode_t *dn, dmu_tx_t *tx);
 void dnode_sync(dnode_t *dn, dmu_tx_t *tx);
 void dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
-    dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
+    dmu_object_type_t bonustype, int bonuslen, int dn_slots, dmu_tx_t *tx);
 void dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
-    dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
+    dmu_object_type_t bonustype, int bonuslen, int dn_slots, dmu_tx_t *tx);
 void dnode_free(dnode_t *dn, dmu_tx_t *tx);
+void dnode_free_interior_slots(dnode_t *dn);
 void dnode_byteswap(dnode_phys_t *dnp);
 void dnode_buf_byteswap(void *buf, size_t size);
 void dnode_verify(dnode_t *dn);
@@ -0,0 +1,134 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_DSL_CRYPT_H
+#define	_SYS_DSL_CRYPT_H
+
+#include <sys/zfs_context.h>
+#include <sys/avl.h>
+#include <sys/refcount.h>
+#include <sys/nvpair.h>
+#include <sys/zio_crypt.h>
+#include <sys/fs/zfs.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct dsl_dir;
+struct dsl_dataset;
+struct dmu_tx;
+struct spa;
+struct zbookmark_phys;
+
+/*
+ * ZAP entries of the key object.  The key object is a MOS ZAP shared by
+ * an encryption root and every dataset (child, snapshot or clone) that
+ * inherits its key; DSL_CRYPTO_KEY_REFCOUNT counts the dsl_dirs using it.
+ */
+#define	DSL_CRYPTO_KEY_CRYPTO_SUITE	"DSL_CRYPTO_SUITE"
+#define	DSL_CRYPTO_KEY_GUID		"DSL_CRYPTO_GUID"
+#define	DSL_CRYPTO_KEY_IV		"DSL_CRYPTO_IV"
+#define	DSL_CRYPTO_KEY_MAC		"DSL_CRYPTO_MAC"
+#define	DSL_CRYPTO_KEY_MASTER_KEY	"DSL_CRYPTO_MASTER_KEY_1"
+#define	DSL_CRYPTO_KEY_REFCOUNT		"DSL_CRYPTO_REFCOUNT"
+#define	DSL_CRYPTO_KEY_ROOT_DDOBJ	"DSL_CRYPTO_ROOT_DDOBJ"
+#define	DSL_CRYPTO_KEY_FORMAT		"DSL_CRYPTO_KEYFORMAT"
+
+/* the user's key, only held while it is needed to (un)wrap a master key */
+typedef struct dsl_wrapping_key {
+	crypto_key_t	wk_key;
+	uint8_t		wk_keydata[WRAPPING_KEY_LEN];
+} dsl_wrapping_key_t;
+
+/*
+ * Encryption parameters of a dataset being created.  A new encryption
+ * root either has a wrapping key, from which a new master key is made,
+ * or (for a raw receive) the already wrapped key from the send stream.
+ */
+typedef struct dsl_crypto_params {
+	uint64_t		cp_crypt;	/* enum zio_encrypt */
+	zfs_keyformat_t		cp_keyformat;
+	dsl_wrapping_key_t	*cp_wkey;
+	nvlist_t		*cp_keydata;	/* raw receive only */
+} dsl_crypto_params_t;
+
+/* a loaded master key */
+typedef struct dsl_crypto_key {
+	avl_node_t		dck_avl_link;
+	refcount_t		dck_holds;	/* mounted fs, open zvols */
+	uint64_t		dck_obj;	/* key object */
+	zio_crypt_key_t		dck_key;
+} dsl_crypto_key_t;
+
+/*
+ * The zio layer only knows the objset (dataset) number of a block, so
+ * every encrypted dataset that has been opened gets a mapping from its
+ * dataset object to its key object.
+ */
+typedef struct dsl_key_mapping {
+	avl_node_t		km_avl_link;
+	uint64_t		km_dsobj;
+	uint64_t		km_key_obj;
+} dsl_key_mapping_t;
+
+typedef struct spa_keystore {
+	krwlock_t		sk_lock;
+	avl_tree_t		sk_dslkeys;	/* dsl_crypto_key_t by dck_obj */
+	avl_tree_t		sk_key_mappings; /* dsl_key_mapping_t */
+} spa_keystore_t;
+
+int dsl_wrapping_key_create(uint8_t *wkeydata, uint_t wkeylen,
+    dsl_wrapping_key_t **wkey_out);
+void dsl_wrapping_key_free(dsl_wrapping_key_t *wkey);
+
+int dsl_crypto_params_create_nvlist(nvlist_t *props, nvlist_t *crypto_args,
+    dsl_crypto_params_t **dcp_out);
+void dsl_crypto_params_free(dsl_crypto_params_t *dcp);
+int dsl_crypto_params_check(struct dsl_dir *pdd, struct dsl_dataset *origin,
+    dsl_crypto_params_t *dcp);
+void dsl_crypto_key_create_sync(struct dsl_dir *dd, struct dsl_dir *pdd,
+    struct dsl_dataset *origin, dsl_crypto_params_t *dcp,
+    struct dmu_tx *tx);
+void dsl_crypto_key_destroy_sync(struct dsl_dir *dd, struct dmu_tx *tx);
+int dsl_crypto_key_get_raw(struct dsl_dir *dd, nvlist_t **keydata);
+int dsl_crypto_key_check_raw(struct dsl_dir *dd, nvlist_t *keydata);
+void dsl_dataset_crypt_stats(struct dsl_dataset *ds, nvlist_t *nv);
+
+void spa_keystore_init(spa_keystore_t *sk);
+void spa_keystore_fini(spa_keystore_t *sk);
+int spa_keystore_load_wkey(const char *dsname, dsl_wrapping_key_t *wkey);
+int spa_keystore_unload_wkey(const char *dsname);
+boolean_t spa_keystore_key_loaded(struct spa *spa, uint64_t key_obj);
+void spa_keystore_create_mapping(struct spa *spa, uint64_t dsobj,
+    uint64_t key_obj);
+void spa_keystore_remove_mapping(struct spa *spa, uint64_t dsobj);
+int spa_keystore_hold_dsl_key(struct spa *spa, uint64_t dsobj, void *tag);
+void spa_keystore_rele_dsl_key(struct spa *spa, uint64_t dsobj, void *tag);
+int spa_do_crypt_abd(boolean_t encrypt, struct spa *spa,
+    const struct zbookmark_phys *zb, blkptr_t *bp, uint_t datalen,
+    abd_t *pabd, abd_t *cabd);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DSL_CRYPT_H */
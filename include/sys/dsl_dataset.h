@@ -48,6 +48,7 @@ extern "C" {
 struct dsl_dataset;
 struct dsl_dir;
 struct dsl_pool;
+struct dsl_crypto_params;
 
 
 #define	DS_FLAG_INCONSISTENT	(1ULL<<0)
@@ -74,6 +75,15 @@ struct dsl_pool;
 #define	DS_IS_DEFER_DESTROY(ds)	\
 	(dsl_dataset_phys(ds)->ds_flags & DS_FLAG_DEFER_DESTROY)
 
+/*
+ * DS_FLAG_FILTERED is set on datasets received from a stream that left
+ * some objects out ('zfs send -X'), whose directories may name files that
+ * are not there.  Such file systems are not mounted.
+ */
+#define	DS_FLAG_FILTERED	(1ULL<<4)
+#define	DS_IS_FILTERED(ds)	\
+	(dsl_dataset_phys(ds)->ds_flags & DS_FLAG_FILTERED)
+
 /*
  * DS_FIELD_* are strings that are used in the "extensified" dataset zap object.
  * They should be of the format <reverse-dns>:<field>.
@@ -180,7 +190,7 @@ typedef struct dsl_dataset {
 	 * Owning counts as a long hold.  See the comments above
 	 * dsl_pool_hold() for details.
 	 */
-	refcount_t ds_longholds;
+	refcount_percpu_t ds_longholds;
 
 	/* no locking; only for making guesses */
 	uint64_t ds_trysnap_txg;
@@ -256,7 +266,8 @@ boolean_t dsl_dataset_tryown(dsl_dataset_t *ds, void *tag);
 int dsl_dataset_namelen(dsl_dataset_t *ds);
 boolean_t dsl_dataset_has_owner(dsl_dataset_t *ds);
 uint64_t dsl_dataset_create_sync(dsl_dir_t *pds, const char *lastname,
-    dsl_dataset_t *origin, uint64_t flags, cred_t *, dmu_tx_t *);
+    dsl_dataset_t *origin, uint64_t flags, cred_t *,
+    struct dsl_crypto_params *, dmu_tx_t *);
 uint64_t dsl_dataset_create_sync_dd(dsl_dir_t *dd, dsl_dataset_t *origin,
     uint64_t flags, dmu_tx_t *tx);
 int dsl_dataset_snapshot(nvlist_t *snaps, nvlist_t *props, nvlist_t *errors);
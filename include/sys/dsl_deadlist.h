@@ -45,8 +45,10 @@ typedef struct dsl_deadlist_phys {
 typedef struct dsl_deadlist {
 	objset_t *dl_os;
 	uint64_t dl_object;
-	avl_tree_t dl_tree;
+	avl_tree_t dl_tree;		/* of dsl_deadlist_entry_t */
 	boolean_t dl_havetree;
+	avl_tree_t dl_cache;		/* of dsl_deadlist_cache_entry_t */
+	boolean_t dl_havecache;
 	struct dmu_buf *dl_dbuf;
 	dsl_deadlist_phys_t *dl_phys;
 	kmutex_t dl_lock;
@@ -62,6 +64,19 @@ typedef struct dsl_deadlist_entry {
 	bpobj_t dle_bpobj;
 } dsl_deadlist_entry_t;
 
+/*
+ * The space of one key's bpobj, as read when the deadlist was loaded.
+ * This is all dsl_deadlist_space_range() needs, and unlike dl_tree it
+ * keeps no bpobj held; it is discarded once the deadlist is modified.
+ */
+typedef struct dsl_deadlist_cache_entry {
+	avl_node_t dlce_node;
+	uint64_t dlce_mintxg;
+	uint64_t dlce_bytes;
+	uint64_t dlce_comp;
+	uint64_t dlce_uncomp;
+} dsl_deadlist_cache_entry_t;
+
 void dsl_deadlist_open(dsl_deadlist_t *dl, objset_t *os, uint64_t object);
 void dsl_deadlist_close(dsl_deadlist_t *dl);
 uint64_t dsl_deadlist_alloc(objset_t *os, dmu_tx_t *tx);
@@ -77,6 +92,7 @@ void dsl_deadlist_space_range(dsl_deadlist_t *dl,
     uint64_t mintxg, uint64_t maxtxg,
     uint64_t *usedp, uint64_t *compp, uint64_t *uncompp);
 void dsl_deadlist_merge(dsl_deadlist_t *dl, uint64_t obj, dmu_tx_t *tx);
+void dsl_deadlist_prefetch(dsl_deadlist_t *dl);
 void dsl_deadlist_move_bpobj(dsl_deadlist_t *dl, bpobj_t *bpo, uint64_t mintxg,
     dmu_tx_t *tx);
 
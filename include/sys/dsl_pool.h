@@ -55,10 +55,14 @@ struct dsl_scan;
 extern uint64_t zfs_dirty_data_max;
 extern uint64_t zfs_dirty_data_max_max;
 extern uint64_t zfs_dirty_data_sync;
+extern uint64_t zfs_dirty_data_cpu_slack;
 extern int zfs_dirty_data_max_percent;
 extern int zfs_dirty_data_max_max_percent;
 extern int zfs_delay_min_dirty_percent;
+extern int zfs_dirty_data_fair;
 extern uint64_t zfs_delay_scale;
+extern int zfs_delay_sync_target_ms;
+extern int zfs_txg_early_write;
 
 /* These macros are for indexing into the zfs_all_blkstats_t. */
 #define	DMU_OT_DEFERRED	DMU_OT_NONE
@@ -81,6 +85,26 @@ typedef struct zfs_all_blkstats {
 } zfs_all_blkstats_t;
 
 
+/* States of the dirty data write throttle, see dsl_pool_dirty_delta() */
+typedef enum dsl_pool_throttle_state {
+	DP_THROTTLE_NONE,	/* under zfs_delay_min_dirty_percent */
+	DP_THROTTLE_DELAY,	/* transactions are being delayed */
+	DP_THROTTLE_STALL,	/* at zfs_dirty_data_max, assigns block */
+	DP_THROTTLE_STATES
+} dsl_pool_throttle_state_t;
+
+typedef struct dsl_pool_throttle_stats {
+	uint64_t	dpts_dirty;		/* dirty bytes now */
+	uint64_t	dpts_dirty_peak;	/* most dirty bytes seen */
+	uint64_t	dpts_delay_scale;	/* zfs_delay_scale in use */
+	uint64_t	dpts_delays;		/* transactions delayed */
+	uint64_t	dpts_delay_time;	/* nsecs they slept */
+	uint64_t	dpts_stalls;		/* waits at the dirty max */
+	uint64_t	dpts_stall_time;	/* nsecs they waited */
+	uint64_t	dpts_passes;		/* not delayed, under share */
+	uint64_t	dpts_state_time[DP_THROTTLE_STATES]; /* nsecs in each */
+} dsl_pool_throttle_stats_t;
+
 typedef struct dsl_pool {
 	/* Immutable */
 	spa_t *dp_spa;
@@ -111,6 +135,10 @@ typedef struct dsl_pool {
 	uint64_t dp_mos_used_delta;
 	uint64_t dp_mos_compressed_delta;
 	uint64_t dp_mos_uncompressed_delta;
+	uint64_t dp_dirty_peak;
+	dsl_pool_throttle_state_t dp_throttle_state;
+	hrtime_t dp_throttle_start;	/* when dp_throttle_state was entered */
+	hrtime_t dp_throttle_time[DP_THROTTLE_STATES];
 
 	/*
 	 * Time of most recently scheduled (furthest in the future)
@@ -118,6 +146,19 @@ typedef struct dsl_pool {
 	 */
 	hrtime_t dp_last_wakeup;
 
+	/* Atomic counters of write throttle waits */
+	uint64_t dp_throttle_delays;
+	uint64_t dp_throttle_delay_time;
+	uint64_t dp_throttle_stalls;
+	uint64_t dp_throttle_stall_time;
+	uint64_t dp_throttle_passes;	/* under their dataset's share */
+
+	/* Atomic, dirty_weight of the datasets writing in each txg */
+	uint64_t dp_dirty_weight[TXG_SIZE];
+
+	/* Sync thread only, see dsl_pool_delay_adjust() */
+	uint64_t dp_delay_scale;
+
 	/* Has its own locking */
 	tx_state_t dp_tx;
 	txg_list_t dp_dirty_datasets;
@@ -125,6 +166,7 @@ typedef struct dsl_pool {
 	txg_list_t dp_dirty_dirs;
 	txg_list_t dp_sync_tasks;
 	taskq_t *dp_sync_taskq;
+	uint64_t dp_sync_dnodes_time;	/* atomic, dnode_sync() nsecs */
 
 	/*
 	 * Protects administrative changes (properties, namespace)
@@ -145,9 +187,11 @@ dsl_pool_t *dsl_pool_create(spa_t *spa, nvlist_t *zplprops, uint64_t txg);
 void dsl_pool_sync(dsl_pool_t *dp, uint64_t txg);
 void dsl_pool_sync_done(dsl_pool_t *dp, uint64_t txg);
 int dsl_pool_sync_context(dsl_pool_t *dp);
+uint64_t dsl_pool_early_write(dsl_pool_t *dp, uint64_t txg);
 uint64_t dsl_pool_adjustedsize(dsl_pool_t *dp, boolean_t netfree);
 uint64_t dsl_pool_adjustedfree(dsl_pool_t *dp, boolean_t netfree);
 void dsl_pool_dirty_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx);
+void dsl_pool_dirty_fold(dsl_pool_t *dp, uint64_t space, uint64_t txg);
 void dsl_pool_undirty_space(dsl_pool_t *dp, int64_t space, uint64_t txg);
 void dsl_free(dsl_pool_t *dp, uint64_t txg, const blkptr_t *bpp);
 void dsl_free_sync(zio_t *pio, dsl_pool_t *dp, uint64_t txg,
@@ -164,6 +208,11 @@ void dsl_pool_upgrade_dir_clones(dsl_pool_t *dp, dmu_tx_t *tx);
 void dsl_pool_mos_diduse_space(dsl_pool_t *dp,
     int64_t used, int64_t comp, int64_t uncomp);
 boolean_t dsl_pool_need_dirty_delay(dsl_pool_t *dp);
+uint64_t dsl_pool_dirty_weight(dsl_pool_t *dp);
+uint64_t dsl_pool_delay_scale(dsl_pool_t *dp);
+void dsl_pool_delay_adjust(dsl_pool_t *dp, hrtime_t sync_time);
+void dsl_pool_throttle_stats(dsl_pool_t *dp, dsl_pool_throttle_stats_t *dpts);
+void dsl_pool_throttle_stats_reset(dsl_pool_t *dp);
 void dsl_pool_config_enter(dsl_pool_t *dp, void *tag);
 void dsl_pool_config_enter_prio(dsl_pool_t *dp, void *tag);
 void dsl_pool_config_exit(dsl_pool_t *dp, void *tag);
@@ -70,9 +70,17 @@ typedef struct dsl_scan_phys {
 
 typedef enum dsl_scan_flags {
 	DSF_VISIT_DS_AGAIN = 1<<0,
+	DSF_TXG_RANGE = 1<<1,	/* scrub of the blocks born in a txg range */
+	DSF_DATASETS = 1<<2,	/* scrub of a set of datasets */
 } dsl_scan_flags_t;
 
-#define	DSL_SCAN_FLAGS_MASK (DSF_VISIT_DS_AGAIN)
+#define	DSL_SCAN_FLAGS_MASK (DSF_VISIT_DS_AGAIN | DSF_TXG_RANGE | DSF_DATASETS)
+
+/*
+ * The most blocks of a traversal path that are recorded: an objset, the
+ * levels of its meta-dnode, a dnode block and the levels of an object.
+ */
+#define	DSL_SCAN_PATH_MAX	24
 
 /*
  * Every pool will have one dsl_scan_t and this structure will contain
@@ -98,6 +106,31 @@ typedef enum dsl_scan_flags {
  *			the scan but have not yet been processed (i.e deferred
  *			frees) are accounted for.
  *
+ * scn_phys_cached -	the last state of the scan at which no block
+ *			pointers were held in the scan I/O queues.  This
+ *			is what is written to disk, so that a scan resumed
+ *			after a reboot never skips blocks that were queued
+ *			but not yet read.
+ *
+ * scn_pause_path -	the blocks the traversal had recursed into when it
+ *			paused at scn_bookmark.  It is written to disk
+ *			with the scan state, and when the scan resumes
+ *			after a reboot these blocks are all prefetched at
+ *			once, rather than read one level at a time on the
+ *			way back down to the bookmark.
+ *
+ * scn_checkpoint -	set when the traversal has moved on to another
+ *			dataset in this txg, which changes the on-disk
+ *			dataset queue.  The scan I/O queues are then
+ *			drained before the txg ends, so that the on-disk
+ *			scan state can be brought up to date with them.
+ *
+ * Unless zfs_scan_legacy is set, the blocks found by the traversal are
+ * not read right away.  They are sorted by offset into a queue per
+ * top-level vdev (see dsl_scan_io_queue_t), and issued later as mostly
+ * sequential extents, once the queues fill their memory budget or the
+ * traversal completes.
+ *
  * This structure also maintains information about deferred frees which are
  * a special kind of traversal. Deferred free can exist in either a bptree or
  * a bpobj structure. The scn_is_bptree flag will indicate the type of
@@ -117,18 +150,51 @@ typedef struct dsl_scan {
 	boolean_t scn_is_bptree;
 	boolean_t scn_async_destroying;
 	boolean_t scn_async_stalled;
+	uint64_t scn_free_max_blocks;	/* adaptive per-txg block limit */
+	int64_t scn_freed_used;		/* freed space not yet charged */
+	int64_t scn_freed_comp;		/* to dp_free_dir, see */
+	int64_t scn_freed_uncomp;	/* dsl_scan_free_account() */
+	uint64_t scn_freed_this_txg;	/* bytes freed this txg */
+	uint64_t scn_free_rate;		/* average bytes freed per sec */
+	hrtime_t scn_free_rate_time;	/* when scn_free_rate was updated */
 
 	/* for debugging / information */
 	uint64_t scn_visited_this_txg;
 
+	/* for sorting scan I/O */
+	boolean_t scn_traversal_done;	/* all blocks have been queued */
+	boolean_t scn_checkpoint;	/* drain queues before txg ends */
+	boolean_t scn_priority_done;	/* no resilver_priority ds queued */
+	uint64_t scn_queues_mem;	/* memory held by queued I/O */
+	uint64_t scn_queues_bytes;	/* data bytes of queued I/O */
+
+	/* for throttling scan I/O, see dsl_scan_throttle() */
+	int scn_delay;			/* ticks to delay each I/O */
+	int64_t scn_rate_start;		/* lbolt the rate window began */
+	uint64_t scn_rate_bytes;	/* bytes issued in the window */
+
+	/* the path down to scn_bookmark, see dsl_scan_path_sync() */
+	int scn_path_depth;		/* blocks recursed into */
+	int scn_pause_depth;		/* blocks in scn_pause_path */
+	boolean_t scn_path_dirty;	/* scn_pause_path not on disk */
+	boolean_t scn_path_ondisk;	/* DMU_POOL_SCAN_PATH exists */
+	boolean_t scn_path_resume;	/* prefetch scn_pause_path */
+	blkptr_t scn_path[DSL_SCAN_PATH_MAX];
+	blkptr_t scn_pause_path[DSL_SCAN_PATH_MAX];
+
 	dsl_scan_phys_t scn_phys;
+	dsl_scan_phys_t scn_phys_cached;
 } dsl_scan_t;
 
+typedef struct dsl_scan_io_queue dsl_scan_io_queue_t;
+
 int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
 void dsl_scan_fini(struct dsl_pool *dp);
 void dsl_scan_sync(struct dsl_pool *, dmu_tx_t *);
 int dsl_scan_cancel(struct dsl_pool *);
 int dsl_scan(struct dsl_pool *, pool_scan_func_t);
+int dsl_scan_restricted(struct dsl_pool *, pool_scan_func_t, uint64_t,
+    uint64_t, nvlist_t *);
 void dsl_resilver_restart(struct dsl_pool *, uint64_t txg);
 boolean_t dsl_scan_resilvering(struct dsl_pool *dp);
 boolean_t dsl_dataset_unstable(struct dsl_dataset *ds);
@@ -139,6 +205,9 @@ void dsl_scan_ds_snapshotted(struct dsl_dataset *ds, struct dmu_tx *tx);
 void dsl_scan_ds_clone_swapped(struct dsl_dataset *ds1, struct dsl_dataset *ds2,
     struct dmu_tx *tx);
 boolean_t dsl_scan_active(dsl_scan_t *scn);
+uint64_t dsl_scan_free_rate(dsl_scan_t *scn);
+void dsl_scan_freed(spa_t *spa, const blkptr_t *bp);
+void dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue);
 
 #ifdef	__cplusplus
 }
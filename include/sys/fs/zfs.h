@@ -176,6 +176,15 @@ typedef enum {
 	ZFS_PROP_PREV_SNAP,
 	ZFS_PROP_OVERLAY,
 	ZFS_PROP_RECEIVE_RESUME_TOKEN,
+	ZFS_PROP_ENCRYPTION,
+	ZFS_PROP_KEYLOCATION,
+	ZFS_PROP_KEYFORMAT,
+	ZFS_PROP_KEYSTATUS,
+	ZFS_PROP_PRIMARYCACHE_QUOTA,
+	ZFS_PROP_DNODESIZE,
+	ZFS_PROP_SPECIAL_SMALL_BLOCKS,
+	ZFS_PROP_RESILVER_PRIORITY,
+	ZFS_PROP_DIRTY_WEIGHT,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -223,6 +232,10 @@ typedef enum {
 	ZPOOL_PROP_LEAKED,
 	ZPOOL_PROP_MAXBLOCKSIZE,
 	ZPOOL_PROP_TNAME,
+	ZPOOL_PROP_AUTOTRIM,
+	ZPOOL_PROP_SCANRATE,
+	ZPOOL_PROP_DEDUPQUOTA,
+	ZPOOL_PROP_FREERATE,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -271,6 +284,12 @@ typedef int (*zprop_func)(int, void *);
  */
 #define	ZPOOL_ROOTFS_PROPS	"root-props-nvl"
 
+/*
+ * Ioctl arguments that must never end up in the pool history, such as
+ * wrapping keys, are passed in their own nvlist.
+ */
+#define	ZPOOL_HIDDEN_ARGS	"hidden_args"
+
 /*
  * Dataset property functions shared between libzfs and kernel.
  */
@@ -345,7 +364,8 @@ typedef enum {
 
 typedef enum {
 	ZFS_LOGBIAS_LATENCY = 0,
-	ZFS_LOGBIAS_THROUGHPUT = 1
+	ZFS_LOGBIAS_THROUGHPUT = 1,
+	ZFS_LOGBIAS_HYBRID = 2
 } zfs_logbias_op_t;
 
 typedef enum zfs_share_op {
@@ -367,7 +387,8 @@ typedef enum zfs_smb_acl_op {
 typedef enum zfs_cache_type {
 	ZFS_CACHE_NONE = 0,
 	ZFS_CACHE_METADATA = 1,
-	ZFS_CACHE_ALL = 2
+	ZFS_CACHE_ALL = 2,
+	ZFS_CACHE_PREFETCH = 3		/* secondarycache only */
 } zfs_cache_type_t;
 
 typedef enum {
@@ -387,6 +408,34 @@ typedef enum {
 	ZFS_REDUNDANT_METADATA_MOST
 } zfs_redundant_metadata_type_t;
 
+typedef enum {
+	ZFS_DNSIZE_LEGACY = 0,
+	ZFS_DNSIZE_AUTO = 1,
+	ZFS_DNSIZE_1K = 1024,
+	ZFS_DNSIZE_2K = 2048,
+	ZFS_DNSIZE_4K = 4096,
+	ZFS_DNSIZE_8K = 8192,
+	ZFS_DNSIZE_16K = 16384
+} zfs_dnsize_type_t;
+
+/* Range of the dirty_weight property */
+#define	ZFS_DIRTY_WEIGHT_MIN		1
+#define	ZFS_DIRTY_WEIGHT_DEFAULT	100
+#define	ZFS_DIRTY_WEIGHT_MAX		1000
+
+typedef enum {
+	ZFS_KEYSTATUS_NONE = 0,
+	ZFS_KEYSTATUS_UNAVAILABLE,
+	ZFS_KEYSTATUS_AVAILABLE
+} zfs_keystatus_t;
+
+typedef enum {
+	ZFS_KEYFORMAT_NONE = 0,
+	ZFS_KEYFORMAT_RAW,
+	ZFS_KEYFORMAT_HEX,
+	ZFS_KEYFORMAT_FORMATS
+} zfs_keyformat_t;
+
 /*
  * On-disk version number.
  */
@@ -591,6 +640,9 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_VDEV_ASYNC_AGG_W_HISTO	"vdev_async_agg_w_histo"
 #define	ZPOOL_CONFIG_VDEV_AGG_SCRUB_HISTO	"vdev_agg_scrub_histo"
 
+/* Free segment size histogram of a top-level vdev, log2 of bytes */
+#define	ZPOOL_CONFIG_VDEV_FREE_HISTO	"vdev_free_histo"
+
 #define	ZPOOL_CONFIG_WHOLE_DISK		"whole_disk"
 #define	ZPOOL_CONFIG_ERRCOUNT		"error_count"
 #define	ZPOOL_CONFIG_NOT_PRESENT	"not_present"
@@ -603,6 +655,9 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_UNSPARE		"unspare"
 #define	ZPOOL_CONFIG_PHYS_PATH		"phys_path"
 #define	ZPOOL_CONFIG_IS_LOG		"is_log"
+#define	ZPOOL_CONFIG_IS_SPECIAL		"is_special"
+#define	ZPOOL_CONFIG_IS_DEDUP		"is_dedup"
+#define	ZPOOL_CONFIG_SEQUENTIAL		"sequential"
 #define	ZPOOL_CONFIG_L2CACHE		"l2cache"
 #define	ZPOOL_CONFIG_HOLE_ARRAY		"hole_array"
 #define	ZPOOL_CONFIG_VDEV_CHILDREN	"vdev_children"
@@ -610,6 +665,7 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_DDT_HISTOGRAM	"ddt_histogram"
 #define	ZPOOL_CONFIG_DDT_OBJ_STATS	"ddt_object_stats"
 #define	ZPOOL_CONFIG_DDT_STATS		"ddt_stats"
+#define	ZPOOL_CONFIG_DDT_PRUNED		"ddt_pruned"
 #define	ZPOOL_CONFIG_SPLIT		"splitcfg"
 #define	ZPOOL_CONFIG_ORIG_GUID		"orig_guid"
 #define	ZPOOL_CONFIG_SPLIT_GUID		"split_guid"
@@ -667,6 +723,8 @@ typedef struct zpool_rewind_policy {
 #define	VDEV_TYPE_HOLE			"hole"
 #define	VDEV_TYPE_SPARE			"spare"
 #define	VDEV_TYPE_LOG			"log"
+#define	VDEV_TYPE_SPECIAL		"special"
+#define	VDEV_TYPE_DEDUP			"dedup"
 #define	VDEV_TYPE_L2CACHE		"l2cache"
 
 /*
@@ -756,6 +814,22 @@ typedef enum pool_scan_func {
 	POOL_SCAN_FUNCS
 } pool_scan_func_t;
 
+/*
+ * Restrictions of a scrub, passed to ZFS_IOC_POOL_SCAN in zc_nvlist_src.
+ */
+#define	ZPOOL_SCAN_MIN_TXG	"scan_min_txg"	/* first birth txg */
+#define	ZPOOL_SCAN_MAX_TXG	"scan_max_txg"	/* last birth txg */
+#define	ZPOOL_SCAN_DATASETS	"scan_datasets"	/* nvlist of names */
+
+/*
+ * TRIM Functions.
+ */
+typedef enum pool_trim_func {
+	POOL_TRIM_START,
+	POOL_TRIM_STOP,
+	POOL_TRIM_FUNCS
+} pool_trim_func_t;
+
 /*
  * ZIO types.  Needed to interpret vdev statistics below.
  */
@@ -37,6 +37,13 @@ typedef struct osx_kstat {
 	kstat_named_t darwin_create_negatives;
 	kstat_named_t darwin_force_formd_normalized;
 	kstat_named_t darwin_skip_unlinked_drain;
+	kstat_named_t darwin_pagein_readahead;
+	kstat_named_t darwin_reclaim_async;
+	kstat_named_t darwin_reclaim_batch;
+	kstat_named_t darwin_findernotify_interval;
+	kstat_named_t darwin_findernotify_threshold;
+	kstat_named_t darwin_findernotify_sent;
+	kstat_named_t darwin_findernotify_suppressed;
 
 	kstat_named_t arc_zfs_arc_max;
 	kstat_named_t arc_zfs_arc_min;
@@ -46,9 +53,11 @@ typedef struct osx_kstat {
 	kstat_named_t arc_zfs_arc_shrink_shift;
 	kstat_named_t arc_zfs_arc_p_min_shift;
 	kstat_named_t arc_zfs_arc_average_blocksize;
+	kstat_named_t arc_zfs_arc_free_target;
 
 	kstat_named_t l2arc_write_max;
 	kstat_named_t l2arc_write_boost;
+	kstat_named_t l2arc_write_limit;
 	kstat_named_t l2arc_headroom;
 	kstat_named_t l2arc_headroom_boost;
 	kstat_named_t l2arc_max_block_size;
@@ -66,9 +75,16 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_vdev_async_write_max_active;
 	kstat_named_t zfs_vdev_scrub_min_active;
 	kstat_named_t zfs_vdev_scrub_max_active;
+	kstat_named_t zfs_vdev_resilver_min_active;
+	kstat_named_t zfs_vdev_resilver_max_active;
+	kstat_named_t zfs_vdev_queue_tune;
+	kstat_named_t zfs_vdev_queue_tune_window;
+	kstat_named_t zfs_vdev_queue_tune_latency_pct;
+	kstat_named_t zfs_vdev_queue_tune_max_active;
 	kstat_named_t zfs_vdev_async_write_active_min_dirty_percent;
 	kstat_named_t zfs_vdev_async_write_active_max_dirty_percent;
 	kstat_named_t zfs_vdev_aggregation_limit;
+	kstat_named_t zfs_vdev_aggregation_limit_max;
 	kstat_named_t zfs_vdev_read_gap_limit;
 	kstat_named_t zfs_vdev_write_gap_limit;
 
@@ -79,12 +95,16 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_delay_max_ns;
 	kstat_named_t zfs_delay_min_dirty_percent;
 	kstat_named_t zfs_delay_scale;
+	kstat_named_t zfs_delay_sync_target_ms;
 	kstat_named_t spa_asize_inflation;
 	kstat_named_t zfs_mdcomp_disable;
 	kstat_named_t zfs_prefetch_disable;
 	kstat_named_t zfetch_max_streams;
 	kstat_named_t zfetch_min_sec_reap;
 	kstat_named_t zfetch_array_rd_sz;
+	kstat_named_t zfetch_sequential_min;
+	kstat_named_t zfetch_max_stride;
+	kstat_named_t zfetch_adaptive_distance;
 	kstat_named_t zfs_default_bs;
 	kstat_named_t zfs_default_ibs;
 	kstat_named_t metaslab_aliquot;
@@ -92,6 +112,7 @@ typedef struct osx_kstat {
 	kstat_named_t spa_mode_global;
 	kstat_named_t zfs_flags;
 	kstat_named_t zfs_txg_timeout;
+	kstat_named_t zfs_txg_early_write;
 	kstat_named_t zfs_vdev_cache_max;
 	kstat_named_t zfs_vdev_cache_size;
 	kstat_named_t zfs_vdev_cache_bshift;
@@ -100,24 +121,64 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_no_scrub_io;
 	kstat_named_t zfs_no_scrub_prefetch;
 	kstat_named_t fzap_default_block_shift;
+	kstat_named_t zap_micro_max_size;
+	kstat_named_t zap_cursor_prefetch_leaves;
+	kstat_named_t zfs_readdir_dnode_prefetch;
+	kstat_named_t zfs_dir_negcache;
 	kstat_named_t zfs_immediate_write_sz;
 	kstat_named_t zfs_read_chunk_size;
+	kstat_named_t zfs_rlock_fastpath;
+	kstat_named_t zfs_group_commit;
+	kstat_named_t zfs_group_commit_window_us;
+	kstat_named_t zfs_inline_data_max;
 	kstat_named_t zfs_nocacheflush;
+	kstat_named_t zfs_nocacheflush_slog;
 	kstat_named_t zil_replay_disable;
+	kstat_named_t zfs_commit_timeout_pct;
+	kstat_named_t zil_maxblocksize;
+	kstat_named_t zil_replay_taskqs;
 	kstat_named_t metaslab_gang_bang;
 	kstat_named_t metaslab_df_alloc_threshold;
 	kstat_named_t metaslab_df_free_pct;
+	kstat_named_t metaslab_adaptive_alloc;
+	kstat_named_t metaslab_adaptive_free_pct;
+	kstat_named_t metaslab_adaptive_frag_pct;
+	kstat_named_t metaslab_adaptive_latency_ns;
+	kstat_named_t metaslab_latency_bias_pct;
+	kstat_named_t metaslab_seq_zone_shift;
+	kstat_named_t zfs_uberblock_sync_subset;
+	kstat_named_t zfs_embedded_log_metaslabs;
+	kstat_named_t zfs_embedded_log_min_ms;
+	kstat_named_t zfs_log_spacemaps;
+	kstat_named_t zfs_unflushed_log_txg_max;
+	kstat_named_t zfs_min_metaslabs_to_flush;
+	kstat_named_t zfs_keep_log_spacemaps_at_export;
+	kstat_named_t zfs_special_class_metadata_reserve_pct;
+	kstat_named_t zfs_ddt_cache_max;
+	kstat_named_t zfs_ddt_prune_age;
+	kstat_named_t zfs_ddt_prune_batch;
+	kstat_named_t zfs_list_batch_max;
+	kstat_named_t zfs_destroy_prefetch_threads;
+	kstat_named_t zfs_config_sync_delay_ms;
+	kstat_named_t zfs_bench_blocksize;
 	kstat_named_t zio_injection_enabled;
 	kstat_named_t zvol_immediate_write_sz;
+	kstat_named_t zvol_sync_batch;
 
 	kstat_named_t l2arc_noprefetch;
 	kstat_named_t l2arc_feed_again;
 	kstat_named_t l2arc_norw;
+	kstat_named_t l2arc_rebuild_enabled;
+	kstat_named_t l2arc_compress;
 
 	kstat_named_t zfs_top_maxinflight;
 	kstat_named_t zfs_resilver_delay;
 	kstat_named_t zfs_scrub_delay;
 	kstat_named_t zfs_scan_idle;
+	kstat_named_t zfs_scan_fg_latency_pct;
+	kstat_named_t zfs_scan_legacy;
+	kstat_named_t zfs_scan_mem_lim_fact;
+	kstat_named_t zfs_scan_max_ext_gap;
 
 	kstat_named_t zfs_recover;
 
@@ -127,12 +188,21 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_send_corrupt_data;
 	kstat_named_t zfs_send_queue_length;
 	kstat_named_t zfs_recv_queue_length;
+	kstat_named_t zfs_recv_writers;
+	kstat_named_t zfs_recv_write_batch;
+	kstat_named_t zfs_send_readers;
+	kstat_named_t zfs_send_read_window;
+	kstat_named_t zfs_send_write_size;
+	kstat_named_t zfs_send_estimate_sample_rate;
+	kstat_named_t zfs_send_estimate_min_samples;
 
 	kstat_named_t zfs_vdev_mirror_rotating_inc;
 	kstat_named_t zfs_vdev_mirror_rotating_seek_inc;
 	kstat_named_t zfs_vdev_mirror_rotating_seek_offset;
 	kstat_named_t zfs_vdev_mirror_non_rotating_inc;
 	kstat_named_t zfs_vdev_mirror_non_rotating_seek_inc;
+	kstat_named_t zfs_vdev_mirror_rotating_mixed_inc;
+	kstat_named_t zfs_vdev_mirror_ditto_balance;
 
 	kstat_named_t zvol_inhibit_dev;
 	kstat_named_t zfs_send_set_freerecords_bit;
@@ -141,9 +211,70 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_send_holes_without_birth_time;
 
 	kstat_named_t dbuf_cache_max_bytes;
+	kstat_named_t dbuf_cache_adaptive_shift;
+	kstat_named_t dbuf_evict_user_batch;
+	kstat_named_t dbuf_evict_user_taskq_pct;
+	kstat_named_t dmu_object_alloc_chunk_shift;
 
 	kstat_named_t zfs_vdev_queue_depth_pct;
 	kstat_named_t zio_dva_throttle_enabled;
+	kstat_named_t zio_ddt_prefetch_enabled;
+	kstat_named_t zio_stage_timing_enabled;
+	kstat_named_t zio_gang_fit_enabled;
+
+	kstat_named_t zfs_fletcher_4_impl;
+	kstat_named_t zfs_vdev_raidz_impl;
+
+	kstat_named_t zfs_abd_scatter_enabled;
+
+	kstat_named_t zfs_compress_early_abort;
+	kstat_named_t zfs_compress_abort_streak;
+	kstat_named_t zfs_compress_abort_retry;
+
+	kstat_named_t zfs_key_max_salt_uses;
+
+	kstat_named_t zfs_trim_extent_bytes_min;
+	kstat_named_t zfs_trim_extent_bytes_max;
+	kstat_named_t zfs_trim_txg_batch;
+	kstat_named_t zfs_trim_rate;
+	kstat_named_t zfs_arc_warm;
+	kstat_named_t zfs_arc_warm_sample;
+	kstat_named_t zfs_arc_warm_entries;
+	kstat_named_t zfs_arc_warm_rate;
+	kstat_named_t zio_taskq_batch_pct;
+	kstat_named_t zio_taskq_batch_tpq;
+	kstat_named_t zio_taskq_read;
+	kstat_named_t zio_taskq_write;
+	kstat_named_t zio_taskq_affine;
+	kstat_named_t zio_taskq_affine_imbalance;
+	kstat_named_t zfs_dirty_data_cpu_slack;
+	kstat_named_t zfs_arc_sublist_by_cpu;
+	kstat_named_t zfs_mutex_spin;
+	kstat_named_t zfs_rebuild_sequential;
+	kstat_named_t zfs_rebuild_extent_bytes_max;
+	kstat_named_t zfs_rebuild_batch_bytes;
+	kstat_named_t zfs_rebuild_scrub;
+	kstat_named_t zfs_free_async;
+	kstat_named_t zfs_free_max_blocks_limit;
+	kstat_named_t zfs_condense_txgs;
+	kstat_named_t zfs_free_throttle_ms;
+	kstat_named_t zfs_free_throttle_min_blocks;
+	kstat_named_t zfs_free_throttle_urgent_pct;
+	kstat_named_t zio_scan_verify_pct;
+	kstat_named_t zio_scan_verify_batch;
+	kstat_named_t zfs_resilver_priority;
+	kstat_named_t zfs_raidz_combrec_hint;
+	kstat_named_t zfs_vdev_file_nocache;
+	kstat_named_t zfs_vdev_cache_min_hit_pct;
+	kstat_named_t zfs_vdev_cache_probe;
+	kstat_named_t zfs_xattr_sa_rsrc_max;
+	kstat_named_t zfs_acl_access_cache;
+	kstat_named_t zfs_lz4_acceleration;
+	kstat_named_t zfs_dirty_data_fair;
+	kstat_named_t zfs_dbuf_stats_dump;
+	kstat_named_t dbuf_deferred_rmw;
+	kstat_named_t zfs_recv_read_size;
+	kstat_named_t zfs_allow_filtered_mount;
 } osx_kstat_t;
 
 
@@ -152,6 +283,13 @@ extern unsigned int zfs_vnop_ignore_negatives;
 extern unsigned int zfs_vnop_ignore_positives;
 extern unsigned int zfs_vnop_create_negatives;
 extern unsigned int zfs_vnop_skip_unlinked_drain;
+extern uint64_t zfs_vnop_pagein_readahead;
+extern unsigned int zfs_vnop_reclaim_async;
+extern unsigned int zfs_vnop_reclaim_batch;
+extern uint64_t zfs_vnop_findernotify_interval;
+extern uint64_t zfs_vnop_findernotify_threshold;
+extern uint64_t vnop_num_findernotify_sent;
+extern uint64_t vnop_num_findernotify_suppressed;
 extern uint64_t vnop_num_vnodes;
 extern uint64_t vnop_num_reclaims;
 
@@ -163,9 +301,11 @@ extern int zfs_arc_grow_retry;
 extern int zfs_arc_shrink_shift;
 extern int zfs_arc_p_min_shift;
 extern int zfs_arc_average_blocksize;
+extern uint64_t zfs_arc_free_target;
 
 extern uint64_t l2arc_write_max;
 extern uint64_t l2arc_write_boost;
+extern uint64_t l2arc_write_limit;
 extern uint64_t l2arc_headroom;
 extern uint64_t l2arc_headroom_boost;
 extern uint64_t l2arc_max_block_size;
@@ -183,18 +323,29 @@ extern uint32_t zfs_vdev_async_write_min_active;
 extern uint32_t zfs_vdev_async_write_max_active;
 extern uint32_t zfs_vdev_scrub_min_active;
 extern uint32_t zfs_vdev_scrub_max_active;
+extern uint32_t zfs_vdev_resilver_min_active;
+extern uint32_t zfs_vdev_resilver_max_active;
+extern int zfs_vdev_queue_tune;
+extern uint32_t zfs_vdev_queue_tune_window;
+extern uint32_t zfs_vdev_queue_tune_latency_pct;
+extern uint32_t zfs_vdev_queue_tune_max_active;
 extern int zfs_vdev_async_write_active_min_dirty_percent;
 extern int zfs_vdev_async_write_active_max_dirty_percent;
 extern int zfs_vdev_aggregation_limit;
+extern int zfs_vdev_aggregation_limit_max;
 extern int zfs_vdev_read_gap_limit;
 extern int zfs_vdev_write_gap_limit;
 
 extern uint_t arc_reduce_dnlc_percent;
 extern int arc_lotsfree_percent;
 extern hrtime_t zfs_delay_max_ns;
+extern int zfs_delay_sync_target_ms;
+extern int zfs_txg_early_write;
 extern int spa_asize_inflation;
 extern unsigned int	zfetch_max_streams;
 extern unsigned int	zfetch_min_sec_reap;
+extern unsigned int	zfetch_max_stride;
+extern int zfetch_adaptive_distance;
 extern int zfs_default_bs;
 extern int zfs_default_ibs;
 extern uint64_t metaslab_aliquot;
@@ -204,19 +355,51 @@ extern int zfs_no_scrub_io;
 extern int zfs_no_scrub_prefetch;
 extern ssize_t zfs_immediate_write_sz;
 extern offset_t zfs_read_chunk_size;
+extern int zfs_rlock_fastpath;
+extern int zfs_group_commit;
+extern int zfs_group_commit_window_us;
+extern int zfs_inline_data_max;
 extern uint64_t metaslab_gang_bang;
 extern uint64_t metaslab_df_alloc_threshold;
 extern int metaslab_df_free_pct;
+extern int metaslab_adaptive_alloc;
+extern int metaslab_adaptive_free_pct;
+extern int metaslab_adaptive_frag_pct;
+extern unsigned long metaslab_adaptive_latency_ns;
+extern int metaslab_latency_bias_pct;
+extern int metaslab_seq_zone_shift;
+extern int zfs_uberblock_sync_subset;
+extern int zfs_embedded_log_metaslabs;
+extern int zfs_embedded_log_min_ms;
+extern int zfs_log_spacemaps;
+extern uint64_t zfs_unflushed_log_txg_max;
+extern uint64_t zfs_min_metaslabs_to_flush;
+extern int zfs_keep_log_spacemaps_at_export;
+extern int zfs_special_class_metadata_reserve_pct;
+extern uint64_t zfs_ddt_cache_max;
+extern uint64_t zfs_ddt_prune_age;
+extern int zfs_ddt_prune_batch;
+extern int zfs_list_batch_max;
+extern int zfs_destroy_prefetch_threads;
+extern int zfs_config_sync_delay_ms;
+extern int64_t zfs_bench_blocksize;
 extern ssize_t zvol_immediate_write_sz;
+extern int zvol_sync_batch;
 
 extern boolean_t l2arc_noprefetch;
 extern boolean_t l2arc_feed_again;
 extern boolean_t l2arc_norw;
+extern boolean_t l2arc_rebuild_enabled;
+extern boolean_t l2arc_compress;
 
 extern int zfs_top_maxinflight;
 extern int zfs_resilver_delay;
 extern int zfs_scrub_delay;
 extern int zfs_scan_idle;
+extern int zfs_scan_fg_latency_pct;
+extern int zfs_scan_legacy;
+extern int zfs_scan_mem_lim_fact;
+extern uint64_t zfs_scan_max_ext_gap;
 
 extern uint64_t zfs_free_max_blocks;
 extern int64_t zfs_free_bpobj_enabled;
@@ -224,12 +407,21 @@ extern int64_t zfs_free_bpobj_enabled;
 extern int zfs_send_corrupt_data;
 extern int zfs_send_queue_length;
 extern int zfs_recv_queue_length;
+extern int zfs_recv_writers;
+extern int zfs_recv_write_batch;
+extern int zfs_send_readers;
+extern int zfs_send_read_window;
+extern int zfs_send_write_size;
+extern int zfs_send_estimate_sample_rate;
+extern int zfs_send_estimate_min_samples;
 
 extern uint64_t zfs_vdev_mirror_rotating_inc;
 extern uint64_t zfs_vdev_mirror_rotating_seek_inc;
 extern uint64_t zfs_vdev_mirror_rotating_seek_offset;
 extern uint64_t zfs_vdev_mirror_non_rotating_inc;
 extern uint64_t zfs_vdev_mirror_non_rotating_seek_inc;
+extern uint64_t zfs_vdev_mirror_rotating_mixed_inc;
+extern uint64_t zfs_vdev_mirror_ditto_balance;
 extern uint64_t zvol_inhibit_dev;
 extern uint64_t zfs_send_set_freerecords_bit;
 
@@ -238,9 +430,67 @@ extern uint64_t send_holes_without_birth_time;
 extern uint64_t zfs_send_holes_without_birth_time;
 
 extern uint64_t dbuf_cache_max_bytes;
+extern int dbuf_cache_adaptive_shift;
+extern int dbuf_evict_user_batch;
+extern int dbuf_evict_user_taskq_pct;
+extern int dmu_object_alloc_chunk_shift;
 
 extern uint64_t zfs_vdev_queue_depth_pct;
 extern boolean_t zio_dva_throttle_enabled;
+extern boolean_t zio_ddt_prefetch_enabled;
+extern boolean_t zio_stage_timing_enabled;
+extern boolean_t zio_gang_fit_enabled;
+
+extern uint64_t zfs_trim_extent_bytes_min;
+extern uint64_t zfs_trim_extent_bytes_max;
+extern uint64_t zfs_trim_txg_batch;
+extern uint64_t zfs_trim_rate;
+
+extern int zfs_arc_warm;
+extern int zfs_arc_warm_sample;
+extern int zfs_arc_warm_entries;
+extern int zfs_arc_warm_rate;
+extern uint_t zio_taskq_batch_pct;
+extern uint_t zio_taskq_batch_tpq;
+extern int zio_taskq_affine;
+extern int zio_taskq_affine_imbalance;
+extern int zfs_arc_sublist_by_cpu;
+extern int zfs_rebuild_sequential;
+extern uint64_t zfs_rebuild_extent_bytes_max;
+extern uint64_t zfs_rebuild_batch_bytes;
+extern int zfs_rebuild_scrub;
+extern int zfs_free_async;
+extern uint64_t zfs_free_max_blocks_limit;
+extern int zfs_condense_txgs;
+extern int zfs_free_throttle_ms;
+extern int zfs_free_throttle_min_blocks;
+extern int zfs_free_throttle_urgent_pct;
+extern uint_t zio_scan_verify_pct;
+extern uint_t zio_scan_verify_batch;
+extern int zfs_resilver_priority;
+extern int zfs_raidz_combrec_hint;
+extern int zfs_vdev_file_nocache;
+extern int zfs_vdev_cache_min_hit_pct;
+extern int zfs_vdev_cache_probe;
+extern uint64_t zfs_xattr_sa_rsrc_max;
+extern int zfs_acl_access_cache;
+extern int zfs_lz4_acceleration;
+extern int zfs_dirty_data_fair;
+extern int zfs_dbuf_stats_dump;
+extern int dbuf_deferred_rmw;
+extern int zfs_recv_read_size;
+extern int zfs_allow_filtered_mount;
+
+extern int zfs_readdir_dnode_prefetch;
+extern int zfs_dir_negcache;
+
+/* The kstats copied by kstat.zfs.misc.stats_snapshot */
+extern kstat_t *arc_ksp;
+extern kstat_t *zfetch_ksp;
+extern kstat_t *vdc_ksp;
+extern kstat_t *dbuf_stats_cache_kstat;
+extern kstat_t *dbuf_stats_hash_kstat;
+extern kstat_t *dbuf_stats_evict_user_kstat;
 
 int        kstat_osx_init(void);
 void       kstat_osx_fini(void);
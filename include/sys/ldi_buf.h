@@ -33,7 +33,18 @@ extern "C" {
 #endif /* __cplusplus */
 
 /*
- * Buffer context for LDI strategy
+ * One segment of a scattered IO, see b_vec below
+ */
+typedef struct ldi_buf_vec {
+	void		*bv_addr;	/* Segment address */
+	uint64_t	bv_len;		/* Segment length */
+} ldi_buf_vec_t;
+
+/*
+ * Buffer context for LDI strategy.  The data is either the single
+ * buffer at b_addr, or when b_vec is set, the b_veccnt segments it
+ * points to, which together are b_bcount bytes.  Only IOKit handles
+ * accept a vector, strategy on other handles returns ENOTSUP.
  */
 typedef struct ldi_buf {
 	/* For client use */
@@ -47,8 +58,10 @@ typedef struct ldi_buf {
 	uint64_t	b_resid;	/* Remaining IO size */
 	int		b_flags;	/* Read or write, options */
 	int		b_error;	/* IO error code */
-	uint64_t	pad;		/* Pad to 64 bytes */
-} ldi_buf_t;				/* XXX Currently 64b */
+	ldi_buf_vec_t	*b_vec;		/* Scatter list, or NULL */
+	uint32_t	b_veccnt;	/* Segments in b_vec */
+	uint32_t	pad;		/* Pad to 72 bytes */
+} ldi_buf_t;				/* XXX Currently 72b */
 
 ldi_buf_t *ldi_getrbuf(int);
 void ldi_freerbuf(ldi_buf_t *);
@@ -92,7 +92,8 @@ struct dk_minfo_ext {
 	uint64_t		dki_capacity;	/* Logical block count */
 	uint32_t		dki_lbsize;	/* Logical block size */
 	uint32_t		dki_pbsize;	/* Physical block size */
-};	/* (16b) */
+	uint64_t		dki_max_xfer;	/* Max bytes per IO, or 0 */
+};	/* (24b) */
 
 struct io_bootinfo {
 	char			dev_path[MAXPATHLEN];	/* IODeviceTree path */
@@ -122,9 +123,31 @@ struct dk_callback {
 #define	DKIOCGMEDIAINFO		(DKIOC | 42)
 #define	DKIOCGMEDIAINFOEXT	(DKIOC | 48)
 
+#define	DKIOCFREE		(DKIOC | 50)
+
 /* XXX Created this additional ioctl */
 #define	DKIOCGETBOOTINFO	(DKIOC | 99)
 
+/*
+ * Argument to DKIOCFREE, the byte ranges to unmap (TRIM).  dfl_offset is
+ * added to the start of each extent.
+ */
+typedef struct dkioc_free_list_ext {
+	uint64_t		dfle_start;
+	uint64_t		dfle_length;
+} dkioc_free_list_ext_t;
+
+typedef struct dkioc_free_list {
+	uint64_t		dfl_flags;
+	uint64_t		dfl_num_exts;
+	uint64_t		dfl_offset;
+	dkioc_free_list_ext_t	dfl_exts[1];	/* actually dfl_num_exts */
+} dkioc_free_list_t;
+
+#define	DFL_SZ(num_exts) \
+	(sizeof (dkioc_free_list_t) + \
+	((num_exts) - 1) * sizeof (dkioc_free_list_ext_t))
+
 /*
  * This state enum is the argument passed to the DKIOCSTATE ioctl.
  */
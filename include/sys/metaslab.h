@@ -37,12 +37,26 @@ extern "C" {
 #endif
 
 
+typedef enum metaslab_allocator {
+	METASLAB_ALLOCATOR_FF,		/* first fit */
+	METASLAB_ALLOCATOR_DF,		/* dynamic fit */
+	METASLAB_ALLOCATOR_CF,		/* cursor fit */
+	METASLAB_ALLOCATOR_NDF,		/* new dynamic fit */
+	METASLAB_ALLOCATOR_SEQ,		/* sequential, for SMR vdevs */
+	METASLAB_ALLOCATORS
+} metaslab_allocator_t;
+
 typedef struct metaslab_ops {
 	uint64_t (*msop_alloc)(metaslab_t *, uint64_t);
+	metaslab_allocator_t msop_type;
 } metaslab_ops_t;
 
 
 extern metaslab_ops_t *zfs_metaslab_ops;
+extern metaslab_ops_t *metaslab_allocators[METASLAB_ALLOCATORS];
+extern const char *metaslab_allocator_names[METASLAB_ALLOCATORS];
+extern int zfs_embedded_log_metaslabs;
+extern int zfs_embedded_log_min_ms;
 
 int metaslab_init(metaslab_group_t *, uint64_t, uint64_t, uint64_t,
     metaslab_t **);
@@ -55,7 +69,14 @@ void metaslab_unload(metaslab_t *);
 void metaslab_sync(metaslab_t *, uint64_t);
 void metaslab_sync_done(metaslab_t *, uint64_t);
 void metaslab_sync_reassess(metaslab_group_t *);
+void metaslab_condense_cancel(metaslab_t *, dmu_tx_t *);
 uint64_t metaslab_block_maxsize(metaslab_t *);
+uint64_t metaslab_allocated_space(metaslab_t *);
+void metaslab_unflushed_alloc(void *, uint64_t, uint64_t);
+void metaslab_unflushed_free(void *, uint64_t, uint64_t);
+int metaslab_trim_all(metaslab_t *, boolean_t *);
+int metaslab_trim_take(metaslab_t *, range_seg_t *, int, uint64_t, uint64_t);
+void metaslab_trim_done(metaslab_t *, boolean_t);
 
 #define	METASLAB_HINTBP_FAVOR		0x0
 #define	METASLAB_HINTBP_AVOID		0x1
@@ -64,6 +85,7 @@ uint64_t metaslab_block_maxsize(metaslab_t *);
 #define	METASLAB_ASYNC_ALLOC		0x8
 #define	METASLAB_DONT_THROTTLE		0x10
 #define	METASLAB_FASTWRITE	0x20
+#define	METASLAB_ZIL			0x40
 
 int metaslab_alloc(spa_t *, metaslab_class_t *, uint64_t,
     blkptr_t *, int, uint64_t, blkptr_t *, int, zio_alloc_list_t *, zio_t *);
@@ -75,6 +97,8 @@ void metaslab_fastwrite_unmark(spa_t *, const blkptr_t *);
 
 void metaslab_alloc_trace_init(void);
 void metaslab_alloc_trace_fini(void);
+void metaslab_stat_init(void);
+void metaslab_stat_fini(void);
 void metaslab_trace_init(zio_alloc_list_t *);
 void metaslab_trace_fini(zio_alloc_list_t *);
 
@@ -83,6 +107,7 @@ void metaslab_class_destroy(metaslab_class_t *);
 int metaslab_class_validate(metaslab_class_t *);
 void metaslab_class_histogram_verify(metaslab_class_t *);
 uint64_t metaslab_class_fragmentation(metaslab_class_t *);
+uint64_t metaslab_class_maxsize(metaslab_class_t *);
 uint64_t metaslab_class_expandable_space(metaslab_class_t *);
 boolean_t metaslab_class_throttle_reserve(metaslab_class_t *, int,
     zio_t *, int);
@@ -99,6 +124,7 @@ metaslab_group_t *metaslab_group_create(metaslab_class_t *, vdev_t *);
 void metaslab_group_destroy(metaslab_group_t *);
 void metaslab_group_activate(metaslab_group_t *);
 void metaslab_group_passivate(metaslab_group_t *);
+void metaslab_group_reserve_log(metaslab_group_t *);
 boolean_t metaslab_group_initialized(metaslab_group_t *);
 uint64_t metaslab_group_get_space(metaslab_group_t *);
 void metaslab_group_histogram_verify(metaslab_group_t *);
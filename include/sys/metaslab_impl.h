@@ -243,8 +243,34 @@ struct metaslab_group {
 
 	uint64_t		mg_allocations;
 	uint64_t		mg_failed_allocations;
+	uint64_t		mg_log_count;	/* embedded log metaslabs */
 	uint64_t		mg_fragmentation;
 	uint64_t		mg_histogram[RANGE_TREE_HISTOGRAM_SIZE];
+
+	/*
+	 * The block allocator used by this group's metaslabs when
+	 * metaslab_adaptive_alloc is set.  It is reconsidered every txg
+	 * from the group's free capacity, fragmentation and the average
+	 * latency of its allocations since the last txg (mg_alloc_nsecs
+	 * over mg_alloc_count).  A switch made because of latency is kept
+	 * until mg_allocator_hold_txg.
+	 */
+	metaslab_allocator_t	mg_allocator;
+	uint64_t		mg_allocator_hold_txg;
+	uint64_t		mg_alloc_count;
+	uint64_t		mg_alloc_nsecs;
+
+	/*
+	 * The average completion latency of the writes to the group's
+	 * vdev, updated every txg, and the part of mg_bias it adds
+	 * (see metaslab_group_latency_bias()).  mg_latency_pct is the
+	 * share of its aliquot the group gets because of it, and
+	 * mg_alloc_bytes counts the bytes allocated from the group.
+	 */
+	uint64_t		mg_write_latency;
+	int64_t			mg_latency_bias;
+	int64_t			mg_latency_pct;
+	uint64_t		mg_alloc_bytes;
 };
 
 /*
@@ -308,7 +334,17 @@ struct metaslab_group {
  * metaslab needs to condense then we must set the ms_condensing flag to
  * ensure that allocations are not performed on the metaslab that is
  * being written.
+ *
+ * Unless zfs_condense_txgs is 1, the minimized form is instead written
+ * to a new space map, ms_condense_sm, a range of the metaslab per txg
+ * starting at ms_start.  Every txg's changes below ms_condense_cursor
+ * go to both space maps, and once the cursor reaches the end the new
+ * space map replaces ms_sm.  Until then the new object is recorded in
+ * the vdev's VDEV_TOP_ZAP_MS_CONDENSING ZAP, by metaslab id, so that
+ * one left behind by an export or crash is freed (ms_condense_stale).
  */
+#define	VDEV_TOP_ZAP_MS_CONDENSING	"org.openzfsonosx:ms_condensing"
+
 struct metaslab {
 	kmutex_t	ms_lock;
 	kcondvar_t	ms_load_cv;
@@ -321,6 +357,16 @@ struct metaslab {
 	range_tree_t	*ms_alloctree[TXG_SIZE];
 	range_tree_t	*ms_tree;
 
+	/*
+	 * Free space that has not been unmapped (TRIMmed) yet.  ms_trimtree
+	 * is a subset of ms_tree and is only maintained while the metaslab
+	 * is loaded; an allocation simply drops its range from it.  The
+	 * ranges in ms_trimming are being unmapped by vdev_trim and are
+	 * held out of ms_tree until metaslab_trim_done() returns them.
+	 */
+	range_tree_t	*ms_trimtree;
+	range_tree_t	*ms_trimming;
+
 	/*
 	 * The following range trees are accessed only from syncing context.
 	 * ms_free*tree only have entries while syncing, and are empty
@@ -332,6 +378,36 @@ struct metaslab {
 
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
+	space_map_t	*ms_condense_sm;	/* being written, or NULL */
+	uint64_t	ms_condense_cursor;	/* written below here */
+	hrtime_t	ms_condense_start;	/* when condensing began */
+	uint64_t	ms_condense_stale;	/* abandoned ms_condense_sm */
+	boolean_t	ms_embedded_log; /* for ZIL blocks, see mg_log_count */
+
+	/*
+	 * Changes that have been written to the vdev's log space maps but
+	 * not yet to ms_sm.  The two trees are disjoint: ms_unflushed_allocs
+	 * holds space that ms_sm has as free but which has been allocated
+	 * since, and ms_unflushed_frees the reverse.  ms_unflushed_txg is
+	 * the first txg whose changes are only in the logs, or 0 when ms_sm
+	 * is up to date.  ms_logged_delta is the space allocated by this
+	 * txg that is not reflected in ms_sm's allocated space; it is
+	 * folded into the vdev's space accounting by metaslab_sync_done().
+	 *
+	 * A metaslab either logs or flushes for a whole txg; ms_logged_txg
+	 * and ms_flushed_txg record which one it picked.  The frees of a
+	 * logged txg, and the trees of a flushed one, are only applied to
+	 * the unflushed trees in metaslab_sync_done() so that metaslab_load()
+	 * always sees them together with the matching ms_sm length.
+	 */
+	range_tree_t	*ms_unflushed_allocs;
+	range_tree_t	*ms_unflushed_frees;
+	uint64_t	ms_unflushed_txg;
+	int64_t		ms_logged_delta;
+	uint64_t	ms_logged_txg;
+	uint64_t	ms_flushed_txg;
+	boolean_t	ms_flush_wanted;	/* write the unflushed changes */
+	avl_node_t	ms_unflushed_node;	/* spa_unflushed_ms linkage */
 
 	/*
 	 * We must hold both ms_lock and ms_group->mg_lock in order to
@@ -361,8 +437,9 @@ struct metaslab {
 	 * same number of segments as the ms_tree. The only difference
 	 * is that the ms_size_tree is ordered by segment sizes.
 	 */
-	avl_tree_t	ms_size_tree;
+	zfs_btree_t	ms_size_tree;
 	uint64_t	ms_lbas[MAX_LBAS];
+	metaslab_allocator_t ms_allocator;	/* owner of ms_lbas */
 
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
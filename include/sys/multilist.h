@@ -43,11 +43,15 @@ struct multilist_sublist {
 	 * The actual list object containing all objects in this sublist.
 	 */
 	list_t		mls_list;
+	/*
+	 * The number of objects on mls_list, protected by mls_lock.
+	 */
+	uint64_t	mls_count;
 	/*
 	 * Pad to cache line (64 bytes), in an effort to try and prevent
 	 * cache line contention.
 	 */
-	uint8_t		mls_pad[24];
+	uint8_t		mls_pad[16];
 };
 
 struct multilist {
@@ -81,6 +85,9 @@ int  multilist_is_empty(multilist_t *);
 
 unsigned int multilist_get_num_sublists(multilist_t *);
 unsigned int multilist_get_random_index(multilist_t *);
+unsigned int multilist_get_cpu_index(multilist_t *);
+uint64_t multilist_get_sublist_count(multilist_t *, unsigned int);
+uint64_t multilist_get_skew(multilist_t *);
 
 multilist_sublist_t *multilist_sublist_lock(multilist_t *, unsigned int);
 multilist_sublist_t *multilist_sublist_lock_obj(multilist_t *, void *);
@@ -111,6 +111,36 @@ typedef struct refcount {
 
 #endif	/* ZFS_DEBUG */
 
+/*
+ * A count of very hot references that are rarely checked for zero, such
+ * as the long holds of a dataset.  Holds and releases only update the
+ * shard of their cpu, so they do not bounce one cache line between all
+ * cpus, while reading the count sums all shards.  A reference can be
+ * released on another shard than it was taken on, so each shard counts
+ * holds and releases separately and all releases are read before all
+ * holds: a reference held throughout is never missed, but a count read
+ * while others come and go can be too high.  Holders are not tracked.
+ */
+#define	REFCOUNT_PERCPU_SHARDS	16
+
+typedef struct refcount_percpu_shard {
+	uint64_t	rcps_adds;
+	uint64_t	rcps_removes;
+	char		rcps_pad[48];	/* pad to fill a cache line */
+} refcount_percpu_shard_t;
+
+typedef struct refcount_percpu {
+	refcount_percpu_shard_t	*rcp_shards;
+	int			rcp_nshards;
+} refcount_percpu_t;
+
+void refcount_percpu_create(refcount_percpu_t *rcp);
+void refcount_percpu_destroy(refcount_percpu_t *rcp);
+void refcount_percpu_add(refcount_percpu_t *rcp, void *holder_tag);
+void refcount_percpu_remove(refcount_percpu_t *rcp, void *holder_tag);
+int64_t refcount_percpu_count(refcount_percpu_t *rcp);
+boolean_t refcount_percpu_is_zero(refcount_percpu_t *rcp);
+
 #ifdef	__cplusplus
 }
 #endif
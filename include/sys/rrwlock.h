@@ -89,11 +89,18 @@ void rrw_tsd_destroy(void *arg);
  * for hightly parallel read acquisitions, pessimizing write acquisitions.
  *
  * This should be a prime number.  See comment in rrwlock.c near
- * RRM_TD_LOCK() for details.
+ * RRM_TD_LOCK() for details.  Each lock is padded out to whole cache
+ * lines, so that readers of different locks do not share one.
  */
-#define	RRM_NUM_LOCKS		17
+#define	RRM_NUM_LOCKS		31
+#define	RRM_LOCK_SIZE		P2ROUNDUP(sizeof (rrwlock_t), 64)
+typedef union rrmlock_slot {
+	rrwlock_t	rms_lock;
+	char		rms_pad[RRM_LOCK_SIZE];
+} rrmlock_slot_t;
+
 typedef struct rrmlock {
-	rrwlock_t	locks[RRM_NUM_LOCKS];
+	rrmlock_slot_t	locks[RRM_NUM_LOCKS];
 } rrmlock_t;
 
 void rrm_init(rrmlock_t *rrl, boolean_t track_all);
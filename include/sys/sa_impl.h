@@ -112,6 +112,7 @@ typedef struct sa_idx_tab {
 	uint16_t	*sa_variable_lengths;
 	refcount_t	sa_refcount;
 	uint32_t	*sa_idx_tab;	/* array of offsets */
+	uint16_t	*sa_attr_lengths; /* resolved length of each attr */
 } sa_idx_tab_t;
 
 /*
@@ -256,7 +257,7 @@ struct sa_handle {
 
 #define	SA_ATTR_INFO(sa, idx, hdr, attr, bulk, type, hdl) \
 	{ \
-		bulk.sa_size = SA_ATTR_LEN(sa, idx, attr, hdr); \
+		bulk.sa_size = idx->sa_attr_lengths[attr]; \
 		bulk.sa_buftype = type; \
 		bulk.sa_addr = \
 		    (void *)((uintptr_t)TOC_OFF(idx->sa_idx_tab[attr]) + \
@@ -0,0 +1,212 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * x86 SIMD feature detection shared by the checksum, parity and
+ * compression kernels.
+ *
+ * Each zfs_*_available() function reports whether the CPU implements the
+ * instruction set AND, for the AVX family, whether the OS has enabled
+ * saving of the extended register state (OSXSAVE / XCR0).  Results are
+ * cached after the first call, as the CPU can't change underneath us.
+ *
+ * Code using vector registers must be bracketed by kfpu_begin() and
+ * kfpu_end().  XNU preserves the full vector state of kernel threads
+ * across context switches, so these are no-ops on OS X; they exist so
+ * that the callers stay portable to platforms where that is not true.
+ */
+
+#ifndef _SYS_SIMD_H
+#define	_SYS_SIMD_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	kfpu_begin()	do {} while (0)
+#define	kfpu_end()	do {} while (0)
+
+#if defined(__x86_64__) || defined(__x86_64) || defined(__amd64)
+
+#define	HAVE_SIMD_X86	1
+
+/* CPUID.(EAX=1):ECX */
+#define	CPUID1_ECX_SSE3		(1U << 0)
+#define	CPUID1_ECX_PCLMULQDQ	(1U << 1)
+#define	CPUID1_ECX_SSSE3	(1U << 9)
+#define	CPUID1_ECX_SSE41	(1U << 19)
+#define	CPUID1_ECX_SSE42	(1U << 20)
+#define	CPUID1_ECX_AES		(1U << 25)
+#define	CPUID1_ECX_OSXSAVE	(1U << 27)
+#define	CPUID1_ECX_AVX		(1U << 28)
+/* CPUID.(EAX=1):EDX */
+#define	CPUID1_EDX_SSE2		(1U << 26)
+/* CPUID.(EAX=7,ECX=0):EBX */
+#define	CPUID7_EBX_AVX2		(1U << 5)
+#define	CPUID7_EBX_AVX512F	(1U << 16)
+#define	CPUID7_EBX_SHA		(1U << 29)
+#define	CPUID7_EBX_AVX512BW	(1U << 30)
+
+/* XCR0 state components */
+#define	XCR0_SSE		(1ULL << 1)
+#define	XCR0_AVX		(1ULL << 2)
+#define	XCR0_AVX512		(0x7ULL << 5)	/* opmask, ZMM_Hi256, Hi16_ZMM */
+
+typedef struct zfs_cpuid {
+	boolean_t	zc_valid;
+	uint32_t	zc_ecx1;
+	uint32_t	zc_edx1;
+	uint32_t	zc_ebx7;
+	uint64_t	zc_xcr0;
+} zfs_cpuid_t;
+
+static inline void
+__zfs_cpuid(uint32_t func, uint32_t subfunc, uint32_t *eax, uint32_t *ebx,
+    uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ __volatile__(
+	    "cpuid"
+	    : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+	    : "a" (func), "c" (subfunc));
+}
+
+static inline const zfs_cpuid_t *
+__zfs_cpuid_get(void)
+{
+	static zfs_cpuid_t zc = { B_FALSE, 0, 0, 0, 0 };
+	uint32_t eax, ebx, ecx, edx, max;
+
+	if (zc.zc_valid)
+		return (&zc);
+
+	__zfs_cpuid(0, 0, &max, &ebx, &ecx, &edx);
+
+	__zfs_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	zc.zc_ecx1 = ecx;
+	zc.zc_edx1 = edx;
+
+	if (max >= 7) {
+		__zfs_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+		zc.zc_ebx7 = ebx;
+	}
+
+	if (zc.zc_ecx1 & CPUID1_ECX_OSXSAVE) {
+		uint32_t lo, hi;
+
+		__asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+		zc.zc_xcr0 = ((uint64_t)hi << 32) | lo;
+	}
+
+	zc.zc_valid = B_TRUE;
+	return (&zc);
+}
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	return ((__zfs_cpuid_get()->zc_edx1 & CPUID1_EDX_SSE2) != 0);
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+	return ((__zfs_cpuid_get()->zc_ecx1 & CPUID1_ECX_SSSE3) != 0);
+}
+
+static inline boolean_t
+zfs_sse4_1_available(void)
+{
+	return ((__zfs_cpuid_get()->zc_ecx1 & CPUID1_ECX_SSE41) != 0);
+}
+
+static inline boolean_t
+zfs_aes_available(void)
+{
+	return ((__zfs_cpuid_get()->zc_ecx1 & CPUID1_ECX_AES) != 0);
+}
+
+static inline boolean_t
+zfs_pclmulqdq_available(void)
+{
+	return ((__zfs_cpuid_get()->zc_ecx1 & CPUID1_ECX_PCLMULQDQ) != 0);
+}
+
+static inline boolean_t
+zfs_shani_available(void)
+{
+	return ((__zfs_cpuid_get()->zc_ebx7 & CPUID7_EBX_SHA) != 0);
+}
+
+static inline boolean_t
+zfs_avx_available(void)
+{
+	const zfs_cpuid_t *zc = __zfs_cpuid_get();
+
+	return ((zc->zc_ecx1 & CPUID1_ECX_AVX) != 0 &&
+	    (zc->zc_xcr0 & (XCR0_SSE | XCR0_AVX)) == (XCR0_SSE | XCR0_AVX));
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+	return (zfs_avx_available() &&
+	    (__zfs_cpuid_get()->zc_ebx7 & CPUID7_EBX_AVX2) != 0);
+}
+
+static inline boolean_t
+zfs_avx512f_available(void)
+{
+	const zfs_cpuid_t *zc = __zfs_cpuid_get();
+
+	return (zfs_avx_available() &&
+	    (zc->zc_xcr0 & XCR0_AVX512) == XCR0_AVX512 &&
+	    (zc->zc_ebx7 & CPUID7_EBX_AVX512F) != 0);
+}
+
+static inline boolean_t
+zfs_avx512bw_available(void)
+{
+	return (zfs_avx512f_available() &&
+	    (__zfs_cpuid_get()->zc_ebx7 & CPUID7_EBX_AVX512BW) != 0);
+}
+
+#else	/* !__x86_64__ */
+
+#define	zfs_sse2_available()		(B_FALSE)
+#define	zfs_ssse3_available()		(B_FALSE)
+#define	zfs_sse4_1_available()		(B_FALSE)
+#define	zfs_aes_available()		(B_FALSE)
+#define	zfs_pclmulqdq_available()	(B_FALSE)
+#define	zfs_shani_available()		(B_FALSE)
+#define	zfs_avx_available()		(B_FALSE)
+#define	zfs_avx2_available()		(B_FALSE)
+#define	zfs_avx512f_available()		(B_FALSE)
+#define	zfs_avx512bw_available()	(B_FALSE)
+
+#endif	/* __x86_64__ */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SIMD_H */
@@ -212,7 +212,7 @@ typedef struct zio_cksum_salt {
  * G		gang block indicator
  * B		byteorder (endianness)
  * D		dedup
- * X		encryption (on version 30, which is not supported)
+ * X		encryption (see below)
  * E		blkptr_t contains embedded data (see below)
  * lvl		level of indirection
  * type		DMU object type
@@ -222,6 +222,37 @@ typedef struct zio_cksum_salt {
  * checksum[4]	256-bit checksum of the data this bp describes
  */
 
+/*
+ * Blocks written to an encrypted dataset have the X bit set.  Such a
+ * blkptr_t can have at most two DVAs: the third is reused to hold the
+ * encryption parameters, and the second half of the checksum holds the
+ * authentication tag (MAC) produced by the cipher:
+ *
+ *	64	56	48	40	32	24	16	8	0
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ * 4	|		salt		|	      IV2		|
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ * 5	|				IV1				|
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ *	...
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ * c	|		checksum[0] (truncated to 128 bits)		|
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ * d	|		checksum[1]					|
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ * e	|			MAC[0]					|
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ * f	|			MAC[1]					|
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ *
+ * salt		identifies the key the block was encrypted with
+ * IV		96-bit initialization vector, random for every block
+ * MAC		128-bit AES-GCM authentication tag
+ *
+ * The checksum is computed over the ciphertext, so the pool can be
+ * scrubbed and resilvered without the dataset's key being loaded.
+ */
+
 /*
  * "Embedded" blkptr_t's don't actually point to a block, instead they
  * have a data payload embedded in the blkptr_t itself.  See the comment
@@ -401,6 +432,9 @@ _NOTE(CONSTCOND) } while (0)
 #define	BP_GET_LEVEL(bp)		BF64_GET((bp)->blk_prop, 56, 5)
 #define	BP_SET_LEVEL(bp, x)		BF64_SET((bp)->blk_prop, 56, 5, x)
 
+#define	BP_IS_ENCRYPTED(bp)		BF64_GET((bp)->blk_prop, 61, 1)
+#define	BP_SET_CRYPT(bp, x)		BF64_SET((bp)->blk_prop, 61, 1, x)
+
 #define	BP_GET_DEDUP(bp)		BF64_GET((bp)->blk_prop, 62, 1)
 #define	BP_SET_DEDUP(bp, x)		BF64_SET((bp)->blk_prop, 62, 1, x)
 
@@ -424,7 +458,7 @@ _NOTE(CONSTCOND) } while (0)
 	(BP_IS_EMBEDDED(bp) ? 0 : \
 	DVA_GET_ASIZE(&(bp)->blk_dva[0]) + \
 	DVA_GET_ASIZE(&(bp)->blk_dva[1]) + \
-	DVA_GET_ASIZE(&(bp)->blk_dva[2]))
+	(BP_IS_ENCRYPTED(bp) ? 0 : DVA_GET_ASIZE(&(bp)->blk_dva[2])))
 
 #define	BP_GET_UCSIZE(bp) \
 	((BP_GET_LEVEL(bp) > 0 || DMU_OT_IS_METADATA(BP_GET_TYPE(bp))) ? \
@@ -434,13 +468,13 @@ _NOTE(CONSTCOND) } while (0)
 	(BP_IS_EMBEDDED(bp) ? 0 : \
 	!!DVA_GET_ASIZE(&(bp)->blk_dva[0]) + \
 	!!DVA_GET_ASIZE(&(bp)->blk_dva[1]) + \
-	!!DVA_GET_ASIZE(&(bp)->blk_dva[2]))
+	(BP_IS_ENCRYPTED(bp) ? 0 : !!DVA_GET_ASIZE(&(bp)->blk_dva[2])))
 
 #define	BP_COUNT_GANG(bp)	\
 	(BP_IS_EMBEDDED(bp) ? 0 : \
 	(DVA_GET_GANG(&(bp)->blk_dva[0]) + \
 	DVA_GET_GANG(&(bp)->blk_dva[1]) + \
-	DVA_GET_GANG(&(bp)->blk_dva[2])))
+	(BP_IS_ENCRYPTED(bp) ? 0 : DVA_GET_GANG(&(bp)->blk_dva[2]))))
 
 #define	DVA_EQUAL(dva1, dva2)	\
 	((dva1)->dva_word[1] == (dva2)->dva_word[1] && \
@@ -459,6 +493,10 @@ _NOTE(CONSTCOND) } while (0)
 	((zc1).zc_word[2] - (zc2).zc_word[2]) | \
 	((zc1).zc_word[3] - (zc2).zc_word[3])))
 
+#define	ZIO_CHECKSUM_MAC_EQUAL(zc1, zc2) \
+	(0 == (((zc1).zc_word[0] - (zc2).zc_word[0]) | \
+	((zc1).zc_word[1] - (zc2).zc_word[1])))
+
 #define ZIO_CHECKSUM_IS_ZERO(zc)							\
 	(0 == ((zc)->zc_word[0] | (zc)->zc_word[1] |			\
 		   (zc)->zc_word[2] | (zc)->zc_word[3]))
@@ -566,12 +604,12 @@ _NOTE(CONSTCOND) } while (0)
 			    (u_longlong_t)DVA_GET_ASIZE(dva),		\
 			    ws);					\
 		}							\
-		if (BP_IS_GANG(bp) &&					\
+		if (BP_IS_GANG(bp) && !BP_IS_ENCRYPTED(bp) &&		\
 		    DVA_GET_ASIZE(&bp->blk_dva[2]) <=			\
 		    DVA_GET_ASIZE(&bp->blk_dva[1]) / 2)			\
 			copies--;					\
 		len += func(buf + len, size - len,			\
-		    "[L%llu %s] %s %s %s %s %s %s%c"			\
+		    "[L%llu %s] %s %s %s %s %s %s %s%c"			\
 		    "size=%llxL/%llxP birth=%lluL/%lluP fill=%llu%c"	\
 		    "cksum=%llx:%llx:%llx:%llx",			\
 		    (u_longlong_t)BP_GET_LEVEL(bp),			\
@@ -581,6 +619,7 @@ _NOTE(CONSTCOND) } while (0)
 		    BP_GET_BYTEORDER(bp) == 0 ? "BE" : "LE",		\
 		    BP_IS_GANG(bp) ? "gang" : "contiguous",		\
 		    BP_GET_DEDUP(bp) ? "dedup" : "unique",		\
+		    BP_IS_ENCRYPTED(bp) ? "encrypted" : "plain",	\
 		    copyname[copies],					\
 		    ws,							\
 		    (u_longlong_t)BP_GET_LSIZE(bp),			\
@@ -641,6 +680,7 @@ extern int spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps);
 #define	SPA_ASYNC_AUTOEXPAND	0x20
 #define	SPA_ASYNC_REMOVE_DONE	0x40
 #define	SPA_ASYNC_REMOVE_STOP	0x80
+#define	SPA_ASYNC_SCRUB		0x100
 
 /*
  * Controls the behavior of spa_vdev_remove().
@@ -676,11 +716,30 @@ extern void spa_l2cache_drop(spa_t *spa);
 
 /* scanning */
 extern int spa_scan(spa_t *spa, pool_scan_func_t func);
+extern int spa_scan_restricted(spa_t *spa, uint64_t min_txg,
+    uint64_t max_txg, nvlist_t *datasets);
 extern int spa_scan_stop(spa_t *spa);
 
+/* trimming */
+extern int spa_trim(spa_t *spa, pool_trim_func_t func, uint64_t rate);
+extern void spa_trim_stop(spa_t *spa);
+extern void spa_trim_auto(spa_t *spa, uint64_t txg);
+
+/* sequential rebuild */
+extern boolean_t spa_rebuild_start(spa_t *spa, vdev_t *tvd, uint64_t txg);
+extern void spa_rebuild_stop(spa_t *spa);
+
+/* ARC warm-up */
+extern void spa_warm_record(spa_t *spa, const zbookmark_phys_t *zb);
+extern void spa_warm_sync(spa_t *spa, dmu_tx_t *tx);
+extern void spa_warm_flush(spa_t *spa);
+extern void spa_warm_start(spa_t *spa);
+extern void spa_warm_stop(spa_t *spa);
+
 /* spa syncing */
 extern void spa_sync(spa_t *spa, uint64_t txg); /* only for DMU use */
 extern void spa_sync_allpools(void);
+extern boolean_t spa_free_backlogged(spa_t *spa);
 
 extern int zfs_sync_pass_deferred_free;
 
@@ -695,6 +754,9 @@ extern kmutex_t spa_namespace_lock;
 #define	SPA_CONFIG_UPDATE_VDEVS	1
 
 extern void spa_config_sync(spa_t *, boolean_t, boolean_t);
+extern void spa_config_sync_deferred(spa_t *);
+extern void spa_config_sync_start(void);
+extern void spa_config_sync_stop(void);
 extern void spa_config_load(void);
 extern nvlist_t *spa_all_configs(uint64_t *);
 extern void spa_config_set(spa_t *spa, nvlist_t *config);
@@ -744,9 +806,110 @@ typedef struct spa_stats {
 	spa_stats_history_t	read_history;
 	spa_stats_history_t	txg_history;
 	spa_stats_history_t	tx_assign_histogram;
+	spa_stats_history_t	tx_delay_histogram;
+	spa_stats_history_t	tx_throttle;
 	spa_stats_history_t	io_history;
+	spa_stats_history_t	compress_abort;
+	spa_stats_history_t	frees;
+	spa_stats_history_t	ditto_reads;
+	spa_stats_history_t	metaslab_alloc;
+	spa_stats_history_t	fragmentation;
+	spa_stats_history_t	vdev_histo;
+	spa_stats_history_t	vdev_queue;
+	spa_stats_history_t	raidz_children;
+	spa_stats_history_t	metaslab_groups;
+	spa_stats_history_t	zil;
+	spa_stats_history_t	zil_datasets;
+	spa_stats_history_t	zio_stages;
+	spa_stats_history_t	zio_taskqs;
 } spa_stats_t;
 
+/*
+ * Metaslab classes whose block allocators are tracked by the
+ * "metaslab_alloc" kstat, and its power of two latency buckets.
+ */
+typedef enum spa_alloc_class {
+	SPA_ALLOC_CLASS_NORMAL,
+	SPA_ALLOC_CLASS_LOG,
+	SPA_ALLOC_CLASS_SPECIAL,
+	SPA_ALLOC_CLASS_DEDUP,
+	SPA_ALLOC_CLASSES
+} spa_alloc_class_t;
+
+#define	SPA_ALLOC_LATENCY_BUCKETS	30	/* 1ns to ~0.5s */
+
+/* Counters kept by the compression early abort heuristic */
+typedef enum spa_compress_abort_stat {
+	SPA_COMPRESS_ABORT_PROBES,	/* sample probes run */
+	SPA_COMPRESS_ABORT_PROBE,	/* blocks skipped by a failed probe */
+	SPA_COMPRESS_ABORT_STREAK,	/* blocks skipped by an objset streak */
+	SPA_COMPRESS_ABORT_WASTED,	/* full compressions that didn't pay */
+	SPA_COMPRESS_ABORT_STATS
+} spa_compress_abort_stat_t;
+
+/* Counters kept by the free throttle of spa_sync() */
+typedef enum spa_free_stat {
+	SPA_FREE_ISSUED,		/* new frees issued in pass 1 */
+	SPA_FREE_DEFERRED,		/* new frees held back */
+	SPA_FREE_RELEASED,		/* held back frees issued */
+	SPA_FREE_THROTTLED_TXGS,	/* txgs that left a backlog */
+	SPA_FREE_BACKLOG_BYTES,		/* space of the backlog */
+	SPA_FREE_STATS
+} spa_free_stat_t;
+
+/*
+ * Counters of the reads of ditto blocks: which of the DVAs served them,
+ * and how many reads had to be retried from another DVA.
+ */
+#define	SPA_DITTO_READ_DVA(d)		(d)
+#define	SPA_DITTO_READ_RETRIES		SPA_DVAS_PER_BP
+#define	SPA_DITTO_READ_STATS		(SPA_DVAS_PER_BP + 1)
+
+/*
+ * Counters kept by the ZIL, both for the pool as a whole ("zil" kstat)
+ * and for each dataset whose log is open ("zil_datasets" kstat).
+ */
+typedef enum spa_zil_stat {
+	SPA_ZIL_COMMITS,	/* zil_commit() calls that waited on the log */
+	SPA_ZIL_COMMIT_NSECS,	/* time spent by those calls */
+	SPA_ZIL_COMMIT_WRITERS,	/* times the commit list was processed */
+	SPA_ZIL_ITXS,		/* log records written */
+	SPA_ZIL_LWBS_SLOG,	/* log blocks meant for the log devices */
+	SPA_ZIL_LWBS_SLOG_BYTES,
+	SPA_ZIL_LWBS_NORMAL,	/* log blocks kept off the log devices */
+	SPA_ZIL_LWBS_NORMAL_BYTES,
+	SPA_ZIL_LWB_NSECS,	/* time from lwb issue until flushed */
+	SPA_ZIL_LWB_TIMEOUTS,	/* lwbs issued by a commit waiter's timeout */
+	SPA_ZIL_STALLS,		/* lwb allocation failures */
+	SPA_ZIL_FLUSHES,	/* vdev cache flushes issued after lwbs */
+	SPA_ZIL_FLUSHES_ELIDED,	/* flushes skipped by zfs_nocacheflush_slog */
+	SPA_ZIL_FLUSH_NSECS,	/* time from lwb written until flushed */
+	SPA_ZIL_STATS
+} spa_zil_stat_t;
+
+/* Power of two latency histograms of the "zil" kstat */
+typedef enum spa_zil_latency {
+	SPA_ZIL_LATENCY_COMMIT,	/* zil_commit() */
+	SPA_ZIL_LATENCY_LWB,	/* lwb issue until flushed */
+	SPA_ZIL_LATENCIES
+} spa_zil_latency_t;
+
+#define	SPA_ZIL_LATENCY_BUCKETS	30	/* 1ns to ~0.5s */
+
+/* The counters of one dataset's log, linked on the "zil_datasets" kstat */
+typedef struct spa_zil_ds_stats {
+	list_node_t	szd_node;
+	uint64_t	szd_objset;
+	uint64_t	szd_stats[SPA_ZIL_STATS];
+} spa_zil_ds_stats_t;
+
+/*
+ * zio pipeline stages of the "zio_stages" kstat, indexed by the bit number
+ * of the stage, and its power of two latency buckets.
+ */
+#define	SPA_ZIO_STAGES		26
+#define	SPA_ZIO_STAGE_BUCKETS	30	/* 1ns to ~0.5s */
+
 typedef enum txg_state {
 	TXG_STATE_BIRTH		= 0,
 	TXG_STATE_OPEN		= 1,
@@ -756,6 +919,20 @@ typedef enum txg_state {
 	TXG_STATE_COMMITTED	= 5,
 } txg_state_t;
 
+/* Phases of spa_sync() timed in the txg history */
+typedef enum txg_sync_phase {
+	TXG_SYNC_DATASETS,	/* first write out of the dirty datasets */
+	TXG_SYNC_USERQUOTA,	/* user/group accounting and second write */
+	TXG_SYNC_DIRS,		/* dsl_dataset_sync_done() and dsl_dir_sync() */
+	TXG_SYNC_MOS,		/* MOS write out */
+	TXG_SYNC_TASKS,		/* sync tasks */
+	TXG_SYNC_DNODES,	/* dnode sync time summed over all threads */
+	TXG_SYNC_FLUSH,		/* flush of the disks written in the txg */
+	TXG_SYNC_LABELS,	/* even and odd label writes and flushes */
+	TXG_SYNC_UBERBLOCK,	/* uberblock writes and flushes */
+	TXG_SYNC_PHASES
+} txg_sync_phase_t;
+
 extern void spa_stats_init(spa_t *spa);
 extern void spa_stats_destroy(spa_t *spa);
 extern void spa_read_history_add(spa_t *spa, const zbookmark_phys_t *zb,
@@ -765,7 +942,36 @@ extern int spa_txg_history_set(spa_t *spa,  uint64_t txg,
     txg_state_t completed_state, hrtime_t completed_time);
 extern int spa_txg_history_set_io(spa_t *spa,  uint64_t txg, uint64_t nread,
     uint64_t nwritten, uint64_t reads, uint64_t writes, uint64_t ndirty);
+extern int spa_txg_history_set_early(spa_t *spa, uint64_t txg,
+    uint64_t nearly);
+extern int spa_txg_history_add_sync(spa_t *spa, uint64_t txg,
+    txg_sync_phase_t phase, hrtime_t delta);
 extern void spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_tx_delay_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_compress_abort_add(spa_t *spa, spa_compress_abort_stat_t stat);
+extern void spa_free_stats_add(spa_t *spa, spa_free_stat_t stat,
+    uint64_t delta);
+extern void spa_free_stats_set(spa_t *spa, spa_free_stat_t stat,
+    uint64_t value);
+extern void spa_ditto_read_add(spa_t *spa, int stat);
+extern void spa_metaslab_alloc_add(spa_t *spa, spa_alloc_class_t class,
+    int allocator, uint64_t nsecs);
+extern void spa_metaslab_alloc_switch(spa_t *spa, spa_alloc_class_t class);
+extern void spa_fragmentation_gang_add(spa_t *spa, uint64_t size,
+    boolean_t fragmented);
+extern void spa_zil_stat_add(spa_t *spa, spa_zil_ds_stats_t *szd,
+    spa_zil_stat_t stat, uint64_t val);
+extern void spa_zil_latency_add(spa_t *spa, spa_zil_latency_t type,
+    uint64_t nsecs);
+extern void spa_zil_ds_register(spa_t *spa, spa_zil_ds_stats_t *szd,
+    uint64_t objset);
+extern void spa_zil_ds_unregister(spa_t *spa, spa_zil_ds_stats_t *szd);
+extern void spa_zio_stage_add(spa_t *spa, int stage, uint64_t nsecs);
+extern void spa_zio_taskq_layout(spa_t *spa, int t, int q, uint_t taskqs,
+    uint_t threads);
+extern void spa_zio_taskq_dispatched(spa_t *spa, int t, int q);
+extern void spa_zio_taskq_rerouted(spa_t *spa, int t, int q);
+extern void spa_zio_taskq_started(spa_t *spa, int t, int q, uint64_t nsecs);
 
 /* Pool configuration locks */
 extern int spa_config_tryenter(spa_t *spa, int locks, void *tag, krw_t rw);
@@ -826,6 +1032,10 @@ extern uint64_t spa_version(spa_t *spa);
 extern boolean_t spa_deflate(spa_t *spa);
 extern metaslab_class_t *spa_normal_class(spa_t *spa);
 extern metaslab_class_t *spa_log_class(spa_t *spa);
+extern metaslab_class_t *spa_special_class(spa_t *spa);
+extern metaslab_class_t *spa_dedup_class(spa_t *spa);
+extern metaslab_class_t *spa_preferred_class(spa_t *spa, uint64_t size,
+    dmu_object_type_t type, uint64_t level, uint64_t special_smallblk);
 extern void spa_evicting_os_register(spa_t *, objset_t *os);
 extern void spa_evicting_os_deregister(spa_t *, objset_t *os);
 extern void spa_evicting_os_wait(spa_t *spa);
@@ -865,6 +1075,7 @@ extern boolean_t spa_is_root(spa_t *spa);
 extern boolean_t spa_writeable(spa_t *spa);
 extern boolean_t spa_has_pending_synctask(spa_t *spa);
 extern int spa_maxblocksize(spa_t *spa);
+extern int spa_maxdnodesize(spa_t *spa);
 extern void zfs_blkptr_verify(spa_t *spa, const blkptr_t *bp);
 
 extern int spa_mode(spa_t *spa);
@@ -41,6 +41,7 @@
 #include <sys/refcount.h>
 #include <sys/bplist.h>
 #include <sys/bpobj.h>
+#include <sys/dsl_crypt.h>
 #include <sys/zfeature.h>
 #include <zfeature_common.h>
 
@@ -72,12 +73,28 @@ struct spa_aux_vdev {
 	uint_t		sav_npending;		/* # pending devices */
 };
 
+/*
+ * Every zio holds SCL_ZIO as reader, so readers only touch the shard of
+ * the cpu they run on: they count themselves in and out under its lock.
+ * A hold can be dropped on another cpu, or by another thread, than it
+ * was taken on, so a shard's count can go negative; only the sum over
+ * all shards, taken with all of their locks held, is the number of
+ * readers.  A writer raises scl_write_wanted under scl_lock, which keeps
+ * new readers out once it has passed their shard, and waits for that sum
+ * to drain to zero.
+ */
+typedef struct spa_config_shard {
+	kmutex_t	scs_lock;
+	int64_t		scs_count;	/* readers in less readers out */
+	char		scs_pad[64];	/* keep shards on separate lines */
+} spa_config_shard_t;
+
 typedef struct spa_config_lock {
 	kmutex_t	scl_lock;
 	kthread_t	*scl_writer;
 	int		scl_write_wanted;
 	kcondvar_t	scl_cv;
-	refcount_t	scl_count;
+	spa_config_shard_t *scl_shards;	/* max_ncpus of them */
 } spa_config_lock_t;
 
 typedef struct spa_config_dirent {
@@ -93,6 +110,8 @@ typedef enum zio_taskq_type {
 	ZIO_TASKQ_TYPES
 } zio_taskq_type_t;
 
+extern const char *const zio_taskq_types[ZIO_TASKQ_TYPES];
+
 /*
  * State machine for the zpool-poolname process.  The states transitions
  * are done as follows:
@@ -115,6 +134,7 @@ typedef enum spa_proc_state {
 typedef struct spa_taskqs {
 	uint_t stqs_count;
 	taskq_t **stqs_taskq;
+	uint64_t *stqs_queued;	/* zios waiting on each, see spa_taskq_select */
 } spa_taskqs_t;
 
 typedef enum spa_all_vdev_zap_action {
@@ -151,6 +171,8 @@ struct spa {
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	metaslab_class_t *spa_normal_class;	/* normal data class */
 	metaslab_class_t *spa_log_class;	/* intent log data class */
+	metaslab_class_t *spa_special_class;	/* metadata class */
+	metaslab_class_t *spa_dedup_class;	/* dedup table class */
 	uint64_t	spa_first_txg;		/* first txg after spa_open() */
 	uint64_t	spa_final_txg;		/* txg of export/destroy */
 	uint64_t	spa_freeze_txg;		/* freeze pool at this txg */
@@ -172,6 +194,10 @@ struct spa {
 	list_t		spa_state_dirty_list;	/* vdevs with dirty state */
 	kmutex_t	spa_alloc_lock;
 	avl_tree_t	spa_alloc_tree;
+	kmutex_t	spa_log_lock;		/* protects spa_unflushed_ms */
+	avl_tree_t	spa_unflushed_ms;	/* by ms_unflushed_txg */
+	uint64_t	spa_log_sm_count;	/* live log space maps */
+	boolean_t	spa_log_flushall;	/* flush and stop logging */
 	spa_aux_vdev_t	spa_spares;		/* hot spares */
 	spa_aux_vdev_t	spa_l2cache;		/* L2ARC cache devices */
 	nvlist_t	*spa_label_features;	/* Features for reading MOS */
@@ -179,6 +205,7 @@ struct spa {
 	uint64_t	spa_config_generation;	/* config generation number */
 	uint64_t	spa_syncing_txg;	/* txg currently syncing */
 	bpobj_t		spa_deferred_bpobj;	/* deferred-free bplist */
+	boolean_t	spa_free_backlog;	/* throttled frees pending */
 	bplist_t	spa_free_bplist[TXG_SIZE]; /* bplist of stuff to free */
 	zio_cksum_salt_t spa_cksum_salt;        /* secret salt for cksum */
 	/* checksum context templates */
@@ -188,6 +215,8 @@ struct spa {
 	uberblock_t	spa_uberblock;		/* current uberblock */
 	boolean_t	spa_extreme_rewind;	/* rewind past deferred frees */
 	uint64_t	spa_last_io;		/* lbolt of last non-scan I/O */
+	uint64_t	spa_sync_read_lat_pct;	/* sync read latency vs. best */
+	uint64_t	spa_scan_rate;		/* scan bytes/sec, 0 unlimited */
 	kmutex_t	spa_scrub_lock;		/* resilver/scrub lock */
 	uint64_t	spa_scrub_inflight;	/* in-flight scrub I/Os */
 	kcondvar_t	spa_scrub_io_cv;	/* scrub I/O completion */
@@ -212,6 +241,8 @@ struct spa {
 	uint64_t	spa_load_txg_ts;	/* timestamp from that ub */
 	uint64_t	spa_load_meta_errors;	/* verify metadata err count */
 	uint64_t	spa_load_data_errors;	/* verify data err count */
+	uint64_t	spa_load_vdevs_total;	/* top-level vdevs to load */
+	uint64_t	spa_load_vdevs_done;	/* top-level vdevs loaded */
 	uint64_t	spa_verify_min_txg;	/* start txg of verify scrub */
 	kmutex_t	spa_errlog_lock;	/* error log lock */
 	uint64_t	spa_errlog_last;	/* last error log object */
@@ -228,7 +259,11 @@ struct spa {
 	uint64_t	spa_bootfs;		/* default boot filesystem */
 	uint64_t	spa_failmode;		/* failure mode for the pool */
 	uint64_t	spa_delegation;		/* delegation on/off */
+	spa_keystore_t	spa_keystore;		/* loaded crypto keys */
 	list_t		spa_config_list;	/* previous cache file(s) */
+	uint64_t	spa_config_set_count;	/* spa_config changes */
+	uint64_t	spa_config_cached;	/* set count in cache file */
+	boolean_t	spa_config_sync_pending; /* deferred cache sync */
 	/* per-CPU array of root of async I/O: */
 	zio_t		**spa_async_zio_root;
 	zio_t		*spa_suspend_zio_root;	/* root of all suspended I/O */
@@ -242,9 +277,13 @@ struct spa {
 	int		spa_mode;		/* FREAD | FWRITE */
 	spa_log_state_t spa_log_state;		/* log state */
 	uint64_t	spa_autoexpand;		/* lun expansion on/off */
+	uint64_t	spa_autotrim;		/* unmap freed space on/off */
 	ddt_t		*spa_ddt[ZIO_CHECKSUM_FUNCTIONS]; /* in-core DDTs */
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_ditto;	/* dedup ditto threshold */
+	uint64_t	spa_dedup_quota;	/* DDT on-disk size limit */
+	uint64_t	spa_dedup_dsize;	/* DDT on-disk size */
+	uint64_t	spa_ddt_pruned;		/* unique entries pruned */
 	uint64_t	spa_dedup_checksum;	/* default dedup checksum */
 	uint64_t	spa_dspace;		/* dspace in normal class */
 	kmutex_t	spa_vdev_top_lock;	/* dueling offline/remove */
@@ -274,6 +313,36 @@ struct spa {
 	uint64_t	spa_errata;		/* errata issues detected */
 	spa_stats_t	spa_stats;		/* assorted spa statistics */
 	taskq_t		*spa_zvol_taskq;	/* Taskq for minor managment */
+	taskq_t		*spa_scan_verify_taskq;	/* verifies scan reads */
+	kmutex_t	spa_scan_verify_lock;	/* protects spa_scan_verify_* */
+	list_t		spa_scan_verify_list;	/* scan reads to verify */
+	uint_t		spa_scan_verify_threads; /* threads of the taskq */
+	uint_t		spa_scan_verify_active;	/* drain tasks running */
+	kmutex_t	spa_trim_lock;		/* protects spa_trim_* */
+	kcondvar_t	spa_trim_cv;		/* spa_trim_thread exited */
+	kthread_t	*spa_trim_thread;	/* unmapping free space */
+	boolean_t	spa_trim_stop;		/* stop spa_trim_thread */
+	boolean_t	spa_trim_manual;	/* zpool trim requested */
+	uint64_t	spa_trim_rate;		/* bytes/sec, 0 is unlimited */
+	kmutex_t	spa_rebuild_lock;	/* protects spa_rebuild_* */
+	kcondvar_t	spa_rebuild_cv;		/* spa_rebuild_thread exited */
+	kthread_t	*spa_rebuild_thread;	/* sequential mirror rebuild */
+	boolean_t	spa_rebuild_stop;	/* stop spa_rebuild_thread */
+	uint64_t	spa_rebuild_vdev;	/* top-level vdev rebuilt */
+	uint64_t	spa_rebuild_guid;	/* its guid */
+	uint64_t	spa_rebuild_txg;	/* rebuild DTLs up to txg */
+	kmutex_t	spa_warm_lock;		/* protects spa_warm_* */
+	kcondvar_t	spa_warm_cv;		/* spa_warm_thread exited */
+	kthread_t	*spa_warm_thread;	/* prefetching logged blocks */
+	boolean_t	spa_warm_stop;		/* stop spa_warm_thread */
+	boolean_t	spa_warm_flush;		/* write the log at export */
+	zbookmark_phys_t *spa_warm_log;		/* ring of hot bookmarks */
+	uint64_t	spa_warm_size;		/* entries in spa_warm_log */
+	uint64_t	spa_warm_count;		/* bookmarks ever logged */
+	uint64_t	spa_warm_synced;	/* spa_warm_count at write */
+	uint64_t	spa_warm_seen;		/* MFU promotions sampled */
+	uint64_t	spa_warm_obj;		/* MOS object of the log */
+	hrtime_t	spa_warm_sync_time;	/* when the log was written */
 #ifdef __APPLE__
 	spa_iokit_t	*spa_iokit_proxy;	/* IOKit pool proxy */
 #endif
@@ -294,6 +363,17 @@ extern void spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
     task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent);
 extern void spa_taskq_dispatch_sync(spa_t *, zio_type_t t, zio_taskq_type_t q,
     task_func_t *func, void *arg, uint_t flags);
+extern void spa_config_lock_init(spa_t *spa);
+extern void spa_config_lock_destroy(spa_t *spa);
+extern uint_t spa_taskq_select(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
+    uint_t cpu);
+extern void spa_taskq_started(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
+    uint_t idx);
+extern void spa_taskq_dispatch_ent_on(spa_t *spa, zio_type_t t,
+    zio_taskq_type_t q, uint_t idx, task_func_t *func, void *arg,
+    uint_t flags, taskq_ent_t *ent);
+extern int spa_taskq_param_set(zio_type_t t, const char *val);
+extern int spa_taskq_param_get(zio_type_t t, char *buf, size_t size);
 
 
 #ifdef	__cplusplus
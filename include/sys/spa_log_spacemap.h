@@ -0,0 +1,69 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SPA_LOG_SPACEMAP_H
+#define	_SYS_SPA_LOG_SPACEMAP_H
+
+#include <sys/avl.h>
+#include <sys/list.h>
+#include <sys/space_map.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Entries of a top-level vdev's ZAP.  The first is a ZAP mapping the txg
+ * of each of the vdev's log space maps to its object, the second an array
+ * holding the ms_unflushed_txg of each of its metaslabs.
+ */
+#define	VDEV_TOP_ZAP_LOG_SPACEMAPS	"org.openzfsonosx:log_spacemaps"
+#define	VDEV_TOP_ZAP_MS_UNFLUSHED_TXGS	"org.openzfsonosx:ms_unflushed_txgs"
+
+/* a log space map of a top-level vdev, on vdev_log_list */
+typedef struct vdev_log_entry {
+	list_node_t	vle_node;
+	uint64_t	vle_txg;	/* txg whose changes it holds */
+	uint64_t	vle_obj;	/* space map object */
+} vdev_log_entry_t;
+
+extern int zfs_log_spacemaps;
+extern uint64_t zfs_unflushed_log_txg_max;
+extern uint64_t zfs_min_metaslabs_to_flush;
+extern int zfs_keep_log_spacemaps_at_export;
+
+int spa_unflushed_ms_compare(const void *, const void *);
+boolean_t spa_log_sm_enabled(spa_t *);
+void spa_log_sync(spa_t *, dmu_tx_t *);
+void spa_log_flush_all(spa_t *);
+int spa_ld_log_spacemaps(spa_t *);
+
+void vdev_log_init(vdev_t *);
+void vdev_log_fini(vdev_t *);
+space_map_t *vdev_log_sm_get(vdev_t *, dmu_tx_t *);
+void vdev_log_sm_sync_done(vdev_t *, uint64_t);
+void vdev_log_set_unflushed_txg(vdev_t *, uint64_t, uint64_t, dmu_tx_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SPA_LOG_SPACEMAP_H */
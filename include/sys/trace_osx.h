@@ -0,0 +1,165 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_TRACE_OSX_H
+#define	_SYS_TRACE_OSX_H
+
+#if defined(_KERNEL) && defined(__APPLE__)
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * The OS X counterpart of the Linux tracepoints of sys/trace_*.h.  A kext
+ * can't register SDT probes, so each DTRACE_PROBEn(name, ...) instead
+ * calls an empty function zfs_sdt_<name>() which is never inlined, and
+ * the probe is its fbt entry:
+ *
+ *	dtrace -n 'fbt:zfs:zfs_sdt_arc__hit:entry { @[arg0] = count(); }'
+ *
+ * Each argument is passed as a uintptr_t in the order of the DTRACE_PROBEn()
+ * call, so a probe's arg0..arg3 are stable as long as its call is.  Every
+ * probe must be listed below, with the types of its arguments; trace_osx.c
+ * defines the functions.  A disabled probe costs a call.
+ */
+#define	ZFS_SDT_PROBES(P0, P1, P2, P3, P4)				\
+	/* arc.c */							\
+	P1(arc__hit)			/* arc_buf_hdr_t * */		\
+	P4(arc__miss)			/* arc_buf_hdr_t *, blkptr_t *,	\
+					 * uint64_t lsize,		\
+					 * zbookmark_phys_t * */	\
+	P1(arc__evict)			/* arc_buf_hdr_t * */		\
+	P1(arc__delete)			/* arc_buf_hdr_t * */		\
+	P1(arc__sync__wait__for__async)	/* arc_buf_hdr_t * */		\
+	P1(arc__demand__hit__predictive__prefetch)			\
+					/* arc_buf_hdr_t * */		\
+	P1(new_state__mru)		/* arc_buf_hdr_t * */		\
+	P1(new_state__mfu)		/* arc_buf_hdr_t * */		\
+	P1(l2arc__hit)			/* arc_buf_hdr_t * */		\
+	P1(l2arc__miss)			/* arc_buf_hdr_t * */		\
+	P2(l2arc__read)			/* vdev_t *, zio_t * */		\
+	P2(l2arc__write)		/* vdev_t *, zio_t * */		\
+	P2(l2arc__iodone)		/* zio_t *,			\
+					 * l2arc_write_callback_t * */	\
+	P4(l2arc__evict)		/* l2arc_dev_t *, list_t *,	\
+					 * uint64_t taddr,		\
+					 * boolean_t all */		\
+	/* dbuf.c */							\
+	P2(dbuf__evict__one)		/* dmu_buf_impl_t *,		\
+					 * multilist_sublist_t * */	\
+	P2(blocked__read)		/* dmu_buf_impl_t *, zio_t * */	\
+	/* dmu.c, dmu_tx.c, dnode.c */					\
+	P3(free__long__range)		/* uint64_t dirty, uint64_t len, \
+					 * uint64_t txg */		\
+	P3(delay__mintime)		/* dmu_tx_t *, uint64_t dirty,	\
+					 * uint64_t min_tx_time */	\
+	P3(dnode__move)			/* dnode_t *, int64_t refcount,	\
+					 * uint32_t dbufs */		\
+	/* dsl_pool.c, txg.c */						\
+	P2(dsl_pool_sync__done)		/* dsl_pool_t *, uint64_t txg */ \
+	P2(txg__opened)			/* dsl_pool_t *, uint64_t txg */ \
+	P2(txg__quiescing)		/* dsl_pool_t *, uint64_t txg */ \
+	P2(txg__quiesced)		/* dsl_pool_t *, uint64_t txg */ \
+	P2(txg__syncing)		/* dsl_pool_t *, uint64_t txg */ \
+	P2(txg__synced)			/* dsl_pool_t *, uint64_t txg */ \
+	/* multilist.c, zrlock.c, rrwlock.c */				\
+	P3(multilist__insert)		/* multilist_t *,		\
+					 * unsigned int sublist,	\
+					 * void *obj */			\
+	P3(multilist__remove)		/* multilist_t *,		\
+					 * unsigned int sublist,	\
+					 * void *obj */			\
+	P2(zrlock__reentry)		/* zrlock_t *, uint32_t n */	\
+	P0(zfs__rrwfastpath__rdmiss)					\
+	P0(zfs__rrwfastpath__exitmiss)					\
+	/* zil.c */							\
+	P1(zil__commit)			/* zilog_t * */			\
+	P1(zil__commit__done)		/* zilog_t * */			\
+	P1(zil__cw1)			/* zilog_t * */			\
+	P1(zil__cw2)			/* zilog_t * */			\
+	/* zio.c */							\
+	P1(zio__done)			/* zio_t * */			\
+	P2(zio__delay__miss)		/* zio_t *, hrtime_t now */	\
+	P3(zio__delay__hit)		/* zio_t *, hrtime_t now,	\
+					 * hrtime_t diff */		\
+	P1(zio__delay__skip)		/* zio_t * */			\
+	/* zfs_acl.c, zfs_vnops.c, zfs_debug.c */			\
+	P3(zfs__ace__denies)		/* znode_t *, zfs_ace_hdr_t *,	\
+					 * uint32_t mask */		\
+	P3(zfs__ace__allows)		/* znode_t *, zfs_ace_hdr_t *,	\
+					 * uint32_t mask */		\
+	P0(zfs__fastpath__execute__access__miss)			\
+	P2(zfs__fastpath__lookup__miss)	/* vnode_t *, char *name */	\
+	P3(zfs_cp_write)		/* int, iovec_t *,		\
+					 * arc_buf_t * */		\
+	P3(zfs_reqzcbuf_align)		/* int preamble,		\
+					 * int postamble, int blocks */	\
+	P1(zfs__dbgmsg)			/* char *msg */
+
+#define	ZFS_SDT_DECL0(name)						\
+	extern void zfs_sdt_##name(void) __attribute__((noinline));
+#define	ZFS_SDT_DECL1(name)						\
+	extern void zfs_sdt_##name(uintptr_t) __attribute__((noinline));
+#define	ZFS_SDT_DECL2(name)						\
+	extern void zfs_sdt_##name(uintptr_t, uintptr_t)		\
+	    __attribute__((noinline));
+#define	ZFS_SDT_DECL3(name)						\
+	extern void zfs_sdt_##name(uintptr_t, uintptr_t, uintptr_t)	\
+	    __attribute__((noinline));
+#define	ZFS_SDT_DECL4(name)						\
+	extern void zfs_sdt_##name(uintptr_t, uintptr_t, uintptr_t,	\
+	    uintptr_t) __attribute__((noinline));
+
+ZFS_SDT_PROBES(ZFS_SDT_DECL0, ZFS_SDT_DECL1, ZFS_SDT_DECL2, ZFS_SDT_DECL3,
+    ZFS_SDT_DECL4)
+
+#undef DTRACE_PROBE
+#define	DTRACE_PROBE(name)						\
+	zfs_sdt_##name()
+
+#undef DTRACE_PROBE1
+#define	DTRACE_PROBE1(name, t1, arg1)					\
+	zfs_sdt_##name((uintptr_t)(arg1))
+
+#undef DTRACE_PROBE2
+#define	DTRACE_PROBE2(name, t1, arg1, t2, arg2)				\
+	zfs_sdt_##name((uintptr_t)(arg1), (uintptr_t)(arg2))
+
+#undef DTRACE_PROBE3
+#define	DTRACE_PROBE3(name, t1, arg1, t2, arg2, t3, arg3)		\
+	zfs_sdt_##name((uintptr_t)(arg1), (uintptr_t)(arg2),		\
+	    (uintptr_t)(arg3))
+
+#undef DTRACE_PROBE4
+#define	DTRACE_PROBE4(name, t1, arg1, t2, arg2, t3, arg3, t4, arg4)	\
+	zfs_sdt_##name((uintptr_t)(arg1), (uintptr_t)(arg2),		\
+	    (uintptr_t)(arg3), (uintptr_t)(arg4))
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _KERNEL && __APPLE__ */
+
+#endif	/* _SYS_TRACE_OSX_H */
@@ -66,16 +66,32 @@ extern "C" {
  * The tc_open_lock is held until the transaction is assigned into the
  * transaction group. Typically, this is a short operation but if throttling
  * is occuring it may be held for longer periods of time.
+ *
+ * Dirty space reported by open context transactions is first summed into
+ * tc_dirty of the tx_cpu they hold, and only folded into the pool-wide
+ * dp_dirty_total once it exceeds the slack allowed per cpu, or when the
+ * txg is quiesced (see dsl_pool_dirty_space()).
+ *
+ * Each tx_cpu is padded out to whole cache lines, so that threads holding
+ * neighbouring tx_cpus do not bounce one line between them.
  */
 struct tx_cpu {
 	kmutex_t	tc_open_lock;	/* protects tx_open_txg */
 	kmutex_t	tc_lock;	/* protects the rest of this struct */
 	kcondvar_t	tc_cv[TXG_SIZE];
 	uint64_t	tc_count[TXG_SIZE];	/* tx hold count on each txg */
+	uint64_t	tc_dirty[TXG_SIZE];	/* unfolded dirty space */
 	list_t		tc_callbacks[TXG_SIZE]; /* commit cb list */
-	char		tc_pad[8];		/* pad to fill 3 cache lines */
 };
 
+#define	TX_CPU_SIZE		P2ROUNDUP(sizeof (tx_cpu_t), 64)
+typedef union tx_cpu_slot {
+	tx_cpu_t	tcs_cpu;
+	char		tcs_pad[TX_CPU_SIZE];
+} tx_cpu_slot_t;
+
+#define	TX_CPU(tx, c)		(&(tx)->tx_cpu[(c)].tcs_cpu)
+
 /*
  * The tx_state structure maintains the state information about the different
  * stages of the pool's transcation groups. A per pool tx_state structure
@@ -88,7 +104,7 @@ struct tx_cpu {
  * every cpu (see txg_quiesce()).
  */
 typedef struct tx_state {
-	tx_cpu_t	*tx_cpu;	/* protects access to tx_open_txg */
+	tx_cpu_slot_t	*tx_cpu;	/* protects access to tx_open_txg */
 	kmutex_t	tx_sync_lock;	/* protects the rest of this struct */
 
 	uint64_t	tx_open_txg;	/* currently open txg id */
@@ -46,6 +46,7 @@ typedef enum vdev_dtl_type {
 } vdev_dtl_type_t;
 
 extern int zfs_nocacheflush;
+extern int zfs_nocacheflush_slog;
 
 /*
  * Fault injection modes.
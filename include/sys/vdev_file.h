@@ -36,8 +36,22 @@ extern "C" {
 typedef struct vdev_file {
 	struct vnode	*vf_vnode;
     uint32_t	vf_vid;
+
+	/*
+	 * Flushes that arrive while an fsync is running are all answered by
+	 * the single fsync that follows it; see vdev_file_io_fsync().
+	 */
+	kmutex_t	vf_flush_lock;
+	kcondvar_t	vf_flush_cv;
+	uint64_t	vf_flush_requested;
+	uint64_t	vf_flush_done;
+	boolean_t	vf_flush_active;
+	int		vf_flush_error;
 } vdev_file_t;
 
+extern void vdev_file_init(void);
+extern void vdev_file_fini(void);
+
 #ifdef	__cplusplus
 }
 #endif
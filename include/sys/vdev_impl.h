@@ -32,6 +32,7 @@
 #include <sys/nvpair.h>
 #include <sys/space_map.h>
 #include <sys/vdev.h>
+#include <sys/abd.h>
 #include <sys/dkio.h>
 #include <sys/uberblock_impl.h>
 
@@ -90,7 +91,7 @@ typedef const struct vdev_ops {
  * Virtual device properties
  */
 struct vdev_cache_entry {
-	char		*ve_data;
+	abd_t		*ve_abd;
 	uint64_t	ve_offset;
 	clock_t		ve_lastused;
 	avl_node_t	ve_offset_node;
@@ -98,16 +99,36 @@ struct vdev_cache_entry {
 	uint32_t	ve_hits;
 	uint16_t	ve_missed_update;
 	zio_t		*ve_fill_io;
+	uint64_t	ve_used;	/* bytes of the entry read so far */
 };
 
 struct vdev_cache {
 	avl_tree_t	vc_offset_tree;
 	avl_tree_t	vc_lastused_tree;
 	kmutex_t	vc_lock;
+	uint64_t	vc_fills;	/* recent inflated reads */
+	uint64_t	vc_fills_used;	/* ... of which were read again */
+	uint64_t	vc_skipped;	/* misses not inflated since last */
 };
 
+/*
+ * State of the controller adapting the max_active of a queue class to the
+ * latency of the device, see vdev_queue_tune().
+ */
+typedef struct vdev_queue_tune {
+	uint32_t	vqt_max_active;	/* current limit, 0: unseeded */
+	uint32_t	vqt_ios;	/* completions in this window */
+	uint32_t	vqt_saturated;	/* of those, with i/o held back */
+	hrtime_t	vqt_lat_sum;	/* service time in this window */
+	hrtime_t	vqt_lat_avg;	/* moving average of service time */
+	hrtime_t	vqt_lat_floor;	/* lowest average, decaying */
+	uint64_t	vqt_grows;
+	uint64_t	vqt_shrinks;
+} vdev_queue_tune_t;
+
 typedef struct vdev_queue_class {
 	uint32_t	vqc_active;
+	vdev_queue_tune_t vqc_tune;
 
 	/*
 	 * Sorted by offset or timestamp, depending on if the queue is
@@ -161,8 +182,10 @@ struct vdev {
 	boolean_t	vdev_expanding;	/* expand the vdev?		*/
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
+	uint64_t	vdev_max_xfer;	/* max bytes per i/o, 0 unknown	*/
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
+	int		vdev_load_error; /* error on last load		*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
 
 	/*
@@ -174,6 +197,8 @@ struct vdev {
 	metaslab_group_t *vdev_mg;	/* metaslab group		*/
 	metaslab_t	**vdev_ms;	/* metaslab array		*/
 	uint64_t	vdev_pending_fastwrite; /* allocated fastwrites */
+	uint64_t	vdev_write_nsecs; /* leaf write latency sum	*/
+	uint64_t	vdev_write_count; /* leaf writes in the sum	*/
 	txg_list_t	vdev_ms_list;	/* per-txg dirty metaslab lists	*/
 	txg_list_t	vdev_dtl_list;	/* per-txg dirty DTL lists	*/
 	txg_node_t	vdev_txg_node;	/* per-txg dirty vdev linkage	*/
@@ -183,10 +208,27 @@ struct vdev {
 	list_node_t	vdev_state_dirty_node; /* state dirty list	*/
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
+	uint64_t	vdev_isspecial;	/* holds the special class	*/
+	uint64_t	vdev_isdedup;	/* holds the dedup class	*/
+	uint64_t	vdev_sequential; /* allocates sequentially (SMR) */
 	uint64_t	vdev_removing;	/* device is being removed?	*/
 	boolean_t	vdev_ishole;	/* is a hole in the namespace	*/
 	kmutex_t	vdev_queue_lock; /* protects vdev_queue_depth	*/
 	uint64_t	vdev_top_zap;
+	struct dsl_scan_io_queue *vdev_scan_io_queue; /* sorted scan I/O */
+
+	/*
+	 * Log space maps (see spa_log_spacemap.c).  vdev_log_zap maps the
+	 * txg of each log space map of this vdev to its object, and
+	 * vdev_unflushed_obj is an array holding the ms_unflushed_txg of
+	 * each metaslab.  Both are linked from vdev_top_zap.
+	 */
+	uint64_t	vdev_log_zap;
+	uint64_t	vdev_unflushed_obj;
+	space_map_t	*vdev_log_sm;	/* log of the syncing txg	*/
+	uint64_t	vdev_log_sm_txg;
+	list_t		vdev_log_list;	/* vdev_log_entry_t by txg	*/
+	kmutex_t	vdev_log_lock;	/* lock of vdev_log_sm		*/
 
 	/*
 	 * The queue depth parameters determine how many async writes are
@@ -198,6 +240,12 @@ struct vdev {
 	uint64_t	vdev_async_write_queue_depth;
 	uint64_t	vdev_max_async_write_queue_depth;
 
+	/*
+	 * 1 + the child of a RAID-Z vdev that last returned bad data without
+	 * an I/O error, or 0; see vdev_raidz_combrec_hint().
+	 */
+	int		vdev_raidz_suspect;
+
 	/*
 	 * Leaf vdev state.
 	 */
@@ -220,6 +268,7 @@ struct vdev {
 	uint64_t	vdev_not_present; /* not present during import	*/
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_notrim;	/* true if DKIOCFREE failed */
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_splitting;	/* split or repair in progress  */
@@ -237,6 +286,18 @@ struct vdev {
 	vdev_aux_t	vdev_label_aux;	/* on-disk aux state		*/
 	uint64_t	vdev_leaf_zap;
 
+	/*
+	 * Bad data this child of a RAID-Z vdev returned without an I/O
+	 * error, and how often trying it first settled a reconstruction.
+	 * vdev_silent_recent halves every RAIDZ_SILENT_HALFLIFE since
+	 * vdev_silent_time; all are protected by vdev_stat_lock.
+	 */
+	uint64_t	vdev_silent_errors;
+	uint64_t	vdev_silent_recent;
+	hrtime_t	vdev_silent_time;
+	uint64_t	vdev_hint_hits;
+	uint64_t	vdev_hint_misses;
+
 	/*
 	 * For DTrace to work in userland (libzpool) context, these fields must
 	 * remain at the end of the structure.  DTrace will use the kernel's
@@ -360,6 +421,17 @@ extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
+/*
+ * Adaptive queue depth
+ */
+extern void vdev_queue_tune_get(vdev_t *vd, zio_priority_t p,
+    vdev_queue_tune_t *vqt);
+
+/*
+ * RAID-Z silent error accounting
+ */
+extern uint64_t vdev_raidz_silent_recent(vdev_t *cvd);
+
 /*
  * Global variables
  */
@@ -0,0 +1,75 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_H
+#define	_SYS_VDEV_RAIDZ_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * RAID-Z parity math.
+ *
+ * The parity generation and reconstruction code in vdev_raidz.c is built
+ * on the handful of GF(2^8) primitives below.  Each primitive is provided
+ * by every implementation in vdev_raidz_math*.c; the one in use is chosen
+ * by benchmark at vdev_raidz_math_init() time and may be changed with
+ * vdev_raidz_impl_set().  All sizes are in bytes.
+ */
+
+/* p ^= src */
+void vdev_raidz_math_p_add(void *p, const void *src, uint64_t size);
+
+/* q = 2 * q + src over csize bytes, q = 2 * q over the rest of qsize */
+void vdev_raidz_math_q_add(void *q, const void *src, uint64_t csize,
+    uint64_t qsize);
+
+/* The P and Q steps above fused into one pass */
+void vdev_raidz_math_pq_add(void *p, void *q, const void *src,
+    uint64_t csize, uint64_t psize);
+
+/* As above, plus r = 4 * r + src */
+void vdev_raidz_math_pqr_add(void *p, void *q, void *r, const void *src,
+    uint64_t csize, uint64_t psize);
+
+/* dst ^= c * src */
+void vdev_raidz_math_mul_add(void *dst, const void *src, uint8_t c,
+    uint64_t size);
+
+/* dst = c * dst */
+void vdev_raidz_math_mul(void *dst, uint8_t c, uint64_t size);
+
+void vdev_raidz_math_init(void);
+void vdev_raidz_math_fini(void);
+int vdev_raidz_impl_set(const char *);
+int vdev_raidz_impl_get(char *, size_t);
+int vdev_raidz_math_selftest(uint64_t seed);
+uint64_t vdev_raidz_impl_bench(uint32_t id, int parity, uint8_t **cols,
+    uint64_t size, hrtime_t ns, const char **name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_VDEV_RAIDZ_H */
@@ -0,0 +1,96 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_IMPL_H
+#define	_SYS_VDEV_RAIDZ_IMPL_H
+
+#include <sys/types.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
+#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
+
+/*
+ * We provide a mechanism to perform the field multiplication operation on a
+ * 64-bit value all at once rather than a byte at a time. This works by
+ * creating a mask from the top bit in each byte and using that to
+ * conditionally apply the XOR of 0x1d.
+ */
+#define	VDEV_RAIDZ_64MUL_2(x, mask) \
+{ \
+	(mask) = (x) & 0x8080808080808080ULL; \
+	(mask) = ((mask) << 1) - ((mask) >> 7); \
+	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
+	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
+}
+
+#define	VDEV_RAIDZ_64MUL_4(x, mask) \
+{ \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+}
+
+/* Powers and logs of 2 in GF(2^8), see vdev_raidz.c */
+extern const uint8_t vdev_raidz_pow2[256];
+extern const uint8_t vdev_raidz_log2[256];
+
+/*
+ * One implementation of the primitives in <sys/vdev_raidz.h>.  Vector
+ * implementations are only handed sizes which are a multiple of
+ * 'blocksize'; vdev_raidz_math.c runs anything else through the scalar
+ * code.
+ */
+typedef struct raidz_impl_ops {
+	void (*p_add)(void *, const void *, uint64_t);
+	void (*q_add)(void *, const void *, uint64_t, uint64_t);
+	void (*pq_add)(void *, void *, const void *, uint64_t, uint64_t);
+	void (*pqr_add)(void *, void *, void *, const void *, uint64_t,
+	    uint64_t);
+	void (*mul_add)(void *, const void *, const uint8_t *, uint64_t);
+	void (*mul)(void *, const uint8_t *, uint64_t);
+	boolean_t (*is_supported)(void);
+	uint64_t blocksize;
+	const char *name;
+} raidz_impl_ops_t;
+
+/*
+ * mul_add and mul take the constant as a pair of 16-entry tables, the
+ * products with every low and every high nibble.  c * x is then
+ * tbl[x & 0xf] ^ tbl[16 + (x >> 4)], which is what PSHUFB computes
+ * sixteen or thirty-two bytes at a time.  Table element 32 holds c itself.
+ */
+#define	RAIDZ_MUL_TBL_SIZE	(33)
+
+#if defined(HAVE_SIMD_X86)
+extern const raidz_impl_ops_t vdev_raidz_ssse3_impl;
+extern const raidz_impl_ops_t vdev_raidz_avx2_impl;
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_VDEV_RAIDZ_IMPL_H */
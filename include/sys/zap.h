@@ -120,6 +120,9 @@ uint64_t zap_create(objset_t *ds, dmu_object_type_t ot,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
 uint64_t zap_create_norm(objset_t *ds, int normflags, dmu_object_type_t ot,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
+uint64_t zap_create_norm_dnsize(objset_t *ds, int normflags,
+    dmu_object_type_t ot, dmu_object_type_t bonustype, int bonuslen,
+    int dnodesize, dmu_tx_t *tx);
 uint64_t zap_create_flags(objset_t *os, int normflags, zap_flags_t flags,
     dmu_object_type_t ot, int leaf_blockshift, int indirect_blockshift,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
@@ -141,6 +144,9 @@ int zap_create_claim(objset_t *ds, uint64_t obj, dmu_object_type_t ot,
 int zap_create_claim_norm(objset_t *ds, uint64_t obj,
     int normflags, dmu_object_type_t ot,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
+int zap_create_claim_norm_dnsize(objset_t *ds, uint64_t obj,
+    int normflags, dmu_object_type_t ot,
+    dmu_object_type_t bonustype, int bonuslen, int dnodesize, dmu_tx_t *tx);
 
 /*
  * The zapobj passed in must be a valid ZAP object for all of the
@@ -313,6 +319,8 @@ int zap_update_int_key(objset_t *os, uint64_t obj,
     uint64_t key, uint64_t value, dmu_tx_t *tx);
 int zap_lookup_int_key(objset_t *os, uint64_t obj,
     uint64_t key, uint64_t *valuep);
+int zap_remove_int_key(objset_t *os, uint64_t obj,
+    uint64_t key, dmu_tx_t *tx);
 
 int zap_increment(objset_t *os, uint64_t obj, const char *name, int64_t delta,
     dmu_tx_t *tx);
@@ -328,6 +336,8 @@ typedef struct zap_cursor {
 	uint64_t zc_serialized;
 	uint64_t zc_hash;
 	uint32_t zc_cd;
+	boolean_t zc_prefetch;
+	uint64_t zc_prefetch_hash;	/* leaves before it prefetched */
 } zap_cursor_t;
 
 typedef struct {
@@ -386,6 +396,16 @@ uint64_t zap_cursor_serialize(zap_cursor_t *zc);
 void zap_cursor_init_serialized(zap_cursor_t *zc, objset_t *ds,
     uint64_t zapobj, uint64_t serialized);
 
+/*
+ * Like zap_cursor_init_serialized(), for a cursor which will walk most of
+ * a large zapobj, such as a directory being listed.  Attributes are
+ * returned in hash order, which is the order of the leaf blocks holding
+ * them, and as the cursor moves into each leaf it prefetches the next
+ * zap_cursor_prefetch_leaves leaves.
+ */
+void zap_cursor_init_prefetch(zap_cursor_t *zc, objset_t *ds,
+    uint64_t zapobj, uint64_t serialized);
+
 
 #define	ZAP_HISTOGRAM_SIZE 10
 
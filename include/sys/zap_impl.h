@@ -31,12 +31,15 @@
 #include <sys/zap.h>
 #include <sys/zfs_context.h>
 #include <sys/avl.h>
+#include <sys/btree.h>
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
 extern int fzap_default_block_shift;
+extern int zap_micro_max_size;
+extern int zap_cursor_prefetch_leaves;
 
 #define	ZAP_MAGIC 0x2F52AB2ABULL
 
@@ -45,6 +48,8 @@ extern int fzap_default_block_shift;
 #define	MZAP_ENT_LEN		64
 #define	MZAP_NAME_LEN		(MZAP_ENT_LEN - 8 - 4 - 2)
 #define	MZAP_MAX_BLKSZ		SPA_OLD_MAXBLOCKSIZE
+/* largest microzap zap_micro_max_size can allow, for 16-bit chunk ids */
+#define	MZAP_MAX_BLKSZ_LARGE	(1 << 20)
 
 #define	ZAP_NEED_CD		(-1U)
 
@@ -64,11 +69,14 @@ typedef struct mzap_phys {
 	/* actually variable size depending on block size */
 } mzap_phys_t;
 
+/*
+ * In-core index entry of a microzap chunk, kept by value in zap_tree in
+ * (hash, cd) order.
+ */
 typedef struct mzap_ent {
-	avl_node_t mze_node;
-	int mze_chunkid;
 	uint64_t mze_hash;
 	uint32_t mze_cd; /* copy from mze_phys->mze_cd */
+	uint16_t mze_chunkid;
 } mzap_ent_t;
 
 #define	MZE_PHYS(zap, mze) \
@@ -158,12 +166,14 @@ typedef struct zap {
 			 */
 			kmutex_t zap_num_entries_mtx;
 			int zap_block_shift;
+			/* recently used external ptrtbl entries */
+			uint64_t *zap_ptrtbl_cache;
 		} zap_fat;
 		struct {
 			int16_t zap_num_entries;
 			int16_t zap_num_chunks;
 			int16_t zap_alloc_next;
-			avl_tree_t zap_avl;
+			zfs_btree_t zap_tree;
 		} zap_micro;
 	} zap_u;
 } zap_t;
@@ -206,6 +216,7 @@ void zap_name_free(zap_name_t *zn);
 int zap_hashbits(zap_t *zap);
 uint32_t zap_maxcd(zap_t *zap);
 uint64_t zap_getflags(zap_t *zap);
+uint64_t zap_get_micro_max_size(objset_t *os);
 
 #define	ZAP_HASH_IDX(hash, n) (((n) == 0) ? 0 : ((hash) >> (64 - (n))))
 
@@ -231,6 +242,7 @@ int fzap_add_cd(zap_name_t *zn,
     uint64_t integer_size, uint64_t num_integers,
     const void *val, uint32_t cd, void *tag, dmu_tx_t *tx);
 void fzap_upgrade(zap_t *zap, dmu_tx_t *tx, zap_flags_t flags);
+void fzap_evict(zap_t *zap);
 
 #ifdef	__cplusplus
 }
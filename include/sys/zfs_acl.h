@@ -249,6 +249,10 @@ void zfs_acl_data_locator(void **, uint32_t *, uint32_t, boolean_t, void *);
 uint64_t zfs_mode_compute(uint64_t, zfs_acl_t *,
     uint64_t *, uint64_t, uint64_t);
 int zfs_acl_chown_setattr(struct znode *);
+void zfs_acl_access_purge(struct znode *);
+void zfs_acl_init(void);
+void zfs_acl_fini(void);
+extern int zfs_acl_access_cache;
 
 #endif
 
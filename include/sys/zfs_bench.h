@@ -0,0 +1,69 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_SYS_ZFS_BENCH_H
+#define	_SYS_ZFS_BENCH_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Microbenchmarks of the per-block CPU work: every fletcher_4 and RAID-Z
+ * implementation, every compression algorithm and checksum, and every
+ * encryption suite, each run on one CPU over blocks of one size.  Run
+ * from userland through libzpool by zbench(1), or in the kernel by
+ * writing a block size to the zfs_bench_blocksize tunable; the results
+ * of the last run are in the zfs_bench kstat.
+ */
+#define	ZFS_BENCH_NS_DEFAULT	(MSEC2NSEC(10))
+#define	ZFS_BENCH_RESULTS_MAX	192
+
+typedef struct zfs_bench_result {
+	char		zbr_group[16];	/* fletcher_4, raidz, compress, ... */
+	char		zbr_name[24];	/* implementation or algorithm */
+	char		zbr_op[16];	/* native, gen_pq, decompress, ... */
+	uint64_t	zbr_blksz;	/* bytes per call */
+	uint64_t	zbr_rate;	/* bytes per second */
+} zfs_bench_result_t;
+
+extern int64_t zfs_bench_blocksize;
+
+void zfs_bench_init(void);
+void zfs_bench_fini(void);
+int zfs_bench_run(uint64_t blksz, hrtime_t ns);
+int zfs_bench_results(zfs_bench_result_t *results, int max);
+/* Reader locks taken on every I/O or vnode operation, see zfs_bench_lock() */
+typedef enum zfs_bench_lock {
+	ZFS_BENCH_LOCK_SPA_CONFIG,
+	ZFS_BENCH_LOCK_TEARDOWN
+} zfs_bench_lock_t;
+
+uint64_t zfs_bench_lock(zfs_bench_lock_t which, int threads, hrtime_t ns);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZFS_BENCH_H */
@@ -64,6 +64,7 @@ extern "C" {
 #include <vm/seg_kmem.h>
 #include <sys/zone.h>
 #include <sys/sdt.h>
+#include <sys/trace_osx.h>
 #include <sys/zfs_debug.h>
 #include <sys/zfs_delay.h>
 #include <sys/fm/fs/zfs.h>
@@ -85,6 +86,11 @@ extern "C" {
 #define	KMC_KMEM		0x0
 #define	KMC_VMEM		0x0
 
+/* The SPL taskqs keep a single queue; only libzpool's steal work */
+#ifndef TASKQ_WORKSTEAL
+#define	TASKQ_WORKSTEAL		0x0
+#endif
+
 #define noinline
 
 typedef struct dirent dirent_t;
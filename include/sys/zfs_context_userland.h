@@ -376,6 +376,18 @@ typedef struct taskq_ent {
 	uintptr_t		tqent_flags;
 } taskq_ent_t;
 
+/*
+ * With TASKQ_WORKSTEAL each thread has its own queue: it takes the tasks
+ * it dispatches itself at the front of its own queue, others are spread
+ * over all queues, and an idle thread steals from the back of the others.
+ */
+typedef struct taskq_wsq {
+	kmutex_t		tqw_lock;
+	taskq_ent_t		tqw_task;	/* head of this thread's tasks */
+	struct taskq		*tqw_tq;
+	int			tqw_id;
+} taskq_wsq_t;
+
 typedef struct taskq {
 	char            tq_name[TASKQ_NAMELEN + 1];
 	kmutex_t        tq_lock;
@@ -393,6 +405,11 @@ typedef struct taskq {
 	int             tq_maxalloc_wait;
 	taskq_ent_t     *tq_freelist;
 	taskq_ent_t     tq_task;
+	taskq_wsq_t     *tq_wsq;	/* TASKQ_WORKSTEAL queues */
+	int             tq_nwsq;	/* one per thread */
+	uint64_t        tq_wsq_pending;	/* tasks on them */
+	uint_t          tq_wsq_next;	/* queue for the next outside task */
+	int             tq_idle;	/* threads waiting for a task */
 } taskq_t;
 typedef uintptr_t taskqid_t;
 
@@ -404,6 +421,7 @@ typedef uintptr_t taskqid_t;
 #define	TASKQ_DYNAMIC		0x0004	/* Use dynamic thread scheduling */
 #define	TASKQ_THREADS_CPU_PCT	0x0008	/* Scale # threads by # cpus */
 #define	TASKQ_DC_BATCH		0x0010	/* Mark threads as batch */
+#define	TASKQ_WORKSTEAL		0x0020	/* Per-thread queues, see taskq_wsq */
 
 #define	TQ_SLEEP	KM_SLEEP	/* Can block for memory */
 #define	TQ_NOSLEEP	KM_NOSLEEP	/* cannot block for memory; may fail */
@@ -599,7 +617,8 @@ extern void delay(clock_t ticks);
 #define	defclsyspri	60
 #define	maxclsyspri	99
 
-#define	CPU_SEQID	((uint64_t)pthread_self() & (max_ncpus - 1))
+/* Drop the low bits, which are the same for all page aligned threads */
+#define	CPU_SEQID	(((uint64_t)pthread_self() >> 12) & (max_ncpus - 1))
 
 #define	kcred		NULL
 #define	CRED()		NULL
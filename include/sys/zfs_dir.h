@@ -76,6 +76,12 @@ extern void zfs_mknode(znode_t *dzp, vattr_t *vap, dmu_tx_t *tx, cred_t *cr,
 extern void zfs_rmnode(znode_t *);
 extern void zfs_dl_name_switch(zfs_dirlock_t *dl, char *new, char **old);
 extern boolean_t zfs_dirempty(znode_t *);
+extern void zfs_dirent_prefetch(znode_t *, uint64_t, int);
+extern void zfs_negcache_purge(znode_t *);
+extern void zfs_dir_init(void);
+extern void zfs_dir_fini(void);
+extern int zfs_dir_negcache;
+extern int zfs_readdir_dnode_prefetch;
 extern void zfs_unlinked_add(znode_t *, dmu_tx_t *);
     //extern void zfs_unlinked_drain(zfs_sb_t *);
 extern void zfs_unlinked_drain(zfsvfs_t *zfsvfs);
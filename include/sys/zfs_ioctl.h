@@ -105,6 +105,9 @@ typedef enum drr_headertype {
 #define	DMU_BACKUP_FEATURE_RESUMING		(1 << 20)
 /* flag #21 is reserved for a Delphix feature */
 #define	DMU_BACKUP_FEATURE_COMPRESSED		(1 << 22)
+#define	DMU_BACKUP_FEATURE_LARGE_DNODE		(1 << 23)
+/* flags #24 - #28 are reserved for upstream features */
+#define	DMU_BACKUP_FEATURE_INLINE_DATA		(1 << 29)
 
     /* Unsure what Oracle called this bit */
 #define	DMU_BACKUP_FEATURE_SPILLBLOCKS	(0x20)
@@ -131,7 +134,8 @@ NOTE 3:  Fix to 7097870 (spill block can be dropped in some situations during
     DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_LZ4 | \
     DMU_BACKUP_FEATURE_RESUMING | \
     DMU_BACKUP_FEATURE_LARGE_BLOCKS | \
-    DMU_BACKUP_FEATURE_COMPRESSED)
+    DMU_BACKUP_FEATURE_COMPRESSED | DMU_BACKUP_FEATURE_LARGE_DNODE | \
+    DMU_BACKUP_FEATURE_INLINE_DATA)
 
 /* Are all features in the given flag word currently supported? */
 #define	DMU_STREAM_SUPPORTED(x)	(!((x) & ~DMU_BACKUP_FEATURE_MASK))
@@ -223,7 +227,8 @@ typedef struct dmu_replay_record {
 			uint32_t drr_bonuslen;
 			uint8_t drr_checksumtype;
 			uint8_t drr_compress;
-			uint8_t drr_pad[6];
+			uint8_t drr_dn_slots;
+			uint8_t drr_pad[5];
 			uint64_t drr_toguid;
 			/* bonus content follows */
 		} drr_object;
@@ -344,6 +349,13 @@ typedef struct zinject_record {
 	uint64_t	zi_nlanes;
 	uint32_t	zi_cmd;
 	uint32_t	zi_pad;
+	/* optional latency profile for ZINJECT_DELAY_IO, times in ns */
+	uint64_t	zi_jitter;		/* mean extra latency */
+	uint64_t	zi_bandwidth;		/* bytes/sec, per lane */
+	uint64_t	zi_qdelay;		/* latency per busy lane */
+	uint64_t	zi_stall_period;	/* periodic device stall */
+	uint64_t	zi_stall_len;
+	uint64_t	zi_seed;		/* for zi_jitter */
 } zinject_record_t;
 
 #define	ZINJECT_NULL		0x1
@@ -529,6 +541,14 @@ typedef enum zfs_ioc {
 	ZFS_IOC_BOOKMARK,
 	ZFS_IOC_GET_BOOKMARKS,
 	ZFS_IOC_DESTROY_BOOKMARKS,
+	ZFS_IOC_LOAD_KEY,
+	ZFS_IOC_UNLOAD_KEY,
+	ZFS_IOC_POOL_TRIM,
+	ZFS_IOC_LIST_BATCH,
+	ZFS_IOC_ZPIOS,
+	ZFS_IOC_BLOCK_SAMPLE,
+	ZFS_IOC_OBJ_TO_STATS_BATCH,
+	ZFS_IOC_RECOMPRESS,
 
 	/*
 	 * Linux - 3/64 numbers reserved.
@@ -567,6 +587,12 @@ typedef struct zfs_useracct {
 
 #define	ZPOOL_EXPORT_AFTER_SPLIT 0x1
 
+/*
+ * zc_flags for ZFS_IOC_RECV: the stream may be read past its end, because
+ * the caller puts the file offset back by zc_cookie afterwards.
+ */
+#define	ZFS_RECV_READAHEAD	0x1
+
 #ifdef _KERNEL
 
 typedef struct zfs_creat {
@@ -610,6 +636,7 @@ extern minor_t zfsdev_minor_alloc(void);
 
 extern int zfs_ioctl_osx_init(void);
 extern int zfs_ioctl_osx_fini(void);
+extern int zpios_ioctl(const char *, nvlist_t *, nvlist_t *);
 
 extern int zfs_vnop_force_formd_normalized_output;
 
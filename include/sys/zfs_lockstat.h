@@ -0,0 +1,63 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_ZFS_LOCKSTAT_H
+#define	_SYS_ZFS_LOCKSTAT_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Classes of hot, briefly held mutexes.  zfs_mutex_enter() first tries
+ * to take the lock outright; if it is held, it retries up to
+ * zfs_mutex_spin times with exponential backoff before blocking in
+ * mutex_enter().  The contended acquisitions of each class are counted
+ * in the zfs/lockstat kstat.
+ */
+typedef enum zfs_lock_class {
+	ZFS_LOCK_DBUF,		/* db_mtx */
+	ZFS_LOCK_DNODE,		/* dn_mtx */
+	ZFS_LOCK_ARC_HASH,	/* arc buf hash_lock */
+	ZFS_LOCK_CLASSES
+} zfs_lock_class_t;
+
+extern int zfs_mutex_spin;
+
+void zfs_mutex_enter_contended(kmutex_t *mp, zfs_lock_class_t lc);
+
+static inline void
+zfs_mutex_enter(kmutex_t *mp, zfs_lock_class_t lc)
+{
+	if (!mutex_tryenter(mp))
+		zfs_mutex_enter_contended(mp, lc);
+}
+
+void zfs_lockstat_init(void);
+void zfs_lockstat_fini(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZFS_LOCKSTAT_H */
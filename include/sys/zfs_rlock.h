@@ -52,6 +52,7 @@ typedef struct rl {
 	uint8_t r_proxy;	/* acting for original range */
 	uint8_t r_write_wanted;	/* writer wants to lock this range */
 	uint8_t r_read_wanted;	/* reader wants to lock this range */
+	uint8_t r_fast;		/* reader not in tree, see z_range_readers */
 	list_node_t rl_node;	/* used for deferred release */
 } rl_t;
 
@@ -78,6 +79,11 @@ void zfs_range_reduce(rl_t *rl, uint64_t off, uint64_t len);
  */
 int zfs_range_compare(const void *arg1, const void *arg2);
 
+extern int zfs_rlock_fastpath;
+
+void zfs_rlock_init(void);
+void zfs_rlock_fini(void);
+
 #endif /* _KERNEL */
 
 #ifdef	__cplusplus
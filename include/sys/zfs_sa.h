@@ -83,6 +83,7 @@ typedef enum zpl_attr {
 	ZPL_ADDTIME,
 	ZPL_DOCUMENTID,
 #endif
+	ZPL_INLINE_DATA,
 	ZPL_END
 } zpl_attr_t;
 
@@ -133,6 +134,9 @@ typedef struct znode_phys {
 	 * At present, we use this space for the following:
 	 *  - symbolic links
 	 *  - 32-byte anti-virus scanstamp (regular files only)
+	 *
+	 * SA znodes in large dnodes may also keep the data of small regular
+	 * files in their bonus buffer, as the ZPL_INLINE_DATA attribute.
 	 */
 } znode_phys_t;
 
@@ -143,6 +147,7 @@ typedef struct znode_phys {
 
 int zfs_sa_readlink(struct znode *, uio_t *);
 void zfs_sa_symlink(struct znode *, char *link, int len, dmu_tx_t *);
+int zfs_sa_read_data(struct znode *, uint64_t, uint64_t, void *, uint32_t);
 void zfs_sa_get_scanstamp(struct znode *, xvattr_t *);
 void zfs_sa_set_scanstamp(struct znode *, xvattr_t *, dmu_tx_t *);
 int zfs_sa_get_xattr(struct znode *);
@@ -33,6 +33,7 @@
 #include <sys/sa.h>
 #include <sys/rrwlock.h>
 #include <sys/zfs_ioctl.h>
+#include <sys/dataset_kstats.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -45,6 +46,10 @@ struct znode;
 #define APPLE_SA_RECOVER
 /* #define WITH_SEARCHFS */
 /* #define WITH_READDIRATTR */
+#if defined (MAC_OS_X_VERSION_10_10) && \
+	(MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_10)
+#define WITH_GETATTRLISTBULK
+#endif
 #define	HAVE_NAMED_STREAMS 1
 #define	HAVE_PAGEOUT_V2 1
 #define HIDE_TRIVIAL_ACL 1
@@ -81,6 +86,10 @@ struct zfsvfs {
         krwlock_t	    z_teardown_inactive_lock;
         list_t          z_all_znodes;   /* all vnodes in the fs */
         kmutex_t        z_znodes_lock;  /* lock for z_all_znodes */
+        list_t          z_reclaim_znodes; /* reclaimed, awaiting inactive */
+        kmutex_t        z_reclaim_lock; /* lock for z_reclaim_znodes */
+        kcondvar_t      z_reclaim_cv;   /* signalled when queue drains */
+        boolean_t       z_reclaim_active; /* a drain task is queued */
         struct vnode   *z_ctldir;      /* .zfs directory pointer */
         boolean_t       z_show_ctldir;  /* expose .zfs in the root dir */
         boolean_t       z_issnap;       /* true if this is a snapshot */
@@ -113,14 +122,15 @@ struct zfsvfs {
 #endif /* APPLE_SA_RECOVER */
 
 	    uint64_t        z_findernotify_space;
+	    uint64_t        z_findernotify_txg; /* txg of last space check */
 
 #endif
     	uint64_t	    z_userquota_obj;
         uint64_t	    z_groupquota_obj;
-        uint64_t	    z_replay_eof;	/* New end of file - replay only */
         sa_attr_type_t  *z_attr_table;  /* SA attr mapping->id */
 #define ZFS_OBJ_MTX_SZ  256
         kmutex_t        z_hold_mtx[ZFS_OBJ_MTX_SZ];     /* znode hold locks */
+        dataset_kstats_t z_kstat;       /* per-dataset I/O kstats */
 };
 
 
@@ -51,6 +51,45 @@ extern "C" {
 #define SPOTLIGHT_IOC_GET_LAST_MTIME              _IOR('h', 19, u_int32_t)
 #define SPOTLIGHT_FSCTL_GET_LAST_MTIME            IOCBASECMD(SPOTLIGHT_IOC_GET_LAST_MTIME)
 
+/*
+ * lseek(SEEK_HOLE/SEEK_DATA) and fcntl(F_PUNCHHOLE) arrive as ioctls;
+ * older SDKs do not define them.
+ */
+#ifndef FSIOC_FIOSEEKHOLE
+#define FSIOC_FIOSEEKHOLE	_IOWR('A', 16, off_t)
+#define FSCTL_FIOSEEKHOLE	IOCBASECMD(FSIOC_FIOSEEKHOLE)
+#define FSIOC_FIOSEEKDATA	_IOWR('A', 17, off_t)
+#define FSCTL_FIOSEEKDATA	IOCBASECMD(FSIOC_FIOSEEKDATA)
+#endif
+
+#ifndef F_PUNCHHOLE
+#define F_PUNCHHOLE	99
+typedef struct fpunchhole {
+	unsigned int	fp_flags;	/* unused */
+	unsigned int	reserved;	/* (to maintain 8-byte alignment) */
+	off_t		fp_offset;	/* IN: start of the region */
+	off_t		fp_length;	/* IN: size of the region */
+} fpunchhole_t;
+#endif
+
+/*
+ * Copy a range of another file on the same dataset into the file the
+ * ioctl is issued on, without the data passing through userland.  Holes
+ * in the source are preserved while the destination range is past its
+ * end-of-file.  zcr_copied returns the number of bytes copied.
+ */
+typedef struct zfs_copy_range {
+	int32_t		zcr_src_fd;
+	uint32_t	zcr_pad;
+	uint64_t	zcr_src_off;
+	uint64_t	zcr_dst_off;
+	uint64_t	zcr_len;
+	uint64_t	zcr_copied;
+} zfs_copy_range_t;
+
+#define ZFSIOC_COPY_RANGE	_IOWR('z', 1, zfs_copy_range_t)
+#define ZFS_COPY_RANGE		IOCBASECMD(ZFSIOC_COPY_RANGE)
+
 /*
  * Account for user timespec structure differences
  */
@@ -139,6 +178,35 @@ typedef struct attrinfo {
         ATTR_FILE_DATAALLOCSIZE | ATTR_FILE_RSRCLENGTH | \
         ATTR_FILE_RSRCALLOCSIZE)
 
+/*
+ * Common attributes that getattrlistbulk(2) can pack without a vnode
+ */
+#define ZFS_ATTR_BULK_CMN_VALID (                               \
+        ZFS_ATTR_CMN_VALID | ATTR_CMN_RETURNED_ATTRS |          \
+        ATTR_CMN_ERROR)
+
+/* One getattrlistbulk(2) entry, as read from its SA bonus buffer */
+typedef struct zfs_bulkattr {
+	uint64_t	zba_mode;
+	uint64_t	zba_size;
+	uint64_t	zba_links;
+	uint64_t	zba_parent;
+	uint64_t	zba_uid;
+	uint64_t	zba_gid;
+	uint64_t	zba_pflags;
+	uint64_t	zba_rdev;
+	uint64_t	zba_xattr;
+	uint64_t	zba_crtime[2];
+	uint64_t	zba_mtime[2];
+	uint64_t	zba_ctime[2];
+	uint64_t	zba_atime[2];
+	uint32_t	zba_blksz;
+	u_longlong_t	zba_nblks;
+	uint32_t	zba_useraccess;
+	uint32_t	zba_mntstatus;
+	uint64_t	zba_rsrcsize;
+	finderinfo_t	zba_finderinfo;
+} zfs_bulkattr_t;
 
 
 
@@ -184,6 +252,7 @@ extern int    zfs_link   ( vnode_t *tdvp, vnode_t *svp, char *name,
 extern int    zfs_access ( vnode_t *vp, int mode, int flag, cred_t *cr,
                            caller_context_t *ct);
 extern void   zfs_inactive(vnode_t *vp, cred_t *cr, caller_context_t *ct);
+extern int    zfs_holey  ( vnode_t *vp, boolean_t hole, off_t *off );
 extern int    zfs_space  ( vnode_t *vp, int cmd, struct flock *bfp, int flag,
                            offset_t offset, cred_t *cr, caller_context_t *ct);
 extern int    zfs_setsecattr(vnode_t *vp, vsecattr_t *vsecp, int flag,
@@ -220,6 +289,12 @@ extern void  nameattrpack(attrinfo_t *aip, const char *name, int namelen);
 extern int   getpackedsize(struct attrlist *alp, boolean_t user64);
 extern void  getfinderinfo(znode_t *zp, cred_t *cr, finderinfo_t *fip);
 extern uint32_t getuseraccess(znode_t *zp, vfs_context_t ctx);
+extern int   zfs_bulkattr_get(zfsvfs_t *zfsvfs, sa_handle_t *hdl,
+                              znode_t *zp, struct attrlist *alp,
+                              vfs_context_t ctx, zfs_bulkattr_t *zba);
+extern void  bulkattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs,
+                          const zfs_bulkattr_t *zba, const char *name,
+                          uint64_t objnum, boolean_t user64);
 extern void  finderinfo_update(uint8_t *finderinfo, znode_t *zp);
 extern int   zpl_xattr_set_sa(struct vnode *vp, const char *name,
 							  const void *value, size_t size, int flags,
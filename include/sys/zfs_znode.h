@@ -97,6 +97,7 @@ extern "C" {
 #define	ZFS_ACL_AUTO_INHERIT	0x40		/* ACL should be inherited */
 #define	ZFS_BONUS_SCANSTAMP	0x80		/* Scanstamp in bonus area */
 #define	ZFS_NO_EXECS_DENIED	0x100		/* exec was given to everyone */
+#define	ZFS_INLINE_DATA		0x200		/* file data in SA bonus area */
 
 #define	SA_ZPL_ATIME(z)		z->z_attr_table[ZPL_ATIME]
 #define	SA_ZPL_MTIME(z)		z->z_attr_table[ZPL_MTIME]
@@ -119,6 +120,7 @@ extern "C" {
 #define	SA_ZPL_ZNODE_ACL(z)	z->z_attr_table[ZPL_ZNODE_ACL]
 #define	SA_ZPL_DXATTR(z)	z->z_attr_table[ZPL_DXATTR]
 #define	SA_ZPL_PAD(z)		z->z_attr_table[ZPL_PAD]
+#define	SA_ZPL_INLINE_DATA(z)	z->z_attr_table[ZPL_INLINE_DATA]
 
 #ifdef __APPLE__
 #define	SA_ZPL_ADDTIME(z)		z->z_attr_table[ZPL_ADDTIME]
@@ -200,24 +202,34 @@ typedef struct znode {
 	zfs_dirlock_t	*z_dirlocks;	/* directory entry lock list */
 	kmutex_t	z_range_lock;	/* protects changes to z_range_avl */
 	avl_tree_t	z_range_avl;	/* avl tree of file range locks */
+	kcondvar_t	z_range_cv;	/* writers wait for z_range_readers */
+	uint32_t	z_range_readers; /* readers not in z_range_avl */
+	uint32_t	z_range_writers; /* writers holding or wanting locks */
 	uint8_t		z_unlinked;	/* file has been unlinked */
 	uint8_t		z_atime_dirty;	/* atime needs to be synced */
 	uint8_t		z_zn_prefetch;	/* Prefetch znodes? */
 	uint8_t		z_moved;	/* Has this znode been moved? */
 	uint_t		z_blksz;	/* block size in bytes */
 	uint_t		z_seq;		/* modification sequence number */
+	struct zfs_negcache *z_negcache; /* names known absent (dirs) */
 	uint64_t	z_mapcnt;	/* number of pages mapped to file */
 	uint64_t	z_gen;		/* generation (cached) */
 	uint64_t	z_size;		/* file size (cached) */
+	uint64_t	z_replay_eof;	/* new end of file - replay only */
 	uint64_t	z_atime[2];	/* atime (cached) */
 	uint64_t	z_links;	/* file links (cached) */
 	uint64_t	z_pflags;	/* pflags (cached) */
 	uint64_t	z_uid;		/* uid fuid (cached) */
 	uint64_t	z_gid;		/* gid fuid (cached) */
 	uint32_t	z_sync_cnt;	/* synchronous open count */
+	kcondvar_t	z_commit_cv;	/* wait for the shared zil_commit() */
+	uint64_t	z_commit_seq;	/* sync writes to commit (tickets) */
+	uint64_t	z_commit_done;	/* tickets known to be stable */
+	boolean_t	z_commit_active; /* a writer commits for the others */
 	mode_t		z_mode;		/* mode (cached) */
 	kmutex_t	z_acl_lock;	/* acl data lock */
 	zfs_acl_t	*z_acl_cached;	/* cached acl */
+	struct zfs_access_cache *z_access_cache; /* per-cred ACL verdicts */
     // XATTR
 	krwlock_t	z_xattr_lock;	/* xattr data lock */
 	nvlist_t	*z_xattr_cached; /* cached xattrs */
@@ -389,6 +401,8 @@ extern void zfs_create_fs(objset_t *os, cred_t *cr, nvlist_t *zplprops, dmu_tx_t
 extern void	zfs_tstamp_update_setup(znode_t *, uint_t, uint64_t [2],
     uint64_t [2], boolean_t);
 extern void	zfs_grow_blocksize(znode_t *, uint64_t, dmu_tx_t *);
+extern boolean_t zfs_inline_data_ok(znode_t *, uint64_t);
+extern int	zfs_inline_promote(znode_t *);
 extern int	zfs_freesp(znode_t *, uint64_t, uint64_t, int, boolean_t);
 extern void	zfs_znode_init(void);
 extern void	zfs_znode_fini(void);
@@ -402,6 +416,8 @@ extern int zfs_zget_ext(zfsvfs_t *zfsvfs, uint64_t obj_num, znode_t **zpp, int f
 
 extern int	zfs_rezget(znode_t *);
 extern void	zfs_zinactive(znode_t *);
+extern void	zfs_znode_reclaim(znode_t *);
+extern void	zfs_znode_reclaim_wait(zfsvfs_t *);
 extern void	zfs_znode_delete(znode_t *, dmu_tx_t *);
 extern void	zfs_remove_op_tables(void);
 extern int	zfs_create_op_tables(void);
@@ -460,6 +476,7 @@ extern void zfs_znode_free(znode_t *zp);
 void zfs_perm_init(znode_t *zp, znode_t *parent, int flag,
                    vattr_t *vap, dmu_tx_t *tx, cred_t *cr);
 void zfs_time_stamper(znode_t *zp, uint_t flag, dmu_tx_t *tx);
+uint32_t zfs_pflags_to_bsdflags(uint64_t zflags);
 uint32_t zfs_getbsdflags(znode_t *zp);
 void zfs_setbsdflags(znode_t *zp, uint32_t bsdflags);
 void zfs_time_stamper_locked(znode_t *zp, uint_t flag, dmu_tx_t *tx);
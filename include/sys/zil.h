@@ -130,6 +130,7 @@ typedef enum zil_create {
 /*
  * Intent log transaction types and record structures
  */
+#define	TX_COMMIT		0	/* Commit marker (no on-disk state) */
 #define	TX_CREATE		1	/* Create file */
 #define	TX_MKDIR		2	/* Make directory */
 #define	TX_MKXATTR		3	/* Make XATTR directory */
@@ -172,6 +173,17 @@ typedef enum zil_create {
 	(txtype) == TX_ACL ||		\
 	(txtype) == TX_WRITE2)
 
+/*
+ * Record types that zil_replay() may replay concurrently with the records
+ * of other objects.  These only touch the object named by lr_foid, and
+ * their replay vectors keep no per-dataset replay state; TX_SETATTR and
+ * the ACL records pass FUIDs through the zfsvfs, so they don't qualify.
+ */
+#define	TX_REPLAY_PARALLEL(txtype)	\
+	((txtype) == TX_WRITE ||	\
+	(txtype) == TX_TRUNCATE ||	\
+	(txtype) == TX_WRITE2)
+
 /*
  * Format of log records.
  * The fields are carefully defined to allow them to be aligned
@@ -228,6 +240,16 @@ typedef struct {
 	/* for creates with xvattr data, the name follows the xvattr info */
 } lr_create_t;
 
+/*
+ * The lr_foid of a create record holds the object id in its low
+ * DN_MAX_OBJECT_SHIFT bits and the dnode size in slots, less one, in its
+ * top 8 bits.  Records from before large dnodes leave the top bits zero.
+ */
+#define	LR_FOID_GET_SLOTS(oid)	(BF64_GET((oid), 56, 8) + 1)
+#define	LR_FOID_SET_SLOTS(oid, x)	BF64_SET((oid), 56, 8, (x) - 1)
+#define	LR_FOID_GET_OBJ(oid)	BF64_GET((oid), 0, DN_MAX_OBJECT_SHIFT)
+#define	LR_FOID_SET_OBJ(oid, x)	BF64_SET((oid), 0, DN_MAX_OBJECT_SHIFT, (x))
+
 /*
  * FUID ACL record will be an array of ACEs from the original ACL.
  * If this array includes ephemeral IDs, the record will also include
@@ -394,6 +416,12 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_commit_writer_count;
 
+	/*
+	 * Number of synchronous file writes that shared the zil_commit()
+	 * of another writer instead of calling it (see zfs_write_commit()).
+	 */
+	kstat_named_t zil_commit_saved_count;
+
 	/*
 	 * Number of transactions (reads, writes, renames, etc.)
 	 * that have been commited.
@@ -445,8 +473,9 @@ typedef int (*zil_replay_func_t)(void *, char *, boolean_t);
 
 struct znode;
 struct rl;
-typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf, zio_t *zio,
-						   struct znode *zp, struct rl *rl);
+struct lwb;
+typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf,
+    struct lwb *lwb, zio_t *zio, struct znode *zp, struct rl *rl);
 
 extern int zil_parse(zilog_t *zilog, zil_parse_blk_func_t *parse_blk_func,
     zil_parse_lr_func_t *parse_lr_func, void *arg, uint64_t txg);
@@ -471,6 +500,7 @@ extern void	zil_itx_destroy(itx_t *itx);
 extern void	zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx);
 
 extern void	zil_commit(zilog_t *zilog, uint64_t oid);
+extern void	zil_commit_impl(zilog_t *zilog, uint64_t oid);
 
 extern int	zil_vdev_offline(const char *osname, void *txarg);
 extern int	zil_claim(struct dsl_pool *dp,
@@ -483,7 +513,7 @@ extern void	zil_clean(zilog_t *zilog, uint64_t synced_txg);
 extern int	zil_suspend(const char *osname, void **cookiep);
 extern void	zil_resume(void *cookie);
 
-extern void	zil_add_block(zilog_t *zilog, const blkptr_t *bp);
+extern void	zil_lwb_add_block(struct lwb *lwb, const blkptr_t *bp);
 extern int	zil_bp_tree_add(zilog_t *zilog, const blkptr_t *bp);
 
 extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
@@ -491,6 +521,9 @@ extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
 extern void	zil_set_logbias(zilog_t *zilog, uint64_t slogval);
 
 extern int zil_replay_disable;
+extern int zfs_commit_timeout_pct;
+extern int zil_maxblocksize;
+extern int zil_replay_taskqs;
 
 #ifdef	__cplusplus
 }
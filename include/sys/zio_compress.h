@@ -30,6 +30,9 @@
 #ifndef _SYS_ZIO_COMPRESS_H
 #define	_SYS_ZIO_COMPRESS_H
 
+#include <sys/abd.h>
+#include <zfeature_common.h>
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -51,6 +54,25 @@ enum zio_compress {
 	ZIO_COMPRESS_GZIP_9,
 	ZIO_COMPRESS_ZLE,
 	ZIO_COMPRESS_LZ4,
+	ZIO_COMPRESS_ZSTD_1,
+	ZIO_COMPRESS_ZSTD_2,
+	ZIO_COMPRESS_ZSTD_3,
+	ZIO_COMPRESS_ZSTD_4,
+	ZIO_COMPRESS_ZSTD_5,
+	ZIO_COMPRESS_ZSTD_6,
+	ZIO_COMPRESS_ZSTD_7,
+	ZIO_COMPRESS_ZSTD_8,
+	ZIO_COMPRESS_ZSTD_9,
+	ZIO_COMPRESS_ZSTD_10,
+	ZIO_COMPRESS_ZSTD_11,
+	ZIO_COMPRESS_ZSTD_12,
+	ZIO_COMPRESS_ZSTD_13,
+	ZIO_COMPRESS_ZSTD_14,
+	ZIO_COMPRESS_ZSTD_15,
+	ZIO_COMPRESS_ZSTD_16,
+	ZIO_COMPRESS_ZSTD_17,
+	ZIO_COMPRESS_ZSTD_18,
+	ZIO_COMPRESS_ZSTD_19,
 	ZIO_COMPRESS_FUNCTIONS
 };
 
@@ -73,12 +95,35 @@ typedef const struct zio_compress_info {
 
 extern zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS];
 
+/*
+ * Highest zstd level offered as a dataset property.  Levels above this
+ * need larger windows than a single block can make use of.
+ */
+#define	ZIO_ZSTD_LEVEL_MAX	19
+
+#define	ZIO_COMPRESS_IS_ZSTD(compress)			\
+	((compress) >= ZIO_COMPRESS_ZSTD_1 &&		\
+	(compress) <= ZIO_COMPRESS_ZSTD_19)
+
+/*
+ * Tunables for the compression early abort heuristic.
+ */
+extern int zfs_compress_early_abort;
+extern int zfs_compress_abort_streak;
+extern int zfs_compress_abort_retry;
+
 /*
  * lz4 compression init & free
  */
 extern void lz4_init(void);
 extern void lz4_fini(void);
 
+/*
+ * zstd decompression context cache init & free
+ */
+extern void zstd_init(void);
+extern void zstd_fini(void);
+
 /*
  * Compression routines.
  */
@@ -98,13 +143,26 @@ extern size_t lz4_compress_zfs(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
 extern int lz4_decompress_zfs(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
+extern size_t zstd_compress_zfs(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
+extern int zstd_decompress_zfs(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
+
+/*
+ * Feature which must be enabled to write with a compression function.
+ */
+extern spa_feature_t zio_compress_to_feature(enum zio_compress c);
 
 /*
  * Compress and decompress data if necessary.
  */
-extern size_t zio_compress_data(enum zio_compress c, void *src, void *dst,
+extern size_t zio_compress_data(enum zio_compress c, abd_t *src, void *dst,
     size_t s_len);
-extern int zio_decompress_data(enum zio_compress c, void *src, void *dst,
+extern size_t zio_compress_data_adaptive(struct spa *spa, uint32_t *streak,
+    enum zio_compress c, abd_t *src, void *dst, size_t s_len);
+extern int zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
+    size_t s_len, size_t d_len);
+extern int zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len);
 
 #ifdef	__cplusplus
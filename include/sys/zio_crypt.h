@@ -0,0 +1,100 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_ZIO_CRYPT_H
+#define	_SYS_ZIO_CRYPT_H
+
+#include <sys/zio.h>
+#include <sys/crypto/api.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * The wrapping key is supplied by the user (see the keyformat property)
+ * and is only ever used to encrypt the master key of an encryption root.
+ */
+#define	WRAPPING_KEY_LEN	32
+#define	WRAPPING_IV_LEN		ZIO_DATA_IV_LEN
+#define	WRAPPING_MAC_LEN	ZIO_DATA_MAC_LEN
+
+#define	MASTER_KEY_MAX_LEN	32
+
+/*
+ * Number of blocks encrypted with one salt before a new salt (and so a
+ * new data key) is chosen.  This keeps the number of random IVs used
+ * with any one key well inside the birthday bound of AES-GCM.
+ */
+#define	ZFS_KEY_MAX_SALT_USES_DEFAULT	400000000
+
+typedef struct zio_crypt_info {
+	crypto_mech_name_t	ci_mechname;	/* ICP mechanism name */
+	size_t			ci_keylen;	/* length of the key in bytes */
+	char			*ci_name;	/* property value */
+} zio_crypt_info_t;
+
+extern zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS];
+
+/*
+ * In-core copy of a dataset's master key.  Data is never encrypted with
+ * the master key directly: each salt selects a key derived from it with
+ * HKDF, and the salt is stored in every blkptr_t it was used for.
+ */
+typedef struct zio_crypt_key {
+	uint64_t	zk_crypt;		/* enum zio_encrypt */
+	uint64_t	zk_guid;		/* identifies the master key */
+	uint8_t		zk_master_keydata[MASTER_KEY_MAX_LEN];
+	uint8_t		zk_current_keydata[MASTER_KEY_MAX_LEN];
+	crypto_key_t	zk_current_key;		/* derived from zk_salt */
+	uint32_t	zk_salt;
+	uint64_t	zk_salt_count;		/* blocks written with zk_salt */
+	krwlock_t	zk_salt_lock;
+} zio_crypt_key_t;
+
+extern unsigned long zfs_key_max_salt_uses;
+
+void zio_crypt_key_destroy(zio_crypt_key_t *key);
+int zio_crypt_key_init(uint64_t crypt, zio_crypt_key_t *key);
+int zio_crypt_key_get_salt(zio_crypt_key_t *key, uint32_t *salt);
+
+int zio_crypt_key_wrap(crypto_key_t *cwkey, zio_crypt_key_t *key,
+    uint8_t *iv, uint8_t *mac, uint8_t *keydata_out);
+int zio_crypt_key_unwrap(crypto_key_t *cwkey, uint64_t crypt, uint64_t guid,
+    uint8_t *keydata, uint8_t *iv, uint8_t *mac, zio_crypt_key_t *key);
+
+int zio_crypt_generate_iv(uint8_t *ivbuf);
+
+void zio_crypt_encode_params_bp(blkptr_t *bp, uint32_t salt, uint8_t *iv);
+void zio_crypt_decode_params_bp(const blkptr_t *bp, uint32_t *salt,
+    uint8_t *iv);
+void zio_crypt_encode_mac_bp(blkptr_t *bp, uint8_t *mac);
+void zio_crypt_decode_mac_bp(const blkptr_t *bp, uint8_t *mac);
+
+int zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
+    uint32_t salt, uint8_t *iv, uint8_t *mac, uint_t datalen,
+    uint8_t *plainbuf, uint8_t *cipherbuf);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZIO_CRYPT_H */
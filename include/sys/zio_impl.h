@@ -86,7 +86,15 @@ extern "C" {
  * read pipeline if the dedup bit is set on the block pointer.
  * Writing a dedup block is performed by the ZIO_STAGE_DDT_WRITE stage
  * and added to a write pipeline if a user has enabled dedup on that
- * particular dataset.
+ * particular dataset.  Dedup writes and frees first pass through the
+ * ZIO_STAGE_DDT_PREFETCH stage, which starts reading the block's DDT
+ * entry and requeues the zio so that the lookup rarely has to wait.
+ *
+ * Encryption:
+ * Blocks belonging to an encrypted dataset are encrypted with AES-GCM in
+ * the ZIO_STAGE_ENCRYPT stage, after compression and before the checksum
+ * is generated, so the checksum always covers what is actually on disk.
+ * Reads are decrypted by a transform pushed in ZIO_STAGE_READ_BP_INIT.
  *
  * NOP Write:
  * The NOP write feature is performed by the ZIO_STAGE_NOP_WRITE stage
@@ -112,33 +120,35 @@ enum zio_stage {
 	ZIO_STAGE_FREE_BP_INIT		= 1 << 3,	/* --F-- */
 	ZIO_STAGE_ISSUE_ASYNC		= 1 << 4,	/* RWF-- */
 	ZIO_STAGE_WRITE_COMPRESS	= 1 << 5,	/* -W--- */
+	ZIO_STAGE_ENCRYPT		= 1 << 6,	/* -W--- */
 
-	ZIO_STAGE_CHECKSUM_GENERATE	= 1 << 6,	/* -W--- */
+	ZIO_STAGE_CHECKSUM_GENERATE	= 1 << 7,	/* -W--- */
 
-	ZIO_STAGE_NOP_WRITE		= 1 << 7,	/* -W--- */
+	ZIO_STAGE_NOP_WRITE		= 1 << 8,	/* -W--- */
 
-	ZIO_STAGE_DDT_READ_START	= 1 << 8,	/* R---- */
-	ZIO_STAGE_DDT_READ_DONE		= 1 << 9,	/* R---- */
-	ZIO_STAGE_DDT_WRITE		= 1 << 10,	/* -W--- */
-	ZIO_STAGE_DDT_FREE		= 1 << 11,	/* --F-- */
+	ZIO_STAGE_DDT_PREFETCH		= 1 << 9,	/* -WF-- */
+	ZIO_STAGE_DDT_READ_START	= 1 << 10,	/* R---- */
+	ZIO_STAGE_DDT_READ_DONE		= 1 << 11,	/* R---- */
+	ZIO_STAGE_DDT_WRITE		= 1 << 12,	/* -W--- */
+	ZIO_STAGE_DDT_FREE		= 1 << 13,	/* --F-- */
 
-	ZIO_STAGE_GANG_ASSEMBLE		= 1 << 12,	/* RWFC- */
-	ZIO_STAGE_GANG_ISSUE		= 1 << 13,	/* RWFC- */
+	ZIO_STAGE_GANG_ASSEMBLE		= 1 << 14,	/* RWFC- */
+	ZIO_STAGE_GANG_ISSUE		= 1 << 15,	/* RWFC- */
 
-	ZIO_STAGE_DVA_THROTTLE		= 1 << 14,	/* -W--- */
-	ZIO_STAGE_DVA_ALLOCATE		= 1 << 15,	/* -W--- */
-	ZIO_STAGE_DVA_FREE		= 1 << 16,	/* --F-- */
-	ZIO_STAGE_DVA_CLAIM		= 1 << 17,	/* ---C- */
+	ZIO_STAGE_DVA_THROTTLE		= 1 << 16,	/* -W--- */
+	ZIO_STAGE_DVA_ALLOCATE		= 1 << 17,	/* -W--- */
+	ZIO_STAGE_DVA_FREE		= 1 << 18,	/* --F-- */
+	ZIO_STAGE_DVA_CLAIM		= 1 << 19,	/* ---C- */
 
-	ZIO_STAGE_READY			= 1 << 18,	/* RWFCI */
+	ZIO_STAGE_READY			= 1 << 20,	/* RWFCI */
 
-	ZIO_STAGE_VDEV_IO_START		= 1 << 19,	/* RW--I */
-	ZIO_STAGE_VDEV_IO_DONE		= 1 << 20,	/* RW--I */
-	ZIO_STAGE_VDEV_IO_ASSESS	= 1 << 21,	/* RW--I */
+	ZIO_STAGE_VDEV_IO_START		= 1 << 21,	/* RW--I */
+	ZIO_STAGE_VDEV_IO_DONE		= 1 << 22,	/* RW--I */
+	ZIO_STAGE_VDEV_IO_ASSESS	= 1 << 23,	/* RW--I */
 
-	ZIO_STAGE_CHECKSUM_VERIFY	= 1 << 22,	/* R---- */
+	ZIO_STAGE_CHECKSUM_VERIFY	= 1 << 24,	/* R---- */
 
-	ZIO_STAGE_DONE			= 1 << 23	/* RWFCI */
+	ZIO_STAGE_DONE			= 1 << 25	/* RWFCI */
 };
 
 #define	ZIO_INTERLOCK_STAGES			\
@@ -190,12 +200,14 @@ enum zio_stage {
 #define	ZIO_REWRITE_PIPELINE			\
 	(ZIO_WRITE_COMMON_STAGES |		\
 	ZIO_STAGE_WRITE_COMPRESS |		\
+	ZIO_STAGE_ENCRYPT |			\
 	ZIO_STAGE_WRITE_BP_INIT)
 
 #define	ZIO_WRITE_PIPELINE			\
 	(ZIO_WRITE_COMMON_STAGES |		\
 	ZIO_STAGE_WRITE_BP_INIT |		\
 	ZIO_STAGE_WRITE_COMPRESS |		\
+	ZIO_STAGE_ENCRYPT |			\
 	ZIO_STAGE_DVA_THROTTLE |		\
 	ZIO_STAGE_DVA_ALLOCATE)
 
@@ -211,6 +223,7 @@ enum zio_stage {
 	ZIO_STAGE_ISSUE_ASYNC |			\
 	ZIO_STAGE_WRITE_COMPRESS |		\
 	ZIO_STAGE_CHECKSUM_GENERATE |		\
+	ZIO_STAGE_DDT_PREFETCH |		\
 	ZIO_STAGE_DDT_WRITE)
 
 #define	ZIO_GANG_STAGES				\
@@ -226,6 +239,7 @@ enum zio_stage {
 	(ZIO_INTERLOCK_STAGES |			\
 	ZIO_STAGE_FREE_BP_INIT |		\
 	ZIO_STAGE_ISSUE_ASYNC |			\
+	ZIO_STAGE_DDT_PREFETCH |		\
 	ZIO_STAGE_DDT_FREE)
 
 #define	ZIO_CLAIM_PIPELINE			\
@@ -27,7 +27,8 @@ typedef enum zio_priority {
 	ZIO_PRIORITY_SYNC_WRITE,        /* ZIL */
 	ZIO_PRIORITY_ASYNC_READ,        /* prefetch */
 	ZIO_PRIORITY_ASYNC_WRITE,       /* spa_sync() */
-	ZIO_PRIORITY_SCRUB,             /* asynchronous scrub/resilver reads */
+	ZIO_PRIORITY_SCRUB,             /* asynchronous scrub reads */
+	ZIO_PRIORITY_RESILVER,		/* asynchronous resilver reads */
 	ZIO_PRIORITY_NUM_QUEUEABLE,
 	ZIO_PRIORITY_NOW,		/* non-queued i/os (e.g. free) */
 } zio_priority_t;
@@ -51,6 +51,7 @@ extern void zrl_add_debug(zrlock_t *, const char *);
 extern void zrl_add(zrlock_t *);
 #endif
 extern void zrl_remove(zrlock_t *);
+extern int zrl_tryadd(zrlock_t *);
 extern int zrl_tryenter(zrlock_t *);
 extern void zrl_exit(zrlock_t *);
 extern int zrl_is_zero(zrlock_t *);
@@ -29,6 +29,7 @@
 
 #include <sys/zfs_context.h>
 #include <sys/zfs_znode.h>
+#include <sys/dataset_kstats.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -74,6 +75,13 @@ typedef struct zvol_state {
 	dmu_buf_t *zv_dbuf;	/* bonus handle */
 	zvol_iokit_t *zv_iokitdev;	/* IOKit device */
 	uint64_t zv_openflags;	/* Remember flags used at open */
+	kmutex_t zv_batch_lock;	/* protects the zv_batch fields */
+	kcondvar_t zv_batch_cv;	/* signalled as batches complete */
+	list_t zv_batch_list;	/* sync writes waiting for a batch */
+	boolean_t zv_batch_active;	/* a batch is being written */
+	struct zvol_stats *zv_stats;	/* sync write batching stats */
+	kstat_t *zv_kstat;	/* kstat of zv_stats */
+	dataset_kstats_t zv_io_kstats;	/* per-dataset I/O kstats */
 	char zv_bsdname[MAXPATHLEN];
 	/* 'rdiskX' name, use [1] for diskX */
 } zvol_state_t;
@@ -150,6 +158,7 @@ extern int zvol_read_iokit(zvol_state_t *zv, uint64_t offset,
 
 extern int zvol_write_iokit(zvol_state_t *zv, uint64_t offset,
     uint64_t count, struct iomem *iomem);
+extern taskq_t *zvol_taskq;
 extern int zvol_unmap(zvol_state_t *zv, uint64_t off, uint64_t bytes);
 
 extern void zvol_add_symlink(zvol_state_t *zv, const char *bsd_disk,
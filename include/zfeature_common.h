@@ -54,6 +54,12 @@ typedef enum spa_feature {
 	SPA_FEATURE_SHA512,
 	SPA_FEATURE_SKEIN,
 	SPA_FEATURE_EDONR,
+	SPA_FEATURE_ZSTD_COMPRESS,
+	SPA_FEATURE_ENCRYPTION,
+	SPA_FEATURE_LOG_SPACEMAP,
+	SPA_FEATURE_LARGE_DNODE,
+	SPA_FEATURE_ALLOCATION_CLASSES,
+	SPA_FEATURE_INLINE_DATA,
 	SPA_FEATURES
 } spa_feature_t;
 
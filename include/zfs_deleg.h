@@ -67,6 +67,7 @@ typedef enum {
 	ZFS_DELEG_NOTE_RELEASE,
 	ZFS_DELEG_NOTE_DIFF,
 	ZFS_DELEG_NOTE_BOOKMARK,
+	ZFS_DELEG_NOTE_LOAD_KEY,
 	ZFS_DELEG_NOTE_NONE
 } zfs_deleg_note_t;
 
@@ -31,6 +31,7 @@
 
 #include <sys/types.h>
 #include <sys/spa.h>
+#include <sys/simd.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -41,19 +42,62 @@ extern "C" {
  */
 void fletcher_2_native(const void *, uint64_t, const void *, zio_cksum_t *);
 void fletcher_2_byteswap(const void *, uint64_t, const void *, zio_cksum_t *);
-void fletcher_4_native(const void *, uint64_t, const void *, zio_cksum_t *);
-void fletcher_4_byteswap(const void *, uint64_t, const void *, zio_cksum_t *);
-void fletcher_4_incremental_native(const void *, uint64_t, zio_cksum_t *);
-void fletcher_4_incremental_byteswap(const void *, uint64_t, zio_cksum_t *);
-
-void fletcher_2_native(const void *, uint64_t, const void *, zio_cksum_t *);
-void fletcher_2_byteswap(const void *, uint64_t, const void *, zio_cksum_t *);
+void fletcher_2_incremental_native(const void *, uint64_t,
+    zio_cksum_t *);
+void fletcher_2_incremental_byteswap(const void *, uint64_t,
+    zio_cksum_t *);
 void fletcher_4_native(const void *, uint64_t, const void *, zio_cksum_t *);
 void fletcher_4_byteswap(const void *, uint64_t, const void *, zio_cksum_t *);
 void fletcher_4_incremental_native(const void *, uint64_t,
     zio_cksum_t *);
 void fletcher_4_incremental_byteswap(const void *, uint64_t,
     zio_cksum_t *);
+int fletcher_4_impl_set(const char *);
+int fletcher_4_impl_get(char *, size_t);
+uint64_t fletcher_4_impl_bench(uint32_t, boolean_t, const void *, uint64_t,
+    hrtime_t, const char **);
+void fletcher_4_init(void);
+void fletcher_4_fini(void);
+
+/*
+ * fletcher_4 SIMD implementations
+ *
+ * A vector implementation runs FLETCHER_4_MAX_LANES or fewer independent
+ * fletcher_4 streams ("lanes") side by side, lane i consuming every
+ * lanes'th 32-bit word starting at word i.  The per-lane accumulators are
+ * kept in a fletcher_4_ctx_t between calls and folded back into a single
+ * checksum by fletcher_4_ctx_fini().
+ */
+#define	FLETCHER_4_MAX_LANES	8
+
+typedef struct zfs_fletcher_lanes {
+	uint64_t v[FLETCHER_4_MAX_LANES] __attribute__((aligned(64)));
+} zfs_fletcher_lanes_t;
+
+typedef union fletcher_4_ctx {
+	zio_cksum_t scalar;
+	zfs_fletcher_lanes_t lanes[4];		/* a, b, c, d */
+} fletcher_4_ctx_t;
+
+typedef void (*fletcher_4_compute_f)(fletcher_4_ctx_t *,
+    const void *, uint64_t);
+typedef boolean_t (*fletcher_4_valid_f)(void);
+
+typedef struct fletcher_4_ops {
+	fletcher_4_compute_f compute_native;
+	fletcher_4_compute_f compute_byteswap;
+	fletcher_4_valid_f valid;
+	uint32_t lanes;		/* 0 for the scalar implementation */
+	uint32_t blocksize;	/* bytes consumed per vector iteration */
+	const char *name;
+} fletcher_4_ops_t;
+
+#if defined(HAVE_SIMD_X86)
+extern const fletcher_4_ops_t fletcher_4_sse2_ops;
+extern const fletcher_4_ops_t fletcher_4_ssse3_ops;
+extern const fletcher_4_ops_t fletcher_4_avx2_ops;
+extern const fletcher_4_ops_t fletcher_4_avx512f_ops;
+#endif
 
 #ifdef	__cplusplus
 }
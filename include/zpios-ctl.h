@@ -56,6 +56,7 @@
 #define	DMU_READ_ZC			0x0040 /* Incompatible w/DMU_VERIFY */
 #define	DMU_WRITE_NOWAIT		0x0080
 #define	DMU_READ_NOPF			0x0100
+#define	DMU_MIXED			0x0200 /* OS X only */
 
 #define	ZPIOS_NAME_SIZE			16
 #define	ZPIOS_PATH_SIZE			128
@@ -123,6 +124,33 @@ typedef struct zpios_cmd {
 	char cmd_data_str[0];		/* Opaque data region */
 } zpios_cmd_t;
 
+/*
+ * Per-operation latency histograms, in nanoseconds.  The latency of an
+ * operation with highest set bit h is counted in bucket
+ * (h << ZPIOS_LAT_SUB_BITS) plus the next ZPIOS_LAT_SUB_BITS bits of the
+ * latency, so each power of two is split into 1 << ZPIOS_LAT_SUB_BITS
+ * buckets.
+ */
+#define	ZPIOS_LAT_SUB_BITS		2
+#define	ZPIOS_LAT_BUCKETS		(64 << ZPIOS_LAT_SUB_BITS)
+
+typedef struct zpios_lat {
+	uint32_t lat_read_pct;		/* Mixed phase read percentage */
+	uint32_t lat_pad;
+	zpios_stats_t lat_mixed;	/* Mixed phase, total_time is phase */
+	uint64_t lat_wr[ZPIOS_LAT_BUCKETS];	/* Write phase */
+	uint64_t lat_rd[ZPIOS_LAT_BUCKETS];	/* Read phase */
+	uint64_t lat_mix_wr[ZPIOS_LAT_BUCKETS];	/* Mixed phase writes */
+	uint64_t lat_mix_rd[ZPIOS_LAT_BUCKETS];	/* Mixed phase reads */
+} zpios_lat_t;
+
+/* nvlist keys of the OS X ZFS_IOC_ZPIOS ioctl, see zpios_ioctl() */
+#define	ZPIOS_NVL_CMD			"cmd"
+#define	ZPIOS_NVL_READ_PCT		"read_pct"
+#define	ZPIOS_NVL_STATS			"stats"
+#define	ZPIOS_NVL_LATENCY		"latency"
+#define	ZPIOS_NVL_LOG			"log"
+
 /* Valid ioctls */
 #define	ZPIOS_CFG			_IOWR('f', 101, zpios_cfg_t)
 #define	ZPIOS_CMD			_IOWR('f', 102, zpios_cmd_t)
@@ -174,6 +202,23 @@ zpios_timespec_sub(zpios_timespec_t lhs, zpios_timespec_t rhs)
 	return (ts_delta);
 }
 
+static inline
+int
+zpios_lat_bucket(uint64_t ns)
+{
+	int hb = 0;
+
+	while (hb < 63 && (ns >> (hb + 1)) != 0)
+		hb++;
+
+	if (hb < ZPIOS_LAT_SUB_BITS)
+		return ((int)ns);
+
+	return ((hb << ZPIOS_LAT_SUB_BITS) |
+	    (int)((ns >> (hb - ZPIOS_LAT_SUB_BITS)) &
+	    ((1 << ZPIOS_LAT_SUB_BITS) - 1)));
+}
+
 #ifdef _KERNEL
 
 static inline
@@ -183,7 +228,11 @@ zpios_timespec_now(void)
 	zpios_timespec_t zts_now;
 	struct timespec ts_now;
 
+#ifdef __APPLE__
+	nanotime(&ts_now);
+#else
 	ts_now = current_kernel_time();
+#endif
 	zts_now.ts_sec  = ts_now.tv_sec;
 	zts_now.ts_nsec = ts_now.tv_nsec;
 
@@ -201,6 +250,20 @@ zpios_timespec_to_double(zpios_timespec_t ts)
 	    ((double)(ts.ts_nsec) / (double)(NSEC_PER_SEC)));
 }
 
+/* Largest latency counted in bucket b */
+static inline
+uint64_t
+zpios_lat_bucket_max(int b)
+{
+	int hb = b >> ZPIOS_LAT_SUB_BITS;
+	uint64_t sub = b & ((1 << ZPIOS_LAT_SUB_BITS) - 1);
+
+	if (hb < ZPIOS_LAT_SUB_BITS)
+		return (b);
+
+	return ((1ULL << hb) + ((sub + 1) << (hb - ZPIOS_LAT_SUB_BITS)) - 1);
+}
+
 #endif /* _KERNEL */
 
 #endif /* _ZPIOS_CTL_H */
@@ -476,6 +476,11 @@ typedef struct dk_updatefw_32 {
 #define	FW_TYPE_TEMP	0x0		/* temporary use */
 #define	FW_TYPE_PERM	0x1		/* permanent use */
 
+/*
+ * Unmap (TRIM) byte ranges of the device.
+ */
+#define	DKIOCFREE	(DKIOC|50)
+
 
 #ifdef	__cplusplus
 }
@@ -0,0 +1,376 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Userland side of dataset encryption: locating and parsing the user's
+ * wrapping key, and the create, load-key and unload-key operations.
+ *
+ * The wrapping key is read from the location named by the keylocation
+ * property, either "prompt" (standard input) or a "file://" URI, and
+ * must be in the format named by the keyformat property:
+ *
+ *	raw	exactly 32 bytes of key material
+ *	hex	64 hexadecimal digits, optionally followed by a newline
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/fs/zfs.h>
+#include <libzfs.h>
+#include <libzfs_core.h>
+#include "libzfs_impl.h"
+
+/* must match WRAPPING_KEY_LEN in sys/zio_crypt.h */
+#define	WRAPPING_KEY_LEN	32
+
+#define	KEYLOCATION_PROMPT	"prompt"
+#define	KEYLOCATION_FILE_URI	"file://"
+
+/*
+ * Room for a hex key, its newline and one more byte so that overlong
+ * input is noticed.
+ */
+#define	KEY_BUF_LEN		(WRAPPING_KEY_LEN * 2 + 2)
+
+static boolean_t
+keylocation_is_valid(const char *keylocation)
+{
+	if (strcmp(keylocation, KEYLOCATION_PROMPT) == 0)
+		return (B_TRUE);
+
+	return (strncmp(keylocation, KEYLOCATION_FILE_URI,
+	    strlen(KEYLOCATION_FILE_URI)) == 0 &&
+	    keylocation[strlen(KEYLOCATION_FILE_URI)] == '/');
+}
+
+static int
+hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	return (tolower(c) - 'a' + 10);
+}
+
+/*
+ * Turn the material read from the key location into a wrapping key.
+ */
+static int
+parse_key(libzfs_handle_t *hdl, zfs_keyformat_t keyformat, char *buf,
+    size_t len, uint8_t *wkeydata)
+{
+	int i;
+
+	switch (keyformat) {
+	case ZFS_KEYFORMAT_RAW:
+		if (len != WRAPPING_KEY_LEN) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "raw keys must be exactly %d bytes, got %d"),
+			    WRAPPING_KEY_LEN, (int)len);
+			return (EINVAL);
+		}
+		bcopy(buf, wkeydata, WRAPPING_KEY_LEN);
+		return (0);
+
+	case ZFS_KEYFORMAT_HEX:
+		if (len > 0 && buf[len - 1] == '\n')
+			len--;
+		if (len != WRAPPING_KEY_LEN * 2) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "hex keys must be exactly %d characters"),
+			    WRAPPING_KEY_LEN * 2);
+			return (EINVAL);
+		}
+		for (i = 0; i < WRAPPING_KEY_LEN * 2; i++) {
+			if (!isxdigit((unsigned char)buf[i])) {
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "invalid hex key"));
+				return (EINVAL);
+			}
+		}
+		for (i = 0; i < WRAPPING_KEY_LEN; i++) {
+			wkeydata[i] = (hex_digit(buf[2 * i]) << 4) |
+			    hex_digit(buf[2 * i + 1]);
+		}
+		return (0);
+
+	default:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "invalid keyformat"));
+		return (EINVAL);
+	}
+}
+
+/*
+ * Read the wrapping key from "keylocation" into "wkeydata", which must
+ * hold WRAPPING_KEY_LEN bytes.
+ */
+static int
+get_key_material(libzfs_handle_t *hdl, zfs_keyformat_t keyformat,
+    const char *keylocation, const char *fsname, uint8_t *wkeydata)
+{
+	char buf[KEY_BUF_LEN];
+	FILE *fp = NULL;
+	size_t len;
+	int ret;
+
+	if (!keylocation_is_valid(keylocation)) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "invalid keylocation '%s'"), keylocation);
+		return (EINVAL);
+	}
+
+	if (strcmp(keylocation, KEYLOCATION_PROMPT) == 0) {
+		if (isatty(STDIN_FILENO)) {
+			char prompt[ZFS_MAX_DATASET_NAME_LEN + 32];
+			char *key;
+
+			if (keyformat == ZFS_KEYFORMAT_RAW) {
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "raw keys cannot be entered at a terminal"));
+				return (EINVAL);
+			}
+			(void) snprintf(prompt, sizeof (prompt),
+			    "Enter hex key for '%s': ", fsname);
+			key = getpass(prompt);
+			if (key == NULL) {
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "failed to read key"));
+				return (EIO);
+			}
+			len = strlcpy(buf, key, sizeof (buf));
+			bzero(key, strlen(key));
+			if (len >= sizeof (buf))
+				len = sizeof (buf) - 1;
+			ret = parse_key(hdl, keyformat, buf, len, wkeydata);
+			bzero(buf, sizeof (buf));
+			return (ret);
+		}
+		fp = stdin;
+	} else {
+		const char *path = keylocation + strlen(KEYLOCATION_FILE_URI);
+
+		fp = fopen(path, "r");
+		if (fp == NULL) {
+			ret = errno;
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "failed to open key file '%s': %s"), path,
+			    strerror(ret));
+			return (ret);
+		}
+	}
+
+	len = fread(buf, 1, sizeof (buf), fp);
+	if (ferror(fp)) {
+		ret = EIO;
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "failed to read key"));
+	} else {
+		ret = parse_key(hdl, keyformat, buf, len, wkeydata);
+	}
+	bzero(buf, sizeof (buf));
+
+	if (fp != stdin)
+		(void) fclose(fp);
+
+	return (ret);
+}
+
+/*
+ * Called by zfs_create() once "props" have been validated.  If the new
+ * dataset is to be an encryption root, read its wrapping key and return
+ * it in "wkeydata_out" (to be freed by the caller); otherwise return
+ * NULL there.  A dataset created without these properties under an
+ * encrypted parent simply inherits the parent's key in the kernel.
+ */
+int
+zfs_crypto_create(libzfs_handle_t *hdl, const char *fsname, nvlist_t *props,
+    uint8_t **wkeydata_out, uint_t *wkeylen_out)
+{
+	uint64_t crypt, crypt_off;
+	uint64_t keyformat = ZFS_KEYFORMAT_NONE;
+	boolean_t has_crypt;
+	char *keylocation = NULL;
+	uint8_t *wkeydata;
+	int ret;
+
+	*wkeydata_out = NULL;
+	*wkeylen_out = 0;
+
+	if (props == NULL)
+		return (0);
+
+	VERIFY0(zfs_prop_string_to_index(ZFS_PROP_ENCRYPTION, "off",
+	    &crypt_off));
+	has_crypt = (nvlist_lookup_uint64(props,
+	    zfs_prop_to_name(ZFS_PROP_ENCRYPTION), &crypt) == 0);
+	(void) nvlist_lookup_uint64(props,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), &keyformat);
+	(void) nvlist_lookup_string(props,
+	    zfs_prop_to_name(ZFS_PROP_KEYLOCATION), &keylocation);
+
+	if (has_crypt && crypt == crypt_off) {
+		if (keyformat != ZFS_KEYFORMAT_NONE || keylocation != NULL) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "keyformat and keylocation require encryption"));
+			return (EINVAL);
+		}
+		return (0);
+	}
+
+	if (keyformat == ZFS_KEYFORMAT_NONE) {
+		if (has_crypt) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "encryption requires a keyformat"));
+			return (EINVAL);
+		}
+		if (keylocation != NULL) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "keylocation can only be set on an "
+			    "encryption root"));
+			return (EINVAL);
+		}
+		return (0);
+	}
+
+	if (keylocation == NULL) {
+		keylocation = KEYLOCATION_PROMPT;
+		if (nvlist_add_string(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYLOCATION), keylocation) != 0)
+			return (ENOMEM);
+	}
+
+	wkeydata = zfs_alloc(hdl, WRAPPING_KEY_LEN);
+	if (wkeydata == NULL)
+		return (ENOMEM);
+
+	ret = get_key_material(hdl, keyformat, keylocation, fsname, wkeydata);
+	if (ret != 0) {
+		free(wkeydata);
+		return (ret);
+	}
+
+	*wkeydata_out = wkeydata;
+	*wkeylen_out = WRAPPING_KEY_LEN;
+	return (0);
+}
+
+/*
+ * Load the key of the encryption root "zhp" from "alt_keylocation" or,
+ * if that is NULL, from its keylocation property.
+ */
+int
+zfs_crypto_load_key(zfs_handle_t *zhp, char *alt_keylocation)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	char errbuf[1024];
+	char keylocation[MAXNAMELEN];
+	uint8_t wkeydata[WRAPPING_KEY_LEN];
+	uint64_t keyformat;
+	int ret;
+
+	(void) snprintf(errbuf, sizeof (errbuf),
+	    dgettext(TEXT_DOMAIN, "cannot load key for '%s'"),
+	    zfs_get_name(zhp));
+
+	keyformat = zfs_prop_get_int(zhp, ZFS_PROP_KEYFORMAT);
+	if (keyformat == ZFS_KEYFORMAT_NONE) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "'%s' is not an encryption root"), zfs_get_name(zhp));
+		return (zfs_error(hdl, EZFS_CRYPTOFAILED, errbuf));
+	}
+
+	if (alt_keylocation != NULL) {
+		(void) strlcpy(keylocation, alt_keylocation,
+		    sizeof (keylocation));
+	} else if (zfs_prop_get(zhp, ZFS_PROP_KEYLOCATION, keylocation,
+	    sizeof (keylocation), NULL, NULL, 0, B_TRUE) != 0) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "failed to get keylocation"));
+		return (zfs_error(hdl, EZFS_CRYPTOFAILED, errbuf));
+	}
+
+	ret = get_key_material(hdl, keyformat, keylocation,
+	    zfs_get_name(zhp), wkeydata);
+	if (ret != 0)
+		return (zfs_error(hdl, EZFS_CRYPTOFAILED, errbuf));
+
+	ret = lzc_load_key(zhp->zfs_name, wkeydata, sizeof (wkeydata));
+	bzero(wkeydata, sizeof (wkeydata));
+	if (ret != 0) {
+		switch (ret) {
+		case EACCES:
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "incorrect key provided"));
+			break;
+		case EEXIST:
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "key already loaded"));
+			break;
+		default:
+			return (zfs_standard_error(hdl, ret, errbuf));
+		}
+		return (zfs_error(hdl, EZFS_CRYPTOFAILED, errbuf));
+	}
+
+	return (0);
+}
+
+int
+zfs_crypto_unload_key(zfs_handle_t *zhp)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	char errbuf[1024];
+	int ret;
+
+	(void) snprintf(errbuf, sizeof (errbuf),
+	    dgettext(TEXT_DOMAIN, "cannot unload key for '%s'"),
+	    zfs_get_name(zhp));
+
+	ret = lzc_unload_key(zhp->zfs_name);
+	if (ret != 0) {
+		switch (ret) {
+		case EBUSY:
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "dataset is busy"));
+			break;
+		case EACCES:
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "key already unloaded"));
+			break;
+		case EINVAL:
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "'%s' is not an encryption root"),
+			    zfs_get_name(zhp));
+			break;
+		default:
+			return (zfs_standard_error(hdl, ret, errbuf));
+		}
+		return (zfs_error(hdl, EZFS_CRYPTOFAILED, errbuf));
+	}
+
+	return (0);
+}
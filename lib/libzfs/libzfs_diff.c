@@ -45,6 +45,7 @@
 #include <pthread.h>
 #include <sys/zfs_ioctl.h>
 #include <libzfs.h>
+#include <libzfs_core.h>
 #include "libzfs_impl.h"
 
 #define	ZDIFF_SNAPDIR		"/.zfs/snapshot/"
@@ -56,6 +57,42 @@
 #define	ZDIFF_REMOVED	'-'
 #define	ZDIFF_RENAMED	'R'
 
+/*
+ * Changed objects are resolved to their stats and paths in batches, with
+ * one ioctl per batch and snapshot, by several worker threads at once.
+ * The batches are printed in the order they were filled, which is the
+ * order of the objects in the diff stream, as soon as each one and all
+ * those before it have been resolved.
+ */
+#define	ZDIFF_BATCH		256	/* objects per batch */
+#define	ZDIFF_WORKERS_MAX	8	/* resolving threads */
+
+typedef struct zdiff_stat {
+	int		zs_err;		/* lookup error, 0 if found */
+	zfs_stat_t	zs_sb;		/* valid even if only the path failed */
+	char		*zs_path;	/* NULL unless zs_err is 0 */
+} zdiff_stat_t;
+
+typedef struct zdiff_obj {
+	uint64_t	zo_obj;
+	boolean_t	zo_free;	/* freed, only look on the from side */
+	zdiff_stat_t	zo_from;
+	zdiff_stat_t	zo_to;
+} zdiff_obj_t;
+
+typedef enum zdiff_state {
+	ZDIFF_QUEUED,
+	ZDIFF_RUNNING,
+	ZDIFF_DONE
+} zdiff_state_t;
+
+typedef struct zdiff_batch {
+	struct zdiff_batch *db_next;	/* next in stream order */
+	zdiff_state_t	db_state;
+	int		db_count;
+	zdiff_obj_t	db_objs[ZDIFF_BATCH];
+} zdiff_batch_t;
+
 typedef struct differ_info {
 	zfs_handle_t *zhp;
 	char *fromsnap;
@@ -75,30 +112,111 @@ typedef struct differ_info {
 	int cleanupfd;
 	int outputfd;
 	int datafd;
+	pthread_mutex_t qlock;		/* protects the batch queue */
+	pthread_cond_t qcv;		/* batch queued, or qexit set */
+	pthread_cond_t qdonecv;		/* batch resolved */
+	zdiff_batch_t *qhead;		/* queued batches, in stream order */
+	zdiff_batch_t *qtail;
+	zdiff_batch_t *fill;		/* being filled, not yet queued */
+	zdiff_batch_t *printing;	/* dequeued, being printed */
+	int inflight;			/* batches on the queue */
+	boolean_t qexit;		/* workers should exit */
+	int nworkers;
+	pthread_t workers[ZDIFF_WORKERS_MAX];
 } differ_info_t;
 
 /*
- * Given a {dsname, object id}, get the object path
+ * Given a {dsname, object id}, look up the object stats and path with
+ * the per-object ioctl.  Used when the kernel lacks the batched one.
  */
-static int
-get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
-    char *pn, int maxlen, zfs_stat_t *sb)
+static void
+stat_one_obj(differ_info_t *di, const char *dsname, uint64_t obj,
+    zdiff_stat_t *zs)
 {
 	zfs_cmd_t zc = {"\0"};
-	int error;
 
 	(void) strlcpy(zc.zc_name, dsname, sizeof (zc.zc_name));
 	zc.zc_obj = obj;
 
 	errno = 0;
-	error = zfs_ioctl(di->zhp->zfs_hdl, ZFS_IOC_OBJ_TO_STATS, &zc);
-	di->zerr = errno;
+	zs->zs_err = 0;
+	if (zfs_ioctl(di->zhp->zfs_hdl, ZFS_IOC_OBJ_TO_STATS, &zc) != 0)
+		zs->zs_err = (errno != 0) ? errno : EINVAL;
 
 	/* we can get stats even if we failed to get a path */
-	(void) memcpy(sb, &zc.zc_stat, sizeof (zfs_stat_t));
-	if (error == 0) {
-		ASSERT(di->zerr == 0);
-		(void) strlcpy(pn, zc.zc_value, maxlen);
+	(void) memcpy(&zs->zs_sb, &zc.zc_stat, sizeof (zfs_stat_t));
+	if (zs->zs_err == 0 && (zs->zs_path = strdup(zc.zc_value)) == NULL)
+		zs->zs_err = ENOMEM;
+}
+
+/*
+ * Look up the objects of db on one side of the diff, all with one ioctl
+ * if the kernel can.
+ */
+static void
+stat_batch(differ_info_t *di, zdiff_batch_t *db, const char *dsname,
+    boolean_t to)
+{
+	uint64_t objs[ZDIFF_BATCH];
+	zdiff_stat_t *zss[ZDIFF_BATCH];
+	nvlist_t *args, *result = NULL;
+	int32_t *errors;
+	uint8_t *stats;
+	char **paths;
+	uint_t n = 0, nerrors, nstats, npaths, i;
+
+	for (i = 0; i < db->db_count; i++) {
+		zdiff_obj_t *zo = &db->db_objs[i];
+
+		if (to && zo->zo_free)
+			continue;
+		objs[n] = zo->zo_obj;
+		zss[n++] = to ? &zo->zo_to : &zo->zo_from;
+	}
+	if (n == 0)
+		return;
+
+	args = fnvlist_alloc();
+	fnvlist_add_uint64_array(args, "objects", objs, n);
+
+	if (lzc_obj_to_stats_batch(dsname, args, &result) == 0 &&
+	    nvlist_lookup_int32_array(result, "errors", &errors,
+	    &nerrors) == 0 &&
+	    nvlist_lookup_uint8_array(result, "stats", &stats, &nstats) == 0 &&
+	    nvlist_lookup_string_array(result, "paths", &paths,
+	    &npaths) == 0 &&
+	    nerrors == n && npaths == n && nstats == n * sizeof (zfs_stat_t)) {
+		for (i = 0; i < n; i++) {
+			zss[i]->zs_err = errors[i];
+			(void) memcpy(&zss[i]->zs_sb,
+			    stats + i * sizeof (zfs_stat_t),
+			    sizeof (zfs_stat_t));
+			if (errors[i] == 0 &&
+			    (zss[i]->zs_path = strdup(paths[i])) == NULL)
+				zss[i]->zs_err = ENOMEM;
+		}
+	} else {
+		for (i = 0; i < n; i++)
+			stat_one_obj(di, dsname, objs[i], zss[i]);
+	}
+
+	nvlist_free(result);
+	fnvlist_free(args);
+}
+
+/*
+ * Given a {dsname, object id} and its looked up stats, get the object path
+ */
+static int
+get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
+    const zdiff_stat_t *zs, char *pn, int maxlen, zfs_stat_t *sb)
+{
+	di->zerr = zs->zs_err;
+
+	/* we can get stats even if we failed to get a path */
+	(void) memcpy(sb, &zs->zs_sb, sizeof (zfs_stat_t));
+	if (di->zerr == 0) {
+		(void) strlcpy(pn, zs->zs_path, maxlen);
 		return (0);
 	}
 
@@ -251,8 +369,9 @@ print_file(FILE *fp, differ_info_t *di, char type, const char *file,
 }
 
 static int
-write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
+write_inuse_diffs_one(FILE *fp, differ_info_t *di, zdiff_obj_t *zo)
 {
+	uint64_t dobj = zo->zo_obj;
 	struct zfs_stat fsb, tsb;
 	mode_t fmode, tmode;
 	char fobjname[MAXPATHLEN], tobjname[MAXPATHLEN];
@@ -268,13 +387,13 @@ write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
 	 * snapshot.  If we get ENOTSUP, then we tried to get
 	 * info on a non-ZPL object, which we don't care about anyway.
 	 */
-	fobjerr = get_stats_for_obj(di, di->fromsnap, dobj, fobjname,
-	    MAXPATHLEN, &fsb);
+	fobjerr = get_stats_for_obj(di, di->fromsnap, dobj, &zo->zo_from,
+	    fobjname, MAXPATHLEN, &fsb);
 	if (fobjerr && di->zerr != ENOENT && di->zerr != ENOTSUP)
 		return (-1);
 
-	tobjerr = get_stats_for_obj(di, di->tosnap, dobj, tobjname,
-	    MAXPATHLEN, &tsb);
+	tobjerr = get_stats_for_obj(di, di->tosnap, dobj, &zo->zo_to,
+	    tobjname, MAXPATHLEN, &tsb);
 	if (tobjerr && di->zerr != ENOENT && di->zerr != ENOTSUP)
 		return (-1);
 
@@ -339,26 +458,13 @@ write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
 }
 
 static int
-write_inuse_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
-{
-	uint64_t o;
-	int err;
-
-	for (o = dr->ddr_first; o <= dr->ddr_last; o++) {
-		if ((err = write_inuse_diffs_one(fp, di, o)))
-			return (err);
-	}
-	return (0);
-}
-
-static int
-describe_free(FILE *fp, differ_info_t *di, uint64_t object, char *namebuf,
+describe_free(FILE *fp, differ_info_t *di, zdiff_obj_t *zo, char *namebuf,
     int maxlen)
 {
 	struct zfs_stat sb;
 
-	if (get_stats_for_obj(di, di->fromsnap, object, namebuf,
-	    maxlen, &sb) != 0) {
+	if (get_stats_for_obj(di, di->fromsnap, zo->zo_obj, &zo->zo_from,
+	    namebuf, maxlen, &sb) != 0) {
 		/* Let it slide, if in the delete queue on from side */
 		if (di->zerr == ENOENT && sb.zs_links == 0) {
 			di->zerr = 0;
@@ -371,12 +477,243 @@ describe_free(FILE *fp, differ_info_t *di, uint64_t object, char *namebuf,
 	return (0);
 }
 
+static void
+free_batch(zdiff_batch_t *db)
+{
+	int i;
+
+	for (i = 0; i < db->db_count; i++) {
+		free(db->db_objs[i].zo_from.zs_path);
+		free(db->db_objs[i].zo_to.zs_path);
+	}
+	free(db);
+}
+
+static int
+print_batch(FILE *fp, differ_info_t *di, zdiff_batch_t *db)
+{
+	char fobjname[MAXPATHLEN];
+	int i, err = 0;
+
+	for (i = 0; i < db->db_count && err == 0; i++) {
+		zdiff_obj_t *zo = &db->db_objs[i];
+
+		if (zo->zo_free)
+			err = describe_free(fp, di, zo, fobjname, MAXPATHLEN);
+		else
+			err = write_inuse_diffs_one(fp, di, zo);
+	}
+	return (err);
+}
+
+static void *
+stat_worker(void *arg)
+{
+	differ_info_t *di = arg;
+	zdiff_batch_t *db;
+
+	(void) pthread_mutex_lock(&di->qlock);
+	while (!di->qexit) {
+		for (db = di->qhead; db != NULL; db = db->db_next) {
+			if (db->db_state == ZDIFF_QUEUED)
+				break;
+		}
+		if (db == NULL) {
+			(void) pthread_cond_wait(&di->qcv, &di->qlock);
+			continue;
+		}
+
+		db->db_state = ZDIFF_RUNNING;
+		(void) pthread_mutex_unlock(&di->qlock);
+
+		stat_batch(di, db, di->fromsnap, B_FALSE);
+		stat_batch(di, db, di->tosnap, B_TRUE);
+
+		(void) pthread_mutex_lock(&di->qlock);
+		db->db_state = ZDIFF_DONE;
+		(void) pthread_cond_broadcast(&di->qdonecv);
+	}
+	(void) pthread_mutex_unlock(&di->qlock);
+
+	return (NULL);
+}
+
+/*
+ * Print the resolved batches at the head of the queue.  While too many
+ * are in flight, or when draining at the end of the stream, wait for
+ * the head to be resolved rather than return.  The differ thread can be
+ * cancelled while it prints, so the batch is left where
+ * stop_workers() will find it.
+ */
+static int
+flush_batches(FILE *fp, differ_info_t *di, boolean_t drain)
+{
+	zdiff_batch_t *db;
+	int err = 0;
+
+	(void) pthread_mutex_lock(&di->qlock);
+	while (err == 0 && (db = di->qhead) != NULL) {
+		if (db->db_state != ZDIFF_DONE) {
+			if (!drain && di->inflight < 2 * di->nworkers)
+				break;
+			(void) pthread_cond_wait(&di->qdonecv, &di->qlock);
+			continue;
+		}
+		if ((di->qhead = db->db_next) == NULL)
+			di->qtail = NULL;
+		di->inflight--;
+		di->printing = db;
+		(void) pthread_mutex_unlock(&di->qlock);
+
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		err = print_batch(fp, di, db);
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		di->printing = NULL;
+		free_batch(db);
+		(void) pthread_mutex_lock(&di->qlock);
+	}
+	(void) pthread_mutex_unlock(&di->qlock);
+
+	return (err);
+}
+
+/*
+ * Hand the batch being filled to the workers, and print what is ready.
+ */
+static int
+queue_batch(FILE *fp, differ_info_t *di)
+{
+	zdiff_batch_t *db = di->fill;
+
+	if (db != NULL) {
+		di->fill = NULL;
+		db->db_state = ZDIFF_QUEUED;
+		(void) pthread_mutex_lock(&di->qlock);
+		if (di->qtail != NULL)
+			di->qtail->db_next = db;
+		else
+			di->qhead = db;
+		di->qtail = db;
+		di->inflight++;
+		(void) pthread_cond_signal(&di->qcv);
+		(void) pthread_mutex_unlock(&di->qlock);
+	}
+
+	return (flush_batches(fp, di, B_FALSE));
+}
+
+static int
+add_obj(FILE *fp, differ_info_t *di, uint64_t obj, boolean_t isfree)
+{
+	zdiff_batch_t *db;
+	zdiff_obj_t *zo;
+
+	if ((db = di->fill) == NULL) {
+		if ((db = calloc(1, sizeof (zdiff_batch_t))) == NULL) {
+			di->zerr = ENOMEM;
+			(void) strlcpy(di->errbuf, strerror(ENOMEM),
+			    sizeof (di->errbuf));
+			return (-1);
+		}
+		di->fill = db;
+	}
+
+	zo = &db->db_objs[db->db_count++];
+	zo->zo_obj = obj;
+	zo->zo_free = isfree;
+
+	if (db->db_count == ZDIFF_BATCH)
+		return (queue_batch(fp, di));
+	return (0);
+}
+
+static int
+start_workers(differ_info_t *di)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n, err = 0;
+
+	n = (int)MIN(MAX(ncpus, 2), ZDIFF_WORKERS_MAX);
+
+	(void) pthread_mutex_init(&di->qlock, NULL);
+	(void) pthread_cond_init(&di->qcv, NULL);
+	(void) pthread_cond_init(&di->qdonecv, NULL);
+
+	for (di->nworkers = 0; di->nworkers < n; di->nworkers++) {
+		err = pthread_create(&di->workers[di->nworkers], NULL,
+		    stat_worker, di);
+		if (err != 0)
+			break;
+	}
+
+	if (di->nworkers == 0) {
+		di->zerr = err;
+		(void) strlcpy(di->errbuf, strerror(err), sizeof (di->errbuf));
+		(void) pthread_cond_destroy(&di->qdonecv);
+		(void) pthread_cond_destroy(&di->qcv);
+		(void) pthread_mutex_destroy(&di->qlock);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Stop the workers and free whatever was not printed.  Also run as the
+ * cleanup handler of the differ thread, which is only cancelled where
+ * it holds no lock.
+ */
+static void
+stop_workers(void *arg)
+{
+	differ_info_t *di = arg;
+	zdiff_batch_t *db;
+	int i;
+
+	(void) pthread_mutex_lock(&di->qlock);
+	di->qexit = B_TRUE;
+	(void) pthread_cond_broadcast(&di->qcv);
+	(void) pthread_mutex_unlock(&di->qlock);
+
+	for (i = 0; i < di->nworkers; i++)
+		(void) pthread_join(di->workers[i], NULL);
+
+	while ((db = di->qhead) != NULL) {
+		di->qhead = db->db_next;
+		free_batch(db);
+	}
+	di->qtail = NULL;
+	if (di->fill != NULL)
+		free_batch(di->fill);
+	if (di->printing != NULL)
+		free_batch(di->printing);
+	di->fill = di->printing = NULL;
+
+	(void) pthread_cond_destroy(&di->qdonecv);
+	(void) pthread_cond_destroy(&di->qcv);
+	(void) pthread_mutex_destroy(&di->qlock);
+}
+
+static int
+write_inuse_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
+{
+	uint64_t o;
+	int err;
+
+	for (o = dr->ddr_first; o <= dr->ddr_last; o++) {
+		if (o == di->shares)
+			continue;
+		if ((err = add_obj(fp, di, o, B_FALSE)))
+			return (err);
+	}
+	return (0);
+}
+
 static int
 write_free_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
 {
 	zfs_cmd_t zc = {"\0"};
 	libzfs_handle_t *lhdl = di->zhp->zfs_hdl;
-	char fobjname[MAXPATHLEN];
 
 	(void) strlcpy(zc.zc_name, di->fromsnap, sizeof (zc.zc_name));
 	zc.zc_obj = dr->ddr_first - 1;
@@ -395,8 +732,7 @@ write_free_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
 			if (zc.zc_obj > dr->ddr_last) {
 				break;
 			}
-			err = describe_free(fp, di, zc.zc_obj, fobjname,
-			    MAXPATHLEN);
+			err = add_obj(fp, di, zc.zc_obj, B_TRUE);
 			if (err)
 				break;
 		} else if (errno == ESRCH) {
@@ -422,6 +758,7 @@ differ(void *arg)
 	dmu_diff_record_t dr;
 	FILE *ofp;
 	int err = 0;
+	int zerr;
 
 	if ((ofp = fdopen(di->outputfd, "w")) == NULL) {
 		di->zerr = errno;
@@ -430,16 +767,30 @@ differ(void *arg)
 		return ((void *)-1);
 	}
 
+	/*
+	 * Only allow cancellation while blocked on the diff stream or the
+	 * output, never while holding the queue lock.
+	 */
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	if (start_workers(di) != 0) {
+		(void) fclose(ofp);
+		(void) close(di->datafd);
+		return ((void *)-1);
+	}
+	pthread_cleanup_push(stop_workers, di);
+
 	for (;;) {
 		char *cp = (char *)&dr;
 		int len = sizeof (dr);
 		int rv;
 
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 		do {
 			rv = read(di->datafd, cp, len);
 			cp += rv;
 			len -= rv;
 		} while (len > 0 && rv > 0);
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
 		if (rv < 0 || (rv == 0 && len != sizeof (dr))) {
 			di->zerr = EPIPE;
@@ -465,6 +816,17 @@ differ(void *arg)
 			break;
 	}
 
+	/* Print everything resolved before the stream ended or failed */
+	if (err == 0) {
+		zerr = di->zerr;
+		di->zerr = 0;
+		if ((err = queue_batch(ofp, di)) == 0 &&
+		    (err = flush_batches(ofp, di, B_TRUE)) == 0)
+			di->zerr = zerr;
+	}
+
+	pthread_cleanup_pop(1);
+
 	(void) fclose(ofp);
 	(void) close(di->datafd);
 	if (err)
@@ -872,32 +872,47 @@ label_offset(uint64_t size, int l)
 /*
  * Given a file descriptor, read the label information and return an nvlist
  * describing the configuration, if there is one.  The number of valid
- * labels found will be returned in num_labels when non-NULL.
+ * labels found will be returned in num_labels when non-NULL; when it is
+ * NULL we stop at the first pair of labels that holds a valid one.
+ *
+ * Labels 0 and 1 are adjacent at the front of the device, and 2 and 3 at
+ * the back, so each pair is read with a single pread().
  */
 int
 zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 {
 	struct stat statbuf;
 	int l, count = 0;
-	vdev_label_t *label;
+	vdev_label_t *labels, *label;
 	nvlist_t *expected_config = NULL;
 	uint64_t expected_guid = 0, size;
+	ssize_t nread = 0;
 
 	*config = NULL;
 
-	if (fstat(fd, &statbuf) == -1)
+	/* fstat() reports no size for block devices on some platforms */
+	if (fstat_blk(fd, &statbuf) == -1)
 		return (0);
 	size = P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t);
 
-	if ((label = malloc(sizeof (vdev_label_t))) == NULL)
+	if ((labels = malloc(2 * sizeof (vdev_label_t))) == NULL)
 		return (-1);
 
 	for (l = 0; l < VDEV_LABELS; l++) {
 		uint64_t state, guid, txg;
 
-		if (pread(fd, label, sizeof (vdev_label_t),
-		    label_offset(size, l)) != sizeof (vdev_label_t))
+		if (l % 2 == 0) {
+			if (num_labels == NULL && expected_guid != 0)
+				break;
+			if (l != 0 &&
+			    size < VDEV_LABELS * sizeof (vdev_label_t))
+				break;
+			nread = pread(fd, labels, 2 * sizeof (vdev_label_t),
+			    label_offset(size, l));
+		}
+		if (nread < (ssize_t)((l % 2 + 1) * sizeof (vdev_label_t)))
 			continue;
+		label = &labels[l % 2];
 
 		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
 		    sizeof (label->vl_vdev_phys.vp_nvlist), config, 0) != 0)
@@ -937,7 +952,7 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 	if (num_labels != NULL)
 		*num_labels = count;
 
-	free(label);
+	free(labels);
 	*config = expected_config;
 
 	return (0);
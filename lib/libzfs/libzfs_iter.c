@@ -97,6 +97,91 @@ top:
 	return (rc);
 }
 
+/*
+ * Iterate over the child filesystems or snapshots of zhp a batch at a time
+ * with lzc_list_batch(), saving an ioctl and a property copyout per dataset.
+ * If zhp has been pruned to a property table only those properties are
+ * fetched.  Sets *fallback if the kernel doesn't support batched listing.
+ */
+static int
+zfs_iter_batch(zfs_handle_t *zhp, boolean_t snaps, boolean_t simple,
+    zfs_iter_f func, void *data, boolean_t *fallback)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	nvlist_t *args, *filter, *result, *datasets;
+	nvpair_t *pair;
+	zfs_handle_t *nzhp;
+	uint64_t cursor = 0;
+	boolean_t first = B_TRUE, done = B_FALSE;
+	int prop, err, ret = 0;
+
+	*fallback = B_FALSE;
+
+	args = fnvlist_alloc();
+	if (snaps)
+		fnvlist_add_boolean(args, "snapshots");
+	if (simple)
+		fnvlist_add_boolean(args, "simple");
+	if (!simple && zhp->zfs_props_table != NULL) {
+		filter = fnvlist_alloc();
+		for (prop = 0; prop < ZFS_NUM_PROPS; prop++) {
+			if (zhp->zfs_props_table[prop])
+				fnvlist_add_boolean(filter,
+				    zfs_prop_to_name((zfs_prop_t)prop));
+		}
+		fnvlist_add_nvlist(args, "props", filter);
+		fnvlist_free(filter);
+	}
+
+	while (ret == 0 && !done) {
+		fnvlist_add_uint64(args, "cursor", cursor);
+		err = lzc_list_batch(zhp->zfs_name, args, &result);
+		if (err != 0) {
+			/*
+			 * ESRCH and ENOENT mean the dataset has been removed
+			 * since we obtained the handle.
+			 */
+			if (first && (err == EINVAL || err == ENOTSUP))
+				*fallback = B_TRUE;
+			else if (err != ESRCH && err != ENOENT)
+				ret = zfs_standard_error(hdl, err,
+				    dgettext(TEXT_DOMAIN,
+				    "cannot iterate filesystems"));
+			break;
+		}
+		first = B_FALSE;
+
+		cursor = fnvlist_lookup_uint64(result, "cursor");
+		done = nvlist_exists(result, "done");
+		datasets = fnvlist_lookup_nvlist(result, "datasets");
+		for (pair = nvlist_next_nvpair(datasets, NULL);
+		    pair != NULL && ret == 0;
+		    pair = nvlist_next_nvpair(datasets, pair)) {
+			if (simple) {
+				nzhp = make_dataset_simple_handle(zhp,
+				    nvpair_name(pair));
+			} else {
+				nzhp = make_dataset_handle_nvl(hdl,
+				    nvpair_name(pair),
+				    fnvpair_value_nvlist(pair));
+			}
+			/*
+			 * Silently ignore errors, as the only plausible
+			 * explanation is that the pool has since been removed.
+			 */
+			if (nzhp == NULL)
+				continue;
+			if (!simple)
+				nzhp->zfs_props_table = zhp->zfs_props_table;
+
+			ret = func(nzhp, data);
+		}
+		fnvlist_free(result);
+	}
+	fnvlist_free(args);
+	return (ret);
+}
+
 /*
  * Iterate over all child filesystems
  */
@@ -105,12 +190,17 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 {
 	zfs_cmd_t zc = {"\0"};
 	zfs_handle_t *nzhp;
+	boolean_t fallback;
 	int ret;
     uint64_t allocated_size;
 
 	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
 		return (0);
 
+	ret = zfs_iter_batch(zhp, B_FALSE, B_FALSE, func, data, &fallback);
+	if (!fallback)
+		return (ret);
+
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
 		return (-1);
 
@@ -148,12 +238,17 @@ zfs_iter_snapshots(zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func,
 {
 	zfs_cmd_t zc = {"\0"};
 	zfs_handle_t *nzhp;
+	boolean_t fallback;
 	int ret;
 
 	if (zhp->zfs_type == ZFS_TYPE_SNAPSHOT ||
 	    zhp->zfs_type == ZFS_TYPE_BOOKMARK)
 		return (0);
 
+	ret = zfs_iter_batch(zhp, B_TRUE, simple, func, data, &fallback);
+	if (!fallback)
+		return (ret);
+
 	zc.zc_simple = simple;
 
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
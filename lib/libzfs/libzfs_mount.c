@@ -1565,13 +1565,238 @@ libzfs_dataset_cmp(const void *a, const void *b)
 	return (strcmp(zfs_get_name(a), zfs_get_name(b)));
 }
 
+#define	MOUNT_THREADS_MAX	32
+
+typedef struct mount_node {
+	zfs_handle_t	*mn_zhp;
+	char		mn_mountpoint[ZFS_MAXPROPLEN];
+	size_t		mn_end;		/* first index past our subtree */
+} mount_node_t;
+
+typedef struct mount_pool {
+	mount_node_t	*mp_nodes;
+	size_t		mp_num;
+	size_t		*mp_queue;	/* each index is queued once */
+	size_t		mp_head;
+	size_t		mp_tail;
+	size_t		mp_pending;	/* queued or being mounted */
+	zfs_iter_f	mp_func;
+	void		*mp_data;
+	int		mp_ret;
+	pthread_mutex_t	mp_lock;
+	pthread_cond_t	mp_cv;
+} mount_pool_t;
+
+/*
+ * Order mountpoints so that every mountpoint is directly followed by the
+ * mountpoints below it: '/' sorts before any other character, so that
+ * "/a/b" comes before "/a b".
+ */
+static int
+mountpoint_cmp(const void *a, const void *b)
+{
+	const unsigned char *ma =
+	    (const unsigned char *)((const mount_node_t *)a)->mn_mountpoint;
+	const unsigned char *mb =
+	    (const unsigned char *)((const mount_node_t *)b)->mn_mountpoint;
+
+	for (; *ma == *mb; ma++, mb++) {
+		if (*ma == '\0')
+			return (0);
+	}
+	if (*ma == '\0')
+		return (-1);
+	if (*mb == '\0')
+		return (1);
+	if (*ma == '/')
+		return (-1);
+	if (*mb == '/')
+		return (1);
+	return (*ma < *mb ? -1 : 1);
+}
+
+/*
+ * Does mountpoint "child" have to wait for "parent" to be mounted?  A
+ * mountpoint equal to its parent's is treated as below it, so that the
+ * two are mounted in order.
+ */
+static boolean_t
+mountpoint_is_below(const char *parent, const char *child)
+{
+	size_t len = strlen(parent);
+
+	if (parent[0] != '/' || strncmp(parent, child, len) != 0)
+		return (B_FALSE);
+	return (len == 1 || child[len] == '\0' || child[len] == '/');
+}
+
+/*
+ * Queue the subtrees directly below node "idx" (or the top level ones,
+ * for idx == mp_num).  Called with mp_lock held.
+ */
+static void
+mount_pool_queue_children(mount_pool_t *mp, size_t idx)
+{
+	size_t i, end;
+
+	if (idx == mp->mp_num) {
+		i = 0;
+		end = mp->mp_num;
+	} else {
+		i = idx + 1;
+		end = mp->mp_nodes[idx].mn_end;
+	}
+
+	for (; i < end; i = mp->mp_nodes[i].mn_end) {
+		mp->mp_queue[mp->mp_tail++] = i;
+		mp->mp_pending++;
+	}
+	(void) pthread_cond_broadcast(&mp->mp_cv);
+}
+
+static void *
+mount_pool_worker(void *arg)
+{
+	mount_pool_t *mp = arg;
+	size_t idx;
+	int error;
+
+	(void) pthread_mutex_lock(&mp->mp_lock);
+	for (;;) {
+		while (mp->mp_head == mp->mp_tail && mp->mp_pending != 0)
+			(void) pthread_cond_wait(&mp->mp_cv, &mp->mp_lock);
+		if (mp->mp_head == mp->mp_tail)
+			break;
+		idx = mp->mp_queue[mp->mp_head++];
+		(void) pthread_mutex_unlock(&mp->mp_lock);
+
+		error = mp->mp_func(mp->mp_nodes[idx].mn_zhp, mp->mp_data);
+
+		(void) pthread_mutex_lock(&mp->mp_lock);
+		if (error != 0)
+			mp->mp_ret = -1;
+
+		/* Whatever is mounted below us can go now */
+		mount_pool_queue_children(mp, idx);
+		if (--mp->mp_pending == 0)
+			(void) pthread_cond_broadcast(&mp->mp_cv);
+	}
+	(void) pthread_mutex_unlock(&mp->mp_lock);
+
+	return (NULL);
+}
+
+/*
+ * Call func on each of the handles, parents before the filesystems
+ * mounted below them.  If parallel is set, the subtrees of independent
+ * mountpoints are processed concurrently by a pool of threads, and func
+ * must be safe to call from several threads at once.  Returns -1 if func
+ * failed for any handle.
+ */
+int
+zfs_foreach_mountpoint(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    size_t num_handles, zfs_iter_f func, void *data, boolean_t parallel)
+{
+	mount_pool_t mp = { 0 };
+	pthread_t threads[MOUNT_THREADS_MAX];
+	size_t *stack;
+	size_t i, depth, nthreads;
+
+	if (num_handles == 0)
+		return (0);
+
+	mp.mp_nodes = zfs_alloc(hdl, num_handles * sizeof (mount_node_t));
+	mp.mp_queue = zfs_alloc(hdl, num_handles * sizeof (size_t));
+	stack = zfs_alloc(hdl, num_handles * sizeof (size_t));
+	mp.mp_num = num_handles;
+	mp.mp_func = func;
+	mp.mp_data = data;
+
+	for (i = 0; i < num_handles; i++) {
+		mount_node_t *mn = &mp.mp_nodes[i];
+
+		mn->mn_zhp = handles[i];
+		if (zfs_get_type(mn->mn_zhp) != ZFS_TYPE_FILESYSTEM ||
+		    zfs_prop_get(mn->mn_zhp, ZFS_PROP_MOUNTPOINT,
+		    mn->mn_mountpoint, sizeof (mn->mn_mountpoint),
+		    NULL, NULL, 0, B_FALSE) != 0)
+			mn->mn_mountpoint[0] = '\0';
+	}
+	qsort(mp.mp_nodes, num_handles, sizeof (mount_node_t),
+	    mountpoint_cmp);
+
+	/* Find where each subtree ends, with a stack of open ancestors */
+	for (i = 0, depth = 0; i < num_handles; i++) {
+		while (depth > 0 &&
+		    !mountpoint_is_below(mp.mp_nodes[stack[depth - 1]].
+		    mn_mountpoint, mp.mp_nodes[i].mn_mountpoint))
+			mp.mp_nodes[stack[--depth]].mn_end = i;
+		stack[depth++] = i;
+	}
+	while (depth > 0)
+		mp.mp_nodes[stack[--depth]].mn_end = num_handles;
+	free(stack);
+
+	if (!parallel) {
+		for (i = 0; i < num_handles; i++) {
+			if (func(mp.mp_nodes[i].mn_zhp, data) != 0)
+				mp.mp_ret = -1;
+		}
+		goto out;
+	}
+
+	(void) pthread_mutex_init(&mp.mp_lock, NULL);
+	(void) pthread_cond_init(&mp.mp_cv, NULL);
+	mount_pool_queue_children(&mp, num_handles);
+
+	/* The calling thread is one of the workers */
+	nthreads = 0;
+	while (nthreads < MIN(num_handles, MOUNT_THREADS_MAX) - 1) {
+		if (pthread_create(&threads[nthreads], NULL,
+		    mount_pool_worker, &mp) != 0)
+			break;
+		nthreads++;
+	}
+	(void) mount_pool_worker(&mp);
+	for (i = 0; i < nthreads; i++)
+		(void) pthread_join(threads[i], NULL);
+
+	(void) pthread_cond_destroy(&mp.mp_cv);
+	(void) pthread_mutex_destroy(&mp.mp_lock);
+out:
+	free(mp.mp_queue);
+	free(mp.mp_nodes);
+	return (mp.mp_ret);
+}
+
+typedef struct mount_one_arg {
+	const char	*ma_mntopts;
+	int		ma_flags;
+} mount_one_arg_t;
+
+static int
+zfs_mount_one(zfs_handle_t *zhp, void *arg)
+{
+	mount_one_arg_t *ma = arg;
+
+	return (zfs_mount(zhp, ma->ma_mntopts, ma->ma_flags));
+}
+
+static int
+zfs_share_one(zfs_handle_t *zhp, void *arg)
+{
+	if (!zfs_is_mounted(zhp, NULL))
+		return (0);
+	return (zfs_share(zhp));
+}
+
 /*
  * Mount and share all datasets within the given pool.  This assumes that no
  * datasets within the pool are currently mounted.  Because users can create
  * complicated nested hierarchies of mountpoints, we first gather all the
- * datasets and mountpoints within the pool, and sort them by mountpoint.  Once
- * we have the list of all filesystems, we iterate over them in order and mount
- * and/or share each one.
+ * datasets and mountpoints within the pool.  They are then mounted by
+ * zfs_foreach_mountpoint(), which mounts independent subtrees of the
+ * mountpoint hierarchy in parallel, and then shared one at a time.
  */
 int
 zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
@@ -1579,8 +1804,8 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	get_all_cb_t cb = { 0 };
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
 	zfs_handle_t *zfsp;
+	mount_one_arg_t ma;
 	int i, ret = -1;
-	int *good;
 	/*
 	 * Gather all non-snap datasets within the pool.
 	 */
@@ -1590,40 +1815,23 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	libzfs_add_handle(&cb, zfsp);
 	if (zfs_iter_filesystems(zfsp, mount_cb, &cb) != 0)
 		goto out;
-	/*
-	 * Sort the datasets by mountpoint.
-	 */
-	qsort(cb.cb_handles, cb.cb_used, sizeof (void *),
-	    libzfs_dataset_cmp);
 
 	/*
-	 * And mount all the datasets, keeping track of which ones
-	 * succeeded or failed.
+	 * Mount all the datasets, parents before their children.
 	 */
-	if ((good = zfs_alloc(zhp->zpool_hdl,
-	    cb.cb_used * sizeof (int))) == NULL)
-		goto out;
-
-	ret = 0;
-	for (i = 0; i < cb.cb_used; i++) {
-		if (zfs_mount(cb.cb_handles[i], mntopts, flags) != 0)
-			ret = -1;
-		else
-			good[i] = 1;
-	}
+	ma.ma_mntopts = mntopts;
+	ma.ma_flags = flags;
+	ret = zfs_foreach_mountpoint(hdl, cb.cb_handles, cb.cb_used,
+	    zfs_mount_one, &ma, B_TRUE);
 
 	/*
-	 * Then share all the ones that need to be shared. This needs
+	 * Then share all the ones that were mounted. This needs
 	 * to be a separate pass in order to avoid excessive reloading
-	 * of the configuration. Good should never be NULL since
-	 * zfs_alloc is supposed to exit if memory isn't available.
+	 * of the configuration.
 	 */
-	for (i = 0; i < cb.cb_used; i++) {
-		if (good[i] && zfs_share(cb.cb_handles[i]) != 0)
-			ret = -1;
-	}
-
-	free(good);
+	if (zfs_foreach_mountpoint(hdl, cb.cb_handles, cb.cb_used,
+	    zfs_share_one, NULL, B_FALSE) != 0)
+		ret = -1;
 
 out:
 	for (i = 0; i < cb.cb_used; i++)
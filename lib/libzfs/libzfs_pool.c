@@ -308,8 +308,11 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 		case ZPOOL_PROP_ALLOCATED:
 		case ZPOOL_PROP_FREE:
 		case ZPOOL_PROP_FREEING:
+		case ZPOOL_PROP_FREERATE:
 		case ZPOOL_PROP_LEAKED:
 		case ZPOOL_PROP_ASHIFT:
+		case ZPOOL_PROP_SCANRATE:
+		case ZPOOL_PROP_DEDUPQUOTA:
 			if (literal)
 				(void) snprintf(buf, len, "%llu",
 					(u_longlong_t)intval);
@@ -1698,14 +1701,19 @@ print_vdev_tree(libzfs_handle_t *hdl, const char *name, nvlist_t *nv,
 	nvlist_t *display;
 	uint_t c, children;
 	char *vname;
-	uint64_t is_log = 0;
+	uint64_t is_log = 0, is_special = 0, is_dedup = 0;
 
 	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG,
 	    &is_log);
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL,
+	    &is_special);
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_DEDUP,
+	    &is_dedup);
 
 	if (name != NULL)
 		(void) printf("\t%*s%s%s\n", indent, "", name,
-		    is_log ? " [log]" : "");
+		    is_log ? " [log]" : is_special ? " [special]" :
+		    is_dedup ? " [dedup]" : "");
 
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) != 0)
@@ -1956,16 +1964,33 @@ zpool_import_props(libzfs_handle_t *hdl, nvlist_t *config, const char *newname,
  */
 int
 zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func)
+{
+	return (zpool_scan_restricted(zhp, func, NULL));
+}
+
+/*
+ * Scan the pool, a scrub restricted as given by the ZPOOL_SCAN_* entries
+ * of opts (if not NULL) to a txg range and a set of datasets.
+ */
+int
+zpool_scan_restricted(zpool_handle_t *zhp, pool_scan_func_t func,
+    nvlist_t *opts)
 {
 	zfs_cmd_t zc = {"\0"};
 	char msg[1024];
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
+	int err;
 
 	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
 	zc.zc_cookie = func;
 
-	if (zfs_ioctl(hdl, ZFS_IOC_POOL_SCAN, &zc) == 0 ||
-	    (errno == ENOENT && func != POOL_SCAN_NONE))
+	if (opts != NULL && zcmd_write_src_nvlist(hdl, &zc, opts) != 0)
+		return (-1);
+
+	err = zfs_ioctl(hdl, ZFS_IOC_POOL_SCAN, &zc);
+	zcmd_free_nvlists(&zc);
+	if (err == 0 ||
+	    (errno == ENOENT && func != POOL_SCAN_NONE && opts == NULL))
 		return (0);
 
 	if (func == POOL_SCAN_SCRUB) {
@@ -1992,13 +2017,42 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func)
 			return (zfs_error(hdl, EZFS_SCRUBBING, msg));
 		else
 			return (zfs_error(hdl, EZFS_RESILVERING, msg));
-	} else if (errno == ENOENT) {
+	} else if (errno == ENOENT && opts == NULL) {
 		return (zfs_error(hdl, EZFS_NO_SCRUB, msg));
 	} else {
 		return (zpool_standard_error(hdl, errno, msg));
 	}
 }
 
+/*
+ * Unmap the free space of the pool, at no more than rate bytes/sec.
+ */
+int
+zpool_trim(zpool_handle_t *zhp, pool_trim_func_t func, uint64_t rate)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_cookie = func;
+	zc.zc_obj = rate;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_POOL_TRIM, &zc) == 0)
+		return (0);
+
+	if (func == POOL_TRIM_STOP) {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot cancel trimming %s"),
+		    zc.zc_name);
+	} else {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot trim %s"), zc.zc_name);
+	}
+
+	return (zpool_standard_error(hdl, errno, msg));
+}
+
 #ifdef illumos
 
 /*
@@ -3022,6 +3076,7 @@ zpool_vdev_split(zpool_handle_t *zhp, char *newname, nvlist_t **newroot,
 
 	for (c = 0; c < children; c++) {
 		uint64_t is_log = B_FALSE, is_hole = B_FALSE;
+		uint64_t is_special = B_FALSE, is_dedup = B_FALSE;
 		char *type;
 		nvlist_t **mchild, *vdev;
 		uint_t mchildren;
@@ -3079,6 +3134,18 @@ zpool_vdev_split(zpool_handle_t *zhp, char *newname, nvlist_t **newroot,
 
 		if (nvlist_dup(vdev, &varray[vcount++], 0) != 0)
 			goto out;
+
+		/* a split special or dedup mirror keeps its class */
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_SPECIAL,
+		    &is_special);
+		if (is_special && nvlist_add_uint64(varray[vcount - 1],
+		    ZPOOL_CONFIG_IS_SPECIAL, is_special) != 0)
+			goto out;
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_DEDUP,
+		    &is_dedup);
+		if (is_dedup && nvlist_add_uint64(varray[vcount - 1],
+		    ZPOOL_CONFIG_IS_DEDUP, is_dedup) != 0)
+			goto out;
 	}
 
 	/* did we find every disk the user specified? */
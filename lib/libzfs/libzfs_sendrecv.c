@@ -92,14 +92,43 @@ typedef struct progress_arg {
 	boolean_t pa_parsable;
 } progress_arg_t;
 
+/*
+ * A ring buffer between the send streams and the output fd (see
+ * send_buffer_start()).
+ */
+typedef struct send_buffer {
+	int sb_fd;		/* write end of the pipe, handed out */
+	int sb_infd;		/* read end of the pipe */
+	int sb_outfd;
+	char *sb_buf;
+	size_t sb_size;
+	size_t sb_chunk;	/* smallest write to sb_outfd before EOF */
+	size_t sb_head;		/* offset in sb_buf of the first byte */
+	size_t sb_len;		/* bytes in sb_buf */
+	boolean_t sb_eof;
+	int sb_err;		/* errno of the failed write to sb_outfd */
+	pthread_mutex_t sb_lock;
+	pthread_cond_t sb_cv;
+	pthread_t sb_filler;
+	pthread_t sb_drainer;
+} send_buffer_t;
+
+#define	SEND_BUFFER_CHUNK	(1024 * 1024)
+
 typedef struct dataref {
 	uint64_t ref_guid;
 	uint64_t ref_object;
 	uint64_t ref_offset;
 } dataref_t;
 
+/*
+ * The dedup table is open-addressed: its entries live in the hash array
+ * itself, and a lookup probes at most DDT_PROBE_MAX consecutive slots
+ * from the one the checksum hashes to.  A slot with a zero checksum is
+ * free.  Once the probed slots are all taken, a new entry replaces one of
+ * them, so the table stays within its size however long the stream is.
+ */
 typedef struct dedup_entry {
-	struct dedup_entry	*dde_next;
 	zio_cksum_t dde_chksum;
 	uint64_t dde_prop;
 	dataref_t dde_ref;
@@ -107,17 +136,40 @@ typedef struct dedup_entry {
 
 #define	MAX_DDT_PHYSMEM_PERCENT		20
 #define	SMALLEST_POSSIBLE_MAX_DDT_MB		128
+#define	DDT_PROBE_MAX			16
 
 typedef struct dedup_table {
-	dedup_entry_t	**dedup_hash_array;
-	umem_cache_t	*ddecache;
+	dedup_entry_t	*dedup_hash_array;
 	uint64_t	max_ddt_size;  /* max dedup table size in bytes */
-	uint64_t	cur_ddt_size;  /* current dedup table size in bytes */
 	uint64_t	ddt_count;
+	uint64_t	ddt_replaced;  /* entries replaced by newer ones */
 	int		numhashbits;
 	boolean_t	ddt_full;
 } dedup_table_t;
 
+/*
+ * cksummer() reads the stream a batch of records at a time.  The WRITE
+ * records of a batch that have no dedup-capable checksum are then hashed
+ * by up to DEDUP_HASHERS_MAX threads and cksummer() itself in parallel,
+ * before the batch is looked up in the DDT and written out in order.
+ */
+#define	DEDUP_BATCH_RECORDS	256
+#define	DEDUP_BATCH_BYTES	(16 * 1024 * 1024)
+#define	DEDUP_HASHERS_MAX	8
+
+typedef struct dedup_hashers {
+	pthread_mutex_t	dh_lock;
+	pthread_cond_t	dh_cv;
+	struct drr_write *dh_drrw[DEDUP_BATCH_RECORDS];
+	void		*dh_buf[DEDUP_BATCH_RECORDS];
+	int		dh_njobs;
+	int		dh_next;	/* next job to take */
+	int		dh_pending;	/* jobs not yet done */
+	boolean_t	dh_exit;
+	int		dh_nthreads;
+	pthread_t	dh_threads[DEDUP_HASHERS_MAX];
+} dedup_hashers_t;
+
 static int
 high_order_bit(uint64_t n)
 {
@@ -139,35 +191,6 @@ ssread(void *buf, size_t len, FILE *stream)
 	return (outlen);
 }
 
-static void
-ddt_hash_append(libzfs_handle_t *hdl, dedup_table_t *ddt, dedup_entry_t **ddepp,
-    zio_cksum_t *cs, uint64_t prop, dataref_t *dr)
-{
-	dedup_entry_t	*dde;
-
-	if (ddt->cur_ddt_size >= ddt->max_ddt_size) {
-		if (ddt->ddt_full == B_FALSE) {
-			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "Dedup table full.  Deduplication will continue "
-			    "with existing table entries"));
-			ddt->ddt_full = B_TRUE;
-		}
-		return;
-	}
-
-	if ((dde = umem_cache_alloc(ddt->ddecache, UMEM_DEFAULT))
-	    != NULL) {
-		assert(*ddepp == NULL);
-		dde->dde_next = NULL;
-		dde->dde_chksum = *cs;
-		dde->dde_prop = prop;
-		dde->dde_ref = *dr;
-		*ddepp = dde;
-		ddt->cur_ddt_size += sizeof (dedup_entry_t);
-		ddt->ddt_count++;
-	}
-}
-
 /*
  * Using the specified dedup table, do a lookup for an entry with
  * the checksum cs.  If found, return the block's reference info
@@ -181,23 +204,169 @@ static boolean_t
 ddt_update(libzfs_handle_t *hdl, dedup_table_t *ddt, zio_cksum_t *cs,
     uint64_t prop, dataref_t *dr)
 {
-	uint32_t hashcode;
-	dedup_entry_t **ddepp;
+	uint64_t mask = (1ULL << ddt->numhashbits) - 1;
+	uint64_t hashcode;
+	dedup_entry_t *dde;
+	int i;
 
 	hashcode = BF64_GET(cs->zc_word[0], 0, ddt->numhashbits);
 
-	for (ddepp = &(ddt->dedup_hash_array[hashcode]); *ddepp != NULL;
-	    ddepp = &((*ddepp)->dde_next)) {
-		if (ZIO_CHECKSUM_EQUAL(((*ddepp)->dde_chksum), *cs) &&
-		    (*ddepp)->dde_prop == prop) {
-			*dr = (*ddepp)->dde_ref;
+	for (i = 0; i < DDT_PROBE_MAX; i++) {
+		dde = &ddt->dedup_hash_array[(hashcode + i) & mask];
+		if (ZIO_CHECKSUM_IS_ZERO(&dde->dde_chksum))
+			break;
+		if (ZIO_CHECKSUM_EQUAL(dde->dde_chksum, *cs) &&
+		    dde->dde_prop == prop) {
+			*dr = dde->dde_ref;
 			return (B_TRUE);
 		}
 	}
-	ddt_hash_append(hdl, ddt, ddepp, cs, prop, dr);
+
+	if (i == DDT_PROBE_MAX) {
+		if (ddt->ddt_full == B_FALSE) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Dedup table full.  Deduplication will continue "
+			    "replacing older table entries"));
+			ddt->ddt_full = B_TRUE;
+		}
+		/* rotate through the probed slots rather than favor one */
+		dde = &ddt->dedup_hash_array[(hashcode +
+		    ddt->ddt_replaced++ % DDT_PROBE_MAX) & mask];
+	} else {
+		ddt->ddt_count++;
+	}
+	dde->dde_chksum = *cs;
+	dde->dde_prop = prop;
+	dde->dde_ref = *dr;
 	return (B_FALSE);
 }
 
+/*
+ * Return true if the payload of a WRITE record must be hashed before it
+ * can be looked up in the DDT.
+ */
+static boolean_t
+dedup_hash_needed(struct drr_write *drrw)
+{
+	return (ZIO_CHECKSUM_EQUAL(drrw->drr_key.ddk_cksum, zero_cksum) ||
+	    !DRR_IS_DEDUP_CAPABLE(drrw->drr_checksumflags));
+}
+
+/*
+ * Use the existing checksum if it's dedup-capable, else calculate a SHA256
+ * checksum for it.
+ */
+static void
+dedup_hash_write(struct drr_write *drrw, void *buf)
+{
+	SHA256_CTX	ctx;
+	zio_cksum_t tmpsha256;
+
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, buf, DRR_WRITE_PAYLOAD_SIZE(drrw));
+	SHA256Final(&tmpsha256, &ctx);
+
+	drrw->drr_key.ddk_cksum.zc_word[0] = BE_64(tmpsha256.zc_word[0]);
+	drrw->drr_key.ddk_cksum.zc_word[1] = BE_64(tmpsha256.zc_word[1]);
+	drrw->drr_key.ddk_cksum.zc_word[2] = BE_64(tmpsha256.zc_word[2]);
+	drrw->drr_key.ddk_cksum.zc_word[3] = BE_64(tmpsha256.zc_word[3]);
+	drrw->drr_checksumtype = ZIO_CHECKSUM_SHA256;
+	drrw->drr_checksumflags = DRR_CHECKSUM_DEDUP;
+}
+
+/*
+ * Take and do hashing jobs until none are left.  Called with dh_lock held.
+ */
+static void
+dedup_hashers_work(dedup_hashers_t *dh)
+{
+	int job;
+
+	while (dh->dh_next < dh->dh_njobs) {
+		job = dh->dh_next++;
+		(void) pthread_mutex_unlock(&dh->dh_lock);
+		dedup_hash_write(dh->dh_drrw[job], dh->dh_buf[job]);
+		(void) pthread_mutex_lock(&dh->dh_lock);
+		if (--dh->dh_pending == 0)
+			(void) pthread_cond_broadcast(&dh->dh_cv);
+	}
+}
+
+static void *
+dedup_hasher(void *arg)
+{
+	dedup_hashers_t *dh = arg;
+
+	(void) pthread_mutex_lock(&dh->dh_lock);
+	for (;;) {
+		dedup_hashers_work(dh);
+		if (dh->dh_exit)
+			break;
+		(void) pthread_cond_wait(&dh->dh_cv, &dh->dh_lock);
+	}
+	(void) pthread_mutex_unlock(&dh->dh_lock);
+
+	return (NULL);
+}
+
+/*
+ * Hash the "njobs" queued WRITE records, with the help of the hashers.
+ * Not a cancellation point, so that a cancel of cksummer() can't leave the
+ * hashers' lock held.
+ */
+static void
+dedup_hash_batch(dedup_hashers_t *dh, int njobs)
+{
+	int state;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	(void) pthread_mutex_lock(&dh->dh_lock);
+	dh->dh_njobs = njobs;
+	dh->dh_next = 0;
+	dh->dh_pending = njobs;
+	(void) pthread_cond_broadcast(&dh->dh_cv);
+	dedup_hashers_work(dh);
+	while (dh->dh_pending != 0)
+		(void) pthread_cond_wait(&dh->dh_cv, &dh->dh_lock);
+	dh->dh_njobs = dh->dh_next = 0;
+	(void) pthread_mutex_unlock(&dh->dh_lock);
+	(void) pthread_setcancelstate(state, NULL);
+}
+
+static void
+dedup_hashers_start(dedup_hashers_t *dh)
+{
+	long nthreads = MIN(sysconf(_SC_NPROCESSORS_ONLN) - 1,
+	    DEDUP_HASHERS_MAX);
+
+	bzero(dh, sizeof (*dh));
+	(void) pthread_mutex_init(&dh->dh_lock, NULL);
+	(void) pthread_cond_init(&dh->dh_cv, NULL);
+	while (dh->dh_nthreads < nthreads) {
+		if (pthread_create(&dh->dh_threads[dh->dh_nthreads], NULL,
+		    dedup_hasher, dh) != 0)
+			break;
+		dh->dh_nthreads++;
+	}
+}
+
+/* Also the cleanup handler for a cancel of cksummer(). */
+static void
+dedup_hashers_stop(void *arg)
+{
+	dedup_hashers_t *dh = arg;
+	int i;
+
+	(void) pthread_mutex_lock(&dh->dh_lock);
+	dh->dh_exit = B_TRUE;
+	(void) pthread_cond_broadcast(&dh->dh_cv);
+	(void) pthread_mutex_unlock(&dh->dh_lock);
+	for (i = 0; i < dh->dh_nthreads; i++)
+		(void) pthread_join(dh->dh_threads[i], NULL);
+	(void) pthread_cond_destroy(&dh->dh_cv);
+	(void) pthread_mutex_destroy(&dh->dh_lock);
+}
+
 static int
 dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
     zio_cksum_t *zc, int outfd)
@@ -224,6 +393,100 @@ dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
 }
 
 
+/*
+ * Write out a record of the stream, other than its BEGIN record, whose
+ * payload has been read into buf.  Returns nonzero if the write failed.
+ */
+static int
+dedup_dump_record(dedup_arg_t *dda, dedup_table_t *ddt,
+    dmu_replay_record_t *drr, void *buf, int len, zio_cksum_t *stream_cksum,
+    int outfd)
+{
+	switch (drr->drr_type) {
+	case DRR_END:
+	{
+		struct drr_end *drre = &drr->drr_u.drr_end;
+		/* use the recalculated checksum */
+		drre->drr_checksum = *stream_cksum;
+		return (dump_record(drr, NULL, 0, stream_cksum, outfd));
+	}
+
+	case DRR_OBJECT:
+	case DRR_SPILL:
+	case DRR_FREEOBJECTS:
+	case DRR_WRITE_EMBEDDED:
+	case DRR_FREE:
+		return (dump_record(drr, buf, len, stream_cksum, outfd));
+
+	case DRR_WRITE:
+	{
+		struct drr_write *drrw = &drr->drr_u.drr_write;
+		dataref_t	dataref;
+
+		dataref.ref_guid = drrw->drr_toguid;
+		dataref.ref_object = drrw->drr_object;
+		dataref.ref_offset = drrw->drr_offset;
+
+		if (ddt_update(dda->dedup_hdl, ddt,
+		    &drrw->drr_key.ddk_cksum, drrw->drr_key.ddk_prop,
+		    &dataref)) {
+			dmu_replay_record_t wbr_drr = {0};
+			struct drr_write_byref *wbr_drrr =
+			    &wbr_drr.drr_u.drr_write_byref;
+
+			/* block already present in stream */
+			wbr_drr.drr_type = DRR_WRITE_BYREF;
+
+			wbr_drrr->drr_object = drrw->drr_object;
+			wbr_drrr->drr_offset = drrw->drr_offset;
+			wbr_drrr->drr_length = drrw->drr_logical_size;
+			wbr_drrr->drr_toguid = drrw->drr_toguid;
+			wbr_drrr->drr_refguid = dataref.ref_guid;
+			wbr_drrr->drr_refobject = dataref.ref_object;
+			wbr_drrr->drr_refoffset = dataref.ref_offset;
+
+			wbr_drrr->drr_checksumtype = drrw->drr_checksumtype;
+			wbr_drrr->drr_checksumflags = drrw->drr_checksumtype;
+			wbr_drrr->drr_key.ddk_cksum = drrw->drr_key.ddk_cksum;
+			wbr_drrr->drr_key.ddk_prop = drrw->drr_key.ddk_prop;
+
+			return (dump_record(&wbr_drr, NULL, 0, stream_cksum,
+			    outfd));
+		}
+		/* block not previously seen */
+		return (dump_record(drr, buf, len, stream_cksum, outfd));
+	}
+
+	default:
+		(void) printf("INVALID record type 0x%x\n", drr->drr_type);
+		/* should never happen, so assert */
+		assert(B_FALSE);
+		return (0);
+	}
+}
+
+/*
+ * Return the length of the payload that follows a record other than BEGIN.
+ */
+static int
+dedup_payload_len(dmu_replay_record_t *drr)
+{
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		return (P2ROUNDUP((uint64_t)drr->drr_u.drr_object.drr_bonuslen,
+		    8));
+	case DRR_SPILL:
+		return (drr->drr_u.drr_spill.drr_length);
+	case DRR_WRITE:
+		return (DRR_WRITE_PAYLOAD_SIZE(&drr->drr_u.drr_write));
+	case DRR_WRITE_EMBEDDED:
+		return (P2ROUNDUP(
+		    (uint64_t)drr->drr_u.drr_write_embedded.drr_psize, 8));
+	default:
+		return (0);
+	}
+}
+
 /*
  * This function is started in a separate thread when the dedup option
  * has been requested.  The main send thread determines the list of
@@ -240,22 +503,34 @@ dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
  *      a duplicate block is found.
  * The output of this function then goes to the output fd requested
  * by the caller of zfs_send().
+ *
+ * The records are read in batches (see dedup_hashers_t), so that the
+ * checksums of step 2 can be computed in parallel.
  */
 static void *
 cksummer(void *arg)
 {
 	dedup_arg_t *dda = arg;
 	char *buf = zfs_alloc(dda->dedup_hdl, SPA_MAXBLOCKSIZE);
+	char *batchbuf = zfs_alloc(dda->dedup_hdl,
+	    DEDUP_BATCH_BYTES + SPA_MAXBLOCKSIZE);
+	dmu_replay_record_t *drrs = zfs_alloc(dda->dedup_hdl,
+	    DEDUP_BATCH_RECORDS * sizeof (dmu_replay_record_t));
+	char *bufs[DEDUP_BATCH_RECORDS];
+	int lens[DEDUP_BATCH_RECORDS];
 	dmu_replay_record_t thedrr;
 	dmu_replay_record_t *drr = &thedrr;
+	boolean_t have_begin = B_FALSE;
+	boolean_t eof = B_FALSE;
+	dedup_hashers_t dh;
 	FILE *ofp;
 	int outfd;
-	dmu_replay_record_t wbr_drr = {0};
-	dedup_table_t ddt;
+	dedup_table_t ddt = { 0 };
 	zio_cksum_t stream_cksum;
     size_t len;
 	uint64_t physmem = 0;
 	uint64_t numbuckets;
+	int bufsize = SPA_MAXBLOCKSIZE;
 
     len = sizeof(physmem);
     sysctlbyname("hw.memsize", &physmem, &len, NULL, 0);
@@ -267,44 +542,83 @@ cksummer(void *arg)
 	numbuckets = ddt.max_ddt_size/(sizeof (dedup_entry_t));
 
 	/*
-	 * numbuckets must be a power of 2.  Increase number to
-	 * a power of 2 if necessary.
+	 * numbuckets must be a power of 2.  Decrease number to
+	 * a power of 2 if necessary, to stay within max_ddt_size.
 	 */
 	if (!ISP2(numbuckets))
-		numbuckets = 1 << high_order_bit(numbuckets);
+		numbuckets = 1ULL << (high_order_bit(numbuckets) - 1);
 
-	ddt.dedup_hash_array = calloc(numbuckets, sizeof (dedup_entry_t *));
-	ddt.ddecache = umem_cache_create("dde", sizeof (dedup_entry_t), 0,
-	    NULL, NULL, NULL, NULL, NULL, 0);
-	ddt.cur_ddt_size = numbuckets * sizeof (dedup_entry_t *);
+	ddt.dedup_hash_array = calloc(numbuckets, sizeof (dedup_entry_t));
 	ddt.numhashbits = high_order_bit(numbuckets) - 1;
 	ddt.ddt_full = B_FALSE;
 
-	/* Initialize the write-by-reference block. */
-	wbr_drr.drr_type = DRR_WRITE_BYREF;
-	wbr_drr.drr_payloadlen = 0;
+	dedup_hashers_start(&dh);
+	pthread_cleanup_push(dedup_hashers_stop, &dh);
 
 	outfd = dda->outputfd;
 	ofp = fdopen(dda->inputfd, "r");
-	while (ssread(drr, sizeof (dmu_replay_record_t), ofp) != 0) {
+	while (!eof) {
+		size_t used = 0;
+		int n = 0, njobs = 0;
 
-		/*
-		 * kernel filled in checksum, we are going to write same
-		 * record, but need to regenerate checksum.
-		 */
-		if (drr->drr_type != DRR_BEGIN) {
-			bzero(&drr->drr_u.drr_checksum.drr_checksum,
-			    sizeof (drr->drr_u.drr_checksum.drr_checksum));
+		while (n < DEDUP_BATCH_RECORDS && used < DEDUP_BATCH_BYTES) {
+			dmu_replay_record_t *bdrr = &drrs[n];
+
+			if (ssread(drr, sizeof (dmu_replay_record_t),
+			    ofp) == 0) {
+				eof = B_TRUE;
+				break;
+			}
+
+			/*
+			 * A BEGIN record is written out on its own, after
+			 * the records that were read before it.
+			 */
+			if (drr->drr_type == DRR_BEGIN) {
+				have_begin = B_TRUE;
+				break;
+			}
+
+			/*
+			 * kernel filled in checksum, we are going to write
+			 * same record, but need to regenerate checksum.
+			 */
+			*bdrr = *drr;
+			bzero(&bdrr->drr_u.drr_checksum.drr_checksum,
+			    sizeof (bdrr->drr_u.drr_checksum.drr_checksum));
+
+			bufs[n] = batchbuf + used;
+			lens[n] = dedup_payload_len(bdrr);
+			if (lens[n] != 0)
+				(void) ssread(bufs[n], lens[n], ofp);
+			used += lens[n];
+
+			if (bdrr->drr_type == DRR_WRITE &&
+			    dedup_hash_needed(&bdrr->drr_u.drr_write)) {
+				dh.dh_drrw[njobs] = &bdrr->drr_u.drr_write;
+				dh.dh_buf[njobs] = bufs[n];
+				njobs++;
+			}
+			/* don't hold the end of a stream back */
+			if (drrs[n++].drr_type == DRR_END)
+				break;
 		}
 
-		switch (drr->drr_type) {
-		case DRR_BEGIN:
-		{
+		if (njobs != 0)
+			dedup_hash_batch(&dh, njobs);
+		for (int i = 0; i < n; i++) {
+			if (dedup_dump_record(dda, &ddt, &drrs[i], bufs[i],
+			    lens[i], &stream_cksum, outfd) != 0)
+				goto out;
+		}
+
+		if (have_begin) {
 			struct drr_begin *drrb = &drr->drr_u.drr_begin;
 			int fflags;
 			int sz = 0;
 			ZIO_SET_CHECKSUM(&stream_cksum, 0, 0, 0, 0);
 
+			have_begin = B_FALSE;
 			ASSERT3U(drrb->drr_magic, ==, DMU_BACKUP_MAGIC);
 
 			/* set the DEDUP feature flag for this stream */
@@ -316,9 +630,10 @@ cksummer(void *arg)
 			if (drr->drr_payloadlen != 0) {
 				sz = drr->drr_payloadlen;
 
-				if (sz > SPA_MAXBLOCKSIZE) {
+				if (sz > bufsize) {
 					buf = zfs_realloc(dda->dedup_hdl, buf,
-					    SPA_MAXBLOCKSIZE, sz);
+					    bufsize, sz);
+					bufsize = sz;
 				}
 				(void) ssread(buf, sz, ofp);
 				if (ferror(stdin))
@@ -327,169 +642,166 @@ cksummer(void *arg)
 			if (dump_record(drr, buf, sz, &stream_cksum,
 			    outfd) != 0)
 				goto out;
-			break;
 		}
+	}
+out:
+	pthread_cleanup_pop(1);
+	free(ddt.dedup_hash_array);
+	free(drrs);
+	free(batchbuf);
+	free(buf);
+	(void) fclose(ofp);
 
-		case DRR_END:
-		{
-			struct drr_end *drre = &drr->drr_u.drr_end;
-			/* use the recalculated checksum */
-			drre->drr_checksum = stream_cksum;
-			if (dump_record(drr, NULL, 0, &stream_cksum,
-			    outfd) != 0)
-				goto out;
-			break;
-		}
+	return (NULL);
+}
 
-		case DRR_OBJECT:
-		{
-			struct drr_object *drro = &drr->drr_u.drr_object;
-			if (drro->drr_bonuslen > 0) {
-				(void) ssread(buf,
-				    P2ROUNDUP((uint64_t)drro->drr_bonuslen, 8),
-				    ofp);
-			}
-			if (dump_record(drr, buf,
-			    P2ROUNDUP((uint64_t)drro->drr_bonuslen, 8),
-			    &stream_cksum, outfd) != 0)
-				goto out;
-			break;
-		}
+/*
+ * Read the pipe into the ring until EOF.  If writing the ring out fails we
+ * close the pipe, so that the send fails as it would have writing to the
+ * output fd itself.
+ */
+static void *
+send_buffer_filler(void *arg)
+{
+	send_buffer_t *sb = arg;
+	size_t tail, len;
+	ssize_t rv;
 
-		case DRR_SPILL:
-		{
-			struct drr_spill *drrs = &drr->drr_u.drr_spill;
-			(void) ssread(buf, drrs->drr_length, ofp);
-			if (dump_record(drr, buf, drrs->drr_length,
-			    &stream_cksum, outfd) != 0)
-				goto out;
+	(void) pthread_mutex_lock(&sb->sb_lock);
+	for (;;) {
+		while (sb->sb_len == sb->sb_size && sb->sb_err == 0)
+			(void) pthread_cond_wait(&sb->sb_cv, &sb->sb_lock);
+		if (sb->sb_err != 0)
 			break;
-		}
-
-		case DRR_FREEOBJECTS:
-		{
-			if (dump_record(drr, NULL, 0, &stream_cksum,
-							outfd) != 0)
-				goto out;
+		tail = (sb->sb_head + sb->sb_len) % sb->sb_size;
+		len = MIN(sb->sb_size - sb->sb_len, sb->sb_size - tail);
+		(void) pthread_mutex_unlock(&sb->sb_lock);
+		rv = read(sb->sb_infd, sb->sb_buf + tail, len);
+		(void) pthread_mutex_lock(&sb->sb_lock);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv <= 0)
 			break;
-		}
-
-		case DRR_WRITE:
-		{
- 			struct drr_write *drrw = &drr->drr_u.drr_write;
-			dataref_t	dataref;
-			uint64_t	payload_size;
-
-			payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
-			(void) ssread(buf, payload_size, ofp);
+		sb->sb_len += rv;
+		(void) pthread_cond_broadcast(&sb->sb_cv);
+	}
+	(void) close(sb->sb_infd);
+	sb->sb_infd = -1;
+	sb->sb_eof = B_TRUE;
+	(void) pthread_cond_broadcast(&sb->sb_cv);
+	(void) pthread_mutex_unlock(&sb->sb_lock);
 
-			/*
-			 * Use the existing checksum if it's dedup-capable,
-			 * else calculate a SHA256 checksum for it.
-			 */
+	return (NULL);
+}
 
-			if (ZIO_CHECKSUM_EQUAL(drrw->drr_key.ddk_cksum,
-			    zero_cksum) ||
-			    !DRR_IS_DEDUP_CAPABLE(drrw->drr_checksumflags)) {
-				SHA256_CTX	ctx;
-				zio_cksum_t tmpsha256;
-
-				SHA256Init(&ctx);
-				SHA256Update(&ctx, buf, payload_size);
-				SHA256Final(&tmpsha256, &ctx);
-
-				drrw->drr_key.ddk_cksum.zc_word[0] =
-				    BE_64(tmpsha256.zc_word[0]);
-				drrw->drr_key.ddk_cksum.zc_word[1] =
-				    BE_64(tmpsha256.zc_word[1]);
-				drrw->drr_key.ddk_cksum.zc_word[2] =
-				    BE_64(tmpsha256.zc_word[2]);
-				drrw->drr_key.ddk_cksum.zc_word[3] =
-				    BE_64(tmpsha256.zc_word[3]);
-				drrw->drr_checksumtype = ZIO_CHECKSUM_SHA256;
-				drrw->drr_checksumflags = DRR_CHECKSUM_DEDUP;
-			}
+/*
+ * Write the ring out, in writes of at least sb_chunk bytes until EOF.
+ */
+static void *
+send_buffer_drainer(void *arg)
+{
+	send_buffer_t *sb = arg;
+	size_t len;
+	ssize_t rv;
 
-			dataref.ref_guid = drrw->drr_toguid;
-			dataref.ref_object = drrw->drr_object;
-			dataref.ref_offset = drrw->drr_offset;
-
-			if (ddt_update(dda->dedup_hdl, &ddt,
-			    &drrw->drr_key.ddk_cksum, drrw->drr_key.ddk_prop,
-			    &dataref)) {
-				dmu_replay_record_t wbr_drr = {0};
-				struct drr_write_byref *wbr_drrr =
-				    &wbr_drr.drr_u.drr_write_byref;
-
-				/* block already present in stream */
-				wbr_drr.drr_type = DRR_WRITE_BYREF;
-
-				wbr_drrr->drr_object = drrw->drr_object;
-				wbr_drrr->drr_offset = drrw->drr_offset;
-				wbr_drrr->drr_length = drrw->drr_logical_size;
-				wbr_drrr->drr_toguid = drrw->drr_toguid;
-				wbr_drrr->drr_refguid = dataref.ref_guid;
-				wbr_drrr->drr_refobject =
-				    dataref.ref_object;
-				wbr_drrr->drr_refoffset =
-				    dataref.ref_offset;
-
-				wbr_drrr->drr_checksumtype =
-				    drrw->drr_checksumtype;
-				wbr_drrr->drr_checksumflags =
-				    drrw->drr_checksumtype;
-				wbr_drrr->drr_key.ddk_cksum =
-				    drrw->drr_key.ddk_cksum;
-				wbr_drrr->drr_key.ddk_prop =
-				    drrw->drr_key.ddk_prop;
-
-				if (dump_record(&wbr_drr, NULL, 0,
-				    &stream_cksum, outfd) != 0)
-					goto out;
-			} else {
-				/* block not previously seen */
-				if (dump_record(drr, buf, payload_size,
-				    &stream_cksum, outfd) != 0)
-					goto out;
-			}
+	(void) pthread_mutex_lock(&sb->sb_lock);
+	for (;;) {
+		while (sb->sb_len < sb->sb_chunk && !sb->sb_eof)
+			(void) pthread_cond_wait(&sb->sb_cv, &sb->sb_lock);
+		if (sb->sb_len == 0)
 			break;
-		}
-
-		case DRR_WRITE_EMBEDDED:
-		{
-			struct drr_write_embedded *drrwe =
-			    &drr->drr_u.drr_write_embedded;
-			(void) ssread(buf,
-			    P2ROUNDUP((uint64_t)drrwe->drr_psize, 8), ofp);
-			if (dump_record(drr, buf,
-			    P2ROUNDUP((uint64_t)drrwe->drr_psize, 8),
-			    &stream_cksum, outfd) != 0)
-				goto out;
+		len = MIN(sb->sb_len, sb->sb_size - sb->sb_head);
+		(void) pthread_mutex_unlock(&sb->sb_lock);
+		rv = write(sb->sb_outfd, sb->sb_buf + sb->sb_head, len);
+		(void) pthread_mutex_lock(&sb->sb_lock);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv == -1) {
+			sb->sb_err = errno;
 			break;
 		}
+		sb->sb_head = (sb->sb_head + rv) % sb->sb_size;
+		sb->sb_len -= rv;
+		(void) pthread_cond_broadcast(&sb->sb_cv);
+	}
+	(void) pthread_cond_broadcast(&sb->sb_cv);
+	(void) pthread_mutex_unlock(&sb->sb_lock);
 
-		case DRR_FREE:
-		{
-			if (dump_record(drr, NULL, 0, &stream_cksum,
-			    outfd) != 0)
-				goto out;
-			break;
-		}
+	return (NULL);
+}
 
-		default:
-			(void) printf("INVALID record type 0x%x\n",
-			    drr->drr_type);
-			/* should never happen, so assert */
-			assert(B_FALSE);
-		}
+/*
+ * Put a ring buffer of "size" bytes between the send streams and "outfd",
+ * so that neither a consumer that reads in bursts (such as ssh) stalls the
+ * send, nor the consumer is fed small writes.  On success, *fdp is the fd
+ * to write the streams to in place of outfd, until send_buffer_finish().
+ */
+static int
+send_buffer_start(send_buffer_t *sb, size_t size, int outfd, int *fdp)
+{
+	int pipefd[2];
+	int err;
+
+	bzero(sb, sizeof (*sb));
+	if ((sb->sb_buf = malloc(size)) == NULL)
+		return (ENOMEM);
+	if (pipe(pipefd) != 0) {
+		err = errno;
+		free(sb->sb_buf);
+		return (err);
+	}
+	sb->sb_infd = pipefd[0];
+	sb->sb_fd = pipefd[1];
+	sb->sb_outfd = outfd;
+	sb->sb_size = size;
+	sb->sb_chunk = MAX(MIN(SEND_BUFFER_CHUNK, size / 2), 1);
+	(void) pthread_mutex_init(&sb->sb_lock, NULL);
+	(void) pthread_cond_init(&sb->sb_cv, NULL);
+
+	if ((err = pthread_create(&sb->sb_filler, NULL,
+	    send_buffer_filler, sb)) != 0) {
+		(void) close(pipefd[0]);
+		(void) close(pipefd[1]);
+		(void) pthread_cond_destroy(&sb->sb_cv);
+		(void) pthread_mutex_destroy(&sb->sb_lock);
+		free(sb->sb_buf);
+		return (err);
+	}
+	if ((err = pthread_create(&sb->sb_drainer, NULL,
+	    send_buffer_drainer, sb)) != 0) {
+		/* the filler stops on the error and closes the pipe */
+		(void) pthread_mutex_lock(&sb->sb_lock);
+		sb->sb_err = err;
+		(void) pthread_cond_broadcast(&sb->sb_cv);
+		(void) pthread_mutex_unlock(&sb->sb_lock);
+		(void) close(pipefd[1]);
+		(void) pthread_join(sb->sb_filler, NULL);
+		(void) pthread_cond_destroy(&sb->sb_cv);
+		(void) pthread_mutex_destroy(&sb->sb_lock);
+		free(sb->sb_buf);
+		return (err);
 	}
-out:
-	umem_cache_destroy(ddt.ddecache);
-	free(ddt.dedup_hash_array);
-	free(buf);
-	(void) fclose(ofp);
 
-	return (NULL);
+	*fdp = sb->sb_fd;
+	return (0);
+}
+
+/*
+ * Close the fd handed out by send_buffer_start() and wait for everything
+ * written to it to reach the output fd.  Returns the errno of a failed
+ * write to the output fd, or 0.
+ */
+static int
+send_buffer_finish(send_buffer_t *sb)
+{
+	(void) close(sb->sb_fd);
+	(void) pthread_join(sb->sb_filler, NULL);
+	(void) pthread_join(sb->sb_drainer, NULL);
+	(void) pthread_cond_destroy(&sb->sb_cv);
+	(void) pthread_mutex_destroy(&sb->sb_lock);
+	free(sb->sb_buf);
+
+	return (sb->sb_err);
 }
 
 /*
@@ -981,14 +1293,17 @@ typedef struct send_dump_data {
 	snapfilter_cb_t *filter_cb;
 	void *filter_cb_arg;
 	nvlist_t *debugnv;
+	nvlist_t *exclude;
 	char holdtag[ZFS_MAX_DATASET_NAME_LEN];
 	int cleanup_fd;
 	uint64_t size;
+	uint64_t size_error;
 } send_dump_data_t;
 
 static int
 estimate_ioctl(zfs_handle_t *zhp, uint64_t fromsnap_obj,
-    boolean_t fromorigin, enum lzc_send_flags flags, uint64_t *sizep)
+    boolean_t fromorigin, enum lzc_send_flags flags, uint64_t *sizep,
+    uint64_t *errorp)
 {
 	zfs_cmd_t zc = {"\0"};
 	libzfs_handle_t *hdl = zhp->zfs_hdl;
@@ -1043,6 +1358,7 @@ estimate_ioctl(zfs_handle_t *zhp, uint64_t fromsnap_obj,
 	}
 
 	*sizep = zc.zc_objset_type;
+	*errorp = zc.zc_cookie;
 
 	return (0);
 }
@@ -1054,11 +1370,12 @@ estimate_ioctl(zfs_handle_t *zhp, uint64_t fromsnap_obj,
 static int
 dump_ioctl(zfs_handle_t *zhp, const char *fromsnap, uint64_t fromsnap_obj,
     boolean_t fromorigin, int outfd, enum lzc_send_flags flags,
-    nvlist_t *debugnv)
+    nvlist_t *exclude, nvlist_t *debugnv)
 {
 	zfs_cmd_t zc = {"\0"};
 	libzfs_handle_t *hdl = zhp->zfs_hdl;
 	nvlist_t *thisdbg;
+	int error;
 
 	assert(zhp->zfs_type == ZFS_TYPE_SNAPSHOT);
 	assert(fromsnap_obj == 0 || !fromorigin);
@@ -1069,6 +1386,8 @@ dump_ioctl(zfs_handle_t *zhp, const char *fromsnap, uint64_t fromsnap_obj,
 	zc.zc_sendobj = zfs_prop_get_int(zhp, ZFS_PROP_OBJSETID);
 	zc.zc_fromobj = fromsnap_obj;
 	zc.zc_flags = flags;
+	if (exclude != NULL && zcmd_write_src_nvlist(hdl, &zc, exclude) != 0)
+		return (-1);
 
 	VERIFY(0 == nvlist_alloc(&thisdbg, NV_UNIQUE_NAME, 0));
 	if (fromsnap && fromsnap[0] != '\0') {
@@ -1076,7 +1395,10 @@ dump_ioctl(zfs_handle_t *zhp, const char *fromsnap, uint64_t fromsnap_obj,
 		    "fromsnap", fromsnap));
 	}
 
-	if (zfs_ioctl(zhp->zfs_hdl, ZFS_IOC_SEND, &zc) != 0) {
+	error = zfs_ioctl(zhp->zfs_hdl, ZFS_IOC_SEND, &zc);
+	if (exclude != NULL)
+		zcmd_free_nvlists(&zc);
+	if (error != 0) {
 		char errbuf[1024];
 		(void) snprintf(errbuf, sizeof (errbuf), dgettext(TEXT_DOMAIN,
 		    "warning: cannot send '%s'"), zhp->zfs_name);
@@ -1151,48 +1473,94 @@ send_progress_thread(void *arg)
 	zfs_cmd_t zc = {"\0"};
 	zfs_handle_t *zhp = pa->pa_zhp;
 	libzfs_handle_t *hdl = zhp->zfs_hdl;
-	unsigned long long bytes;
-	char buf[16];
+	unsigned long long bytes, traversed, read;
+	unsigned long long last_bytes = 0, last_traversed = 0, last_read = 0;
+	char buf[16], tbuf[16], rbuf[16], sbuf[16];
 	time_t t;
 	struct tm *tm;
 
 	(void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
 
-	if (!pa->pa_parsable)
-		(void) fprintf(stderr, "TIME        SENT   SNAPSHOT\n");
+	if (!pa->pa_parsable) {
+		(void) fprintf(stderr, "TIME        SENT   TRAV/s   READ/s   "
+		    "SENT/s   SNAPSHOT\n");
+	}
 
 	/*
-	 * Print the progress from ZFS_IOC_SEND_PROGRESS every second.
+	 * Print the progress from ZFS_IOC_SEND_PROGRESS every second, with
+	 * the rate at which each stage of the send (traversing the dataset,
+	 * reading its data and writing the stream) is going.  The parsable
+	 * output gives the running totals instead, after the snapshot name.
 	 */
 	for (;;) {
 		(void) sleep(1);
 
 		zc.zc_cookie = pa->pa_fd;
+		zc.zc_sendobj = 0;
+		zc.zc_fromobj = 0;
 		if (zfs_ioctl(hdl, ZFS_IOC_SEND_PROGRESS, &zc) != 0)
 			return ((void *)-1);
 
 		(void) time(&t);
 		tm = localtime(&t);
 		bytes = zc.zc_cookie;
+		traversed = zc.zc_sendobj;
+		read = zc.zc_fromobj;
 
 		if (pa->pa_parsable) {
-			(void) fprintf(stderr, "%02d:%02d:%02d\t%llu\t%s\n",
+			(void) fprintf(stderr,
+			    "%02d:%02d:%02d\t%llu\t%s\t%llu\t%llu\n",
 			    tm->tm_hour, tm->tm_min, tm->tm_sec,
-			    bytes, zhp->zfs_name);
+			    bytes, zhp->zfs_name, traversed, read);
 		} else {
 			zfs_nicenum(bytes, buf, sizeof (buf));
-			(void) fprintf(stderr, "%02d:%02d:%02d   %5s   %s\n",
+			zfs_nicenum(traversed - last_traversed, tbuf,
+			    sizeof (tbuf));
+			zfs_nicenum(read - last_read, rbuf, sizeof (rbuf));
+			zfs_nicenum(bytes - last_bytes, sbuf, sizeof (sbuf));
+			(void) fprintf(stderr,
+			    "%02d:%02d:%02d   %5s   %6s   %6s   %6s   %s\n",
 			    tm->tm_hour, tm->tm_min, tm->tm_sec,
-			    buf, zhp->zfs_name);
+			    buf, tbuf, rbuf, sbuf, zhp->zfs_name);
 		}
+		last_bytes = bytes;
+		last_traversed = traversed;
+		last_read = read;
 	}
 }
 
 
 
+/*
+ * Print an estimated stream size, and the bytes it may be off by with 95%
+ * confidence, if that is known.
+ */
+static void
+send_print_size(FILE *fout, uint64_t size, uint64_t error, boolean_t parsable)
+{
+	char buf[16], ebuf[16];
+
+	if (parsable) {
+		(void) fprintf(fout, "\t%llu\t%llu",
+		    (longlong_t)size, (longlong_t)error);
+		return;
+	}
+
+	zfs_nicenum(size, buf, sizeof (buf));
+	if (error == 0) {
+		(void) fprintf(fout, dgettext(TEXT_DOMAIN,
+		    " estimated size is %s"), buf);
+	} else {
+		zfs_nicenum(error, ebuf, sizeof (ebuf));
+		(void) fprintf(fout, dgettext(TEXT_DOMAIN,
+		    " estimated size is %s +/- %s (95%% confidence)"),
+		    buf, ebuf);
+	}
+}
+
 static void
 send_print_verbose(FILE *fout, const char *tosnap, const char *fromsnap,
-    uint64_t size, boolean_t parsable)
+    uint64_t size, uint64_t error, boolean_t parsable)
 {
 	if (parsable) {
 		if (fromsnap != NULL) {
@@ -1221,17 +1589,8 @@ send_print_verbose(FILE *fout, const char *tosnap, const char *fromsnap,
 		}
 	}
 
-	if (size != 0) {
-		if (parsable) {
-			(void) fprintf(fout, "\t%llu",
-			    (longlong_t)size);
-		} else {
-			char buf[16];
-			zfs_nicenum(size, buf, sizeof (buf));
-			(void) fprintf(fout, dgettext(TEXT_DOMAIN,
-			    " estimated size is %s"), buf);
-		}
-	}
+	if (size != 0)
+		send_print_size(fout, size, error, parsable);
 	(void) fprintf(fout, "\n");
 }
 
@@ -1322,14 +1681,15 @@ dump_snapshot(zfs_handle_t *zhp, void *arg)
 	    (sdd->fromorigin || sdd->replicate);
 
 	if (sdd->verbose) {
-		uint64_t size = 0;
+		uint64_t size = 0, error = 0;
 		(void) estimate_ioctl(zhp, sdd->prevsnap_obj,
-		    fromorigin, flags, &size);
+		    fromorigin, flags, &size, &error);
 
 		send_print_verbose(fout, zhp->zfs_name,
 		    sdd->prevsnap[0] ? sdd->prevsnap : NULL,
-		    size, sdd->parsable);
+		    size, error, sdd->parsable);
 		sdd->size += size;
+		sdd->size_error += error;
 	}
 
 	if (!sdd->dryrun) {
@@ -1350,7 +1710,7 @@ dump_snapshot(zfs_handle_t *zhp, void *arg)
 		}
 
 		err = dump_ioctl(zhp, sdd->prevsnap, sdd->prevsnap_obj,
-		    fromorigin, sdd->outfd, flags, sdd->debugnv);
+		    fromorigin, sdd->outfd, flags, sdd->exclude, sdd->debugnv);
 
 		if (sdd->progress) {
 			(void) pthread_cancel(tid);
@@ -1691,18 +2051,30 @@ zfs_send_resume(libzfs_handle_t *hdl, sendflags_t *flags, int outfd,
 	}
 
 	if (flags->verbose) {
-		uint64_t size = 0;
-		error = lzc_send_space(zhp->zfs_name, fromname,
-		    lzc_flags, &size);
+		uint64_t size = 0, size_error = 0;
+		error = lzc_send_space_error(zhp->zfs_name, fromname,
+		    lzc_flags, &size, &size_error);
 		if (error == 0)
 			size = MAX(0, (int64_t)(size - bytes));
 		send_print_verbose(stderr, zhp->zfs_name, fromname,
-		    size, flags->parsable);
+		    size, MIN(size_error, size), flags->parsable);
 	}
 
 	if (!flags->dryrun) {
 		progress_arg_t pa = { 0 };
 		pthread_t tid;
+		send_buffer_t sb;
+
+		if (flags->buffer_size != 0) {
+			error = send_buffer_start(&sb, flags->buffer_size,
+			    outfd, &outfd);
+			if (error != 0) {
+				zfs_close(zhp);
+				zfs_error_aux(hdl, strerror(error));
+				return (zfs_error(hdl, EZFS_PIPEFAILED,
+				    errbuf));
+			}
+		}
 		/*
 		 * If progress reporting is requested, spawn a new thread to
 		 * poll ZFS_IOC_SEND_PROGRESS at a regular interval.
@@ -1715,19 +2087,27 @@ zfs_send_resume(libzfs_handle_t *hdl, sendflags_t *flags, int outfd,
 			error = pthread_create(&tid, NULL,
 			    send_progress_thread, &pa);
 			if (error != 0) {
+				if (flags->buffer_size != 0)
+					(void) send_buffer_finish(&sb);
 				zfs_close(zhp);
 				return (error);
 			}
 		}
 
-		error = lzc_send_resume(zhp->zfs_name, fromname, outfd,
-		    lzc_flags, resumeobj, resumeoff);
+		error = lzc_send_exclude(zhp->zfs_name, fromname, outfd,
+		    lzc_flags, resumeobj, resumeoff, flags->exclude);
 
 		if (flags->progress) {
 			(void) pthread_cancel(tid);
 			(void) pthread_join(tid, NULL);
 		}
 
+		if (flags->buffer_size != 0) {
+			int berr = send_buffer_finish(&sb);
+			if (error == 0 && berr != 0)
+				errno = error = berr;
+		}
+
 		char errbuf[1024];
 		(void) snprintf(errbuf, sizeof (errbuf), dgettext(TEXT_DOMAIN,
 		    "warning: cannot send '%s'"), zhp->zfs_name);
@@ -1797,6 +2177,8 @@ zfs_send(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 	dedup_arg_t dda = { 0 };
 	int featureflags = 0;
 	FILE *fout;
+	send_buffer_t sb;
+	boolean_t buffered = B_FALSE;
 
 	(void) snprintf(errbuf, sizeof (errbuf), dgettext(TEXT_DOMAIN,
 	    "cannot send '%s'"), zhp->zfs_name);
@@ -1815,11 +2197,27 @@ zfs_send(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 		}
 	}
 
+	/*
+	 * Everything from here on, including the records we write ourselves,
+	 * goes through the ring buffer to keep the stream in order.
+	 */
+	if (flags->buffer_size != 0 && !flags->dryrun) {
+		err = send_buffer_start(&sb, flags->buffer_size, outfd, &outfd);
+		if (err != 0) {
+			zfs_error_aux(zhp->zfs_hdl, strerror(err));
+			return (zfs_error(zhp->zfs_hdl, EZFS_PIPEFAILED,
+			    errbuf));
+		}
+		buffered = B_TRUE;
+	}
+
 	if (flags->dedup && !flags->dryrun) {
 		featureflags |= (DMU_BACKUP_FEATURE_DEDUP |
 		    DMU_BACKUP_FEATURE_DEDUPPROPS);
 		if ((err = socketpair(AF_UNIX, SOCK_STREAM, 0, pipefd))) {
 			zfs_error_aux(zhp->zfs_hdl, strerror(errno));
+			if (buffered)
+				(void) send_buffer_finish(&sb);
 			return (zfs_error(zhp->zfs_hdl, EZFS_PIPEFAILED,
 			    errbuf));
 		}
@@ -1830,6 +2228,8 @@ zfs_send(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 			(void) close(pipefd[0]);
 			(void) close(pipefd[1]);
 			zfs_error_aux(zhp->zfs_hdl, strerror(errno));
+			if (buffered)
+				(void) send_buffer_finish(&sb);
 			return (zfs_error(zhp->zfs_hdl,
 			    EZFS_THREADCREATEFAILED, errbuf));
 		}
@@ -1925,6 +2325,7 @@ zfs_send(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 	sdd.large_block = flags->largeblock;
 	sdd.embed_data = flags->embed_data;
 	sdd.compress = flags->compress;
+	sdd.exclude = flags->exclude;
 	sdd.filter_cb = filter_func;
 	sdd.filter_cb_arg = cb_arg;
 	if (debugnvp)
@@ -1969,16 +2370,16 @@ zfs_send(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 		if (err != 0)
 			goto stderr_out;
 
+		/*
+		 * The errors of the estimates are summed, which bounds the
+		 * error of the total at least as confidently.
+		 */
 		if (flags->verbose) {
-			if (flags->parsable) {
-				(void) fprintf(fout, "size\t%llu\n",
-				    (longlong_t)sdd.size);
-			} else {
-				char buf[16];
-				zfs_nicenum(sdd.size, buf, sizeof (buf));
-				(void) fprintf(fout, dgettext(TEXT_DOMAIN,
-				    "total estimated size is %s\n"), buf);
-			}
+			(void) fprintf(fout, flags->parsable ? "size" :
+			    dgettext(TEXT_DOMAIN, "total"));
+			send_print_size(fout, sdd.size, sdd.size_error,
+			    flags->parsable);
+			(void) fprintf(fout, "\n");
 		}
 
 		/* Ensure no snaps found is treated as an error. */
@@ -2034,11 +2435,20 @@ zfs_send(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 		dmu_replay_record_t drr = { 0 };
 		drr.drr_type = DRR_END;
 		if (write(outfd, &drr, sizeof (drr)) == -1) {
+			err = errno;
+			if (buffered)
+				(void) send_buffer_finish(&sb);
 			return (zfs_standard_error(zhp->zfs_hdl,
-			    errno, errbuf));
+			    err, errbuf));
 		}
 	}
 
+	if (buffered) {
+		int berr = send_buffer_finish(&sb);
+		if (berr != 0)
+			return (zfs_standard_error(zhp->zfs_hdl, berr, errbuf));
+	}
+
 	return (err || sdd.err);
 
 stderr_out:
@@ -2055,6 +2465,8 @@ err_out:
         (void) close(pipefd[0]);
 		(void) pthread_join(tid, NULL);
 	}
+	if (buffered)
+		(void) send_buffer_finish(&sb);
 	return (err);
 }
 
@@ -3124,6 +3536,8 @@ zfs_receive_one(libzfs_handle_t *hdl, int infd, const char *tosnap,
 	zprop_errflags_t prop_errflags;
 	boolean_t recursive;
 	char *snapname = NULL;
+	struct stat sb;
+	off_t recv_start = -1;
 
 	begin_time = time(NULL);
 
@@ -3455,10 +3869,27 @@ zfs_receive_one(libzfs_handle_t *hdl, int infd, const char *tosnap,
 	zc.zc_cleanup_fd = cleanup_fd;
 	zc.zc_action_handle = *action_handlep;
 
+	/*
+	 * The kernel may read a stream from a regular file ahead of the
+	 * records it has consumed, as long as we put the offset back
+	 * afterwards for whatever follows this stream in the file.
+	 */
+	if (fstat(infd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+	    (recv_start = lseek(infd, 0, SEEK_CUR)) != -1)
+		zc.zc_flags |= ZFS_RECV_READAHEAD;
+
 	err = ioctl_err = zfs_ioctl(hdl, ZFS_IOC_RECV, &zc);
 	ioctl_errno = errno;
 	prop_errflags = (zprop_errflags_t)zc.zc_obj;
 
+	/*
+	 * zc_cookie is only the byte count once the stream has been read,
+	 * which is also the only time the offset can have moved past it.
+	 */
+	if (recv_start != -1 &&
+	    lseek(infd, 0, SEEK_CUR) > recv_start + (off_t)zc.zc_cookie)
+		(void) lseek(infd, recv_start + zc.zc_cookie, SEEK_SET);
+
 	if (err == 0) {
 		nvlist_t *prop_errors;
 		VERIFY(0 == nvlist_unpack((void *)(uintptr_t)zc.zc_nvlist_dst,
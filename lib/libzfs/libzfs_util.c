@@ -52,6 +52,7 @@
 #include "libzfs_impl.h"
 #include "zfs_prop.h"
 #include "zfeature_common.h"
+#include <zfs_fletcher.h>
 
 #ifdef __APPLE__
 #include <sys/zfs_mount.h>
@@ -266,6 +267,8 @@ libzfs_error_description(libzfs_handle_t *hdl)
 		return (dgettext(TEXT_DOMAIN, "afp remove share failed"));
 	case EZFS_SHAREAFPFAILED:
 		return (dgettext(TEXT_DOMAIN, "afp add share failed"));
+	case EZFS_CRYPTOFAILED:
+		return (dgettext(TEXT_DOMAIN, "encryption failure"));
 	case EZFS_UNKNOWN:
 		return (dgettext(TEXT_DOMAIN, "unknown error"));
 	default:
@@ -941,6 +944,7 @@ libzfs_init(void)
 	zpool_prop_init();
 	zpool_feature_init();
 	libzfs_mnttab_init(hdl);
+	fletcher_4_init();
 #ifdef __APPLE__
 	libshare_init();
 #endif
@@ -969,7 +973,9 @@ libzfs_fini(libzfs_handle_t *hdl)
 	libzfs_fru_clear(hdl, B_TRUE);
 	namespace_clear(hdl);
 	libzfs_mnttab_fini(hdl);
+	(void) pthread_mutex_destroy(&hdl->libzfs_mnttab_cache_lock);
 	libzfs_core_fini();
+	fletcher_4_fini();
 	free(hdl);
 }
 
@@ -184,15 +184,30 @@ out:
 	return (error);
 }
 
+/*
+ * If "wkeydata" is non-NULL the new dataset becomes an encryption root
+ * wrapped with that key; the encryption and keyformat properties must
+ * then be given in "props".  The key is passed in the hidden arguments
+ * so that it is never recorded in the pool history.
+ */
 int
-lzc_create(const char *fsname, enum lzc_dataset_type type, nvlist_t *props)
+lzc_create(const char *fsname, enum lzc_dataset_type type, nvlist_t *props,
+    uint8_t *wkeydata, uint_t wkeylen)
 {
 	int error;
+	nvlist_t *hidden_args = NULL;
 	nvlist_t *args = fnvlist_alloc();
 	fnvlist_add_int32(args, "type", (dmu_objset_type_t)type);
 	if (props != NULL)
 		fnvlist_add_nvlist(args, "props", props);
+	if (wkeydata != NULL) {
+		hidden_args = fnvlist_alloc();
+		fnvlist_add_uint8_array(hidden_args, "wkeydata", wkeydata,
+		    wkeylen);
+		fnvlist_add_nvlist(args, ZPOOL_HIDDEN_ARGS, hidden_args);
+	}
 	error = lzc_ioctl(ZFS_IOC_CREATE, fsname, args, NULL);
+	nvlist_free(hidden_args);
 	nvlist_free(args);
 	return (error);
 }
@@ -489,6 +504,23 @@ lzc_send(const char *snapname, const char *from, int fd,
 int
 lzc_send_resume(const char *snapname, const char *from, int fd,
     enum lzc_send_flags flags, uint64_t resumeobj, uint64_t resumeoff)
+{
+	return (lzc_send_exclude(snapname, from, fd, flags, resumeobj,
+	    resumeoff, NULL));
+}
+
+/*
+ * As lzc_send_resume, leaving out of the stream some of the objects of the
+ * snapshot.  "exclude" (which may be NULL) holds an "exclude_objs" uint64
+ * array of object numbers and/or an "exclude_paths" string array of paths,
+ * relative to the root of the dataset, beneath which every file and
+ * directory is excluded.  The stream frees the objects excluded, in place
+ * of sending them; directory entries naming them are sent as they are.
+ */
+int
+lzc_send_exclude(const char *snapname, const char *from, int fd,
+    enum lzc_send_flags flags, uint64_t resumeobj, uint64_t resumeoff,
+    nvlist_t *exclude)
 {
 	nvlist_t *args;
 	int err;
@@ -507,6 +539,8 @@ lzc_send_resume(const char *snapname, const char *from, int fd,
 		fnvlist_add_uint64(args, "resume_object", resumeobj);
 		fnvlist_add_uint64(args, "resume_offset", resumeoff);
 	}
+	if (exclude != NULL)
+		fnvlist_merge(args, exclude);
 	err = lzc_ioctl(ZFS_IOC_SEND_NEW, snapname, args, NULL);
 	nvlist_free(args);
 	return (err);
@@ -515,21 +549,27 @@ lzc_send_resume(const char *snapname, const char *from, int fd,
 /*
  * "from" can be NULL, a snapshot, or a bookmark.
  *
- * If from is NULL, a full (non-incremental) stream will be estimated.  This
- * is calculated very efficiently.
- *
- * If from is a snapshot, lzc_send_space uses the deadlists attached to
- * each snapshot to efficiently estimate the stream size.
- *
- * If from is a bookmark, the indirect blocks in the destination snapshot
- * are traversed, looking for blocks with a birth time since the creation TXG of
- * the snapshot this bookmark was created from.  This will result in
- * significantly more I/O and be less efficient than a send space estimation on
- * an equivalent snapshot.
+ * If from is NULL, a full (non-incremental) stream will be estimated.
+ * Otherwise only the blocks born since the snapshot (or the snapshot the
+ * bookmark was created from) are considered.  Either way the indirect
+ * blocks of the destination snapshot are traversed, and the data beneath
+ * a sample of them is used to estimate the rest; see lzc_send_space_error.
  */
 int
 lzc_send_space(const char *snapname, const char *from,
     enum lzc_send_flags flags, uint64_t *spacep)
+{
+	return (lzc_send_space_error(snapname, from, flags, spacep, NULL));
+}
+
+/*
+ * As lzc_send_space, also returning in *errorp (if not NULL) the number of
+ * bytes the estimate may be off by, with 95% confidence.  That is 0 if the
+ * kernel does not report it.
+ */
+int
+lzc_send_space_error(const char *snapname, const char *from,
+    enum lzc_send_flags flags, uint64_t *spacep, uint64_t *errorp)
 {
 	nvlist_t *args;
 	nvlist_t *result;
@@ -546,8 +586,12 @@ lzc_send_space(const char *snapname, const char *from,
 		fnvlist_add_boolean(args, "compressok");
 	err = lzc_ioctl(ZFS_IOC_SEND_SPACE, snapname, args, &result);
 	nvlist_free(args);
-	if (err == 0)
+	if (err == 0) {
 		*spacep = fnvlist_lookup_uint64(result, "space");
+		if (errorp != NULL && nvlist_lookup_uint64(result,
+		    "space_error", errorp) != 0)
+			*errorp = 0;
+	}
 	nvlist_free(result);
 	return (err);
 }
@@ -791,6 +835,76 @@ lzc_get_bookmarks(const char *fsname, nvlist_t *props, nvlist_t **bmarks)
 	return (lzc_ioctl(ZFS_IOC_GET_BOOKMARKS, fsname, props, bmarks));
 }
 
+/*
+ * Lists a batch of the child filesystems, or with "snapshots" set in args
+ * the snapshots, of fsname.
+ *
+ * The args nvlist may contain "cursor" (uint64, 0 or the "cursor" returned
+ * by the previous call), "count" (uint64, most datasets to return),
+ * "snapshots", "simple" (snapshot names only) and "props" (an nvlist whose
+ * keys are the native properties to return; user properties are always
+ * returned).
+ *
+ * On success *result holds "cursor", "done" once the listing is complete,
+ * and "datasets": an nvlist keyed by dataset name whose values hold the
+ * dataset's "stats" (a dmu_objset_stats_t) and "props".
+ */
+int
+lzc_list_batch(const char *fsname, nvlist_t *args, nvlist_t **result)
+{
+	return (lzc_ioctl(ZFS_IOC_LIST_BATCH, fsname, args, result));
+}
+
+/*
+ * Runs one zpios DMU benchmark against pool, see zpios_ioctl() in
+ * module/zfs/zpios_osx.c for the contents of args and *result.  *result
+ * holds the run's "log" also when the run fails.
+ */
+int
+lzc_zpios(const char *pool, nvlist_t *args, nvlist_t **result)
+{
+	return (lzc_ioctl(ZFS_IOC_ZPIOS, pool, args, result));
+}
+
+/*
+ * Samples the block sizes and compression of the data blocks of the
+ * snapshot snapname.  The args nvlist may contain "rate_ppm" (uint64, parts
+ * per million of the level 1 indirect blocks to follow, default 10000).
+ * See zfs_ioc_block_sample() in module/zfs/zfs_ioctl.c for *result.
+ */
+int
+lzc_block_sample(const char *snapname, nvlist_t *args, nvlist_t **result)
+{
+	return (lzc_ioctl(ZFS_IOC_BLOCK_SAMPLE, snapname, args, result));
+}
+
+/*
+ * Looks up the stats and paths of a batch of objects in the snapshot or
+ * filesystem dsname.  The args nvlist holds "objects" (a uint64 array of
+ * up to 1024 object numbers).  On success *result holds, for each object in
+ * turn, "errors" (int32 array), "stats" (uint8 array of zfs_stat_t) and
+ * "paths" (string array, "" where the lookup failed).
+ */
+int
+lzc_obj_to_stats_batch(const char *dsname, nvlist_t *args, nvlist_t **result)
+{
+	return (lzc_ioctl(ZFS_IOC_OBJ_TO_STATS_BATCH, dsname, args, result));
+}
+
+/*
+ * Does a bounded step of a background recompression pass over the
+ * filesystem or volume dsname: blocks old enough and not shared with a
+ * snapshot are rewritten with the algorithm in args' "compress".  Pass
+ * the "object" and "offset" of each *result back in args to continue;
+ * "object" is 0 once the pass is complete.  See zfs_ioc_recompress() in
+ * module/zfs/zfs_ioctl.c for the other arguments and statistics.
+ */
+int
+lzc_recompress(const char *dsname, nvlist_t *args, nvlist_t **result)
+{
+	return (lzc_ioctl(ZFS_IOC_RECOMPRESS, dsname, args, result));
+}
+
 /*
  * Destroys bookmarks.
  *
@@ -825,3 +939,44 @@ lzc_destroy_bookmarks(nvlist_t *bmarks, nvlist_t **errlist)
 
 	return (error);
 }
+
+/*
+ * Load the wrapping key of the encryption root "fsname" and use it to
+ * unwrap the master key, making the data of every dataset sharing that
+ * key accessible.  Fails with EACCES if the key is wrong and EEXIST if
+ * it is already loaded.
+ */
+int
+lzc_load_key(const char *fsname, uint8_t *wkeydata, uint_t wkeylen)
+{
+	int error;
+	nvlist_t *ioc_args;
+	nvlist_t *hidden_args;
+
+	if (wkeydata == NULL)
+		return (EINVAL);
+
+	ioc_args = fnvlist_alloc();
+	hidden_args = fnvlist_alloc();
+	fnvlist_add_uint8_array(hidden_args, "wkeydata", wkeydata, wkeylen);
+	fnvlist_add_nvlist(ioc_args, ZPOOL_HIDDEN_ARGS, hidden_args);
+	error = lzc_ioctl(ZFS_IOC_LOAD_KEY, fsname, ioc_args, NULL);
+	nvlist_free(hidden_args);
+	nvlist_free(ioc_args);
+
+	return (error);
+}
+
+/*
+ * Unload the key of the encryption root "fsname".  Fails with EBUSY
+ * while any dataset using the key is mounted or open.
+ */
+int
+lzc_unload_key(const char *fsname)
+{
+	int error;
+	nvlist_t *args = fnvlist_alloc();
+	error = lzc_ioctl(ZFS_IOC_UNLOAD_KEY, fsname, args, NULL);
+	nvlist_free(args);
+	return (error);
+}
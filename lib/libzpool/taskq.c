@@ -97,6 +97,83 @@ task_free(taskq_t *tq, taskq_ent_t *t)
 		cv_signal(&tq->tq_maxalloc_cv);
 }
 
+/*
+ * Queue a task of a TASKQ_WORKSTEAL taskq.  One that a thread of the taskq
+ * dispatches goes to the front of its own queue, to run next while its
+ * data is still in cache; others go round robin over all queues.  Waking
+ * an idle thread only needs tq_lock when there is one: a thread going idle
+ * counts itself in tq_idle before its last look at the queues, so either
+ * that look finds the task or this sees the count.
+ */
+static void
+taskq_wsq_insert(taskq_t *tq, taskq_ent_t *t, uint_t tqflags)
+{
+	taskq_wsq_t *wsq = NULL;
+	int i;
+
+	for (i = 0; i < tq->tq_nwsq; i++) {
+		if (tq->tq_threadlist[i] == curthread) {
+			wsq = &tq->tq_wsq[i];
+			tqflags |= TQ_FRONT;
+			break;
+		}
+	}
+	if (wsq == NULL) {
+		wsq = &tq->tq_wsq[atomic_inc_uint_nv(&tq->tq_wsq_next) %
+		    tq->tq_nwsq];
+	}
+
+	atomic_inc_64(&tq->tq_wsq_pending);
+	mutex_enter(&wsq->tqw_lock);
+	if (tqflags & TQ_FRONT) {
+		t->tqent_next = wsq->tqw_task.tqent_next;
+		t->tqent_prev = &wsq->tqw_task;
+	} else {
+		t->tqent_next = &wsq->tqw_task;
+		t->tqent_prev = wsq->tqw_task.tqent_prev;
+	}
+	t->tqent_next->tqent_prev = t;
+	t->tqent_prev->tqent_next = t;
+	mutex_exit(&wsq->tqw_lock);
+
+	if (tq->tq_idle > 0) {
+		mutex_enter(&tq->tq_lock);
+		cv_signal(&tq->tq_dispatch_cv);
+		mutex_exit(&tq->tq_lock);
+	}
+}
+
+/*
+ * Take the first task of a thread's own queue, or else steal the last one
+ * of another thread's, which that thread would have run last.
+ */
+static taskq_ent_t *
+taskq_wsq_remove(taskq_wsq_t *own)
+{
+	taskq_t *tq = own->tqw_tq;
+	taskq_ent_t *t = NULL;
+	int i;
+
+	for (i = 0; i < tq->tq_nwsq && t == NULL; i++) {
+		taskq_wsq_t *wsq = &tq->tq_wsq[(own->tqw_id + i) % tq->tq_nwsq];
+
+		mutex_enter(&wsq->tqw_lock);
+		if (wsq->tqw_task.tqent_next != &wsq->tqw_task) {
+			t = (i == 0) ? wsq->tqw_task.tqent_next :
+			    wsq->tqw_task.tqent_prev;
+			t->tqent_prev->tqent_next = t->tqent_next;
+			t->tqent_next->tqent_prev = t->tqent_prev;
+			t->tqent_next = NULL;
+			t->tqent_prev = NULL;
+		}
+		mutex_exit(&wsq->tqw_lock);
+	}
+
+	if (t != NULL)
+		atomic_dec_64(&tq->tq_wsq_pending);
+	return (t);
+}
+
 taskqid_t
 taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
 {
@@ -107,6 +184,18 @@ taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
 		return (1);
 	}
 
+	/* The per-thread queues allocate outside tq_lock, and unthrottled */
+	if (tq->tq_wsq != NULL) {
+		ASSERT(tq->tq_flags & TASKQ_ACTIVE);
+		if ((t = kmem_alloc(sizeof (taskq_ent_t), tqflags)) == NULL)
+			return (0);
+		t->tqent_func = func;
+		t->tqent_arg = arg;
+		t->tqent_flags = 0;
+		taskq_wsq_insert(tq, t, tqflags);
+		return (1);
+	}
+
 	mutex_enter(&tq->tq_lock);
 	ASSERT(tq->tq_flags & TASKQ_ACTIVE);
 	if ((t = task_alloc(tq, tqflags)) == NULL) {
@@ -164,6 +253,14 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 	 * to ensure that we don't free it later.
 	 */
 	t->tqent_flags |= TQENT_FLAG_PREALLOC;
+
+	if (tq->tq_wsq != NULL) {
+		t->tqent_func = func;
+		t->tqent_arg = arg;
+		taskq_wsq_insert(tq, t, flags);
+		return;
+	}
+
 	/*
 	 * Enqueue the task to the underlying queue.
 	 */
@@ -188,7 +285,8 @@ void
 taskq_wait(taskq_t *tq)
 {
 	mutex_enter(&tq->tq_lock);
-	while (tq->tq_task.tqent_next != &tq->tq_task || tq->tq_active != 0)
+	while (tq->tq_task.tqent_next != &tq->tq_task ||
+	    tq->tq_wsq_pending != 0 || tq->tq_active != 0)
 		cv_wait(&tq->tq_wait_cv, &tq->tq_lock);
 	mutex_exit(&tq->tq_lock);
 }
@@ -242,6 +340,55 @@ taskq_thread(void *arg)
 	thread_exit();
 }
 
+static void
+taskq_wsq_run(taskq_t *tq, taskq_ent_t *t)
+{
+	boolean_t prealloc = t->tqent_flags & TQENT_FLAG_PREALLOC;
+
+	rw_enter(&tq->tq_threadlock, RW_READER);
+	t->tqent_func(t->tqent_arg);
+	rw_exit(&tq->tq_threadlock);
+
+	if (!prealloc)
+		kmem_free(t, sizeof (taskq_ent_t));
+}
+
+static void
+taskq_wsq_thread(void *arg)
+{
+	taskq_wsq_t *own = arg;
+	taskq_t *tq = own->tqw_tq;
+	taskq_ent_t *t;
+
+	for (;;) {
+		if ((t = taskq_wsq_remove(own)) != NULL) {
+			taskq_wsq_run(tq, t);
+			continue;
+		}
+
+		mutex_enter(&tq->tq_lock);
+		if (!(tq->tq_flags & TASKQ_ACTIVE))
+			break;
+		/* Look once more as idle, see taskq_wsq_insert() */
+		tq->tq_idle++;
+		if ((t = taskq_wsq_remove(own)) == NULL) {
+			if (--tq->tq_active == 0)
+				cv_broadcast(&tq->tq_wait_cv);
+			cv_wait(&tq->tq_dispatch_cv, &tq->tq_lock);
+			tq->tq_active++;
+		}
+		tq->tq_idle--;
+		mutex_exit(&tq->tq_lock);
+
+		if (t != NULL)
+			taskq_wsq_run(tq, t);
+	}
+	tq->tq_nthreads--;
+	cv_broadcast(&tq->tq_wait_cv);
+	mutex_exit(&tq->tq_lock);
+	thread_exit();
+}
+
 /*ARGSUSED*/
 taskq_t *
 taskq_create(const char *name, int nthreads, pri_t pri,
@@ -276,9 +423,24 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	tq->tq_maxalloc = maxalloc;
 	tq->tq_task.tqent_next = &tq->tq_task;
 	tq->tq_task.tqent_prev = &tq->tq_task;
-	tq->tq_threadlist = kmem_alloc(nthreads * sizeof (kthread_t *),
+	tq->tq_threadlist = kmem_zalloc(nthreads * sizeof (kthread_t *),
 	    KM_SLEEP);
 
+	if (flags & TASKQ_WORKSTEAL) {
+		tq->tq_nwsq = nthreads;
+		tq->tq_wsq = kmem_zalloc(nthreads * sizeof (taskq_wsq_t),
+		    KM_SLEEP);
+		for (t = 0; t < nthreads; t++) {
+			taskq_wsq_t *wsq = &tq->tq_wsq[t];
+
+			mutex_init(&wsq->tqw_lock, NULL, MUTEX_DEFAULT, NULL);
+			wsq->tqw_task.tqent_next = &wsq->tqw_task;
+			wsq->tqw_task.tqent_prev = &wsq->tqw_task;
+			wsq->tqw_tq = tq;
+			wsq->tqw_id = t;
+		}
+	}
+
 	if (flags & TASKQ_PREPOPULATE) {
 		mutex_enter(&tq->tq_lock);
 		while (minalloc-- > 0)
@@ -286,9 +448,16 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 		mutex_exit(&tq->tq_lock);
 	}
 
-	for (t = 0; t < nthreads; t++)
-		VERIFY((tq->tq_threadlist[t] = thread_create(NULL, 0,
-			taskq_thread, tq, 0, NULL, TS_RUN, pri)) != NULL);
+	for (t = 0; t < nthreads; t++) {
+		if (tq->tq_wsq != NULL) {
+			VERIFY((tq->tq_threadlist[t] = thread_create(NULL, 0,
+			    taskq_wsq_thread, &tq->tq_wsq[t], 0, NULL, TS_RUN,
+			    pri)) != NULL);
+		} else {
+			VERIFY((tq->tq_threadlist[t] = thread_create(NULL, 0,
+			    taskq_thread, tq, 0, NULL, TS_RUN, pri)) != NULL);
+		}
+	}
 
 	return (tq);
 }
@@ -297,6 +466,7 @@ void
 taskq_destroy(taskq_t *tq)
 {
 	int nthreads = tq->tq_nthreads;
+	int t;
 
 	taskq_wait(tq);
 
@@ -318,6 +488,12 @@ taskq_destroy(taskq_t *tq)
 
 	kmem_free(tq->tq_threadlist, nthreads * sizeof (kthread_t *));
 
+	if (tq->tq_wsq != NULL) {
+		for (t = 0; t < tq->tq_nwsq; t++)
+			mutex_destroy(&tq->tq_wsq[t].tqw_lock);
+		kmem_free(tq->tq_wsq, tq->tq_nwsq * sizeof (taskq_wsq_t));
+	}
+
 	rw_destroy(&tq->tq_threadlock);
 	mutex_destroy(&tq->tq_lock);
 	cv_destroy(&tq->tq_dispatch_cv);
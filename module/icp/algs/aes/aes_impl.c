@@ -26,6 +26,7 @@
 #include <sys/crypto/spi.h>
 #include <modes/modes.h>
 #include <aes/aes_impl.h>
+#include <sys/simd.h>
 
 #ifdef __APPLE__
 // No assembler for now
@@ -1114,7 +1115,83 @@ aes_setupkeys(aes_key_t *key, const uint32_t *keyarr32, int keybits)
 	key->nr = rijndael_key_setup_dec(&(key->decr_ks.ks32[0]), keyarr32,
 	    keybits);
 	key->type = AES_32BIT_KS;
+
+#if defined(HAVE_SIMD_X86)
+	/*
+	 * The AES-NI instructions take the round keys as byte strings
+	 * rather than native words.  The decryption schedule built above
+	 * is already in the "equivalent inverse cipher" form that aesdec
+	 * expects (reversed, with InvMixColumns applied to the inner
+	 * round keys), so both only need their words swapped.
+	 */
+	if (zfs_aes_available()) {
+		int i;
+
+		for (i = 0; i < 4 * (key->nr + 1); i++) {
+			key->encr_ks.ks32[i] = htonl(key->encr_ks.ks32[i]);
+			key->decr_ks.ks32[i] = htonl(key->decr_ks.ks32[i]);
+		}
+		key->flags = INTEL_AES_NI_CAPABLE;
+	} else {
+		key->flags = 0;
+	}
+#endif
+}
+
+#if defined(HAVE_SIMD_X86)
+/*
+ * Encrypt or decrypt one block with AES-NI, using a key schedule
+ * prepared by aes_setupkeys().  Unlike the C code, the blocks are byte
+ * strings and need no alignment or byte swapping.
+ */
+static void
+aes_aesni_encrypt(const uint32_t rk[], int Nr, const uint8_t *pt,
+    uint8_t *ct)
+{
+	int n = Nr - 1;
+
+	__asm__ __volatile__(
+	    "movdqu (%[pt]), %%xmm0\n"
+	    "movdqu (%[rk]), %%xmm1\n"
+	    "pxor %%xmm1, %%xmm0\n"
+	    "1:\n"
+	    "add $16, %[rk]\n"
+	    "movdqu (%[rk]), %%xmm1\n"
+	    "aesenc %%xmm1, %%xmm0\n"
+	    "dec %[n]\n"
+	    "jnz 1b\n"
+	    "movdqu 16(%[rk]), %%xmm1\n"
+	    "aesenclast %%xmm1, %%xmm0\n"
+	    "movdqu %%xmm0, (%[ct])\n"
+	    : [rk] "+r" (rk), [n] "+r" (n)
+	    : [pt] "r" (pt), [ct] "r" (ct)
+	    : "cc", "memory", "xmm0", "xmm1");
+}
+
+static void
+aes_aesni_decrypt(const uint32_t rk[], int Nr, const uint8_t *ct,
+    uint8_t *pt)
+{
+	int n = Nr - 1;
+
+	__asm__ __volatile__(
+	    "movdqu (%[ct]), %%xmm0\n"
+	    "movdqu (%[rk]), %%xmm1\n"
+	    "pxor %%xmm1, %%xmm0\n"
+	    "1:\n"
+	    "add $16, %[rk]\n"
+	    "movdqu (%[rk]), %%xmm1\n"
+	    "aesdec %%xmm1, %%xmm0\n"
+	    "dec %[n]\n"
+	    "jnz 1b\n"
+	    "movdqu 16(%[rk]), %%xmm1\n"
+	    "aesdeclast %%xmm1, %%xmm0\n"
+	    "movdqu %%xmm0, (%[pt])\n"
+	    : [rk] "+r" (rk), [n] "+r" (n)
+	    : [pt] "r" (pt), [ct] "r" (ct)
+	    : "cc", "memory", "xmm0", "xmm1");
 }
+#endif	/* HAVE_SIMD_X86 */
 
 
 /*
@@ -1454,6 +1531,15 @@ aes_encrypt_block(const void *ks, const uint8_t *pt, uint8_t *ct)
 {
 	aes_key_t	*ksch = (aes_key_t *)ks;
 
+#if defined(HAVE_SIMD_X86) && !defined(__amd64)
+	if (ksch->flags & INTEL_AES_NI_CAPABLE) {
+		kfpu_begin();
+		aes_aesni_encrypt(&ksch->encr_ks.ks32[0], ksch->nr, pt, ct);
+		kfpu_end();
+		return (CRYPTO_SUCCESS);
+	}
+#endif
+
 #ifndef	AES_BYTE_SWAP
 	if (IS_P2ALIGNED2(pt, ct, sizeof (uint32_t))) {
 		/* LINTED:  pointer alignment */
@@ -1507,6 +1593,15 @@ aes_decrypt_block(const void *ks, const uint8_t *ct, uint8_t *pt)
 {
 	aes_key_t	*ksch = (aes_key_t *)ks;
 
+#if defined(HAVE_SIMD_X86) && !defined(__amd64)
+	if (ksch->flags & INTEL_AES_NI_CAPABLE) {
+		kfpu_begin();
+		aes_aesni_decrypt(&ksch->decr_ks.ks32[0], ksch->nr, ct, pt);
+		kfpu_end();
+		return (CRYPTO_SUCCESS);
+	}
+#endif
+
 #ifndef	AES_BYTE_SWAP
 	if (IS_P2ALIGNED2(ct, pt, sizeof (uint32_t))) {
 		/* LINTED:  pointer alignment */
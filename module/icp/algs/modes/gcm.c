@@ -27,6 +27,7 @@
 #include <sys/crypto/common.h>
 #include <sys/crypto/impl.h>
 #include <sys/byteorder.h>
+#include <sys/simd.h>
 
 #ifdef __APPLE__
 // No assembler for now
@@ -54,6 +55,95 @@ struct aes_block {
 	uint64_t b;
 };
 
+#if defined(HAVE_SIMD_X86) && !defined(__amd64)
+static const uint8_t gcm_pclmul_bswap[16] __attribute__((aligned(16))) = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+};
+
+/*
+ * The carry-less multiply from gcm_intel.S, as a single asm statement
+ * for builds that don't assemble the .S files: multiply with four
+ * pclmulqdq, shift the 256-bit product left by one to account for the
+ * bit-reflected representation, then reduce modulo the GCM polynomial.
+ */
+static void
+gcm_mul_pclmul(uint64_t *x_in, uint64_t *y, uint64_t *res)
+{
+	__asm__ __volatile__(
+	    "movdqa %[bs], %%xmm10\n"
+	    "movdqu (%[x]), %%xmm0\n"
+	    "movdqu (%[y]), %%xmm1\n"
+	    "pshufb %%xmm10, %%xmm0\n"
+	    "pshufb %%xmm10, %%xmm1\n"
+
+	    /* <xmm6:xmm3> = xmm0 * xmm1 */
+	    "movdqa %%xmm0, %%xmm3\n"
+	    "pclmulqdq $0x00, %%xmm1, %%xmm3\n"
+	    "movdqa %%xmm0, %%xmm4\n"
+	    "pclmulqdq $0x10, %%xmm1, %%xmm4\n"
+	    "movdqa %%xmm0, %%xmm5\n"
+	    "pclmulqdq $0x01, %%xmm1, %%xmm5\n"
+	    "movdqa %%xmm0, %%xmm6\n"
+	    "pclmulqdq $0x11, %%xmm1, %%xmm6\n"
+	    "pxor %%xmm5, %%xmm4\n"
+	    "movdqa %%xmm4, %%xmm5\n"
+	    "psrldq $8, %%xmm4\n"
+	    "pslldq $8, %%xmm5\n"
+	    "pxor %%xmm5, %%xmm3\n"
+	    "pxor %%xmm4, %%xmm6\n"
+
+	    /* Shift <xmm6:xmm3> left by one bit */
+	    "movdqa %%xmm3, %%xmm7\n"
+	    "movdqa %%xmm6, %%xmm8\n"
+	    "pslld $1, %%xmm3\n"
+	    "pslld $1, %%xmm6\n"
+	    "psrld $31, %%xmm7\n"
+	    "psrld $31, %%xmm8\n"
+	    "movdqa %%xmm7, %%xmm9\n"
+	    "pslldq $4, %%xmm8\n"
+	    "pslldq $4, %%xmm7\n"
+	    "psrldq $12, %%xmm9\n"
+	    "por %%xmm7, %%xmm3\n"
+	    "por %%xmm8, %%xmm6\n"
+	    "por %%xmm9, %%xmm6\n"
+
+	    /* First phase of the reduction */
+	    "movdqa %%xmm3, %%xmm7\n"
+	    "movdqa %%xmm3, %%xmm8\n"
+	    "movdqa %%xmm3, %%xmm9\n"
+	    "pslld $31, %%xmm7\n"
+	    "pslld $30, %%xmm8\n"
+	    "pslld $25, %%xmm9\n"
+	    "pxor %%xmm8, %%xmm7\n"
+	    "pxor %%xmm9, %%xmm7\n"
+	    "movdqa %%xmm7, %%xmm8\n"
+	    "pslldq $12, %%xmm7\n"
+	    "psrldq $4, %%xmm8\n"
+	    "pxor %%xmm7, %%xmm3\n"
+
+	    /* Second phase of the reduction, result in xmm6 */
+	    "movdqa %%xmm3, %%xmm2\n"
+	    "movdqa %%xmm3, %%xmm4\n"
+	    "movdqa %%xmm3, %%xmm5\n"
+	    "psrld $1, %%xmm2\n"
+	    "psrld $2, %%xmm4\n"
+	    "psrld $7, %%xmm5\n"
+	    "pxor %%xmm4, %%xmm2\n"
+	    "pxor %%xmm5, %%xmm2\n"
+	    "pxor %%xmm8, %%xmm2\n"
+	    "pxor %%xmm2, %%xmm3\n"
+	    "pxor %%xmm3, %%xmm6\n"
+
+	    "pshufb %%xmm10, %%xmm6\n"
+	    "movdqu %%xmm6, (%[r])\n"
+	    :
+	    : [x] "r" (x_in), [y] "r" (y), [r] "r" (res),
+	    [bs] "m" (gcm_pclmul_bswap)
+	    : "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+}
+#endif	/* HAVE_SIMD_X86 && !__amd64 */
+
 
 /*
  * gcm_mul()
@@ -74,6 +164,12 @@ gcm_mul(uint64_t *x_in, uint64_t *y, uint64_t *res)
 		gcm_mul_pclmulqdq(x_in, y, res);
 		KPREEMPT_ENABLE;
 	} else
+#elif defined(HAVE_SIMD_X86)
+	if (zfs_pclmulqdq_available() && zfs_ssse3_available()) {
+		kfpu_begin();
+		gcm_mul_pclmul(x_in, y, res);
+		kfpu_end();
+	} else
 #endif	/* __amd64 */
 	{
 		static const uint64_t R = 0xe100000000000000ULL;
@@ -40,6 +40,7 @@
 #define	_SHA2_IMPL
 #include <sys/sha2.h>
 #include <sha2/sha2_consts.h>
+#include <sha2/sha2_impl.h>
 
 #define	_RESTRICT_KYWD
 
@@ -67,6 +68,7 @@ void SHA256TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
 #else
 static void SHA256Transform(SHA2_CTX *, const uint8_t *);
 static void SHA512Transform(SHA2_CTX *, const uint8_t *);
+static void SHA256TransformBlocks(SHA2_CTX *, const uint8_t *, size_t);
 #endif	/* __amd64 */
 
 static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
@@ -605,6 +607,25 @@ SHA512Transform(SHA2_CTX *ctx, const uint8_t *blk)
 	ctx->state.s64[7] += h;
 
 }
+
+/*
+ * Transform num consecutive 64-byte blocks, using the SHA extensions
+ * when the CPU has them.
+ */
+static void
+SHA256TransformBlocks(SHA2_CTX *ctx, const uint8_t *in, size_t num)
+{
+#if defined(HAVE_SIMD_X86)
+	if (sha256_shani_available()) {
+		kfpu_begin();
+		sha256_shani_transform(ctx->state.s32, in, num);
+		kfpu_end();
+		return;
+	}
+#endif
+	for (; num > 0; num--, in += 64)
+		SHA256Transform(ctx, in);
+}
 #endif	/* !__amd64 */
 
 
@@ -788,9 +809,7 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 	uint32_t	i, buf_index, buf_len, buf_limit;
 	const uint8_t	*input = inptr;
 	uint32_t	algotype = ctx->algotype;
-#if defined(__amd64)
 	uint32_t	block_count;
-#endif	/* !__amd64 */
 
 
 	/* check for noop */
@@ -840,25 +859,13 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		if (buf_index) {
 			bcopy(input, &ctx->buf_un.buf8[buf_index], buf_len);
 			if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE)
-				SHA256Transform(ctx, ctx->buf_un.buf8);
+				SHA256TransformBlocks(ctx, ctx->buf_un.buf8, 1);
 			else
 				SHA512Transform(ctx, ctx->buf_un.buf8);
 
 			i = buf_len;
 		}
 
-#if !defined(__amd64)
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA256Transform(ctx, &input[i]);
-			}
-		} else {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA512Transform(ctx, &input[i]);
-			}
-		}
-
-#else
 		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
 			block_count = (input_len - i) >> 6;
 			if (block_count > 0) {
@@ -867,14 +874,19 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 				i += block_count << 6;
 			}
 		} else {
+#if !defined(__amd64)
+			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
+				SHA512Transform(ctx, &input[i]);
+			}
+#else
 			block_count = (input_len - i) >> 7;
 			if (block_count > 0) {
 				SHA512TransformBlocks(ctx, &input[i],
 				    block_count);
 				i += block_count << 7;
 			}
-		}
 #endif	/* !__amd64 */
+		}
 
 		/*
 		 * general optimization:
@@ -0,0 +1,283 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 block transform using the Intel SHA extensions.
+ *
+ * sha256rnds2 works on the state split as ABEF / CDGH rather than the
+ * A..H order kept in SHA2_CTX, so the state is shuffled on the way in
+ * and out.  Each sha256rnds2 does two rounds with the message words
+ * plus constants in the implicit %xmm0 operand; sha256msg1/msg2 expand
+ * the message schedule four words at a time, interleaved with the
+ * rounds.  The whole multi-block loop is a single asm statement so no
+ * vector state lives across statements.
+ */
+
+#include <sys/types.h>
+#include <sys/simd.h>
+#define	_SHA2_IMPL
+#include <sys/sha2.h>
+#include <sha2/sha2_consts.h>
+#include <sha2/sha2_impl.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static const uint32_t sha256_shani_k[64] __attribute__((aligned(16))) = {
+	SHA256_CONST_0, SHA256_CONST_1, SHA256_CONST_2, SHA256_CONST_3,
+	SHA256_CONST_4, SHA256_CONST_5, SHA256_CONST_6, SHA256_CONST_7,
+	SHA256_CONST_8, SHA256_CONST_9, SHA256_CONST_10, SHA256_CONST_11,
+	SHA256_CONST_12, SHA256_CONST_13, SHA256_CONST_14, SHA256_CONST_15,
+	SHA256_CONST_16, SHA256_CONST_17, SHA256_CONST_18, SHA256_CONST_19,
+	SHA256_CONST_20, SHA256_CONST_21, SHA256_CONST_22, SHA256_CONST_23,
+	SHA256_CONST_24, SHA256_CONST_25, SHA256_CONST_26, SHA256_CONST_27,
+	SHA256_CONST_28, SHA256_CONST_29, SHA256_CONST_30, SHA256_CONST_31,
+	SHA256_CONST_32, SHA256_CONST_33, SHA256_CONST_34, SHA256_CONST_35,
+	SHA256_CONST_36, SHA256_CONST_37, SHA256_CONST_38, SHA256_CONST_39,
+	SHA256_CONST_40, SHA256_CONST_41, SHA256_CONST_42, SHA256_CONST_43,
+	SHA256_CONST_44, SHA256_CONST_45, SHA256_CONST_46, SHA256_CONST_47,
+	SHA256_CONST_48, SHA256_CONST_49, SHA256_CONST_50, SHA256_CONST_51,
+	SHA256_CONST_52, SHA256_CONST_53, SHA256_CONST_54, SHA256_CONST_55,
+	SHA256_CONST_56, SHA256_CONST_57, SHA256_CONST_58, SHA256_CONST_59,
+	SHA256_CONST_60, SHA256_CONST_61, SHA256_CONST_62, SHA256_CONST_63
+};
+
+/* pshufb mask to load the big-endian message words */
+static const uint8_t sha256_shani_bswap[16] __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+boolean_t
+sha256_shani_available(void)
+{
+	return (zfs_shani_available() && zfs_ssse3_available() &&
+	    zfs_sse4_1_available());
+}
+
+void
+sha256_shani_transform(uint32_t *state, const void *in, size_t num)
+{
+	if (num == 0)
+		return;
+
+	__asm__ __volatile__(
+	    /* Load the state and reorder it to ABEF / CDGH */
+	    "movdqu 0(%[st]), %%xmm1\n"
+	    "movdqu 16(%[st]), %%xmm2\n"
+	    "pshufd $0xb1, %%xmm1, %%xmm1\n"
+	    "pshufd $0x1b, %%xmm2, %%xmm2\n"
+	    "movdqa %%xmm1, %%xmm7\n"
+	    "palignr $8, %%xmm2, %%xmm1\n"
+	    "pblendw $0xf0, %%xmm7, %%xmm2\n"
+	    "movdqa %[bs], %%xmm8\n"
+
+	    "1:\n"
+	    "movdqa %%xmm1, %%xmm9\n"
+	    "movdqa %%xmm2, %%xmm10\n"
+
+	    /* Rounds 0-3 */
+	    "movdqu 0(%[in]), %%xmm0\n"
+	    "pshufb %%xmm8, %%xmm0\n"
+	    "movdqa %%xmm0, %%xmm3\n"
+	    "paddd 0(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    /* Rounds 4-7 */
+	    "movdqu 16(%[in]), %%xmm0\n"
+	    "pshufb %%xmm8, %%xmm0\n"
+	    "movdqa %%xmm0, %%xmm4\n"
+	    "paddd 16(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm4, %%xmm3\n"
+	    /* Rounds 8-11 */
+	    "movdqu 32(%[in]), %%xmm0\n"
+	    "pshufb %%xmm8, %%xmm0\n"
+	    "movdqa %%xmm0, %%xmm5\n"
+	    "paddd 32(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm5, %%xmm4\n"
+	    /* Rounds 12-15 */
+	    "movdqu 48(%[in]), %%xmm0\n"
+	    "pshufb %%xmm8, %%xmm0\n"
+	    "movdqa %%xmm0, %%xmm6\n"
+	    "paddd 48(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm6, %%xmm7\n"
+	    "palignr $4, %%xmm5, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm3\n"
+	    "sha256msg2 %%xmm6, %%xmm3\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm6, %%xmm5\n"
+	    /* Rounds 16-19 */
+	    "movdqa %%xmm3, %%xmm0\n"
+	    "paddd 64(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm3, %%xmm7\n"
+	    "palignr $4, %%xmm6, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm4\n"
+	    "sha256msg2 %%xmm3, %%xmm4\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm3, %%xmm6\n"
+	    /* Rounds 20-23 */
+	    "movdqa %%xmm4, %%xmm0\n"
+	    "paddd 80(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm4, %%xmm7\n"
+	    "palignr $4, %%xmm3, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm5\n"
+	    "sha256msg2 %%xmm4, %%xmm5\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm4, %%xmm3\n"
+	    /* Rounds 24-27 */
+	    "movdqa %%xmm5, %%xmm0\n"
+	    "paddd 96(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm5, %%xmm7\n"
+	    "palignr $4, %%xmm4, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm6\n"
+	    "sha256msg2 %%xmm5, %%xmm6\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm5, %%xmm4\n"
+	    /* Rounds 28-31 */
+	    "movdqa %%xmm6, %%xmm0\n"
+	    "paddd 112(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm6, %%xmm7\n"
+	    "palignr $4, %%xmm5, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm3\n"
+	    "sha256msg2 %%xmm6, %%xmm3\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm6, %%xmm5\n"
+	    /* Rounds 32-35 */
+	    "movdqa %%xmm3, %%xmm0\n"
+	    "paddd 128(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm3, %%xmm7\n"
+	    "palignr $4, %%xmm6, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm4\n"
+	    "sha256msg2 %%xmm3, %%xmm4\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm3, %%xmm6\n"
+	    /* Rounds 36-39 */
+	    "movdqa %%xmm4, %%xmm0\n"
+	    "paddd 144(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm4, %%xmm7\n"
+	    "palignr $4, %%xmm3, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm5\n"
+	    "sha256msg2 %%xmm4, %%xmm5\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm4, %%xmm3\n"
+	    /* Rounds 40-43 */
+	    "movdqa %%xmm5, %%xmm0\n"
+	    "paddd 160(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm5, %%xmm7\n"
+	    "palignr $4, %%xmm4, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm6\n"
+	    "sha256msg2 %%xmm5, %%xmm6\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm5, %%xmm4\n"
+	    /* Rounds 44-47 */
+	    "movdqa %%xmm6, %%xmm0\n"
+	    "paddd 176(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm6, %%xmm7\n"
+	    "palignr $4, %%xmm5, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm3\n"
+	    "sha256msg2 %%xmm6, %%xmm3\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm6, %%xmm5\n"
+	    /* Rounds 48-51 */
+	    "movdqa %%xmm3, %%xmm0\n"
+	    "paddd 192(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm3, %%xmm7\n"
+	    "palignr $4, %%xmm6, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm4\n"
+	    "sha256msg2 %%xmm3, %%xmm4\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    "sha256msg1 %%xmm3, %%xmm6\n"
+	    /* Rounds 52-55 */
+	    "movdqa %%xmm4, %%xmm0\n"
+	    "paddd 208(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm4, %%xmm7\n"
+	    "palignr $4, %%xmm3, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm5\n"
+	    "sha256msg2 %%xmm4, %%xmm5\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    /* Rounds 56-59 */
+	    "movdqa %%xmm5, %%xmm0\n"
+	    "paddd 224(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "movdqa %%xmm5, %%xmm7\n"
+	    "palignr $4, %%xmm4, %%xmm7\n"
+	    "paddd %%xmm7, %%xmm6\n"
+	    "sha256msg2 %%xmm5, %%xmm6\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+	    /* Rounds 60-63 */
+	    "movdqa %%xmm6, %%xmm0\n"
+	    "paddd 240(%[k]), %%xmm0\n"
+	    "sha256rnds2 %%xmm1, %%xmm2\n"
+	    "pshufd $0x0e, %%xmm0, %%xmm0\n"
+	    "sha256rnds2 %%xmm2, %%xmm1\n"
+
+	    /* Add this block's result to the saved state */
+	    "paddd %%xmm9, %%xmm1\n"
+	    "paddd %%xmm10, %%xmm2\n"
+
+	    "add $64, %[in]\n"
+	    "dec %[n]\n"
+	    "jnz 1b\n"
+
+	    /* Reorder the state back to A..H and store it */
+	    "pshufd $0x1b, %%xmm1, %%xmm1\n"
+	    "pshufd $0xb1, %%xmm2, %%xmm2\n"
+	    "movdqa %%xmm1, %%xmm7\n"
+	    "pblendw $0xf0, %%xmm2, %%xmm1\n"
+	    "palignr $8, %%xmm7, %%xmm2\n"
+	    "movdqu %%xmm1, 0(%[st])\n"
+	    "movdqu %%xmm2, 16(%[st])\n"
+	    : [in] "+r" (in), [n] "+r" (num)
+	    : [st] "r" (state), [k] "r" (sha256_shani_k),
+	    [bs] "m" (sha256_shani_bswap)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+}
+
+#endif /* HAVE_SIMD_X86 */
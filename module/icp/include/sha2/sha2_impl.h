@@ -27,6 +27,7 @@
 #define	_SHA2_IMPL_H
 
 #include <sys/sha2.h>
+#include <sys/simd.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,6 +58,12 @@ typedef struct sha2_hmac_ctx {
 	SHA2_CTX		hc_ocontext;	/* outer SHA2 context */
 } sha2_hmac_ctx_t;
 
+#if defined(HAVE_SIMD_X86)
+/* SHA-256 transform using the SHA extensions, see sha256_shani.c */
+extern boolean_t sha256_shani_available(void);
+extern void sha256_shani_transform(uint32_t *, const void *, size_t);
+#endif
+
 #ifdef	__cplusplus
 }
 #endif
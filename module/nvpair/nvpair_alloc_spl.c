@@ -94,3 +94,106 @@ nv_alloc_t nv_alloc_nosleep_def = {
 nv_alloc_t *nv_alloc_sleep = &nv_alloc_sleep_def;
 nv_alloc_t *nv_alloc_pushpage = &nv_alloc_pushpage_def;
 nv_alloc_t *nv_alloc_nosleep = &nv_alloc_nosleep_def;
+
+/*
+ * Arena allocator, for nvlists that live no longer than one well defined
+ * operation such as an ioctl.  Memory is carved out of large chunks and
+ * nothing is given back until nv_alloc_fini(), so building or unpacking
+ * a list costs a pointer bump per pair rather than a kmem_alloc() and a
+ * kmem_free().  nv_alloc_init() takes the expected total size, which
+ * sizes the first chunk; later chunks double up to NV_ARENA_CHUNK_MAX.
+ */
+#define	NV_ARENA_CHUNK_MIN	(16 * 1024)
+#define	NV_ARENA_CHUNK_MAX	(1024 * 1024)
+
+typedef struct nv_arena_chunk {
+	struct nv_arena_chunk	*nac_next;
+	size_t			nac_size;	/* including this header */
+} nv_arena_chunk_t;
+
+typedef struct nv_arena {
+	nv_arena_chunk_t	*na_chunks;	/* most recent first */
+	uintptr_t		na_cur;		/* next free byte */
+	uintptr_t		na_lim;		/* end of current chunk */
+	size_t			na_chunksz;	/* size of next chunk */
+} nv_arena_t;
+
+static int
+nv_arena_init(nv_alloc_t *nva, va_list valist)
+{
+	size_t hint = va_arg(valist, size_t);
+	nv_arena_t *na;
+
+	na = kmem_zalloc(sizeof (nv_arena_t), KM_SLEEP);
+	na->na_chunksz = MIN(MAX(P2ROUNDUP(hint, NV_ARENA_CHUNK_MIN),
+	    NV_ARENA_CHUNK_MIN), NV_ARENA_CHUNK_MAX);
+	nva->nva_arg = na;
+
+	return (0);
+}
+
+static void *
+nv_arena_alloc(nv_alloc_t *nva, size_t size)
+{
+	nv_arena_t *na = nva->nva_arg;
+	nv_arena_chunk_t *nac;
+	uintptr_t new;
+	size_t chunksz;
+
+	size = P2ROUNDUP(size, sizeof (uint64_t));
+
+	if (na->na_cur + size > na->na_lim) {
+		chunksz = MAX(na->na_chunksz,
+		    sizeof (nv_arena_chunk_t) + size);
+		nac = kmem_alloc(chunksz, KM_SLEEP);
+		nac->nac_next = na->na_chunks;
+		nac->nac_size = chunksz;
+		na->na_chunks = nac;
+		na->na_cur = (uintptr_t)&nac[1];
+		na->na_lim = (uintptr_t)nac + chunksz;
+		na->na_chunksz = MIN(na->na_chunksz * 2, NV_ARENA_CHUNK_MAX);
+	}
+
+	new = na->na_cur;
+	na->na_cur += size;
+
+	return ((void *)new);
+}
+
+/*ARGSUSED*/
+static void
+nv_arena_free(nv_alloc_t *nva, void *buf, size_t size)
+{
+	/* everything is released at once by nv_arena_reset() */
+}
+
+static void
+nv_arena_reset(nv_alloc_t *nva)
+{
+	nv_arena_t *na = nva->nva_arg;
+	nv_arena_chunk_t *nac;
+
+	while ((nac = na->na_chunks) != NULL) {
+		na->na_chunks = nac->nac_next;
+		kmem_free(nac, nac->nac_size);
+	}
+	na->na_cur = na->na_lim = 0;
+}
+
+static void
+nv_arena_fini(nv_alloc_t *nva)
+{
+	nv_arena_reset(nva);
+	kmem_free(nva->nva_arg, sizeof (nv_arena_t));
+	nva->nva_arg = NULL;
+}
+
+const nv_alloc_ops_t nv_arena_ops_def = {
+	nv_arena_init,	/* nv_ao_init() */
+	nv_arena_fini,	/* nv_ao_fini() */
+	nv_arena_alloc,	/* nv_ao_alloc() */
+	nv_arena_free,	/* nv_ao_free() */
+	nv_arena_reset	/* nv_ao_reset() */
+};
+
+const nv_alloc_ops_t *nv_arena_ops = &nv_arena_ops_def;
@@ -1911,6 +1911,34 @@ u8_strcmp(const char *s1, const char *s2, size_t n, int flag, size_t uv,
 	    flag, errnum));
 }
 
+/*
+ * Return the length of the run of 7-bit ASCII characters at the start of
+ * s, ending early at a NUL if stopnull is set.  Eight bytes are checked
+ * at a time: a byte with its top bit set is not ASCII, and a zero byte
+ * sets a top bit in (w - lobits) & ~w.
+ */
+static size_t
+u8_ascii_span(const uchar_t *s, size_t len, boolean_t stopnull)
+{
+	const uint64_t hibits = 0x8080808080808080ULL;
+	const uint64_t lobits = 0x0101010101010101ULL;
+	uint64_t w;
+	size_t n;
+
+	for (n = 0; n + sizeof (w) <= len; n += sizeof (w)) {
+		bcopy(s + n, &w, sizeof (w));
+		if (stopnull)
+			w |= (w - lobits) & ~w;
+		if (w & hibits)
+			break;
+	}
+
+	while (n < len && U8_ISASCII(s[n]) && !(stopnull && s[n] == '\0'))
+		n++;
+
+	return (n);
+}
+
 size_t
 u8_textprep_str(char *inarray, size_t *inlen, char *outarray, size_t *outlen,
 	int flag, size_t unicode_version, int *errnum)
@@ -1970,6 +1998,29 @@ u8_textprep_str(char *inarray, size_t *inlen, char *outarray, size_t *outlen,
 	is_it_toupper = flag & U8_TEXTPREP_TOUPPER;
 	is_it_tolower = flag & U8_TEXTPREP_TOLOWER;
 
+	/*
+	 * Every normalization form leaves 7-bit ASCII text as it is, so
+	 * if the whole input is ASCII and fits, as nearly all file names
+	 * do, only the simple case conversion is left to do and we need
+	 * not look at the Unicode tables at all.  Anything else takes the
+	 * general paths below, which give the same result for ASCII.
+	 */
+	i = u8_ascii_span(ib, *inlen, do_not_ignore_null);
+	if ((ib + i == ibtail || *(ib + i) == '\0') && i <= *outlen) {
+		if (is_it_toupper) {
+			for (j = 0; j < i; j++)
+				ob[j] = U8_ASCII_TOUPPER(ib[j]);
+		} else if (is_it_tolower) {
+			for (j = 0; j < i; j++)
+				ob[j] = U8_ASCII_TOLOWER(ib[j]);
+		} else {
+			bcopy(ib, ob, i);
+		}
+		*inlen -= i;
+		*outlen -= i;
+		return (0);
+	}
+
 	ret_val = 0;
 
 	/*
@@ -133,17 +133,28 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <sys/zfs_context.h>
+#include <zfs_fletcher.h>
 
-/*ARGSUSED*/
+/*
+ * The fletcher_2 state is just the four running sums, so a checksum may
+ * be continued over any split of the buffer that keeps the pieces a
+ * multiple of 16 bytes long.
+ */
 void
-fletcher_2_native(const void *buf, uint64_t size,
-	const void *ctx_template, zio_cksum_t *zcp)
+fletcher_2_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
 	const uint64_t *ip = buf;
 	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
 	uint64_t a0, b0, a1, b1;
 
-	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
+	a0 = zcp->zc_word[0];
+	a1 = zcp->zc_word[1];
+	b0 = zcp->zc_word[2];
+	b1 = zcp->zc_word[3];
+
+	for (; ip < ipend; ip += 2) {
 		a0 += ip[0];
 		a1 += ip[1];
 		b0 += a0;
@@ -153,16 +164,20 @@ fletcher_2_native(const void *buf, uint64_t size,
 	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
-/*ARGSUSED*/
 void
-fletcher_2_byteswap(const void *buf, uint64_t size,
-	const void *ctx_template, zio_cksum_t *zcp)
+fletcher_2_incremental_byteswap(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
 	const uint64_t *ip = buf;
 	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
 	uint64_t a0, b0, a1, b1;
 
-	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
+	a0 = zcp->zc_word[0];
+	a1 = zcp->zc_word[1];
+	b0 = zcp->zc_word[2];
+	b1 = zcp->zc_word[3];
+
+	for (; ip < ipend; ip += 2) {
 		a0 += BSWAP_64(ip[0]);
 		a1 += BSWAP_64(ip[1]);
 		b0 += a0;
@@ -172,93 +187,606 @@ fletcher_2_byteswap(const void *buf, uint64_t size,
 	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
+/*ARGSUSED*/
+void
+fletcher_2_native(const void *buf, uint64_t size,
+	const void *ctx_template, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_2_incremental_native(buf, size, zcp);
+}
+
+/*ARGSUSED*/
 void
-fletcher_4_native(const void *buf, uint64_t size,
+fletcher_2_byteswap(const void *buf, uint64_t size,
 	const void *ctx_template, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_2_incremental_byteswap(buf, size, zcp);
+}
+
+/*
+ * fletcher_4 implementation selection
+ *
+ * fletcher_4 is computed either by the portable scalar loop below or by one
+ * of the vector implementations in zfs_fletcher_{sse,intel,avx512}.c.  At
+ * fletcher_4_init() time each implementation supported by the CPU is timed
+ * against the same buffer and the fastest native and byteswap variants are
+ * remembered.  Until then, and in consumers which never call
+ * fletcher_4_init() (libzfs), the scalar code is used.
+ *
+ * The selection may be overridden at runtime through fletcher_4_impl_set().
+ * "fastest" restores the benchmarked choice, "cycle" rotates through all
+ * supported implementations and is intended for testing only.
+ */
+
+static void
+fletcher_4_scalar_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
+	a = ctx->scalar.zc_word[0];
+	b = ctx->scalar.zc_word[1];
+	c = ctx->scalar.zc_word[2];
+	d = ctx->scalar.zc_word[3];
+
+	for (; ip < ipend; ip++) {
 		a += ip[0];
 		b += a;
 		c += b;
 		d += c;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	ZIO_SET_CHECKSUM(&ctx->scalar, a, b, c, d);
 }
 
-void
-fletcher_4_byteswap(const void *buf, uint64_t size,
-	const void *ctx_template, zio_cksum_t *zcp)
+static void
+fletcher_4_scalar_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
+	a = ctx->scalar.zc_word[0];
+	b = ctx->scalar.zc_word[1];
+	c = ctx->scalar.zc_word[2];
+	d = ctx->scalar.zc_word[3];
+
+	for (; ip < ipend; ip++) {
 		a += BSWAP_32(ip[0]);
 		b += a;
 		c += b;
 		d += c;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	ZIO_SET_CHECKSUM(&ctx->scalar, a, b, c, d);
+}
+
+static boolean_t
+fletcher_4_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+static const fletcher_4_ops_t fletcher_4_scalar_ops = {
+	.compute_native = fletcher_4_scalar_native,
+	.compute_byteswap = fletcher_4_scalar_byteswap,
+	.valid = fletcher_4_scalar_valid,
+	.lanes = 0,
+	.blocksize = sizeof (uint32_t),
+	.name = "scalar"
+};
+
+static const fletcher_4_ops_t *fletcher_4_impls[] = {
+	&fletcher_4_scalar_ops,
+#if defined(HAVE_SIMD_X86)
+	&fletcher_4_sse2_ops,
+	&fletcher_4_ssse3_ops,
+	&fletcher_4_avx2_ops,
+	&fletcher_4_avx512f_ops,
+#endif
+};
+
+#define	FLETCHER_4_IMPL_NUM	ARRAY_SIZE(fletcher_4_impls)
+
+/* Implementations usable on this CPU, filled in by fletcher_4_init() */
+static const fletcher_4_ops_t *fletcher_4_supp_impls[FLETCHER_4_IMPL_NUM];
+static uint32_t fletcher_4_supp_impls_cnt = 0;
+
+/* Benchmark winners, indexed by native (1) or byteswap (0) */
+static const fletcher_4_ops_t *fletcher_4_fastest_impl[2] = {
+	&fletcher_4_scalar_ops, &fletcher_4_scalar_ops
+};
+
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+
+static uint32_t fletcher_4_impl_chosen = IMPL_FASTEST;
+static boolean_t fletcher_4_initialized = B_FALSE;
+
+static struct {
+	const char *fis_name;
+	uint32_t fis_sel;
+} fletcher_4_impl_selectors[] = {
+	{ "fastest",	IMPL_FASTEST },
+	{ "cycle",	IMPL_CYCLE },
+};
+
+/*
+ * Buffers smaller than this are not worth the vector setup and lane
+ * folding; the send stream record checksums mostly land here.
+ */
+#define	FLETCHER_4_SIMD_MIN	(256)
+
+/*
+ * The incremental combine below overflows for chunks approaching 16M, so
+ * larger incremental buffers are folded in pieces of this size.
+ */
+#define	ZFS_FLETCHER_4_INC_MAX_SIZE	(8ULL << 20)
+
+static inline const fletcher_4_ops_t *
+fletcher_4_ops_get(boolean_t native)
+{
+	uint32_t impl = *(volatile uint32_t *)&fletcher_4_impl_chosen;
+	static volatile uint32_t cycle = 0;
+
+	if (!fletcher_4_initialized)
+		return (&fletcher_4_scalar_ops);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		return (fletcher_4_fastest_impl[native ? 1 : 0]);
+	case IMPL_CYCLE:
+		return (fletcher_4_supp_impls[atomic_inc_32_nv(&cycle) %
+		    fletcher_4_supp_impls_cnt]);
+	default:
+		ASSERT3U(impl, <, fletcher_4_supp_impls_cnt);
+		return (fletcher_4_supp_impls[impl]);
+	}
+}
+
+/*
+ * Fold the per-lane accumulators of an L-lane implementation into a
+ * single fletcher_4 checksum.  Lane j (0 <= j < L) holds the fletcher_4
+ * of words j, j + L, j + 2L, ...; rewriting the global position weights
+ * in terms of the per-lane ones gives, for every lane:
+ *
+ *	A += a
+ *	B += L b - j a
+ *	C += L^2 c - L (L + 2j - 1) / 2 b + j (j - 1) / 2 a
+ *	D += L^3 d - L^2 (L + j - 1) c +
+ *	    (L^3 - 3 L^2 (1 - j) + L (3 j^2 - 6 j + 2)) / 6 b -
+ *	    j (j - 1) (j - 2) / 6 a
+ *
+ * All divisions are exact and the arithmetic is modulo 2^64, exactly as in
+ * the scalar loop.
+ */
+static void
+fletcher_4_ctx_fini(const fletcher_4_ctx_t *ctx, uint32_t lanes,
+    zio_cksum_t *zcp)
+{
+	const int64_t L = lanes;
+	uint64_t A = 0, B = 0, C = 0, D = 0;
+	int64_t j;
+
+	for (j = 0; j < L; j++) {
+		uint64_t a = ctx->lanes[0].v[j];
+		uint64_t b = ctx->lanes[1].v[j];
+		uint64_t c = ctx->lanes[2].v[j];
+		uint64_t d = ctx->lanes[3].v[j];
+
+		A += a;
+		B += L * b - j * a;
+		C += L * L * c - (uint64_t)(L * (L + 2 * j - 1) / 2) * b +
+		    (uint64_t)(j * (j - 1) / 2) * a;
+		D += L * L * L * d - (uint64_t)(L * L * (L + j - 1)) * c +
+		    (uint64_t)((L * L * L - 3 * L * L * (1 - j) +
+		    L * (3 * j * j - 6 * j + 2)) / 6) * b -
+		    (uint64_t)(j * (j - 1) * (j - 2) / 6) * a;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+/*
+ * Checksum 'size' bytes of 'buf' with 'ops', continuing from the running
+ * checksum in 'zcp'.  The vector kernels only see a multiple of their
+ * block size; any remainder is finished by the scalar loop.
+ */
+static void
+fletcher_4_compute_impl(const fletcher_4_ops_t *ops, boolean_t native,
+    const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_ctx_t ctx;
+	uint64_t p2size = 0;
+
+	if (ops->lanes != 0 && size >= FLETCHER_4_SIMD_MIN)
+		p2size = P2ALIGN(size, (uint64_t)ops->blocksize);
+
+	if (p2size != 0) {
+		ASSERT0(zcp->zc_word[0] | zcp->zc_word[1] |
+		    zcp->zc_word[2] | zcp->zc_word[3]);
+
+		bzero(&ctx, sizeof (ctx));
+		kfpu_begin();
+		if (native)
+			ops->compute_native(&ctx, buf, p2size);
+		else
+			ops->compute_byteswap(&ctx, buf, p2size);
+		kfpu_end();
+
+		fletcher_4_ctx_fini(&ctx, ops->lanes, zcp);
+	}
+
+	if (p2size < size) {
+		ctx.scalar = *zcp;
+		if (native)
+			fletcher_4_scalar_native(&ctx, (char *)buf + p2size,
+			    size - p2size);
+		else
+			fletcher_4_scalar_byteswap(&ctx, (char *)buf + p2size,
+			    size - p2size);
+		*zcp = ctx.scalar;
+	}
 }
 
+/*ARGSUSED*/
 void
-fletcher_4_incremental_native(const void *buf, uint64_t size,
+fletcher_4_native(const void *buf, uint64_t size,
+	const void *ctx_template, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_compute_impl(fletcher_4_ops_get(B_TRUE), B_TRUE,
+	    buf, size, zcp);
+}
+
+/*ARGSUSED*/
+void
+fletcher_4_byteswap(const void *buf, uint64_t size,
+	const void *ctx_template, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_compute_impl(fletcher_4_ops_get(B_FALSE), B_FALSE,
+	    buf, size, zcp);
+}
+
+/*
+ * Combine the running checksum 'zcp' with 'nzcp', the checksum of the
+ * following 'size' bytes computed from a zero state.  With n = size / 4,
+ * every word of the new chunk adds the old a, b, c to the later sums n,
+ * n (n + 1) / 2 and n (n + 1) (n + 2) / 6 times respectively.
+ */
+static inline void
+fletcher_4_incremental_combine(zio_cksum_t *zcp, const uint64_t size,
+    const zio_cksum_t *nzcp)
+{
+	const uint64_t c1 = size / sizeof (uint32_t);
+	const uint64_t c2 = c1 * (c1 + 1) / 2;
+	const uint64_t c3 = c2 * (c1 + 2) / 3;
+
+	ASSERT3U(size, <=, ZFS_FLETCHER_4_INC_MAX_SIZE);
+
+	zcp->zc_word[3] += nzcp->zc_word[3] + c1 * zcp->zc_word[2] +
+	    c2 * zcp->zc_word[1] + c3 * zcp->zc_word[0];
+	zcp->zc_word[2] += nzcp->zc_word[2] + c1 * zcp->zc_word[1] +
+	    c2 * zcp->zc_word[0];
+	zcp->zc_word[1] += nzcp->zc_word[1] + c1 * zcp->zc_word[0];
+	zcp->zc_word[0] += nzcp->zc_word[0];
+}
+
+static inline void
+fletcher_4_incremental_impl(boolean_t native, const void *buf, uint64_t size,
     zio_cksum_t *zcp)
 {
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	const fletcher_4_ops_t *ops = fletcher_4_ops_get(native);
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+	/* Small records are cheaper to just continue in the scalar loop */
+	if (ops->lanes == 0 || size < FLETCHER_4_SIMD_MIN) {
+		fletcher_4_compute_impl(&fletcher_4_scalar_ops, native,
+		    buf, size, zcp);
+		return;
+	}
 
-	for (; ip < ipend; ip++) {
-		a += ip[0];
-		b += a;
-		c += b;
-		d += c;
+	while (size > 0) {
+		zio_cksum_t nzc;
+		uint64_t len = MIN(size, ZFS_FLETCHER_4_INC_MAX_SIZE);
+
+		ZIO_SET_CHECKSUM(&nzc, 0, 0, 0, 0);
+		fletcher_4_compute_impl(ops, native, buf, len, &nzc);
+		fletcher_4_incremental_combine(zcp, len, &nzc);
+
+		size -= len;
+		buf = (const char *)buf + len;
 	}
+}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+void
+fletcher_4_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	fletcher_4_incremental_impl(B_TRUE, buf, size, zcp);
 }
 
 void
 fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
     zio_cksum_t *zcp)
 {
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	fletcher_4_incremental_impl(B_FALSE, buf, size, zcp);
+}
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+/*
+ * Select the fletcher_4 implementation by name: "fastest", "cycle" or the
+ * name of any implementation supported by this CPU.
+ */
+int
+fletcher_4_impl_set(const char *val)
+{
+	char req_name[32];
+	uint32_t impl = UINT32_MAX - 2;
+	size_t len;
+	int i;
 
-	for (; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
-		b += a;
-		c += b;
-		d += c;
+	if (val == NULL)
+		return (SET_ERROR(EINVAL));
+
+	/* Drop the trailing newline left by sysctl(8) and echo(1) */
+	(void) strlcpy(req_name, val, sizeof (req_name));
+	len = strlen(req_name);
+	while (len > 0 && (req_name[len - 1] == '\n' ||
+	    req_name[len - 1] == ' '))
+		req_name[--len] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(fletcher_4_impl_selectors); i++) {
+		if (strcmp(req_name, fletcher_4_impl_selectors[i].fis_name)
+		    == 0) {
+			impl = fletcher_4_impl_selectors[i].fis_sel;
+			break;
+		}
+	}
+
+	for (i = 0; impl == UINT32_MAX - 2 &&
+	    i < fletcher_4_supp_impls_cnt; i++) {
+		if (strcmp(req_name, fletcher_4_supp_impls[i]->name) == 0)
+			impl = i;
+	}
+
+	if (impl == UINT32_MAX - 2)
+		return (SET_ERROR(EINVAL));
+
+	atomic_swap_32(&fletcher_4_impl_chosen, impl);
+	return (0);
+}
+
+/*
+ * Describe the available implementations in 'buf', with the active one in
+ * square brackets, e.g. "fastest [sse2] ssse3 avx2 scalar".
+ */
+int
+fletcher_4_impl_get(char *buf, size_t size)
+{
+	uint32_t impl = fletcher_4_impl_chosen;
+	size_t off = 0;
+	const char *fmt;
+	int i;
+
+	if (size == 0)
+		return (SET_ERROR(EINVAL));
+	buf[0] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(fletcher_4_impl_selectors); i++) {
+		fmt = (impl == fletcher_4_impl_selectors[i].fis_sel) ?
+		    "[%s] " : "%s ";
+		off += snprintf(buf + off, size - MIN(off, size), fmt,
+		    fletcher_4_impl_selectors[i].fis_name);
+	}
+
+	for (i = 0; i < fletcher_4_supp_impls_cnt; i++) {
+		fmt = (impl == i) ? "[%s] " : "%s ";
+		off += snprintf(buf + off, size - MIN(off, size), fmt,
+		    fletcher_4_supp_impls[i]->name);
+	}
+
+	if (off > 0 && off <= size)
+		buf[off - 1] = '\0';
+
+	return (0);
+}
+
+/*
+ * ==========================================================================
+ * Benchmark
+ * ==========================================================================
+ */
+
+#define	FLETCHER_4_BENCH_SIZE	(128 * 1024)
+#define	FLETCHER_4_BENCH_NS	(MSEC2NSEC(1))
+
+typedef struct fletcher_4_bench_stat {
+	uint64_t native;	/* bytes per second */
+	uint64_t byteswap;
+} fletcher_4_bench_stat_t;
+
+static fletcher_4_bench_stat_t fletcher_4_stat_data[FLETCHER_4_IMPL_NUM];
+static kstat_t *fletcher_4_kstat;
+
+static int
+fletcher_4_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-17s %-15s %-15s\n",
+	    "implementation", "native", "byteswap");
+
+	return (0);
+}
+
+static int
+fletcher_4_kstat_data(char *buf, size_t size, void *data)
+{
+	fletcher_4_bench_stat_t *fbs = data;
+	int id = fbs - fletcher_4_stat_data;
+
+	(void) snprintf(buf, size, "%-17s %-15llu %-15llu\n",
+	    fletcher_4_supp_impls[id]->name, (u_longlong_t)fbs->native,
+	    (u_longlong_t)fbs->byteswap);
+
+	return (0);
+}
+
+static void *
+fletcher_4_kstat_addr(kstat_t *ksp, off_t n)
+{
+	if (n < fletcher_4_supp_impls_cnt)
+		ksp->ks_private = (void *)(fletcher_4_stat_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+/*
+ * Bytes per second of the id'th supported implementation over data_size
+ * bytes at data, measured for at least ns.  Returns 0 once id is past the
+ * last supported implementation, otherwise sets *name to its name.
+ */
+uint64_t
+fletcher_4_impl_bench(uint32_t id, boolean_t native, const void *data,
+    uint64_t data_size, hrtime_t ns, const char **name)
+{
+	const fletcher_4_ops_t *ops;
+	uint64_t run_count = 0;
+	hrtime_t start, run_time_ns;
+	zio_cksum_t zc;
+
+	if (id >= fletcher_4_supp_impls_cnt)
+		return (0);
+
+	ops = fletcher_4_supp_impls[id];
+	if (name != NULL)
+		*name = ops->name;
+
+	start = gethrtime();
+	do {
+		int l;
+
+		for (l = 0; l < 32; l++, run_count++) {
+			ZIO_SET_CHECKSUM(&zc, 0, 0, 0, 0);
+			fletcher_4_compute_impl(ops, native,
+			    data, data_size, &zc);
+		}
+		run_time_ns = gethrtime() - start;
+	} while (run_time_ns < ns);
+
+	return (data_size * run_count * NANOSEC / run_time_ns);
+}
+
+static void
+fletcher_4_benchmark_impl(boolean_t native, char *data, uint64_t data_size)
+{
+	uint64_t run_bw, best_run_bw = 0;
+	uint32_t i, best_id = 0;
+
+	for (i = 0; i < fletcher_4_supp_impls_cnt; i++) {
+		run_bw = fletcher_4_impl_bench(i, native, data, data_size,
+		    FLETCHER_4_BENCH_NS, NULL);
+
+		if (native)
+			fletcher_4_stat_data[i].native = run_bw;
+		else
+			fletcher_4_stat_data[i].byteswap = run_bw;
+
+		if (run_bw > best_run_bw) {
+			best_run_bw = run_bw;
+			best_id = i;
+		}
+	}
+
+	fletcher_4_fastest_impl[native ? 1 : 0] =
+	    fletcher_4_supp_impls[best_id];
+}
+
+void
+fletcher_4_init(void)
+{
+	const uint64_t data_size = FLETCHER_4_BENCH_SIZE;
+	zio_cksum_t zc_ref, zc;
+	char *databuf;
+	uint64_t i;
+	int c, n;
+
+	if (fletcher_4_initialized)
+		return;
+
+	databuf = kmem_alloc(data_size, KM_SLEEP);
+	for (i = 0; i < data_size / sizeof (uint64_t); i++)
+		((uint64_t *)databuf)[i] = (uintptr_t)(databuf + i);
+
+	/*
+	 * Only keep implementations which the CPU supports and which agree
+	 * with the scalar code on the benchmark buffer.
+	 */
+	fletcher_4_supp_impls_cnt = 0;
+	for (c = 0; c < FLETCHER_4_IMPL_NUM; c++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[c];
+		boolean_t ok = ops->valid();
+
+		for (n = 0; ok && n < 2; n++) {
+			ZIO_SET_CHECKSUM(&zc_ref, 0, 0, 0, 0);
+			fletcher_4_compute_impl(&fletcher_4_scalar_ops, n,
+			    databuf, data_size - 20, &zc_ref);
+			ZIO_SET_CHECKSUM(&zc, 0, 0, 0, 0);
+			fletcher_4_compute_impl(ops, n,
+			    databuf, data_size - 20, &zc);
+			ok = ZIO_CHECKSUM_EQUAL(zc, zc_ref);
+		}
+
+		if (ok)
+			fletcher_4_supp_impls[fletcher_4_supp_impls_cnt++] =
+			    ops;
+		else if (ops->valid())
+			cmn_err(CE_WARN, "fletcher_4: %s implementation "
+			    "disabled, result mismatch", ops->name);
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	fletcher_4_benchmark_impl(B_FALSE, databuf, data_size);
+	fletcher_4_benchmark_impl(B_TRUE, databuf, data_size);
+
+	kmem_free(databuf, data_size);
+
+	fletcher_4_kstat = kstat_create("zfs", 0, "fletcher_4_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (fletcher_4_kstat != NULL) {
+		fletcher_4_kstat->ks_data = NULL;
+		fletcher_4_kstat->ks_ndata = fletcher_4_supp_impls_cnt;
+		kstat_set_raw_ops(fletcher_4_kstat, fletcher_4_kstat_headers,
+		    fletcher_4_kstat_data, fletcher_4_kstat_addr);
+		kstat_install(fletcher_4_kstat);
+	}
+
+	fletcher_4_initialized = B_TRUE;
+}
+
+void
+fletcher_4_fini(void)
+{
+	if (fletcher_4_kstat != NULL) {
+		kstat_delete(fletcher_4_kstat);
+		fletcher_4_kstat = NULL;
+	}
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
 EXPORT_SYMBOL(fletcher_2_native);
 EXPORT_SYMBOL(fletcher_2_byteswap);
+EXPORT_SYMBOL(fletcher_2_incremental_native);
+EXPORT_SYMBOL(fletcher_2_incremental_byteswap);
 EXPORT_SYMBOL(fletcher_4_native);
 EXPORT_SYMBOL(fletcher_4_byteswap);
 EXPORT_SYMBOL(fletcher_4_incremental_native);
 EXPORT_SYMBOL(fletcher_4_incremental_byteswap);
+EXPORT_SYMBOL(fletcher_4_init);
+EXPORT_SYMBOL(fletcher_4_fini);
+EXPORT_SYMBOL(fletcher_4_impl_set);
 #endif
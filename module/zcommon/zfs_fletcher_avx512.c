@@ -0,0 +1,136 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512F fletcher_4.
+ *
+ * Eight 64-bit lanes per accumulator in %zmm0..%zmm3, two rounds of eight
+ * words per 64-byte iteration.  AVX-512F has no byte shuffle on %zmm, so
+ * the byteswap variant swaps with the AVX2 vpshufb before widening.
+ */
+
+#include <sys/types.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static inline void
+fletcher_4_avx512f_load(const fletcher_4_ctx_t *ctx)
+{
+	__asm__ __volatile__(
+	    "vmovdqu64 %0, %%zmm0\n"
+	    "vmovdqu64 %1, %%zmm1\n"
+	    "vmovdqu64 %2, %%zmm2\n"
+	    "vmovdqu64 %3, %%zmm3\n"
+	    :: "m" (ctx->lanes[0]), "m" (ctx->lanes[1]),
+	    "m" (ctx->lanes[2]), "m" (ctx->lanes[3]));
+}
+
+static inline void
+fletcher_4_avx512f_save(fletcher_4_ctx_t *ctx)
+{
+	__asm__ __volatile__(
+	    "vmovdqu64 %%zmm0, %0\n"
+	    "vmovdqu64 %%zmm1, %1\n"
+	    "vmovdqu64 %%zmm2, %2\n"
+	    "vmovdqu64 %%zmm3, %3\n"
+	    "vzeroupper\n"
+	    : "=m" (ctx->lanes[0]), "=m" (ctx->lanes[1]),
+	    "=m" (ctx->lanes[2]), "=m" (ctx->lanes[3]));
+}
+
+#define	FLETCHER_4_AVX512_ACCUMULATE(reg)		\
+	"vpaddq %%" reg ", %%zmm0, %%zmm0\n"		\
+	"vpaddq %%zmm0, %%zmm1, %%zmm1\n"		\
+	"vpaddq %%zmm1, %%zmm2, %%zmm2\n"		\
+	"vpaddq %%zmm2, %%zmm3, %%zmm3\n"
+
+static void
+fletcher_4_avx512f_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_avx512f_load(ctx);
+
+	for (; ip < ipend; ip += 8) {
+		__asm__ __volatile__(
+		    "vpmovzxdq %0, %%zmm4\n"
+		    "vpmovzxdq %1, %%zmm5\n"
+		    FLETCHER_4_AVX512_ACCUMULATE("zmm4")
+		    FLETCHER_4_AVX512_ACCUMULATE("zmm5")
+		    :: "m" (ip[0]), "m" (ip[4]));
+	}
+
+	fletcher_4_avx512f_save(ctx);
+}
+
+static void
+fletcher_4_avx512f_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	static const zfs_fletcher_lanes_t mask = {{
+	    0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL,
+	    0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL, 0, 0, 0, 0
+	}};
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_avx512f_load(ctx);
+
+	__asm__ __volatile__("vmovdqa %0, %%ymm7" :: "m" (mask));
+
+	for (; ip < ipend; ip += 8) {
+		__asm__ __volatile__(
+		    "vmovdqu %0, %%ymm4\n"
+		    "vmovdqu %1, %%ymm5\n"
+		    "vpshufb %%ymm7, %%ymm4, %%ymm4\n"
+		    "vpshufb %%ymm7, %%ymm5, %%ymm5\n"
+		    "vpmovzxdq %%ymm4, %%zmm4\n"
+		    "vpmovzxdq %%ymm5, %%zmm5\n"
+		    FLETCHER_4_AVX512_ACCUMULATE("zmm4")
+		    FLETCHER_4_AVX512_ACCUMULATE("zmm5")
+		    :: "m" (ip[0]), "m" (ip[4]));
+	}
+
+	fletcher_4_avx512f_save(ctx);
+}
+
+static boolean_t
+fletcher_4_avx512f_valid(void)
+{
+	return (zfs_avx512f_available() && zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx512f_ops = {
+	.compute_native = fletcher_4_avx512f_native,
+	.compute_byteswap = fletcher_4_avx512f_byteswap,
+	.valid = fletcher_4_avx512f_valid,
+	.lanes = 8,
+	.blocksize = 64,
+	.name = "avx512f"
+};
+
+#endif /* HAVE_SIMD_X86 */
@@ -0,0 +1,134 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 fletcher_4.
+ *
+ * Four 64-bit lanes per accumulator in %ymm0..%ymm3.  vpmovzxdq widens
+ * four input words straight from memory, so each 32-byte iteration is two
+ * rounds of four words.
+ */
+
+#include <sys/types.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static inline void
+fletcher_4_avx2_load(const fletcher_4_ctx_t *ctx)
+{
+	__asm__ __volatile__(
+	    "vmovdqa %0, %%ymm0\n"
+	    "vmovdqa %1, %%ymm1\n"
+	    "vmovdqa %2, %%ymm2\n"
+	    "vmovdqa %3, %%ymm3\n"
+	    :: "m" (ctx->lanes[0]), "m" (ctx->lanes[1]),
+	    "m" (ctx->lanes[2]), "m" (ctx->lanes[3]));
+}
+
+static inline void
+fletcher_4_avx2_save(fletcher_4_ctx_t *ctx)
+{
+	__asm__ __volatile__(
+	    "vmovdqa %%ymm0, %0\n"
+	    "vmovdqa %%ymm1, %1\n"
+	    "vmovdqa %%ymm2, %2\n"
+	    "vmovdqa %%ymm3, %3\n"
+	    "vzeroupper\n"
+	    : "=m" (ctx->lanes[0]), "=m" (ctx->lanes[1]),
+	    "=m" (ctx->lanes[2]), "=m" (ctx->lanes[3]));
+}
+
+#define	FLETCHER_4_AVX2_ACCUMULATE(reg)			\
+	"vpaddq %%" reg ", %%ymm0, %%ymm0\n"		\
+	"vpaddq %%ymm0, %%ymm1, %%ymm1\n"		\
+	"vpaddq %%ymm1, %%ymm2, %%ymm2\n"		\
+	"vpaddq %%ymm2, %%ymm3, %%ymm3\n"
+
+static void
+fletcher_4_avx2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_avx2_load(ctx);
+
+	for (; ip < ipend; ip += 4) {
+		__asm__ __volatile__(
+		    "vpmovzxdq %0, %%ymm4\n"
+		    "vpmovzxdq %1, %%ymm5\n"
+		    FLETCHER_4_AVX2_ACCUMULATE("ymm4")
+		    FLETCHER_4_AVX2_ACCUMULATE("ymm5")
+		    :: "m" (ip[0]), "m" (ip[2]));
+	}
+
+	fletcher_4_avx2_save(ctx);
+}
+
+static void
+fletcher_4_avx2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	/* Reverse the low dword of every qword, the zero high dword stays */
+	static const zfs_fletcher_lanes_t mask = {{
+	    0xFFFFFFFF00010203ULL, 0xFFFFFFFF08090A0BULL,
+	    0xFFFFFFFF00010203ULL, 0xFFFFFFFF08090A0BULL, 0, 0, 0, 0
+	}};
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_avx2_load(ctx);
+
+	__asm__ __volatile__("vmovdqa %0, %%ymm7" :: "m" (mask));
+
+	for (; ip < ipend; ip += 4) {
+		__asm__ __volatile__(
+		    "vpmovzxdq %0, %%ymm4\n"
+		    "vpmovzxdq %1, %%ymm5\n"
+		    "vpshufb %%ymm7, %%ymm4, %%ymm4\n"
+		    "vpshufb %%ymm7, %%ymm5, %%ymm5\n"
+		    FLETCHER_4_AVX2_ACCUMULATE("ymm4")
+		    FLETCHER_4_AVX2_ACCUMULATE("ymm5")
+		    :: "m" (ip[0]), "m" (ip[2]));
+	}
+
+	fletcher_4_avx2_save(ctx);
+}
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx2_ops = {
+	.compute_native = fletcher_4_avx2_native,
+	.compute_byteswap = fletcher_4_avx2_byteswap,
+	.valid = fletcher_4_avx2_valid,
+	.lanes = 4,
+	.blocksize = 32,
+	.name = "avx2"
+};
+
+#endif /* HAVE_SIMD_X86 */
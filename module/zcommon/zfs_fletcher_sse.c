@@ -0,0 +1,179 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 fletcher_4.
+ *
+ * Two 64-bit lanes per accumulator: %xmm0..%xmm3 hold a, b, c and d, %xmm4
+ * is kept zero for widening the 32-bit input words.  Each 16-byte load
+ * feeds words 0 and 1 to the lanes, then words 2 and 3.
+ */
+
+#include <sys/types.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static inline void
+fletcher_4_sse2_load(const fletcher_4_ctx_t *ctx)
+{
+	__asm__ __volatile__(
+	    "movdqa %0, %%xmm0\n"
+	    "movdqa %1, %%xmm1\n"
+	    "movdqa %2, %%xmm2\n"
+	    "movdqa %3, %%xmm3\n"
+	    "pxor %%xmm4, %%xmm4\n"
+	    :: "m" (ctx->lanes[0]), "m" (ctx->lanes[1]),
+	    "m" (ctx->lanes[2]), "m" (ctx->lanes[3]));
+}
+
+static inline void
+fletcher_4_sse2_save(fletcher_4_ctx_t *ctx)
+{
+	__asm__ __volatile__(
+	    "movdqa %%xmm0, %0\n"
+	    "movdqa %%xmm1, %1\n"
+	    "movdqa %%xmm2, %2\n"
+	    "movdqa %%xmm3, %3\n"
+	    : "=m" (ctx->lanes[0]), "=m" (ctx->lanes[1]),
+	    "=m" (ctx->lanes[2]), "=m" (ctx->lanes[3]));
+}
+
+/* Accumulate the four words in %xmm5 into the lanes */
+#define	FLETCHER_4_SSE_ACCUMULATE			\
+	"movdqa %%xmm5, %%xmm6\n"			\
+	"punpckldq %%xmm4, %%xmm5\n"			\
+	"punpckhdq %%xmm4, %%xmm6\n"			\
+	"paddq %%xmm5, %%xmm0\n"			\
+	"paddq %%xmm0, %%xmm1\n"			\
+	"paddq %%xmm1, %%xmm2\n"			\
+	"paddq %%xmm2, %%xmm3\n"			\
+	"paddq %%xmm6, %%xmm0\n"			\
+	"paddq %%xmm0, %%xmm1\n"			\
+	"paddq %%xmm1, %%xmm2\n"			\
+	"paddq %%xmm2, %%xmm3\n"
+
+static void
+fletcher_4_sse2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_sse2_load(ctx);
+
+	for (; ip < ipend; ip += 2) {
+		__asm__ __volatile__(
+		    "movdqu %0, %%xmm5\n"
+		    FLETCHER_4_SSE_ACCUMULATE
+		    :: "m" (*ip));
+	}
+
+	fletcher_4_sse2_save(ctx);
+}
+
+static void
+fletcher_4_sse2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_sse2_load(ctx);
+
+	/*
+	 * No byte shuffle in SSE2: swap the bytes of each 16-bit half, then
+	 * the halves of each 32-bit word.
+	 */
+	for (; ip < ipend; ip += 2) {
+		__asm__ __volatile__(
+		    "movdqu %0, %%xmm5\n"
+		    "movdqa %%xmm5, %%xmm6\n"
+		    "psrlw $8, %%xmm5\n"
+		    "psllw $8, %%xmm6\n"
+		    "por %%xmm6, %%xmm5\n"
+		    "pshuflw $0xb1, %%xmm5, %%xmm5\n"
+		    "pshufhw $0xb1, %%xmm5, %%xmm5\n"
+		    FLETCHER_4_SSE_ACCUMULATE
+		    :: "m" (*ip));
+	}
+
+	fletcher_4_sse2_save(ctx);
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.compute_native = fletcher_4_sse2_native,
+	.compute_byteswap = fletcher_4_sse2_byteswap,
+	.valid = fletcher_4_sse2_valid,
+	.lanes = 2,
+	.blocksize = 16,
+	.name = "sse2"
+};
+
+static void
+fletcher_4_ssse3_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	static const zfs_fletcher_lanes_t mask = {{
+	    0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL, 0, 0, 0, 0, 0, 0
+	}};
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = (const uint64_t *)((const uint8_t *)ip + size);
+
+	fletcher_4_sse2_load(ctx);
+
+	__asm__ __volatile__("movdqa %0, %%xmm7" :: "m" (mask));
+
+	for (; ip < ipend; ip += 2) {
+		__asm__ __volatile__(
+		    "movdqu %0, %%xmm5\n"
+		    "pshufb %%xmm7, %%xmm5\n"
+		    FLETCHER_4_SSE_ACCUMULATE
+		    :: "m" (*ip));
+	}
+
+	fletcher_4_sse2_save(ctx);
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.compute_native = fletcher_4_sse2_native,
+	.compute_byteswap = fletcher_4_ssse3_byteswap,
+	.valid = fletcher_4_ssse3_valid,
+	.lanes = 2,
+	.blocksize = 16,
+	.name = "ssse3"
+};
+
+#endif /* HAVE_SIMD_X86 */
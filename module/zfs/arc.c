@@ -90,7 +90,9 @@
  *
  * buf_hash_find() returns the appropriate mutex (held) when it
  * locates the requested buffer in the hash table.  It returns
- * NULL for the mutex if the buffer was not in the table.
+ * NULL for the mutex if the buffer was not in the table.  A lookup
+ * in an empty hash chain, which is what most misses find, does not
+ * take the mutex at all.
  *
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
@@ -130,14 +132,14 @@
  * the arc_buf_hdr_t that will point to the data block in memory. A block can
  * only be read by a consumer if it has an l1arc_buf_hdr_t. The L1ARC
  * caches data in two ways -- in a list of ARC buffers (arc_buf_t) and
- * also in the arc_buf_hdr_t's private physical data block pointer (b_pdata).
+ * also in the arc_buf_hdr_t's private physical data block pointer (b_pabd).
  *
  * The L1ARC's data pointer may or may not be uncompressed. The ARC has the
- * ability to store the physical data (b_pdata) associated with the DVA of the
- * arc_buf_hdr_t. Since the b_pdata is a copy of the on-disk physical block,
+ * ability to store the physical data (b_pabd) associated with the DVA of the
+ * arc_buf_hdr_t. Since the b_pabd is a copy of the on-disk physical block,
  * it will match its on-disk compression characteristics. This behavior can be
  * disabled by setting 'zfs_compressed_arc_enabled' to B_FALSE. When the
- * compressed ARC functionality is disabled, the b_pdata will point to an
+ * compressed ARC functionality is disabled, the b_pabd will point to an
  * uncompressed version of the on-disk data.
  *
  * Data in the L1ARC is not accessed by consumers of the ARC directly. Each
@@ -176,7 +178,7 @@
  *   | l1arc_buf_hdr_t
  *   |           |              arc_buf_t
  *   | b_buf     +------------>+-----------+      arc_buf_t
- *   | b_pdata   +-+           |b_next     +---->+-----------+
+ *   | b_pabd    +-+           |b_next     +---->+-----------+
  *   +-----------+ |           |-----------|     |b_next     +-->NULL
  *                 |           |b_comp = T |     +-----------+
  *                 |           |b_data     +-+   |b_comp = F |
@@ -193,8 +195,8 @@
  * When a consumer reads a block, the ARC must first look to see if the
  * arc_buf_hdr_t is cached. If the hdr is cached then the ARC allocates a new
  * arc_buf_t and either copies uncompressed data into a new data buffer from an
- * existing uncompressed arc_buf_t, decompresses the hdr's b_pdata buffer into a
- * new data buffer, or shares the hdr's b_pdata buffer, depending on whether the
+ * existing uncompressed arc_buf_t, decompresses the hdr's b_pabd buffer into a
+ * new data buffer, or shares the hdr's b_pabd buffer, depending on whether the
  * hdr is compressed and the desired compression characteristics of the
  * arc_buf_t consumer. If the arc_buf_t ends up sharing data with the
  * arc_buf_hdr_t and both of them are uncompressed then the arc_buf_t must be
@@ -218,7 +220,7 @@
  *                |           |                 arc_buf_t    (shared)
  *                |    b_buf  +------------>+---------+      arc_buf_t
  *                |           |             |b_next   +---->+---------+
- *                |  b_pdata  +-+           |---------|     |b_next   +-->NULL
+ *                |  b_pabd   +-+           |---------|     |b_next   +-->NULL
  *                +-----------+ |           |         |     +---------+
  *                              |           |b_data   +-+   |         |
  *                              |           +---------+ |   |b_data   +-+
@@ -232,19 +234,19 @@
  *                                    |                    +------+     |
  *                                    +---------------------------------+
  *
- * Writing to the ARC requires that the ARC first discard the hdr's b_pdata
+ * Writing to the ARC requires that the ARC first discard the hdr's b_pabd
  * since the physical block is about to be rewritten. The new data contents
  * will be contained in the arc_buf_t. As the I/O pipeline performs the write,
  * it may compress the data before writing it to disk. The ARC will be called
  * with the transformed data and will bcopy the transformed on-disk block into
- * a newly allocated b_pdata. Writes are always done into buffers which have
+ * a newly allocated b_pabd. Writes are always done into buffers which have
  * either been loaned (and hence are new and don't have other readers) or
  * buffers which have been released (and hence have their own hdr, if there
  * were originally other readers of the buf's original hdr). This ensures that
  * the ARC only needs to update a single buf and its hdr after a write occurs.
  *
- * When the L2ARC is in use, it will also take advantage of the b_pdata. The
- * L2ARC will always write the contents of b_pdata to the L2ARC. This means
+ * When the L2ARC is in use, it will also take advantage of the b_pabd. The
+ * L2ARC will always write the contents of b_pabd to the L2ARC. This means
  * that when compressed ARC is enabled that the L2ARC blocks are identical
  * to the on-disk block in the main data pool. This provides a significant
  * advantage since the ARC can leverage the bp's checksum when reading from the
@@ -266,6 +268,8 @@
 #include <sys/vdev_impl.h>
 #include <sys/dsl_pool.h>
 #include <sys/multilist.h>
+#include <sys/abd.h>
+#include <sys/zfs_lockstat.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <vm/anon.h>
@@ -298,6 +302,8 @@ static kmutex_t		arc_reclaim_lock;
 static kcondvar_t	arc_reclaim_thread_cv;
 static boolean_t	arc_reclaim_thread_exit;
 static kcondvar_t	arc_reclaim_waiters_cv;
+/* a wakeup arrived while the reclaim thread was busy; don't sleep */
+static volatile boolean_t arc_reclaim_pending;
 
 uint_t arc_reduce_dnlc_percent = 3;
 
@@ -310,10 +316,41 @@ uint_t arc_reduce_dnlc_percent = 3;
  */
 int zfs_arc_evict_batch_limit = 10;
 
+/*
+ * The number of threads that evict from the sublists of an arc state in
+ * parallel.  0 sizes it from the number of CPUs; 1 keeps all eviction on
+ * the calling thread.  Only read in arc_init().
+ */
+int zfs_arc_evict_threads = 0;
+
+/*
+ * Insert buffers into the sublist of the inserting CPU, rather than the
+ * one their DVA hashes to.  See arc_state_multilist_index_func().
+ */
+int zfs_arc_sublist_by_cpu = 0;
+static taskq_t		*arc_evict_taskq;
+
+typedef struct arc_evict_wait {
+	kmutex_t	aew_lock;
+	kcondvar_t	aew_cv;
+	int		aew_pending;
+} arc_evict_wait_t;
+
+typedef struct arc_evict_arg {
+	multilist_t		*eva_ml;
+	int			eva_idx;
+	arc_buf_hdr_t		*eva_marker;
+	uint64_t		eva_spa;
+	int64_t			eva_bytes;
+	boolean_t		eva_over_quota;
+	uint64_t		eva_evicted;
+	arc_evict_wait_t	*eva_wait;
+} arc_evict_arg_t;
+
 /* number of seconds before growing cache again */
 static int		arc_grow_retry = 60;
 
-/* shift of arc_c for calculating overflow limit in arc_get_data_buf */
+/* shift of arc_c for calculating overflow limit in arc_get_data_impl */
 int		zfs_arc_overflow_shift = 8;
 
 /* shift of arc_c for calculating both min and max arc_p */
@@ -363,6 +400,7 @@ int zfs_arc_grow_retry = 0;
 int zfs_arc_shrink_shift = 0;
 int zfs_arc_p_min_shift = 0;
 int zfs_arc_average_blocksize = 8 * 1024; /* 8KB */
+uint64_t zfs_arc_free_target = 0;	/* bottom of the band, 0 for auto */
 
 boolean_t zfs_compressed_arc_enabled = B_TRUE;
 
@@ -460,6 +498,14 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_ineligible;
 	kstat_named_t arcstat_evict_l2_skip;
+	/*
+	 * Sequential (scan) buffers: bytes read in as part of a long
+	 * zfetch stream, bytes of those evicted without ever leaving the
+	 * MRU state, and the number of MFU promotions they were denied.
+	 */
+	kstat_named_t arcstat_sequential_admits;
+	kstat_named_t arcstat_evict_sequential;
+	kstat_named_t arcstat_sequential_mfu_skips;
 	kstat_named_t arcstat_hash_elements;
 	kstat_named_t arcstat_hash_elements_max;
 	kstat_named_t arcstat_hash_collisions;
@@ -471,13 +517,13 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_c_max;
 	kstat_named_t arcstat_size;
 	/*
-	 * Number of compressed bytes stored in the arc_buf_hdr_t's b_pdata.
+	 * Number of compressed bytes stored in the arc_buf_hdr_t's b_pabd.
 	 * Note that the compressed bytes may match the uncompressed bytes
 	 * if the block is either not compressed or compressed arc is disabled.
 	 */
 	kstat_named_t arcstat_compressed_size;
 	/*
-	 * Uncompressed size of the data stored in b_pdata. If compressed
+	 * Uncompressed size of the data stored in b_pabd. If compressed
 	 * arc is disabled then this value will be identical to the stat
 	 * above.
 	 */
@@ -621,9 +667,21 @@ typedef struct arc_stats {
 	 * ARC_BUFC_METADATA, and linked off the arc_mru_ghost state.
 	 */
 	kstat_named_t arcstat_mfu_ghost_evictable_metadata;
+	/*
+	 * The longest sublist of the arc_mru and arc_mfu states, as a
+	 * percentage of their mean sublist length (the larger of the data
+	 * and metadata lists').  100 means the buffers are spread evenly.
+	 */
+	kstat_named_t arcstat_mru_sublist_skew;
+	kstat_named_t arcstat_mfu_sublist_skew;
 	kstat_named_t arcstat_l2_hits;
 	kstat_named_t arcstat_l2_misses;
 	kstat_named_t arcstat_l2_feeds;
+	/*
+	 * Feeds whose write size was cut back since the device took
+	 * longer than l2arc_feed_min_ms to complete the previous write.
+	 */
+	kstat_named_t arcstat_l2_feeds_throttled;
 	kstat_named_t arcstat_l2_rw_clash;
 	kstat_named_t arcstat_l2_read_bytes;
 	kstat_named_t arcstat_l2_write_bytes;
@@ -642,6 +700,30 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_size;
 	kstat_named_t arcstat_l2_asize;
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Memory taken by the headers of buffers only in the L2ARC, as
+	 * parts per million of the space they take on the cache devices.
+	 * Multiplying l2_asize by this gives the RAM a larger device
+	 * would need for buffers like the ones it holds now.
+	 */
+	kstat_named_t arcstat_l2_hdr_overhead_ppm;
+	/*
+	 * Buffers lz4-compressed for the L2ARC by l2arc_compress, those
+	 * that were written as is since they didn't compress well, and
+	 * the cache device space currently saved by the former.
+	 */
+	kstat_named_t arcstat_l2_compress_successes;
+	kstat_named_t arcstat_l2_compress_failures;
+	kstat_named_t arcstat_l2_compress_saved;
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_meta_used;
 	kstat_named_t arcstat_meta_limit;
@@ -653,6 +735,15 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_loaned_bytes;
 	kstat_named_t arcstat_dbuf_redirtied;
 	kstat_named_t arcstat_arc_no_grow;
+	/*
+	 * The memory pressure level as of the last pass of the reclaim
+	 * thread (see arc_pressure_t), and the bytes evicted since the ARC
+	 * was shrunk for the lack of free memory, or merely to stay within
+	 * its target size.
+	 */
+	kstat_named_t arcstat_pressure_level;
+	kstat_named_t arcstat_evict_pressure;
+	kstat_named_t arcstat_evict_size;
 } arc_stats_t;
 
 static arc_stats_t arc_stats = {
@@ -678,6 +769,9 @@ static arc_stats_t arc_stats = {
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
 	{ "evict_l2_skip",		KSTAT_DATA_UINT64 },
+	{ "sequential_admits",		KSTAT_DATA_UINT64 },
+	{ "evict_sequential",		KSTAT_DATA_UINT64 },
+	{ "sequential_mfu_skips",	KSTAT_DATA_UINT64 },
 	{ "hash_elements",		KSTAT_DATA_UINT64 },
 	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
@@ -710,9 +804,12 @@ static arc_stats_t arc_stats = {
 	{ "mfu_ghost_size",		KSTAT_DATA_UINT64 },
 	{ "mfu_ghost_evictable_data",	KSTAT_DATA_UINT64 },
 	{ "mfu_ghost_evictable_metadata", KSTAT_DATA_UINT64 },
+	{ "mru_sublist_skew",		KSTAT_DATA_UINT64 },
+	{ "mfu_sublist_skew",		KSTAT_DATA_UINT64 },
 	{ "l2_hits",			KSTAT_DATA_UINT64 },
 	{ "l2_misses",			KSTAT_DATA_UINT64 },
 	{ "l2_feeds",			KSTAT_DATA_UINT64 },
+	{ "l2_feeds_throttled",		KSTAT_DATA_UINT64 },
 	{ "l2_rw_clash",		KSTAT_DATA_UINT64 },
 	{ "l2_read_bytes",		KSTAT_DATA_UINT64 },
 	{ "l2_write_bytes",		KSTAT_DATA_UINT64 },
@@ -731,6 +828,19 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_hdr_overhead_ppm",	KSTAT_DATA_UINT64 },
+	{ "l2_compress_successes",	KSTAT_DATA_UINT64 },
+	{ "l2_compress_failures",	KSTAT_DATA_UINT64 },
+	{ "l2_compress_saved",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "arc_meta_used",		KSTAT_DATA_UINT64 },
 	{ "arc_meta_limit",		KSTAT_DATA_UINT64 },
@@ -742,6 +852,9 @@ static arc_stats_t arc_stats = {
 	{ "loaned_bytes", KSTAT_DATA_UINT64 },
 	{ "dbuf_redirtied", KSTAT_DATA_UINT64 },
 	{ "arc_no_grow", KSTAT_DATA_UINT64 },
+	{ "pressure_level",		KSTAT_DATA_UINT64 },
+	{ "evict_pressure",		KSTAT_DATA_UINT64 },
+	{ "evict_size",			KSTAT_DATA_UINT64 },
 };
 
 #define	ARCSTAT(stat)	(arc_stats.stat.value.ui64)
@@ -844,6 +957,37 @@ struct arc_callback {
 
 typedef struct arc_write_callback arc_write_callback_t;
 
+/*
+ * Per-dataset ARC accounting.  Every byte of ARC data (arc_get_data_impl()
+ * and arc_free_data_impl()) is charged to the header it belongs to, in
+ * b_ds_charged, and to the dataset in b_ds, if the header has one.  A
+ * header is given its dataset by arc_read() and arc_write(), which know
+ * the block's bookmark; the bytes already charged to the header move to
+ * the dataset with it.  Entries are kept in arc_ds_tree, and freed by
+ * arc_ds_reap() once no header points to them and neither a quota nor
+ * ads_l2prefetch is set.
+ *
+ * A dataset whose ads_size exceeds its primarycache_quota is preferred
+ * for eviction, see arc_evict_state().
+ */
+typedef struct arc_ds {
+	avl_node_t	ads_node;
+	uint64_t	ads_spa;	/* spa_load_guid(), as in b_spa */
+	uint64_t	ads_objset;
+	uint64_t	ads_pool_guid;	/* for the kstat */
+	uint64_t	ads_size;	/* updated atomically */
+	uint64_t	ads_quota;	/* 0 for none */
+	uint64_t	ads_holds;	/* headers, updated atomically */
+	boolean_t	ads_l2prefetch;	/* secondarycache=prefetch */
+} arc_ds_t;
+
+static kmutex_t arc_ds_lock;
+static avl_tree_t arc_ds_tree;
+static kstat_t *arc_ds_ksp;
+
+/* datasets over their quota as of the last arc_ds_reap() */
+static uint64_t arc_ds_nover;
+
 struct arc_write_callback {
 	void		*awcb_private;
 	arc_done_func_t	*awcb_ready;
@@ -913,7 +1057,11 @@ typedef struct l1arc_buf_hdr {
 	refcount_t		b_refcnt;
 
 	arc_callback_t		*b_acb;
-	void			*b_pdata;
+	abd_t			*b_pabd;
+
+	/* dataset the data of this header is charged to, see arc_ds_t */
+	arc_ds_t		*b_ds;
+	uint64_t		b_ds_charged;
 } l1arc_buf_hdr_t;
 
 typedef struct l2arc_dev l2arc_dev_t;
@@ -931,8 +1079,14 @@ struct arc_buf_hdr {
 	dva_t			b_dva;
 	uint64_t		b_birth;
 
-	arc_buf_contents_t	b_type;
 	arc_buf_hdr_t		*b_hash_next;
+
+	/*
+	 * Besides the state of the header, b_flags encodes the type of
+	 * the buffer (ARC_FLAG_BUFC_METADATA) and its compression
+	 * (HDR_GET_COMPRESS()), and packs with the two sizes below into
+	 * a single word, to keep L2-only headers small.
+	 */
 	arc_flags_t		b_flags;
 
 	/*
@@ -976,6 +1130,7 @@ struct arc_buf_hdr {
 #define	HDR_IO_IN_PROGRESS(hdr)	((hdr)->b_flags & ARC_FLAG_IO_IN_PROGRESS)
 #define	HDR_IO_ERROR(hdr)	((hdr)->b_flags & ARC_FLAG_IO_ERROR)
 #define	HDR_PREFETCH(hdr)	((hdr)->b_flags & ARC_FLAG_PREFETCH)
+#define	HDR_SEQUENTIAL(hdr)	((hdr)->b_flags & ARC_FLAG_SEQUENTIAL)
 #define	HDR_COMPRESSION_ENABLED(hdr)	\
 	((hdr)->b_flags & ARC_FLAG_COMPRESSED_ARC)
 
@@ -1003,6 +1158,15 @@ struct arc_buf_hdr {
 #define	HDR_SET_COMPRESS(hdr, cmp) BF32_SET((hdr)->b_flags, \
 	HDR_COMPRESS_OFFSET, SPA_COMPRESSBITS, (cmp));
 
+/* For storing the size of an L2ARC-compressed copy in b_flags */
+#define	HDR_L2COMPRESS_OFFSET	(highbit64(ARC_FLAG_L2COMPRESS_0) - 1)
+#define	HDR_L2COMPRESS_BITS	4
+
+#define	HDR_GET_L2COMPRESS(hdr)	BF32_GET((hdr)->b_flags, \
+	HDR_L2COMPRESS_OFFSET, HDR_L2COMPRESS_BITS)
+#define	HDR_SET_L2COMPRESS(hdr, x) BF32_SET((hdr)->b_flags, \
+	HDR_L2COMPRESS_OFFSET, HDR_L2COMPRESS_BITS, (x));
+
 #define	ARC_BUF_LAST(buf)	((buf)->b_next == NULL)
 #define	ARC_BUF_SHARED(buf)	((buf)->b_flags & ARC_BUF_FLAG_SHARED)
 #define	ARC_BUF_COMPRESSED(buf)	((buf)->b_flags & ARC_BUF_FLAG_COMPRESSED)
@@ -1027,18 +1191,28 @@ struct ht_lock {
 #endif
 };
 
-#define	BUF_LOCKS 256
+/*
+ * The number of hash locks scales with arc_c_max, one per
+ * BUF_LOCKS_ARC_SHIFT bytes of it, so that large machines, which have
+ * many CPUs looking up buffers, do not all contend on a few of them.
+ */
+#define	BUF_LOCKS_MIN		256
+#define	BUF_LOCKS_MAX		16384
+#define	BUF_LOCKS_ARC_SHIFT	26	/* 64MB */
+
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	struct ht_lock ht_locks[BUF_LOCKS];
+	uint64_t ht_lock_mask;
+	struct ht_lock *ht_locks;
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
 #define	BUF_HASH_INDEX(spa, dva, birth) \
 	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
+#define	BUF_HASH_LOCK_NTRY(idx) \
+	(buf_hash_table.ht_locks[(idx) & buf_hash_table.ht_lock_mask])
 #define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
 #define	HDR_LOCK(hdr) \
 	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
@@ -1071,6 +1245,7 @@ uint64_t zfs_crc64_table[256];
 /* L2ARC Performance Tunables */
 uint64_t l2arc_write_max = L2ARC_WRITE_SIZE;	/* default max write size */
 uint64_t l2arc_write_boost = L2ARC_WRITE_SIZE;	/* extra write during warmup */
+uint64_t l2arc_write_limit = 8 * L2ARC_WRITE_SIZE; /* adaptive write max */
 uint64_t l2arc_headroom = L2ARC_HEADROOM;	/* number of dev writes */
 uint64_t l2arc_headroom_boost = L2ARC_HEADROOM_BOOST;
 uint64_t l2arc_max_block_size = L2ARC_MAX_BLOCK_SIZE;
@@ -1079,6 +1254,81 @@ uint64_t l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval milliseconds */
 boolean_t l2arc_noprefetch = B_TRUE;		/* don't cache prefetch bufs */
 boolean_t l2arc_feed_again = B_TRUE;		/* turbo warmup */
 boolean_t l2arc_norw = B_TRUE;			/* no reads during writes */
+boolean_t l2arc_rebuild_enabled = B_TRUE;	/* restore buffers at import */
+boolean_t l2arc_compress = B_FALSE;		/* lz4 uncompressed buffers */
+
+/*
+ * L2ARC Persistence
+ *
+ * The start of each cache device, after the vdev labels, holds a device
+ * header.  Among the buffers written to the device are log blocks, each
+ * describing up to L2ARC_LOG_BLK_ENTRIES of the buffers written before
+ * it, and pointing to the log block written before it.  The device
+ * header points to the most recent log block, so that the chain can be
+ * walked from the newest to the oldest.  See l2arc_rebuild().
+ */
+#define	L2ARC_PERSIST_VERSION	1
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534341434845ULL	/* ASCII: "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844ULL	/* ASCII: "LOGBLKHD" */
+#define	L2ARC_DEV_HDR_SIZE	SPA_MINBLOCKSIZE
+#define	L2ARC_LOG_BLK_SIZE	(64 * 1024)
+#define	L2ARC_LOG_BLK_ENTRIES	\
+	((L2ARC_LOG_BLK_SIZE - 64) / sizeof (l2arc_log_ent_phys_t))
+
+/* l2arc_dev_hdr_phys_t.dh_flags */
+#define	L2ARC_DEV_HDR_WRAPPED	(1ULL << 0)	/* hand has wrapped around */
+
+/* where a log block is, and its fletcher4 checksum */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;	/* device address */
+	uint64_t	lbp_size;	/* allocated size on the device */
+	zio_cksum_t	lbp_cksum;
+} l2arc_log_blkptr_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;	/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t	dh_version;	/* L2ARC_PERSIST_VERSION */
+	uint64_t	dh_spa_guid;	/* pool the device belongs to */
+	uint64_t	dh_vdev_guid;	/* the device itself */
+	uint64_t	dh_flags;	/* L2ARC_DEV_HDR_* */
+	uint64_t	dh_start;	/* l2ad_start */
+	uint64_t	dh_end;		/* l2ad_end */
+	uint64_t	dh_hand;	/* l2ad_hand */
+	uint64_t	dh_evict;	/* [hand, evict) may be overwritten */
+	l2arc_log_blkptr_t dh_start_lbp; /* most recent log block */
+	uint64_t	dh_pad[45];
+	zio_cksum_t	dh_self_cksum;	/* fletcher4 of the fields above */
+} l2arc_dev_hdr_phys_t;
+
+/* a buffer on the device, as recorded in a log block */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;
+	uint64_t	le_birth;
+	uint64_t	le_prop;	/* see LE_GET_*() */
+	uint64_t	le_daddr;	/* device address */
+	uint64_t	le_pad[3];
+} l2arc_log_ent_phys_t;
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	uint64_t		lb_nents;	/* entries in use */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log block */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+/* le_prop holds b_lsize and b_psize, in SPA_MINBLOCKSIZE units */
+#define	LE_GET_LSIZE(le)	BF64_GET((le)->le_prop, 0, 16)
+#define	LE_SET_LSIZE(le, x)	BF64_SET((le)->le_prop, 0, 16, x)
+#define	LE_GET_PSIZE(le)	BF64_GET((le)->le_prop, 16, 16)
+#define	LE_SET_PSIZE(le, x)	BF64_SET((le)->le_prop, 16, 16, x)
+#define	LE_GET_COMPRESS(le)	BF64_GET((le)->le_prop, 32, SPA_COMPRESSBITS)
+#define	LE_SET_COMPRESS(le, x)	BF64_SET((le)->le_prop, 32, SPA_COMPRESSBITS, x)
+#define	LE_GET_TYPE(le)		BF64_GET((le)->le_prop, 48, 8)
+#define	LE_SET_TYPE(le, x)	BF64_SET((le)->le_prop, 48, 8, x)
+#define	LE_GET_L2COMPRESS(le)	\
+	BF64_GET((le)->le_prop, 56, HDR_L2COMPRESS_BITS)
+#define	LE_SET_L2COMPRESS(le, x)	\
+	BF64_SET((le)->le_prop, 56, HDR_L2COMPRESS_BITS, x)
 
 /*
  * L2ARC Internals
@@ -1095,12 +1345,25 @@ struct l2arc_dev {
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	refcount_t		l2ad_alloc;	/* allocated bytes */
+	/* protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild thread running */
+	boolean_t		l2ad_rebuild_cancel; /* device going away */
+	/* protected by l2arc_feed_thr_lock */
+	boolean_t		l2ad_feeding;	/* feed thread running */
+	boolean_t		l2ad_feed_exit;	/* feed thread to stop */
+	/* updated by the feed thread */
+	uint64_t		l2ad_evict_l2_last; /* evict_l2_eligible seen */
+	uint64_t		l2ad_write_size; /* size of the last write */
+	hrtime_t		l2ad_write_time; /* time the last write took */
+	/* updated by the feed thread, or the rebuild thread before it */
+	uint64_t		l2ad_dev_hdr_asize; /* space reserved for it */
+	l2arc_dev_hdr_phys_t	l2ad_dev_hdr;	/* as last written */
+	l2arc_log_blk_phys_t	l2ad_log_blk;	/* log block being filled */
 };
 
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
-static l2arc_dev_t *l2arc_dev_last;		/* last device used */
 static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
@@ -1120,7 +1383,7 @@ typedef struct l2arc_write_callback {
 
 typedef struct l2arc_data_free {
 	/* protected by l2arc_free_on_write_mtx */
-	void		*l2df_data;
+	abd_t		*l2df_abd;
 	size_t		l2df_size;
 	arc_buf_contents_t l2df_type;
 	list_node_t	l2df_list_node;
@@ -1128,12 +1391,19 @@ typedef struct l2arc_data_free {
 
 static kmutex_t l2arc_feed_thr_lock;
 static kcondvar_t l2arc_feed_thr_cv;
-static uint8_t l2arc_thread_exit;
+static boolean_t l2arc_feed_enabled;		/* between start and stop */
+
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
 
+static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
+static void arc_get_data_impl(arc_buf_hdr_t *, uint64_t, void *);
+static void arc_free_data_abd(arc_buf_hdr_t *, abd_t *, uint64_t, void *);
 static void arc_free_data_buf(arc_buf_hdr_t *, void *, uint64_t, void *);
-static void arc_hdr_free_pdata(arc_buf_hdr_t *hdr);
-static void arc_hdr_alloc_pdata(arc_buf_hdr_t *);
+static void arc_free_data_impl(arc_buf_hdr_t *, uint64_t, void *);
+static void arc_hdr_free_pabd(arc_buf_hdr_t *);
+static void arc_hdr_alloc_pabd(arc_buf_hdr_t *);
 static void arc_access(arc_buf_hdr_t *, kmutex_t *);
 static boolean_t arc_is_overflowing();
 static void arc_buf_watch(arc_buf_t *);
@@ -1145,6 +1415,7 @@ static inline void arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags);
 
 static boolean_t l2arc_write_eligible(uint64_t, arc_buf_hdr_t *);
 static void l2arc_read_done(zio_t *);
+static void l2arc_decompress(zio_t *, abd_t *, uint64_t);
 
 static uint64_t
 buf_hash(uint64_t spa, const dva_t *dva, uint64_t birth)
@@ -1189,7 +1460,19 @@ buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
 	arc_buf_hdr_t *hdr;
 
-	mutex_enter(hash_lock);
+	/*
+	 * The chain head is a single word, so an unlocked look at it is
+	 * as good as a locked one that happened a moment earlier: either
+	 * way the buffer may be inserted right after we report a miss,
+	 * which callers already handle.
+	 */
+	if (*(arc_buf_hdr_t * volatile *)&buf_hash_table.ht_table[idx] ==
+	    NULL) {
+		*lockp = NULL;
+		return (NULL);
+	}
+
+	zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
 	    hdr = hdr->b_hash_next) {
 		if (HDR_EQUAL(spa, dva, birth, hdr)) {
@@ -1223,7 +1506,7 @@ buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 
 	if (lockp != NULL) {
 		*lockp = hash_lock;
-		mutex_enter(hash_lock);
+		zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 	} else {
 		ASSERT(MUTEX_HELD(hash_lock));
 	}
@@ -1293,8 +1576,10 @@ buf_fini(void)
 
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
-	for (i = 0; i < BUF_LOCKS; i++)
+	for (i = 0; i <= buf_hash_table.ht_lock_mask; i++)
 		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
+	kmem_free(buf_hash_table.ht_locks,
+	    (buf_hash_table.ht_lock_mask + 1) * sizeof (struct ht_lock));
 	kmem_cache_destroy(hdr_full_cache);
 	kmem_cache_destroy(hdr_l2only_cache);
 	kmem_cache_destroy(buf_cache);
@@ -1388,6 +1673,17 @@ buf_dest(void *vbuf, void *unused)
 	arc_space_return(sizeof (arc_buf_t), ARC_SPACE_HDRS);
 }
 
+/*
+ * Wake up arc_reclaim_thread() on memory pressure.  If it is busy the
+ * signal is lost, so also tell it to go around again without sleeping.
+ */
+static void
+arc_reclaim_wakeup(void)
+{
+	arc_reclaim_pending = B_TRUE;
+	cv_signal(&arc_reclaim_thread_cv);
+}
+
 /*
  * Reclaim callback -- invoked when memory is low.
  */
@@ -1401,7 +1697,7 @@ hdr_recl(void *unused)
 	 * which is after we do arc_fini().
 	 */
 	if (!arc_dead)
-		cv_signal(&arc_reclaim_thread_cv);
+		arc_reclaim_wakeup();
 }
 
 static void
@@ -1409,6 +1705,7 @@ buf_init(void)
 {
 	uint64_t *ct;
 	uint64_t hsize = 1ULL << 12;
+	uint64_t nlocks = BUF_LOCKS_MIN;
 	int i, j;
 
 	/*
@@ -1443,7 +1740,14 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++) {
+	/* arc_c_max is set by now; there is no use in more locks than chains */
+	while (nlocks < BUF_LOCKS_MAX && nlocks < hsize &&
+	    (nlocks << BUF_LOCKS_ARC_SHIFT) < arc_c_max)
+		nlocks <<= 1;
+	buf_hash_table.ht_lock_mask = nlocks - 1;
+	buf_hash_table.ht_locks =
+	    kmem_zalloc(nlocks * sizeof (struct ht_lock), KM_SLEEP);
+	for (i = 0; i < nlocks; i++) {
 		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
 		    NULL, MUTEX_DEFAULT, NULL);
 	}
@@ -1480,7 +1784,9 @@ static inline boolean_t
 arc_buf_is_shared(arc_buf_t *buf)
 {
 	boolean_t shared = (buf->b_data != NULL &&
-		buf->b_data == buf->b_hdr->b_l1hdr.b_pdata);
+		buf->b_hdr->b_l1hdr.b_pabd != NULL &&
+		abd_is_linear(buf->b_hdr->b_l1hdr.b_pabd) &&
+		buf->b_data == abd_to_buf(buf->b_hdr->b_l1hdr.b_pabd));
 	IMPLY(shared, HDR_SHARED_DATA(buf->b_hdr));
 	IMPLY(shared, ARC_BUF_SHARED(buf));
 	IMPLY(shared, ARC_BUF_COMPRESSED(buf) || ARC_BUF_LAST(buf));
@@ -1585,7 +1891,9 @@ arc_cksum_is_equal(arc_buf_hdr_t *hdr, zio_t *zio)
 		uint64_t csize;
 
 		void *cbuf = zio_buf_alloc(HDR_GET_PSIZE(hdr));
-		csize = zio_compress_data(compress, zio->io_data, cbuf, lsize);
+		abd_t *cabd;
+
+		csize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
 		ASSERT3U(csize, <=, HDR_GET_PSIZE(hdr));
 		if (csize < HDR_GET_PSIZE(hdr)) {
 			/*
@@ -1603,7 +1911,9 @@ arc_cksum_is_equal(arc_buf_hdr_t *hdr, zio_t *zio)
 			bzero((char *)cbuf + csize, HDR_GET_PSIZE(hdr) - csize);
 			csize = HDR_GET_PSIZE(hdr);
 		}
-		zio_push_transform(zio, cbuf, csize, HDR_GET_PSIZE(hdr), NULL);
+		cabd = abd_get_from_buf(cbuf, HDR_GET_PSIZE(hdr));
+		abd_take_ownership_of_buf(cabd, B_TRUE);
+		zio_push_transform(zio, cabd, csize, HDR_GET_PSIZE(hdr), NULL);
 	}
 
 	/*
@@ -1620,7 +1930,7 @@ arc_cksum_is_equal(arc_buf_hdr_t *hdr, zio_t *zio)
 	 * logical I/O size and not just a gang fragment.
 	 */
 	valid_cksum = (zio_checksum_error_impl(zio->io_spa, zio->io_bp,
-		BP_GET_CHECKSUM(zio->io_bp), zio->io_data, zio->io_size,
+		BP_GET_CHECKSUM(zio->io_bp), zio->io_abd, zio->io_size,
 		zio->io_offset, NULL) == 0);
 	zio_pop_transforms(zio);
 	return (valid_cksum);
@@ -1719,7 +2029,6 @@ arc_buf_type(arc_buf_hdr_t *hdr)
 	} else {
 		type = ARC_BUFC_DATA;
 	}
-	VERIFY3U(hdr->b_type, ==, type);
 	return (type);
 }
 
@@ -1798,7 +2107,7 @@ arc_buf_freeze(arc_buf_t *buf)
 	}
 
 	hash_lock = HDR_LOCK(hdr);
-	mutex_enter(hash_lock);
+	zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 
 	ASSERT(HDR_HAS_L1HDR(hdr));
 	ASSERT(hdr->b_l1hdr.b_freeze_cksum != NULL ||
@@ -1924,7 +2233,7 @@ arc_buf_fill(arc_buf_t *buf, boolean_t compressed)
 
 	if (hdr_compressed == compressed) {
 		if (!arc_buf_is_shared(buf)) {
-			bcopy(hdr->b_l1hdr.b_pdata, buf->b_data,
+			abd_copy_to_buf(buf->b_data, hdr->b_l1hdr.b_pabd,
 			    arc_buf_size(buf));
 		}
 	} else {
@@ -1976,7 +2285,7 @@ arc_buf_fill(arc_buf_t *buf, boolean_t compressed)
 			return (0);
 		} else {
 			int error = zio_decompress_data(HDR_GET_COMPRESS(hdr),
-			    hdr->b_l1hdr.b_pdata, buf->b_data,
+			    hdr->b_l1hdr.b_pabd, buf->b_data,
 			    HDR_GET_PSIZE(hdr), HDR_GET_LSIZE(hdr));
 
 			/*
@@ -2013,7 +2322,7 @@ arc_decompress(arc_buf_t *buf)
 }
 
 /*
- * Return the size of the block, b_pdata, that is stored in the arc_buf_hdr_t.
+ * Return the size of the block, b_pabd, that is stored in the arc_buf_hdr_t.
  */
 static uint64_t
 arc_hdr_size(arc_buf_hdr_t *hdr)
@@ -2030,6 +2339,24 @@ arc_hdr_size(arc_buf_hdr_t *hdr)
 	return (size);
 }
 
+/*
+ * Return the number of bytes the hdr's data takes up on its L2ARC device
+ * (before rounding up to the device's allocation size).  This is
+ * arc_hdr_size() unless the data was compressed by l2arc_compress_buf().
+ */
+static uint64_t
+l2arc_hdr_size(arc_buf_hdr_t *hdr)
+{
+	uint64_t sixteenths = HDR_GET_L2COMPRESS(hdr);
+
+	if (sixteenths == 0)
+		return (arc_hdr_size(hdr));
+
+	ASSERT3U(HDR_GET_COMPRESS(hdr), ==, ZIO_COMPRESS_OFF);
+	return (P2ROUNDUP(howmany(HDR_GET_LSIZE(hdr) * sixteenths, 16),
+	    SPA_MINBLOCKSIZE));
+}
+
 /*
  * Increment the amount of evictable space in the arc_state_t's refcount.
  * We account for the space used by the hdr and the arc buf individually
@@ -2045,14 +2372,14 @@ arc_evictable_space_increment(arc_buf_hdr_t *hdr, arc_state_t *state)
 	if (GHOST_STATE(state)) {
 		ASSERT0(hdr->b_l1hdr.b_bufcnt);
 		ASSERT3P(hdr->b_l1hdr.b_buf, ==, NULL);
-		ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 		(void) refcount_add_many(&state->arcs_esize[type],
 		    HDR_GET_LSIZE(hdr), hdr);
 		return;
 	}
 
 	ASSERT(!GHOST_STATE(state));
-	if (hdr->b_l1hdr.b_pdata != NULL) {
+	if (hdr->b_l1hdr.b_pabd != NULL) {
 		(void) refcount_add_many(&state->arcs_esize[type],
 		    arc_hdr_size(hdr), hdr);
 	}
@@ -2080,14 +2407,14 @@ arc_evictable_space_decrement(arc_buf_hdr_t *hdr, arc_state_t *state)
 	if (GHOST_STATE(state)) {
 		ASSERT0(hdr->b_l1hdr.b_bufcnt);
 		ASSERT3P(hdr->b_l1hdr.b_buf, ==, NULL);
-		ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 		(void) refcount_remove_many(&state->arcs_esize[type],
 		    HDR_GET_LSIZE(hdr), hdr);
 		return;
 	}
 
 	ASSERT(!GHOST_STATE(state));
-	if (hdr->b_l1hdr.b_pdata != NULL) {
+	if (hdr->b_l1hdr.b_pabd != NULL) {
 		(void) refcount_remove_many(&state->arcs_esize[type],
 		    arc_hdr_size(hdr), hdr);
 	}
@@ -2131,6 +2458,26 @@ add_reference(arc_buf_hdr_t *hdr, void *tag)
 	}
 }
 
+/*
+ * Make an unreferenced hdr evictable in the given state.  Sequential
+ * buffers in the MRU state go on the cold (tail) end of their sublist, so
+ * that a long scan recycles its own buffers before it pushes anything
+ * else out of the cache.
+ */
+static void
+arc_state_insert(arc_state_t *state, arc_buf_hdr_t *hdr)
+{
+	multilist_t *ml = state->arcs_list[arc_buf_type(hdr)];
+
+	if (state == arc_mru && HDR_SEQUENTIAL(hdr)) {
+		multilist_sublist_t *mls = multilist_sublist_lock_obj(ml, hdr);
+		multilist_sublist_insert_tail(mls, hdr);
+		multilist_sublist_unlock(mls);
+	} else {
+		multilist_insert(ml, hdr);
+	}
+}
+
 /*
  * Remove a reference from this hdr. When the reference transitions from
  * 1 to 0 and we're not anonymous, then we add this hdr to the arc_state_t's
@@ -2152,7 +2499,7 @@ remove_reference(arc_buf_hdr_t *hdr, kmutex_t *hash_lock, void *tag)
 	 */
 	if (((cnt = refcount_remove(&hdr->b_l1hdr.b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
-		multilist_insert(state->arcs_list[arc_buf_type(hdr)], hdr);
+		arc_state_insert(state, hdr);
 		ASSERT3U(hdr->b_l1hdr.b_bufcnt, >, 0);
 		arc_evictable_space_increment(hdr, state);
 	}
@@ -2184,7 +2531,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 		old_state = hdr->b_l1hdr.b_state;
 		refcnt = refcount_count(&hdr->b_l1hdr.b_refcnt);
 		bufcnt = hdr->b_l1hdr.b_bufcnt;
-		update_old = (bufcnt > 0 || hdr->b_l1hdr.b_pdata != NULL);
+		update_old = (bufcnt > 0 || hdr->b_l1hdr.b_pabd != NULL);
 	} else {
 		old_state = arc_l2c_only;
 		refcnt = 0;
@@ -2223,7 +2570,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 			 * beforehand.
 			 */
 			ASSERT(HDR_HAS_L1HDR(hdr));
-			multilist_insert(new_state->arcs_list[buftype], hdr);
+			arc_state_insert(new_state, hdr);
 
 			if (GHOST_STATE(new_state)) {
 				ASSERT0(bufcnt);
@@ -2254,7 +2601,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 			 */
 			(void) refcount_add_many(&new_state->arcs_size,
 			    HDR_GET_LSIZE(hdr), hdr);
-			ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+			ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 		} else {
 			uint32_t buffers = 0;
 
@@ -2283,7 +2630,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 			}
 			ASSERT3U(bufcnt, ==, buffers);
 
-			if (hdr->b_l1hdr.b_pdata != NULL) {
+			if (hdr->b_l1hdr.b_pabd != NULL) {
 				(void) refcount_add_many(&new_state->arcs_size,
 					arc_hdr_size(hdr), hdr);
 			} else {
@@ -2296,7 +2643,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 		ASSERT(HDR_HAS_L1HDR(hdr));
 		if (GHOST_STATE(old_state)) {
 			ASSERT0(bufcnt);
-			ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+			ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 
 			/*
 			 * When moving a header off of a ghost state,
@@ -2336,7 +2683,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 				    buf);
 			}
 			ASSERT3U(bufcnt, ==, buffers);
-			ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+			ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 			(void) refcount_remove_many(
 			    &old_state->arcs_size, arc_hdr_size(hdr), hdr);
 		}
@@ -2420,9 +2767,255 @@ arc_space_return(uint64_t space, arc_space_type_t type)
 	atomic_add_64(&arc_size, -space);
 }
 
+static int
+arc_ds_compare(const void *x1, const void *x2)
+{
+	const arc_ds_t *a = x1;
+	const arc_ds_t *b = x2;
+
+	if (a->ads_spa != b->ads_spa)
+		return (a->ads_spa < b->ads_spa ? -1 : 1);
+	if (a->ads_objset != b->ads_objset)
+		return (a->ads_objset < b->ads_objset ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Find or create the entry of a dataset, and return with arc_ds_lock
+ * held.  Called with kmflag KM_NOSLEEP when a hash lock is held, in which
+ * case it may return NULL and the header goes unaccounted.
+ */
+static arc_ds_t *
+arc_ds_lookup(spa_t *spa, uint64_t objset, int kmflag)
+{
+	arc_ds_t search, *ads;
+	avl_index_t where;
+
+	search.ads_spa = spa_load_guid(spa);
+	search.ads_objset = objset;
+
+	mutex_enter(&arc_ds_lock);
+	ads = avl_find(&arc_ds_tree, &search, &where);
+	if (ads == NULL) {
+		ads = kmem_zalloc(sizeof (arc_ds_t), kmflag);
+		if (ads != NULL) {
+			ads->ads_spa = search.ads_spa;
+			ads->ads_objset = objset;
+			ads->ads_pool_guid = spa_guid(spa);
+			avl_insert(&arc_ds_tree, ads, where);
+		}
+	}
+	return (ads);
+}
+
+static arc_ds_t *
+arc_ds_hold(spa_t *spa, uint64_t objset, int kmflag)
+{
+	arc_ds_t *ads = arc_ds_lookup(spa, objset, kmflag);
+
+	/* taken under arc_ds_lock, so that arc_ds_reap() sees it */
+	if (ads != NULL)
+		atomic_inc_64(&ads->ads_holds);
+	mutex_exit(&arc_ds_lock);
+
+	return (ads);
+}
+
+/*
+ * Move the header, and the bytes charged to it, to another dataset (or
+ * none).  Takes over the caller's hold on ads.  Called with the hash lock
+ * held, or on a header no other thread can see.
+ */
+static void
+arc_hdr_set_ds(arc_buf_hdr_t *hdr, arc_ds_t *ads)
+{
+	arc_ds_t *old = hdr->b_l1hdr.b_ds;
+	uint64_t charged = hdr->b_l1hdr.b_ds_charged;
+
+	ASSERT(HDR_HAS_L1HDR(hdr));
+
+	if (old == ads) {
+		if (ads != NULL)
+			atomic_dec_64(&ads->ads_holds);
+		return;
+	}
+	if (old != NULL) {
+		atomic_add_64(&old->ads_size, -charged);
+		atomic_dec_64(&old->ads_holds);
+	}
+	if (ads != NULL)
+		atomic_add_64(&ads->ads_size, charged);
+	hdr->b_l1hdr.b_ds = ads;
+}
+
+static void
+arc_hdr_charge(arc_buf_hdr_t *hdr, int64_t size)
+{
+	hdr->b_l1hdr.b_ds_charged += size;
+	if (hdr->b_l1hdr.b_ds != NULL)
+		atomic_add_64(&hdr->b_l1hdr.b_ds->ads_size, size);
+}
+
+static boolean_t
+arc_hdr_over_quota(arc_buf_hdr_t *hdr)
+{
+	arc_ds_t *ads;
+
+	if (!HDR_HAS_L1HDR(hdr) || (ads = hdr->b_l1hdr.b_ds) == NULL)
+		return (B_FALSE);
+	return (ads->ads_quota != 0 && ads->ads_size > ads->ads_quota);
+}
+
+/*
+ * Set the primarycache_quota of a dataset, 0 for none.
+ */
+void
+arc_ds_set_quota(spa_t *spa, uint64_t objset, uint64_t quota)
+{
+	arc_ds_t *ads = arc_ds_lookup(spa, objset, KM_SLEEP);
+
+	ads->ads_quota = quota;
+	mutex_exit(&arc_ds_lock);
+}
+
+/*
+ * Let the prefetched buffers of a dataset into the L2ARC regardless of
+ * l2arc_noprefetch, for secondarycache=prefetch.
+ */
+void
+arc_ds_set_l2prefetch(spa_t *spa, uint64_t objset, boolean_t l2prefetch)
+{
+	arc_ds_t *ads = arc_ds_lookup(spa, objset, KM_SLEEP);
+
+	ads->ads_l2prefetch = l2prefetch;
+	mutex_exit(&arc_ds_lock);
+}
+
+static boolean_t
+arc_hdr_l2prefetch(arc_buf_hdr_t *hdr)
+{
+	arc_ds_t *ads;
+
+	if (!HDR_HAS_L1HDR(hdr) || (ads = hdr->b_l1hdr.b_ds) == NULL)
+		return (B_FALSE);
+	return (ads->ads_l2prefetch);
+}
+
+/*
+ * Free the entries no longer in use, and count those over their quota.
+ */
+static void
+arc_ds_reap(void)
+{
+	arc_ds_t *ads, *next;
+	uint64_t nover = 0;
+
+	mutex_enter(&arc_ds_lock);
+	for (ads = avl_first(&arc_ds_tree); ads != NULL; ads = next) {
+		next = AVL_NEXT(&arc_ds_tree, ads);
+		if (ads->ads_holds == 0 && ads->ads_quota == 0 &&
+		    !ads->ads_l2prefetch) {
+			ASSERT0(ads->ads_size);
+			avl_remove(&arc_ds_tree, ads);
+			kmem_free(ads, sizeof (arc_ds_t));
+		} else if (ads->ads_quota != 0 &&
+		    ads->ads_size > ads->ads_quota) {
+			nover++;
+		}
+	}
+	arc_ds_nover = nover;
+	mutex_exit(&arc_ds_lock);
+}
+
+static int
+arc_ds_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-20s %-10s %-14s %-14s\n",
+	    "pool", "objset", "size", "quota");
+
+	return (0);
+}
+
+static int
+arc_ds_kstat_data(char *buf, size_t size, void *data)
+{
+	arc_ds_t *ads = data;
+
+	(void) snprintf(buf, size, "%-20llu %-10llu %-14llu %-14llu\n",
+	    (u_longlong_t)ads->ads_pool_guid, (u_longlong_t)ads->ads_objset,
+	    (u_longlong_t)ads->ads_size, (u_longlong_t)ads->ads_quota);
+
+	return (0);
+}
+
+static void *
+arc_ds_kstat_addr(kstat_t *ksp, off_t n)
+{
+	ASSERT(MUTEX_HELD(&arc_ds_lock));
+
+	if (n == 0)
+		ksp->ks_private = avl_first(&arc_ds_tree);
+	else if (ksp->ks_private != NULL)
+		ksp->ks_private = AVL_NEXT(&arc_ds_tree, ksp->ks_private);
+
+	return (ksp->ks_private);
+}
+
+static int
+arc_ds_kstat_update(kstat_t *ksp, int rw)
+{
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	ksp->ks_ndata = avl_numnodes(&arc_ds_tree);
+	ksp->ks_data_size = ksp->ks_ndata * sizeof (arc_ds_t);
+
+	return (0);
+}
+
+static void
+arc_ds_init(void)
+{
+	mutex_init(&arc_ds_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&arc_ds_tree, arc_ds_compare, sizeof (arc_ds_t),
+	    offsetof(arc_ds_t, ads_node));
+
+	arc_ds_ksp = kstat_create("zfs", 0, "arc_datasets", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (arc_ds_ksp != NULL) {
+		arc_ds_ksp->ks_lock = &arc_ds_lock;
+		arc_ds_ksp->ks_data = NULL;
+		arc_ds_ksp->ks_private = NULL;
+		arc_ds_ksp->ks_update = arc_ds_kstat_update;
+		kstat_set_raw_ops(arc_ds_ksp, arc_ds_kstat_headers,
+		    arc_ds_kstat_data, arc_ds_kstat_addr);
+		kstat_install(arc_ds_ksp);
+	}
+}
+
+static void
+arc_ds_fini(void)
+{
+	arc_ds_t *ads;
+	void *cookie = NULL;
+
+	if (arc_ds_ksp != NULL) {
+		kstat_delete(arc_ds_ksp);
+		arc_ds_ksp = NULL;
+	}
+
+	/* every header is gone, but quotas may still be set */
+	while ((ads = avl_destroy_nodes(&arc_ds_tree, &cookie)) != NULL) {
+		ASSERT0(ads->ads_holds);
+		kmem_free(ads, sizeof (arc_ds_t));
+	}
+	avl_destroy(&arc_ds_tree);
+	mutex_destroy(&arc_ds_lock);
+}
+
 /*
  * Given a hdr and a buf, returns whether that buf can share its b_data buffer
- * with the hdr's b_pdata.
+ * with the hdr's b_pabd.
  */
 static boolean_t
 arc_can_share(arc_buf_hdr_t *hdr, arc_buf_t *buf)
@@ -2470,8 +3063,6 @@ arc_buf_alloc_impl(arc_buf_hdr_t *hdr, void *tag, boolean_t compressed,
 
 	ASSERT(HDR_HAS_L1HDR(hdr));
 	ASSERT3U(HDR_GET_LSIZE(hdr), >, 0);
-	VERIFY(hdr->b_type == ARC_BUFC_DATA ||
-        hdr->b_type == ARC_BUFC_METADATA);
 	ASSERT3P(ret, !=, NULL);
 	ASSERT3P(*ret, ==, NULL);
 
@@ -2499,7 +3090,7 @@ arc_buf_alloc_impl(arc_buf_hdr_t *hdr, void *tag, boolean_t compressed,
 	/*
 	 * If the hdr's data can be shared then we share the data buffer and
 	 * set the appropriate bit in the hdr's b_flags to indicate the hdr is
-	 * sharing it's b_pdata with the arc_buf_t. Otherwise, we allocate a new
+	 * sharing it's b_pabd with the arc_buf_t. Otherwise, we allocate a new
 	 * buffer to store the buf's data.
 	 *
 	 * There is one additional restriction here because we're sharing
@@ -2508,11 +3099,14 @@ arc_buf_alloc_impl(arc_buf_hdr_t *hdr, void *tag, boolean_t compressed,
 	 * arc_write() then the hdr's data buffer will be released when the
 	 * write completes, even though the L2ARC write might still be using it.
 	 */
-	boolean_t can_share = arc_can_share(hdr, buf) && !HDR_L2_WRITING(hdr);
+	boolean_t can_share = arc_can_share(hdr, buf) &&
+	    !HDR_L2_WRITING(hdr) &&
+	    hdr->b_l1hdr.b_pabd != NULL &&
+	    abd_is_linear(hdr->b_l1hdr.b_pabd);
 
 	/* Set up b_data and sharing */
 	if (can_share) {
-		buf->b_data = hdr->b_l1hdr.b_pdata;
+		buf->b_data = abd_to_buf(hdr->b_l1hdr.b_pabd);
 		buf->b_flags |= ARC_BUF_FLAG_SHARED;
 		arc_hdr_set_flags(hdr, ARC_FLAG_SHARED_DATA);
 	} else {
@@ -2606,11 +3200,11 @@ arc_loan_inuse_buf(arc_buf_t *buf, void *tag)
 }
 
 static void
-l2arc_free_data_on_write(void *data, size_t size, arc_buf_contents_t type)
+l2arc_free_abd_on_write(abd_t *abd, size_t size, arc_buf_contents_t type)
 {
 	l2arc_data_free_t *df = kmem_alloc(sizeof (*df), KM_SLEEP);
 
-	df->l2df_data = data;
+	df->l2df_abd = abd;
 	df->l2df_size = size;
 	df->l2df_type = type;
 	mutex_enter(&l2arc_free_on_write_mtx);
@@ -2641,7 +3235,7 @@ arc_hdr_free_on_write(arc_buf_hdr_t *hdr)
 		arc_space_return(size, ARC_SPACE_DATA);
 	}
 
-	l2arc_free_data_on_write(hdr->b_l1hdr.b_pdata, size, type);
+	l2arc_free_abd_on_write(hdr->b_l1hdr.b_pabd, size, type);
 }
 
 /*
@@ -2657,7 +3251,7 @@ arc_share_buf(arc_buf_hdr_t *hdr, arc_buf_t *buf)
 #endif
 
 	ASSERT(arc_can_share(hdr, buf));
-	ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 	ASSERT(MUTEX_HELD(HDR_LOCK(hdr)) || HDR_EMPTY(hdr));
 
 	/*
@@ -2666,7 +3260,9 @@ arc_share_buf(arc_buf_hdr_t *hdr, arc_buf_t *buf)
 	 * the refcount whenever an arc_buf_t is shared.
 	 */
 	refcount_transfer_ownership(&state->arcs_size, buf, hdr);
-	hdr->b_l1hdr.b_pdata = buf->b_data;
+	hdr->b_l1hdr.b_pabd = abd_get_from_buf(buf->b_data, arc_buf_size(buf));
+	abd_take_ownership_of_buf(hdr->b_l1hdr.b_pabd,
+	    HDR_ISTYPE_METADATA(hdr));
 	arc_hdr_set_flags(hdr, ARC_FLAG_SHARED_DATA);
 	buf->b_flags |= ARC_BUF_FLAG_SHARED;
 
@@ -2688,7 +3284,7 @@ arc_unshare_buf(arc_buf_hdr_t *hdr, arc_buf_t *buf)
 #endif
 
 	ASSERT(arc_buf_is_shared(buf));
-	ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 	ASSERT(MUTEX_HELD(HDR_LOCK(hdr)) || HDR_EMPTY(hdr));
 
 	/*
@@ -2697,7 +3293,9 @@ arc_unshare_buf(arc_buf_hdr_t *hdr, arc_buf_t *buf)
 	 */
 	refcount_transfer_ownership(&state->arcs_size, hdr, buf);
 	arc_hdr_clear_flags(hdr, ARC_FLAG_SHARED_DATA);
-	hdr->b_l1hdr.b_pdata = NULL;
+	abd_release_ownership_of_buf(hdr->b_l1hdr.b_pabd);
+	abd_put(hdr->b_l1hdr.b_pabd);
+	hdr->b_l1hdr.b_pabd = NULL;
 	buf->b_flags &= ~ARC_BUF_FLAG_SHARED;
 
 	/*
@@ -2792,7 +3390,7 @@ arc_buf_destroy_impl(arc_buf_t *buf)
 	if (ARC_BUF_SHARED(buf) && !ARC_BUF_COMPRESSED(buf)) {
 		/*
 		 * If the current arc_buf_t is sharing its data buffer with the
-		 * hdr, then reassign the hdr's b_pdata to share it with the new
+		 * hdr, then reassign the hdr's b_pabd to share it with the new
 		 * buffer at the end of the list. The shared buffer is always
 		 * the last one on the hdr's buffer list.
 		 *
@@ -2807,8 +3405,8 @@ arc_buf_destroy_impl(arc_buf_t *buf)
 			/* hdr is uncompressed so can't have compressed buf */
 			VERIFY(!ARC_BUF_COMPRESSED(lastbuf));
 
-			ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
-			arc_hdr_free_pdata(hdr);
+			ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
+			arc_hdr_free_pabd(hdr);
 
 			/*
 			 * We must setup a new shared block between the
@@ -2846,26 +3444,26 @@ arc_buf_destroy_impl(arc_buf_t *buf)
 }
 
 static void
-arc_hdr_alloc_pdata(arc_buf_hdr_t *hdr)
+arc_hdr_alloc_pabd(arc_buf_hdr_t *hdr)
 {
 	ASSERT3U(HDR_GET_LSIZE(hdr), >, 0);
 	ASSERT(HDR_HAS_L1HDR(hdr));
 	ASSERT(!HDR_SHARED_DATA(hdr));
 
-	ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
-	hdr->b_l1hdr.b_pdata = arc_get_data_buf(hdr, arc_hdr_size(hdr), hdr);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
+	hdr->b_l1hdr.b_pabd = arc_get_data_abd(hdr, arc_hdr_size(hdr), hdr);
 	hdr->b_l1hdr.b_byteswap = DMU_BSWAP_NUMFUNCS;
-	ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 
 	ARCSTAT_INCR(arcstat_compressed_size, arc_hdr_size(hdr));
 	ARCSTAT_INCR(arcstat_uncompressed_size, HDR_GET_LSIZE(hdr));
 }
 
 static void
-arc_hdr_free_pdata(arc_buf_hdr_t *hdr)
+arc_hdr_free_pabd(arc_buf_hdr_t *hdr)
 {
 	ASSERT(HDR_HAS_L1HDR(hdr));
-	ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 
 	/*
 	 * If the hdr is currently being written to the l2arc then
@@ -2877,10 +3475,10 @@ arc_hdr_free_pdata(arc_buf_hdr_t *hdr)
 		arc_hdr_free_on_write(hdr);
 		ARCSTAT_BUMP(arcstat_l2_free_on_write);
 	} else {
-		arc_free_data_buf(hdr, hdr->b_l1hdr.b_pdata,
+		arc_free_data_abd(hdr, hdr->b_l1hdr.b_pabd,
 		    arc_hdr_size(hdr), hdr);
 	}
-	hdr->b_l1hdr.b_pdata = NULL;
+	hdr->b_l1hdr.b_pabd = NULL;
 	hdr->b_l1hdr.b_byteswap = DMU_BSWAP_NUMFUNCS;
 
 	ARCSTAT_INCR(arcstat_compressed_size, -arc_hdr_size(hdr));
@@ -2902,7 +3500,6 @@ arc_hdr_alloc(uint64_t spa, int32_t psize, int32_t lsize,
 	HDR_SET_PSIZE(hdr, psize);
 	HDR_SET_LSIZE(hdr, lsize);
 	hdr->b_spa = spa;
-	hdr->b_type = type;
 	hdr->b_flags = 0;
 	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L1HDR);
 	arc_hdr_set_compress(hdr, compression_type);
@@ -2917,7 +3514,7 @@ arc_hdr_alloc(uint64_t spa, int32_t psize, int32_t lsize,
 	 * the compressed or uncompressed data depending on the block
 	 * it references and compressed arc enablement.
 	 */
-	arc_hdr_alloc_pdata(hdr);
+	arc_hdr_alloc_pabd(hdr);
 	ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 
 	return (hdr);
@@ -2958,7 +3555,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 		nhdr->b_l1hdr.b_state = arc_l2c_only;
 
 		/* Verify previous threads set to NULL before freeing */
-		ASSERT3P(nhdr->b_l1hdr.b_pdata, ==, NULL);
+		ASSERT3P(nhdr->b_l1hdr.b_pabd, ==, NULL);
 	} else {
 		ASSERT3P(hdr->b_l1hdr.b_buf, ==, NULL);
 		ASSERT0(hdr->b_l1hdr.b_bufcnt);
@@ -2976,11 +3573,13 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 		/*
 		 * A buffer must not be moved into the arc_l2c_only
 		 * state if it's not finished being written out to the
-		 * l2arc device. Otherwise, the b_l1hdr.b_pdata field
+		 * l2arc device. Otherwise, the b_l1hdr.b_pabd field
 		 * might try to be accessed, even though it was removed.
 		 */
 		VERIFY(!HDR_L2_WRITING(hdr));
-		VERIFY3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+		VERIFY3P(hdr->b_l1hdr.b_pabd, ==, NULL);
+		ASSERT0(hdr->b_l1hdr.b_ds_charged);
+		arc_hdr_set_ds(hdr, NULL);
 
 #ifdef ZFS_DEBUG
 		if (hdr->b_l1hdr.b_thawed != NULL) {
@@ -3077,7 +3676,7 @@ arc_hdr_l2hdr_destroy(arc_buf_hdr_t *hdr)
 {
 	l2arc_buf_hdr_t *l2hdr = &hdr->b_l2hdr;
 	l2arc_dev_t *dev = l2hdr->b_dev;
-	uint64_t asize = arc_hdr_size(hdr);
+	uint64_t asize = l2arc_hdr_size(hdr);
 
 	ASSERT(MUTEX_HELD(&dev->l2ad_mtx));
 	ASSERT(HDR_HAS_L2HDR(hdr));
@@ -3086,11 +3685,16 @@ arc_hdr_l2hdr_destroy(arc_buf_hdr_t *hdr)
 
 	ARCSTAT_INCR(arcstat_l2_asize, -asize);
 	ARCSTAT_INCR(arcstat_l2_size, -HDR_GET_LSIZE(hdr));
+	if (HDR_GET_L2COMPRESS(hdr) != 0) {
+		ARCSTAT_INCR(arcstat_l2_compress_saved,
+		    -(HDR_GET_LSIZE(hdr) - asize));
+	}
 
 	vdev_space_update(dev->l2ad_vdev, -asize, 0, 0);
 
 	(void) refcount_remove_many(&dev->l2ad_alloc, asize, hdr);
 	arc_hdr_clear_flags(hdr, ARC_FLAG_HAS_L2HDR);
+	HDR_SET_L2COMPRESS(hdr, 0);
 }
 
 static void
@@ -3144,9 +3748,13 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 		}
 #endif
 
-		if (hdr->b_l1hdr.b_pdata != NULL) {
-			arc_hdr_free_pdata(hdr);
+		if (hdr->b_l1hdr.b_pabd != NULL) {
+			arc_hdr_free_pabd(hdr);
 		}
+
+		/* the cache does not reconstruct its objects */
+		ASSERT0(hdr->b_l1hdr.b_ds_charged);
+		arc_hdr_set_ds(hdr, NULL);
 	}
 
 	ASSERT3P(hdr->b_hash_next, ==, NULL);
@@ -3173,7 +3781,7 @@ arc_buf_destroy(arc_buf_t *buf, void* tag)
 		return;
 	}
 
-	mutex_enter(hash_lock);
+	zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 	ASSERT3P(hdr, ==, buf->b_hdr);
 	ASSERT(hdr->b_l1hdr.b_bufcnt > 0);
 	ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
@@ -3213,7 +3821,7 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 
 		/*
 		 * l2arc_write_buffers() relies on a header's L1 portion
-		 * (i.e. its b_pdata field) during its write phase.
+		 * (i.e. its b_pabd field) during its write phase.
 		 * Thus, we cannot push a header onto the arc_l2c_only
 		 * state (removing it's L1 piece) until the header is
 		 * done being written to the l2arc.
@@ -3228,7 +3836,7 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 
 		DTRACE_PROBE1(arc__delete, arc_buf_hdr_t *, hdr);
 
-		ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 		if (HDR_HAS_L2HDR(hdr)) {
 			/*
 			 * This buffer is cached on the 2nd Level ARC;
@@ -3273,6 +3881,9 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		arc_buf_destroy_impl(buf);
 	}
 
+	if (state == arc_mru && HDR_SEQUENTIAL(hdr))
+		ARCSTAT_INCR(arcstat_evict_sequential, HDR_GET_LSIZE(hdr));
+
 	if (HDR_HAS_L2HDR(hdr)) {
 		ARCSTAT_INCR(arcstat_evict_l2_cached, HDR_GET_LSIZE(hdr));
 	} else {
@@ -3296,7 +3907,7 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		 * This ensures that the accounting is updated correctly
 		 * in arc_free_data_buf().
 		 */
-		arc_hdr_free_pdata(hdr);
+		arc_hdr_free_pabd(hdr);
 
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
@@ -3309,7 +3920,7 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 
 static uint64_t
 arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
-    uint64_t spa, int64_t bytes)
+    uint64_t spa, int64_t bytes, boolean_t over_quota)
 {
 	multilist_sublist_t *mls;
 	uint64_t bytes_evicted = 0;
@@ -3373,7 +3984,15 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 		ASSERT(!MUTEX_HELD(hash_lock));
 
 		if (mutex_tryenter(hash_lock)) {
-			uint64_t evicted = arc_evict_hdr(hdr, hash_lock);
+			uint64_t evicted;
+
+			/* b_ds is protected by the hash lock */
+			if (over_quota && !arc_hdr_over_quota(hdr)) {
+				mutex_exit(hash_lock);
+				continue;
+			}
+
+			evicted = arc_evict_hdr(hdr, hash_lock);
 			mutex_exit(hash_lock);
 
 			bytes_evicted += evicted;
@@ -3418,6 +4037,90 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 	return (bytes_evicted);
 }
 
+static void
+arc_evict_task(void *arg)
+{
+	arc_evict_arg_t *eva = arg;
+	arc_evict_wait_t *aew = eva->eva_wait;
+
+	eva->eva_evicted = arc_evict_state_impl(eva->eva_ml, eva->eva_idx,
+	    eva->eva_marker, eva->eva_spa, eva->eva_bytes,
+	    eva->eva_over_quota);
+
+	mutex_enter(&aew->aew_lock);
+	if (--aew->aew_pending == 0)
+		cv_signal(&aew->aew_cv);
+	mutex_exit(&aew->aew_lock);
+}
+
+/*
+ * Make one pass over every sublist of the multilist at once, on
+ * arc_evict_taskq, splitting the target between the sublists in
+ * proportion to their length.  A sublist whose task can't be
+ * dispatched is done by the caller.
+ */
+static uint64_t
+arc_evict_sublists(multilist_t *ml, arc_buf_hdr_t **markers,
+    arc_evict_arg_t *eva, uint64_t spa, int64_t bytes,
+    boolean_t over_quota)
+{
+	int num_sublists = multilist_get_num_sublists(ml);
+	arc_evict_wait_t aew;
+	uint64_t evicted = 0;
+	uint64_t total = 0;
+	int64_t per_buf = 0;
+
+	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
+
+	/*
+	 * Sublists filled by CPU rather than by hash may not be of even
+	 * length; have each evict its share of the state's buffers, at
+	 * no less than one buffer's worth so the shortest make progress.
+	 */
+	for (int i = 0; i < num_sublists; i++)
+		total += multilist_get_sublist_count(ml, i);
+	if (bytes != ARC_EVICT_ALL && total != 0)
+		per_buf = howmany(bytes, total);
+
+	mutex_init(&aew.aew_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&aew.aew_cv, NULL, CV_DEFAULT, NULL);
+	aew.aew_pending = num_sublists;
+
+	for (int i = 0; i < num_sublists; i++) {
+		eva[i].eva_ml = ml;
+		eva[i].eva_idx = i;
+		eva[i].eva_marker = markers[i];
+		eva[i].eva_spa = spa;
+		if (bytes == ARC_EVICT_ALL)
+			eva[i].eva_bytes = ARC_EVICT_ALL;
+		else if (total == 0)
+			eva[i].eva_bytes = howmany(bytes, num_sublists);
+		else
+			eva[i].eva_bytes = MAX(per_buf, per_buf *
+			    multilist_get_sublist_count(ml, i));
+		eva[i].eva_over_quota = over_quota;
+		eva[i].eva_evicted = 0;
+		eva[i].eva_wait = &aew;
+
+		if (taskq_dispatch(arc_evict_taskq, arc_evict_task,
+		    &eva[i], TQ_NOSLEEP) == 0)
+			arc_evict_task(&eva[i]);
+	}
+
+	mutex_enter(&aew.aew_lock);
+	while (aew.aew_pending != 0)
+		cv_wait(&aew.aew_cv, &aew.aew_lock);
+	mutex_exit(&aew.aew_lock);
+
+	mutex_destroy(&aew.aew_lock);
+	cv_destroy(&aew.aew_cv);
+
+	for (int i = 0; i < num_sublists; i++)
+		evicted += eva[i].eva_evicted;
+
+	return (evicted);
+}
+
 /*
  * Evict buffers from the given arc state, until we've removed the
  * specified number of bytes. Move the removed buffers to the
@@ -3439,9 +4142,18 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 	multilist_t *ml = state->arcs_list[type];
 	int num_sublists;
 	arc_buf_hdr_t **markers;
+	arc_evict_arg_t *eva = NULL;
+	boolean_t over_quota;
 
 	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
 
+	/*
+	 * While some dataset is over its primarycache_quota, start with
+	 * its buffers.  Ghost states hold no data to be charged for.
+	 */
+	over_quota = (arc_ds_nover != 0 && bytes != ARC_EVICT_ALL &&
+	    !GHOST_STATE(state));
+
 	num_sublists = multilist_get_num_sublists(ml);
 
 	/*
@@ -3467,41 +4179,60 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		multilist_sublist_unlock(mls);
 	}
 
+	/*
+	 * Only hand the work to arc_evict_taskq when there is enough of
+	 * it to keep the sublists busy; small evictions are cheaper done
+	 * here.
+	 */
+	if (arc_evict_taskq != NULL && num_sublists > 1 &&
+	    (bytes == ARC_EVICT_ALL ||
+	    bytes >= (int64_t)num_sublists * SPA_OLD_MAXBLOCKSIZE))
+		eva = kmem_alloc(sizeof (*eva) * num_sublists, KM_SLEEP);
+
 	/*
 	 * While we haven't hit our target number of bytes to evict, or
 	 * we're evicting all available buffers.
 	 */
 	while (total_evicted < bytes || bytes == ARC_EVICT_ALL) {
-		/*
-		 * Start eviction using a randomly selected sublist,
-		 * this is to try and evenly balance eviction across all
-		 * sublists. Always starting at the same sublist
-		 * (e.g. index 0) would cause evictions to favor certain
-		 * sublists over others.
-		 */
-		int sublist_idx = multilist_get_random_index(ml);
 		uint64_t scan_evicted = 0;
 
-		for (int i = 0; i < num_sublists; i++) {
-			uint64_t bytes_remaining;
-			uint64_t bytes_evicted;
+		if (eva != NULL) {
+			scan_evicted = arc_evict_sublists(ml, markers, eva,
+			    spa, (bytes == ARC_EVICT_ALL) ? ARC_EVICT_ALL :
+			    bytes - total_evicted, over_quota);
+			total_evicted += scan_evicted;
+		} else {
+			/*
+			 * Start eviction using a randomly selected sublist,
+			 * this is to try and evenly balance eviction across
+			 * all sublists. Always starting at the same sublist
+			 * (e.g. index 0) would cause evictions to favor
+			 * certain sublists over others.
+			 */
+			int sublist_idx = multilist_get_random_index(ml);
+
+			for (int i = 0; i < num_sublists; i++) {
+				uint64_t bytes_remaining;
+				uint64_t bytes_evicted;
 
-			if (bytes == ARC_EVICT_ALL)
-				bytes_remaining = ARC_EVICT_ALL;
-			else if (total_evicted < bytes)
-				bytes_remaining = bytes - total_evicted;
-			else
-				break;
+				if (bytes == ARC_EVICT_ALL)
+					bytes_remaining = ARC_EVICT_ALL;
+				else if (total_evicted < bytes)
+					bytes_remaining = bytes - total_evicted;
+				else
+					break;
 
-			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
-			    markers[sublist_idx], spa, bytes_remaining);
+				bytes_evicted = arc_evict_state_impl(ml,
+				    sublist_idx, markers[sublist_idx], spa,
+				    bytes_remaining, over_quota);
 
-			scan_evicted += bytes_evicted;
-			total_evicted += bytes_evicted;
+				scan_evicted += bytes_evicted;
+				total_evicted += bytes_evicted;
 
-			/* we've reached the end, wrap to the beginning */
-			if (++sublist_idx >= num_sublists)
-				sublist_idx = 0;
+				/* we've reached the end, wrap to the start */
+				if (++sublist_idx >= num_sublists)
+					sublist_idx = 0;
+			}
 		}
 
 		/*
@@ -3509,6 +4240,22 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		 * no reason to believe we'll evict more during another
 		 * scan, so break the loop.
 		 */
+		if (scan_evicted == 0 && over_quota) {
+			/*
+			 * Nothing over quota is left to evict; go over the
+			 * buffers skipped so far as well.
+			 */
+			for (int i = 0; i < num_sublists; i++) {
+				multilist_sublist_t *mls =
+				    multilist_sublist_lock(ml, i);
+				multilist_sublist_remove(mls, markers[i]);
+				multilist_sublist_insert_tail(mls, markers[i]);
+				multilist_sublist_unlock(mls);
+			}
+			over_quota = B_FALSE;
+			continue;
+		}
+
 		if (scan_evicted == 0) {
 			/* This isn't possible, let's make that obvious */
 			ASSERT3S(bytes, !=, 0);
@@ -3536,6 +4283,8 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		kmem_cache_free(hdr_full_cache, markers[i]);
 	}
 	kmem_free(markers, sizeof (*markers) * num_sublists);
+	if (eva != NULL)
+		kmem_free(eva, sizeof (*eva) * num_sublists);
 
 	return (total_evicted);
 }
@@ -3714,6 +4463,8 @@ arc_adjust(void)
 	uint64_t bytes;
 	int64_t target;
 
+	arc_ds_reap();
+
 	/*
 	 * If we're over arc_meta_limit, we want to correct that before
 	 * potentially evicting data buffers below.
@@ -3898,7 +4649,7 @@ arc_shrink(int64_t to_free)
 	}
 
 	if (arc_size > arc_c)
-		(void) arc_adjust();
+		ARCSTAT_INCR(arcstat_evict_pressure, arc_adjust());
 }
 
 typedef enum free_memory_reason_t {
@@ -3946,7 +4697,7 @@ arc_available_memory(void)
 	r = FMR_SPL_FREE;
 	if(spl_free_fast_pressure_wrapper() != FALSE) {
 		// wake up arc_reclaim_thread() if it is sleeping
-		cv_signal(&arc_reclaim_thread_cv);
+		arc_reclaim_wakeup();
 	}
 #endif //__APPLE__
 #ifdef sun
@@ -4031,6 +4782,62 @@ arc_available_memory(void)
 }
 
 
+/*
+ * Memory pressure levels.  The ARC keeps the free memory reported by
+ * arc_available_memory() within the free target band, from
+ * arc_free_target() to twice that: above the band it may grow, within it
+ * it holds its size, and below it it shrinks, by more the higher the
+ * level.  The SPL asking for memory back (its manual pressure) is as
+ * critical as running out.
+ */
+typedef enum arc_pressure {
+	ARC_PRESSURE_NONE,	/* above the band */
+	ARC_PRESSURE_LOW,	/* within the band */
+	ARC_PRESSURE_WARN,	/* below the band */
+	ARC_PRESSURE_CRITICAL	/* no free memory left, or asked for it */
+} arc_pressure_t;
+
+/* bounds of zfs_arc_free_target when it is left to auto */
+#define	ARC_FREE_TARGET_MIN	(64ULL << 20)
+#define	ARC_FREE_TARGET_MAX	(1ULL << 30)
+
+static int64_t
+arc_free_target(void)
+{
+	uint64_t target = zfs_arc_free_target;
+
+	if (target == 0) {
+		target = MIN(MAX((physmem * PAGESIZE) / 64,
+		    ARC_FREE_TARGET_MIN), ARC_FREE_TARGET_MAX);
+	}
+	return ((int64_t)target);
+}
+
+static arc_pressure_t
+arc_pressure_level(int64_t free_memory, int64_t manual_pressure)
+{
+	int64_t target = arc_free_target();
+
+	if (free_memory < 0 || manual_pressure > 0)
+		return (ARC_PRESSURE_CRITICAL);
+	if (free_memory < target)
+		return (ARC_PRESSURE_WARN);
+	if (free_memory < 2 * target)
+		return (ARC_PRESSURE_LOW);
+	return (ARC_PRESSURE_NONE);
+}
+
+static arc_pressure_t
+arc_pressure(void)
+{
+	int64_t manual_pressure = 0;
+
+#if defined(__APPLE__) && defined(_KERNEL)
+	manual_pressure = spl_free_manual_pressure_wrapper();
+#endif
+	return (arc_pressure_level(arc_available_memory(), manual_pressure));
+}
+
 /*
  * Determine if the system is under memory pressure and is asking
  * to reclaim memory. A return value of B_TRUE indicates that the system
@@ -4039,20 +4846,8 @@ arc_available_memory(void)
 static boolean_t
 arc_reclaim_needed(void)
 {
-    if(arc_available_memory() < 0) {
-      return 1;
-    }
-
-#ifdef __APPLE__
-#ifdef _KERNEL
-    if(spl_free_manual_pressure_wrapper() != 0) {
-      return 1;
-    }
-#endif
-#endif
-
-    return 0;
-}
+	return (arc_pressure() == ARC_PRESSURE_CRITICAL);
+}
 
 static void
 arc_kmem_reap_now(void)
@@ -4090,6 +4885,7 @@ arc_kmem_reap_now(void)
 			kmem_cache_reap_now(zio_data_buf_cache[i]);
 		}
 	}
+	abd_cache_reap_now();
 	kmem_cache_reap_now(buf_cache);
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
@@ -4115,13 +4911,13 @@ arc_kmem_reap_now(void)
 }
 
 /*
- * Threads can block in arc_get_data_buf() waiting for this thread to evict
+ * Threads can block in arc_get_data_impl() waiting for this thread to evict
  * enough data and signal them to proceed. When this happens, the threads in
- * arc_get_data_buf() are sleeping while holding the hash lock for their
+ * arc_get_data_impl() are sleeping while holding the hash lock for their
  * particular arc header. Thus, we must be careful to never sleep on a
  * hash lock in this thread. This is to prevent the following deadlock:
  *
- *  - Thread A sleeps on CV in arc_get_data_buf() holding hash lock "L",
+ *  - Thread A sleeps on CV in arc_get_data_impl() holding hash lock "L",
  *    waiting for the reclaim thread to signal it.
  *
  *  - arc_reclaim_thread() tries to acquire hash lock "L" using mutex_enter,
@@ -4140,6 +4936,7 @@ arc_reclaim_thread(void)
 {
 	hrtime_t		growtime = 0;
 	callb_cpr_t		cpr;
+	arc_pressure_t		level = ARC_PRESSURE_NONE;
 
 	CALLB_CPR_INIT(&cpr, &arc_reclaim_lock, callb_generic_cpr, FTAG);
 
@@ -4181,10 +4978,16 @@ arc_reclaim_thread(void)
 		/*
 		 * We call arc_adjust() before (possibly) calling
 		 * arc_kmem_reap_now(), so that we can wake up
-		 * arc_get_data_buf() sooner.
+		 * arc_get_data_impl() sooner.
 		 */
 		evicted = arc_adjust();
 
+		/* the last pass shrank the ARC if it was pressed for memory */
+		if (level >= ARC_PRESSURE_WARN)
+			ARCSTAT_INCR(arcstat_evict_pressure, evicted);
+		else
+			ARCSTAT_INCR(arcstat_evict_size, evicted);
+
 		int64_t free_memory = arc_available_memory();
 
 #if defined(__APPLE__) && defined(_KERNEL)
@@ -4211,8 +5014,10 @@ arc_reclaim_thread(void)
 		}
 
 		free_memory = post_adjust_free_memory;
+		level = arc_pressure_level(free_memory, manual_pressure);
+		ARCSTAT(arcstat_pressure_level) = level;
 
-		if (free_memory < 0 || manual_pressure > 0) {
+		if (level == ARC_PRESSURE_CRITICAL) {
 
 			if (free_memory <= (arc_c >> arc_no_grow_shift) + SPA_MAXBLOCKSIZE) {
 				arc_no_grow = B_TRUE;
@@ -4223,7 +5028,10 @@ arc_reclaim_thread(void)
 				growtime = gethrtime() + SEC2NSEC(arc_grow_retry);
 			}
 #else
-	        if (free_memory < 0) {
+		level = arc_pressure_level(free_memory, 0);
+		ARCSTAT(arcstat_pressure_level) = level;
+
+		if (level == ARC_PRESSURE_CRITICAL) {
 
 			arc_no_grow = B_TRUE;
 
@@ -4322,7 +5130,19 @@ arc_reclaim_thread(void)
 #ifndef _KERNEL
 			}
 #endif // !_KERNEL
-		} else if (free_memory < (arc_c >> arc_no_grow_shift) && arc_size >= arc_c_min) {
+		} else if (level == ARC_PRESSURE_WARN) {
+			/*
+			 * Below the free target band, but not out of memory:
+			 * shrink by half the way back to the top of the band,
+			 * a little at a time.
+			 */
+			arc_no_grow = B_TRUE;
+			growtime = gethrtime() + SEC2NSEC(arc_grow_retry);
+			arc_shrink(MIN(2 * arc_free_target() - free_memory,
+			    (int64_t)(arc_c >> arc_shrink_shift)) / 2);
+		} else if (level == ARC_PRESSURE_LOW ||
+		    (free_memory < (arc_c >> arc_no_grow_shift) &&
+		    arc_size >= arc_c_min)) {
 			arc_no_grow = B_TRUE;
 		} else if (growtime > 0 && gethrtime() >= growtime) {
 			if (arc_no_grow == B_TRUE)
@@ -4355,10 +5175,14 @@ arc_reclaim_thread(void)
 			 * might need to perform arc_kmem_reap_now()
 			 * even if we aren't being signalled)
 			 */
-			CALLB_CPR_SAFE_BEGIN(&cpr);
-			(void) cv_timedwait_hires(&arc_reclaim_thread_cv,
-			    &arc_reclaim_lock, MSEC2NSEC(500), MSEC2NSEC(1), 0);
-			CALLB_CPR_SAFE_END(&cpr, &arc_reclaim_lock);
+			if (!arc_reclaim_pending) {
+				CALLB_CPR_SAFE_BEGIN(&cpr);
+				(void) cv_timedwait_hires(
+				    &arc_reclaim_thread_cv, &arc_reclaim_lock,
+				    MSEC2NSEC(500), MSEC2NSEC(1), 0);
+				CALLB_CPR_SAFE_END(&cpr, &arc_reclaim_lock);
+			}
+			arc_reclaim_pending = B_FALSE;
 		}
 	}
 
@@ -4536,16 +5360,43 @@ arc_is_overflowing(void)
 	return (arc_size >= arc_c + overflow);
 }
 
+static abd_t *
+arc_get_data_abd(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
+{
+	arc_buf_contents_t type = arc_buf_type(hdr);
+
+	arc_get_data_impl(hdr, size, tag);
+	if (type == ARC_BUFC_METADATA) {
+		return (abd_alloc(size, B_TRUE));
+	} else {
+		ASSERT(type == ARC_BUFC_DATA);
+		return (abd_alloc(size, B_FALSE));
+	}
+}
+
+static void *
+arc_get_data_buf(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
+{
+	arc_buf_contents_t type = arc_buf_type(hdr);
+
+	arc_get_data_impl(hdr, size, tag);
+	if (type == ARC_BUFC_METADATA) {
+		return (zio_buf_alloc(size));
+	} else {
+		ASSERT(type == ARC_BUFC_DATA);
+		return (zio_data_buf_alloc(size));
+	}
+}
+
 /*
- * Allocate a block and return it to the caller. If we are hitting the
+ * Account for a new block of the given size. If we are hitting the
  * hard limit for the cache size, we must sleep, waiting for the eviction
  * thread to catch up. If we're past the target size but below the hard
  * limit, we'll only signal the reclaim thread and continue on.
  */
-static void *
-arc_get_data_buf(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
+static void
+arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 {
-	void *datap = NULL;
 	arc_state_t		*state = hdr->b_l1hdr.b_state;
 	arc_buf_contents_t	type = arc_buf_type(hdr);
 
@@ -4591,15 +5442,13 @@ arc_get_data_buf(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 		mutex_exit(&arc_reclaim_lock);
 	}
 
-	VERIFY3U(hdr->b_type, ==, type);
 	if (type == ARC_BUFC_METADATA) {
-		datap = zio_buf_alloc(size);
 		arc_space_consume(size, ARC_SPACE_META);
 	} else {
 		ASSERT(type == ARC_BUFC_DATA);
-		datap = zio_data_buf_alloc(size);
 		arc_space_consume(size, ARC_SPACE_DATA);
 	}
+	arc_hdr_charge(hdr, size);
 
 	/*
 	 * Update the state size.  Note that ghost states have a
@@ -4633,14 +5482,34 @@ arc_get_data_buf(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 		    refcount_count(&arc_mru->arcs_size) > arc_p))
 			arc_p = MIN(arc_c, arc_p + size);
 	}
-	return (datap);
+}
+
+static void
+arc_free_data_abd(arc_buf_hdr_t *hdr, abd_t *abd, uint64_t size, void *tag)
+{
+	arc_free_data_impl(hdr, size, tag);
+	abd_free(abd);
+}
+
+static void
+arc_free_data_buf(arc_buf_hdr_t *hdr, void *buf, uint64_t size, void *tag)
+{
+	arc_buf_contents_t type = arc_buf_type(hdr);
+
+	arc_free_data_impl(hdr, size, tag);
+	if (type == ARC_BUFC_METADATA) {
+		zio_buf_free(buf, size);
+	} else {
+		ASSERT(type == ARC_BUFC_DATA);
+		zio_data_buf_free(buf, size);
+	}
 }
 
 /*
  * Free the arc data buffer.
  */
 static void
-arc_free_data_buf(arc_buf_hdr_t *hdr, void *data, uint64_t size, void *tag)
+arc_free_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 {
 	arc_state_t *state = hdr->b_l1hdr.b_state;
 	arc_buf_contents_t type = arc_buf_type(hdr);
@@ -4654,14 +5523,12 @@ arc_free_data_buf(arc_buf_hdr_t *hdr, void *data, uint64_t size, void *tag)
 		    size, tag);
 	}
 	(void) refcount_remove_many(&state->arcs_size, size, tag);
+	arc_hdr_charge(hdr, -size);
 
-	VERIFY3U(hdr->b_type, ==, type);
 	if (type == ARC_BUFC_METADATA) {
-		zio_buf_free(data, size);
 		arc_space_return(size, ARC_SPACE_META);
 	} else {
 		ASSERT(type == ARC_BUFC_DATA);
-		zio_data_buf_free(data, size);
 		arc_space_return(size, ARC_SPACE_DATA);
 	}
 }
@@ -4714,6 +5581,23 @@ arc_access(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 			return;
 		}
 
+		/*
+		 * A buffer read by a long sequential stream stays on
+		 * probation in the MRU state: the stream touching it again
+		 * says nothing about its value, so rather than promoting
+		 * it an access well after it was read only lifts the
+		 * probation, and it needs yet another access to reach MFU.
+		 */
+		if (HDR_SEQUENTIAL(hdr)) {
+			if (now > hdr->b_l1hdr.b_arc_access + ARC_MINTIME) {
+				arc_hdr_clear_flags(hdr, ARC_FLAG_SEQUENTIAL);
+				hdr->b_l1hdr.b_arc_access = now;
+				ARCSTAT_BUMP(arcstat_sequential_mfu_skips);
+			}
+			ARCSTAT_BUMP(arcstat_mru_hits);
+			return;
+		}
+
 		/*
 		 * This buffer has been "accessed" only once so far,
 		 * but it is still in the cache. Move it to the MFU
@@ -4738,10 +5622,12 @@ arc_access(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		 * MFU state.
 		 */
 
-		if (HDR_PREFETCH(hdr)) {
+		if (HDR_PREFETCH(hdr) || HDR_SEQUENTIAL(hdr)) {
 			new_state = arc_mru;
 			if (refcount_count(&hdr->b_l1hdr.b_refcnt) > 0)
 				arc_hdr_clear_flags(hdr, ARC_FLAG_PREFETCH);
+			if (HDR_SEQUENTIAL(hdr))
+				ARCSTAT_BUMP(arcstat_sequential_mfu_skips);
 			DTRACE_PROBE1(new_state__mru, arc_buf_hdr_t *, hdr);
 		} else {
 			new_state = arc_mfu;
@@ -4774,8 +5660,9 @@ arc_access(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		/*
 		 * This buffer has been accessed more than once but has
 		 * been evicted from the cache.  Move it back to the
-		 * MFU state.
+		 * MFU state.  Its history outweighs a scan reading it.
 		 */
+		arc_hdr_clear_flags(hdr, ARC_FLAG_SEQUENTIAL);
 
 		if (HDR_PREFETCH(hdr)) {
 			/*
@@ -4896,7 +5783,7 @@ arc_read_done(zio_t *zio)
 	}
 
 	arc_hdr_clear_flags(hdr, ARC_FLAG_L2_EVICTED);
-	if (l2arc_noprefetch && HDR_PREFETCH(hdr))
+	if (l2arc_noprefetch && HDR_PREFETCH(hdr) && !arc_hdr_l2prefetch(hdr))
 		arc_hdr_clear_flags(hdr, ARC_FLAG_L2CACHE);
 
 	callback_list = hdr->b_l1hdr.b_acb;
@@ -4937,7 +5824,7 @@ arc_read_done(zio_t *zio)
 	if (callback_cnt == 0) {
 		ASSERT(HDR_PREFETCH(hdr));
 		ASSERT0(hdr->b_l1hdr.b_bufcnt);
-		ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 	}
 
 	ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt) ||
@@ -5020,6 +5907,8 @@ arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp, arc_done_func_t *done,
 	zio_t *rzio;
 	uint64_t guid = spa_load_guid(spa);
 	boolean_t compressed_read = (zio_flags & ZIO_FLAG_RAW) != 0;
+	arc_state_t *ostate = NULL;
+	boolean_t promoted;
 
 	ASSERT(!BP_IS_EMBEDDED(bp) ||
 	    BPE_GET_ETYPE(bp) == BP_EMBEDDED_TYPE_DATA);
@@ -5033,7 +5922,7 @@ top:
 		hdr = buf_hash_find(guid, bp, &hash_lock);
 	}
 
-	if (hdr != NULL && HDR_HAS_L1HDR(hdr) && hdr->b_l1hdr.b_pdata != NULL) {
+	if (hdr != NULL && HDR_HAS_L1HDR(hdr) && hdr->b_l1hdr.b_pabd != NULL) {
 		arc_buf_t *buf = NULL;
 		*arc_flags |= ARC_FLAG_CACHED;
 
@@ -5127,10 +6016,16 @@ top:
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
 		}
 		DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
+		ostate = hdr->b_l1hdr.b_state;
 		arc_access(hdr, hash_lock);
-		if (*arc_flags & ARC_FLAG_L2CACHE)
+		promoted = (ostate != arc_mfu &&
+		    hdr->b_l1hdr.b_state == arc_mfu);
+		/* encrypted blocks are kept out of the (unencrypted) L2ARC */
+		if ((*arc_flags & ARC_FLAG_L2CACHE) && !BP_IS_ENCRYPTED(bp))
 			arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
 		mutex_exit(hash_lock);
+		if (promoted)
+			spa_warm_record(spa, zb);
 		ARCSTAT_BUMP(arcstat_hits);
 		ARCSTAT_CONDSTAT(!HDR_PREFETCH(hdr),
 		    demand, prefetch, !HDR_ISTYPE_METADATA(hdr),
@@ -5144,8 +6039,10 @@ top:
 		arc_callback_t *acb;
 		vdev_t *vd = NULL;
 		uint64_t addr = 0;
+		uint64_t l2size = 0;
 		boolean_t devw = B_FALSE;
 		uint64_t size;
+		arc_ds_t *ads;
 
 		if (hdr == NULL) {
 			/* this block is not in the cache */
@@ -5153,6 +6050,10 @@ top:
 			arc_buf_contents_t type = BP_GET_BUFC_TYPE(bp);
 			hdr = arc_hdr_alloc(spa_load_guid(spa), psize, lsize,
 			    BP_GET_COMPRESS(bp), type);
+			if (zb != NULL) {
+				arc_hdr_set_ds(hdr, arc_ds_hold(spa,
+				    zb->zb_objset, KM_PUSHPAGE));
+			}
 
 			if (!BP_IS_EMBEDDED(bp)) {
 				hdr->b_dva = *BP_IDENTITY(bp);
@@ -5176,13 +6077,27 @@ top:
 				hdr = arc_hdr_realloc(hdr, hdr_l2only_cache,
 				    hdr_full_cache);
 			}
-			ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+			ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 			ASSERT(GHOST_STATE(hdr->b_l1hdr.b_state));
 			ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 			ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 			ASSERT3P(hdr->b_l1hdr.b_buf, ==, NULL);
 			ASSERT3P(hdr->b_l1hdr.b_freeze_cksum, ==, NULL);
 
+			/* no data is charged while it is a ghost */
+			if (zb != NULL && (ads = arc_ds_hold(spa,
+			    zb->zb_objset, KM_NOSLEEP)) != NULL)
+				arc_hdr_set_ds(hdr, ads);
+
+			/*
+			 * A ghost hit from anything but a sequential stream
+			 * is a real re-reference; let arc_access() promote.
+			 */
+			if (*arc_flags & ARC_FLAG_SEQUENTIAL)
+				arc_hdr_set_flags(hdr, ARC_FLAG_SEQUENTIAL);
+			else
+				arc_hdr_clear_flags(hdr, ARC_FLAG_SEQUENTIAL);
+
 			/*
 			 * This is a delicate dance that we play here.
 			 * This hdr is in the ghost list so we access it
@@ -5193,10 +6108,11 @@ top:
 			 * do this after we've called arc_access() to
 			 * avoid hitting an assert in remove_reference().
 			 */
+			ostate = hdr->b_l1hdr.b_state;
 			arc_access(hdr, hash_lock);
-			arc_hdr_alloc_pdata(hdr);
+			arc_hdr_alloc_pabd(hdr);
 		}
-		ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 		size = arc_hdr_size(hdr);
 
 		/*
@@ -5211,12 +6127,16 @@ top:
 
 		if (*arc_flags & ARC_FLAG_PREFETCH)
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
-		if (*arc_flags & ARC_FLAG_L2CACHE)
+		if ((*arc_flags & ARC_FLAG_L2CACHE) && !BP_IS_ENCRYPTED(bp))
 			arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
 		if (BP_GET_LEVEL(bp) > 0)
 			arc_hdr_set_flags(hdr, ARC_FLAG_INDIRECT);
 		if (*arc_flags & ARC_FLAG_PREDICTIVE_PREFETCH)
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREDICTIVE_PREFETCH);
+		if (*arc_flags & ARC_FLAG_SEQUENTIAL) {
+			arc_hdr_set_flags(hdr, ARC_FLAG_SEQUENTIAL);
+			ARCSTAT_INCR(arcstat_sequential_admits, lsize);
+		}
 		ASSERT(!GHOST_STATE(hdr->b_l1hdr.b_state));
 
 		acb = kmem_zalloc(sizeof (arc_callback_t), KM_SLEEP);
@@ -5232,6 +6152,7 @@ top:
 		    (vd = hdr->b_l2hdr.b_dev->l2ad_vdev) != NULL) {
 			devw = hdr->b_l2hdr.b_dev->l2ad_writing;
 			addr = hdr->b_l2hdr.b_daddr;
+			l2size = l2arc_hdr_size(hdr);
 			/*
 			 * Lock out device removal.
 			 */
@@ -5248,6 +6169,10 @@ top:
 		if (hash_lock != NULL)
 			mutex_exit(hash_lock);
 
+		/* A ghost hit that promotes it marks a block still in demand */
+		if (GHOST_STATE(ostate) && hdr->b_l1hdr.b_state == arc_mfu)
+			spa_warm_record(spa, zb);
+
 		/*
 		 * At this point, we have a level 1 cache miss.  Try again in
 		 * L2ARC if possible.
@@ -5269,11 +6194,13 @@ top:
 			 * 3. This buffer isn't currently writing to the L2ARC.
 			 * 4. The L2ARC entry wasn't evicted, which may
 			 *    also have invalidated the vdev.
-			 * 5. This isn't prefetch and l2arc_noprefetch is set.
+			 * 5. This isn't prefetch and l2arc_noprefetch is set,
+			 *    unless the dataset caches prefetched buffers.
 			 */
 			if (HDR_HAS_L2HDR(hdr) &&
 			    !HDR_L2_WRITING(hdr) && !HDR_L2_EVICTED(hdr) &&
-			    !(l2arc_noprefetch && HDR_PREFETCH(hdr))) {
+			    !(l2arc_noprefetch && HDR_PREFETCH(hdr) &&
+			    !arc_hdr_l2prefetch(hdr))) {
 				l2arc_read_callback_t *cb;
 
 				DTRACE_PROBE1(l2arc__hit, arc_buf_hdr_t *, hdr);
@@ -5299,16 +6226,27 @@ top:
 				ASSERT3U(HDR_GET_COMPRESS(hdr), !=,
 				    ZIO_COMPRESS_EMPTY);
 				rzio = zio_read_phys(pio, vd, addr,
-				    size, hdr->b_l1hdr.b_pdata,
+				    size, hdr->b_l1hdr.b_pabd,
 				    ZIO_CHECKSUM_OFF,
 				    l2arc_read_done, cb, priority,
 				    zio_flags | ZIO_FLAG_DONT_CACHE |
 				    ZIO_FLAG_CANFAIL |
 				    ZIO_FLAG_DONT_PROPAGATE |
 				    ZIO_FLAG_DONT_RETRY, B_FALSE);
+				/*
+				 * Read an L2ARC-compressed copy into a
+				 * buffer of its own; l2arc_decompress()
+				 * restores b_pabd before l2arc_read_done().
+				 */
+				if (l2size != size) {
+					zio_push_transform(rzio,
+					    abd_alloc_for_io(l2size,
+					    HDR_ISTYPE_METADATA(hdr)),
+					    l2size, l2size, l2arc_decompress);
+				}
 				DTRACE_PROBE2(l2arc__read, vdev_t *, vd,
 				    zio_t *, rzio);
-				ARCSTAT_INCR(arcstat_l2_read_bytes, size);
+				ARCSTAT_INCR(arcstat_l2_read_bytes, l2size);
 
 				if (*arc_flags & ARC_FLAG_NOWAIT) {
 					zio_nowait(rzio);
@@ -5338,7 +6276,7 @@ top:
 			}
 		}
 
-		rzio = zio_read(pio, spa, bp, hdr->b_l1hdr.b_pdata, size,
+		rzio = zio_read(pio, spa, bp, hdr->b_l1hdr.b_pabd, size,
 		    arc_read_done, hdr, priority, zio_flags, zb);
 
 		if (*arc_flags & ARC_FLAG_WAIT)
@@ -5449,7 +6387,7 @@ arc_release(arc_buf_t *buf, void *tag)
 	}
 
 	kmutex_t *hash_lock = HDR_LOCK(hdr);
-	mutex_enter(hash_lock);
+	zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 
 	/*
 	 * This assignment is only valid as long as the hash_lock is
@@ -5490,7 +6428,6 @@ arc_release(arc_buf_t *buf, void *tag)
 		uint64_t lsize = HDR_GET_LSIZE(hdr);
 		enum zio_compress compress = HDR_GET_COMPRESS(hdr);
 		arc_buf_contents_t type = arc_buf_type(hdr);
-		VERIFY3U(hdr->b_type, ==, type);
 
 		ASSERT(hdr->b_l1hdr.b_buf != buf || buf->b_next != NULL);
 		(void) remove_reference(hdr, hash_lock, tag);
@@ -5522,16 +6459,17 @@ arc_release(arc_buf_t *buf, void *tag)
 			arc_unshare_buf(hdr, buf);
 
 			/*
-			 * Now we need to recreate the hdr's b_pdata. Since we
+			 * Now we need to recreate the hdr's b_pabd. Since we
 			 * have lastbuf handy, we try to share with it, but if
-			 * we can't then we allocate a new b_pdata and copy the
+			 * we can't then we allocate a new b_pabd and copy the
 			 * data from buf into it.
 			 */
 			if (arc_can_share(hdr, lastbuf)) {
 				arc_share_buf(hdr, lastbuf);
 			} else {
-				arc_hdr_alloc_pdata(hdr);
-				bcopy(buf->b_data, hdr->b_l1hdr.b_pdata, psize);
+				arc_hdr_alloc_pabd(hdr);
+				abd_copy_from_buf(hdr->b_l1hdr.b_pabd,
+				    buf->b_data, psize);
 			}
 			VERIFY3P(lastbuf->b_data, !=, NULL);
 		} else if (HDR_SHARED_DATA(hdr)) {
@@ -5547,11 +6485,12 @@ arc_release(arc_buf_t *buf, void *tag)
 			    HDR_GET_COMPRESS(hdr) != ZIO_COMPRESS_OFF);
 			ASSERT(!ARC_BUF_SHARED(buf));
 		}
-		ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 		ASSERT3P(state, !=, arc_l2c_only);
 
 		(void) refcount_remove_many(&state->arcs_size,
 		    arc_buf_size(buf), buf);
+		arc_hdr_charge(hdr, -arc_buf_size(buf));
 
 		if (refcount_is_zero(&hdr->b_l1hdr.b_refcnt)) {
 			ASSERT3P(state, !=, arc_l2c_only);
@@ -5566,14 +6505,13 @@ arc_release(arc_buf_t *buf, void *tag)
 		mutex_exit(hash_lock);
 
 		/*
-		 * Allocate a new hdr. The new hdr will contain a b_pdata
+		 * Allocate a new hdr. The new hdr will contain a b_pabd
 		 * buffer which will be freed in arc_write().
 		 */
 		nhdr = arc_hdr_alloc(spa, psize, lsize, compress, type);
 		ASSERT3P(nhdr->b_l1hdr.b_buf, ==, NULL);
 		ASSERT0(nhdr->b_l1hdr.b_bufcnt);
 		ASSERT0(refcount_count(&nhdr->b_l1hdr.b_refcnt));
-		VERIFY3U(nhdr->b_type, ==, type);
 		ASSERT(!HDR_SHARED_DATA(nhdr));
 
 		nhdr->b_l1hdr.b_buf = buf;
@@ -5584,6 +6522,7 @@ arc_release(arc_buf_t *buf, void *tag)
 		mutex_exit(&buf->b_evict_lock);
 		(void) refcount_add_many(&arc_anon->arcs_size,
 		    arc_buf_size(buf), buf);
+		arc_hdr_charge(nhdr, arc_buf_size(buf));
 	} else {
 		mutex_exit(&buf->b_evict_lock);
 		ASSERT(refcount_count(&hdr->b_l1hdr.b_refcnt) == 1);
@@ -5644,15 +6583,15 @@ arc_write_ready(zio_t *zio)
 	if (zio->io_flags & ZIO_FLAG_REEXECUTED) {
 		arc_cksum_free(hdr);
 		arc_buf_unwatch(buf);
-		if (hdr->b_l1hdr.b_pdata != NULL) {
+		if (hdr->b_l1hdr.b_pabd != NULL) {
 			if (arc_buf_is_shared(buf)) {
 				arc_unshare_buf(hdr, buf);
 			} else {
-				arc_hdr_free_pdata(hdr);
+				arc_hdr_free_pabd(hdr);
 			}
 		}
 	}
-	ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 	ASSERT(!HDR_SHARED_DATA(hdr));
 	ASSERT(!arc_buf_is_shared(buf));
 
@@ -5678,18 +6617,18 @@ arc_write_ready(zio_t *zio)
 	 * If the hdr is compressed, then copy the compressed
 	 * zio contents into arc_buf_hdr_t. Otherwise, copy the original
 	 * data buf into the hdr. Ideally, we would like to always copy the
-	 * io_data into b_pdata but the user may have disabled compressed
+	 * io_abd into b_pabd but the user may have disabled compressed
 	 * arc thus the on-disk block may or may not match what we maintain
-	 * in the hdr's b_pdata field.
+	 * in the hdr's b_pabd field.
 	 */
 	if (HDR_GET_COMPRESS(hdr) != ZIO_COMPRESS_OFF &&
 	    !ARC_BUF_COMPRESSED(buf)) {
 		ASSERT3U(BP_GET_COMPRESS(zio->io_bp), !=, ZIO_COMPRESS_OFF);
 		ASSERT3U(psize, >, 0);
-		arc_hdr_alloc_pdata(hdr);
-		bcopy(zio->io_data, hdr->b_l1hdr.b_pdata, psize);
+		arc_hdr_alloc_pabd(hdr);
+		abd_copy(hdr->b_l1hdr.b_pabd, zio->io_abd, psize);
 	} else {
-		ASSERT3P(buf->b_data, ==, zio->io_orig_data);
+		ASSERT3P(buf->b_data, ==, abd_to_buf(zio->io_orig_abd));
 		ASSERT3U(zio->io_orig_size, ==, arc_buf_size(buf));
 		ASSERT3U(hdr->b_l1hdr.b_bufcnt, ==, 1);
 
@@ -5698,7 +6637,7 @@ arc_write_ready(zio_t *zio)
 		 * the arc_buf_t data buffer with the hdr.
 		 */
 		arc_share_buf(hdr, buf);
-		ASSERT0(bcmp(zio->io_orig_data, hdr->b_l1hdr.b_pdata,
+		ASSERT0(abd_cmp(zio->io_orig_abd, hdr->b_l1hdr.b_pabd,
 		    HDR_GET_LSIZE(hdr)));
 	}
 	arc_hdr_verify(hdr, zio->io_bp);
@@ -5805,6 +6744,7 @@ arc_write_done(zio_t *zio)
 	ASSERT(!refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 	callback->awcb_done(zio, buf, callback->awcb_private);
 
+	abd_put(zio->io_abd);
 	kmem_free(callback, sizeof (arc_write_callback_t));
 }
 
@@ -5825,7 +6765,10 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, arc_buf_t *buf,
 	ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 	ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
 	ASSERT3U(hdr->b_l1hdr.b_bufcnt, >, 0);
-	if (l2arc)
+	if (zb != NULL)
+		arc_hdr_set_ds(hdr, arc_ds_hold(spa, zb->zb_objset,
+		    KM_PUSHPAGE));
+	if (l2arc && !zp->zp_encrypt)
 		arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
 	if (ARC_BUF_COMPRESSED(buf)) {
 		ASSERT3U(zp->zp_compress, !=, ZIO_COMPRESS_OFF);
@@ -5841,10 +6784,10 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, arc_buf_t *buf,
 	callback->awcb_buf = buf;
 
 	/*
-	 * The hdr's b_pdata is now stale, free it now. A new data block
+	 * The hdr's b_pabd is now stale, free it now. A new data block
 	 * will be allocated when the zio pipeline calls arc_write_ready().
 	 */
-	if (hdr->b_l1hdr.b_pdata != NULL) {
+	if (hdr->b_l1hdr.b_pabd != NULL) {
 		/*
 		 * If the buf is currently sharing the data block with
 		 * the hdr then we need to break that relationship here.
@@ -5854,15 +6797,16 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, arc_buf_t *buf,
 		if (arc_buf_is_shared(buf)) {
 			arc_unshare_buf(hdr, buf);
 		} else {
-			arc_hdr_free_pdata(hdr);
+			arc_hdr_free_pabd(hdr);
 		}
 		VERIFY3P(buf->b_data, !=, NULL);
 		arc_hdr_set_compress(hdr, ZIO_COMPRESS_OFF);
 	}
 	ASSERT(!arc_buf_is_shared(buf));
-	ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 
-	zio = zio_write(pio, spa, txg, bp, buf->b_data,
+	zio = zio_write(pio, spa, txg, bp,
+	    abd_get_from_buf(buf->b_data, arc_buf_size(buf)),
 	    HDR_GET_LSIZE(hdr), arc_buf_size(buf), zp, arc_write_ready,
 	    (children_ready != NULL) ? arc_write_children_ready : NULL,
 	    arc_write_physdone, arc_write_done, callback,
@@ -5928,7 +6872,7 @@ arc_memory_throttle(uint64_t reserve, uint64_t txg)
 	// except in exceptional cases - smd
 
 	if(spl_free_manual_pressure_wrapper() != 0) {
-	  cv_signal(&arc_reclaim_thread_cv);
+	  arc_reclaim_wakeup();
 	  kpreempt(KPREEMPT_SYNC);
 	}
 
@@ -5937,7 +6881,7 @@ arc_memory_throttle(uint64_t reserve, uint64_t txg)
 	  printf("ZFS: %s: !spl_minimal_physmem_p(), available_memory == %lld, "
 		 "page_load = %llu, txg = %llu, reserve = %llu\n",
 		 __func__, available_memory, page_load, txg, reserve);
-	  cv_signal(&arc_reclaim_thread_cv);
+	  arc_reclaim_wakeup();
 	  return (SET_ERROR(EAGAIN));
 	}
 
@@ -5946,7 +6890,7 @@ arc_memory_throttle(uint64_t reserve, uint64_t txg)
 	  printf("ZFS: %s: arc_reclaim_needed(), available_memory == %lld, "
 		 "page_load = %llu, txg = %llu, reserve = %lld\n",
 		 __func__, available_memory, page_load, txg, reserve);
-	  cv_signal(&arc_reclaim_thread_cv);
+	  arc_reclaim_wakeup();
 	  return (SET_ERROR(EAGAIN));
 	}
 
@@ -5957,7 +6901,7 @@ arc_memory_throttle(uint64_t reserve, uint64_t txg)
 
 	if(!spl_minimal_physmem_p()) {
 	  page_load += reserve/8;
-	  cv_signal(&arc_reclaim_thread_cv);
+	  arc_reclaim_wakeup();
 	  return (0);
 	}
 
@@ -6055,6 +6999,11 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	if (rw == KSTAT_WRITE) {
 		return (EACCES);
 	} else {
+		uint64_t l2_asize = as->arcstat_l2_asize.value.ui64;
+
+		as->arcstat_l2_hdr_overhead_ppm.value.ui64 = (l2_asize == 0) ?
+		    0 : as->arcstat_l2_hdr_size.value.ui64 * 1000000 / l2_asize;
+
 		arc_kstat_update_state(arc_anon,
 		    &as->arcstat_anon_size,
 		    &as->arcstat_anon_evictable_data,
@@ -6075,6 +7024,13 @@ arc_kstat_update(kstat_t *ksp, int rw)
 		    &as->arcstat_mfu_ghost_size,
 		    &as->arcstat_mfu_ghost_evictable_data,
 		    &as->arcstat_mfu_ghost_evictable_metadata);
+
+		as->arcstat_mru_sublist_skew.value.ui64 = MAX(
+		    multilist_get_skew(arc_mru->arcs_list[ARC_BUFC_DATA]),
+		    multilist_get_skew(arc_mru->arcs_list[ARC_BUFC_METADATA]));
+		as->arcstat_mfu_sublist_skew.value.ui64 = MAX(
+		    multilist_get_skew(arc_mfu->arcs_list[ARC_BUFC_DATA]),
+		    multilist_get_skew(arc_mfu->arcs_list[ARC_BUFC_METADATA]));
 	}
 
 	return (0);
@@ -6159,6 +7115,7 @@ int arc_kstat_update_osx(kstat_t *ksp, int rw)
 		zfs_arc_shrink_shift      = ks->arc_zfs_arc_shrink_shift.value.ui64;
 		zfs_arc_p_min_shift       = ks->arc_zfs_arc_p_min_shift.value.ui64;
 		zfs_arc_average_blocksize = ks->arc_zfs_arc_average_blocksize.value.ui64;
+		zfs_arc_free_target = ks->arc_zfs_arc_free_target.value.ui64;
 
 	} else {
 
@@ -6175,44 +7132,58 @@ int arc_kstat_update_osx(kstat_t *ksp, int rw)
 		ks->arc_zfs_arc_shrink_shift.value.ui64      = zfs_arc_shrink_shift;
 		ks->arc_zfs_arc_p_min_shift.value.ui64       = zfs_arc_p_min_shift;
 		ks->arc_zfs_arc_average_blocksize.value.ui64 = zfs_arc_average_blocksize;
+		ks->arc_zfs_arc_free_target.value.ui64 = zfs_arc_free_target;
 	}
 	return 0;
 }
 #endif
 
 /*
- * This function *must* return indices evenly distributed between all
- * sublists of the multilist. This is needed due to how the ARC eviction
- * code is laid out; arc_evict_state() assumes ARC buffers are evenly
- * distributed between all sublists and uses this assumption when
- * deciding which sublist to evict from and how much to evict from it.
+ * This function should return indices evenly distributed between all
+ * sublists of the multilist, unless zfs_arc_sublist_by_cpu is set.
+ * arc_evict_state() evicts from each sublist in proportion to its
+ * length, so an uneven distribution doesn't make eviction unfair, but
+ * it does make the longer sublists the contended ones.
+ *
+ * The index handed out on insertion is kept in b_arc_sublist and
+ * returned on removal, so that it needn't be recomputable from the
+ * header, and zfs_arc_sublist_by_cpu can be changed at any time.
  */
 unsigned int
 arc_state_multilist_index_func(multilist_t *ml, void *obj)
 {
 	arc_buf_hdr_t *hdr = obj;
 
-	/*
-	 * We rely on b_dva to generate evenly distributed index
-	 * numbers using buf_hash below. So, as an added precaution,
-	 * let's make sure we never add empty buffers to the arc lists.
-	 */
-	ASSERT(!HDR_EMPTY(hdr));
+	ASSERT(HDR_HAS_L1HDR(hdr));
+	if (multilist_link_active(&hdr->b_l1hdr.b_arc_node))
+		return (hdr->b_l1hdr.b_arc_sublist);
 
-	/*
-	 * The assumption here, is the hash value for a given
-	 * arc_buf_hdr_t will remain constant throughout it's lifetime
-	 * (i.e. it's b_spa, b_dva, and b_birth fields don't change).
-	 * Thus, we don't need to store the header's sublist index
-	 * on insertion, as this index can be recalculated on removal.
-	 *
-	 * Also, the low order bits of the hash value are thought to be
-	 * distributed evenly. Otherwise, in the case that the multilist
-	 * has a power of two number of sublists, each sublists' usage
-	 * would not be evenly distributed.
-	 */
-	return (buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth) %
-			multilist_get_num_sublists(ml));
+	if (zfs_arc_sublist_by_cpu) {
+		/*
+		 * Keep insertions from one CPU (or a group of neighbouring
+		 * ones, if there are fewer sublists than CPUs) on one
+		 * sublist, so they don't pull its lock across packages.
+		 */
+		hdr->b_l1hdr.b_arc_sublist = multilist_get_cpu_index(ml);
+	} else {
+		/*
+		 * We rely on b_dva to generate evenly distributed index
+		 * numbers using buf_hash below. So, as an added precaution,
+		 * let's make sure we never add empty buffers to the arc
+		 * lists.
+		 *
+		 * The low order bits of the hash value are thought to be
+		 * distributed evenly. Otherwise, in the case that the
+		 * multilist has a power of two number of sublists, each
+		 * sublists' usage would not be evenly distributed.
+		 */
+		ASSERT(!HDR_EMPTY(hdr));
+		hdr->b_l1hdr.b_arc_sublist = buf_hash(hdr->b_spa,
+		    &hdr->b_dva, hdr->b_birth) %
+		    multilist_get_num_sublists(ml);
+	}
+
+	return (hdr->b_l1hdr.b_arc_sublist);
 }
 
 static void
@@ -6328,6 +7299,17 @@ arc_max_bytes(void)
 	return (arc_c_max);
 }
 
+/*
+ * Number of demand reads that had to wait for a predictive prefetch of
+ * the same block still in flight, i.e. prefetches that were issued too
+ * late to hide the read latency.
+ */
+uint64_t
+arc_prefetch_late(void)
+{
+	return (ARCSTAT(arcstat_sync_wait_for_async));
+}
+
 void
 arc_init(void)
 {
@@ -6444,6 +7426,16 @@ arc_init(void)
 
 	arc_state_init();
 	buf_init();
+	arc_ds_init();
+
+	if (zfs_arc_evict_threads == 0)
+		zfs_arc_evict_threads = MAX(1, MIN(max_ncpus / 2, 8));
+	if (zfs_arc_evict_threads > 1) {
+		arc_evict_taskq = taskq_create("arc_evict",
+		    zfs_arc_evict_threads, minclsyspri,
+		    multilist_get_num_sublists(arc_mru->arcs_list[0]),
+		    INT_MAX, TASKQ_PREPOPULATE);
+	}
 
 	arc_reclaim_thread_exit = B_FALSE;
 
@@ -6497,6 +7489,11 @@ arc_fini(void)
 	/* Use B_TRUE to ensure *all* buffers are evicted */
 	arc_flush(NULL, B_TRUE);
 
+	if (arc_evict_taskq != NULL) {
+		taskq_destroy(arc_evict_taskq);
+		arc_evict_taskq = NULL;
+	}
+
 	arc_dead = B_TRUE;
 
 	if (arc_ksp != NULL) {
@@ -6510,6 +7507,7 @@ arc_fini(void)
 
 	arc_state_fini();
 	buf_fini();
+	arc_ds_fini();
 
 	ASSERT0(arc_loaned_bytes);
 }
@@ -6575,8 +7573,9 @@ arc_fini(void)
  * temporarily boost scanning headroom during the next scan cycle to make
  * sure we adapt to compression effects (which might significantly reduce
  * the data volume we write to L2ARC). The thread that does this is
- * l2arc_feed_thread(), illustrated below; example sizes are included to
- * provide a better sense of ratio than this diagram:
+ * l2arc_feed_thread(), one for each cache device, illustrated below;
+ * example sizes are included to provide a better sense of ratio than
+ * this diagram:
  *
  *	       head -->                        tail
  *	        +---------------------+----------+
@@ -6624,7 +7623,9 @@ arc_fini(void)
  * 6. Writes to the L2ARC devices are grouped and sent in-sequence, so that
  * the vdev queue can aggregate them into larger and fewer writes.  Each
  * device is written to in a rotor fashion, sweeping writes through
- * available space then repeating.
+ * available space then repeating.  The devices are fed in parallel, by
+ * a feed thread of their own, so that a slow device only holds up its
+ * own writes.
  *
  * 7. The L2ARC does not store dirty content.  It never needs to flush
  * write buffers back to disk based storage.
@@ -6632,12 +7633,27 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. The contents of the L2ARC survive a reboot or a pool export.  Among
+ * the buffers, each device is written log blocks that describe them, and
+ * a device header that points to the latest log block (see "L2ARC
+ * Persistence" above).  When the device is added to the L2ARC again, a
+ * thread of its own walks the log blocks and recreates the L2-only
+ * headers of the buffers that are still intact, see l2arc_rebuild().
+ * They can be read as soon as they are restored; the device is only
+ * kept from being fed until the rebuild completes.  Nothing depends on
+ * the log being accurate: every L2ARC read is verified against the
+ * checksum of the block pointer, and falls back to the pool.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
  *	l2arc_write_max		max write bytes per interval
  *	l2arc_write_boost	extra write bytes during device warmup
- *	l2arc_noprefetch	skip caching prefetched buffers
+ *	l2arc_write_limit	max write bytes per interval when the ARC
+ *				evicts eligible buffers faster than
+ *				l2arc_write_max would keep up with
+ *	l2arc_noprefetch	skip caching prefetched buffers, except
+ *				for datasets with secondarycache=prefetch
  *	l2arc_headroom		number of max device writes to precache
  *	l2arc_headroom_boost	when we find compressed buffers during ARC
  *				scanning, we multiply headroom by this
@@ -6645,6 +7661,10 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	restore the L2ARC contents when a cache
+ *				device is added, e.g. at pool import
+ *	l2arc_compress		lz4-compress buffers the ARC holds
+ *				uncompressed before writing them
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -6677,9 +7697,9 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *hdr)
 }
 
 static uint64_t
-l2arc_write_size(void)
+l2arc_write_size(l2arc_dev_t *dev)
 {
-	uint64_t size;
+	uint64_t size, evicted, delta;
 
 	/*
 	 * Make sure our globals have meaningful values in case the user
@@ -6693,6 +7713,29 @@ l2arc_write_size(void)
 		size = l2arc_write_max = L2ARC_WRITE_SIZE;
 	}
 
+	/*
+	 * Keep up with the ARC: write this device's share of the eligible
+	 * bytes evicted since its last feed, up to l2arc_write_limit.
+	 */
+	evicted = ARCSTAT(arcstat_evict_l2_eligible);
+	delta = evicted > dev->l2ad_evict_l2_last ?
+	    evicted - dev->l2ad_evict_l2_last : 0;
+	dev->l2ad_evict_l2_last = evicted;
+	if (l2arc_write_limit > size)
+		size = MAX(size, MIN(delta / MAX(l2arc_ndev, 1),
+		    l2arc_write_limit));
+
+	/*
+	 * Back off a device that can't keep up: if it took longer than the
+	 * shortest feed interval to complete the last write, write at most
+	 * half as much this time, but no less than l2arc_write_max.
+	 */
+	if (dev->l2ad_write_time > MSEC2NSEC(l2arc_feed_min_ms) &&
+	    MAX(dev->l2ad_write_size / 2, l2arc_write_max) < size) {
+		size = MAX(dev->l2ad_write_size / 2, l2arc_write_max);
+		ARCSTAT_BUMP(arcstat_l2_feeds_throttled);
+	}
+
 	if (arc_warm == B_FALSE)
 		size += l2arc_write_boost;
 
@@ -6722,67 +7765,6 @@ l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 	return (next);
 }
 
-/*
- * Cycle through L2ARC devices.  This is how L2ARC load balances.
- * If a device is returned, this also returns holding the spa config lock.
- */
-static l2arc_dev_t *
-l2arc_dev_get_next(void)
-{
-	l2arc_dev_t *first, *next = NULL;
-
-	/*
-	 * Lock out the removal of spas (spa_namespace_lock), then removal
-	 * of cache devices (l2arc_dev_mtx).  Once a device has been selected,
-	 * both locks will be dropped and a spa config lock held instead.
-	 */
-	mutex_enter(&spa_namespace_lock);
-	mutex_enter(&l2arc_dev_mtx);
-
-	/* if there are no vdevs, there is nothing to do */
-	if (l2arc_ndev == 0)
-		goto out;
-
-	first = NULL;
-	next = l2arc_dev_last;
-	do {
-		/* loop around the list looking for a non-faulted vdev */
-		if (next == NULL) {
-			next = list_head(l2arc_dev_list);
-		} else {
-			next = list_next(l2arc_dev_list, next);
-			if (next == NULL)
-				next = list_head(l2arc_dev_list);
-		}
-
-		/* if we have come back to the start, bail out */
-		if (first == NULL)
-			first = next;
-		else if (next == first)
-			break;
-
-	} while (vdev_is_dead(next->l2ad_vdev));
-
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
-		next = NULL;
-
-	l2arc_dev_last = next;
-
-out:
-	mutex_exit(&l2arc_dev_mtx);
-
-	/*
-	 * Grab the config lock to prevent the 'next' device from being
-	 * removed while we are writing to it.
-	 */
-	if (next != NULL)
-		spa_config_enter(next->l2ad_spa, SCL_L2ARC, next, RW_READER);
-	mutex_exit(&spa_namespace_lock);
-
-	return (next);
-}
-
 /*
  * Free buffers that were tagged for destruction.
  */
@@ -6797,13 +7779,8 @@ l2arc_do_free_on_write()
 
 	for (df = list_tail(buflist); df; df = df_prev) {
 		df_prev = list_prev(buflist, df);
-		ASSERT3P(df->l2df_data, !=, NULL);
-		if (df->l2df_type == ARC_BUFC_METADATA) {
-			zio_buf_free(df->l2df_data, df->l2df_size);
-		} else {
-			ASSERT(df->l2df_type == ARC_BUFC_DATA);
-			zio_data_buf_free(df->l2df_data, df->l2df_size);
-		}
+		ASSERT3P(df->l2df_abd, !=, NULL);
+		abd_free(df->l2df_abd);
 		list_remove(buflist, df);
 		kmem_free(df, sizeof (l2arc_data_free_t));
 	}
@@ -6878,7 +7855,7 @@ top:
 			 * the chance we'll be able to acquire the lock
 			 * the next time around.
 			 */
-			mutex_enter(hash_lock);
+			zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 			mutex_exit(hash_lock);
 			goto top;
 		}
@@ -6894,15 +7871,22 @@ top:
 			/*
 			 * Error - drop L2ARC entry.
 			 */
+			uint64_t asize = l2arc_hdr_size(hdr);
+
 			list_remove(buflist, hdr);
 			arc_hdr_clear_flags(hdr, ARC_FLAG_HAS_L2HDR);
 
-			ARCSTAT_INCR(arcstat_l2_asize, -arc_hdr_size(hdr));
+			ARCSTAT_INCR(arcstat_l2_asize, -asize);
 			ARCSTAT_INCR(arcstat_l2_size, -HDR_GET_LSIZE(hdr));
+			if (HDR_GET_L2COMPRESS(hdr) != 0) {
+				ARCSTAT_INCR(arcstat_l2_compress_saved,
+				    -(HDR_GET_LSIZE(hdr) - asize));
+			}
+			HDR_SET_L2COMPRESS(hdr, 0);
 
-			bytes_dropped += arc_hdr_size(hdr);
+			bytes_dropped += asize;
 			(void) refcount_remove_many(&dev->l2ad_alloc,
-				arc_hdr_size(hdr), hdr);
+				asize, hdr);
 		}
 
 		/*
@@ -6931,6 +7915,71 @@ top:
  * A read to a cache device completed.  Validate buffer contents before
  * handing over to the regular ARC routines.
  */
+/*
+ * I/O transform callback for reads of buffers compressed by
+ * l2arc_compress_buf(), see zio_push_transform().
+ */
+static void
+l2arc_decompress(zio_t *zio, abd_t *data, uint64_t size)
+{
+	if (zio->io_error == 0) {
+		void *tmp = abd_borrow_buf(data, size);
+		int ret = zio_decompress_data(ZIO_COMPRESS_LZ4,
+		    zio->io_abd, tmp, zio->io_size, size);
+		abd_return_buf_copy(data, tmp, size);
+
+		if (ret != 0)
+			zio->io_error = SET_ERROR(EIO);
+	}
+}
+
+/*
+ * With l2arc_compress set, buffers that the ARC holds uncompressed are
+ * lz4-compressed on their way to the L2ARC.  Rather than adding a size
+ * field to every hdr, the compressed copy is padded to a whole number of
+ * sixteenths of the logical size and that number is kept in b_flags, see
+ * l2arc_hdr_size().  Returns the data to write, or NULL if the buffer
+ * doesn't compress well enough to save any space.
+ */
+static abd_t *
+l2arc_compress_buf(arc_buf_hdr_t *hdr)
+{
+	uint64_t lsize = HDR_GET_LSIZE(hdr);
+	uint64_t csize, asize, sixteenths;
+	abd_t *cabd;
+	void *cbuf;
+
+	ASSERT(MUTEX_HELD(HDR_LOCK(hdr)));
+	ASSERT3U(HDR_GET_COMPRESS(hdr), ==, ZIO_COMPRESS_OFF);
+	ASSERT0(HDR_GET_L2COMPRESS(hdr));
+
+	cbuf = zio_buf_alloc(lsize);
+	csize = zio_compress_data(ZIO_COMPRESS_LZ4, hdr->b_l1hdr.b_pabd,
+	    cbuf, lsize);
+
+	/* zero-filled buffers (csize 0) are rare; write them as they are */
+	sixteenths = howmany(csize * 16, lsize);
+	asize = P2ROUNDUP(howmany(lsize * sixteenths, 16), SPA_MINBLOCKSIZE);
+	if (csize == 0 || asize >= lsize) {
+		zio_buf_free(cbuf, lsize);
+		ARCSTAT_BUMP(arcstat_l2_compress_failures);
+		return (NULL);
+	}
+	ASSERT3U(sixteenths, <, 1 << HDR_L2COMPRESS_BITS);
+
+	cabd = abd_alloc_for_io(asize, HDR_ISTYPE_METADATA(hdr));
+	abd_copy_from_buf(cabd, cbuf, csize);
+	abd_zero_off(cabd, csize, asize - csize);
+	zio_buf_free(cbuf, lsize);
+
+	HDR_SET_L2COMPRESS(hdr, sixteenths);
+	ASSERT3U(l2arc_hdr_size(hdr), ==, asize);
+	ARCSTAT_BUMP(arcstat_l2_compress_successes);
+	ARCSTAT_INCR(arcstat_l2_compress_saved, lsize - asize);
+
+	return (cabd);
+}
+
 static void
 l2arc_read_done(zio_t *zio)
 {
@@ -6950,15 +7999,15 @@ l2arc_read_done(zio_t *zio)
 	ASSERT3P(hdr, !=, NULL);
 
 	hash_lock = HDR_LOCK(hdr);
-	mutex_enter(hash_lock);
+	zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 	ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
 
-	ASSERT3P(zio->io_data, !=, NULL);
+	ASSERT3P(zio->io_abd, !=, NULL);
 
 	/*
 	 * Check this survived the L2ARC journey.
 	 */
-	ASSERT3P(zio->io_data, ==, hdr->b_l1hdr.b_pdata);
+	ASSERT3P(zio->io_abd, ==, hdr->b_l1hdr.b_pabd);
 	zio->io_bp_copy = cb->l2rcb_bp;	/* XXX fix in L2ARC 2.0	*/
 	zio->io_bp = &zio->io_bp_copy;	/* XXX fix in L2ARC 2.0	*/
 
@@ -6992,7 +8041,7 @@ l2arc_read_done(zio_t *zio)
 			ASSERT(!pio || pio->io_child_type == ZIO_CHILD_LOGICAL);
 
 			zio_nowait(zio_read(pio, zio->io_spa, zio->io_bp,
-			    hdr->b_l1hdr.b_pdata, zio->io_size, arc_read_done,
+			    hdr->b_l1hdr.b_pabd, zio->io_size, arc_read_done,
 			    hdr, zio->io_priority, cb->l2rcb_flags,
 			    &cb->l2rcb_zb));
 		}
@@ -7044,6 +8093,34 @@ l2arc_sublist_lock(int list_num)
 	return (multilist_sublist_lock(ml, idx));
 }
 
+/*
+ * The most log block space that writing size bytes of buffers may take.
+ * The log block being filled may already hold entries from earlier
+ * writes, hence the extra block.
+ */
+static uint64_t
+l2arc_log_blk_overhead(uint64_t size)
+{
+	return ((howmany(size >> SPA_MINBLOCKSHIFT, L2ARC_LOG_BLK_ENTRIES) +
+	    1) * L2ARC_LOG_BLK_SIZE);
+}
+
+/*
+ * The address up to which l2arc_evict() clears the device for a write of
+ * the given distance.
+ */
+static uint64_t
+l2arc_evict_target(l2arc_dev_t *dev, uint64_t distance)
+{
+	/*
+	 * When nearing the end of the device, evict to the end
+	 * before the device write hand jumps to the start.
+	 */
+	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance)))
+		return (dev->l2ad_end);
+	return (dev->l2ad_hand + distance);
+}
+
 /*
  * Evict buffers from the device write hand to the distance specified in
  * bytes.  This distance may span populated buffers, it may span nothing.
@@ -7068,15 +8145,7 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 		return;
 	}
 
-	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance))) {
-		/*
-		 * When nearing the end of the device, evict to the end
-		 * before the device write hand jumps to the start.
-		 */
-		taddr = dev->l2ad_end;
-	} else {
-		taddr = dev->l2ad_hand + distance;
-	}
+	taddr = l2arc_evict_target(dev, distance);
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
@@ -7098,7 +8167,7 @@ top:
 			 */
 			ARCSTAT_BUMP(arcstat_l2_evict_lock_retry);
 			mutex_exit(&dev->l2ad_mtx);
-			mutex_enter(hash_lock);
+			zfs_mutex_enter(hash_lock, ZFS_LOCK_ARC_HASH);
 			mutex_exit(hash_lock);
 			goto top;
 		}
@@ -7157,6 +8226,112 @@ top:
 	mutex_exit(&dev->l2ad_mtx);
 }
 
+/*
+ * Write the device header, pointing to the latest log block.  distance is
+ * what the next l2arc_evict() will be asked to clear ahead of the hand;
+ * buffers in that range may be overwritten before the header is written
+ * again, and are not restored.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev, uint64_t distance)
+{
+	l2arc_dev_hdr_phys_t *dh = &dev->l2ad_dev_hdr;
+	uint64_t asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+	int err;
+
+	dh->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	dh->dh_version = L2ARC_PERSIST_VERSION;
+	dh->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	dh->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	dh->dh_flags = dev->l2ad_first ? 0 : L2ARC_DEV_HDR_WRAPPED;
+	dh->dh_start = dev->l2ad_start;
+	dh->dh_end = dev->l2ad_end;
+	dh->dh_hand = dev->l2ad_hand;
+	dh->dh_evict = l2arc_evict_target(dev, distance);
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_self_cksum),
+	    NULL, &dh->dh_self_cksum);
+
+	abd = abd_alloc_linear(asize, B_TRUE);
+	abd_zero(abd, asize);
+	abd_copy_from_buf(abd, dh, sizeof (*dh));
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_free(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC device header write failed on %s: %d",
+		    dev->l2ad_vdev->vdev_path, err);
+	}
+}
+
+/*
+ * Write out the log block being filled, as a child of pio, at the write
+ * hand.  Returns the device space used.
+ */
+static uint64_t
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_blkptr_t *lbp = &dev->l2ad_dev_hdr.dh_start_lbp;
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev,
+	    L2ARC_LOG_BLK_SIZE);
+	abd_t *abd;
+
+	ASSERT3U(lb->lb_nents, >, 0);
+
+	/* link to the log block before this one */
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev_lbp = *lbp;
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_zero(abd, asize);
+	abd_copy_from_buf(abd, lb, sizeof (*lb));
+	l2arc_free_abd_on_write(abd, asize, ARC_BUFC_METADATA);
+
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_size = asize;
+	fletcher_4_native(lb, sizeof (*lb), NULL, &lbp->lbp_cksum);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev,
+	    dev->l2ad_hand, asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+
+	dev->l2ad_hand += asize;
+	lb->lb_nents = 0;
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+
+	return (asize);
+}
+
+/*
+ * Record a buffer that is being written to the device in the log block
+ * being filled.  Returns B_TRUE once the log block is full.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, arc_buf_hdr_t *hdr)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT(HDR_HAS_L2HDR(hdr));
+	ASSERT3U(lb->lb_nents, <, L2ARC_LOG_BLK_ENTRIES);
+
+	le = &lb->lb_entries[lb->lb_nents++];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	LE_SET_LSIZE(le, hdr->b_lsize);
+	LE_SET_PSIZE(le, hdr->b_psize);
+	LE_SET_COMPRESS(le, HDR_GET_COMPRESS(hdr));
+	LE_SET_TYPE(le, arc_buf_type(hdr));
+	LE_SET_L2COMPRESS(le, HDR_GET_L2COMPRESS(hdr));
+
+	return (lb->lb_nents == L2ARC_LOG_BLK_ENTRIES);
+}
+
 /*
  * Find and write ARC buffers to the L2ARC device.
  *
@@ -7166,17 +8341,22 @@ top:
  * state between calls to this function.
  *
  * Returns the number of bytes actually written (which may be smaller than
- * the delta by which the device hand has changed due to alignment).
+ * the delta by which the device hand has changed due to alignment).  This
+ * does not include the log blocks written along the buffers, which may
+ * take up to l2arc_log_blk_overhead(target_sz) more.
  */
 static uint64_t
 l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 {
 	arc_buf_hdr_t *hdr, *hdr_prev, *head;
 	uint64_t write_asize, write_psize, write_sz, headroom;
-	boolean_t full;
+	uint64_t distance = target_sz + l2arc_log_blk_overhead(target_sz);
+	boolean_t full, lb_full;
 	l2arc_write_callback_t *cb;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_load_guid(spa);
+	hrtime_t begin;
+	int err;
 
 	ASSERT3P(dev->l2ad_vdev, !=, NULL);
 
@@ -7280,12 +8460,10 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			ASSERT(HDR_HAS_L1HDR(hdr));
 
 			ASSERT3U(HDR_GET_PSIZE(hdr), >, 0);
-			ASSERT3P(hdr->b_l1hdr.b_pdata, !=, NULL);
+			ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 			ASSERT3U(arc_hdr_size(hdr), >, 0);
 			uint64_t size = arc_hdr_size(hdr);
 
-			(void) refcount_add_many(&dev->l2ad_alloc, size, hdr);
-
 			/*
 			 * Normally the L2ARC can use the hdr's data, but if
 			 * we're sharing data between the hdr and one of its
@@ -7293,23 +8471,30 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			 * the ZIO below can't race with the buf consumer. To
 			 * ensure that this copy will be available for the
 			 * lifetime of the ZIO and be cleaned up afterwards, we
-			 * add it to the l2arc_free_on_write queue.
+			 * add it to the l2arc_free_on_write queue.  A copy
+			 * compressed by l2arc_compress_buf() is handled the
+			 * same way.
 			 */
-			void *to_write;
-			if (!HDR_SHARED_DATA(hdr)) {
-				to_write = hdr->b_l1hdr.b_pdata;
+			abd_t *to_write = NULL;
+			if (l2arc_compress &&
+			    HDR_GET_COMPRESS(hdr) == ZIO_COMPRESS_OFF &&
+			    (to_write = l2arc_compress_buf(hdr)) != NULL) {
+				size = l2arc_hdr_size(hdr);
+				l2arc_free_abd_on_write(to_write, size,
+				    arc_buf_type(hdr));
+			} else if (!HDR_SHARED_DATA(hdr)) {
+				to_write = hdr->b_l1hdr.b_pabd;
 			} else {
 				arc_buf_contents_t type = arc_buf_type(hdr);
-				if (type == ARC_BUFC_METADATA) {
-					to_write = zio_buf_alloc(size);
-				} else {
-					ASSERT3U(type, ==, ARC_BUFC_DATA);
-					to_write = zio_data_buf_alloc(size);
-				}
 
-				bcopy(hdr->b_l1hdr.b_pdata, to_write, size);
-				l2arc_free_data_on_write(to_write, size, type);
+				to_write = abd_alloc_for_io(size,
+				    type == ARC_BUFC_METADATA);
+				abd_copy(to_write, hdr->b_l1hdr.b_pabd, size);
+				l2arc_free_abd_on_write(to_write, size, type);
 			}
+
+			(void) refcount_add_many(&dev->l2ad_alloc, size, hdr);
+
 			wzio = zio_write_phys(pio, dev->l2ad_vdev,
 			    hdr->b_l2hdr.b_daddr, size, to_write,
 			    ZIO_CHECKSUM_OFF, NULL, hdr,
@@ -7329,9 +8514,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			write_psize += asize;
 			dev->l2ad_hand += asize;
 
+			lb_full = l2arc_log_blk_insert(dev, hdr);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			if (lb_full)
+				(void) l2arc_log_blk_commit(dev, pio);
 		}
 
 		multilist_sublist_unlock(mls);
@@ -7359,40 +8549,115 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	 * Bump device hand to the device start if it is approaching the end.
 	 * l2arc_evict() will already have evicted ahead for this case.
 	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
+	if (dev->l2ad_hand >= (dev->l2ad_end - distance)) {
 		dev->l2ad_hand = dev->l2ad_start;
 		dev->l2ad_first = B_FALSE;
 	}
 
 	dev->l2ad_writing = B_TRUE;
-	(void) zio_wait(pio);
+	begin = gethrtime();
+	err = zio_wait(pio);
+	dev->l2ad_write_time = gethrtime() - begin;
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Point the device header at the log blocks just written, unless
+	 * they may not have made it to the device.
+	 */
+	if (err == 0)
+		l2arc_dev_hdr_update(dev, distance);
+
 	return (write_asize);
 }
 
 /*
- * This thread feeds the L2ARC at regular intervals.  This is the beating
- * heart of the L2ARC.
+ * Hold the config lock of the device's spa without keeping the device
+ * from being removed, see l2arc_rebuild_enter().  Returns B_FALSE once
+ * the feed thread is asked to stop.
+ */
+static boolean_t
+l2arc_feed_enter(l2arc_dev_t *dev)
+{
+	while (!dev->l2ad_feed_exit) {
+		if (spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+		    RW_READER))
+			return (B_TRUE);
+		delay(1);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Feed a device once, with its spa's config lock held.  Returns when to
+ * feed it next.
+ */
+static clock_t
+l2arc_feed_dev(l2arc_dev_t *dev)
+{
+	spa_t *spa = dev->l2ad_spa;
+	uint64_t size, wrote;
+	clock_t begin = ddi_get_lbolt();
+
+	ASSERT3P(spa, !=, NULL);
+
+	if (vdev_is_dead(dev->l2ad_vdev))
+		return (begin + hz);
+
+	/*
+	 * If the pool is read-only then force the feed thread to
+	 * sleep a little longer.
+	 */
+	if (!spa_writeable(spa))
+		return (begin + 5 * l2arc_feed_secs * hz);
+
+	/*
+	 * Avoid contributing to memory pressure.
+	 */
+	if (arc_reclaim_needed()) {
+		ARCSTAT_BUMP(arcstat_l2_abort_lowmem);
+		return (begin + hz);
+	}
+
+	ARCSTAT_BUMP(arcstat_l2_feeds);
+
+	size = l2arc_write_size(dev);
+
+	/*
+	 * Evict L2ARC buffers that will be overwritten, by the
+	 * buffers or the log blocks that describe them.
+	 */
+	l2arc_evict(dev, size + l2arc_log_blk_overhead(size), B_FALSE);
+
+	/*
+	 * Write ARC buffers.
+	 */
+	dev->l2ad_write_time = 0;
+	wrote = l2arc_write_buffers(spa, dev, size);
+	dev->l2ad_write_size = size;
+
+	/*
+	 * Calculate interval between writes.
+	 */
+	return (l2arc_write_interval(begin, size, wrote));
+}
+
+/*
+ * This thread feeds a cache device at regular intervals.  This is the
+ * beating heart of the L2ARC.  Every device has one, started by
+ * l2arc_add_vdev() and stopped by l2arc_feed_stop().
  */
 static void
-#ifdef __APPLE__
-l2arc_feed_thread(void *notused)
-#else
-l2arc_feed_thread(void)
-#endif
+l2arc_feed_thread(void *arg)
 {
+	l2arc_dev_t *dev = arg;
 	callb_cpr_t cpr;
-	l2arc_dev_t *dev;
-	spa_t *spa;
-	uint64_t size, wrote;
-	clock_t begin, next = ddi_get_lbolt();
+	clock_t next = ddi_get_lbolt();
 
 	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
 
 	mutex_enter(&l2arc_feed_thr_lock);
 
-	while (l2arc_thread_exit == 0) {
+	while (!dev->l2ad_feed_exit) {
 		CALLB_CPR_SAFE_BEGIN(&cpr);
 		(void) cv_timedwait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock,
 		    next);
@@ -7400,75 +8665,385 @@ l2arc_feed_thread(void)
 		next = ddi_get_lbolt() + hz;
 
 		/*
-		 * Quick check for L2ARC devices.
+		 * The device is not fed until its rebuild completes.
 		 */
-		mutex_enter(&l2arc_dev_mtx);
-		if (l2arc_ndev == 0) {
-			mutex_exit(&l2arc_dev_mtx);
+		if (dev->l2ad_feed_exit || dev->l2ad_rebuild)
 			continue;
+		mutex_exit(&l2arc_feed_thr_lock);
+
+		if (l2arc_feed_enter(dev)) {
+			next = l2arc_feed_dev(dev);
+			spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
 		}
-		mutex_exit(&l2arc_dev_mtx);
-		begin = ddi_get_lbolt();
 
-		/*
-		 * This selects the next l2arc device to write to, and in
-		 * doing so the next spa to feed from: dev->l2ad_spa.   This
-		 * will return NULL if there are now no l2arc devices or if
-		 * they are all faulted.
-		 *
-		 * If a device is returned, its spa's config lock is also
-		 * held to prevent device removal.  l2arc_dev_get_next()
-		 * will grab and release l2arc_dev_mtx.
-		 */
-		if ((dev = l2arc_dev_get_next()) == NULL)
-			continue;
+		mutex_enter(&l2arc_feed_thr_lock);
+	}
 
-		spa = dev->l2ad_spa;
-		ASSERT3P(spa, !=, NULL);
+	dev->l2ad_feeding = B_FALSE;
+	cv_broadcast(&l2arc_feed_thr_cv);
+	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
+	thread_exit();
+}
 
-		/*
-		 * If the pool is read-only then force the feed thread to
-		 * sleep a little longer.
-		 */
-		if (!spa_writeable(spa)) {
-			next = ddi_get_lbolt() + 5 * l2arc_feed_secs * hz;
-			spa_config_exit(spa, SCL_L2ARC, dev);
-			continue;
+static void
+l2arc_feed_start(l2arc_dev_t *dev)
+{
+	ASSERT(MUTEX_HELD(&l2arc_feed_thr_lock));
+
+	if (dev->l2ad_feeding)
+		return;
+
+	dev->l2ad_feeding = B_TRUE;
+	dev->l2ad_feed_exit = B_FALSE;
+	(void) thread_create(NULL, 0, l2arc_feed_thread, dev, 0, &p0,
+	    TS_RUN, minclsyspri);
+}
+
+/*
+ * Stop the feed thread of a device, and wait for it to exit.
+ */
+static void
+l2arc_feed_stop(l2arc_dev_t *dev)
+{
+	ASSERT(MUTEX_HELD(&l2arc_feed_thr_lock));
+
+	dev->l2ad_feed_exit = B_TRUE;
+	cv_broadcast(&l2arc_feed_thr_cv);
+	while (dev->l2ad_feeding)
+		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
+}
+
+/*
+ * How far behind the write hand recorded in the device header an address
+ * is, i.e. how long ago it was written, in bytes of the device.
+ */
+static uint64_t
+l2arc_hand_dist(l2arc_dev_t *dev, uint64_t daddr)
+{
+	l2arc_dev_hdr_phys_t *dh = &dev->l2ad_dev_hdr;
+
+	if (daddr < dh->dh_hand)
+		return (dh->dh_hand - daddr);
+	return ((dh->dh_hand - dh->dh_start) + (dh->dh_end - daddr));
+}
+
+/*
+ * Whether [daddr, daddr + asize) lies on the device, and outside the
+ * range that may have been overwritten since the device header was.
+ */
+static boolean_t
+l2arc_range_valid(l2arc_dev_t *dev, uint64_t daddr, uint64_t asize)
+{
+	l2arc_dev_hdr_phys_t *dh = &dev->l2ad_dev_hdr;
+
+	if (asize == 0 || daddr < dh->dh_start || daddr + asize > dh->dh_end)
+		return (B_FALSE);
+	if (daddr < dh->dh_evict && daddr + asize > dh->dh_hand)
+		return (B_FALSE);
+	return (B_TRUE);
+}
+
+/*
+ * Whether the buffer a log entry describes can still be on the device:
+ * buffers are written before the log block recording them, so one no
+ * further behind the hand than its log block has been overwritten.
+ */
+static boolean_t
+l2arc_log_ent_valid(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le,
+    uint64_t lb_dist)
+{
+	uint64_t size;
+
+	if (LE_GET_TYPE(le) >= ARC_BUFC_NUMTYPES ||
+	    LE_GET_COMPRESS(le) >= ZIO_COMPRESS_FUNCTIONS)
+		return (B_FALSE);
+	if (LE_GET_COMPRESS(le) != ZIO_COMPRESS_OFF) {
+		/* b_pabd is never kept compressed in this case */
+		if (!zfs_compressed_arc_enabled)
+			return (B_FALSE);
+		/* only uncompressed buffers are compressed for the L2ARC */
+		if (LE_GET_L2COMPRESS(le) != 0)
+			return (B_FALSE);
+		size = LE_GET_PSIZE(le) << SPA_MINBLOCKSHIFT;
+	} else {
+		size = LE_GET_LSIZE(le) << SPA_MINBLOCKSHIFT;
+		if (LE_GET_L2COMPRESS(le) != 0) {
+			size = P2ROUNDUP(howmany(size *
+			    LE_GET_L2COMPRESS(le), 16), SPA_MINBLOCKSIZE);
 		}
+	}
 
-		/*
-		 * Avoid contributing to memory pressure.
-		 */
+	return (l2arc_range_valid(dev, le->le_daddr,
+	    vdev_psize_to_asize(dev->l2ad_vdev, size)) &&
+	    l2arc_hand_dist(dev, le->le_daddr) > lb_dist);
+}
+
+/*
+ * Read and verify the device header.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh = &dev->l2ad_dev_hdr;
+	uint64_t asize = dev->l2ad_dev_hdr_asize;
+	zio_cksum_t cksum;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_linear(asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	if (err == 0)
+		abd_copy_to_buf(dh, abd, sizeof (*dh));
+	abd_free(abd);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		return (err);
+	}
+
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_self_cksum),
+	    NULL, &cksum);
+
+	/*
+	 * A header written by another pool, or by this pool on a previous
+	 * incarnation of the device, or for a different device size, is
+	 * of no use.
+	 */
+	if (dh->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    dh->dh_version != L2ARC_PERSIST_VERSION ||
+	    !ZIO_CHECKSUM_EQUAL(cksum, dh->dh_self_cksum) ||
+	    dh->dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    dh->dh_vdev_guid != dev->l2ad_vdev->vdev_guid ||
+	    dh->dh_start != dev->l2ad_start || dh->dh_end != dev->l2ad_end ||
+	    dh->dh_hand < dh->dh_start || dh->dh_hand > dh->dh_end ||
+	    dh->dh_evict < dh->dh_hand || dh->dh_evict > dh->dh_end) {
+		bzero(dh, sizeof (*dh));
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	return (0);
+}
+
+/*
+ * Read the log block lbp points to into lb and verify it.
+ */
+static int
+l2arc_log_blk_read(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    l2arc_log_blk_phys_t *lb)
+{
+	zio_cksum_t cksum;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_for_io(lbp->lbp_size, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, lbp->lbp_daddr,
+	    lbp->lbp_size, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	if (err == 0)
+		abd_copy_to_buf(lb, abd, sizeof (*lb));
+	abd_free(abd);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		return (err);
+	}
+
+	/*
+	 * A mismatch is the normal end of the chain, once the oldest log
+	 * blocks have been overwritten.
+	 */
+	fletcher_4_native(lb, sizeof (*lb), NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum) ||
+	    lb->lb_magic != L2ARC_LOG_BLK_MAGIC ||
+	    lb->lb_nents > L2ARC_LOG_BLK_ENTRIES) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	return (0);
+}
+
+/*
+ * Recreate the L2-only header of a buffer recorded in a log block.  The
+ * log is walked from the newest buffer to the oldest, so the header goes
+ * to the tail of the buflist, where l2arc_evict() expects older buffers.
+ */
+static void
+l2arc_hdr_restore(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	arc_buf_contents_t type = LE_GET_TYPE(le);
+	enum zio_compress compress = LE_GET_COMPRESS(le);
+	kmutex_t *hash_lock;
+	uint64_t asize;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	ASSERT(HDR_EMPTY(hdr));
+	hdr->b_lsize = LE_GET_LSIZE(le);
+	hdr->b_psize = LE_GET_PSIZE(le);
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_flags = 0;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L2HDR);
+
+	/* the data on the device is as it was in b_pabd */
+	if (compress != ZIO_COMPRESS_OFF)
+		arc_hdr_set_flags(hdr, ARC_FLAG_COMPRESSED_ARC);
+	HDR_SET_COMPRESS(hdr, compress);
+	HDR_SET_L2COMPRESS(hdr, LE_GET_L2COMPRESS(le));
+
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* already cached, e.g. read by the pool in the meantime */
+		mutex_exit(hash_lock);
+		buf_discard_identity(hdr);
+		kmem_cache_free(hdr_l2only_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	asize = l2arc_hdr_size(hdr);
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) refcount_add_many(&dev->l2ad_alloc, asize, hdr);
+	mutex_exit(&dev->l2ad_mtx);
+	mutex_exit(hash_lock);
+
+	ARCSTAT_INCR(arcstat_l2_size, HDR_GET_LSIZE(hdr));
+	ARCSTAT_INCR(arcstat_l2_asize, asize);
+	if (HDR_GET_L2COMPRESS(hdr) != 0) {
+		ARCSTAT_INCR(arcstat_l2_compress_saved,
+		    HDR_GET_LSIZE(hdr) - asize);
+	}
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+}
+
+/*
+ * Hold the config lock like the feed thread does, without keeping the
+ * device from being removed: l2arc_remove_vdev() is called with the lock
+ * held as writer, and waits for the rebuild to notice the cancellation.
+ */
+static boolean_t
+l2arc_rebuild_enter(l2arc_dev_t *dev)
+{
+	while (!dev->l2ad_rebuild_cancel) {
+		if (spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+		    RW_READER))
+			return (B_TRUE);
+		delay(1);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Restore the buffers of a device from its log blocks.  Walking from the
+ * newest log block, every one must be further behind the write hand than
+ * the one before it; one that is not has been overwritten since it was
+ * written, and so have the ones before it.  Likewise the buffers of a
+ * log block must be behind it.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh = &dev->l2ad_dev_hdr;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp;
+	uint64_t lb_dist, prev_dist = 0;
+	int err;
+
+	if (!l2arc_rebuild_enter(dev))
+		return (SET_ERROR(ECANCELED));
+	err = l2arc_dev_hdr_read(dev);
+	if (err != 0) {
+		spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+		return (err);
+	}
+
+	/* new writes carry on where the last ones left off */
+	dev->l2ad_hand = dh->dh_hand;
+	dev->l2ad_first = !(dh->dh_flags & L2ARC_DEV_HDR_WRAPPED);
+	spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+
+	lb = kmem_alloc(sizeof (*lb), KM_SLEEP);
+	lbp = dh->dh_start_lbp;
+
+	while (lbp.lbp_size == vdev_psize_to_asize(dev->l2ad_vdev,
+	    L2ARC_LOG_BLK_SIZE) &&
+	    l2arc_range_valid(dev, lbp.lbp_daddr, lbp.lbp_size)) {
+		lb_dist = l2arc_hand_dist(dev, lbp.lbp_daddr);
+		if (lb_dist <= prev_dist)
+			break;
+		prev_dist = lb_dist;
+
+		/* the headers restored so far take memory too */
 		if (arc_reclaim_needed()) {
-			ARCSTAT_BUMP(arcstat_l2_abort_lowmem);
-			spa_config_exit(spa, SCL_L2ARC, dev);
-			continue;
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			err = SET_ERROR(ENOMEM);
+			break;
 		}
 
-		ARCSTAT_BUMP(arcstat_l2_feeds);
-
-		size = l2arc_write_size();
+		if (!l2arc_rebuild_enter(dev)) {
+			err = SET_ERROR(ECANCELED);
+			break;
+		}
+		if (vdev_is_dead(dev->l2ad_vdev)) {
+			spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+			err = SET_ERROR(ENXIO);
+			break;
+		}
 
-		/*
-		 * Evict L2ARC buffers that will be overwritten.
-		 */
-		l2arc_evict(dev, size, B_FALSE);
+		err = l2arc_log_blk_read(dev, &lbp, lb);
+		if (err == 0) {
+			for (int i = lb->lb_nents - 1; i >= 0; i--) {
+				l2arc_log_ent_phys_t *le = &lb->lb_entries[i];
 
-		/*
-		 * Write ARC buffers.
-		 */
-		wrote = l2arc_write_buffers(spa, dev, size);
+				if (l2arc_log_ent_valid(dev, le, lb_dist))
+					l2arc_hdr_restore(dev, le);
+			}
+		}
+		spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+		if (err != 0)
+			break;
 
-		/*
-		 * Calculate interval between writes.
-		 */
-		next = l2arc_write_interval(begin, size, wrote);
-		spa_config_exit(spa, SCL_L2ARC, dev);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+		lbp = lb->lb_prev_lbp;
 	}
 
-	l2arc_thread_exit = 0;
-	cv_broadcast(&l2arc_feed_thr_cv);
-	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
+	kmem_free(lb, sizeof (*lb));
+
+	/* the end of the chain is not an error */
+	if (err == ECKSUM)
+		err = 0;
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+
+	return (err);
+}
+
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+
+	ASSERT(dev->l2ad_rebuild);
+
+	(void) l2arc_rebuild(dev);
+
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	thread_exit();
 }
 
@@ -7505,11 +9080,15 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* the device header sits between the front labels and the data */
+	adddev->l2ad_dev_hdr_asize = vdev_psize_to_asize(vd,
+	    L2ARC_DEV_HDR_SIZE);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE + adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_rebuild = l2arc_rebuild_enabled;
 
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
 	/*
@@ -7521,6 +9100,8 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 
 	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
 	refcount_create(&adddev->l2ad_alloc);
+	/* the evictions before the device was added aren't its concern */
+	adddev->l2ad_evict_l2_last = ARCSTAT(arcstat_evict_l2_eligible);
 
 	/*
 	 * Add device to global list
@@ -7529,6 +9110,20 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * Restore what the device held when the pool was last exported,
+	 * without holding up the import.  The device is not fed meanwhile.
+	 */
+	if (adddev->l2ad_rebuild) {
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+		    adddev, 0, &p0, TS_RUN, minclsyspri);
+	}
+
+	mutex_enter(&l2arc_feed_thr_lock);
+	if (l2arc_feed_enabled)
+		l2arc_feed_start(adddev);
+	mutex_exit(&l2arc_feed_thr_lock);
 }
 
 /*
@@ -7556,10 +9151,22 @@ l2arc_remove_vdev(vdev_t *vd)
 	 * Remove device from global list
 	 */
 	list_remove(l2arc_dev_list, remdev);
-	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	mutex_enter(&l2arc_feed_thr_lock);
+	l2arc_feed_stop(remdev);
+	mutex_exit(&l2arc_feed_thr_lock);
+
+	/*
+	 * Stop a rebuild still in progress before dropping its buffers.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
@@ -7573,13 +9180,15 @@ l2arc_remove_vdev(vdev_t *vd)
 void
 l2arc_init(void)
 {
-	l2arc_thread_exit = 0;
+	l2arc_feed_enabled = B_FALSE;
 	l2arc_ndev = 0;
 	l2arc_writes_sent = 0;
 	l2arc_writes_done = 0;
 
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -7604,6 +9213,8 @@ l2arc_fini(void)
 
 	mutex_destroy(&l2arc_feed_thr_lock);
 	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -7611,26 +9222,42 @@ l2arc_fini(void)
 	list_destroy(l2arc_free_on_write);
 }
 
+/*
+ * Let the cache devices be fed, each by a thread of its own; devices
+ * added before this are fed from now on.
+ */
 void
 l2arc_start(void)
 {
+	l2arc_dev_t *dev;
+
 	if (!(spa_mode_global & FWRITE))
 		return;
 
-	(void) thread_create(NULL, 0, l2arc_feed_thread, NULL, 0, &p0,
-	    TS_RUN, minclsyspri);
+	mutex_enter(&l2arc_dev_mtx);
+	mutex_enter(&l2arc_feed_thr_lock);
+	l2arc_feed_enabled = B_TRUE;
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev))
+		l2arc_feed_start(dev);
+	mutex_exit(&l2arc_feed_thr_lock);
+	mutex_exit(&l2arc_dev_mtx);
 }
 
 void
 l2arc_stop(void)
 {
+	l2arc_dev_t *dev;
+
 	if (!(spa_mode_global & FWRITE))
 		return;
 
+	mutex_enter(&l2arc_dev_mtx);
 	mutex_enter(&l2arc_feed_thr_lock);
-	cv_signal(&l2arc_feed_thr_cv);	/* kick thread out of startup */
-	l2arc_thread_exit = 1;
-	while (l2arc_thread_exit != 0)
-		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
+	l2arc_feed_enabled = B_FALSE;
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev))
+		l2arc_feed_stop(dev);
 	mutex_exit(&l2arc_feed_thr_lock);
+	mutex_exit(&l2arc_dev_mtx);
 }
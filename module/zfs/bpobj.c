@@ -454,6 +454,29 @@ bpobj_enqueue_subobj(bpobj_t *bpo, uint64_t subobj, dmu_tx_t *tx)
 	bpobj_close(&subbpo);
 }
 
+/*
+ * Start reading what bpobj_enqueue_subobj() will need of subbpo beyond
+ * its (held) bonus buffer: the dnode of its own list of subobjs, which
+ * it looks up to decide whether to copy that list into the new parent.
+ */
+void
+bpobj_prefetch_subobj(bpobj_t *subbpo)
+{
+	uint64_t subsubobjs;
+
+	if (!subbpo->bpo_havesubobj)
+		return;
+
+	mutex_enter(&subbpo->bpo_lock);
+	subsubobjs = subbpo->bpo_phys->bpo_subobjs;
+	mutex_exit(&subbpo->bpo_lock);
+
+	if (subsubobjs != 0) {
+		dmu_prefetch(subbpo->bpo_os, subsubobjs, 0, 0, 0,
+		    ZIO_PRIORITY_SYNC_READ);
+	}
+}
+
 void
 bpobj_enqueue(bpobj_t *bpo, const blkptr_t *bp, dmu_tx_t *tx)
 {
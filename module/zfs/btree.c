@@ -0,0 +1,690 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/btree.h>
+
+/*
+ * A classic B-tree: every element is stored exactly once, in either a
+ * leaf or a core node, and a core node with n elements has n + 1
+ * children.  All leaves are at the same depth.  Nodes other than the
+ * root are kept at least half full; an insertion into a full node splits
+ * it around its median, which moves up into the parent, and a removal
+ * that leaves a node under-full either borrows an element from a sibling
+ * (through the parent) or merges with it.
+ */
+
+static kmem_cache_t *zfs_btree_leaf_cache;
+
+#define	BT_CORE_SIZE(tree)	(offsetof(zfs_btree_core_t, btc_elems) + \
+	BTREE_CORE_ELEMS * (tree)->bt_elem_size)
+#define	BT_CORE(hdr)		((zfs_btree_core_t *)(hdr))
+#define	BT_ELEM(tree, hdr, i)	\
+	(bt_elems(hdr) + (size_t)(i) * (tree)->bt_elem_size)
+
+void
+zfs_btree_init(void)
+{
+	ASSERT(zfs_btree_leaf_cache == NULL);
+	zfs_btree_leaf_cache = kmem_cache_create("zfs_btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zfs_btree_fini(void)
+{
+	kmem_cache_destroy(zfs_btree_leaf_cache);
+	zfs_btree_leaf_cache = NULL;
+}
+
+static inline uint8_t *
+bt_elems(zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core)
+		return (BT_CORE(hdr)->btc_elems);
+	return (((zfs_btree_leaf_t *)hdr)->btl_elems);
+}
+
+static inline uint32_t
+bt_capacity(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	return (hdr->bth_core ? BTREE_CORE_ELEMS : tree->bt_leaf_cap);
+}
+
+static zfs_btree_hdr_t *
+bt_node_alloc(zfs_btree_t *tree, boolean_t core)
+{
+	zfs_btree_hdr_t *hdr;
+
+	if (core)
+		hdr = kmem_alloc(BT_CORE_SIZE(tree), KM_SLEEP);
+	else
+		hdr = kmem_cache_alloc(zfs_btree_leaf_cache, KM_SLEEP);
+
+	hdr->bth_parent = NULL;
+	hdr->bth_core = core;
+	hdr->bth_count = 0;
+	tree->bt_num_nodes++;
+
+	return (hdr);
+}
+
+static void
+bt_node_free(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	ASSERT3U(tree->bt_num_nodes, >, 0);
+	tree->bt_num_nodes--;
+
+	if (hdr->bth_core)
+		kmem_free(hdr, BT_CORE_SIZE(tree));
+	else
+		kmem_cache_free(zfs_btree_leaf_cache, hdr);
+}
+
+void
+zfs_btree_create(zfs_btree_t *tree, int (*compar)(const void *, const void *),
+    size_t size)
+{
+	ASSERT3U(size, >, 0);
+	ASSERT3U(size, <=, BTREE_ELEM_MAX);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = (BTREE_LEAF_SIZE -
+	    offsetof(zfs_btree_leaf_t, btl_elems)) / size;
+	tree->bt_height = -1;
+
+	ASSERT3U(tree->bt_leaf_cap, >=, 4);
+}
+
+void
+zfs_btree_destroy(zfs_btree_t *tree)
+{
+	ASSERT0(tree->bt_num_elems);
+	ASSERT3P(tree->bt_root, ==, NULL);
+	ASSERT0(tree->bt_num_nodes);
+}
+
+ulong_t
+zfs_btree_numnodes(zfs_btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+static void *
+bt_index_set(zfs_btree_t *tree, zfs_btree_index_t *idx,
+    zfs_btree_hdr_t *hdr, uint32_t off)
+{
+	if (idx != NULL) {
+		idx->bti_node = hdr;
+		idx->bti_offset = off;
+		idx->bti_before = B_FALSE;
+	}
+	return (BT_ELEM(tree, hdr, off));
+}
+
+/*
+ * Return the offset of the first element of the node that is not less
+ * than "value", and whether it compares equal.
+ */
+static uint32_t
+bt_node_search(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, const void *value,
+    boolean_t *found)
+{
+	uint32_t lo = 0, hi = hdr->bth_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (tree->bt_compar(BT_ELEM(tree, hdr, mid), value) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = (lo < hdr->bth_count &&
+	    tree->bt_compar(BT_ELEM(tree, hdr, lo), value) == 0);
+	return (lo);
+}
+
+void *
+zfs_btree_find(zfs_btree_t *tree, const void *value, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+	zfs_btree_index_t idx;
+
+	if (where == NULL)
+		where = &idx;
+
+	where->bti_node = NULL;
+	where->bti_offset = 0;
+	where->bti_before = B_TRUE;
+
+	while (hdr != NULL) {
+		boolean_t found;
+		uint32_t off = bt_node_search(tree, hdr, value, &found);
+
+		if (found)
+			return (bt_index_set(tree, where, hdr, off));
+
+		if (!hdr->bth_core) {
+			where->bti_node = hdr;
+			where->bti_offset = off;
+			return (NULL);
+		}
+		hdr = BT_CORE(hdr)->btc_children[off];
+	}
+
+	return (NULL);
+}
+
+void *
+zfs_btree_get(zfs_btree_t *tree, const zfs_btree_index_t *idx)
+{
+	ASSERT(!idx->bti_before);
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (BT_ELEM(tree, idx->bti_node, idx->bti_offset));
+}
+
+static uint32_t
+bt_child_index(zfs_btree_core_t *parent, zfs_btree_hdr_t *child)
+{
+	uint32_t i;
+
+	for (i = 0; i <= parent->btc_hdr.bth_count; i++) {
+		if (parent->btc_children[i] == child)
+			return (i);
+	}
+	panic("btree node %p is not a child of %p", (void *)child,
+	    (void *)parent);
+	return (0);
+}
+
+/*
+ * Insert "value" at offset "off" of a node that has room for it.
+ */
+static void
+bt_insert_at(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t off,
+    const void *value)
+{
+	size_t size = tree->bt_elem_size;
+
+	ASSERT3U(hdr->bth_count, <, bt_capacity(tree, hdr));
+	ASSERT3U(off, <=, hdr->bth_count);
+
+	(void) memmove(BT_ELEM(tree, hdr, off + 1), BT_ELEM(tree, hdr, off),
+	    (hdr->bth_count - off) * size);
+	bcopy(value, BT_ELEM(tree, hdr, off), size);
+	hdr->bth_count++;
+}
+
+/*
+ * Copy entries [from, to) of the sequence formed by inserting "value" at
+ * position "off" of the array "src" into "dst".  Used when splitting a
+ * full node, which never has room for the new entry itself.
+ */
+static void
+bt_virt_copy(size_t size, uint8_t *dst, const uint8_t *src, uint32_t off,
+    const void *value, uint32_t from, uint32_t to)
+{
+	uint32_t j;
+
+	for (j = from; j < to; j++, dst += size) {
+		if (j < off)
+			bcopy(src + j * size, dst, size);
+		else if (j == off)
+			bcopy(value, dst, size);
+		else
+			bcopy(src + (j - 1) * size, dst, size);
+	}
+}
+
+/*
+ * "right" was split off "left", with "median" separating them; link it
+ * into the parent, splitting the parent in turn if it is full.
+ */
+static void
+bt_insert_into_parent(zfs_btree_t *tree, zfs_btree_hdr_t *left,
+    const void *median, zfs_btree_hdr_t *right)
+{
+	zfs_btree_core_t *parent = left->bth_parent;
+	zfs_btree_core_t *new_core;
+	zfs_btree_hdr_t **children;
+	uint8_t buf[BTREE_ELEM_MAX];
+	size_t size = tree->bt_elem_size;
+	uint32_t cap = BTREE_CORE_ELEMS;
+	uint32_t off, m, i;
+
+	if (parent == NULL) {
+		ASSERT3P(left, ==, tree->bt_root);
+		parent = BT_CORE(bt_node_alloc(tree, B_TRUE));
+		bcopy(median, parent->btc_elems, size);
+		parent->btc_hdr.bth_count = 1;
+		parent->btc_children[0] = left;
+		parent->btc_children[1] = right;
+		left->bth_parent = parent;
+		right->bth_parent = parent;
+		tree->bt_root = &parent->btc_hdr;
+		tree->bt_height++;
+		return;
+	}
+
+	off = bt_child_index(parent, left);
+	children = parent->btc_children;
+
+	if (parent->btc_hdr.bth_count < cap) {
+		(void) memmove(&children[off + 2], &children[off + 1],
+		    (parent->btc_hdr.bth_count - off) * sizeof (*children));
+		children[off + 1] = right;
+		right->bth_parent = parent;
+		bt_insert_at(tree, &parent->btc_hdr, off, median);
+		return;
+	}
+
+	/*
+	 * Split the parent.  Of the cap + 1 elements, the first m stay,
+	 * element m moves up and the rest go to the new node, along with
+	 * the children to their left and right.
+	 */
+	m = (cap + 1) / 2;
+	new_core = BT_CORE(bt_node_alloc(tree, B_TRUE));
+	bt_virt_copy(size, new_core->btc_elems, parent->btc_elems, off,
+	    median, m + 1, cap + 1);
+	bt_virt_copy(sizeof (*children), (uint8_t *)new_core->btc_children,
+	    (uint8_t *)children, off + 1, &right, m + 1, cap + 2);
+	bt_virt_copy(size, buf, parent->btc_elems, off, median, m, m + 1);
+	new_core->btc_hdr.bth_count = cap - m;
+
+	if (off < m) {
+		(void) memmove(BT_ELEM(tree, &parent->btc_hdr, off + 1),
+		    BT_ELEM(tree, &parent->btc_hdr, off), (m - 1 - off) * size);
+		bcopy(median, BT_ELEM(tree, &parent->btc_hdr, off), size);
+		(void) memmove(&children[off + 2], &children[off + 1],
+		    (m - 1 - off) * sizeof (*children));
+		children[off + 1] = right;
+		right->bth_parent = parent;
+	}
+	parent->btc_hdr.bth_count = m;
+
+	for (i = 0; i <= new_core->btc_hdr.bth_count; i++)
+		new_core->btc_children[i]->bth_parent = new_core;
+
+	bt_insert_into_parent(tree, &parent->btc_hdr, buf, &new_core->btc_hdr);
+}
+
+/*
+ * Insert "value" at "where", which must come from a zfs_btree_find() for
+ * the same value that returned NULL, with no modification since.
+ */
+void
+zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *leaf = where->bti_node;
+	zfs_btree_hdr_t *new_leaf;
+	uint8_t buf[BTREE_ELEM_MAX];
+	size_t size = tree->bt_elem_size;
+	uint32_t cap = tree->bt_leaf_cap;
+	uint32_t off = where->bti_offset;
+	uint32_t m;
+
+	ASSERT(where->bti_before);
+	tree->bt_num_elems++;
+
+	if (leaf == NULL) {
+		ASSERT3P(tree->bt_root, ==, NULL);
+		leaf = bt_node_alloc(tree, B_FALSE);
+		tree->bt_root = leaf;
+		tree->bt_height = 0;
+		bt_insert_at(tree, leaf, 0, value);
+		return;
+	}
+
+	ASSERT(!leaf->bth_core);
+	if (leaf->bth_count < cap) {
+		bt_insert_at(tree, leaf, off, value);
+		return;
+	}
+
+	/* Split the leaf the same way bt_insert_into_parent() splits cores */
+	m = (cap + 1) / 2;
+	new_leaf = bt_node_alloc(tree, B_FALSE);
+	bt_virt_copy(size, bt_elems(new_leaf), bt_elems(leaf), off, value,
+	    m + 1, cap + 1);
+	bt_virt_copy(size, buf, bt_elems(leaf), off, value, m, m + 1);
+	new_leaf->bth_count = cap - m;
+
+	if (off < m) {
+		(void) memmove(BT_ELEM(tree, leaf, off + 1),
+		    BT_ELEM(tree, leaf, off), (m - 1 - off) * size);
+		bcopy(value, BT_ELEM(tree, leaf, off), size);
+	}
+	leaf->bth_count = m;
+
+	bt_insert_into_parent(tree, leaf, buf, new_leaf);
+}
+
+void
+zfs_btree_add(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), ==, NULL);
+	zfs_btree_add_idx(tree, value, &where);
+}
+
+/*
+ * Merge the children on either side of the parent's element "sep", and
+ * that element, into the left child.
+ */
+static void bt_rebalance(zfs_btree_t *tree, zfs_btree_hdr_t *hdr);
+
+static void
+bt_merge(zfs_btree_t *tree, zfs_btree_core_t *parent, uint32_t sep)
+{
+	zfs_btree_hdr_t *left = parent->btc_children[sep];
+	zfs_btree_hdr_t *right = parent->btc_children[sep + 1];
+	size_t size = tree->bt_elem_size;
+	uint32_t n = left->bth_count;
+	uint32_t pcount = parent->btc_hdr.bth_count;
+	uint32_t i;
+
+	ASSERT3U(n + 1 + right->bth_count, <=, bt_capacity(tree, left));
+
+	bcopy(BT_ELEM(tree, &parent->btc_hdr, sep), BT_ELEM(tree, left, n),
+	    size);
+	bcopy(BT_ELEM(tree, right, 0), BT_ELEM(tree, left, n + 1),
+	    right->bth_count * size);
+	if (left->bth_core) {
+		for (i = 0; i <= right->bth_count; i++) {
+			zfs_btree_hdr_t *child = BT_CORE(right)->btc_children[i];
+
+			BT_CORE(left)->btc_children[n + 1 + i] = child;
+			child->bth_parent = BT_CORE(left);
+		}
+	}
+	left->bth_count = n + 1 + right->bth_count;
+	bt_node_free(tree, right);
+
+	(void) memmove(BT_ELEM(tree, &parent->btc_hdr, sep),
+	    BT_ELEM(tree, &parent->btc_hdr, sep + 1), (pcount - sep - 1) * size);
+	(void) memmove(&parent->btc_children[sep + 1],
+	    &parent->btc_children[sep + 2],
+	    (pcount - sep - 1) * sizeof (zfs_btree_hdr_t *));
+	parent->btc_hdr.bth_count--;
+
+	bt_rebalance(tree, &parent->btc_hdr);
+}
+
+/*
+ * Restore the fill invariant of a node that an element was removed from.
+ */
+static void
+bt_rebalance(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	zfs_btree_core_t *parent = hdr->bth_parent;
+	zfs_btree_hdr_t *left, *right;
+	size_t size = tree->bt_elem_size;
+	uint32_t min, idx;
+
+	if (parent == NULL) {
+		if (hdr->bth_count > 0)
+			return;
+		if (hdr->bth_core) {
+			tree->bt_root = BT_CORE(hdr)->btc_children[0];
+			tree->bt_root->bth_parent = NULL;
+		} else {
+			tree->bt_root = NULL;
+		}
+		tree->bt_height--;
+		bt_node_free(tree, hdr);
+		return;
+	}
+
+	min = bt_capacity(tree, hdr) / 2;
+	if (hdr->bth_count >= min)
+		return;
+
+	idx = bt_child_index(parent, hdr);
+	left = (idx > 0) ? parent->btc_children[idx - 1] : NULL;
+	right = (idx < parent->btc_hdr.bth_count) ?
+	    parent->btc_children[idx + 1] : NULL;
+
+	if (left != NULL && left->bth_count > min) {
+		/* Rotate the left sibling's last element through the parent */
+		bt_insert_at(tree, hdr, 0,
+		    BT_ELEM(tree, &parent->btc_hdr, idx - 1));
+		bcopy(BT_ELEM(tree, left, left->bth_count - 1),
+		    BT_ELEM(tree, &parent->btc_hdr, idx - 1), size);
+		if (hdr->bth_core) {
+			zfs_btree_hdr_t **children = BT_CORE(hdr)->btc_children;
+
+			(void) memmove(&children[1], &children[0],
+			    hdr->bth_count * sizeof (*children));
+			children[0] =
+			    BT_CORE(left)->btc_children[left->bth_count];
+			children[0]->bth_parent = BT_CORE(hdr);
+		}
+		left->bth_count--;
+		return;
+	}
+
+	if (right != NULL && right->bth_count > min) {
+		/* Rotate the right sibling's first element through the parent */
+		uint32_t n = hdr->bth_count;
+
+		bt_insert_at(tree, hdr, n, BT_ELEM(tree, &parent->btc_hdr, idx));
+		bcopy(BT_ELEM(tree, right, 0),
+		    BT_ELEM(tree, &parent->btc_hdr, idx), size);
+		if (hdr->bth_core) {
+			zfs_btree_hdr_t **children = BT_CORE(right)->btc_children;
+
+			BT_CORE(hdr)->btc_children[n + 1] = children[0];
+			children[0]->bth_parent = BT_CORE(hdr);
+			(void) memmove(&children[0], &children[1],
+			    right->bth_count * sizeof (*children));
+		}
+		(void) memmove(BT_ELEM(tree, right, 0), BT_ELEM(tree, right, 1),
+		    (right->bth_count - 1) * size);
+		right->bth_count--;
+		return;
+	}
+
+	if (left != NULL)
+		bt_merge(tree, parent, idx - 1);
+	else
+		bt_merge(tree, parent, idx);
+}
+
+void
+zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t off = where->bti_offset;
+	size_t size = tree->bt_elem_size;
+
+	ASSERT(!where->bti_before);
+	ASSERT3U(off, <, hdr->bth_count);
+
+	if (hdr->bth_core) {
+		/*
+		 * Replace the element with its predecessor, which is the
+		 * last element of the rightmost leaf of the subtree to its
+		 * left, and remove that instead.
+		 */
+		zfs_btree_hdr_t *leaf = BT_CORE(hdr)->btc_children[off];
+
+		while (leaf->bth_core)
+			leaf = BT_CORE(leaf)->btc_children[leaf->bth_count];
+
+		bcopy(BT_ELEM(tree, leaf, leaf->bth_count - 1),
+		    BT_ELEM(tree, hdr, off), size);
+		hdr = leaf;
+		off = leaf->bth_count - 1;
+	}
+
+	(void) memmove(BT_ELEM(tree, hdr, off), BT_ELEM(tree, hdr, off + 1),
+	    (hdr->bth_count - off - 1) * size);
+	hdr->bth_count--;
+	tree->bt_num_elems--;
+
+	bt_rebalance(tree, hdr);
+}
+
+void
+zfs_btree_remove(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), !=, NULL);
+	zfs_btree_remove_idx(tree, &where);
+}
+
+void *
+zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	while (hdr->bth_core)
+		hdr = BT_CORE(hdr)->btc_children[0];
+
+	return (bt_index_set(tree, where, hdr, 0));
+}
+
+void *
+zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	while (hdr->bth_core)
+		hdr = BT_CORE(hdr)->btc_children[hdr->bth_count];
+
+	return (bt_index_set(tree, where, hdr, hdr->bth_count - 1));
+}
+
+void *
+zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		/* The next element is the first of the subtree to the right */
+		ASSERT(!idx->bti_before);
+		hdr = BT_CORE(hdr)->btc_children[idx->bti_offset + 1];
+		while (hdr->bth_core)
+			hdr = BT_CORE(hdr)->btc_children[0];
+		return (bt_index_set(tree, out_idx, hdr, 0));
+	}
+
+	off = idx->bti_before ? idx->bti_offset : idx->bti_offset + 1;
+	if (off < hdr->bth_count)
+		return (bt_index_set(tree, out_idx, hdr, off));
+
+	/*
+	 * This was the last element of the leaf: go up until we reach a
+	 * parent in which we are not the rightmost child.
+	 */
+	while (hdr->bth_parent != NULL) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+
+		off = bt_child_index(parent, hdr);
+		if (off < parent->btc_hdr.bth_count) {
+			return (bt_index_set(tree, out_idx,
+			    &parent->btc_hdr, off));
+		}
+		hdr = &parent->btc_hdr;
+	}
+
+	return (NULL);
+}
+
+void *
+zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		/* The previous element is the last of the subtree to the left */
+		ASSERT(!idx->bti_before);
+		hdr = BT_CORE(hdr)->btc_children[idx->bti_offset];
+		while (hdr->bth_core)
+			hdr = BT_CORE(hdr)->btc_children[hdr->bth_count];
+		return (bt_index_set(tree, out_idx, hdr, hdr->bth_count - 1));
+	}
+
+	off = idx->bti_offset;
+	if (off > 0)
+		return (bt_index_set(tree, out_idx, hdr, off - 1));
+
+	while (hdr->bth_parent != NULL) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+
+		off = bt_child_index(parent, hdr);
+		if (off > 0) {
+			return (bt_index_set(tree, out_idx,
+			    &parent->btc_hdr, off - 1));
+		}
+		hdr = &parent->btc_hdr;
+	}
+
+	return (NULL);
+}
+
+static void
+bt_clear_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	uint32_t i;
+
+	if (hdr->bth_core) {
+		for (i = 0; i <= hdr->bth_count; i++)
+			bt_clear_node(tree, BT_CORE(hdr)->btc_children[i]);
+	}
+	bt_node_free(tree, hdr);
+}
+
+void
+zfs_btree_clear(zfs_btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		bt_clear_node(tree, tree->bt_root);
+
+	tree->bt_root = NULL;
+	tree->bt_height = -1;
+	tree->bt_num_elems = 0;
+	ASSERT0(tree->bt_num_nodes);
+}
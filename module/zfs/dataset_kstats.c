@@ -0,0 +1,152 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#include <sys/zfs_context.h>
+#include <sys/dataset_kstats.h>
+#include <sys/dmu_objset.h>
+#include <sys/spa.h>
+
+static const dataset_kstat_values_t dataset_kstat_values_template = {
+	{ "dataset_name",	KSTAT_DATA_STRING },
+	{ "writes",		KSTAT_DATA_UINT64 },
+	{ "nwritten",		KSTAT_DATA_UINT64 },
+	{ "write_nsecs",	KSTAT_DATA_UINT64 },
+	{ "reads",		KSTAT_DATA_UINT64 },
+	{ "nread",		KSTAT_DATA_UINT64 },
+	{ "read_nsecs",		KSTAT_DATA_UINT64 },
+};
+
+static int
+dataset_kstats_update(kstat_t *ksp, int rw)
+{
+	dataset_kstats_t *dk = ksp->ks_private;
+	dataset_kstat_values_t *dkv = &dk->dk_values;
+	int c;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	dkv->dkv_writes.value.ui64 = 0;
+	dkv->dkv_nwritten.value.ui64 = 0;
+	dkv->dkv_write_nsecs.value.ui64 = 0;
+	dkv->dkv_reads.value.ui64 = 0;
+	dkv->dkv_nread.value.ui64 = 0;
+	dkv->dkv_read_nsecs.value.ui64 = 0;
+
+	for (c = 0; c < max_ncpus; c++) {
+		dataset_kstats_shard_t *dks = &dk->dk_shards[c];
+
+		dkv->dkv_writes.value.ui64 += dks->dks_writes;
+		dkv->dkv_nwritten.value.ui64 += dks->dks_nwritten;
+		dkv->dkv_write_nsecs.value.ui64 += dks->dks_write_nsecs;
+		dkv->dkv_reads.value.ui64 += dks->dks_reads;
+		dkv->dkv_nread.value.ui64 += dks->dks_nread;
+		dkv->dkv_read_nsecs.value.ui64 += dks->dks_read_nsecs;
+	}
+
+	return (0);
+}
+
+void
+dataset_kstats_create(dataset_kstats_t *dk, objset_t *os)
+{
+	char name[KSTAT_STRLEN];
+	char kname[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	/* the shards may be read at any time, so start them at zero */
+	dk->dk_shards = kmem_zalloc(max_ncpus *
+	    sizeof (dataset_kstats_shard_t), KM_SLEEP);
+	mutex_init(&dk->dk_lock, NULL, MUTEX_DEFAULT, NULL);
+	bcopy(&dataset_kstat_values_template, &dk->dk_values,
+	    sizeof (dataset_kstat_values_t));
+	dmu_objset_name(os, dk->dk_ds_name);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s",
+	    spa_name(dmu_objset_spa(os)));
+	(void) snprintf(kname, KSTAT_STRLEN, "objset-0x%llx",
+	    (u_longlong_t)dmu_objset_id(os));
+
+	ksp = kstat_create(name, 0, kname, "dataset", KSTAT_TYPE_NAMED,
+	    sizeof (dataset_kstat_values_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	dk->dk_kstats = ksp;
+	if (ksp != NULL) {
+		KSTAT_NAMED_STR_PTR(&dk->dk_values.dkv_ds_name) =
+		    dk->dk_ds_name;
+		KSTAT_NAMED_STR_BUFLEN(&dk->dk_values.dkv_ds_name) =
+		    strlen(dk->dk_ds_name) + 1;
+		ksp->ks_lock = &dk->dk_lock;
+		ksp->ks_data = &dk->dk_values;
+		ksp->ks_private = dk;
+		ksp->ks_update = dataset_kstats_update;
+		kstat_install(ksp);
+	}
+}
+
+void
+dataset_kstats_destroy(dataset_kstats_t *dk)
+{
+	if (dk->dk_shards == NULL)
+		return;
+
+	if (dk->dk_kstats != NULL)
+		kstat_delete(dk->dk_kstats);
+	mutex_destroy(&dk->dk_lock);
+	kmem_free(dk->dk_shards, max_ncpus * sizeof (dataset_kstats_shard_t));
+	dk->dk_shards = NULL;
+	dk->dk_kstats = NULL;
+}
+
+/*
+ * Threads can migrate between reading CPU_SEQID and updating the shard,
+ * so the updates stay atomic; they are just rarely contended.
+ */
+void
+dataset_kstats_update_write(dataset_kstats_t *dk, uint64_t nwritten,
+    hrtime_t nsecs)
+{
+	dataset_kstats_shard_t *dks;
+
+	if (dk->dk_shards == NULL)
+		return;
+
+	dks = &dk->dk_shards[CPU_SEQID % max_ncpus];
+	atomic_inc_64(&dks->dks_writes);
+	atomic_add_64(&dks->dks_nwritten, nwritten);
+	atomic_add_64(&dks->dks_write_nsecs, nsecs);
+}
+
+void
+dataset_kstats_update_read(dataset_kstats_t *dk, uint64_t nread,
+    hrtime_t nsecs)
+{
+	dataset_kstats_shard_t *dks;
+
+	if (dk->dk_shards == NULL)
+		return;
+
+	dks = &dk->dk_shards[CPU_SEQID % max_ncpus];
+	atomic_inc_64(&dks->dks_reads);
+	atomic_add_64(&dks->dks_nread, nread);
+	atomic_add_64(&dks->dks_read_nsecs, nsecs);
+}
@@ -38,6 +38,7 @@
 #include <sys/dmu_tx.h>
 #include <sys/spa.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/dmu_zfetch.h>
 #include <sys/sa.h>
 #include <sys/sa_impl.h>
@@ -71,6 +72,8 @@ struct dbuf_hold_impl_data {
 	dbuf_dirty_record_t *dh_dr;
 	arc_buf_contents_t dh_type;
 	int dh_depth;
+	/* Held level-1 dbuf that may be the parent, see dbuf_hold_range() */
+	dmu_buf_impl_t *dh_parent_hint;
 };
 
 static void __dbuf_hold_impl_init(struct dbuf_hold_impl_data *dh,
@@ -94,6 +97,33 @@ extern inline void dmu_buf_init_user(dmu_buf_user_t *dbu,
 static kmem_cache_t *dbuf_kmem_cache;
 static taskq_t *dbu_evict_taskq;
 
+/*
+ * Users with an asynchronous eviction callback are queued on one of
+ * dbu_evict_nqueues queues, chosen by CPU, rather than dispatched to the
+ * taskq one at a time.  Each non-empty queue has a single drain task on
+ * dbu_evict_taskq, which takes up to dbuf_evict_user_batch users off the
+ * queue at a time and runs their callbacks without the queue lock held.
+ * The taskq has dbuf_evict_user_taskq_pct threads per CPU, so mass
+ * evictions (e.g. of the dnodes of a large directory being removed, or
+ * at unmount) are spread over several threads.
+ */
+typedef struct dbu_evict_queue {
+	kmutex_t	deq_lock;
+	list_t		deq_list;	/* dmu_buf_user_t's to evict */
+	boolean_t	deq_active;	/* deq_tqent is dispatched */
+	taskq_ent_t	deq_tqent;
+} dbu_evict_queue_t;
+
+int dbuf_evict_user_taskq_pct = 50;
+int dbuf_evict_user_batch = 64;
+
+static dbu_evict_queue_t *dbu_evict_queues;
+static int dbu_evict_nqueues;
+static uint64_t dbu_evict_queued;	/* users on the queues, atomic */
+static uint64_t dbu_evict_queued_max;
+static uint64_t dbu_evict_users;
+static uint64_t dbu_evict_batches;
+
 static kthread_t *dbuf_cache_evict_thread;
 static kmutex_t dbuf_evict_lock;
 static kcondvar_t dbuf_evict_cv;
@@ -116,6 +146,75 @@ uint64_t dbuf_cache_max_bytes = 100 * 1024 * 1024;
 /* Cap the size of the dbuf cache to log2 fraction of arc size. */
 int dbuf_cache_max_shift = 5;
 
+/*
+ * The size the dbuf cache is kept at.  It starts at dbuf_cache_max_bytes,
+ * and is adapted by dbuf_cache_adapt() once a second: while dbufs are
+ * aged out of the cache, and held again or re-created from the ARC at
+ * comparable rates, the cache is smaller than the working set and grows
+ * by an eighth, up to a log2 fraction of the arc size given by
+ * dbuf_cache_adaptive_shift.  Once the cache stops earning its keep it
+ * shrinks back by a sixteenth at a time.  Setting
+ * dbuf_cache_adaptive_shift to 0 keeps it at dbuf_cache_max_bytes.
+ */
+int dbuf_cache_adaptive_shift = 3;
+static uint64_t dbuf_cache_target_bytes;
+static uint64_t dbuf_cache_evicts;
+static hrtime_t dbuf_cache_adapt_time;
+static dbuf_hold_stats_t dbuf_cache_adapt_last;
+static uint64_t dbuf_cache_adapt_evicts;
+
+/*
+ * Let a partial write of a block that is not cached go ahead without
+ * waiting for the rest of the block to be read, see
+ * dmu_buf_will_dirty_range().
+ */
+int dbuf_deferred_rmw = 1;
+
+dbuf_hold_stats_t dbuf_hold_stats[DMU_OT_NUMTYPES + 1];
+dbuf_type_stats_t dbuf_type_stats[DMU_OT_NUMTYPES + 1];
+
+#define	DBUF_STAT_TYPE(_type)						\
+	((_type) < DMU_OT_NUMTYPES ? (_type) : DMU_OT_NUMTYPES)
+
+#define	DBUF_HOLD_STAT(_dn, _stat)					\
+	atomic_inc_64(&dbuf_hold_stats[DBUF_STAT_TYPE((_dn)->dn_type)]._stat)
+
+/*
+ * Account for dbufs coming and going, or changing size, in the counters
+ * of their type and of their objset.
+ */
+static inline void
+dbuf_stat_update(dmu_buf_impl_t *db, int64_t dbufs, int64_t bytes)
+{
+	dbuf_type_stats_t *dts = &dbuf_type_stats[db->db_stat_type];
+	objset_t *os = db->db_objset;
+
+	atomic_add_64(&dts->dts_dbufs, dbufs);
+	atomic_add_64(&dts->dts_bytes, bytes);
+	atomic_add_64(&os->os_dbufs, dbufs);
+	atomic_add_64(&os->os_dbuf_bytes, bytes);
+	if (db->db_level > 0) {
+		atomic_add_64(&dts->dts_indirect, dbufs);
+		atomic_add_64(&os->os_dbuf_indirect, dbufs);
+	}
+}
+
+/*
+ * Account for a dbuf entering (1) or leaving (-1) the dbuf cache.
+ */
+static inline void
+dbuf_stat_idle(dmu_buf_impl_t *db, int64_t dbufs)
+{
+	dbuf_type_stats_t *dts = &dbuf_type_stats[db->db_stat_type];
+	objset_t *os = db->db_objset;
+	int64_t bytes = dbufs * (int64_t)db->db.db_size;
+
+	atomic_add_64(&dts->dts_idle, dbufs);
+	atomic_add_64(&dts->dts_idle_bytes, bytes);
+	atomic_add_64(&os->os_dbuf_idle, dbufs);
+	atomic_add_64(&os->os_dbuf_idle_bytes, bytes);
+}
+
 /*
  * The dbuf cache uses a three-stage eviction policy:
  *	- A low water marker designates when the dbuf eviction thread
@@ -191,7 +290,8 @@ dbuf_dest(void *vdb, void *unused)
  */
 static dbuf_hash_table_t dbuf_hash_table;
 
-static uint64_t dbuf_hash_count;
+/* Grows shard bucket arrays; never run with a db_mtx held */
+static taskq_t *dbuf_hash_taskq;
 
 static uint64_t
 dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
@@ -218,31 +318,134 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	(dbuf)->db_level == (level) &&			\
 	(dbuf)->db_blkid == (blkid))
 
+/*
+ * The shard is chosen by bits well above any used to pick a bucket.
+ */
+static inline dbuf_hash_shard_t *
+dbuf_hash_shard(uint64_t hv)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+
+	return (&h->hash_shards[(hv >> 48) & (h->hash_nshards - 1)]);
+}
+
 dmu_buf_impl_t *
 dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 {
-	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = dbuf_hash(os, obj, level, blkid);
-	uint64_t idx;
+	dbuf_hash_shard_t *hs = dbuf_hash_shard(hv);
+	kmutex_t *hmtx = DBUF_HASH_MUTEX(hs, hv);
 	dmu_buf_impl_t *db;
 
-	idx = hv & h->hash_table_mask;
-
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
+	mutex_enter(hmtx);
+	for (db = hs->hs_table[hv & hs->hs_mask]; db != NULL;
+	    db = db->db_hash_next) {
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
-			mutex_enter(&db->db_mtx);
+			zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(hmtx);
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	mutex_exit(hmtx);
 	return (NULL);
 }
 
+/*
+ * Double the bucket array of a shard.  Every mutex of the shard is held
+ * while its dbufs are rehashed, so lookups in the shard wait for the
+ * grow, but those in other shards do not notice it.
+ */
+static void
+dbuf_hash_grow(void *arg)
+{
+	dbuf_hash_shard_t *hs = arg;
+	dmu_buf_impl_t **table, **otable, *db, *next;
+	uint64_t osize, nsize, i, idx, chains = 0;
+
+	/* Only a grow changes hs_mask, and grows of a shard are serial */
+	osize = hs->hs_mask + 1;
+	nsize = osize << 1;
+	table = kmem_zalloc(nsize * sizeof (void *), KM_NOSLEEP);
+	if (table == NULL)
+		goto out;
+
+	for (i = 0; i < DBUF_SHARD_MUTEXES; i++)
+		mutex_enter(&hs->hs_mutexes[i]);
+
+	otable = hs->hs_table;
+	for (i = 0; i < osize; i++) {
+		for (db = otable[i]; db != NULL; db = next) {
+			next = db->db_hash_next;
+			idx = dbuf_hash(db->db_objset, db->db.db_object,
+			    db->db_level, db->db_blkid) & (nsize - 1);
+			if (table[idx] != NULL &&
+			    table[idx]->db_hash_next == NULL)
+				chains++;
+			db->db_hash_next = table[idx];
+			table[idx] = db;
+		}
+	}
+	hs->hs_table = table;
+	hs->hs_mask = nsize - 1;
+	hs->hs_chains = chains;
+	hs->hs_chain_max = 0;
+	hs->hs_resizes++;
+
+	for (i = 0; i < DBUF_SHARD_MUTEXES; i++)
+		mutex_exit(&hs->hs_mutexes[i]);
+
+	kmem_free(otable, osize * sizeof (void *));
+out:
+	membar_producer();
+	hs->hs_growing = 0;
+}
+
+/*
+ * Queue a grow of the shard if it is above its load factor.  The
+ * caller holds the new dbuf's db_mtx, which must not be held while
+ * taking the shard's hash mutexes, so the grow runs from a taskq.
+ */
+static void
+dbuf_hash_check_grow(dbuf_hash_shard_t *hs, uint64_t count)
+{
+	uint64_t buckets = hs->hs_mask + 1;
+
+	if (count <= buckets * DBUF_HASH_LOAD ||
+	    buckets >= dbuf_hash_table.hash_shard_max)
+		return;
+
+	if (atomic_cas_32(&hs->hs_growing, 0, 1) != 0)
+		return;
+
+	if (taskq_dispatch(dbuf_hash_taskq, dbuf_hash_grow, hs,
+	    TQ_NOSLEEP) == 0)
+		hs->hs_growing = 0;
+}
+
+void
+dbuf_hash_stats_get(dbuf_hash_stats_t *dht)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	int i;
+
+	bzero(dht, sizeof (*dht));
+	dht->dht_shards = h->hash_nshards;
+	for (i = 0; i < h->hash_nshards; i++) {
+		dbuf_hash_shard_t *hs = &h->hash_shards[i];
+
+		dht->dht_buckets += hs->hs_mask + 1;
+		dht->dht_elements += hs->hs_count;
+		dht->dht_collisions += hs->hs_collisions;
+		dht->dht_chains += hs->hs_chains;
+		dht->dht_chain_max = MAX(dht->dht_chain_max,
+		    hs->hs_chain_max);
+		dht->dht_resizes += hs->hs_resizes;
+	}
+}
+
 static dmu_buf_impl_t *
 dbuf_find_bonus(objset_t *os, uint64_t object)
 {
@@ -253,7 +456,7 @@ dbuf_find_bonus(objset_t *os, uint64_t object)
 		rw_enter(&dn->dn_struct_rwlock, RW_READER);
 		if (dn->dn_bonus != NULL) {
 			db = dn->dn_bonus;
-			mutex_enter(&db->db_mtx);
+			zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		}
 		rw_exit(&dn->dn_struct_rwlock);
 		dnode_rele(dn, FTAG);
@@ -270,32 +473,44 @@ dbuf_find_bonus(objset_t *os, uint64_t object)
 static dmu_buf_impl_t *
 dbuf_hash_insert(dmu_buf_impl_t *db)
 {
-	dbuf_hash_table_t *h = &dbuf_hash_table;
 	objset_t *os = db->db_objset;
 	uint64_t obj = db->db.db_object;
 	int level = db->db_level;
 	uint64_t blkid = db->db_blkid;
 	uint64_t hv = dbuf_hash(os, obj, level, blkid);
-	uint64_t idx = hv & h->hash_table_mask;
+	dbuf_hash_shard_t *hs = dbuf_hash_shard(hv);
+	kmutex_t *hmtx = DBUF_HASH_MUTEX(hs, hv);
 	dmu_buf_impl_t *dbf;
+	uint64_t idx, count, i = 0;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
+	mutex_enter(hmtx);
+	idx = hv & hs->hs_mask;
+	for (dbf = hs->hs_table[idx]; dbf != NULL;
+	    dbf = dbf->db_hash_next, i++) {
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(hmtx);
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
 		}
 	}
 
-	mutex_enter(&db->db_mtx);
-	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_inc_64(&dbuf_hash_count);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	db->db_hash_next = hs->hs_table[idx];
+	hs->hs_table[idx] = db;
+	if (i > 0) {
+		atomic_inc_64(&hs->hs_collisions);
+		if (i == 1)
+			atomic_inc_64(&hs->hs_chains);
+		if (i + 1 > hs->hs_chain_max)
+			hs->hs_chain_max = i + 1;
+	}
+	mutex_exit(hmtx);
+	count = atomic_inc_64_nv(&hs->hs_count);
+
+	dbuf_hash_check_grow(hs, count);
 
 	return (NULL);
 }
@@ -306,11 +521,12 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 static void
 dbuf_hash_remove(dmu_buf_impl_t *db)
 {
-	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = dbuf_hash(db->db_objset, db->db.db_object,
 		db->db_level, db->db_blkid);
-	uint64_t idx = hv & h->hash_table_mask;
+	dbuf_hash_shard_t *hs = dbuf_hash_shard(hv);
+	kmutex_t *hmtx = DBUF_HASH_MUTEX(hs, hv);
 	dmu_buf_impl_t *dbf, **dbp;
+	uint64_t idx;
 
 	/*
 	 * We musn't hold db_mtx to maintain lock ordering:
@@ -320,16 +536,20 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	dbp = &h->hash_table[idx];
+	mutex_enter(hmtx);
+	idx = hv & hs->hs_mask;
+	dbp = &hs->hs_table[idx];
 	while ((dbf = *dbp) != db) {
 		dbp = &dbf->db_hash_next;
 		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_dec_64(&dbuf_hash_count);
+	if (hs->hs_table[idx] != NULL &&
+	    hs->hs_table[idx]->db_hash_next == NULL)
+		atomic_dec_64(&hs->hs_chains);
+	mutex_exit(hmtx);
+	atomic_dec_64(&hs->hs_count);
 }
 
 typedef enum {
@@ -374,6 +594,72 @@ dbuf_verify_user(dmu_buf_impl_t *db, dbvu_verify_type_t verify_type)
 #endif
 }
 
+static void
+dbu_evict_drain(void *arg)
+{
+	dbu_evict_queue_t *deq = arg;
+	dmu_buf_user_t *dbu;
+	list_t batch;
+	int n;
+
+	list_create(&batch, sizeof (dmu_buf_user_t),
+	    offsetof(dmu_buf_user_t, dbu_evict_node));
+
+	mutex_enter(&deq->deq_lock);
+	while (!list_is_empty(&deq->deq_list)) {
+		for (n = 0; n < MAX(dbuf_evict_user_batch, 1) &&
+		    (dbu = list_remove_head(&deq->deq_list)) != NULL; n++)
+			list_insert_tail(&batch, dbu);
+		mutex_exit(&deq->deq_lock);
+
+		/* the callback may free the dbu, so unlink it first */
+		while ((dbu = list_remove_head(&batch)) != NULL)
+			dbu->dbu_evict_func_async(dbu);
+
+		atomic_add_64(&dbu_evict_queued, -n);
+		atomic_add_64(&dbu_evict_users, n);
+		atomic_inc_64(&dbu_evict_batches);
+
+		mutex_enter(&deq->deq_lock);
+	}
+	deq->deq_active = B_FALSE;
+	mutex_exit(&deq->deq_lock);
+
+	list_destroy(&batch);
+}
+
+static void
+dbu_evict_enqueue(dmu_buf_user_t *dbu)
+{
+	dbu_evict_queue_t *deq =
+	    &dbu_evict_queues[CPU_SEQID % dbu_evict_nqueues];
+	uint64_t queued;
+
+	/* counted first so that the drain can never take it below zero */
+	queued = atomic_inc_64_nv(&dbu_evict_queued);
+	if (queued > dbu_evict_queued_max)
+		dbu_evict_queued_max = queued;
+
+	mutex_enter(&deq->deq_lock);
+	list_insert_tail(&deq->deq_list, dbu);
+	if (!deq->deq_active) {
+		deq->deq_active = B_TRUE;
+		taskq_dispatch_ent(dbu_evict_taskq, dbu_evict_drain, deq, 0,
+		    &deq->deq_tqent);
+	}
+	mutex_exit(&deq->deq_lock);
+}
+
+void
+dbuf_evict_user_stats_get(dbuf_evict_user_stats_t *deus)
+{
+	deus->deus_queues = dbu_evict_nqueues;
+	deus->deus_queued = dbu_evict_queued;
+	deus->deus_queued_max = dbu_evict_queued_max;
+	deus->deus_evicts = dbu_evict_users;
+	deus->deus_batches = dbu_evict_batches;
+}
+
 static void
 dbuf_evict_user(dmu_buf_impl_t *db)
 {
@@ -407,10 +693,8 @@ dbuf_evict_user(dmu_buf_impl_t *db)
 	if (dbu->dbu_evict_func_sync != NULL)
 		dbu->dbu_evict_func_sync(dbu);
 
-	if (has_async) {
-		taskq_dispatch_ent(dbu_evict_taskq, dbu->dbu_evict_func_async,
-		    dbu, 0, &dbu->dbu_tqent);
-	}
+	if (has_async)
+		dbu_evict_enqueue(dbu);
 }
 
 boolean_t
@@ -465,20 +749,72 @@ static inline boolean_t
 dbuf_cache_above_hiwater(void)
 {
 	uint64_t dbuf_cache_hiwater_bytes =
-	    (dbuf_cache_max_bytes * dbuf_cache_hiwater_pct) / 100;
+	    (dbuf_cache_target_bytes * dbuf_cache_hiwater_pct) / 100;
 
 	return (refcount_count(&dbuf_cache_size) >
-	    dbuf_cache_max_bytes + dbuf_cache_hiwater_bytes);
+	    dbuf_cache_target_bytes + dbuf_cache_hiwater_bytes);
 }
 
 static inline boolean_t
 dbuf_cache_above_lowater(void)
 {
 	uint64_t dbuf_cache_lowater_bytes =
-	    (dbuf_cache_max_bytes * dbuf_cache_lowater_pct) / 100;
+	    (dbuf_cache_target_bytes * dbuf_cache_lowater_pct) / 100;
 
 	return (refcount_count(&dbuf_cache_size) >
-	    dbuf_cache_max_bytes - dbuf_cache_lowater_bytes);
+	    dbuf_cache_target_bytes - dbuf_cache_lowater_bytes);
+}
+
+/*
+ * Adapt dbuf_cache_target_bytes to what the holds of the last second
+ * found, see dbuf_cache_target_bytes.  Called by the eviction thread.
+ */
+static void
+dbuf_cache_adapt(void)
+{
+	dbuf_hold_stats_t now = { 0 };
+	uint64_t reholds, misses, evicts;
+	uint64_t base, limit, target = dbuf_cache_target_bytes;
+	hrtime_t t = gethrtime();
+	int i;
+
+	if (t - dbuf_cache_adapt_time < SEC2NSEC(1))
+		return;
+	dbuf_cache_adapt_time = t;
+
+	for (i = 0; i <= DMU_OT_NUMTYPES; i++) {
+		now.dhs_reholds += dbuf_hold_stats[i].dhs_reholds;
+		now.dhs_misses += dbuf_hold_stats[i].dhs_misses;
+	}
+	reholds = now.dhs_reholds - dbuf_cache_adapt_last.dhs_reholds;
+	misses = now.dhs_misses - dbuf_cache_adapt_last.dhs_misses;
+	evicts = dbuf_cache_evicts - dbuf_cache_adapt_evicts;
+	dbuf_cache_adapt_last = now;
+	dbuf_cache_adapt_evicts = dbuf_cache_evicts;
+
+	base = dbuf_cache_max_bytes;
+	limit = base;
+	if (dbuf_cache_adaptive_shift > 0)
+		limit = MAX(base, arc_max_bytes() >> dbuf_cache_adaptive_shift);
+
+	if (evicts != 0 && reholds != 0 &&
+	    misses >= reholds && misses <= 8 * reholds) {
+		/* aged out dbufs are wanted again: grow */
+		target += target / 8;
+	} else if (reholds * 8 < misses ||
+	    refcount_count(&dbuf_cache_size) < target / 2) {
+		/* of little use, or not filled: shrink back */
+		target -= target / 16;
+	}
+	dbuf_cache_target_bytes = MIN(MAX(target, base), limit);
+}
+
+void
+dbuf_cache_stats_get(dbuf_cache_stats_t *dcs)
+{
+	dcs->dcs_size = refcount_count(&dbuf_cache_size);
+	dcs->dcs_target = dbuf_cache_target_bytes;
+	dcs->dcs_evicts = dbuf_cache_evicts;
 }
 
 /*
@@ -515,6 +851,8 @@ dbuf_evict_one(void)
 		multilist_sublist_unlock(mls);
 		(void) refcount_remove_many(&dbuf_cache_size,
 		    db->db.db_size, db);
+		dbuf_stat_idle(db, -1);
+		atomic_inc_64(&dbuf_cache_evicts);
 		dbuf_destroy(db);
 	} else {
 		multilist_sublist_unlock(mls);
@@ -548,6 +886,7 @@ dbuf_evict_thread(void)
 			(void) cv_timedwait_hires(&dbuf_evict_cv,
 			    &dbuf_evict_lock, SEC2NSEC(1), MSEC2NSEC(1), 0);
 			CALLB_CPR_SAFE_END(&cpr, &dbuf_evict_lock);
+			dbuf_cache_adapt();
 		}
 		mutex_exit(&dbuf_evict_lock);
 
@@ -558,6 +897,7 @@ dbuf_evict_thread(void)
 		 */
 		while (dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
 			dbuf_evict_one();
+			dbuf_cache_adapt();
 		}
 
 		mutex_enter(&dbuf_evict_lock);
@@ -600,11 +940,12 @@ dbuf_evict_notify(void)
 	if (tsd_get(zfs_dbuf_evict_key) != NULL)
 		return;
 
-	if (refcount_count(&dbuf_cache_size) > dbuf_cache_max_bytes) {
+	if (refcount_count(&dbuf_cache_size) > dbuf_cache_target_bytes) {
 		boolean_t evict_now = B_FALSE;
 
 		mutex_enter(&dbuf_evict_lock);
-		if (refcount_count(&dbuf_cache_size) > dbuf_cache_max_bytes) {
+		if (refcount_count(&dbuf_cache_size) >
+		    dbuf_cache_target_bytes) {
 			evict_now = dbuf_cache_above_hiwater();
 			cv_signal(&dbuf_evict_cv);
 		}
@@ -620,43 +961,49 @@ void
 dbuf_init(void)
 {
 	uint64_t hsize = 1ULL << 16;
+	uint64_t ssize;
 	dbuf_hash_table_t *h = &dbuf_hash_table;
-	int i;
+	int i, j;
 
 	/*
-	 * The hash table is big enough to fill all of physical memory
+	 * The hash table may grow big enough to fill all of physical memory
 	 * with an average block size of zfs_arc_average_blocksize (default 8K).
-	 * By default, the table will take up
+	 * At that size the table takes up
 	 * totalmem * sizeof(void*) / 8K (1MB per GB with 8-byte pointers).
 	 */
 		while (hsize * zfs_arc_average_blocksize <(uint64_t)physmem * PAGESIZE)
 		hsize <<= 1;
 
-retry:
-	h->hash_table_mask = hsize - 1;
-
-    //printf("[dbuf] init hsize is 0x%llx mask is 0x%llx\n", hsize, h->hash_table_mask);
-
-	h->hash_table = kmem_zalloc(hsize * sizeof (void *), KM_SLEEP);
-
-	if (h->hash_table == NULL) {
-		/* XXX - we should really return an error instead of assert */
-		ASSERT(hsize > (1ULL << 10));
-		hsize >>= 1;
-		goto retry;
+	/*
+	 * One shard per CPU, rounded up to a power of two.  Each shard
+	 * starts at 1/64th of its share of the full size and grows on
+	 * demand, so small systems and idle pools don't pay for buckets
+	 * they never use.
+	 */
+	h->hash_nshards = MIN(1 << highbit64(max_ncpus - 1),
+	    DBUF_HASH_MAX_SHARDS);
+	h->hash_shard_max = MAX(hsize / h->hash_nshards, DBUF_SHARD_MUTEXES);
+	ssize = MAX(h->hash_shard_max >> 6, DBUF_SHARD_MUTEXES);
+
+	h->hash_shards = kmem_zalloc(h->hash_nshards *
+	    sizeof (dbuf_hash_shard_t), KM_SLEEP);
+	for (i = 0; i < h->hash_nshards; i++) {
+		dbuf_hash_shard_t *hs = &h->hash_shards[i];
+
+		hs->hs_mask = ssize - 1;
+		hs->hs_table = kmem_zalloc(ssize * sizeof (void *), KM_SLEEP);
+		for (j = 0; j < DBUF_SHARD_MUTEXES; j++) {
+			mutex_init(&hs->hs_mutexes[j], NULL,
+			    MUTEX_DEFAULT, NULL);
+		}
 	}
-
-    //printf("[dbuf] hash_table allocated %llu bytes (hsize %llu)\n",
-    //       hsize * sizeof (void *),
-    //      hsize);
+	dbuf_hash_taskq = taskq_create("dbuf_hash_grow", 1, minclsyspri,
+	    0, 0, 0);
 
 	dbuf_kmem_cache = kmem_cache_create("dmu_buf_impl_t",
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
-
 	dbuf_stats_init(h);
 
 	/*
@@ -665,12 +1012,26 @@ retry:
 	 */
 	dbuf_cache_max_bytes = MIN(dbuf_cache_max_bytes,
 		arc_max_bytes() >> dbuf_cache_max_shift);
+	dbuf_cache_target_bytes = dbuf_cache_max_bytes;
 
 	/*
 	 * All entries are queued via taskq_dispatch_ent(), so min/maxalloc
 	 * configuration is not required.
 	 */
-	dbu_evict_taskq = taskq_create("dbu_evict", 1, minclsyspri, 0, 0, 0);
+	dbu_evict_taskq = taskq_create("dbu_evict",
+	    MAX(MIN(dbuf_evict_user_taskq_pct, 100), 1), minclsyspri, 0, 0,
+	    TASKQ_THREADS_CPU_PCT);
+	dbu_evict_nqueues = max_ncpus;
+	dbu_evict_queues = kmem_zalloc(dbu_evict_nqueues *
+	    sizeof (dbu_evict_queue_t), KM_SLEEP);
+	for (i = 0; i < dbu_evict_nqueues; i++) {
+		dbu_evict_queue_t *deq = &dbu_evict_queues[i];
+
+		mutex_init(&deq->deq_lock, NULL, MUTEX_DEFAULT, NULL);
+		list_create(&deq->deq_list, sizeof (dmu_buf_user_t),
+		    offsetof(dmu_buf_user_t, dbu_evict_node));
+		taskq_init_ent(&deq->deq_tqent);
+	}
 
 	dbuf_cache = multilist_create(sizeof (dmu_buf_impl_t),
 	    offsetof(dmu_buf_impl_t, db_cache_link),
@@ -691,16 +1052,32 @@ void
 dbuf_fini(void)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
-	int i;
+	int i, j;
 
 	dbuf_stats_destroy();
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_destroy(&h->hash_mutexes[i]);
+	/* wait for any queued grow before freeing the shards */
+	taskq_destroy(dbuf_hash_taskq);
+	for (i = 0; i < h->hash_nshards; i++) {
+		dbuf_hash_shard_t *hs = &h->hash_shards[i];
 
-	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
+		for (j = 0; j < DBUF_SHARD_MUTEXES; j++)
+			mutex_destroy(&hs->hs_mutexes[j]);
+		kmem_free(hs->hs_table, (hs->hs_mask + 1) * sizeof (void *));
+	}
+	kmem_free(h->hash_shards, h->hash_nshards *
+	    sizeof (dbuf_hash_shard_t));
 	kmem_cache_destroy(dbuf_kmem_cache);
 	taskq_destroy(dbu_evict_taskq);
+	for (i = 0; i < dbu_evict_nqueues; i++) {
+		dbu_evict_queue_t *deq = &dbu_evict_queues[i];
+
+		ASSERT(list_is_empty(&deq->deq_list));
+		list_destroy(&deq->deq_list);
+		mutex_destroy(&deq->deq_lock);
+	}
+	kmem_free(dbu_evict_queues, dbu_evict_nqueues *
+	    sizeof (dbu_evict_queue_t));
 
 	mutex_enter(&dbuf_evict_lock);
 	dbuf_evict_thread_exit = B_TRUE;
@@ -901,7 +1278,7 @@ dbuf_loan_arcbuf(dmu_buf_impl_t *db)
 	arc_buf_t *abuf;
 
 	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	if (arc_released(db->db_buf) || refcount_count(&db->db_holds) > 1) {
 		int blksz = db->db.db_size;
 		spa_t *spa = db->db_objset->os_spa;
@@ -955,7 +1332,7 @@ dbuf_read_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 {
 	dmu_buf_impl_t *db = vdb;
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	ASSERT3U(db->db_state, ==, DB_READ);
 	/*
 	 * All reads are synchronous, so we must have a hold on the dbuf
@@ -984,6 +1361,108 @@ dbuf_read_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 	dbuf_rele_and_unlock(db, NULL);
 }
 
+typedef struct dbuf_rmw_merge_arg {
+	dmu_buf_impl_t	*dma_db;
+	arc_buf_t	*dma_buf;	/* the old contents of the block */
+	uint64_t	dma_off;	/* end of the last range written */
+} dbuf_rmw_merge_arg_t;
+
+/*
+ * Copy the old contents between the last range written and this one.
+ */
+static void
+dbuf_rmw_merge_range(void *arg, uint64_t start, uint64_t size)
+{
+	dbuf_rmw_merge_arg_t *dma = arg;
+	uint64_t off = dma->dma_off;
+
+	if (start > off) {
+		bcopy((char *)dma->dma_buf->b_data + off,
+		    (char *)dma->dma_db->db.db_data + off, start - off);
+	}
+	dma->dma_off = start + size;
+}
+
+/*
+ * Merge the old contents of a block, read in for
+ * dmu_buf_will_dirty_range(), with what has been written to it since,
+ * and send the dbuf to CACHED.  Drops db_mtx and the hold of the read.
+ */
+static void
+dbuf_rmw_merge(dmu_buf_impl_t *db, arc_buf_t *buf)
+{
+	dbuf_dirty_record_t *dr = db->db_last_dirty;
+	dbuf_rmw_merge_arg_t dma = { db, buf, 0 };
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT(db->db_rmw_pending);
+	ASSERT3U(db->db_state, ==, DB_FILL);
+	ASSERT3U(arc_buf_size(buf), ==, db->db.db_size);
+
+	/* without a dirty record, the write was undone by a free */
+	if (dr != NULL && dr->dt.dl.dr_written != NULL) {
+		ASSERT0(dr->dt.dl.dr_rmw_writers);
+		range_tree_walk(dr->dt.dl.dr_written, dbuf_rmw_merge_range,
+		    &dma);
+		range_tree_vacate(dr->dt.dl.dr_written, NULL, NULL);
+		range_tree_destroy(dr->dt.dl.dr_written);
+		dr->dt.dl.dr_written = NULL;
+		dr->dt.dl.dr_rmw_buf = NULL;
+	}
+	dbuf_rmw_merge_range(&dma, db->db.db_size, 0);
+
+	if (db->db_freed_in_flight) {
+		/* we were freed while the block was read */
+		bzero(db->db.db_data, db->db.db_size);
+		db->db_freed_in_flight = FALSE;
+	}
+	arc_buf_destroy(buf, db);
+	db->db_rmw_pending = FALSE;
+	db->db_state = DB_CACHED;
+	cv_broadcast(&db->db_changed);
+	dbuf_rele_and_unlock(db, NULL);
+}
+
+static void
+dbuf_rmw_read_done(zio_t *zio, arc_buf_t *buf, void *vdb)
+{
+	dmu_buf_impl_t *db = vdb;
+	dbuf_dirty_record_t *dr;
+
+	if (zio != NULL && zio->io_error != 0) {
+		/*
+		 * Our ZIO_FLAG_MUSTSUCCEED is only honoured when our read
+		 * is the one that does the I/O; one that joined a read
+		 * already in flight (a prefetch, say) gets that read's
+		 * error and a buffer that was never filled.  Never merge
+		 * that: read the block again, keeping the read's hold.
+		 * The block pointer cannot change meanwhile, since syncing
+		 * this dbuf waits for db_rmw_pending.
+		 */
+		blkptr_t bp = *zio->io_bp;
+		zbookmark_phys_t zb = zio->io_bookmark;
+		arc_flags_t aflags = ARC_FLAG_NOWAIT;
+
+		if (buf != NULL)
+			arc_buf_destroy(buf, db);
+		(void) arc_read(NULL, zio->io_spa, &bp, dbuf_rmw_read_done,
+		    db, ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_MUSTSUCCEED,
+		    &aflags, &zb);
+		return;
+	}
+
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	dr = db->db_last_dirty;
+	if (dr != NULL && dr->dt.dl.dr_rmw_writers > 0) {
+		/* the last writer to finish merges it */
+		ASSERT3P(dr->dt.dl.dr_rmw_buf, ==, NULL);
+		dr->dt.dl.dr_rmw_buf = buf;
+		mutex_exit(&db->db_mtx);
+		return;
+	}
+	dbuf_rmw_merge(db, buf);
+}
+
 static int
 dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 {
@@ -1003,12 +1482,13 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 
 	if (db->db_blkid == DMU_BONUS_BLKID) {
 		int bonuslen = MIN(dn->dn_bonuslen, dn->dn_phys->dn_bonuslen);
+		int max_bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
 
 		ASSERT3U(bonuslen, <=, db->db.db_size);
-		db->db.db_data = zio_buf_alloc(DN_MAX_BONUSLEN);
-		arc_space_consume(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
-		if (bonuslen < DN_MAX_BONUSLEN)
-			bzero(db->db.db_data, DN_MAX_BONUSLEN);
+		db->db.db_data = zio_buf_alloc(max_bonuslen);
+		arc_space_consume(max_bonuslen, ARC_SPACE_OTHER);
+		if (bonuslen < max_bonuslen)
+			bzero(db->db.db_data, max_bonuslen);
 		if (bonuslen)
 			bcopy(DN_BONUS(dn->dn_phys), db->db.db_data, bonuslen);
 		DB_DNODE_EXIT(db);
@@ -1112,10 +1592,13 @@ dbuf_fix_old_data(dmu_buf_impl_t *db, uint64_t txg)
 	 */
 	ASSERT(dr->dr_txg >= txg - 2);
 	if (db->db_blkid == DMU_BONUS_BLKID) {
+		dnode_t *dn = DB_DNODE(db);
+		int bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
+
 		/* Note that the data bufs here are zio_bufs */
-		dr->dt.dl.dr_data = zio_buf_alloc(DN_MAX_BONUSLEN);
-		arc_space_consume(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
-		bcopy(db->db.db_data, dr->dt.dl.dr_data, DN_MAX_BONUSLEN);
+		dr->dt.dl.dr_data = zio_buf_alloc(bonuslen);
+		arc_space_consume(bonuslen, ARC_SPACE_OTHER);
+		bcopy(db->db.db_data, dr->dt.dl.dr_data, bonuslen);
 	} else if (refcount_count(&db->db_holds) > db->db_dirtycnt) {
 		int size = arc_buf_size(db->db_buf);
 		arc_buf_contents_t type = DBUF_GET_BUFC_TYPE(db);
@@ -1163,7 +1646,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	    (flags & DB_RF_NOPREFETCH) == 0 && dn != NULL &&
 	    DBUF_IS_CACHEABLE(db);
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	if (db->db_state == DB_CACHED) {
 		/*
 		 * If the arc buf is compressed, we need to decompress it to
@@ -1219,11 +1702,12 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		DB_DNODE_EXIT(db);
 
 		/* Skip the wait per the caller's request. */
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		if ((flags & DB_RF_NEVERWAIT) == 0) {
 			while (db->db_state == DB_READ ||
 			    db->db_state == DB_FILL) {
 				ASSERT(db->db_state == DB_READ ||
+				    db->db_rmw_pending ||
 				    (flags & DB_RF_HAVESTRUCT) == 0);
 				DTRACE_PROBE2(blocked__read, dmu_buf_impl_t *,
 				    db, zio_t *, zio);
@@ -1244,7 +1728,7 @@ dbuf_noread(dmu_buf_impl_t *db)
 {
 	ASSERT(!refcount_is_zero(&db->db_holds));
 	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	while (db->db_state == DB_READ || db->db_state == DB_FILL)
 		cv_wait(&db->db_changed, &db->db_mtx);
 	if (db->db_state == DB_UNCACHED) {
@@ -1338,12 +1822,20 @@ dbuf_free_range(dnode_t *dn, uint64_t start_blkid, uint64_t end_blkid,
 		ASSERT3U(db->db_blkid, >=, start_blkid);
 
 		/* found a level 0 buffer in the range */
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		if (dbuf_undirty(db, tx)) {
 			/* mutex has been dropped and dbuf destroyed */
 			continue;
 		}
 
+		/*
+		 * The partial write of an earlier txg must not be lost to
+		 * db_freed_in_flight; let its read-modify-write finish.
+		 */
+		while (db->db_rmw_pending && db->db_last_dirty != NULL &&
+		    db->db_last_dirty->dr_txg != txg)
+			cv_wait(&db->db_changed, &db->db_mtx);
+
 		if (db->db_state == DB_UNCACHED ||
 			db->db_state == DB_NOFILL ||
 			db->db_state == DB_EVICTING) {
@@ -1440,10 +1932,11 @@ dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx)
 	if (size > osize)
 		bzero((uint8_t *)buf->b_data + osize, size - osize);
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	dbuf_set_data(db, buf);
 	arc_buf_destroy(obuf, db);
 	db->db.db_size = size;
+	dbuf_stat_update(db, 0, size - osize);
 
 	if (db->db_level == 0) {
 		ASSERT3U(db->db_last_dirty->dr_txg, ==, tx->tx_txg);
@@ -1537,7 +2030,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	    dn->dn_dirtyctx == DN_UNDIRTIED || dn->dn_dirtyctx ==
 	    (dmu_tx_is_syncing(tx) ? DN_DIRTY_SYNC : DN_DIRTY_OPEN));
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	/*
 	 * XXX make this true for indirects too?  The problem is that
 	 * transactions created with dmu_tx_create_assigned() from
@@ -1547,7 +2040,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	    db->db_state == DB_CACHED || db->db_state == DB_FILL ||
 	    db->db_state == DB_NOFILL);
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	/*
 	 * Don't set dirtyctx to SYNC if we're just modifying this as we
 	 * initialize the objset.
@@ -1678,7 +2171,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	 */
 	if (db->db_level == 0 && db->db_blkid != DMU_BONUS_BLKID &&
 	    db->db_blkid != DMU_SPILL_BLKID) {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		if (dn->dn_free_ranges[txgoff] != NULL) {
 			range_tree_clear(dn->dn_free_ranges[txgoff],
 			    db->db_blkid, 1);
@@ -1698,7 +2191,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 
 	if (db->db_blkid == DMU_BONUS_BLKID ||
 	    db->db_blkid == DMU_SPILL_BLKID) {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		ASSERT(!list_link_active(&dr->dr_dirty_node));
 		list_insert_tail(&dn->dn_dirty_records[txgoff], dr);
 		mutex_exit(&dn->dn_mtx);
@@ -1751,7 +2244,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 		if (parent_held)
 			dbuf_rele(parent, FTAG);
 
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		/*
 		 * Since we've dropped the mutex, it's possible that
 		 * dbuf_undirty() might have changed this out from under us.
@@ -1770,7 +2263,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 		ASSERT(db->db_level+1 == dn->dn_nlevels);
 		ASSERT(db->db_blkid < dn->dn_nblkptr);
 		ASSERT(db->db_parent == NULL || db->db_parent == dn->dn_dbuf);
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		ASSERT(!list_link_active(&dr->dr_dirty_node));
 		list_insert_tail(&dn->dn_dirty_records[txgoff], dr);
 		mutex_exit(&dn->dn_mtx);
@@ -1827,8 +2320,7 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 
 	ASSERT(db->db.db_size != 0);
 
-	dsl_pool_undirty_space(dmu_objset_pool(dn->dn_objset),
-	    dr->dr_accounted, txg);
+	dmu_objset_undirty_space(dn->dn_objset, dr->dr_accounted, txg);
 
 	*drp = dr->dr_next;
 
@@ -1845,7 +2337,7 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	} else if (db->db_blkid == DMU_SPILL_BLKID ||
 	    db->db_level + 1 == dn->dn_nlevels) {
 		ASSERT(db->db_blkptr == NULL || db->db_parent == dn->dn_dbuf);
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		list_remove(&dn->dn_dirty_records[txg & TXG_MASK], dr);
 		mutex_exit(&dn->dn_mtx);
 	}
@@ -1859,6 +2351,13 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 		if (dr->dt.dl.dr_data != db->db_buf)
 			arc_buf_destroy(dr->dt.dl.dr_data, db);
 	}
+	if (dr->dt.dl.dr_written != NULL) {
+		/* dbuf_rmw_merge() will find no dirty record */
+		ASSERT0(dr->dt.dl.dr_rmw_writers);
+		ASSERT3P(dr->dt.dl.dr_rmw_buf, ==, NULL);
+		range_tree_vacate(dr->dt.dl.dr_written, NULL, NULL);
+		range_tree_destroy(dr->dt.dl.dr_written);
+	}
 
 	kmem_free(dr, sizeof (dbuf_dirty_record_t));
 
@@ -1890,7 +2389,7 @@ dmu_buf_will_dirty(dmu_buf_t *db_fake, dmu_tx_t *tx)
 	 * by 50% for some workloads (e.g. file deletion with indirect blocks
 	 * cached).
 	 */
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 
 	for (dr = db->db_last_dirty;
 	    dr != NULL && dr->dr_txg >= tx->tx_txg; dr = dr->dr_next) {
@@ -1916,12 +2415,186 @@ dmu_buf_will_dirty(dmu_buf_t *db_fake, dmu_tx_t *tx)
 	(void) dbuf_dirty(db, tx);
 }
 
+/*
+ * Dirty a level 0 block for a write of len bytes at off, without waiting
+ * for the rest of the block to be read in if it is not cached: the dbuf
+ * is given an empty buffer and stays in DB_FILL while the read is in
+ * flight, and the ranges written in the meantime are kept in the dirty
+ * record.  Once the read is done and the writers have called
+ * dmu_buf_dirty_range_done(), dbuf_rmw_merge() fills in the rest of the
+ * buffer from the old block.  Anyone else wanting the contents, or a
+ * hold in another txg, waits for DB_FILL to end as for any fill, and so
+ * does dbuf_sync_leaf().
+ */
+void
+dmu_buf_will_dirty_range(dmu_buf_t *db_fake, uint64_t off, uint64_t len,
+    dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	arc_flags_t aflags = ARC_FLAG_NOWAIT;
+	boolean_t drop_struct_lock = FALSE;
+	dbuf_dirty_record_t *dr;
+	zbookmark_phys_t zb;
+	dnode_t *dn;
+	spa_t *spa;
+
+	ASSERT(tx->tx_txg != 0);
+	ASSERT(!refcount_is_zero(&db->db_holds));
+	ASSERT3U(off + len, <=, db->db.db_size);
+
+	if (!dbuf_deferred_rmw || db->db_level != 0 ||
+	    db->db_blkid == DMU_BONUS_BLKID ||
+	    db->db_blkid == DMU_SPILL_BLKID ||
+	    db->db.db_object == DMU_META_DNODE_OBJECT ||
+	    dmu_tx_is_syncing(tx)) {
+		dmu_buf_will_dirty(db_fake, tx);
+		return;
+	}
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	spa = dn->dn_objset->os_spa;
+	/* We need the struct_rwlock to prevent db_blkptr from changing. */
+	if (!RW_WRITE_HELD(&dn->dn_struct_rwlock)) {
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+		drop_struct_lock = TRUE;
+	}
+
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	dr = db->db_last_dirty;
+	if (db->db_rmw_pending && dr != NULL && dr->dr_txg == tx->tx_txg &&
+	    dr->dt.dl.dr_written != NULL) {
+		/* join the read-modify-write under way */
+		dr->dt.dl.dr_rmw_writers++;
+		mutex_exit(&db->db_mtx);
+		if (drop_struct_lock)
+			rw_exit(&dn->dn_struct_rwlock);
+		DB_DNODE_EXIT(db);
+		(void) dbuf_dirty(db, tx);
+		return;
+	}
+
+	/*
+	 * Only a read from disk is worth deferring; holes and freed blocks
+	 * are zero filled by dbuf_read() straight away.
+	 */
+	if (db->db_state != DB_UNCACHED || dr != NULL ||
+	    db->db_blkptr == NULL || BP_IS_HOLE(db->db_blkptr) ||
+	    BP_IS_EMBEDDED(db->db_blkptr) ||
+	    dnode_block_freed(dn, db->db_blkid)) {
+		mutex_exit(&db->db_mtx);
+		if (drop_struct_lock)
+			rw_exit(&dn->dn_struct_rwlock);
+		DB_DNODE_EXIT(db);
+		dmu_buf_will_dirty(db_fake, tx);
+		return;
+	}
+
+	ASSERT3P(db->db_buf, ==, NULL);
+	dbuf_set_data(db, arc_alloc_buf(spa, db, DBUF_GET_BUFC_TYPE(db),
+	    db->db.db_size));
+	db->db_state = DB_FILL;
+	db->db_rmw_pending = TRUE;
+	mutex_exit(&db->db_mtx);
+
+	if (DBUF_IS_L2CACHEABLE(db))
+		aflags |= ARC_FLAG_L2CACHE;
+
+	SET_BOOKMARK(&zb, db->db_objset->os_dsl_dataset ?
+	    db->db_objset->os_dsl_dataset->ds_object : DMU_META_OBJSET,
+	    db->db.db_object, db->db_level, db->db_blkid);
+
+	dbuf_add_ref(db, NULL);
+
+	(void) arc_read(NULL, spa, db->db_blkptr, dbuf_rmw_read_done, db,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_MUSTSUCCEED, &aflags, &zb);
+
+	if (drop_struct_lock)
+		rw_exit(&dn->dn_struct_rwlock);
+	DB_DNODE_EXIT(db);
+
+	dr = dbuf_dirty(db, tx);
+
+	/* unless the block was in the ARC, and has been merged already */
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	if (db->db_rmw_pending) {
+		ASSERT3P(db->db_last_dirty, ==, dr);
+		dr->dt.dl.dr_written = range_tree_create(NULL, NULL,
+		    &db->db_mtx);
+		dr->dt.dl.dr_rmw_writers = 1;
+	}
+	mutex_exit(&db->db_mtx);
+}
+
+/*
+ * Finish a write started with dmu_buf_will_dirty_range(), of which len
+ * bytes at off were copied in.
+ */
+void
+dmu_buf_dirty_range_done(dmu_buf_t *db_fake, uint64_t off, uint64_t len,
+    dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dbuf_dirty_record_t *dr;
+	arc_buf_t *buf;
+
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	dr = db->db_last_dirty;
+	if (dr == NULL || dr->dr_txg != tx->tx_txg ||
+	    dr->dt.dl.dr_written == NULL) {
+		/* the write did not defer the read */
+		mutex_exit(&db->db_mtx);
+		return;
+	}
+
+	ASSERT(db->db_rmw_pending);
+	ASSERT3U(dr->dt.dl.dr_rmw_writers, >, 0);
+	if (len > 0) {
+		range_tree_clear(dr->dt.dl.dr_written, off, len);
+		range_tree_add(dr->dt.dl.dr_written, off, len);
+	}
+	buf = dr->dt.dl.dr_rmw_buf;
+	if (--dr->dt.dl.dr_rmw_writers == 0 && buf != NULL)
+		dbuf_rmw_merge(db, buf);
+	else
+		mutex_exit(&db->db_mtx);
+}
+
+/*
+ * Dirty a level 0 data block without changing it, so that it is written
+ * again compressed with compress instead of the dataset's algorithm.
+ * See dmu_recompress().
+ */
+void
+dmu_buf_will_recompress(dmu_buf_t *db_fake, enum zio_compress compress,
+    dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dbuf_dirty_record_t *dr;
+
+	ASSERT0(db->db_level);
+	ASSERT3U(db->db_blkid, !=, DMU_SPILL_BLKID);
+	ASSERT3U(compress, <, ZIO_COMPRESS_FUNCTIONS);
+
+	dmu_buf_will_dirty(db_fake, tx);
+
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	dr = db->db_last_dirty;
+	ASSERT3U(dr->dr_txg, ==, tx->tx_txg);
+	dr->dt.dl.dr_recompress = compress;
+	mutex_exit(&db->db_mtx);
+}
+
 void
 dmu_buf_will_not_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 {
 	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
 
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	while (db->db_rmw_pending)
+		cv_wait(&db->db_changed, &db->db_mtx);
 	db->db_state = DB_NOFILL;
+	mutex_exit(&db->db_mtx);
 
 	dmu_buf_will_fill(db_fake, tx);
 }
@@ -1948,7 +2621,7 @@ dmu_buf_will_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 void
 dbuf_fill_done(dmu_buf_impl_t *db, dmu_tx_t *tx)
 {
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	DBUF_VERIFY(db);
 
 	if (db->db_state == DB_FILL) {
@@ -2020,7 +2693,7 @@ dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx)
 	arc_return_buf(buf, db);
 	ASSERT(arc_released(buf));
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 
 	while (db->db_state == DB_READ || db->db_state == DB_FILL)
 		cv_wait(&db->db_changed, &db->db_mtx);
@@ -2081,9 +2754,11 @@ dbuf_destroy(dmu_buf_impl_t *db)
 	}
 
 	if (db->db_blkid == DMU_BONUS_BLKID) {
+		int slots = DB_DNODE(db)->dn_num_slots;
+		int bonuslen = DN_SLOTS_TO_BONUSLEN(slots);
 		ASSERT(db->db.db_data != NULL);
-		zio_buf_free(db->db.db_data, DN_MAX_BONUSLEN);
-		arc_space_return(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+		zio_buf_free(db->db.db_data, bonuslen);
+		arc_space_return(bonuslen, ARC_SPACE_OTHER);
 		db->db_state = DB_UNCACHED;
 	}
 
@@ -2093,6 +2768,7 @@ dbuf_destroy(dmu_buf_impl_t *db)
 		multilist_remove(dbuf_cache, db);
 		(void) refcount_remove_many(&dbuf_cache_size,
 		    db->db.db_size, db);
+		dbuf_stat_idle(db, -1);
 	}
 
 	ASSERT(db->db_state == DB_UNCACHED || db->db_state == DB_NOFILL);
@@ -2100,6 +2776,7 @@ dbuf_destroy(dmu_buf_impl_t *db)
 
 	db->db_state = DB_EVICTING;
 	db->db_blkptr = NULL;
+	dbuf_stat_update(db, -1, -(int64_t)db->db.db_size);
 
 	/*
 	 * Now that db_state is DB_EVICTING, nobody else can find this via
@@ -2171,10 +2848,10 @@ dbuf_findbp(dnode_t *dn, int level, uint64_t blkid, int fail_sparse,
 	ASSERT(blkid != DMU_BONUS_BLKID);
 
 	if (blkid == DMU_SPILL_BLKID) {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		if (dn->dn_have_spill &&
 		    (dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR))
-			*bpp = &dn->dn_phys->dn_spill;
+			*bpp = DN_SPILL_BLKPTR(dn->dn_phys);
 		else
 			*bpp = NULL;
 		dbuf_add_ref(dn->dn_dbuf, NULL);
@@ -2217,7 +2894,14 @@ dbuf_findbp(dnode_t *dn, int level, uint64_t blkid, int fail_sparse,
 	} else if (level < nlevels-1) {
 		/* this block is referenced from an indirect block */
 		int err;
-		if (dh == NULL) {
+		dmu_buf_impl_t *hint = (dh != NULL) ? dh->dh_parent_hint : NULL;
+		if (hint != NULL && hint->db_level == level + 1 &&
+		    hint->db_blkid == blkid >> epbs) {
+			/* the caller already holds our parent */
+			dbuf_add_ref(hint, NULL);
+			*parentp = hint;
+			err = 0;
+		} else if (dh == NULL) {
 			err = dbuf_hold_impl(dn, level+1, blkid >> epbs,
 					fail_sparse, FALSE, NULL, parentp);
 		} else {
@@ -2280,16 +2964,18 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_user_immediate_evict = FALSE;
 	db->db_freed_in_flight = FALSE;
 	db->db_pending_evict = FALSE;
+	db->db_stat_type = DBUF_STAT_TYPE(dn->dn_type);
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
-		db->db.db_size = DN_MAX_BONUSLEN -
+		db->db.db_size = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots) -
 		    (dn->dn_nblkptr-1) * sizeof (blkptr_t);
 		ASSERT3U(db->db.db_size, >=, dn->dn_bonuslen);
 		db->db.db_offset = DMU_BONUS_BLKID;
 		db->db_state = DB_UNCACHED;
 		/* the bonus dbuf is not placed in the hash table */
 		arc_space_consume(sizeof (dmu_buf_impl_t), ARC_SPACE_OTHER);
+		dbuf_stat_update(db, 1, db->db.db_size);
 		return (db);
 	} else if (blkid == DMU_SPILL_BLKID) {
 		db->db.db_size = (blkptr != NULL) ?
@@ -2322,6 +3008,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_state = DB_UNCACHED;
 	mutex_exit(&dn->dn_dbufs_mtx);
 	arc_space_consume(sizeof (dmu_buf_impl_t), ARC_SPACE_OTHER);
+	dbuf_stat_update(db, 1, db->db.db_size);
 
 	if (parent && parent != dn->dn_dbuf)
 		dbuf_add_ref(parent, db);
@@ -2532,6 +3219,9 @@ dbuf_prefetch(dnode_t *dn, int64_t level, uint64_t blkid, zio_priority_t prio,
 	dpa->dpa_curlevel = curlevel;
 	dpa->dpa_prio = prio;
 	dpa->dpa_aflags = aflags;
+	/* secondarycache=prefetch caches what is read ahead */
+	if (dn->dn_objset->os_secondary_cache == ZFS_CACHE_PREFETCH)
+		dpa->dpa_aflags |= ARC_FLAG_L2CACHE;
 	dpa->dpa_spa = dn->dn_objset->os_spa;
 	dpa->dpa_dnode = dn;
 	dpa->dpa_epbs = epbs;
@@ -2614,6 +3304,9 @@ __dbuf_hold_impl(struct dbuf_hold_impl_data *dh)
 			return (dh->dh_err);
 		dh->dh_db = dbuf_create(dh->dh_dn, dh->dh_level, dh->dh_blkid,
 					dh->dh_parent, dh->dh_bp);
+		DBUF_HOLD_STAT(dh->dh_dn, dhs_misses);
+	} else {
+		DBUF_HOLD_STAT(dh->dh_dn, dhs_hits);
 	}
 
 	if (dh->dh_fail_uncached && dh->dh_db->db_state != DB_CACHED) {
@@ -2650,9 +3343,11 @@ __dbuf_hold_impl(struct dbuf_hold_impl_data *dh)
 
 	if (multilist_link_active(&dh->dh_db->db_cache_link)) {
 		ASSERT(refcount_is_zero(&dh->dh_db->db_holds));
+		DBUF_HOLD_STAT(dh->dh_dn, dhs_reholds);
 		multilist_remove(dbuf_cache, dh->dh_db);
 		(void) refcount_remove_many(&dbuf_cache_size,
 			dh->dh_db->db.db_size, dh->dh_db);
+		dbuf_stat_idle(dh->dh_db, -1);
 	}
 	(void) refcount_add(&dh->dh_db->db_holds, dh->dh_tag);
 	DBUF_VERIFY(dh->dh_db);
@@ -2709,6 +3404,7 @@ __dbuf_hold_impl_init(struct dbuf_hold_impl_data *dh,
 	dh->dh_tag = tag;
 	dh->dh_dbp = dbp;
 	dh->dh_depth = depth;
+	dh->dh_parent_hint = NULL;
 }
 
 dmu_buf_impl_t *
@@ -2725,6 +3421,56 @@ dbuf_hold_level(dnode_t *dn, int level, uint64_t blkid, void *tag)
 	return (err ? NULL : db);
 }
 
+/*
+ * Hold the nblks level-0 dbufs starting at blkid, as that many calls to
+ * dbuf_hold() would, and return them in dbp.  The hold state is set up
+ * once for the whole range, and each block not yet in the dbuf hash
+ * reuses the level-1 parent of the block before it when they share one,
+ * instead of looking up and reading that indirect block again.
+ *
+ * On error, the dbufs held so far are left in dbp (the rest are NULL)
+ * for the caller to release.  dn_struct_rwlock must be held.
+ */
+int
+dbuf_hold_range(dnode_t *dn, uint64_t blkid, uint64_t nblks, void *tag,
+    dmu_buf_impl_t **dbp)
+{
+	struct dbuf_hold_impl_data *dh;
+	dmu_buf_impl_t *parent = NULL;
+	uint64_t i;
+	int error = 0;
+
+	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
+
+	dh = kmem_zalloc(sizeof (struct dbuf_hold_impl_data) *
+	    DBUF_HOLD_IMPL_MAX_DEPTH, KM_SLEEP);
+
+	for (i = 0; i < nblks; i++) {
+		__dbuf_hold_impl_init(dh, dn, 0, blkid + i, FALSE, FALSE,
+		    tag, &dbp[i], 0);
+		dh->dh_parent_hint = parent;
+
+		error = __dbuf_hold_impl(dh);
+		if (error != 0)
+			break;
+
+		/*
+		 * dbp[i] holds its parent, so the parent stays valid as a
+		 * hint for the next block for as long as we hold dbp[i].
+		 */
+		mutex_enter(&dbp[i]->db_mtx);
+		parent = dbp[i]->db_parent;
+		mutex_exit(&dbp[i]->db_mtx);
+		if (parent != NULL && parent->db_level != 1)
+			parent = NULL;
+	}
+
+	kmem_free(dh, sizeof (struct dbuf_hold_impl_data) *
+	    DBUF_HOLD_IMPL_MAX_DEPTH);
+
+	return (error);
+}
+
 void
 dbuf_create_bonus(dnode_t *dn)
 {
@@ -2804,7 +3550,7 @@ dbuf_try_add_ref(dmu_buf_t *db_fake, objset_t *os, uint64_t obj, uint64_t blkid,
 void
 dbuf_rele(dmu_buf_impl_t *db, void *tag)
 {
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	dbuf_rele_and_unlock(db, tag);
 }
 
@@ -2912,6 +3658,7 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag)
 				multilist_insert(dbuf_cache, db);
 				(void) refcount_add_many(&dbuf_cache_size,
 					db->db.db_size, db);
+				dbuf_stat_idle(db, 1);
 				mutex_exit(&db->db_mtx);
 
 				dbuf_evict_notify();
@@ -2939,7 +3686,7 @@ dmu_buf_replace_user(dmu_buf_t *db_fake, dmu_buf_user_t *old_user,
 {
 	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	dbuf_verify_user(db, DBVU_NOT_EVICTING);
 	if (db->db_user == old_user)
 		db->db_user = new_user;
@@ -3026,7 +3773,7 @@ dbuf_check_blkptr(dnode_t *dn, dmu_buf_impl_t *db)
 		return;
 
 	if (db->db_blkid == DMU_SPILL_BLKID) {
-		db->db_blkptr = &dn->dn_phys->dn_spill;
+		db->db_blkptr = DN_SPILL_BLKPTR(dn->dn_phys);
 		BP_ZERO(db->db_blkptr);
 		return;
 	}
@@ -3052,7 +3799,7 @@ dbuf_check_blkptr(dnode_t *dn, dmu_buf_impl_t *db)
 			parent = dbuf_hold_level(dn, db->db_level + 1,
 									 db->db_blkid >> epbs, db);
 			rw_exit(&dn->dn_struct_rwlock);
-			mutex_enter(&db->db_mtx);
+			zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 			db->db_parent = parent;
 		}
 		db->db_blkptr = (blkptr_t *)parent->db.db_data +
@@ -3077,7 +3824,7 @@ dbuf_sync_indirect(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 
 	dprintf_dbuf_bp(db, db->db_blkptr, "blkptr=%p", db->db_blkptr);
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 
 	ASSERT(db->db_level > 0);
 	DBUF_VERIFY(db);
@@ -3086,7 +3833,7 @@ dbuf_sync_indirect(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	if (db->db_buf == NULL) {
 		mutex_exit(&db->db_mtx);
 		(void) dbuf_read(db, NULL, DB_RF_MUST_SUCCEED);
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	}
 	ASSERT3U(db->db_state, ==, DB_CACHED);
 	ASSERT(db->db_buf != NULL);
@@ -3130,7 +3877,12 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 
 	dprintf_dbuf_bp(db, db->db_blkptr, "blkptr=%p", db->db_blkptr);
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+	/* see dmu_buf_will_dirty_range() */
+	while (db->db_rmw_pending)
+		cv_wait(&db->db_changed, &db->db_mtx);
+	ASSERT3P(dr->dt.dl.dr_written, ==, NULL);
+
 	/*
 	 * To be synced, we must be dirtied.  But we
 	 * might have been freed after the dirty.
@@ -3150,7 +3902,7 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	dn = DB_DNODE(db);
 
 	if (db->db_blkid == DMU_SPILL_BLKID) {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		dn->dn_phys->dn_flags |= DNODE_FLAG_SPILL_BLKPTR;
 		mutex_exit(&dn->dn_mtx);
 	}
@@ -3166,14 +3918,17 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 
 		ASSERT(*datap != NULL);
 		ASSERT0(db->db_level);
-		ASSERT3U(dn->dn_phys->dn_bonuslen, <=, DN_MAX_BONUSLEN);
+		ASSERT3U(dn->dn_phys->dn_bonuslen, <=,
+		    DN_SLOTS_TO_BONUSLEN(dn->dn_phys->dn_extra_slots + 1));
 		bcopy(*datap, DN_BONUS(dn->dn_phys), dn->dn_phys->dn_bonuslen);
-		DB_DNODE_EXIT(db);
 
 		if (*datap != db->db.db_data) {
-			zio_buf_free(*datap, DN_MAX_BONUSLEN);
-			arc_space_return(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+			int slots = dn->dn_num_slots;
+			int bonuslen = DN_SLOTS_TO_BONUSLEN(slots);
+			zio_buf_free(*datap, bonuslen);
+			arc_space_return(bonuslen, ARC_SPACE_OTHER);
 		}
+		DB_DNODE_EXIT(db);
 		db->db_data_pending = NULL;
 		drp = &db->db_last_dirty;
 		while (*drp != dr)
@@ -3326,18 +4081,18 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 		ASSERT(BP_GET_LEVEL(bp) == db->db_level);
 	}
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 
 #ifdef ZFS_DEBUG
 	if (db->db_blkid == DMU_SPILL_BLKID) {
 		ASSERT(dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR);
 		ASSERT(!(BP_IS_HOLE(bp)) &&
-		    db->db_blkptr == &dn->dn_phys->dn_spill);
+		    db->db_blkptr == DN_SPILL_BLKPTR(dn->dn_phys));
 	}
 #endif
 
 	if (db->db_level == 0) {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		if (db->db_blkid > dn->dn_phys->dn_maxblkid &&
 		    db->db_blkid != DMU_SPILL_BLKID)
 			dn->dn_phys->dn_maxblkid = db->db_blkid;
@@ -3345,9 +4100,9 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 
 		if (dn->dn_type == DMU_OT_DNODE) {
 			dnode_phys_t *dnp = db->db.db_data;
-			for (i = db->db.db_size >> DNODE_SHIFT; i > 0;
-			    i--, dnp++) {
-				if (dnp->dn_type != DMU_OT_NONE)
+			for (i = 0; i < db->db.db_size >> DNODE_SHIFT;
+			    i += dnp[i].dn_extra_slots + 1) {
+				if (dnp[i].dn_type != DMU_OT_NONE)
 					fill++;
 			}
 		} else {
@@ -3432,7 +4187,6 @@ dbuf_write_physdone(zio_t *zio, arc_buf_t *buf, void *arg)
 {
 	dmu_buf_impl_t *db = arg;
 	objset_t *os = db->db_objset;
-	dsl_pool_t *dp = dmu_objset_pool(os);
 	dbuf_dirty_record_t *dr;
 	int delta = 0;
 
@@ -3443,10 +4197,10 @@ dbuf_write_physdone(zio_t *zio, arc_buf_t *buf, void *arg)
 	 * The callback will be called io_phys_children times.  Retire one
 	 * portion of our dirty space each time we are called.  Any rounding
 	 * error will be cleaned up by dsl_pool_sync()'s call to
-	 * dsl_pool_undirty_space().
+	 * dsl_pool_undirty_space(), and dmu_objset_dirty_done().
 	 */
 	delta = dr->dr_accounted / zio->io_phys_children;
-	dsl_pool_undirty_space(dp, delta, zio->io_txg);
+	dmu_objset_undirty_space(os, delta, zio->io_txg);
 }
 
 /* ARGSUSED */
@@ -3475,7 +4229,7 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		dsl_dataset_block_born(ds, bp, tx);
 	}
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 
 	DBUF_VERIFY(db);
 
@@ -3495,7 +4249,7 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		dn = DB_DNODE(db);
 		ASSERT(dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR);
 		ASSERT(!(BP_IS_HOLE(db->db_blkptr)) &&
-		    db->db_blkptr == &dn->dn_phys->dn_spill);
+		    db->db_blkptr == DN_SPILL_BLKPTR(dn->dn_phys));
 		DB_DNODE_EXIT(db);
 	}
 #endif
@@ -3563,7 +4317,7 @@ dbuf_write_override_done(zio_t *zio)
 	dmu_buf_impl_t *db = dr->dr_dbuf;
 	blkptr_t *obp = &dr->dt.dl.dr_overridden_by;
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	if (!BP_EQUAL(zio->io_bp, obp)) {
 		if (!BP_IS_HOLE(obp))
 			dsl_free(spa_get_dsl(zio->io_spa), zio->io_txg, obp);
@@ -3572,6 +4326,9 @@ dbuf_write_override_done(zio_t *zio)
 	mutex_exit(&db->db_mtx);
 
 	dbuf_write_done(zio, NULL, db);
+
+	if (zio->io_abd != NULL)
+		abd_put(zio->io_abd);
 }
 
 /* Issue I/O to commit a dirty buffer to disk. */
@@ -3650,6 +4407,21 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 	    arc_get_compression(data) : ZIO_COMPRESS_INHERIT, &zp);
 	DB_DNODE_EXIT(db);
 
+	/*
+	 * A block dirtied by dmu_buf_will_recompress() is being written
+	 * only for the sake of its new compression: nopwrite would see the
+	 * unchanged checksum and skip it, and the streak heuristic might
+	 * not try the algorithm at all.
+	 */
+	if (db->db_level == 0 && db->db_state != DB_NOFILL &&
+	    dr->dt.dl.dr_recompress != ZIO_COMPRESS_INHERIT &&
+	    dr->dt.dl.dr_override_state == DR_NOT_OVERRIDDEN &&
+	    (data == NULL || arc_get_compression(data) == ZIO_COMPRESS_OFF)) {
+		zp.zp_compress = dr->dt.dl.dr_recompress;
+		zp.zp_nopwrite = B_FALSE;
+		zp.zp_compress_streak = NULL;
+	}
+
 	/*
 	 * We copy the blkptr now (rather than when we instantiate the dirty
 	 * record), because its value can change between open context and
@@ -3664,14 +4436,15 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 		 * The BP for this block has been provided by open context
 		 * (by dmu_sync() or dmu_buf_write_embedded()).
 		 */
-		void *contents = (data != NULL) ? data->b_data : NULL;
+		abd_t *contents = (data != NULL) ?
+		    abd_get_from_buf(data->b_data, db->db.db_size) : NULL;
 
 		dr->dr_zio = zio_write(zio, os->os_spa, txg, &dr->dr_bp_copy,
 		    contents, db->db.db_size, db->db.db_size, &zp,
 		    dbuf_write_override_ready, NULL, NULL,
 		    dbuf_write_override_done,
 		    dr, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_MUSTSUCCEED, &zb);
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		dr->dt.dl.dr_override_state = DR_NOT_OVERRIDDEN;
 		zio_write_override(dr->dr_zio, &dr->dt.dl.dr_overridden_by,
 		    dr->dt.dl.dr_copies, dr->dt.dl.dr_nopwrite);
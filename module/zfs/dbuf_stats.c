@@ -28,6 +28,13 @@
  */
 int zfs_dbuf_state_index = 0;
 
+/*
+ * Export every dbuf in the dbufs kstat.  This walks and locks the whole
+ * dbuf hash table for each read, so it is meant for debugging only; the
+ * dbuftypes and dbufobjsets kstats carry the running totals.
+ */
+int zfs_dbuf_stats_dump = 0;
+
 /*
  * ==========================================================================
  * Dbuf Hash Read Routines
@@ -37,7 +44,8 @@ typedef struct dbuf_stats_t {
 	kmutex_t		lock;
 	kstat_t			*kstat;
 	dbuf_hash_table_t	*hash;
-	int			idx;
+	int			shard;
+	uint64_t		idx;
 } dbuf_stats_t;
 
 static dbuf_stats_t dbuf_stats_hash_table;
@@ -131,16 +139,17 @@ static int
 dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 {
 	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
-	dbuf_hash_table_t *h = dsh->hash;
+	dbuf_hash_shard_t *hs = &dsh->hash->hash_shards[dsh->shard];
+	kmutex_t *hmtx = DBUF_HASH_MUTEX(hs, dsh->idx);
 	dmu_buf_impl_t *db;
 	int length, error = 0;
 
-	ASSERT3S(dsh->idx, >=, 0);
-	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
 	memset(buf, 0, size);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
-	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
+	mutex_enter(hmtx);
+	/* the shard may have grown since dbuf_stats_hash_table_addr() */
+	db = (dsh->idx <= hs->hs_mask) ? hs->hs_table[dsh->idx] : NULL;
+	for (; db != NULL; db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
 		 * to be called with a larger scratch buffers.
@@ -150,8 +159,8 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 			break;
 		}
 
-		mutex_enter(&db->db_mtx);
-		mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+		mutex_exit(hmtx);
 
 		if (db->db_state != DB_EVICTING) {
 			length = __dbuf_stats_hash_table_data(buf, size, db);
@@ -160,9 +169,9 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 		}
 
 		mutex_exit(&db->db_mtx);
-		mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
+		mutex_enter(hmtx);
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+	mutex_exit(hmtx);
 
 	return (error);
 }
@@ -171,12 +180,25 @@ static void *
 dbuf_stats_hash_table_addr(kstat_t *ksp, off_t n)
 {
 	dbuf_stats_t *dsh = ksp->ks_private;
+	dbuf_hash_table_t *h = dsh->hash;
+	uint64_t idx = n;
+	int i;
 
 	ASSERT(MUTEX_HELD(&dsh->lock));
 
-	if (n <= dsh->hash->hash_table_mask) {
-		dsh->idx = n;
-		return (dsh);
+	if (!zfs_dbuf_stats_dump)
+		return (NULL);
+
+	/* the buckets of all shards, one shard after another */
+	for (i = 0; i < h->hash_nshards; i++) {
+		uint64_t buckets = h->hash_shards[i].hs_mask + 1;
+
+		if (idx < buckets) {
+			dsh->shard = i;
+			dsh->idx = idx;
+			return (dsh);
+		}
+		idx -= buckets;
 	}
 
 	return (NULL);
@@ -218,19 +240,402 @@ dbuf_stats_hash_table_destroy(void)
 	mutex_destroy(&dsh->lock);
 }
 
+/*
+ * ==========================================================================
+ * Dbuf Hold Routines
+ * ==========================================================================
+ */
+static kmutex_t dbuf_stats_types_lock;
+static kstat_t *dbuf_stats_types_kstat;
+
+static int
+dbuf_stats_types_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size,
+	    "%-5s %-14s %-14s %-14s %-10s %-14s %-10s %-10s %-14s\n",
+	    "dtype", "hits", "reholds", "misses", "dbufs", "dbbytes",
+	    "dbind", "dbidle", "dbidlesz");
+
+	return (0);
+}
+
+static int
+dbuf_stats_types_data(char *buf, size_t size, void *data)
+{
+	dbuf_hold_stats_t *dhs = data;
+	int type = (int)(dhs - dbuf_hold_stats);
+	dbuf_type_stats_t *dts = &dbuf_type_stats[type];
+
+	(void) snprintf(buf, size,
+	    "%-5d %-14llu %-14llu %-14llu %-10llu %-14llu %-10llu %-10llu "
+	    "%-14llu\n", type, (u_longlong_t)dhs->dhs_hits,
+	    (u_longlong_t)dhs->dhs_reholds, (u_longlong_t)dhs->dhs_misses,
+	    (u_longlong_t)dts->dts_dbufs, (u_longlong_t)dts->dts_bytes,
+	    (u_longlong_t)dts->dts_indirect, (u_longlong_t)dts->dts_idle,
+	    (u_longlong_t)dts->dts_idle_bytes);
+
+	return (0);
+}
+
+static void *
+dbuf_stats_types_addr(kstat_t *ksp, off_t n)
+{
+	if (n <= DMU_OT_NUMTYPES)
+		return (&dbuf_hold_stats[n]);
+
+	return (NULL);
+}
+
+static void
+dbuf_stats_types_init(void)
+{
+	kstat_t *ksp;
+
+	mutex_init(&dbuf_stats_types_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ksp = kstat_create("zfs", 0, "dbuftypes", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	dbuf_stats_types_kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &dbuf_stats_types_lock;
+		ksp->ks_ndata = DMU_OT_NUMTYPES + 1;
+		kstat_set_raw_ops(ksp, dbuf_stats_types_headers,
+		    dbuf_stats_types_data, dbuf_stats_types_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+dbuf_stats_types_destroy(void)
+{
+	if (dbuf_stats_types_kstat)
+		kstat_delete(dbuf_stats_types_kstat);
+
+	mutex_destroy(&dbuf_stats_types_lock);
+}
+
+/*
+ * ==========================================================================
+ * Dbuf Objset Routines
+ * ==========================================================================
+ */
+static kmutex_t dbuf_stats_objsets_lock;
+static list_t dbuf_stats_objsets;
+static kstat_t *dbuf_stats_objsets_kstat;
+
+void
+dbuf_stats_objset_register(objset_t *os)
+{
+	mutex_enter(&dbuf_stats_objsets_lock);
+	list_insert_tail(&dbuf_stats_objsets, os);
+	mutex_exit(&dbuf_stats_objsets_lock);
+}
+
+void
+dbuf_stats_objset_unregister(objset_t *os)
+{
+	mutex_enter(&dbuf_stats_objsets_lock);
+	list_remove(&dbuf_stats_objsets, os);
+	mutex_exit(&dbuf_stats_objsets_lock);
+}
+
+static int
+dbuf_stats_objsets_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size,
+	    "%-16s %-8s %-10s %-14s %-10s %-10s %-14s\n",
+	    "pool", "objset", "dbufs", "dbbytes", "dbind", "dbidle",
+	    "dbidlesz");
+
+	return (0);
+}
+
+static int
+dbuf_stats_objsets_data(char *buf, size_t size, void *data)
+{
+	objset_t *os = data;
+
+	(void) snprintf(buf, size,
+	    "%-16s %-8llu %-10llu %-14llu %-10llu %-10llu %-14llu\n",
+	    spa_name(os->os_spa), (u_longlong_t)dmu_objset_id(os),
+	    (u_longlong_t)os->os_dbufs, (u_longlong_t)os->os_dbuf_bytes,
+	    (u_longlong_t)os->os_dbuf_indirect, (u_longlong_t)os->os_dbuf_idle,
+	    (u_longlong_t)os->os_dbuf_idle_bytes);
+
+	return (0);
+}
+
+static void *
+dbuf_stats_objsets_addr(kstat_t *ksp, off_t n)
+{
+	objset_t *os;
+
+	ASSERT(MUTEX_HELD(&dbuf_stats_objsets_lock));
+
+	for (os = list_head(&dbuf_stats_objsets); os != NULL && n > 0;
+	    os = list_next(&dbuf_stats_objsets, os))
+		n--;
+
+	return (os);
+}
+
+static void
+dbuf_stats_objsets_init(void)
+{
+	kstat_t *ksp;
+
+	mutex_init(&dbuf_stats_objsets_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&dbuf_stats_objsets, sizeof (objset_t),
+	    offsetof(objset_t, os_dbuf_stats_node));
+
+	ksp = kstat_create("zfs", 0, "dbufobjsets", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	dbuf_stats_objsets_kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &dbuf_stats_objsets_lock;
+		ksp->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(ksp, dbuf_stats_objsets_headers,
+		    dbuf_stats_objsets_data, dbuf_stats_objsets_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+dbuf_stats_objsets_destroy(void)
+{
+	if (dbuf_stats_objsets_kstat)
+		kstat_delete(dbuf_stats_objsets_kstat);
+
+	list_destroy(&dbuf_stats_objsets);
+	mutex_destroy(&dbuf_stats_objsets_lock);
+}
+
+/*
+ * ==========================================================================
+ * Dbuf Cache Routines
+ * ==========================================================================
+ */
+typedef struct dbuf_cache_kstats {
+	kstat_named_t	size;
+	kstat_named_t	target;
+	kstat_named_t	evicts;
+} dbuf_cache_kstats_t;
+
+static dbuf_cache_kstats_t dbuf_cache_kstats = {
+	{ "cache_size",		KSTAT_DATA_UINT64 },
+	{ "cache_target",	KSTAT_DATA_UINT64 },
+	{ "cache_evicts",	KSTAT_DATA_UINT64 },
+};
+
+kstat_t *dbuf_stats_cache_kstat;
+
+static int
+dbuf_stats_cache_update(kstat_t *ksp, int rw)
+{
+	dbuf_cache_kstats_t *dck = ksp->ks_data;
+	dbuf_cache_stats_t dcs;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	dbuf_cache_stats_get(&dcs);
+	dck->size.value.ui64 = dcs.dcs_size;
+	dck->target.value.ui64 = dcs.dcs_target;
+	dck->evicts.value.ui64 = dcs.dcs_evicts;
+
+	return (0);
+}
+
+static void
+dbuf_stats_cache_init(void)
+{
+	kstat_t *ksp;
+
+	ksp = kstat_create("zfs", 0, "dbufcachestats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_cache_kstats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	dbuf_stats_cache_kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_data = &dbuf_cache_kstats;
+		ksp->ks_update = dbuf_stats_cache_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+dbuf_stats_cache_destroy(void)
+{
+	if (dbuf_stats_cache_kstat)
+		kstat_delete(dbuf_stats_cache_kstat);
+}
+
+/*
+ * ==========================================================================
+ * Dbuf Hash Table Statistics
+ * ==========================================================================
+ */
+typedef struct dbuf_hash_kstats {
+	kstat_named_t	shards;
+	kstat_named_t	buckets;
+	kstat_named_t	elements;
+	kstat_named_t	collisions;
+	kstat_named_t	chains;
+	kstat_named_t	chain_max;
+	kstat_named_t	resizes;
+} dbuf_hash_kstats_t;
+
+static dbuf_hash_kstats_t dbuf_hash_kstats = {
+	{ "hash_shards",	KSTAT_DATA_UINT64 },
+	{ "hash_buckets",	KSTAT_DATA_UINT64 },
+	{ "hash_elements",	KSTAT_DATA_UINT64 },
+	{ "hash_collisions",	KSTAT_DATA_UINT64 },
+	{ "hash_chains",	KSTAT_DATA_UINT64 },
+	{ "hash_chain_max",	KSTAT_DATA_UINT64 },
+	{ "hash_resizes",	KSTAT_DATA_UINT64 },
+};
+
+kstat_t *dbuf_stats_hash_kstat;
+
+static int
+dbuf_stats_hash_update(kstat_t *ksp, int rw)
+{
+	dbuf_hash_kstats_t *dhk = ksp->ks_data;
+	dbuf_hash_stats_t dht;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	dbuf_hash_stats_get(&dht);
+	dhk->shards.value.ui64 = dht.dht_shards;
+	dhk->buckets.value.ui64 = dht.dht_buckets;
+	dhk->elements.value.ui64 = dht.dht_elements;
+	dhk->collisions.value.ui64 = dht.dht_collisions;
+	dhk->chains.value.ui64 = dht.dht_chains;
+	dhk->chain_max.value.ui64 = dht.dht_chain_max;
+	dhk->resizes.value.ui64 = dht.dht_resizes;
+
+	return (0);
+}
+
+static void
+dbuf_stats_hash_init(void)
+{
+	kstat_t *ksp;
+
+	ksp = kstat_create("zfs", 0, "dbufhashstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_hash_kstats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	dbuf_stats_hash_kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_data = &dbuf_hash_kstats;
+		ksp->ks_update = dbuf_stats_hash_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+dbuf_stats_hash_destroy(void)
+{
+	if (dbuf_stats_hash_kstat)
+		kstat_delete(dbuf_stats_hash_kstat);
+}
+
+/*
+ * ==========================================================================
+ * Dbuf User Eviction Statistics
+ * ==========================================================================
+ */
+typedef struct dbuf_evict_user_kstats {
+	kstat_named_t	queues;
+	kstat_named_t	queued;
+	kstat_named_t	queued_max;
+	kstat_named_t	evicts;
+	kstat_named_t	batches;
+} dbuf_evict_user_kstats_t;
+
+static dbuf_evict_user_kstats_t dbuf_evict_user_kstats = {
+	{ "user_evict_queues",		KSTAT_DATA_UINT64 },
+	{ "user_evict_queued",		KSTAT_DATA_UINT64 },
+	{ "user_evict_queued_max",	KSTAT_DATA_UINT64 },
+	{ "user_evicts",		KSTAT_DATA_UINT64 },
+	{ "user_evict_batches",		KSTAT_DATA_UINT64 },
+};
+
+kstat_t *dbuf_stats_evict_user_kstat;
+
+static int
+dbuf_stats_evict_user_update(kstat_t *ksp, int rw)
+{
+	dbuf_evict_user_kstats_t *deuk = ksp->ks_data;
+	dbuf_evict_user_stats_t deus;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	dbuf_evict_user_stats_get(&deus);
+	deuk->queues.value.ui64 = deus.deus_queues;
+	deuk->queued.value.ui64 = deus.deus_queued;
+	deuk->queued_max.value.ui64 = deus.deus_queued_max;
+	deuk->evicts.value.ui64 = deus.deus_evicts;
+	deuk->batches.value.ui64 = deus.deus_batches;
+
+	return (0);
+}
+
+static void
+dbuf_stats_evict_user_init(void)
+{
+	kstat_t *ksp;
+
+	ksp = kstat_create("zfs", 0, "dbufevictstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_evict_user_kstats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	dbuf_stats_evict_user_kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_data = &dbuf_evict_user_kstats;
+		ksp->ks_update = dbuf_stats_evict_user_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+dbuf_stats_evict_user_destroy(void)
+{
+	if (dbuf_stats_evict_user_kstat)
+		kstat_delete(dbuf_stats_evict_user_kstat);
+}
+
 void
 dbuf_stats_init(dbuf_hash_table_t *hash)
 {
 	dbuf_stats_hash_table_init(hash);
+	dbuf_stats_types_init();
+	dbuf_stats_objsets_init();
+	dbuf_stats_cache_init();
+	dbuf_stats_hash_init();
+	dbuf_stats_evict_user_init();
 }
 
 void
 dbuf_stats_destroy(void)
 {
+	dbuf_stats_evict_user_destroy();
+	dbuf_stats_hash_destroy();
+	dbuf_stats_cache_destroy();
+	dbuf_stats_objsets_destroy();
+	dbuf_stats_types_destroy();
 	dbuf_stats_hash_table_destroy();
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(zfs_dbuf_state_index, int, 0644);
 MODULE_PARM_DESC(zfs_dbuf_state_index, "Calculate arc header index");
+
+module_param(zfs_dbuf_stats_dump, int, 0644);
+MODULE_PARM_DESC(zfs_dbuf_stats_dump, "Export every dbuf in the dbufs kstat");
 #endif
@@ -39,12 +39,48 @@
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
+static kmem_cache_t *ddt_cache_entry_cache;
 
 /*
  * Enable/disable prefetching of dedup-ed blocks which are going to be freed.
  */
 int zfs_dedup_prefetch = 0;
 
+/*
+ * The DDT entry cache keeps compact copies of the entries that were
+ * written out by recent txgs, so that another write, free or scrub of a
+ * dedup-ed block whose entry was recently seen does not have to look it
+ * up in the DDT ZAP objects, whose blocks must otherwise compete with
+ * everything else for space in the ARC.  It is sized separately, by
+ * zfs_ddt_cache_max bytes shared by all DDTs (default 1/64 of memory),
+ * and each DDT's cache is split into DDT_CACHE_SHARDS shards by hash so
+ * that concurrent zio threads rarely contend on a lock.
+ *
+ * An entry lives either in the cache or in ddt_tree, never both:
+ * ddt_lookup() takes it out of the cache and ddt_sync_entry() puts it
+ * back once the on-disk copy is up to date, so the cache always matches
+ * the DDT objects.
+ */
+uint64_t zfs_ddt_cache_max = 0;
+static uint64_t ddt_cache_size = 0;
+
+/*
+ * Unique entries, those of blocks written only once, make up most of a
+ * typical DDT and are only there in case another copy of the block is
+ * written.  Once one is zfs_ddt_prune_age txgs old it is pruned, on the
+ * grounds that a block which has not been deduplicated by then most likely
+ * never will be; up to zfs_ddt_prune_batch entries are pruned per DDT each
+ * txg.  The block's bps keep their dedup bit, so when it is freed
+ * zio_ddt_free() finds no entry and frees it like any other block.  0
+ * disables pruning.
+ *
+ * Separately, the "dedupquota" pool property caps the on-disk size of the
+ * DDT: while it is exceeded, dedup writes which would add an entry are
+ * written as ordinary blocks instead (see zio_ddt_write()).
+ */
+uint64_t zfs_ddt_prune_age = 0;
+int zfs_ddt_prune_batch = 1000;
+
 static const ddt_ops_t *ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -656,6 +692,202 @@ ddt_exit(ddt_t *ddt)
 	mutex_exit(&ddt->ddt_lock);
 }
 
+static int
+ddt_key_compare(const ddt_key_t *k1, const ddt_key_t *k2)
+{
+	const uint64_t *u1 = (const uint64_t *)k1;
+	const uint64_t *u2 = (const uint64_t *)k2;
+	int i;
+
+	for (i = 0; i < DDT_KEY_WORDS; i++) {
+		if (u1[i] < u2[i])
+			return (-1);
+		if (u1[i] > u2[i])
+			return (1);
+	}
+
+	return (0);
+}
+
+static int
+ddt_cache_compare(const void *x1, const void *x2)
+{
+	const ddt_cache_entry_t *dce1 = x1;
+	const ddt_cache_entry_t *dce2 = x2;
+
+	return (ddt_key_compare(&dce1->dce_key, &dce2->dce_key));
+}
+
+static ddt_cache_shard_t *
+ddt_cache_shard(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	return (&ddt->ddt_dce_shard[ddk->ddk_cksum.zc_word[0] %
+	    DDT_CACHE_SHARDS]);
+}
+
+static void
+ddt_cache_remove(ddt_cache_shard_t *dcs, ddt_cache_entry_t *dce)
+{
+	ASSERT(MUTEX_HELD(&dcs->dcs_lock));
+
+	avl_remove(&dcs->dcs_tree, dce);
+	list_remove(&dcs->dcs_lru, dce);
+	atomic_add_64(&ddt_cache_size, -sizeof (ddt_cache_entry_t));
+	kmem_cache_free(ddt_cache_entry_cache, dce);
+}
+
+/*
+ * If the entry is cached, move it from the cache into dde, which is about
+ * to be modified.
+ */
+static boolean_t
+ddt_cache_take(ddt_t *ddt, ddt_entry_t *dde)
+{
+	ddt_cache_shard_t *dcs = ddt_cache_shard(ddt, &dde->dde_key);
+	ddt_cache_entry_t *dce, dce_search;
+
+	dce_search.dce_key = dde->dde_key;
+
+	mutex_enter(&dcs->dcs_lock);
+	dce = avl_find(&dcs->dcs_tree, &dce_search, NULL);
+	if (dce == NULL) {
+		mutex_exit(&dcs->dcs_lock);
+		return (B_FALSE);
+	}
+	bzero(dde->dde_phys, sizeof (dde->dde_phys));
+	dde->dde_phys[dce->dce_phys_type] = dce->dce_phys;
+	dde->dde_type = dce->dce_type;
+	dde->dde_class = dce->dce_class;
+	ddt_cache_remove(dcs, dce);
+	mutex_exit(&dcs->dcs_lock);
+
+	return (B_TRUE);
+}
+
+/*
+ * Drop an entry from the cache when it is removed from the DDT objects
+ * behind the cache's back.
+ */
+static void
+ddt_cache_drop(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	ddt_cache_shard_t *dcs = ddt_cache_shard(ddt, ddk);
+	ddt_cache_entry_t *dce, dce_search;
+
+	dce_search.dce_key = *ddk;
+
+	mutex_enter(&dcs->dcs_lock);
+	if ((dce = avl_find(&dcs->dcs_tree, &dce_search, NULL)) != NULL)
+		ddt_cache_remove(dcs, dce);
+	mutex_exit(&dcs->dcs_lock);
+}
+
+/*
+ * Return the class of a cached entry, or DDT_CLASSES if it is not cached.
+ */
+static enum ddt_class
+ddt_cache_class(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	ddt_cache_shard_t *dcs = ddt_cache_shard(ddt, ddk);
+	ddt_cache_entry_t *dce, dce_search;
+	enum ddt_class class = DDT_CLASSES;
+
+	dce_search.dce_key = *ddk;
+
+	mutex_enter(&dcs->dcs_lock);
+	dce = avl_find(&dcs->dcs_tree, &dce_search, NULL);
+	if (dce != NULL) {
+		class = dce->dce_class;
+		list_remove(&dcs->dcs_lru, dce);
+		list_insert_head(&dcs->dcs_lru, dce);
+	}
+	mutex_exit(&dcs->dcs_lock);
+
+	return (class);
+}
+
+/*
+ * Cache an entry whose on-disk copy has just been updated, evicting the
+ * least recently used entries of its shard to stay within
+ * zfs_ddt_cache_max.
+ */
+static void
+ddt_cache_insert(ddt_t *ddt, const ddt_entry_t *dde)
+{
+	ddt_cache_shard_t *dcs = ddt_cache_shard(ddt, &dde->dde_key);
+	ddt_cache_entry_t *dce, *old;
+	avl_index_t where;
+	int p, phys_type = -1;
+
+	for (p = 0; p < DDT_PHYS_TYPES; p++) {
+		if (dde->dde_phys[p].ddp_phys_birth == 0)
+			continue;
+		if (phys_type != -1)
+			return;
+		phys_type = p;
+	}
+	if (phys_type == -1 || zfs_ddt_cache_max < sizeof (*dce))
+		return;
+
+	dce = kmem_cache_alloc(ddt_cache_entry_cache, KM_SLEEP);
+	dce->dce_key = dde->dde_key;
+	dce->dce_phys = dde->dde_phys[phys_type];
+	dce->dce_phys_type = phys_type;
+	dce->dce_type = dde->dde_type;
+	dce->dce_class = dde->dde_class;
+
+	mutex_enter(&dcs->dcs_lock);
+	if ((old = avl_find(&dcs->dcs_tree, dce, &where)) != NULL) {
+		ddt_cache_remove(dcs, old);
+		(void) avl_find(&dcs->dcs_tree, dce, &where);
+	}
+	avl_insert(&dcs->dcs_tree, dce, where);
+	list_insert_head(&dcs->dcs_lru, dce);
+	atomic_add_64(&ddt_cache_size, sizeof (ddt_cache_entry_t));
+
+	while (ddt_cache_size > zfs_ddt_cache_max &&
+	    (old = list_tail(&dcs->dcs_lru)) != NULL)
+		ddt_cache_remove(dcs, old);
+	mutex_exit(&dcs->dcs_lock);
+}
+
+static void
+ddt_cache_create(ddt_t *ddt)
+{
+	int i;
+
+	for (i = 0; i < DDT_CACHE_SHARDS; i++) {
+		ddt_cache_shard_t *dcs = &ddt->ddt_dce_shard[i];
+
+		mutex_init(&dcs->dcs_lock, NULL, MUTEX_DEFAULT, NULL);
+		avl_create(&dcs->dcs_tree, ddt_cache_compare,
+		    sizeof (ddt_cache_entry_t),
+		    offsetof(ddt_cache_entry_t, dce_node));
+		list_create(&dcs->dcs_lru, sizeof (ddt_cache_entry_t),
+		    offsetof(ddt_cache_entry_t, dce_lru));
+	}
+}
+
+static void
+ddt_cache_destroy(ddt_t *ddt)
+{
+	ddt_cache_entry_t *dce;
+	int i;
+
+	for (i = 0; i < DDT_CACHE_SHARDS; i++) {
+		ddt_cache_shard_t *dcs = &ddt->ddt_dce_shard[i];
+
+		mutex_enter(&dcs->dcs_lock);
+		while ((dce = list_head(&dcs->dcs_lru)) != NULL)
+			ddt_cache_remove(dcs, dce);
+		mutex_exit(&dcs->dcs_lock);
+
+		list_destroy(&dcs->dcs_lru);
+		avl_destroy(&dcs->dcs_tree);
+		mutex_destroy(&dcs->dcs_lock);
+	}
+}
+
 void
 ddt_init(void)
 {
@@ -663,11 +895,18 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_cache_entry_cache = kmem_cache_create("ddt_cache_entry_cache",
+	    sizeof (ddt_cache_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+
+	if (zfs_ddt_cache_max == 0)
+		zfs_ddt_cache_max = (uint64_t)physmem * PAGESIZE / 64;
 }
 
 void
 ddt_fini(void)
 {
+	ASSERT0(ddt_cache_size);
+	kmem_cache_destroy(ddt_cache_entry_cache);
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
@@ -696,9 +935,8 @@ ddt_free(ddt_entry_t *dde)
 	for (p = 0; p < DDT_PHYS_TYPES; p++)
 		ASSERT(dde->dde_lead_zio[p] == NULL);
 
-	if (dde->dde_repair_data != NULL)
-		zio_buf_free(dde->dde_repair_data,
-		    DDK_GET_PSIZE(&dde->dde_key));
+	if (dde->dde_repair_abd != NULL)
+		abd_free(dde->dde_repair_abd);
 
 	cv_destroy(&dde->dde_cv);
 	kmem_cache_free(ddt_entry_cache, dde);
@@ -746,14 +984,21 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	error = ENOENT;
 
-	for (type = 0; type < DDT_TYPES; type++) {
-		for (class = 0; class < DDT_CLASSES; class++) {
-			error = ddt_object_lookup(ddt, type, class, dde);
+	if (ddt_cache_take(ddt, dde)) {
+		type = dde->dde_type;
+		class = dde->dde_class;
+		error = 0;
+	} else {
+		for (type = 0; type < DDT_TYPES; type++) {
+			for (class = 0; class < DDT_CLASSES; class++) {
+				error = ddt_object_lookup(ddt, type, class,
+				    dde);
+				if (error != ENOENT)
+					break;
+			}
 			if (error != ENOENT)
 				break;
 		}
-		if (error != ENOENT)
-			break;
 	}
 
 	ASSERT(error == 0 || error == ENOENT);
@@ -776,16 +1021,18 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	return (dde);
 }
 
-void
-ddt_prefetch(spa_t *spa, const blkptr_t *bp)
+/*
+ * Prefetch the DDT entry of a dedup block unless it is in the DDT entry
+ * cache.  Returns B_TRUE if any prefetch was issued.
+ */
+boolean_t
+ddt_prefetch_entry(spa_t *spa, const blkptr_t *bp)
 {
 	ddt_t *ddt;
 	ddt_entry_t dde;
 	enum ddt_type type;
 	enum ddt_class class;
-
-	if (!zfs_dedup_prefetch || bp == NULL || !BP_GET_DEDUP(bp))
-		return;
+	boolean_t issued = B_FALSE;
 
 	/*
 	 * We only remove the DDT once all tables are empty and only
@@ -795,11 +1042,28 @@ ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 	ddt = ddt_select(spa, bp);
 	ddt_key_fill(&dde.dde_key, bp);
 
+	if (ddt_cache_class(ddt, &dde.dde_key) != DDT_CLASSES)
+		return (B_FALSE);
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class < DDT_CLASSES; class++) {
-			ddt_object_prefetch(ddt, type, class, &dde);
+			if (ddt_object_exists(ddt, type, class)) {
+				ddt_object_prefetch(ddt, type, class, &dde);
+				issued = B_TRUE;
+			}
 		}
 	}
+
+	return (issued);
+}
+
+void
+ddt_prefetch(spa_t *spa, const blkptr_t *bp)
+{
+	if (!zfs_dedup_prefetch || bp == NULL || !BP_GET_DEDUP(bp))
+		return;
+
+	(void) ddt_prefetch_entry(spa, bp);
 }
 
 int
@@ -807,18 +1071,8 @@ ddt_entry_compare(const void *x1, const void *x2)
 {
 	const ddt_entry_t *dde1 = x1;
 	const ddt_entry_t *dde2 = x2;
-	const uint64_t *u1 = (const uint64_t *)&dde1->dde_key;
-	const uint64_t *u2 = (const uint64_t *)&dde2->dde_key;
-	int i;
 
-	for (i = 0; i < DDT_KEY_WORDS; i++) {
-		if (u1[i] < u2[i])
-			return (-1);
-		if (u1[i] > u2[i])
-			return (1);
-	}
-
-	return (0);
+	return (ddt_key_compare(&dde1->dde_key, &dde2->dde_key));
 }
 
 static ddt_t *
@@ -834,6 +1088,7 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
 	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	ddt_cache_create(ddt);
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
@@ -848,10 +1103,35 @@ ddt_table_free(ddt_t *ddt)
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
 	avl_destroy(&ddt->ddt_tree);
 	avl_destroy(&ddt->ddt_repair_tree);
+	ddt_cache_destroy(ddt);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
 
+/*
+ * On-disk size of all the DDT objects as of the last time they were synced
+ */
+static uint64_t
+ddt_get_dsize(spa_t *spa)
+{
+	uint64_t dsize = 0;
+	enum zio_checksum c;
+	enum ddt_type type;
+	enum ddt_class class;
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		for (type = 0; type < DDT_TYPES; type++) {
+			for (class = 0; class < DDT_CLASSES; class++) {
+				dsize += ddt->ddt_object_stats[type][class].
+				    ddo_dspace;
+			}
+		}
+	}
+
+	return (dsize);
+}
+
 void
 ddt_create(spa_t *spa)
 {
@@ -880,6 +1160,12 @@ ddt_load(spa_t *spa)
 	if (error)
 		return (error == ENOENT ? 0 : error);
 
+	spa->spa_ddt_pruned = 0;
+	error = zap_lookup(spa->spa_meta_objset, spa->spa_ddt_stat_object,
+	    DDT_PRUNED_ENTRIES, sizeof (uint64_t), 1, &spa->spa_ddt_pruned);
+	if (error != 0 && error != ENOENT)
+		return (error);
+
 	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
 		ddt_t *ddt = spa->spa_ddt[c];
 		for (type = 0; type < DDT_TYPES; type++) {
@@ -898,6 +1184,8 @@ ddt_load(spa_t *spa)
 		    sizeof (ddt->ddt_histogram));
 	}
 
+	spa->spa_dedup_dsize = ddt_get_dsize(spa);
+
 	return (0);
 }
 
@@ -925,7 +1213,11 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 	if (!BP_GET_DEDUP(bp))
 		return (B_FALSE);
 
-	if (max_class == DDT_CLASS_UNIQUE)
+	/*
+	 * Every dedup block is in the DDT, so it is contained in the unique
+	 * class or below -- unless its entry has been pruned.
+	 */
+	if (max_class == DDT_CLASS_UNIQUE && !ddt_pruned(spa))
 		return (B_TRUE);
 
 	ddt = spa->spa_ddt[BP_GET_CHECKSUM(bp)];
@@ -933,6 +1225,11 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 
 	ddt_key_fill(&(dde->dde_key), bp);
 
+	if ((class = ddt_cache_class(ddt, &dde->dde_key)) != DDT_CLASSES) {
+		kmem_cache_free(ddt_entry_cache, dde);
+		return (class <= max_class);
+	}
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class <= max_class; class++) {
 			if (ddt_object_lookup(ddt, type, class, dde) == 0) {
@@ -983,7 +1280,7 @@ ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde)
 
 	ddt_enter(ddt);
 
-	if (dde->dde_repair_data != NULL && spa_writeable(ddt->ddt_spa) &&
+	if (dde->dde_repair_abd != NULL && spa_writeable(ddt->ddt_spa) &&
 	    avl_find(&ddt->ddt_repair_tree, dde, &where) == NULL)
 		avl_insert(&ddt->ddt_repair_tree, dde, where);
 	else
@@ -1021,7 +1318,7 @@ ddt_repair_entry(ddt_t *ddt, ddt_entry_t *dde, ddt_entry_t *rdde, zio_t *rio)
 			continue;
 		ddt_bp_create(ddt->ddt_checksum, ddk, ddp, &blk);
 		zio_nowait(zio_rewrite(zio, zio->io_spa, 0, &blk,
-		    rdde->dde_repair_data, DDK_GET_PSIZE(rddk), NULL, NULL,
+		    rdde->dde_repair_abd, DDK_GET_PSIZE(rddk), NULL, NULL,
 		    ZIO_PRIORITY_SYNC_WRITE, ZIO_DDT_CHILD_FLAGS(zio), NULL));
 	}
 
@@ -1117,7 +1414,34 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 			dsl_scan_ddt_entry(dp->dp_scan,
 			    ddt->ddt_checksum, dde, tx);
 		}
+
+		ddt_cache_insert(ddt, dde);
+	}
+}
+
+/*
+ * Prefetch the DDT object leaf that syncing this entry will modify: the
+ * one it is in now, or for a new entry the one it is most likely to be
+ * added to.
+ */
+static void
+ddt_sync_prefetch(ddt_t *ddt, ddt_entry_t *dde)
+{
+	enum ddt_type type = dde->dde_type;
+	enum ddt_class class = dde->dde_class;
+
+	if (type == DDT_TYPES) {
+		type = DDT_TYPE_CURRENT;
+		if (dde->dde_phys[DDT_PHYS_DITTO].ddp_phys_birth != 0)
+			class = DDT_CLASS_DITTO;
+		else if (ddt_phys_total_refcnt(dde) > 1)
+			class = DDT_CLASS_DUPLICATE;
+		else
+			class = DDT_CLASS_UNIQUE;
 	}
+
+	if (ddt_object_exists(ddt, type, class))
+		ddt_object_prefetch(ddt, type, class, dde);
 }
 
 static void
@@ -1140,10 +1464,24 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 		    DMU_POOL_DDT_STATS, tx);
 	}
 
-	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
+	/*
+	 * Apply the updates in key order.  For the checksums which dedup
+	 * uses, the key is also the ZAP hash (see ddt_object_create()), so
+	 * updates falling in the same ZAP leaf are made one after the other
+	 * and each leaf is dirtied once per txg.  Prefetch all of the leaves
+	 * first so that their reads are issued together, rather than one at
+	 * a time as each update needs its leaf.
+	 */
+	for (dde = avl_first(&ddt->ddt_tree); dde != NULL;
+	    dde = AVL_NEXT(&ddt->ddt_tree, dde))
+		ddt_sync_prefetch(ddt, dde);
+
+	for (dde = avl_first(&ddt->ddt_tree); dde != NULL;
+	    dde = AVL_NEXT(&ddt->ddt_tree, dde))
 		ddt_sync_entry(ddt, dde, tx, txg);
+
+	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL)
 		ddt_free(dde);
-	}
 
 	for (type = 0; type < DDT_TYPES; type++) {
 		uint64_t count = 0;
@@ -1163,6 +1501,118 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 	    sizeof (ddt->ddt_histogram));
 }
 
+/*
+ * Prune up to zfs_ddt_prune_batch unique entries older than
+ * zfs_ddt_prune_age txgs, continuing the walk of the unique class where
+ * the previous txg left off.
+ */
+static uint64_t
+ddt_prune_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
+{
+	enum ddt_type type = DDT_TYPE_CURRENT;
+	enum ddt_class class = DDT_CLASS_UNIQUE;
+	ddt_entry_t *dde;
+	uint64_t pruned = 0;
+	int n, p;
+
+	if (!ddt_object_exists(ddt, type, class))
+		return (0);
+
+	dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+
+	for (n = 0; n < zfs_ddt_prune_batch; n++) {
+		boolean_t old = B_TRUE;
+
+		if (ddt_object_walk(ddt, type, class, &ddt->ddt_prune_cursor,
+		    dde) != 0) {
+			ddt->ddt_prune_cursor = 0;
+			break;
+		}
+
+		for (p = 0; p < DDT_PHYS_TYPES; p++) {
+			uint64_t birth = dde->dde_phys[p].ddp_phys_birth;
+
+			if (birth != 0 && birth + zfs_ddt_prune_age > txg)
+				old = B_FALSE;
+		}
+		if (!old || ddt_phys_total_refcnt(dde) > 1 ||
+		    dde->dde_phys[DDT_PHYS_DITTO].ddp_phys_birth != 0)
+			continue;
+
+		/*
+		 * Leave alone an entry which is being modified; it will
+		 * come around again.
+		 */
+		ddt_enter(ddt);
+		if (avl_find(&ddt->ddt_tree, dde, NULL) != NULL) {
+			ddt_exit(ddt);
+			continue;
+		}
+		ddt_exit(ddt);
+
+		dde->dde_type = type;
+		dde->dde_class = class;
+		ddt_stat_update(ddt, dde, -1ULL);
+		VERIFY0(ddt_object_remove(ddt, type, class, dde, tx));
+		ddt_cache_drop(ddt, &dde->dde_key);
+		pruned++;
+	}
+
+	kmem_cache_free(ddt_entry_cache, dde);
+
+	if (pruned != 0) {
+		ddt_object_sync(ddt, type, class, tx);
+		bcopy(ddt->ddt_histogram, &ddt->ddt_histogram_cache,
+		    sizeof (ddt->ddt_histogram));
+	}
+
+	return (pruned);
+}
+
+static void
+ddt_prune(spa_t *spa, dmu_tx_t *tx, uint64_t txg)
+{
+	uint64_t pruned = 0;
+	enum zio_checksum c;
+
+	if (zfs_ddt_prune_age == 0 || spa_sync_pass(spa) != 1 ||
+	    spa->spa_ddt_stat_object == 0)
+		return;
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		if (spa->spa_ddt[c] != NULL)
+			pruned += ddt_prune_table(spa->spa_ddt[c], tx, txg);
+	}
+
+	if (pruned != 0) {
+		spa->spa_ddt_pruned += pruned;
+		VERIFY0(zap_update(spa->spa_meta_objset,
+		    spa->spa_ddt_stat_object, DDT_PRUNED_ENTRIES,
+		    sizeof (uint64_t), 1, &spa->spa_ddt_pruned, tx));
+	}
+}
+
+/*
+ * Whether the DDT has outgrown the pool's dedupquota, in which case no new
+ * entries are created.
+ */
+boolean_t
+ddt_over_quota(spa_t *spa)
+{
+	return (spa->spa_dedup_quota != 0 &&
+	    spa->spa_dedup_dsize >= spa->spa_dedup_quota);
+}
+
+/*
+ * Whether unique entries have ever been pruned from the pool's DDT, so
+ * that dedup blocks may have no entry.
+ */
+boolean_t
+ddt_pruned(spa_t *spa)
+{
+	return (spa->spa_ddt_pruned != 0);
+}
+
 void
 ddt_sync(spa_t *spa, uint64_t txg)
 {
@@ -1185,6 +1635,9 @@ ddt_sync(spa_t *spa, uint64_t txg)
 
 	(void) zio_wait(rio);
 
+	ddt_prune(spa, tx, txg);
+	spa->spa_dedup_dsize = ddt_get_dsize(spa);
+
 	dmu_tx_commit(tx);
 }
 
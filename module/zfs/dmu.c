@@ -46,6 +46,8 @@
 #include <sys/zio_compress.h>
 #include <sys/sa.h>
 #include <sys/zfeature.h>
+#include <sys/abd.h>
+#include <sys/zfs_lockstat.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <sys/zfs_znode.h>
@@ -479,18 +481,44 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 
 	zio = zio_root(dn->dn_objset->os_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
 	blkid = dbuf_whichblock(dn, 0, offset);
-	for (i = 0; i < nblks; i++) {
-		dmu_buf_impl_t *db = dbuf_hold(dn, blkid + i, tag);
-		if (db == NULL) {
-			rw_exit(&dn->dn_struct_rwlock);
-			dmu_buf_rele_array(dbp, nblks, tag);
-			zio_nowait(zio);
-			return (SET_ERROR(EIO));
+
+	/*
+	 * Holding each dbuf reads its level-1 indirect block synchronously
+	 * if that is not cached yet, so a large cold read would otherwise
+	 * wait for one indirect block at a time.  Start the reads of all
+	 * the level-1 blocks the request spans up front so they are in
+	 * flight together; dbuf_prefetch() does nothing for those already
+	 * cached.
+	 */
+	if (read && dn->dn_nlevels > 1 && nblks > 1) {
+		int epbs = dn->dn_indblkshift - SPA_BLKPTRSHIFT;
+		uint64_t l1_first = blkid >> epbs;
+		uint64_t l1_last = (blkid + nblks - 1) >> epbs;
+		uint64_t l1;
+
+		if (l1_last > l1_first) {
+			for (l1 = l1_first; l1 <= l1_last; l1++) {
+				dbuf_prefetch(dn, 1, l1,
+				    ZIO_PRIORITY_SYNC_READ, 0);
+			}
+		}
+	}
+
+	err = dbuf_hold_range(dn, blkid, nblks, tag,
+	    (dmu_buf_impl_t **)dbp);
+	if (err != 0) {
+		rw_exit(&dn->dn_struct_rwlock);
+		dmu_buf_rele_array(dbp, nblks, tag);
+		zio_nowait(zio);
+		return (SET_ERROR(EIO));
+	}
+
+	/* initiate async i/o */
+	if (read) {
+		for (i = 0; i < nblks; i++) {
+			(void) dbuf_read((dmu_buf_impl_t *)dbp[i], zio,
+			    dbuf_flags);
 		}
-		/* initiate async i/o */
-		if (read)
-			(void) dbuf_read(db, zio, dbuf_flags);
-		dbp[i] = &db->db;
 	}
 
 	if ((flags & DMU_READ_NO_PREFETCH) == 0 &&
@@ -511,7 +539,7 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 	if (read) {
 		for (i = 0; i < nblks; i++) {
 			dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
-			mutex_enter(&db->db_mtx);
+			zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 			while (db->db_state == DB_READ ||
 			    db->db_state == DB_FILL)
 				cv_wait(&db->db_changed, &db->db_mtx);
@@ -656,10 +684,14 @@ dmu_prefetch(objset_t *os, uint64_t object, int64_t level, uint64_t offset,
  *
  * On input, *start should be the first offset that does not need to be
  * freed (e.g. "offset + length").  On return, *start will be the first
- * offset that should be freed.
+ * offset that should be freed and *l1blks the number of allocated level 1
+ * indirects the chunk covers, i.e. roughly how many indirect blocks freeing
+ * it will dirty.  For a sparse object this is much smaller than the length
+ * of the chunk would suggest.
  */
 static int
-get_next_chunk(dnode_t *dn, uint64_t *start, uint64_t minimum)
+get_next_chunk(dnode_t *dn, uint64_t *start, uint64_t minimum,
+    uint64_t *l1blks)
 {
 	uint64_t maxblks = DMU_MAX_ACCESS >> (dn->dn_indblkshift + 1);
 	/* bytes of data covered by a level-1 indirect block */
@@ -670,6 +702,7 @@ get_next_chunk(dnode_t *dn, uint64_t *start, uint64_t minimum)
 	ASSERT3U(minimum, <=, *start);
 
 	if (*start - minimum <= iblkrange * maxblks) {
+		*l1blks = MAX(1, howmany(*start - minimum, iblkrange));
 		*start = minimum;
 		return (0);
 	}
@@ -701,6 +734,7 @@ get_next_chunk(dnode_t *dn, uint64_t *start, uint64_t minimum)
 	}
 	if (*start < minimum)
 		*start = minimum;
+	*l1blks = MAX(1, blks);
 	return (0);
 }
 
@@ -746,7 +780,7 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 		length = object_size - offset;
 
 	while (length != 0) {
-		uint64_t chunk_end, chunk_begin, chunk_len;
+		uint64_t chunk_end, chunk_begin, chunk_len, l1blks;
 		uint64_t long_free_dirty_all_txgs = 0;
 		dmu_tx_t *tx;
 
@@ -756,7 +790,7 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 		chunk_end = chunk_begin = offset + length;
 
 		/* move chunk_begin backwards to the beginning of this chunk */
-		err = get_next_chunk(dn, &chunk_begin, offset);
+		err = get_next_chunk(dn, &chunk_begin, offset, &l1blks);
 		if (err)
 			return (err);
 		ASSERT3U(chunk_begin, >=, offset);
@@ -778,6 +812,7 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 		 */
 		if (dirty_frees_threshold != 0 &&
 		    long_free_dirty_all_txgs >= dirty_frees_threshold) {
+			DMU_TX_STAT_BUMP(dmu_tx_dirty_frees_delay);
 			txg_wait_open(dp, 0);
 			continue;
 		}
@@ -796,9 +831,17 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 			return (err);
 		}
 
+		/*
+		 * Charge the txg with the indirect blocks this chunk dirties
+		 * rather than with its length.  What fills up a txg when
+		 * freeing is the rewritten indirects; charging the length
+		 * made every chunk of a huge sparse range (a deleted VM
+		 * image, a zvol unmapped as a whole) wait for a txg of its
+		 * own, so that freeing one took minutes of txgs.
+		 */
 		mutex_enter(&dp->dp_lock);
 		dp->dp_long_free_dirty_pertxg[dmu_tx_get_txg(tx) & TXG_MASK] +=
-		    chunk_len;
+		    l1blks << dn->dn_indblkshift;
 		mutex_exit(&dp->dp_lock);
 		DTRACE_PROBE3(free__long__range,
 		    uint64_t, long_free_dirty_all_txgs, uint64_t, chunk_len,
@@ -973,12 +1016,14 @@ dmu_write_impl(dmu_buf_t **dbp, int numbufs, uint64_t offset, uint64_t size,
 		if (tocpy == db->db_size)
 			dmu_buf_will_fill(db, tx);
 		else
-			dmu_buf_will_dirty(db, tx);
+			dmu_buf_will_dirty_range(db, bufoff, tocpy, tx);
 
 		(void) memcpy((char *)db->db_data + bufoff, buf, tocpy);
 
 		if (tocpy == db->db_size)
 			dmu_buf_fill_done(db, tx);
+		else
+			dmu_buf_dirty_range_done(db, bufoff, tocpy, tx);
 
 		offset += tocpy;
 		size -= tocpy;
@@ -1362,7 +1407,7 @@ dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
 		if (tocpy == db->db_size)
 			dmu_buf_will_fill(db, tx);
 		else
-			dmu_buf_will_dirty(db, tx);
+			dmu_buf_will_dirty_range(db, bufoff, tocpy, tx);
 
 		/*
 		 * XXX uiomove could block forever (eg.nfs-backed
@@ -1373,8 +1418,12 @@ dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
 		err = uiomove((char *)db->db_data + bufoff, tocpy,
 		    UIO_WRITE, uio);
 
+		/* only what uiomove() got to is known to be written */
 		if (tocpy == db->db_size)
 			dmu_buf_fill_done(db, tx);
+		else
+			dmu_buf_dirty_range_done(db, bufoff,
+			    uio_offset(uio) - db->db_offset - bufoff, tx);
 
 		if (err)
 			break;
@@ -1464,38 +1513,31 @@ dmu_read_iokit(objset_t *os, uint64_t object, uint64_t *offset,
     dprintf("dmu_read_iokit: memoffset %llu offset %llu size %llu\n",
            *offset, position+*offset, *size);
 
-	while (*size > 0) {
-
-        for (i = 0; i < numbufs; i++) {
-            int tocpy;
-            int bufoff;
-            dmu_buf_t *db = dbp[i];
-            uint64_t done;
-
-            ASSERT(size > 0);
-
-            //bufoff = uio->uio_loffset - db->db_offset;
-            bufoff = (position+*offset) - db->db_offset;
-            tocpy = (int)MIN(db->db_size - bufoff, *size);
+	/*
+	 * Each block is copied exactly once, from the dbuf's arc buf
+	 * straight into the descriptor.
+	 */
+	for (i = 0; i < numbufs; i++) {
+		uint64_t tocpy;
+		int64_t bufoff;
+		dmu_buf_t *db = dbp[i];
+		uint64_t done;
 
-            /*
-              err = uiomove((char *)db->db_data + bufoff, tocpy,
-              UIO_READ, uio);
-            */
+		ASSERT(*size > 0);
 
-            done = zvolIO_kit_read(iomem,
-                                   *offset,
-                                   (char *)db->db_data + bufoff,
-                                   tocpy);
+		bufoff = (position+*offset) - db->db_offset;
+		tocpy = MIN(db->db_size - bufoff, *size);
 
-            if (done > 0) {
-                (*offset) += done;
-                (*size) -= done;
-            }
+		done = zvolIO_kit_read(iomem, *offset,
+		    (char *)db->db_data + bufoff, tocpy);
+		if (done != tocpy) {
+			err = EIO;
+			break;
+		}
 
-            //size -= tocpy;
-        }
-    }
+		(*offset) += done;
+		(*size) -= done;
+	}
 	dmu_buf_rele_array(dbp, numbufs, FTAG);
 
 	return (err);
@@ -1525,8 +1567,10 @@ dmu_read_iokit_dbuf(dmu_buf_t *zdb, uint64_t object, uint64_t *offset,
 	 */
 	err = dmu_buf_hold_array_by_dnode(dn, (position+*offset), *size,
 									  TRUE, FTAG, &numbufs, &dbp, 0);
-	if (err)
+	if (err) {
+		DB_DNODE_EXIT(db);
 		return (err);
+	}
 
 	for (i = 0; i < numbufs; i++) {
 		uint64_t tocpy;
@@ -1544,7 +1588,7 @@ dmu_read_iokit_dbuf(dmu_buf_t *zdb, uint64_t object, uint64_t *offset,
 							   (char *)db->db_data + bufoff,
 							   tocpy);
 
-		if (!done) {
+		if (done != tocpy) {
 			err = EIO;
 			break;
 		}
@@ -1559,6 +1603,14 @@ dmu_read_iokit_dbuf(dmu_buf_t *zdb, uint64_t object, uint64_t *offset,
 	return (err);
 }
 
+/*
+ * Write from an IOMemoryDescriptor into the dbufs of a dnode.  Blocks that
+ * are completely overwritten are filled into a loaned arc buf straight
+ * from the descriptor and then assigned to their dbuf, rather than being
+ * copied into the dbuf's own data.  This saves the dbuf_fix_old_data()
+ * copy when the block is still being synced out from an earlier txg, and
+ * leaves partial blocks as the only ones that need read-modify-write.
+ */
 static int
 dmu_write_iokit_dnode(dnode_t *dn, uint64_t *offset, uint64_t position,
     uint64_t *size, struct iomem *iomem, dmu_tx_t *tx)
@@ -1568,61 +1620,56 @@ dmu_write_iokit_dnode(dnode_t *dn, uint64_t *offset, uint64_t position,
 	int err = 0;
 	int i;
 
-	//err = dmu_buf_hold_array_by_dnode(dn, uio->uio_loffset, size,
-    //   FALSE, FTAG, &numbufs, &dbp, DMU_READ_PREFETCH);
 	err = dmu_buf_hold_array_by_dnode(dn, *offset+position, *size,
 	    FALSE, FTAG, &numbufs, &dbp, DMU_READ_PREFETCH);
 	if (err)
 		return (err);
 
-    dprintf("dmu_write_iokit_done: memoffset %llu offset %llu size %llu\n",
-           *offset, *offset + position, *size);
-
-    while(*size > 0) {
-
-        for (i = 0; i < numbufs; i++) {
-            int tocpy;
-            int bufoff;
-            uint64_t done;
-            dmu_buf_t *db = dbp[i];
-
-            ASSERT(size > 0);
-
-            //bufoff = uio->uio_loffset - db->db_offset;
-            bufoff = (position + *offset) - db->db_offset;
-            tocpy = (int)MIN(db->db_size - bufoff, *size);
-
-            ASSERT(i == 0 || i == numbufs-1 || tocpy == db->db_size);
-
-            if (tocpy == db->db_size)
-                dmu_buf_will_fill(db, tx);
-            else
-                dmu_buf_will_dirty(db, tx);
-
-            /*
-             * XXX uiomove could block forever (eg.nfs-backed
-             * pages).  There needs to be a uiolockdown() function
-             * to lock the pages in memory, so that uiomove won't
-             * block.
-             */
-            /*
-              err = uiomove((char *)db->db_data + bufoff, tocpy,
-              UIO_WRITE, uio);
-            */
-            done = zvolIO_kit_write(iomem,
-                                    *offset,
-                                    (char *)db->db_data + bufoff,
-                                    tocpy);
-
-            if (tocpy == db->db_size)
-                dmu_buf_fill_done(db, tx);
-
-            if (done > 0) {
-                *offset += done;
-                *size -= done;
-            }
-        }
-    }
+	dprintf("dmu_write_iokit_done: memoffset %llu offset %llu size %llu\n",
+	    *offset, *offset + position, *size);
+
+	for (i = 0; i < numbufs; i++) {
+		uint64_t tocpy;
+		int64_t bufoff;
+		uint64_t done;
+		dmu_buf_t *db = dbp[i];
+
+		ASSERT(*size > 0);
+
+		bufoff = (position + *offset) - db->db_offset;
+		tocpy = MIN(db->db_size - bufoff, *size);
+
+		ASSERT(i == 0 || i == numbufs-1 || tocpy == db->db_size);
+
+		if (tocpy == db->db_size) {
+			arc_buf_t *abuf;
+
+			abuf = arc_loan_buf(dn->dn_objset->os_spa, B_FALSE,
+			    db->db_size);
+
+			done = zvolIO_kit_write(iomem, *offset,
+			    (char *)abuf->b_data, tocpy);
+			if (done != tocpy) {
+				dmu_return_arcbuf(abuf);
+				err = EIO;
+				break;
+			}
+
+			dbuf_assign_arcbuf((dmu_buf_impl_t *)db, abuf, tx);
+		} else {
+			dmu_buf_will_dirty(db, tx);
+
+			done = zvolIO_kit_write(iomem, *offset,
+			    (char *)db->db_data + bufoff, tocpy);
+			if (done != tocpy) {
+				err = EIO;
+				break;
+			}
+		}
+
+		*offset += done;
+		*size -= done;
+	}
 
 	dmu_buf_rele_array(dbp, numbufs, FTAG);
 	return (err);
@@ -1636,7 +1683,7 @@ dmu_write_iokit_dbuf(dmu_buf_t *zdb, uint64_t *offset, uint64_t position,
 	dnode_t *dn;
 	int err;
 
-	if (size == 0)
+	if (*size == 0)
 		return (0);
 
 	DB_DNODE_ENTER(db);
@@ -1763,7 +1810,7 @@ dmu_sync_done(zio_t *zio, arc_buf_t *buf, void *varg)
 	dbuf_dirty_record_t *dr = dsa->dsa_dr;
 	dmu_buf_impl_t *db = dr->dr_dbuf;
 
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 	ASSERT(dr->dt.dl.dr_override_state == DR_IN_DMU_SYNC);
 	if (zio->io_error == 0) {
 		dr->dt.dl.dr_nopwrite = !!(zio->io_flags & ZIO_FLAG_NOPWRITE);
@@ -1812,6 +1859,8 @@ dmu_sync_late_arrival_done(zio_t *zio)
 	dmu_sync_arg_t *dsa = zio->io_private;
 	ASSERTV(blkptr_t *bp_orig = &zio->io_bp_orig);
 
+	abd_put(zio->io_abd);
+
 	if (zio->io_error == 0 && !BP_IS_HOLE(bp)) {
 		/*
 		 * If we didn't allocate a new block (i.e. ZIO_FLAG_NOPWRITE)
@@ -1857,7 +1906,8 @@ dmu_sync_late_arrival(zio_t *pio, objset_t *os, dmu_sync_cb_t *done, zgd_t *zgd,
 	dsa->dsa_tx = tx;
 
 	zio_nowait(zio_write(pio, os->os_spa, dmu_tx_get_txg(tx), zgd->zgd_bp,
-	    zgd->zgd_db->db_data, zgd->zgd_db->db_size, zgd->zgd_db->db_size,
+	    abd_get_from_buf(zgd->zgd_db->db_data, zgd->zgd_db->db_size),
+	    zgd->zgd_db->db_size, zgd->zgd_db->db_size,
         zp, dmu_sync_late_arrival_ready, NULL,
         NULL, dmu_sync_late_arrival_done, dsa, ZIO_PRIORITY_SYNC_WRITE,
         ZIO_FLAG_CANFAIL, zb));
@@ -1927,7 +1977,7 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 	 * but it begins to sync a moment later, that's OK because the
 	 * sync thread will block in dbuf_sync_leaf() until we drop db_mtx.
 	 */
-	mutex_enter(&db->db_mtx);
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 
 	if (txg <= spa_last_synced_txg(os->os_spa)) {
 		/*
@@ -2019,6 +2069,116 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 	return (0);
 }
 
+/*
+ * Early write support: write the level-0 block associated with db as it
+ * was dirtied in txg, which has been quiesced but has not yet begun to
+ * sync (see zfs_txg_early_write).  The block is written the way dmu_sync()
+ * writes it for the intent log: dbuf_sync_leaf() either finds the dirty
+ * record DR_OVERRIDDEN and just hands its block pointer to the parent, or
+ * waits for the write to finish while it is DR_IN_DMU_SYNC.  If the write
+ * fails the record reverts to DR_NOT_OVERRIDDEN and is written normally.
+ *
+ * Unlike dmu_sync() the caller does not keep the data from changing, so
+ * the dirty record is given its own copy of the data before the write is
+ * issued.  Otherwise a writer in the open txg could redirty the dbuf and
+ * dbuf_fix_old_data() would move the record, not db_buf, to a new copy.
+ *
+ * Returns 0 if the write was issued, in which case done is called when it
+ * completes, or EBUSY/EALREADY if there is nothing to do.
+ */
+int
+dmu_write_early(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
+{
+	blkptr_t *bp = zgd->zgd_bp;
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)zgd->zgd_db;
+	objset_t *os = db->db_objset;
+	dsl_dataset_t *ds = os->os_dsl_dataset;
+	dbuf_dirty_record_t *dr;
+	dmu_sync_arg_t *dsa;
+	zbookmark_phys_t zb;
+	zio_prop_t zp;
+	dnode_t *dn;
+
+	ASSERT(pio != NULL);
+	ASSERT(ds != NULL);
+	ASSERT0(db->db_level);
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+	ASSERT(db->db_blkid != DMU_SPILL_BLKID);
+
+	/* ziltest relies on nothing past the freeze txg reaching disk */
+	if (txg > spa_freeze_txg(os->os_spa))
+		return (SET_ERROR(EBUSY));
+
+	SET_BOOKMARK(&zb, ds->ds_object,
+	    db->db.db_object, db->db_level, db->db_blkid);
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	dmu_write_policy(os, dn, db->db_level, WP_DMU_SYNC,
+	    ZIO_COMPRESS_INHERIT, &zp);
+	DB_DNODE_EXIT(db);
+
+	/*
+	 * As in dmu_sync(), db_mtx is the barrier with dbuf_sync_leaf().
+	 * The txg is only handed to the sync thread once all of its early
+	 * writes have been issued, so it can't be syncing yet; the check
+	 * only guards against a caller that got that wrong.
+	 */
+	zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
+
+	if (txg <= spa_syncing_txg(os->os_spa) || db->db_state != DB_CACHED) {
+		mutex_exit(&db->db_mtx);
+		return (SET_ERROR(EBUSY));
+	}
+
+	dr = db->db_last_dirty;
+	while (dr && dr->dr_txg != txg)
+		dr = dr->dr_next;
+
+	if (dr == NULL || dr->dt.dl.dr_override_state != DR_NOT_OVERRIDDEN ||
+	    dr->dt.dl.dr_data == NULL ||
+	    arc_get_compression(dr->dt.dl.dr_data) != ZIO_COMPRESS_OFF) {
+		mutex_exit(&db->db_mtx);
+		return (SET_ERROR(EALREADY));
+	}
+
+	/* see the nopwrite comment in dmu_sync() */
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	if (dr->dr_next != NULL || dnode_block_freed(dn, db->db_blkid))
+		zp.zp_nopwrite = B_FALSE;
+	DB_DNODE_EXIT(db);
+
+	if (dr->dt.dl.dr_data == db->db_buf) {
+		arc_buf_t *buf = arc_alloc_buf(os->os_spa, db,
+		    DBUF_GET_BUFC_TYPE(db), db->db.db_size);
+
+		bcopy(db->db.db_data, buf->b_data, db->db.db_size);
+		dr->dt.dl.dr_data = buf;
+	}
+
+	dr->dt.dl.dr_override_state = DR_IN_DMU_SYNC;
+	mutex_exit(&db->db_mtx);
+
+	dsa = kmem_alloc(sizeof (dmu_sync_arg_t), KM_SLEEP);
+	dsa->dsa_dr = dr;
+	dsa->dsa_done = done;
+	dsa->dsa_zgd = zgd;
+	dsa->dsa_tx = NULL;
+
+	/*
+	 * Issued at sync write priority, as dmu_sync() does: async writes
+	 * go through the allocation throttle, whose slots belong to the
+	 * txg being synced.
+	 */
+	zio_nowait(arc_write(pio, os->os_spa, txg,
+	    bp, dr->dt.dl.dr_data, DBUF_IS_L2CACHEABLE(db),
+	    &zp, dmu_sync_ready, NULL, NULL, dmu_sync_done, dsa,
+	    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL, &zb));
+
+	return (0);
+}
+
 int
 dmu_object_set_blocksize(objset_t *os, uint64_t object, uint64_t size, int ibs,
 	dmu_tx_t *tx)
@@ -2093,7 +2253,9 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp,
 	enum zio_checksum dedup_checksum = os->os_dedup_checksum;
 	boolean_t dedup = B_FALSE;
 	boolean_t nopwrite = B_FALSE;
+	boolean_t encrypt = B_FALSE;
 	boolean_t dedup_verify = os->os_dedup_verify;
+	uint32_t *compress_streak = NULL;
 	int copies = os->os_copies;
 #ifndef __APPLE__
 	ASSERTV(boolean_t lz4_ac = spa_feature_is_active(os->os_spa,
@@ -2184,6 +2346,26 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp,
 		nopwrite = (!dedup && (zio_checksum_table[checksum].ci_flags &
 							   ZCHECKSUM_FLAG_NOPWRITE) &&
 			compress != ZIO_COMPRESS_OFF && zfs_nopwrite_enabled);
+
+		/*
+		 * Both dedup and nopwrite depend on equal data having equal
+		 * checksums, which the random IVs of encrypted blocks rule
+		 * out.  The third DVA of an encrypted bp holds its IV.
+		 */
+		if (os->os_encrypted && DMU_OT_IS_ENCRYPTED(type)) {
+			encrypt = B_TRUE;
+			dedup = B_FALSE;
+			dedup_verify = B_FALSE;
+			nopwrite = B_FALSE;
+			copies = MIN(copies, SPA_DVAS_PER_BP - 1);
+		}
+
+		/*
+		 * Whether a block was compressed changes its checksum, so
+		 * keep the streak heuristic away from dedup candidates.
+		 */
+		if (!dedup)
+			compress_streak = &os->os_compress_streak;
 	}
 
 	zp->zp_checksum = checksum;
@@ -2203,6 +2385,16 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp,
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
 	zp->zp_nopwrite = nopwrite;
+	zp->zp_encrypt = encrypt;
+	zp->zp_salt = 0;
+	bzero(zp->zp_iv, ZIO_DATA_IV_LEN);
+	bzero(zp->zp_mac, ZIO_DATA_MAC_LEN);
+	zp->zp_compress_streak = compress_streak;
+
+	/* only file data is routed to the special class by size */
+	zp->zp_special_smallblk = (!ismd &&
+	    zp->zp_type == DMU_OT_PLAIN_FILE_CONTENTS) ?
+	    os->os_special_smallblk : 0;
 }
 
 int
@@ -2281,6 +2473,7 @@ __dmu_object_info_from_dnode(dnode_t *dn, dmu_object_info_t *doi)
 	doi->doi_checksum = dn->dn_checksum;
 	doi->doi_compress = dn->dn_compress;
 	doi->doi_nblkptr = dn->dn_nblkptr;
+	doi->doi_dnodesize = dn->dn_num_slots << DNODE_SHIFT;
 	doi->doi_physical_blocks_512 = (DN_USED_BYTES(dnp) + 256) >> 9;
 	doi->doi_max_offset = (dn->dn_maxblkid + 1) * dn->dn_datablksz;
 	doi->doi_fill_count = 0;
@@ -2293,7 +2486,7 @@ void
 dmu_object_info_from_dnode(dnode_t *dn, dmu_object_info_t *doi)
 {
 	rw_enter(&dn->dn_struct_rwlock, RW_READER);
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 
 	__dmu_object_info_from_dnode(dn, doi);
 
@@ -2355,6 +2548,18 @@ dmu_object_size_from_db(dmu_buf_t *db_fake, uint32_t *blksize,
 	DB_DNODE_EXIT(db);
 }
 
+void
+dmu_object_dnsize_from_db(dmu_buf_t *db_fake, int *dnsize)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dnode_t *dn;
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	*dnsize = dn->dn_num_slots << DNODE_SHIFT;
+	DB_DNODE_EXIT(db);
+}
+
 void
 byteswap_uint64_array(void *vbuf, size_t size)
 {
@@ -2404,6 +2609,7 @@ void
 dmu_init(void)
 {
 	zfs_dbgmsg_init();
+	zfs_lockstat_init();
 	sa_cache_init();
 	xuio_stat_init();
 	dmu_objset_init();
@@ -2427,6 +2633,7 @@ dmu_fini(void)
 	dmu_objset_fini();
 	xuio_stat_fini();
 	sa_cache_fini();
+	zfs_lockstat_fini();
 	zfs_dbgmsg_fini();
 }
 
@@ -39,6 +39,7 @@
 #include <sys/dsl_prop.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_synctask.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dsl_deleg.h>
 #include <sys/dnode.h>
 #include <sys/dbuf.h>
@@ -75,6 +76,8 @@ int dmu_find_threads = 0;
 int dmu_rescan_dnode_threshold = 131072;
 
 static void dmu_objset_find_dp_cb(void *arg);
+static void dmu_objset_dirty_space(objset_t *os, int64_t space,
+    uint64_t txg);
 
 void
 dmu_objset_init(void)
@@ -149,6 +152,15 @@ dmu_objset_logbias(objset_t *os)
 	return (os->os_logbias);
 }
 
+/*
+ * Size of the dnodes of new objects, from the dnodesize property.
+ */
+int
+dmu_objset_dnodesize(objset_t *os)
+{
+	return (os->os_dnodesize != 0 ? os->os_dnodesize : DNODE_MIN_SIZE);
+}
+
 static void
 checksum_changed_cb(void *arg, uint64_t newval)
 {
@@ -222,6 +234,28 @@ primary_cache_changed_cb(void *arg, uint64_t newval)
 	os->os_primary_cache = newval;
 }
 
+static void
+primary_cache_quota_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	arc_ds_set_quota(os->os_spa, dmu_objset_id(os), newval);
+}
+
+static void
+dirty_weight_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval >= ZFS_DIRTY_WEIGHT_MIN &&
+	    newval <= ZFS_DIRTY_WEIGHT_MAX);
+
+	os->os_dirty_weight = newval;
+}
+
 static void
 secondary_cache_changed_cb(void *arg, uint64_t newval)
 {
@@ -231,9 +265,11 @@ secondary_cache_changed_cb(void *arg, uint64_t newval)
 	 * Inheritance and range checking should have been done by now.
 	 */
 	ASSERT(newval == ZFS_CACHE_ALL || newval == ZFS_CACHE_NONE ||
-	    newval == ZFS_CACHE_METADATA);
+	    newval == ZFS_CACHE_METADATA || newval == ZFS_CACHE_PREFETCH);
 
 	os->os_secondary_cache = newval;
+	arc_ds_set_l2prefetch(os->os_spa, dmu_objset_id(os),
+	    newval == ZFS_CACHE_PREFETCH);
 }
 
 static void
@@ -266,13 +302,56 @@ redundant_metadata_changed_cb(void *arg, uint64_t newval)
 	os->os_redundant_metadata = newval;
 }
 
+static void
+dnodesize_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	switch (newval) {
+	case ZFS_DNSIZE_LEGACY:
+		os->os_dnodesize = DNODE_MIN_SIZE;
+		break;
+	case ZFS_DNSIZE_AUTO:
+		/*
+		 * Twice the legacy size leaves room in the bonus buffer
+		 * for the extended attributes, Finder info and ACLs of
+		 * most files, without wasting much space on those that
+		 * have none.
+		 */
+		os->os_dnodesize = DNODE_MIN_SIZE * 2;
+		break;
+	case ZFS_DNSIZE_1K:
+	case ZFS_DNSIZE_2K:
+	case ZFS_DNSIZE_4K:
+	case ZFS_DNSIZE_8K:
+	case ZFS_DNSIZE_16K:
+		os->os_dnodesize = newval;
+		break;
+	}
+}
+
+static void
+special_small_blocks_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == 0 || (ISP2(newval) && newval >= SPA_MINBLOCKSIZE &&
+	    newval <= SPA_OLD_MAXBLOCKSIZE));
+
+	os->os_special_smallblk = newval;
+}
+
 static void
 logbias_changed_cb(void *arg, uint64_t newval)
 {
 	objset_t *os = arg;
 
 	ASSERT(newval == ZFS_LOGBIAS_LATENCY ||
-	    newval == ZFS_LOGBIAS_THROUGHPUT);
+	    newval == ZFS_LOGBIAS_THROUGHPUT ||
+	    newval == ZFS_LOGBIAS_HYBRID);
 	os->os_logbias = newval;
 	if (os->os_zil)
 		zil_set_logbias(os->os_zil, newval);
@@ -334,6 +413,109 @@ dnode_multilist_index_func(multilist_t *ml, void *obj)
 	    multilist_get_num_sublists(ml));
 }
 
+/*
+ * Write throttle statistics of a head dataset,
+ * kstat.zfs.<pool>.dataset.throttle-0x<id>.
+ */
+typedef struct dmu_objset_throttle_values {
+	kstat_named_t	dotv_ds_name;
+	kstat_named_t	dotv_dirty;
+	kstat_named_t	dotv_weight;
+	kstat_named_t	dotv_passes;
+	kstat_named_t	dotv_delays;
+	kstat_named_t	dotv_delay_time;
+	kstat_named_t	dotv_stalls;
+	kstat_named_t	dotv_stall_time;
+} dmu_objset_throttle_values_t;
+
+static const dmu_objset_throttle_values_t dmu_objset_throttle_template = {
+	{ "dataset_name",	KSTAT_DATA_STRING },
+	{ "dirty_bytes",	KSTAT_DATA_UINT64 },
+	{ "dirty_weight",	KSTAT_DATA_UINT64 },
+	{ "fair_passes",	KSTAT_DATA_UINT64 },
+	{ "delays",		KSTAT_DATA_UINT64 },
+	{ "delay_ns",		KSTAT_DATA_UINT64 },
+	{ "stalls",		KSTAT_DATA_UINT64 },
+	{ "stall_ns",		KSTAT_DATA_UINT64 },
+};
+
+typedef struct dmu_objset_throttle {
+	kstat_t				*dot_kstat;
+	kmutex_t			dot_lock;	/* protects values */
+	dmu_objset_throttle_values_t	dot_values;
+	char				dot_ds_name[ZFS_MAX_DATASET_NAME_LEN];
+} dmu_objset_throttle_t;
+
+static int
+dmu_objset_throttle_update(kstat_t *ksp, int rw)
+{
+	objset_t *os = ksp->ks_private;
+	dmu_objset_throttle_values_t *dotv = &os->os_throttle->dot_values;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	dotv->dotv_dirty.value.ui64 = dmu_objset_dirty(os);
+	dotv->dotv_weight.value.ui64 = os->os_dirty_weight;
+	dotv->dotv_passes.value.ui64 = os->os_throttle_passes;
+	dotv->dotv_delays.value.ui64 = os->os_throttle_delays;
+	dotv->dotv_delay_time.value.ui64 = os->os_throttle_delay_time;
+	dotv->dotv_stalls.value.ui64 = os->os_throttle_stalls;
+	dotv->dotv_stall_time.value.ui64 = os->os_throttle_stall_time;
+
+	return (0);
+}
+
+static void
+dmu_objset_throttle_create(objset_t *os)
+{
+	dmu_objset_throttle_t *dot;
+	char name[KSTAT_STRLEN];
+	char kname[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(os->os_spa));
+	(void) snprintf(kname, KSTAT_STRLEN, "throttle-0x%llx",
+	    (u_longlong_t)dmu_objset_id(os));
+
+	ksp = kstat_create(name, 0, kname, "dataset", KSTAT_TYPE_NAMED,
+	    sizeof (dmu_objset_throttle_values_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (ksp == NULL)
+		return;
+
+	dot = kmem_zalloc(sizeof (dmu_objset_throttle_t), KM_SLEEP);
+	mutex_init(&dot->dot_lock, NULL, MUTEX_DEFAULT, NULL);
+	bcopy(&dmu_objset_throttle_template, &dot->dot_values,
+	    sizeof (dmu_objset_throttle_values_t));
+	dsl_dataset_name(os->os_dsl_dataset, dot->dot_ds_name);
+	KSTAT_NAMED_STR_PTR(&dot->dot_values.dotv_ds_name) = dot->dot_ds_name;
+	KSTAT_NAMED_STR_BUFLEN(&dot->dot_values.dotv_ds_name) =
+	    strlen(dot->dot_ds_name) + 1;
+	dot->dot_kstat = ksp;
+	os->os_throttle = dot;
+
+	ksp->ks_lock = &dot->dot_lock;
+	ksp->ks_data = &dot->dot_values;
+	ksp->ks_private = os;
+	ksp->ks_update = dmu_objset_throttle_update;
+	kstat_install(ksp);
+}
+
+static void
+dmu_objset_throttle_destroy(objset_t *os)
+{
+	dmu_objset_throttle_t *dot = os->os_throttle;
+
+	if (dot == NULL)
+		return;
+
+	kstat_delete(dot->dot_kstat);
+	mutex_destroy(&dot->dot_lock);
+	kmem_free(dot, sizeof (dmu_objset_throttle_t));
+	os->os_throttle = NULL;
+}
+
 /*
  * Instantiates the objset_t in-memory structure corresponding to the
  * objset_phys_t that's pointed to by the specified blkptr_t.
@@ -463,6 +645,33 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    zfs_prop_to_name(ZFS_PROP_RECORDSIZE),
 				    recordsize_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(
+				    ZFS_PROP_PRIMARYCACHE_QUOTA),
+				    primary_cache_quota_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_DNODESIZE),
+				    dnodesize_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(
+				    ZFS_PROP_SPECIAL_SMALL_BLOCKS),
+				    special_small_blocks_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_DIRTY_WEIGHT),
+				    dirty_weight_changed_cb, os);
+			}
+		}
+		if (err == 0 && ds->ds_dir->dd_crypto_obj != 0) {
+			os->os_encrypted = B_TRUE;
+			spa_keystore_create_mapping(spa, ds->ds_object,
+			    ds->ds_dir->dd_crypto_obj);
 		}
 		if (needlock)
 			dsl_pool_config_exit(dmu_objset_pool(os), FTAG);
@@ -471,6 +680,8 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 			kmem_free(os, sizeof (objset_t));
 			return (err);
 		}
+		if (!ds->ds_is_snapshot && spa_writeable(spa))
+			dmu_objset_throttle_create(os);
 	} else {
 		/* It's the meta-objset. */
 		os->os_checksum = ZIO_CHECKSUM_FLETCHER_4;
@@ -482,6 +693,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		os->os_sync = ZFS_SYNC_STANDARD;
 		os->os_primary_cache = ZFS_CACHE_ALL;
 		os->os_secondary_cache = ZFS_CACHE_ALL;
+		os->os_dnodesize = DNODE_MIN_SIZE;
 	}
 
 	if (ds == NULL || !ds->ds_is_snapshot)
@@ -504,6 +716,15 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	mutex_init(&os->os_userused_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_user_ptr_lock, NULL, MUTEX_DEFAULT, NULL);
+	for (int i = 0; i < OS_DNODE_HINTS; i++) {
+		mutex_init(&os->os_dnode_hints[i].odh_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
+	os->os_obj_next_percpu_len = max_ncpus;
+	os->os_obj_next_percpu = kmem_zalloc(os->os_obj_next_percpu_len *
+	    sizeof (os->os_obj_next_percpu[0]), KM_SLEEP);
+
+	dbuf_stats_objset_register(os);
 
 	dnode_special_open(os, &os->os_phys->os_meta_dnode,
 	    DMU_META_DNODE_OBJECT, &os->os_meta_dnode);
@@ -751,9 +972,15 @@ dmu_objset_evict(objset_t *os)
 	for (t = 0; t < TXG_SIZE; t++)
 		ASSERT(!dmu_objset_is_dirty(os, t));
 
-	if (ds)
+	if (ds) {
 		dsl_prop_unregister_all(ds, os);
 
+		/* a closed dataset's buffers compete like any others */
+		if (!ds->ds_is_snapshot)
+			arc_ds_set_quota(os->os_spa, dmu_objset_id(os), 0);
+		arc_ds_set_l2prefetch(os->os_spa, dmu_objset_id(os), B_FALSE);
+	}
+
 	if (os->os_sa)
 		sa_tear_down(os);
 
@@ -796,9 +1023,17 @@ dmu_objset_evict_done(objset_t *os)
 	mutex_destroy(&os->os_userused_lock);
 	mutex_destroy(&os->os_obj_lock);
 	mutex_destroy(&os->os_user_ptr_lock);
+	for (int i = 0; i < OS_DNODE_HINTS; i++) {
+		ASSERT3P(os->os_dnode_hints[i].odh_dnh, ==, NULL);
+		mutex_destroy(&os->os_dnode_hints[i].odh_lock);
+	}
+	kmem_free(os->os_obj_next_percpu,
+	    os->os_obj_next_percpu_len * sizeof (os->os_obj_next_percpu[0]));
 	for (int i = 0; i < TXG_SIZE; i++) {
 		multilist_destroy(os->os_dirty_dnodes[i]);
 	}
+	dmu_objset_throttle_destroy(os);
+	dbuf_stats_objset_unregister(os);
 	spa_evicting_os_deregister(os->os_spa, os);
 	kmem_free(os, sizeof (objset_t));
 }
@@ -827,7 +1062,7 @@ dmu_objset_create_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	mdn = DMU_META_DNODE(os);
 
 	dnode_allocate(mdn, DMU_OT_DNODE, 1 << DNODE_BLOCK_SHIFT,
-	    DN_MAX_INDBLKSHIFT, DMU_OT_NONE, 0, tx);
+	    DN_MAX_INDBLKSHIFT, DMU_OT_NONE, 0, DNODE_MIN_SLOTS, tx);
 
 	/*
 	 * We don't want to have to increase the meta-dnode's nlevels
@@ -884,6 +1119,7 @@ typedef struct dmu_objset_create_arg {
 	void *doca_userarg;
 	dmu_objset_type_t doca_type;
 	uint64_t doca_flags;
+	dsl_crypto_params_t *doca_dcp;
 } dmu_objset_create_arg_t;
 
 /*ARGSUSED*/
@@ -911,6 +1147,8 @@ dmu_objset_create_check(void *arg, dmu_tx_t *tx)
 	}
 	error = dsl_fs_ss_limit_check(pdd, 1, ZFS_PROP_FILESYSTEM_LIMIT, NULL,
 	    doca->doca_cred);
+	if (error == 0)
+		error = dsl_crypto_params_check(pdd, NULL, doca->doca_dcp);
 	dsl_dir_rele(pdd, FTAG);
 
 	return (error);
@@ -931,7 +1169,7 @@ dmu_objset_create_sync(void *arg, dmu_tx_t *tx)
 	VERIFY0(dsl_dir_hold(dp, doca->doca_name, FTAG, &pdd, &tail));
 
 	obj = dsl_dataset_create_sync(pdd, tail, NULL, doca->doca_flags,
-	    doca->doca_cred, tx);
+	    doca->doca_cred, doca->doca_dcp, tx);
 
 	VERIFY0(dsl_dataset_hold_obj(pdd->dd_pool, obj, FTAG, &ds));
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
@@ -956,6 +1194,7 @@ dmu_objset_create_sync(void *arg, dmu_tx_t *tx)
 
 int
 dmu_objset_create(const char *name, dmu_objset_type_t type, uint64_t flags,
+    dsl_crypto_params_t *dcp,
     void (*func)(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx), void *arg)
 {
 	dmu_objset_create_arg_t doca;
@@ -966,6 +1205,7 @@ dmu_objset_create(const char *name, dmu_objset_type_t type, uint64_t flags,
 	doca.doca_userfunc = func;
 	doca.doca_userarg = arg;
 	doca.doca_type = type;
+	doca.doca_dcp = dcp;
 
 	return (dsl_sync_task(name,
 	    dmu_objset_create_check, dmu_objset_create_sync, &doca,
@@ -1020,9 +1260,15 @@ dmu_objset_clone_check(void *arg, dmu_tx_t *tx)
 		dsl_dataset_rele(origin, FTAG);
 		return (SET_ERROR(EINVAL));
 	}
+
+	error = dsl_dir_hold(dp, doca->doca_clone, FTAG, &pdd, &tail);
+	if (error == 0) {
+		error = dsl_crypto_params_check(pdd, origin, NULL);
+		dsl_dir_rele(pdd, FTAG);
+	}
 	dsl_dataset_rele(origin, FTAG);
 
-	return (0);
+	return (error);
 }
 
 static void
@@ -1040,7 +1286,7 @@ dmu_objset_clone_sync(void *arg, dmu_tx_t *tx)
 	VERIFY0(dsl_dataset_hold(dp, doca->doca_origin, FTAG, &origin));
 
 	obj = dsl_dataset_create_sync(pdd, tail, origin, 0,
-	    doca->doca_cred, tx);
+	    doca->doca_cred, NULL, tx);
 
 	VERIFY0(dsl_dataset_hold_obj(pdd->dd_pool, obj, FTAG, &ds));
 	dsl_dataset_name(origin, namebuf);
@@ -1158,26 +1404,99 @@ dmu_objset_write_done(zio_t *zio, arc_buf_t *abuf, void *arg)
 	kmem_free(bp, sizeof (*bp));
 }
 
+/*
+ * State shared by the sync_dnodes_task()s of one objset.  The last task
+ * to finish completes the objset sync with sync_meta_dnode_task(), so
+ * dmu_objset_sync() never waits on the taskq and the dnodes of many
+ * objsets can be synced concurrently.
+ */
+typedef struct sync_objset_arg {
+	zio_t		*soa_zio;
+	objset_t	*soa_os;
+	dmu_tx_t	*soa_tx;
+	kmutex_t	soa_mutex;
+	int		soa_count;
+} sync_objset_arg_t;
+
 typedef struct sync_dnodes_arg {
 	multilist_t *sda_list;
 	int sda_sublist_idx;
-	multilist_t *sda_newlist;
-	dmu_tx_t *sda_tx;
+	sync_objset_arg_t *sda_soa;
 } sync_dnodes_arg_t;
 
+static void sync_meta_dnode_task(void *arg);
+
 static void
 sync_dnodes_task(void *arg)
 {
 	sync_dnodes_arg_t *sda = arg;
+	sync_objset_arg_t *soa = sda->sda_soa;
+	dsl_pool_t *dp = dmu_objset_pool(soa->soa_os);
+	hrtime_t start = gethrtime();
 
 	multilist_sublist_t *ms =
 	    multilist_sublist_lock(sda->sda_list, sda->sda_sublist_idx);
 
-	dmu_objset_sync_dnodes(ms, sda->sda_tx);
+	dmu_objset_sync_dnodes(ms, soa->soa_tx);
 
 	multilist_sublist_unlock(ms);
 
 	kmem_free(sda, sizeof (*sda));
+
+	atomic_add_64(&dp->dp_sync_dnodes_time, gethrtime() - start);
+
+	mutex_enter(&soa->soa_mutex);
+	ASSERT3S(soa->soa_count, >, 0);
+	if (--soa->soa_count != 0) {
+		mutex_exit(&soa->soa_mutex);
+		return;
+	}
+	mutex_exit(&soa->soa_mutex);
+
+	sync_meta_dnode_task(soa);
+}
+
+/*
+ * Issue the writes of the meta dnode's dirty blocks, now that all of the
+ * objset's dnodes have been copied into them, then clean the intent log
+ * and issue the root block write.  The caller's parent zio is waited on
+ * by dsl_pool_sync(), which is what guarantees this has run.
+ */
+static void
+sync_meta_dnode_task(void *arg)
+{
+	sync_objset_arg_t *soa = arg;
+	objset_t *os = soa->soa_os;
+	dmu_tx_t *tx = soa->soa_tx;
+	int txgoff = tx->tx_txg & TXG_MASK;
+	list_t *list;
+	dbuf_dirty_record_t *dr;
+
+	ASSERT0(soa->soa_count);
+
+	list = &DMU_META_DNODE(os)->dn_dirty_records[txgoff];
+	while ((dr = list_head(list)) != NULL) {
+		ASSERT0(dr->dr_dbuf->db_level);
+		list_remove(list, dr);
+		if (dr->dr_zio)
+			zio_nowait(dr->dr_zio);
+	}
+
+	/* Enable dnode backfill if enough objects have been freed. */
+	if (os->os_freed_dnodes >= dmu_rescan_dnode_threshold) {
+		os->os_rescan_dnodes = B_TRUE;
+		os->os_freed_dnodes = 0;
+	}
+
+	/*
+	 * Free intent log blocks up to this tx.
+	 */
+	zil_sync(os->os_zil, tx);
+	os->os_phys->os_zil_header = os->os_zil_header;
+	zio_nowait(soa->soa_zio);
+
+	mutex_destroy(&soa->soa_mutex);
+	kmem_free(soa, sizeof (*soa));
 }
 
 
@@ -1189,8 +1508,9 @@ dmu_objset_sync(objset_t *os, zio_t *pio, dmu_tx_t *tx)
 	zbookmark_phys_t zb;
 	zio_prop_t zp;
 	zio_t *zio;
-	list_t *list;
-	dbuf_dirty_record_t *dr;
+	sync_objset_arg_t *soa;
+	multilist_t *ml;
+	int num_sublists;
 	blkptr_t *blkptr_copy = kmem_alloc(sizeof (*os->os_rootbp), KM_SLEEP);
 	*blkptr_copy = *os->os_rootbp;
 
@@ -1259,38 +1579,30 @@ dmu_objset_sync(objset_t *os, zio_t *pio, dmu_tx_t *tx)
 		}
 	}
 
-	for (int i = 0;
-	    i < multilist_get_num_sublists(os->os_dirty_dnodes[txgoff]); i++) {
+	/*
+	 * The remainder of the sync, including the zio_nowait() of the
+	 * root block, is done by the last of the sync_dnodes_task()s to
+	 * finish.  The soa is freed at the end of sync_meta_dnode_task().
+	 */
+	ml = os->os_dirty_dnodes[txgoff];
+	num_sublists = multilist_get_num_sublists(ml);
+
+	soa = kmem_alloc(sizeof (*soa), KM_SLEEP);
+	soa->soa_zio = zio;
+	soa->soa_os = os;
+	soa->soa_tx = tx;
+	soa->soa_count = num_sublists;
+	mutex_init(&soa->soa_mutex, NULL, MUTEX_DEFAULT, NULL);
+
+	for (int i = 0; i < num_sublists; i++) {
 		sync_dnodes_arg_t *sda = kmem_alloc(sizeof (*sda), KM_SLEEP);
-		sda->sda_list = os->os_dirty_dnodes[txgoff];
+		sda->sda_list = ml;
 		sda->sda_sublist_idx = i;
-		sda->sda_tx = tx;
+		sda->sda_soa = soa;
 		(void) taskq_dispatch(dmu_objset_pool(os)->dp_sync_taskq,
 		    sync_dnodes_task, sda, 0);
 		/* callback frees sda */
 	}
-	taskq_wait(dmu_objset_pool(os)->dp_sync_taskq);
-
-	list = &DMU_META_DNODE(os)->dn_dirty_records[txgoff];
-	while ((dr = list_head(list)) != NULL) {
-		ASSERT0(dr->dr_dbuf->db_level);
-		list_remove(list, dr);
-		if (dr->dr_zio)
-			zio_nowait(dr->dr_zio);
-	}
-
-	/* Enable dnode backfill if enough objects have been freed. */
-	if (os->os_freed_dnodes >= dmu_rescan_dnode_threshold) {
-		os->os_rescan_dnodes = B_TRUE;
-		os->os_freed_dnodes = 0;
-	}
-
-	/*
-	 * Free intent log blocks up to this tx.
-	 */
-	zil_sync(os->os_zil, tx);
-	os->os_phys->os_zil_header = os->os_zil_header;
-	zio_nowait(zio);
 }
 
 boolean_t
@@ -1339,40 +1651,74 @@ userquota_compare(const void *l, const void *r)
 	return (0);
 }
 
+/*
+ * Deltas from all of an objset's userquota_updates_task()s are merged
+ * here, so that each id's ZAP entry is updated once per txg, in id order,
+ * rather than once per sublist that happened to touch it.
+ */
+typedef struct userquota_merge {
+	kmutex_t uqm_lock;
+	userquota_cache_t uqm_cache;
+	int uqm_pending;
+} userquota_merge_t;
+
 static void
-do_userquota_cacheflush(objset_t *os, userquota_cache_t *cache, dmu_tx_t *tx)
+do_userquota_flush_tree(objset_t *os, avl_tree_t *avl, uint64_t obj,
+    dmu_tx_t *tx)
 {
-	void *cookie;
+	void *cookie = NULL;
 	userquota_node_t *uqn;
 
-	ASSERT(dmu_tx_is_syncing(tx));
-
-	cookie = NULL;
-	while ((uqn = avl_destroy_nodes(&cache->uqc_user_deltas,
-	    &cookie)) != NULL) {
-		/*
-		 * os_userused_lock protects against concurrent calls to
-		 * zap_increment_int().  It's needed because zap_increment_int()
-		 * is not thread-safe (i.e. not atomic).
-		 */
-		mutex_enter(&os->os_userused_lock);
-		VERIFY0(zap_increment_int(os, DMU_USERUSED_OBJECT,
-		    uqn->uqn_id, uqn->uqn_delta, tx));
-		mutex_exit(&os->os_userused_lock);
+	while ((uqn = avl_destroy_nodes(avl, &cookie)) != NULL) {
+		if (uqn->uqn_delta != 0) {
+			VERIFY0(zap_increment_int(os, obj,
+			    uqn->uqn_id, uqn->uqn_delta, tx));
+		}
 		kmem_free(uqn, sizeof (*uqn));
 	}
-	avl_destroy(&cache->uqc_user_deltas);
+	avl_destroy(avl);
+}
 
-	cookie = NULL;
-	while ((uqn = avl_destroy_nodes(&cache->uqc_group_deltas,
-	    &cookie)) != NULL) {
-		mutex_enter(&os->os_userused_lock);
-		VERIFY0(zap_increment_int(os, DMU_GROUPUSED_OBJECT,
-		    uqn->uqn_id, uqn->uqn_delta, tx));
-		mutex_exit(&os->os_userused_lock);
-		kmem_free(uqn, sizeof (*uqn));
+static void
+do_userquota_cacheflush(objset_t *os, userquota_cache_t *cache, dmu_tx_t *tx)
+{
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	/*
+	 * os_userused_lock protects against concurrent calls to
+	 * zap_increment_int().  It's needed because zap_increment_int()
+	 * is not thread-safe (i.e. not atomic).
+	 */
+	mutex_enter(&os->os_userused_lock);
+	do_userquota_flush_tree(os, &cache->uqc_user_deltas,
+	    DMU_USERUSED_OBJECT, tx);
+	do_userquota_flush_tree(os, &cache->uqc_group_deltas,
+	    DMU_GROUPUSED_OBJECT, tx);
+	mutex_exit(&os->os_userused_lock);
+}
+
+/*
+ * Move every node of src into dst, summing the deltas of ids present
+ * in both.
+ */
+static void
+userquota_merge_tree(avl_tree_t *dst, avl_tree_t *src)
+{
+	void *cookie = NULL;
+	userquota_node_t *uqn;
+
+	while ((uqn = avl_destroy_nodes(src, &cookie)) != NULL) {
+		avl_index_t idx;
+		userquota_node_t *found = avl_find(dst, uqn, &idx);
+
+		if (found != NULL) {
+			found->uqn_delta += uqn->uqn_delta;
+			kmem_free(uqn, sizeof (*uqn));
+		} else {
+			avl_insert(dst, uqn, idx);
+		}
 	}
-	avl_destroy(&cache->uqc_group_deltas);
+	avl_destroy(src);
 }
 
 static void
@@ -1408,6 +1754,7 @@ typedef struct userquota_updates_arg {
 	objset_t *uua_os;
 	int uua_sublist_idx;
 	dmu_tx_t *uua_tx;
+	userquota_merge_t *uua_merge;
 } userquota_updates_arg_t;
 
 static void
@@ -1416,8 +1763,10 @@ userquota_updates_task(void *arg)
 	userquota_updates_arg_t *uua = arg;
 	objset_t *os = uua->uua_os;
 	dmu_tx_t *tx = uua->uua_tx;
+	userquota_merge_t *uqm = uua->uua_merge;
 	dnode_t *dn;
 	userquota_cache_t cache = { { 0 } };
+	boolean_t last;
 
 	multilist_sublist_t *list =
 	    multilist_sublist_lock(os->os_synced_dnodes, uua->uua_sublist_idx);
@@ -1450,7 +1799,7 @@ userquota_updates_task(void *arg)
 			    dn->dn_newgid, B_FALSE);
 		}
 
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		dn->dn_oldused = 0;
 		dn->dn_oldflags = 0;
 		if (dn->dn_id_flags & DN_ID_NEW_EXIST) {
@@ -1468,14 +1817,34 @@ userquota_updates_task(void *arg)
 		multilist_sublist_remove(list, dn);
 		dnode_rele(dn, os->os_synced_dnodes);
 	}
-	do_userquota_cacheflush(os, &cache, tx);
 	multilist_sublist_unlock(list);
+
+	/*
+	 * Fold our deltas into the objset's; whichever task finishes last
+	 * writes them all out.
+	 */
+	mutex_enter(&uqm->uqm_lock);
+	userquota_merge_tree(&uqm->uqm_cache.uqc_user_deltas,
+	    &cache.uqc_user_deltas);
+	userquota_merge_tree(&uqm->uqm_cache.uqc_group_deltas,
+	    &cache.uqc_group_deltas);
+	last = (--uqm->uqm_pending == 0);
+	mutex_exit(&uqm->uqm_lock);
+
+	if (last) {
+		do_userquota_cacheflush(os, &uqm->uqm_cache, tx);
+		mutex_destroy(&uqm->uqm_lock);
+		kmem_free(uqm, sizeof (*uqm));
+	}
 	kmem_free(uua, sizeof (*uua));
 }
 
 void
 dmu_objset_do_userquota_updates(objset_t *os, dmu_tx_t *tx)
 {
+	userquota_merge_t *uqm;
+	int nsublists;
+
 	if (!dmu_objset_userused_enabled(os))
 		return;
 
@@ -1489,13 +1858,22 @@ dmu_objset_do_userquota_updates(objset_t *os, dmu_tx_t *tx)
 		    DMU_OT_USERGROUP_USED, DMU_OT_NONE, 0, tx));
 	}
 
-	for (int i = 0;
-	    i < multilist_get_num_sublists(os->os_synced_dnodes); i++) {
+	nsublists = multilist_get_num_sublists(os->os_synced_dnodes);
+	uqm = kmem_zalloc(sizeof (*uqm), KM_SLEEP);
+	mutex_init(&uqm->uqm_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&uqm->uqm_cache.uqc_user_deltas, userquota_compare,
+	    sizeof (userquota_node_t), offsetof(userquota_node_t, uqn_node));
+	avl_create(&uqm->uqm_cache.uqc_group_deltas, userquota_compare,
+	    sizeof (userquota_node_t), offsetof(userquota_node_t, uqn_node));
+	uqm->uqm_pending = nsublists;
+
+	for (int i = 0; i < nsublists; i++) {
 		userquota_updates_arg_t *uua =
 		    kmem_alloc(sizeof (*uua), KM_SLEEP);
 		uua->uua_os = os;
 		uua->uua_sublist_idx = i;
 		uua->uua_tx = tx;
+		uua->uua_merge = uqm;
 		/* note: caller does taskq_wait() */
 		(void) taskq_dispatch(dmu_objset_pool(os)->dp_sync_taskq,
 		    userquota_updates_task, uua, 0);
@@ -1581,7 +1959,7 @@ dmu_objset_userquota_get_ids(dnode_t *dn, boolean_t before, dmu_tx_t *tx)
 				if (!have_bonus)
 					return;
 			}
-			mutex_enter(&db->db_mtx);
+			zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 			data = dmu_objset_userquota_find_data(db, tx);
 		} else {
 			data = DN_BONUS(dn->dn_phys);
@@ -1595,12 +1973,12 @@ dmu_objset_userquota_get_ids(dnode_t *dn, boolean_t before, dmu_tx_t *tx)
 			    rf | DB_RF_MUST_SUCCEED,
 			    FTAG, (dmu_buf_t **)&db);
 			ASSERT(error == 0);
-			mutex_enter(&db->db_mtx);
+			zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 			data = (before) ? db->db.db_data :
 			    dmu_objset_userquota_find_data(db, tx);
 			have_spill = B_TRUE;
 	} else {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		dn->dn_id_flags |= DN_ID_CHKED_BONUS;
 		mutex_exit(&dn->dn_mtx);
 		return;
@@ -1643,7 +2021,7 @@ dmu_objset_userquota_get_ids(dnode_t *dn, boolean_t before, dmu_tx_t *tx)
 	if (db)
 		mutex_exit(&db->db_mtx);
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	if (error == 0 && before)
 		dn->dn_id_flags |= DN_ID_OLD_EXIST;
 	if (error == 0 && !before)
@@ -2274,5 +2652,86 @@ dmu_objset_willuse_space(objset_t *os, int64_t space, dmu_tx_t *tx)
 	if (ds != NULL) {
 		dsl_dir_willuse_space(ds->ds_dir, aspace, tx);
 		dsl_pool_dirty_space(dmu_tx_pool(tx), space, tx);
+		if (space > 0)
+			dmu_objset_dirty_space(os, space, tx->tx_txg);
+	}
+}
+
+/*
+ * Per-dataset dirty data, for the fair share of the write throttle.
+ *
+ * Each head dataset's dirty data is counted per txg next to the pool's.
+ * The first space a dataset dirties in a txg adds its dirty_weight to the
+ * pool's dp_dirty_weight[] of that txg, which is so the sum of the weights
+ * of the datasets writing at the time.  dmu_tx_try_assign() does not delay
+ * a transaction of a dataset holding less than its weighted share of the
+ * dirty data at which the pool starts to delay, so that one bulk writer
+ * does not slow the small writes of every other dataset; the datasets
+ * over their share take the delay.  A single writer's share is the whole
+ * delay threshold, which leaves the throttle as it was.
+ */
+static void
+dmu_objset_dirty_space(objset_t *os, int64_t space, uint64_t txg)
+{
+	dsl_pool_t *dp = dmu_objset_pool(os);
+	int g = txg & TXG_MASK;
+
+	if (atomic_add_64_nv(&os->os_dirty_pertxg[g], space) == space)
+		atomic_add_64(&dp->dp_dirty_weight[g], os->os_dirty_weight);
+}
+
+/*
+ * Called when dirty data of the objset has been written out, or undirtied.
+ */
+void
+dmu_objset_undirty_space(objset_t *os, int64_t space, uint64_t txg)
+{
+	dsl_pool_undirty_space(dmu_objset_pool(os), space, txg);
+	if (os->os_dsl_dataset != NULL && space > 0)
+		atomic_add_64(&os->os_dirty_pertxg[txg & TXG_MASK], -space);
+}
+
+/*
+ * Called by dsl_dataset_sync_done(): drop what rounding left of the
+ * synced txg's dirty data.
+ */
+void
+dmu_objset_dirty_done(objset_t *os, uint64_t txg)
+{
+	os->os_dirty_pertxg[txg & TXG_MASK] = 0;
+}
+
+uint64_t
+dmu_objset_dirty(objset_t *os)
+{
+	uint64_t dirty = 0;
+
+	for (int t = 0; t < TXG_SIZE; t++) {
+		int64_t space = (int64_t)os->os_dirty_pertxg[t];
+
+		if (space > 0)
+			dirty += space;
 	}
+	return (dirty);
+}
+
+boolean_t
+dmu_objset_dirty_under_share(objset_t *os)
+{
+	dsl_pool_t *dp = dmu_objset_pool(os);
+	uint64_t delay_min_bytes =
+	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
+	uint64_t weight, total;
+
+	if (!zfs_dirty_data_fair || os->os_dsl_dataset == NULL ||
+	    dp->dp_dirty_total >= zfs_dirty_data_max)
+		return (B_FALSE);
+
+	weight = os->os_dirty_weight;
+	total = MAX(dsl_pool_dirty_weight(dp), weight);
+	if (dmu_objset_dirty(os) >= delay_min_bytes / total * weight)
+		return (B_FALSE);
+
+	atomic_inc_64(&os->os_throttle_passes);
+	return (B_TRUE);
 }
@@ -0,0 +1,331 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+/*
+ * Background recompression.
+ *
+ * Ingest-heavy datasets often have to be written with a fast compression
+ * algorithm.  Once the data has gone cold it can be written again with a
+ * stronger one.  dmu_recompress() looks at the level 0 blocks of the
+ * file and zvol objects of an objset.  It dirties those blocks, unchanged,
+ * in a transaction, and their next write uses the requested algorithm
+ * (see dmu_buf_will_recompress()).  A block is rewritten only if:
+ *
+ *	- it was born after the objset's most recent snapshot, so a snapshot
+ *	  does not still hold the old copy, which would take twice the
+ *	  space;
+ *	- it was born at least "age" txgs before the last synced txg, so
+ *	  that data which is still hot is left alone;
+ *	- it is not already compressed with the requested algorithm.
+ *
+ * The subtrees written no later than the last snapshot are left out of
+ * the search altogether by the txg given to dnode_next_offset().
+ *
+ * A call does a bounded amount of work and returns a cursor, so a caller
+ * in userland can pace a pass, report its progress and stop it at any
+ * point.  Only syncing context can rewrite blocks, so there is no traversal
+ * of the live block tree here, only ordinary open-context holds.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dmu.h>
+#include <sys/dmu_impl.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_recompress.h>
+#include <sys/dmu_tx.h>
+#include <sys/dbuf.h>
+#include <sys/dnode.h>
+#include <sys/dsl_dataset.h>
+#include <sys/spa.h>
+
+/* blocks dirtied per transaction */
+#define	RECOMPRESS_CHUNK	32
+
+typedef struct recompress_arg {
+	objset_t	*ra_os;
+	enum zio_compress ra_compress;
+	uint64_t	ra_mintxg;	/* rewrite only blocks born after */
+	uint64_t	ra_maxtxg;	/* ... and no later than this */
+	uint64_t	ra_budget;	/* bytes to look at in this call */
+	dmu_recompress_stats_t *ra_stats;
+} recompress_arg_t;
+
+static boolean_t
+dmu_recompress_wanted(recompress_arg_t *ra, dmu_buf_impl_t *db,
+    blkptr_t *bp)
+{
+	dmu_recompress_stats_t *drs = ra->ra_stats;
+	boolean_t dirty;
+
+	mutex_enter(&db->db_mtx);
+	dirty = (db->db_last_dirty != NULL);
+	if (db->db_blkptr != NULL)
+		*bp = *db->db_blkptr;
+	else
+		BP_ZERO(bp);
+	mutex_exit(&db->db_mtx);
+
+	if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+		return (B_FALSE);
+
+	drs->drs_blocks++;
+	drs->drs_bytes += BP_GET_LSIZE(bp);
+
+	if (bp->blk_birth <= ra->ra_mintxg) {
+		drs->drs_skipped_snap++;
+		return (B_FALSE);
+	}
+	if (bp->blk_birth > ra->ra_maxtxg || dirty) {
+		drs->drs_skipped_young++;
+		return (B_FALSE);
+	}
+	if (BP_GET_COMPRESS(bp) == ra->ra_compress) {
+		drs->drs_skipped_done++;
+		return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Rewrite the wanted blocks among nblks starting at blkid, in one
+ * transaction.
+ */
+static int
+dmu_recompress_chunk(recompress_arg_t *ra, dnode_t *dn, uint64_t blkid,
+    int nblks)
+{
+	dmu_recompress_stats_t *drs = ra->ra_stats;
+	dmu_buf_impl_t *dbs[RECOMPRESS_CHUNK];
+	blkptr_t bps[RECOMPRESS_CHUNK];
+	uint64_t blksz = dn->dn_datablksz;
+	dmu_tx_t *tx;
+	int i, n = 0;
+	int error;
+
+	ASSERT3S(nblks, <=, RECOMPRESS_CHUNK);
+
+	for (i = 0; i < nblks; i++) {
+		dmu_buf_impl_t *db;
+
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+		db = dbuf_hold(dn, blkid + i, FTAG);
+		rw_exit(&dn->dn_struct_rwlock);
+		if (db == NULL) {
+			drs->drs_errors++;
+			continue;
+		}
+		if (!dmu_recompress_wanted(ra, db, &bps[n])) {
+			dbuf_rele(db, FTAG);
+			continue;
+		}
+		dbs[n++] = db;
+	}
+	if (n == 0)
+		return (0);
+
+	/* start all the reads before waiting on any */
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	for (i = 0; i < n; i++) {
+		dbuf_prefetch(dn, 0, dbs[i]->db_blkid,
+		    ZIO_PRIORITY_ASYNC_READ, 0);
+	}
+	rw_exit(&dn->dn_struct_rwlock);
+
+	/*
+	 * Read with DB_RF_CANFAIL first: dmu_buf_will_dirty() would
+	 * otherwise panic on a block that can't be read.
+	 */
+	for (i = 0; i < n; i++) {
+		if (dbuf_read(dbs[i], NULL,
+		    DB_RF_CANFAIL | DB_RF_NOPREFETCH) != 0) {
+			drs->drs_errors++;
+			dbuf_rele(dbs[i], FTAG);
+			dbs[i] = NULL;
+		}
+	}
+
+	tx = dmu_tx_create(ra->ra_os);
+	dmu_tx_hold_write_by_dnode(tx, dn, blkid * blksz, nblks * blksz);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error != 0)
+		dmu_tx_abort(tx);
+
+	for (i = 0; i < n; i++) {
+		if (dbs[i] == NULL)
+			continue;
+		if (error == 0) {
+			dmu_buf_will_recompress(&dbs[i]->db, ra->ra_compress,
+			    tx);
+			drs->drs_rewritten++;
+			drs->drs_rewritten_lsize += BP_GET_LSIZE(&bps[i]);
+			drs->drs_rewritten_psize += BP_GET_PSIZE(&bps[i]);
+		}
+		dbuf_rele(dbs[i], FTAG);
+	}
+
+	if (error == 0)
+		dmu_tx_commit(tx);
+	return (error);
+}
+
+/*
+ * Work through object from *offsetp until it is done, setting *offsetp
+ * to 0 and *donep, or until the call's budget is spent.
+ */
+static int
+dmu_recompress_object(recompress_arg_t *ra, uint64_t object,
+    uint64_t *offsetp, boolean_t *donep)
+{
+	dmu_recompress_stats_t *drs = ra->ra_stats;
+	uint64_t offset = *offsetp;
+	uint64_t blksz, blkid, maxblkid;
+	dnode_t *dn;
+	int error;
+
+	*donep = B_TRUE;
+	*offsetp = 0;
+
+	error = dnode_hold(ra->ra_os, object, FTAG, &dn);
+	if (error == ENOENT)
+		return (0);
+	if (error != 0)
+		return (error);
+
+	if (dn->dn_type != DMU_OT_PLAIN_FILE_CONTENTS &&
+	    dn->dn_type != DMU_OT_ZVOL) {
+		dnode_rele(dn, FTAG);
+		return (0);
+	}
+	if (offset == 0)
+		drs->drs_objects++;
+
+	for (;;) {
+		if (drs->drs_bytes >= ra->ra_budget) {
+			*donep = B_FALSE;
+			*offsetp = offset;
+			break;
+		}
+
+		/* find the next block written since the last snapshot */
+		error = dnode_next_offset(dn, 0, &offset, 1, 1,
+		    ra->ra_mintxg);
+		if (error == ESRCH) {
+			error = 0;
+			break;
+		}
+		if (error != 0)
+			break;
+
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+		blksz = dn->dn_datablksz;
+		maxblkid = dn->dn_maxblkid;
+		rw_exit(&dn->dn_struct_rwlock);
+
+		blkid = dbuf_whichblock(dn, 0, offset);
+		if (blkid > maxblkid)
+			break;
+		error = dmu_recompress_chunk(ra, dn, blkid,
+		    MIN(RECOMPRESS_CHUNK, maxblkid - blkid + 1));
+		if (error != 0)
+			break;
+		offset = (blkid + RECOMPRESS_CHUNK) * blksz;
+	}
+
+	dnode_rele(dn, FTAG);
+	return (error);
+}
+
+/*
+ * Do up to budget bytes' worth of a recompression pass over os, see
+ * above.  A pass starts with *objectp == 0; each call resumes from and
+ * updates the cursor in *objectp and *offsetp, and sets *objectp back to
+ * 0 when the pass has visited every object.  The objset must be a
+ * writable head dataset.
+ */
+int
+dmu_recompress(objset_t *os, enum zio_compress compress, uint64_t age,
+    uint64_t budget, uint64_t *objectp, uint64_t *offsetp,
+    dmu_recompress_stats_t *drs)
+{
+	recompress_arg_t ra;
+	uint64_t object = *objectp;
+	uint64_t offset = *offsetp;
+	uint64_t last = spa_last_synced_txg(dmu_objset_spa(os));
+	boolean_t done;
+	int error = 0;
+
+	if (dmu_objset_is_snapshot(os) || os->os_dsl_dataset == NULL)
+		return (SET_ERROR(EINVAL));
+
+	bzero(drs, sizeof (*drs));
+	ra.ra_os = os;
+	ra.ra_compress = compress;
+	ra.ra_mintxg = dsl_dataset_phys(os->os_dsl_dataset)->ds_prev_snap_txg;
+	ra.ra_maxtxg = last > age ? last - age : 0;
+	ra.ra_budget = budget;
+	ra.ra_stats = drs;
+
+	if (object == 0) {
+		offset = 0;
+		error = dmu_object_next(os, &object, B_FALSE, 0);
+	}
+
+	while (error == 0) {
+		if (issig(JUSTLOOKING) && issig(FORREAL)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+		error = dmu_recompress_object(&ra, object, &offset, &done);
+		if (error != 0 || !done)
+			break;
+		error = dmu_object_next(os, &object, B_FALSE, 0);
+	}
+
+	if (error == ESRCH) {
+		/* the pass is complete */
+		object = 0;
+		offset = 0;
+		error = 0;
+	}
+	*objectp = object;
+	*offsetp = offset;
+	return (error);
+}
+
+/*
+ * Add the statistics to nvl as part of the outnvl of ZFS_IOC_RECOMPRESS,
+ * see zfs_ioc_recompress().
+ */
+void
+dmu_recompress_to_nvlist(const dmu_recompress_stats_t *drs, nvlist_t *nvl)
+{
+	fnvlist_add_uint64(nvl, "objects", drs->drs_objects);
+	fnvlist_add_uint64(nvl, "blocks", drs->drs_blocks);
+	fnvlist_add_uint64(nvl, "bytes", drs->drs_bytes);
+	fnvlist_add_uint64(nvl, "rewritten", drs->drs_rewritten);
+	fnvlist_add_uint64(nvl, "rewritten_lsize", drs->drs_rewritten_lsize);
+	fnvlist_add_uint64(nvl, "rewritten_psize", drs->drs_rewritten_psize);
+	fnvlist_add_uint64(nvl, "skipped_snapshot", drs->drs_skipped_snap);
+	fnvlist_add_uint64(nvl, "skipped_young", drs->drs_skipped_young);
+	fnvlist_add_uint64(nvl, "skipped_done", drs->drs_skipped_done);
+	fnvlist_add_uint64(nvl, "errors", drs->drs_errors);
+}
@@ -0,0 +1,224 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+/*
+ * Sampled block statistics of a dataset.
+ *
+ * Walking every block of a large dataset to learn its block size and
+ * compression distribution takes as long as a scrub.  Instead the walk
+ * follows only a pseudo-random subset of the level 1 indirect blocks of
+ * each data object, and counts the level 0 blocks below them, so that only
+ * the metadata above level 1 and the sampled L1 blocks are read.  Objects
+ * too small to have an indirect block are sampled block by block.
+ *
+ * Which blocks are sampled is a function of their object and block id
+ * only, so the same rate gives the same subset on every run and in every
+ * snapshot of a dataset, and their results can be compared directly.
+ * Counts are those of the sample; scale them by dss_units over
+ * dss_units_sampled to estimate the whole dataset.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dmu.h>
+#include <sys/dmu_sample.h>
+#include <sys/dmu_traverse.h>
+#include <sys/dsl_dataset.h>
+#include <sys/spa.h>
+#include <sys/vdev_impl.h>
+
+/* bucket limits of dss_ratio_hist, lsize/psize in hundredths */
+const uint64_t dmu_sample_ratio_limits[DMU_SAMPLE_RATIO_BUCKETS] = {
+	110, 125, 150, 200, 300, 400, 800, UINT64_MAX
+};
+
+static boolean_t
+dmu_sample_pick(const zbookmark_phys_t *zb, uint64_t rate)
+{
+	uint64_t h;
+
+	if (rate >= DMU_SAMPLE_RATE_ALL)
+		return (B_TRUE);
+
+	/* the splitmix64 finalizer, over the block's object and id */
+	h = zb->zb_object * 0x9e3779b97f4a7c15ULL ^ zb->zb_blkid;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return (h % DMU_SAMPLE_RATE_ALL < rate);
+}
+
+static int
+dmu_sample_bucket(uint64_t size)
+{
+	int b = highbit64(size) - 1 - SPA_MINBLOCKSHIFT;
+
+	return (MIN(MAX(b, 0), DMU_SAMPLE_SIZE_BUCKETS - 1));
+}
+
+static void
+dmu_sample_count(spa_t *spa, dmu_sample_stats_t *dss, const blkptr_t *bp)
+{
+	uint64_t lsize = BP_GET_LSIZE(bp);
+	uint64_t psize, asize, ratio;
+	enum zio_compress comp = BP_GET_COMPRESS(bp);
+	vdev_t *vd;
+	int b;
+
+	dss->dss_blocks++;
+	dss->dss_lsize += lsize;
+	dss->dss_lsize_hist[dmu_sample_bucket(lsize)]++;
+
+	if (BP_IS_EMBEDDED(bp)) {
+		/* the data lives in the bp itself, nothing is allocated */
+		dss->dss_embedded++;
+		psize = BPE_GET_PSIZE(bp);
+		asize = 0;
+	} else {
+		psize = BP_GET_PSIZE(bp);
+		asize = BP_GET_ASIZE(bp);
+		dss->dss_asize += asize;
+		dss->dss_asize_hist[dmu_sample_bucket(asize)]++;
+
+		/* special vdevs cannot be removed, so the lookup is safe */
+		vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+		if (vd != NULL && vd->vdev_isspecial) {
+			dss->dss_special_blocks++;
+			dss->dss_special_asize += asize;
+		}
+	}
+	dss->dss_psize += psize;
+	dss->dss_psize_hist[dmu_sample_bucket(psize)]++;
+
+	ratio = lsize * 100 / MAX(psize, 1);
+	for (b = 0; ratio >= dmu_sample_ratio_limits[b]; b++)
+		;
+	dss->dss_ratio_hist[b]++;
+
+	if (comp < ZIO_COMPRESS_FUNCTIONS) {
+		dss->dss_comp_blocks[comp]++;
+		dss->dss_comp_lsize[comp] += lsize;
+		dss->dss_comp_psize[comp] += psize;
+	}
+}
+
+/* ARGSUSED */
+static int
+dmu_sample_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
+{
+	dmu_sample_stats_t *dss = arg;
+
+	if (issig(JUSTLOOKING) && issig(FORREAL))
+		return (SET_ERROR(EINTR));
+
+	/* always descend through the metadata to find every data object */
+	if (bp == NULL || zb->zb_level < 0 || BP_IS_HOLE(bp) ||
+	    DMU_OT_IS_METADATA(BP_GET_TYPE(bp)) || zb->zb_level > 1)
+		return (0);
+
+	/*
+	 * The level 0 blocks of an object with indirect blocks are only
+	 * reached below a sampled L1 block and are all counted.
+	 */
+	if (zb->zb_level == 1 || dnp->dn_nlevels == 1) {
+		dss->dss_units++;
+		if (!dmu_sample_pick(zb, dss->dss_rate))
+			return (zb->zb_level == 1 ?
+			    TRAVERSE_VISIT_NO_CHILDREN : 0);
+		dss->dss_units_sampled++;
+		if (zb->zb_level == 1)
+			return (0);
+	}
+
+	dmu_sample_count(spa, dss, bp);
+	return (0);
+}
+
+/*
+ * Sample the data blocks of ds at rate parts per million of its L1
+ * blocks, see above.  Blocks that cannot be read are skipped.
+ *
+ * NB: dataset must not be changing on-disk (eg, is a snapshot or we are
+ * in zdb), as for traverse_dataset().
+ */
+int
+dmu_sample_dataset(dsl_dataset_t *ds, uint64_t rate, dmu_sample_stats_t *dss)
+{
+	if (rate == 0)
+		return (SET_ERROR(EINVAL));
+
+	bzero(dss, sizeof (*dss));
+	dss->dss_rate = MIN(rate, DMU_SAMPLE_RATE_ALL);
+
+	/*
+	 * No TRAVERSE_PREFETCH_METADATA: it would read the L1 blocks that
+	 * are skipped, which is most of the cost the sampling saves.
+	 */
+	return (traverse_dataset(ds, 0, TRAVERSE_PRE | TRAVERSE_HARD,
+	    dmu_sample_cb, dss));
+}
+
+/*
+ * Add the statistics to nvl as the outnvl of ZFS_IOC_BLOCK_SAMPLE, see
+ * zfs_ioc_block_sample().
+ */
+void
+dmu_sample_to_nvlist(const dmu_sample_stats_t *dss, nvlist_t *nvl)
+{
+	nvlist_t *comp = fnvlist_alloc();
+
+	fnvlist_add_uint64(nvl, "rate_ppm", dss->dss_rate);
+	fnvlist_add_uint64(nvl, "units", dss->dss_units);
+	fnvlist_add_uint64(nvl, "units_sampled", dss->dss_units_sampled);
+	fnvlist_add_uint64(nvl, "blocks", dss->dss_blocks);
+	fnvlist_add_uint64(nvl, "embedded", dss->dss_embedded);
+	fnvlist_add_uint64(nvl, "lsize", dss->dss_lsize);
+	fnvlist_add_uint64(nvl, "psize", dss->dss_psize);
+	fnvlist_add_uint64(nvl, "asize", dss->dss_asize);
+	fnvlist_add_uint64(nvl, "special_blocks", dss->dss_special_blocks);
+	fnvlist_add_uint64(nvl, "special_asize", dss->dss_special_asize);
+	fnvlist_add_uint64_array(nvl, "lsize_histogram",
+	    (uint64_t *)dss->dss_lsize_hist, DMU_SAMPLE_SIZE_BUCKETS);
+	fnvlist_add_uint64_array(nvl, "psize_histogram",
+	    (uint64_t *)dss->dss_psize_hist, DMU_SAMPLE_SIZE_BUCKETS);
+	fnvlist_add_uint64_array(nvl, "asize_histogram",
+	    (uint64_t *)dss->dss_asize_hist, DMU_SAMPLE_SIZE_BUCKETS);
+	fnvlist_add_uint64_array(nvl, "ratio_histogram",
+	    (uint64_t *)dss->dss_ratio_hist, DMU_SAMPLE_RATIO_BUCKETS);
+
+	for (int c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		uint64_t v[3];
+
+		if (dss->dss_comp_blocks[c] == 0)
+			continue;
+		v[0] = dss->dss_comp_blocks[c];
+		v[1] = dss->dss_comp_lsize[c];
+		v[2] = dss->dss_comp_psize[c];
+		fnvlist_add_uint64_array(comp, zio_compress_table[c].ci_name,
+		    v, 3);
+	}
+	fnvlist_add_nvlist(nvl, "compress", comp);
+	fnvlist_free(comp);
+}
@@ -37,6 +37,7 @@
 #include <sys/dmu_objset.h>
 #include <sys/dmu_traverse.h>
 #include <sys/dsl_dataset.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dsl_dir.h>
 #include <sys/dsl_prop.h>
 #include <sys/dsl_pool.h>
@@ -45,6 +46,7 @@
 #include <sys/zap.h>
 #include <sys/zio_checksum.h>
 #include <sys/zfs_znode.h>
+#include <sys/sa_impl.h>
 #include <zfs_fletcher.h>
 #include <sys/avl.h>
 #include <sys/ddt.h>
@@ -61,6 +63,43 @@
 int zfs_send_corrupt_data = B_FALSE;
 int zfs_send_queue_length = 16 * 1024 * 1024;
 int zfs_recv_queue_length = 16 * 1024 * 1024;
+/*
+ * Number of threads applying the records of a receive to the objset, and
+ * the most bytes of consecutive writes to one object that one of them will
+ * apply in a single tx.  With zfs_recv_writers set to 0 every record is
+ * applied by the thread taking them off the receive queue.
+ */
+int zfs_recv_writers = 4;
+int zfs_recv_write_batch = 1024 * 1024;
+/*
+ * Number of threads reading the data blocks of a send ahead of the thread
+ * writing the stream, and the most bytes they may have read or be reading
+ * ahead of it.  With zfs_send_readers set to 0 the writing thread reads
+ * each block itself when it gets to it.
+ */
+int zfs_send_readers = 8;
+int zfs_send_read_window = 32 * 1024 * 1024;
+/*
+ * Records are gathered into writes of up to this many bytes to the output
+ * file, rather than written one by one.  Set to 0 to write each record (and
+ * its payload) as it is generated.
+ */
+int zfs_send_write_size = 1024 * 1024;
+/*
+ * A stream received from a regular file is read from it this many bytes at
+ * a time, and the records taken out of that buffer, rather than with a read
+ * for every record header.  Payloads at least this large are still read
+ * straight into their own buffers.  Set to 0 to read each record as it is
+ * needed.
+ */
+int zfs_recv_read_size = 1024 * 1024;
+/*
+ * Send size estimates read the data beneath 1 in this many level 1 indirect
+ * blocks, after the first few, and scale what they find to the rest.  Set
+ * it to 1 for an exact (and slow) count.
+ */
+int zfs_send_estimate_sample_rate = 32;
+int zfs_send_estimate_min_samples = 32;
 /* Set this tunable to FALSE to disable setting of DRR_FLAG_FREERECORDS */
 uint64_t zfs_send_set_freerecords_bit = B_TRUE;
 
@@ -81,6 +120,26 @@ struct send_thread_arg {
 	int		error_code;
 	boolean_t	cancel;
 	zbookmark_phys_t resume;
+	uint64_t	*traversed;	/* bytes of blocks queued */
+	objset_t	*os;
+	dmu_send_filter_t *filter; /* objects to skip, or NULL */
+};
+
+/*
+ * The records taken off the traversal queue by the thread writing the
+ * stream, in stream order.  The data blocks among them are being read by
+ * the taskq; the writing thread waits for the read of the first record
+ * before dumping it.
+ */
+struct send_reader_arg {
+	struct send_thread_arg *sta;	/* traversal feeding the window */
+	dmu_sendarg_t	*dsa;
+	taskq_t		*tq;
+	kmutex_t	lock;
+	kcondvar_t	cv;		/* signalled when a read completes */
+	list_t		window;
+	uint64_t	window_bytes;	/* of blocks read or being read */
+	boolean_t	eos;		/* end of stream is in the window */
 };
 
 struct send_block_record {
@@ -90,14 +149,21 @@ struct send_block_record {
 	uint8_t			indblkshift;
 	uint16_t		datablkszsec;
 	bqueue_node_t		ln;
+
+	/* read ahead by the send readers, see send_reader_arg */
+	struct send_reader_arg	*sra;
+	list_node_t		rd_node;
+	boolean_t		read_issued;
+	boolean_t		read_pending;
+	int			read_err;
+	arc_buf_t		*abuf;
 };
 
 static int
-dump_bytes(dmu_sendarg_t *dsp, void *buf, int len)
+dump_write(dmu_sendarg_t *dsp, void *buf, int len)
 {
 	dsl_dataset_t *ds = dmu_objset_ds(dsp->dsa_os);
 	ssize_t resid; /* have to get resid to get detailed errno */
-	ASSERT0(len % 8);
 
 #ifdef _KERNEL
 	dsp->dsa_err = spl_vn_rdwr(UIO_WRITE, dsp->dsa_vp,
@@ -114,6 +180,40 @@ dump_bytes(dmu_sendarg_t *dsp, void *buf, int len)
 	return (dsp->dsa_err);
 }
 
+/*
+ * Write out whatever is in dsa_buf.  Done after the END record, since the
+ * caller may write its own records to the file once we return.
+ */
+static int
+dump_flush(dmu_sendarg_t *dsp)
+{
+	int len = dsp->dsa_buf_len;
+
+	if (len == 0 || dsp->dsa_err != 0)
+		return (dsp->dsa_err);
+	dsp->dsa_buf_len = 0;
+	return (dump_write(dsp, dsp->dsa_buf, len));
+}
+
+static int
+dump_bytes(dmu_sendarg_t *dsp, void *buf, int len)
+{
+	ASSERT0(len % 8);
+
+	if (dsp->dsa_buf == NULL)
+		return (dump_write(dsp, buf, len));
+
+	if (dsp->dsa_buf_len + len > dsp->dsa_buf_size) {
+		if (dump_flush(dsp) != 0)
+			return (dsp->dsa_err);
+		if (len >= dsp->dsa_buf_size)
+			return (dump_write(dsp, buf, len));
+	}
+	bcopy(buf, dsp->dsa_buf + dsp->dsa_buf_len, len);
+	dsp->dsa_buf_len += len;
+	return (0);
+}
+
 /*
  * For all record types except BEGIN, fill in the checksum (overlaid in
  * drr_u.drr_checksum.drr_checksum).  The checksum verifies everything
@@ -148,6 +248,8 @@ dump_record(dmu_sendarg_t *dsp, void *payload, int payload_len)
 		if (dump_bytes(dsp, payload, payload_len) != 0)
 			return (SET_ERROR(EINTR));
 	}
+	if (dsp->dsa_sent_end && dump_flush(dsp) != 0)
+		return (SET_ERROR(EINTR));
 	return (0);
 }
 
@@ -421,6 +523,253 @@ dump_freeobjects(dmu_sendarg_t *dsp, uint64_t firstobj, uint64_t numobjs)
 	return (0);
 }
 
+/*
+ * A send filter: the objects, and the path prefixes of the files and
+ * directories, to leave out of a stream.  Once the send has started it is
+ * asked about each object twice, by the traversal (which skips the blocks
+ * of the objects left out) and by the thread writing the stream (which
+ * sends FREEOBJECTS in place of their OBJECT records).  The objects and
+ * paths are only read then; dsf_judged holds the verdicts on paths that
+ * one of the two has looked up and the other has yet to ask for.
+ */
+struct dmu_send_filter {
+	avl_tree_t	dsf_objs;	/* of send_filter_obj_t */
+	char		**dsf_paths;
+	uint_t		dsf_npaths;
+	kmutex_t	dsf_lock;	/* protects dsf_judged */
+	avl_tree_t	dsf_judged;	/* of send_filter_obj_t */
+};
+
+typedef struct send_filter_obj {
+	avl_node_t	sfo_node;
+	uint64_t	sfo_object;
+	boolean_t	sfo_excluded;	/* the verdict, in dsf_judged */
+} send_filter_obj_t;
+
+static int
+send_filter_obj_compare(const void *x1, const void *x2)
+{
+	const send_filter_obj_t *s1 = x1;
+	const send_filter_obj_t *s2 = x2;
+
+	if (s1->sfo_object < s2->sfo_object)
+		return (-1);
+	if (s1->sfo_object > s2->sfo_object)
+		return (1);
+	return (0);
+}
+
+/*
+ * Build the filter given by the "exclude_objs" (uint64 array) and
+ * "exclude_paths" (string array, relative to the root of the dataset) of
+ * nvl.  *dsfp is set to NULL if nvl excludes nothing.
+ */
+int
+dmu_send_filter_create(nvlist_t *nvl, dmu_send_filter_t **dsfp)
+{
+	dmu_send_filter_t *dsf;
+	send_filter_obj_t *sfo;
+	avl_index_t where;
+	uint64_t *objs = NULL;
+	char **paths = NULL;
+	uint_t nobjs = 0, npaths = 0;
+	uint_t i;
+
+	*dsfp = NULL;
+	if (nvl == NULL)
+		return (0);
+	(void) nvlist_lookup_uint64_array(nvl, "exclude_objs", &objs, &nobjs);
+	(void) nvlist_lookup_string_array(nvl, "exclude_paths", &paths,
+	    &npaths);
+	if (nobjs == 0 && npaths == 0)
+		return (0);
+
+	for (i = 0; i < npaths; i++) {
+		size_t len = strlen(paths[i]);
+
+		/* "/" alone would leave out the root directory */
+		while (len > 0 && paths[i][len - 1] == '/')
+			len--;
+		if (paths[i][0] != '/' || len == 0 || len >= MAXPATHLEN)
+			return (SET_ERROR(EINVAL));
+	}
+
+	dsf = kmem_zalloc(sizeof (*dsf), KM_SLEEP);
+	avl_create(&dsf->dsf_objs, send_filter_obj_compare,
+	    sizeof (send_filter_obj_t), offsetof(send_filter_obj_t, sfo_node));
+	avl_create(&dsf->dsf_judged, send_filter_obj_compare,
+	    sizeof (send_filter_obj_t), offsetof(send_filter_obj_t, sfo_node));
+	mutex_init(&dsf->dsf_lock, NULL, MUTEX_DEFAULT, NULL);
+	for (i = 0; i < nobjs; i++) {
+		sfo = kmem_alloc(sizeof (*sfo), KM_SLEEP);
+		sfo->sfo_object = objs[i];
+		if (avl_find(&dsf->dsf_objs, sfo, &where) != NULL) {
+			kmem_free(sfo, sizeof (*sfo));
+			continue;
+		}
+		avl_insert(&dsf->dsf_objs, sfo, where);
+	}
+
+	if (npaths != 0) {
+		dsf->dsf_paths = kmem_alloc(npaths * sizeof (char *), KM_SLEEP);
+		dsf->dsf_npaths = npaths;
+	}
+	for (i = 0; i < npaths; i++) {
+		size_t len = strlen(paths[i]);
+
+		/* "/a/b/" is the prefix "/a/b" */
+		while (len > 0 && paths[i][len - 1] == '/')
+			len--;
+		dsf->dsf_paths[i] = kmem_alloc(len + 1, KM_SLEEP);
+		bcopy(paths[i], dsf->dsf_paths[i], len);
+		dsf->dsf_paths[i][len] = '\0';
+	}
+
+	*dsfp = dsf;
+	return (0);
+}
+
+void
+dmu_send_filter_destroy(dmu_send_filter_t *dsf)
+{
+	send_filter_obj_t *sfo;
+	void *cookie = NULL;
+	uint_t i;
+
+	if (dsf == NULL)
+		return;
+
+	while ((sfo = avl_destroy_nodes(&dsf->dsf_objs, &cookie)) != NULL)
+		kmem_free(sfo, sizeof (*sfo));
+	avl_destroy(&dsf->dsf_objs);
+	cookie = NULL;
+	while ((sfo = avl_destroy_nodes(&dsf->dsf_judged, &cookie)) != NULL)
+		kmem_free(sfo, sizeof (*sfo));
+	avl_destroy(&dsf->dsf_judged);
+	mutex_destroy(&dsf->dsf_lock);
+	for (i = 0; i < dsf->dsf_npaths; i++)
+		kmem_free(dsf->dsf_paths[i], strlen(dsf->dsf_paths[i]) + 1);
+	if (dsf->dsf_npaths != 0)
+		kmem_free(dsf->dsf_paths, dsf->dsf_npaths * sizeof (char *));
+	kmem_free(dsf, sizeof (*dsf));
+}
+
+/*
+ * Refuse a filter that leaves out an object that the dataset cannot do
+ * without: for a file system the master node, the objects it names (the
+ * root directory, the delete queue, the SA registry and so on) and those
+ * named by the SA master node; for a volume its data and its properties.
+ */
+static int
+send_filter_check(const dmu_send_filter_t *dsf, objset_t *os)
+{
+	const char *names[] = { ZFS_ROOT_OBJ, ZFS_UNLINKED_SET, ZFS_SA_ATTRS,
+	    ZFS_FUID_TABLES, ZFS_SHARES_DIR,
+	    zfs_userquota_prop_prefixes[ZFS_PROP_USERQUOTA],
+	    zfs_userquota_prop_prefixes[ZFS_PROP_GROUPQUOTA] };
+	const char *sa_names[] = { SA_LAYOUTS, SA_REGISTRY };
+	uint64_t objs[2 + ARRAY_SIZE(names) + ARRAY_SIZE(sa_names)];
+	send_filter_obj_t search;
+	uint64_t sa_obj;
+	int i, n = 0;
+
+	switch (dmu_objset_type(os)) {
+	case DMU_OST_ZVOL:
+		objs[n++] = ZVOL_OBJ;
+		objs[n++] = ZVOL_ZAP_OBJ;
+		break;
+	case DMU_OST_ZFS:
+		objs[n++] = MASTER_NODE_OBJ;
+		for (i = 0; i < ARRAY_SIZE(names); i++) {
+			if (zap_lookup(os, MASTER_NODE_OBJ, names[i], 8, 1,
+			    &objs[n]) == 0)
+				n++;
+		}
+		if (zap_lookup(os, MASTER_NODE_OBJ, ZFS_SA_ATTRS, 8, 1,
+		    &sa_obj) != 0)
+			break;
+		for (i = 0; i < ARRAY_SIZE(sa_names); i++) {
+			if (zap_lookup(os, sa_obj, sa_names[i], 8, 1,
+			    &objs[n]) == 0)
+				n++;
+		}
+		break;
+	default:
+		break;
+	}
+
+	for (i = 0; i < n; i++) {
+		search.sfo_object = objs[i];
+		if (avl_find(&dsf->dsf_objs, &search, NULL) != NULL)
+			return (SET_ERROR(EINVAL));
+	}
+	return (0);
+}
+
+/*
+ * Whether the filter leaves object out of the stream.  Paths are only
+ * looked up for the files and directories of a ZPL dataset; an object
+ * whose path cannot be found (say, an unlinked file still held open) is
+ * sent.  A file with several links is judged by the path of its first.
+ *
+ * The first of the traversal and dump_dnode() to ask about an object
+ * looks its path up, under dsf_lock so that the other waits for the
+ * verdict rather than looks it up as well, and leaves the verdict for the
+ * other to take.
+ */
+static boolean_t
+send_object_excluded(dmu_send_filter_t *dsf, objset_t *os,
+    uint64_t object, const dnode_phys_t *dnp)
+{
+	send_filter_obj_t search, *sfo;
+	avl_index_t where;
+	boolean_t excluded = B_FALSE;
+	char *path;
+	uint_t i;
+
+	if (dsf == NULL || DMU_OBJECT_IS_SPECIAL(object) ||
+	    dnp->dn_type == DMU_OT_NONE)
+		return (B_FALSE);
+
+	search.sfo_object = object;
+	if (avl_find(&dsf->dsf_objs, &search, NULL) != NULL)
+		return (B_TRUE);
+
+	if (dsf->dsf_npaths == 0 || dmu_objset_type(os) != DMU_OST_ZFS ||
+	    (dnp->dn_type != DMU_OT_PLAIN_FILE_CONTENTS &&
+	    dnp->dn_type != DMU_OT_DIRECTORY_CONTENTS))
+		return (B_FALSE);
+
+	mutex_enter(&dsf->dsf_lock);
+	sfo = avl_find(&dsf->dsf_judged, &search, &where);
+	if (sfo != NULL) {
+		excluded = sfo->sfo_excluded;
+		avl_remove(&dsf->dsf_judged, sfo);
+		mutex_exit(&dsf->dsf_lock);
+		kmem_free(sfo, sizeof (*sfo));
+		return (excluded);
+	}
+
+	path = kmem_alloc(MAXPATHLEN, KM_SLEEP);
+	if (zfs_obj_to_path(os, object, path, MAXPATHLEN) == 0) {
+		for (i = 0; i < dsf->dsf_npaths && !excluded; i++) {
+			size_t len = strlen(dsf->dsf_paths[i]);
+
+			excluded = (strncmp(path, dsf->dsf_paths[i],
+			    len) == 0 && (path[len] == '\0' ||
+			    path[len] == '/'));
+		}
+	}
+	kmem_free(path, MAXPATHLEN);
+
+	sfo = kmem_alloc(sizeof (*sfo), KM_SLEEP);
+	sfo->sfo_object = object;
+	sfo->sfo_excluded = excluded;
+	avl_insert(&dsf->dsf_judged, sfo, where);
+	mutex_exit(&dsf->dsf_lock);
+	return (excluded);
+}
+
 static int
 dump_dnode(dmu_sendarg_t *dsp, uint64_t object, dnode_phys_t *dnp)
 {
@@ -439,7 +788,8 @@ dump_dnode(dmu_sendarg_t *dsp, uint64_t object, dnode_phys_t *dnp)
 		return (0);
 	}
 
-	if (dnp == NULL || dnp->dn_type == DMU_OT_NONE)
+	if (dnp == NULL || dnp->dn_type == DMU_OT_NONE ||
+	    send_object_excluded(dsp->dsa_filter, dsp->dsa_os, object, dnp))
 		return (dump_freeobjects(dsp, object, 1));
 
 	if (dsp->dsa_pending_op != PENDING_NONE) {
@@ -458,6 +808,7 @@ dump_dnode(dmu_sendarg_t *dsp, uint64_t object, dnode_phys_t *dnp)
 	drro->drr_bonuslen = dnp->dn_bonuslen;
 	drro->drr_checksumtype = dnp->dn_checksum;
 	drro->drr_compress = dnp->dn_compress;
+	drro->drr_dn_slots = dnp->dn_extra_slots + 1;
 	drro->drr_toguid = dsp->dsa_toguid;
 
 	if (!(dsp->dsa_featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS) &&
@@ -527,6 +878,9 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 
 	if (bp == NULL) {
 		ASSERT3U(zb->zb_level, ==, ZB_DNODE_LEVEL);
+		if (send_object_excluded(sta->filter, sta->os, zb->zb_object,
+		    dnp))
+			return (TRAVERSE_VISIT_NO_CHILDREN);
 		return (0);
 	} else if (zb->zb_level < 0) {
 		return (0);
@@ -539,6 +893,8 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	record->indblkshift = dnp->dn_indblkshift;
 	record->datablkszsec = dnp->dn_datablkszsec;
 	record_size = dnp->dn_datablkszsec << SPA_MINBLOCKSHIFT;
+	if (zb->zb_level == 0 && !BP_IS_HOLE(bp))
+		atomic_add_64(sta->traversed, BP_GET_LSIZE(bp));
 	bqueue_enqueue(&sta->q, record, record_size);
 
 	return (err);
@@ -571,6 +927,87 @@ send_traverse_thread(void *arg)
 	thread_exit();
 }
 
+/*
+ * If we have large blocks stored on disk but the send flags don't allow
+ * us to send large blocks, we split the data from the arc buf into chunks.
+ */
+static boolean_t
+send_split_large_blocks(dmu_sendarg_t *dsa, int blksz)
+{
+	return (blksz > SPA_OLD_MAXBLOCKSIZE &&
+	    !(dsa->dsa_featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS));
+}
+
+/*
+ * Does do_dump() read this record as a level-0 block of a regular object
+ * (and so can it be read ahead by the send readers)?
+ */
+static boolean_t
+send_record_is_data(dmu_sendarg_t *dsa, struct send_block_record *data)
+{
+	const blkptr_t *bp = &data->bp;
+	const zbookmark_phys_t *zb = &data->zb;
+
+	if (DMU_OBJECT_IS_SPECIAL(zb->zb_object) ||
+	    zb->zb_object == DMU_META_DNODE_OBJECT ||
+	    BP_IS_HOLE(bp) || zb->zb_level != 0)
+		return (B_FALSE);
+
+	switch (BP_GET_TYPE(bp)) {
+	case DMU_OT_OBJSET:
+	case DMU_OT_DNODE:
+	case DMU_OT_SA:
+		return (B_FALSE);
+	default:
+		return (!backup_do_embed(dsa, bp));
+	}
+}
+
+/*
+ * Read the data of a level-0 block of a regular object for do_dump(),
+ * from send_read_task() if it has been read ahead.
+ */
+static int
+send_read_block(dmu_sendarg_t *dsa, struct send_block_record *data,
+    arc_buf_t **abufp)
+{
+	dsl_dataset_t *ds = dmu_objset_ds(dsa->dsa_os);
+	spa_t *spa = ds->ds_dir->dd_pool->dp_spa;
+	const blkptr_t *bp = &data->bp;
+	int blksz = data->datablkszsec << SPA_MINBLOCKSHIFT;
+	arc_flags_t aflags = ARC_FLAG_WAIT;
+	enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
+	int err;
+
+	/*
+	 * We should only request compressed data from the ARC if all
+	 * the following are true:
+	 *  - stream compression was requested
+	 *  - we aren't splitting large blocks into smaller chunks
+	 *  - the data won't need to be byteswapped before sending
+	 *  - this isn't an embedded block
+	 *  - this isn't metadata (if receiving on a different endian
+	 *    system it can be byteswapped more easily)
+	 *  - this isn't zstd, which the stream format has no feature
+	 *    flag for, so the receiver could not check it can read it
+	 */
+	boolean_t request_compressed =
+	    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
+	    !send_split_large_blocks(dsa, blksz) && !BP_SHOULD_BYTESWAP(bp) &&
+	    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp)) &&
+	    !ZIO_COMPRESS_IS_ZSTD(BP_GET_COMPRESS(bp));
+
+	if (request_compressed)
+		zioflags |= ZIO_FLAG_RAW;
+
+	*abufp = NULL;
+	err = arc_read(NULL, spa, bp, arc_getbuf_func, abufp,
+	    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, &data->zb);
+	if (err == 0)
+		atomic_add_64(&dsa->dsa_read_bytes, BP_GET_LSIZE(bp));
+	return (err);
+}
+
 /*
  * This function actually handles figuring out what kind of record needs to be
  * dumped, reading the data (which has hopefully been prefetched), and calling
@@ -621,7 +1058,8 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 
 		dnode_phys_t *blk = abuf->b_data;
 		uint64_t dnobj = zb->zb_blkid * (blksz >> DNODE_SHIFT);
-		for (int i = 0; i < blksz >> DNODE_SHIFT; i++) {
+		for (int i = 0; i < blksz >> DNODE_SHIFT;
+		    i += blk[i].dn_extra_slots + 1) {
 			err = dump_dnode(dsa, dnobj + i, blk + i);
 			if (err != 0)
 				break;
@@ -647,37 +1085,11 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		    zb->zb_blkid * blksz, blksz, bp);
 	} else {
 		/* it's a level-0 block of a regular object */
-		arc_flags_t aflags = ARC_FLAG_WAIT;
 		arc_buf_t *abuf;
 		int blksz = dblkszsec << SPA_MINBLOCKSHIFT;
 		uint64_t offset;
-
-		/*
-		 * If we have large blocks stored on disk but the send flags
-		 * don't allow us to send large blocks, we split the data from
-		 * the arc buf into chunks.
-		 */
-		boolean_t split_large_blocks = blksz > SPA_OLD_MAXBLOCKSIZE &&
-		    !(dsa->dsa_featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS);
-		/*
-		 * We should only request compressed data from the ARC if all
-		 * the following are true:
-		 *  - stream compression was requested
-		 *  - we aren't splitting large blocks into smaller chunks
-		 *  - the data won't need to be byteswapped before sending
-		 *  - this isn't an embedded block
-		 *  - this isn't metadata (if receiving on a different endian
-		 *    system it can be byteswapped more easily)
-		 */
-		boolean_t request_compressed =
-		    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
-		    !split_large_blocks && !BP_SHOULD_BYTESWAP(bp) &&
-		    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp));
-
-		ASSERT0(zb->zb_level);
-		ASSERT(zb->zb_object > dsa->dsa_resume_object ||
-		    (zb->zb_object == dsa->dsa_resume_object &&
-		    zb->zb_blkid * blksz >= dsa->dsa_resume_offset));
+		boolean_t split_large_blocks = send_split_large_blocks(dsa,
+		    blksz);
 
 		ASSERT0(zb->zb_level);
 		ASSERT(zb->zb_object > dsa->dsa_resume_object ||
@@ -686,11 +1098,16 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 
 		ASSERT3U(blksz, ==, BP_GET_LSIZE(bp));
 
-		enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
-		if (request_compressed)
-			zioflags |= ZIO_FLAG_RAW;
-		if (arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
-		    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, zb) != 0) {
+		if (data->read_issued) {
+			ASSERT(!data->read_pending);
+			abuf = data->abuf;
+			data->abuf = NULL;
+			err = data->read_err;
+		} else {
+			err = send_read_block(dsa, data, &abuf);
+		}
+		if (err != 0) {
+			err = 0;
 			if (zfs_send_corrupt_data) {
 				/* Send a block filled with 0x"zfs badd bloc" */
 				abuf = arc_alloc_buf(spa, &abuf, ARC_BUFC_DATA,
@@ -711,6 +1128,13 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 			ASSERT3U(arc_get_compression(abuf), ==,
 			    ZIO_COMPRESS_OFF);
 			char *buf = abuf->b_data;
+
+			/*
+			 * A large microzap (see zap_micro_max_size) would
+			 * not be a zap at all once split.
+			 */
+			if (DMU_OT_BYTESWAP(type) == DMU_BSWAP_ZAP)
+				err = SET_ERROR(ENOTSUP);
 			while (blksz > 0 && err == 0) {
 				int n = MIN(blksz, SPA_OLD_MAXBLOCKSIZE);
 				err = dump_write(dsa, type, zb->zb_object,
@@ -730,15 +1154,80 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 	return (err);
 }
 
+static void
+send_read_task(void *arg)
+{
+	struct send_block_record *data = arg;
+	struct send_reader_arg *sra = data->sra;
+	arc_buf_t *abuf;
+	int err;
+
+	err = send_read_block(sra->dsa, data, &abuf);
+
+	mutex_enter(&sra->lock);
+	data->abuf = abuf;
+	data->read_err = err;
+	data->read_pending = B_FALSE;
+	cv_broadcast(&sra->cv);
+	mutex_exit(&sra->lock);
+}
+
 /*
- * Pop the new data off the queue, and free the old data.
+ * Take records off the traversal queue until the reads of the window fill
+ * zfs_send_read_window, or up to the end of the stream, and hand the data
+ * blocks among them to the readers.  This only waits for the traversal
+ * when the window is empty, so that records which are ready are not held
+ * back by a slow traversal.
+ */
+static void
+send_reader_fill(struct send_reader_arg *sra)
+{
+	struct send_block_record *data;
+
+	while (!sra->eos && (list_is_empty(&sra->window) ||
+	    (sra->window_bytes < zfs_send_read_window &&
+	    !bqueue_empty(&sra->sta->q)))) {
+		data = bqueue_dequeue(&sra->sta->q);
+		data->sra = sra;
+		if (data->eos_marker) {
+			sra->eos = B_TRUE;
+		} else if (sra->tq != NULL && send_record_is_data(sra->dsa,
+		    data)) {
+			data->read_issued = B_TRUE;
+			data->read_pending = B_TRUE;
+			sra->window_bytes += BP_GET_LSIZE(&data->bp);
+			(void) taskq_dispatch(sra->tq, send_read_task, data,
+			    TQ_SLEEP);
+		}
+		list_insert_tail(&sra->window, data);
+	}
+}
+
+/*
+ * Free the old data, and return the next record once its data, if any,
+ * has been read.
  */
 static struct send_block_record *
-get_next_record(bqueue_t *bq, struct send_block_record *data)
+get_next_record(struct send_reader_arg *sra, struct send_block_record *data)
 {
-	struct send_block_record *tmp = bqueue_dequeue(bq);
-	kmem_free(data, sizeof (*data));
-	return (tmp);
+	if (data != NULL) {
+		if (data->abuf != NULL)
+			arc_buf_destroy(data->abuf, &data->abuf);
+		kmem_free(data, sizeof (*data));
+	}
+
+	send_reader_fill(sra);
+	data = list_remove_head(&sra->window);
+	ASSERT(data != NULL);
+
+	if (data->read_issued) {
+		mutex_enter(&sra->lock);
+		while (data->read_pending)
+			cv_wait(&sra->cv, &sra->lock);
+		mutex_exit(&sra->lock);
+		sra->window_bytes -= BP_GET_LSIZE(&data->bp);
+	}
+	return (data);
 }
 
 /*
@@ -750,8 +1239,8 @@ static int
 dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
     zfs_bookmark_phys_t *ancestor_zb, boolean_t is_clone,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    int outfd, uint64_t resumeobj, uint64_t resumeoff,
-    vnode_t *vp, offset_t *off)
+    dmu_send_filter_t *filter, int outfd, uint64_t resumeobj,
+    uint64_t resumeoff, vnode_t *vp, offset_t *off)
 {
 	objset_t *os;
 	dmu_replay_record_t *drr;
@@ -760,8 +1249,11 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	uint64_t fromtxg = 0;
 	uint64_t featureflags = 0;
 	struct send_thread_arg to_arg = { { { 0 } } };
+	struct send_reader_arg to_reader = { 0 };
 
 	err = dmu_objset_from_ds(to_ds, &os);
+	if (err == 0 && filter != NULL)
+		err = send_filter_check(filter, os);
 	if (err != 0) {
 		dsl_pool_rele(dp, tag);
 		return (err);
@@ -789,6 +1281,10 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 
 	if (large_block_ok && to_ds->ds_feature_inuse[SPA_FEATURE_LARGE_BLOCKS])
 		featureflags |= DMU_BACKUP_FEATURE_LARGE_BLOCKS;
+	if (to_ds->ds_feature_inuse[SPA_FEATURE_LARGE_DNODE])
+		featureflags |= DMU_BACKUP_FEATURE_LARGE_DNODE;
+	if (to_ds->ds_feature_inuse[SPA_FEATURE_INLINE_DATA])
+		featureflags |= DMU_BACKUP_FEATURE_INLINE_DATA;
 	if (embedok &&
 	    spa_feature_is_active(dp->dp_spa, SPA_FEATURE_EMBEDDED_DATA)) {
 		featureflags |= DMU_BACKUP_FEATURE_EMBED_DATA;
@@ -840,12 +1336,17 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	dsp->dsa_outfd = outfd;
 	dsp->dsa_proc = curproc;
 	dsp->dsa_os = os;
+	dsp->dsa_filter = filter;
 	dsp->dsa_off = off;
 	dsp->dsa_toguid = dsl_dataset_phys(to_ds)->ds_guid;
 	dsp->dsa_pending_op = PENDING_NONE;
 	dsp->dsa_featureflags = featureflags;
 	dsp->dsa_resume_object = resumeobj;
 	dsp->dsa_resume_offset = resumeoff;
+	if (zfs_send_write_size > 0) {
+		dsp->dsa_buf_size = P2ROUNDUP(zfs_send_write_size, 8);
+		dsp->dsa_buf = kmem_alloc(dsp->dsa_buf_size, KM_SLEEP);
+	}
 
 	mutex_enter(&to_ds->ds_sendstream_lock);
 	list_insert_head(&to_ds->ds_sendstreams, dsp);
@@ -856,17 +1357,35 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 
 	void *payload = NULL;
 	size_t payload_len = 0;
+	nvlist_t *nvl = NULL;
 	if (resumeobj != 0 || resumeoff != 0) {
 		dmu_object_info_t to_doi;
-		err = dmu_object_info(os, resumeobj, &to_doi);
-		if (err != 0)
-			goto out;
+		uint64_t blkid = 0;
+
+		/*
+		 * A receive may resume from the start of a block of dnodes,
+		 * whose first object need not be allocated.
+		 */
+		if (resumeoff != 0) {
+			err = dmu_object_info(os, resumeobj, &to_doi);
+			if (err != 0)
+				goto out;
+			blkid = resumeoff / to_doi.doi_data_block_size;
+		}
 		SET_BOOKMARK(&to_arg.resume, to_ds->ds_object, resumeobj, 0,
-		    resumeoff / to_doi.doi_data_block_size);
+		    blkid);
 
-		nvlist_t *nvl = fnvlist_alloc();
+		nvl = fnvlist_alloc();
 		fnvlist_add_uint64(nvl, "resume_object", resumeobj);
 		fnvlist_add_uint64(nvl, "resume_offset", resumeoff);
+	}
+	/* the receiving side marks the dataset, see dmu_recv_end_sync() */
+	if (filter != NULL) {
+		if (nvl == NULL)
+			nvl = fnvlist_alloc();
+		fnvlist_add_boolean(nvl, "filtered");
+	}
+	if (nvl != NULL) {
 		payload = fnvlist_pack(nvl, &payload_len);
 		drr->drr_payloadlen = payload_len;
 		fnvlist_free(nvl);
@@ -886,15 +1405,35 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	to_arg.ds = to_ds;
 	to_arg.fromtxg = fromtxg;
 	to_arg.flags = TRAVERSE_PRE | TRAVERSE_PREFETCH;
+	to_arg.traversed = &dsp->dsa_traversed_bytes;
+	to_arg.os = os;
+	to_arg.filter = filter;
+
+	/*
+	 * The readers take over prefetching the data blocks from the
+	 * traversal, leaving it only the metadata.
+	 */
+	to_reader.sta = &to_arg;
+	to_reader.dsa = dsp;
+	mutex_init(&to_reader.lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&to_reader.cv, NULL, CV_DEFAULT, NULL);
+	list_create(&to_reader.window, sizeof (struct send_block_record),
+	    offsetof(struct send_block_record, rd_node));
+	if (zfs_send_readers > 0) {
+		to_reader.tq = taskq_create("send_readers", zfs_send_readers,
+		    minclsyspri, zfs_send_readers, INT_MAX, TASKQ_PREPOPULATE);
+		to_arg.flags &= ~TRAVERSE_PREFETCH_DATA;
+	}
+
 	(void) thread_create(NULL, 0, send_traverse_thread, &to_arg, 0, curproc,
 	    TS_RUN, minclsyspri);
 
 	struct send_block_record *to_data;
-	to_data = bqueue_dequeue(&to_arg.q);
+	to_data = get_next_record(&to_reader, NULL);
 
 	while (!to_data->eos_marker && err == 0) {
 		err = do_dump(dsp, to_data);
-		to_data = get_next_record(&to_arg.q, to_data);
+		to_data = get_next_record(&to_reader, to_data);
 		if (issig(JUSTLOOKING) && issig(FORREAL))
 			err = EINTR;
 	}
@@ -902,11 +1441,18 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	if (err != 0) {
 		to_arg.cancel = B_TRUE;
 		while (!to_data->eos_marker) {
-			to_data = get_next_record(&to_arg.q, to_data);
+			to_data = get_next_record(&to_reader, to_data);
 		}
 	}
 	kmem_free(to_data, sizeof (*to_data));
 
+	ASSERT(list_is_empty(&to_reader.window));
+	if (to_reader.tq != NULL)
+		taskq_destroy(to_reader.tq);
+	list_destroy(&to_reader.window);
+	cv_destroy(&to_reader.cv);
+	mutex_destroy(&to_reader.lock);
+
 	bqueue_destroy(&to_arg.q);
 
 	if (err == 0 && to_arg.error_code != 0)
@@ -940,6 +1486,13 @@ out:
 
 	VERIFY(err != 0 || (dsp->dsa_sent_begin && dsp->dsa_sent_end));
 
+	/*
+	 * Even a failed stream gets what we had generated of it, so that a
+	 * resumable receive keeps as much of it as it can.
+	 */
+	(void) dump_flush(dsp);
+	if (dsp->dsa_buf != NULL)
+		kmem_free(dsp->dsa_buf, dsp->dsa_buf_size);
 	kmem_free(drr, sizeof (dmu_replay_record_t));
 	kmem_free(dsp, sizeof (dmu_sendarg_t));
 
@@ -951,7 +1504,7 @@ out:
 int
 dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    int outfd, vnode_t *vp, offset_t *off)
+    dmu_send_filter_t *filter, int outfd, vnode_t *vp, offset_t *off)
 {
 	dsl_pool_t *dp;
 	dsl_dataset_t *ds;
@@ -987,10 +1540,12 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 		is_clone = (fromds->ds_dir != ds->ds_dir);
 		dsl_dataset_rele(fromds, FTAG);
 		err = dmu_send_impl(FTAG, dp, ds, &zb, is_clone,
-		    embedok, large_block_ok, compressok, outfd, 0, 0, vp, off);
+		    embedok, large_block_ok, compressok, filter, outfd, 0, 0,
+		    vp, off);
 	} else {
 		err = dmu_send_impl(FTAG, dp, ds, NULL, B_FALSE,
-		    embedok, large_block_ok, compressok, outfd, 0, 0, vp, off);
+		    embedok, large_block_ok, compressok, filter, outfd, 0, 0,
+		    vp, off);
 	}
 	dsl_dataset_rele(ds, FTAG);
 	return (err);
@@ -998,8 +1553,8 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
-    boolean_t large_block_ok, boolean_t compressok, int outfd,
-    uint64_t resumeobj, uint64_t resumeoff,
+    boolean_t large_block_ok, boolean_t compressok, dmu_send_filter_t *filter,
+    int outfd, uint64_t resumeobj, uint64_t resumeoff,
     vnode_t *vp, offset_t *off)
 {
 	dsl_pool_t *dp;
@@ -1067,11 +1622,11 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 			return (err);
 		}
 		err = dmu_send_impl(FTAG, dp, ds, &zb, is_clone,
-		    embedok, large_block_ok, compressok,
+		    embedok, large_block_ok, compressok, filter,
 		    outfd, resumeobj, resumeoff, vp, off);
 	} else {
 		err = dmu_send_impl(FTAG, dp, ds, NULL, B_FALSE,
-		    embedok, large_block_ok, compressok,
+		    embedok, large_block_ok, compressok, filter,
 		    outfd, resumeobj, resumeoff, vp, off);
 	}
 	if (owned)
@@ -1081,61 +1636,238 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 	return (err);
 }
 
-static int
-dmu_adjust_send_estimate_for_indirects(dsl_dataset_t *ds, uint64_t uncompressed,
-    uint64_t compressed, boolean_t stream_compressed, uint64_t *sizep)
+/*
+ * Send size estimation.  Nearly all of a stream is the WRITE records of the
+ * data blocks born after the source txg and the OBJECT records of the
+ * dnodes in the dnode blocks born after it.  The latter are counted
+ * exactly, as are the WRITE records of objects whose blocks hang directly
+ * off their dnode.  Beneath the level 1 indirect blocks of other objects,
+ * only a sample of 1 in zfs_send_estimate_sample_rate (and the first
+ * zfs_send_estimate_min_samples) is read.  For each of those, the bytes of
+ * stream the data beneath it produces (y) are compared with a prediction
+ * from its fill count, one full-sized WRITE record per block (x), and the
+ * ratio of the sums over the sample scales the predictions of the rest.
+ * The prediction is all but exact for a full send that is not compressed;
+ * what the sample measures is compression and, for an incremental, the
+ * share of the blocks that changed.
+ *
+ * The error returned with the estimate is the half width of the ratio
+ * estimate's 95% confidence interval.
+ */
+struct estimate_send_arg {
+	boolean_t esa_compressed;
+	uint64_t esa_rate;
+	uint64_t esa_exact;	/* bytes of stream counted exactly */
+	uint64_t esa_nl1;	/* level 1 blocks born after from_txg */
+	uint64_t esa_pred;	/* predicted bytes beneath them */
+	/* the sampled level 1 blocks, squares and products in KiB */
+	uint64_t esa_n;
+	uint64_t esa_x;
+	uint64_t esa_y;
+	uint64_t esa_xx;
+	uint64_t esa_yy;
+	uint64_t esa_xy;
+	/* the sampled level 1 block being traversed */
+	boolean_t esa_sampling;
+	uint64_t esa_cur_obj;
+	uint64_t esa_cur_x;
+	uint64_t esa_cur_y;
+};
+
+static void
+send_estimate_end_sample(struct estimate_send_arg *esa)
+{
+	uint64_t x = esa->esa_cur_x >> 10;
+	uint64_t y = esa->esa_cur_y >> 10;
+
+	esa->esa_n++;
+	esa->esa_x += esa->esa_cur_x;
+	esa->esa_y += esa->esa_cur_y;
+	esa->esa_xx += x * x;
+	esa->esa_yy += y * y;
+	esa->esa_xy += x * y;
+	esa->esa_sampling = B_FALSE;
+}
+
+/* Bytes of stream sent for the level 0 block bp. */
+static uint64_t
+send_estimate_block(struct estimate_send_arg *esa, const blkptr_t *bp)
 {
-	int err;
 	uint64_t size;
+
+	if (BP_IS_EMBEDDED(bp))
+		size = P2ROUNDUP(BPE_GET_PSIZE(bp), 8);
+	else if (esa->esa_compressed &&
+	    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF)
+		size = BP_GET_PSIZE(bp);
+	else
+		size = BP_GET_LSIZE(bp);
+	return (sizeof (dmu_replay_record_t) + size);
+}
+
+/* ARGSUSED */
+static int
+dmu_estimate_send_traversal(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
+{
+	struct estimate_send_arg *esa = arg;
+	uint64_t size, hash;
+
 	/*
-	 * Assume that space (both on-disk and in-stream) is dominated by
-	 * data.  We will adjust for indirect blocks and the copies property,
-	 * but ignore per-object space used (eg, dnodes and DRR_OBJECT records).
+	 * The data blocks beneath a sampled level 1 block are visited right
+	 * after it, and anything else ends the sample.
 	 */
-	uint64_t recordsize;
-	uint64_t record_count;
+	if (esa->esa_sampling && (bp == NULL || zb->zb_level != 0 ||
+	    zb->zb_object != esa->esa_cur_obj ||
+	    zb->zb_blkid == DMU_SPILL_BLKID))
+		send_estimate_end_sample(esa);
+
+	/* the dnodes are counted, not the blocks holding them */
+	if (DMU_OBJECT_IS_SPECIAL(zb->zb_object) && bp != NULL)
+		return (0);
+
+	if (bp == NULL) {
+		/* an OBJECT record with its bonus buffer, and a FREE */
+		ASSERT3U(zb->zb_level, ==, ZB_DNODE_LEVEL);
+		if (!DMU_OBJECT_IS_SPECIAL(zb->zb_object) &&
+		    dnp->dn_type != DMU_OT_NONE) {
+			esa->esa_exact += 2 * sizeof (dmu_replay_record_t) +
+			    P2ROUNDUP(dnp->dn_bonuslen, 8);
+		}
+		return (0);
+	}
+
+	if (BP_IS_HOLE(bp) || zb->zb_level > 1)
+		return (0);
+
+	if (zb->zb_level == 0) {
+		size = send_estimate_block(esa, bp);
+		if (esa->esa_sampling)
+			esa->esa_cur_y += size;
+		else
+			esa->esa_exact += size;
+		return (0);
+	}
+
+	size = BP_GET_FILL(bp) * (sizeof (dmu_replay_record_t) +
+	    (dnp->dn_datablkszsec << SPA_MINBLOCKSHIFT));
+	esa->esa_nl1++;
+	esa->esa_pred += size;
+
+	hash = (zb->zb_object * 0x9E3779B97F4A7C15ULL + zb->zb_blkid) *
+	    0x9E3779B97F4A7C15ULL;
+	if (esa->esa_n >= zfs_send_estimate_min_samples &&
+	    (hash >> 32) % esa->esa_rate != 0)
+		return (TRAVERSE_VISIT_NO_CHILDREN);
+
+	esa->esa_sampling = B_TRUE;
+	esa->esa_cur_obj = zb->zb_object;
+	esa->esa_cur_x = size;
+	esa->esa_cur_y = 0;
+	return (0);
+}
+
+static uint64_t
+send_estimate_isqrt(uint64_t v)
+{
+	uint64_t r = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > v)
+		bit >>= 2;
+	while (bit != 0) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (r);
+}
+
+/* v * r / 2^16, for a 16.16 fixed point ratio r */
+static uint64_t
+send_estimate_scale(uint64_t v, uint64_t r)
+{
+	return ((v >> 16) * r + (((v & 0xffff) * r) >> 16));
+}
+
+/*
+ * Estimate the size of a stream of ds sent from from_txg (0 for a full
+ * send), and the error of the estimate.
+ */
+static int
+dmu_send_estimate_impl(dsl_dataset_t *ds, uint64_t from_txg,
+    boolean_t stream_compressed, uint64_t *sizep, uint64_t *errorp)
+{
+	struct estimate_send_arg esa = { 0 };
+	uint64_t x, y, r, n, nn, v, t;
+	int err;
 
-	/* Assume all (uncompressed) blocks are recordsize. */
-	err = dsl_prop_get_int_ds(ds, zfs_prop_to_name(ZFS_PROP_RECORDSIZE),
-	    &recordsize);
+	esa.esa_compressed = stream_compressed;
+	esa.esa_rate = MAX(zfs_send_estimate_sample_rate, 1);
+	err = traverse_dataset(ds, from_txg, TRAVERSE_PRE,
+	    dmu_estimate_send_traversal, &esa);
 	if (err != 0)
 		return (err);
-	record_count = uncompressed / recordsize;
+	if (esa.esa_sampling)
+		send_estimate_end_sample(&esa);
 
-	/*
-	 * If we're estimating a send size for a compressed stream, use the
-	 * compressed data size to estimate the stream size. Otherwise, use the
-	 * uncompressed data size.
-	 */
-	size = stream_compressed ? compressed : uncompressed;
+	/* the BEGIN and END records */
+	*sizep = esa.esa_exact + 2 * sizeof (dmu_replay_record_t);
+	if (errorp != NULL)
+		*errorp = 0;
 
-	/*
-	 * Subtract out approximate space used by indirect blocks.
-	 * Assume most space is used by data blocks (non-indirect, non-dnode).
-	 * Assume no ditto blocks or internal fragmentation.
-	 *
-	 * Therefore, space used by indirect blocks is sizeof(blkptr_t) per
-	 * block.
-	 */
-	size -= record_count * sizeof (blkptr_t);
+	n = esa.esa_n;
+	if (n == esa.esa_nl1) {
+		*sizep += esa.esa_y;
+		return (0);
+	}
 
-	/* Add in the space for the record associated with each block. */
-	size += record_count * sizeof (dmu_replay_record_t);
+	/* the ratio of actual to predicted, 16.16 fixed point */
+	x = esa.esa_x;
+	y = esa.esa_y;
+	while (y >= (1ULL << 47)) {
+		x >>= 1;
+		y >>= 1;
+	}
+	r = (x == 0) ? (1 << 16) : (y << 16) / x;
+	*sizep += esa.esa_y + send_estimate_scale(esa.esa_pred - esa.esa_x, r);
 
-	*sizep = size;
+	if (errorp == NULL)
+		return (0);
+	if (n < 2) {
+		*errorp = *sizep;
+		return (0);
+	}
 
+	/*
+	 * The variance of the residuals y - r * x over the sample, divided
+	 * by the sample size, and the standard error of the estimated total
+	 * sqrt(N * (N - n) * that).
+	 */
+	v = esa.esa_yy / n +
+	    send_estimate_scale(send_estimate_scale(esa.esa_xx / n, r), r);
+	t = 2 * send_estimate_scale(esa.esa_xy / n, r);
+	v = (v > t) ? (v - t) / (n - 1) : 0;
+	nn = esa.esa_nl1 * (esa.esa_nl1 - n);
+	if (v != 0 && v > UINT64_MAX / nn)
+		t = send_estimate_isqrt(v) * send_estimate_isqrt(nn);
+	else
+		t = send_estimate_isqrt(v * nn);
+	*errorp = MIN((t * 196 / 100) << 10, *sizep);
 	return (0);
 }
 
 int
 dmu_send_estimate(dsl_dataset_t *ds, dsl_dataset_t *fromds,
-    boolean_t stream_compressed, uint64_t *sizep)
+    boolean_t stream_compressed, uint64_t *sizep, uint64_t *errorp)
 {
 #ifdef DEBUG
 	dsl_pool_t *dp = ds->ds_dir->dd_pool;
 #endif
-	int err;
-	uint64_t uncomp, comp;
 
 	ASSERT(dsl_pool_config_held(dp));
 
@@ -1150,47 +1882,13 @@ dmu_send_estimate(dsl_dataset_t *ds, dsl_dataset_t *fromds,
 	/*
 	 * fromsnap must be an earlier snapshot from the same fs as tosnap,
 	 * or the origin's fs.
-	 */
-	if (fromds != NULL && !dsl_dataset_is_before(ds, fromds, 0))
-		return (SET_ERROR(EXDEV));
-
-	/* Get compressed and uncompressed size estimates of changed data. */
-	if (fromds == NULL) {
-		uncomp = dsl_dataset_phys(ds)->ds_uncompressed_bytes;
-		comp = dsl_dataset_phys(ds)->ds_compressed_bytes;
-	} else {
-		uint64_t used;
-		err = dsl_dataset_space_written(fromds, ds,
-		    &used, &comp, &uncomp);
-		if (err != 0)
-			return (err);
-	}
-
-	err = dmu_adjust_send_estimate_for_indirects(ds, uncomp, comp,
-	    stream_compressed, sizep);
-	return (err);
-}
-
-struct calculate_send_arg {
-	uint64_t uncompressed;
-	uint64_t compressed;
-};
-
-/*
- * Simple callback used to traverse the blocks of a snapshot and sum their
- * uncompressed and compressed sizes.
- */
-/* ARGSUSED */
-static int
-dmu_calculate_send_traversal(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
-    const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
-{
-	struct calculate_send_arg *space = arg;
-	if (bp != NULL && !BP_IS_HOLE(bp)) {
-		space->uncompressed += BP_GET_UCSIZE(bp);
-		space->compressed += BP_GET_PSIZE(bp);
-	}
-	return (0);
+	 */
+	if (fromds != NULL && !dsl_dataset_is_before(ds, fromds, 0))
+		return (SET_ERROR(EXDEV));
+
+	return (dmu_send_estimate_impl(ds, fromds == NULL ? 0 :
+	    dsl_dataset_phys(fromds)->ds_creation_txg, stream_compressed,
+	    sizep, errorp));
 }
 
 /*
@@ -1200,13 +1898,11 @@ dmu_calculate_send_traversal(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
  */
 int
 dmu_send_estimate_from_txg(dsl_dataset_t *ds, uint64_t from_txg,
-    boolean_t stream_compressed, uint64_t *sizep)
+    boolean_t stream_compressed, uint64_t *sizep, uint64_t *errorp)
 {
 #ifdef DEBUG
 	dsl_pool_t *dp = ds->ds_dir->dd_pool;
 #endif
-	int err;
-	struct calculate_send_arg size = { 0 };
 
 	ASSERT(dsl_pool_config_held(dp));
 
@@ -1219,18 +1915,8 @@ dmu_send_estimate_from_txg(dsl_dataset_t *ds, uint64_t from_txg,
 		return (SET_ERROR(EXDEV));
 	}
 
-	/*
-	 * traverse the blocks of the snapshot with birth times after
-	 * from_txg, summing their uncompressed size
-	 */
-	err = traverse_dataset(ds, from_txg, TRAVERSE_POST,
-	    dmu_calculate_send_traversal, &size);
-	if (err)
-		return (err);
-
-	err = dmu_adjust_send_estimate_for_indirects(ds, size.uncompressed,
-	    size.compressed, stream_compressed, sizep);
-	return (err);
+	return (dmu_send_estimate_impl(ds, from_txg, stream_compressed,
+	    sizep, errorp));
 }
 
 typedef struct dmu_recv_begin_arg {
@@ -1380,6 +2066,22 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LARGE_BLOCKS))
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * The pool must have the LARGE_DNODE feature enabled if the stream
+	 * contains dnodes larger than DNODE_MIN_SIZE.
+	 */
+	if ((featureflags & DMU_BACKUP_FEATURE_LARGE_DNODE) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LARGE_DNODE))
+		return (SET_ERROR(ENOTSUP));
+
+	/*
+	 * The pool must have the INLINE_DATA feature enabled if the stream
+	 * contains files whose data is held in their bonus buffers.
+	 */
+	if ((featureflags & DMU_BACKUP_FEATURE_INLINE_DATA) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_INLINE_DATA))
+		return (SET_ERROR(ENOTSUP));
+
 	error = dsl_dataset_hold(dp, tofs, FTAG, &ds);
 	if (error == 0) {
 		/* target fs already exists; recv into temp clone */
@@ -1458,10 +2160,14 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 				dsl_dataset_rele(ds, FTAG);
 				return (SET_ERROR(ENODEV));
 			}
+			error = dsl_crypto_params_check(ds->ds_dir, origin,
+			    NULL);
 			dsl_dataset_rele(origin, FTAG);
+		} else {
+			/* an encrypted parent's key must be loaded */
+			error = dsl_crypto_params_check(ds->ds_dir, NULL, NULL);
 		}
 		dsl_dataset_rele(ds, FTAG);
-		error = 0;
 	}
 	return (error);
 }
@@ -1491,7 +2197,7 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 			    drba->drba_snapobj, FTAG, &snap));
 		}
 		dsobj = dsl_dataset_create_sync(ds->ds_dir, recv_clone_name,
-		    snap, crflags, drba->drba_cred, tx);
+		    snap, crflags, drba->drba_cred, NULL, tx);
 		if (drba->drba_snapobj != 0)
 			dsl_dataset_rele(snap, FTAG);
 		dsl_dataset_rele(ds, FTAG);
@@ -1510,7 +2216,7 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 		/* Create new dataset. */
 		dsobj = dsl_dataset_create_sync(dd,
 		    strrchr(tofs, '/') + 1,
-		    origin, crflags, drba->drba_cred, tx);
+		    origin, crflags, drba->drba_cred, NULL, tx);
 		if (origin != NULL)
 			dsl_dataset_rele(origin, FTAG);
 		dsl_dir_rele(dd, FTAG);
@@ -1556,6 +2262,15 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 	dmu_buf_will_dirty(newds->ds_dbuf, tx);
 	dsl_dataset_phys(newds)->ds_flags |= DS_FLAG_INCONSISTENT;
 
+	/* The received objects' bonus buffers can hold file data */
+	if (DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
+	    DMU_BACKUP_FEATURE_INLINE_DATA) {
+		mutex_enter(&newds->ds_lock);
+		newds->ds_feature_activation_needed[SPA_FEATURE_INLINE_DATA] =
+		    B_TRUE;
+		mutex_exit(&newds->ds_lock);
+	}
+
 	/*
 	 * If we actually created a non-clone, we need to create the
 	 * objset in our new dataset.
@@ -1609,6 +2324,9 @@ dmu_recv_resume_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_INLINE_DATA) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_INLINE_DATA))
+		return (SET_ERROR(ENOTSUP));
 
 	/* 6 extra bytes for /%recv */
 	char recvname[ZFS_MAX_DATASET_NAME_LEN + 6];
@@ -1775,17 +2493,54 @@ struct receive_record_arg {
 	int payload_size;
 	uint64_t bytes_read; /* bytes read from stream when record created */
 	boolean_t eos_marker; /* Marks the end of the stream */
+	uint64_t seq; /* position of the record among those applied */
 	bqueue_node_t node;
 };
 
+/*
+ * A record at which a receive can be resumed, kept on rwa->resume_list in
+ * stream order until every record up to and including it has been applied.
+ */
+struct receive_resume_point {
+	list_node_t node;
+	uint64_t seq;
+	uint64_t object, offset;
+	uint64_t bytes_read;
+};
+
+/*
+ * One of the threads applying records to the objset.  Records are handed to
+ * a worker by the dnode block of their object, so that all of the records of
+ * an object are applied in stream order by the same thread.  The last entry
+ * of rwa->workers stands for the writer thread itself, which applies the
+ * records that may touch more than one object once the workers are idle.
+ */
+struct receive_worker_arg {
+	struct receive_writer_arg *rwa;
+	bqueue_t q;
+	uint64_t dispatched; /* seq of the last record handed to us */
+	uint64_t done; /* seq of the last record we applied */
+	uint64_t seq; /* seq of the last record we are applying */
+};
+
 struct receive_writer_arg {
 	objset_t *os;
 	boolean_t byteswap;
 	bqueue_t q;
 
+	struct receive_worker_arg *workers;
+	int nworkers;
+	int nrunning; /* how many worker threads haven't exited */
+	kcondvar_t idle_cv; /* signaled when a worker goes idle or exits */
+	uint64_t seq; /* seq of the last record handed to a worker */
+	uint64_t max_txg; /* no record was applied in a later txg */
+	list_t resume_list; /* of struct receive_resume_point */
+	boolean_t resume_pending; /* resume_* not yet saved on disk */
+	uint64_t resume_object, resume_offset, resume_bytes;
+
 	/*
 	 * These three args are used to signal to the main thread that we're
-	 * done.
+	 * done.  The mutex also protects the worker and resume state above.
 	 */
 	kmutex_t mutex;
 	kcondvar_t cv;
@@ -1831,6 +2586,15 @@ struct receive_arg {
 	boolean_t byteswap;
 	/* Sorted list of objects not to issue prefetches for. */
 	struct objlist ignore_objlist;
+	/*
+	 * Stream read ahead of voff; the bytes from rbuf_off to rbuf_len
+	 * haven't been consumed yet.  NULL unless the caller said the stream
+	 * may be read past the end of what it needs.
+	 */
+	char *rbuf;
+	int rbuf_size;
+	int rbuf_off;
+	int rbuf_len;
 };
 
 typedef struct guid_map_entry {
@@ -1868,15 +2632,18 @@ free_guid_map_onexit(void *arg)
 	kmem_free(ca, sizeof (avl_tree_t));
 }
 
+/*
+ * Read up to len bytes of the stream into buf, stopping once at least want
+ * of them have been read.  The number read is returned in *donep, even on
+ * error.
+ */
 static int
-receive_read(struct receive_arg *ra, int len, void *buf)
+receive_read_stream(struct receive_arg *ra, void *buf, int len, int want,
+    int *donep)
 {
 	int done = 0;
 
-	/* some things will require 8-byte alignment, so everything must */
-	ASSERT0(len % 8);
-
-	while (done < len) {
+	while (done < want) {
 		ssize_t resid;
 
 #ifdef _KERNEL
@@ -1885,7 +2652,7 @@ receive_read(struct receive_arg *ra, int len, void *buf)
 		ra->err = vn_rdwr(UIO_READ, ra->vp,
 #endif
 		    (char *)buf + done, len - done,
-		    ra->voff, UIO_SYSSPACE, FAPPEND,
+		    ra->voff + done, UIO_SYSSPACE, FAPPEND,
 		    RLIM64_INFINITY, CRED(), &resid);
 
 		if (resid == len - done) {
@@ -1895,8 +2662,51 @@ receive_read(struct receive_arg *ra, int len, void *buf)
 			 */
 			ra->err = SET_ERROR(ECKSUM);
 		}
-		ra->voff += len - done - resid;
 		done = len - resid;
+		if (ra->err != 0)
+			break;
+	}
+
+	*donep = done;
+	return (ra->err);
+}
+
+static int
+receive_read(struct receive_arg *ra, int len, void *buf)
+{
+	int done = 0;
+
+	/* some things will require 8-byte alignment, so everything must */
+	ASSERT0(len % 8);
+
+	while (done < len) {
+		int n;
+
+		if (ra->rbuf_off < ra->rbuf_len) {
+			n = MIN(len - done, ra->rbuf_len - ra->rbuf_off);
+			bcopy(ra->rbuf + ra->rbuf_off, (char *)buf + done, n);
+			ra->rbuf_off += n;
+			ra->voff += n;
+			done += n;
+			continue;
+		}
+
+		/*
+		 * Anything that would fill the read-ahead buffer anyway is
+		 * read straight into buf, which is always the case when
+		 * there is no buffer.
+		 */
+		if (len - done >= ra->rbuf_size) {
+			(void) receive_read_stream(ra, (char *)buf + done,
+			    len - done, len - done, &n);
+			ra->voff += n;
+			done += n;
+		} else {
+			ra->rbuf_off = 0;
+			(void) receive_read_stream(ra, ra->rbuf, ra->rbuf_size,
+			    len - done, &n);
+			ra->rbuf_len = n;
+		}
 		if (ra->err != 0)
 			return (ra->err);
 	}
@@ -2006,51 +2816,129 @@ deduce_nblkptr(dmu_object_type_t bonus_type, uint64_t bonus_size)
 	}
 }
 
+/*
+ * Note that the worker has applied every record it was handed up to and
+ * including "seq", in txgs no later than "txg".
+ */
+static void
+receive_worker_done(struct receive_worker_arg *rwka, uint64_t seq,
+    uint64_t txg)
+{
+	struct receive_writer_arg *rwa = rwka->rwa;
+
+	ASSERT(MUTEX_HELD(&rwa->mutex));
+	ASSERT3U(seq, >=, rwka->done);
+	ASSERT3U(seq, <=, rwka->dispatched);
+
+	rwka->done = seq;
+	rwa->max_txg = MAX(rwa->max_txg, txg);
+	if (rwka->done == rwka->dispatched)
+		cv_broadcast(&rwa->idle_cv);
+}
+
+/*
+ * Return the seq of the last record such that it and every record before it
+ * in the stream have been applied.  A worker that is idle holds nothing
+ * back; a busy one has applied everything handed to it up to its done.
+ */
+static uint64_t
+receive_applied_seq(struct receive_writer_arg *rwa)
+{
+	uint64_t seq = rwa->seq;
+	int i;
+
+	ASSERT(MUTEX_HELD(&rwa->mutex));
+
+	for (i = 0; i <= rwa->nworkers; i++) {
+		struct receive_worker_arg *rwka = &rwa->workers[i];
+
+		if (rwka->done != rwka->dispatched)
+			seq = MIN(seq, rwka->done);
+	}
+	return (seq);
+}
+
+/*
+ * Called with the tx of the last record the worker is applying still open.
+ * The resume state we record must only cover records whose changes will be
+ * on disk once its txg syncs: with several workers, that is the last resume
+ * point before which every record has been applied, and only if none of
+ * them was applied in a txg later than this one.  Otherwise the resume
+ * point is left pending for a later call to save.
+ */
 static void
-save_resume_state(struct receive_writer_arg *rwa,
-    uint64_t object, uint64_t offset, dmu_tx_t *tx)
+save_resume_state(struct receive_worker_arg *rwka, dmu_tx_t *tx)
 {
-	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
+	struct receive_writer_arg *rwa = rwka->rwa;
+	dsl_dataset_t *ds = rwa->os->os_dsl_dataset;
+	struct receive_resume_point *rp;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	int txgoff = txg & TXG_MASK;
+	uint64_t applied;
+
+	mutex_enter(&rwa->mutex);
+	receive_worker_done(rwka, rwka->seq, txg);
+	if (!rwa->resumable) {
+		mutex_exit(&rwa->mutex);
+		return;
+	}
 
-	if (!rwa->resumable)
+	applied = receive_applied_seq(rwa);
+	while ((rp = list_head(&rwa->resume_list)) != NULL &&
+	    rp->seq <= applied) {
+		list_remove(&rwa->resume_list, rp);
+		rwa->resume_object = rp->object;
+		rwa->resume_offset = rp->offset;
+		rwa->resume_bytes = rp->bytes_read;
+		rwa->resume_pending = B_TRUE;
+		kmem_free(rp, sizeof (*rp));
+	}
+	if (!rwa->resume_pending || txg < rwa->max_txg) {
+		mutex_exit(&rwa->mutex);
 		return;
+	}
 
 	/*
 	 * We use ds_resume_bytes[] != 0 to indicate that we need to
 	 * update this on disk, so it must not be 0.
 	 */
-	ASSERT(rwa->bytes_read != 0);
+	ASSERT(rwa->resume_bytes != 0);
 
 	/*
-	 * We only resume from write records, which have a valid
+	 * We only resume from write and object records, which have a valid
 	 * (non-meta-dnode) object number.
 	 */
-	ASSERT(object != 0);
+	ASSERT(rwa->resume_object != 0);
 
 	/*
 	 * For resuming to work correctly, we must receive records in order,
-	 * sorted by object,offset.  This is checked by the callers, but
-	 * assert it here for good measure.
+	 * sorted by object,offset.  This is checked by the writer thread as
+	 * it hands out the records, but assert it here for good measure.
 	 */
-	ASSERT3U(object, >=, rwa->os->os_dsl_dataset->ds_resume_object[txgoff]);
-	ASSERT(object != rwa->os->os_dsl_dataset->ds_resume_object[txgoff] ||
-	    offset >= rwa->os->os_dsl_dataset->ds_resume_offset[txgoff]);
-	ASSERT3U(rwa->bytes_read, >=,
-	    rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff]);
-
-	rwa->os->os_dsl_dataset->ds_resume_object[txgoff] = object;
-	rwa->os->os_dsl_dataset->ds_resume_offset[txgoff] = offset;
-	rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff] = rwa->bytes_read;
+	ASSERT3U(rwa->resume_object, >=, ds->ds_resume_object[txgoff]);
+	ASSERT(rwa->resume_object != ds->ds_resume_object[txgoff] ||
+	    rwa->resume_offset >= ds->ds_resume_offset[txgoff]);
+	ASSERT3U(rwa->resume_bytes, >=, ds->ds_resume_bytes[txgoff]);
+
+	ds->ds_resume_object[txgoff] = rwa->resume_object;
+	ds->ds_resume_offset[txgoff] = rwa->resume_offset;
+	ds->ds_resume_bytes[txgoff] = rwa->resume_bytes;
+	rwa->resume_pending = B_FALSE;
+	mutex_exit(&rwa->mutex);
 }
 
 static int
-receive_object(struct receive_writer_arg *rwa, struct drr_object *drro,
+receive_object(struct receive_worker_arg *rwka, struct drr_object *drro,
     void *data)
 {
+	struct receive_writer_arg *rwa = rwka->rwa;
 	dmu_object_info_t doi;
 	dmu_tx_t *tx;
 	uint64_t object;
 	int err;
+	int maxdnsize = spa_maxdnodesize(dmu_objset_spa(rwa->os));
+	uint32_t dn_slots = drro->drr_dn_slots != 0 ?
+	    drro->drr_dn_slots : DNODE_MIN_SLOTS;
 
 	if (drro->drr_type == DMU_OT_NONE ||
 	    !DMU_OT_IS_VALID(drro->drr_type) ||
@@ -2060,7 +2948,9 @@ receive_object(struct receive_writer_arg *rwa, struct drr_object *drro,
 	    P2PHASE(drro->drr_blksz, SPA_MINBLOCKSIZE) ||
 	    drro->drr_blksz < SPA_MINBLOCKSIZE ||
 	    drro->drr_blksz > spa_maxblocksize(dmu_objset_spa(rwa->os)) ||
-	    drro->drr_bonuslen > DN_MAX_BONUSLEN) {
+	    drro->drr_bonuslen > DN_BONUS_SIZE(maxdnsize) ||
+	    dn_slots > (maxdnsize >> DNODE_SHIFT) ||
+	    drro->drr_bonuslen > DN_SLOTS_TO_BONUSLEN(dn_slots)) {
 		return (SET_ERROR(EINVAL));
 	}
 
@@ -2088,6 +2978,19 @@ receive_object(struct receive_writer_arg *rwa, struct drr_object *drro,
 			if (err != 0)
 				return (SET_ERROR(EINVAL));
 		}
+
+		/*
+		 * A dnode cannot change size in place, so free the old
+		 * object and wait for the free to sync before claiming the
+		 * object number again with the new number of slots.
+		 */
+		if (dn_slots != doi.doi_dnodesize >> DNODE_SHIFT) {
+			err = dmu_free_long_object(rwa->os, drro->drr_object);
+			if (err != 0)
+				return (SET_ERROR(EINVAL));
+			txg_wait_synced(dmu_objset_pool(rwa->os), 0);
+			object = DMU_NEW_OBJECT;
+		}
 	}
 
 	tx = dmu_tx_create(rwa->os);
@@ -2100,17 +3003,19 @@ receive_object(struct receive_writer_arg *rwa, struct drr_object *drro,
 
 	if (object == DMU_NEW_OBJECT) {
 		/* currently free, want to be allocated */
-		err = dmu_object_claim(rwa->os, drro->drr_object,
+		err = dmu_object_claim_dnsize(rwa->os, drro->drr_object,
 		    drro->drr_type, drro->drr_blksz,
-		    drro->drr_bonustype, drro->drr_bonuslen, tx);
+		    drro->drr_bonustype, drro->drr_bonuslen,
+		    dn_slots << DNODE_SHIFT, tx);
 	} else if (drro->drr_type != doi.doi_type ||
 	    drro->drr_blksz != doi.doi_data_block_size ||
 	    drro->drr_bonustype != doi.doi_bonus_type ||
 	    drro->drr_bonuslen != doi.doi_bonus_size) {
 		/* currently allocated, but with different properties */
-		err = dmu_object_reclaim(rwa->os, drro->drr_object,
+		err = dmu_object_reclaim_dnsize(rwa->os, drro->drr_object,
 		    drro->drr_type, drro->drr_blksz,
-		    drro->drr_bonustype, drro->drr_bonuslen, tx);
+		    drro->drr_bonustype, drro->drr_bonuslen,
+		    dn_slots << DNODE_SHIFT, tx);
 	}
 	if (err != 0) {
 		dmu_tx_commit(tx);
@@ -2138,6 +3043,7 @@ receive_object(struct receive_writer_arg *rwa, struct drr_object *drro,
 		}
 		dmu_buf_rele(db, FTAG);
 	}
+	save_resume_state(rwka, tx);
 	dmu_tx_commit(tx);
 
 	return (0);
@@ -2171,53 +3077,63 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 	return (0);
 }
 
+/*
+ * Apply "n" DRR_WRITE records to the same object, in increasing order of
+ * offset, in a single tx.  The arc_buf_t of each record is consumed (and its
+ * write_buf cleared) as it is assigned to the object.
+ */
 static int
-receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
-    arc_buf_t *abuf)
+receive_write(struct receive_worker_arg *rwka,
+    struct receive_record_arg **rrds, int n)
 {
+	struct receive_writer_arg *rwa = rwka->rwa;
+	struct drr_write *first = &rrds[0]->header.drr_u.drr_write;
+	struct drr_write *last = &rrds[n - 1]->header.drr_u.drr_write;
+	struct drr_write *drrw;
+	dmu_buf_t *bonus;
 	dmu_tx_t *tx;
-	int err;
+	int err, i;
 
-	if (drrw->drr_offset + drrw->drr_logical_size < drrw->drr_offset ||
-	    !DMU_OT_IS_VALID(drrw->drr_type))
-		return (SET_ERROR(EINVAL));
+	for (i = 0; i < n; i++) {
+		drrw = &rrds[i]->header.drr_u.drr_write;
+		ASSERT3U(drrw->drr_object, ==, first->drr_object);
+		if (drrw->drr_offset + drrw->drr_logical_size <
+		    drrw->drr_offset || !DMU_OT_IS_VALID(drrw->drr_type))
+			return (SET_ERROR(EINVAL));
+	}
 
-	/*
-	 * For resuming to work, records must be in increasing order
-	 * by (object, offset).
-	 */
-	if (drrw->drr_object < rwa->last_object ||
-	    (drrw->drr_object == rwa->last_object &&
-	    drrw->drr_offset < rwa->last_offset)) {
+	if (dmu_object_info(rwa->os, first->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
-	}
-	rwa->last_object = drrw->drr_object;
-	rwa->last_offset = drrw->drr_offset;
 
-	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
+	/* use the bonus buf to look up the dnode in dmu_assign_arcbuf */
+	if (dmu_bonus_hold(rwa->os, first->drr_object, FTAG, &bonus) != 0)
 		return (SET_ERROR(EINVAL));
 
 	tx = dmu_tx_create(rwa->os);
 
-	dmu_tx_hold_write(tx, drrw->drr_object,
-	    drrw->drr_offset, drrw->drr_logical_size);
+	dmu_tx_hold_write(tx, first->drr_object, first->drr_offset,
+	    last->drr_offset + last->drr_logical_size - first->drr_offset);
 	err = dmu_tx_assign(tx, TXG_WAIT);
 	if (err != 0) {
 		dmu_tx_abort(tx);
+		dmu_buf_rele(bonus, FTAG);
 		return (err);
 	}
-	if (rwa->byteswap) {
-		dmu_object_byteswap_t byteswap =
-		    DMU_OT_BYTESWAP(drrw->drr_type);
-		dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
-		    DRR_WRITE_PAYLOAD_SIZE(drrw));
-	}
 
-	/* use the bonus buf to look up the dnode in dmu_assign_arcbuf */
-	dmu_buf_t *bonus;
-	if (dmu_bonus_hold(rwa->os, drrw->drr_object, FTAG, &bonus) != 0)
-		return (SET_ERROR(EINVAL));
-	dmu_assign_arcbuf(bonus, drrw->drr_offset, abuf, tx);
+	for (i = 0; i < n; i++) {
+		arc_buf_t *abuf = rrds[i]->write_buf;
+
+		drrw = &rrds[i]->header.drr_u.drr_write;
+		if (rwa->byteswap) {
+			dmu_object_byteswap_t byteswap =
+			    DMU_OT_BYTESWAP(drrw->drr_type);
+			dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
+			    DRR_WRITE_PAYLOAD_SIZE(drrw));
+		}
+		dmu_assign_arcbuf(bonus, drrw->drr_offset, abuf, tx);
+		rrds[i]->write_buf = NULL;
+		rrds[i]->payload = NULL;
+	}
 
 	/*
 	 * Note: If the receive fails, we want the resume stream to start
@@ -2225,7 +3141,7 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	 * to the next record), so that we can verify that we are
 	 * resuming from the correct location.
 	 */
-	save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
+	save_resume_state(rwka, tx);
 	dmu_tx_commit(tx);
 	dmu_buf_rele(bonus, FTAG);
 
@@ -2240,9 +3156,10 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
  * data from the stream to fulfill this write.
  */
 static int
-receive_write_byref(struct receive_writer_arg *rwa,
+receive_write_byref(struct receive_worker_arg *rwka,
     struct drr_write_byref *drrwbr)
 {
+	struct receive_writer_arg *rwa = rwka->rwa;
 	dmu_tx_t *tx;
 	int err;
 	guid_map_entry_t gmesrch;
@@ -2289,15 +3206,16 @@ receive_write_byref(struct receive_writer_arg *rwa,
 	dmu_buf_rele(dbp, FTAG);
 
 	/* See comment in restore_write. */
-	save_resume_state(rwa, drrwbr->drr_object, drrwbr->drr_offset, tx);
+	save_resume_state(rwka, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
 
 static int
-receive_write_embedded(struct receive_writer_arg *rwa,
+receive_write_embedded(struct receive_worker_arg *rwka,
     struct drr_write_embedded *drrwe, void *data)
 {
+	struct receive_writer_arg *rwa = rwka->rwa;
 	dmu_tx_t *tx;
 	int err;
 
@@ -2328,7 +3246,7 @@ receive_write_embedded(struct receive_writer_arg *rwa,
 	    rwa->byteswap ^ ZFS_HOST_BYTEORDER, tx);
 
 	/* See comment in restore_write. */
-	save_resume_state(rwa, drrwe->drr_object, drrwe->drr_offset, tx);
+	save_resume_state(rwka, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
@@ -2714,20 +3632,17 @@ receive_read_record(struct receive_arg *ra)
  * Commit the records to the pool.
  */
 static int
-receive_process_record(struct receive_writer_arg *rwa,
+receive_process_record(struct receive_worker_arg *rwka,
     struct receive_record_arg *rrd)
 {
+	struct receive_writer_arg *rwa = rwka->rwa;
 	int err;
 
-	/* Processing in order, therefore bytes_read should be increasing. */
-	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
-	rwa->bytes_read = rrd->bytes_read;
-
 	switch (rrd->header.drr_type) {
 	case DRR_OBJECT:
 	{
 		struct drr_object *drro = &rrd->header.drr_u.drr_object;
-		err = receive_object(rwa, drro, rrd->payload);
+		err = receive_object(rwka, drro, rrd->payload);
 		kmem_free(rrd->payload, rrd->payload_size);
 		rrd->payload = NULL;
 		return (err);
@@ -2740,26 +3655,20 @@ receive_process_record(struct receive_writer_arg *rwa,
 	}
 	case DRR_WRITE:
 	{
-		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
-		err = receive_write(rwa, drrw, rrd->write_buf);
 		/* if receive_write() is successful, it consumes the arc_buf */
-		if (err != 0)
-			dmu_return_arcbuf(rrd->write_buf);
-		rrd->write_buf = NULL;
-		rrd->payload = NULL;
-		return (err);
+		return (receive_write(rwka, &rrd, 1));
 	}
 	case DRR_WRITE_BYREF:
 	{
 		struct drr_write_byref *drrwbr =
 		    &rrd->header.drr_u.drr_write_byref;
-		return (receive_write_byref(rwa, drrwbr));
+		return (receive_write_byref(rwka, drrwbr));
 	}
 	case DRR_WRITE_EMBEDDED:
 	{
 		struct drr_write_embedded *drrwe =
 		    &rrd->header.drr_u.drr_write_embedded;
-		err = receive_write_embedded(rwa, drrwe, rrd->payload);
+		err = receive_write_embedded(rwka, drrwe, rrd->payload);
 		kmem_free(rrd->payload, rrd->payload_size);
 		rrd->payload = NULL;
 		return (err);
@@ -2782,36 +3691,301 @@ receive_process_record(struct receive_writer_arg *rwa,
 	}
 }
 
+static void
+receive_record_free(struct receive_record_arg *rrd)
+{
+	if (rrd->write_buf != NULL) {
+		dmu_return_arcbuf(rrd->write_buf);
+		rrd->write_buf = NULL;
+		rrd->payload = NULL;
+	} else if (rrd->payload != NULL) {
+		kmem_free(rrd->payload, rrd->payload_size);
+		rrd->payload = NULL;
+	}
+	kmem_free(rrd, sizeof (*rrd));
+}
+
+/*
+ * Apply "n" records to the objset, which are either a single record or
+ * consecutive writes to one object (see receive_write_batches()), then
+ * free them.  Once there's an error, records are only freed.
+ */
+static void
+receive_apply_records(struct receive_worker_arg *rwka,
+    struct receive_record_arg **rrds, int n)
+{
+	struct receive_writer_arg *rwa = rwka->rwa;
+	uint64_t seq = rrds[n - 1]->seq;
+	int err = 0;
+	int i;
+
+	if (rwa->err == 0) {
+		rwka->seq = seq;
+		if (n > 1)
+			err = receive_write(rwka, rrds, n);
+		else
+			err = receive_process_record(rwka, rrds[0]);
+	}
+	for (i = 0; i < n; i++)
+		receive_record_free(rrds[i]);
+
+	/*
+	 * Whatever txgs the records were applied in, none is later than the
+	 * one open now.
+	 */
+	mutex_enter(&rwa->mutex);
+	if (err != 0 && rwa->err == 0)
+		rwa->err = err;
+	receive_worker_done(rwka, seq,
+	    dmu_objset_pool(rwa->os)->dp_tx.tx_open_txg);
+	mutex_exit(&rwa->mutex);
+}
+
+/*
+ * Return true if "rrd" is a write that can be applied in the same tx as the
+ * batch of writes starting with "first".
+ */
+static boolean_t
+receive_write_batches(struct receive_record_arg *first,
+    struct receive_record_arg *rrd)
+{
+	struct drr_write *drrf = &first->header.drr_u.drr_write;
+	struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+	if (rrd->eos_marker || rrd->header.drr_type != DRR_WRITE ||
+	    drrw->drr_object != drrf->drr_object ||
+	    drrw->drr_offset < drrf->drr_offset ||
+	    drrw->drr_offset + drrw->drr_logical_size < drrw->drr_offset)
+		return (B_FALSE);
+	return (drrw->drr_offset + drrw->drr_logical_size - drrf->drr_offset <=
+	    zfs_recv_write_batch);
+}
+
+#define	RECV_WRITE_BATCH_MAX	32
+
+/*
+ * A worker thread; pull records off its queue and apply them.  Writes to an
+ * object that are already queued behind one another are applied together.
+ * When we get the eos marker, tell the writer thread and exit.
+ */
+static void
+receive_worker_thread(void *arg)
+{
+	struct receive_worker_arg *rwka = arg;
+	struct receive_writer_arg *rwa = rwka->rwa;
+	struct receive_record_arg *batch[RECV_WRITE_BATCH_MAX];
+	struct receive_record_arg *rrd;
+	int n;
+
+	rrd = bqueue_dequeue(&rwka->q);
+	while (!rrd->eos_marker) {
+		batch[0] = rrd;
+		rrd = NULL;
+		n = 1;
+		while (batch[0]->header.drr_type == DRR_WRITE &&
+		    n < RECV_WRITE_BATCH_MAX && !bqueue_empty(&rwka->q)) {
+			rrd = bqueue_dequeue(&rwka->q);
+			if (!receive_write_batches(batch[0], rrd))
+				break;
+			batch[n++] = rrd;
+			rrd = NULL;
+		}
+		receive_apply_records(rwka, batch, n);
+		if (rrd == NULL)
+			rrd = bqueue_dequeue(&rwka->q);
+	}
+	kmem_free(rrd, sizeof (*rrd));
+
+	mutex_enter(&rwa->mutex);
+	rwa->nrunning--;
+	cv_broadcast(&rwa->idle_cv);
+	mutex_exit(&rwa->mutex);
+	thread_exit();
+}
+
+/*
+ * Return the worker that should apply "rrd".  Freeing a range of objects
+ * and writes by reference may depend on records handed to several workers,
+ * so those are applied by the writer thread itself.
+ */
+static struct receive_worker_arg *
+receive_record_worker(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	uint64_t object;
+
+	switch (rrd->header.drr_type) {
+	case DRR_OBJECT:
+		object = rrd->header.drr_u.drr_object.drr_object;
+		break;
+	case DRR_WRITE:
+		object = rrd->header.drr_u.drr_write.drr_object;
+		break;
+	case DRR_WRITE_EMBEDDED:
+		object = rrd->header.drr_u.drr_write_embedded.drr_object;
+		break;
+	case DRR_FREE:
+		object = rrd->header.drr_u.drr_free.drr_object;
+		break;
+	case DRR_SPILL:
+		object = rrd->header.drr_u.drr_spill.drr_object;
+		break;
+	default:
+		return (&rwa->workers[rwa->nworkers]);
+	}
+	if (rwa->nworkers == 0)
+		return (&rwa->workers[rwa->nworkers]);
+	return (&rwa->workers[(object >> DNODES_PER_BLOCK_SHIFT) %
+	    rwa->nworkers]);
+}
+
+/*
+ * Check the order of the records as they come off the queue, since the
+ * workers may apply them in any order relative to one another.
+ */
+static int
+receive_check_record(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	/* Processing in order, therefore bytes_read should be increasing. */
+	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
+	rwa->bytes_read = rrd->bytes_read;
+
+	if (rrd->header.drr_type == DRR_WRITE) {
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+		/*
+		 * For resuming to work, records must be in increasing order
+		 * by (object, offset).
+		 */
+		if (drrw->drr_object < rwa->last_object ||
+		    (drrw->drr_object == rwa->last_object &&
+		    drrw->drr_offset < rwa->last_offset)) {
+			return (SET_ERROR(EINVAL));
+		}
+		rwa->last_object = drrw->drr_object;
+		rwa->last_offset = drrw->drr_offset;
+	}
+	return (0);
+}
+
+static void
+receive_add_resume_point(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	struct receive_resume_point *rp;
+	uint64_t object, offset;
+
+	ASSERT(MUTEX_HELD(&rwa->mutex));
+
+	switch (rrd->header.drr_type) {
+	case DRR_OBJECT:
+		/*
+		 * The OBJECT records of a block of dnodes all come before
+		 * the data of its objects, and after that of the objects
+		 * of earlier blocks.  So once this one is applied, we can
+		 * resume from the start of its block: that way a stream of
+		 * objects with little or no data still makes progress.
+		 */
+		object = P2ALIGN(rrd->header.drr_u.drr_object.drr_object,
+		    DNODES_PER_BLOCK);
+		offset = 0;
+		rp = list_tail(&rwa->resume_list);
+		if (object <= (rp != NULL ? rp->object : rwa->resume_object))
+			return;
+		break;
+	case DRR_WRITE:
+		object = rrd->header.drr_u.drr_write.drr_object;
+		offset = rrd->header.drr_u.drr_write.drr_offset;
+		break;
+	case DRR_WRITE_BYREF:
+		object = rrd->header.drr_u.drr_write_byref.drr_object;
+		offset = rrd->header.drr_u.drr_write_byref.drr_offset;
+		break;
+	case DRR_WRITE_EMBEDDED:
+		object = rrd->header.drr_u.drr_write_embedded.drr_object;
+		offset = rrd->header.drr_u.drr_write_embedded.drr_offset;
+		break;
+	default:
+		return;
+	}
+
+	rp = kmem_alloc(sizeof (*rp), KM_SLEEP);
+	rp->seq = rrd->seq;
+	rp->object = object;
+	rp->offset = offset;
+	rp->bytes_read = rrd->bytes_read;
+	list_insert_tail(&rwa->resume_list, rp);
+}
+
 /*
- * dmu_recv_stream's worker thread; pull records off the queue, and then call
- * receive_process_record  When we're done, signal the main thread and exit.
+ * dmu_recv_stream's writer thread; pull records off the queue, and hand each
+ * of them to the worker that will apply it.  Records applied by this thread
+ * wait for the workers to go idle first.  When we're done, stop the workers,
+ * signal the main thread and exit.
  */
 static void
 receive_writer_thread(void *arg)
 {
 	struct receive_writer_arg *rwa = arg;
+	struct receive_worker_arg *self = &rwa->workers[rwa->nworkers];
+	struct receive_worker_arg *rwka;
 	struct receive_record_arg *rrd;
+	int i;
+
 	for (rrd = bqueue_dequeue(&rwa->q); !rrd->eos_marker;
 	    rrd = bqueue_dequeue(&rwa->q)) {
+		int err = 0;
+
 		/*
 		 * If there's an error, the main thread will stop putting things
 		 * on the queue, but we need to clear everything in it before we
 		 * can exit.
 		 */
-		if (rwa->err == 0) {
-			rwa->err = receive_process_record(rwa, rrd);
-		} else if (rrd->write_buf != NULL) {
-			dmu_return_arcbuf(rrd->write_buf);
-			rrd->write_buf = NULL;
-			rrd->payload = NULL;
-		} else if (rrd->payload != NULL) {
-			kmem_free(rrd->payload, rrd->payload_size);
-			rrd->payload = NULL;
+		if (rwa->err == 0)
+			err = receive_check_record(rwa, rrd);
+		if (rwa->err != 0 || err != 0) {
+			mutex_enter(&rwa->mutex);
+			if (rwa->err == 0)
+				rwa->err = err;
+			mutex_exit(&rwa->mutex);
+			receive_record_free(rrd);
+			continue;
+		}
+
+		rwka = receive_record_worker(rwa, rrd);
+		mutex_enter(&rwa->mutex);
+		if (rwka == self) {
+			for (i = 0; i < rwa->nworkers; i++) {
+				while (rwa->workers[i].done !=
+				    rwa->workers[i].dispatched)
+					cv_wait(&rwa->idle_cv, &rwa->mutex);
+			}
+		}
+		rrd->seq = ++rwa->seq;
+		rwka->dispatched = rrd->seq;
+		if (rwa->resumable)
+			receive_add_resume_point(rwa, rrd);
+		mutex_exit(&rwa->mutex);
+
+		if (rwka == self) {
+			receive_apply_records(rwka, &rrd, 1);
+		} else {
+			bqueue_enqueue(&rwka->q, rrd,
+			    sizeof (struct receive_record_arg) +
+			    rrd->payload_size);
 		}
-		kmem_free(rrd, sizeof (*rrd));
 	}
 	kmem_free(rrd, sizeof (*rrd));
+
+	for (i = 0; i < rwa->nworkers; i++) {
+		rrd = kmem_zalloc(sizeof (*rrd), KM_SLEEP);
+		rrd->eos_marker = B_TRUE;
+		bqueue_enqueue(&rwa->workers[i].q, rrd, 1);
+	}
 	mutex_enter(&rwa->mutex);
+	while (rwa->nrunning != 0)
+		cv_wait(&rwa->idle_cv, &rwa->mutex);
 	rwa->done = B_TRUE;
 	cv_signal(&rwa->cv);
 	mutex_exit(&rwa->mutex);
@@ -2845,14 +4019,16 @@ resume_check(struct receive_arg *ra, nvlist_t *begin_nvl)
 }
 
 /*
- * Read in the stream's records, one by one, and apply them to the pool.  There
- * are two threads involved; the thread that calls this function will spin up a
- * worker thread, read the records off the stream one by one, and issue
- * prefetches for any necessary indirect blocks.  It will then push the records
- * onto an internal blocking queue.  The worker thread will pull the records off
- * the queue, and actually write the data into the DMU.  This way, the worker
- * thread doesn't have to wait for reads to complete, since everything it needs
- * (the indirect blocks) will be prefetched.
+ * Read in the stream's records, one by one, and apply them to the pool.  The
+ * thread that calls this function will spin up a writer thread and
+ * zfs_recv_writers worker threads, read the records off the stream one by
+ * one, and issue prefetches for any necessary indirect blocks.  It will then
+ * push the records onto an internal blocking queue.  The writer thread will
+ * pull the records off the queue and hand each one to the worker for its
+ * object, which actually writes the data into the DMU.  This way, the workers
+ * don't have to wait for reads to complete, since everything they need (the
+ * indirect blocks) will be prefetched, and records for different objects are
+ * applied in parallel.
  *
  * NB: callers *must* call dmu_recv_end() if this succeeds.
  */
@@ -2870,6 +4046,10 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	ra.cksum = drc->drc_cksum;
 	ra.vp = vp;
 	ra.voff = *voffp;
+	if (drc->drc_readahead && zfs_recv_read_size > 0) {
+		ra.rbuf_size = P2ROUNDUP(zfs_recv_read_size, 8);
+		ra.rbuf = kmem_alloc(ra.rbuf_size, KM_SLEEP);
+	}
 
 	if (dsl_dataset_is_zapified(drc->drc_ds)) {
 		(void) zap_lookup(drc->drc_ds->ds_dir->dd_pool->dp_meta_objset,
@@ -2951,14 +4131,40 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 		if (err != 0)
 			goto out;
 	}
+	drc->drc_filtered = (begin_nvl != NULL &&
+	    nvlist_exists(begin_nvl, "filtered"));
 
 	(void) bqueue_init(&rwa.q, zfs_recv_queue_length,
 	    offsetof(struct receive_record_arg, node));
 	cv_init(&rwa.cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&rwa.mutex, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&rwa.idle_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&rwa.resume_list, sizeof (struct receive_resume_point),
+	    offsetof(struct receive_resume_point, node));
 	rwa.os = ra.os;
 	rwa.byteswap = drc->drc_byteswap;
 	rwa.resumable = drc->drc_resumable;
+	if (featureflags & DMU_BACKUP_FEATURE_RESUMING) {
+		/* resume_check() found these; later points must follow */
+		VERIFY0(nvlist_lookup_uint64(begin_nvl, "resume_object",
+		    &rwa.resume_object));
+		VERIFY0(nvlist_lookup_uint64(begin_nvl, "resume_offset",
+		    &rwa.resume_offset));
+	}
+
+	rwa.nworkers = MAX(zfs_recv_writers, 0);
+	rwa.workers = kmem_zalloc((rwa.nworkers + 1) *
+	    sizeof (struct receive_worker_arg), KM_SLEEP);
+	for (int i = 0; i <= rwa.nworkers; i++)
+		rwa.workers[i].rwa = &rwa;
+	for (int i = 0; i < rwa.nworkers; i++) {
+		(void) bqueue_init(&rwa.workers[i].q,
+		    MAX(zfs_recv_queue_length / rwa.nworkers, 1),
+		    offsetof(struct receive_record_arg, node));
+		rwa.nrunning++;
+		(void) thread_create(NULL, 0, receive_worker_thread,
+		    &rwa.workers[i], 0, curproc, TS_RUN, minclsyspri);
+	}
 
 	(void) thread_create(NULL, 0, receive_writer_thread, &rwa, 0, curproc,
 	    TS_RUN, minclsyspri);
@@ -3010,6 +4216,15 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	}
 	mutex_exit(&rwa.mutex);
 
+	struct receive_resume_point *rp;
+	while ((rp = list_remove_head(&rwa.resume_list)) != NULL)
+		kmem_free(rp, sizeof (*rp));
+	list_destroy(&rwa.resume_list);
+	for (int i = 0; i < rwa.nworkers; i++)
+		bqueue_destroy(&rwa.workers[i].q);
+	kmem_free(rwa.workers,
+	    (rwa.nworkers + 1) * sizeof (struct receive_worker_arg));
+	cv_destroy(&rwa.idle_cv);
 	cv_destroy(&rwa.cv);
 	mutex_destroy(&rwa.mutex);
 	bqueue_destroy(&rwa.q);
@@ -3032,6 +4247,8 @@ out:
 
 	*voffp = ra.voff;
 	objlist_destroy(&ra.ignore_objlist);
+	if (ra.rbuf != NULL)
+		kmem_free(ra.rbuf, ra.rbuf_size);
 	return (err);
 }
 
@@ -3143,6 +4360,11 @@ dmu_recv_end_sync(void *arg, dmu_tx_t *tx)
 
 		dsl_dataset_clone_swap_sync_impl(drc->drc_ds,
 		    origin_head, tx);
+		if (drc->drc_filtered) {
+			dmu_buf_will_dirty(origin_head->ds_dbuf, tx);
+			dsl_dataset_phys(origin_head)->ds_flags |=
+			    DS_FLAG_FILTERED;
+		}
 		dsl_dataset_snapshot_sync_impl(origin_head,
 		    drc->drc_tosnap, tx);
 
@@ -3170,6 +4392,15 @@ dmu_recv_end_sync(void *arg, dmu_tx_t *tx)
 	} else {
 		dsl_dataset_t *ds = drc->drc_ds;
 
+		/*
+		 * Directories of a filtered stream may name objects it left
+		 * out; the new snapshot inherits the flag that keeps the file
+		 * system from being mounted.
+		 */
+		if (drc->drc_filtered) {
+			dmu_buf_will_dirty(ds->ds_dbuf, tx);
+			dsl_dataset_phys(ds)->ds_flags |= DS_FLAG_FILTERED;
+		}
 		dsl_dataset_snapshot_sync_impl(ds, drc->drc_tosnap, tx);
 
 		/* set snapshot's creation time and guid */
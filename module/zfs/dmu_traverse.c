@@ -70,6 +70,8 @@ static int traverse_dnode(traverse_data_t *td, const dnode_phys_t *dnp,
     uint64_t objset, uint64_t object);
 static void prefetch_dnode_metadata(traverse_data_t *td, const dnode_phys_t *,
     uint64_t objset, uint64_t object);
+static int traverse_prefetcher(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg);
 
 static int
 traverse_zil_block(zilog_t *zilog, blkptr_t *bp, void *arg, uint64_t claim_txg)
@@ -150,6 +152,11 @@ typedef enum resume_skip {
  * resume point. This indicates that this block should be visited but not its
  * children (since they must have been visited in a previous traversal).
  * Otherwise returns RESUME_SKIP_NONE.
+ *
+ * The resume point itself need not be visited: it may be a hole, or it or
+ * one of its parents may have been born before td_min_txg.  Reaching any
+ * block after it also means that we have resumed.  Until then metadata is
+ * not prefetched, so finding out as soon as possible matters.
  */
 static resume_skip_t
 resume_skip_check(traverse_data_t *td, const dnode_phys_t *dnp,
@@ -171,6 +178,11 @@ resume_skip_check(traverse_data_t *td, const dnode_phys_t *dnp,
 			bzero(td->td_resume, sizeof (*zb));
 			if (td->td_flags & TRAVERSE_POST)
 				return (RESUME_SKIP_CHILDREN);
+		} else if (dnp != NULL &&
+		    zbookmark_compare(dnp->dn_datablkszsec, dnp->dn_indblkshift,
+		    1ULL << (DNODE_BLOCK_SHIFT - SPA_MINBLOCKSHIFT), 0,
+		    zb, td->td_resume) > 0) {
+			bzero(td->td_resume, sizeof (*zb));
 		}
 	}
 	return (RESUME_SKIP_NONE);
@@ -203,10 +215,20 @@ traverse_prefetch_metadata(traverse_data_t *td,
 static boolean_t
 prefetch_needed(prefetch_data_t *pfd, const blkptr_t *bp)
 {
-	ASSERT(pfd->pd_flags & TRAVERSE_PREFETCH_DATA);
+	ASSERT(pfd->pd_flags &
+	    (TRAVERSE_PREFETCH_DATA | TRAVERSE_PREFETCH_INDIRECT));
 	if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp) ||
 	    BP_GET_TYPE(bp) == DMU_OT_INTENT_LOG)
 		return (B_FALSE);
+	/*
+	 * With only TRAVERSE_PREFETCH_INDIRECT the prefetch thread runs
+	 * ahead through the indirect and dnode blocks alone, which is all
+	 * a traversal that never reads data (e.g. freeing) waits on.
+	 */
+	if (!(pfd->pd_flags & TRAVERSE_PREFETCH_DATA))
+		return (BP_GET_LEVEL(bp) > 0 ||
+		    BP_GET_TYPE(bp) == DMU_OT_DNODE ||
+		    BP_GET_TYPE(bp) == DMU_OT_OBJSET);
 	return (B_TRUE);
 }
 
@@ -229,6 +251,16 @@ traverse_visitbp(traverse_data_t *td, const dnode_phys_t *dnp,
 		ASSERT(0);
 	}
 
+	/*
+	 * A hole has nothing beneath it and nothing to read, so there is
+	 * no point in the prefetch thread walking the same holes as the
+	 * main traversal.  With send_holes_without_birth_time set this
+	 * is most of the blocks visited by a small incremental send of
+	 * a sparse object.
+	 */
+	if (BP_IS_HOLE(bp) && td->td_func == traverse_prefetcher)
+		return (0);
+
 	if (bp->blk_birth == 0) {
 		/*
 		 * Since this block has a birth time of 0 it must be one of
@@ -333,13 +365,13 @@ traverse_visitbp(traverse_data_t *td, const dnode_phys_t *dnp,
 			goto post;
 		dnode_phys_t *child_dnp = buf->b_data;
 
-		for (i = 0; i < epb; i++) {
+		for (i = 0; i < epb; i += child_dnp[i].dn_extra_slots + 1) {
 			prefetch_dnode_metadata(td, &child_dnp[i],
 				zb->zb_objset, zb->zb_blkid * epb + i);
 		}
 
 		/* recursively visitbp() blocks below this */
-		for (i = 0; i < epb; i++) {
+		for (i = 0; i < epb; i += child_dnp[i].dn_extra_slots + 1) {
 			err = traverse_dnode(td, &child_dnp[i],
 				zb->zb_objset, zb->zb_blkid * epb + i);
 			if (err != 0)
@@ -446,7 +478,7 @@ prefetch_dnode_metadata(traverse_data_t *td, const dnode_phys_t *dnp,
 
 	if (dnp->dn_flags & DNODE_FLAG_SPILL_BLKPTR) {
 		SET_BOOKMARK(&czb, objset, object, 0, DMU_SPILL_BLKID);
-		traverse_prefetch_metadata(td, &dnp->dn_spill, &czb);
+		traverse_prefetch_metadata(td, DN_SPILL_BLKPTR(dnp), &czb);
 	}
 }
 
@@ -481,7 +513,7 @@ traverse_dnode(traverse_data_t *td, const dnode_phys_t *dnp,
 
 	if (err == 0 && (dnp->dn_flags & DNODE_FLAG_SPILL_BLKPTR)) {
 		SET_BOOKMARK(&czb, objset, object, 0, DMU_SPILL_BLKID);
-		err = traverse_visitbp(td, dnp, &dnp->dn_spill, &czb);
+		err = traverse_visitbp(td, dnp, DN_SPILL_BLKPTR(dnp), &czb);
 	}
 
 	if (err == 0 && (td->td_flags & TRAVERSE_POST)) {
@@ -614,7 +646,7 @@ traverse_impl(spa_t *spa, dsl_dataset_t *ds, uint64_t objset, blkptr_t *rootbp,
 		arc_buf_destroy(buf, &buf);
 	}
 
-	if (!(flags & TRAVERSE_PREFETCH_DATA) ||
+	if (!(flags & (TRAVERSE_PREFETCH_DATA | TRAVERSE_PREFETCH_INDIRECT)) ||
 	    0 == taskq_dispatch(system_taskq, traverse_prefetch_thread,
 	    td, TQ_NOQUEUE))
 		pd->pd_exited = B_TRUE;
@@ -667,6 +699,17 @@ traverse_dataset_destroyed(spa_t *spa, blkptr_t *blkptr,
 	    blkptr, txg_start, resume, flags, func, arg));
 }
 
+/*
+ * Visit the MOS only, not the datasets it describes.
+ */
+int
+traverse_mos(spa_t *spa, uint64_t txg_start, int flags,
+    blkptr_cb_t func, void *arg)
+{
+	return (traverse_impl(spa, NULL, 0, spa_get_rootblkptr(spa),
+	    txg_start, NULL, flags, func, arg));
+}
+
 /*
  * NB: pool must not be changing on-disk (eg, from zdb or sync context).
  */
@@ -680,8 +723,7 @@ traverse_pool(spa_t *spa, uint64_t txg_start, int flags,
 	boolean_t hard = (flags & TRAVERSE_HARD);
 
 	/* visit the MOS */
-	err = traverse_impl(spa, NULL, 0, spa_get_rootblkptr(spa),
-	    txg_start, NULL, flags, func, arg);
+	err = traverse_mos(spa, txg_start, flags, func, arg);
 	if (err != 0)
 		return (err);
 
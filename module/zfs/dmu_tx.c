@@ -54,6 +54,7 @@ dmu_tx_stats_t dmu_tx_stats = {
 	{ "dmu_tx_dirty_throttle",	KSTAT_DATA_UINT64 },
 	{ "dmu_tx_dirty_delay",		KSTAT_DATA_UINT64 },
 	{ "dmu_tx_dirty_over_max",	KSTAT_DATA_UINT64 },
+	{ "dmu_tx_dirty_frees_delay",	KSTAT_DATA_UINT64 },
 	{ "dmu_tx_quota",		KSTAT_DATA_UINT64 },
 };
 
@@ -116,7 +117,7 @@ dmu_tx_hold_dnode_impl(dmu_tx_t *tx, dnode_t *dn, enum dmu_tx_hold_type type,
 	if (dn != NULL) {
 		(void) refcount_add(&dn->dn_holds, tx);
 		if (tx->tx_txg != 0) {
-			mutex_enter(&dn->dn_mtx);
+			zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 			/*
 			 * dn->dn_assigned_txg == tx->tx_txg doesn't pose a
 			 * problem, but there's no way for it to happen (for
@@ -201,6 +202,14 @@ dmu_tx_add_new_object(dmu_tx_t *tx, dnode_t *dn)
  * move the work elsewhere (after the dmu_tx_assign()), where it may
  * have a greater impact on performance (in addition to the impact on
  * fault tolerance noted above).
+ *
+ * The exception is the partial first and last level-0 blocks of a write
+ * when dbuf_deferred_rmw is set: dmu_write() then reads those
+ * asynchronously after dmu_tx_assign() without waiting for them, so
+ * reading them here would only put the wait back.  An i/o error on them
+ * is not returned to the caller; the read that fills in the rest of the
+ * block is ZIO_FLAG_MUSTSUCCEED.  The indirect blocks above them are
+ * still read here.
  */
 static int
 dmu_tx_check_ioerr(zio_t *zio, dnode_t *dn, int level, uint64_t blkid)
@@ -223,6 +232,7 @@ static void
 dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 {
 	dnode_t *dn = txh->txh_dnode;
+	boolean_t deferred;
 	int err = 0;
 
 	if (len == 0)
@@ -240,10 +250,13 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 	 * For i/o error checking, read the blocks that will be needed
 	 * to perform the write: the first and last level-0 blocks (if
 	 * they are not aligned, i.e. if they are partial-block writes),
-	 * and all the level-1 blocks.
+	 * and all the level-1 blocks.  Partial level-0 blocks whose read
+	 * will be deferred are skipped, but not their level-1 blocks.
 	 */
+	deferred = (dbuf_deferred_rmw &&
+	    dn->dn_object != DMU_META_DNODE_OBJECT);
 	if (dn->dn_maxblkid == 0) {
-		if (off < dn->dn_datablksz &&
+		if (!deferred && off < dn->dn_datablksz &&
 		    (off > 0 || len < dn->dn_datablksz)) {
 			err = dmu_tx_check_ioerr(NULL, dn, 0, 0);
 			if (err != 0) {
@@ -256,7 +269,9 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 
 		/* first level-0 block */
 		uint64_t start = off >> dn->dn_datablkshift;
-		if (P2PHASE(off, dn->dn_datablksz) || len < dn->dn_datablksz) {
+		boolean_t partial = (P2PHASE(off, dn->dn_datablksz) ||
+		    len < dn->dn_datablksz);
+		if (partial && !deferred) {
 			err = dmu_tx_check_ioerr(zio, dn, 0, start);
 			if (err != 0) {
 				txh->txh_tx->tx_err = err;
@@ -265,8 +280,9 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 
 		/* last level-0 block */
 		uint64_t end = (off + len - 1) >> dn->dn_datablkshift;
-		if (end != start && end <= dn->dn_maxblkid &&
-		    P2PHASE(off + len, dn->dn_datablksz)) {
+		boolean_t partial_end = (end != start &&
+		    end <= dn->dn_maxblkid && P2PHASE(off + len, dn->dn_datablksz));
+		if (partial_end && !deferred) {
 			err = dmu_tx_check_ioerr(zio, dn, 0, end);
 			if (err != 0) {
 				txh->txh_tx->tx_err = err;
@@ -276,6 +292,22 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 		/* level-1 blocks */
 		if (dn->dn_nlevels > 1) {
 			int shft = dn->dn_indblkshift - SPA_BLKPTRSHIFT;
+
+			/* those the skipped level-0 reads would have read */
+			if (partial && deferred) {
+				err = dmu_tx_check_ioerr(zio, dn, 1,
+				    start >> shft);
+				if (err != 0) {
+					txh->txh_tx->tx_err = err;
+				}
+			}
+			if (partial_end && deferred &&
+			    (!partial || (end >> shft) != (start >> shft))) {
+				err = dmu_tx_check_ioerr(zio, dn, 1, end >> shft);
+				if (err != 0) {
+					txh->txh_tx->tx_err = err;
+				}
+			}
 			for (uint64_t i = (start >> shft) + 1;
 			    i < end >> shft; i++) {
 				err = dmu_tx_check_ioerr(zio, dn, 1, i);
@@ -470,7 +502,8 @@ dmu_tx_hold_zap_impl(dmu_tx_hold_t *txh, const char *name)
 	dmu_tx_count_dnode(txh);
 
 	/*
-	 * Modifying a almost-full microzap is around the worst case (128KB)
+	 * Modifying a almost-full microzap is around the worst case (128KB,
+	 * or up to zap_micro_max_size in datasets with large blocks)
 	 *
 	 * If it is a fat zap, the worst case would be 7*16KB=112KB:
 	 * - 3 blocks overwritten: target leaf, ptrtbl block, header block
@@ -479,7 +512,8 @@ dmu_tx_hold_zap_impl(dmu_tx_hold_t *txh, const char *name)
 	 *    - 2 grown ptrtbl blocks
 	 */
 	(void) refcount_add_many(&txh->txh_space_towrite,
-		MZAP_MAX_BLKSZ, FTAG);
+	    zap_get_micro_max_size(dn != NULL ? dn->dn_objset :
+	    tx->tx_objset), FTAG);
 
 	if (dn == NULL)
 		return;
@@ -782,7 +816,7 @@ dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 	dsl_pool_t *dp = tx->tx_pool;
 	uint64_t delay_min_bytes =
 	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
-	hrtime_t wakeup, min_tx_time, now;
+	hrtime_t wakeup, min_tx_time, now, slept;
 
 	if (dirty <= delay_min_bytes)
 		return;
@@ -796,7 +830,7 @@ dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 	ASSERT3U(dirty, <, zfs_dirty_data_max);
 
 	now = gethrtime();
-	min_tx_time = zfs_delay_scale *
+	min_tx_time = dsl_pool_delay_scale(dp) *
 	    (dirty - delay_min_bytes) / (zfs_dirty_data_max - dirty);
 	min_tx_time = MIN(min_tx_time, zfs_delay_max_ns);
 	if (now > tx->tx_start + min_tx_time)
@@ -812,6 +846,15 @@ dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 	mutex_exit(&dp->dp_lock);
 
 	zfs_sleep_until(wakeup);
+
+	slept = gethrtime() - now;
+	atomic_inc_64(&dp->dp_throttle_delays);
+	atomic_add_64(&dp->dp_throttle_delay_time, slept);
+	if (tx->tx_objset != NULL) {
+		atomic_inc_64(&tx->tx_objset->os_throttle_delays);
+		atomic_add_64(&tx->tx_objset->os_throttle_delay_time, slept);
+	}
+	spa_tx_delay_add_nsecs(dp->dp_spa, slept);
 }
 
 /*
@@ -886,9 +929,14 @@ dmu_tx_try_assign(dmu_tx_t *tx, txg_how_t txg_how)
 
 	if (!tx->tx_waited &&
 	    dsl_pool_need_dirty_delay(tx->tx_pool)) {
-		tx->tx_wait_dirty = B_TRUE;
-		DMU_TX_STAT_BUMP(dmu_tx_dirty_delay);
-		return (ERESTART);
+		if (tx->tx_objset != NULL &&
+		    dmu_objset_dirty_under_share(tx->tx_objset)) {
+			atomic_inc_64(&tx->tx_pool->dp_throttle_passes);
+		} else {
+			tx->tx_wait_dirty = B_TRUE;
+			DMU_TX_STAT_BUMP(dmu_tx_dirty_delay);
+			return (ERESTART);
+		}
 	}
 
 	tx->tx_txg = txg_hold_open(tx->tx_pool, &tx->tx_txgh);
@@ -906,7 +954,7 @@ dmu_tx_try_assign(dmu_tx_t *tx, txg_how_t txg_how)
 	    txh = list_next(&tx->tx_holds, txh)) {
 		dnode_t *dn = txh->txh_dnode;
 		if (dn != NULL) {
-			mutex_enter(&dn->dn_mtx);
+			zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 			if (dn->dn_assigned_txg == tx->tx_txg - 1) {
 				mutex_exit(&dn->dn_mtx);
 				tx->tx_needassign_txh = txh;
@@ -959,7 +1007,7 @@ dmu_tx_unassign(dmu_tx_t *tx)
 
 		if (dn == NULL)
 			continue;
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		ASSERT3U(dn->dn_assigned_txg, ==, tx->tx_txg);
 
 		if (refcount_remove(&dn->dn_tx_holds, tx) == 0) {
@@ -1042,10 +1090,21 @@ dmu_tx_wait(dmu_tx_t *tx)
 		 * space.
 		 */
 		mutex_enter(&dp->dp_lock);
-		if (dp->dp_dirty_total >= zfs_dirty_data_max)
+		if (dp->dp_dirty_total >= zfs_dirty_data_max) {
 			DMU_TX_STAT_BUMP(dmu_tx_dirty_over_max);
-		while (dp->dp_dirty_total >= zfs_dirty_data_max)
-			cv_wait(&dp->dp_spaceavail_cv, &dp->dp_lock);
+			while (dp->dp_dirty_total >= zfs_dirty_data_max)
+				cv_wait(&dp->dp_spaceavail_cv, &dp->dp_lock);
+			atomic_inc_64(&dp->dp_throttle_stalls);
+			atomic_add_64(&dp->dp_throttle_stall_time,
+			    gethrtime() - before);
+			if (tx->tx_objset != NULL) {
+				atomic_inc_64(
+				    &tx->tx_objset->os_throttle_stalls);
+				atomic_add_64(
+				    &tx->tx_objset->os_throttle_stall_time,
+				    gethrtime() - before);
+			}
+		}
 		dirty = dp->dp_dirty_total;
 		mutex_exit(&dp->dp_lock);
 
@@ -1072,7 +1131,7 @@ dmu_tx_wait(dmu_tx_t *tx)
 	} else if (tx->tx_needassign_txh) {
 		dnode_t *dn = tx->tx_needassign_txh->txh_dnode;
 
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		while (dn->dn_assigned_txg == tx->tx_lasttried_txg - 1)
 			cv_wait(&dn->dn_notxholds, &dn->dn_mtx);
 		mutex_exit(&dn->dn_mtx);
@@ -1127,7 +1186,7 @@ dmu_tx_commit(dmu_tx_t *tx)
 		if (dn == NULL)
 			continue;
 
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		ASSERT3U(dn->dn_assigned_txg, ==, tx->tx_txg);
 
 		if (refcount_remove(&dn->dn_tx_holds, tx) == 0) {
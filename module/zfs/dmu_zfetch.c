@@ -53,21 +53,115 @@ uint32_t	zfetch_max_distance = 8 * 1024 * 1024;
 uint32_t	zfetch_max_idistance = 64 * 1024 * 1024;
 /* max number of bytes in an array_read in which we allow prefetching (1MB) */
 uint64_t	zfetch_array_rd_sz = 1024 * 1024;
+/*
+ * bytes a stream must have covered before its data blocks are read into
+ * the ARC as sequential (scan-resistant, see arc_access()); 0 disables
+ */
+uint64_t	zfetch_sequential_min = 64 * 1024 * 1024;
+/* max bytes between the starts of accesses of a strided stream (4MB) */
+uint32_t	zfetch_max_stride = 4 * 1024 * 1024;
+/* scale the prefetch distance by how much of the prefetch is used */
+int		zfetch_adaptive_distance = 1;
 
 typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_forward_hits;
+	kstat_named_t zfetchstat_forward_misses;
+	kstat_named_t zfetchstat_stride_hits;
+	kstat_named_t zfetchstat_stride_misses;
+	kstat_named_t zfetchstat_stride_streams;
+	kstat_named_t zfetchstat_reverse_hits;
+	kstat_named_t zfetchstat_reverse_misses;
+	kstat_named_t zfetchstat_reverse_streams;
+	kstat_named_t zfetchstat_prefetch_bytes;
+	kstat_named_t zfetchstat_wasted_bytes;
+	kstat_named_t zfetchstat_distance_pct;
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "forward_hits",		KSTAT_DATA_UINT64 },
+	{ "forward_misses",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "stride_misses",		KSTAT_DATA_UINT64 },
+	{ "stride_streams",		KSTAT_DATA_UINT64 },
+	{ "reverse_hits",		KSTAT_DATA_UINT64 },
+	{ "reverse_misses",		KSTAT_DATA_UINT64 },
+	{ "reverse_streams",		KSTAT_DATA_UINT64 },
+	{ "prefetch_bytes",		KSTAT_DATA_UINT64 },
+	{ "wasted_bytes",		KSTAT_DATA_UINT64 },
+	{ "distance_pct",		KSTAT_DATA_UINT64 },
 };
 
+#define	ZFETCHSTAT(stat)	(zfetch_stats.stat.value.ui64)
 #define	ZFETCHSTAT_BUMP(stat) \
-	atomic_inc_64(&zfetch_stats.stat.value.ui64);
+	atomic_inc_64(&zfetch_stats.stat.value.ui64)
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val))
+
+/*
+ * The data prefetch distance of every stream is capped at this percentage
+ * of zfetch_max_distance.  dmu_zfetch_adapt() moves it once a second:
+ * down when much of what was prefetched was never read (a low prefetch
+ * hit rate), up when demand reads keep catching prefetches still in
+ * flight (the prefetch is not far enough ahead to hide the i/o latency).
+ */
+#define	ZFETCH_DIST_PCT_MIN	25
+#define	ZFETCH_DIST_PCT_MAX	400
+
+static uint64_t	zfetch_distance_pct = 100;
+static uint64_t	zfetch_adapt_time;
+static uint64_t	zfetch_adapt_prefetched;
+static uint64_t	zfetch_adapt_wasted;
+static uint64_t	zfetch_adapt_late;
+static uint64_t	zfetch_adapt_hits;
+
+static void
+dmu_zfetch_adapt(void)
+{
+	uint64_t now = gethrtime();
+	uint64_t last = zfetch_adapt_time;
+	uint64_t prefetched, wasted, late, hits;
+	uint64_t pct = zfetch_distance_pct;
+
+	if (now - last < NANOSEC ||
+	    atomic_cas_64(&zfetch_adapt_time, last, now) != last)
+		return;
+
+	if (!zfetch_adaptive_distance) {
+		zfetch_distance_pct = ZFETCHSTAT(zfetchstat_distance_pct) = 100;
+		return;
+	}
+
+	prefetched = ZFETCHSTAT(zfetchstat_prefetch_bytes);
+	wasted = ZFETCHSTAT(zfetchstat_wasted_bytes);
+	late = arc_prefetch_late();
+	hits = ZFETCHSTAT(zfetchstat_hits);
+
+	uint64_t dprefetched = prefetched - zfetch_adapt_prefetched;
+	uint64_t dwasted = wasted - zfetch_adapt_wasted;
+	uint64_t dlate = late - zfetch_adapt_late;
+	uint64_t dhits = hits - zfetch_adapt_hits;
+
+	zfetch_adapt_prefetched = prefetched;
+	zfetch_adapt_wasted = wasted;
+	zfetch_adapt_late = late;
+	zfetch_adapt_hits = hits;
+
+	if (dprefetched == 0)
+		return;
+
+	if (dwasted > dprefetched / 4)
+		pct = MAX(ZFETCH_DIST_PCT_MIN, pct - pct / 4);
+	else if (dlate > dhits / 16)
+		pct = MIN(ZFETCH_DIST_PCT_MAX, pct + pct / 4);
+
+	zfetch_distance_pct = ZFETCHSTAT(zfetchstat_distance_pct) = pct;
+}
 
 kstat_t		*zfetch_ksp;
 
@@ -78,6 +172,8 @@ zfetch_init(void)
 	    KSTAT_TYPE_NAMED, sizeof (zfetch_stats) / sizeof (kstat_named_t),
 	    KSTAT_FLAG_VIRTUAL);
 
+	ZFETCHSTAT(zfetchstat_distance_pct) = zfetch_distance_pct;
+
 	if (zfetch_ksp != NULL) {
 		zfetch_ksp->ks_data = &zfetch_stats;
 		kstat_install(zfetch_ksp);
@@ -112,10 +208,41 @@ dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
 	rw_init(&zf->zf_rwlock, NULL, RW_DEFAULT, NULL);
 }
 
+/*
+ * Account for the blocks this stream prefetched that were never read before
+ * it was retired.  A stream that leaves prefetched blocks unread counts as a
+ * miss of its pattern.
+ */
+static void
+dmu_zfetch_stream_wasted(zfetch_t *zf, zstream_t *zs)
+{
+	uint64_t blks;
+
+	if (zs->zs_pattern == ZFETCH_FORWARD) {
+		if (zs->zs_pf_blkid <= zs->zs_blkid)
+			return;
+		blks = zs->zs_pf_blkid - zs->zs_blkid;
+		ZFETCHSTAT_BUMP(zfetchstat_forward_misses);
+	} else {
+		int64_t ahead = ((int64_t)zs->zs_pf_blkid -
+		    (int64_t)zs->zs_blkid) / zs->zs_stride;
+		if (ahead <= 0)
+			return;
+		blks = ahead * zs->zs_len;
+		if (zs->zs_pattern == ZFETCH_STRIDE)
+			ZFETCHSTAT_BUMP(zfetchstat_stride_misses);
+		else
+			ZFETCHSTAT_BUMP(zfetchstat_reverse_misses);
+	}
+	ZFETCHSTAT_INCR(zfetchstat_wasted_bytes,
+	    blks << zf->zf_dnode->dn_datablkshift);
+}
+
 static void
 dmu_zfetch_stream_remove(zfetch_t *zf, zstream_t *zs)
 {
 	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
+	dmu_zfetch_stream_wasted(zf, zs);
 	list_remove(&zf->zf_stream, zs);
 	mutex_destroy(&zs->zs_lock);
 	kmem_free(zs, sizeof (*zs));
@@ -144,12 +271,13 @@ dmu_zfetch_fini(zfetch_t *zf)
 
 /*
  * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * The "blkid" argument is the next block that we expect this stream to access,
+ * "nblks" the length of the access that started it.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
 {
 	zstream_t *zs_next;
 	int numstreams = 0;
@@ -187,14 +315,135 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 
 	zstream_t *zs = kmem_zalloc(sizeof (*zs), KM_SLEEP);
 	zs->zs_blkid = blkid;
+	zs->zs_start_blkid = blkid;
 	zs->zs_pf_blkid = blkid;
 	zs->zs_ipf_blkid = blkid;
+	zs->zs_len = nblks;
+	zs->zs_pattern = ZFETCH_FORWARD;
 	zs->zs_atime = gethrtime();
 	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	list_insert_head(&zf->zf_stream, zs);
 }
 
+/*
+ * An access that matched no stream may still continue one that has seen a
+ * single access so far: if it is the same length and starts a short
+ * distance before or after that access, turn the stream into a strided or
+ * reverse one expecting the next access one stride further on.  Two
+ * accesses only suggest a stride, so nothing is prefetched until a third
+ * access confirms it.  Returns B_TRUE if a stream was converted.
+ */
+static boolean_t
+dmu_zfetch_stride_match(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
+{
+	int shift = zf->zf_dnode->dn_datablkshift;
+	int64_t max_stride = zfetch_max_stride >> shift;
+
+	ASSERT(RW_LOCK_HELD(&zf->zf_rwlock));
+
+	for (zstream_t *zs = list_head(&zf->zf_stream); zs != NULL;
+	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_pattern != ZFETCH_FORWARD || zs->zs_hits != 0 ||
+		    zs->zs_len != nblks)
+			continue;
+
+		mutex_enter(&zs->zs_lock);
+		int64_t last = (int64_t)zs->zs_blkid - zs->zs_len;
+		int64_t stride = (int64_t)blkid - last;
+		int64_t next = (int64_t)blkid + stride;
+
+		if (zs->zs_pattern != ZFETCH_FORWARD || zs->zs_hits != 0 ||
+		    stride == 0 || next < 0 ||
+		    (stride > 0 && stride <= nblks) ||
+		    (stride < 0 && -stride < nblks) ||
+		    stride > max_stride || -stride > max_stride) {
+			mutex_exit(&zs->zs_lock);
+			continue;
+		}
+
+		if (stride > 0) {
+			zs->zs_pattern = ZFETCH_STRIDE;
+			ZFETCHSTAT_BUMP(zfetchstat_stride_streams);
+		} else {
+			zs->zs_pattern = ZFETCH_REVERSE;
+			ZFETCHSTAT_BUMP(zfetchstat_reverse_streams);
+		}
+		zs->zs_stride = stride;
+		zs->zs_blkid = next;
+		zs->zs_pf_blkid = next;
+		zs->zs_ipf_blkid = next;
+		zs->zs_atime = gethrtime();
+		mutex_exit(&zs->zs_lock);
+		return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Prefetch for a hit on a strided or reverse stream, called with zs_lock
+ * and zf_rwlock held, both of which it drops.  As for forward streams the
+ * number of accesses prefetched ahead doubles on every hit, up to the
+ * (scaled) zfetch_max_distance worth of blocks.  dbuf_prefetch() reads
+ * the indirect blocks on the way, so they are not prefetched separately.
+ */
+static void
+dmu_zfetch_strided(zfetch_t *zf, zstream_t *zs, uint64_t nblks,
+    boolean_t fetch_data)
+{
+	dnode_t *dn = zf->zf_dnode;
+	int64_t stride = zs->zs_stride;
+	int64_t next = (int64_t)zs->zs_blkid + stride;
+	int64_t pf_start, ahead, max_ahead, pf_nacc = 0;
+	uint32_t len = MAX(zs->zs_len, nblks);
+
+	ASSERT(MUTEX_HELD(&zs->zs_lock));
+
+	pf_start = (int64_t)zs->zs_pf_blkid;
+	if ((stride > 0 && pf_start < next) || (stride < 0 && pf_start > next))
+		pf_start = next;
+
+	if (fetch_data) {
+		uint64_t max_dist = (uint64_t)zfetch_max_distance *
+		    zfetch_distance_pct / 100;
+		max_ahead = MAX(1, (max_dist >> dn->dn_datablkshift) / len);
+		ahead = (pf_start - next) / stride;
+		pf_nacc = MIN(2 * (ahead + 1), max_ahead) - ahead;
+		/* a reverse stream stops at the start of the object */
+		if (stride < 0) {
+			pf_nacc = (pf_start < 0) ? 0 :
+			    MIN(pf_nacc, pf_start / -stride + 1);
+		}
+		pf_nacc = MAX(pf_nacc, 0);
+	}
+
+	zs->zs_len = len;
+	zs->zs_pf_blkid = pf_start + pf_nacc * stride;
+	zs->zs_hits++;
+	zs->zs_atime = gethrtime();
+	zs->zs_blkid = next;
+	boolean_t reverse = (zs->zs_pattern == ZFETCH_REVERSE);
+	mutex_exit(&zs->zs_lock);
+	rw_exit(&zf->zf_rwlock);
+
+	for (int64_t i = 0; i < pf_nacc; i++) {
+		int64_t start = pf_start + i * stride;
+		for (uint32_t j = 0; j < len; j++) {
+			dbuf_prefetch(dn, 0, start + j,
+			    ZIO_PRIORITY_ASYNC_READ,
+			    ARC_FLAG_PREDICTIVE_PREFETCH);
+		}
+	}
+	ZFETCHSTAT_INCR(zfetchstat_prefetch_bytes,
+	    (pf_nacc * len) << dn->dn_datablkshift);
+	ZFETCHSTAT_BUMP(zfetchstat_hits);
+	if (reverse)
+		ZFETCHSTAT_BUMP(zfetchstat_reverse_hits);
+	else
+		ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
+	dmu_zfetch_adapt();
+}
+
 /*
  * This is the predictive prefetch entry point.  It associates dnode access
  * specified with blkid and nblks arguments with prefetch stream, predicts
@@ -211,6 +460,7 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	int64_t pf_ahead_blks, max_blks;
 	int epbs, max_dist_blks, pf_nblks, ipf_nblks;
 	uint64_t end_of_access_blkid = blkid + nblks;
+	arc_flags_t aflags = ARC_FLAG_PREDICTIVE_PREFETCH;
 
 	if (zfs_prefetch_disable)
 		return;
@@ -242,16 +492,23 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 
 	if (zs == NULL) {
 		/*
-		 * This access is not part of any existing stream.  Create
-		 * a new stream for it.
+		 * This access is not part of any existing stream.  Unless
+		 * it reveals a stride in one, create a new stream for it.
 		 */
 		ZFETCHSTAT_BUMP(zfetchstat_misses);
-		if (rw_tryupgrade(&zf->zf_rwlock))
-			dmu_zfetch_stream_create(zf, end_of_access_blkid);
+		if (!dmu_zfetch_stride_match(zf, blkid, nblks) &&
+		    rw_tryupgrade(&zf->zf_rwlock))
+			dmu_zfetch_stream_create(zf, end_of_access_blkid,
+			    nblks);
 		rw_exit(&zf->zf_rwlock);
 		return;
 	}
 
+	if (zs->zs_pattern != ZFETCH_FORWARD) {
+		dmu_zfetch_strided(zf, zs, nblks, fetch_data);
+		return;
+	}
+
 	/*
 	 * This access was to a block that we issued a prefetch for on
 	 * behalf of this stream. Issue further prefetches for this stream.
@@ -269,8 +526,8 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	 * prefetch get further ahead than zfetch_max_distance.
 	 */
 	if (fetch_data) {
-		max_dist_blks =
-		    zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+		max_dist_blks = ((uint64_t)zfetch_max_distance *
+		    zfetch_distance_pct / 100) >> zf->zf_dnode->dn_datablkshift;
 		/*
 		 * Previously, we were (zs_pf_blkid - blkid) ahead.  We
 		 * want to now be double that, so read that amount again,
@@ -309,6 +566,17 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	ipf_istart = P2ROUNDUP(ipf_start, 1 << epbs) >> epbs;
 	ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
 
+	/*
+	 * Once a stream has run long enough to look like a scan, tell the
+	 * ARC so that the data it prefetches for it does not displace
+	 * frequently used blocks.
+	 */
+	if (zfetch_sequential_min != 0 &&
+	    end_of_access_blkid - zs->zs_start_blkid >=
+	    (zfetch_sequential_min >> zf->zf_dnode->dn_datablkshift))
+		aflags |= ARC_FLAG_SEQUENTIAL;
+
+	zs->zs_hits++;
 	zs->zs_atime = gethrtime();
 	zs->zs_blkid = end_of_access_blkid;
 	mutex_exit(&zs->zs_lock);
@@ -322,11 +590,15 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 
 	for (int i = 0; i < pf_nblks; i++) {
 		dbuf_prefetch(zf->zf_dnode, 0, pf_start + i,
-		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
+		    ZIO_PRIORITY_ASYNC_READ, aflags);
 	}
 	for (int64_t iblk = ipf_istart; iblk < ipf_iend; iblk++) {
 		dbuf_prefetch(zf->zf_dnode, 1, iblk,
 		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
 	}
+	ZFETCHSTAT_INCR(zfetchstat_prefetch_bytes,
+	    (uint64_t)pf_nblks << zf->zf_dnode->dn_datablkshift);
 	ZFETCHSTAT_BUMP(zfetchstat_hits);
+	ZFETCHSTAT_BUMP(zfetchstat_forward_hits);
+	dmu_zfetch_adapt();
 }
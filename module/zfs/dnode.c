@@ -56,6 +56,25 @@ kmem_cache_t *dnode_cache;
 
 ASSERTV(static dnode_phys_t dnode_phys_zero);
 
+typedef struct dnode_stats {
+	kstat_named_t dns_hint_hits;
+	kstat_named_t dns_hint_misses;
+	kstat_named_t dns_hint_busy;
+	kstat_named_t dns_hint_stale;
+} dnode_stats_t;
+
+static dnode_stats_t dnode_stats = {
+	{ "hold_hint_hits",	KSTAT_DATA_UINT64 },
+	{ "hold_hint_misses",	KSTAT_DATA_UINT64 },
+	{ "hold_hint_busy",	KSTAT_DATA_UINT64 },
+	{ "hold_hint_stale",	KSTAT_DATA_UINT64 },
+};
+
+#define	DNSTAT_BUMP(stat) \
+	atomic_inc_64(&dnode_stats.stat.value.ui64)
+
+static kstat_t *dnode_ksp;
+
 int zfs_default_bs = SPA_MINBLOCKSHIFT;
 int zfs_default_ibs = DN_MAX_INDBLKSHIFT;
 
@@ -217,11 +236,24 @@ dnode_init(void)
 	dnode_cache = kmem_cache_create("dnode_t", sizeof (dnode_t),
 	    0, dnode_cons, dnode_dest, NULL, NULL, NULL, 0);
 	kmem_cache_set_move(dnode_cache, dnode_move);
+
+	dnode_ksp = kstat_create("zfs", 0, "dnodestats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dnode_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (dnode_ksp != NULL) {
+		dnode_ksp->ks_data = &dnode_stats;
+		kstat_install(dnode_ksp);
+	}
 }
 
 void
 dnode_fini(void)
 {
+	if (dnode_ksp != NULL) {
+		kstat_delete(dnode_ksp);
+		dnode_ksp = NULL;
+	}
+
 	kmem_cache_destroy(dnode_cache);
 	dnode_cache = NULL;
 }
@@ -258,12 +290,16 @@ dnode_verify(dnode_t *dn)
 		ASSERT(DMU_OT_IS_VALID(dn->dn_type));
 		ASSERT3U(dn->dn_nblkptr, >=, 1);
 		ASSERT3U(dn->dn_nblkptr, <=, DN_MAX_NBLKPTR);
-		ASSERT3U(dn->dn_bonuslen, <=, DN_MAX_BONUSLEN);
+		ASSERT3U(dn->dn_num_slots, >=, DNODE_MIN_SLOTS);
+		ASSERT3U(dn->dn_num_slots, <=, DNODE_MAX_SLOTS);
+		ASSERT3U(dn->dn_bonuslen, <=,
+		    DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots));
 		ASSERT3U(dn->dn_datablksz, ==,
 		    dn->dn_datablkszsec << SPA_MINBLOCKSHIFT);
 		ASSERT3U(ISP2(dn->dn_datablksz), ==, dn->dn_datablkshift != 0);
 		ASSERT3U((dn->dn_nblkptr - 1) * sizeof (blkptr_t) +
-		    dn->dn_bonuslen, <=, DN_MAX_BONUSLEN);
+		    dn->dn_bonuslen, <=,
+		    DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots));
 		for (i = 0; i < TXG_SIZE; i++) {
 			ASSERT3U(dn->dn_next_nlevels[i], <=, dn->dn_nlevels);
 		}
@@ -319,17 +355,16 @@ dnode_byteswap(dnode_phys_t *dnp)
 		 * pointer (instead of packing it against the end of the
 		 * dnode buffer).
 		 */
-		int off = (dnp->dn_nblkptr-1) * sizeof (blkptr_t);
-		size_t len = DN_MAX_BONUSLEN - off;
 		dmu_object_byteswap_t byteswap;
 		ASSERT(DMU_OT_IS_VALID(dnp->dn_bonustype));
 		byteswap = DMU_OT_BYTESWAP(dnp->dn_bonustype);
-		dmu_ot_byteswap[byteswap].ob_func(dnp->dn_bonus + off, len);
+		dmu_ot_byteswap[byteswap].ob_func(DN_BONUS(dnp),
+		    DN_MAX_BONUS_LEN(dnp));
 	}
 
 	/* Swap SPILL block if we have one */
 	if (dnp->dn_flags & DNODE_FLAG_SPILL_BLKPTR)
-		byteswap_uint64_array(&dnp->dn_spill, sizeof (blkptr_t));
+		byteswap_uint64_array(DN_SPILL_BLKPTR(dnp), sizeof (blkptr_t));
 
 }
 
@@ -337,15 +372,18 @@ void
 dnode_buf_byteswap(void *vbuf, size_t size)
 {
 	dnode_phys_t *buf = vbuf;
-	int i;
+	int i, slots;
 
 	ASSERT3U(sizeof (dnode_phys_t), ==, (1<<DNODE_SHIFT));
 	ASSERT((size & (sizeof (dnode_phys_t)-1)) == 0);
 
 	size >>= DNODE_SHIFT;
-	for (i = 0; i < size; i++) {
+	for (i = 0; i < size; i += slots) {
+		/* a free dnode is zeroed by dnode_byteswap() */
+		slots = (buf->dn_type == DMU_OT_NONE) ? 1 :
+		    buf->dn_extra_slots + 1;
 		dnode_byteswap(buf);
-		buf++;
+		buf += slots;
 	}
 }
 
@@ -356,7 +394,7 @@ dnode_setbonuslen(dnode_t *dn, int newsize, dmu_tx_t *tx)
 
 	dnode_setdirty(dn, tx);
 	rw_enter(&dn->dn_struct_rwlock, RW_WRITER);
-	ASSERT3U(newsize, <=, DN_MAX_BONUSLEN -
+	ASSERT3U(newsize, <=, DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots) -
 	    (dn->dn_nblkptr-1) * sizeof (blkptr_t));
 	dn->dn_bonuslen = newsize;
 	if (newsize == 0)
@@ -421,6 +459,7 @@ dnode_create(objset_t *os, dnode_phys_t *dnp, dmu_buf_impl_t *db,
 	dn->dn_dbuf = db;
 	dn->dn_handle = dnh;
 	dn->dn_phys = dnp;
+	dn->dn_num_slots = dnp->dn_extra_slots + 1;
 
 	if (dnp->dn_datablkszsec) {
 		dnode_setdblksz(dn, dnp->dn_datablkszsec << SPA_MINBLOCKSHIFT);
@@ -446,7 +485,7 @@ dnode_create(objset_t *os, dnode_phys_t *dnp, dmu_buf_impl_t *db,
 	ASSERT(DMU_OT_IS_VALID(dn->dn_phys->dn_type));
 
 	mutex_enter(&os->os_lock);
-	if (dnh->dnh_dnode != NULL) {
+	if (DN_SLOT_IS_PTR(dnh->dnh_dnode)) {
 		/* Lost the allocation race. */
 		mutex_exit(&os->os_lock);
 		kmem_cache_free(dnode_cache, dn);
@@ -478,6 +517,100 @@ dnode_create(objset_t *os, dnode_phys_t *dnp, dmu_buf_impl_t *db,
 	return (dn);
 }
 
+static os_dnode_hint_t *
+dnode_hint(objset_t *os, uint64_t object)
+{
+	return (&os->os_dnode_hints[object % OS_DNODE_HINTS]);
+}
+
+/*
+ * Forget the hint pointing at this dnode's handle, if any. This is what
+ * keeps dnode_hold_hinted() from looking at a dnode being destroyed. The
+ * hint lock is only ever held across a non-blocking zrl_tryadd() and a
+ * dn_mtx hold, so it may be taken here with the handle held, even
+ * exclusively.
+ */
+static void
+dnode_hint_clear(objset_t *os, dnode_t *dn)
+{
+	os_dnode_hint_t *odh;
+
+	if (DMU_OBJECT_IS_SPECIAL(dn->dn_object))
+		return;
+
+	odh = dnode_hint(os, dn->dn_object);
+	mutex_enter(&odh->odh_lock);
+	if (odh->odh_dnh == dn->dn_handle) {
+		odh->odh_dnh = NULL;
+		odh->odh_object = 0;
+	}
+	mutex_exit(&odh->odh_lock);
+}
+
+static void
+dnode_hint_set(objset_t *os, uint64_t object, dnode_handle_t *dnh)
+{
+	os_dnode_hint_t *odh = dnode_hint(os, object);
+
+	mutex_enter(&odh->odh_lock);
+	odh->odh_object = object;
+	odh->odh_dnh = dnh;
+	mutex_exit(&odh->odh_lock);
+}
+
+/*
+ * Try to add a hold to an allocated dnode that is already held by someone
+ * else, using the objset's hint rather than the dnode block's dbuf. The
+ * existing holds keep the dbuf, and so the handle, in place; the handle
+ * lock keeps the dnode from moving. Neither stops a dnode whose last hold
+ * is gone from being destroyed by the eviction of its dbuf, which takes
+ * the handle lock shared too, so the hint lock is held until we are done
+ * with the dnode: dnode_destroy() clears the hint first, under that lock.
+ * Returns B_FALSE if the caller must take the slow path.
+ */
+static boolean_t
+dnode_hold_hinted(objset_t *os, uint64_t object, void *tag, dnode_t **dnp)
+{
+	os_dnode_hint_t *odh = dnode_hint(os, object);
+	dnode_handle_t *dnh;
+	dnode_t *dn;
+
+	mutex_enter(&odh->odh_lock);
+	dnh = odh->odh_dnh;
+	if (dnh == NULL || odh->odh_object != object) {
+		mutex_exit(&odh->odh_lock);
+		DNSTAT_BUMP(dns_hint_misses);
+		return (B_FALSE);
+	}
+	if (!zrl_tryadd(&dnh->dnh_zrlock)) {
+		mutex_exit(&odh->odh_lock);
+		DNSTAT_BUMP(dns_hint_busy);
+		return (B_FALSE);
+	}
+
+	dn = dnh->dnh_dnode;
+	ASSERT(DN_SLOT_IS_PTR(dn));
+	ASSERT3U(dn->dn_object, ==, object);
+
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
+	if (refcount_is_zero(&dn->dn_holds) || dn->dn_free_txg ||
+	    dn->dn_type == DMU_OT_NONE) {
+		mutex_exit(&dn->dn_mtx);
+		zrl_remove(&dnh->dnh_zrlock);
+		mutex_exit(&odh->odh_lock);
+		DNSTAT_BUMP(dns_hint_stale);
+		return (B_FALSE);
+	}
+	(void) refcount_add(&dn->dn_holds, tag);
+	mutex_exit(&dn->dn_mtx);
+	zrl_remove(&dnh->dnh_zrlock);
+	mutex_exit(&odh->odh_lock);
+
+	DNSTAT_BUMP(dns_hint_hits);
+	*dnp = dn;
+	return (B_TRUE);
+}
+
 /*
  * Caller must be holding the dnode handle, which is released upon return.
  */
@@ -489,6 +622,8 @@ dnode_destroy(dnode_t *dn)
 
 	ASSERT((dn->dn_id_flags & DN_ID_NEW_EXIST) == 0);
 
+	dnode_hint_clear(os, dn);
+
 	mutex_enter(&os->os_lock);
 	POINTER_INVALIDATE(&dn->dn_objset);
 	if (!DMU_OBJECT_IS_SPECIAL(dn->dn_object)) {
@@ -499,8 +634,12 @@ dnode_destroy(dnode_t *dn)
 	}
 	mutex_exit(&os->os_lock);
 
-	/* the dnode can no longer move, so we can release the handle */
-	zrl_remove(&dn->dn_handle->dnh_zrlock);
+	/*
+	 * The dnode can no longer move, so we can release the handle, unless
+	 * the caller holds it exclusively (see dnode_reclaim_slots()).
+	 */
+	if (!zrl_is_locked(&dn->dn_handle->dnh_zrlock))
+		zrl_remove(&dn->dn_handle->dnh_zrlock);
 
 	dn->dn_allocated_txg = 0;
 	dn->dn_free_txg = 0;
@@ -537,10 +676,15 @@ dnode_destroy(dnode_t *dn)
 
 void
 dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
-    dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+    dmu_object_type_t bonustype, int bonuslen, int dn_slots, dmu_tx_t *tx)
 {
 	int i;
 
+	if (dn_slots == 0)
+		dn_slots = DNODE_MIN_SLOTS;
+	ASSERT3S(dn_slots, >=, DNODE_MIN_SLOTS);
+	ASSERT3S(dn_slots, <=, DNODE_MAX_SLOTS);
+
 	ASSERT3U(blocksize, <=,
 	    spa_maxblocksize(dmu_objset_spa(dn->dn_objset)));
 	if (blocksize == 0)
@@ -553,8 +697,8 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 
 	ibs = MIN(MAX(ibs, DN_MIN_INDBLKSHIFT), DN_MAX_INDBLKSHIFT);
 
-	dprintf("os=%p obj=%llu txg=%llu blocksize=%d ibs=%d\n", dn->dn_objset,
-	    dn->dn_object, tx->tx_txg, blocksize, ibs);
+	dprintf("os=%p obj=%llu txg=%llu blocksize=%d ibs=%d dn_slots=%d\n",
+	    dn->dn_objset, dn->dn_object, tx->tx_txg, blocksize, ibs, dn_slots);
 
 	ASSERT(dn->dn_type == DMU_OT_NONE);
 	ASSERT(bcmp(dn->dn_phys, &dnode_phys_zero, sizeof (dnode_phys_t)) == 0);
@@ -565,7 +709,7 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 	    (bonustype == DMU_OT_SA && bonuslen == 0) ||
 	    (bonustype != DMU_OT_NONE && bonuslen != 0));
 	ASSERT(DMU_OT_IS_VALID(bonustype));
-	ASSERT3U(bonuslen, <=, DN_MAX_BONUSLEN);
+	ASSERT3U(bonuslen, <=, DN_SLOTS_TO_BONUSLEN(dn_slots));
 	ASSERT(dn->dn_type == DMU_OT_NONE);
 	ASSERT0(dn->dn_maxblkid);
 	ASSERT0(dn->dn_allocated_txg);
@@ -591,11 +735,13 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 	dnode_setdblksz(dn, blocksize);
 	dn->dn_indblkshift = ibs;
 	dn->dn_nlevels = 1;
+	dn->dn_num_slots = dn_slots;
 	if (bonustype == DMU_OT_SA) /* Maximize bonus space for SA */
 		dn->dn_nblkptr = 1;
 	else
-		dn->dn_nblkptr = 1 +
-		    ((DN_MAX_BONUSLEN - bonuslen) >> SPA_BLKPTRSHIFT);
+		dn->dn_nblkptr = MIN(DN_MAX_NBLKPTR, 1 +
+		    ((DN_SLOTS_TO_BONUSLEN(dn_slots) - bonuslen) >>
+		    SPA_BLKPTRSHIFT));
 	dn->dn_bonustype = bonustype;
 	dn->dn_bonuslen = bonuslen;
 	dn->dn_checksum = ZIO_CHECKSUM_INHERIT;
@@ -620,10 +766,15 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 
 void
 dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
-    dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+    dmu_object_type_t bonustype, int bonuslen, int dn_slots, dmu_tx_t *tx)
 {
 	int nblkptr;
 
+	/* the number of slots is fixed until the object is freed */
+	if (dn_slots == 0)
+		dn_slots = DNODE_MIN_SLOTS;
+	ASSERT3S(dn_slots, ==, dn->dn_num_slots);
+
 	ASSERT3U(blocksize, >=, SPA_MINBLOCKSIZE);
 	ASSERT3U(blocksize, <=,
 	    spa_maxblocksize(dmu_objset_spa(dn->dn_objset)));
@@ -634,7 +785,7 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 	    (bonustype != DMU_OT_NONE && bonuslen != 0) ||
 	    (bonustype == DMU_OT_SA && bonuslen == 0));
 	ASSERT(DMU_OT_IS_VALID(bonustype));
-	ASSERT3U(bonuslen, <=, DN_MAX_BONUSLEN);
+	ASSERT3U(bonuslen, <=, DN_SLOTS_TO_BONUSLEN(dn_slots));
 
 	/* clean up any unreferenced dbufs */
 	dnode_evict_dbufs(dn);
@@ -657,7 +808,9 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 	if (bonustype == DMU_OT_SA) /* Maximize bonus space for SA */
 		nblkptr = 1;
 	else
-		nblkptr = 1 + ((DN_MAX_BONUSLEN - bonuslen) >> SPA_BLKPTRSHIFT);
+		nblkptr = MIN(DN_MAX_NBLKPTR, 1 +
+		    ((DN_SLOTS_TO_BONUSLEN(dn_slots) - bonuslen) >>
+		    SPA_BLKPTRSHIFT));
 	if (dn->dn_bonustype != bonustype)
 		dn->dn_next_bonustype[tx->tx_txg&TXG_MASK] = bonustype;
 	if (dn->dn_nblkptr != nblkptr)
@@ -672,7 +825,7 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 	dn->dn_type = ot;
 
 	/* change bonus size and type */
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	dn->dn_bonustype = bonustype;
 	dn->dn_bonuslen = bonuslen;
 	dn->dn_nblkptr = nblkptr;
@@ -683,7 +836,8 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 	/* fix up the bonus db_size */
 	if (dn->dn_bonus) {
 		dn->dn_bonus->db.db_size =
-		    DN_MAX_BONUSLEN - (dn->dn_nblkptr-1) * sizeof (blkptr_t);
+		    DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots) -
+		    (dn->dn_nblkptr-1) * sizeof (blkptr_t);
 		ASSERT(dn->dn_bonuslen <= dn->dn_bonus->db.db_size);
 	}
 
@@ -720,6 +874,7 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	ndn->dn_dbuf = odn->dn_dbuf;
 	ndn->dn_handle = odn->dn_handle;
 	ndn->dn_phys = odn->dn_phys;
+	ndn->dn_num_slots = odn->dn_num_slots;
 	ndn->dn_type = odn->dn_type;
 	ndn->dn_bonuslen = odn->dn_bonuslen;
 	ndn->dn_bonustype = odn->dn_bonustype;
@@ -1023,6 +1178,129 @@ dnode_special_open(objset_t *os, dnode_phys_t *dnp, uint64_t object,
 	DNODE_VERIFY(dn);
 }
 
+/*
+ * Take the handles of slots [idx, idx + slots) exclusively, so that their
+ * state can be changed.  Fails, holding none of them, if any is in use.
+ */
+static boolean_t
+dnode_slots_tryenter(dnode_children_t *children, int idx, int slots)
+{
+	ASSERT3S(idx + slots, <=, children->dnc_count);
+
+	for (int i = idx; i < idx + slots; i++) {
+		dnode_handle_t *dnh = &children->dnc_children[i];
+
+		if (!zrl_tryenter(&dnh->dnh_zrlock)) {
+			for (int j = idx; j < i; j++)
+				zrl_exit(&children->dnc_children[j].dnh_zrlock);
+			return (B_FALSE);
+		}
+	}
+	return (B_TRUE);
+}
+
+static void
+dnode_slots_exit(dnode_children_t *children, int idx, int slots)
+{
+	for (int i = idx; i < idx + slots; i++)
+		zrl_exit(&children->dnc_children[i].dnh_zrlock);
+}
+
+/* Shared holds keeping the dnodes of the slots from moving. */
+static void
+dnode_slots_hold(dnode_children_t *children, int idx, int slots)
+{
+	for (int i = idx; i < idx + slots; i++)
+		zrl_add(&children->dnc_children[i].dnh_zrlock);
+}
+
+static void
+dnode_slots_rele(dnode_children_t *children, int idx, int slots)
+{
+	for (int i = idx; i < idx + slots; i++)
+		zrl_remove(&children->dnc_children[i].dnh_zrlock);
+}
+
+static void
+dnode_set_slots(dnode_children_t *children, int idx, int slots, void *ptr)
+{
+	ASSERT3S(idx + slots, <=, children->dnc_count);
+
+	for (int i = idx; i < idx + slots; i++) {
+		dnode_handle_t *dnh = &children->dnc_children[i];
+
+		ASSERT(zrl_is_locked(&dnh->dnh_zrlock) ||
+		    dnh->dnh_dnode == DN_SLOT_UNINIT);
+		dnh->dnh_dnode = ptr;
+	}
+}
+
+/*
+ * Can slots [idx, idx + slots) become a new dnode?  Each must be free, or
+ * hold an unreferenced dnode_t of a free object.
+ */
+static boolean_t
+dnode_check_slots_free(dnode_children_t *children, int idx, int slots)
+{
+	for (int i = idx; i < idx + slots; i++) {
+		dnode_t *dn = children->dnc_children[i].dnh_dnode;
+
+		if (dn == DN_SLOT_FREE)
+			continue;
+		if (!DN_SLOT_IS_PTR(dn))
+			return (B_FALSE);
+
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
+		boolean_t can_free = (dn->dn_type == DMU_OT_NONE &&
+		    dn->dn_free_txg == 0 && refcount_is_zero(&dn->dn_holds));
+		mutex_exit(&dn->dn_mtx);
+		if (!can_free)
+			return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Destroy the dnode_t's of free objects in slots about to become the
+ * interior of a multi-slot dnode.
+ */
+static void
+dnode_reclaim_slots(dnode_children_t *children, int idx, int slots)
+{
+	for (int i = idx; i < idx + slots; i++) {
+		dnode_handle_t *dnh = &children->dnc_children[i];
+
+		ASSERT(zrl_is_locked(&dnh->dnh_zrlock));
+		if (DN_SLOT_IS_PTR(dnh->dnh_dnode)) {
+			ASSERT3S(dnh->dnh_dnode->dn_type, ==, DMU_OT_NONE);
+			dnode_destroy(dnh->dnh_dnode);
+			dnh->dnh_dnode = DN_SLOT_FREE;
+		}
+	}
+}
+
+/*
+ * Release the interior slots of a multi-slot dnode being freed in syncing
+ * context, so that new objects can be allocated in them.
+ */
+void
+dnode_free_interior_slots(dnode_t *dn)
+{
+	dnode_children_t *children = dmu_buf_get_user(&dn->dn_dbuf->db);
+	int epb = dn->dn_dbuf->db.db_size >> DNODE_SHIFT;
+	int idx = (dn->dn_object & (epb - 1)) + 1;
+	int slots = dn->dn_num_slots - 1;
+
+	if (slots == 0)
+		return;
+
+	ASSERT3S(idx + slots, <=, epb);
+	while (!dnode_slots_tryenter(children, idx, slots))
+		delay(1);
+	dnode_set_slots(children, idx, slots, DN_SLOT_FREE);
+	dnode_slots_exit(children, idx, slots);
+}
+
 static void
 dnode_buf_evict_async(void *dbu)
 {
@@ -1036,10 +1314,11 @@ dnode_buf_evict_async(void *dbu)
 		/*
 		 * The dnode handle lock guards against the dnode moving to
 		 * another valid address, so there is no need here to guard
-		 * against changes to or from NULL.
+		 * against changes to or from a slot state.
 		 */
-		if (dnh->dnh_dnode == NULL) {
+		if (!DN_SLOT_IS_PTR(dnh->dnh_dnode)) {
 			zrl_destroy(&dnh->dnh_zrlock);
+			dnh->dnh_dnode = DN_SLOT_UNINIT;
 			continue;
 		}
 
@@ -1065,11 +1344,16 @@ dnode_buf_evict_async(void *dbu)
 /*
  * errors:
  * EINVAL - invalid object number.
+ * ENOSPC - the slots for a DNODE_MUST_BE_FREE hold are not all free.
  * EIO - i/o error.
- * succeeds even for free dnodes.
+ * succeeds even for free dnodes, unless the object is the interior of a
+ * larger one (EEXIST).
+ *
+ * "slots" is the number of slots a dnode held with DNODE_MUST_BE_FREE will
+ * take; otherwise it is ignored.
  */
 int
-dnode_hold_impl(objset_t *os, uint64_t object, int flag,
+dnode_hold_impl(objset_t *os, uint64_t object, int flag, int slots,
     void *tag, dnode_t **dnp)
 {
 	int epb, idx, err;
@@ -1080,6 +1364,7 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	dmu_buf_impl_t *db;
 	dnode_children_t *children_dnodes;
 	dnode_handle_t *dnh;
+	dnode_phys_t *dn_block;
 
 	/*
 	 * If you are holding the spa config lock as writer, you shouldn't
@@ -1111,6 +1396,10 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	if (object == 0 || object >= DN_MAX_OBJECT)
 		return (SET_ERROR(EINVAL));
 
+	if ((flag & DNODE_MUST_BE_ALLOCATED) &&
+	    dnode_hold_hinted(os, object, tag, dnp))
+		return (0);
+
 	mdn = DMU_META_DNODE(os);
 	ASSERT(mdn->dn_object == DMU_META_DNODE_OBJECT);
 
@@ -1140,16 +1429,30 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	idx = object & (epb-1);
 
 	ASSERT(DB_DNODE(db)->dn_type == DMU_OT_DNODE);
+	dn_block = (dnode_phys_t *)db->db.db_data;
 	children_dnodes = dmu_buf_get_user(&db->db);
 	if (children_dnodes == NULL) {
-		int i;
+		int i, skip = 0;
 		dnode_children_t *winner;
 		children_dnodes = kmem_zalloc(sizeof (dnode_children_t) +
 		    epb * sizeof (dnode_handle_t), KM_SLEEP);
 		children_dnodes->dnc_count = epb;
 		dnh = &children_dnodes->dnc_children[0];
+
+		/* Initialize the slot states from the dnode block. */
 		for (i = 0; i < epb; i++) {
 			zrl_init(&dnh[i].dnh_zrlock);
+
+			if (skip > 0) {
+				dnh[i].dnh_dnode = DN_SLOT_INTERIOR;
+				skip--;
+			} else if (dn_block[i].dn_type != DMU_OT_NONE) {
+				dnh[i].dnh_dnode = DN_SLOT_ALLOCATED;
+				skip = MIN(dn_block[i].dn_extra_slots,
+				    epb - i - 1);
+			} else {
+				dnh[i].dnh_dnode = DN_SLOT_FREE;
+			}
 		}
 		dmu_buf_init_user(&children_dnodes->dnc_dbu, NULL,
 		    dnode_buf_evict_async, NULL);
@@ -1168,32 +1471,100 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	ASSERT(children_dnodes->dnc_count == epb);
 
 	dnh = &children_dnodes->dnc_children[idx];
-	zrl_add(&dnh->dnh_zrlock);
-	dn = dnh->dnh_dnode;
-	if (dn == NULL) {
-		dnode_phys_t *phys = (dnode_phys_t *)db->db.db_data+idx;
+	if (flag & DNODE_MUST_BE_FREE) {
+		slots = MAX(slots, DNODE_MIN_SLOTS);
+		if (idx + slots > epb) {
+			dbuf_rele(db, FTAG);
+			return (SET_ERROR(ENOSPC));
+		}
 
-		dn = dnode_create(os, phys, db, object, dnh);
-	}
+		/*
+		 * Changing the state of the slots takes their handles
+		 * exclusively; retry while a concurrent hold is using one.
+		 * EEXIST means the object itself is in use, ENOSPC that
+		 * only the slots it would extend into are.
+		 */
+		boolean_t entered, isfree = B_TRUE;
+		while (!(entered = dnode_slots_tryenter(children_dnodes,
+		    idx, slots))) {
+			dnode_slots_hold(children_dnodes, idx, slots);
+			isfree = dnode_check_slots_free(children_dnodes, idx,
+			    slots);
+			if (!isfree) {
+				err = dnode_check_slots_free(children_dnodes,
+				    idx, 1) ? SET_ERROR(ENOSPC) :
+				    SET_ERROR(EEXIST);
+			}
+			dnode_slots_rele(children_dnodes, idx, slots);
+			if (!isfree)
+				break;
+		}
+		if (entered && !dnode_check_slots_free(children_dnodes, idx,
+		    slots)) {
+			err = dnode_check_slots_free(children_dnodes, idx, 1) ?
+			    SET_ERROR(ENOSPC) : SET_ERROR(EEXIST);
+			dnode_slots_exit(children_dnodes, idx, slots);
+			isfree = B_FALSE;
+		}
+		if (!isfree) {
+			dbuf_rele(db, FTAG);
+			return (err);
+		}
+
+		dnode_reclaim_slots(children_dnodes, idx + 1, slots - 1);
+		dn = dnh->dnh_dnode;
+		if (!DN_SLOT_IS_PTR(dn))
+			dn = dnode_create(os, dn_block + idx, db, object, dnh);
 
-	mutex_enter(&dn->dn_mtx);
-	type = dn->dn_type;
-	if (dn->dn_free_txg ||
-	    ((flag & DNODE_MUST_BE_ALLOCATED) && type == DMU_OT_NONE) ||
-	    ((flag & DNODE_MUST_BE_FREE) &&
-	    (type != DMU_OT_NONE || !refcount_is_zero(&dn->dn_holds)))) {
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
+		if (!refcount_is_zero(&dn->dn_holds) || dn->dn_free_txg) {
+			mutex_exit(&dn->dn_mtx);
+			dnode_slots_exit(children_dnodes, idx, slots);
+			dbuf_rele(db, FTAG);
+			return (SET_ERROR(EEXIST));
+		}
+		dnode_set_slots(children_dnodes, idx + 1, slots - 1,
+		    DN_SLOT_INTERIOR);
+		if (refcount_add(&dn->dn_holds, tag) == 1)
+			dbuf_add_ref(db, dnh);
 		mutex_exit(&dn->dn_mtx);
-		zrl_remove(&dnh->dnh_zrlock);
-		dbuf_rele(db, FTAG);
-		return (type == DMU_OT_NONE ? ENOENT : EEXIST);
-	}
-	if (refcount_add(&dn->dn_holds, tag) == 1)
-		dbuf_add_ref(db, dnh);
 
-	mutex_exit(&dn->dn_mtx);
+		dnode_slots_exit(children_dnodes, idx, slots);
+	} else {
+		zrl_add(&dnh->dnh_zrlock);
+		dn = dnh->dnh_dnode;
+		if (dn == DN_SLOT_INTERIOR ||
+		    (dn == DN_SLOT_FREE && (flag & DNODE_MUST_BE_ALLOCATED))) {
+			zrl_remove(&dnh->dnh_zrlock);
+			dbuf_rele(db, FTAG);
+			return (dn == DN_SLOT_FREE ? SET_ERROR(ENOENT) :
+			    SET_ERROR(EEXIST));
+		}
+		if (!DN_SLOT_IS_PTR(dn))
+			dn = dnode_create(os, dn_block + idx, db, object, dnh);
 
-	/* Now we can rely on the hold to prevent the dnode from moving. */
-	zrl_remove(&dnh->dnh_zrlock);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
+		type = dn->dn_type;
+		if (dn->dn_free_txg ||
+		    ((flag & DNODE_MUST_BE_ALLOCATED) &&
+		    type == DMU_OT_NONE)) {
+			mutex_exit(&dn->dn_mtx);
+			zrl_remove(&dnh->dnh_zrlock);
+			dbuf_rele(db, FTAG);
+			return (type == DMU_OT_NONE ? ENOENT : EEXIST);
+		}
+		if (refcount_add(&dn->dn_holds, tag) == 1)
+			dbuf_add_ref(db, dnh);
+
+		mutex_exit(&dn->dn_mtx);
+
+		/*
+		 * Now we can rely on the hold to prevent the dnode from
+		 * moving.
+		 */
+		zrl_remove(&dnh->dnh_zrlock);
+		dnode_hint_set(os, object, dnh);
+	}
 
 	DNODE_VERIFY(dn);
 	ASSERT3P(dn->dn_dbuf, ==, db);
@@ -1210,7 +1581,8 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 int
 dnode_hold(objset_t *os, uint64_t object, void *tag, dnode_t **dnp)
 {
-	return (dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED, tag, dnp));
+	return (dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED, 0,
+	    tag, dnp));
 }
 
 /*
@@ -1221,7 +1593,7 @@ dnode_hold(objset_t *os, uint64_t object, void *tag, dnode_t **dnp)
 boolean_t
 dnode_add_ref(dnode_t *dn, void *tag)
 {
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	if (refcount_is_zero(&dn->dn_holds)) {
 		mutex_exit(&dn->dn_mtx);
 		return (FALSE);
@@ -1235,7 +1607,7 @@ dnode_add_ref(dnode_t *dn, void *tag)
 void
 dnode_rele(dnode_t *dn, void *tag)
 {
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	dnode_rele_and_unlock(dn, tag);
 }
 
@@ -1290,7 +1662,7 @@ dnode_setdirty(dnode_t *dn, dmu_tx_t *tx)
 	DNODE_VERIFY(dn);
 
 #ifdef ZFS_DEBUG
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	ASSERT(dn->dn_phys->dn_type || dn->dn_allocated_txg);
 	ASSERT(dn->dn_free_txg == 0 || dn->dn_free_txg >= txg);
 	mutex_exit(&dn->dn_mtx);
@@ -1345,7 +1717,7 @@ dnode_setdirty(dnode_t *dn, dmu_tx_t *tx)
 void
 dnode_free(dnode_t *dn, dmu_tx_t *tx)
 {
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	if (dn->dn_type == DMU_OT_NONE || dn->dn_free_txg) {
 		mutex_exit(&dn->dn_mtx);
 		return;
@@ -1484,7 +1856,7 @@ dnode_new_blkid(dnode_t *dn, uint64_t blkid, dmu_tx_t *tx, boolean_t have_read)
 		dbuf_rele(db, FTAG);
 
 		/* transfer the dirty records to the new indirect */
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		mutex_enter(&new->dt.di.dr_mtx);
 		list = &dn->dn_dirty_records[txgoff];
 		for (dr = list_head(list); dr; dr = dr_next) {
@@ -1707,7 +2079,7 @@ done:
 	 * Add this range to the dnode range list.
 	 * We will finish up this free operation in the syncing phase.
 	 */
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	{
 	int txgoff = tx->tx_txg & TXG_MASK;
 	if (dn->dn_free_ranges[txgoff] == NULL) {
@@ -1733,7 +2105,7 @@ dnode_spill_freed(dnode_t *dn)
 {
 	int i;
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	for (i = 0; i < TXG_SIZE; i++) {
 		if (dn->dn_rm_spillblk[i] == DN_KILL_SPILLBLK)
 			break;
@@ -1765,7 +2137,7 @@ dnode_block_freed(dnode_t *dn, uint64_t blkid)
 	if (blkid == DMU_SPILL_BLKID)
 		return (dnode_spill_freed(dn));
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	for (i = 0; i < TXG_SIZE; i++) {
 		if (dn->dn_free_ranges[i] != NULL &&
 		    range_tree_contains(dn->dn_free_ranges[i], blkid, 1))
@@ -1785,7 +2157,7 @@ dnode_diduse_space(dnode_t *dn, int64_t delta)
 	    (u_longlong_t)dn->dn_phys->dn_used,
 	    (longlong_t)delta);
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	space = DN_USED_BYTES(dn->dn_phys);
 	if (delta > 0) {
 		ASSERT3U(space + delta, >=, space); /* no overflow */
@@ -1881,16 +2253,34 @@ dnode_next_offset_level(dnode_t *dn, int flags, uint64_t *offset,
 		error = SET_ERROR(ESRCH);
 	} else if (lvl == 0) {
 		dnode_phys_t *dnp = data;
+		int step = inc;
 		span = DNODE_SHIFT;
 		ASSERT(dn->dn_type == DMU_OT_DNODE);
 
-		for (i = (*offset >> span) & (blkfill - 1);
-		    i >= 0 && i < blkfill; i += inc) {
+		i = (*offset >> span) & (blkfill - 1);
+		if (inc > 0) {
+			/*
+			 * The interior slots of a large dnode hold its bonus
+			 * data, not dnodes: walk the dnodes from the start
+			 * of the block, and start at the first one at or
+			 * after the offset.
+			 */
+			int j = 0;
+			while (j < i) {
+				j += (dnp[j].dn_type == DMU_OT_NONE) ? 1 :
+				    dnp[j].dn_extra_slots + 1;
+			}
+			*offset += (uint64_t)(j - i) << span;
+			i = j;
+		}
+		for (; i >= 0 && i < blkfill; i += step) {
 			if ((dnp[i].dn_type == DMU_OT_NONE) == hole)
 				break;
-			*offset += (1ULL << span) * inc;
+			if (inc > 0)
+				step = dnp[i].dn_extra_slots + 1;
+			*offset += (1ULL << span) * step;
 		}
-		if (i < 0 || i == blkfill)
+		if (i < 0 || i >= blkfill)
 			error = SET_ERROR(ESRCH);
 	} else {
 		blkptr_t *bp = data;
@@ -395,7 +395,7 @@ dnode_sync_free_range(void *arg, uint64_t blkid, uint64_t nblks)
 
 	mutex_exit(&dn->dn_mtx);
 	dnode_sync_free_range_impl(dn, blkid, nblks, dsfra->dsfra_tx);
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 }
 
 /*
@@ -418,7 +418,7 @@ dnode_evict_dbufs(dnode_t *dn)
 		DB_DNODE_EXIT(db);
 #endif	/* DEBUG */
 
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		if (db->db_state != DB_EVICTING &&
 		    refcount_is_zero(&db->db_holds)) {
 			db_marker->db_level = db->db_level;
@@ -472,7 +472,7 @@ dnode_undirty_dbufs(list_t *list)
 		if (db->db_level != 0)
 			dnode_undirty_dbufs(&dr->dt.di.dr_children);
 
-		mutex_enter(&db->db_mtx);
+		zfs_mutex_enter(&db->db_mtx, ZFS_LOCK_DBUF);
 		/* XXX - use dbuf_undirty()? */
 		list_remove(list, dr);
 		ASSERT(db->db_last_dirty == dr);
@@ -530,10 +530,12 @@ dnode_sync_free(dnode_t *dn, dmu_tx_t *tx)
 	ASSERT(dn->dn_free_txg > 0);
 	if (dn->dn_allocated_txg != dn->dn_free_txg)
 		dmu_buf_will_dirty(&dn->dn_dbuf->db, tx);
-	bzero(dn->dn_phys, sizeof (dnode_phys_t));
+	bzero(dn->dn_phys, sizeof (dnode_phys_t) * dn->dn_num_slots);
+	dnode_free_interior_slots(dn);
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	dn->dn_type = DMU_OT_NONE;
+	dn->dn_num_slots = DNODE_MIN_SLOTS;
 	dn->dn_maxblkid = 0;
 	dn->dn_allocated_txg = 0;
 	dn->dn_free_txg = 0;
@@ -565,14 +567,14 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 	ASSERT(dmu_tx_is_syncing(tx));
 	ASSERT(dnp->dn_type != DMU_OT_NONE || dn->dn_allocated_txg);
 	ASSERT(dnp->dn_type != DMU_OT_NONE ||
-	    bcmp(dnp, &zerodn, DNODE_SIZE) == 0);
+	    bcmp(dnp, &zerodn, DNODE_MIN_SIZE) == 0);
 	DNODE_VERIFY(dn);
 
 	ASSERT(dn->dn_dbuf == NULL || arc_released(dn->dn_dbuf->db_buf));
 
 	if (dmu_objset_userused_enabled(dn->dn_objset) &&
 	    !DMU_OBJECT_IS_SPECIAL(dn->dn_object)) {
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		dn->dn_oldused = DN_USED_BYTES(dn->dn_phys);
 		dn->dn_oldflags = dn->dn_phys->dn_flags;
 		dn->dn_phys->dn_flags |= DNODE_FLAG_USERUSED_ACCOUNTED;
@@ -584,7 +586,7 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 		    DNODE_FLAG_USERUSED_ACCOUNTED));
 	}
 
-	mutex_enter(&dn->dn_mtx);
+	zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 	if (dn->dn_allocated_txg == tx->tx_txg) {
 		/* The dnode is newly allocated or reallocated */
 		if (dnp->dn_type == DMU_OT_NONE) {
@@ -596,6 +598,16 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 		dnp->dn_type = dn->dn_type;
 		dnp->dn_bonustype = dn->dn_bonustype;
 		dnp->dn_bonuslen = dn->dn_bonuslen;
+		dnp->dn_extra_slots = dn->dn_num_slots - 1;
+
+		if (dn->dn_num_slots > DNODE_MIN_SLOTS &&
+		    dn->dn_objset->os_dsl_dataset != NULL) {
+			dsl_dataset_t *ds = dn->dn_objset->os_dsl_dataset;
+			mutex_enter(&ds->ds_lock);
+			ds->ds_feature_activation_needed[
+			    SPA_FEATURE_LARGE_DNODE] = B_TRUE;
+			mutex_exit(&ds->ds_lock);
+		}
 	}
 	ASSERT(dnp->dn_nlevels > 1 ||
 	    BP_IS_HOLE(&dnp->dn_blkptr[0]) ||
@@ -629,7 +641,8 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 			dnp->dn_bonuslen = 0;
 		else
 			dnp->dn_bonuslen = dn->dn_next_bonuslen[txgoff];
-		ASSERT(dnp->dn_bonuslen <= DN_MAX_BONUSLEN);
+		ASSERT(dnp->dn_bonuslen <=
+		    DN_SLOTS_TO_BONUSLEN(dnp->dn_extra_slots + 1));
 		dn->dn_next_bonuslen[txgoff] = 0;
 	}
 
@@ -668,8 +681,8 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 	mutex_exit(&dn->dn_mtx);
 
 	if (kill_spill) {
-		free_blocks(dn, &dn->dn_phys->dn_spill, 1, tx);
-		mutex_enter(&dn->dn_mtx);
+		free_blocks(dn, DN_SPILL_BLKPTR(dn->dn_phys), 1, tx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		dnp->dn_flags &= ~DNODE_FLAG_SPILL_BLKPTR;
 		mutex_exit(&dn->dn_mtx);
 	}
@@ -679,7 +692,7 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 		dnode_sync_free_range_arg_t dsfra;
 		dsfra.dsfra_dnode = dn;
 		dsfra.dsfra_tx = tx;
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		range_tree_vacate(dn->dn_free_ranges[txgoff],
 		    dnode_sync_free_range, &dsfra);
 		range_tree_destroy(dn->dn_free_ranges[txgoff]);
@@ -717,7 +730,7 @@ dnode_sync(dnode_t *dn, dmu_tx_t *tx)
 			}
 #endif
 		}
-		mutex_enter(&dn->dn_mtx);
+		zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
 		dnp->dn_nblkptr = dn->dn_next_nblkptr[txgoff];
 		dn->dn_next_nblkptr[txgoff] = 0;
 		mutex_exit(&dn->dn_mtx);
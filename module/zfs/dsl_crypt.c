@@ -0,0 +1,914 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Dataset encryption keys.
+ *
+ * A dataset created with the encryption property set (or with a keyformat)
+ * becomes an encryption root.  Its master key is generated at creation
+ * time, wrapped with the user's wrapping key and stored in a MOS ZAP, the
+ * key object, which dsl_dir's point at with DD_FIELD_CRYPTO_KEY_OBJ.
+ * Children, snapshots and clones share the key object of their encryption
+ * root; the key object counts the dsl_dir's using it.
+ *
+ * Loading a key (zfs load-key) unwraps the master key into the pool's
+ * keystore, where it stays until it is unloaded.  The zio layer only
+ * knows the objset number of a block, so opening an encrypted objset adds
+ * a mapping from the dataset to its key object.  Mounted filesystems and
+ * open zvols hold their key so that it can't be unloaded from under them.
+ *
+ * Only the contents of files and zvols are encrypted (DMU_OT_IS_ENCRYPTED);
+ * dnodes, indirect blocks, directories and the rest of the ZPL metadata
+ * are not, so a pool can be scrubbed, and most of the DMU run, without
+ * any keys loaded.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dsl_crypt.h>
+#include <sys/dsl_dataset.h>
+#include <sys/dsl_dir.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_prop.h>
+#include <sys/dmu_tx.h>
+#include <sys/spa_impl.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
+#include <sys/arc.h>
+#include <sys/abd.h>
+#include <sys/fs/zfs.h>
+#include "zfs_prop.h"
+
+int
+dsl_wrapping_key_create(uint8_t *wkeydata, uint_t wkeylen,
+    dsl_wrapping_key_t **wkey_out)
+{
+	dsl_wrapping_key_t *wkey;
+
+	if (wkeydata == NULL || wkeylen != WRAPPING_KEY_LEN)
+		return (SET_ERROR(EINVAL));
+
+	wkey = kmem_zalloc(sizeof (dsl_wrapping_key_t), KM_SLEEP);
+	bcopy(wkeydata, wkey->wk_keydata, WRAPPING_KEY_LEN);
+
+	wkey->wk_key.ck_format = CRYPTO_KEY_RAW;
+	wkey->wk_key.ck_data = wkey->wk_keydata;
+	wkey->wk_key.ck_length = CRYPTO_BYTES2BITS(WRAPPING_KEY_LEN);
+
+	*wkey_out = wkey;
+	return (0);
+}
+
+void
+dsl_wrapping_key_free(dsl_wrapping_key_t *wkey)
+{
+	bzero(wkey, sizeof (dsl_wrapping_key_t));
+	kmem_free(wkey, sizeof (dsl_wrapping_key_t));
+}
+
+/*
+ * Pull the encryption properties out of the props of a dataset being
+ * created; they end up in the key object rather than as properties.  The
+ * wrapping key travels separately (crypto_args) so that it never shows
+ * up in the pool history.
+ */
+int
+dsl_crypto_params_create_nvlist(nvlist_t *props, nvlist_t *crypto_args,
+    dsl_crypto_params_t **dcp_out)
+{
+	dsl_crypto_params_t *dcp;
+	uint64_t crypt = ZIO_CRYPT_INHERIT;
+	uint64_t keyformat = ZFS_KEYFORMAT_NONE;
+	uint8_t *wkeydata = NULL;
+	uint_t wkeylen = 0;
+	int ret;
+
+	if (props != NULL) {
+		(void) nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_ENCRYPTION), &crypt);
+		(void) nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), &keyformat);
+		(void) nvlist_remove_all(props,
+		    zfs_prop_to_name(ZFS_PROP_ENCRYPTION));
+		(void) nvlist_remove_all(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYFORMAT));
+	}
+
+	if (crypto_args != NULL) {
+		(void) nvlist_lookup_uint8_array(crypto_args, "wkeydata",
+		    &wkeydata, &wkeylen);
+	}
+
+	if (crypt >= ZIO_CRYPT_FUNCTIONS || keyformat >= ZFS_KEYFORMAT_FORMATS)
+		return (SET_ERROR(EINVAL));
+
+	/* a keyformat on its own asks for the default suite */
+	if (crypt == ZIO_CRYPT_INHERIT && keyformat != ZFS_KEYFORMAT_NONE)
+		crypt = ZIO_CRYPT_ON;
+	if (crypt == ZIO_CRYPT_ON)
+		crypt = ZIO_CRYPT_ON_VALUE;
+
+	/* a new encryption root needs both a keyformat and a key */
+	if (crypt > ZIO_CRYPT_OFF) {
+		if (keyformat == ZFS_KEYFORMAT_NONE || wkeydata == NULL)
+			return (SET_ERROR(EINVAL));
+	} else if (keyformat != ZFS_KEYFORMAT_NONE || wkeydata != NULL) {
+		return (SET_ERROR(EINVAL));
+	}
+
+	dcp = kmem_zalloc(sizeof (dsl_crypto_params_t), KM_SLEEP);
+	dcp->cp_crypt = crypt;
+	dcp->cp_keyformat = keyformat;
+
+	if (wkeydata != NULL) {
+		ret = dsl_wrapping_key_create(wkeydata, wkeylen,
+		    &dcp->cp_wkey);
+		if (ret != 0) {
+			kmem_free(dcp, sizeof (dsl_crypto_params_t));
+			return (ret);
+		}
+	}
+
+	*dcp_out = dcp;
+	return (0);
+}
+
+/*
+ * cp_keydata belongs to the receive stream and is not freed here.
+ */
+void
+dsl_crypto_params_free(dsl_crypto_params_t *dcp)
+{
+	if (dcp == NULL)
+		return;
+
+	if (dcp->cp_wkey != NULL)
+		dsl_wrapping_key_free(dcp->cp_wkey);
+	kmem_free(dcp, sizeof (dsl_crypto_params_t));
+}
+
+static boolean_t
+dsl_crypto_params_new_root(dsl_crypto_params_t *dcp)
+{
+	return (dcp != NULL &&
+	    (dcp->cp_crypt > ZIO_CRYPT_OFF || dcp->cp_keydata != NULL));
+}
+
+/*
+ * Called from the check functions of dataset creation and cloning.
+ */
+int
+dsl_crypto_params_check(dsl_dir_t *pdd, dsl_dataset_t *origin,
+    dsl_crypto_params_t *dcp)
+{
+	uint64_t key_obj;
+	spa_t *spa;
+
+	if (pdd == NULL)
+		return (0);
+	spa = pdd->dd_pool->dp_spa;
+
+	if (dsl_crypto_params_new_root(dcp)) {
+		/* clones always share the key of their origin */
+		if (origin != NULL)
+			return (SET_ERROR(EINVAL));
+		if (!spa_feature_is_enabled(spa, SPA_FEATURE_ENCRYPTION))
+			return (SET_ERROR(ENOTSUP));
+		return (0);
+	}
+
+	key_obj = (origin != NULL) ?
+	    origin->ds_dir->dd_crypto_obj : pdd->dd_crypto_obj;
+
+	/* encryption can't be turned off below an encryption root */
+	if (dcp != NULL && dcp->cp_crypt == ZIO_CRYPT_OFF && key_obj != 0)
+		return (SET_ERROR(EINVAL));
+
+	/* raw receives don't need the key, anything else does */
+	if (key_obj != 0 && (dcp == NULL || dcp->cp_keydata == NULL) &&
+	    !spa_keystore_key_loaded(spa, key_obj))
+		return (SET_ERROR(EACCES));
+
+	return (0);
+}
+
+static void
+dsl_crypto_key_set_dd(dsl_dir_t *dd, uint64_t key_obj, dmu_tx_t *tx)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+
+	dsl_dir_zapify(dd, tx);
+	VERIFY0(zap_add(mos, dd->dd_object, DD_FIELD_CRYPTO_KEY_OBJ,
+	    sizeof (uint64_t), 1, &key_obj, tx));
+	dd->dd_crypto_obj = key_obj;
+}
+
+static void
+dsl_crypto_key_write_sync(objset_t *mos, uint64_t key_obj, uint64_t crypt,
+    uint64_t guid, uint8_t *iv, uint8_t *mac, uint8_t *keydata,
+    uint64_t keyformat, uint64_t root_ddobj, dmu_tx_t *tx)
+{
+	uint64_t refcount = 1;
+
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    sizeof (uint64_t), 1, &crypt, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_GUID,
+	    sizeof (uint64_t), 1, &guid, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_IV,
+	    1, WRAPPING_IV_LEN, iv, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_MAC,
+	    1, WRAPPING_MAC_LEN, mac, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_MASTER_KEY,
+	    1, zio_crypt_table[crypt].ci_keylen, keydata, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_FORMAT,
+	    sizeof (uint64_t), 1, &keyformat, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_REFCOUNT,
+	    sizeof (uint64_t), 1, &refcount, tx));
+	VERIFY0(zap_add(mos, key_obj, DSL_CRYPTO_KEY_ROOT_DDOBJ,
+	    sizeof (uint64_t), 1, &root_ddobj, tx));
+}
+
+static int
+dsl_crypto_key_cmp(const void *a, const void *b)
+{
+	const dsl_crypto_key_t *dcka = a;
+	const dsl_crypto_key_t *dckb = b;
+
+	if (dcka->dck_obj < dckb->dck_obj)
+		return (-1);
+	if (dcka->dck_obj > dckb->dck_obj)
+		return (1);
+	return (0);
+}
+
+static int
+dsl_key_mapping_cmp(const void *a, const void *b)
+{
+	const dsl_key_mapping_t *kma = a;
+	const dsl_key_mapping_t *kmb = b;
+
+	if (kma->km_dsobj < kmb->km_dsobj)
+		return (-1);
+	if (kma->km_dsobj > kmb->km_dsobj)
+		return (1);
+	return (0);
+}
+
+static dsl_crypto_key_t *
+spa_keystore_find_key(spa_keystore_t *sk, uint64_t key_obj)
+{
+	dsl_crypto_key_t search;
+
+	ASSERT(RW_LOCK_HELD(&sk->sk_lock));
+
+	search.dck_obj = key_obj;
+	return (avl_find(&sk->sk_dslkeys, &search, NULL));
+}
+
+static dsl_crypto_key_t *
+spa_keystore_find_dsobj(spa_keystore_t *sk, uint64_t dsobj)
+{
+	dsl_key_mapping_t search, *km;
+
+	ASSERT(RW_LOCK_HELD(&sk->sk_lock));
+
+	search.km_dsobj = dsobj;
+	km = avl_find(&sk->sk_key_mappings, &search, NULL);
+	if (km == NULL)
+		return (NULL);
+
+	return (spa_keystore_find_key(sk, km->km_key_obj));
+}
+
+static void
+dsl_crypto_key_free(dsl_crypto_key_t *dck)
+{
+	ASSERT0(refcount_count(&dck->dck_holds));
+
+	zio_crypt_key_destroy(&dck->dck_key);
+	refcount_destroy(&dck->dck_holds);
+	kmem_free(dck, sizeof (dsl_crypto_key_t));
+}
+
+/*
+ * Add an unwrapped key to the keystore; consumes dck.
+ */
+static int
+spa_keystore_add_key(spa_t *spa, dsl_crypto_key_t *dck)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	avl_index_t where;
+
+	rw_enter(&sk->sk_lock, RW_WRITER);
+	if (avl_find(&sk->sk_dslkeys, dck, &where) != NULL) {
+		rw_exit(&sk->sk_lock);
+		dsl_crypto_key_free(dck);
+		return (SET_ERROR(EEXIST));
+	}
+	avl_insert(&sk->sk_dslkeys, dck, where);
+	rw_exit(&sk->sk_lock);
+
+	return (0);
+}
+
+void
+dsl_crypto_key_create_sync(dsl_dir_t *dd, dsl_dir_t *pdd,
+    dsl_dataset_t *origin, dsl_crypto_params_t *dcp, dmu_tx_t *tx)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	uint64_t key_obj, refcount;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (!dsl_crypto_params_new_root(dcp)) {
+		key_obj = (origin != NULL) ? origin->ds_dir->dd_crypto_obj :
+		    (pdd != NULL) ? pdd->dd_crypto_obj : 0;
+		if (key_obj == 0)
+			return;
+
+		VERIFY0(zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_REFCOUNT,
+		    sizeof (uint64_t), 1, &refcount));
+		refcount++;
+		VERIFY0(zap_update(mos, key_obj, DSL_CRYPTO_KEY_REFCOUNT,
+		    sizeof (uint64_t), 1, &refcount, tx));
+		dsl_crypto_key_set_dd(dd, key_obj, tx);
+		return;
+	}
+
+	key_obj = zap_create(mos, DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+
+	if (dcp->cp_keydata != NULL) {
+		/* raw receive: the stream carries the wrapped key */
+		uint64_t crypt, guid, keyformat;
+		uint8_t *iv, *mac, *keydata;
+		uint_t iv_len, mac_len, keydata_len;
+
+		VERIFY0(nvlist_lookup_uint64(dcp->cp_keydata,
+		    DSL_CRYPTO_KEY_CRYPTO_SUITE, &crypt));
+		VERIFY0(nvlist_lookup_uint64(dcp->cp_keydata,
+		    DSL_CRYPTO_KEY_GUID, &guid));
+		VERIFY0(nvlist_lookup_uint64(dcp->cp_keydata,
+		    DSL_CRYPTO_KEY_FORMAT, &keyformat));
+		VERIFY0(nvlist_lookup_uint8_array(dcp->cp_keydata,
+		    DSL_CRYPTO_KEY_IV, &iv, &iv_len));
+		VERIFY0(nvlist_lookup_uint8_array(dcp->cp_keydata,
+		    DSL_CRYPTO_KEY_MAC, &mac, &mac_len));
+		VERIFY0(nvlist_lookup_uint8_array(dcp->cp_keydata,
+		    DSL_CRYPTO_KEY_MASTER_KEY, &keydata, &keydata_len));
+
+		dsl_crypto_key_write_sync(mos, key_obj, crypt, guid, iv, mac,
+		    keydata, keyformat, dd->dd_object, tx);
+	} else {
+		dsl_crypto_key_t *dck;
+		uint8_t iv[WRAPPING_IV_LEN];
+		uint8_t mac[WRAPPING_MAC_LEN];
+		uint8_t keydata[MASTER_KEY_MAX_LEN];
+
+		ASSERT(dcp->cp_wkey != NULL);
+
+		dck = kmem_zalloc(sizeof (dsl_crypto_key_t), KM_SLEEP);
+		refcount_create(&dck->dck_holds);
+		dck->dck_obj = key_obj;
+
+		VERIFY0(zio_crypt_key_init(dcp->cp_crypt, &dck->dck_key));
+		VERIFY0(zio_crypt_key_wrap(&dcp->cp_wkey->wk_key,
+		    &dck->dck_key, iv, mac, keydata));
+
+		dsl_crypto_key_write_sync(mos, key_obj, dcp->cp_crypt,
+		    dck->dck_key.zk_guid, iv, mac, keydata, dcp->cp_keyformat,
+		    dd->dd_object, tx);
+		bzero(keydata, sizeof (keydata));
+
+		/* whoever created the dataset has its key loaded already */
+		VERIFY0(spa_keystore_add_key(dd->dd_pool->dp_spa, dck));
+	}
+
+	dsl_crypto_key_set_dd(dd, key_obj, tx);
+}
+
+/*
+ * Called when a dsl_dir goes away.  The key object goes with the last
+ * dsl_dir using it.
+ */
+void
+dsl_crypto_key_destroy_sync(dsl_dir_t *dd, dmu_tx_t *tx)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	spa_keystore_t *sk = &dd->dd_pool->dp_spa->spa_keystore;
+	uint64_t key_obj = dd->dd_crypto_obj;
+	dsl_crypto_key_t *dck;
+	uint64_t refcount;
+
+	if (key_obj == 0)
+		return;
+
+	VERIFY0(zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_REFCOUNT,
+	    sizeof (uint64_t), 1, &refcount));
+	ASSERT3U(refcount, >, 0);
+	refcount--;
+	dd->dd_crypto_obj = 0;
+
+	if (refcount != 0) {
+		VERIFY0(zap_update(mos, key_obj, DSL_CRYPTO_KEY_REFCOUNT,
+		    sizeof (uint64_t), 1, &refcount, tx));
+		return;
+	}
+
+	VERIFY0(zap_destroy(mos, key_obj, tx));
+
+	rw_enter(&sk->sk_lock, RW_WRITER);
+	dck = spa_keystore_find_key(sk, key_obj);
+	if (dck != NULL) {
+		avl_remove(&sk->sk_dslkeys, dck);
+		dsl_crypto_key_free(dck);
+	}
+	rw_exit(&sk->sk_lock);
+}
+
+/*
+ * The wrapped key of dd's encryption root, for a raw send.
+ */
+int
+dsl_crypto_key_get_raw(dsl_dir_t *dd, nvlist_t **keydata_out)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	uint64_t key_obj = dd->dd_crypto_obj;
+	uint64_t crypt, guid, keyformat;
+	uint8_t iv[WRAPPING_IV_LEN];
+	uint8_t mac[WRAPPING_MAC_LEN];
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+	nvlist_t *nvl;
+	int ret;
+
+	if (key_obj == 0)
+		return (SET_ERROR(EINVAL));
+
+	ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    sizeof (uint64_t), 1, &crypt);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_GUID,
+		    sizeof (uint64_t), 1, &guid);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_FORMAT,
+		    sizeof (uint64_t), 1, &keyformat);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_IV,
+		    1, WRAPPING_IV_LEN, iv);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_MAC,
+		    1, WRAPPING_MAC_LEN, mac);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_MASTER_KEY,
+		    1, zio_crypt_table[crypt].ci_keylen, keydata);
+	if (ret != 0)
+		return (ret);
+
+	nvl = fnvlist_alloc();
+	fnvlist_add_uint64(nvl, DSL_CRYPTO_KEY_CRYPTO_SUITE, crypt);
+	fnvlist_add_uint64(nvl, DSL_CRYPTO_KEY_GUID, guid);
+	fnvlist_add_uint64(nvl, DSL_CRYPTO_KEY_FORMAT, keyformat);
+	fnvlist_add_uint8_array(nvl, DSL_CRYPTO_KEY_IV, iv, WRAPPING_IV_LEN);
+	fnvlist_add_uint8_array(nvl, DSL_CRYPTO_KEY_MAC, mac,
+	    WRAPPING_MAC_LEN);
+	fnvlist_add_uint8_array(nvl, DSL_CRYPTO_KEY_MASTER_KEY, keydata,
+	    zio_crypt_table[crypt].ci_keylen);
+
+	*keydata_out = nvl;
+	return (0);
+}
+
+/*
+ * Validate the key of a raw stream.  An incremental stream has to be
+ * encrypted with the key the target already has.
+ */
+int
+dsl_crypto_key_check_raw(dsl_dir_t *dd, nvlist_t *keydata)
+{
+	uint64_t crypt, guid, keyformat, old_guid;
+	uint8_t *buf;
+	uint_t len;
+
+	if (nvlist_lookup_uint64(keydata, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    &crypt) != 0 ||
+	    nvlist_lookup_uint64(keydata, DSL_CRYPTO_KEY_GUID, &guid) != 0 ||
+	    nvlist_lookup_uint64(keydata, DSL_CRYPTO_KEY_FORMAT,
+	    &keyformat) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if (crypt <= ZIO_CRYPT_OFF || crypt >= ZIO_CRYPT_FUNCTIONS ||
+	    keyformat == ZFS_KEYFORMAT_NONE ||
+	    keyformat >= ZFS_KEYFORMAT_FORMATS)
+		return (SET_ERROR(EINVAL));
+
+	if (nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_IV,
+	    &buf, &len) != 0 || len != WRAPPING_IV_LEN)
+		return (SET_ERROR(EINVAL));
+	if (nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_MAC,
+	    &buf, &len) != 0 || len != WRAPPING_MAC_LEN)
+		return (SET_ERROR(EINVAL));
+	if (nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_MASTER_KEY,
+	    &buf, &len) != 0 || len != zio_crypt_table[crypt].ci_keylen)
+		return (SET_ERROR(EINVAL));
+
+	if (dd == NULL)
+		return (0);
+
+	if (dd->dd_crypto_obj == 0)
+		return (SET_ERROR(EINVAL));
+	if (zap_lookup(dd->dd_pool->dp_meta_objset, dd->dd_crypto_obj,
+	    DSL_CRYPTO_KEY_GUID, sizeof (uint64_t), 1, &old_guid) != 0 ||
+	    old_guid != guid)
+		return (SET_ERROR(EINVAL));
+
+	return (0);
+}
+
+void
+dsl_dataset_crypt_stats(dsl_dataset_t *ds, nvlist_t *nv)
+{
+	dsl_pool_t *dp = ds->ds_dir->dd_pool;
+	uint64_t key_obj = ds->ds_dir->dd_crypto_obj;
+	uint64_t crypt, keyformat;
+
+	if (key_obj == 0)
+		return;
+
+	if (zap_lookup(dp->dp_meta_objset, key_obj,
+	    DSL_CRYPTO_KEY_CRYPTO_SUITE, sizeof (uint64_t), 1, &crypt) == 0)
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_ENCRYPTION, crypt);
+	if (zap_lookup(dp->dp_meta_objset, key_obj,
+	    DSL_CRYPTO_KEY_FORMAT, sizeof (uint64_t), 1, &keyformat) == 0)
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_KEYFORMAT, keyformat);
+
+	dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_KEYSTATUS,
+	    spa_keystore_key_loaded(dp->dp_spa, key_obj) ?
+	    ZFS_KEYSTATUS_AVAILABLE : ZFS_KEYSTATUS_UNAVAILABLE);
+}
+
+void
+spa_keystore_init(spa_keystore_t *sk)
+{
+	rw_init(&sk->sk_lock, NULL, RW_DEFAULT, NULL);
+	avl_create(&sk->sk_dslkeys, dsl_crypto_key_cmp,
+	    sizeof (dsl_crypto_key_t),
+	    offsetof(dsl_crypto_key_t, dck_avl_link));
+	avl_create(&sk->sk_key_mappings, dsl_key_mapping_cmp,
+	    sizeof (dsl_key_mapping_t),
+	    offsetof(dsl_key_mapping_t, km_avl_link));
+}
+
+void
+spa_keystore_fini(spa_keystore_t *sk)
+{
+	dsl_crypto_key_t *dck;
+	dsl_key_mapping_t *km;
+	void *cookie;
+
+	cookie = NULL;
+	while ((km = avl_destroy_nodes(&sk->sk_key_mappings,
+	    &cookie)) != NULL)
+		kmem_free(km, sizeof (dsl_key_mapping_t));
+	avl_destroy(&sk->sk_key_mappings);
+
+	cookie = NULL;
+	while ((dck = avl_destroy_nodes(&sk->sk_dslkeys, &cookie)) != NULL)
+		dsl_crypto_key_free(dck);
+	avl_destroy(&sk->sk_dslkeys);
+
+	rw_destroy(&sk->sk_lock);
+}
+
+/*
+ * Keys are loaded and unloaded at their encryption root only.
+ */
+static int
+spa_keystore_hold_root(const char *dsname, void *tag, dsl_pool_t **dpp,
+    dsl_dir_t **ddp)
+{
+	dsl_pool_t *dp;
+	dsl_dir_t *dd;
+	uint64_t root_ddobj;
+	int ret;
+
+	ret = dsl_pool_hold(dsname, tag, &dp);
+	if (ret != 0)
+		return (ret);
+
+	ret = dsl_dir_hold(dp, dsname, tag, &dd, NULL);
+	if (ret != 0) {
+		dsl_pool_rele(dp, tag);
+		return (ret);
+	}
+
+	if (dd->dd_crypto_obj == 0) {
+		ret = SET_ERROR(EINVAL);
+	} else {
+		ret = zap_lookup(dp->dp_meta_objset, dd->dd_crypto_obj,
+		    DSL_CRYPTO_KEY_ROOT_DDOBJ, sizeof (uint64_t), 1,
+		    &root_ddobj);
+		if (ret == 0 && root_ddobj != dd->dd_object)
+			ret = SET_ERROR(EINVAL);
+	}
+
+	if (ret != 0) {
+		dsl_dir_rele(dd, tag);
+		dsl_pool_rele(dp, tag);
+		return (ret);
+	}
+
+	*dpp = dp;
+	*ddp = dd;
+	return (0);
+}
+
+int
+spa_keystore_load_wkey(const char *dsname, dsl_wrapping_key_t *wkey)
+{
+	dsl_pool_t *dp;
+	dsl_dir_t *dd;
+	dsl_crypto_key_t *dck;
+	objset_t *mos;
+	uint64_t key_obj, crypt, guid;
+	uint8_t iv[WRAPPING_IV_LEN];
+	uint8_t mac[WRAPPING_MAC_LEN];
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+	int ret;
+
+	ret = spa_keystore_hold_root(dsname, FTAG, &dp, &dd);
+	if (ret != 0)
+		return (ret);
+
+	mos = dp->dp_meta_objset;
+	key_obj = dd->dd_crypto_obj;
+
+	if (spa_keystore_key_loaded(dp->dp_spa, key_obj)) {
+		ret = SET_ERROR(EEXIST);
+		goto out;
+	}
+
+	ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    sizeof (uint64_t), 1, &crypt);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_GUID,
+		    sizeof (uint64_t), 1, &guid);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_IV,
+		    1, WRAPPING_IV_LEN, iv);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_MAC,
+		    1, WRAPPING_MAC_LEN, mac);
+	if (ret == 0)
+		ret = zap_lookup(mos, key_obj, DSL_CRYPTO_KEY_MASTER_KEY,
+		    1, zio_crypt_table[crypt].ci_keylen, keydata);
+	if (ret != 0)
+		goto out;
+
+	dck = kmem_zalloc(sizeof (dsl_crypto_key_t), KM_SLEEP);
+	refcount_create(&dck->dck_holds);
+	dck->dck_obj = key_obj;
+
+	ret = zio_crypt_key_unwrap(&wkey->wk_key, crypt, guid, keydata,
+	    iv, mac, &dck->dck_key);
+	if (ret != 0) {
+		refcount_destroy(&dck->dck_holds);
+		kmem_free(dck, sizeof (dsl_crypto_key_t));
+		goto out;
+	}
+
+	ret = spa_keystore_add_key(dp->dp_spa, dck);
+
+out:
+	bzero(keydata, sizeof (keydata));
+	dsl_dir_rele(dd, FTAG);
+	dsl_pool_rele(dp, FTAG);
+	return (ret);
+}
+
+int
+spa_keystore_unload_wkey(const char *dsname)
+{
+	spa_keystore_t *sk;
+	dsl_crypto_key_t *dck;
+	dsl_pool_t *dp;
+	dsl_dir_t *dd;
+	uint64_t key_obj;
+	spa_t *spa;
+	int ret;
+
+	ret = spa_keystore_hold_root(dsname, FTAG, &dp, &dd);
+	if (ret != 0)
+		return (ret);
+
+	/* keep the pool around once its config lock has been dropped */
+	spa = dp->dp_spa;
+	spa_open_ref(spa, FTAG);
+	key_obj = dd->dd_crypto_obj;
+	dsl_dir_rele(dd, FTAG);
+	dsl_pool_rele(dp, FTAG);
+
+	sk = &spa->spa_keystore;
+
+	rw_enter(&sk->sk_lock, RW_READER);
+	dck = spa_keystore_find_key(sk, key_obj);
+	if (dck == NULL)
+		ret = SET_ERROR(EACCES);
+	else if (refcount_count(&dck->dck_holds) != 0)
+		ret = SET_ERROR(EBUSY);
+	rw_exit(&sk->sk_lock);
+	if (ret != 0)
+		goto out;
+
+	/* data dirtied before the last hold went away still needs the key */
+	txg_wait_synced(spa_get_dsl(spa), 0);
+
+	rw_enter(&sk->sk_lock, RW_WRITER);
+	dck = spa_keystore_find_key(sk, key_obj);
+	if (dck == NULL) {
+		ret = SET_ERROR(EACCES);
+	} else if (refcount_count(&dck->dck_holds) != 0) {
+		ret = SET_ERROR(EBUSY);
+	} else {
+		avl_remove(&sk->sk_dslkeys, dck);
+		dsl_crypto_key_free(dck);
+	}
+	rw_exit(&sk->sk_lock);
+
+	/* don't leave decrypted data behind in the ARC */
+	if (ret == 0)
+		arc_flush(spa, B_TRUE);
+
+out:
+	spa_close(spa, FTAG);
+	return (ret);
+}
+
+boolean_t
+spa_keystore_key_loaded(spa_t *spa, uint64_t key_obj)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	boolean_t loaded;
+
+	rw_enter(&sk->sk_lock, RW_READER);
+	loaded = (spa_keystore_find_key(sk, key_obj) != NULL);
+	rw_exit(&sk->sk_lock);
+
+	return (loaded);
+}
+
+void
+spa_keystore_create_mapping(spa_t *spa, uint64_t dsobj, uint64_t key_obj)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_key_mapping_t *km;
+	avl_index_t where;
+
+	km = kmem_zalloc(sizeof (dsl_key_mapping_t), KM_SLEEP);
+	km->km_dsobj = dsobj;
+	km->km_key_obj = key_obj;
+
+	rw_enter(&sk->sk_lock, RW_WRITER);
+	if (avl_find(&sk->sk_key_mappings, km, &where) == NULL) {
+		avl_insert(&sk->sk_key_mappings, km, where);
+		km = NULL;
+	}
+	rw_exit(&sk->sk_lock);
+
+	if (km != NULL)
+		kmem_free(km, sizeof (dsl_key_mapping_t));
+}
+
+void
+spa_keystore_remove_mapping(spa_t *spa, uint64_t dsobj)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_key_mapping_t search, *km;
+
+	search.km_dsobj = dsobj;
+
+	rw_enter(&sk->sk_lock, RW_WRITER);
+	km = avl_find(&sk->sk_key_mappings, &search, NULL);
+	if (km != NULL)
+		avl_remove(&sk->sk_key_mappings, km);
+	rw_exit(&sk->sk_lock);
+
+	if (km != NULL)
+		kmem_free(km, sizeof (dsl_key_mapping_t));
+}
+
+/*
+ * Taken by mounted filesystems and open zvols.  Fails with EACCES if the
+ * key isn't loaded.
+ */
+int
+spa_keystore_hold_dsl_key(spa_t *spa, uint64_t dsobj, void *tag)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_crypto_key_t *dck;
+	int ret = 0;
+
+	rw_enter(&sk->sk_lock, RW_READER);
+	dck = spa_keystore_find_dsobj(sk, dsobj);
+	if (dck == NULL)
+		ret = SET_ERROR(EACCES);
+	else
+		(void) refcount_add(&dck->dck_holds, tag);
+	rw_exit(&sk->sk_lock);
+
+	return (ret);
+}
+
+void
+spa_keystore_rele_dsl_key(spa_t *spa, uint64_t dsobj, void *tag)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_crypto_key_t *dck;
+
+	rw_enter(&sk->sk_lock, RW_READER);
+	dck = spa_keystore_find_dsobj(sk, dsobj);
+	VERIFY(dck != NULL);
+	(void) refcount_remove(&dck->dck_holds, tag);
+	rw_exit(&sk->sk_lock);
+}
+
+/*
+ * Encrypt pabd into cabd, recording the salt, IV and MAC in bp, or
+ * decrypt cabd into pabd using the parameters from bp.  The keystore lock
+ * is held throughout so the key can't be unloaded while in use.
+ */
+int
+spa_do_crypt_abd(boolean_t encrypt, spa_t *spa, const zbookmark_phys_t *zb,
+    blkptr_t *bp, uint_t datalen, abd_t *pabd, abd_t *cabd)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_crypto_key_t *dck;
+	uint32_t salt;
+	uint8_t iv[ZIO_DATA_IV_LEN];
+	uint8_t mac[ZIO_DATA_MAC_LEN];
+	uint8_t *plainbuf, *cipherbuf;
+	int ret;
+
+	rw_enter(&sk->sk_lock, RW_READER);
+
+	dck = spa_keystore_find_dsobj(sk, zb->zb_objset);
+	if (dck == NULL) {
+		rw_exit(&sk->sk_lock);
+		return (SET_ERROR(EACCES));
+	}
+
+	if (encrypt) {
+		ret = zio_crypt_key_get_salt(&dck->dck_key, &salt);
+		if (ret == 0)
+			ret = zio_crypt_generate_iv(iv);
+		if (ret != 0) {
+			rw_exit(&sk->sk_lock);
+			return (ret);
+		}
+
+		plainbuf = abd_borrow_buf_copy(pabd, datalen);
+		cipherbuf = abd_borrow_buf(cabd, datalen);
+	} else {
+		zio_crypt_decode_params_bp(bp, &salt, iv);
+		zio_crypt_decode_mac_bp(bp, mac);
+
+		plainbuf = abd_borrow_buf(pabd, datalen);
+		cipherbuf = abd_borrow_buf_copy(cabd, datalen);
+	}
+
+	ret = zio_do_crypt_data(encrypt, &dck->dck_key, salt, iv, mac,
+	    datalen, plainbuf, cipherbuf);
+
+	rw_exit(&sk->sk_lock);
+
+	if (encrypt) {
+		abd_return_buf(pabd, plainbuf, datalen);
+		abd_return_buf_copy(cabd, cipherbuf, datalen);
+
+		if (ret == 0) {
+			BP_SET_CRYPT(bp, B_TRUE);
+			zio_crypt_encode_params_bp(bp, salt, iv);
+			zio_crypt_encode_mac_bp(bp, mac);
+		}
+	} else {
+		abd_return_buf_copy(pabd, plainbuf, datalen);
+		abd_return_buf(cabd, cipherbuf, datalen);
+	}
+
+	return (ret);
+}
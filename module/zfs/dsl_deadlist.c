@@ -49,8 +49,17 @@
  *     and protecting the dl_tree from being loaded.
  * The locking is provided by dl_lock.  Note that locking on the bpobj_t
  * provides its own locking, and dl_oldfmt is immutable.
+ *
+ * A deadlist whose tree has not been loaded answers the accessors from
+ * dl_cache, the space of each of its keys, which is much cheaper to keep
+ * than the tree with one open bpobj per key.  Snapshots' deadlists are
+ * only modified when a neighbouring snapshot is destroyed, so this is
+ * how most of them are ever read.  Loading the tree discards the cache.
  */
 
+/* Number of entries dsl_deadlist_move_bpobj() prefetches ahead */
+#define	DSL_DEADLIST_PREFETCH_MAX	128
+
 static int
 dsl_deadlist_compare(const void *arg1, const void *arg2)
 {
@@ -65,6 +74,97 @@ dsl_deadlist_compare(const void *arg1, const void *arg2)
 		return (0);
 }
 
+static int
+dsl_deadlist_cache_compare(const void *arg1, const void *arg2)
+{
+	const dsl_deadlist_cache_entry_t *dlce1 = arg1;
+	const dsl_deadlist_cache_entry_t *dlce2 = arg2;
+
+	if (dlce1->dlce_mintxg < dlce2->dlce_mintxg)
+		return (-1);
+	else if (dlce1->dlce_mintxg > dlce2->dlce_mintxg)
+		return (+1);
+	else
+		return (0);
+}
+
+/*
+ * Issue the reads of the dnodes (and so bonus buffers) of all the bpobjs
+ * of deadlist dlobj, so that opening them one by one does not wait for
+ * each in turn.
+ */
+static void
+dsl_deadlist_prefetch_bpobjs(objset_t *os, uint64_t dlobj)
+{
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	uint64_t empty_bpobj = dmu_objset_pool(os)->dp_empty_bpobj;
+
+	for (zap_cursor_init(&zc, os, dlobj);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		if (za.za_first_integer != empty_bpobj) {
+			dmu_prefetch(os, za.za_first_integer, 0, 0, 0,
+			    ZIO_PRIORITY_SYNC_READ);
+		}
+	}
+	zap_cursor_fini(&zc);
+}
+
+static void
+dsl_deadlist_unload_cache(dsl_deadlist_t *dl)
+{
+	void *cookie = NULL;
+	dsl_deadlist_cache_entry_t *dlce;
+
+	if (!dl->dl_havecache)
+		return;
+
+	while ((dlce = avl_destroy_nodes(&dl->dl_cache, &cookie)) != NULL)
+		kmem_free(dlce, sizeof (*dlce));
+	avl_destroy(&dl->dl_cache);
+	dl->dl_havecache = B_FALSE;
+}
+
+static void
+dsl_deadlist_load_cache(dsl_deadlist_t *dl)
+{
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	uint64_t empty_bpobj = dmu_objset_pool(dl->dl_os)->dp_empty_bpobj;
+
+	ASSERT(MUTEX_HELD(&dl->dl_lock));
+
+	ASSERT(!dl->dl_oldfmt);
+	if (dl->dl_havetree || dl->dl_havecache)
+		return;
+
+	avl_create(&dl->dl_cache, dsl_deadlist_cache_compare,
+	    sizeof (dsl_deadlist_cache_entry_t),
+	    offsetof(dsl_deadlist_cache_entry_t, dlce_node));
+	dsl_deadlist_prefetch_bpobjs(dl->dl_os, dl->dl_object);
+	for (zap_cursor_init(&zc, dl->dl_os, dl->dl_object);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		dsl_deadlist_cache_entry_t *dlce;
+		bpobj_t bpo;
+
+		/* Keys with nothing dead in them add nothing to any range. */
+		if (za.za_first_integer == empty_bpobj)
+			continue;
+
+		dlce = kmem_alloc(sizeof (*dlce), KM_SLEEP);
+		dlce->dlce_mintxg = strtonum(za.za_name, NULL);
+		VERIFY0(bpobj_open(&bpo, dl->dl_os, za.za_first_integer));
+		VERIFY0(bpobj_space(&bpo, &dlce->dlce_bytes,
+		    &dlce->dlce_comp, &dlce->dlce_uncomp));
+		bpobj_close(&bpo);
+		avl_add(&dl->dl_cache, dlce);
+	}
+	zap_cursor_fini(&zc);
+	dl->dl_havecache = B_TRUE;
+}
+
 static void
 dsl_deadlist_load_tree(dsl_deadlist_t *dl)
 {
@@ -77,9 +177,13 @@ dsl_deadlist_load_tree(dsl_deadlist_t *dl)
 	if (dl->dl_havetree)
 		return;
 
+	/* The tree is loaded to modify the deadlist; the cache goes stale. */
+	dsl_deadlist_unload_cache(dl);
+
 	avl_create(&dl->dl_tree, dsl_deadlist_compare,
 	    sizeof (dsl_deadlist_entry_t),
 	    offsetof(dsl_deadlist_entry_t, dle_node));
+	dsl_deadlist_prefetch_bpobjs(dl->dl_os, dl->dl_object);
 	for (zap_cursor_init(&zc, dl->dl_os, dl->dl_object);
 	    zap_cursor_retrieve(&zc, &za) == 0;
 	    zap_cursor_advance(&zc)) {
@@ -116,6 +220,7 @@ dsl_deadlist_open(dsl_deadlist_t *dl, objset_t *os, uint64_t object)
 	dl->dl_oldfmt = B_FALSE;
 	dl->dl_phys = dl->dl_dbuf->db_data;
 	dl->dl_havetree = B_FALSE;
+	dl->dl_havecache = B_FALSE;
 }
 
 void
@@ -140,6 +245,7 @@ dsl_deadlist_close(dsl_deadlist_t *dl)
 		}
 		avl_destroy(&dl->dl_tree);
 	}
+	dsl_deadlist_unload_cache(dl);
 	dmu_buf_rele(dl->dl_dbuf, dl);
 	mutex_destroy(&dl->dl_lock);
 	dl->dl_dbuf = NULL;
@@ -379,6 +485,31 @@ dsl_deadlist_space(dsl_deadlist_t *dl,
 	mutex_exit(&dl->dl_lock);
 }
 
+static void
+dsl_deadlist_space_range_cached(dsl_deadlist_t *dl, uint64_t mintxg,
+    uint64_t maxtxg, uint64_t *usedp, uint64_t *compp, uint64_t *uncompp)
+{
+	dsl_deadlist_cache_entry_t *dlce;
+	dsl_deadlist_cache_entry_t dlce_tofind;
+	avl_index_t where;
+
+	ASSERT(MUTEX_HELD(&dl->dl_lock));
+	dsl_deadlist_load_cache(dl);
+
+	/* Keys with empty bpobjs are not cached, so mintxg may be absent. */
+	dlce_tofind.dlce_mintxg = mintxg;
+	dlce = avl_find(&dl->dl_cache, &dlce_tofind, &where);
+	if (dlce == NULL)
+		dlce = avl_nearest(&dl->dl_cache, where, AVL_AFTER);
+
+	for (; dlce && dlce->dlce_mintxg < maxtxg;
+	    dlce = AVL_NEXT(&dl->dl_cache, dlce)) {
+		*usedp += dlce->dlce_bytes;
+		*compp += dlce->dlce_comp;
+		*uncompp += dlce->dlce_uncomp;
+	}
+}
+
 /*
  * return space used in the range (mintxg, maxtxg].
  * Includes maxtxg, does not include mintxg.
@@ -402,7 +533,12 @@ dsl_deadlist_space_range(dsl_deadlist_t *dl, uint64_t mintxg, uint64_t maxtxg,
 	*usedp = *compp = *uncompp = 0;
 
 	mutex_enter(&dl->dl_lock);
-	dsl_deadlist_load_tree(dl);
+	if (!dl->dl_havetree) {
+		dsl_deadlist_space_range_cached(dl, mintxg, maxtxg,
+		    usedp, compp, uncompp);
+		mutex_exit(&dl->dl_lock);
+		return;
+	}
 	dle_tofind.dle_mintxg = mintxg;
 	dle = avl_find(&dl->dl_tree, &dle_tofind, &where);
 	/*
@@ -488,6 +624,7 @@ dsl_deadlist_merge(dsl_deadlist_t *dl, uint64_t obj, dmu_tx_t *tx)
 	}
 
 	mutex_enter(&dl->dl_lock);
+	dsl_deadlist_prefetch_bpobjs(dl->dl_os, obj);
 	for (zap_cursor_init(&zc, dl->dl_os, obj);
 	    zap_cursor_retrieve(&zc, &za) == 0;
 	    zap_cursor_advance(&zc)) {
@@ -505,6 +642,21 @@ dsl_deadlist_merge(dsl_deadlist_t *dl, uint64_t obj, dmu_tx_t *tx)
 	mutex_exit(&dl->dl_lock);
 }
 
+/*
+ * Load dl's tree, and with it the bonus buffers of all of its bpobjs, so
+ * that a following sync task which merges or moves them finds them cached.
+ */
+void
+dsl_deadlist_prefetch(dsl_deadlist_t *dl)
+{
+	if (dl->dl_oldfmt)
+		return;
+
+	mutex_enter(&dl->dl_lock);
+	dsl_deadlist_load_tree(dl);
+	mutex_exit(&dl->dl_lock);
+}
+
 /*
  * Remove entries on dl that are >= mintxg, and put them on the bpobj.
  */
@@ -513,8 +665,9 @@ dsl_deadlist_move_bpobj(dsl_deadlist_t *dl, bpobj_t *bpo, uint64_t mintxg,
     dmu_tx_t *tx)
 {
 	dsl_deadlist_entry_t dle_tofind;
-	dsl_deadlist_entry_t *dle;
+	dsl_deadlist_entry_t *dle, *pdle;
 	avl_index_t where;
+	int i;
 
 	ASSERT(!dl->dl_oldfmt);
 
@@ -526,10 +679,24 @@ dsl_deadlist_move_bpobj(dsl_deadlist_t *dl, bpobj_t *bpo, uint64_t mintxg,
 	dle = avl_find(&dl->dl_tree, &dle_tofind, &where);
 	if (dle == NULL)
 		dle = avl_nearest(&dl->dl_tree, where, AVL_AFTER);
+
+	/*
+	 * Keep the reads bpobj_enqueue_subobj() does for the entries a
+	 * window ahead of the one being moved.
+	 */
+	for (pdle = dle, i = 0; pdle != NULL && i < DSL_DEADLIST_PREFETCH_MAX;
+	    pdle = AVL_NEXT(&dl->dl_tree, pdle), i++)
+		bpobj_prefetch_subobj(&pdle->dle_bpobj);
+
 	while (dle) {
 		uint64_t used, comp, uncomp;
 		dsl_deadlist_entry_t *dle_next;
 
+		if (pdle != NULL) {
+			bpobj_prefetch_subobj(&pdle->dle_bpobj);
+			pdle = AVL_NEXT(&dl->dl_tree, pdle);
+		}
+
 		bpobj_enqueue_subobj(bpo, dle->dle_bpobj.bpo_object, tx);
 
 		VERIFY3U(0, ==, bpobj_space(&dle->dle_bpobj,
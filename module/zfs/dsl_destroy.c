@@ -33,6 +33,7 @@
 #include <sys/dmu_tx.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_dir.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dmu_traverse.h>
 #include <sys/dsl_scan.h>
 #include <sys/dmu_objset.h>
@@ -48,8 +49,14 @@ typedef struct dmu_snapshots_destroy_arg {
 	nvlist_t *dsda_successful_snaps;
 	boolean_t dsda_defer;
 	nvlist_t *dsda_errlist;
+	hrtime_t dsda_prefetch_time;
 } dmu_snapshots_destroy_arg_t;
 
+/*
+ * Most threads used to prefetch the deadlists of snapshots being destroyed.
+ */
+int zfs_destroy_prefetch_threads = 8;
+
 int
 dsl_destroy_snapshot_check_impl(dsl_dataset_t *ds, boolean_t defer)
 {
@@ -114,13 +121,15 @@ dsl_destroy_snapshot_check(void *arg, dmu_tx_t *tx)
 		if (error == 0) {
 			error = dsl_destroy_snapshot_check_impl(ds,
 			    dsda->dsda_defer);
+			/* Let the sync task hold it without a name lookup */
+			if (error == 0) {
+				fnvlist_add_uint64(dsda->dsda_successful_snaps,
+				    nvpair_name(pair), ds->ds_object);
+			}
 			dsl_dataset_rele(ds, FTAG);
 		}
 
-		if (error == 0) {
-			fnvlist_add_boolean(dsda->dsda_successful_snaps,
-			    nvpair_name(pair));
-		} else {
+		if (error != 0) {
 			fnvlist_add_int32(dsda->dsda_errlist,
 			    nvpair_name(pair), error);
 		}
@@ -257,7 +266,7 @@ dsl_destroy_snapshot_sync_impl(dsl_dataset_t *ds, boolean_t defer, dmu_tx_t *tx)
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
 	ASSERT3U(dsl_dataset_phys(ds)->ds_bp.blk_birth, <=, tx->tx_txg);
 	rrw_exit(&ds->ds_bp_rwlock, FTAG);
-	ASSERT(refcount_is_zero(&ds->ds_longholds));
+	ASSERT(refcount_percpu_is_zero(&ds->ds_longholds));
 
 	if (defer &&
 	    (ds->ds_userrefs > 0 ||
@@ -456,6 +465,7 @@ dsl_destroy_snapshot_sync_impl(dsl_dataset_t *ds, boolean_t defer, dmu_tx_t *tx)
 		dsl_dataset_rele(ds_prev, FTAG);
 
 	spa_prop_clear_bootfs(dp->dp_spa, ds->ds_object, tx);
+	spa_keystore_remove_mapping(dp->dp_spa, ds->ds_object);
 
 	if (dsl_dataset_phys(ds)->ds_next_clones_obj != 0) {
 		ASSERTV(uint64_t count);
@@ -482,20 +492,94 @@ dsl_destroy_snapshot_sync(void *arg, dmu_tx_t *tx)
 	dmu_snapshots_destroy_arg_t *dsda = arg;
 	dsl_pool_t *dp = dmu_tx_pool(tx);
 	nvpair_t *pair;
+	hrtime_t start = gethrtime();
+	uint64_t count = 0;
 
 	for (pair = nvlist_next_nvpair(dsda->dsda_successful_snaps, NULL);
 	    pair != NULL;
 	    pair = nvlist_next_nvpair(dsda->dsda_successful_snaps, pair)) {
 		dsl_dataset_t *ds;
 
-		VERIFY0(dsl_dataset_hold(dp, nvpair_name(pair), FTAG, &ds));
+		VERIFY0(dsl_dataset_hold_obj(dp, fnvpair_value_uint64(pair),
+		    FTAG, &ds));
 
 		dsl_destroy_snapshot_sync_impl(ds, dsda->dsda_defer, tx);
 		zvol_remove_minors(dp->dp_spa, nvpair_name(pair), B_TRUE);
 		dsl_dataset_rele(ds, FTAG);
+		count++;
+	}
+
+	if (count > 1) {
+		spa_history_log_internal(dp->dp_spa, "destroy_snaps", tx,
+		    "count=%llu prefetch=%llums sync=%llums",
+		    (u_longlong_t)count,
+		    (u_longlong_t)NSEC2MSEC(dsda->dsda_prefetch_time),
+		    (u_longlong_t)NSEC2MSEC(gethrtime() - start));
 	}
 }
 
+/*
+ * Read in the deadlists of a snapshot about to be destroyed, and of the
+ * snapshot or head after it, which its deadlist will be merged into.
+ */
+static void
+dsl_destroy_snapshot_prefetch(void *arg)
+{
+	const char *name = arg;
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds, *ds_next;
+
+	if (dsl_pool_hold(name, FTAG, &dp) != 0)
+		return;
+
+	if (dsl_dataset_hold(dp, name, FTAG, &ds) == 0) {
+		if (ds->ds_is_snapshot) {
+			dsl_deadlist_prefetch(&ds->ds_deadlist);
+			if (dsl_dataset_hold_obj(dp,
+			    dsl_dataset_phys(ds)->ds_next_snap_obj, FTAG,
+			    &ds_next) == 0) {
+				dsl_deadlist_prefetch(&ds_next->ds_deadlist);
+				dsl_dataset_rele(ds_next, FTAG);
+			}
+		}
+		dsl_dataset_rele(ds, FTAG);
+	}
+	dsl_pool_rele(dp, FTAG);
+}
+
+/*
+ * The sync task destroys the snapshots one at a time in syncing context,
+ * where reading each one's deadlist would stall the txg.  Read them in
+ * beforehand, several snapshots at a time.
+ */
+static void
+dsl_destroy_snapshots_prefetch(nvlist_t *snaps)
+{
+	nvpair_t *pair;
+	taskq_t *tq;
+	int count = 0;
+
+	for (pair = nvlist_next_nvpair(snaps, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(snaps, pair))
+		count++;
+	if (count < 2 || zfs_destroy_prefetch_threads <= 0)
+		return;
+
+	tq = taskq_create("z_destroy_prefetch",
+	    MIN(count, zfs_destroy_prefetch_threads), minclsyspri,
+	    1, INT_MAX, 0);
+
+	for (pair = nvlist_next_nvpair(snaps, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(snaps, pair)) {
+		if (taskq_dispatch(tq, dsl_destroy_snapshot_prefetch,
+		    nvpair_name(pair), TQ_SLEEP) == 0)
+			dsl_destroy_snapshot_prefetch(nvpair_name(pair));
+	}
+
+	taskq_wait(tq);
+	taskq_destroy(tq);
+}
+
 /*
  * The semantics of this function are described in the comment above
  * lzc_destroy_snaps().  To summarize:
@@ -527,6 +611,10 @@ dsl_destroy_snapshots_nvl(nvlist_t *snaps, boolean_t defer,
 	dsda.dsda_defer = defer;
 	dsda.dsda_errlist = errlist;
 
+	dsda.dsda_prefetch_time = gethrtime();
+	dsl_destroy_snapshots_prefetch(snaps);
+	dsda.dsda_prefetch_time = gethrtime() - dsda.dsda_prefetch_time;
+
 	error = dsl_sync_task(nvpair_name(pair),
 	    dsl_destroy_snapshot_check, dsl_destroy_snapshot_sync,
 	    &dsda, 0, ZFS_SPACE_CHECK_NONE);
@@ -618,7 +706,7 @@ dsl_destroy_head_check_impl(dsl_dataset_t *ds, int expected_holds)
 	if (ds->ds_is_snapshot)
 		return (SET_ERROR(EINVAL));
 
-	if (refcount_count(&ds->ds_longholds) != expected_holds)
+	if (refcount_percpu_count(&ds->ds_longholds) != expected_holds)
 		return (SET_ERROR(EBUSY));
 
 	mos = ds->ds_dir->dd_pool->dp_meta_objset;
@@ -646,7 +734,7 @@ dsl_destroy_head_check_impl(dsl_dataset_t *ds, int expected_holds)
 	    dsl_dataset_phys(ds->ds_prev)->ds_num_children == 2 &&
 	    ds->ds_prev->ds_userrefs == 0) {
 		/* We need to remove the origin snapshot as well. */
-		if (!refcount_is_zero(&ds->ds_prev->ds_longholds))
+		if (!refcount_percpu_is_zero(&ds->ds_prev->ds_longholds))
 			return (SET_ERROR(EBUSY));
 	}
 	return (0);
@@ -712,6 +800,8 @@ dsl_dir_destroy_sync(uint64_t ddobj, dmu_tx_t *tx)
 	    dsl_dir_phys(dd->dd_parent)->dd_child_dir_zapobj,
 	    dd->dd_myname, tx));
 
+	dsl_crypto_key_destroy_sync(dd, tx);
+
 	dsl_dir_rele(dd, FTAG);
 	dmu_object_free_zapified(mos, ddobj, tx);
 }
@@ -867,6 +957,7 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 	}
 
 	spa_prop_clear_bootfs(dp->dp_spa, ds->ds_object, tx);
+	spa_keystore_remove_mapping(dp->dp_spa, ds->ds_object);
 
 	ASSERT0(dsl_dataset_phys(ds)->ds_next_clones_obj);
 	ASSERT0(dsl_dataset_phys(ds)->ds_props_obj);
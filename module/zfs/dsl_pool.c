@@ -33,6 +33,7 @@
 #include <sys/dsl_synctask.h>
 #include <sys/dsl_scan.h>
 #include <sys/dnode.h>
+#include <sys/dbuf.h>
 #include <sys/dmu_tx.h>
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
@@ -80,6 +81,13 @@
  * zfs_dirty_data_max determines the dirty space limit. Once that value is
  * exceeded, new writes are halted until space frees up.
  *
+ * To keep open context transactions off dp_lock, the space they dirty is
+ * first summed per cpu, in the tx_cpu the transaction holds, and folded
+ * into the poolwide values once it exceeds zfs_dirty_data_cpu_slack, and
+ * at the latest when the txg quiesces. The slack is limited so that all
+ * cpus together never hold back more than 1/32 of zfs_dirty_data_max,
+ * so the (slightly lagging) dp_dirty_total still bounds dirty data.
+ *
  * The zfs_dirty_data_sync tunable dictates the threshold at which we
  * ensure that there is a txg syncing (see the comment in txg.c for a full
  * description of transaction group stages).
@@ -89,7 +97,9 @@
  * issues. See the comment in vdev_queue.c for details of the IO scheduler.
  *
  * The delay is also calculated based on the amount of dirty data.  See the
- * comment above dmu_tx_delay() for details.
+ * comment above dmu_tx_delay() for details.  Datasets holding less than
+ * their dirty_weight share of the dirty data are not delayed, see
+ * dmu_objset_dirty_space().
  */
 
 /*
@@ -107,6 +117,11 @@ int zfs_dirty_data_max_max_percent = 25;
  */
 uint64_t zfs_dirty_data_sync = 64 * 1024 * 1024;
 
+/*
+ * Dirty space a cpu may accumulate before it is folded into dp_dirty_total.
+ */
+uint64_t zfs_dirty_data_cpu_slack = 1024 * 1024;
+
 /*
  * Once there is this amount of dirty data, the dmu_tx_delay() will kick in
  * and delay each transaction.
@@ -114,6 +129,12 @@ uint64_t zfs_dirty_data_sync = 64 * 1024 * 1024;
  */
 int zfs_delay_min_dirty_percent = 60;
 
+/*
+ * Let the writes of a dataset holding less than its dirty_weight share of
+ * the dirty data pass the delay, see dmu_objset_dirty_space().
+ */
+int zfs_dirty_data_fair = 1;
+
 /*
  * This controls how quickly the delay approaches infinity.
  * Larger values cause it to delay more for a given amount of dirty data.
@@ -129,11 +150,48 @@ int zfs_delay_min_dirty_percent = 60;
  */
 uint64_t zfs_delay_scale = 1000 * 1000 * 1000 / 2000;
 
+/*
+ * If non-zero, the delay curve is steered by how long txgs take to sync
+ * rather than by the amount of dirty data alone.  After each txg,
+ * dsl_pool_delay_adjust() moves the pool's delay scale a quarter of the
+ * way toward the value that would have made the sync take this long,
+ * within 1/16th and 16 times zfs_delay_scale.  Writers that would fill
+ * the dirty data space faster than the pool can sync it are then slowed
+ * steadily instead of swinging between full speed and stalls at
+ * zfs_dirty_data_max.
+ */
+int zfs_delay_sync_target_ms = 0;
+
 /*
  * This determines the number of threads used by the dp_sync_taskq.
  */
 uint64_t zfs_sync_taskq_batch_pct = 75;
 
+/*
+ * Overlap the data writes of a txg with the sync of the previous one.
+ * When a txg is quiesced while the previous txg is still syncing (e.g.
+ * still writing its metadata and uberblock to high latency vdevs), the
+ * quiesce thread issues the writes of its dirty level-0 data blocks
+ * right away, with dsl_pool_early_write(), instead of leaving them all
+ * to spa_sync().  The ordering rules are those the intent log already
+ * relies on for dmu_sync():
+ *
+ *  - The blocks are allocated in the quiesced txg, so metaslab_sync()
+ *    of the syncing txg never sees them, and a crash before the quiesced
+ *    txg syncs leaves them free on disk.  Blocks freed by the syncing
+ *    txg are deferred, so they can't be overwritten.
+ *
+ *  - The txg is handed to the sync thread only after all of its early
+ *    writes have been issued, so they never race with the walk of its
+ *    dirty records.  dbuf_sync_leaf() waits for any still in flight
+ *    (DR_IN_DMU_SYNC) and then simply uses the written block pointer
+ *    (DR_OVERRIDDEN); a failed early write is redone by the sync.
+ *
+ * Bonus and spill buffers, the dnode blocks themselves and all indirect
+ * blocks are still written by spa_sync().
+ */
+int zfs_txg_early_write = 0;
+
 hrtime_t zfs_throttle_delay = MSEC2NSEC(10);
 hrtime_t zfs_throttle_resolution = MSEC2NSEC(10);
 
@@ -175,10 +233,12 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 
 	dp->dp_sync_taskq = taskq_create("dp_sync_taskq",
 	    zfs_sync_taskq_batch_pct, minclsyspri, 1, INT_MAX,
-	    TASKQ_THREADS_CPU_PCT);
+	    TASKQ_THREADS_CPU_PCT | TASKQ_WORKSTEAL);
 
 	mutex_init(&dp->dp_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&dp->dp_spaceavail_cv, NULL, CV_DEFAULT, NULL);
+	dp->dp_throttle_start = gethrtime();
+	dp->dp_delay_scale = zfs_delay_scale;
 
 	dp->dp_vnrele_taskq = taskq_create("zfs_vn_rele_taskq", max_ncpus,
 		minclsyspri, max_ncpus * 8, INT_MAX,
@@ -449,6 +509,40 @@ dsl_pool_sync_mos(dsl_pool_t *dp, dmu_tx_t *tx)
 	spa_set_rootblkptr(dp->dp_spa, &dp->dp_meta_rootbp);
 }
 
+/*
+ * Account the time spent in the throttle state being left, when the
+ * amount of dirty data moves the pool into another one.
+ */
+static void
+dsl_pool_throttle_update(dsl_pool_t *dp)
+{
+	uint64_t delay_min_bytes =
+	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
+	dsl_pool_throttle_state_t state;
+	hrtime_t now;
+
+	ASSERT(MUTEX_HELD(&dp->dp_lock));
+
+	if (dp->dp_dirty_total > dp->dp_dirty_peak)
+		dp->dp_dirty_peak = dp->dp_dirty_total;
+
+	if (dp->dp_dirty_total >= zfs_dirty_data_max)
+		state = DP_THROTTLE_STALL;
+	else if (dp->dp_dirty_total > delay_min_bytes)
+		state = DP_THROTTLE_DELAY;
+	else
+		state = DP_THROTTLE_NONE;
+
+	if (state == dp->dp_throttle_state)
+		return;
+
+	now = gethrtime();
+	dp->dp_throttle_time[dp->dp_throttle_state] +=
+	    now - dp->dp_throttle_start;
+	dp->dp_throttle_state = state;
+	dp->dp_throttle_start = now;
+}
+
 static void
 dsl_pool_dirty_delta(dsl_pool_t *dp, int64_t delta)
 {
@@ -458,6 +552,7 @@ dsl_pool_dirty_delta(dsl_pool_t *dp, int64_t delta)
 		ASSERT3U(-delta, <=, dp->dp_dirty_total);
 
 	dp->dp_dirty_total += delta;
+	dsl_pool_throttle_update(dp);
 
 	/*
 	 * Note: we signal even when increasing dp_dirty_total.
@@ -476,6 +571,7 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	dsl_dataset_t *ds;
 	objset_t *mos = dp->dp_meta_objset;
 	list_t synced_datasets;
+	hrtime_t start, now;
 
 	list_create(&synced_datasets, sizeof (dsl_dataset_t),
 	    offsetof(dsl_dataset_t, ds_synced_link));
@@ -483,8 +579,13 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	tx = dmu_tx_create_assigned(dp, txg);
 
 	/*
-	 * Write out all dirty blocks of dirty datasets.
+	 * Write out all dirty blocks of dirty datasets.  The dnodes of each
+	 * objset are synced on dp_sync_taskq without waiting, so independent
+	 * datasets are synced concurrently; the zio_wait() below is what
+	 * waits for all of them.  Note, this could create a very large zio
+	 * tree.
 	 */
+	start = gethrtime();
 	zio = zio_root(dp->dp_spa, NULL, NULL, ZIO_FLAG_MUSTSUCCEED);
 	while ((ds = txg_list_remove(&dp->dp_dirty_datasets, txg)) != NULL) {
 		/*
@@ -497,6 +598,10 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 		dsl_dataset_sync(ds, zio, tx);
 	}
 	VERIFY0(zio_wait(zio));
+	now = gethrtime();
+	spa_txg_history_add_sync(dp->dp_spa, txg, TXG_SYNC_DATASETS,
+	    now - start);
+	start = now;
 
 	/*
 	 * We have written all of the accounted dirty data, so our
@@ -506,6 +611,7 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	 * Shore up the accounting of any dirtied space now.
 	 */
 	dsl_pool_undirty_space(dp, dp->dp_dirty_pertxg[txg & TXG_MASK], txg);
+	dp->dp_dirty_weight[txg & TXG_MASK] = 0;
 
 	/*
 	 * Update the long range free counter after
@@ -543,6 +649,10 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 		dsl_dataset_sync(ds, zio, tx);
 	}
 	VERIFY0(zio_wait(zio));
+	now = gethrtime();
+	spa_txg_history_add_sync(dp->dp_spa, txg, TXG_SYNC_USERQUOTA,
+	    now - start);
+	start = now;
 
 	/*
 	 * Now that the datasets have been completely synced, we can
@@ -558,6 +668,9 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	while ((dd = txg_list_remove(&dp->dp_dirty_dirs, txg)) != NULL) {
 		dsl_dir_sync(dd, tx);
 	}
+	now = gethrtime();
+	spa_txg_history_add_sync(dp->dp_spa, txg, TXG_SYNC_DIRS, now - start);
+	start = now;
 
 	/*
 	 * The MOS's space is accounted for in the pool/$MOS
@@ -578,6 +691,17 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	if (!multilist_is_empty(mos->os_dirty_dnodes[txg & TXG_MASK])) {
 		dsl_pool_sync_mos(dp, tx);
 	}
+	now = gethrtime();
+	spa_txg_history_add_sync(dp->dp_spa, txg, TXG_SYNC_MOS, now - start);
+	start = now;
+
+	/*
+	 * All of the sync_dnodes_task()s have completed, since their
+	 * parent zios have been waited on.
+	 */
+	spa_txg_history_add_sync(dp->dp_spa, txg, TXG_SYNC_DNODES,
+	    dp->dp_sync_dnodes_time);
+	dp->dp_sync_dnodes_time = 0;
 
 	/*
 	 * If we modify a dataset in the same txg that we want to destroy it,
@@ -597,6 +721,8 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 		ASSERT3U(spa_sync_pass(dp->dp_spa), ==, 1);
 		while ((dst = txg_list_remove(&dp->dp_sync_tasks, txg)) != NULL)
 			dsl_sync_task_sync(dst, tx);
+		spa_txg_history_add_sync(dp->dp_spa, txg, TXG_SYNC_TASKS,
+		    gethrtime() - start);
 	}
 
 	dmu_tx_commit(tx);
@@ -630,6 +756,116 @@ dsl_pool_sync_context(dsl_pool_t *dp)
 	    taskq_member(dp->dp_sync_taskq, curthread));
 }
 
+typedef struct dsl_early_write {
+	zgd_t		dew_zgd;	/* must be first */
+	blkptr_t	dew_bp;
+	list_node_t	dew_node;
+} dsl_early_write_t;
+
+static void
+dsl_pool_early_write_done(zgd_t *zgd, int error)
+{
+	dsl_early_write_t *dew = (dsl_early_write_t *)zgd;
+
+	dmu_buf_rele(zgd->zgd_db, dew);
+	kmem_free(dew, sizeof (dsl_early_write_t));
+}
+
+/*
+ * Hold the level-0 dbufs of a list of dirty records for the early write,
+ * descending into the children of indirect blocks.  The txg is quiesced,
+ * so the records can't change under us.
+ */
+static void
+dsl_pool_early_write_collect(list_t *records, list_t *dews)
+{
+	dbuf_dirty_record_t *dr;
+
+	for (dr = list_head(records); dr != NULL;
+	    dr = list_next(records, dr)) {
+		dmu_buf_impl_t *db = dr->dr_dbuf;
+		dsl_early_write_t *dew;
+
+		if (db->db_level > 0) {
+			mutex_enter(&dr->dt.di.dr_mtx);
+			dsl_pool_early_write_collect(&dr->dt.di.dr_children,
+			    dews);
+			mutex_exit(&dr->dt.di.dr_mtx);
+			continue;
+		}
+
+		if (db->db_blkid == DMU_BONUS_BLKID ||
+		    db->db_blkid == DMU_SPILL_BLKID ||
+		    dr->dt.dl.dr_override_state != DR_NOT_OVERRIDDEN)
+			continue;
+
+		/* the locks held here are also taken by reclaim */
+		dew = kmem_zalloc(sizeof (dsl_early_write_t), KM_NOSLEEP);
+		if (dew == NULL)
+			return;
+		dbuf_add_ref(db, dew);
+		dew->dew_zgd.zgd_db = &db->db;
+		dew->dew_zgd.zgd_bp = &dew->dew_bp;
+		list_insert_tail(dews, dew);
+	}
+}
+
+/*
+ * Issue the writes of the dirty data blocks of the quiesced txg, see
+ * zfs_txg_early_write.  Returns the number of bytes issued.
+ */
+uint64_t
+dsl_pool_early_write(dsl_pool_t *dp, uint64_t txg)
+{
+	int txgoff = txg & TXG_MASK;
+	dsl_early_write_t *dew;
+	dsl_dataset_t *ds;
+	uint64_t bytes = 0;
+	list_t dews;
+	zio_t *zio;
+
+	list_create(&dews, sizeof (dsl_early_write_t),
+	    offsetof(dsl_early_write_t, dew_node));
+
+	for (ds = txg_list_head(&dp->dp_dirty_datasets, txg); ds != NULL;
+	    ds = txg_list_next(&dp->dp_dirty_datasets, ds, txg)) {
+		multilist_t *ml = ds->ds_objset->os_dirty_dnodes[txgoff];
+
+		for (int i = 0; i < multilist_get_num_sublists(ml); i++) {
+			multilist_sublist_t *mls =
+			    multilist_sublist_lock(ml, i);
+			dnode_t *dn;
+
+			for (dn = multilist_sublist_head(mls); dn != NULL;
+			    dn = multilist_sublist_next(mls, dn)) {
+				if (DMU_OBJECT_IS_SPECIAL(dn->dn_object))
+					continue;
+				zfs_mutex_enter(&dn->dn_mtx, ZFS_LOCK_DNODE);
+				dsl_pool_early_write_collect(
+				    &dn->dn_dirty_records[txgoff], &dews);
+				mutex_exit(&dn->dn_mtx);
+			}
+			multilist_sublist_unlock(mls);
+		}
+	}
+
+	zio = zio_root(dp->dp_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	while ((dew = list_remove_head(&dews)) != NULL) {
+		uint64_t size = dew->dew_zgd.zgd_db->db_size;
+
+		if (dmu_write_early(zio, txg, dsl_pool_early_write_done,
+		    &dew->dew_zgd) == 0)
+			bytes += size;
+		else
+			dsl_pool_early_write_done(&dew->dew_zgd, 0);
+	}
+	zio_nowait(zio);
+
+	list_destroy(&dews);
+
+	return (bytes);
+}
+
 uint64_t
 dsl_pool_adjustedsize(dsl_pool_t *dp, boolean_t netfree)
 {
@@ -653,25 +889,154 @@ dsl_pool_need_dirty_delay(dsl_pool_t *dp)
 {
 	uint64_t delay_min_bytes =
 	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
-	boolean_t rv;
+	uint64_t dirty;
 
-	mutex_enter(&dp->dp_lock);
-	if (dp->dp_dirty_total > zfs_dirty_data_sync)
+	/*
+	 * This is checked for every tx, so don't take dp_lock: the total
+	 * lags the per-cpu slack anyway, and dmu_tx_wait() rechecks it
+	 * under the lock before sleeping.
+	 */
+	dirty = dp->dp_dirty_total;
+	if (dirty > zfs_dirty_data_sync)
 		txg_kick(dp);
-	rv = (dp->dp_dirty_total > delay_min_bytes);
+	return (dirty > delay_min_bytes);
+}
+
+/*
+ * The sum of the dirty_weight of the datasets with dirty data, taken as
+ * the largest of the unsynced txgs' sums.
+ */
+uint64_t
+dsl_pool_dirty_weight(dsl_pool_t *dp)
+{
+	uint64_t weight = 0;
+
+	for (int t = 0; t < TXG_SIZE; t++)
+		weight = MAX(weight, dp->dp_dirty_weight[t]);
+	return (weight);
+}
+
+/*
+ * The delay scale dmu_tx_delay() should use.
+ */
+uint64_t
+dsl_pool_delay_scale(dsl_pool_t *dp)
+{
+	if (zfs_delay_sync_target_ms == 0)
+		return (zfs_delay_scale);
+	return (dp->dp_delay_scale);
+}
+
+/*
+ * Called by the sync thread with the time spent in spa_sync() for the
+ * txg just synced; see zfs_delay_sync_target_ms.
+ */
+void
+dsl_pool_delay_adjust(dsl_pool_t *dp, hrtime_t sync_time)
+{
+	uint64_t target = MSEC2NSEC(zfs_delay_sync_target_ms);
+	uint64_t scale = dp->dp_delay_scale;
+	uint64_t lo, hi, want;
+
+	if (target == 0) {
+		dp->dp_delay_scale = zfs_delay_scale;
+		return;
+	}
+
+	/* keep zfs_delay_scale * zfs_dirty_data_max from overflowing */
+	lo = MAX(zfs_delay_scale >> 4, 1);
+	hi = MIN(zfs_delay_scale << 4,
+	    UINT64_MAX / MAX(zfs_dirty_data_max, 1));
+	scale = MIN(MAX(scale, lo), hi);
+
+	want = MIN(MAX(scale / target * sync_time +
+	    scale % target * sync_time / target, lo), hi);
+	if (want > scale)
+		scale += (want - scale + 3) / 4;
+	else
+		scale -= (scale - want) / 4;
+
+	dp->dp_delay_scale = scale;
+}
+
+void
+dsl_pool_throttle_stats(dsl_pool_t *dp, dsl_pool_throttle_stats_t *dpts)
+{
+	mutex_enter(&dp->dp_lock);
+	dpts->dpts_dirty = dp->dp_dirty_total;
+	dpts->dpts_dirty_peak = dp->dp_dirty_peak;
+	for (int i = 0; i < DP_THROTTLE_STATES; i++)
+		dpts->dpts_state_time[i] = dp->dp_throttle_time[i];
+	dpts->dpts_state_time[dp->dp_throttle_state] +=
+	    gethrtime() - dp->dp_throttle_start;
+	mutex_exit(&dp->dp_lock);
+
+	dpts->dpts_delay_scale = dsl_pool_delay_scale(dp);
+	dpts->dpts_delays = dp->dp_throttle_delays;
+	dpts->dpts_delay_time = dp->dp_throttle_delay_time;
+	dpts->dpts_stalls = dp->dp_throttle_stalls;
+	dpts->dpts_stall_time = dp->dp_throttle_stall_time;
+	dpts->dpts_passes = dp->dp_throttle_passes;
+}
+
+void
+dsl_pool_throttle_stats_reset(dsl_pool_t *dp)
+{
+	mutex_enter(&dp->dp_lock);
+	dp->dp_dirty_peak = dp->dp_dirty_total;
+	bzero(dp->dp_throttle_time, sizeof (dp->dp_throttle_time));
+	dp->dp_throttle_start = gethrtime();
+	mutex_exit(&dp->dp_lock);
+
+	dp->dp_throttle_delays = 0;
+	dp->dp_throttle_delay_time = 0;
+	dp->dp_throttle_stalls = 0;
+	dp->dp_throttle_stall_time = 0;
+	dp->dp_throttle_passes = 0;
+}
+
+void
+dsl_pool_dirty_fold(dsl_pool_t *dp, uint64_t space, uint64_t txg)
+{
+	if (space == 0)
+		return;
+
+	mutex_enter(&dp->dp_lock);
+	dp->dp_dirty_pertxg[txg & TXG_MASK] += space;
+	dsl_pool_dirty_delta(dp, space);
 	mutex_exit(&dp->dp_lock);
-	return (rv);
 }
 
 void
 dsl_pool_dirty_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx)
 {
-	if (space > 0) {
-		mutex_enter(&dp->dp_lock);
-		dp->dp_dirty_pertxg[tx->tx_txg & TXG_MASK] += space;
-		dsl_pool_dirty_delta(dp, space);
-		mutex_exit(&dp->dp_lock);
+	tx_cpu_t *tc = tx->tx_txgh.th_cpu;
+	int g = tx->tx_txg & TXG_MASK;
+	uint64_t slack;
+
+	if (space <= 0)
+		return;
+
+	/*
+	 * Syncing context transactions hold no tx_cpu, and account
+	 * their space directly.
+	 */
+	if (tc != NULL) {
+		slack = MIN(zfs_dirty_data_cpu_slack,
+		    zfs_dirty_data_max / (max_ncpus * 32));
+
+		mutex_enter(&tc->tc_lock);
+		tc->tc_dirty[g] += space;
+		if (tc->tc_dirty[g] > slack) {
+			space = tc->tc_dirty[g];
+			tc->tc_dirty[g] = 0;
+		} else {
+			space = 0;
+		}
+		mutex_exit(&tc->tc_lock);
 	}
+
+	dsl_pool_dirty_fold(dp, space, tx->tx_txg);
 }
 
 void
@@ -851,7 +1216,7 @@ dsl_pool_create_origin(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	/* create the origin dir, ds, & snap-ds */
 	dsobj = dsl_dataset_create_sync(dp->dp_root_dir, ORIGIN_DIR_NAME,
-	    NULL, 0, kcred, tx);
+	    NULL, 0, kcred, NULL, tx);
 	VERIFY0(dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
 	dsl_dataset_snapshot_sync_impl(ds, ORIGIN_DIR_NAME, tx);
 	VERIFY0(dsl_dataset_hold_obj(dp, dsl_dataset_phys(ds)->ds_prev_snap_obj,
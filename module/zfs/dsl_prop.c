@@ -536,6 +536,20 @@ dsl_prop_notify_all(dsl_dir_t *dd)
 	    NULL, DS_FIND_CHILDREN);
 }
 
+typedef struct dsl_prop_notify_node {
+	list_node_t	dpn_node;
+	uint64_t	dpn_ddobj;
+} dsl_prop_notify_node_t;
+
+/*
+ * Tell the callbacks of ddobj, and of the descendants that inherit
+ * propname from it, about the new value.  Unless first is set, ddobj
+ * itself is skipped if the property is set there.  The tree is walked
+ * breadth first from a queue rather than by recursion, which took a
+ * kernel stack frame and a zap cursor per level.  The child directories
+ * are also prefetched as they are queued, so that on a big tree their
+ * dnodes are read in parallel instead of one at a time as each is held.
+ */
 static void
 dsl_prop_changed_notify(dsl_pool_t *dp, uint64_t ddobj,
     const char *propname, uint64_t value, int first)
@@ -546,69 +560,94 @@ dsl_prop_changed_notify(dsl_pool_t *dp, uint64_t ddobj,
 	objset_t *mos = dp->dp_meta_objset;
 	zap_cursor_t zc;
 	zap_attribute_t *za;
+	dsl_prop_notify_node_t *dpn;
+	list_t queue;
 	int err;
 
 	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
-	err = dsl_dir_hold_obj(dp, ddobj, NULL, FTAG, &dd);
-	if (err)
-		return;
 
-	if (!first) {
-		/*
-		 * If the prop is set here, then this change is not
-		 * being inherited here or below; stop the recursion.
-		 */
-		err = zap_contains(mos, dsl_dir_phys(dd)->dd_props_zapobj,
-		    propname);
-		if (err == 0) {
-			dsl_dir_rele(dd, FTAG);
-			return;
-		}
-		ASSERT3U(err, ==, ENOENT);
-	}
+	list_create(&queue, sizeof (dsl_prop_notify_node_t),
+	    offsetof(dsl_prop_notify_node_t, dpn_node));
+	dpn = kmem_alloc(sizeof (dsl_prop_notify_node_t), KM_SLEEP);
+	dpn->dpn_ddobj = ddobj;
+	list_insert_tail(&queue, dpn);
 
-	mutex_enter(&dd->dd_lock);
-	pr = dsl_prop_record_find(dd, propname);
-	if (pr != NULL) {
-		for (cbr = list_head(&pr->pr_cbs); cbr;
-		    cbr = list_next(&pr->pr_cbs, cbr)) {
-			uint64_t propobj;
+	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+	while ((dpn = list_remove_head(&queue)) != NULL) {
+		ddobj = dpn->dpn_ddobj;
+		kmem_free(dpn, sizeof (dsl_prop_notify_node_t));
+
+		err = dsl_dir_hold_obj(dp, ddobj, NULL, FTAG, &dd);
+		if (err)
+			goto next;
 
+		if (!first) {
 			/*
-			 * cbr->cbr_ds may be invalidated due to eviction,
-			 * requiring the use of dsl_dataset_try_add_ref().
-			 * See comment block in dsl_prop_notify_all_cb()
-			 * for details.
+			 * If the prop is set here, then this change is not
+			 * being inherited here or below; stop the descent.
 			 */
-			if (!dsl_dataset_try_add_ref(dp, cbr->cbr_ds, FTAG))
-				continue;
+			err = zap_contains(mos,
+			    dsl_dir_phys(dd)->dd_props_zapobj, propname);
+			if (err == 0) {
+				dsl_dir_rele(dd, FTAG);
+				goto next;
+			}
+			ASSERT3U(err, ==, ENOENT);
+		}
 
-			propobj = dsl_dataset_phys(cbr->cbr_ds)->ds_props_obj;
+		mutex_enter(&dd->dd_lock);
+		pr = dsl_prop_record_find(dd, propname);
+		if (pr != NULL) {
+			for (cbr = list_head(&pr->pr_cbs); cbr;
+			    cbr = list_next(&pr->pr_cbs, cbr)) {
+				uint64_t propobj;
+
+				/*
+				 * cbr->cbr_ds may be invalidated due to
+				 * eviction, requiring the use of
+				 * dsl_dataset_try_add_ref().  See comment
+				 * block in dsl_prop_notify_all_cb() for
+				 * details.
+				 */
+				if (!dsl_dataset_try_add_ref(dp, cbr->cbr_ds,
+				    FTAG))
+					continue;
 
-			/*
-			 * If the property is not set on this ds, then it is
-			 * inherited here; call the callback.
-			 */
-			if (propobj == 0 ||
-			    zap_contains(mos, propobj, propname) != 0)
-				cbr->cbr_func(cbr->cbr_arg, value);
+				propobj = dsl_dataset_phys(
+				    cbr->cbr_ds)->ds_props_obj;
 
-			dsl_dataset_rele(cbr->cbr_ds, FTAG);
-		}
-	}
-	mutex_exit(&dd->dd_lock);
+				/*
+				 * If the property is not set on this ds,
+				 * then it is inherited here; call the
+				 * callback.
+				 */
+				if (propobj == 0 ||
+				    zap_contains(mos, propobj, propname) != 0)
+					cbr->cbr_func(cbr->cbr_arg, value);
 
-	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
-	for (zap_cursor_init(&zc, mos,
-	    dsl_dir_phys(dd)->dd_child_dir_zapobj);
-	    zap_cursor_retrieve(&zc, za) == 0;
-	    zap_cursor_advance(&zc)) {
-		dsl_prop_changed_notify(dp, za->za_first_integer,
-		    propname, value, FALSE);
+				dsl_dataset_rele(cbr->cbr_ds, FTAG);
+			}
+		}
+		mutex_exit(&dd->dd_lock);
+
+		for (zap_cursor_init(&zc, mos,
+		    dsl_dir_phys(dd)->dd_child_dir_zapobj);
+		    zap_cursor_retrieve(&zc, za) == 0;
+		    zap_cursor_advance(&zc)) {
+			dmu_prefetch(mos, za->za_first_integer, 0, 0, 0,
+			    ZIO_PRIORITY_SYNC_READ);
+			dpn = kmem_alloc(sizeof (dsl_prop_notify_node_t),
+			    KM_SLEEP);
+			dpn->dpn_ddobj = za->za_first_integer;
+			list_insert_tail(&queue, dpn);
+		}
+		zap_cursor_fini(&zc);
+		dsl_dir_rele(dd, FTAG);
+next:
+		first = FALSE;
 	}
 	kmem_free(za, sizeof (zap_attribute_t));
-	zap_cursor_fini(&zc);
-	dsl_dir_rele(dd, FTAG);
+	list_destroy(&queue);
 }
 
 void
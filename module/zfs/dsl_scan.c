@@ -36,6 +36,7 @@
 #include <sys/arc.h>
 #include <sys/zap.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zfs_context.h>
 #include <sys/fs/zfs.h>
 #include <sys/zfs_znode.h>
@@ -43,6 +44,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/zil_impl.h>
 #include <sys/zio_checksum.h>
+#include <sys/range_tree.h>
 #include <sys/ddt.h>
 #include <sys/sa.h>
 #include <sys/sa_impl.h>
@@ -50,6 +52,7 @@
 #ifdef _KERNEL
 #include <sys/zfs_vfsops.h>
 #endif
+#include "zfs_prop.h"
 
 typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *,
     const zbookmark_phys_t *);
@@ -57,12 +60,16 @@ typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *,
 static scan_cb_t dsl_scan_scrub_cb;
 static void dsl_scan_cancel_sync(void *, dmu_tx_t *);
 static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *);
+static void dsl_scan_path_load(dsl_scan_t *);
 static boolean_t dsl_scan_restarting(dsl_scan_t *, dmu_tx_t *);
+static void dsl_scan_queues_destroy(dsl_scan_t *);
+static void dsl_scan_issue(dsl_scan_t *, boolean_t);
 
 int zfs_top_maxinflight = 32;		/* maximum I/Os per top-level */
-int zfs_resilver_delay = 2;		/* number of ticks to delay resilver */
-int zfs_scrub_delay = 4;		/* number of ticks to delay scrub */
+int zfs_resilver_delay = 2;		/* max ticks to delay resilver I/O */
+int zfs_scrub_delay = 4;		/* max ticks to delay scrub I/O */
 int zfs_scan_idle = 50;			/* idle window in clock ticks */
+int zfs_scan_fg_latency_pct = 150;	/* sync read slowdown to back off at */
 
 int zfs_scan_min_time_ms = 1000; /* min millisecs to scrub per txg */
 int zfs_free_min_time_ms = 1000; /* min millisecs to free per txg */
@@ -73,6 +80,59 @@ enum ddt_class zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 int dsl_scan_delay_completion = B_FALSE; /* set to delay scan completion */
 /* max number of blocks to free in a single TXG */
 uint64_t zfs_free_max_blocks = 100000;
+/*
+ * The per-txg block limit starts at zfs_free_max_blocks and is doubled,
+ * up to zfs_free_max_blocks_limit, each txg that reaches it well within
+ * zfs_free_min_time_ms; it is halved again when freeing runs out of time.
+ */
+uint64_t zfs_free_max_blocks_limit = 1600000;
+int zfs_free_async = B_TRUE; /* issue background frees from the taskqs */
+
+/*
+ * Scrub and resilver I/O is not issued in the order the blocks are found
+ * by the traversal, which is logical (per object) order and so mostly
+ * random on disk.  Instead it is queued per top-level vdev, sorted by
+ * offset, and issued in offset order once the queues fill up or the
+ * traversal reaches a point it can be resumed from (see dsl_scan_sync()).
+ */
+int zfs_scan_legacy = B_FALSE; /* set to issue scan i/o unsorted */
+int zfs_scan_mem_lim_fact = 20; /* queues use up to 1/fact of memory */
+uint64_t zfs_scan_max_ext_gap = 2 << 20; /* max gap in an extent */
+
+/*
+ * A resilver takes the datasets whose resilver_priority property is on
+ * from the scan queue before any others, so that the data they hold gets
+ * its redundancy back first (see dsl_scan_priority_next()).
+ */
+int zfs_resilver_priority = B_TRUE;
+
+/*
+ * A queued scrub/resilver read, sorted on the offset of its first DVA.
+ */
+typedef struct scan_io {
+	avl_node_t		sio_node;	/* q_sios_by_addr */
+	list_node_t		sio_list_node;	/* while being issued */
+	blkptr_t		sio_bp;
+	zbookmark_phys_t	sio_zb;
+	uint64_t		sio_offset;
+	uint64_t		sio_asize;
+	int			sio_flags;
+} scan_io_t;
+
+/*
+ * The scan I/O queue of a top-level vdev.  q_exts_by_addr holds the
+ * ranges of the vdev covered by queued I/O, with gaps of up to
+ * zfs_scan_max_ext_gap filled in, so that each segment is an extent that
+ * can be read in one sweep.
+ */
+struct dsl_scan_io_queue {
+	dsl_scan_t	*q_scn;
+	vdev_t		*q_vd;
+	kmutex_t	q_lock;		/* protects the two trees */
+	avl_tree_t	q_sios_by_addr;
+	range_tree_t	*q_exts_by_addr;
+	uint64_t	q_last_ext_addr; /* end of the last issued extent */
+};
 
 #define	DSL_SCAN_IS_SCRUB_RESILVER(scn) \
 	((scn)->scn_phys.scn_func == POOL_SCAN_SCRUB || \
@@ -99,6 +159,7 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 	uint64_t f;
 
 	scn = dp->dp_scan = kmem_zalloc(sizeof (dsl_scan_t), KM_SLEEP);
+	scn->scn_free_max_blocks = zfs_free_max_blocks;
 	scn->scn_dp = dp;
 
 	/*
@@ -190,6 +251,8 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 		}
 	}
 
+	bcopy(&scn->scn_phys, &scn->scn_phys_cached, sizeof (scn->scn_phys));
+	dsl_scan_path_load(scn);
 	spa_scan_stat_init(spa);
 	return (0);
 }
@@ -198,28 +261,110 @@ void
 dsl_scan_fini(dsl_pool_t *dp)
 {
 	if (dp->dp_scan) {
+		dsl_scan_queues_destroy(dp->dp_scan);
 		kmem_free(dp->dp_scan, sizeof (dsl_scan_t));
 		dp->dp_scan = NULL;
 	}
 }
 
 /* ARGSUSED */
+/*
+ * What a scan is to cover.  A scrub may be restricted to the blocks born
+ * in a txg range and to a set of datasets, in which case it doesn't clear
+ * any DTLs when it is done, since it hasn't seen every block.
+ */
+typedef struct dsl_scan_setup_arg {
+	pool_scan_func_t dssa_func;
+	uint64_t	dssa_min_txg;	/* first birth txg scanned, or 0 */
+	uint64_t	dssa_max_txg;	/* last birth txg scanned, or 0 */
+	nvlist_t	*dssa_datasets;	/* names scanned, NULL for all */
+} dsl_scan_setup_arg_t;
+
 static int
 dsl_scan_setup_check(void *arg, dmu_tx_t *tx)
 {
-	dsl_scan_t *scn = dmu_tx_pool(tx)->dp_scan;
+	dsl_scan_setup_arg_t *dssa = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	dsl_scan_t *scn = dp->dp_scan;
+	nvpair_t *pair;
 
 	if (scn->scn_phys.scn_state == DSS_SCANNING)
 		return (SET_ERROR(EBUSY));
 
+	if (dssa->dssa_max_txg != 0 && dssa->dssa_min_txg > dssa->dssa_max_txg)
+		return (SET_ERROR(EINVAL));
+
+	if (dssa->dssa_datasets == NULL)
+		return (0);
+
+	for (pair = nvlist_next_nvpair(dssa->dssa_datasets, NULL);
+	    pair != NULL;
+	    pair = nvlist_next_nvpair(dssa->dssa_datasets, pair)) {
+		dsl_dataset_t *ds;
+		int error;
+
+		error = dsl_dataset_hold(dp, nvpair_name(pair), FTAG, &ds);
+		if (error != 0)
+			return (error);
+		if (ds->ds_is_snapshot)
+			error = SET_ERROR(EINVAL);
+		dsl_dataset_rele(ds, FTAG);
+		if (error != 0)
+			return (error);
+	}
+
 	return (0);
 }
 
+/*
+ * Queue the oldest snapshot of each dataset of a restricted scrub.  The
+ * traversal carries on from there through the later snapshots up to the
+ * head, but doesn't follow clones, see dsl_scan_visitds().
+ */
+static void
+dsl_scan_enqueue_datasets(dsl_scan_t *scn, nvlist_t *datasets, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	nvpair_t *pair;
+
+	for (pair = nvlist_next_nvpair(datasets, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(datasets, pair)) {
+		dsl_dataset_t *ds, *prev;
+		int error;
+
+		VERIFY0(dsl_dataset_hold(dp, nvpair_name(pair), FTAG, &ds));
+		while (dsl_dataset_phys(ds)->ds_prev_snap_obj != 0) {
+			VERIFY0(dsl_dataset_hold_obj(dp,
+			    dsl_dataset_phys(ds)->ds_prev_snap_obj, FTAG,
+			    &prev));
+			if (prev->ds_dir->dd_object != ds->ds_dir->dd_object) {
+				/* the origin of a clone */
+				dsl_dataset_rele(prev, FTAG);
+				break;
+			}
+			dsl_dataset_rele(ds, FTAG);
+			ds = prev;
+		}
+
+		/*
+		 * Start from the scan's own minimum rather than from the
+		 * creation of the origin of a clone, which dsl_scan_visit()
+		 * would use for 0, since the origin itself isn't visited.
+		 */
+		error = zap_add_int_key(dp->dp_meta_objset,
+		    scn->scn_phys.scn_queue_obj, ds->ds_object,
+		    MAX(scn->scn_phys.scn_min_txg, 1), tx);
+		VERIFY(error == 0 || error == EEXIST);
+		dsl_dataset_rele(ds, FTAG);
+	}
+}
+
 static void
 dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 {
 	dsl_scan_t *scn = dmu_tx_pool(tx)->dp_scan;
-	pool_scan_func_t *funcp = arg;
+	dsl_scan_setup_arg_t *dssa = arg;
+	pool_scan_func_t *funcp = &dssa->dssa_func;
 	dmu_object_type_t ot = 0;
 	dsl_pool_t *dp = scn->scn_dp;
 	spa_t *spa = dp->dp_spa;
@@ -237,6 +382,10 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 	scn->scn_phys.scn_to_examine = spa->spa_root_vdev->vdev_stat.vs_alloc;
 	scn->scn_restart_txg = 0;
 	scn->scn_done_txg = 0;
+	scn->scn_traversal_done = B_FALSE;
+	scn->scn_checkpoint = B_FALSE;
+	scn->scn_priority_done = B_FALSE;
+	ASSERT0(scn->scn_queues_mem);
 	spa_scan_stat_init(spa);
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
@@ -247,11 +396,36 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 
 		if (vdev_resilver_needed(spa->spa_root_vdev,
 		    &scn->scn_phys.scn_min_txg, &scn->scn_phys.scn_max_txg)) {
+			/* a resilver has to see every block it may repair */
 			spa_event_notify(spa, NULL,
 			    FM_EREPORT_ZFS_RESILVER_START);
 		} else {
 			spa_event_notify(spa, NULL,
 			    FM_EREPORT_ZFS_SCRUB_START);
+
+			if (dssa->dssa_min_txg != 0 ||
+			    dssa->dssa_max_txg != 0) {
+				scn->scn_phys.scn_flags |= DSF_TXG_RANGE;
+				if (dssa->dssa_min_txg != 0) {
+					scn->scn_phys.scn_min_txg =
+					    dssa->dssa_min_txg - 1;
+				}
+				if (dssa->dssa_max_txg != 0) {
+					scn->scn_phys.scn_max_txg = MIN(
+					    dssa->dssa_max_txg + 1, tx->tx_txg);
+				}
+			}
+
+			/*
+			 * The DDT phase is skipped, as its entries don't
+			 * tell which datasets refer to them; their blocks
+			 * are scrubbed as the traversal comes across them.
+			 */
+			if (dssa->dssa_datasets != NULL) {
+				scn->scn_phys.scn_flags |= DSF_DATASETS;
+				scn->scn_phys.scn_ddt_bookmark.ddb_class =
+				    DDT_CLASSES;
+			}
 		}
 
 		spa->spa_scrub_started = B_TRUE;
@@ -279,11 +453,15 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 	scn->scn_phys.scn_queue_obj = zap_create(dp->dp_meta_objset,
 	    ot ? ot : DMU_OT_SCAN_QUEUE, DMU_OT_NONE, 0, tx);
 
+	if (scn->scn_phys.scn_flags & DSF_DATASETS)
+		dsl_scan_enqueue_datasets(scn, dssa->dssa_datasets, tx);
+
 	dsl_scan_sync_state(scn, tx);
 
 	spa_history_log_internal(spa, "scan setup", tx,
-	    "func=%u mintxg=%llu maxtxg=%llu",
-	    *funcp, scn->scn_phys.scn_min_txg, scn->scn_phys.scn_max_txg);
+	    "func=%u mintxg=%llu maxtxg=%llu flags=%llu",
+	    *funcp, scn->scn_phys.scn_min_txg, scn->scn_phys.scn_max_txg,
+	    scn->scn_phys.scn_flags);
 }
 
 /* ARGSUSED */
@@ -306,6 +484,11 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 	spa_t *spa = dp->dp_spa;
 	int i;
 
+	/* Whatever is still queued will not be needed any more. */
+	dsl_scan_queues_destroy(scn);
+	scn->scn_traversal_done = B_FALSE;
+	scn->scn_checkpoint = B_FALSE;
+
 	/* Remove any remnants of an old-style scrub. */
 	for (i = 0; old_names[i]; i++) {
 		(void) zap_remove(dp->dp_meta_objset,
@@ -318,6 +501,12 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		scn->scn_phys.scn_queue_obj = 0;
 	}
 
+	(void) zap_remove(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCAN_PATH, tx);
+	scn->scn_path_ondisk = B_FALSE;
+	scn->scn_path_resume = B_FALSE;
+	scn->scn_pause_depth = 0;
+
 	/*
 	 * If we were "restarted" from a stopped state, don't bother
 	 * with anything else.
@@ -355,10 +544,15 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		 * reflect this.  Whether it succeeded or not, vacate
 		 * all temporary scrub DTLs.
 		 */
+		boolean_t restricted = (scn->scn_phys.scn_flags &
+		    (DSF_TXG_RANGE | DSF_DATASETS)) != 0;
+
 		vdev_dtl_reassess(spa->spa_root_vdev, tx->tx_txg,
-		    complete ? scn->scn_phys.scn_max_txg : 0, B_TRUE);
+		    complete && !restricted ? scn->scn_phys.scn_max_txg : 0,
+		    B_TRUE);
 		if (complete) {
-			spa_event_notify(spa, NULL, scn->scn_phys.scn_min_txg ?
+			spa_event_notify(spa, NULL,
+			    scn->scn_phys.scn_min_txg != 0 && !restricted ?
 			    FM_EREPORT_ZFS_RESILVER_FINISH :
 			    FM_EREPORT_ZFS_SCRUB_FINISH);
 		}
@@ -453,24 +647,204 @@ dsl_scan_ds_maxtxg(dsl_dataset_t *ds)
 	return (smt);
 }
 
+/*
+ * The path to the bookmark is kept in the MOS directory as an array of
+ * integers: the bookmark it leads to, followed by the block pointers from
+ * the root of the objset down.
+ */
+#define	SCAN_PATH_BM_INTS	(sizeof (zbookmark_phys_t) / sizeof (uint64_t))
+#define	SCAN_PATH_BP_INTS	(sizeof (blkptr_t) / sizeof (uint64_t))
+
+/*
+ * Write out the path to the bookmark along with the scan state it belongs
+ * to, or remove it once the traversal is no longer resuming anywhere.
+ */
+static void
+dsl_scan_path_sync(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	uint64_t *path;
+	uint64_t n;
+
+	if (ZB_IS_ZERO(&scn->scn_phys.scn_bookmark) ||
+	    scn->scn_pause_depth == 0) {
+		if (scn->scn_path_ondisk) {
+			(void) zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+			    DMU_POOL_SCAN_PATH, tx);
+			scn->scn_path_ondisk = B_FALSE;
+		}
+		return;
+	}
+
+	if (!scn->scn_path_dirty)
+		return;
+
+	n = SCAN_PATH_BM_INTS + scn->scn_pause_depth * SCAN_PATH_BP_INTS;
+	path = kmem_alloc(n * sizeof (uint64_t), KM_SLEEP);
+	bcopy(&scn->scn_phys.scn_bookmark, path, sizeof (zbookmark_phys_t));
+	bcopy(scn->scn_pause_path, &path[SCAN_PATH_BM_INTS],
+	    scn->scn_pause_depth * sizeof (blkptr_t));
+	VERIFY0(zap_update(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCAN_PATH, sizeof (uint64_t), n, path, tx));
+	kmem_free(path, n * sizeof (uint64_t));
+
+	scn->scn_path_dirty = B_FALSE;
+	scn->scn_path_ondisk = B_TRUE;
+}
+
+/*
+ * Load the path to the scan bookmark written by dsl_scan_path_sync(), if
+ * it still leads to the bookmark the scan resumes from.
+ */
+static void
+dsl_scan_path_load(dsl_scan_t *scn)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	uint64_t *path;
+	uint64_t intsz, n;
+	int depth;
+
+	scn->scn_pause_depth = 0;
+	scn->scn_path_resume = B_FALSE;
+	scn->scn_path_ondisk = B_FALSE;
+
+	if (zap_length(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_PATH,
+	    &intsz, &n) != 0)
+		return;
+	scn->scn_path_ondisk = B_TRUE;
+
+	if (intsz != sizeof (uint64_t) || n <= SCAN_PATH_BM_INTS ||
+	    (n - SCAN_PATH_BM_INTS) % SCAN_PATH_BP_INTS != 0 ||
+	    (n - SCAN_PATH_BM_INTS) / SCAN_PATH_BP_INTS > DSL_SCAN_PATH_MAX)
+		return;
+	depth = (n - SCAN_PATH_BM_INTS) / SCAN_PATH_BP_INTS;
+
+	path = kmem_alloc(n * sizeof (uint64_t), KM_SLEEP);
+	if (zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_PATH,
+	    sizeof (uint64_t), n, path) == 0 &&
+	    scn->scn_phys.scn_state == DSS_SCANNING &&
+	    !ZB_IS_ZERO(&scn->scn_phys.scn_bookmark) &&
+	    bcmp(path, &scn->scn_phys.scn_bookmark,
+	    sizeof (zbookmark_phys_t)) == 0) {
+		bcopy(&path[SCAN_PATH_BM_INTS], scn->scn_pause_path,
+		    depth * sizeof (blkptr_t));
+		scn->scn_pause_depth = depth;
+		scn->scn_path_resume = B_TRUE;
+	}
+	kmem_free(path, n * sizeof (uint64_t));
+}
+
+/*
+ * Read the blocks on the path to the bookmark the scan is resuming from
+ * all at once, so that the traversal finds them in the ARC on its way
+ * back down instead of waiting for each level in turn.  The dataset may
+ * have changed since the path was written, so the reads are speculative.
+ */
+static void
+dsl_scan_path_prefetch(dsl_scan_t *scn)
+{
+	zbookmark_phys_t *zb = &scn->scn_phys.scn_bookmark;
+	int i;
+
+	scn->scn_path_resume = B_FALSE;
+
+	if (zfs_no_scrub_prefetch || ZB_IS_ZERO(zb))
+		return;
+
+	for (i = 0; i < scn->scn_pause_depth; i++) {
+		blkptr_t *bp = &scn->scn_pause_path[i];
+		arc_flags_t flags = ARC_FLAG_NOWAIT | ARC_FLAG_PREFETCH;
+		zbookmark_phys_t czb;
+
+		if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp) ||
+		    bp->blk_birth <= scn->scn_phys.scn_min_txg)
+			continue;
+
+		if (BP_GET_TYPE(bp) == DMU_OT_OBJSET) {
+			SET_BOOKMARK(&czb, zb->zb_objset, ZB_ROOT_OBJECT,
+			    ZB_ROOT_LEVEL, ZB_ROOT_BLKID);
+		} else {
+			SET_BOOKMARK(&czb, zb->zb_objset,
+			    BP_GET_TYPE(bp) == DMU_OT_DNODE ?
+			    DMU_META_DNODE_OBJECT : zb->zb_object,
+			    BP_GET_LEVEL(bp), 0);
+		}
+		(void) arc_read(scn->scn_zio_root, scn->scn_dp->dp_spa, bp,
+		    NULL, NULL, ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL |
+		    ZIO_FLAG_SPECULATIVE | ZIO_FLAG_SCAN_THREAD, &flags, &czb);
+	}
+}
+
+/*
+ * Write out the scan state.  While scan I/O is queued, the traversal is
+ * ahead of what has been read, so the on-disk state is left at the last
+ * point everything before which has been issued, and an import resumes
+ * from there.
+ */
 static void
 dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx)
 {
+	if (scn->scn_queues_mem == 0) {
+		bcopy(&scn->scn_phys, &scn->scn_phys_cached,
+		    sizeof (scn->scn_phys));
+		dsl_scan_path_sync(scn, tx);
+	}
 	VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
 	    DMU_POOL_DIRECTORY_OBJECT,
 	    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
-	    &scn->scn_phys, tx));
+	    &scn->scn_phys_cached, tx));
+}
+
+static uint64_t
+dsl_scan_mem_limit(void)
+{
+	return (MAX((uint64_t)physmem * PAGESIZE /
+	    MAX(zfs_scan_mem_lim_fact, 1), SPA_MAXBLOCKSIZE));
+}
+
+static boolean_t
+dsl_scan_queues_full(dsl_scan_t *scn)
+{
+	return (scn->scn_queues_mem >= dsl_scan_mem_limit());
 }
 
 extern int zfs_vdev_async_write_active_min_dirty_percent;
 
+/*
+ * We have done enough scan work in this txg if:
+ *  - we have scanned for the maximum time: an entire txg
+ *    timeout (default 5 sec)
+ *  or
+ *  - we have scanned for at least the minimum time (default 1 sec
+ *    for scrub, 3 sec for resilver), and either we have sufficient
+ *    dirty data that we are starting to write more quickly
+ *    (default 30%), or someone is explicitly waiting for this txg
+ *    to complete.
+ *  or
+ *  - the spa is shutting down because this pool is being exported
+ *    or the machine is rebooting.
+ */
 static boolean_t
-dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+dsl_scan_txg_exceeded(dsl_scan_t *scn)
 {
 	uint64_t elapsed_nanosecs;
 	int mintime;
 	int dirty_pct;
 
+	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
+	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
+	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
+	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
+	return (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
+	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
+	    (txg_sync_waiting(scn->scn_dp) ||
+	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
+	    spa_shutting_down(scn->scn_dp->dp_spa));
+}
+
+static boolean_t
+dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+{
 	/* we never skip user/group accounting objects */
 	if (zb && (int64_t)zb->zb_object < 0)
 		return (B_FALSE);
@@ -486,28 +860,10 @@ dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 		return (B_FALSE);
 
 	/*
-	 * We pause if:
-	 *  - we have scanned for the maximum time: an entire txg
-	 *    timeout (default 5 sec)
-	 *  or
-	 *  - we have scanned for at least the minimum time (default 1 sec
-	 *    for scrub, 3 sec for resilver), and either we have sufficient
-	 *    dirty data that we are starting to write more quickly
-	 *    (default 30%), or someone is explicitly waiting for this txg
-	 *    to complete.
-	 *  or
-	 *  - the spa is shutting down because this pool is being exported
-	 *    or the machine is rebooting.
+	 * We pause if we have done enough work in this txg, or if the
+	 * scan I/O queues have filled up and must be issued first.
 	 */
-	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
-	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
-	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
-	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
-	if (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
-	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
-	    (txg_sync_waiting(scn->scn_dp) ||
-	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
-	    spa_shutting_down(scn->scn_dp->dp_spa)) {
+	if (dsl_scan_txg_exceeded(scn) || dsl_scan_queues_full(scn)) {
 		if (zb) {
 			dprintf("pausing at bookmark %llx/%llx/%llx/%llx\n",
 			    (longlong_t)zb->zb_objset,
@@ -515,6 +871,11 @@ dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 			    (longlong_t)zb->zb_level,
 			    (longlong_t)zb->zb_blkid);
 			scn->scn_phys.scn_bookmark = *zb;
+			scn->scn_pause_depth = MIN(scn->scn_path_depth,
+			    DSL_SCAN_PATH_MAX);
+			bcopy(scn->scn_path, scn->scn_pause_path,
+			    scn->scn_pause_depth * sizeof (blkptr_t));
+			scn->scn_path_dirty = B_TRUE;
 		}
 		dprintf("pausing at DDT bookmark %llx/%llx/%llx/%llx\n",
 		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_class,
@@ -617,10 +978,14 @@ dsl_scan_zil(dsl_pool_t *dp, zil_header_t *zh)
 	zil_free(zilog);
 }
 
+/*
+ * Prefetch a child block of one being traversed.  While resuming, the
+ * children the scan already covered before it paused are left alone.
+ */
 /* ARGSUSED */
 static void
-dsl_scan_prefetch(dsl_scan_t *scn, arc_buf_t *buf, blkptr_t *bp,
-    uint64_t objset, uint64_t object, uint64_t blkid)
+dsl_scan_prefetch(dsl_scan_t *scn, arc_buf_t *buf, const dnode_phys_t *dnp,
+    blkptr_t *bp, uint64_t objset, uint64_t object, uint64_t blkid)
 {
 	zbookmark_phys_t czb;
 	arc_flags_t flags = ARC_FLAG_NOWAIT | ARC_FLAG_PREFETCH;
@@ -634,6 +999,11 @@ dsl_scan_prefetch(dsl_scan_t *scn, arc_buf_t *buf, blkptr_t *bp,
 
 	SET_BOOKMARK(&czb, objset, object, BP_GET_LEVEL(bp), blkid);
 
+	if (!ZB_IS_ZERO(&scn->scn_phys.scn_bookmark) &&
+	    (int64_t)object >= 0 && zbookmark_subtree_completed(dnp, &czb,
+	    &scn->scn_phys.scn_bookmark))
+		return;
+
 	(void) arc_read(scn->scn_zio_root, scn->scn_dp->dp_spa, bp,
 	    NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
 	    ZIO_FLAG_CANFAIL | ZIO_FLAG_SCAN_THREAD, &flags, &czb);
@@ -702,7 +1072,7 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 			return (err);
 		}
 		for (i = 0, cbp = buf->b_data; i < epb; i++, cbp++) {
-			dsl_scan_prefetch(scn, buf, cbp, zb->zb_objset,
+			dsl_scan_prefetch(scn, buf, dnp, cbp, zb->zb_objset,
 			    zb->zb_object, zb->zb_blkid * epb + i);
 		}
 		for (i = 0, cbp = buf->b_data; i < epb; i++, cbp++) {
@@ -728,14 +1098,18 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 			scn->scn_phys.scn_errors++;
 			return (err);
 		}
-		for (i = 0, cdnp = buf->b_data; i < epb; i++, cdnp++) {
+		for (i = 0, cdnp = buf->b_data; i < epb;
+		    i += cdnp->dn_extra_slots + 1,
+		    cdnp += cdnp->dn_extra_slots + 1) {
 			for (j = 0; j < cdnp->dn_nblkptr; j++) {
 				blkptr_t *cbp = &cdnp->dn_blkptr[j];
-				dsl_scan_prefetch(scn, buf, cbp,
+				dsl_scan_prefetch(scn, buf, cdnp, cbp,
 				    zb->zb_objset, zb->zb_blkid * epb + i, j);
 			}
 		}
-		for (i = 0, cdnp = buf->b_data; i < epb; i++, cdnp++) {
+		for (i = 0, cdnp = buf->b_data; i < epb;
+		    i += cdnp->dn_extra_slots + 1,
+		    cdnp += cdnp->dn_extra_slots + 1) {
 			dsl_scan_visitdnode(scn, ds, ostype,
 			    cdnp, zb->zb_blkid * epb + i, tx);
 		}
@@ -798,7 +1172,7 @@ dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
 		zbookmark_phys_t czb;
 		SET_BOOKMARK(&czb, ds ? ds->ds_object : 0, object,
 		    0, DMU_SPILL_BLKID);
-		dsl_scan_visitbp(&dnp->dn_spill,
+		dsl_scan_visitbp(DN_SPILL_BLKPTR(dnp),
 		    &czb, dnp, ds, scn, ostype, tx);
 	}
 }
@@ -847,15 +1221,26 @@ dsl_scan_visitbp(blkptr_t *bp, const zbookmark_phys_t *zb,
 	if (bp->blk_birth <= scn->scn_phys.scn_cur_min_txg)
 		goto out;
 
-	if (dsl_scan_recurse(scn, ds, ostype, dnp, bp_toread, zb, tx) != 0)
-		goto out;
+	if (BP_GET_LEVEL(bp) > 0 || BP_GET_TYPE(bp) == DMU_OT_DNODE ||
+	    BP_GET_TYPE(bp) == DMU_OT_OBJSET) {
+		int err;
+
+		if (scn->scn_path_depth < DSL_SCAN_PATH_MAX)
+			scn->scn_path[scn->scn_path_depth] = *bp;
+		scn->scn_path_depth++;
+		err = dsl_scan_recurse(scn, ds, ostype, dnp, bp_toread, zb, tx);
+		scn->scn_path_depth--;
+		if (err != 0)
+			goto out;
+	}
 
 	/*
 	 * If dsl_scan_ddt() has aready visited this block, it will have
 	 * already done any translations or scrubbing, so don't call the
 	 * callback again.
 	 */
-	if (ddt_class_contains(dp->dp_spa,
+	if (!(scn->scn_phys.scn_flags & DSF_DATASETS) &&
+	    ddt_class_contains(dp->dp_spa,
 	    scn->scn_phys.scn_ddt_class_max, bp)) {
 		goto out;
 	}
@@ -888,6 +1273,42 @@ dsl_scan_visit_rootbp(dsl_scan_t *scn, dsl_dataset_t *ds, blkptr_t *bp,
 	dprintf_ds(ds, "finished scan%s", "");
 }
 
+/*
+ * The changes the dataset hooks below make to the position of the scan are
+ * applied both to scn_phys and to scn_phys_cached, the state last written
+ * to disk, so that a pool imported before the queued I/O is issued
+ * resumes from a dataset that still exists.
+ */
+static void
+ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
+{
+	if (ds->ds_is_snapshot) {
+		/*
+		 * Note:
+		 *  - scn_cur_{min,max}_txg stays the same.
+		 *  - Setting the flag is not really necessary if
+		 *    scn_cur_max_txg == scn_max_txg, because there
+		 *    is nothing after this snapshot that we care
+		 *    about.  However, we set it anyway and then
+		 *    ignore it when we retraverse it in
+		 *    dsl_scan_visitds().
+		 */
+		scn_phys->scn_bookmark.zb_objset =
+		    dsl_dataset_phys(ds)->ds_next_snap_obj;
+		zfs_dbgmsg("destroying ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)dsl_dataset_phys(ds)->ds_next_snap_obj);
+		scn_phys->scn_flags |= DSF_VISIT_DS_AGAIN;
+	} else {
+		SET_BOOKMARK(&scn_phys->scn_bookmark,
+		    ZB_DESTROYED_OBJSET, 0, 0, 0);
+		zfs_dbgmsg("destroying ds %llu; currently traversing; "
+		    "reset bookmark to -1,0,0,0",
+		    (u_longlong_t)ds->ds_object);
+	}
+}
+
 void
 dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 {
@@ -899,32 +1320,7 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 		return;
 
 	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
-		if (ds->ds_is_snapshot) {
-			/*
-			 * Note:
-			 *  - scn_cur_{min,max}_txg stays the same.
-			 *  - Setting the flag is not really necessary if
-			 *    scn_cur_max_txg == scn_max_txg, because there
-			 *    is nothing after this snapshot that we care
-			 *    about.  However, we set it anyway and then
-			 *    ignore it when we retraverse it in
-			 *    dsl_scan_visitds().
-			 */
-			scn->scn_phys.scn_bookmark.zb_objset =
-			    dsl_dataset_phys(ds)->ds_next_snap_obj;
-			zfs_dbgmsg("destroying ds %llu; currently traversing; "
-			    "reset zb_objset to %llu",
-			    (u_longlong_t)ds->ds_object,
-			    (u_longlong_t)dsl_dataset_phys(ds)->
-			    ds_next_snap_obj);
-			scn->scn_phys.scn_flags |= DSF_VISIT_DS_AGAIN;
-		} else {
-			SET_BOOKMARK(&scn->scn_phys.scn_bookmark,
-			    ZB_DESTROYED_OBJSET, 0, 0, 0);
-			zfs_dbgmsg("destroying ds %llu; currently traversing; "
-			    "reset bookmark to -1,0,0,0",
-			    (u_longlong_t)ds->ds_object);
-		}
+		ds_destroyed_scn_phys(ds, &scn->scn_phys);
 	} else if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		ASSERT3U(dsl_dataset_phys(ds)->ds_num_children, <=, 1);
@@ -950,6 +1346,8 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 			    (u_longlong_t)ds->ds_object);
 		}
 	}
+	if (scn->scn_phys_cached.scn_bookmark.zb_objset == ds->ds_object)
+		ds_destroyed_scn_phys(ds, &scn->scn_phys_cached);
 
 	/*
 	 * dsl_scan_sync() should be called after this, and should sync
@@ -989,6 +1387,10 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 		    (u_longlong_t)ds->ds_object,
 		    (u_longlong_t)dsl_dataset_phys(ds)->ds_prev_snap_obj);
 	}
+	if (scn->scn_phys_cached.scn_bookmark.zb_objset == ds->ds_object) {
+		scn->scn_phys_cached.scn_bookmark.zb_objset =
+		    dsl_dataset_phys(ds)->ds_prev_snap_obj;
+	}
 	dsl_scan_sync_state(scn, tx);
 }
 
@@ -1015,6 +1417,12 @@ dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 		    (u_longlong_t)ds2->ds_object,
 		    (u_longlong_t)ds1->ds_object);
 	}
+	if (scn->scn_phys_cached.scn_bookmark.zb_objset == ds1->ds_object) {
+		scn->scn_phys_cached.scn_bookmark.zb_objset = ds2->ds_object;
+	} else if (scn->scn_phys_cached.scn_bookmark.zb_objset ==
+	    ds2->ds_object) {
+		scn->scn_phys_cached.scn_bookmark.zb_objset = ds1->ds_object;
+	}
 
 	if (zap_lookup_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
 	    ds1->ds_object, &mintxg) == 0) {
@@ -1176,8 +1584,11 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		goto out;
 
 	/*
-	 * We've finished this pass over this dataset.
+	 * We've finished this pass over this dataset.  The queue of
+	 * datasets is about to change, so issue all queued I/O before
+	 * this txg is synced, letting the on-disk state catch up.
 	 */
+	scn->scn_checkpoint = B_TRUE;
 
 	/*
 	 * If we did not completely visit this dataset, do another pass.
@@ -1192,7 +1603,8 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	}
 
 	/*
-	 * Add descendent datasets to work queue.
+	 * Add descendent datasets to work queue.  Clones are left out of
+	 * a scrub of a set of datasets, which has queued those it covers.
 	 */
 	if (dsl_dataset_phys(ds)->ds_next_snap_obj != 0) {
 		VERIFY(zap_add_int_key(dp->dp_meta_objset,
@@ -1200,7 +1612,8 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		    dsl_dataset_phys(ds)->ds_next_snap_obj,
 		    dsl_dataset_phys(ds)->ds_creation_txg, tx) == 0);
 	}
-	if (dsl_dataset_phys(ds)->ds_num_children > 1) {
+	if (dsl_dataset_phys(ds)->ds_num_children > 1 &&
+	    !(scn->scn_phys.scn_flags & DSF_DATASETS)) {
 		boolean_t usenext = B_FALSE;
 		if (dsl_dataset_phys(ds)->ds_next_clones_obj != 0) {
 			uint64_t count;
@@ -1376,6 +1789,61 @@ dsl_scan_ddt_entry(dsl_scan_t *scn, enum zio_checksum checksum,
 	}
 }
 
+/*
+ * Look for a dataset in the scan queue that a resilver should visit first,
+ * and return its queue entry in za.  The queue itself has no order, so it
+ * is searched from the start.  Once a search finds no such dataset, the
+ * rest of the scan takes the queue in order; the datasets queued later
+ * follow ones that have been visited already.
+ */
+static boolean_t
+dsl_scan_priority_next(dsl_scan_t *scn, zap_attribute_t *za)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	zap_cursor_t *zc;
+	zap_attribute_t *pza;
+	boolean_t found = B_FALSE;
+
+	if (!zfs_resilver_priority || scn->scn_priority_done ||
+	    scn->scn_phys.scn_func != POOL_SCAN_RESILVER)
+		return (B_FALSE);
+
+	zc = kmem_alloc(sizeof (zap_cursor_t), KM_SLEEP);
+	pza = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+
+	for (zap_cursor_init(zc, dp->dp_meta_objset,
+	    scn->scn_phys.scn_queue_obj);
+	    zap_cursor_retrieve(zc, pza) == 0;
+	    zap_cursor_advance(zc)) {
+		dsl_dataset_t *ds;
+		uint64_t prio = 0;
+
+		if (dsl_dataset_hold_obj(dp, strtonum(pza->za_name, NULL),
+		    FTAG, &ds) != 0)
+			continue;
+		(void) dsl_prop_get_int_ds(ds,
+		    zfs_prop_to_name(ZFS_PROP_RESILVER_PRIORITY), &prio);
+		dsl_dataset_rele(ds, FTAG);
+
+		if (prio != 0) {
+			bcopy(pza, za, sizeof (zap_attribute_t));
+			found = B_TRUE;
+			break;
+		}
+	}
+	zap_cursor_fini(zc);
+
+	kmem_free(pza, sizeof (zap_attribute_t));
+	kmem_free(zc, sizeof (zap_cursor_t));
+
+	if (!found) {
+		zfs_dbgmsg("resilver of priority datasets done in txg %llu",
+		    (u_longlong_t)spa_syncing_txg(dp->dp_spa));
+		scn->scn_priority_done = B_TRUE;
+	}
+	return (found);
+}
+
 static void
 dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 {
@@ -1383,6 +1851,9 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 	zap_cursor_t *zc;
 	zap_attribute_t *za;
 
+	if (scn->scn_path_resume)
+		dsl_scan_path_prefetch(scn);
+
 	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
 	    scn->scn_phys.scn_ddt_class_max) {
 		scn->scn_phys.scn_cur_min_txg = scn->scn_phys.scn_min_txg;
@@ -1392,7 +1863,8 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 			return;
 	}
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == DMU_META_OBJSET) {
+	if (scn->scn_phys.scn_bookmark.zb_objset == DMU_META_OBJSET &&
+	    !(scn->scn_phys.scn_flags & DSF_DATASETS)) {
 		/* First do the MOS & ORIGIN */
 
 		scn->scn_phys.scn_cur_min_txg = scn->scn_phys.scn_min_txg;
@@ -1402,6 +1874,7 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 		spa_set_rootblkptr(dp->dp_spa, &dp->dp_meta_rootbp);
 		if (scn->scn_pausing)
 			return;
+		scn->scn_checkpoint = B_TRUE;
 
 		if (spa_version(dp->dp_spa) < SPA_VERSION_DSL_SCRUB) {
 			VERIFY0(dmu_objset_find_dp(dp, dp->dp_root_dir_obj,
@@ -1411,8 +1884,8 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 			    dp->dp_origin_snap->ds_object, tx);
 		}
 		ASSERT(!scn->scn_pausing);
-	} else if (scn->scn_phys.scn_bookmark.zb_objset !=
-	    ZB_DESTROYED_OBJSET) {
+	} else if (scn->scn_phys.scn_bookmark.zb_objset != DMU_META_OBJSET &&
+	    scn->scn_phys.scn_bookmark.zb_objset != ZB_DESTROYED_OBJSET) {
 		/*
 		 * If we were paused, continue from here.  Note if the
 		 * ds we were paused on was deleted, the zb_objset may
@@ -1439,7 +1912,9 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 		dsl_dataset_t *ds;
 		uint64_t dsobj;
 
+		(void) dsl_scan_priority_next(scn, za);
 		dsobj = strtonum(za->za_name, NULL);
+		scn->scn_checkpoint = B_TRUE;
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, dsobj, tx));
 
@@ -1476,7 +1951,8 @@ dsl_scan_free_should_pause(dsl_scan_t *scn)
 	if (zfs_recover)
 		return (B_FALSE);
 
-	if (scn->scn_visited_this_txg >= zfs_free_max_blocks)
+	if (scn->scn_visited_this_txg >=
+	    MAX(scn->scn_free_max_blocks, zfs_free_max_blocks))
 		return (B_TRUE);
 
 	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
@@ -1497,15 +1973,96 @@ dsl_scan_free_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 			return (SET_ERROR(ERESTART));
 	}
 
-	zio_nowait(zio_free_sync(scn->scn_zio_root, scn->scn_dp->dp_spa,
-	    dmu_tx_get_txg(tx), bp, 0));
-	dsl_dir_diduse_space(tx->tx_pool->dp_free_dir, DD_USED_HEAD,
-	    -bp_get_dsize_sync(scn->scn_dp->dp_spa, bp),
-	    -BP_GET_PSIZE(bp), -BP_GET_UCSIZE(bp), tx);
+	if (zfs_free_async) {
+		zio_nowait(zio_free_sync_async(scn->scn_zio_root,
+		    scn->scn_dp->dp_spa, dmu_tx_get_txg(tx), bp, 0));
+	} else {
+		zio_nowait(zio_free_sync(scn->scn_zio_root,
+		    scn->scn_dp->dp_spa, dmu_tx_get_txg(tx), bp, 0));
+	}
+	scn->scn_freed_used += bp_get_dsize_sync(scn->scn_dp->dp_spa, bp);
+	scn->scn_freed_comp += BP_GET_PSIZE(bp);
+	scn->scn_freed_uncomp += BP_GET_UCSIZE(bp);
 	scn->scn_visited_this_txg++;
 	return (0);
 }
 
+/*
+ * Charge the blocks freed by the last bpobj or bptree iteration to
+ * dp_free_dir.  dsl_scan_free_block_cb() only accumulates the space, as
+ * dirtying the dsl_dir for each of up to zfs_free_max_blocks_limit
+ * blocks is a large part of the cost of freeing them.
+ */
+static void
+dsl_scan_free_account(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	if (scn->scn_freed_used == 0 && scn->scn_freed_comp == 0 &&
+	    scn->scn_freed_uncomp == 0)
+		return;
+
+	dsl_dir_diduse_space(tx->tx_pool->dp_free_dir, DD_USED_HEAD,
+	    -scn->scn_freed_used, -scn->scn_freed_comp,
+	    -scn->scn_freed_uncomp, tx);
+	scn->scn_freed_this_txg += scn->scn_freed_used;
+	scn->scn_freed_used = 0;
+	scn->scn_freed_comp = 0;
+	scn->scn_freed_uncomp = 0;
+}
+
+/*
+ * Adjust the per-txg block limit and the freeing rate after the async
+ * destroys of a txg.  The limit only grows when a txg stopped on it
+ * with most of zfs_free_min_time_ms to spare and nobody waiting on the
+ * sync, and shrinks back whenever freeing stopped on time instead.
+ */
+static void
+dsl_scan_free_adjust(dsl_scan_t *scn, int err)
+{
+	hrtime_t now = gethrtime();
+	uint64_t elapsed_ms = NSEC2MSEC(now - scn->scn_sync_start_time);
+	uint64_t limit = MAX(scn->scn_free_max_blocks, zfs_free_max_blocks);
+
+	if (err == ERESTART) {
+		if (scn->scn_visited_this_txg >= limit &&
+		    elapsed_ms < zfs_free_min_time_ms / 4 &&
+		    !txg_sync_waiting(scn->scn_dp))
+			limit = MIN(limit * 2, zfs_free_max_blocks_limit);
+		else if (scn->scn_visited_this_txg < limit)
+			limit /= 2;
+	}
+	scn->scn_free_max_blocks = MAX(limit, zfs_free_max_blocks);
+
+	if (scn->scn_freed_this_txg != 0) {
+		if (scn->scn_free_rate_time != 0) {
+			uint64_t ms = MAX(NSEC2MSEC(now -
+			    scn->scn_free_rate_time), 1);
+			uint64_t rate = scn->scn_freed_this_txg / ms * 1000;
+
+			scn->scn_free_rate = (scn->scn_free_rate == 0) ? rate :
+			    (scn->scn_free_rate * 3 + rate) / 4;
+		}
+		scn->scn_free_rate_time = now;
+		scn->scn_freed_this_txg = 0;
+	} else if (!scn->scn_async_destroying) {
+		scn->scn_free_rate = 0;
+		scn->scn_free_rate_time = 0;
+	}
+}
+
+/*
+ * Bytes per second the pool has recently been freeing in the
+ * background, or zero when it is not freeing anything.
+ */
+uint64_t
+dsl_scan_free_rate(dsl_scan_t *scn)
+{
+	dsl_dir_t *dd = scn->scn_dp->dp_free_dir;
+
+	if (dd == NULL || dsl_dir_phys(dd)->dd_used_bytes == 0)
+		return (0);
+	return (scn->scn_free_rate);
+}
+
 boolean_t
 dsl_scan_active(dsl_scan_t *scn)
 {
@@ -1540,13 +2097,13 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	 * imported (see dsl_scan_init).
 	 */
 	if (dsl_scan_restarting(scn, tx)) {
-		pool_scan_func_t func = POOL_SCAN_SCRUB;
+		dsl_scan_setup_arg_t dssa = { POOL_SCAN_SCRUB };
 		dsl_scan_done(scn, B_FALSE, tx);
 		if (vdev_resilver_needed(spa->spa_root_vdev, NULL, NULL))
-			func = POOL_SCAN_RESILVER;
+			dssa.dssa_func = POOL_SCAN_RESILVER;
 		zfs_dbgmsg("restarting scan func=%u txg=%llu",
-		    func, tx->tx_txg);
-		dsl_scan_setup_sync(&func, tx);
+		    dssa.dssa_func, tx->tx_txg);
+		dsl_scan_setup_sync(&dssa, tx);
 	}
 
 	/*
@@ -1589,6 +2146,7 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 		err = bpobj_iterate(&dp->dp_free_bpobj,
 		    dsl_scan_free_block_cb, scn, tx);
 		VERIFY3U(0, ==, zio_wait(scn->scn_zio_root));
+		dsl_scan_free_account(scn, tx);
 
 		if (err != 0 && err != ERESTART)
 			zfs_panic_recover("error %u from bpobj_iterate()", err);
@@ -1602,6 +2160,7 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 		err = bptree_iterate(dp->dp_meta_objset,
 		    dp->dp_bptree_obj, B_TRUE, dsl_scan_free_block_cb, scn, tx);
 		VERIFY0(zio_wait(scn->scn_zio_root));
+		dsl_scan_free_account(scn, tx);
 
 		if (err == EIO || err == ECKSUM) {
 			err = 0;
@@ -1636,6 +2195,7 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 			    (scn->scn_visited_this_txg == 0);
 		}
 	}
+	dsl_scan_free_adjust(scn, err);
 	if (scn->scn_visited_this_txg) {
 		zfs_dbgmsg("freed %llu blocks in %llums from "
 		    "free_bpobj/bptree txg %llu; err=%u",
@@ -1725,9 +2285,13 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
 	    NULL, ZIO_FLAG_CANFAIL);
-	dsl_pool_config_enter(dp, FTAG);
-	dsl_scan_visit(scn, tx);
-	dsl_pool_config_exit(dp, FTAG);
+	if (!scn->scn_traversal_done && !dsl_scan_queues_full(scn)) {
+		dsl_pool_config_enter(dp, FTAG);
+		dsl_scan_visit(scn, tx);
+		dsl_pool_config_exit(dp, FTAG);
+		if (!scn->scn_pausing)
+			scn->scn_traversal_done = B_TRUE;
+	}
 	(void) zio_wait(scn->scn_zio_root);
 	scn->scn_zio_root = NULL;
 
@@ -1735,7 +2299,14 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	    (longlong_t)scn->scn_visited_this_txg,
 	    (longlong_t)NSEC2MSEC(gethrtime() - scn->scn_sync_start_time));
 
-	if (!scn->scn_pausing) {
+	/*
+	 * Issue the queued I/O.  Once the traversal is done, or has reached
+	 * a point the on-disk state must move to, all of it is issued.
+	 */
+	dsl_scan_issue(scn, scn->scn_traversal_done || scn->scn_checkpoint);
+	scn->scn_checkpoint = B_FALSE;
+
+	if (scn->scn_traversal_done && scn->scn_queues_mem == 0) {
 		scn->scn_done_txg = tx->tx_txg + 1;
 		zfs_dbgmsg("txg %llu traversal complete, waiting till txg %llu",
 		    tx->tx_txg, scn->scn_done_txg);
@@ -1839,7 +2410,7 @@ dsl_scan_scrub_done(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
 
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
@@ -1852,17 +2423,375 @@ dsl_scan_scrub_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Slow the scan down for the sake of other I/O to the pool.
+ *
+ * While the pool has seen no "important" I/O for zfs_scan_idle ticks the
+ * scan runs at full speed.  Otherwise each scan I/O is delayed by up to
+ * zfs_scrub_delay or zfs_resilver_delay ticks.  With zfs_vdev_queue_tune
+ * set, the vdev queues report how much slower than usual sync reads are
+ * (spa_sync_read_lat_pct); the delay then grows by a tick per I/O while
+ * that exceeds zfs_scan_fg_latency_pct, and shrinks back to nothing once
+ * it does not.  Without that feedback the maximum delay always applies.
+ *
+ * Independently of the above, the "scanrate" pool property caps the
+ * bytes the scan reads per second.
+ */
+static void
+dsl_scan_throttle(dsl_scan_t *scn, uint64_t size)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	int max_delay = (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) ?
+	    zfs_scrub_delay : zfs_resilver_delay;
+	uint64_t lat_pct = spa->spa_sync_read_lat_pct;
+	uint64_t rate = spa->spa_scan_rate;
+	int64_t now = ddi_get_lbolt64();
+
+	if (now - spa->spa_last_io > zfs_scan_idle)
+		scn->scn_delay = 0;
+	else if (lat_pct == 0)
+		scn->scn_delay = max_delay;
+	else if (lat_pct > (uint64_t)zfs_scan_fg_latency_pct)
+		scn->scn_delay = MIN(scn->scn_delay + 1, max_delay);
+	else if (scn->scn_delay > 0)
+		scn->scn_delay--;
+
+	if (scn->scn_delay > 0)
+		delay(scn->scn_delay);
+
+	if (rate != 0) {
+		int64_t elapsed, due;
+
+		now = ddi_get_lbolt64();
+		elapsed = now - scn->scn_rate_start;
+		if (elapsed >= hz || elapsed < 0) {
+			scn->scn_rate_start = now;
+			scn->scn_rate_bytes = 0;
+			elapsed = 0;
+		}
+		scn->scn_rate_bytes += size;
+
+		/* this is sync context, so never stall a txg for long */
+		due = scn->scn_rate_bytes * hz / rate;
+		if (due > elapsed)
+			delay(MIN(due - elapsed, hz));
+	}
+}
+
+static void
+dsl_scan_exec_io(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_phys_t *zb)
+{
+	dsl_scan_t *scn = dp->dp_scan;
+	spa_t *spa = dp->dp_spa;
+	size_t size = BP_GET_PSIZE(bp);
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+	zio_priority_t priority = (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) ?
+	    ZIO_PRIORITY_SCRUB : ZIO_PRIORITY_RESILVER;
+
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_inflight >= maxinflight)
+		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+	spa->spa_scrub_inflight++;
+	mutex_exit(&spa->spa_scrub_lock);
+
+	dsl_scan_throttle(scn, size);
+
+	zio_nowait(zio_read(NULL, spa, bp,
+	    abd_alloc_for_io(size, B_FALSE), size, dsl_scan_scrub_done,
+	    NULL, priority, zio_flags, zb));
+}
+
+static int
+scan_io_compare(const void *x1, const void *x2)
+{
+	const scan_io_t *s1 = x1;
+	const scan_io_t *s2 = x2;
+
+	if (s1->sio_offset < s2->sio_offset)
+		return (-1);
+	if (s1->sio_offset > s2->sio_offset)
+		return (1);
+	return (0);
+}
+
+static dsl_scan_io_queue_t *
+dsl_scan_io_queue_create(vdev_t *vd)
+{
+	dsl_scan_io_queue_t *q = kmem_zalloc(sizeof (*q), KM_SLEEP);
+
+	q->q_scn = vd->vdev_spa->spa_dsl_pool->dp_scan;
+	q->q_vd = vd;
+	mutex_init(&q->q_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&q->q_sios_by_addr, scan_io_compare,
+	    sizeof (scan_io_t), offsetof(scan_io_t, sio_node));
+	q->q_exts_by_addr = range_tree_create(NULL, NULL, &q->q_lock);
+
+	return (q);
+}
+
+static void
+scan_io_free(dsl_scan_t *scn, scan_io_t *sio)
+{
+	atomic_add_64(&scn->scn_queues_mem, -(int64_t)sizeof (scan_io_t));
+	atomic_add_64(&scn->scn_queues_bytes,
+	    -(int64_t)BP_GET_PSIZE(&sio->sio_bp));
+	kmem_free(sio, sizeof (scan_io_t));
+}
+
+/*
+ * Discard all I/O queued on a top-level vdev, which is going away or
+ * whose scan is over.
+ */
+void
+dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *q)
+{
+	scan_io_t *sio;
+	void *cookie = NULL;
+
+	mutex_enter(&q->q_lock);
+	while ((sio = avl_destroy_nodes(&q->q_sios_by_addr, &cookie)) != NULL)
+		scan_io_free(q->q_scn, sio);
+	range_tree_vacate(q->q_exts_by_addr, NULL, NULL);
+	range_tree_destroy(q->q_exts_by_addr);
+	mutex_exit(&q->q_lock);
+
+	avl_destroy(&q->q_sios_by_addr);
+	mutex_destroy(&q->q_lock);
+	q->q_vd->vdev_scan_io_queue = NULL;
+	kmem_free(q, sizeof (*q));
+}
+
+static void
+dsl_scan_queues_destroy(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t c;
+
+	if (rvd == NULL)
+		return;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		if (tvd->vdev_scan_io_queue != NULL)
+			dsl_scan_io_queue_destroy(tvd->vdev_scan_io_queue);
+	}
+	ASSERT0(scn->scn_queues_mem);
+}
+
+/*
+ * Add [start, start + size) to the extents of the queue, bridging a gap of
+ * up to zfs_scan_max_ext_gap to the extents on either side.
+ */
+static void
+dsl_scan_io_queue_add_ext(dsl_scan_io_queue_t *q, uint64_t start,
+    uint64_t size)
+{
+	range_tree_t *rt = q->q_exts_by_addr;
+	uint64_t gap = zfs_scan_max_ext_gap;
+	uint64_t lo = start, hi = start + size;
+	uint64_t ostart, osize;
+
+	ASSERT(MUTEX_HELD(&q->q_lock));
+
+	if (gap != 0) {
+		uint64_t before = MIN(gap, start);
+
+		if (before != 0 && range_tree_find_in(rt, start - before,
+		    before, &ostart, &osize))
+			lo = ostart;
+		if (range_tree_find_in(rt, hi, gap, &ostart, &osize))
+			hi = MAX(hi, ostart);
+	}
+
+	range_tree_clear(rt, lo, hi - lo);
+	range_tree_add(rt, lo, hi - lo);
+}
+
+/*
+ * Queue a scrub/resilver read on the top-level vdev of its first DVA,
+ * which is the one it will normally be read from.
+ */
+static void
+dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_phys_t *zb)
+{
+	dsl_scan_t *scn = dp->dp_scan;
+	const dva_t *dva = &bp->blk_dva[0];
+	vdev_t *vd = vdev_lookup_top(dp->dp_spa, DVA_GET_VDEV(dva));
+	dsl_scan_io_queue_t *q;
+	scan_io_t *sio;
+	avl_index_t where;
+
+	if (vd == NULL) {
+		dsl_scan_exec_io(dp, bp, zio_flags, zb);
+		return;
+	}
+
+	if ((q = vd->vdev_scan_io_queue) == NULL)
+		q = vd->vdev_scan_io_queue = dsl_scan_io_queue_create(vd);
+
+	sio = kmem_alloc(sizeof (scan_io_t), KM_SLEEP);
+	sio->sio_bp = *bp;
+	sio->sio_zb = *zb;
+	sio->sio_offset = DVA_GET_OFFSET(dva);
+	sio->sio_asize = DVA_GET_ASIZE(dva);
+	sio->sio_flags = zio_flags;
+
+	mutex_enter(&q->q_lock);
+	if (avl_find(&q->q_sios_by_addr, sio, &where) != NULL) {
+		/* already queued, e.g. found through the DDT */
+		mutex_exit(&q->q_lock);
+		kmem_free(sio, sizeof (scan_io_t));
+		return;
+	}
+	avl_insert(&q->q_sios_by_addr, sio, where);
+	dsl_scan_io_queue_add_ext(q, sio->sio_offset, sio->sio_asize);
+	mutex_exit(&q->q_lock);
+
+	atomic_add_64(&scn->scn_queues_mem, sizeof (scan_io_t));
+	atomic_add_64(&scn->scn_queues_bytes, BP_GET_PSIZE(bp));
+}
+
+/*
+ * Issue the next extent of the queue, continuing upwards from the last
+ * one issued like an elevator, and wrapping around at the end of the
+ * vdev.  Returns B_FALSE if the queue is empty.
+ */
+static boolean_t
+dsl_scan_io_queue_issue_ext(dsl_scan_io_queue_t *q)
+{
+	dsl_pool_t *dp = q->q_scn->scn_dp;
+	range_tree_t *rt = q->q_exts_by_addr;
+	uint64_t start, size;
+	scan_io_t srch, *sio;
+	avl_index_t where;
+	list_t sio_list;
+
+	mutex_enter(&q->q_lock);
+	if (!range_tree_find_in(rt, q->q_last_ext_addr,
+	    UINT64_MAX - q->q_last_ext_addr, &start, &size) &&
+	    !range_tree_find_in(rt, 0, UINT64_MAX, &start, &size)) {
+		mutex_exit(&q->q_lock);
+		return (B_FALSE);
+	}
+
+	list_create(&sio_list, sizeof (scan_io_t),
+	    offsetof(scan_io_t, sio_list_node));
+
+	srch.sio_offset = start;
+	sio = avl_find(&q->q_sios_by_addr, &srch, &where);
+	if (sio == NULL)
+		sio = avl_nearest(&q->q_sios_by_addr, where, AVL_AFTER);
+	while (sio != NULL && sio->sio_offset < start + size) {
+		scan_io_t *next = AVL_NEXT(&q->q_sios_by_addr, sio);
+
+		avl_remove(&q->q_sios_by_addr, sio);
+		list_insert_tail(&sio_list, sio);
+		sio = next;
+	}
+
+	range_tree_remove(rt, start, size);
+	q->q_last_ext_addr = start + size;
+
+	/* extents left over from freed blocks */
+	if (avl_numnodes(&q->q_sios_by_addr) == 0)
+		range_tree_vacate(rt, NULL, NULL);
+	mutex_exit(&q->q_lock);
+
+	while ((sio = list_remove_head(&sio_list)) != NULL) {
+		dsl_scan_exec_io(dp, &sio->sio_bp, sio->sio_flags,
+		    &sio->sio_zb);
+		scan_io_free(q->q_scn, sio);
+	}
+	list_destroy(&sio_list);
+
+	return (B_TRUE);
+}
+
+/*
+ * Issue queued scan I/O, an extent per top-level vdev at a time.  Unless
+ * we are draining the queues, this only starts once they are full and
+ * stops when they are half empty or the txg has seen enough scan work.
+ */
+static void
+dsl_scan_issue(dsl_scan_t *scn, boolean_t drain)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t limit = dsl_scan_mem_limit();
+	uint64_t mem = scn->scn_queues_mem;
+	uint64_t exts = 0;
+	boolean_t progress;
+	uint64_t c;
+
+	if (mem == 0 || (!drain && mem < limit))
+		return;
+
+	do {
+		progress = B_FALSE;
+		for (c = 0; c < rvd->vdev_children; c++) {
+			dsl_scan_io_queue_t *q =
+			    rvd->vdev_child[c]->vdev_scan_io_queue;
+
+			if (q != NULL && dsl_scan_io_queue_issue_ext(q)) {
+				progress = B_TRUE;
+				exts++;
+			}
+		}
+	} while (progress && (drain ||
+	    (scn->scn_queues_mem >= limit / 2 && !dsl_scan_txg_exceeded(scn))));
+
+	zfs_dbgmsg("issued %llu scan extents (%llu bytes queued) drain=%u",
+	    (longlong_t)exts, (longlong_t)scn->scn_queues_bytes, (int)drain);
+}
+
+/*
+ * A block is being freed; its queued scan I/O, if any, must not be issued
+ * since the space may be reallocated before it is.
+ */
+void
+dsl_scan_freed(spa_t *spa, const blkptr_t *bp)
+{
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+	dsl_scan_t *scn;
+	dsl_scan_io_queue_t *q;
+	scan_io_t srch, *sio;
+	vdev_t *vd;
+
+	if (dp == NULL || (scn = dp->dp_scan) == NULL ||
+	    scn->scn_queues_mem == 0 || BP_IS_EMBEDDED(bp))
+		return;
+
+	vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+	if (vd == NULL || (q = vd->vdev_scan_io_queue) == NULL)
+		return;
+
+	srch.sio_offset = DVA_GET_OFFSET(&bp->blk_dva[0]);
+	mutex_enter(&q->q_lock);
+	sio = avl_find(&q->q_sios_by_addr, &srch, NULL);
+	if (sio != NULL &&
+	    BP_PHYSICAL_BIRTH(&sio->sio_bp) == BP_PHYSICAL_BIRTH(bp))
+		avl_remove(&q->q_sios_by_addr, sio);
+	else
+		sio = NULL;
+	mutex_exit(&q->q_lock);
+
+	if (sio != NULL)
+		scan_io_free(scn, sio);
+}
+
 static int
 dsl_scan_scrub_cb(dsl_pool_t *dp,
     const blkptr_t *bp, const zbookmark_phys_t *zb)
 {
 	dsl_scan_t *scn = dp->dp_scan;
-	size_t size = BP_GET_PSIZE(bp);
 	spa_t *spa = dp->dp_spa;
 	uint64_t phys_birth = BP_PHYSICAL_BIRTH(bp);
 	boolean_t needs_io = B_FALSE;
-	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
-	int scan_delay = 0;
+	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_RAW_ENCRYPT;
 	int d;
 
 	if (phys_birth <= scn->scn_phys.scn_min_txg ||
@@ -1878,12 +2807,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	if (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) {
 		zio_flags |= ZIO_FLAG_SCRUB;
 		needs_io = B_TRUE;
-		scan_delay = zfs_scrub_delay;
 	} else {
 		ASSERT3U(scn->scn_phys.scn_func, ==, POOL_SCAN_RESILVER);
 		zio_flags |= ZIO_FLAG_RESILVER;
 		needs_io = B_FALSE;
-		scan_delay = zfs_resilver_delay;
 	}
 
 	/* If it's an intent log block, failure is expected. */
@@ -1921,26 +2848,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	}
 
 	if (needs_io && !zfs_no_scrub_io) {
-		vdev_t *rvd = spa->spa_root_vdev;
-		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
-		void *data = zio_data_buf_alloc(size);
-
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight >= maxinflight)
-			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
-		spa->spa_scrub_inflight++;
-		mutex_exit(&spa->spa_scrub_lock);
-
-		/*
-		 * If we're seeing recent (zfs_scan_idle) "important" I/Os
-		 * then throttle our workload to limit the impact of a scan.
-		 */
-		if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
-			delay(scan_delay);
-
-		zio_nowait(zio_read(NULL, spa, bp, data, size,
-		    dsl_scan_scrub_done, NULL, ZIO_PRIORITY_SCRUB,
-		    zio_flags, zb));
+		if (zfs_scan_legacy)
+			dsl_scan_exec_io(dp, bp, zio_flags, zb);
+		else
+			dsl_scan_enqueue(dp, bp, zio_flags, zb);
 	}
 
 	/* do not relocate this block */
@@ -1949,8 +2860,25 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 
 int
 dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
+{
+	return (dsl_scan_restricted(dp, func, 0, 0, NULL));
+}
+
+/*
+ * Start a scan of the blocks born from min_txg to max_txg (0 for no
+ * limit) of the datasets named in datasets (NULL for the whole pool).
+ */
+int
+dsl_scan_restricted(dsl_pool_t *dp, pool_scan_func_t func, uint64_t min_txg,
+    uint64_t max_txg, nvlist_t *datasets)
 {
 	spa_t *spa = dp->dp_spa;
+	dsl_scan_setup_arg_t dssa;
+
+	dssa.dssa_func = func;
+	dssa.dssa_min_txg = min_txg;
+	dssa.dssa_max_txg = max_txg;
+	dssa.dssa_datasets = datasets;
 
 	/*
 	 * Purge all vdev caches and probe all devices.  We do this here
@@ -1966,7 +2894,7 @@ dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
 	(void) spa_vdev_state_exit(spa, NULL, 0);
 
 	return (dsl_sync_task(spa_name(spa), dsl_scan_setup_check,
-	    dsl_scan_setup_sync, &func, 0, ZFS_SPACE_CHECK_NONE));
+	    dsl_scan_setup_sync, &dssa, 0, ZFS_SPACE_CHECK_NONE));
 }
 
 static boolean_t
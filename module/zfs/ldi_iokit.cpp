@@ -83,10 +83,21 @@ static IOService		*ldi_zfs_handle;
 /* Exposed to c callers */
 extern "C" {
 
+/*
+ * Per-CPU freelist of IOKit buffers, see buf_strategy_iokit.  Padded to a
+ * cache line so that neighbouring CPUs don't share one.
+ */
+struct ldi_iokit_bufcache {
+	kmutex_t		lbc_lock;
+	list_t			lbc_list;
+	uint_t			lbc_count;
+} __attribute__((aligned(64)));
+
 struct _handle_iokit {
 	IOMedia			*media;
 	IOService		*client;
-};	/* 16b */
+	struct ldi_iokit_bufcache *bufcache;	/* max_ncpus entries */
+};	/* 24b */
 
 struct _handle_notifier {
 	IONotifier		*obj;
@@ -94,8 +105,12 @@ struct _handle_notifier {
 
 #define	LH_MEDIA(lhp)		lhp->lh_tsd.iokit_tsd->media
 #define	LH_CLIENT(lhp)		lhp->lh_tsd.iokit_tsd->client
+#define	LH_BUFCACHE(lhp)	lhp->lh_tsd.iokit_tsd->bufcache
 #define	LH_NOTIFIER(lhp)	lhp->lh_notifier->obj
 
+static void ldi_iokit_bufcache_create(struct ldi_handle *);
+static void ldi_iokit_bufcache_destroy(struct ldi_handle *);
+
 void
 handle_free_iokit(struct ldi_handle *lhp) {
 	if (!lhp) {
@@ -114,6 +129,9 @@ handle_free_iokit(struct ldi_handle *lhp) {
 		    __func__, lhp, "couldn't be removed");
 	}
 
+	/* Free any cached IOKit buffers */
+	ldi_iokit_bufcache_destroy(lhp);
+
 	kmem_free(lhp->lh_tsd.iokit_tsd, sizeof (struct _handle_iokit));
 	lhp->lh_tsd.iokit_tsd = 0;
 }
@@ -142,6 +160,7 @@ handle_alloc_iokit(dev_t device, int fmode)
 	    sizeof (struct _handle_iokit), KM_SLEEP);
 	LH_MEDIA(lhp) = 0;
 	LH_CLIENT(lhp) = 0;
+	ldi_iokit_bufcache_create(lhp);
 
 	/* Allocate an IOService client for open/close */
 	if (handle_alloc_ioservice(lhp) != 0) {
@@ -1174,12 +1193,197 @@ media_from_path(const char *path = 0)
 	return (media);
 }
 
-/* Define an IOKit buffer for buf_strategy_iokit */
+/*
+ * Define an IOKit buffer for buf_strategy_iokit.  These are kept on the
+ * per-CPU freelists of the handle between IOs, along with their memory
+ * descriptor, which is reinitialized to point at the next IO's data
+ * rather than being allocated and freed each time.
+ */
 typedef struct ldi_iokit_buf {
 	IOMemoryDescriptor	*iomem;
 	IOStorageCompletion	iocompletion;
 	IOStorageAttributes	ioattr;
-} ldi_iokit_buf_t;		/* XXX Currently 64b */
+	IOVirtualRange		iorange;	/* referenced by iomem */
+	IOVirtualRange		*ioranges;	/* same, for b_vec IO */
+	uint32_t		ioranges_cnt;	/* capacity of ioranges */
+	struct ldi_handle	*lhp;
+	list_node_t		node;		/* bufcache membership */
+} ldi_iokit_buf_t;
+
+/* Maximum number of IOKit buffers cached per CPU, per handle */
+static uint_t ldi_iokit_bufcache_max = 32;
+
+static void
+ldi_iokit_bufcache_create(struct ldi_handle *lhp)
+{
+	struct ldi_iokit_bufcache *lbc;
+	int i;
+
+	LH_BUFCACHE(lhp) = (struct ldi_iokit_bufcache *)kmem_zalloc(
+	    max_ncpus * sizeof (struct ldi_iokit_bufcache), KM_SLEEP);
+
+	for (i = 0; i < max_ncpus; i++) {
+		lbc = &LH_BUFCACHE(lhp)[i];
+		mutex_init(&lbc->lbc_lock, NULL, MUTEX_DEFAULT, NULL);
+		list_create(&lbc->lbc_list, sizeof (ldi_iokit_buf_t),
+		    offsetof(ldi_iokit_buf_t, node));
+	}
+}
+
+static void
+ldi_iokit_buf_free(ldi_iokit_buf_t *iobp)
+{
+	if (iobp->iomem) {
+		iobp->iomem->release();
+		iobp->iomem = 0;
+	}
+	if (iobp->ioranges) {
+		kmem_free(iobp->ioranges,
+		    iobp->ioranges_cnt * sizeof (IOVirtualRange));
+	}
+	kmem_free(iobp, sizeof (ldi_iokit_buf_t));
+}
+
+static void
+ldi_iokit_bufcache_destroy(struct ldi_handle *lhp)
+{
+	struct ldi_iokit_bufcache *lbc;
+	ldi_iokit_buf_t *iobp;
+	int i;
+
+	if (LH_BUFCACHE(lhp) == NULL)
+		return;
+
+	for (i = 0; i < max_ncpus; i++) {
+		lbc = &LH_BUFCACHE(lhp)[i];
+		while ((iobp = (ldi_iokit_buf_t *)
+		    list_remove_head(&lbc->lbc_list)) != NULL) {
+			ldi_iokit_buf_free(iobp);
+		}
+		lbc->lbc_count = 0;
+		list_destroy(&lbc->lbc_list);
+		mutex_destroy(&lbc->lbc_lock);
+	}
+
+	kmem_free(LH_BUFCACHE(lhp),
+	    max_ncpus * sizeof (struct ldi_iokit_bufcache));
+	LH_BUFCACHE(lhp) = 0;
+}
+
+/* Take an IOKit buffer from this CPU's freelist, or allocate one */
+static ldi_iokit_buf_t *
+ldi_iokit_buf_get(struct ldi_handle *lhp)
+{
+	struct ldi_iokit_bufcache *lbc = &LH_BUFCACHE(lhp)[CPU_SEQID];
+	ldi_iokit_buf_t *iobp;
+
+	mutex_enter(&lbc->lbc_lock);
+	iobp = (ldi_iokit_buf_t *)list_remove_head(&lbc->lbc_list);
+	if (iobp != NULL)
+		lbc->lbc_count--;
+	mutex_exit(&lbc->lbc_lock);
+
+	if (iobp == NULL) {
+		iobp = (ldi_iokit_buf_t *)kmem_zalloc(
+		    sizeof (ldi_iokit_buf_t), KM_SLEEP);
+		list_link_init(&iobp->node);
+		iobp->lhp = lhp;
+	}
+
+	ASSERT3P(iobp->lhp, ==, lhp);
+	return (iobp);
+}
+
+/*
+ * Return an IOKit buffer to the freelist of the CPU we are completing on,
+ * keeping its memory descriptor for reuse.
+ */
+static void
+ldi_iokit_buf_put(ldi_iokit_buf_t *iobp)
+{
+	struct ldi_iokit_bufcache *lbc =
+	    &LH_BUFCACHE(iobp->lhp)[CPU_SEQID];
+
+	mutex_enter(&lbc->lbc_lock);
+	if (lbc->lbc_count < ldi_iokit_bufcache_max) {
+		list_insert_head(&lbc->lbc_list, iobp);
+		lbc->lbc_count++;
+		iobp = NULL;
+	}
+	mutex_exit(&lbc->lbc_lock);
+
+	if (iobp != NULL)
+		ldi_iokit_buf_free(iobp);
+}
+
+/*
+ * Point the buffer's memory descriptor at the data of an ldi_buf_t and
+ * wire it.  A cached descriptor is reinitialized in place, only a new
+ * buffer allocates one.  A scattered ldi_buf_t gets one range per
+ * segment, the range array is kept with the buffer and only grows.
+ */
+static int
+ldi_iokit_buf_prepare(ldi_iokit_buf_t *iobp, ldi_buf_t *lbp)
+{
+	IODirection direction = (lbp->b_flags & B_READ ?
+	    kIODirectionIn : kIODirectionOut);
+	IOOptionBits options = kIOMemoryTypeVirtual | kIOMemoryAsReference |
+	    direction;
+	IOVirtualRange *ranges;
+	uint32_t i, count;
+
+	if (lbp->b_vec != NULL) {
+		ASSERT3U(lbp->b_veccnt, >, 0);
+		if (iobp->ioranges_cnt < lbp->b_veccnt) {
+			if (iobp->ioranges) {
+				kmem_free(iobp->ioranges, iobp->ioranges_cnt *
+				    sizeof (IOVirtualRange));
+			}
+			iobp->ioranges_cnt = lbp->b_veccnt;
+			iobp->ioranges = (IOVirtualRange *)kmem_alloc(
+			    iobp->ioranges_cnt * sizeof (IOVirtualRange),
+			    KM_SLEEP);
+		}
+		for (i = 0; i < lbp->b_veccnt; i++) {
+			iobp->ioranges[i].address =
+			    (IOVirtualAddress)lbp->b_vec[i].bv_addr;
+			iobp->ioranges[i].length = lbp->b_vec[i].bv_len;
+		}
+		ranges = iobp->ioranges;
+		count = lbp->b_veccnt;
+	} else {
+		iobp->iorange.address = (IOVirtualAddress)lbp->b_un.b_addr;
+		iobp->iorange.length = lbp->b_bcount;
+		ranges = &iobp->iorange;
+		count = 1;
+	}
+
+	if (iobp->iomem && !iobp->iomem->initWithOptions(ranges,
+	    count, 0, kernel_task, options, 0)) {
+		iobp->iomem->release();
+		iobp->iomem = 0;
+	}
+
+	if (!iobp->iomem && lbp->b_vec == NULL) {
+		iobp->iomem = IOMemoryDescriptor::withAddress(
+		    lbp->b_un.b_addr, lbp->b_bcount, direction);
+	} else if (!iobp->iomem) {
+		iobp->iomem = IOMemoryDescriptor::withOptions(ranges,
+		    count, 0, kernel_task, options, 0);
+	}
+
+	/* Verify the buffer */
+	if (!iobp->iomem || iobp->iomem->getLength() != lbp->b_bcount ||
+	    iobp->iomem->prepare() != kIOReturnSuccess) {
+		if (iobp->iomem) {
+			iobp->iomem->release();
+			iobp->iomem = 0;
+		}
+		return (ENOMEM);
+	}
+
+	return (0);
+}
 
 /* Completion handler for IOKit strategy */
 static void
@@ -1210,10 +1414,8 @@ ldi_iokit_io_intr(void *target, void *parameter,
 	}
 #endif
 
-	/* Complete and release IOMemoryDescriptor */
+	/* Complete IOMemoryDescriptor, it is kept for reuse */
 	iobp->iomem->complete();
-	iobp->iomem->release();
-	iobp->iomem = 0;
 
 	/* Compute resid */
 	ASSERT3U(lbp->b_bcount, >=, actualByteCount);
@@ -1227,8 +1429,8 @@ ldi_iokit_io_intr(void *target, void *parameter,
 		lbp->b_error = EIO;
 	}
 
-	/* Free IOKit buffer */
-	kmem_free(iobp, sizeof (ldi_iokit_buf_t));
+	/* Return IOKit buffer to the handle's cache */
+	ldi_iokit_buf_put(iobp);
 
 	/* Call original completion function */
 	if (lbp->b_iodone) {
@@ -1293,17 +1495,8 @@ buf_strategy_iokit(ldi_buf_t *lbp, struct ldi_handle *lhp)
 	}
 #endif /* DEBUG */
 
-	/* Allocate an IOKit buffer */
-	iobp = (ldi_iokit_buf_t *)kmem_alloc(sizeof (ldi_iokit_buf_t),
-	    KM_SLEEP);
-	if (!iobp) {
-		dprintf("%s couldn't allocate buf_iokit_t\n", __func__);
-		return (ENOMEM);
-	}
-#ifdef LDI_ZERO
-	/* Zero the new buffer struct */
-	bzero(iobp, sizeof (ldi_iokit_buf_t));
-#endif
+	/* Get an IOKit buffer from the handle's cache */
+	iobp = ldi_iokit_buf_get(lhp);
 
 	/* Set completion and attributes for async IO */
 	if (lbp->b_iodone != NULL) {
@@ -1312,26 +1505,14 @@ buf_strategy_iokit(ldi_buf_t *lbp, struct ldi_handle *lhp)
 		iobp->iocompletion.action = &ldi_iokit_io_intr;
 	}
 
-/* XXX Zeroed above if LDI_ZERO, otherwise here */
-#ifndef LDI_ZERO
-	/* XXX Zero the ioattr struct */
+	/* Zero the ioattr struct */
 	bzero(&iobp->ioattr, sizeof (IOStorageAttributes));
-#endif
 
-	/* Allocate a memory descriptor pointing to the data address */
-	iobp->iomem = IOMemoryDescriptor::withAddress(
-	    lbp->b_un.b_addr, lbp->b_bcount,
-	    (lbp->b_flags & B_READ ? kIODirectionIn : kIODirectionOut));
-
-	/* Verify the buffer */
-	if (!iobp->iomem || iobp->iomem->getLength() != lbp->b_bcount ||
-	    iobp->iomem->prepare() != kIOReturnSuccess) {
+	/* Point the memory descriptor at the data address */
+	if (ldi_iokit_buf_prepare(iobp, lbp) != 0) {
 		dprintf("%s couldn't allocate IO buffer\n",
 		    __func__);
-		if (iobp->iomem) {
-			iobp->iomem->release();
-		}
-		kmem_free(iobp, sizeof (ldi_iokit_buf_t));
+		ldi_iokit_buf_put(iobp);
 		return (ENOMEM);
 	}
 
@@ -1339,8 +1520,7 @@ buf_strategy_iokit(ldi_buf_t *lbp, struct ldi_handle *lhp)
 	if (lhp->lh_status != LDI_STATUS_ONLINE) {
 		dprintf("%s device not online\n", __func__);
 		iobp->iomem->complete();
-		iobp->iomem->release();
-		kmem_free(iobp, sizeof (ldi_iokit_buf_t));
+		ldi_iokit_buf_put(iobp);
 		return (ENODEV);
 	}
 
@@ -1722,6 +1902,32 @@ handle_get_media_info_iokit(struct ldi_handle *lhp,
 	return (0);
 }
 
+/*
+ * Look up the largest transfer the storage driver below the media will
+ * take in one request, as a byte count or failing that a block count.
+ * Returns UINT64_MAX when neither is published.
+ */
+static uint64_t
+handle_get_max_xfer_iokit(struct ldi_handle *lhp, const char *bytekey,
+    const char *blockkey, uint32_t blksize)
+{
+	OSNumber *number;
+
+	number = OSDynamicCast(OSNumber, LH_MEDIA(lhp)->getProperty(bytekey,
+	    gIOServicePlane, kIORegistryIterateRecursively |
+	    kIORegistryIterateParents));
+	if (number && number->unsigned64BitValue() != 0)
+		return (number->unsigned64BitValue());
+
+	number = OSDynamicCast(OSNumber, LH_MEDIA(lhp)->getProperty(blockkey,
+	    gIOServicePlane, kIORegistryIterateRecursively |
+	    kIORegistryIterateParents));
+	if (number && number->unsigned64BitValue() != 0)
+		return (number->unsigned64BitValue() * blksize);
+
+	return (UINT64_MAX);
+}
+
 int
 handle_get_media_info_ext_iokit(struct ldi_handle *lhp,
     struct dk_minfo_ext *dkmext)
@@ -1729,7 +1935,7 @@ handle_get_media_info_ext_iokit(struct ldi_handle *lhp,
 	OSObject *prop;
 	OSNumber *number;
 	uint32_t blksize, pblksize;
-	uint64_t blkcount;
+	uint64_t blkcount, max_xfer;
 
 	if (!lhp || !dkmext) {
 		dprintf("%s missing lhp or dkmext\n", __func__);
@@ -1771,6 +1977,13 @@ handle_get_media_info_ext_iokit(struct ldi_handle *lhp,
 		return (ENXIO);
 	}
 
+	/* The smaller of the read and write limits, if published */
+	max_xfer = handle_get_max_xfer_iokit(lhp,
+	    kIOMaximumByteCountReadKey, kIOMaximumBlockCountReadKey, blksize);
+	max_xfer = MIN(max_xfer, handle_get_max_xfer_iokit(lhp,
+	    kIOMaximumByteCountWriteKey, kIOMaximumBlockCountWriteKey,
+	    blksize));
+
 	LH_MEDIA(lhp)->release();
 
 #ifdef DEBUG
@@ -1782,6 +1995,7 @@ handle_get_media_info_ext_iokit(struct ldi_handle *lhp,
 	dkmext->dki_capacity = blkcount;
 	dkmext->dki_lbsize = blksize;
 	dkmext->dki_pbsize = pblksize;
+	dkmext->dki_max_xfer = (max_xfer == UINT64_MAX ? 0 : max_xfer);
 
 	return (0);
 }
@@ -1863,4 +2077,54 @@ handle_is_solidstate_iokit(struct ldi_handle *lhp, int *isssd)
 	return (0);
 }
 
+/*
+ * Unmap (TRIM) the extents of a DKIOCFREE list.  Media that doesn't
+ * support it returns ENOTSUP.
+ */
+int
+handle_unmap_iokit(struct ldi_handle *lhp, dkioc_free_list_t *dfl)
+{
+	IOStorageExtent *extents;
+	IOReturn result;
+	uint64_t i;
+
+	/* Validate arguments */
+	if (!lhp || !dfl || dfl->dfl_num_exts == 0) {
+		return (EINVAL);
+	}
+
+	/* Validate IOMedia */
+	if (!OSDynamicCast(IOMedia, LH_MEDIA(lhp)) ||
+	    !OSDynamicCast(IOService, LH_CLIENT(lhp))) {
+		dprintf("%s invalid IOKit handle\n", __func__);
+		return (ENODEV);
+	}
+
+	extents = (IOStorageExtent *)kmem_alloc(dfl->dfl_num_exts *
+	    sizeof (IOStorageExtent), KM_SLEEP);
+	for (i = 0; i < dfl->dfl_num_exts; i++) {
+		extents[i].byteStart = dfl->dfl_offset +
+		    dfl->dfl_exts[i].dfle_start;
+		extents[i].byteCount = dfl->dfl_exts[i].dfle_length;
+	}
+
+	LH_MEDIA(lhp)->retain();
+	result = LH_MEDIA(lhp)->unmap(LH_CLIENT(lhp), extents,
+	    dfl->dfl_num_exts, 0);
+	LH_MEDIA(lhp)->release();
+
+	kmem_free(extents, dfl->dfl_num_exts * sizeof (IOStorageExtent));
+
+	if (result == kIOReturnUnsupported) {
+		return (ENOTSUP);
+	} else if (result != kIOReturnSuccess) {
+		dprintf("%s unmap error %d %s\n", __func__,
+		    ldi_zfs_handle->errnoFromReturn(result),
+		    ldi_zfs_handle->stringFromReturn(result));
+		return (EIO);
+	}
+
+	return (0);
+}
+
 } /* extern "C" */
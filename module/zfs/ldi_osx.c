@@ -2179,6 +2179,21 @@ ldi_ioctl(ldi_handle_t lh, int cmd, intptr_t arg,
 			return (ENOTSUP);
 		}
 
+	case DKIOCFREE:
+		/* IOMedia or vnode */
+		switch (handlep->lh_type) {
+		case LDI_TYPE_IOKIT:
+			return (handle_unmap_iokit(handlep,
+			    (dkioc_free_list_t *)arg));
+
+		case LDI_TYPE_VNODE:
+			return (handle_unmap_vnode(handlep,
+			    (dkioc_free_list_t *)arg));
+
+		default:
+			return (ENOTSUP);
+		}
+
 	case DKIOCGETBOOTINFO:
 		/* IOMedia or vnode */
 		switch (handlep->lh_type) {
@@ -2290,6 +2305,8 @@ ldi_bioinit(ldi_buf_t *lbp)
 	lbp->b_lblkno = 0;
 	lbp->b_resid = 0;
 	lbp->b_error = 0;
+	lbp->b_vec = NULL;
+	lbp->b_veccnt = 0;
 }
 
 /*
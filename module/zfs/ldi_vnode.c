@@ -567,6 +567,11 @@ buf_strategy_vnode(ldi_buf_t *lbp, struct ldi_handle *lhp)
 	}
 #endif
 
+	/* Scattered IO is only supported by IOKit handles */
+	if (lbp->b_vec != NULL) {
+		return (ENOTSUP);
+	}
+
 	/* Allocate and verify buf_t */
 	if (NULL == (bp = buf_alloc(LH_VNODE(lhp)))) {
 		dprintf("%s couldn't allocate buf_t\n", __func__);
@@ -826,6 +831,7 @@ handle_get_media_info_ext_vnode(struct ldi_handle *lhp,
 		dkmext->dki_capacity = 0;
 		dkmext->dki_lbsize = 0;
 		dkmext->dki_pbsize = 0;
+		dkmext->dki_max_xfer = 0;
 		return (error);
 	}
 
@@ -833,6 +839,8 @@ handle_get_media_info_ext_vnode(struct ldi_handle *lhp,
 	dkmext->dki_capacity = blkcount;
 	dkmext->dki_lbsize = blksize;
 	dkmext->dki_pbsize = pblksize;
+	/* Not known through the vnode interface */
+	dkmext->dki_max_xfer = 0;
 	return (0);
 }
 
@@ -901,3 +909,67 @@ handle_is_solidstate_vnode(struct ldi_handle *lhp, int *isssd)
 
 	return (error);
 }
+
+int
+handle_unmap_vnode(struct ldi_handle *lhp, dkioc_free_list_t *dfl)
+{
+	vfs_context_t context;
+	dk_extent_t *extents;
+	dk_unmap_t unmap;
+	uint64_t i;
+	int error;
+
+	if (!lhp || !dfl || dfl->dfl_num_exts == 0) {
+		dprintf("%s missing lhp or dfl\n", __func__);
+		return (EINVAL);
+	}
+
+	/* Validate vnode */
+	if (LH_VNODE(lhp) == NULLVP) {
+		dprintf("%s missing vnode\n", __func__);
+		return (ENODEV);
+	}
+
+	/* Translate to the extents of DKIOCUNMAP */
+	extents = (dk_extent_t *)kmem_alloc(dfl->dfl_num_exts *
+	    sizeof (dk_extent_t), KM_SLEEP);
+	for (i = 0; i < dfl->dfl_num_exts; i++) {
+		extents[i].offset = dfl->dfl_offset +
+		    dfl->dfl_exts[i].dfle_start;
+		extents[i].length = dfl->dfl_exts[i].dfle_length;
+	}
+	bzero(&unmap, sizeof (dk_unmap_t));
+	unmap.extents = extents;
+	unmap.extentsCount = dfl->dfl_num_exts;
+
+	/* Allocate and validate context */
+	context = vfs_context_create(spl_vfs_context_kernel());
+	if (!context) {
+		dprintf("%s couldn't create VFS context\n", __func__);
+		kmem_free(extents, dfl->dfl_num_exts * sizeof (dk_extent_t));
+		return (ENOMEM);
+	}
+
+	/* Take an iocount on devvp vnode. */
+	error = vnode_getwithref(LH_VNODE(lhp));
+	if (error) {
+		dprintf("%s vnode_getwithref error %d\n",
+		    __func__, error);
+		vfs_context_rele(context);
+		kmem_free(extents, dfl->dfl_num_exts * sizeof (dk_extent_t));
+		return (ENODEV);
+	}
+	/* All code paths from here must vnode_put. */
+
+	error = VNOP_IOCTL(LH_VNODE(lhp), DKIOCUNMAP,
+	    (caddr_t)&unmap, 0, context);
+
+	/* Release iocount on vnode (still has usecount) */
+	vnode_put(LH_VNODE(lhp));
+	/* Drop vfs_context */
+	vfs_context_rele(context);
+
+	kmem_free(extents, dfl->dfl_num_exts * sizeof (dk_extent_t));
+
+	return (error);
+}
@@ -35,16 +35,25 @@
 #include <sys/zfs_context.h>
 
 static int real_LZ4_compress(const char *source, char *dest, int isize,
-    int osize);
+    int osize, int acceleration);
 static int LZ4_uncompress_unknownOutputSize(const char *source, char *dest,
     int isize, int maxOutputSize);
 static int LZ4_compressCtx(void *ctx, const char *source, char *dest,
-    int isize, int osize);
+    int isize, int osize, int acceleration);
 static int LZ4_compress64kCtx(void *ctx, const char *source, char *dest,
-    int isize, int osize);
+    int isize, int osize, int acceleration);
 
 static kmem_cache_t *lz4_cache;
 
+/*
+ * How quickly the compressor gives up looking for matches in
+ * incompressible data. 1 is the reference LZ4 behaviour; each step up
+ * trades some ratio for speed. The output is a valid LZ4 stream at any
+ * setting, so this can be changed at any time.
+ */
+int zfs_lz4_acceleration = 1;
+#define	LZ4_ACCELERATION_MAX	65537
+
 /*ARGSUSED*/
 size_t
 lz4_compress_zfs(void *s_start, void *d_start, size_t s_len,
@@ -52,11 +61,13 @@ lz4_compress_zfs(void *s_start, void *d_start, size_t s_len,
 {
 	uint32_t bufsiz;
 	char *dest = d_start;
+	int acceleration = zfs_lz4_acceleration;
 
 	ASSERT(d_len >= sizeof (bufsiz));
 
+	acceleration = MAX(MIN(acceleration, LZ4_ACCELERATION_MAX), 1);
 	bufsiz = real_LZ4_compress(s_start, &dest[sizeof (bufsiz)], s_len,
-	    d_len - sizeof (bufsiz));
+	    d_len - sizeof (bufsiz), acceleration);
 
 	/* Signal an error if the compression routine returned zero. */
 	if (bufsiz == 0)
@@ -146,6 +157,10 @@ lz4_decompress_zfs(void *s_start, void *d_start, size_t s_len,
  * LZ4_compressCtx() :
  * 	This function explicitly handles the CTX memory structure.
  *
+ * 	acceleration : 1 gives the reference behaviour. Larger values skip
+ * 		ahead faster over data that isn't matching, as the
+ * 		"acceleration" parameter of LZ4_compress_fast() does.
+ *
  * 	ILLUMOS CHANGES: the CTX memory structure must be explicitly allocated
  * 	by the caller (either on the stack or using kmem_cache_alloc). Passing
  * 	NULL isn't valid.
@@ -465,7 +480,7 @@ LZ4_NbCommonBytes(register U32 val)
 /*ARGSUSED*/
 static int
 LZ4_compressCtx(void *ctx, const char *source, char *dest, int isize,
-    int osize)
+    int osize, int acceleration)
 {
 	struct refTables *srt = (struct refTables *)ctx;
 	HTYPE *HashTable = (HTYPE *) (srt->hashTable);
@@ -496,7 +511,7 @@ LZ4_compressCtx(void *ctx, const char *source, char *dest, int isize,
 
 	/* Main Loop */
 	for (;;) {
-		int findMatchAttempts = (1U << skipStrength) + 3;
+		int findMatchAttempts = (acceleration << skipStrength) + 3;
 		const BYTE *forwardIp = ip;
 		const BYTE *ref;
 		BYTE *token;
@@ -656,7 +671,7 @@ LZ4_compressCtx(void *ctx, const char *source, char *dest, int isize,
 /*ARGSUSED*/
 static int
 LZ4_compress64kCtx(void *ctx, const char *source, char *dest, int isize,
-    int osize)
+    int osize, int acceleration)
 {
 	struct refTables *srt = (struct refTables *)ctx;
 	U16 *HashTable = (U16 *) (srt->hashTable);
@@ -685,7 +700,7 @@ LZ4_compress64kCtx(void *ctx, const char *source, char *dest, int isize,
 
 	/* Main Loop */
 	for (;;) {
-		int findMatchAttempts = (1U << skipStrength) + 3;
+		int findMatchAttempts = (acceleration << skipStrength) + 3;
 		const BYTE *forwardIp = ip;
 		const BYTE *ref;
 		BYTE *token;
@@ -832,7 +847,8 @@ LZ4_compress64kCtx(void *ctx, const char *source, char *dest, int isize,
 }
 
 static int
-real_LZ4_compress(const char *source, char *dest, int isize, int osize)
+real_LZ4_compress(const char *source, char *dest, int isize, int osize,
+    int acceleration)
 {
 	void *ctx;
 	int result;
@@ -850,9 +866,11 @@ real_LZ4_compress(const char *source, char *dest, int isize, int osize)
 	memset(ctx, 0, sizeof (struct refTables));
 
 	if (isize < LZ4_64KLIMIT)
-		result = LZ4_compress64kCtx(ctx, source, dest, isize, osize);
+		result = LZ4_compress64kCtx(ctx, source, dest, isize, osize,
+		    acceleration);
 	else
-		result = LZ4_compressCtx(ctx, source, dest, isize, osize);
+		result = LZ4_compressCtx(ctx, source, dest, isize, osize,
+		    acceleration);
 
 	kmem_cache_free(lz4_cache, ctx);
 	return (result);
@@ -898,7 +916,41 @@ LZ4_uncompress_unknownOutputSize(const char *source, char *dest, int isize,
 
 		/* get runlength */
 		token = *ip++;
-		if ((length = (token >> ML_BITS)) == RUN_MASK) {
+
+		/*
+		 * Shortcut for the common case of a short literal run
+		 * followed by a short match, well away from the ends of
+		 * both buffers: copy both with fixed-size copies that
+		 * compile to a handful of loads and stores, skipping the
+		 * bounds checks below. The margins cover the widest case
+		 * (14 literals, copied as 16, then an 18-byte match), and
+		 * a sequence this far from the end of the input cannot be
+		 * the final, literals-only one.
+		 */
+		length = token >> ML_BITS;
+		if (length != RUN_MASK && (token & ML_MASK) != ML_MASK &&
+		    iend - ip > 16 && oend - op >= 32) {
+			(void) memcpy(op, ip, 16);
+			op += length;
+			ip += length;
+
+			LZ4_READ_LITTLEENDIAN_16(ref, op, ip);
+			ip += 2;
+			length = token & ML_MASK;
+			if (ref < (BYTE * const) dest)
+				goto _output_error;
+			if (op - ref >= 8) {
+				(void) memcpy(op, ref, 8);
+				(void) memcpy(op + 8, ref + 8, 8);
+				(void) memcpy(op + 16, ref + 16, 2);
+				op += length + MINMATCH;
+				continue;
+			}
+			/* overlapping match; let the general code do it */
+			goto _copy_match;
+		}
+
+		if (length == RUN_MASK) {
 			int s = 255;
 			while ((ip < iend) && (s == 255)) {
 				s = *ip++;
@@ -951,6 +1003,7 @@ LZ4_uncompress_unknownOutputSize(const char *source, char *dest, int isize,
 			}
 		}
 		/* copy repeated sequence */
+		_copy_match:
 		if (unlikely(op - ref < STEPSIZE)) {
 #if LZ4_ARCH64
 			size_t dec64 = dec64table[op-ref];
@@ -32,9 +32,10 @@
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 #include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/zfeature.h>
-
-#define	WITH_DF_BLOCK_ALLOCATOR
+#include <sys/zap.h>
+#include <sys/kstat.h>
 
 #define	GANG_ALLOCATION(flags) \
 	((flags) & (METASLAB_GANG_CHILD | METASLAB_GANG_HEADER))
@@ -72,6 +73,34 @@ int zfs_condense_pct = 200;
  */
 int zfs_metaslab_condense_block_threshold = 4;
 
+/*
+ * Condense a space map a range of the metaslab at a time over this many
+ * txgs, so that no single spa_sync() rewrites all of it (see
+ * metaslab_condense_sync()).  1 condenses it in one txg.
+ */
+int zfs_condense_txgs = 8;
+
+typedef struct metaslab_condense_stats {
+	kstat_named_t mcs_condensed;
+	kstat_named_t mcs_txgs;
+	kstat_named_t mcs_time_ms;
+	kstat_named_t mcs_last_time_ms;
+	kstat_named_t mcs_reclaimed_bytes;
+} metaslab_condense_stats_t;
+
+static metaslab_condense_stats_t metaslab_condense_stats = {
+	{ "condensed",		KSTAT_DATA_UINT64 },
+	{ "txgs",		KSTAT_DATA_UINT64 },
+	{ "time_ms",		KSTAT_DATA_UINT64 },
+	{ "last_time_ms",	KSTAT_DATA_UINT64 },
+	{ "reclaimed_bytes",	KSTAT_DATA_UINT64 }
+};
+
+#define	MCSTAT_BUMP(stat) \
+	atomic_inc_64(&metaslab_condense_stats.stat.value.ui64)
+
+static kstat_t *metaslab_condense_ksp;
+
 /*
  * The zfs_mg_noalloc_threshold defines which metaslab groups should
  * be eligible for allocation. The value is defined as a percentage of
@@ -130,6 +159,31 @@ uint64_t metaslab_df_alloc_threshold = SPA_MAXBLOCKSIZE;
  */
 int metaslab_df_free_pct = 4;
 
+/*
+ * When set, each metaslab group chooses its own block allocator every txg
+ * instead of using zfs_metaslab_ops, see metaslab_group_select_allocator().
+ * A group moves from the dynamic fit to the new dynamic fit allocator when
+ * its free capacity falls below metaslab_adaptive_free_pct, its
+ * fragmentation reaches metaslab_adaptive_frag_pct, or its allocations
+ * took more than metaslab_adaptive_latency_ns on average (0 disables the
+ * latency check).
+ */
+int metaslab_adaptive_alloc = 1;
+int metaslab_adaptive_free_pct = 20;
+int metaslab_adaptive_frag_pct = 50;
+unsigned long metaslab_adaptive_latency_ns = 20000;
+
+/*
+ * A group only moves back to the dynamic fit allocator once it is
+ * METASLAB_ADAPTIVE_MARGIN percent clear of both thresholds, and not
+ * before METASLAB_ADAPTIVE_HOLD_TXGS txgs after a switch caused by
+ * latency.  The latency average needs METASLAB_ADAPTIVE_MIN_ALLOCS
+ * allocations in the txg to count.
+ */
+#define	METASLAB_ADAPTIVE_MARGIN	5
+#define	METASLAB_ADAPTIVE_HOLD_TXGS	100
+#define	METASLAB_ADAPTIVE_MIN_ALLOCS	64
+
 /*
  * Percentage of all cpus that can be used by the metaslab taskq.
  */
@@ -167,6 +221,24 @@ int metaslab_lba_weighting_enabled = B_TRUE;
  */
 int metaslab_bias_enabled = B_TRUE;
 
+/*
+ * How far, in percent of its aliquot, the write latency of a top-level
+ * vdev may move its share of each pass around the rotor, see
+ * metaslab_group_latency_bias().  A vdev writing half as fast as the
+ * average of its class loses up to this much of its share so that it
+ * doesn't set the pace of the whole txg, and a faster one gains as much.
+ * 0 disables the latency bias.
+ */
+int metaslab_latency_bias_pct = 50;
+
+/*
+ * The latency average of a group is only updated from txgs with at least
+ * METASLAB_LATENCY_MIN_WRITES writes to its vdev, and moves a quarter of
+ * the way to the latest txg's average each time.
+ */
+#define	METASLAB_LATENCY_MIN_WRITES	32
+#define	METASLAB_LATENCY_WEIGHT		4
+
 /*
  * Enable/disable segment-based metaslab selection.
  */
@@ -179,6 +251,19 @@ boolean_t zfs_metaslab_segment_weight_enabled = B_TRUE;
  */
 int zfs_metaslab_switch_threshold = 2;
 
+/*
+ * Without a separate log device, ZIL blocks are allocated from the normal
+ * class among the data, where they break up the locality of both and
+ * leave holes behind once they are freed.  This many metaslabs of each
+ * top-level vdev of the normal class with at least zfs_embedded_log_min_ms
+ * metaslabs are set aside as an "embedded log": ZIL blocks are allocated
+ * from them first and data only once the rest of the vdev is full.  The
+ * emptiest metaslabs are picked when the vdev's metaslabs are set up, so
+ * changes take effect on the next import or expansion.
+ */
+int zfs_embedded_log_metaslabs = 0;
+int zfs_embedded_log_min_ms = 64;
+
 /*
  * Internal switch to enable/disable the metaslab allocation tracing
  * facility.
@@ -333,6 +418,24 @@ metaslab_class_histogram_verify(metaslab_class_t *mc)
 	kmem_free(mc_hist, sizeof (uint64_t) * RANGE_TREE_HISTOGRAM_SIZE);
 }
 
+/*
+ * Return a block size that at least one free segment of the class is known
+ * to hold, judging by the space map histograms, or 0 if the histograms are
+ * empty (e.g. SPA_FEATURE_SPACEMAP_HISTOGRAM is not enabled).  The histograms
+ * are not updated under a common lock, so this is only a hint.
+ */
+uint64_t
+metaslab_class_maxsize(metaslab_class_t *mc)
+{
+	int i;
+
+	for (i = RANGE_TREE_HISTOGRAM_SIZE - 1; i >= SPA_MINBLOCKSHIFT; i--) {
+		if (mc->mc_histogram[i] != 0)
+			return (1ULL << MIN(i, SPA_MAXBLOCKSHIFT));
+	}
+	return (0);
+}
+
 /*
  * Calculate the metaslab class's fragmentation metric. The metric
  * is weighted based on the space contribution of each metaslab group.
@@ -470,8 +573,15 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 	    !msp->ms_loaded)
 		return;
 
-	sm_free_space = msp->ms_size - space_map_allocated(msp->ms_sm) -
-	    space_map_alloc_delta(msp->ms_sm);
+	/*
+	 * A metaslab that logged in this txg has already moved its
+	 * allocations, but not its frees, into the unflushed trees.
+	 */
+	if (msp->ms_logged_txg == txg)
+		return;
+
+	sm_free_space = msp->ms_size - metaslab_allocated_space(msp) -
+	    space_map_alloc_delta(msp->ms_sm) - msp->ms_logged_delta;
 
 	/*
 	 * Account for future allocations since we would have already
@@ -483,7 +593,8 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 	}
 
 	msp_free_space = range_tree_space(msp->ms_tree) + allocated +
-	    msp->ms_deferspace + range_tree_space(msp->ms_freedtree);
+	    msp->ms_deferspace + range_tree_space(msp->ms_freedtree) +
+	    range_tree_space(msp->ms_trimming);
 
 	VERIFY3U(sm_free_space, ==, msp_free_space);
 }
@@ -588,6 +699,8 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	mg->mg_activation_count = 0;
 	mg->mg_initialized = B_FALSE;
 	mg->mg_no_free_space = B_TRUE;
+	mg->mg_allocator = METASLAB_ALLOCATOR_DF;
+	mg->mg_latency_pct = 100;
 	refcount_create_tracked(&mg->mg_alloc_queue_depth);
 
 	mg->mg_taskq = taskq_create("metaslab_group_taskq", metaslab_load_pct,
@@ -802,10 +915,52 @@ metaslab_group_remove(metaslab_group_t *mg, metaslab_t *msp)
 	mutex_enter(&mg->mg_lock);
 	ASSERT(msp->ms_group == mg);
 	avl_remove(&mg->mg_metaslab_tree, msp);
+	if (msp->ms_embedded_log) {
+		ASSERT3U(mg->mg_log_count, >, 0);
+		mg->mg_log_count--;
+		msp->ms_embedded_log = B_FALSE;
+	}
 	msp->ms_group = NULL;
 	mutex_exit(&mg->mg_lock);
 }
 
+/*
+ * Set aside the emptiest metaslabs of the group's vdev for ZIL blocks,
+ * see zfs_embedded_log_metaslabs.
+ */
+void
+metaslab_group_reserve_log(metaslab_group_t *mg)
+{
+	vdev_t *vd = mg->mg_vd;
+	uint64_t m;
+
+	if (mg->mg_class != spa_normal_class(vd->vdev_spa) ||
+	    vd->vdev_ms_count < zfs_embedded_log_min_ms)
+		return;
+
+	/* never set aside more than half of the vdev */
+	mutex_enter(&mg->mg_lock);
+	while ((int64_t)mg->mg_log_count < zfs_embedded_log_metaslabs &&
+	    mg->mg_log_count < vd->vdev_ms_count / 2) {
+		metaslab_t *best = NULL;
+
+		for (m = 0; m < vd->vdev_ms_count; m++) {
+			metaslab_t *msp = vd->vdev_ms[m];
+
+			if (msp->ms_embedded_log)
+				continue;
+			if (best == NULL || metaslab_allocated_space(msp) <
+			    metaslab_allocated_space(best))
+				best = msp;
+		}
+		if (best == NULL)
+			break;
+		best->ms_embedded_log = B_TRUE;
+		mg->mg_log_count++;
+	}
+	mutex_exit(&mg->mg_lock);
+}
+
 static void
 metaslab_group_sort(metaslab_group_t *mg, metaslab_t *msp, uint64_t weight)
 {
@@ -999,8 +1154,8 @@ metaslab_rt_create(range_tree_t *rt, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT(msp->ms_tree == NULL);
 
-	avl_create(&msp->ms_size_tree, metaslab_rangesize_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_create(&msp->ms_size_tree, metaslab_rangesize_compare,
+	    sizeof (range_seg_t));
 }
 
 /*
@@ -1013,9 +1168,9 @@ metaslab_rt_destroy(range_tree_t *rt, void *arg)
 
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
-	ASSERT0(avl_numnodes(&msp->ms_size_tree));
+	ASSERT0(zfs_btree_numnodes(&msp->ms_size_tree));
 
-	avl_destroy(&msp->ms_size_tree);
+	zfs_btree_destroy(&msp->ms_size_tree);
 }
 
 static void
@@ -1026,7 +1181,7 @@ metaslab_rt_add(range_tree_t *rt, range_seg_t *rs, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 	VERIFY(!msp->ms_condensing);
-	avl_add(&msp->ms_size_tree, rs);
+	zfs_btree_add(&msp->ms_size_tree, rs);
 }
 
 static void
@@ -1037,7 +1192,7 @@ metaslab_rt_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 	VERIFY(!msp->ms_condensing);
-	avl_remove(&msp->ms_size_tree, rs);
+	zfs_btree_remove(&msp->ms_size_tree, rs);
 }
 
 static void
@@ -1049,13 +1204,10 @@ metaslab_rt_vacate(range_tree_t *rt, void *arg)
 	ASSERT3P(msp->ms_tree, ==, rt);
 
 	/*
-	 * Normally one would walk the tree freeing nodes along the way.
-	 * Since the nodes are shared with the range trees we can avoid
-	 * walking all nodes and just reinitialize the avl tree. The nodes
-	 * will be freed by the range tree, so we don't want to free them here.
+	 * The size tree holds its own copies of the segments, so it can be
+	 * emptied in one go rather than segment by segment.
 	 */
-	avl_create(&msp->ms_size_tree, metaslab_rangesize_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_clear(&msp->ms_size_tree);
 }
 
 static range_tree_ops_t metaslab_rt_ops = {
@@ -1078,44 +1230,42 @@ static range_tree_ops_t metaslab_rt_ops = {
 uint64_t
 metaslab_block_maxsize(metaslab_t *msp)
 {
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	range_seg_t *rs;
 
-	if (t == NULL || (rs = avl_last(t)) == NULL)
+	if (t == NULL || (rs = zfs_btree_last(t, NULL)) == NULL)
 		return (0ULL);
 
 	return (rs->rs_end - rs->rs_start);
 }
 
 static range_seg_t *
-metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
+metaslab_block_find(zfs_btree_t *t, uint64_t start, uint64_t size,
+    zfs_btree_index_t *where)
 {
 	range_seg_t *rs, rsearch;
-	avl_index_t where;
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = start + size;
 
-	rs = avl_find(t, &rsearch, &where);
+	rs = zfs_btree_find(t, &rsearch, where);
 	if (rs == NULL) {
-		rs = avl_nearest(t, where, AVL_AFTER);
+		rs = zfs_btree_next(t, where, where);
 	}
 	return (rs);
 }
 
-#if defined(WITH_FF_BLOCK_ALLOCATOR) || \
-    defined(WITH_DF_BLOCK_ALLOCATOR) || \
-    defined(WITH_CF_BLOCK_ALLOCATOR)
 /*
  * This is a helper function that can be used by the allocator to find
- * a suitable block to allocate. This will search the specified AVL
- * tree looking for a block that matches the specified criteria.
+ * a suitable block to allocate. This will search the specified b-tree
+ * looking for a block that matches the specified criteria.
  */
 static uint64_t
-metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
+metaslab_block_picker(zfs_btree_t *t, uint64_t *cursor, uint64_t size,
     uint64_t align)
 {
-	range_seg_t *rs = metaslab_block_find(t, *cursor, size);
+	zfs_btree_index_t where;
+	range_seg_t *rs = metaslab_block_find(t, *cursor, size, &where);
 
 	while (rs != NULL) {
 		uint64_t offset = P2ROUNDUP(rs->rs_start, align);
@@ -1124,7 +1274,7 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 			*cursor = offset + size;
 			return (offset);
 		}
-		rs = AVL_NEXT(t, rs);
+		rs = zfs_btree_next(t, &where, &where);
 	}
 
 	/*
@@ -1137,9 +1287,7 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 	*cursor = 0;
 	return (metaslab_block_picker(t, cursor, size, align));
 }
-#endif /* WITH_FF/DF/CF_BLOCK_ALLOCATOR */
 
-#if defined(WITH_FF_BLOCK_ALLOCATOR)
 /*
  * ==========================================================================
  * The first-fit block allocator
@@ -1157,19 +1305,16 @@ metaslab_ff_alloc(metaslab_t *msp, uint64_t size)
 	 */
 	uint64_t align = size & -size;
 	uint64_t *cursor = &msp->ms_lbas[highbit64(align) - 1];
-	avl_tree_t *t = &msp->ms_tree->rt_root;
+	zfs_btree_t *t = &msp->ms_tree->rt_root;
 
 	return (metaslab_block_picker(t, cursor, size, align));
 }
 
 static metaslab_ops_t metaslab_ff_ops = {
-	metaslab_ff_alloc
+	metaslab_ff_alloc,
+	METASLAB_ALLOCATOR_FF
 };
 
-metaslab_ops_t *zfs_metaslab_ops = &metaslab_ff_ops;
-#endif /* WITH_FF_BLOCK_ALLOCATOR */
-
-#if defined(WITH_DF_BLOCK_ALLOCATOR)
 /*
  * ==========================================================================
  * Dynamic block allocator -
@@ -1191,19 +1336,20 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 	uint64_t align = size & -size;
 	uint64_t *cursor = &msp->ms_lbas[highbit64(align) - 1];
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
 	uint64_t max_size = metaslab_block_maxsize(msp);
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&msp->ms_size_tree));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
 
 	if (max_size < size)
 		return (-1ULL);
 
 	/*
 	 * If we're running low on space switch to using the size
-	 * sorted AVL tree (best-fit).
+	 * sorted tree (best-fit).
 	 */
 	if (max_size < metaslab_df_alloc_threshold ||
 	    free_pct < metaslab_df_free_pct) {
@@ -1215,13 +1361,10 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 }
 
 static metaslab_ops_t metaslab_df_ops = {
-	metaslab_df_alloc
+	metaslab_df_alloc,
+	METASLAB_ALLOCATOR_DF
 };
 
-metaslab_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
-#endif /* WITH_DF_BLOCK_ALLOCATOR */
-
-#if defined(WITH_CF_BLOCK_ALLOCATOR)
 /*
  * ==========================================================================
  * Cursor fit block allocator -
@@ -1235,20 +1378,20 @@ static uint64_t
 metaslab_cf_alloc(metaslab_t *msp, uint64_t size)
 {
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	uint64_t *cursor = &msp->ms_lbas[0];
 	uint64_t *cursor_end = &msp->ms_lbas[1];
 	uint64_t offset = 0;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&rt->rt_root));
+	ASSERT3U(zfs_btree_numnodes(t), ==, zfs_btree_numnodes(&rt->rt_root));
 
 	ASSERT3U(*cursor_end, >=, *cursor);
 
 	if ((*cursor + size) > *cursor_end) {
 		range_seg_t *rs;
 
-		rs = avl_last(&msp->ms_size_tree);
+		rs = zfs_btree_last(t, NULL);
 		if (rs == NULL || (rs->rs_end - rs->rs_start) < size)
 			return (-1ULL);
 
@@ -1263,13 +1406,10 @@ metaslab_cf_alloc(metaslab_t *msp, uint64_t size)
 }
 
 static metaslab_ops_t metaslab_cf_ops = {
-	metaslab_cf_alloc
+	metaslab_cf_alloc,
+	METASLAB_ALLOCATOR_CF
 };
 
-metaslab_ops_t *zfs_metaslab_ops = &metaslab_cf_ops;
-#endif /* WITH_CF_BLOCK_ALLOCATOR */
-
-#if defined(WITH_NDF_BLOCK_ALLOCATOR)
 /*
  * ==========================================================================
  * New dynamic fit allocator -
@@ -1288,15 +1428,16 @@ uint64_t metaslab_ndf_clump_shift = 4;
 static uint64_t
 metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 {
-	avl_tree_t *t = &msp->ms_tree->rt_root;
-	avl_index_t where;
+	zfs_btree_t *t = &msp->ms_tree->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs, rsearch;
 	uint64_t hbit = highbit64(size);
 	uint64_t *cursor = &msp->ms_lbas[hbit - 1];
 	uint64_t max_size = metaslab_block_maxsize(msp);
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&msp->ms_size_tree));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -1304,16 +1445,16 @@ metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 	rsearch.rs_start = *cursor;
 	rsearch.rs_end = *cursor + size;
 
-	rs = avl_find(t, &rsearch, &where);
+	rs = zfs_btree_find(t, &rsearch, &where);
 	if (rs == NULL || (rs->rs_end - rs->rs_start) < size) {
 		t = &msp->ms_size_tree;
 
 		rsearch.rs_start = 0;
 		rsearch.rs_end = MIN(max_size,
 		    1ULL << (hbit + metaslab_ndf_clump_shift));
-		rs = avl_find(t, &rsearch, &where);
+		rs = zfs_btree_find(t, &rsearch, &where);
 		if (rs == NULL)
-			rs = avl_nearest(t, where, AVL_AFTER);
+			rs = zfs_btree_next(t, &where, &where);
 		ASSERT(rs != NULL);
 	}
 
@@ -1325,11 +1466,144 @@ metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 }
 
 static metaslab_ops_t metaslab_ndf_ops = {
-	metaslab_ndf_alloc
+	metaslab_ndf_alloc,
+	METASLAB_ALLOCATOR_NDF
+};
+
+/*
+ * ==========================================================================
+ * Sequential block allocator -
+ * Used by the metaslabs of sequential top-level vdevs, which are meant for
+ * host-aware SMR disks that slow to a crawl once they have to rewrite their
+ * zones on their own.  The cursor only moves forward, and allocations never
+ * straddle a boundary of the 2^metaslab_seq_zone_shift byte zones.  Space
+ * freed behind the cursor isn't reused until it merges back into a whole
+ * free zone, at which point the cursor restarts there once it reaches the
+ * end of the metaslab.  Only when no free zone is left does the allocator
+ * fall back to the largest free segment, so that the space isn't lost.
+ * ==========================================================================
+ */
+
+/*
+ * Zones are aligned on the disk, and the allocatable space of a vdev
+ * starts after its front labels.  This is exact for disks and mirrors;
+ * raidz spreads each zone over its children.
+ */
+int metaslab_seq_zone_shift = 28;
+
+#define	METASLAB_SEQ_ZONE(msp)	\
+	(1ULL << MIN(MAX(metaslab_seq_zone_shift, SPA_MINBLOCKSHIFT), \
+	(msp)->ms_group->mg_vd->vdev_ms_shift))
+#define	METASLAB_SEQ_ZONE_START(off, zone)	\
+	(P2ROUNDUP((off) + VDEV_LABEL_START_SIZE, zone) - VDEV_LABEL_START_SIZE)
+
+/*
+ * Return the start of the first completely free zone of the metaslab, or
+ * -1ULL if none is left.
+ */
+static uint64_t
+metaslab_seq_free_zone(metaslab_t *msp, uint64_t zone)
+{
+	zfs_btree_t *t = &msp->ms_tree->rt_root;
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+
+	rs = zfs_btree_last(&msp->ms_size_tree, NULL);
+	if (rs == NULL || rs->rs_end - rs->rs_start < zone)
+		return (-1ULL);
+
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
+		uint64_t start = METASLAB_SEQ_ZONE_START(rs->rs_start, zone);
+
+		if (start + zone <= rs->rs_end)
+			return (start);
+	}
+	return (-1ULL);
+}
+
+static uint64_t
+metaslab_seq_alloc(metaslab_t *msp, uint64_t size)
+{
+	zfs_btree_t *t = &msp->ms_tree->rt_root;
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+	uint64_t *cursor = &msp->ms_lbas[0];
+	uint64_t zone = METASLAB_SEQ_ZONE(msp);
+	int restarts;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
+
+	if (metaslab_block_maxsize(msp) < size)
+		return (-1ULL);
+
+	/* a fresh cursor starts at the first free zone, not in a hole */
+	if (*cursor == 0 && (*cursor = metaslab_seq_free_zone(msp,
+	    zone)) == -1ULL)
+		*cursor = msp->ms_start;
+
+	for (restarts = 0; restarts < 2; restarts++) {
+		for (rs = metaslab_block_find(t, *cursor, size, &where);
+		    rs != NULL; rs = zfs_btree_next(t, &where, &where)) {
+			uint64_t offset = MAX(rs->rs_start, *cursor);
+			uint64_t next = METASLAB_SEQ_ZONE_START(offset + 1,
+			    zone);
+
+			if (size <= zone && offset + size > next)
+				offset = next;
+			if (offset + size <= rs->rs_end) {
+				*cursor = offset + size;
+				return (offset);
+			}
+		}
+
+		/* restart at the first zone freed behind the cursor */
+		if ((*cursor = metaslab_seq_free_zone(msp, zone)) == -1ULL)
+			break;
+	}
+
+	/*
+	 * Every zone has been written to.  Fill the largest free segments
+	 * rather than failing, and look for a free zone again next time.
+	 */
+	*cursor = 0;
+	rs = zfs_btree_last(&msp->ms_size_tree, NULL);
+	if (rs == NULL || rs->rs_end - rs->rs_start < size)
+		return (-1ULL);
+	return (rs->rs_start);
+}
+
+static metaslab_ops_t metaslab_seq_ops = {
+	metaslab_seq_alloc,
+	METASLAB_ALLOCATOR_SEQ
+};
+
+/*
+ * All block allocators, indexed by metaslab_allocator_t.  The static
+ * zfs_metaslab_ops is used for every metaslab group unless
+ * metaslab_adaptive_alloc is set, in which case each group picks between
+ * the dynamic and new dynamic fit allocators on its own, see
+ * metaslab_group_select_allocator().
+ */
+metaslab_ops_t *metaslab_allocators[METASLAB_ALLOCATORS] = {
+	&metaslab_ff_ops,
+	&metaslab_df_ops,
+	&metaslab_cf_ops,
+	&metaslab_ndf_ops,
+	&metaslab_seq_ops
+};
+
+const char *metaslab_allocator_names[METASLAB_ALLOCATORS] = {
+	"ff",
+	"df",
+	"cf",
+	"ndf",
+	"seq"
 };
 
-metaslab_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
-#endif /* WITH_NDF_BLOCK_ALLOCATOR */
+metaslab_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
 
 
 /*
@@ -1382,10 +1656,24 @@ metaslab_load(metaslab_t *msp)
 		ASSERT3P(msp->ms_group, !=, NULL);
 		msp->ms_loaded = B_TRUE;
 
+		/*
+		 * Apply the changes that are only in the log space maps.
+		 * The deferred frees below are part of ms_unflushed_frees
+		 * as well as of the defer trees.
+		 */
+		range_tree_walk(msp->ms_unflushed_allocs,
+		    range_tree_remove, msp->ms_tree);
+		range_tree_walk(msp->ms_unflushed_frees,
+		    range_tree_add, msp->ms_tree);
+
 		for (t = 0; t < TXG_DEFER_SIZE; t++) {
 			range_tree_walk(msp->ms_defertree[t],
 			    range_tree_remove, msp->ms_tree);
 		}
+
+		/* Space still being unmapped stays out of the allocator. */
+		range_tree_walk(msp->ms_trimming,
+		    range_tree_remove, msp->ms_tree);
 		msp->ms_max_size = metaslab_block_maxsize(msp);
 	}
 	cv_broadcast(&msp->ms_load_cv);
@@ -1396,12 +1684,68 @@ void
 metaslab_unload(metaslab_t *msp)
 {
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	range_tree_vacate(msp->ms_trimtree, NULL, NULL);
 	range_tree_vacate(msp->ms_tree, NULL, NULL);
 	msp->ms_loaded = B_FALSE;
 	msp->ms_weight &= ~METASLAB_ACTIVE_MASK;
 	msp->ms_max_size = 0;
 }
 
+/*
+ * The space allocated in the metaslab as of the last synced txg, including
+ * the changes that are only in the log space maps.
+ */
+uint64_t
+metaslab_allocated_space(metaslab_t *msp)
+{
+	return (space_map_allocated(msp->ms_sm) +
+	    range_tree_space(msp->ms_unflushed_allocs) -
+	    range_tree_space(msp->ms_unflushed_frees));
+}
+
+/*
+ * Record a change that went to a log space map rather than ms_sm.  A
+ * change that reverts an unflushed change of the opposite kind cancels
+ * it instead, which keeps the two unflushed trees disjoint.
+ */
+static void
+metaslab_unflushed_change(range_tree_t *undo, range_tree_t *rt,
+    uint64_t start, uint64_t size)
+{
+	uint64_t end = start + size;
+	uint64_t ostart, osize;
+
+	while (start < end &&
+	    range_tree_find_in(undo, start, end - start, &ostart, &osize)) {
+		if (ostart > start)
+			range_tree_add(rt, start, ostart - start);
+		range_tree_remove(undo, ostart, osize);
+		start = ostart + osize;
+	}
+	if (start < end)
+		range_tree_add(rt, start, end - start);
+}
+
+void
+metaslab_unflushed_alloc(void *arg, uint64_t start, uint64_t size)
+{
+	metaslab_t *msp = arg;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	metaslab_unflushed_change(msp->ms_unflushed_frees,
+	    msp->ms_unflushed_allocs, start, size);
+}
+
+void
+metaslab_unflushed_free(void *arg, uint64_t start, uint64_t size)
+{
+	metaslab_t *msp = arg;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	metaslab_unflushed_change(msp->ms_unflushed_allocs,
+	    msp->ms_unflushed_frees, start, size);
+}
+
 int
 metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
     metaslab_t **msp)
@@ -1434,6 +1778,21 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 		ASSERT(ms->ms_sm != NULL);
 	}
 
+	/*
+	 * A condense that was not finished left its new space map behind;
+	 * metaslab_sync() frees it.
+	 */
+	if (object != 0 && vd->vdev_top_zap != 0) {
+		uint64_t zapobj;
+
+		if (zap_lookup(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_CONDENSING, sizeof (uint64_t), 1,
+		    &zapobj) == 0) {
+			(void) zap_lookup_int_key(mos, zapobj, id,
+			    &ms->ms_condense_stale);
+		}
+	}
+
 	/*
 	 * We create the main range tree here, but we don't create the
 	 * other range trees until metaslab_sync_done().  This serves
@@ -1442,6 +1801,10 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
 	ms->ms_tree = range_tree_create(&metaslab_rt_ops, ms, &ms->ms_lock);
+	ms->ms_trimtree = range_tree_create(NULL, NULL, &ms->ms_lock);
+	ms->ms_trimming = range_tree_create(NULL, NULL, &ms->ms_lock);
+	ms->ms_unflushed_allocs = range_tree_create(NULL, NULL, &ms->ms_lock);
+	ms->ms_unflushed_frees = range_tree_create(NULL, NULL, &ms->ms_lock);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
@@ -1486,15 +1849,37 @@ metaslab_fini(metaslab_t *msp)
 
 	metaslab_group_t *mg = msp->ms_group;
 
+	/*
+	 * spa_unflushed_ms is sorted by vdev, so leave it while the
+	 * metaslab still belongs to its group.
+	 */
+	if (msp->ms_unflushed_txg != 0) {
+		spa_t *spa = mg->mg_vd->vdev_spa;
+
+		mutex_enter(&spa->spa_log_lock);
+		avl_remove(&spa->spa_unflushed_ms, msp);
+		mutex_exit(&spa->spa_log_lock);
+	}
+
 	metaslab_group_remove(mg, msp);
 
 	mutex_enter(&msp->ms_lock);
 	VERIFY(msp->ms_group == NULL);
-	vdev_space_update(mg->mg_vd, -space_map_allocated(msp->ms_sm),
+	vdev_space_update(mg->mg_vd, -metaslab_allocated_space(msp),
 	    0, -msp->ms_size);
 	space_map_close(msp->ms_sm);
+	if (msp->ms_condense_sm != NULL)
+		space_map_close(msp->ms_condense_sm);
+
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+	range_tree_destroy(msp->ms_unflushed_allocs);
+	range_tree_destroy(msp->ms_unflushed_frees);
 
 	metaslab_unload(msp);
+	range_tree_vacate(msp->ms_trimming, NULL, NULL);
+	range_tree_destroy(msp->ms_trimtree);
+	range_tree_destroy(msp->ms_trimming);
 	range_tree_destroy(msp->ms_tree);
 	range_tree_destroy(msp->ms_freeingtree);
 	range_tree_destroy(msp->ms_freedtree);
@@ -1647,7 +2032,7 @@ metaslab_space_weight(metaslab_t *msp)
 	/*
 	 * The baseline weight is the metaslab's free space.
 	 */
-	space = msp->ms_size - space_map_allocated(msp->ms_sm);
+	space = msp->ms_size - metaslab_allocated_space(msp);
 
 	if (metaslab_fragmentation_factor_enabled &&
 	    msp->ms_fragmentation != ZFS_FRAG_INVALID) {
@@ -1783,7 +2168,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * The metaslab is completely free.
 	 */
-	if (space_map_allocated(msp->ms_sm) == 0) {
+	if (metaslab_allocated_space(msp) == 0) {
 		int idx = highbit64(msp->ms_size) - 1;
 		int max_idx = SPACE_MAP_HISTOGRAM_SIZE + shift - 1;
 
@@ -1805,7 +2190,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * If the metaslab is fully allocated then just make the weight 0.
 	 */
-	if (space_map_allocated(msp->ms_sm) == msp->ms_size)
+	if (metaslab_allocated_space(msp) == msp->ms_size)
 		return (0);
 	/*
 	 * If the metaslab is already loaded, then use the range tree to
@@ -1875,7 +2260,7 @@ metaslab_weight(metaslab_t *msp)
 	 * for us to do here.
 	 */
 	if (vd->vdev_removing) {
-		ASSERT0(space_map_allocated(msp->ms_sm));
+		ASSERT0(metaslab_allocated_space(msp));
 		ASSERT0(vd->vdev_ms_shift);
 		return (0);
 	}
@@ -2079,7 +2464,7 @@ metaslab_should_condense(metaslab_t *msp)
 	 * metaslabs that are empty and metaslabs for which a condense
 	 * request has been made.
 	 */
-	rs = avl_last(&msp->ms_size_tree);
+	rs = zfs_btree_last(&msp->ms_size_tree, NULL);
 	if (rs == NULL || msp->ms_condense_wanted)
 		return (B_TRUE);
 
@@ -2093,7 +2478,8 @@ metaslab_should_condense(metaslab_t *msp)
 	entries = size / (MIN(size, SM_RUN_MAX));
 	segsz = entries * sizeof (uint64_t);
 
-	optimal_size = sizeof (uint64_t) * avl_numnodes(&msp->ms_tree->rt_root);
+	optimal_size = sizeof (uint64_t) *
+	    zfs_btree_numnodes(&msp->ms_tree->rt_root);
 	object_size = space_map_length(msp->ms_sm);
 
 	dmu_object_info_from_db(sm->sm_dbuf, &doi);
@@ -2104,6 +2490,30 @@ metaslab_should_condense(metaslab_t *msp)
 	    object_size > zfs_metaslab_condense_block_threshold * record_size);
 }
 
+/*
+ * Account for a finished condense of the metaslab, which shrank its space
+ * map from length to new_length bytes.
+ */
+static void
+metaslab_condense_done(metaslab_t *msp, uint64_t length, uint64_t new_length)
+{
+	uint64_t elapsed = NSEC2MSEC(gethrtime() - msp->ms_condense_start);
+
+	spa_dbgmsg(msp->ms_group->mg_vd->vdev_spa, "condensed: msp[%llu] %p, "
+	    "smp size %llu -> %llu in %llums", msp->ms_id, msp, length,
+	    new_length, elapsed);
+
+	MCSTAT_BUMP(mcs_condensed);
+	atomic_add_64(&metaslab_condense_stats.mcs_time_ms.value.ui64,
+	    elapsed);
+	metaslab_condense_stats.mcs_last_time_ms.value.ui64 = elapsed;
+	if (length > new_length) {
+		atomic_add_64(
+		    &metaslab_condense_stats.mcs_reclaimed_bytes.value.ui64,
+		    length - new_length);
+	}
+}
+
 /*
  * Condense the on-disk space map representation to its minimized form.
  * The minimized form consists of a small number of allocations followed by
@@ -2115,17 +2525,19 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
 	range_tree_t *condense_tree;
 	space_map_t *sm = msp->ms_sm;
+	uint64_t length = space_map_length(sm);
 	int t;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 	ASSERT3U(spa_sync_pass(spa), ==, 1);
 	ASSERT(msp->ms_loaded);
 
+	msp->ms_condense_start = gethrtime();
 
 	spa_dbgmsg(spa, "condensing: txg %llu, msp[%llu] %p, "
 	    "smp size %llu, segments %lu, forcing condense=%s", txg,
 	    msp->ms_id, msp, space_map_length(msp->ms_sm),
-	    avl_numnodes(&msp->ms_tree->rt_root),
+	    zfs_btree_numnodes(&msp->ms_tree->rt_root),
 	    msp->ms_condense_wanted ? "TRUE" : "FALSE");
 
 	msp->ms_condense_wanted = B_FALSE;
@@ -2157,6 +2569,9 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 		    range_tree_remove, condense_tree);
 	}
 
+	/* Space being unmapped is free even though it's not in ms_tree. */
+	range_tree_walk(msp->ms_trimming, range_tree_remove, condense_tree);
+
 	/*
 	 * We're about to drop the metaslab's lock thus allowing
 	 * other consumers to change it's content. Set the
@@ -2188,6 +2603,312 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 
 	space_map_write(sm, msp->ms_tree, SM_FREE, tx);
 	msp->ms_condensing = B_FALSE;
+
+	MCSTAT_BUMP(mcs_txgs);
+	metaslab_condense_done(msp, length, sm->sm_phys->smp_objsize);
+}
+
+/*
+ * Record that ms_condense_sm is object obj, for metaslab_init() to find
+ * it should the condense not be finished.
+ */
+static void
+metaslab_condense_record(vdev_t *vd, uint64_t ms_id, uint64_t obj,
+    dmu_tx_t *tx)
+{
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+	uint64_t zapobj;
+
+	if (zap_lookup(mos, vd->vdev_top_zap, VDEV_TOP_ZAP_MS_CONDENSING,
+	    sizeof (uint64_t), 1, &zapobj) != 0) {
+		zapobj = zap_create(mos, DMU_OTN_ZAP_METADATA, DMU_OT_NONE,
+		    0, tx);
+		VERIFY0(zap_add(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_CONDENSING, sizeof (uint64_t), 1,
+		    &zapobj, tx));
+	}
+	VERIFY0(zap_add_int_key(mos, zapobj, ms_id, obj, tx));
+}
+
+static void
+metaslab_condense_unrecord(vdev_t *vd, uint64_t ms_id, dmu_tx_t *tx)
+{
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+	uint64_t zapobj, count;
+
+	VERIFY0(zap_lookup(mos, vd->vdev_top_zap, VDEV_TOP_ZAP_MS_CONDENSING,
+	    sizeof (uint64_t), 1, &zapobj));
+	VERIFY0(zap_remove_int_key(mos, zapobj, ms_id, tx));
+	VERIFY0(zap_count(mos, zapobj, &count));
+	if (count == 0) {
+		VERIFY0(zap_destroy(mos, zapobj, tx));
+		VERIFY0(zap_remove(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_CONDENSING, tx));
+	}
+}
+
+/*
+ * Start condensing the metaslab into a new space map, which
+ * metaslab_condense_sync() writes a range at a time.
+ */
+static void
+metaslab_condense_start(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	space_map_t *sm = NULL;
+	uint64_t obj;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+	ASSERT3P(msp->ms_condense_sm, ==, NULL);
+	ASSERT0(msp->ms_condense_stale);
+	ASSERT(msp->ms_loaded);
+
+	spa_dbgmsg(spa, "condensing over %d txgs: txg %llu, msp[%llu] %p, "
+	    "smp size %llu, segments %lu, forcing condense=%s",
+	    zfs_condense_txgs, txg, msp->ms_id, msp,
+	    space_map_length(msp->ms_sm),
+	    zfs_btree_numnodes(&msp->ms_tree->rt_root),
+	    msp->ms_condense_wanted ? "TRUE" : "FALSE");
+
+	msp->ms_condense_wanted = B_FALSE;
+	msp->ms_condense_start = gethrtime();
+
+	mutex_exit(&msp->ms_lock);
+	obj = space_map_alloc(spa->spa_meta_objset, tx);
+	VERIFY0(space_map_open(&sm, spa->spa_meta_objset, obj,
+	    msp->ms_start, msp->ms_size, vd->vdev_ashift, &msp->ms_lock));
+	metaslab_condense_record(vd, msp->ms_id, obj, tx);
+	mutex_enter(&msp->ms_lock);
+
+	msp->ms_condense_sm = sm;
+	msp->ms_condense_cursor = msp->ms_start;
+}
+
+static void
+metaslab_condense_clear(void *arg, uint64_t start, uint64_t size)
+{
+	range_tree_clear(arg, start, size);
+}
+
+/*
+ * Add the part of rt that lies within [start, end) to clip.
+ */
+static void
+metaslab_range_clip(range_tree_t *rt, uint64_t start, uint64_t end,
+    range_tree_t *clip)
+{
+	uint64_t ostart, osize;
+
+	while (start < end &&
+	    range_tree_find_in(rt, start, end - start, &ostart, &osize)) {
+		range_tree_add(clip, ostart, osize);
+		start = ostart + osize;
+	}
+}
+
+/*
+ * Write the minimized form of [start, end) of the metaslab to
+ * ms_condense_sm, in the same way metaslab_condense() does for all of it.
+ */
+static void
+metaslab_condense_range(metaslab_t *msp, uint64_t start, uint64_t end,
+    uint64_t txg, dmu_tx_t *tx)
+{
+	range_tree_t *condense_tree, *free_tree;
+	int t;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	condense_tree = range_tree_create(NULL, NULL, &msp->ms_lock);
+	range_tree_add(condense_tree, start, end - start);
+
+	range_tree_walk(msp->ms_freeingtree, metaslab_condense_clear,
+	    condense_tree);
+	for (t = 0; t < TXG_DEFER_SIZE; t++) {
+		range_tree_walk(msp->ms_defertree[t],
+		    metaslab_condense_clear, condense_tree);
+	}
+	for (t = 1; t < TXG_CONCURRENT_STATES; t++) {
+		range_tree_walk(msp->ms_alloctree[(txg + t) & TXG_MASK],
+		    metaslab_condense_clear, condense_tree);
+	}
+	range_tree_walk(msp->ms_trimming, metaslab_condense_clear,
+	    condense_tree);
+
+	/*
+	 * Copy this range of ms_tree rather than setting ms_condensing,
+	 * so that allocations can go on while space_map_write() drops
+	 * ms_lock.
+	 */
+	free_tree = range_tree_create(NULL, NULL, &msp->ms_lock);
+	metaslab_range_clip(msp->ms_tree, start, end, free_tree);
+
+	space_map_write(msp->ms_condense_sm, condense_tree, SM_ALLOC, tx);
+	space_map_write(msp->ms_condense_sm, free_tree, SM_FREE, tx);
+
+	range_tree_vacate(condense_tree, NULL, NULL);
+	range_tree_destroy(condense_tree);
+	range_tree_vacate(free_tree, NULL, NULL);
+	range_tree_destroy(free_tree);
+}
+
+/*
+ * Bring ms_condense_sm up to date with this sync pass, after its changes
+ * have been written to ms_sm: append the ones below the cursor, and in
+ * pass 1 condense the next range.  Once all of the metaslab has been
+ * condensed the new space map, which now describes the same space as
+ * ms_sm, takes its place.
+ */
+static void
+metaslab_condense_sync(metaslab_t *msp, range_tree_t *alloctree,
+    uint64_t txg, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	space_map_t *sm = msp->ms_condense_sm;
+	space_map_t *osm = msp->ms_sm;
+	uint64_t ms_end = msp->ms_start + msp->ms_size;
+	uint64_t chunk, end, length;
+	range_tree_t *rt;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT(msp->ms_loaded);
+
+	rt = range_tree_create(NULL, NULL, &msp->ms_lock);
+	metaslab_range_clip(alloctree, msp->ms_start,
+	    msp->ms_condense_cursor, rt);
+	space_map_write(sm, rt, SM_ALLOC, tx);
+	range_tree_vacate(rt, NULL, NULL);
+	metaslab_range_clip(msp->ms_freeingtree, msp->ms_start,
+	    msp->ms_condense_cursor, rt);
+	space_map_write(sm, rt, SM_FREE, tx);
+	range_tree_vacate(rt, NULL, NULL);
+	range_tree_destroy(rt);
+
+	if (spa_sync_pass(vd->vdev_spa) != 1)
+		return;
+
+	chunk = MAX(P2ROUNDUP(msp->ms_size / MAX(zfs_condense_txgs, 1),
+	    1ULL << vd->vdev_ashift), 1ULL << vd->vdev_ashift);
+	end = MIN(msp->ms_condense_cursor + chunk, ms_end);
+	metaslab_condense_range(msp, msp->ms_condense_cursor, end, txg, tx);
+	msp->ms_condense_cursor = end;
+	MCSTAT_BUMP(mcs_txgs);
+
+	if (end < ms_end)
+		return;
+
+	/*
+	 * metaslab_sync_done() accounts for the change in allocated space
+	 * against the synced value of ms_sm, so carry the old one over.
+	 */
+	ASSERT3U(sm->sm_phys->smp_alloc, ==, osm->sm_phys->smp_alloc);
+	sm->sm_alloc = osm->sm_alloc;
+	length = osm->sm_phys->smp_objsize;
+	msp->ms_sm = sm;
+	msp->ms_condense_sm = NULL;
+	metaslab_condense_done(msp, length, sm->sm_phys->smp_objsize);
+
+	mutex_exit(&msp->ms_lock);
+	space_map_free(osm, tx);
+	space_map_close(osm);
+	metaslab_condense_unrecord(vd, msp->ms_id, tx);
+	mutex_enter(&msp->ms_lock);
+}
+
+/*
+ * Free the new space map of a condense that will not be finished: the
+ * one in progress on a vdev that is being removed, or one that an
+ * export or crash left behind (ms_condense_stale).
+ */
+void
+metaslab_condense_cancel(metaslab_t *msp, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	space_map_t *sm = msp->ms_condense_sm;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (sm == NULL && msp->ms_condense_stale != 0) {
+		VERIFY0(space_map_open(&sm, vd->vdev_spa->spa_meta_objset,
+		    msp->ms_condense_stale, msp->ms_start, msp->ms_size,
+		    vd->vdev_ashift, &msp->ms_lock));
+	}
+	if (sm == NULL)
+		return;
+
+	msp->ms_condense_sm = NULL;
+	msp->ms_condense_stale = 0;
+	space_map_free(sm, tx);
+	space_map_close(sm);
+	metaslab_condense_unrecord(vd, msp->ms_id, tx);
+}
+
+/*
+ * Whether the metaslab should write this txg's changes to its vdev's log
+ * space map.  Log devices and metaslabs that are about to be condensed or
+ * flushed use their own space map.
+ */
+static boolean_t
+metaslab_use_log(metaslab_t *msp)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	vdev_t *vd = mg->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+
+	return (spa_log_sm_enabled(spa) &&
+	    mg->mg_class != spa_log_class(spa) &&
+	    vd->vdev_top_zap != 0 && !vd->vdev_removing &&
+	    msp->ms_sm != NULL && !msp->ms_flush_wanted &&
+	    !msp->ms_condense_wanted && msp->ms_condense_sm == NULL);
+}
+
+/*
+ * Append this sync pass's changes to the vdev's log space map instead of
+ * to ms_sm.  The allocations are recorded as unflushed right away, the
+ * frees only by metaslab_sync_done(), once they are in a defer tree.
+ */
+static void
+metaslab_sync_log(metaslab_t *msp, range_tree_t *alloctree, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	space_map_t *log_sm;
+	boolean_t first = B_FALSE;
+
+	log_sm = vdev_log_sm_get(vd, tx);
+
+	mutex_enter(&msp->ms_lock);
+
+	space_map_write(log_sm, alloctree, SM_ALLOC, tx);
+	space_map_write(log_sm, msp->ms_freeingtree, SM_FREE, tx);
+	msp->ms_logged_delta += (int64_t)range_tree_space(alloctree) -
+	    (int64_t)range_tree_space(msp->ms_freeingtree);
+
+	range_tree_walk(alloctree, metaslab_unflushed_alloc, msp);
+
+	if (spa_sync_pass(spa) == 1) {
+		range_tree_swap(&msp->ms_freeingtree, &msp->ms_freedtree);
+	} else {
+		range_tree_vacate(msp->ms_freeingtree,
+		    range_tree_add, msp->ms_freedtree);
+	}
+	range_tree_vacate(alloctree, NULL, NULL);
+
+	if (msp->ms_unflushed_txg == 0) {
+		mutex_enter(&spa->spa_log_lock);
+		msp->ms_unflushed_txg = txg;
+		avl_add(&spa->spa_unflushed_ms, msp);
+		mutex_exit(&spa->spa_log_lock);
+		first = B_TRUE;
+	}
+
+	mutex_exit(&msp->ms_lock);
+
+	if (first)
+		vdev_log_set_unflushed_txg(vd, msp->ms_id, txg, tx);
 }
 
 /*
@@ -2203,6 +2924,8 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	range_tree_t *alloctree = msp->ms_alloctree[txg & TXG_MASK];
 	dmu_tx_t *tx;
 	uint64_t object = space_map_object(msp->ms_sm);
+	boolean_t flush = B_FALSE;
+	boolean_t condense;
 
 	ASSERT(!vd->vdev_ishole);
 
@@ -2221,13 +2944,29 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	/*
 	 * Normally, we don't want to process a metaslab if there
 	 * are no allocations or frees to perform. However, if the metaslab
-	 * is being forced to condense we need to let it through.
+	 * is being forced to condense or flush, or is in the middle of
+	 * condensing, we need to let it through.
 	 */
 	if (range_tree_space(alloctree) == 0 &&
 	    range_tree_space(msp->ms_freeingtree) == 0 &&
-	    !msp->ms_condense_wanted)
+	    !msp->ms_condense_wanted && !msp->ms_flush_wanted &&
+	    msp->ms_condense_sm == NULL)
 		return;
 
+	/*
+	 * Pick between the log and ms_sm on the first pass that syncs this
+	 * metaslab, and stick to it for the rest of the txg.  Flushing writes
+	 * the unflushed changes to ms_sm ahead of this txg's.
+	 */
+	if (msp->ms_logged_txg != txg && msp->ms_flushed_txg != txg) {
+		if (metaslab_use_log(msp)) {
+			msp->ms_logged_txg = txg;
+		} else {
+			msp->ms_flushed_txg = txg;
+			flush = (msp->ms_unflushed_txg != 0);
+		}
+	}
+
 	/*
 	 * The only state that can actually be changing concurrently with
 	 * metaslab_sync() is the metaslab's ms_tree.  No other thread can
@@ -2240,6 +2979,12 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	tx = dmu_tx_create_assigned(spa_get_dsl(spa), txg);
 
+	if (msp->ms_logged_txg == txg) {
+		metaslab_sync_log(msp, alloctree, tx);
+		dmu_tx_commit(tx);
+		return;
+	}
+
 	if (msp->ms_sm == NULL) {
 		uint64_t new_object;
 
@@ -2254,6 +2999,9 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	mutex_enter(&msp->ms_lock);
 
+	if (msp->ms_condense_stale != 0)
+		metaslab_condense_cancel(msp, tx);
+
 	/*
 	 * Note: metaslab_condense() clears the space map's histogram.
 	 * Therefore we muse verify and remove this histogram before
@@ -2263,12 +3011,34 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	metaslab_class_histogram_verify(mg->mg_class);
 	metaslab_group_histogram_remove(mg, msp);
 
-	if (msp->ms_loaded && spa_sync_pass(spa) == 1 &&
-	    metaslab_should_condense(msp)) {
+	/*
+	 * The unflushed changes are about to be part of ms_sm, so they no
+	 * longer change the vdev's allocated space when this txg is done.
+	 * Condensing writes them out as part of ms_tree.
+	 */
+	if (flush) {
+		msp->ms_logged_delta -=
+		    (int64_t)range_tree_space(msp->ms_unflushed_allocs) -
+		    (int64_t)range_tree_space(msp->ms_unflushed_frees);
+	}
+
+	condense = (msp->ms_loaded && spa_sync_pass(spa) == 1 &&
+	    msp->ms_condense_sm == NULL && metaslab_should_condense(msp));
+	if (condense && (zfs_condense_txgs <= 1 || vd->vdev_top_zap == 0)) {
 		metaslab_condense(msp, txg, tx);
 	} else {
+		if (condense)
+			metaslab_condense_start(msp, txg, tx);
+		if (flush) {
+			space_map_write(msp->ms_sm, msp->ms_unflushed_allocs,
+			    SM_ALLOC, tx);
+			space_map_write(msp->ms_sm, msp->ms_unflushed_frees,
+			    SM_FREE, tx);
+		}
 		space_map_write(msp->ms_sm, alloctree, SM_ALLOC, tx);
 		space_map_write(msp->ms_sm, msp->ms_freeingtree, SM_FREE, tx);
+		if (msp->ms_condense_sm != NULL)
+			metaslab_condense_sync(msp, alloctree, txg, tx);
 	}
 
 	if (msp->ms_loaded) {
@@ -2301,6 +3071,9 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 			space_map_histogram_add(msp->ms_sm,
 			    msp->ms_defertree[t], tx);
 		}
+	} else if (flush) {
+		space_map_histogram_add(msp->ms_sm,
+		    msp->ms_unflushed_frees, tx);
 	}
 
 	/*
@@ -2336,6 +3109,9 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	mutex_exit(&msp->ms_lock);
 
+	if (flush)
+		vdev_log_set_unflushed_txg(vd, msp->ms_id, 0, tx);
+
 	if (object != space_map_object(msp->ms_sm)) {
 		object = space_map_object(msp->ms_sm);
 		dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
@@ -2348,6 +3124,19 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
  * Called after a transaction group has completely synced to mark
  * all of the metaslab's free space as usable.
  */
+/*
+ * Return freed space to the allocator and mark it as needing to be
+ * unmapped.  A range_tree_vacate() callback for metaslab_sync_done().
+ */
+static void
+metaslab_trim_add(void *arg, uint64_t offset, uint64_t size)
+{
+	metaslab_t *msp = arg;
+
+	range_tree_add(msp->ms_tree, offset, size);
+	range_tree_add(msp->ms_trimtree, offset, size);
+}
+
 void
 metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 {
@@ -2402,7 +3191,8 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	defer_delta = 0;
-	alloc_delta = space_map_alloc_delta(msp->ms_sm);
+	alloc_delta = space_map_alloc_delta(msp->ms_sm) + msp->ms_logged_delta;
+	msp->ms_logged_delta = 0;
 	if (defer_allowed) {
 		defer_delta = range_tree_space(msp->ms_freedtree) -
 		    range_tree_space(*defer_tree);
@@ -2418,16 +3208,40 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 */
 	metaslab_load_wait(msp);
 
+	/*
+	 * Bring the unflushed trees up to date with this txg: a metaslab
+	 * that logged adds its frees, one that flushed starts over.
+	 */
+	if (msp->ms_logged_txg == txg) {
+		range_tree_walk(msp->ms_freedtree,
+		    metaslab_unflushed_free, msp);
+	} else if (msp->ms_flushed_txg == txg && msp->ms_unflushed_txg != 0) {
+		range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+		range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+
+		mutex_enter(&spa->spa_log_lock);
+		avl_remove(&spa->spa_unflushed_ms, msp);
+		mutex_exit(&spa->spa_log_lock);
+		msp->ms_unflushed_txg = 0;
+	}
+	msp->ms_flush_wanted = B_FALSE;
+
 	/*
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and the
 	 * defer_tree -- this is safe to do because we've just emptied out
 	 * the defer_tree.
 	 */
-	range_tree_vacate(*defer_tree,
-	    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
+	if (msp->ms_loaded && spa->spa_autotrim) {
+		range_tree_vacate(*defer_tree, metaslab_trim_add, msp);
+	} else {
+		range_tree_vacate(*defer_tree,
+		    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
+	}
 	if (defer_allowed) {
 		range_tree_swap(&msp->ms_freedtree, defer_tree);
+	} else if (msp->ms_loaded && spa->spa_autotrim) {
+		range_tree_vacate(msp->ms_freedtree, metaslab_trim_add, msp);
 	} else {
 		range_tree_vacate(msp->ms_freedtree,
 		    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
@@ -2438,10 +3252,10 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
 	ASSERT3S(msp->ms_deferspace, <=, msp->ms_size);
-	if (msp->ms_deferspace != 0) {
+	if (msp->ms_deferspace != 0 || msp->ms_condense_sm != NULL) {
 		/*
 		 * Keep syncing this metaslab until all deferred frees
-		 * are back in circulation.
+		 * are back in circulation, and until it is condensed.
 		 */
 		vdev_dirty(vd, VDD_METASLAB, msp, txg + 1);
 	}
@@ -2454,10 +3268,13 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 
 	/*
 	 * If the metaslab is loaded and we've not tried to load or allocate
-	 * from it in 'metaslab_unload_delay' txgs, then unload it.
+	 * from it in 'metaslab_unload_delay' txgs, then unload it.  With
+	 * autotrim on, space that is still waiting to be unmapped keeps
+	 * it loaded, as does condensing it.
 	 */
-	if (msp->ms_loaded &&
-	    msp->ms_selected_txg + metaslab_unload_delay < txg) {
+	if (msp->ms_loaded && msp->ms_condense_sm == NULL &&
+	    msp->ms_selected_txg + metaslab_unload_delay < txg &&
+	    (!spa->spa_autotrim || range_tree_space(msp->ms_trimtree) == 0)) {
 		for (t = 1; t < TXG_CONCURRENT_STATES; t++) {
 			VERIFY0(range_tree_space(
 			    msp->ms_alloctree[(txg + t) & TXG_MASK]));
@@ -2470,11 +3287,285 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	mutex_exit(&msp->ms_lock);
 }
 
+/*
+ * ==========================================================================
+ * TRIM support
+ * ==========================================================================
+ *
+ * vdev_trim unmaps a metaslab's free space in batches: it takes segments
+ * out of ms_trimtree with metaslab_trim_take(), which holds them out of
+ * the allocator in ms_trimming while the ioctls are outstanding, and
+ * gives them back with metaslab_trim_done().  All three functions are
+ * called with ms_lock held.
+ */
+
+/*
+ * Queue all of the metaslab's free space for unmapping, loading it
+ * first if necessary.  *loadedp is set if it was loaded here, in which
+ * case the caller should hand it to metaslab_trim_done() with
+ * unload set once it is done with it.
+ */
+int
+metaslab_trim_all(metaslab_t *msp, boolean_t *loadedp)
+{
+	int error;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	*loadedp = B_FALSE;
+
+	/* don't bother with space that isn't in circulation yet */
+	if (msp->ms_freedtree == NULL)
+		return (SET_ERROR(EAGAIN));
+
+	metaslab_load_wait(msp);
+	if (!msp->ms_loaded) {
+		error = metaslab_load(msp);
+		if (error != 0)
+			return (error);
+		*loadedp = B_TRUE;
+	}
+	msp->ms_selected_txg = spa_syncing_txg(msp->ms_group->mg_vd->vdev_spa);
+
+	range_tree_vacate(msp->ms_trimtree, NULL, NULL);
+	range_tree_walk(msp->ms_tree, range_tree_add, msp->ms_trimtree);
+
+	return (0);
+}
+
+/*
+ * Move up to maxsegs segments of the space queued for unmapping from the
+ * allocator to ms_trimming and return them in segs.  Segments larger
+ * than max are split; those smaller than min are not worth an ioctl and
+ * are dropped.  Returns the number of segments taken, which is 0 once
+ * ms_trimtree is empty.
+ */
+int
+metaslab_trim_take(metaslab_t *msp, range_seg_t *segs, int maxsegs,
+    uint64_t min, uint64_t max)
+{
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+	uint64_t first, done;
+	int i, n = 0;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3U(max, >, 0);
+
+	/* ms_tree can't change while it is being written out */
+	if (!msp->ms_loaded || msp->ms_condensing)
+		return (0);
+
+	rs = zfs_btree_first(&msp->ms_trimtree->rt_root, &where);
+	if (rs == NULL)
+		return (0);
+
+	first = done = rs->rs_start;
+	while (rs != NULL && n < maxsegs) {
+		uint64_t start = rs->rs_start;
+		uint64_t end = rs->rs_end;
+
+		while (start < end && n < maxsegs) {
+			uint64_t len = MIN(end - start, max);
+
+			if (len >= min) {
+				segs[n].rs_start = start;
+				segs[n].rs_end = start + len;
+				n++;
+			}
+			start += len;
+		}
+		done = start;
+		rs = zfs_btree_next(&msp->ms_trimtree->rt_root, &where, &where);
+	}
+
+	range_tree_clear(msp->ms_trimtree, first, done - first);
+	for (i = 0; i < n; i++) {
+		uint64_t size = segs[i].rs_end - segs[i].rs_start;
+
+		range_tree_remove(msp->ms_tree, segs[i].rs_start, size);
+		range_tree_add(msp->ms_trimming, segs[i].rs_start, size);
+	}
+	msp->ms_max_size = metaslab_block_maxsize(msp);
+
+	return (n);
+}
+
+/*
+ * Return the space taken by metaslab_trim_take() to the allocator.  If
+ * unload is set and nothing has started using the metaslab since
+ * metaslab_trim_all() loaded it, it is unloaded again, dropping whatever
+ * is still queued for unmapping.
+ */
+void
+metaslab_trim_done(metaslab_t *msp, boolean_t unload)
+{
+	int t;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	/* metaslab_condense() drops ms_lock while ms_tree is frozen */
+	while (msp->ms_condensing) {
+		mutex_exit(&msp->ms_lock);
+		delay(1);
+		mutex_enter(&msp->ms_lock);
+	}
+
+	if (msp->ms_loaded) {
+		range_tree_vacate(msp->ms_trimming, range_tree_add,
+		    msp->ms_tree);
+		msp->ms_max_size = metaslab_block_maxsize(msp);
+	} else {
+		range_tree_vacate(msp->ms_trimming, NULL, NULL);
+	}
+
+	if (!unload || !msp->ms_loaded || msp->ms_condense_sm != NULL ||
+	    (msp->ms_weight & METASLAB_ACTIVE_MASK))
+		return;
+
+	for (t = 0; t < TXG_SIZE; t++) {
+		if (range_tree_space(msp->ms_alloctree[t]) != 0)
+			return;
+	}
+
+	if (!metaslab_debug_unload)
+		metaslab_unload(msp);
+	else
+		range_tree_vacate(msp->ms_trimtree, NULL, NULL);
+}
+
+static spa_alloc_class_t
+metaslab_class_stat_index(metaslab_class_t *mc)
+{
+	if (mc == spa_log_class(mc->mc_spa))
+		return (SPA_ALLOC_CLASS_LOG);
+	if (mc == spa_special_class(mc->mc_spa))
+		return (SPA_ALLOC_CLASS_SPECIAL);
+	if (mc == spa_dedup_class(mc->mc_spa))
+		return (SPA_ALLOC_CLASS_DEDUP);
+	return (SPA_ALLOC_CLASS_NORMAL);
+}
+
+/*
+ * Pick the block allocator a metaslab group uses in the next txg.  The
+ * dynamic fit allocator is cheap while metaslabs have large free segments,
+ * but once they are nearly full or fragmented it falls back to walking
+ * the size sorted tree for a best fit.  The new dynamic fit allocator
+ * finds a segment with a single lookup in that tree instead, so groups
+ * that are full, fragmented or allocating slowly are switched to it.
+ */
+static void
+metaslab_group_select_allocator(metaslab_group_t *mg)
+{
+	metaslab_class_t *mc = mg->mg_class;
+	uint64_t txg = spa_syncing_txg(mc->mc_spa);
+	uint64_t frag = mg->mg_fragmentation;
+	uint64_t count, nsecs;
+	metaslab_allocator_t allocator;
+	boolean_t full, fragmented, slow;
+
+	count = atomic_swap_64(&mg->mg_alloc_count, 0);
+	nsecs = atomic_swap_64(&mg->mg_alloc_nsecs, 0);
+
+	if (!metaslab_adaptive_alloc)
+		return;
+
+	if (mg->mg_allocator == METASLAB_ALLOCATOR_NDF) {
+		full = (mg->mg_free_capacity <
+		    metaslab_adaptive_free_pct + METASLAB_ADAPTIVE_MARGIN);
+		fragmented = (frag != ZFS_FRAG_INVALID &&
+		    frag + METASLAB_ADAPTIVE_MARGIN > metaslab_adaptive_frag_pct);
+		slow = (txg < mg->mg_allocator_hold_txg);
+	} else {
+		full = (mg->mg_free_capacity < metaslab_adaptive_free_pct);
+		fragmented = (frag != ZFS_FRAG_INVALID &&
+		    frag >= metaslab_adaptive_frag_pct);
+		slow = (metaslab_adaptive_latency_ns != 0 &&
+		    count >= METASLAB_ADAPTIVE_MIN_ALLOCS &&
+		    nsecs / count > metaslab_adaptive_latency_ns);
+		if (slow)
+			mg->mg_allocator_hold_txg =
+			    txg + METASLAB_ADAPTIVE_HOLD_TXGS;
+	}
+
+	allocator = (full || fragmented || slow) ?
+	    METASLAB_ALLOCATOR_NDF : METASLAB_ALLOCATOR_DF;
+	if (allocator != mg->mg_allocator) {
+		mg->mg_allocator = allocator;
+		spa_metaslab_alloc_switch(mc->mc_spa,
+		    metaslab_class_stat_index(mc));
+	}
+}
+
+/*
+ * Fold the completion latency of the writes to the group's vdev since the
+ * last update, summed by vdev_stat_update(), into mg_write_latency.
+ */
+static void
+metaslab_group_latency_update(metaslab_group_t *mg)
+{
+	vdev_t *vd = mg->mg_vd;
+	uint64_t count, nsecs, latency;
+
+	if (vd->vdev_write_count < METASLAB_LATENCY_MIN_WRITES)
+		return;
+
+	count = atomic_swap_64(&vd->vdev_write_count, 0);
+	nsecs = atomic_swap_64(&vd->vdev_write_nsecs, 0);
+	if (count == 0)
+		return;
+
+	latency = nsecs / count;
+	if (mg->mg_write_latency == 0) {
+		mg->mg_write_latency = latency;
+	} else {
+		mg->mg_write_latency = (mg->mg_write_latency *
+		    (METASLAB_LATENCY_WEIGHT - 1) + latency) /
+		    METASLAB_LATENCY_WEIGHT;
+	}
+}
+
+/*
+ * Return how much more or less than its aliquot should be allocated from
+ * this group in a pass around the rotor because of its write latency.
+ * The group's share is scaled by the average write latency of the groups
+ * of its class over its own, within metaslab_latency_bias_pct percent
+ * either way.  Groups without a latency average yet are left alone.
+ */
+static int64_t
+metaslab_group_latency_bias(metaslab_group_t *mg)
+{
+	metaslab_group_t *mgp = mg;
+	uint64_t sum = 0, groups = 0;
+	int64_t pct = MIN(MAX(metaslab_latency_bias_pct, 0), 100);
+	int64_t ratio;
+
+	if (pct == 0 || mg->mg_write_latency == 0 || mg->mg_next == mg) {
+		mg->mg_latency_pct = 100;
+		return (0);
+	}
+
+	do {
+		if (mgp->mg_write_latency != 0) {
+			sum += mgp->mg_write_latency;
+			groups++;
+		}
+	} while ((mgp = mgp->mg_next) != mg);
+
+	ratio = (int64_t)((sum * 100) / (groups * mg->mg_write_latency));
+	ratio = MIN(MAX(ratio, 100 - pct), 100 + pct);
+	mg->mg_latency_pct = ratio;
+
+	return (((ratio - 100) * (int64_t)mg->mg_aliquot) / 100);
+}
+
 void
 metaslab_sync_reassess(metaslab_group_t *mg)
 {
 	metaslab_group_alloc_update(mg);
 	mg->mg_fragmentation = metaslab_group_fragmentation(mg);
+	metaslab_group_select_allocator(mg);
+	metaslab_group_latency_update(mg);
 
 	/*
 	 * Preload the next potential metaslabs
@@ -2524,6 +3615,28 @@ metaslab_alloc_trace_init(void)
 	}
 }
 
+void
+metaslab_stat_init(void)
+{
+	metaslab_condense_ksp = kstat_create("zfs", 0,
+	    "metaslab_condense_stats", "misc", KSTAT_TYPE_NAMED,
+	    sizeof (metaslab_condense_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (metaslab_condense_ksp != NULL) {
+		metaslab_condense_ksp->ks_data = &metaslab_condense_stats;
+		kstat_install(metaslab_condense_ksp);
+	}
+}
+
+void
+metaslab_stat_fini(void)
+{
+	if (metaslab_condense_ksp != NULL) {
+		kstat_delete(metaslab_condense_ksp);
+		metaslab_condense_ksp = NULL;
+	}
+}
+
 void
 metaslab_alloc_trace_fini(void)
 {
@@ -2655,24 +3768,64 @@ metaslab_group_alloc_verify(spa_t *spa, const blkptr_t *bp, void *tag)
 #endif
 }
 
+/*
+ * Account an msop_alloc call in the pool's per-class statistics and in
+ * the group's running latency average.
+ */
+static void
+metaslab_alloc_latency_add(metaslab_group_t *mg, metaslab_allocator_t type,
+    uint64_t nsecs)
+{
+	metaslab_class_t *mc = mg->mg_class;
+
+	spa_metaslab_alloc_add(mc->mc_spa, metaslab_class_stat_index(mc),
+	    type, nsecs);
+	atomic_inc_64(&mg->mg_alloc_count);
+	atomic_add_64(&mg->mg_alloc_nsecs, nsecs);
+}
+
 static uint64_t
 metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 {
 	uint64_t start;
 	range_tree_t *rt = msp->ms_tree;
-	metaslab_class_t *mc = msp->ms_group->mg_class;
+	metaslab_group_t *mg = msp->ms_group;
+	metaslab_class_t *mc = mg->mg_class;
+	metaslab_ops_t *ops;
+	hrtime_t alloc_start;
 
 	VERIFY(!msp->ms_condensing);
 
-	start = mc->mc_ops->msop_alloc(msp, size);
+	/*
+	 * A class given private ops (e.g. by zdb) keeps them, and
+	 * sequential vdevs always use the sequential allocator.
+	 */
+	if (mg->mg_vd->vdev_sequential)
+		ops = &metaslab_seq_ops;
+	else if (metaslab_adaptive_alloc && mc->mc_ops == zfs_metaslab_ops)
+		ops = metaslab_allocators[mg->mg_allocator];
+	else
+		ops = mc->mc_ops;
+
+	/* each allocator keeps its own kind of cursors in ms_lbas */
+	if (msp->ms_allocator != ops->msop_type) {
+		bzero(msp->ms_lbas, sizeof (msp->ms_lbas));
+		msp->ms_allocator = ops->msop_type;
+	}
+
+	alloc_start = gethrtime();
+	start = ops->msop_alloc(msp, size);
+	metaslab_alloc_latency_add(mg, ops->msop_type,
+	    gethrtime() - alloc_start);
+
 	if (start != -1ULL) {
-		metaslab_group_t *mg = msp->ms_group;
 		vdev_t *vd = mg->mg_vd;
 
 		VERIFY0(P2PHASE(start, 1ULL << vd->vdev_ashift));
 		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 		VERIFY3U(range_tree_space(rt) - size, <=, msp->ms_size);
 		range_tree_remove(rt, start, size);
+		range_tree_clear(msp->ms_trimtree, start, size);
 
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
 			vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
@@ -2694,7 +3847,8 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 
 static uint64_t
 metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
-    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d)
+    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d,
+    boolean_t log)
 {
 	metaslab_t *msp = NULL;
 	uint64_t offset = -1ULL;
@@ -2739,6 +3893,13 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			msp = avl_nearest(t, idx, AVL_AFTER);
 		for (; msp != NULL; msp = AVL_NEXT(t, msp)) {
 
+			/*
+			 * Only allocate log blocks from the embedded log,
+			 * and everything else from the other metaslabs.
+			 */
+			if (msp->ms_embedded_log != log)
+				continue;
+
 			if (!metaslab_should_allocate(msp, asize)) {
 				metaslab_trace_add(zal, mg, msp, asize, d,
 				    TRACE_TOO_SMALL);
@@ -2756,7 +3917,7 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 				break;
 
 			target_distance = min_distance +
-			    (space_map_allocated(msp->ms_sm) != 0 ? 0 :
+			    (metaslab_allocated_space(msp) != 0 ? 0 :
 			    min_distance >> 1);
 
 			for (i = 0; i < d; i++) {
@@ -2887,13 +4048,24 @@ next:
 
 static uint64_t
 metaslab_group_alloc(metaslab_group_t *mg, zio_alloc_list_t *zal,
-    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d)
+    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d,
+    int flags)
 {
 	uint64_t offset;
+	boolean_t log;
 	ASSERT(mg->mg_initialized);
 
+	/*
+	 * Try the metaslabs meant for this kind of block first, then,
+	 * if the group has an embedded log, the others.
+	 */
+	log = (flags & METASLAB_ZIL) && mg->mg_log_count != 0;
 	offset = metaslab_group_alloc_normal(mg, zal, asize, txg,
-	    min_distance, dva, d);
+	    min_distance, dva, d, log);
+	if (offset == -1ULL && mg->mg_log_count != 0) {
+		offset = metaslab_group_alloc_normal(mg, zal, asize, txg,
+		    min_distance, dva, d, !log);
+	}
 
 	mutex_enter(&mg->mg_lock);
 	if (offset == -1ULL) {
@@ -3086,7 +4258,7 @@ top:
 		ASSERT(P2PHASE(asize, 1ULL << vd->vdev_ashift) == 0);
 
 		uint64_t offset = metaslab_group_alloc(mg, zal, asize, txg,
-		    distance, dva, d);
+		    distance, dva, d, flags);
 
 		if (offset != -1ULL) {
 			/*
@@ -3096,8 +4268,13 @@ top:
 			 * and set an allocation bias to even it out.
 			 *
 			 * Bias is also used to compensate for unequally
-			 * sized vdevs so that space is allocated fairly.
+			 * sized vdevs so that space is allocated fairly,
+			 * and to send less to vdevs that write slowly.
 			 */
+			if (mc->mc_aliquot == 0) {
+				mg->mg_latency_bias =
+				    metaslab_group_latency_bias(mg);
+			}
 			if (mc->mc_aliquot == 0 && metaslab_bias_enabled) {
 				vdev_stat_t *vs = &vd->vdev_stat;
 				int64_t vs_free = vs->vs_space - vs->vs_alloc;
@@ -3130,10 +4307,12 @@ top:
 				ratio = (vs_free * mc->mc_alloc_groups * 100) /
 				    (mc_free + 1);
 				mg->mg_bias = ((ratio - 100) *
-				    (int64_t)mg->mg_aliquot) / 100;
+				    (int64_t)mg->mg_aliquot) / 100 +
+				    mg->mg_latency_bias;
 			} else if (!metaslab_bias_enabled) {
-				mg->mg_bias = 0;
+				mg->mg_bias = mg->mg_latency_bias;
 			}
+			atomic_add_64(&mg->mg_alloc_bytes, asize);
 
 			if ((flags & METASLAB_FASTWRITE) ||
 			    atomic_add_64_nv(&mc->mc_aliquot, asize) >=
@@ -3276,6 +4455,7 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 	VERIFY3U(range_tree_space(msp->ms_tree) - size, <=, msp->ms_size);
 	range_tree_remove(msp->ms_tree, offset, size);
+	range_tree_clear(msp->ms_trimtree, offset, size);
 
 	if (spa_writeable(spa)) {	/* don't dirty if we're zdb(1M) */
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
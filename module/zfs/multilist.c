@@ -275,6 +275,54 @@ multilist_get_random_index(multilist_t *ml)
 	return (spa_get_random(ml->ml_num_sublists));
 }
 
+/*
+ * Return the sublist index the current CPU is mapped to.  CPUs are
+ * spread over the sublists in contiguous ranges, so that when there are
+ * fewer sublists than CPUs, a sublist is shared by neighbouring CPUs
+ * (which usually sit on the same package) rather than by CPUs strided
+ * across all of them.  Index functions that use it must remember the
+ * index they handed out, as it won't be the same on removal.
+ */
+unsigned int
+multilist_get_cpu_index(multilist_t *ml)
+{
+	return ((CPU_SEQID % max_ncpus) * ml->ml_num_sublists / max_ncpus);
+}
+
+/*
+ * Return the number of objects on the given sublist.  This is read
+ * without the sublist lock, and so is only a snapshot.
+ */
+uint64_t
+multilist_get_sublist_count(multilist_t *ml, unsigned int sublist_idx)
+{
+	ASSERT3U(sublist_idx, <, ml->ml_num_sublists);
+	return (ml->ml_sublists[sublist_idx].mls_count);
+}
+
+/*
+ * Return the length of the longest sublist as a percentage of the mean
+ * sublist length; 100 for evenly filled sublists, and 0 when empty.
+ * Like multilist_get_sublist_count(), this doesn't take any locks.
+ */
+uint64_t
+multilist_get_skew(multilist_t *ml)
+{
+	uint64_t total = 0;
+	uint64_t max = 0;
+
+	for (int i = 0; i < ml->ml_num_sublists; i++) {
+		uint64_t count = ml->ml_sublists[i].mls_count;
+
+		total += count;
+		max = MAX(max, count);
+	}
+
+	if (total == 0)
+		return (0);
+	return (max * 100 * ml->ml_num_sublists / total);
+}
+
 /* Lock and return the sublist specified at the given index */
 multilist_sublist_t *
 multilist_sublist_lock(multilist_t *ml, unsigned int sublist_idx)
@@ -315,6 +363,7 @@ multilist_sublist_insert_head(multilist_sublist_t *mls, void *obj)
 {
 	ASSERT(MUTEX_HELD(&mls->mls_lock));
 	list_insert_head(&mls->mls_list, obj);
+	mls->mls_count++;
 }
 
 /* please see comment above multilist_sublist_insert_head */
@@ -323,6 +372,7 @@ multilist_sublist_insert_tail(multilist_sublist_t *mls, void *obj)
 {
 	ASSERT(MUTEX_HELD(&mls->mls_lock));
 	list_insert_tail(&mls->mls_list, obj);
+	mls->mls_count++;
 }
 
 /*
@@ -358,7 +408,9 @@ void
 multilist_sublist_remove(multilist_sublist_t *mls, void *obj)
 {
 	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	ASSERT3U(mls->mls_count, >, 0);
 	list_remove(&mls->mls_list, obj);
+	mls->mls_count--;
 }
 
 void *
@@ -124,18 +124,25 @@ refcount_count(refcount_t *rc)
 int64_t
 refcount_add_many(refcount_t *rc, uint64_t number, void *holder)
 {
-	reference_t *ref = NULL;
+	reference_t *ref;
 	int64_t count;
 
-	if (rc->rc_tracked) {
-		ref = kmem_cache_alloc(reference_cache, KM_SLEEP);
-		ref->ref_holder = holder;
-		ref->ref_number = number;
+	/*
+	 * Untracked counts have no list to keep in step with the count, so
+	 * update them atomically like production builds do.
+	 */
+	if (!rc->rc_tracked) {
+		count = atomic_add_64_nv(&rc->rc_count, number);
+		ASSERT3S(count, >=, (int64_t)number);
+		return (count);
 	}
+
+	ref = kmem_cache_alloc(reference_cache, KM_SLEEP);
+	ref->ref_holder = holder;
+	ref->ref_number = number;
 	mutex_enter(&rc->rc_mtx);
 	ASSERT(rc->rc_count >= 0);
-	if (rc->rc_tracked)
-		list_insert_head(&rc->rc_list, ref);
+	list_insert_head(&rc->rc_list, ref);
 	rc->rc_count += number;
 	count = rc->rc_count;
 	mutex_exit(&rc->rc_mtx);
@@ -155,16 +162,15 @@ refcount_remove_many(refcount_t *rc, uint64_t number, void *holder)
 	reference_t *ref;
 	int64_t count;
 
-	mutex_enter(&rc->rc_mtx);
-	ASSERT(rc->rc_count >= number);
-
 	if (!rc->rc_tracked) {
-		rc->rc_count -= number;
-		count = rc->rc_count;
-		mutex_exit(&rc->rc_mtx);
+		count = atomic_add_64_nv(&rc->rc_count, -number);
+		ASSERT3S(count, >=, 0);
 		return (count);
 	}
 
+	mutex_enter(&rc->rc_mtx);
+	ASSERT(rc->rc_count >= number);
+
 	for (ref = list_head(&rc->rc_list); ref;
 	    ref = list_next(&rc->rc_list, ref)) {
 		if (ref->ref_holder == holder && ref->ref_number == number) {
@@ -217,14 +223,14 @@ refcount_transfer(refcount_t *dst, refcount_t *src)
 	mutex_enter(&src->rc_mtx);
 	count = src->rc_count;
 	removed_count = src->rc_removed_count;
-	src->rc_count = 0;
+	atomic_add_64(&src->rc_count, -count);
 	src->rc_removed_count = 0;
 	list_move_tail(&list, &src->rc_list);
 	list_move_tail(&removed, &src->rc_removed);
 	mutex_exit(&src->rc_mtx);
 
 	mutex_enter(&dst->rc_mtx);
-	dst->rc_count += count;
+	atomic_add_64(&dst->rc_count, count);
 	dst->rc_removed_count += removed_count;
 	list_move_tail(&dst->rc_list, &list);
 	list_move_tail(&dst->rc_removed, &removed);
@@ -269,12 +275,10 @@ refcount_held(refcount_t *rc, void *holder)
 {
 	reference_t *ref;
 
-	mutex_enter(&rc->rc_mtx);
-
-	if (!rc->rc_tracked) {
-		mutex_exit(&rc->rc_mtx);
+	if (!rc->rc_tracked)
 		return (rc->rc_count > 0);
-	}
+
+	mutex_enter(&rc->rc_mtx);
 
 	for (ref = list_head(&rc->rc_list); ref;
 	    ref = list_next(&rc->rc_list, ref)) {
@@ -297,12 +301,10 @@ refcount_not_held(refcount_t *rc, void *holder)
 {
 	reference_t *ref;
 
-	mutex_enter(&rc->rc_mtx);
-
-	if (!rc->rc_tracked) {
-		mutex_exit(&rc->rc_mtx);
+	if (!rc->rc_tracked)
 		return (B_TRUE);
-	}
+
+	mutex_enter(&rc->rc_mtx);
 
 	for (ref = list_head(&rc->rc_list); ref;
 	    ref = list_next(&rc->rc_list, ref)) {
@@ -315,3 +317,60 @@ refcount_not_held(refcount_t *rc, void *holder)
 	return (B_TRUE);
 }
 #endif	/* ZFS_DEBUG */
+
+void
+refcount_percpu_create(refcount_percpu_t *rcp)
+{
+	rcp->rcp_nshards = MIN(max_ncpus, REFCOUNT_PERCPU_SHARDS);
+	rcp->rcp_shards = kmem_zalloc(rcp->rcp_nshards *
+	    sizeof (refcount_percpu_shard_t), KM_SLEEP);
+}
+
+void
+refcount_percpu_destroy(refcount_percpu_t *rcp)
+{
+	ASSERT(refcount_percpu_is_zero(rcp));
+	kmem_free(rcp->rcp_shards,
+	    rcp->rcp_nshards * sizeof (refcount_percpu_shard_t));
+	rcp->rcp_shards = NULL;
+}
+
+void
+refcount_percpu_add(refcount_percpu_t *rcp, void *holder)
+{
+	atomic_inc_64(&rcp->rcp_shards[CPU_SEQID % rcp->rcp_nshards].rcps_adds);
+}
+
+void
+refcount_percpu_remove(refcount_percpu_t *rcp, void *holder)
+{
+	atomic_inc_64(
+	    &rcp->rcp_shards[CPU_SEQID % rcp->rcp_nshards].rcps_removes);
+}
+
+/*
+ * Both counters only grow, so releases read before holds can only be
+ * fewer, and holds read after them only more, than at the point between
+ * the two passes.
+ */
+int64_t
+refcount_percpu_count(refcount_percpu_t *rcp)
+{
+	uint64_t adds = 0, removes = 0;
+	int i;
+
+	for (i = 0; i < rcp->rcp_nshards; i++)
+		removes += rcp->rcp_shards[i].rcps_removes;
+	membar_consumer();
+	for (i = 0; i < rcp->rcp_nshards; i++)
+		adds += rcp->rcp_shards[i].rcps_adds;
+
+	ASSERT3U(adds, >=, removes);
+	return ((int64_t)(adds - removes));
+}
+
+boolean_t
+refcount_percpu_is_zero(refcount_percpu_t *rcp)
+{
+	return (refcount_percpu_count(rcp) == 0);
+}
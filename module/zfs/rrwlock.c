@@ -382,7 +382,7 @@ rrm_init(rrmlock_t *rrl, boolean_t track_all)
 	int i;
 
 	for (i = 0; i < RRM_NUM_LOCKS; i++)
-		rrw_init(&rrl->locks[i], track_all);
+		rrw_init(&rrl->locks[i].rms_lock, track_all);
 }
 
 void
@@ -391,7 +391,7 @@ rrm_destroy(rrmlock_t *rrl)
 	int i;
 
 	for (i = 0; i < RRM_NUM_LOCKS; i++)
-		rrw_destroy(&rrl->locks[i]);
+		rrw_destroy(&rrl->locks[i].rms_lock);
 }
 
 void
@@ -416,7 +416,7 @@ rrm_enter(rrmlock_t *rrl, krw_t rw, void *tag)
 void
 rrm_enter_read(rrmlock_t *rrl, void *tag)
 {
-	rrw_enter_read(&rrl->locks[RRM_TD_LOCK()], tag);
+	rrw_enter_read(&rrl->locks[RRM_TD_LOCK()].rms_lock, tag);
 }
 
 void
@@ -425,7 +425,7 @@ rrm_enter_write(rrmlock_t *rrl)
 	int i;
 
 	for (i = 0; i < RRM_NUM_LOCKS; i++)
-		rrw_enter_write(&rrl->locks[i]);
+		rrw_enter_write(&rrl->locks[i].rms_lock);
 }
 
 void
@@ -433,11 +433,11 @@ rrm_exit(rrmlock_t *rrl, void *tag)
 {
 	int i;
 
-	if (rrl->locks[0].rr_writer == curthread) {
+	if (rrl->locks[0].rms_lock.rr_writer == curthread) {
 		for (i = 0; i < RRM_NUM_LOCKS; i++)
-			rrw_exit(&rrl->locks[i], tag);
+			rrw_exit(&rrl->locks[i].rms_lock, tag);
 	} else {
-		rrw_exit(&rrl->locks[RRM_TD_LOCK()], tag);
+		rrw_exit(&rrl->locks[RRM_TD_LOCK()].rms_lock, tag);
 	}
 }
 
@@ -445,8 +445,8 @@ boolean_t
 rrm_held(rrmlock_t *rrl, krw_t rw)
 {
 	if (rw == RW_WRITER) {
-		return (rrw_held(&rrl->locks[0], rw));
+		return (rrw_held(&rrl->locks[0].rms_lock, rw));
 	} else {
-		return (rrw_held(&rrl->locks[RRM_TD_LOCK()], rw));
+		return (rrw_held(&rrl->locks[RRM_TD_LOCK()].rms_lock, rw));
 	}
 }
@@ -312,6 +312,42 @@ sa_get_spill(sa_handle_t *hdl)
 	return (rc);
 }
 
+/*
+ * Lookup fast path for the common case of attributes that all live in the
+ * bonus buffer, such as the ZPL attributes fetched by getattr.  Offsets
+ * and lengths come straight from the bonus index table, with no spill
+ * handling or per-attribute length decoding.  Returns B_FALSE, having
+ * touched nothing, if any attribute is not in the bonus buffer.
+ */
+static boolean_t
+sa_lookup_bonus(sa_handle_t *hdl, sa_bulk_attr_t *bulk, int count)
+{
+	sa_idx_tab_t *idx_tab = hdl->sa_bonus_tab;
+	sa_hdr_phys_t *hdr;
+	uint32_t toc;
+	int i;
+
+	for (i = 0; i != count; i++) {
+		ASSERT(bulk[i].sa_attr <= hdl->sa_os->os_sa->sa_num_attrs);
+		if (!TOC_ATTR_PRESENT(idx_tab->sa_idx_tab[bulk[i].sa_attr]))
+			return (B_FALSE);
+	}
+
+	hdr = SA_GET_HDR(hdl, SA_BONUS);
+	for (i = 0; i != count; i++) {
+		toc = idx_tab->sa_idx_tab[bulk[i].sa_attr];
+		bulk[i].sa_size = idx_tab->sa_attr_lengths[bulk[i].sa_attr];
+		bulk[i].sa_buftype = SA_BONUS;
+		bulk[i].sa_addr = (void *)((uintptr_t)hdr + TOC_OFF(toc));
+		if (bulk[i].sa_data) {
+			SA_COPY_DATA(bulk[i].sa_data_func,
+			    bulk[i].sa_addr, bulk[i].sa_data,
+			    bulk[i].sa_size);
+		}
+	}
+	return (B_TRUE);
+}
+
 /*
  * Main attribute lookup/update function
  * returns 0 for success or non zero for failures
@@ -330,6 +366,10 @@ sa_attr_op(sa_handle_t *hdl, sa_bulk_attr_t *bulk, int count,
 	buftypes = 0;
 
 	ASSERT(count > 0);
+	if (data_op == SA_LOOKUP && hdl->sa_bonus_tab != NULL &&
+	    sa_lookup_bonus(hdl, bulk, count))
+		return (0);
+
 	for (i = 0; i != count; i++) {
 		ASSERT(bulk[i].sa_attr <= hdl->sa_os->os_sa->sa_num_attrs);
 
@@ -562,6 +602,7 @@ sa_find_sizes(sa_os_t *sa, sa_bulk_attr_t *attr_desc, int attr_count,
 	int full_space;
 	int hdrsize;
 	int extra_hdrsize;
+	int dnodesize;
 
 	if (buftype == SA_BONUS && sa->sa_force_spill) {
 		*total = 0;
@@ -578,7 +619,12 @@ sa_find_sizes(sa_os_t *sa, sa_bulk_attr_t *attr_desc, int attr_count,
 	hdrsize = (SA_BONUSTYPE_FROM_DB(db) == DMU_OT_ZNODE) ? 0 :
 	    sizeof (sa_hdr_phys_t);
 
-	full_space = (buftype == SA_BONUS) ? DN_MAX_BONUSLEN : db->db_size;
+	if (buftype == SA_BONUS) {
+		dmu_object_dnsize_from_db(db, &dnodesize);
+		full_space = DN_BONUS_SIZE(dnodesize);
+	} else {
+		full_space = db->db_size;
+	}
 	ASSERT(IS_P2ALIGNED(full_space, 8));
 
 	for (i = 0; i != attr_count; i++) {
@@ -678,6 +724,7 @@ sa_build_layouts(sa_handle_t *hdl, sa_bulk_attr_t *attr_desc, int attr_count,
 	int len_idx;
 	int spill_used;
 	boolean_t spilling;
+	int dnodesize;
 
 	dmu_buf_will_dirty(hdl->sa_bonus, tx);
 	bonustype = SA_BONUSTYPE_FROM_DB(hdl->sa_bonus);
@@ -689,8 +736,9 @@ sa_build_layouts(sa_handle_t *hdl, sa_bulk_attr_t *attr_desc, int attr_count,
 	if (used > SPA_OLD_MAXBLOCKSIZE)
 		return (SET_ERROR(EFBIG));
 
+	dmu_object_dnsize_from_db(hdl->sa_bonus, &dnodesize);
 	VERIFY(0 == dmu_set_bonus(hdl->sa_bonus, spilling ?
-	    MIN(DN_MAX_BONUSLEN - sizeof (blkptr_t), used + hdrsize) :
+	    MIN(DN_BONUS_SIZE(dnodesize) - sizeof (blkptr_t), used + hdrsize) :
 	    used + hdrsize, tx));
 
 	ASSERT((bonustype == DMU_OT_ZNODE && spilling == 0) ||
@@ -1171,6 +1219,7 @@ sa_build_idx_tab(void *hdr, void *attr_addr, sa_attr_type_t attr,
 	}
 	TOC_ATTR_ENCODE(idx_tab->sa_idx_tab[attr], length_idx,
 	    (uint32_t)((uintptr_t)attr_addr - (uintptr_t)hdr));
+	idx_tab->sa_attr_lengths[attr] = length;
 }
 
 static void
@@ -1335,6 +1384,8 @@ sa_idx_tab_rele(objset_t *os, void *arg)
 		refcount_destroy(&idx_tab->sa_refcount);
 		kmem_free(idx_tab->sa_idx_tab,
 		    sizeof (uint32_t) * sa->sa_num_attrs);
+		kmem_free(idx_tab->sa_attr_lengths,
+		    sizeof (uint16_t) * sa->sa_num_attrs);
 		kmem_free(idx_tab, sizeof (sa_idx_tab_t));
 	}
 	mutex_exit(&sa->sa_lock);
@@ -1567,6 +1618,8 @@ sa_find_idx_tab(objset_t *os, dmu_object_type_t bonustype, void *data)
 	idx_tab = kmem_zalloc(sizeof (sa_idx_tab_t), KM_SLEEP);
 	idx_tab->sa_idx_tab =
 	    kmem_zalloc(sizeof (uint32_t) * sa->sa_num_attrs, KM_SLEEP);
+	idx_tab->sa_attr_lengths =
+	    kmem_zalloc(sizeof (uint16_t) * sa->sa_num_attrs, KM_SLEEP);
 	idx_tab->sa_layout = tb;
 	refcount_create(&idx_tab->sa_refcount);
 	if (tb->lot_var_sizes)
@@ -40,6 +40,7 @@
 #include <sys/fm/fs/zfs.h>
 #include <sys/spa_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zio_checksum.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
@@ -50,6 +51,7 @@
 #include <sys/vdev_disk.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
@@ -94,6 +96,7 @@
 typedef enum zti_modes {
 	ZTI_MODE_FIXED,			/* value is # of threads (min 1) */
 	ZTI_MODE_BATCH,			/* cpu-intensive; value is ignored */
+	ZTI_MODE_SCALE,			/* taskqs and threads from ncpus */
 	ZTI_MODE_NULL,			/* don't create a taskq */
 	ZTI_NMODES
 } zti_modes_t;
@@ -101,6 +104,7 @@ typedef enum zti_modes {
 #define	ZTI_P(n, q)	{ ZTI_MODE_FIXED, (n), (q) }
 #define	ZTI_PCT(n)	{ ZTI_MODE_ONLINE_PERCENT, (n), 1 }
 #define	ZTI_BATCH	{ ZTI_MODE_BATCH, 0, 1 }
+#define	ZTI_SCALE	{ ZTI_MODE_SCALE, 0, 1 }
 #define	ZTI_NULL	{ ZTI_MODE_NULL, 0, 0 }
 
 #define	ZTI_N(n)	ZTI_P(n, 1)
@@ -112,7 +116,7 @@ typedef struct zio_taskq_info {
 	uint_t zti_count;
 } zio_taskq_info_t;
 
-static const char *const zio_taskq_types[ZIO_TASKQ_TYPES] = {
+const char *const zio_taskq_types[ZIO_TASKQ_TYPES] = {
 	"iss", "iss_h", "int", "int_h"
 };
 
@@ -127,18 +131,24 @@ static const char *const zio_taskq_types[ZIO_TASKQ_TYPES] = {
  * point of lock contention. The ZTI_P(#, #) macro indicates that we need an
  * additional degree of parallelism specified by the number of threads per-
  * taskq and the number of taskqs; when dispatching an event in this case, the
- * particular taskq is chosen at random.
+ * particular taskq is chosen at random.  ZTI_SCALE does the same for the
+ * busiest of these, with both numbers derived from the number of CPUs (see
+ * spa_taskqs_init()), so that large machines get enough threads and small
+ * ones aren't oversubscribed.
+ *
+ * The READ and WRITE rows can be replaced through the zio_taskq_read and
+ * zio_taskq_write tunables, which apply to pools activated afterwards.
  *
  * The different taskq priorities are to handle the different contexts (issue
  * and interrupt) and then to reserve threads for ZIO_PRIORITY_NOW I/Os that
  * need to be handled with minimum delay.
  */
-const zio_taskq_info_t zio_taskqs[ZIO_TYPES][ZIO_TASKQ_TYPES] = {
+static zio_taskq_info_t zio_taskqs[ZIO_TYPES][ZIO_TASKQ_TYPES] = {
 	/* ISSUE	ISSUE_HIGH	INTR		INTR_HIGH */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* NULL */
-	{ ZTI_N(8),	ZTI_NULL,	ZTI_P(12, 8),	ZTI_NULL }, /* READ */
-	{ ZTI_BATCH,	ZTI_N(5),	ZTI_P(12, 8),	ZTI_N(5) }, /* WRITE */
-	{ ZTI_P(12, 8),	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* FREE */
+	{ ZTI_N(8),	ZTI_NULL,	ZTI_SCALE,	ZTI_NULL }, /* READ */
+	{ ZTI_BATCH,	ZTI_N(5),	ZTI_SCALE,	ZTI_N(5) }, /* WRITE */
+	{ ZTI_SCALE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* FREE */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* CLAIM */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* IOCTL */
 };
@@ -152,6 +162,9 @@ static inline int spa_load_impl(spa_t *spa, uint64_t, nvlist_t *config,
 static void spa_vdev_resilver_done(spa_t *spa);
 
 uint_t		zio_taskq_batch_pct = 75;	/* 1 thread per cpu in pset */
+uint_t		zio_taskq_batch_tpq = 0;	/* threads per scale taskq */
+int		zio_taskq_affine = 1;		/* see spa_taskq_select() */
+int		zio_taskq_affine_imbalance = 16;
 id_t		zio_taskq_psrset_bind = PS_NONE;
 boolean_t	zio_taskq_sysdc = B_TRUE;	/* use SDC scheduling class */
 uint_t		zio_taskq_basedc = 80;		/* base duty cycle */
@@ -208,8 +221,12 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 	ASSERT(MUTEX_HELD(&spa->spa_props_lock));
 
 	if (rvd != NULL) {
-		alloc = metaslab_class_get_alloc(spa_normal_class(spa));
-		size = metaslab_class_get_space(spa_normal_class(spa));
+		alloc = metaslab_class_get_alloc(spa_normal_class(spa)) +
+		    metaslab_class_get_alloc(spa_special_class(spa)) +
+		    metaslab_class_get_alloc(spa_dedup_class(spa));
+		size = metaslab_class_get_space(spa_normal_class(spa)) +
+		    metaslab_class_get_space(spa_special_class(spa)) +
+		    metaslab_class_get_space(spa_dedup_class(spa));
 		spa_prop_add_list(*nvp, ZPOOL_PROP_NAME, spa_name(spa), 0, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_SIZE, NULL, size, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_ALLOCATED, NULL, alloc, src);
@@ -253,6 +270,8 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 			spa_prop_add_list(*nvp, ZPOOL_PROP_FREEING,
 			    NULL, 0, src);
 		}
+		spa_prop_add_list(*nvp, ZPOOL_PROP_FREERATE, NULL,
+		    dsl_scan_free_rate(pool->dp_scan), src);
 
 		if (pool->dp_leak_dir != NULL) {
 			spa_prop_add_list(*nvp, ZPOOL_PROP_LEAKED, NULL,
@@ -467,6 +486,7 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 		case ZPOOL_PROP_AUTOREPLACE:
 		case ZPOOL_PROP_LISTSNAPS:
 		case ZPOOL_PROP_AUTOEXPAND:
+		case ZPOOL_PROP_AUTOTRIM:
 			error = nvpair_value_uint64(elem, &intval);
 			if (!error && intval > 1)
 				error = SET_ERROR(EINVAL);
@@ -606,6 +626,11 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 				error = SET_ERROR(EINVAL);
 			break;
 
+		case ZPOOL_PROP_SCANRATE:
+		case ZPOOL_PROP_DEDUPQUOTA:
+			error = nvpair_value_uint64(elem, &intval);
+			break;
+
 		default:
 			break;
 		}
@@ -859,14 +884,10 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 	if (mode == ZTI_MODE_NULL) {
 		tqs->stqs_count = 0;
 		tqs->stqs_taskq = NULL;
+		spa_zio_taskq_layout(spa, t, q, 0, 0);
 		return;
 	}
 
-	ASSERT3U(count, >, 0);
-
-	tqs->stqs_count = count;
-	tqs->stqs_taskq = kmem_alloc(count * sizeof (taskq_t *), KM_SLEEP);
-
 	switch (mode) {
 	case ZTI_MODE_FIXED:
 		ASSERT3U(value, >=, 1);
@@ -879,6 +900,31 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 		value = zio_taskq_batch_pct;
 		break;
 
+	case ZTI_MODE_SCALE: {
+		uint_t cpus = MAX(1, max_ncpus * zio_taskq_batch_pct / 100);
+
+		/*
+		 * More taskqs contend less on their locks, fewer keep the
+		 * requests in order and the CPUs busy.  Unless told how
+		 * many threads to give each, aim for about 6 per taskq but
+		 * no more taskqs than threads in each: 1 taskq of 3 threads
+		 * for 4 CPUs at 75%, 3 of 4 for 16, 6 of 6 for 48.
+		 */
+		if (zio_taskq_batch_tpq > 0) {
+			count = MAX(1, (cpus + zio_taskq_batch_tpq / 2) /
+			    zio_taskq_batch_tpq);
+		} else {
+			count = 1 + cpus / 6;
+			while (count * count > cpus)
+				count--;
+		}
+		/* Each taskq gets its share of zio_taskq_batch_pct */
+		count = MAX(count, (zio_taskq_batch_pct + 99) / 100);
+		flags |= TASKQ_THREADS_CPU_PCT;
+		value = MAX(1, (zio_taskq_batch_pct + count / 2) / count);
+		break;
+	}
+
 	default:
 		panic("unrecognized mode for %s_%s taskq (%u:%u) in "
 		    "spa_activate()",
@@ -886,6 +932,18 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 		break;
 	}
 
+	ASSERT3U(count, >, 0);
+
+	/* Let the threads of a taskq steal from each other where supported */
+	if (mode != ZTI_MODE_FIXED || value > 1)
+		flags |= TASKQ_WORKSTEAL;
+
+	tqs->stqs_count = count;
+	tqs->stqs_taskq = kmem_alloc(count * sizeof (taskq_t *), KM_SLEEP);
+	tqs->stqs_queued = kmem_zalloc(count * sizeof (uint64_t), KM_SLEEP);
+	spa_zio_taskq_layout(spa, t, q, count, (flags & TASKQ_THREADS_CPU_PCT) ?
+	    MAX(1, max_ncpus * value / 100) : value);
+
 	for (i = 0; i < count; i++) {
 		taskq_t *tq;
 
@@ -927,6 +985,131 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 	}
 }
 
+/*
+ * Parse a decimal number of at most 5 digits at *sp, moving *sp past it.
+ */
+static int
+spa_taskq_param_number(const char **sp, uint_t *vp)
+{
+	const char *s = *sp;
+	uint_t v = 0;
+
+	while (*s >= '0' && *s <= '9' && s - *sp < 5)
+		v = v * 10 + (*s++ - '0');
+	if (s == *sp || (*s >= '0' && *s <= '9'))
+		return (SET_ERROR(EINVAL));
+
+	*sp = s;
+	*vp = v;
+	return (0);
+}
+
+/*
+ * Replace the READ or WRITE row of zio_taskqs[] with the four space
+ * separated entries of val, for the issue, high priority issue, interrupt
+ * and high priority interrupt taskqs.  An entry is "fixed,<taskqs>,<threads>",
+ * "batch", "scale" or "null"; only the high priority ones can be null.
+ * The row is only replaced if all of val is valid.
+ */
+int
+spa_taskq_param_set(zio_type_t t, const char *val)
+{
+	zio_taskq_info_t row[ZIO_TASKQ_TYPES];
+	const char *s = val;
+	int q;
+
+	if (t != ZIO_TYPE_READ && t != ZIO_TYPE_WRITE)
+		return (SET_ERROR(EINVAL));
+
+	for (q = 0; q < ZIO_TASKQ_TYPES; q++) {
+		zio_taskq_info_t *ztip = &row[q];
+
+		while (*s == ' ')
+			s++;
+
+		if (strncmp(s, "fixed,", 6) == 0) {
+			s += 6;
+			ztip->zti_mode = ZTI_MODE_FIXED;
+			if (spa_taskq_param_number(&s, &ztip->zti_count) ||
+			    *s++ != ',' ||
+			    spa_taskq_param_number(&s, &ztip->zti_value) ||
+			    ztip->zti_count == 0 || ztip->zti_value == 0)
+				return (SET_ERROR(EINVAL));
+		} else if (strncmp(s, "batch", 5) == 0) {
+			s += 5;
+			ztip->zti_mode = ZTI_MODE_BATCH;
+			ztip->zti_value = 0;
+			ztip->zti_count = 1;
+		} else if (strncmp(s, "scale", 5) == 0) {
+			s += 5;
+			ztip->zti_mode = ZTI_MODE_SCALE;
+			ztip->zti_value = 0;
+			ztip->zti_count = 1;
+		} else if (strncmp(s, "null", 4) == 0 &&
+		    (q == ZIO_TASKQ_ISSUE_HIGH ||
+		    q == ZIO_TASKQ_INTERRUPT_HIGH)) {
+			s += 4;
+			ztip->zti_mode = ZTI_MODE_NULL;
+			ztip->zti_value = 0;
+			ztip->zti_count = 0;
+		} else {
+			return (SET_ERROR(EINVAL));
+		}
+
+		if (*s != ' ' && *s != '\0' && *s != '\n')
+			return (SET_ERROR(EINVAL));
+	}
+
+	while (*s == ' ' || *s == '\n')
+		s++;
+	if (*s != '\0')
+		return (SET_ERROR(EINVAL));
+
+	mutex_enter(&spa_namespace_lock);
+	bcopy(row, zio_taskqs[t], sizeof (row));
+	mutex_exit(&spa_namespace_lock);
+
+	return (0);
+}
+
+/*
+ * Format the READ or WRITE row of zio_taskqs[] as spa_taskq_param_set()
+ * takes it.
+ */
+int
+spa_taskq_param_get(zio_type_t t, char *buf, size_t size)
+{
+	size_t len = 0;
+	int q;
+
+	if (t != ZIO_TYPE_READ && t != ZIO_TYPE_WRITE)
+		return (SET_ERROR(EINVAL));
+
+	buf[0] = '\0';
+	for (q = 0; q < ZIO_TASKQ_TYPES && len < size; q++) {
+		const zio_taskq_info_t *ztip = &zio_taskqs[t][q];
+		const char *sep = (q == 0) ? "" : " ";
+
+		switch (ztip->zti_mode) {
+		case ZTI_MODE_FIXED:
+			len += snprintf(buf + len, size - len, "%sfixed,%u,%u",
+			    sep, ztip->zti_count, ztip->zti_value);
+			break;
+		case ZTI_MODE_BATCH:
+			len += snprintf(buf + len, size - len, "%sbatch", sep);
+			break;
+		case ZTI_MODE_SCALE:
+			len += snprintf(buf + len, size - len, "%sscale", sep);
+			break;
+		default:
+			len += snprintf(buf + len, size - len, "%snull", sep);
+			break;
+		}
+	}
+
+	return (0);
+}
+
 static void
 spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 {
@@ -944,7 +1127,10 @@ spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 	}
 
 	kmem_free(tqs->stqs_taskq, tqs->stqs_count * sizeof (taskq_t *));
+	kmem_free(tqs->stqs_queued, tqs->stqs_count * sizeof (uint64_t));
 	tqs->stqs_taskq = NULL;
+	tqs->stqs_queued = NULL;
+	spa_zio_taskq_layout(spa, t, q, 0, 0);
 }
 
 /*
@@ -971,6 +1157,71 @@ spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
 	taskq_dispatch_ent(tq, func, arg, flags, ent);
 }
 
+/*
+ * Pick one of a set of taskqs for a zio issued on cpu.  With
+ * zio_taskq_affine set, each taskq serves a group of neighbouring cpus, so
+ * that the zios of one thread, such as the checksum and decompression of
+ * its reads, keep going to the same taskq threads; the scheduler tends to
+ * run those near where they last ran, near the caches that will consume
+ * the data.  If that taskq has more than zio_taskq_affine_imbalance zios
+ * waiting beyond another one picked at random, the zio goes there
+ * instead.  The pick is counted as waiting until spa_taskq_started().
+ */
+uint_t
+spa_taskq_select(spa_t *spa, zio_type_t t, zio_taskq_type_t q, uint_t cpu)
+{
+	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
+	uint_t idx, other;
+
+	ASSERT3U(tqs->stqs_count, !=, 0);
+
+	if (tqs->stqs_count == 1) {
+		idx = 0;
+	} else if (!zio_taskq_affine) {
+		idx = ((uint64_t)gethrtime()) % tqs->stqs_count;
+	} else {
+		idx = (cpu % max_ncpus) * tqs->stqs_count / max_ncpus;
+		other = ((uint64_t)gethrtime()) % tqs->stqs_count;
+		if (tqs->stqs_queued[idx] > tqs->stqs_queued[other] +
+		    zio_taskq_affine_imbalance) {
+			idx = other;
+			spa_zio_taskq_rerouted(spa, t, q);
+		}
+	}
+
+	atomic_inc_64(&tqs->stqs_queued[idx]);
+	return (idx);
+}
+
+/*
+ * A thread of taskq idx picked up a zio that spa_taskq_select() chose it
+ * for.
+ */
+void
+spa_taskq_started(spa_t *spa, zio_type_t t, zio_taskq_type_t q, uint_t idx)
+{
+	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
+
+	ASSERT3U(idx, <, tqs->stqs_count);
+	atomic_dec_64(&tqs->stqs_queued[idx]);
+}
+
+/*
+ * Same as spa_taskq_dispatch_ent() but to the taskq spa_taskq_select()
+ * picked.
+ */
+void
+spa_taskq_dispatch_ent_on(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
+    uint_t idx, task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent)
+{
+	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
+
+	ASSERT3P(tqs->stqs_taskq, !=, NULL);
+	ASSERT3U(idx, <, tqs->stqs_count);
+
+	taskq_dispatch_ent(tqs->stqs_taskq[idx], func, arg, flags, ent);
+}
+
 /*
  * Same as spa_taskq_dispatch_ent() but block on the task until completion.
  */
@@ -1091,6 +1342,8 @@ spa_activate(spa_t *spa, int mode)
 
 	spa->spa_normal_class = metaslab_class_create(spa, zfs_metaslab_ops);
 	spa->spa_log_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_special_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_dedup_class = metaslab_class_create(spa, zfs_metaslab_ops);
 
 	/* Try to create a covering process */
 	mutex_enter(&spa->spa_proc_lock);
@@ -1166,6 +1419,12 @@ spa_activate(spa_t *spa, int mode)
 	 */
 	spa->spa_zvol_taskq = taskq_create("z_zvol", 1, defclsyspri,
 	    1, INT_MAX, 0);
+
+	/*
+	 * Scrub and resilver reads are checksummed on their own taskq, so
+	 * that they don't hold up the completion of foreground reads.
+	 */
+	zio_scan_verify_init(spa);
 }
 
 /*
@@ -1189,6 +1448,8 @@ spa_deactivate(spa_t *spa)
 		spa->spa_zvol_taskq = NULL;
 	}
 
+	zio_scan_verify_fini(spa);
+
 	txg_list_destroy(&spa->spa_vdev_txg_list);
 
 	list_destroy(&spa->spa_config_dirty_list);
@@ -1211,6 +1472,12 @@ spa_deactivate(spa_t *spa)
 	metaslab_class_destroy(spa->spa_log_class);
 	spa->spa_log_class = NULL;
 
+	metaslab_class_destroy(spa->spa_special_class);
+	spa->spa_special_class = NULL;
+
+	metaslab_class_destroy(spa->spa_dedup_class);
+	spa->spa_dedup_class = NULL;
+
 	/*
 	 * If this was part of an import or the open otherwise failed, we may
 	 * still have errors left in the queues.  Empty them just in case.
@@ -1320,6 +1587,11 @@ spa_unload(spa_t *spa)
 	 */
 	spa_async_suspend(spa);
 
+	/*
+	 * Stop the sequential rebuild while its batches can still get a tx.
+	 */
+	spa_rebuild_stop(spa);
+
 	/*
 	 * Stop syncing.
 	 */
@@ -1328,6 +1600,17 @@ spa_unload(spa_t *spa)
 		spa->spa_sync_on = B_FALSE;
 	}
 
+	/*
+	 * Stop unmapping free space, now that syncing can't restart it.
+	 */
+	spa_trim_stop(spa);
+
+	/*
+	 * Stop prefetching for the ARC warm-up; its log was written out
+	 * by the last sync.
+	 */
+	spa_warm_stop(spa);
+
 	/*
 	 * Even though vdev_free() also calls vdev_metaslab_fini, we need
 	 * to call it earlier, before we wait for async i/o to complete.
@@ -1988,7 +2271,7 @@ spa_load_verify_done(zio_t *zio)
 		else
 			atomic_inc_64(&sle->sle_data_count);
 	}
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
@@ -2011,7 +2294,6 @@ spa_load_verify_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 {
 	zio_t *rio;
 	size_t size;
-	void *data;
 
 	if (bp == NULL || BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
 		return (0);
@@ -2027,7 +2309,6 @@ spa_load_verify_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 
 	rio = arg;
 	size = BP_GET_PSIZE(bp);
-	data = zio_data_buf_alloc(size);
 
 	mutex_enter(&spa->spa_scrub_lock);
 	while (spa->spa_scrub_inflight >= spa_load_verify_maxinflight)
@@ -2035,10 +2316,10 @@ spa_load_verify_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	spa->spa_scrub_inflight++;
 	mutex_exit(&spa->spa_scrub_lock);
 
-	zio_nowait(zio_read(rio, spa, bp, data, size,
-	    spa_load_verify_done, rio->io_private, ZIO_PRIORITY_SCRUB,
+	zio_nowait(zio_read(rio, spa, bp, abd_alloc_for_io(size, B_FALSE),
+	    size, spa_load_verify_done, rio->io_private, ZIO_PRIORITY_SCRUB,
 	    ZIO_FLAG_SPECULATIVE | ZIO_FLAG_CANFAIL |
-	    ZIO_FLAG_SCRUB | ZIO_FLAG_RAW, zb));
+	    ZIO_FLAG_SCRUB | ZIO_FLAG_RAW | ZIO_FLAG_RAW_ENCRYPT, zb));
 	return (0);
 }
 
@@ -2292,6 +2573,10 @@ spa_load(spa_t *spa, spa_load_state_t state, spa_import_type_t type,
 	spa->spa_load_state = error ? SPA_LOAD_ERROR : SPA_LOAD_NONE;
 	spa->spa_ena = 0;
 
+	/* Read back what was in demand before the ARC lost it */
+	if (error == 0 && state != SPA_LOAD_TRYIMPORT)
+		spa_warm_start(spa);
+
 	return (error);
 }
 
@@ -2851,6 +3136,10 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa_prop_find(spa, ZPOOL_PROP_DELEGATION, &spa->spa_delegation);
 		spa_prop_find(spa, ZPOOL_PROP_FAILUREMODE, &spa->spa_failmode);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
+		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &spa->spa_autotrim);
+		spa_prop_find(spa, ZPOOL_PROP_SCANRATE, &spa->spa_scan_rate);
+		spa_prop_find(spa, ZPOOL_PROP_DEDUPQUOTA,
+		    &spa->spa_dedup_quota);
 		spa_prop_find(spa, ZPOOL_PROP_DEDUPDITTO,
 		    &spa->spa_dedup_ditto);
 
@@ -2882,6 +3171,14 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	 */
 	vdev_load(rvd);
 
+	/*
+	 * Apply the changes in the log space maps that have not been
+	 * flushed to the metaslabs' space maps yet.
+	 */
+	error = spa_ld_log_spacemaps(spa);
+	if (error != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, error));
+
 	/*
 	 * Propagate the leaf DTLs we just loaded all the way up the tree.
 	 */
@@ -3792,7 +4089,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	nvlist_t **spares, **l2cache;
 	uint_t nspares, nl2cache;
 	uint64_t version, obj;
-	boolean_t has_features;
+	boolean_t has_features, has_allocclass;
 	nvpair_t *elem;
 	int c, i;
 	char *poolname;
@@ -3835,10 +4132,18 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 		spa->spa_import_flags |= ZFS_IMPORT_TEMP_NAME;
 
 	has_features = B_FALSE;
+	has_allocclass = B_FALSE;
 	for (elem = nvlist_next_nvpair(props, NULL);
 	    elem != NULL; elem = nvlist_next_nvpair(props, elem)) {
-		if (zpool_prop_feature(nvpair_name(elem)))
+		spa_feature_t fid;
+
+		if (zpool_prop_feature(nvpair_name(elem))) {
 			has_features = B_TRUE;
+			if (zfeature_lookup_name(strchr(nvpair_name(elem),
+			    '@') + 1, &fid) == 0 &&
+			    fid == SPA_FEATURE_ALLOCATION_CLASSES)
+				has_allocclass = B_TRUE;
+		}
 	}
 
 	if (has_features || nvlist_lookup_uint64(props,
@@ -3877,6 +4182,18 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	if (error == 0 && !zfs_allocatable_devs(nvroot))
 		error = SET_ERROR(EINVAL);
 
+	/*
+	 * Special and dedup vdevs need the allocation_classes feature,
+	 * which is only enabled by the properties once the pool is being
+	 * synced.
+	 */
+	for (c = 0; error == 0 && !has_allocclass && c < rvd->vdev_children;
+	    c++) {
+		if (rvd->vdev_child[c]->vdev_isspecial ||
+		    rvd->vdev_child[c]->vdev_isdedup)
+			error = SET_ERROR(ENOTSUP);
+	}
+
 	if (error == 0 &&
 	    (error = vdev_create(rvd, txg, B_FALSE)) == 0 &&
 	    (error = spa_validate_aux(spa, nvroot, txg,
@@ -4008,6 +4325,10 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_delegation = zpool_prop_default_numeric(ZPOOL_PROP_DELEGATION);
 	spa->spa_failmode = zpool_prop_default_numeric(ZPOOL_PROP_FAILUREMODE);
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
+	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
+	spa->spa_scan_rate = zpool_prop_default_numeric(ZPOOL_PROP_SCANRATE);
+	spa->spa_dedup_quota =
+	    zpool_prop_default_numeric(ZPOOL_PROP_DEDUPQUOTA);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
@@ -4665,6 +4986,19 @@ spa_export_common(char *pool, int new_state, nvlist_t **oldconfig,
 			return (SET_ERROR(EXDEV));
 		}
 
+		/*
+		 * Write out the changes held in the log space maps so that
+		 * the exported pool does not need them.
+		 */
+		if (new_state == POOL_STATE_EXPORTED && !hardforce)
+			spa_log_flush_all(spa);
+
+		/*
+		 * Save the ARC warm-up log for the next import.
+		 */
+		if (new_state == POOL_STATE_EXPORTED && !hardforce)
+			spa_warm_flush(spa);
+
 		/*
 		 * We want this to be reflected on every label,
 		 * so mark them all dirty.  spa_unload() will do the
@@ -5038,9 +5372,11 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	/*
 	 * Schedule the resilver to restart in the future. We do this to
 	 * ensure that dmu_sync-ed blocks have been stitched into the
-	 * respective datasets.
+	 * respective datasets.  A mirror may be rebuilt sequentially
+	 * instead, once the same txg has synced.
 	 */
-	dsl_resilver_restart(spa->spa_dsl_pool, dtl_max_txg);
+	if (!spa_rebuild_start(spa, tvd, dtl_max_txg))
+		dsl_resilver_restart(spa->spa_dsl_pool, dtl_max_txg);
 
 	/*
 	 * Commit the config
@@ -6066,6 +6402,20 @@ spa_scan(spa_t *spa, pool_scan_func_t func)
 	return (dsl_scan(spa->spa_dsl_pool, func));
 }
 
+/*
+ * Scrub only the blocks born from min_txg to max_txg (0 for no limit) of
+ * the datasets named in datasets (NULL for all of them).
+ */
+int
+spa_scan_restricted(spa_t *spa, uint64_t min_txg, uint64_t max_txg,
+    nvlist_t *datasets)
+{
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == 0);
+
+	return (dsl_scan_restricted(spa->spa_dsl_pool, POOL_SCAN_SCRUB,
+	    min_txg, max_txg, datasets));
+}
+
 /*
  * ==========================================================================
  * SPA async task processing
@@ -6208,6 +6558,12 @@ spa_async_thread(void *arg)
 	if (tasks & SPA_ASYNC_RESILVER)
 		dsl_resilver_restart(spa->spa_dsl_pool, 0);
 
+	/*
+	 * Verify what a sequential rebuild has copied.
+	 */
+	if (tasks & SPA_ASYNC_SCRUB)
+		(void) spa_scan(spa, POOL_SCAN_SCRUB);
+
 	/*
 	 * Let the world know that we're done.
 	 */
@@ -6276,6 +6632,58 @@ bpobj_enqueue_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 	return (0);
 }
 
+/*
+ * Free throttling.  The frees of pass 1 are issued while spa_sync() is
+ * writing out metadata, and a mass delete can flood the vdevs with them.
+ * Once zfs_free_throttle_ms have passed since the txg began syncing, or
+ * the next txg is already waiting, the remaining frees are left on
+ * spa_deferred_bpobj and released by later txgs instead.  Each txg still
+ * issues at least zfs_free_throttle_min_blocks new frees and as many from
+ * the backlog, and nothing is held back while the normal class has less
+ * than zfs_free_throttle_urgent_pct percent of its space free.  Setting
+ * zfs_free_throttle_ms to 0 disables the throttle.
+ */
+int zfs_free_throttle_ms = 1000;
+int zfs_free_throttle_min_blocks = 10000;
+int zfs_free_throttle_urgent_pct = 10;
+
+typedef struct spa_free_arg {
+	spa_t		*sfa_spa;
+	zio_t		*sfa_zio;
+	boolean_t	sfa_throttle;	/* may hold frees back */
+	uint64_t	sfa_issued;	/* frees issued so far */
+	uint64_t	sfa_deferred;	/* frees added to the backlog */
+} spa_free_arg_t;
+
+static void
+spa_free_arg_init(spa_free_arg_t *sfa, spa_t *spa)
+{
+	metaslab_class_t *mc = spa_normal_class(spa);
+	uint64_t space = metaslab_class_get_space(mc);
+	uint64_t alloc = metaslab_class_get_alloc(mc);
+
+	sfa->sfa_spa = spa;
+	sfa->sfa_zio = zio_root(spa, NULL, NULL, 0);
+	sfa->sfa_throttle = (zfs_free_throttle_ms > 0 && space != 0 &&
+	    (space - MIN(alloc, space)) * 100 >
+	    space * zfs_free_throttle_urgent_pct);
+	sfa->sfa_issued = 0;
+	sfa->sfa_deferred = 0;
+}
+
+static boolean_t
+spa_free_should_defer(spa_free_arg_t *sfa)
+{
+	spa_t *spa = sfa->sfa_spa;
+
+	if (!sfa->sfa_throttle ||
+	    sfa->sfa_issued < (uint64_t)zfs_free_throttle_min_blocks)
+		return (B_FALSE);
+
+	return (NSEC2MSEC(gethrtime() - spa->spa_sync_starttime) >=
+	    zfs_free_throttle_ms || txg_sync_waiting(spa->spa_dsl_pool));
+}
+
 static int
 spa_free_sync_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 {
@@ -6286,6 +6694,33 @@ spa_free_sync_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 	return (0);
 }
 
+static int
+spa_free_throttle_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	spa_free_arg_t *sfa = arg;
+
+	if (spa_free_should_defer(sfa)) {
+		bpobj_enqueue(&sfa->sfa_spa->spa_deferred_bpobj, bp, tx);
+		sfa->sfa_deferred++;
+		return (0);
+	}
+
+	sfa->sfa_issued++;
+	return (spa_free_sync_cb(sfa->sfa_zio, bp, tx));
+}
+
+static int
+spa_free_release_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	spa_free_arg_t *sfa = arg;
+
+	if (spa_free_should_defer(sfa))
+		return (SET_ERROR(ERESTART));
+
+	sfa->sfa_issued++;
+	return (spa_free_sync_cb(sfa->sfa_zio, bp, tx));
+}
+
 /*
  * Note: this simple function is not inlined to make it easier to dtrace the
  * amount of time spent syncing frees.
@@ -6293,9 +6728,17 @@ spa_free_sync_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 static void
 spa_sync_frees(spa_t *spa, bplist_t *bpl, dmu_tx_t *tx)
 {
-	zio_t *zio = zio_root(spa, NULL, NULL, 0);
-	bplist_iterate(bpl, spa_free_sync_cb, zio, tx);
-	VERIFY(zio_wait(zio) == 0);
+	spa_free_arg_t sfa;
+
+	spa_free_arg_init(&sfa, spa);
+	bplist_iterate(bpl, spa_free_throttle_cb, &sfa, tx);
+	VERIFY(zio_wait(sfa.sfa_zio) == 0);
+
+	spa_free_stats_add(spa, SPA_FREE_ISSUED, sfa.sfa_issued);
+	if (sfa.sfa_deferred != 0) {
+		spa_free_stats_add(spa, SPA_FREE_DEFERRED, sfa.sfa_deferred);
+		spa->spa_free_backlog = B_TRUE;
+	}
 }
 
 /*
@@ -6305,10 +6748,37 @@ spa_sync_frees(spa_t *spa, bplist_t *bpl, dmu_tx_t *tx)
 static void
 spa_sync_deferred_frees(spa_t *spa, dmu_tx_t *tx)
 {
-	zio_t *zio = zio_root(spa, NULL, NULL, 0);
-	VERIFY3U(bpobj_iterate(&spa->spa_deferred_bpobj,
-	    spa_free_sync_cb, zio, tx), ==, 0);
-	VERIFY0(zio_wait(zio));
+	spa_free_arg_t sfa;
+	uint64_t used, comp, uncomp;
+	int err;
+
+	spa_free_arg_init(&sfa, spa);
+	err = bpobj_iterate(&spa->spa_deferred_bpobj,
+	    spa_free_release_cb, &sfa, tx);
+	VERIFY(err == 0 || err == ERESTART);
+	VERIFY0(zio_wait(sfa.sfa_zio));
+
+	spa_free_stats_add(spa, SPA_FREE_RELEASED, sfa.sfa_issued);
+	if (err == ERESTART) {
+		spa_free_stats_add(spa, SPA_FREE_THROTTLED_TXGS, 1);
+		spa->spa_free_backlog = B_TRUE;
+	} else {
+		spa->spa_free_backlog = B_FALSE;
+	}
+
+	VERIFY0(bpobj_space(&spa->spa_deferred_bpobj, &used, &comp, &uncomp));
+	spa_free_stats_set(spa, SPA_FREE_BACKLOG_BYTES, used);
+}
+
+/*
+ * Returns true while frees held back by the throttle are waiting to be
+ * released, so that the sync thread keeps syncing txgs to drain them.
+ */
+boolean_t
+spa_free_backlogged(spa_t *spa)
+{
+	return (spa->spa_free_backlog && spa->spa_load_state == SPA_LOAD_NONE &&
+	    !spa_shutting_down(spa));
 }
 
 static void
@@ -6675,6 +7145,15 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 					spa_async_request(spa,
 					    SPA_ASYNC_AUTOEXPAND);
 				break;
+			case ZPOOL_PROP_AUTOTRIM:
+				spa->spa_autotrim = intval;
+				break;
+			case ZPOOL_PROP_SCANRATE:
+				spa->spa_scan_rate = intval;
+				break;
+			case ZPOOL_PROP_DEDUPQUOTA:
+				spa->spa_dedup_quota = intval;
+				break;
 			case ZPOOL_PROP_DEDUPDITTO:
 				spa->spa_dedup_ditto = intval;
 				break;
@@ -6910,6 +7389,11 @@ spa_sync(spa_t *spa, uint64_t txg)
 		ddt_sync(spa, txg);
 		dsl_scan_sync(dp, tx);
 
+		if (pass == 1) {
+			spa_log_sync(spa, tx);
+			spa_warm_sync(spa, tx);
+		}
+
 		while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)))
 			vdev_sync(vd, txg);
 
@@ -6929,12 +7413,15 @@ spa_sync(spa_t *spa, uint64_t txg)
 			 * effects, we don't want to rely on that here).
 			 */
 			if (spa->spa_uberblock.ub_rootbp.blk_birth < txg &&
-			    !dmu_objset_is_dirty(mos, txg)) {
+			    !dmu_objset_is_dirty(mos, txg) &&
+			    !spa->spa_free_backlog) {
 				/*
 				 * Nothing changed on the first pass,
 				 * therefore this TXG is a no-op.  Avoid
 				 * syncing deferred frees, so that we
-				 * can keep this TXG as a no-op.
+				 * can keep this TXG as a no-op.  Frees
+				 * held back by the throttle are the
+				 * exception, they are released anyway.
 				 */
 				ASSERT(txg_list_empty(&dp->dp_dirty_datasets,
 				    txg));
@@ -7066,6 +7553,11 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 * If any async tasks have been requested, kick them off.
 	 */
 	spa_async_dispatch(spa);
+
+	/*
+	 * Unmap the space freed over the last few txgs.
+	 */
+	spa_trim_auto(spa, txg);
 }
 
 /*
@@ -36,6 +36,7 @@
 #include <sys/systeminfo.h>
 #include <sys/sunddi.h>
 #include <sys/zfeature.h>
+#include <sys/callb.h>
 #ifdef _KERNEL
 #include <sys/kobj.h>
 #include <sys/zone.h>
@@ -62,6 +63,19 @@
 
 static uint64_t spa_config_generation = 1;
 
+/*
+ * Cache file syncs requested through spa_config_sync_deferred() are
+ * coalesced for this long before being written out, so that a burst of
+ * device state changes costs a single write of each cache file.
+ */
+int zfs_config_sync_delay_ms = 500;
+
+static kmutex_t spa_config_sync_lock;
+static kcondvar_t spa_config_sync_cv;
+static kthread_t *spa_config_sync_thr;
+static boolean_t spa_config_sync_exit;
+static boolean_t spa_config_sync_wanted;
+
 /*
  * This can be overridden in userland to preserve an alternate namespace for
  * userland pools when doing testing.
@@ -221,6 +235,32 @@ spa_config_write(spa_config_dirent_t *dp, nvlist_t *nvl)
 	kmem_free(temp, MAXPATHLEN);
 }
 
+/*
+ * Return B_TRUE if the config of any pool that belongs in the cache file
+ * 'dp' changed since the file was last written.
+ */
+static boolean_t
+spa_config_cache_changed(spa_config_dirent_t *dp)
+{
+	spa_config_dirent_t *tdp;
+	spa_t *spa = NULL;
+	boolean_t changed = B_FALSE;
+
+	while (!changed && (spa = spa_next(spa)) != NULL) {
+		if (!spa_writeable(spa))
+			continue;
+
+		mutex_enter(&spa->spa_props_lock);
+		tdp = list_head(&spa->spa_config_list);
+		if (spa->spa_config != NULL && tdp->scd_path != NULL &&
+		    strcmp(tdp->scd_path, dp->scd_path) == 0 &&
+		    spa->spa_config_cached != spa->spa_config_set_count)
+			changed = B_TRUE;
+		mutex_exit(&spa->spa_props_lock);
+	}
+	return (changed);
+}
+
 /*
  * Synchronize pool configuration to disk.  This must be called with the
  * namespace lock held. Synchronizing the pool cache is typically done after
@@ -253,6 +293,17 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 		if (dp->scd_path == NULL)
 			continue;
 
+		/*
+		 * The cache file need not be packed and rewritten if none of
+		 * its pools changed since it was last written.  This only
+		 * holds if the set of pools is unchanged too, which is not
+		 * known when removing a pool or when it changed cache files.
+		 */
+		if (!removing && dp == list_head(&target->spa_config_list) &&
+		    list_next(&target->spa_config_list, dp) == NULL &&
+		    !spa_config_cache_changed(dp))
+			continue;
+
 		/*
 		 * Iterate over all pools, adding any matching pools to 'nvl'.
 		 */
@@ -289,6 +340,7 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 
 			fnvlist_add_nvlist(nvl, spa->spa_name,
 			    spa->spa_config);
+			spa->spa_config_cached = spa->spa_config_set_count;
 			mutex_exit(&spa->spa_props_lock);
 		}
 
@@ -316,6 +368,123 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 		spa_event_notify(target, NULL, FM_EREPORT_ZFS_CONFIG_SYNC);
 }
 
+/*
+ * Write out the cache files of all pools with a deferred sync pending.
+ */
+static void
+spa_config_sync_deferred_all(void)
+{
+	spa_t *spa = NULL;
+
+	mutex_enter(&spa_namespace_lock);
+	while ((spa = spa_next(spa)) != NULL) {
+		if (!spa->spa_config_sync_pending)
+			continue;
+		spa->spa_config_sync_pending = B_FALSE;
+		spa_config_sync(spa, B_FALSE, B_TRUE);
+	}
+	mutex_exit(&spa_namespace_lock);
+}
+
+static void
+spa_config_sync_thread(void *arg)
+{
+	callb_cpr_t cpr;
+
+	CALLB_CPR_INIT(&cpr, &spa_config_sync_lock, callb_generic_cpr, FTAG);
+
+	mutex_enter(&spa_config_sync_lock);
+	while (!spa_config_sync_exit || spa_config_sync_wanted) {
+		if (!spa_config_sync_wanted) {
+			CALLB_CPR_SAFE_BEGIN(&cpr);
+			cv_wait(&spa_config_sync_cv, &spa_config_sync_lock);
+			CALLB_CPR_SAFE_END(&cpr, &spa_config_sync_lock);
+			continue;
+		}
+
+		/*
+		 * Let further requests accumulate, unless we are exiting.
+		 */
+		if (!spa_config_sync_exit) {
+			CALLB_CPR_SAFE_BEGIN(&cpr);
+			(void) cv_timedwait(&spa_config_sync_cv,
+			    &spa_config_sync_lock, ddi_get_lbolt() +
+			    MSEC_TO_TICK(zfs_config_sync_delay_ms));
+			CALLB_CPR_SAFE_END(&cpr, &spa_config_sync_lock);
+		}
+		spa_config_sync_wanted = B_FALSE;
+		mutex_exit(&spa_config_sync_lock);
+
+		spa_config_sync_deferred_all();
+
+		mutex_enter(&spa_config_sync_lock);
+	}
+
+	spa_config_sync_thr = NULL;
+	cv_broadcast(&spa_config_sync_cv);
+	CALLB_CPR_EXIT(&cpr);		/* drops spa_config_sync_lock */
+	thread_exit();
+}
+
+/*
+ * Like spa_config_sync(spa, B_FALSE, B_TRUE), but the write is done
+ * asynchronously and coalesced with other requests made within
+ * zfs_config_sync_delay_ms.  This must be called with the namespace lock
+ * held.  Used where the pool itself does not depend on the cache file
+ * being current, such as vdev state changes.
+ */
+void
+spa_config_sync_deferred(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	mutex_enter(&spa_config_sync_lock);
+	if (spa_config_sync_thr == NULL || spa_config_sync_exit ||
+	    zfs_config_sync_delay_ms <= 0) {
+		mutex_exit(&spa_config_sync_lock);
+		spa_config_sync(spa, B_FALSE, B_TRUE);
+		return;
+	}
+
+	spa->spa_config_sync_pending = B_TRUE;
+	if (!spa_config_sync_wanted) {
+		spa_config_sync_wanted = B_TRUE;
+		cv_signal(&spa_config_sync_cv);
+	}
+	mutex_exit(&spa_config_sync_lock);
+}
+
+void
+spa_config_sync_start(void)
+{
+	mutex_init(&spa_config_sync_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&spa_config_sync_cv, NULL, CV_DEFAULT, NULL);
+
+	if (!(spa_mode_global & FWRITE))
+		return;
+
+	spa_config_sync_exit = B_FALSE;
+	spa_config_sync_thr = thread_create(NULL, 0, spa_config_sync_thread,
+	    NULL, 0, &p0, TS_RUN, minclsyspri);
+}
+
+/*
+ * Stop the sync thread, writing out any deferred syncs first.
+ */
+void
+spa_config_sync_stop(void)
+{
+	mutex_enter(&spa_config_sync_lock);
+	spa_config_sync_exit = B_TRUE;
+	cv_broadcast(&spa_config_sync_cv);
+	while (spa_config_sync_thr != NULL)
+		cv_wait(&spa_config_sync_cv, &spa_config_sync_lock);
+	mutex_exit(&spa_config_sync_lock);
+
+	cv_destroy(&spa_config_sync_cv);
+	mutex_destroy(&spa_config_sync_lock);
+}
+
 /*
  * Sigh.  Inside a local zone, we don't have access to /etc/zfs/zpool.cache,
  * and we don't want to allow the local zone to see all the pools anyway.
@@ -356,6 +525,7 @@ spa_config_set(spa_t *spa, nvlist_t *config)
 	if (spa->spa_config != NULL)
 		nvlist_free(spa->spa_config);
 	spa->spa_config = config;
+	spa->spa_config_set_count++;
 	mutex_exit(&spa->spa_props_lock);
 }
 
@@ -516,6 +686,11 @@ spa_config_generate(spa_t *spa, vdev_t *vd, uint64_t txg, int getstats)
 		    ZPOOL_CONFIG_DDT_STATS,
 		    (uint64_t *)dds, sizeof (*dds) / sizeof (uint64_t));
 		kmem_free(dds, sizeof (ddt_stat_t));
+
+		if (spa->spa_ddt_pruned != 0) {
+			fnvlist_add_uint64(config, ZPOOL_CONFIG_DDT_PRUNED,
+			    spa->spa_ddt_pruned);
+		}
 	}
 
 	if (locked)
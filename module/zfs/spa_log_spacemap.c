@@ -0,0 +1,524 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/space_map.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
+
+/*
+ * Log space maps.
+ *
+ * Every txg, each metaslab that had allocations or frees appends them to
+ * its own space map.  On a large, fragmented pool a txg touches many
+ * metaslabs, and each of them costs at least one block write (plus the
+ * indirect blocks and the dnode above it) for a handful of entries.
+ *
+ * With the log_spacemap feature, a metaslab instead appends its changes
+ * to the log space map of its top-level vdev for that txg, so the changes
+ * of all the vdev's metaslabs share the same few blocks.  The metaslab
+ * keeps the changes that are only in the logs in two range trees,
+ * ms_unflushed_allocs and ms_unflushed_frees, which are applied on top of
+ * ms_sm whenever the metaslab is loaded.
+ *
+ * Every txg spa_log_sync() picks the metaslabs that have been unflushed
+ * the longest and lets them write their unflushed changes to their own
+ * space map ("flush"), so the changes of each metaslab reach its space
+ * map at least once every zfs_unflushed_log_txg_max txgs.  Once no
+ * metaslab references the changes of a txg anymore, that txg's log space
+ * maps are destroyed.
+ *
+ * On disk, the first txg of each metaslab whose changes have not been
+ * flushed (ms_unflushed_txg) is kept in an array linked from the
+ * vdev's top-level ZAP, together with a ZAP of the vdev's log space maps.
+ * When the pool is imported spa_ld_log_spacemaps() replays the logs into
+ * the unflushed trees of the metaslabs.
+ */
+
+/*
+ * Write the changes of metaslabs to the log space maps instead of their
+ * own space maps, when the feature is enabled.
+ */
+int zfs_log_spacemaps = 1;
+
+/*
+ * The most txgs the changes of a metaslab go unflushed, which bounds both
+ * the number of log space maps and the work done by the import.
+ */
+uint64_t zfs_unflushed_log_txg_max = 1000;
+
+/* the fewest metaslabs flushed in a txg, if there is anything to flush */
+uint64_t zfs_min_metaslabs_to_flush = 1;
+
+/*
+ * Normally all the metaslabs are flushed and the logs destroyed when the
+ * pool is exported, so that the exported pool is self contained and
+ * software without the feature can import it.  Setting this makes export
+ * faster instead, leaving the logs to be replayed by the next import.
+ */
+int zfs_keep_log_spacemaps_at_export = 0;
+
+int
+spa_unflushed_ms_compare(const void *x1, const void *x2)
+{
+	const metaslab_t *m1 = x1;
+	const metaslab_t *m2 = x2;
+	uint64_t id1 = m1->ms_group->mg_vd->vdev_id;
+	uint64_t id2 = m2->ms_group->mg_vd->vdev_id;
+
+	if (m1->ms_unflushed_txg < m2->ms_unflushed_txg)
+		return (-1);
+	if (m1->ms_unflushed_txg > m2->ms_unflushed_txg)
+		return (1);
+
+	if (id1 < id2)
+		return (-1);
+	if (id1 > id2)
+		return (1);
+
+	if (m1->ms_id < m2->ms_id)
+		return (-1);
+	if (m1->ms_id > m2->ms_id)
+		return (1);
+
+	return (0);
+}
+
+boolean_t
+spa_log_sm_enabled(spa_t *spa)
+{
+	return (zfs_log_spacemaps && !spa->spa_log_flushall &&
+	    spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP));
+}
+
+void
+vdev_log_init(vdev_t *vd)
+{
+	mutex_init(&vd->vdev_log_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&vd->vdev_log_list, sizeof (vdev_log_entry_t),
+	    offsetof(vdev_log_entry_t, vle_node));
+}
+
+void
+vdev_log_fini(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_log_entry_t *vle;
+
+	ASSERT3P(vd->vdev_log_sm, ==, NULL);
+
+	while ((vle = list_remove_head(&vd->vdev_log_list)) != NULL) {
+		ASSERT3U(spa->spa_log_sm_count, >, 0);
+		spa->spa_log_sm_count--;
+		kmem_free(vle, sizeof (vdev_log_entry_t));
+	}
+	list_destroy(&vd->vdev_log_list);
+	mutex_destroy(&vd->vdev_log_lock);
+}
+
+static int
+vdev_log_sm_open(vdev_t *vd, uint64_t obj, space_map_t **smp)
+{
+	return (space_map_open(smp, vd->vdev_spa->spa_meta_objset, obj, 0,
+	    vd->vdev_ms_count << vd->vdev_ms_shift, vd->vdev_ashift,
+	    &vd->vdev_log_lock));
+}
+
+/*
+ * Return the log space map of the syncing txg for this top-level vdev,
+ * creating it on first use.  Must not be called with a ms_lock held,
+ * since this calls into the DMU.
+ */
+space_map_t *
+vdev_log_sm_get(vdev_t *vd, dmu_tx_t *tx)
+{
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	vdev_log_entry_t *vle;
+	uint64_t obj;
+
+	ASSERT(vd == vd->vdev_top);
+	ASSERT(dmu_tx_is_syncing(tx));
+	ASSERT(vd->vdev_top_zap != 0);
+
+	if (vd->vdev_log_sm != NULL) {
+		ASSERT3U(vd->vdev_log_sm_txg, ==, txg);
+		return (vd->vdev_log_sm);
+	}
+
+	if (vd->vdev_log_zap == 0) {
+		vd->vdev_log_zap = zap_create(mos, DMU_OTN_ZAP_METADATA,
+		    DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_LOG_SPACEMAPS, sizeof (uint64_t), 1,
+		    &vd->vdev_log_zap, tx));
+	}
+
+	obj = space_map_alloc(mos, tx);
+	VERIFY0(zap_add_int_key(mos, vd->vdev_log_zap, txg, obj, tx));
+	VERIFY0(vdev_log_sm_open(vd, obj, &vd->vdev_log_sm));
+	vd->vdev_log_sm_txg = txg;
+
+	vle = kmem_alloc(sizeof (vdev_log_entry_t), KM_SLEEP);
+	vle->vle_txg = txg;
+	vle->vle_obj = obj;
+	list_insert_tail(&vd->vdev_log_list, vle);
+
+	spa->spa_log_sm_count++;
+	spa_feature_incr(spa, SPA_FEATURE_LOG_SPACEMAP, tx);
+
+	return (vd->vdev_log_sm);
+}
+
+void
+vdev_log_sm_sync_done(vdev_t *vd, uint64_t txg)
+{
+	if (vd->vdev_log_sm == NULL)
+		return;
+
+	ASSERT3U(vd->vdev_log_sm_txg, ==, txg);
+	space_map_close(vd->vdev_log_sm);
+	vd->vdev_log_sm = NULL;
+	vd->vdev_log_sm_txg = 0;
+}
+
+/*
+ * Persist the ms_unflushed_txg of a metaslab, 0 once it has been flushed.
+ */
+void
+vdev_log_set_unflushed_txg(vdev_t *vd, uint64_t ms_id, uint64_t txg,
+    dmu_tx_t *tx)
+{
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+	ASSERT(vd->vdev_top_zap != 0);
+
+	if (vd->vdev_unflushed_obj == 0) {
+		vd->vdev_unflushed_obj = dmu_object_alloc(mos,
+		    DMU_OTN_UINT64_METADATA, 0, DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_TXGS, sizeof (uint64_t), 1,
+		    &vd->vdev_unflushed_obj, tx));
+	}
+
+	dmu_write(mos, vd->vdev_unflushed_obj, ms_id * sizeof (uint64_t),
+	    sizeof (uint64_t), &txg, tx);
+}
+
+/*
+ * Destroy the log space maps of this vdev that only hold changes from
+ * before min_txg, all of which have been flushed.
+ */
+static void
+vdev_log_destroy_obsolete(vdev_t *vd, uint64_t min_txg, dmu_tx_t *tx)
+{
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	vdev_log_entry_t *vle;
+
+	while ((vle = list_head(&vd->vdev_log_list)) != NULL &&
+	    vle->vle_txg < min_txg) {
+		space_map_t *sm = NULL;
+
+		VERIFY0(vdev_log_sm_open(vd, vle->vle_obj, &sm));
+		space_map_free(sm, tx);
+		space_map_close(sm);
+		VERIFY0(zap_remove_int_key(mos, vd->vdev_log_zap,
+		    vle->vle_txg, tx));
+
+		list_remove(&vd->vdev_log_list, vle);
+		kmem_free(vle, sizeof (vdev_log_entry_t));
+
+		ASSERT3U(spa->spa_log_sm_count, >, 0);
+		spa->spa_log_sm_count--;
+		spa_feature_decr(spa, SPA_FEATURE_LOG_SPACEMAP, tx);
+	}
+}
+
+/*
+ * Called in the first pass of spa_sync(), before the vdevs are synced.
+ * Destroys the logs no metaslab needs anymore and marks the metaslabs
+ * that are to flush in this txg.
+ */
+void
+spa_log_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t min_txg, nflush;
+	metaslab_t *msp;
+
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	mutex_enter(&spa->spa_log_lock);
+	msp = avl_first(&spa->spa_unflushed_ms);
+	min_txg = (msp != NULL) ? msp->ms_unflushed_txg : UINT64_MAX;
+	mutex_exit(&spa->spa_log_lock);
+
+	if (spa->spa_log_sm_count != 0) {
+		for (int c = 0; c < rvd->vdev_children; c++)
+			vdev_log_destroy_obsolete(rvd->vdev_child[c],
+			    min_txg, tx);
+	}
+
+	if (msp == NULL)
+		return;
+
+	/*
+	 * Flush enough metaslabs that each of them is flushed about once
+	 * every zfs_unflushed_log_txg_max txgs, and any metaslab that has
+	 * been unflushed for longer than that.  Since the metaslabs are
+	 * sorted by ms_unflushed_txg the latter are at the front.  When
+	 * logging is being turned off, flush everything.
+	 */
+	if (spa_log_sm_enabled(spa)) {
+		nflush = MAX(zfs_min_metaslabs_to_flush,
+		    howmany(avl_numnodes(&spa->spa_unflushed_ms),
+		    MAX(zfs_unflushed_log_txg_max, 1)));
+	} else {
+		nflush = UINT64_MAX;
+	}
+
+	mutex_enter(&spa->spa_log_lock);
+	for (msp = avl_first(&spa->spa_unflushed_ms); msp != NULL;
+	    msp = AVL_NEXT(&spa->spa_unflushed_ms, msp)) {
+		if (nflush == 0 &&
+		    msp->ms_unflushed_txg + zfs_unflushed_log_txg_max > txg)
+			break;
+		if (nflush != 0)
+			nflush--;
+
+		if (!msp->ms_flush_wanted) {
+			msp->ms_flush_wanted = B_TRUE;
+			vdev_dirty(msp->ms_group->mg_vd, VDD_METASLAB,
+			    msp, txg);
+		}
+	}
+	mutex_exit(&spa->spa_log_lock);
+}
+
+/*
+ * Flush every metaslab and destroy the logs, so that the pool no longer
+ * depends on them.  Called when the pool is exported.
+ */
+void
+spa_log_flush_all(spa_t *spa)
+{
+	if (!spa_writeable(spa) || zfs_keep_log_spacemaps_at_export)
+		return;
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+		return;
+
+	/*
+	 * The first txg flushes the metaslabs and the next one destroys
+	 * the logs; txg_wait_synced() of txg 0 waits for TXG_DEFER_SIZE
+	 * txgs past the open one.
+	 */
+	spa->spa_log_flushall = B_TRUE;
+	txg_wait_synced(spa_get_dsl(spa), 0);
+}
+
+typedef struct spa_ld_log_arg {
+	vdev_t		*slla_vd;
+	uint64_t	slla_txg;
+} spa_ld_log_arg_t;
+
+static int
+spa_ld_log_sm_cb(maptype_t type, uint64_t offset, uint64_t size, void *arg)
+{
+	spa_ld_log_arg_t *slla = arg;
+	vdev_t *vd = slla->slla_vd;
+	uint64_t id = offset >> vd->vdev_ms_shift;
+	metaslab_t *msp;
+
+	VERIFY3U(id, <, vd->vdev_ms_count);
+	msp = vd->vdev_ms[id];
+
+	/* changes from before the last flush are already in ms_sm */
+	if (msp->ms_unflushed_txg == 0 ||
+	    slla->slla_txg < msp->ms_unflushed_txg)
+		return (0);
+
+	mutex_enter(&msp->ms_lock);
+	if (type == SM_ALLOC) {
+		metaslab_unflushed_alloc(msp, offset, size);
+		if (msp->ms_loaded)
+			range_tree_remove(msp->ms_tree, offset, size);
+	} else {
+		metaslab_unflushed_free(msp, offset, size);
+		if (msp->ms_loaded)
+			range_tree_add(msp->ms_tree, offset, size);
+	}
+	mutex_exit(&msp->ms_lock);
+
+	return (0);
+}
+
+static void
+vdev_log_insert_sorted(vdev_t *vd, vdev_log_entry_t *vle)
+{
+	vdev_log_entry_t *next;
+
+	for (next = list_head(&vd->vdev_log_list); next != NULL;
+	    next = list_next(&vd->vdev_log_list, next)) {
+		if (next->vle_txg > vle->vle_txg)
+			break;
+	}
+	list_insert_before(&vd->vdev_log_list, next, vle);
+}
+
+static int
+vdev_ld_log_spacemaps(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	vdev_log_entry_t *vle;
+	uint64_t *txgs;
+	int error;
+
+	if (vd->vdev_top_zap == 0 || vd->vdev_ms == NULL)
+		return (0);
+
+	error = zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_TXGS, sizeof (uint64_t), 1,
+	    &vd->vdev_unflushed_obj);
+	if (error != 0 && error != ENOENT)
+		return (error);
+	error = zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_LOG_SPACEMAPS, sizeof (uint64_t), 1,
+	    &vd->vdev_log_zap);
+	if (error != 0 && error != ENOENT)
+		return (error);
+
+	if (vd->vdev_unflushed_obj != 0) {
+		txgs = kmem_zalloc(vd->vdev_ms_count * sizeof (uint64_t),
+		    KM_SLEEP);
+		error = dmu_read(mos, vd->vdev_unflushed_obj, 0,
+		    vd->vdev_ms_count * sizeof (uint64_t), txgs,
+		    DMU_READ_PREFETCH);
+		if (error != 0) {
+			kmem_free(txgs, vd->vdev_ms_count * sizeof (uint64_t));
+			return (error);
+		}
+
+		mutex_enter(&spa->spa_log_lock);
+		for (uint64_t m = 0; m < vd->vdev_ms_count; m++) {
+			metaslab_t *msp = vd->vdev_ms[m];
+
+			if (txgs[m] == 0)
+				continue;
+			msp->ms_unflushed_txg = txgs[m];
+			avl_add(&spa->spa_unflushed_ms, msp);
+		}
+		mutex_exit(&spa->spa_log_lock);
+		kmem_free(txgs, vd->vdev_ms_count * sizeof (uint64_t));
+	}
+
+	if (vd->vdev_log_zap == 0)
+		return (0);
+
+	for (zap_cursor_init(&zc, mos, vd->vdev_log_zap);
+	    zap_cursor_retrieve(&zc, &za) == 0; zap_cursor_advance(&zc)) {
+		vle = kmem_alloc(sizeof (vdev_log_entry_t), KM_SLEEP);
+		vle->vle_txg = strtonum(za.za_name, NULL);
+		vle->vle_obj = za.za_first_integer;
+		vdev_log_insert_sorted(vd, vle);
+		spa->spa_log_sm_count++;
+	}
+	zap_cursor_fini(&zc);
+
+	/*
+	 * Replay the logs oldest first, so that the changes are applied in
+	 * the order they were made.
+	 */
+	for (vle = list_head(&vd->vdev_log_list); vle != NULL;
+	    vle = list_next(&vd->vdev_log_list, vle)) {
+		space_map_t *sm = NULL;
+		spa_ld_log_arg_t slla;
+
+		error = vdev_log_sm_open(vd, vle->vle_obj, &sm);
+		if (error != 0)
+			return (error);
+
+		slla.slla_vd = vd;
+		slla.slla_txg = vle->vle_txg;
+
+		mutex_enter(&vd->vdev_log_lock);
+		space_map_update(sm);
+		error = space_map_iterate(sm, spa_ld_log_sm_cb, &slla);
+		mutex_exit(&vd->vdev_log_lock);
+		space_map_close(sm);
+		if (error != 0)
+			return (error);
+	}
+
+	/*
+	 * metaslab_init() only accounted for the space allocated in ms_sm.
+	 */
+	for (uint64_t m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *msp = vd->vdev_ms[m];
+		int64_t delta;
+
+		mutex_enter(&msp->ms_lock);
+		delta = range_tree_space(msp->ms_unflushed_allocs) -
+		    range_tree_space(msp->ms_unflushed_frees);
+		mutex_exit(&msp->ms_lock);
+
+		if (delta != 0)
+			vdev_space_update(vd, delta, 0, 0);
+	}
+
+	return (0);
+}
+
+/*
+ * Load the log space maps of all top-level vdevs and replay them into the
+ * unflushed trees of their metaslabs.  Called by spa_load() once the
+ * metaslabs have been opened.
+ */
+int
+spa_ld_log_spacemaps(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	int error = 0;
+
+	spa->spa_log_flushall = B_FALSE;
+
+	for (int c = 0; c < rvd->vdev_children && error == 0; c++)
+		error = vdev_ld_log_spacemaps(rvd->vdev_child[c]);
+
+	if (error != 0) {
+		zfs_dbgmsg("spa %s: failed to load log space maps: %d",
+		    spa_name(spa), error);
+	}
+	return (error);
+}
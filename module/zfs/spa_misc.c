@@ -37,10 +37,12 @@
 #include <sys/zil.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
+#include <sys/vdev_raidz.h>
 #include <sys/metaslab.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
+#include <sys/btree.h>
 #include <sys/unique.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_dir.h>
@@ -49,11 +51,14 @@
 #include <sys/dsl_scan.h>
 #include <sys/fs/zfs.h>
 #include <sys/metaslab_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
 #include <sys/stropts.h>
 #include "zfs_prop.h"
 #include <sys/zfeature.h>
+#include <sys/abd.h>
+#include <sys/zfs_bench.h>
 
 /*
  * SPA locking
@@ -296,41 +301,149 @@ int spa_asize_inflation = 24;
 int spa_slop_shift = 5;
 uint64_t spa_min_slop = 128 * 1024 * 1024;
 
+/*
+ * Percentage of the special class kept for metadata: small file blocks
+ * (see the special_small_blocks property) are no longer allocated from it
+ * once it is fuller than this leaves room for.
+ */
+int zfs_special_class_metadata_reserve_pct = 25;
+
 /*
  * ==========================================================================
  * SPA config locking
  * ==========================================================================
  */
-static void
+/*
+ * The number of readers of scl.  All shard locks are held at once, like
+ * txg_quiesce() holds all tc_open_locks, as a reader can enter on one
+ * shard and exit on another.
+ */
+static int64_t
+spa_config_lock_readers(spa_config_lock_t *scl)
+{
+	int64_t readers = 0;
+	int c;
+
+	for (c = 0; c < max_ncpus; c++)
+		mutex_enter(&scl->scl_shards[c].scs_lock);
+	for (c = 0; c < max_ncpus; c++)
+		readers += scl->scl_shards[c].scs_count;
+	for (c = 0; c < max_ncpus; c++)
+		mutex_exit(&scl->scl_shards[c].scs_lock);
+
+	ASSERT3S(readers, >=, 0);
+	return (readers);
+}
+
+/*
+ * Make curthread the writer of scl if it has neither writer nor readers.
+ * Holding all shard locks while doing so also makes the caller's raised
+ * scl_write_wanted, and then scl_writer, seen by the next reader of
+ * every shard.
+ */
+static boolean_t
+spa_config_tryenter_write(spa_config_lock_t *scl)
+{
+	int64_t readers = 0;
+	int c;
+
+	ASSERT(MUTEX_HELD(&scl->scl_lock));
+	ASSERT(scl->scl_write_wanted > 0);
+
+	if (scl->scl_writer != NULL)
+		return (B_FALSE);
+
+	for (c = 0; c < max_ncpus; c++)
+		mutex_enter(&scl->scl_shards[c].scs_lock);
+	for (c = 0; c < max_ncpus; c++)
+		readers += scl->scl_shards[c].scs_count;
+	ASSERT3S(readers, >=, 0);
+	if (readers == 0)
+		scl->scl_writer = (kthread_t *)curthread;
+	for (c = 0; c < max_ncpus; c++)
+		mutex_exit(&scl->scl_shards[c].scs_lock);
+
+	return (readers == 0);
+}
+
+void
 spa_config_lock_init(spa_t *spa)
 {
-	int i;
+	int i, c;
 
 	for (i = 0; i < SCL_LOCKS; i++) {
 		spa_config_lock_t *scl = &spa->spa_config_lock[i];
 		mutex_init(&scl->scl_lock, NULL, MUTEX_DEFAULT, NULL);
 		cv_init(&scl->scl_cv, NULL, CV_DEFAULT, NULL);
-		refcount_create_untracked(&scl->scl_count);
+		scl->scl_shards = kmem_zalloc(max_ncpus *
+		    sizeof (spa_config_shard_t), KM_SLEEP);
+		for (c = 0; c < max_ncpus; c++)
+			mutex_init(&scl->scl_shards[c].scs_lock, NULL,
+			    MUTEX_DEFAULT, NULL);
 		scl->scl_writer = NULL;
 		scl->scl_write_wanted = 0;
 	}
 }
 
-static void
+void
 spa_config_lock_destroy(spa_t *spa)
 {
-	int i;
+	int i, c;
 
 	for (i = 0; i < SCL_LOCKS; i++) {
 		spa_config_lock_t *scl = &spa->spa_config_lock[i];
+		ASSERT0(spa_config_lock_readers(scl));
 		mutex_destroy(&scl->scl_lock);
 		cv_destroy(&scl->scl_cv);
-		refcount_destroy(&scl->scl_count);
+		for (c = 0; c < max_ncpus; c++)
+			mutex_destroy(&scl->scl_shards[c].scs_lock);
+		kmem_free(scl->scl_shards,
+		    max_ncpus * sizeof (spa_config_shard_t));
+		scl->scl_shards = NULL;
 		ASSERT(scl->scl_writer == NULL);
 		ASSERT(scl->scl_write_wanted == 0);
 	}
 }
 
+/*
+ * Count a reader in on this cpu's shard, unless a writer holds or wants
+ * the lock.
+ */
+static boolean_t
+spa_config_tryenter_read(spa_config_lock_t *scl)
+{
+	spa_config_shard_t *scs = &scl->scl_shards[CPU_SEQID % max_ncpus];
+	boolean_t entered = B_FALSE;
+
+	mutex_enter(&scs->scs_lock);
+	if (scl->scl_writer == NULL && scl->scl_write_wanted == 0) {
+		scs->scs_count++;
+		entered = B_TRUE;
+	}
+	mutex_exit(&scs->scs_lock);
+
+	return (entered);
+}
+
+static void
+spa_config_exit_read(spa_config_lock_t *scl)
+{
+	spa_config_shard_t *scs = &scl->scl_shards[CPU_SEQID % max_ncpus];
+	boolean_t wanted;
+
+	mutex_enter(&scs->scs_lock);
+	scs->scs_count--;
+	wanted = (scl->scl_write_wanted != 0);
+	mutex_exit(&scs->scs_lock);
+
+	/* The writer may be waiting for this reader to drain */
+	if (wanted) {
+		mutex_enter(&scl->scl_lock);
+		cv_broadcast(&scl->scl_cv);
+		mutex_exit(&scl->scl_lock);
+	}
+}
+
 int
 spa_config_tryenter(spa_t *spa, int locks, void *tag, krw_t rw)
 {
@@ -340,25 +453,25 @@ spa_config_tryenter(spa_t *spa, int locks, void *tag, krw_t rw)
 		spa_config_lock_t *scl = &spa->spa_config_lock[i];
 		if (!(locks & (1 << i)))
 			continue;
-		mutex_enter(&scl->scl_lock);
 		if (rw == RW_READER) {
-			if (scl->scl_writer || scl->scl_write_wanted) {
-				mutex_exit(&scl->scl_lock);
+			if (!spa_config_tryenter_read(scl)) {
 				spa_config_exit(spa, locks & ((1 << i) - 1),
 				    tag);
 				return (0);
 			}
-		} else {
-			ASSERT(scl->scl_writer != curthread);
-			if (!refcount_is_zero(&scl->scl_count)) {
-				mutex_exit(&scl->scl_lock);
-				spa_config_exit(spa, locks & ((1 << i) - 1),
-				    tag);
-				return (0);
-			}
-			scl->scl_writer = (kthread_t *)curthread;
+			continue;
 		}
-		(void) refcount_add(&scl->scl_count, tag);
+		mutex_enter(&scl->scl_lock);
+		ASSERT(scl->scl_writer != curthread);
+		scl->scl_write_wanted++;
+		if (!spa_config_tryenter_write(scl)) {
+			scl->scl_write_wanted--;
+			cv_broadcast(&scl->scl_cv);
+			mutex_exit(&scl->scl_lock);
+			spa_config_exit(spa, locks & ((1 << i) - 1), tag);
+			return (0);
+		}
+		scl->scl_write_wanted--;
 		mutex_exit(&scl->scl_lock);
 	}
 	return (1);
@@ -378,26 +491,32 @@ spa_config_enter(spa_t *spa, int locks, void *tag, krw_t rw)
 			wlocks_held |= (1 << i);
 		if (!(locks & (1 << i)))
 			continue;
-		mutex_enter(&scl->scl_lock);
 		if (rw == RW_READER) {
-			while (scl->scl_writer || scl->scl_write_wanted) {
-				cv_wait(&scl->scl_cv, &scl->scl_lock);
-			}
-		} else {
-			ASSERT(scl->scl_writer != curthread);
-			while (!refcount_is_zero(&scl->scl_count)) {
-				scl->scl_write_wanted++;
-				cv_wait(&scl->scl_cv, &scl->scl_lock);
-				scl->scl_write_wanted--;
+			while (!spa_config_tryenter_read(scl)) {
+				mutex_enter(&scl->scl_lock);
+				while (scl->scl_writer ||
+				    scl->scl_write_wanted) {
+					cv_wait(&scl->scl_cv, &scl->scl_lock);
+				}
+				mutex_exit(&scl->scl_lock);
 			}
-			scl->scl_writer = (kthread_t *)curthread;
+			continue;
 		}
-		(void) refcount_add(&scl->scl_count, tag);
+		mutex_enter(&scl->scl_lock);
+		ASSERT(scl->scl_writer != curthread);
+		scl->scl_write_wanted++;
+		while (!spa_config_tryenter_write(scl))
+			cv_wait(&scl->scl_cv, &scl->scl_lock);
+		scl->scl_write_wanted--;
 		mutex_exit(&scl->scl_lock);
 	}
 	ASSERT(wlocks_held <= locks);
 }
 
+/*
+ * A writer holds no count, and no reader can hold a lock that has a
+ * writer, so a lock with a writer is dropped by that writer.
+ */
 void
 spa_config_exit(spa_t *spa, int locks, void *tag)
 {
@@ -407,14 +526,14 @@ spa_config_exit(spa_t *spa, int locks, void *tag)
 		spa_config_lock_t *scl = &spa->spa_config_lock[i];
 		if (!(locks & (1 << i)))
 			continue;
-		mutex_enter(&scl->scl_lock);
-		ASSERT(!refcount_is_zero(&scl->scl_count));
-		if (refcount_remove(&scl->scl_count, tag) == 0) {
-			ASSERT(scl->scl_writer == NULL ||
-			    scl->scl_writer == curthread);
-			scl->scl_writer = NULL;	/* OK in either case */
-			cv_broadcast(&scl->scl_cv);
+		if (scl->scl_writer == NULL) {
+			spa_config_exit_read(scl);
+			continue;
 		}
+		mutex_enter(&scl->scl_lock);
+		ASSERT(scl->scl_writer == curthread);
+		scl->scl_writer = NULL;
+		cv_broadcast(&scl->scl_cv);
 		mutex_exit(&scl->scl_lock);
 	}
 }
@@ -428,7 +547,8 @@ spa_config_held(spa_t *spa, int locks, krw_t rw)
 		spa_config_lock_t *scl = &spa->spa_config_lock[i];
 		if (!(locks & (1 << i)))
 			continue;
-		if ((rw == RW_READER && !refcount_is_zero(&scl->scl_count)) ||
+		if ((rw == RW_READER && (scl->scl_writer != NULL ||
+		    spa_config_lock_readers(scl) != 0)) ||
 		    (rw == RW_WRITER && scl->scl_writer == (kthread_t *)curthread))
 			locks_held |= 1 << i;
 	}
@@ -522,12 +642,19 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	mutex_init(&spa->spa_vdev_top_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_feat_stats_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_alloc_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_log_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_trim_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_rebuild_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_warm_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_evicting_os_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_proc_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_scrub_io_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_suspend_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&spa->spa_trim_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&spa->spa_rebuild_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&spa->spa_warm_cv, NULL, CV_DEFAULT, NULL);
 
 	for (t = 0; t < TXG_SIZE; t++)
 		bplist_create(&spa->spa_free_bplist[t]);
@@ -556,6 +683,10 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 
 	avl_create(&spa->spa_alloc_tree, zio_bookmark_compare,
 	    sizeof (zio_t), offsetof(zio_t, io_alloc_node));
+	avl_create(&spa->spa_unflushed_ms, spa_unflushed_ms_compare,
+	    sizeof (metaslab_t), offsetof(metaslab_t, ms_unflushed_node));
+
+	spa_keystore_init(&spa->spa_keystore);
 
 	/*
 	 * Every pool starts with the default cachefile
@@ -567,6 +698,9 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	dp->scd_path = altroot ? NULL : spa_strdup(spa_config_path);
 	list_insert_head(&spa->spa_config_list, dp);
 
+	/* Not yet in any cache file */
+	spa->spa_config_set_count = 1;
+
 	VERIFY(nvlist_alloc(&spa->spa_load_info, NV_UNIQUE_NAME,
 	    KM_SLEEP) == 0);
 
@@ -635,8 +769,11 @@ spa_remove(spa_t *spa)
 	}
 
 	avl_destroy(&spa->spa_alloc_tree);
+	avl_destroy(&spa->spa_unflushed_ms);
 	list_destroy(&spa->spa_config_list);
 
+	spa_keystore_fini(&spa->spa_keystore);
+
 	nvlist_free(spa->spa_label_features);
 	nvlist_free(spa->spa_load_info);
 	nvlist_free(spa->spa_feat_stats);
@@ -657,8 +794,15 @@ spa_remove(spa_t *spa)
 	cv_destroy(&spa->spa_proc_cv);
 	cv_destroy(&spa->spa_scrub_io_cv);
 	cv_destroy(&spa->spa_suspend_cv);
+	cv_destroy(&spa->spa_trim_cv);
+	cv_destroy(&spa->spa_rebuild_cv);
+	cv_destroy(&spa->spa_warm_cv);
 
 	mutex_destroy(&spa->spa_alloc_lock);
+	mutex_destroy(&spa->spa_log_lock);
+	mutex_destroy(&spa->spa_trim_lock);
+	mutex_destroy(&spa->spa_rebuild_lock);
+	mutex_destroy(&spa->spa_warm_lock);
 	mutex_destroy(&spa->spa_async_lock);
 	mutex_destroy(&spa->spa_errlist_lock);
 	mutex_destroy(&spa->spa_errlog_lock);
@@ -1041,6 +1185,8 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	 */
 	ASSERT(metaslab_class_validate(spa_normal_class(spa)) == 0);
 	ASSERT(metaslab_class_validate(spa_log_class(spa)) == 0);
+	ASSERT(metaslab_class_validate(spa_special_class(spa)) == 0);
+	ASSERT(metaslab_class_validate(spa_dedup_class(spa)) == 0);
 
 	spa_config_exit(spa, SCL_ALL, spa);
 
@@ -1155,7 +1301,7 @@ spa_vdev_state_exit(spa_t *spa, vdev_t *vd, int error)
 	 */
 	if (config_changed) {
 		mutex_enter(&spa_namespace_lock);
-		spa_config_sync(spa, B_FALSE, B_TRUE);
+		spa_config_sync_deferred(spa);
 		mutex_exit(&spa_namespace_lock);
 	}
 
@@ -1621,6 +1767,58 @@ spa_log_class(spa_t *spa)
 	return (spa->spa_log_class);
 }
 
+metaslab_class_t *
+spa_special_class(spa_t *spa)
+{
+	return (spa->spa_special_class);
+}
+
+metaslab_class_t *
+spa_dedup_class(spa_t *spa)
+{
+	return (spa->spa_dedup_class);
+}
+
+/*
+ * Return the class a block should be allocated from first.  The blocks of
+ * the dedup tables go to the dedup class when the pool has dedup vdevs,
+ * and other metadata to the special class when it has special vdevs (as
+ * do the dedup tables without dedup vdevs).  The caller falls back to the
+ * normal class when that allocation fails.
+ *
+ * Data blocks with a psize of up to special_smallblk (the dataset's
+ * special_small_blocks) go there too, but only while the special class is
+ * less than (100 - zfs_special_class_metadata_reserve_pct)% full, so that
+ * small files cannot push the metadata out.
+ */
+metaslab_class_t *
+spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t type,
+    uint64_t level, uint64_t special_smallblk)
+{
+	metaslab_class_t *special = spa->spa_special_class;
+
+	if ((type == DMU_OT_DDT_ZAP || type == DMU_OT_DDT_STATS) &&
+	    spa->spa_dedup_class->mc_rotor != NULL)
+		return (spa->spa_dedup_class);
+
+	if (special->mc_rotor == NULL)
+		return (spa->spa_normal_class);
+
+	if (level > 0 || DMU_OT_IS_METADATA(type))
+		return (special);
+
+	if (special_smallblk != 0 && size <= special_smallblk) {
+		uint64_t space = metaslab_class_get_space(special);
+		uint64_t limit = space / 100 *
+		    (100 - MIN(zfs_special_class_metadata_reserve_pct, 100));
+
+		if (metaslab_class_get_alloc(special) < limit)
+			return (special);
+	}
+
+	return (spa->spa_normal_class);
+}
+
 void
 spa_evicting_os_register(spa_t *spa, objset_t *os)
 {
@@ -1786,17 +1984,28 @@ spa_init(int mode)
 	fm_init();
 	refcount_init();
 	unique_init();
-	range_tree_init();
+	fletcher_4_init();
+	zfs_btree_init();
 	metaslab_alloc_trace_init();
+	metaslab_stat_init();
+	abd_init();
+#ifdef _KERNEL
+	/* userland consumers initialize the ICP in kernel_init() */
+	icp_init();
+#endif
 	ddt_init();
 	zio_init();
+	vdev_raidz_math_init();
+	zfs_bench_init();
 	dmu_init();
 	zil_init();
 	vdev_cache_stat_init();
+	vdev_file_init();
 	zfs_prop_init();
 	zpool_prop_init();
 	zpool_feature_init();
 	spa_config_load();
+	spa_config_sync_start();
 	l2arc_start();
 }
 
@@ -1804,16 +2013,26 @@ void
 spa_fini(void)
 {
 	l2arc_stop();
+	spa_config_sync_stop();
 
 	spa_evict_all();
 
+	vdev_file_fini();
 	vdev_cache_stat_fini();
 	zil_fini();
 	dmu_fini();
+	zfs_bench_fini();
+	vdev_raidz_math_fini();
 	zio_fini();
 	ddt_fini();
+#ifdef _KERNEL
+	icp_fini();
+#endif
+	abd_fini();
+	metaslab_stat_fini();
 	metaslab_alloc_trace_fini();
-	range_tree_fini();
+	zfs_btree_fini();
+	fletcher_4_fini();
 	unique_fini();
 	refcount_fini();
 	fm_fini();
@@ -1959,3 +2178,12 @@ spa_maxblocksize(spa_t *spa)
 	else
 		return (SPA_OLD_MAXBLOCKSIZE);
 }
+
+int
+spa_maxdnodesize(spa_t *spa)
+{
+	if (spa_feature_is_enabled(spa, SPA_FEATURE_LARGE_DNODE))
+		return (DNODE_MAX_SIZE);
+	else
+		return (DNODE_MIN_SIZE);
+}
@@ -21,6 +21,9 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa_impl.h>
+#include <sys/metaslab.h>
+#include <sys/metaslab_impl.h>
+#include <sys/vdev_impl.h>
 
 /*
  * Keeps stats on last N reads per spa_t, disabled by default.
@@ -248,7 +251,9 @@ typedef struct spa_txg_history {
 	uint64_t	reads;		/* number of read operations */
 	uint64_t	writes;		/* number of write operations */
 	uint64_t	ndirty;		/* number of dirty bytes */
+	uint64_t	nearly;		/* bytes written before the sync */
 	hrtime_t	times[TXG_STATE_COMMITTED]; /* completion times */
+	hrtime_t	sync[TXG_SYNC_PHASES];	/* spa_sync() phases */
 	list_node_t	sth_link;
 } spa_txg_history_t;
 
@@ -256,9 +261,12 @@ static int
 spa_txg_history_headers(char *buf, size_t size)
 {
 	(void) snprintf(buf, size, "%-8s %-16s %-5s %-12s %-12s %-12s "
-	    "%-8s %-8s %-12s %-12s %-12s %-12s\n", "txg", "birth", "state",
-	    "ndirty", "nread", "nwritten", "reads", "writes",
-	    "otime", "qtime", "wtime", "stime");
+	    "%-12s %-8s %-8s %-12s %-12s %-12s %-12s %-12s %-12s %-12s "
+	    "%-12s %-12s %-12s %-12s %-12s %-12s\n", "txg", "birth", "state",
+	    "ndirty", "nearly", "nread", "nwritten", "reads", "writes",
+	    "otime", "qtime", "wtime", "stime",
+	    "dstime", "uqtime", "ddtime", "mostime", "sttime", "dntime",
+	    "fltime", "lbtime", "ubtime");
 
 	return (0);
 }
@@ -296,14 +304,25 @@ spa_txg_history_data(char *buf, size_t size, void *data)
 		sync = sth->times[TXG_STATE_SYNCED] -
 		    sth->times[TXG_STATE_WAIT_FOR_SYNC];
 
-	(void) snprintf(buf, size, "%-8llu %-16llu %-5c %-12llu "
-	    "%-12llu %-12llu %-8llu %-8llu %-12llu %-12llu %-12llu %-12llu\n",
+	(void) snprintf(buf, size, "%-8llu %-16llu %-5c %-12llu %-12llu "
+	    "%-12llu %-12llu %-8llu %-8llu %-12llu %-12llu %-12llu %-12llu "
+	    "%-12llu %-12llu %-12llu %-12llu %-12llu %-12llu %-12llu %-12llu "
+	    "%-12llu\n",
 	    (longlong_t)sth->txg, sth->times[TXG_STATE_BIRTH], state,
-	    (u_longlong_t)sth->ndirty,
+	    (u_longlong_t)sth->ndirty, (u_longlong_t)sth->nearly,
 	    (u_longlong_t)sth->nread, (u_longlong_t)sth->nwritten,
 	    (u_longlong_t)sth->reads, (u_longlong_t)sth->writes,
 	    (u_longlong_t)open, (u_longlong_t)quiesce, (u_longlong_t)wait,
-	    (u_longlong_t)sync);
+	    (u_longlong_t)sync,
+	    (u_longlong_t)sth->sync[TXG_SYNC_DATASETS],
+	    (u_longlong_t)sth->sync[TXG_SYNC_USERQUOTA],
+	    (u_longlong_t)sth->sync[TXG_SYNC_DIRS],
+	    (u_longlong_t)sth->sync[TXG_SYNC_MOS],
+	    (u_longlong_t)sth->sync[TXG_SYNC_TASKS],
+	    (u_longlong_t)sth->sync[TXG_SYNC_DNODES],
+	    (u_longlong_t)sth->sync[TXG_SYNC_FLUSH],
+	    (u_longlong_t)sth->sync[TXG_SYNC_LABELS],
+	    (u_longlong_t)sth->sync[TXG_SYNC_UBERBLOCK]);
 
 	return (0);
 }
@@ -505,14 +524,74 @@ spa_txg_history_set_io(spa_t *spa, uint64_t txg, uint64_t nread,
 	return (error);
 }
 
+/*
+ * Set the number of bytes written by dsl_pool_early_write().
+ */
+int
+spa_txg_history_set_early(spa_t *spa, uint64_t txg, uint64_t nearly)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.txg_history;
+	spa_txg_history_t *sth;
+	int error = ENOENT;
+
+	if (zfs_txg_history == 0)
+		return (0);
+
+	mutex_enter(&ssh->lock);
+	for (sth = list_head(&ssh->list); sth != NULL;
+	    sth = list_next(&ssh->list, sth)) {
+		if (sth->txg == txg) {
+			sth->nearly = nearly;
+			error = 0;
+			break;
+		}
+	}
+	mutex_exit(&ssh->lock);
+
+	return (error);
+}
+
+/*
+ * Add the time spent in a phase of dsl_pool_sync().  Phases are summed
+ * over all of the txg's sync passes.
+ */
+int
+spa_txg_history_add_sync(spa_t *spa, uint64_t txg, txg_sync_phase_t phase,
+    hrtime_t delta)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.txg_history;
+	spa_txg_history_t *sth;
+	int error = ENOENT;
+
+	ASSERT3U(phase, <, TXG_SYNC_PHASES);
+
+	if (zfs_txg_history == 0)
+		return (0);
+
+	mutex_enter(&ssh->lock);
+	for (sth = list_head(&ssh->list); sth != NULL;
+	    sth = list_next(&ssh->list, sth)) {
+		if (sth->txg == txg) {
+			sth->sync[phase] += delta;
+			error = 0;
+			break;
+		}
+	}
+	mutex_exit(&ssh->lock);
+
+	return (error);
+}
+
 /*
  * ==========================================================================
- * SPA TX Assign Histogram Routines
+ * SPA TX Assign and Delay Histogram Routines
  * ==========================================================================
  */
 
 /*
- * Tx statistics - Information exported regarding dmu_tx_assign time.
+ * Tx statistics - Information exported regarding dmu_tx_assign time, and
+ * the time dmu_tx_delay() made transactions sleep.  Both are power of two
+ * histograms of nanoseconds.
  */
 
 /*
@@ -521,10 +600,9 @@ spa_txg_history_set_io(spa_t *spa, uint64_t txg, uint64_t nread,
  * such that they are not output.
  */
 static int
-spa_tx_assign_update(kstat_t *ksp, int rw)
+spa_nsecs_histogram_update(kstat_t *ksp, int rw)
 {
-	spa_t *spa = ksp->ks_private;
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
+	spa_stats_history_t *ssh = ksp->ks_private;
 	int i;
 
 	if (rw == KSTAT_WRITE) {
@@ -543,9 +621,9 @@ spa_tx_assign_update(kstat_t *ksp, int rw)
 }
 
 static void
-spa_tx_assign_init(spa_t *spa)
+spa_nsecs_histogram_init(spa_t *spa, spa_stats_history_t *ssh,
+    const char *kstat_name)
 {
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
 	char name[KSTAT_STRLEN];
 	kstat_named_t *ks;
 	kstat_t *ksp;
@@ -567,7 +645,7 @@ spa_tx_assign_init(spa_t *spa)
 		    (u_longlong_t)1 << i);
 	}
 
-	ksp = kstat_create(name, 0, "dmu_tx_assign", "misc",
+	ksp = kstat_create(name, 0, kstat_name, "misc",
 	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
 	ssh->kstat = ksp;
 
@@ -576,16 +654,15 @@ spa_tx_assign_init(spa_t *spa)
 		ksp->ks_data = ssh->_private;
 		ksp->ks_ndata = ssh->count;
 		ksp->ks_data_size = ssh->size;
-		ksp->ks_private = spa;
-		ksp->ks_update = spa_tx_assign_update;
+		ksp->ks_private = ssh;
+		ksp->ks_update = spa_nsecs_histogram_update;
 		kstat_install(ksp);
 	}
 }
 
 static void
-spa_tx_assign_destroy(spa_t *spa)
+spa_nsecs_histogram_destroy(spa_stats_history_t *ssh)
 {
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
 	kstat_t *ksp;
 
 	ksp = ssh->kstat;
@@ -596,18 +673,174 @@ spa_tx_assign_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
-void
-spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs)
+static void
+spa_nsecs_histogram_add(spa_stats_history_t *ssh, uint64_t nsecs)
 {
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
 	uint64_t idx = 0;
 
-	while (((1 << idx) < nsecs) && (idx < ssh->size - 1))
+	while (((1ULL << idx) < nsecs) && (idx < ssh->count - 1))
 		idx++;
 
 	atomic_inc_64(&((kstat_named_t *)ssh->_private)[idx].value.ui64);
 }
 
+void
+spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs)
+{
+	spa_nsecs_histogram_add(&spa->spa_stats.tx_assign_histogram, nsecs);
+}
+
+void
+spa_tx_delay_add_nsecs(spa_t *spa, uint64_t nsecs)
+{
+	spa_nsecs_histogram_add(&spa->spa_stats.tx_delay_histogram, nsecs);
+}
+
+/*
+ * ==========================================================================
+ * SPA Write Throttle Routines
+ * ==========================================================================
+ */
+
+/*
+ * The state of the pool's dirty data write throttle: the dirty data and
+ * delay scale now, how often and for how long transactions have been
+ * delayed or stalled at zfs_dirty_data_max, how many passed the delay under
+ * their dataset's dirty_weight share, and how long the pool has
+ * spent in each throttle state.  Writing the kstat resets the counters.
+ */
+typedef enum spa_tx_throttle_stat {
+	SPA_TX_THROTTLE_DIRTY,
+	SPA_TX_THROTTLE_DIRTY_PEAK,
+	SPA_TX_THROTTLE_DIRTY_MAX,
+	SPA_TX_THROTTLE_DELAY_SCALE,
+	SPA_TX_THROTTLE_DELAYS,
+	SPA_TX_THROTTLE_DELAY_TIME,
+	SPA_TX_THROTTLE_STALLS,
+	SPA_TX_THROTTLE_STALL_TIME,
+	SPA_TX_THROTTLE_PASSES,
+	SPA_TX_THROTTLE_TIME_NONE,
+	SPA_TX_THROTTLE_TIME_DELAY,
+	SPA_TX_THROTTLE_TIME_STALL,
+	SPA_TX_THROTTLE_STATS
+} spa_tx_throttle_stat_t;
+
+static const char *spa_tx_throttle_names[SPA_TX_THROTTLE_STATS] = {
+	"dirty_bytes",
+	"dirty_peak",
+	"dirty_max",
+	"delay_scale",
+	"delays",
+	"delay_ns",
+	"stalls",
+	"stall_ns",
+	"fair_passes",
+	"time_unthrottled_ns",
+	"time_delaying_ns",
+	"time_stalled_ns"
+};
+
+static int
+spa_tx_throttle_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.tx_throttle;
+	kstat_named_t *ks = ssh->_private;
+	dsl_pool_throttle_stats_t dpts;
+	dsl_pool_t *dp;
+
+	/*
+	 * The dsl_pool is closed by spa_unload() with SCL_ALL held as
+	 * writer.  Don't wait for it, just report the last values.
+	 */
+	if (!spa_config_tryenter(spa, SCL_STATE, FTAG, RW_READER))
+		return (0);
+
+	if ((dp = spa_get_dsl(spa)) == NULL) {
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return (0);
+	}
+
+	if (rw == KSTAT_WRITE) {
+		dsl_pool_throttle_stats_reset(dp);
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return (0);
+	}
+
+	dsl_pool_throttle_stats(dp, &dpts);
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	ks[SPA_TX_THROTTLE_DIRTY].value.ui64 = dpts.dpts_dirty;
+	ks[SPA_TX_THROTTLE_DIRTY_PEAK].value.ui64 = dpts.dpts_dirty_peak;
+	ks[SPA_TX_THROTTLE_DIRTY_MAX].value.ui64 = zfs_dirty_data_max;
+	ks[SPA_TX_THROTTLE_DELAY_SCALE].value.ui64 = dpts.dpts_delay_scale;
+	ks[SPA_TX_THROTTLE_DELAYS].value.ui64 = dpts.dpts_delays;
+	ks[SPA_TX_THROTTLE_DELAY_TIME].value.ui64 = dpts.dpts_delay_time;
+	ks[SPA_TX_THROTTLE_STALLS].value.ui64 = dpts.dpts_stalls;
+	ks[SPA_TX_THROTTLE_STALL_TIME].value.ui64 = dpts.dpts_stall_time;
+	ks[SPA_TX_THROTTLE_PASSES].value.ui64 = dpts.dpts_passes;
+	ks[SPA_TX_THROTTLE_TIME_NONE].value.ui64 =
+	    dpts.dpts_state_time[DP_THROTTLE_NONE];
+	ks[SPA_TX_THROTTLE_TIME_DELAY].value.ui64 =
+	    dpts.dpts_state_time[DP_THROTTLE_DELAY];
+	ks[SPA_TX_THROTTLE_TIME_STALL].value.ui64 =
+	    dpts.dpts_state_time[DP_THROTTLE_STALL];
+
+	return (0);
+}
+
+static void
+spa_tx_throttle_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.tx_throttle;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_TX_THROTTLE_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_alloc(ssh->size, KM_SLEEP);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (i = 0; i < ssh->count; i++) {
+		ks = &((kstat_named_t *)ssh->_private)[i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		ks->value.ui64 = 0;
+		(void) strlcpy(ks->name, spa_tx_throttle_names[i],
+		    KSTAT_STRLEN);
+	}
+
+	ksp = kstat_create(name, 0, "dmu_tx_throttle", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_tx_throttle_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_tx_throttle_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.tx_throttle;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
 /*
  * ==========================================================================
  * SPA IO History Routines
@@ -655,19 +888,1933 @@ spa_io_history_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Compression Early Abort Routines
+ * ==========================================================================
+ */
+
+/*
+ * How often zio_compress_data_adaptive() decided against compressing a
+ * block, and how often it compressed one for nothing.
+ */
+static const char *spa_compress_abort_names[SPA_COMPRESS_ABORT_STATS] = {
+	"probes",
+	"probe_aborts",
+	"streak_aborts",
+	"wasted"
+};
+
+static int
+spa_compress_abort_update(kstat_t *ksp, int rw)
+{
+	if (rw == KSTAT_WRITE)
+		memset(ksp->ks_data, 0, ksp->ks_data_size);
+
+	return (0);
+}
+
+static void
+spa_compress_abort_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.compress_abort;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_COMPRESS_ABORT_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_alloc(ssh->size, KM_SLEEP);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (i = 0; i < ssh->count; i++) {
+		ks = &((kstat_named_t *)ssh->_private)[i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		ks->value.ui64 = 0;
+		(void) strlcpy(ks->name, spa_compress_abort_names[i],
+		    KSTAT_STRLEN);
+	}
+
+	ksp = kstat_create(name, 0, "compress_abort", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_compress_abort_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_compress_abort_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.compress_abort;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+void
+spa_compress_abort_add(spa_t *spa, spa_compress_abort_stat_t stat)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.compress_abort;
+
+	ASSERT3U(stat, <, SPA_COMPRESS_ABORT_STATS);
+	atomic_inc_64(&((kstat_named_t *)ssh->_private)[stat].value.ui64);
+}
+
+/*
+ * ==========================================================================
+ * SPA Free Throttle Routines
+ * ==========================================================================
+ */
+
+/*
+ * How many frees spa_sync() issued, held back on the deferred bpobj and
+ * released from it again, and the space still held back.
+ */
+static const char *spa_free_names[SPA_FREE_STATS] = {
+	"issued",
+	"deferred",
+	"released",
+	"throttled_txgs",
+	"backlog_bytes"
+};
+
+static int
+spa_free_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = ksp->ks_data;
+	int i;
+
+	/* The backlog is a gauge; only the counters are reset */
+	if (rw == KSTAT_WRITE) {
+		for (i = 0; i < SPA_FREE_STATS; i++) {
+			if (i != SPA_FREE_BACKLOG_BYTES)
+				ks[i].value.ui64 = 0;
+		}
+	}
+
+	return (0);
+}
+
+static void
+spa_free_stats_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.frees;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_FREE_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_alloc(ssh->size, KM_SLEEP);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (i = 0; i < ssh->count; i++) {
+		ks = &((kstat_named_t *)ssh->_private)[i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		ks->value.ui64 = 0;
+		(void) strlcpy(ks->name, spa_free_names[i], KSTAT_STRLEN);
+	}
+
+	ksp = kstat_create(name, 0, "frees", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_free_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_free_stats_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.frees;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+void
+spa_free_stats_add(spa_t *spa, spa_free_stat_t stat, uint64_t delta)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.frees;
+
+	ASSERT3U(stat, <, SPA_FREE_STATS);
+	if (delta != 0)
+		atomic_add_64(
+		    &((kstat_named_t *)ssh->_private)[stat].value.ui64, delta);
+}
+
+void
+spa_free_stats_set(spa_t *spa, spa_free_stat_t stat, uint64_t value)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.frees;
+
+	ASSERT3U(stat, <, SPA_FREE_STATS);
+	((kstat_named_t *)ssh->_private)[stat].value.ui64 = value;
+}
+
+/*
+ * ==========================================================================
+ * SPA Ditto Read Routines
+ * ==========================================================================
+ */
+
+/*
+ * Which DVA of a ditto block served each of its reads, and how many reads
+ * had to be retried from another DVA; see vdev_mirror_child_select().
+ */
+static const char *spa_ditto_read_names[SPA_DITTO_READ_STATS] = {
+	"dva0",
+	"dva1",
+	"dva2",
+	"retries"
+};
+
+static void
+spa_ditto_read_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.ditto_reads;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_DITTO_READ_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_alloc(ssh->size, KM_SLEEP);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (i = 0; i < ssh->count; i++) {
+		ks = &((kstat_named_t *)ssh->_private)[i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		ks->value.ui64 = 0;
+		(void) strlcpy(ks->name, spa_ditto_read_names[i],
+		    KSTAT_STRLEN);
+	}
+
+	ksp = kstat_create(name, 0, "ditto_reads", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_compress_abort_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_ditto_read_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.ditto_reads;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+void
+spa_ditto_read_add(spa_t *spa, int stat)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.ditto_reads;
+
+	ASSERT3S(stat, >=, 0);
+	ASSERT3S(stat, <, SPA_DITTO_READ_STATS);
+	atomic_inc_64(&((kstat_named_t *)ssh->_private)[stat].value.ui64);
+}
+
+/*
+ * ==========================================================================
+ * SPA Metaslab Allocator Routines
+ * ==========================================================================
+ */
+
+/*
+ * Block allocator statistics of each metaslab class: how often groups
+ * switched allocators, the calls and total time spent in each allocator,
+ * and a power of two histogram of the time taken by single allocations.
+ */
+static const char *spa_alloc_class_names[SPA_ALLOC_CLASSES] = {
+	"normal",
+	"log",
+	"special",
+	"dedup"
+};
+
+#define	SPA_ALLOC_STAT_SWITCHES		0
+#define	SPA_ALLOC_STAT_ALLOCS(a)	(1 + 2 * (a))
+#define	SPA_ALLOC_STAT_NSECS(a)		(2 + 2 * (a))
+#define	SPA_ALLOC_STAT_LATENCY(i)	(1 + 2 * METASLAB_ALLOCATORS + (i))
+#define	SPA_ALLOC_STATS_PER_CLASS	\
+	SPA_ALLOC_STAT_LATENCY(SPA_ALLOC_LATENCY_BUCKETS)
+
+static kstat_named_t *
+spa_metaslab_alloc_stat(spa_t *spa, spa_alloc_class_t class, int stat)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_alloc;
+
+	ASSERT3U(class, <, SPA_ALLOC_CLASSES);
+	ASSERT3S(stat, <, SPA_ALLOC_STATS_PER_CLASS);
+	return (&((kstat_named_t *)ssh->_private)
+	    [class * SPA_ALLOC_STATS_PER_CLASS + stat]);
+}
+
+static int
+spa_metaslab_alloc_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_alloc;
+	int i;
+
+	if (rw == KSTAT_WRITE) {
+		for (i = 0; i < ssh->count; i++)
+			((kstat_named_t *)ssh->_private)[i].value.ui64 = 0;
+	}
+
+	return (0);
+}
+
+static void
+spa_metaslab_alloc_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_alloc;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int c, a, i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_ALLOC_CLASSES * SPA_ALLOC_STATS_PER_CLASS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (c = 0; c < SPA_ALLOC_CLASSES; c++) {
+		const char *cname = spa_alloc_class_names[c];
+
+		ks = spa_metaslab_alloc_stat(spa, c, SPA_ALLOC_STAT_SWITCHES);
+		ks->data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ks->name, KSTAT_STRLEN, "%s_switches", cname);
+
+		for (a = 0; a < METASLAB_ALLOCATORS; a++) {
+			ks = spa_metaslab_alloc_stat(spa, c,
+			    SPA_ALLOC_STAT_ALLOCS(a));
+			ks->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%s_%s_allocs",
+			    cname, metaslab_allocator_names[a]);
+
+			ks = spa_metaslab_alloc_stat(spa, c,
+			    SPA_ALLOC_STAT_NSECS(a));
+			ks->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%s_%s_nsecs",
+			    cname, metaslab_allocator_names[a]);
+		}
+
+		for (i = 0; i < SPA_ALLOC_LATENCY_BUCKETS; i++) {
+			ks = spa_metaslab_alloc_stat(spa, c,
+			    SPA_ALLOC_STAT_LATENCY(i));
+			ks->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%s_%llu_ns",
+			    cname, (u_longlong_t)1 << i);
+		}
+	}
+
+	ksp = kstat_create(name, 0, "metaslab_alloc", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_metaslab_alloc_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_metaslab_alloc_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_alloc;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+void
+spa_metaslab_alloc_add(spa_t *spa, spa_alloc_class_t class, int allocator,
+    uint64_t nsecs)
+{
+	int idx = MIN(highbit64(nsecs), SPA_ALLOC_LATENCY_BUCKETS - 1);
+
+	ASSERT3S(allocator, <, METASLAB_ALLOCATORS);
+	atomic_inc_64(&spa_metaslab_alloc_stat(spa, class,
+	    SPA_ALLOC_STAT_ALLOCS(allocator))->value.ui64);
+	atomic_add_64(&spa_metaslab_alloc_stat(spa, class,
+	    SPA_ALLOC_STAT_NSECS(allocator))->value.ui64, nsecs);
+	atomic_inc_64(&spa_metaslab_alloc_stat(spa, class,
+	    SPA_ALLOC_STAT_LATENCY(idx))->value.ui64);
+}
+
+void
+spa_metaslab_alloc_switch(spa_t *spa, spa_alloc_class_t class)
+{
+	atomic_inc_64(&spa_metaslab_alloc_stat(spa, class,
+	    SPA_ALLOC_STAT_SWITCHES)->value.ui64);
+}
+
+/*
+ * ==========================================================================
+ * SPA Fragmentation Routines
+ * ==========================================================================
+ */
+
+/*
+ * The free space of each metaslab class: its fragmentation metric, free
+ * bytes and the merged power of two histogram of free segment sizes of its
+ * metaslab groups, from the space map histograms.  Bucket names are log2
+ * of bytes.  Also counts the gang blocks written because no segment was
+ * large enough, and how many of those were written while the normal class
+ * had more than the slop space free, i.e. due to fragmentation rather than
+ * a full pool.  The per top-level vdev histograms are reported through the
+ * pool config, see "zpool frag".
+ */
+#define	SPA_FRAG_GANG_BLOCKS		0
+#define	SPA_FRAG_GANG_BYTES		1
+#define	SPA_FRAG_GANG_FRAGMENTED	2
+#define	SPA_FRAG_BUCKETS	(RANGE_TREE_HISTOGRAM_SIZE - SPA_MINBLOCKSHIFT)
+#define	SPA_FRAG_PER_CLASS	(2 + SPA_FRAG_BUCKETS)
+#define	SPA_FRAG_CLASS(c, s)	(3 + (c) * SPA_FRAG_PER_CLASS + (s))
+#define	SPA_FRAG_FRAGMENTATION	0
+#define	SPA_FRAG_FREE		1
+#define	SPA_FRAG_HISTO(b)	(2 + (b))
+#define	SPA_FRAG_STATS		SPA_FRAG_CLASS(SPA_ALLOC_CLASSES, 0)
+
+static metaslab_class_t *
+spa_fragmentation_class(spa_t *spa, spa_alloc_class_t c)
+{
+	switch (c) {
+	case SPA_ALLOC_CLASS_LOG:
+		return (spa_log_class(spa));
+	case SPA_ALLOC_CLASS_SPECIAL:
+		return (spa_special_class(spa));
+	case SPA_ALLOC_CLASS_DEDUP:
+		return (spa_dedup_class(spa));
+	default:
+		return (spa_normal_class(spa));
+	}
+}
+
+static int
+spa_fragmentation_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.fragmentation;
+	kstat_named_t *ks = ssh->_private;
+	metaslab_class_t *mc;
+	int c, b;
+
+	if (rw == KSTAT_WRITE) {
+		ks[SPA_FRAG_GANG_BLOCKS].value.ui64 = 0;
+		ks[SPA_FRAG_GANG_BYTES].value.ui64 = 0;
+		ks[SPA_FRAG_GANG_FRAGMENTED].value.ui64 = 0;
+		return (0);
+	}
+
+	for (c = 0; c < SPA_ALLOC_CLASSES; c++) {
+		if ((mc = spa_fragmentation_class(spa, c)) == NULL)
+			continue;
+
+		/* The histogram is read unlocked, as for its verification. */
+		ks[SPA_FRAG_CLASS(c, SPA_FRAG_FRAGMENTATION)].value.ui64 =
+		    metaslab_class_fragmentation(mc);
+		ks[SPA_FRAG_CLASS(c, SPA_FRAG_FREE)].value.ui64 =
+		    metaslab_class_get_space(mc) -
+		    metaslab_class_get_alloc(mc);
+		for (b = 0; b < SPA_FRAG_BUCKETS; b++) {
+			ks[SPA_FRAG_CLASS(c, SPA_FRAG_HISTO(b))].value.ui64 =
+			    mc->mc_histogram[SPA_MINBLOCKSHIFT + b];
+		}
+	}
+
+	return (0);
+}
+
+static void
+spa_fragmentation_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.fragmentation;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int c, b;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_FRAG_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+	ks = ssh->_private;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	kstat_named_init(&ks[SPA_FRAG_GANG_BLOCKS], "gang_blocks",
+	    KSTAT_DATA_UINT64);
+	kstat_named_init(&ks[SPA_FRAG_GANG_BYTES], "gang_bytes",
+	    KSTAT_DATA_UINT64);
+	kstat_named_init(&ks[SPA_FRAG_GANG_FRAGMENTED], "gang_fragmented",
+	    KSTAT_DATA_UINT64);
+
+	for (c = 0; c < SPA_ALLOC_CLASSES; c++) {
+		const char *cname = spa_alloc_class_names[c];
+
+		ks[SPA_FRAG_CLASS(c, SPA_FRAG_FRAGMENTATION)].data_type =
+		    KSTAT_DATA_UINT64;
+		(void) snprintf(ks[SPA_FRAG_CLASS(c,
+		    SPA_FRAG_FRAGMENTATION)].name, KSTAT_STRLEN,
+		    "%s_fragmentation", cname);
+		ks[SPA_FRAG_CLASS(c, SPA_FRAG_FREE)].data_type =
+		    KSTAT_DATA_UINT64;
+		(void) snprintf(ks[SPA_FRAG_CLASS(c, SPA_FRAG_FREE)].name,
+		    KSTAT_STRLEN, "%s_free", cname);
+
+		for (b = 0; b < SPA_FRAG_BUCKETS; b++) {
+			kstat_named_t *kh = &ks[SPA_FRAG_CLASS(c,
+			    SPA_FRAG_HISTO(b))];
+
+			kh->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(kh->name, KSTAT_STRLEN, "%s_free_%d",
+			    cname, SPA_MINBLOCKSHIFT + b);
+		}
+	}
+
+	ksp = kstat_create(name, 0, "fragmentation", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_fragmentation_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_fragmentation_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.fragmentation;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+void
+spa_fragmentation_gang_add(spa_t *spa, uint64_t size, boolean_t fragmented)
+{
+	kstat_named_t *ks = spa->spa_stats.fragmentation._private;
+
+	atomic_inc_64(&ks[SPA_FRAG_GANG_BLOCKS].value.ui64);
+	atomic_add_64(&ks[SPA_FRAG_GANG_BYTES].value.ui64, size);
+	if (fragmented)
+		atomic_inc_64(&ks[SPA_FRAG_GANG_FRAGMENTED].value.ui64);
+}
+
+/*
+ * ==========================================================================
+ * SPA Vdev Histogram Routines
+ * ==========================================================================
+ */
+
+/*
+ * The power of two latency and request size histograms of the pool's
+ * leaf vdevs, as kept in vdev_stat_ex_t and summed up the vdev tree by
+ * vdev_get_stats_ex().  Latency buckets are log2 of nanoseconds, size
+ * buckets log2 of bytes.  Per-vdev histograms are reported through the
+ * pool config, see "zpool iostat -w" and "zpool iostat -r".
+ */
+static const char *spa_vdev_histo_prio_names[ZIO_PRIORITY_NUM_QUEUEABLE] = {
+	"sync_r",
+	"sync_w",
+	"async_r",
+	"async_w",
+	"scrub",
+	"resilver"
+};
+
+static const char *spa_vdev_histo_type_names[] = {
+	[ZIO_TYPE_READ] = "r",
+	[ZIO_TYPE_WRITE] = "w"
+};
+
+#define	SPA_VDEV_HISTO_QUEUE(p, b)	\
+	((p) * VDEV_L_HISTO_BUCKETS + (b))
+#define	SPA_VDEV_HISTO_DISK(t, b)	\
+	SPA_VDEV_HISTO_QUEUE(ZIO_PRIORITY_NUM_QUEUEABLE + \
+	    ((t) - ZIO_TYPE_READ), b)
+#define	SPA_VDEV_HISTO_TOTAL(t, b)	\
+	SPA_VDEV_HISTO_QUEUE(ZIO_PRIORITY_NUM_QUEUEABLE + 2 + \
+	    ((t) - ZIO_TYPE_READ), b)
+#define	SPA_VDEV_HISTO_IND(p, b)	\
+	(SPA_VDEV_HISTO_QUEUE(ZIO_PRIORITY_NUM_QUEUEABLE + 4, 0) + \
+	    (p) * VDEV_RQ_HISTO_BUCKETS + (b))
+#define	SPA_VDEV_HISTO_AGG(p, b)	\
+	SPA_VDEV_HISTO_IND(ZIO_PRIORITY_NUM_QUEUEABLE + (p), b)
+#define	SPA_VDEV_HISTO_STATS		\
+	SPA_VDEV_HISTO_AGG(ZIO_PRIORITY_NUM_QUEUEABLE, 0)
+
+static void
+spa_vdev_histo_name(kstat_named_t *ks, int idx, const char *prefix,
+    const char *histo, int bucket)
+{
+	ks += idx;
+	ks->data_type = KSTAT_DATA_UINT64;
+	(void) snprintf(ks->name, KSTAT_STRLEN, "%s_%s_%d", prefix, histo,
+	    bucket);
+}
+
+static int
+spa_vdev_histo_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_histo;
+	kstat_named_t *ks = ssh->_private;
+	vdev_stat_ex_t *vsx;
+	int p, t, b;
+
+	/* These are cumulative and can't be reset */
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	vsx = kmem_zalloc(sizeof (vdev_stat_ex_t), KM_SLEEP);
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if (spa->spa_root_vdev != NULL)
+		vdev_get_stats_ex(spa->spa_root_vdev, NULL, vsx);
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		for (b = 0; b < VDEV_L_HISTO_BUCKETS; b++) {
+			ks[SPA_VDEV_HISTO_QUEUE(p, b)].value.ui64 =
+			    vsx->vsx_queue_histo[p][b];
+		}
+		for (b = 0; b < VDEV_RQ_HISTO_BUCKETS; b++) {
+			ks[SPA_VDEV_HISTO_IND(p, b)].value.ui64 =
+			    vsx->vsx_ind_histo[p][b];
+			ks[SPA_VDEV_HISTO_AGG(p, b)].value.ui64 =
+			    vsx->vsx_agg_histo[p][b];
+		}
+	}
+
+	for (t = ZIO_TYPE_READ; t <= ZIO_TYPE_WRITE; t++) {
+		for (b = 0; b < VDEV_L_HISTO_BUCKETS; b++) {
+			ks[SPA_VDEV_HISTO_DISK(t, b)].value.ui64 =
+			    vsx->vsx_disk_histo[t][b];
+			ks[SPA_VDEV_HISTO_TOTAL(t, b)].value.ui64 =
+			    vsx->vsx_total_histo[t][b];
+		}
+	}
+
+	kmem_free(vsx, sizeof (vdev_stat_ex_t));
+
+	return (0);
+}
+
+static void
+spa_vdev_histo_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_histo;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int p, t, b;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_VDEV_HISTO_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+	ks = ssh->_private;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		const char *pname = spa_vdev_histo_prio_names[p];
+
+		for (b = 0; b < VDEV_L_HISTO_BUCKETS; b++) {
+			spa_vdev_histo_name(ks, SPA_VDEV_HISTO_QUEUE(p, b),
+			    pname, "queue", b);
+		}
+		for (b = 0; b < VDEV_RQ_HISTO_BUCKETS; b++) {
+			spa_vdev_histo_name(ks, SPA_VDEV_HISTO_IND(p, b),
+			    pname, "ind", b);
+			spa_vdev_histo_name(ks, SPA_VDEV_HISTO_AGG(p, b),
+			    pname, "agg", b);
+		}
+	}
+
+	for (t = ZIO_TYPE_READ; t <= ZIO_TYPE_WRITE; t++) {
+		const char *tname = spa_vdev_histo_type_names[t];
+
+		for (b = 0; b < VDEV_L_HISTO_BUCKETS; b++) {
+			spa_vdev_histo_name(ks, SPA_VDEV_HISTO_DISK(t, b),
+			    tname, "disk", b);
+			spa_vdev_histo_name(ks, SPA_VDEV_HISTO_TOTAL(t, b),
+			    tname, "total", b);
+		}
+	}
+
+	ksp = kstat_create(name, 0, "vdev_histo", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_vdev_histo_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_vdev_histo_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_histo;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * ==========================================================================
+ * SPA Vdev Queue Depth Information
+ * ==========================================================================
+ */
+
+/*
+ * The state of the adaptive queue depth controller of each leaf vdev and
+ * queue class (see zfs_vdev_queue_tune in vdev_queue.c), snapshotted each
+ * time the kstat is read.  Latencies are in nanoseconds.
+ */
+typedef struct spa_vdev_queue_row {
+	uint64_t		guid;
+	zio_priority_t		prio;
+	boolean_t		nonrot;
+	vdev_queue_tune_t	tune;
+} spa_vdev_queue_row_t;
+
+static int
+spa_vdev_queue_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-20s %-8s %-6s %-10s %-12s %-12s "
+	    "%-10s %-10s\n", "guid", "class", "nonrot", "max_active",
+	    "lat_avg", "lat_floor", "grows", "shrinks");
+
+	return (0);
+}
+
+static int
+spa_vdev_queue_data(char *buf, size_t size, void *data)
+{
+	spa_vdev_queue_row_t *row = (spa_vdev_queue_row_t *)data;
+
+	(void) snprintf(buf, size, "%-20llu %-8s %-6d %-10u %-12llu %-12llu "
+	    "%-10llu %-10llu\n", (u_longlong_t)row->guid,
+	    spa_vdev_histo_prio_names[row->prio], (int)row->nonrot,
+	    row->tune.vqt_max_active, (u_longlong_t)row->tune.vqt_lat_avg,
+	    (u_longlong_t)row->tune.vqt_lat_floor,
+	    (u_longlong_t)row->tune.vqt_grows,
+	    (u_longlong_t)row->tune.vqt_shrinks);
+
+	return (0);
+}
+
+static void *
+spa_vdev_queue_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue;
+	spa_vdev_queue_row_t *rows = ssh->_private;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < 0 || (uint64_t)n >= ssh->count)
+		return (NULL);
+
+	return (&rows[n]);
+}
+
+/*
+ * Count the rows of the leaf vdevs under vd, filling in the first max of
+ * them if rows is not NULL.
+ */
+static uint64_t
+spa_vdev_queue_collect(vdev_t *vd, spa_vdev_queue_row_t *rows, uint64_t n,
+    uint64_t max)
+{
+	uint64_t c;
+	zio_priority_t p;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++, n++) {
+			if (rows == NULL || n >= max)
+				continue;
+			rows[n].guid = vd->vdev_guid;
+			rows[n].prio = p;
+			rows[n].nonrot = vd->vdev_nonrot;
+			vdev_queue_tune_get(vd, p, &rows[n].tune);
+		}
+		return (n);
+	}
+
+	for (c = 0; c < vd->vdev_children; c++)
+		n = spa_vdev_queue_collect(vd->vdev_child[c], rows, n, max);
+
+	return (n);
+}
+
+static int
+spa_vdev_queue_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue;
+	vdev_t *rvd;
+	uint64_t count;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	ssh->_private = NULL;
+	ssh->count = 0;
+	ssh->size = 0;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if ((rvd = spa->spa_root_vdev) != NULL &&
+	    (count = spa_vdev_queue_collect(rvd, NULL, 0, 0)) != 0) {
+		ssh->size = count * sizeof (spa_vdev_queue_row_t);
+		ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+		ssh->count = spa_vdev_queue_collect(rvd, ssh->_private, 0,
+		    count);
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	ksp->ks_ndata = ssh->count;
+	ksp->ks_data_size = ssh->count * sizeof (spa_vdev_queue_row_t);
+
+	return (0);
+}
+
+static void
+spa_vdev_queue_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "vdev_queue", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_vdev_queue_update;
+		kstat_set_raw_ops(ksp, spa_vdev_queue_headers,
+		    spa_vdev_queue_data, spa_vdev_queue_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_vdev_queue_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * ==========================================================================
+ * SPA RAID-Z Child Information
+ * ==========================================================================
+ */
+
+/*
+ * The bad data each child of a RAID-Z vdev silently returned, in total and
+ * decayed to its recent rate (see vdev_raidz_silent_recent()), and how
+ * often trying the vdev's suspect child first settled a reconstruction,
+ * snapshotted each time the kstat is read.
+ */
+typedef struct spa_raidz_children_row {
+	uint64_t	raidz_guid;
+	uint64_t	child;
+	uint64_t	guid;
+	uint64_t	silent_errors;
+	uint64_t	silent_recent;
+	uint64_t	hint_hits;
+	uint64_t	hint_misses;
+	boolean_t	suspect;
+} spa_raidz_children_row_t;
+
+static int
+spa_raidz_children_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-20s %-6s %-20s %-10s %-10s %-10s "
+	    "%-10s %-7s\n", "raidz_guid", "child", "guid", "silent",
+	    "recent", "hint_hits", "hint_miss", "suspect");
+
+	return (0);
+}
+
+static int
+spa_raidz_children_data(char *buf, size_t size, void *data)
+{
+	spa_raidz_children_row_t *row = (spa_raidz_children_row_t *)data;
+
+	(void) snprintf(buf, size, "%-20llu %-6llu %-20llu %-10llu %-10llu "
+	    "%-10llu %-10llu %-7d\n", (u_longlong_t)row->raidz_guid,
+	    (u_longlong_t)row->child, (u_longlong_t)row->guid,
+	    (u_longlong_t)row->silent_errors,
+	    (u_longlong_t)row->silent_recent,
+	    (u_longlong_t)row->hint_hits, (u_longlong_t)row->hint_misses,
+	    (int)row->suspect);
+
+	return (0);
+}
+
+static void *
+spa_raidz_children_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.raidz_children;
+	spa_raidz_children_row_t *rows = ssh->_private;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < 0 || (uint64_t)n >= ssh->count)
+		return (NULL);
+
+	return (&rows[n]);
+}
+
+/*
+ * Count the children of the RAID-Z vdevs under vd, filling in the first
+ * max of them if rows is not NULL.
+ */
+static uint64_t
+spa_raidz_children_collect(vdev_t *vd, spa_raidz_children_row_t *rows,
+    uint64_t n, uint64_t max)
+{
+	vdev_t *cvd;
+	uint64_t c;
+
+	if (vd->vdev_ops != &vdev_raidz_ops) {
+		for (c = 0; c < vd->vdev_children; c++) {
+			n = spa_raidz_children_collect(vd->vdev_child[c],
+			    rows, n, max);
+		}
+		return (n);
+	}
+
+	for (c = 0; c < vd->vdev_children; c++, n++) {
+		if (rows == NULL || n >= max)
+			continue;
+		cvd = vd->vdev_child[c];
+		rows[n].raidz_guid = vd->vdev_guid;
+		rows[n].child = c;
+		rows[n].guid = cvd->vdev_guid;
+		rows[n].silent_recent = vdev_raidz_silent_recent(cvd);
+		mutex_enter(&cvd->vdev_stat_lock);
+		rows[n].silent_errors = cvd->vdev_silent_errors;
+		rows[n].hint_hits = cvd->vdev_hint_hits;
+		rows[n].hint_misses = cvd->vdev_hint_misses;
+		mutex_exit(&cvd->vdev_stat_lock);
+		rows[n].suspect = (vd->vdev_raidz_suspect == c + 1);
+	}
+
+	return (n);
+}
+
+static int
+spa_raidz_children_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.raidz_children;
+	vdev_t *rvd;
+	uint64_t count;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	ssh->_private = NULL;
+	ssh->count = 0;
+	ssh->size = 0;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if ((rvd = spa->spa_root_vdev) != NULL &&
+	    (count = spa_raidz_children_collect(rvd, NULL, 0, 0)) != 0) {
+		ssh->size = count * sizeof (spa_raidz_children_row_t);
+		ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+		ssh->count = spa_raidz_children_collect(rvd, ssh->_private, 0,
+		    count);
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	ksp->ks_ndata = ssh->count;
+	ksp->ks_data_size = ssh->count * sizeof (spa_raidz_children_row_t);
+
+	return (0);
+}
+
+static void
+spa_raidz_children_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.raidz_children;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "raidz_children", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_raidz_children_update;
+		kstat_set_raw_ops(ksp, spa_raidz_children_headers,
+		    spa_raidz_children_data, spa_raidz_children_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_raidz_children_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.raidz_children;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * The allocations from the metaslab group of each top-level vdev, and its
+ * write latency average and the share of each pass around the rotor it
+ * gets because of it (metaslab_latency_bias_pct), snapshotted each time
+ * the kstat is read.  The allocation rates are the differences of the
+ * counters between reads.  Latencies are in nanoseconds.
+ */
+typedef struct spa_metaslab_groups_row {
+	uint64_t		guid;
+	spa_alloc_class_t	class;
+	uint64_t		allocations;
+	uint64_t		alloc_bytes;
+	uint64_t		write_latency;
+	int64_t			latency_pct;
+	int64_t			bias;
+} spa_metaslab_groups_row_t;
+
+static int
+spa_metaslab_groups_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-20s %-8s %-12s %-16s %-12s %-8s "
+	    "%-12s\n", "guid", "class", "allocations", "alloc_bytes",
+	    "write_lat", "lat_pct", "bias");
+
+	return (0);
+}
+
+static int
+spa_metaslab_groups_data(char *buf, size_t size, void *data)
+{
+	spa_metaslab_groups_row_t *row = (spa_metaslab_groups_row_t *)data;
+
+	(void) snprintf(buf, size, "%-20llu %-8s %-12llu %-16llu %-12llu "
+	    "%-8lld %-12lld\n", (u_longlong_t)row->guid,
+	    spa_alloc_class_names[row->class],
+	    (u_longlong_t)row->allocations, (u_longlong_t)row->alloc_bytes,
+	    (u_longlong_t)row->write_latency, (longlong_t)row->latency_pct,
+	    (longlong_t)row->bias);
+
+	return (0);
+}
+
+static void *
+spa_metaslab_groups_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_groups;
+	spa_metaslab_groups_row_t *rows = ssh->_private;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < 0 || (uint64_t)n >= ssh->count)
+		return (NULL);
+
+	return (&rows[n]);
+}
+
+static void
+spa_metaslab_groups_row(spa_t *spa, metaslab_group_t *mg,
+    spa_metaslab_groups_row_t *row)
+{
+	spa_alloc_class_t c;
+
+	row->guid = mg->mg_vd->vdev_guid;
+	row->class = SPA_ALLOC_CLASS_NORMAL;
+	for (c = 0; c < SPA_ALLOC_CLASSES; c++) {
+		if (mg->mg_class == spa_fragmentation_class(spa, c))
+			row->class = c;
+	}
+	row->allocations = mg->mg_allocations;
+	row->alloc_bytes = mg->mg_alloc_bytes;
+	row->write_latency = mg->mg_write_latency;
+	row->latency_pct = mg->mg_latency_pct;
+	row->bias = mg->mg_bias;
+}
+
+static int
+spa_metaslab_groups_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_groups;
+	spa_metaslab_groups_row_t *rows;
+	vdev_t *rvd;
+	uint64_t c, n;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	ssh->_private = NULL;
+	ssh->count = 0;
+	ssh->size = 0;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if ((rvd = spa->spa_root_vdev) != NULL && rvd->vdev_children != 0) {
+		ssh->size = rvd->vdev_children *
+		    sizeof (spa_metaslab_groups_row_t);
+		ssh->_private = rows = kmem_zalloc(ssh->size, KM_SLEEP);
+		for (c = 0, n = 0; c < rvd->vdev_children; c++) {
+			metaslab_group_t *mg = rvd->vdev_child[c]->vdev_mg;
+
+			if (mg != NULL)
+				spa_metaslab_groups_row(spa, mg, &rows[n++]);
+		}
+		ssh->count = n;
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	ksp->ks_ndata = ssh->count;
+	ksp->ks_data_size = ssh->count * sizeof (spa_metaslab_groups_row_t);
+
+	return (0);
+}
+
+static void
+spa_metaslab_groups_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_groups;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "metaslab_groups", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_metaslab_groups_update;
+		kstat_set_raw_ops(ksp, spa_metaslab_groups_headers,
+		    spa_metaslab_groups_data, spa_metaslab_groups_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_metaslab_groups_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.metaslab_groups;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * ==========================================================================
+ * SPA ZIL Statistics Routines
+ * ==========================================================================
+ */
+
+/*
+ * The "zil" kstat holds the pool-wide sums of the spa_zil_stat_t counters
+ * followed by the commit and lwb latency histograms.  The "zil_datasets"
+ * kstat has a row of the same counters for each dataset with an open log,
+ * snapshotted each time it is read.
+ */
+static const char *spa_zil_stat_names[SPA_ZIL_STATS] = {
+	"commits",
+	"commit_nsecs",
+	"commit_writers",
+	"itxs",
+	"lwbs_slog",
+	"lwbs_slog_bytes",
+	"lwbs_normal",
+	"lwbs_normal_bytes",
+	"lwb_nsecs",
+	"lwb_timeouts",
+	"stalls",
+	"flushes",
+	"flushes_elided",
+	"flush_nsecs"
+};
+
+static const char *spa_zil_latency_names[SPA_ZIL_LATENCIES] = {
+	"commit",
+	"lwb"
+};
+
+#define	SPA_ZIL_STAT_LATENCY(t, i)	\
+	(SPA_ZIL_STATS + (t) * SPA_ZIL_LATENCY_BUCKETS + (i))
+
+static int
+spa_zil_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zil;
+	int i;
+
+	if (rw == KSTAT_WRITE) {
+		for (i = 0; i < ssh->count; i++)
+			((kstat_named_t *)ssh->_private)[i].value.ui64 = 0;
+	}
+
+	return (0);
+}
+
+static void
+spa_zil_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int s, t, i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_ZIL_STAT_LATENCY(SPA_ZIL_LATENCIES, 0);
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+	ks = ssh->_private;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (s = 0; s < SPA_ZIL_STATS; s++) {
+		ks[s].data_type = KSTAT_DATA_UINT64;
+		(void) strlcpy(ks[s].name, spa_zil_stat_names[s],
+		    KSTAT_STRLEN);
+	}
+
+	for (t = 0; t < SPA_ZIL_LATENCIES; t++) {
+		for (i = 0; i < SPA_ZIL_LATENCY_BUCKETS; i++) {
+			kstat_named_t *kl = &ks[SPA_ZIL_STAT_LATENCY(t, i)];
+
+			kl->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(kl->name, KSTAT_STRLEN, "%s_%llu_ns",
+			    spa_zil_latency_names[t], (u_longlong_t)1 << i);
+		}
+	}
+
+	ksp = kstat_create(name, 0, "zil", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zil_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zil_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * Add val to a counter of the pool, and of the dataset szd if not NULL.
+ */
+void
+spa_zil_stat_add(spa_t *spa, spa_zil_ds_stats_t *szd, spa_zil_stat_t stat,
+    uint64_t val)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil;
+
+	ASSERT3U(stat, <, SPA_ZIL_STATS);
+	atomic_add_64(&((kstat_named_t *)ssh->_private)[stat].value.ui64, val);
+	if (szd != NULL)
+		atomic_add_64(&szd->szd_stats[stat], val);
+}
+
+void
+spa_zil_latency_add(spa_t *spa, spa_zil_latency_t type, uint64_t nsecs)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil;
+	int idx = MIN(highbit64(nsecs), SPA_ZIL_LATENCY_BUCKETS - 1);
+
+	ASSERT3U(type, <, SPA_ZIL_LATENCIES);
+	atomic_inc_64(&((kstat_named_t *)ssh->_private)
+	    [SPA_ZIL_STAT_LATENCY(type, idx)].value.ui64);
+}
+
+static int
+spa_zil_ds_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-10s %-10s %-14s %-10s %-10s %-10s "
+	    "%-14s %-10s %-14s %-14s %-8s %-8s %-10s %-10s %-14s\n",
+	    "objset", "commits", "commit_nsecs", "writers", "itxs",
+	    "lwbs_slog", "slog_bytes", "lwbs_norm", "norm_bytes",
+	    "lwb_nsecs", "timeouts", "stalls", "flushes", "elided",
+	    "flush_nsecs");
+
+	return (0);
+}
+
+static int
+spa_zil_ds_data(char *buf, size_t size, void *data)
+{
+	spa_zil_ds_stats_t *szd = data;
+	uint64_t *s = szd->szd_stats;
+
+	(void) snprintf(buf, size, "%-10llu %-10llu %-14llu %-10llu %-10llu "
+	    "%-10llu %-14llu %-10llu %-14llu %-14llu %-8llu %-8llu %-10llu "
+	    "%-10llu %-14llu\n",
+	    (u_longlong_t)szd->szd_objset,
+	    (u_longlong_t)s[SPA_ZIL_COMMITS],
+	    (u_longlong_t)s[SPA_ZIL_COMMIT_NSECS],
+	    (u_longlong_t)s[SPA_ZIL_COMMIT_WRITERS],
+	    (u_longlong_t)s[SPA_ZIL_ITXS],
+	    (u_longlong_t)s[SPA_ZIL_LWBS_SLOG],
+	    (u_longlong_t)s[SPA_ZIL_LWBS_SLOG_BYTES],
+	    (u_longlong_t)s[SPA_ZIL_LWBS_NORMAL],
+	    (u_longlong_t)s[SPA_ZIL_LWBS_NORMAL_BYTES],
+	    (u_longlong_t)s[SPA_ZIL_LWB_NSECS],
+	    (u_longlong_t)s[SPA_ZIL_LWB_TIMEOUTS],
+	    (u_longlong_t)s[SPA_ZIL_STALLS],
+	    (u_longlong_t)s[SPA_ZIL_FLUSHES],
+	    (u_longlong_t)s[SPA_ZIL_FLUSHES_ELIDED],
+	    (u_longlong_t)s[SPA_ZIL_FLUSH_NSECS]);
+
+	return (0);
+}
+
+static void *
+spa_zil_ds_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_datasets;
+	spa_zil_ds_stats_t *rows = ssh->_private;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < 0 || (uint64_t)n >= ssh->count)
+		return (NULL);
+
+	return (&rows[n]);
+}
+
+static int
+spa_zil_ds_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_datasets;
+	spa_zil_ds_stats_t *szd, *rows;
+	uint64_t n = 0;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (rw == KSTAT_WRITE) {
+		for (szd = list_head(&ssh->list); szd != NULL;
+		    szd = list_next(&ssh->list, szd))
+			bzero(szd->szd_stats, sizeof (szd->szd_stats));
+		return (0);
+	}
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	ssh->_private = NULL;
+	ssh->size = 0;
+
+	/*
+	 * The logs can't come or go while we hold the lock, so the rows
+	 * are copied out in one pass; the counters themselves may keep
+	 * moving while they are copied.
+	 */
+	for (szd = list_head(&ssh->list); szd != NULL;
+	    szd = list_next(&ssh->list, szd))
+		n++;
+
+	if (n != 0) {
+		ssh->size = n * sizeof (spa_zil_ds_stats_t);
+		ssh->_private = rows = kmem_zalloc(ssh->size, KM_SLEEP);
+		for (szd = list_head(&ssh->list); szd != NULL;
+		    szd = list_next(&ssh->list, szd), rows++) {
+			rows->szd_objset = szd->szd_objset;
+			bcopy(szd->szd_stats, rows->szd_stats,
+			    sizeof (rows->szd_stats));
+		}
+	}
+	ssh->count = n;
+
+	ksp->ks_ndata = ssh->count;
+	ksp->ks_data_size = ssh->size;
+
+	return (0);
+}
+
+static void
+spa_zil_ds_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_datasets;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&ssh->list, sizeof (spa_zil_ds_stats_t),
+	    offsetof(spa_zil_ds_stats_t, szd_node));
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "zil_datasets", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zil_ds_update;
+		kstat_set_raw_ops(ksp, spa_zil_ds_headers,
+		    spa_zil_ds_data, spa_zil_ds_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zil_ds_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_datasets;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	ASSERT(list_is_empty(&ssh->list));
+	list_destroy(&ssh->list);
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * Start (and stop) reporting the counters of a dataset's log.
+ */
+void
+spa_zil_ds_register(spa_t *spa, spa_zil_ds_stats_t *szd, uint64_t objset)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_datasets;
+
+	szd->szd_objset = objset;
+	bzero(szd->szd_stats, sizeof (szd->szd_stats));
+
+	mutex_enter(&ssh->lock);
+	list_insert_tail(&ssh->list, szd);
+	mutex_exit(&ssh->lock);
+}
+
+void
+spa_zil_ds_unregister(spa_t *spa, spa_zil_ds_stats_t *szd)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_datasets;
+
+	mutex_enter(&ssh->lock);
+	list_remove(&ssh->list, szd);
+	mutex_exit(&ssh->lock);
+}
+
+/*
+ * ==========================================================================
+ * SPA Zio Pipeline Stage Statistics
+ * ==========================================================================
+ */
+
+/*
+ * While zio_stage_timing_enabled is set, the "zio_stages" kstat counts
+ * for each pipeline stage the zios that went through it, their total time
+ * in it and a power of two histogram of those times.  A zio's time in a
+ * stage runs from when it enters the stage until it enters the next one,
+ * so it includes waiting for its children, the vdev queue and the device,
+ * or a taskq thread, and not only the stage itself.  The done stage ends
+ * once the done callback returns.  Writing to the kstat resets it.
+ */
+static const char *spa_zio_stage_names[SPA_ZIO_STAGES] = {
+	"open",
+	"read_bp_init",
+	"write_bp_init",
+	"free_bp_init",
+	"issue_async",
+	"write_compress",
+	"encrypt",
+	"checksum_generate",
+	"nop_write",
+	"ddt_prefetch",
+	"ddt_read_start",
+	"ddt_read_done",
+	"ddt_write",
+	"ddt_free",
+	"gang_assemble",
+	"gang_issue",
+	"dva_throttle",
+	"dva_allocate",
+	"dva_free",
+	"dva_claim",
+	"ready",
+	"vdev_io_start",
+	"vdev_io_done",
+	"vdev_io_assess",
+	"checksum_verify",
+	"done"
+};
+
+#define	SPA_ZIO_STAGE_STATS		(2 + SPA_ZIO_STAGE_BUCKETS)
+#define	SPA_ZIO_STAGE_COUNT(s)		((s) * SPA_ZIO_STAGE_STATS)
+#define	SPA_ZIO_STAGE_NSECS(s)		(SPA_ZIO_STAGE_COUNT(s) + 1)
+#define	SPA_ZIO_STAGE_LATENCY(s, i)	(SPA_ZIO_STAGE_COUNT(s) + 2 + (i))
+
+static int
+spa_zio_stages_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+	int i;
+
+	if (rw == KSTAT_WRITE) {
+		for (i = 0; i < ssh->count; i++)
+			((kstat_named_t *)ssh->_private)[i].value.ui64 = 0;
+	}
+
+	return (0);
+}
+
+static void
+spa_zio_stages_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int s, i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_ZIO_STAGE_COUNT(SPA_ZIO_STAGES);
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+	ks = ssh->_private;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (s = 0; s < SPA_ZIO_STAGES; s++) {
+		const char *sname = spa_zio_stage_names[s];
+
+		ks[SPA_ZIO_STAGE_COUNT(s)].data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ks[SPA_ZIO_STAGE_COUNT(s)].name, KSTAT_STRLEN,
+		    "%s_count", sname);
+		ks[SPA_ZIO_STAGE_NSECS(s)].data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ks[SPA_ZIO_STAGE_NSECS(s)].name, KSTAT_STRLEN,
+		    "%s_nsecs", sname);
+
+		for (i = 0; i < SPA_ZIO_STAGE_BUCKETS; i++) {
+			kstat_named_t *kl = &ks[SPA_ZIO_STAGE_LATENCY(s, i)];
+
+			kl->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(kl->name, KSTAT_STRLEN, "%s_%llu_ns",
+			    sname, (u_longlong_t)1 << i);
+		}
+	}
+
+	ksp = kstat_create(name, 0, "zio_stages", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zio_stages_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zio_stages_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * Account nsecs spent by a zio in the stage of bit number stage.
+ */
+void
+spa_zio_stage_add(spa_t *spa, int stage, uint64_t nsecs)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+	kstat_named_t *ks = ssh->_private;
+	int idx = MIN(highbit64(nsecs), SPA_ZIO_STAGE_BUCKETS - 1);
+
+	ASSERT3S(stage, >=, 0);
+	ASSERT3S(stage, <, SPA_ZIO_STAGES);
+	atomic_inc_64(&ks[SPA_ZIO_STAGE_COUNT(stage)].value.ui64);
+	atomic_add_64(&ks[SPA_ZIO_STAGE_NSECS(stage)].value.ui64, nsecs);
+	atomic_inc_64(&ks[SPA_ZIO_STAGE_LATENCY(stage, idx)].value.ui64);
+}
+
+/*
+ * ==========================================================================
+ * SPA Zio Taskq Statistics
+ * ==========================================================================
+ */
+
+/*
+ * The "zio_taskqs" kstat shows for each zio taskq set of the pool, named
+ * like its taskqs, how many taskqs it has and threads each of them has (see
+ * spa_taskqs_init()), the zios dispatched to it, those waiting for a
+ * thread now, the total time zios waited for one, and the zios sent to
+ * another taskq than that of their cpu (see spa_taskq_select()).  Writing
+ * to the kstat resets the dispatched, wait and rerouted counters.
+ */
+typedef enum spa_zio_taskq_stat {
+	SPA_ZIO_TASKQ_TASKQS,
+	SPA_ZIO_TASKQ_THREADS,
+	SPA_ZIO_TASKQ_DISPATCHED,
+	SPA_ZIO_TASKQ_QUEUED,
+	SPA_ZIO_TASKQ_WAIT_NSECS,
+	SPA_ZIO_TASKQ_REROUTED,
+	SPA_ZIO_TASKQ_STATS
+} spa_zio_taskq_stat_t;
+
+static const char *spa_zio_taskq_names[SPA_ZIO_TASKQ_STATS] = {
+	"taskqs",
+	"threads",
+	"dispatched",
+	"queued",
+	"wait_nsecs",
+	"rerouted"
+};
+
+#define	SPA_ZIO_TASKQ_STAT(t, q, s)	\
+	((((t) * ZIO_TASKQ_TYPES) + (q)) * SPA_ZIO_TASKQ_STATS + (s))
+
+static int
+spa_zio_taskqs_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_taskqs;
+	kstat_named_t *ks = ssh->_private;
+	int t, q;
+
+	if (rw == KSTAT_WRITE) {
+		for (t = 0; t < ZIO_TYPES; t++) {
+			for (q = 0; q < ZIO_TASKQ_TYPES; q++) {
+				ks[SPA_ZIO_TASKQ_STAT(t, q,
+				    SPA_ZIO_TASKQ_DISPATCHED)].value.ui64 = 0;
+				ks[SPA_ZIO_TASKQ_STAT(t, q,
+				    SPA_ZIO_TASKQ_WAIT_NSECS)].value.ui64 = 0;
+				ks[SPA_ZIO_TASKQ_STAT(t, q,
+				    SPA_ZIO_TASKQ_REROUTED)].value.ui64 = 0;
+			}
+		}
+	}
+
+	return (0);
+}
+
+static void
+spa_zio_taskqs_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_taskqs;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int t, q, s;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = ZIO_TYPES * ZIO_TASKQ_TYPES * SPA_ZIO_TASKQ_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+	ks = ssh->_private;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	for (t = 0; t < ZIO_TYPES; t++) {
+		for (q = 0; q < ZIO_TASKQ_TYPES; q++) {
+			for (s = 0; s < SPA_ZIO_TASKQ_STATS; s++) {
+				kstat_named_t *kt =
+				    &ks[SPA_ZIO_TASKQ_STAT(t, q, s)];
+
+				kt->data_type = KSTAT_DATA_UINT64;
+				(void) snprintf(kt->name, KSTAT_STRLEN,
+				    "%s_%s_%s", zio_type_name[t],
+				    zio_taskq_types[q], spa_zio_taskq_names[s]);
+			}
+		}
+	}
+
+	ksp = kstat_create(name, 0, "zio_taskqs", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zio_taskqs_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zio_taskqs_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_taskqs;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * Record the taskqs and threads per taskq that spa_taskqs_init() created
+ * for type t and taskq type q, or 0 for none.
+ */
+void
+spa_zio_taskq_layout(spa_t *spa, int t, int q, uint_t taskqs, uint_t threads)
+{
+	kstat_named_t *ks = spa->spa_stats.zio_taskqs._private;
+
+	ks[SPA_ZIO_TASKQ_STAT(t, q, SPA_ZIO_TASKQ_TASKQS)].value.ui64 = taskqs;
+	ks[SPA_ZIO_TASKQ_STAT(t, q, SPA_ZIO_TASKQ_THREADS)].value.ui64 =
+	    threads;
+}
+
+void
+spa_zio_taskq_dispatched(spa_t *spa, int t, int q)
+{
+	kstat_named_t *ks = spa->spa_stats.zio_taskqs._private;
+
+	atomic_inc_64(&ks[SPA_ZIO_TASKQ_STAT(t, q,
+	    SPA_ZIO_TASKQ_DISPATCHED)].value.ui64);
+	atomic_inc_64(&ks[SPA_ZIO_TASKQ_STAT(t, q,
+	    SPA_ZIO_TASKQ_QUEUED)].value.ui64);
+}
+
+void
+spa_zio_taskq_rerouted(spa_t *spa, int t, int q)
+{
+	kstat_named_t *ks = spa->spa_stats.zio_taskqs._private;
+
+	atomic_inc_64(&ks[SPA_ZIO_TASKQ_STAT(t, q,
+	    SPA_ZIO_TASKQ_REROUTED)].value.ui64);
+}
+
+/*
+ * A taskq thread picked up a zio that waited nsecs for it.
+ */
+void
+spa_zio_taskq_started(spa_t *spa, int t, int q, uint64_t nsecs)
+{
+	kstat_named_t *ks = spa->spa_stats.zio_taskqs._private;
+
+	atomic_dec_64(&ks[SPA_ZIO_TASKQ_STAT(t, q,
+	    SPA_ZIO_TASKQ_QUEUED)].value.ui64);
+	atomic_add_64(&ks[SPA_ZIO_TASKQ_STAT(t, q,
+	    SPA_ZIO_TASKQ_WAIT_NSECS)].value.ui64, nsecs);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
 	spa_read_history_init(spa);
 	spa_txg_history_init(spa);
-	spa_tx_assign_init(spa);
+	spa_nsecs_histogram_init(spa, &spa->spa_stats.tx_assign_histogram,
+	    "dmu_tx_assign");
+	spa_nsecs_histogram_init(spa, &spa->spa_stats.tx_delay_histogram,
+	    "dmu_tx_delay");
+	spa_tx_throttle_init(spa);
 	spa_io_history_init(spa);
+	spa_compress_abort_init(spa);
+	spa_free_stats_init(spa);
+	spa_ditto_read_init(spa);
+	spa_metaslab_alloc_init(spa);
+	spa_fragmentation_init(spa);
+	spa_vdev_histo_init(spa);
+	spa_vdev_queue_init(spa);
+	spa_raidz_children_init(spa);
+	spa_metaslab_groups_init(spa);
+	spa_zil_init(spa);
+	spa_zil_ds_init(spa);
+	spa_zio_stages_init(spa);
+	spa_zio_taskqs_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
-	spa_tx_assign_destroy(spa);
+	spa_zio_taskqs_destroy(spa);
+	spa_zio_stages_destroy(spa);
+	spa_zil_ds_destroy(spa);
+	spa_zil_destroy(spa);
+	spa_metaslab_groups_destroy(spa);
+	spa_raidz_children_destroy(spa);
+	spa_vdev_queue_destroy(spa);
+	spa_vdev_histo_destroy(spa);
+	spa_fragmentation_destroy(spa);
+	spa_metaslab_alloc_destroy(spa);
+	spa_ditto_read_destroy(spa);
+	spa_free_stats_destroy(spa);
+	spa_compress_abort_destroy(spa);
+	spa_tx_throttle_destroy(spa);
+	spa_nsecs_histogram_destroy(&spa->spa_stats.tx_delay_histogram);
+	spa_nsecs_histogram_destroy(&spa->spa_stats.tx_assign_histogram);
 	spa_txg_history_destroy(spa);
 	spa_read_history_destroy(spa);
 	spa_io_history_destroy(spa);
@@ -0,0 +1,343 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/dmu.h>
+#include <sys/dmu_objset.h>
+#include <sys/dsl_dataset.h>
+#include <sys/dsl_pool.h>
+#include <sys/dnode.h>
+#include <sys/dbuf.h>
+#include <sys/zap.h>
+#include <sys/arc.h>
+
+/*
+ * ARC warm-up.
+ *
+ * The ARC starts out empty after the pool is imported, and it takes a
+ * long time of normal use before the blocks it had cached are read back
+ * in.  To shorten that, the pool keeps a log of blocks that were in
+ * demand, and prefetches them at the next import.
+ *
+ * arc_read() calls spa_warm_record() for the blocks it promotes to the
+ * MFU state, and one in zfs_arc_warm_sample of them has its bookmark
+ * added to spa_warm_log, a ring of zfs_arc_warm_entries bookmarks.  At
+ * import the ring is filled from the log in the MOS, so blocks that are
+ * still hot stay in it, and newer ones push out the oldest.
+ *
+ * spa_sync() writes the ring to a MOS object, oldest entry first, every
+ * SPA_WARM_SYNC_INTERVAL seconds that it changed, and once more when the
+ * pool is exported.  The pool directory entry holds the object number
+ * and the number of entries.  Bookmarks rather than block pointers are
+ * logged, since the blocks may have been freed and their space reused
+ * by the next import; a bookmark that no longer exists is just skipped.
+ *
+ * At import spa_warm_thread() issues dbuf_prefetch() for every logged
+ * bookmark, at no more than zfs_arc_warm_rate per second, with the
+ * async read priority so that demand reads go first.
+ */
+
+/* record and replay the warm-up log */
+int zfs_arc_warm = 1;
+
+/* log one in this many MFU promotions */
+int zfs_arc_warm_sample = 8;
+
+/* bookmarks kept in the log, read at import */
+int zfs_arc_warm_entries = 16384;
+
+/* bookmarks prefetched per second at import, 0 for unlimited */
+int zfs_arc_warm_rate = 2000;
+
+/* seconds between writes of a changed log */
+#define	SPA_WARM_SYNC_INTERVAL	600
+
+/* bookmarks prefetched between checks of zfs_arc_warm_rate */
+#define	SPA_WARM_BATCH		64
+
+/*
+ * Add zb to the warm-up log of spa, if it is sampled.  Called from
+ * arc_read() after a block was promoted to the MFU state.
+ */
+void
+spa_warm_record(spa_t *spa, const zbookmark_phys_t *zb)
+{
+	uint64_t seen;
+
+	if (zb == NULL || zb->zb_level < 0 || zb->zb_blkid == DMU_BONUS_BLKID)
+		return;
+
+	if (spa->spa_warm_log == NULL || zfs_arc_warm_sample <= 0)
+		return;
+
+	seen = atomic_inc_64_nv(&spa->spa_warm_seen);
+	if (seen % zfs_arc_warm_sample != 0)
+		return;
+
+	mutex_enter(&spa->spa_warm_lock);
+	if (spa->spa_warm_log != NULL) {
+		spa->spa_warm_log[spa->spa_warm_count % spa->spa_warm_size] =
+		    *zb;
+		spa->spa_warm_count++;
+	}
+	mutex_exit(&spa->spa_warm_lock);
+}
+
+/*
+ * Write the log to the MOS, if it changed since it was last written and
+ * the interval has passed or the pool is being exported.
+ */
+void
+spa_warm_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	zbookmark_phys_t *buf;
+	uint64_t size, n, first, val[2];
+
+	if (spa->spa_warm_log == NULL ||
+	    spa_version(spa) < SPA_VERSION_FEATURES)
+		return;
+
+	size = spa->spa_warm_size;
+	buf = kmem_alloc(size * sizeof (zbookmark_phys_t), KM_SLEEP);
+
+	mutex_enter(&spa->spa_warm_lock);
+	if (spa->spa_warm_count == spa->spa_warm_synced ||
+	    (!spa->spa_warm_flush && gethrtime() - spa->spa_warm_sync_time <
+	    SEC2NSEC(SPA_WARM_SYNC_INTERVAL))) {
+		mutex_exit(&spa->spa_warm_lock);
+		kmem_free(buf, size * sizeof (zbookmark_phys_t));
+		return;
+	}
+
+	n = MIN(spa->spa_warm_count, size);
+	first = (spa->spa_warm_count - n) % size;
+	bcopy(&spa->spa_warm_log[first], buf,
+	    (n - MIN(n, first)) * sizeof (zbookmark_phys_t));
+	bcopy(spa->spa_warm_log, &buf[n - MIN(n, first)],
+	    MIN(n, first) * sizeof (zbookmark_phys_t));
+	spa->spa_warm_synced = spa->spa_warm_count;
+	spa->spa_warm_sync_time = gethrtime();
+	spa->spa_warm_flush = B_FALSE;
+	mutex_exit(&spa->spa_warm_lock);
+
+	if (spa->spa_warm_obj == 0) {
+		spa->spa_warm_obj = dmu_object_alloc(mos,
+		    DMU_OTN_UINT64_METADATA, 0, DMU_OT_NONE, 0, tx);
+	}
+	dmu_write(mos, spa->spa_warm_obj, 0, n * sizeof (zbookmark_phys_t),
+	    buf, tx);
+	VERIFY0(dmu_free_range(mos, spa->spa_warm_obj,
+	    n * sizeof (zbookmark_phys_t), DMU_OBJECT_END, tx));
+
+	val[0] = spa->spa_warm_obj;
+	val[1] = n;
+	VERIFY0(zap_update(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_WARM_LOG, sizeof (uint64_t), 2, val, tx));
+
+	kmem_free(buf, size * sizeof (zbookmark_phys_t));
+}
+
+/*
+ * Have the log written out before the pool is exported, so that the
+ * next import warms up with the blocks in use until now.
+ */
+void
+spa_warm_flush(spa_t *spa)
+{
+	if (!spa_writeable(spa) || spa->spa_warm_log == NULL)
+		return;
+
+	mutex_enter(&spa->spa_warm_lock);
+	spa->spa_warm_flush = B_TRUE;
+	mutex_exit(&spa->spa_warm_lock);
+	txg_wait_synced(spa_get_dsl(spa), 0);
+}
+
+static boolean_t
+spa_warm_stopping(spa_t *spa)
+{
+	return (spa->spa_warm_stop || spa_suspended(spa));
+}
+
+/*
+ * Prefetch the bookmarks of zbs, holding each dataset for the run of
+ * bookmarks that belongs to it.
+ */
+static void
+spa_warm_prefetch(spa_t *spa, zbookmark_phys_t *zbs, uint64_t n)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dsl_dataset_t *ds = NULL;
+	objset_t *os = NULL;
+	uint64_t objset = UINT64_MAX;
+	clock_t start = ddi_get_lbolt();
+	uint64_t i;
+
+	for (i = 0; i < n && !spa_warm_stopping(spa); i++) {
+		zbookmark_phys_t *zb = &zbs[i];
+		dnode_t *dn;
+
+		if (i != 0 && i % SPA_WARM_BATCH == 0 &&
+		    zfs_arc_warm_rate > 0) {
+			clock_t end = start +
+			    (clock_t)(i * hz / zfs_arc_warm_rate);
+
+			if (end > ddi_get_lbolt())
+				delay(end - ddi_get_lbolt());
+		}
+
+		if (zb->zb_objset != objset) {
+			if (ds != NULL) {
+				dsl_dataset_long_rele(ds, FTAG);
+				dsl_dataset_rele(ds, FTAG);
+				ds = NULL;
+			}
+			os = NULL;
+			objset = zb->zb_objset;
+
+			if (objset == 0) {
+				os = spa->spa_meta_objset;
+			} else {
+				dsl_pool_config_enter(dp, FTAG);
+				if (dsl_dataset_hold_obj(dp, objset, FTAG,
+				    &ds) == 0) {
+					if (dmu_objset_from_ds(ds, &os) == 0) {
+						dsl_dataset_long_hold(ds, FTAG);
+					} else {
+						dsl_dataset_rele(ds, FTAG);
+						ds = NULL;
+					}
+				}
+				dsl_pool_config_exit(dp, FTAG);
+			}
+		}
+
+		if (os == NULL)
+			continue;
+
+		if (dnode_hold(os, zb->zb_object, FTAG, &dn) != 0)
+			continue;
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+		dbuf_prefetch(dn, zb->zb_level, zb->zb_blkid,
+		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREFETCH);
+		rw_exit(&dn->dn_struct_rwlock);
+		dnode_rele(dn, FTAG);
+	}
+
+	if (ds != NULL) {
+		dsl_dataset_long_rele(ds, FTAG);
+		dsl_dataset_rele(ds, FTAG);
+	}
+}
+
+static void
+spa_warm_thread(void *arg)
+{
+	spa_t *spa = arg;
+	zbookmark_phys_t *zbs;
+	uint64_t n;
+
+	mutex_enter(&spa->spa_warm_lock);
+	n = MIN(spa->spa_warm_count, spa->spa_warm_size);
+	zbs = kmem_alloc(n * sizeof (zbookmark_phys_t), KM_SLEEP);
+	bcopy(spa->spa_warm_log, zbs, n * sizeof (zbookmark_phys_t));
+	mutex_exit(&spa->spa_warm_lock);
+
+	spa_warm_prefetch(spa, zbs, n);
+	kmem_free(zbs, n * sizeof (zbookmark_phys_t));
+
+	mutex_enter(&spa->spa_warm_lock);
+	spa->spa_warm_thread = NULL;
+	cv_broadcast(&spa->spa_warm_cv);
+	mutex_exit(&spa->spa_warm_lock);
+	thread_exit();
+}
+
+/*
+ * Set up the warm-up log of a pool that was just loaded, filled with the
+ * bookmarks logged until it was last exported, and start prefetching
+ * them.
+ */
+void
+spa_warm_start(spa_t *spa)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t size, n = 0, val[2];
+
+	if (!zfs_arc_warm || zfs_arc_warm_entries <= 0 ||
+	    spa->spa_warm_log != NULL)
+		return;
+
+	size = zfs_arc_warm_entries;
+	spa->spa_warm_log = kmem_zalloc(size * sizeof (zbookmark_phys_t),
+	    KM_SLEEP);
+	spa->spa_warm_size = size;
+
+	if (zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_WARM_LOG,
+	    sizeof (uint64_t), 2, val) == 0) {
+		spa->spa_warm_obj = val[0];
+		n = MIN(val[1], size);
+
+		/* The newest entries are at the end */
+		if (dmu_read(mos, spa->spa_warm_obj,
+		    (val[1] - n) * sizeof (zbookmark_phys_t),
+		    n * sizeof (zbookmark_phys_t), spa->spa_warm_log,
+		    DMU_READ_PREFETCH) != 0)
+			n = 0;
+	}
+
+	mutex_enter(&spa->spa_warm_lock);
+	spa->spa_warm_count = spa->spa_warm_synced = n;
+	spa->spa_warm_sync_time = gethrtime();
+	if (n > 0 && spa->spa_warm_thread == NULL && !spa->spa_warm_stop) {
+		spa->spa_warm_thread = thread_create(NULL, 0,
+		    spa_warm_thread, spa, 0, &p0, TS_RUN, minclsyspri);
+	}
+	mutex_exit(&spa->spa_warm_lock);
+}
+
+/*
+ * Stop prefetching and drop the log.  Must be called after syncing has
+ * stopped and before the pool is closed.
+ */
+void
+spa_warm_stop(spa_t *spa)
+{
+	mutex_enter(&spa->spa_warm_lock);
+	if (spa->spa_warm_thread != NULL) {
+		spa->spa_warm_stop = B_TRUE;
+		while (spa->spa_warm_thread != NULL)
+			cv_wait(&spa->spa_warm_cv, &spa->spa_warm_lock);
+		spa->spa_warm_stop = B_FALSE;
+	}
+	if (spa->spa_warm_log != NULL) {
+		kmem_free(spa->spa_warm_log,
+		    spa->spa_warm_size * sizeof (zbookmark_phys_t));
+		spa->spa_warm_log = NULL;
+	}
+	spa->spa_warm_size = 0;
+	spa->spa_warm_count = spa->spa_warm_synced = 0;
+	spa->spa_warm_obj = 0;
+	spa->spa_warm_flush = B_FALSE;
+	mutex_exit(&spa->spa_warm_lock);
+}
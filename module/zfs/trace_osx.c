@@ -0,0 +1,43 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * The functions behind the DTRACE_PROBEn() calls on OS X, one per probe of
+ * sys/trace_osx.h.  They do nothing; DTrace traces their fbt entries.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/trace_osx.h>
+
+#define	ZFS_SDT_DEF0(name)						\
+	void zfs_sdt_##name(void) { }
+#define	ZFS_SDT_DEF1(name)						\
+	void zfs_sdt_##name(uintptr_t a1) { }
+#define	ZFS_SDT_DEF2(name)						\
+	void zfs_sdt_##name(uintptr_t a1, uintptr_t a2) { }
+#define	ZFS_SDT_DEF3(name)						\
+	void zfs_sdt_##name(uintptr_t a1, uintptr_t a2, uintptr_t a3) { }
+#define	ZFS_SDT_DEF4(name)						\
+	void zfs_sdt_##name(uintptr_t a1, uintptr_t a2, uintptr_t a3,	\
+	    uintptr_t a4) { }
+
+ZFS_SDT_PROBES(ZFS_SDT_DEF0, ZFS_SDT_DEF1, ZFS_SDT_DEF2, ZFS_SDT_DEF3,
+    ZFS_SDT_DEF4)
@@ -124,18 +124,18 @@ txg_init(dsl_pool_t *dp, uint64_t txg)
 	int c;
 	bzero(tx, sizeof (tx_state_t));
 
-	tx->tx_cpu = kmem_zalloc(max_ncpus * sizeof (tx_cpu_t), KM_SLEEP);
+	tx->tx_cpu = kmem_zalloc(max_ncpus * sizeof (tx_cpu_slot_t), KM_SLEEP);
 
 	for (c = 0; c < max_ncpus; c++) {
 		int i;
 
-		mutex_init(&tx->tx_cpu[c].tc_lock, NULL, MUTEX_DEFAULT, NULL);
-		mutex_init(&tx->tx_cpu[c].tc_open_lock, NULL, MUTEX_DEFAULT,
+		mutex_init(&TX_CPU(tx, c)->tc_lock, NULL, MUTEX_DEFAULT, NULL);
+		mutex_init(&TX_CPU(tx, c)->tc_open_lock, NULL, MUTEX_DEFAULT,
 		    NULL);
 		for (i = 0; i < TXG_SIZE; i++) {
-			cv_init(&tx->tx_cpu[c].tc_cv[i], NULL, CV_DEFAULT,
+			cv_init(&TX_CPU(tx, c)->tc_cv[i], NULL, CV_DEFAULT,
 			    NULL);
-			list_create(&tx->tx_cpu[c].tc_callbacks[i],
+			list_create(&TX_CPU(tx, c)->tc_callbacks[i],
 			    sizeof (dmu_tx_callback_t),
 			    offsetof(dmu_tx_callback_t, dcb_node));
 		}
@@ -174,18 +174,18 @@ txg_fini(dsl_pool_t *dp)
 	for (c = 0; c < max_ncpus; c++) {
 		int i;
 
-		mutex_destroy(&tx->tx_cpu[c].tc_open_lock);
-		mutex_destroy(&tx->tx_cpu[c].tc_lock);
+		mutex_destroy(&TX_CPU(tx, c)->tc_open_lock);
+		mutex_destroy(&TX_CPU(tx, c)->tc_lock);
 		for (i = 0; i < TXG_SIZE; i++) {
-			cv_destroy(&tx->tx_cpu[c].tc_cv[i]);
-			list_destroy(&tx->tx_cpu[c].tc_callbacks[i]);
+			cv_destroy(&TX_CPU(tx, c)->tc_cv[i]);
+			list_destroy(&TX_CPU(tx, c)->tc_callbacks[i]);
 		}
 	}
 
 	if (tx->tx_commit_cb_taskq != NULL)
 		taskq_destroy(tx->tx_commit_cb_taskq);
 
-	kmem_free(tx->tx_cpu, max_ncpus * sizeof (tx_cpu_t));
+	kmem_free(tx->tx_cpu, max_ncpus * sizeof (tx_cpu_slot_t));
 
 	bzero(tx, sizeof (tx_state_t));
 }
@@ -303,7 +303,7 @@ txg_hold_open(dsl_pool_t *dp, txg_handle_t *th)
 	 * the current cpu to index into the array?
 	 */
 	kpreempt_disable();
-	tc = &tx->tx_cpu[CPU_SEQID];
+	tc = TX_CPU(tx, CPU_SEQID);
 	kpreempt_enable();
 
 	mutex_enter(&tc->tc_open_lock);
@@ -365,13 +365,14 @@ txg_quiesce(dsl_pool_t *dp, uint64_t txg)
 {
 	tx_state_t *tx = &dp->dp_tx;
 	int g = txg & TXG_MASK;
+	uint64_t dirty = 0;
 	int c;
 
 	/*
 	 * Grab all tc_open_locks so nobody else can get into this txg.
 	 */
 	for (c = 0; c < max_ncpus; c++)
-		mutex_enter(&tx->tx_cpu[c].tc_open_lock);
+		mutex_enter(&TX_CPU(tx, c)->tc_open_lock);
 
 	ASSERT(txg == tx->tx_open_txg);
 	tx->tx_open_txg++;
@@ -388,18 +389,23 @@ txg_quiesce(dsl_pool_t *dp, uint64_t txg)
 	 * enter the next transaction group.
 	 */
 	for (c = 0; c < max_ncpus; c++)
-		mutex_exit(&tx->tx_cpu[c].tc_open_lock);
+		mutex_exit(&TX_CPU(tx, c)->tc_open_lock);
 
 	/*
 	 * Quiesce the transaction group by waiting for everyone to txg_exit().
+	 * Nobody can dirty this txg any more, so collect the dirty space
+	 * that has not been folded into the pool-wide total yet.
 	 */
 	for (c = 0; c < max_ncpus; c++) {
-		tx_cpu_t *tc = &tx->tx_cpu[c];
+		tx_cpu_t *tc = TX_CPU(tx, c);
 		mutex_enter(&tc->tc_lock);
 		while (tc->tc_count[g] != 0)
 			cv_wait(&tc->tc_cv[g], &tc->tc_lock);
+		dirty += tc->tc_dirty[g];
+		tc->tc_dirty[g] = 0;
 		mutex_exit(&tc->tc_lock);
 	}
+	dsl_pool_dirty_fold(dp, dirty, txg);
 
 	spa_txg_history_set(dp->dp_spa, txg, TXG_STATE_QUIESCED, gethrtime());
 }
@@ -428,7 +434,7 @@ txg_dispatch_callbacks(dsl_pool_t *dp, uint64_t txg)
 	list_t *cb_list;
 
 	for (c = 0; c < max_ncpus; c++) {
-		tx_cpu_t *tc = &tx->tx_cpu[c];
+		tx_cpu_t *tc = TX_CPU(tx, c);
 		/*
 		 * No need to lock tx_cpu_t at this point, since this can
 		 * only be called once a txg has been synced.
@@ -482,6 +488,7 @@ txg_sync_thread(void *arg)
 	callb_cpr_t cpr;
 	vdev_stat_t *vs1, *vs2;
 	clock_t start, delta;
+	hrtime_t sync_start;
 
 #ifdef _KERNEL
 	/*
@@ -506,13 +513,14 @@ txg_sync_thread(void *arg)
 		timeout = zfs_txg_timeout * hz;
 
 		/*
-		 * We sync when we're scanning, there's someone waiting
-		 * on us, or the quiesce thread has handed off a txg to
-		 * us, or we have reached our timeout.
+		 * We sync when we're scanning or releasing throttled
+		 * frees, there's someone waiting on us, or the quiesce
+		 * thread has handed off a txg to us, or we have reached
+		 * our timeout.
 		 */
 		timer = (delta >= timeout ? 0 : timeout - delta);
 		while (!dsl_scan_active(dp->dp_scan) &&
-		    !tx->tx_exiting && timer > 0 &&
+		    !spa_free_backlogged(spa) && !tx->tx_exiting && timer > 0 &&
 		    tx->tx_synced_txg >= tx->tx_sync_txg_waiting &&
 		    tx->tx_quiesced_txg == 0 &&
 		    dp->dp_dirty_total < zfs_dirty_data_sync) {
@@ -564,7 +572,9 @@ txg_sync_thread(void *arg)
 		ndirty = dp->dp_dirty_pertxg[txg & TXG_MASK];
 
 		start = ddi_get_lbolt();
+		sync_start = gethrtime();
 		spa_sync(spa, txg);
+		dsl_pool_delay_adjust(dp, gethrtime() - sync_start);
 		delta = ddi_get_lbolt() - start;
 
 		mutex_enter(&tx->tx_sync_lock);
@@ -624,6 +634,17 @@ txg_quiesce_thread(void *arg)
 		    tx->tx_sync_txg_waiting);
 		mutex_exit(&tx->tx_sync_lock);
 		txg_quiesce(dp, txg);
+
+		/*
+		 * If the previous txg is still syncing, start writing out
+		 * this one's data now rather than when it is synced.  This
+		 * must be done before the txg is handed off below; see
+		 * zfs_txg_early_write.
+		 */
+		if (zfs_txg_early_write && tx->tx_syncing_txg == txg - 1) {
+			spa_txg_history_set_early(dp->dp_spa, txg,
+			    dsl_pool_early_write(dp, txg));
+		}
 		mutex_enter(&tx->tx_sync_lock);
 
 		/*
@@ -37,13 +37,16 @@
 #include <sys/metaslab_impl.h>
 #include <sys/space_map.h>
 #include <sys/space_reftree.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zap.h>
 #include <sys/fs/zfs.h>
 #include <sys/arc.h>
 #include <sys/zil.h>
 #include <sys/dsl_scan.h>
 #include <sys/zvol.h>
+#include <sys/zfeature.h>
 #include <sys/zfs_context.h>
 
 /*
@@ -352,6 +355,7 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_stat_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_probe_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	vdev_log_init(vd);
 	for (t = 0; t < DTL_TYPES; t++) {
 		vd->vdev_dtl[t] = range_tree_create(NULL, NULL,
 		    &vd->vdev_dtl_lock);
@@ -378,7 +382,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 {
 	vdev_ops_t *ops;
 	char *type;
-	uint64_t guid = 0, islog, nparity;
+	uint64_t guid = 0, islog, isspecial, isdedup, sequential, nparity;
 	vdev_t *vd;
 
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
@@ -427,6 +431,28 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (islog && spa_version(spa) < SPA_VERSION_SLOGS)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Determine whether we're a special vdev, which holds the pool's
+	 * metadata in preference to the normal class, or a dedup vdev,
+	 * which holds its dedup tables.
+	 */
+	isspecial = isdedup = 0;
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL, &isspecial);
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_DEDUP, &isdedup);
+	if ((isspecial != 0) + (isdedup != 0) + (islog != 0) > 1)
+		return (SET_ERROR(EINVAL));
+	if ((isspecial || isdedup) && alloctype == VDEV_ALLOC_ADD &&
+	    spa->spa_load_state != SPA_LOAD_CREATE &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_ALLOCATION_CLASSES))
+		return (SET_ERROR(ENOTSUP));
+
+	/*
+	 * Sequential top-level vdevs, meant for SMR disks, only ever move
+	 * forward through their metaslabs, see metaslab_seq_alloc().
+	 */
+	sequential = 0;
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_SEQUENTIAL, &sequential);
+
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (SET_ERROR(ENOTSUP));
 
@@ -469,6 +495,9 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vd = vdev_alloc_common(spa, id, guid, ops);
 
 	vd->vdev_islog = islog;
+	vd->vdev_isspecial = isspecial;
+	vd->vdev_isdedup = isdedup;
+	vd->vdev_sequential = sequential;
 	vd->vdev_nparity = nparity;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
@@ -531,8 +560,15 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_ADD ||
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
-		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd);
+		metaslab_class_t *mc = spa_normal_class(spa);
+
+		if (islog)
+			mc = spa_log_class(spa);
+		else if (isspecial)
+			mc = spa_special_class(spa);
+		else if (isdedup)
+			mc = spa_dedup_class(spa);
+		vd->vdev_mg = metaslab_group_create(mc, vd);
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
@@ -640,6 +676,12 @@ vdev_free(vdev_t *vd)
 		metaslab_group_destroy(vd->vdev_mg);
 	}
 
+	/*
+	 * Discard any scrub/resilver I/O still queued for this vdev.
+	 */
+	if (vd->vdev_scan_io_queue != NULL)
+		dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+
 	ASSERT0(vd->vdev_stat.vs_space);
 	ASSERT0(vd->vdev_stat.vs_dspace);
 	ASSERT0(vd->vdev_stat.vs_alloc);
@@ -682,6 +724,7 @@ vdev_free(vdev_t *vd)
 	}
 	mutex_exit(&vd->vdev_dtl_lock);
 
+	vdev_log_fini(vd);
 	mutex_destroy(&vd->vdev_queue_lock);
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
@@ -759,6 +802,15 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+
+	tvd->vdev_isspecial = svd->vdev_isspecial;
+	svd->vdev_isspecial = 0;
+
+	tvd->vdev_isdedup = svd->vdev_isdedup;
+	svd->vdev_isdedup = 0;
+
+	tvd->vdev_sequential = svd->vdev_sequential;
+	svd->vdev_sequential = 0;
 }
 
 static void
@@ -924,6 +976,9 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	if (txg == 0)
 		spa_config_enter(spa, SCL_ALLOC, FTAG, RW_WRITER);
 
+	if (zfs_embedded_log_metaslabs != 0)
+		metaslab_group_reserve_log(vd->vdev_mg);
+
 	/*
 	 * If the vdev is being removed we don't activate
 	 * the metaslabs since we want to ensure that no new
@@ -979,16 +1034,16 @@ vdev_probe_done(zio_t *zio)
 			vps->vps_readable = 1;
 		if (zio->io_error == 0 && spa_writeable(spa)) {
 			zio_nowait(zio_write_phys(vd->vdev_probe_zio, vd,
-			    zio->io_offset, zio->io_size, zio->io_data,
+			    zio->io_offset, zio->io_size, zio->io_abd,
 			    ZIO_CHECKSUM_OFF, vdev_probe_done, vps,
 			    ZIO_PRIORITY_SYNC_WRITE, vps->vps_flags, B_TRUE));
 		} else {
-			zio_buf_free(zio->io_data, zio->io_size);
+			abd_free(zio->io_abd);
 		}
 	} else if (zio->io_type == ZIO_TYPE_WRITE) {
 		if (zio->io_error == 0)
 			vps->vps_writeable = 1;
-		zio_buf_free(zio->io_data, zio->io_size);
+		abd_free(zio->io_abd);
 	} else if (zio->io_type == ZIO_TYPE_NULL) {
 		zio_t *pio;
 
@@ -1107,7 +1162,7 @@ vdev_probe(vdev_t *vd, zio_t *zio)
 		zio_nowait(zio_read_phys(pio, vd,
 		    vdev_label_offset(vd->vdev_psize, l,
 		    offsetof(vdev_label_t, vl_pad2)),
-		    VDEV_PAD_SIZE, zio_buf_alloc(VDEV_PAD_SIZE),
+		    VDEV_PAD_SIZE, abd_alloc_for_io(VDEV_PAD_SIZE, B_TRUE),
 		    ZIO_CHECKSUM_OFF, vdev_probe_done, vps,
 		    ZIO_PRIORITY_SYNC_READ, vps->vps_flags, B_TRUE));
 	}
@@ -1783,7 +1838,7 @@ vdev_dtl_min(vdev_t *vd)
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_first(&vd->vdev_dtl[DTL_MISSING]->rt_root);
+	rs = zfs_btree_first(&vd->vdev_dtl[DTL_MISSING]->rt_root, NULL);
 	return (rs->rs_start - 1);
 }
 
@@ -1799,7 +1854,7 @@ vdev_dtl_max(vdev_t *vd)
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_last(&vd->vdev_dtl[DTL_MISSING]->rt_root);
+	rs = zfs_btree_last(&vd->vdev_dtl[DTL_MISSING]->rt_root, NULL);
 	return (rs->rs_end);
 }
 
@@ -2033,6 +2088,12 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 		}
 		if (vd == vd->vdev_top && vd->vdev_top_zap == 0) {
 			vd->vdev_top_zap = vdev_create_link_zap(vd, tx);
+			if ((vd->vdev_isspecial || vd->vdev_isdedup) &&
+			    spa_feature_is_enabled(
+			    vd->vdev_spa, SPA_FEATURE_ALLOCATION_CLASSES)) {
+				spa_feature_incr(vd->vdev_spa,
+				    SPA_FEATURE_ALLOCATION_CLASSES, tx);
+			}
 		}
 	}
 	for (uint64_t i = 0; i < vd->vdev_children; i++) {
@@ -2201,34 +2262,106 @@ vdev_resilver_needed(vdev_t *vd, uint64_t *minp, uint64_t *maxp)
 	return (needed);
 }
 
-void
-vdev_load(vdev_t *vd)
+/*
+ * Initialize the metaslabs and load the DTLs of vd and its children.
+ * This may run concurrently for several top-level vdevs, so failures
+ * are only recorded in vdev_load_error; vdev_load_set_state() applies
+ * them once all of the loads are done.
+ */
+static void
+vdev_load_impl(vdev_t *vd)
 {
-	int c;
+	int c, error;
 
 	/*
 	 * Recursively load all children.
 	 */
 	for (c = 0; c < vd->vdev_children; c++)
-		vdev_load(vd->vdev_child[c]);
+		vdev_load_impl(vd->vdev_child[c]);
+
+	vd->vdev_load_error = 0;
 
 	/*
 	 * If this is a top-level vdev, initialize its metaslabs.
 	 */
-	if (vd == vd->vdev_top && !vd->vdev_ishole &&
-	    (vd->vdev_ashift == 0 || vd->vdev_asize == 0 ||
-	    vdev_metaslab_init(vd, 0) != 0))
-		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
-		    VDEV_AUX_CORRUPT_DATA);
+	if (vd == vd->vdev_top && !vd->vdev_ishole) {
+		if (vd->vdev_ashift == 0 || vd->vdev_asize == 0)
+			vd->vdev_load_error = SET_ERROR(ENXIO);
+		else if ((error = vdev_metaslab_init(vd, 0)) != 0)
+			vd->vdev_load_error = error;
+	}
 
 	/*
 	 * If this is a leaf vdev, load its DTL.
 	 */
-	if (vd->vdev_ops->vdev_op_leaf && vdev_dtl_load(vd) != 0)
+	if (vd->vdev_ops->vdev_op_leaf && (error = vdev_dtl_load(vd)) != 0)
+		vd->vdev_load_error = error;
+}
+
+static void
+vdev_load_child(void *arg)
+{
+	vdev_t *vd = arg;
+
+	spa_t *spa = vd->vdev_spa;
+	uint64_t done;
+
+	vdev_load_impl(vd);
+
+	done = atomic_inc_64_nv(&spa->spa_load_vdevs_done);
+	zfs_dbgmsg("spa=%s loaded vdev %llu (%llu/%llu), error %d",
+	    spa_name(spa), (u_longlong_t)vd->vdev_id, (u_longlong_t)done,
+	    (u_longlong_t)spa->spa_load_vdevs_total, vd->vdev_load_error);
+}
+
+static void
+vdev_load_set_state(vdev_t *vd)
+{
+	int c;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_load_set_state(vd->vdev_child[c]);
+
+	if (vd->vdev_load_error != 0)
 		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
 		    VDEV_AUX_CORRUPT_DATA);
 }
 
+/*
+ * Load the metaslabs and DTLs of vd and everything below it.  When
+ * called on the root vdev the top-level vdevs are loaded in parallel,
+ * since each one's space map headers are read with synchronous I/O.
+ */
+void
+vdev_load(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	int children = vd->vdev_children;
+	taskq_t *tq;
+	int c;
+
+	if (vd != spa->spa_root_vdev || children <= 1) {
+		vdev_load_impl(vd);
+		vdev_load_set_state(vd);
+		return;
+	}
+
+	spa->spa_load_vdevs_total = children;
+	spa->spa_load_vdevs_done = 0;
+
+	tq = taskq_create("vdev_load", children, minclsyspri,
+	    children, children, TASKQ_PREPOPULATE);
+
+	for (c = 0; c < children; c++)
+		VERIFY(taskq_dispatch(tq, vdev_load_child, vd->vdev_child[c],
+		    TQ_SLEEP) != 0);
+
+	taskq_destroy(tq);
+
+	vd->vdev_load_error = 0;
+	vdev_load_set_state(vd);
+}
+
 /*
  * The special vdev case is used for hot spares and l2cache devices.  Its
  * sole purpose it to set the vdev state for the associated vdev.  To do this,
@@ -2305,6 +2438,7 @@ vdev_remove(vdev_t *vd, uint64_t txg)
 			 */
 			metaslab_group_histogram_remove(mg, msp);
 
+			metaslab_condense_cancel(msp, tx);
 			VERIFY0(space_map_allocated(msp->ms_sm));
 			space_map_free(msp->ms_sm, tx);
 			space_map_close(msp->ms_sm);
@@ -2342,6 +2476,8 @@ vdev_sync_done(vdev_t *vd, uint64_t txg)
 	while ((msp = txg_list_remove(&vd->vdev_ms_list, TXG_CLEAN(txg))))
 		metaslab_sync_done(msp, txg);
 
+	vdev_log_sm_sync_done(vd, txg);
+
 	if (reassess)
 		metaslab_sync_reassess(vd->vdev_mg);
 }
@@ -3013,6 +3149,18 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 				vsx->vsx_total_histo[type]
 				    [L_HISTO(zio->io_delta)]++;
 			}
+
+			/*
+			 * Sum up the write latency of the top-level vdev
+			 * for its allocation bias, see
+			 * metaslab_group_latency_update().
+			 */
+			if (type == ZIO_TYPE_WRITE && zio->io_delta != 0 &&
+			    vd->vdev_top != NULL) {
+				atomic_add_64(&vd->vdev_top->vdev_write_nsecs,
+				    zio->io_delta);
+				atomic_inc_64(&vd->vdev_top->vdev_write_count);
+			}
 		}
 
 		mutex_exit(&vd->vdev_stat_lock);
@@ -3126,7 +3274,7 @@ vdev_space_update(vdev_t *vd, int64_t alloc_delta, int64_t defer_delta,
 	vd->vdev_stat.vs_dspace += dspace_delta;
 	mutex_exit(&vd->vdev_stat_lock);
 
-	if (mc == spa_normal_class(spa)) {
+	if (mc != NULL && mc != spa_log_class(spa)) {
 		mutex_enter(&rvd->vdev_stat_lock);
 		rvd->vdev_stat.vs_alloc += alloc_delta;
 		rvd->vdev_stat.vs_space += space_delta;
@@ -30,6 +30,9 @@
 #include <sys/spa.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/arc.h>
+#include <sys/dmu.h>
 #include <sys/kstat.h>
 
 /*
@@ -44,10 +47,17 @@
  * read into a 64k read, which doesn't affect latency all that much but is
  * terribly wasteful of bandwidth.  A more intelligent version of the cache
  * could keep track of access patterns and not do read-ahead unless it sees
- * at least two temporally close I/Os to the same region.  Currently, only
- * metadata I/O is inflated.  A futher enhancement could take advantage of
- * more semantic information about the I/O.  And it could use something
- * faster than an AVL tree; that was chosen solely for convenience.
+ * at least two temporally close I/Os to the same region.
+ *
+ * To keep the cost of the worst case down, only reads of metadata blocks
+ * are inflated, and only on vdevs where inflating has recently paid off:
+ * each vdev measures what share of its inflated reads were read from
+ * again before being evicted, and while that share is below
+ * zfs_vdev_cache_min_hit_pct it inflates only one miss in
+ * zfs_vdev_cache_probe, to notice when the access pattern changes.  The
+ * memory of the cache is accounted to the ARC, which shrinks its other
+ * contents to make room for it.  It could use something faster than an
+ * AVL tree; that was chosen solely for convenience.
  *
  * There are five cache operations: allocate, fill, read, write, evict.
  *
@@ -77,15 +87,26 @@
  *
  * TODO: Note that with the current ZFS code, it turns out that the
  * vdev cache is not helpful, and in some cases actually harmful.  It
- * is better if we disable this.  Once some time has passed, we should
- * actually remove this to simplify the code.  For now we just disable
- * it by setting the zfs_vdev_cache_size to zero.  Note that Solaris 11
- * has made these same changes.
+ * is better if we disable this.  Solaris 11 disabled it by setting
+ * zfs_vdev_cache_size to zero.  Now that it only inflates metadata reads
+ * on vdevs that show spatial locality, it is enabled again.
  */
 int zfs_vdev_cache_max = 1<<14;			/* 16KB */
-int zfs_vdev_cache_size = 0;
+int zfs_vdev_cache_size = 10 * 1024 * 1024;
 int zfs_vdev_cache_bshift = 16;
 
+/*
+ * While fewer than zfs_vdev_cache_min_hit_pct percent of the recent
+ * inflated reads of a vdev were read from again, only one miss in
+ * zfs_vdev_cache_probe is inflated.  The share is measured over the last
+ * VC_FILLS_WINDOW inflated reads or so.
+ */
+int zfs_vdev_cache_min_hit_pct = 25;
+int zfs_vdev_cache_probe = 16;
+
+#define	VC_FILLS_WINDOW	256
+#define	VC_FILLS_MIN	16
+
 #define	VCBS (1 << zfs_vdev_cache_bshift)	/* 64KB */
 
 kstat_t	*vdc_ksp = NULL;
@@ -94,15 +115,25 @@ typedef struct vdc_stats {
 	kstat_named_t vdc_stat_delegations;
 	kstat_named_t vdc_stat_hits;
 	kstat_named_t vdc_stat_misses;
+	kstat_named_t vdc_stat_skips;
+	kstat_named_t vdc_stat_fills_used;
+	kstat_named_t vdc_stat_waste_bytes;
+	kstat_named_t vdc_stat_size;
 } vdc_stats_t;
 
 static vdc_stats_t vdc_stats = {
 	{ "delegations",	KSTAT_DATA_UINT64 },
 	{ "hits",		KSTAT_DATA_UINT64 },
-	{ "misses",		KSTAT_DATA_UINT64 }
+	{ "misses",		KSTAT_DATA_UINT64 },
+	{ "skips",		KSTAT_DATA_UINT64 },
+	{ "fills_used",		KSTAT_DATA_UINT64 },
+	{ "waste_bytes",	KSTAT_DATA_UINT64 },
+	{ "size",		KSTAT_DATA_UINT64 }
 };
 
 #define	VDCSTAT_BUMP(stat)	atomic_inc_64(&vdc_stats.stat.value.ui64);
+#define	VDCSTAT_INCR(stat, val) \
+	atomic_add_64(&vdc_stats.stat.value.ui64, (val));
 
 static int
 vdev_cache_offset_compare(const void *a1, const void *a2)
@@ -142,14 +173,40 @@ vdev_cache_evict(vdev_cache_t *vc, vdev_cache_entry_t *ve)
 {
 	ASSERT(MUTEX_HELD(&vc->vc_lock));
 	ASSERT(ve->ve_fill_io == NULL);
-	ASSERT(ve->ve_data != NULL);
+	ASSERT(ve->ve_abd != NULL);
 
 	avl_remove(&vc->vc_lastused_tree, ve);
 	avl_remove(&vc->vc_offset_tree, ve);
-	zio_buf_free(ve->ve_data, VCBS);
+	if (ve->ve_used < VCBS)
+		VDCSTAT_INCR(vdc_stat_waste_bytes, VCBS - ve->ve_used);
+	VDCSTAT_INCR(vdc_stat_size, -(int64_t)VCBS);
+	arc_space_return(VCBS, ARC_SPACE_OTHER);
+	abd_free(ve->ve_abd);
 	kmem_free(ve, sizeof (vdev_cache_entry_t));
 }
 
+/*
+ * Whether to inflate a read that missed the cache, given how often the
+ * recent inflated reads of this vdev were read from again.
+ */
+static boolean_t
+vdev_cache_inflate(vdev_cache_t *vc)
+{
+	ASSERT(MUTEX_HELD(&vc->vc_lock));
+
+	if (vc->vc_fills < VC_FILLS_MIN ||
+	    vc->vc_fills_used * 100 >=
+	    vc->vc_fills * zfs_vdev_cache_min_hit_pct)
+		return (B_TRUE);
+
+	if (++vc->vc_skipped >= MAX(zfs_vdev_cache_probe, 1)) {
+		vc->vc_skipped = 0;
+		return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * Allocate an entry in the cache.  At the point we don't have the data,
  * we're just creating a placeholder so that multiple threads don't all
@@ -167,6 +224,11 @@ vdev_cache_allocate(zio_t *zio)
 	if (zfs_vdev_cache_size == 0)
 		return (NULL);
 
+	if (!vdev_cache_inflate(vc)) {
+		VDCSTAT_BUMP(vdc_stat_skips);
+		return (NULL);
+	}
+
 	/*
 	 * If adding a new entry would exceed the cache size,
 	 * evict the oldest entry (LRU).
@@ -183,11 +245,18 @@ vdev_cache_allocate(zio_t *zio)
 	ve = kmem_zalloc(sizeof (vdev_cache_entry_t), KM_SLEEP);
 	ve->ve_offset = offset;
 	ve->ve_lastused = ddi_get_lbolt();
-	ve->ve_data = zio_buf_alloc(VCBS);
+	ve->ve_abd = abd_alloc_for_io(VCBS, B_TRUE);
+	arc_space_consume(VCBS, ARC_SPACE_OTHER);
+	VDCSTAT_INCR(vdc_stat_size, VCBS);
 
 	avl_add(&vc->vc_offset_tree, ve);
 	avl_add(&vc->vc_lastused_tree, ve);
 
+	if (++vc->vc_fills > VC_FILLS_WINDOW) {
+		vc->vc_fills /= 2;
+		vc->vc_fills_used /= 2;
+	}
+
 	return (ve);
 }
 
@@ -205,8 +274,16 @@ vdev_cache_hit(vdev_cache_t *vc, vdev_cache_entry_t *ve, zio_t *zio)
 		avl_add(&vc->vc_lastused_tree, ve);
 	}
 
-	ve->ve_hits++;
-	bcopy(ve->ve_data + cache_phase, zio->io_data, zio->io_size);
+	/*
+	 * The first hit is the read that missed and filled the entry; the
+	 * second shows the inflated read paid off.
+	 */
+	if (++ve->ve_hits == 2) {
+		vc->vc_fills_used++;
+		VDCSTAT_BUMP(vdc_stat_fills_used);
+	}
+	ve->ve_used = MIN(ve->ve_used + zio->io_size, VCBS);
+	abd_copy_off(zio->io_abd, ve->ve_abd, 0, cache_phase, zio->io_size);
 }
 
 /*
@@ -229,7 +306,7 @@ vdev_cache_fill(zio_t *fio)
 
 	ASSERT(ve->ve_fill_io == fio);
 	ASSERT(ve->ve_offset == fio->io_offset);
-	ASSERT(ve->ve_data == fio->io_data);
+	ASSERT(ve->ve_abd == fio->io_abd);
 
 	ve->ve_fill_io = NULL;
 
@@ -257,6 +334,7 @@ vdev_cache_read(zio_t *zio)
 	vdev_cache_t *vc = &zio->io_vd->vdev_cache;
 	vdev_cache_entry_t *ve, *ve_search;
 	uint64_t cache_offset = P2ALIGN(zio->io_offset, VCBS);
+	const blkptr_t *bp;
 	zio_t *fio;
 	ASSERTV(uint64_t cache_phase = P2PHASE(zio->io_offset, VCBS));
 
@@ -268,6 +346,13 @@ vdev_cache_read(zio_t *zio)
 	if (zio->io_size > zfs_vdev_cache_max)
 		return (B_FALSE);
 
+	/*
+	 * Only metadata shows enough spatial locality to be worth it.
+	 */
+	if (zio->io_logical == NULL || (bp = zio->io_logical->io_bp) == NULL ||
+	    (BP_GET_LEVEL(bp) == 0 && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp))))
+		return (B_FALSE);
+
 	/*
 	 * If the I/O straddles two or more cache blocks, don't cache it.
 	 */
@@ -313,7 +398,7 @@ vdev_cache_read(zio_t *zio)
 	}
 
 	fio = zio_vdev_delegated_io(zio->io_vd, cache_offset,
-	    ve->ve_data, VCBS, ZIO_TYPE_READ, ZIO_PRIORITY_NOW,
+	    ve->ve_abd, VCBS, ZIO_TYPE_READ, ZIO_PRIORITY_NOW,
 	    ZIO_FLAG_DONT_CACHE, vdev_cache_fill, ve);
 
 	ve->ve_fill_io = fio;
@@ -358,8 +443,9 @@ vdev_cache_write(zio_t *zio)
 		if (ve->ve_fill_io != NULL) {
 			ve->ve_missed_update = 1;
 		} else {
-			bcopy((char *)zio->io_data + start - io_start,
-			    ve->ve_data + start - ve->ve_offset, end - start);
+			abd_copy_off(ve->ve_abd, zio->io_abd,
+			    start - ve->ve_offset, start - io_start,
+			    end - start);
 		}
 		ve = AVL_NEXT(&vc->vc_offset_tree, ve);
 	}
@@ -30,6 +30,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/fs/zfs.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #ifdef __APPLE__
 /* XXX If renamed to sunldi.h, no ifdef required */
 #include <sys/ldi_osx.h>
@@ -475,12 +476,16 @@ skip_open:
 	/*
 	 * Determine the device's minimum transfer size.
 	 * If the ioctl isn't supported, assume DEV_BSIZE.
+	 * The maximum transfer size bounds i/o aggregation, see
+	 * vdev_queue_agg_limit(); it is left 0 when unknown.
 	 */
+	vd->vdev_max_xfer = 0;
 	if ((error = ldi_ioctl(dvd->vd_lh, DKIOCGMEDIAINFOEXT,
 	    (intptr_t)dkmext, FKIOCTL, kcred, NULL)) == 0) {
 		capacity = dkmext->dki_capacity - 1;
 		blksz = dkmext->dki_lbsize;
 		pbsize = dkmext->dki_pbsize;
+		vd->vdev_max_xfer = dkmext->dki_max_xfer;
 	} else if ((error = ldi_ioctl(dvd->vd_lh, DKIOCGMEDIAINFO,
 	    (intptr_t)dkm, FKIOCTL, kcred, NULL)) == 0) {
 		VDEV_DEBUG(
@@ -538,6 +543,7 @@ skip_open:
 	 * try again.
 	 */
 	vd->vdev_nowritecache = B_FALSE;
+	vd->vdev_notrim = B_FALSE;
 
 #ifdef __APPLE__
 	/* Inform the ZIO pipeline that we are non-rotational */
@@ -672,6 +678,90 @@ vdev_disk_ldi_physio(ldi_handle_t vd_lh, caddr_t data,
 	return (error);
 }
 
+/*
+ * Build the segment list of an i/o, in two passes over its ABD: one to
+ * count the segments and one to fill them in.  Adjacent chunks are
+ * merged into one segment.
+ */
+typedef struct vdev_disk_vec {
+	ldi_buf_vec_t	*vdv_vec;
+	uint32_t	vdv_cnt;
+	char		*vdv_end;
+} vdev_disk_vec_t;
+
+static int
+vdev_disk_vec_cb(void *buf, size_t size, void *arg)
+{
+	vdev_disk_vec_t *vdv = arg;
+
+	if (vdv->vdv_cnt == 0 || (char *)buf != vdv->vdv_end) {
+		if (vdv->vdv_vec != NULL) {
+			vdv->vdv_vec[vdv->vdv_cnt].bv_addr = buf;
+			vdv->vdv_vec[vdv->vdv_cnt].bv_len = 0;
+		}
+		vdv->vdv_cnt++;
+	}
+	if (vdv->vdv_vec != NULL)
+		vdv->vdv_vec[vdv->vdv_cnt - 1].bv_len += size;
+	vdv->vdv_end = (char *)buf + size;
+
+	return (0);
+}
+
+/*
+ * Point the buffer at the data of the zio.  An aggregated i/o (a gang
+ * ABD, see vdev_queue_aggregate()) is passed down as a vector of the
+ * buffers of the zios it was built from when the caller allows it, so
+ * the device reads and writes them in place.  Anything else is borrowed
+ * as one linear buffer, which copies scattered ABDs.
+ */
+static void
+vdev_disk_buf_map(zio_t *zio, ldi_buf_t *bp, boolean_t vec)
+{
+	vdev_disk_vec_t vdv = { 0 };
+	uint32_t cnt;
+
+	if (vec && abd_is_gang(zio->io_abd)) {
+		(void) abd_iterate_func(zio->io_abd, 0, zio->io_size,
+		    vdev_disk_vec_cb, &vdv);
+		cnt = vdv.vdv_cnt;
+		vdv.vdv_vec = kmem_alloc(cnt * sizeof (ldi_buf_vec_t),
+		    KM_SLEEP);
+		vdv.vdv_cnt = 0;
+		(void) abd_iterate_func(zio->io_abd, 0, zio->io_size,
+		    vdev_disk_vec_cb, &vdv);
+		ASSERT3U(vdv.vdv_cnt, ==, cnt);
+
+		bp->b_un.b_addr = NULL;
+		bp->b_vec = vdv.vdv_vec;
+		bp->b_veccnt = cnt;
+	} else if (zio->io_type == ZIO_TYPE_READ) {
+		bp->b_un.b_addr = abd_borrow_buf(zio->io_abd, zio->io_size);
+	} else {
+		bp->b_un.b_addr = abd_borrow_buf_copy(zio->io_abd,
+		    zio->io_size);
+	}
+}
+
+/*
+ * Undo vdev_disk_buf_map().  A borrowed buffer is given back to the ABD,
+ * copying the data in on reads.
+ */
+static void
+vdev_disk_buf_unmap(zio_t *zio, ldi_buf_t *bp)
+{
+	if (bp->b_vec != NULL) {
+		kmem_free(bp->b_vec, bp->b_veccnt * sizeof (ldi_buf_vec_t));
+		bp->b_vec = NULL;
+		bp->b_veccnt = 0;
+	} else if (zio->io_type == ZIO_TYPE_READ) {
+		abd_return_buf_copy(zio->io_abd, bp->b_un.b_addr,
+		    zio->io_size);
+	} else {
+		abd_return_buf(zio->io_abd, bp->b_un.b_addr, zio->io_size);
+	}
+}
+
 #ifdef illumos
 static void
 vdev_disk_io_intr(buf_t *bp)
@@ -683,6 +773,8 @@ vdev_disk_io_intr(ldi_buf_t *bp)
 	vdev_buf_t *vb = (vdev_buf_t *)bp;
 	zio_t *zio = vb->vb_io;
 
+	vdev_disk_buf_unmap(zio, bp);
+
 	/*
 	 * The rest of the zio stack only deals with EIO, ECKSUM, and ENXIO.
 	 * Rather than teach the rest of the stack about other error
@@ -786,6 +878,28 @@ vdev_disk_io_start(zio_t *zio)
 
 			break;
 
+		case DKIOCFREE:
+
+			if (vd->vdev_notrim) {
+				zio->io_error = SET_ERROR(ENOTSUP);
+				break;
+			}
+
+			{
+				dkioc_free_list_t dfl;
+
+				bzero(&dfl, sizeof (dfl));
+				dfl.dfl_num_exts = 1;
+				dfl.dfl_exts[0].dfle_start = zio->io_offset;
+				dfl.dfl_exts[0].dfle_length = zio->io_size;
+
+				zio->io_error = ldi_ioctl(dvd->vd_lh,
+				    zio->io_cmd, (uintptr_t)&dfl, FKIOCTL,
+				    kcred, NULL);
+			}
+
+			break;
+
 		default:
 			zio->io_error = SET_ERROR(ENOTSUP);
 		} /* io_cmd */
@@ -826,7 +940,7 @@ vdev_disk_io_start(zio_t *zio)
 	bp = &vb->vb_buf;
 
 	ASSERT(bp != NULL);
-	ASSERT(zio->io_data != NULL);
+	ASSERT(zio->io_abd != NULL);
 	ASSERT(zio->io_size != 0);
 
 	bioinit(bp);
@@ -834,7 +948,7 @@ vdev_disk_io_start(zio_t *zio)
 	if (!(zio->io_flags & (ZIO_FLAG_IO_RETRY | ZIO_FLAG_TRYHARD)))
 		bp->b_flags |= B_FAILFAST;
 	bp->b_bcount = zio->io_size;
-	bp->b_un.b_addr = zio->io_data;
+	vdev_disk_buf_map(zio, bp, B_TRUE);
 	bp->b_lblkno = lbtodb(zio->io_offset);
 	bp->b_bufsize = zio->io_size;
 	bp->b_iodone = (int (*)())vdev_disk_io_intr;
@@ -844,7 +958,7 @@ vdev_disk_io_start(zio_t *zio)
 
 	buf_setflags(bp, flags);
 	buf_setcount(bp, zio->io_size);
-	buf_setdataptr(bp, (uintptr_t)zio->io_data);
+	buf_setdataptr(bp, (uintptr_t)zio->io_abd);
 
 	/*
 	 * Map offset to blcknumber, based on physical block number.
@@ -861,9 +975,16 @@ vdev_disk_io_start(zio_t *zio)
 #else /* !illumos */
 
 	error = ldi_strategy(dvd->vd_lh, bp);
+	if (error == ENOTSUP && bp->b_vec != NULL) {
+		/* This handle only takes linear buffers */
+		vdev_disk_buf_unmap(zio, bp);
+		vdev_disk_buf_map(zio, bp, B_FALSE);
+		error = ldi_strategy(dvd->vd_lh, bp);
+	}
 	if (error != 0) {
 		dprintf("%s error from ldi_strategy %d\n", __func__, error);
 		zio->io_error = EIO;
+		vdev_disk_buf_unmap(zio, bp);
 		kmem_free(vb, sizeof (vdev_buf_t));
 		zio_execute(zio);
 		// zio_interrupt(zio);
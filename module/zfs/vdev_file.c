@@ -29,6 +29,7 @@
 #include <sys/vdev_file.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/fs/zfs.h>
 #include <sys/fm/fs/zfs.h>
 #include <sys/vnode.h>
@@ -40,6 +41,13 @@
 
 static taskq_t *vdev_file_taskq;
 
+/*
+ * Open file vdevs so that their I/O bypasses the buffer cache of the file
+ * system holding them, which would otherwise cache the same data as the
+ * ARC does.
+ */
+int zfs_vdev_file_nocache = 1;
+
 static void
 vdev_file_hold(vdev_t *vd)
 {
@@ -96,6 +104,8 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 #endif
 
 	vf = vd->vdev_tsd = kmem_zalloc(sizeof (vdev_file_t), KM_SLEEP);
+	mutex_init(&vf->vf_flush_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vf->vf_flush_cv, NULL, CV_DEFAULT, NULL);
 
 	/*
 	 * We always open the files from the root of the global zone, even if
@@ -149,6 +159,14 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
         VN_RELE(vf->vf_vnode);
 		return (SET_ERROR(ENODEV));
 	}
+
+	if (zfs_vdev_file_nocache)
+		vnode_setnocache(vp);
+#else
+#ifdef F_NOCACHE
+	if (zfs_vdev_file_nocache)
+		(void) fcntl(vp->v_fd, F_NOCACHE, 1);
+#endif
 #endif
 
 #if _KERNEL
@@ -200,65 +218,132 @@ vdev_file_close(vdev_t *vd)
 	}
 
 	vd->vdev_delayed_close = B_FALSE;
+	ASSERT(!vf->vf_flush_active);
+	cv_destroy(&vf->vf_flush_cv);
+	mutex_destroy(&vf->vf_flush_lock);
 	kmem_free(vf, sizeof (vdev_file_t));
 	vd->vdev_tsd = NULL;
 }
 
 static void
-vdev_file_io_start(zio_t *zio)
+vdev_file_io_strategy(void *arg)
 {
-    vdev_t *vd = zio->io_vd;
-    vdev_file_t *vf = vd->vdev_tsd;
-    ssize_t resid = 0;
+	zio_t *zio = arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_file_t *vf = vd->vdev_tsd;
+	ssize_t resid = 0;
+	void *buf;
 
+	if (vnode_getwithvid(vf->vf_vnode, vf->vf_vid) != 0) {
+		zio->io_error = SET_ERROR(ENXIO);
+		zio_delay_interrupt(zio);
+		return;
+	}
 
-    if (zio->io_type == ZIO_TYPE_IOCTL) {
+	if (zio->io_type == ZIO_TYPE_READ)
+		buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+	else
+		buf = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
 
-        if (!vdev_readable(vd)) {
-            zio->io_error = SET_ERROR(ENXIO);
-			zio_interrupt(zio);
-            return;
-        }
-
-        switch (zio->io_cmd) {
-        case DKIOCFLUSHWRITECACHE:
-            if (!vnode_getwithvid(vf->vf_vnode, vf->vf_vid)) {
-                zio->io_error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
-                                          kcred, NULL);
-                vnode_put(vf->vf_vnode);
-            }
-            break;
-        default:
-            zio->io_error = SET_ERROR(ENOTSUP);
-        }
+	zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
+	    UIO_READ : UIO_WRITE, vf->vf_vnode, buf, zio->io_size,
+	    zio->io_offset, UIO_SYSSPACE, 0, RLIM64_INFINITY, kcred, &resid);
+	vnode_put(vf->vf_vnode);
 
-		zio_interrupt(zio);
-        return;
-    }
+	if (zio->io_type == ZIO_TYPE_READ)
+		abd_return_buf_copy(zio->io_abd, buf, zio->io_size);
+	else
+		abd_return_buf(zio->io_abd, buf, zio->io_size);
 
-	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
-	zio->io_target_timestamp = zio_handle_io_delay(zio);
+	if (resid != 0 && zio->io_error == 0)
+		zio->io_error = SET_ERROR(ENOSPC);
+
+	zio_delay_interrupt(zio);
+}
+
+/*
+ * An fsync of the file covers every write that completed before it
+ * started, so a flush need not issue its own once one that started after
+ * it arrived has finished.  The first flush to find none running issues
+ * one for itself and every flush that arrived before it; the others wait
+ * for it, and then again for the next one if it started too early for
+ * them.  Concurrent flushes of a file vdev thus cost at most two fsyncs.
+ */
+static void
+vdev_file_io_fsync(void *arg)
+{
+	zio_t *zio = arg;
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	uint64_t gen, target;
+	int error;
+
+	mutex_enter(&vf->vf_flush_lock);
+	gen = ++vf->vf_flush_requested;
+	while (vf->vf_flush_done < gen) {
+		if (vf->vf_flush_active) {
+			cv_wait(&vf->vf_flush_cv, &vf->vf_flush_lock);
+			continue;
+		}
 
-    if (!vnode_getwithvid(vf->vf_vnode, vf->vf_vid)) {
+		vf->vf_flush_active = B_TRUE;
+		target = vf->vf_flush_requested;
+		mutex_exit(&vf->vf_flush_lock);
 
-		/*
-		VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
-	    TQ_PUSHPAGE), !=, 0);
-		*/
+		if (vnode_getwithvid(vf->vf_vnode, vf->vf_vid) == 0) {
+			error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
+			    kcred, NULL);
+			vnode_put(vf->vf_vnode);
+		} else {
+			error = SET_ERROR(ENXIO);
+		}
 
-        zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
-                           UIO_READ : UIO_WRITE, vf->vf_vnode, zio->io_data,
-                           zio->io_size, zio->io_offset, UIO_SYSSPACE,
-                           0, RLIM64_INFINITY, kcred, &resid);
-        vnode_put(vf->vf_vnode);
-    }
+		mutex_enter(&vf->vf_flush_lock);
+		vf->vf_flush_done = target;
+		vf->vf_flush_error = error;
+		vf->vf_flush_active = B_FALSE;
+		cv_broadcast(&vf->vf_flush_cv);
+	}
+	zio->io_error = vf->vf_flush_error;
+	mutex_exit(&vf->vf_flush_lock);
 
-    if (resid != 0 && zio->io_error == 0)
-        zio->io_error = SET_ERROR(ENOSPC);
+	zio_interrupt(zio);
+}
 
-    zio_delay_interrupt(zio);
+/*
+ * Reads, writes and flushes are handed to vdev_file_taskq so that the zio
+ * issue threads never block in the file system, and so that a file vdev
+ * has as many I/Os outstanding as the taskq has threads.
+ */
+static void
+vdev_file_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+
+	if (zio->io_type == ZIO_TYPE_IOCTL) {
+		if (!vdev_readable(vd)) {
+			zio->io_error = SET_ERROR(ENXIO);
+			zio_interrupt(zio);
+			return;
+		}
+
+		switch (zio->io_cmd) {
+		case DKIOCFLUSHWRITECACHE:
+			VERIFY3U(taskq_dispatch(vdev_file_taskq,
+			    vdev_file_io_fsync, zio, TQ_SLEEP), !=, 0);
+			return;
+		default:
+			zio->io_error = SET_ERROR(ENOTSUP);
+		}
+
+		zio_interrupt(zio);
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
-    return;
+	VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
+	    TQ_SLEEP), !=, 0);
 }
 
 
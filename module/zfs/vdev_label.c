@@ -143,10 +143,20 @@
 #include <sys/vdev_impl.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
+#include <sys/metaslab_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/dsl_scan.h>
 #include <sys/fs/zfs.h>
 
+/*
+ * When set, a txg that doesn't change the config only writes its uberblock
+ * to as many children of each raidz top-level vdev as it takes to survive
+ * the loss of its parity disks, rotating through them by txg.  The other
+ * top-level vdevs still get it on all of their children.
+ */
+int zfs_uberblock_sync_subset = 1;
+
 /*
  * Basic routines to read and write from a vdev label.
  * Used throughout the rest of this file.
@@ -178,7 +188,7 @@ vdev_label_number(uint64_t psize, uint64_t offset)
 }
 
 static void
-vdev_label_read(zio_t *zio, vdev_t *vd, int l, void *buf, uint64_t offset,
+vdev_label_read(zio_t *zio, vdev_t *vd, int l, abd_t *buf, uint64_t offset,
 	uint64_t size, zio_done_func_t *done, void *private, int flags)
 {
 	ASSERT(spa_config_held(zio->io_spa, SCL_STATE_ALL, RW_WRITER) ==
@@ -191,7 +201,7 @@ vdev_label_read(zio_t *zio, vdev_t *vd, int l, void *buf, uint64_t offset,
 }
 
 static void
-vdev_label_write(zio_t *zio, vdev_t *vd, int l, void *buf, uint64_t offset,
+vdev_label_write(zio_t *zio, vdev_t *vd, int l, abd_t *buf, uint64_t offset,
 	uint64_t size, zio_done_func_t *done, void *private, int flags)
 {
 	ASSERT(spa_config_held(zio->io_spa, SCL_ALL, RW_WRITER) == SCL_ALL ||
@@ -215,11 +225,34 @@ vdev_config_generate_stats(vdev_t *vd, nvlist_t *nv)
 	nvlist_t *nvx;
 	vdev_stat_t *vs;
 	vdev_stat_ex_t *vsx;
+	int b;
 
 	vs = kmem_alloc(sizeof (*vs), KM_SLEEP);
 	vsx = kmem_alloc(sizeof (*vsx), KM_SLEEP);
 
 	vdev_get_stats_ex(vd, vs, vsx);
+
+	/*
+	 * The config has no entries of its own for the resilver queue; its
+	 * i/o is reported along with scrub i/o, as it was before resilver
+	 * reads got their own class.
+	 */
+	vsx->vsx_active_queue[ZIO_PRIORITY_SCRUB] +=
+	    vsx->vsx_active_queue[ZIO_PRIORITY_RESILVER];
+	vsx->vsx_pend_queue[ZIO_PRIORITY_SCRUB] +=
+	    vsx->vsx_pend_queue[ZIO_PRIORITY_RESILVER];
+	for (b = 0; b < ARRAY_SIZE(vsx->vsx_queue_histo[0]); b++) {
+		vsx->vsx_queue_histo[ZIO_PRIORITY_SCRUB][b] +=
+		    vsx->vsx_queue_histo[ZIO_PRIORITY_RESILVER][b];
+	}
+	for (b = 0; b < ARRAY_SIZE(vsx->vsx_ind_histo[0]); b++) {
+		vsx->vsx_ind_histo[ZIO_PRIORITY_SCRUB][b] +=
+		    vsx->vsx_ind_histo[ZIO_PRIORITY_RESILVER][b];
+	}
+	for (b = 0; b < ARRAY_SIZE(vsx->vsx_agg_histo[0]); b++) {
+		vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB][b] +=
+		    vsx->vsx_agg_histo[ZIO_PRIORITY_RESILVER][b];
+	}
 	fnvlist_add_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
 	    (uint64_t *)vs, sizeof (*vs) / sizeof (uint64_t));
 
@@ -342,6 +375,20 @@ vdev_config_generate_stats(vdev_t *vd, nvlist_t *nv)
 	    vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB],
 	    ARRAY_SIZE(vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB]));
 
+	/* Free segment sizes of a top-level vdev's metaslabs */
+	if (vd == vd->vdev_top && vd->vdev_mg != NULL) {
+		metaslab_group_t *mg = vd->vdev_mg;
+		uint64_t *histo;
+
+		histo = kmem_alloc(sizeof (mg->mg_histogram), KM_SLEEP);
+		mutex_enter(&mg->mg_lock);
+		bcopy(mg->mg_histogram, histo, sizeof (mg->mg_histogram));
+		mutex_exit(&mg->mg_lock);
+		fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_FREE_HISTO,
+		    histo, RANGE_TREE_HISTOGRAM_SIZE);
+		kmem_free(histo, sizeof (mg->mg_histogram));
+	}
+
 	/* Add extended stats nvlist to main nvlist */
 	fnvlist_add_nvlist(nv, ZPOOL_CONFIG_VDEV_STATS_EX, nvx);
 
@@ -419,6 +466,15 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_ASIZE,
 		    vd->vdev_asize);
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_LOG, vd->vdev_islog);
+		if (vd->vdev_isspecial)
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL,
+			    vd->vdev_isspecial);
+		if (vd->vdev_isdedup)
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_DEDUP,
+			    vd->vdev_isdedup);
+		if (vd->vdev_sequential)
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_SEQUENTIAL,
+			    vd->vdev_sequential);
 		if (vd->vdev_removing)
 			fnvlist_add_uint64(nv, ZPOOL_CONFIG_REMOVING,
 			    vd->vdev_removing);
@@ -582,6 +638,7 @@ vdev_label_read_config(vdev_t *vd, uint64_t txg)
 	spa_t *spa = vd->vdev_spa;
 	nvlist_t *config = NULL;
 	vdev_phys_t *vp;
+	abd_t *vp_abd;
 	zio_t *zio;
 	uint64_t best_txg = 0;
 	int error = 0;
@@ -594,7 +651,8 @@ vdev_label_read_config(vdev_t *vd, uint64_t txg)
 	if (!vdev_readable(vd))
 		return (NULL);
 
-	vp = zio_buf_alloc(sizeof (vdev_phys_t));
+	vp_abd = abd_alloc_linear(sizeof (vdev_phys_t), B_TRUE);
+	vp = abd_to_buf(vp_abd);
 
 retry:
 	for (l = 0; l < VDEV_LABELS; l++) {
@@ -602,7 +660,7 @@ retry:
 
 		zio = zio_root(spa, NULL, NULL, flags);
 
-		vdev_label_read(zio, vd, l, vp,
+		vdev_label_read(zio, vd, l, vp_abd,
 		    offsetof(vdev_label_t, vl_vdev_phys),
 		    sizeof (vdev_phys_t), NULL, NULL, flags);
 
@@ -641,7 +699,7 @@ retry:
 		goto retry;
 	}
 
-	zio_buf_free(vp, sizeof (vdev_phys_t));
+	abd_free(vp_abd);
 
 	return (config);
 }
@@ -777,8 +835,10 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 	spa_t *spa = vd->vdev_spa;
 	nvlist_t *label;
 	vdev_phys_t *vp;
-	char *pad2;
+	abd_t *vp_abd;
+	abd_t *pad2;
 	uberblock_t *ub;
+	abd_t *ub_abd;
 	zio_t *zio;
 	char *buf;
 	size_t buflen;
@@ -862,8 +922,9 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 	/*
 	 * Initialize its label.
 	 */
-	vp = zio_buf_alloc(sizeof (vdev_phys_t));
-	bzero(vp, sizeof (vdev_phys_t));
+	vp_abd = abd_alloc_linear(sizeof (vdev_phys_t), B_TRUE);
+	abd_zero(vp_abd, sizeof (vdev_phys_t));
+	vp = abd_to_buf(vp_abd);
 
 	/*
 	 * Generate a label describing the pool and our top-level vdev.
@@ -923,7 +984,7 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 	error = nvlist_pack(label, &buf, &buflen, NV_ENCODE_XDR, KM_SLEEP);
 	if (error != 0) {
 		nvlist_free(label);
-		zio_buf_free(vp, sizeof (vdev_phys_t));
+		abd_free(vp_abd);
 		/* EFAULT means nvlist_pack ran out of room */
 		return (error == EFAULT ? ENAMETOOLONG : EINVAL);
 	}
@@ -931,14 +992,15 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 	/*
 	 * Initialize uberblock template.
 	 */
-	ub = zio_buf_alloc(VDEV_UBERBLOCK_RING);
-	bzero(ub, VDEV_UBERBLOCK_RING);
+	ub_abd = abd_alloc_linear(VDEV_UBERBLOCK_RING, B_TRUE);
+	abd_zero(ub_abd, VDEV_UBERBLOCK_RING);
+	ub = abd_to_buf(ub_abd);
 	*ub = spa->spa_uberblock;
 	ub->ub_txg = 0;
 
 	/* Initialize the 2nd padding area. */
-	pad2 = zio_buf_alloc(VDEV_PAD_SIZE);
-	bzero(pad2, VDEV_PAD_SIZE);
+	pad2 = abd_alloc_for_io(VDEV_PAD_SIZE, B_TRUE);
+	abd_zero(pad2, VDEV_PAD_SIZE);
 
 	/*
 	 * Write everything in parallel.
@@ -948,7 +1010,7 @@ retry:
 
 	for (l = 0; l < VDEV_LABELS; l++) {
 
-		vdev_label_write(zio, vd, l, vp,
+		vdev_label_write(zio, vd, l, vp_abd,
 		    offsetof(vdev_label_t, vl_vdev_phys),
 		    sizeof (vdev_phys_t), NULL, NULL, flags);
 
@@ -961,7 +1023,7 @@ retry:
 		    offsetof(vdev_label_t, vl_pad2),
 		    VDEV_PAD_SIZE, NULL, NULL, flags);
 
-		vdev_label_write(zio, vd, l, ub,
+		vdev_label_write(zio, vd, l, ub_abd,
 		    offsetof(vdev_label_t, vl_uberblock),
 		    VDEV_UBERBLOCK_RING, NULL, NULL, flags);
 	}
@@ -974,9 +1036,9 @@ retry:
 	}
 
 	nvlist_free(label);
-	zio_buf_free(pad2, VDEV_PAD_SIZE);
-	zio_buf_free(ub, VDEV_UBERBLOCK_RING);
-	zio_buf_free(vp, sizeof (vdev_phys_t));
+	abd_free(pad2);
+	abd_free(ub_abd);
+	abd_free(vp_abd);
 
 	/*
 	 * If this vdev hasn't been previously identified as a spare, then we
@@ -1040,7 +1102,7 @@ vdev_uberblock_load_done(zio_t *zio)
 	vdev_t *vd = zio->io_vd;
 	spa_t *spa = zio->io_spa;
 	zio_t *rio = zio->io_private;
-	uberblock_t *ub = zio->io_data;
+	uberblock_t *ub = abd_to_buf(zio->io_abd);
 	struct ubl_cbdata *cbp = rio->io_private;
 
 	ASSERT3U(zio->io_size, ==, VDEV_UBERBLOCK_SIZE(vd));
@@ -1061,7 +1123,7 @@ vdev_uberblock_load_done(zio_t *zio)
 		mutex_exit(&rio->io_lock);
 	}
 
-	zio_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 }
 
 static void
@@ -1077,7 +1139,8 @@ vdev_uberblock_load_impl(zio_t *zio, vdev_t *vd, int flags,
 		for (l = 0; l < VDEV_LABELS; l++) {
 			for (n = 0; n < VDEV_UBERBLOCK_COUNT(vd); n++) {
 				vdev_label_read(zio, vd, l,
-				    zio_buf_alloc(VDEV_UBERBLOCK_SIZE(vd)),
+				    abd_alloc_linear(VDEV_UBERBLOCK_SIZE(vd),
+				    B_TRUE),
 				    VDEV_UBERBLOCK_OFFSET(vd, n),
 				    VDEV_UBERBLOCK_SIZE(vd),
 				    vdev_uberblock_load_done, zio, flags);
@@ -1146,6 +1209,7 @@ static void
 vdev_uberblock_sync(zio_t *zio, uberblock_t *ub, vdev_t *vd, int flags)
 {
 	uberblock_t *ubbuf;
+	abd_t *ub_abd;
 	int c, l, n;
 
 	for (c = 0; c < vd->vdev_children; c++)
@@ -1159,22 +1223,66 @@ vdev_uberblock_sync(zio_t *zio, uberblock_t *ub, vdev_t *vd, int flags)
 
 	n = ub->ub_txg & (VDEV_UBERBLOCK_COUNT(vd) - 1);
 
-	ubbuf = zio_buf_alloc(VDEV_UBERBLOCK_SIZE(vd));
-	bzero(ubbuf, VDEV_UBERBLOCK_SIZE(vd));
+	ub_abd = abd_alloc_linear(VDEV_UBERBLOCK_SIZE(vd), B_TRUE);
+	abd_zero(ub_abd, VDEV_UBERBLOCK_SIZE(vd));
+	ubbuf = abd_to_buf(ub_abd);
 	*ubbuf = *ub;
 
 	for (l = 0; l < VDEV_LABELS; l++)
-		vdev_label_write(zio, vd, l, ubbuf,
+		vdev_label_write(zio, vd, l, ub_abd,
 		    VDEV_UBERBLOCK_OFFSET(vd, n), VDEV_UBERBLOCK_SIZE(vd),
 		    vdev_uberblock_sync_done, zio->io_private,
 		    flags | ZIO_FLAG_DONT_PROPAGATE);
 
-	zio_buf_free(ubbuf, VDEV_UBERBLOCK_SIZE(vd));
+	abd_free(ub_abd);
+}
+
+/*
+ * Write the uberblock to the children of top-level vdev vd, or flush them
+ * if ub is NULL.  With a subset, the writeable children starting at
+ * txg are used until vdev_nparity + 1 of them hold the uberblock, so that
+ * it survives any failure the raidz vdev does.  With fewer writeable
+ * children than that, all of them get it.  The flush covers the
+ * same children as the writes as long as their state doesn't change in
+ * between, and flushing a different one is harmless.
+ */
+static void
+vdev_uberblock_sync_top(zio_t *zio, uberblock_t *ub, vdev_t *vd, uint64_t txg,
+    boolean_t subset, int flags)
+{
+	uint64_t n, copies;
+
+	if (!subset || vd->vdev_ops != &vdev_raidz_ops ||
+	    vd->vdev_nparity + 1 >= vd->vdev_children) {
+		if (ub != NULL)
+			vdev_uberblock_sync(zio, ub, vd, flags);
+		else
+			zio_flush(zio, vd);
+		return;
+	}
+
+	copies = 0;
+	for (n = 0; n < vd->vdev_children &&
+	    copies <= vd->vdev_nparity; n++) {
+		vdev_t *cvd = vd->vdev_child[(txg + n) % vd->vdev_children];
+
+		if (!vdev_writeable(cvd))
+			continue;
+		if (ub != NULL)
+			vdev_uberblock_sync(zio, ub, cvd, flags);
+		else
+			zio_flush(zio, cvd);
+		copies++;
+	}
 }
 
-/* Sync the uberblocks to all vdevs in svd[] */
+/*
+ * Sync the uberblocks to all vdevs in svd[], or with subset to enough
+ * children of each of them (see zfs_uberblock_sync_subset).
+ */
 int
-vdev_uberblock_sync_list(vdev_t **svd, int svdcount, uberblock_t *ub, int flags)
+vdev_uberblock_sync_list(vdev_t **svd, int svdcount, uberblock_t *ub, int flags,
+    boolean_t subset)
 {
 	spa_t *spa = svd[0]->vdev_spa;
 	zio_t *zio;
@@ -1184,7 +1292,8 @@ vdev_uberblock_sync_list(vdev_t **svd, int svdcount, uberblock_t *ub, int flags)
 	zio = zio_root(spa, NULL, &good_writes, flags);
 
 	for (v = 0; v < svdcount; v++)
-		vdev_uberblock_sync(zio, ub, svd[v], flags);
+		vdev_uberblock_sync_top(zio, ub, svd[v], ub->ub_txg, subset,
+		    flags);
 
 	(void) zio_wait(zio);
 
@@ -1192,11 +1301,13 @@ vdev_uberblock_sync_list(vdev_t **svd, int svdcount, uberblock_t *ub, int flags)
 	 * Flush the uberblocks to disk.  This ensures that the odd labels
 	 * are no longer needed (because the new uberblocks and the even
 	 * labels are safely on disk), so it is safe to overwrite them.
+	 * The flushes of all of the vdevs are issued at once.
 	 */
 	zio = zio_root(spa, NULL, NULL, flags);
 
 	for (v = 0; v < svdcount; v++)
-		zio_flush(zio, svd[v]);
+		vdev_uberblock_sync_top(zio, NULL, svd[v], ub->ub_txg, subset,
+		    flags);
 
 	(void) zio_wait(zio);
 
@@ -1246,6 +1357,7 @@ vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
 {
 	nvlist_t *label;
 	vdev_phys_t *vp;
+	abd_t *vp_abd;
 	char *buf;
 	size_t buflen;
 	int c;
@@ -1264,15 +1376,16 @@ vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
 	 */
 	label = spa_config_generate(vd->vdev_spa, vd, txg, B_FALSE);
 
-	vp = zio_buf_alloc(sizeof (vdev_phys_t));
-	bzero(vp, sizeof (vdev_phys_t));
+	vp_abd = abd_alloc_linear(sizeof (vdev_phys_t), B_TRUE);
+	abd_zero(vp_abd, sizeof (vdev_phys_t));
+	vp = abd_to_buf(vp_abd);
 
 	buf = vp->vp_nvlist;
 	buflen = sizeof (vp->vp_nvlist);
 
 	if (!nvlist_pack(label, &buf, &buflen, NV_ENCODE_XDR, KM_SLEEP)) {
 		for (; l < VDEV_LABELS; l += 2) {
-			vdev_label_write(zio, vd, l, vp,
+			vdev_label_write(zio, vd, l, vp_abd,
 			    offsetof(vdev_label_t, vl_vdev_phys),
 			    sizeof (vdev_phys_t),
 			    vdev_label_sync_done, zio->io_private,
@@ -1280,7 +1393,7 @@ vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
 		}
 	}
 
-	zio_buf_free(vp, sizeof (vdev_phys_t));
+	abd_free(vp_abd);
 	nvlist_free(label);
 }
 
@@ -1347,6 +1460,8 @@ vdev_config_sync(vdev_t **svd, int svdcount, uint64_t txg)
 	zio_t *zio;
 	int error = 0;
 	int flags = ZIO_FLAG_CONFIG_WRITER | ZIO_FLAG_CANFAIL;
+	boolean_t subset;
+	hrtime_t start;
 
 retry:
 	/*
@@ -1386,6 +1501,7 @@ retry:
 	 * written in this txg will be committed to stable storage
 	 * before any uberblock that references them.
 	 */
+	start = gethrtime();
 	zio = zio_root(spa, NULL, NULL, flags);
 
 	for (vd = txg_list_head(&spa->spa_vdev_txg_list, TXG_CLEAN(txg)); vd;
@@ -1393,6 +1509,8 @@ retry:
 		zio_flush(zio, vd);
 
 	(void) zio_wait(zio);
+	spa_txg_history_add_sync(spa, txg, TXG_SYNC_FLUSH,
+	    gethrtime() - start);
 
 	/*
 	 * Sync out the even labels (L0, L2) for every dirty vdev.  If the
@@ -1403,7 +1521,11 @@ retry:
 	 * the new labels to disk to ensure that all even-label updates
 	 * are committed to stable storage before the uberblock update.
 	 */
-	if ((error = vdev_label_sync_list(spa, 0, txg, flags)) != 0)
+	start = gethrtime();
+	error = vdev_label_sync_list(spa, 0, txg, flags);
+	spa_txg_history_add_sync(spa, txg, TXG_SYNC_LABELS,
+	    gethrtime() - start);
+	if (error != 0)
 		goto retry;
 
 	/*
@@ -1420,8 +1542,19 @@ retry:
 	 *	will be the newest, and the even labels (which had all
 	 *	been successfully committed) will be valid with respect
 	 *	to the new uberblocks.
+	 *
+	 * Unless the config changed or this is a retry, the uberblock
+	 * only goes to enough children of each raidz vdev to survive
+	 * the loss of its parity disks (see vdev_uberblock_sync_top()).
 	 */
-	if ((error = vdev_uberblock_sync_list(svd, svdcount, ub, flags)) != 0)
+	subset = (zfs_uberblock_sync_subset &&
+	    list_is_empty(&spa->spa_config_dirty_list) &&
+	    !(flags & ZIO_FLAG_TRYHARD));
+	start = gethrtime();
+	error = vdev_uberblock_sync_list(svd, svdcount, ub, flags, subset);
+	spa_txg_history_add_sync(spa, txg, TXG_SYNC_UBERBLOCK,
+	    gethrtime() - start);
+	if (error != 0)
 		goto retry;
 
 	/*
@@ -1434,7 +1567,11 @@ retry:
 	 * to disk to ensure that all odd-label updates are committed to
 	 * stable storage before the next transaction group begins.
 	 */
-	if ((error = vdev_label_sync_list(spa, 1, txg, flags)) != 0)
+	start = gethrtime();
+	error = vdev_label_sync_list(spa, 1, txg, flags);
+	spa_txg_history_add_sync(spa, txg, TXG_SYNC_LABELS,
+	    gethrtime() - start);
+	if (error != 0)
 		goto retry;
 
 	return (0);
@@ -31,6 +31,7 @@
 #include <sys/spa.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/fs/zfs.h>
 
 /*
@@ -53,6 +54,7 @@ typedef struct mirror_map {
 	int		mm_children;
 	boolean_t	mm_replacing;
 	boolean_t	mm_root;
+	boolean_t	mm_mixed;	/* rotating and non-rotating children */
 	mirror_child_t	mm_child[];
 } mirror_map_t;
 
@@ -62,21 +64,29 @@ static int vdev_mirror_shift = 21;
  * The load configuration settings below are tuned by default for
  * the case where all devices are of the same rotational type.
  *
- * If there is a mixture of rotating and non-rotating media, setting
- * zfs_vdev_mirror_non_rotating_seek_inc to 0 may well provide better results
- * as it will direct more reads to the non-rotating vdevs which are more likely
- * to have a higher performance.
+ * If there is a mixture of rotating and non-rotating media, the rotating
+ * children additionally get zfs_vdev_mirror_rotating_mixed_inc, which
+ * directs reads to the non-rotating vdevs, which are more likely to have
+ * a higher performance, unless they are noticeably busier.
  */
 
 /* Rotating media load calculation configuration. */
 uint64_t zfs_vdev_mirror_rotating_inc = 0;
 uint64_t zfs_vdev_mirror_rotating_seek_inc = 5;
 uint64_t zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
+uint64_t zfs_vdev_mirror_rotating_mixed_inc = 5;
 
 /* Non-rotating media load calculation configuration. */
 uint64_t zfs_vdev_mirror_non_rotating_inc = 0;
 uint64_t zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * Choose among the DVAs of a ditto block (e.g. metadata) by the load of
+ * their top-level vdevs, like among the children of a mirror, instead of
+ * at random.
+ */
+uint64_t zfs_vdev_mirror_ditto_balance = 1;
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -113,14 +123,28 @@ static const zio_vsd_ops_t vdev_mirror_vsd_ops = {
 };
 
 static int
-vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
+vdev_mirror_vd_load(vdev_t *vd, uint64_t zio_offset, boolean_t mixed)
 {
-	uint64_t lastoffset;
+	uint64_t lastoffset, distance;
 	int load;
+	int c;
 
-	/* All DVAs have equal weight at the root. */
-	if (mm->mm_root)
-		return (INT_MAX);
+	/*
+	 * A replacing or spare vdev has no queue of its own; it is as
+	 * loaded as the least loaded child it could read from.
+	 */
+	if (!vd->vdev_ops->vdev_op_leaf) {
+		load = INT_MAX;
+		for (c = 0; c < vd->vdev_children; c++) {
+			vdev_t *cvd = vd->vdev_child[c];
+
+			if (vdev_readable(cvd)) {
+				load = MIN(load,
+				    vdev_mirror_vd_load(cvd, zio_offset, mixed));
+			}
+		}
+		return (load);
+	}
 
 	/*
 	 * We don't return INT_MAX if the device is resilvering i.e.
@@ -146,6 +170,10 @@ vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 		return (load + zfs_vdev_mirror_non_rotating_seek_inc);
 	}
 
+	/* Rotating media is slower than the non-rotating children. */
+	if (mixed)
+		load += zfs_vdev_mirror_rotating_mixed_inc;
+
 	/* Rotating media I/O's which directly follow the last I/O. */
 	if (lastoffset == zio_offset)
 		return (load + zfs_vdev_mirror_rotating_inc);
@@ -155,14 +183,55 @@ vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 	 * of the last I/O queued to this vdev as they should incure less
 	 * of a seek increment.
 	 */
-	if (ABS(lastoffset - zio_offset) <
-	    zfs_vdev_mirror_rotating_seek_offset)
+	distance = (lastoffset > zio_offset) ? lastoffset - zio_offset :
+	    zio_offset - lastoffset;
+	if (distance < zfs_vdev_mirror_rotating_seek_offset)
 		return (load + (zfs_vdev_mirror_rotating_seek_inc / 2));
 
 	/* Apply the full seek increment to all other I/O's. */
 	return (load + zfs_vdev_mirror_rotating_seek_inc);
 }
 
+/*
+ * The load of a DVA's top-level vdev.  A mirror is as loaded as its least
+ * loaded child, but a raidz read goes to several children, so it is as
+ * loaded as its busiest one.
+ */
+static int
+vdev_mirror_dva_load(vdev_t *vd, uint64_t zio_offset, boolean_t mixed)
+{
+	int load;
+	int c;
+
+	if (vd->vdev_ops != &vdev_raidz_ops)
+		return (vdev_mirror_vd_load(vd, zio_offset, mixed));
+
+	load = 0;
+	for (c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (vdev_readable(cvd)) {
+			load = MAX(load,
+			    vdev_mirror_vd_load(cvd, zio_offset, mixed));
+		}
+	}
+	return (load);
+}
+
+static int
+vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
+{
+	if (mm->mm_root) {
+		/* Without balancing, all DVAs have equal weight. */
+		if (!zfs_vdev_mirror_ditto_balance)
+			return (INT_MAX);
+
+		return (vdev_mirror_dva_load(vd, zio_offset, mm->mm_mixed));
+	}
+
+	return (vdev_mirror_vd_load(vd, zio_offset, mm->mm_mixed));
+}
+
 /*
  * Avoid inlining the function to keep vdev_mirror_io_start(), which
  * is this functions only caller, as small as possible on the stack.
@@ -178,6 +247,7 @@ vdev_mirror_map_init(zio_t *zio)
 	if (vd == NULL) {
 		dva_t *dva = zio->io_bp->blk_dva;
 		spa_t *spa = zio->io_spa;
+		boolean_t rot = B_FALSE, nonrot = B_FALSE;
 
 		mm = vdev_mirror_map_alloc(BP_GET_NDVAS(zio->io_bp), B_FALSE,
 		    B_TRUE);
@@ -186,8 +256,17 @@ vdev_mirror_map_init(zio_t *zio)
 
 			mc->mc_vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[c]));
 			mc->mc_offset = DVA_GET_OFFSET(&dva[c]);
+			if (mc->mc_vd == NULL)
+				continue;
+			if (mc->mc_vd->vdev_nonrot)
+				nonrot = B_TRUE;
+			else
+				rot = B_TRUE;
 		}
+		mm->mm_mixed = (rot && nonrot);
 	} else {
+		boolean_t rot = B_FALSE, nonrot = B_FALSE;
+
 		mm = vdev_mirror_map_alloc(vd->vdev_children,
 		    (vd->vdev_ops == &vdev_replacing_ops ||
 		    vd->vdev_ops == &vdev_spare_ops), B_FALSE);
@@ -195,7 +274,12 @@ vdev_mirror_map_init(zio_t *zio)
 			mc = &mm->mm_child[c];
 			mc->mc_vd = vd->vdev_child[c];
 			mc->mc_offset = zio->io_offset;
+			if (mc->mc_vd->vdev_nonrot)
+				nonrot = B_TRUE;
+			else
+				rot = B_TRUE;
 		}
+		mm->mm_mixed = (rot && nonrot);
 	}
 
 	zio->io_vsd = mm;
@@ -272,13 +356,13 @@ vdev_mirror_scrub_done(zio_t *zio)
 		while ((pio = zio_walk_parents(zio, &zl)) != NULL) {
 			mutex_enter(&pio->io_lock);
 			ASSERT3U(zio->io_size, >=, pio->io_size);
-			bcopy(zio->io_data, pio->io_data, pio->io_size);
+			abd_copy(pio->io_abd, zio->io_abd, pio->io_size);
 			mutex_exit(&pio->io_lock);
 		}
 		mutex_exit(&zio->io_lock);
 	}
 
-	zio_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mc->mc_error = zio->io_error;
 	mc->mc_tried = 1;
@@ -427,13 +511,14 @@ vdev_mirror_io_start(zio_t *zio)
 			 * For scrubbing reads we need to allocate a read
 			 * buffer for each child and issue reads to all
 			 * children.  If any child succeeds, it will copy its
-			 * data into zio->io_data in vdev_mirror_scrub_done.
+			 * data into zio->io_abd in vdev_mirror_scrub_done.
 			 */
 			for (c = 0; c < mm->mm_children; c++) {
 				mc = &mm->mm_child[c];
 				zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
 				    mc->mc_vd, mc->mc_offset,
-				    zio_buf_alloc(zio->io_size), zio->io_size,
+				    abd_alloc_sametype(zio->io_abd,
+				    zio->io_size), zio->io_size,
 				    zio->io_type, zio->io_priority, 0,
 				    vdev_mirror_scrub_done, mc));
 			}
@@ -458,7 +543,7 @@ vdev_mirror_io_start(zio_t *zio)
 	while (children--) {
 		mc = &mm->mm_child[c];
 		zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
-		    mc->mc_vd, mc->mc_offset, zio->io_data, zio->io_size,
+		    mc->mc_vd, mc->mc_offset, zio->io_abd, zio->io_size,
 		    zio->io_type, zio->io_priority, 0,
 		    vdev_mirror_child_done, mc));
 		c++;
@@ -542,9 +627,11 @@ vdev_mirror_io_done(zio_t *zio)
 	if (good_copies == 0 && (c = vdev_mirror_child_select(zio)) != -1) {
 		ASSERT(c >= 0 && c < mm->mm_children);
 		mc = &mm->mm_child[c];
+		if (mm->mm_root && mm->mm_children > 1)
+			spa_ditto_read_add(zio->io_spa, SPA_DITTO_READ_RETRIES);
 		zio_vdev_io_redone(zio);
 		zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
-		    mc->mc_vd, mc->mc_offset, zio->io_data, zio->io_size,
+		    mc->mc_vd, mc->mc_offset, zio->io_abd, zio->io_size,
 		    ZIO_TYPE_READ, zio->io_priority, 0,
 		    vdev_mirror_child_done, mc));
 		return;
@@ -554,6 +641,19 @@ vdev_mirror_io_done(zio_t *zio)
 	if (good_copies == 0) {
 		zio->io_error = vdev_mirror_worst_error(mm);
 		ASSERT(zio->io_error != 0);
+	} else if (mm->mm_root && mm->mm_children > 1 &&
+	    !(zio->io_flags & ZIO_FLAG_SCRUB)) {
+		/*
+		 * Count which copy of a ditto block served the read.
+		 */
+		for (c = 0; c < mm->mm_children; c++) {
+			mc = &mm->mm_child[c];
+			if (mc->mc_tried && mc->mc_error == 0) {
+				spa_ditto_read_add(zio->io_spa,
+				    SPA_DITTO_READ_DVA(c));
+				break;
+			}
+		}
 	}
 
 	if (good_copies && spa_writeable(zio->io_spa) &&
@@ -585,7 +685,7 @@ vdev_mirror_io_done(zio_t *zio)
 
 			zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
 			    mc->mc_vd, mc->mc_offset,
-			    zio->io_data, zio->io_size,
+			    zio->io_abd, zio->io_size,
 			    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE,
 			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
 			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
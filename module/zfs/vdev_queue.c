@@ -31,6 +31,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/spa_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/avl.h>
 #include <sys/dsl_pool.h>
 #include <sys/metaslab_impl.h>
@@ -44,9 +45,9 @@
  *
  * ZFS issues I/O operations to leaf vdevs to satisfy and complete zios.  The
  * I/O scheduler determines when and in what order those operations are
- * issued.  The I/O scheduler divides operations into five I/O classes
+ * issued.  The I/O scheduler divides operations into six I/O classes
  * prioritized in the following order: sync read, sync write, async read,
- * async write, and scrub/resilver.  Each queue defines the minimum and
+ * async write, scrub and resilver.  Each queue defines the minimum and
  * maximum number of concurrent operations that may be issued to the device.
  * In addition, the device has an aggregate maximum. Note that the sum of the
  * per-queue minimums must not exceed the aggregate maximum. If the
@@ -137,9 +138,9 @@ uint32_t zfs_vdev_max_active = 1000;
  *
  * The ratio of the queues' max_actives determines the balance of performance
  * between reads, writes, and scrubs.  E.g., increasing
- * zfs_vdev_scrub_max_active will cause the scrub or resilver to complete
- * more quickly, but reads and writes to have higher latency and lower
- * throughput.
+ * zfs_vdev_scrub_max_active or zfs_vdev_resilver_max_active will cause the
+ * scrub or resilver to complete more quickly, but reads and writes to have
+ * higher latency and lower throughput.
  */
 uint32_t zfs_vdev_sync_read_min_active = 10;
 uint32_t zfs_vdev_sync_read_max_active = 10;
@@ -151,6 +152,28 @@ uint32_t zfs_vdev_async_write_min_active = 1;
 uint32_t zfs_vdev_async_write_max_active = 10;
 uint32_t zfs_vdev_scrub_min_active = 1;
 uint32_t zfs_vdev_scrub_max_active = 2;
+uint32_t zfs_vdev_resilver_min_active = 1;
+uint32_t zfs_vdev_resilver_max_active = 3;
+
+/*
+ * The best max_active values depend on the device: NVMe drives want far
+ * deeper queues than the defaults above, SMR drives shallower ones.  With
+ * zfs_vdev_queue_tune set, each leaf vdev adapts the max_active of each
+ * class to the latency it observes.  The limit starts at the value above,
+ * doubled for non-rotational devices.  After every
+ * zfs_vdev_queue_tune_window completions of a class, the moving average
+ * of their service time is compared to a target of
+ * zfs_vdev_queue_tune_latency_pct percent of the lowest average seen.
+ * Above the target the limit is cut by a quarter; otherwise, if i/o was
+ * mostly held back by the limit, it grows by one.  The lowest average
+ * slowly decays towards the current one, so that the target follows the
+ * device.  The limit stays between the class's min_active and
+ * zfs_vdev_queue_tune_max_active.
+ */
+int zfs_vdev_queue_tune = 1;
+uint32_t zfs_vdev_queue_tune_window = 64;
+uint32_t zfs_vdev_queue_tune_latency_pct = 200;
+uint32_t zfs_vdev_queue_tune_max_active = 128;
 
 /*
  * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
@@ -172,6 +195,15 @@ int zfs_vdev_aggregation_limit = SPA_OLD_MAXBLOCKSIZE;
 int zfs_vdev_read_gap_limit = 32 << 10;
 int zfs_vdev_write_gap_limit = 4 << 10;
 
+/*
+ * zfs_vdev_aggregation_limit applies to devices that don't report the
+ * largest transfer they take in one request.  Those that do aggregate up
+ * to that size instead, but no further than zfs_vdev_aggregation_limit_max,
+ * which keeps larger aggregation from stopping altogether once a pool
+ * uses large blocks.  Setting it to 0 ignores what the device reports.
+ */
+int zfs_vdev_aggregation_limit_max = SPA_MAXBLOCKSIZE;
+
 /*
  * Define the queue depth percentage for each top-level. This percentage is
  * used in conjunction with zfs_vdev_async_max_active to determine how many
@@ -256,6 +288,8 @@ vdev_queue_class_min_active(zio_priority_t p)
 		return (zfs_vdev_async_write_min_active);
 	case ZIO_PRIORITY_SCRUB:
 		return (zfs_vdev_scrub_min_active);
+	case ZIO_PRIORITY_RESILVER:
+		return (zfs_vdev_resilver_min_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
@@ -263,7 +297,149 @@ vdev_queue_class_min_active(zio_priority_t p)
 }
 
 static int
-vdev_queue_max_async_writes(spa_t *spa)
+vdev_queue_static_max_active(zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (zfs_vdev_sync_read_max_active);
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (zfs_vdev_sync_write_max_active);
+	case ZIO_PRIORITY_ASYNC_READ:
+		return (zfs_vdev_async_read_max_active);
+	case ZIO_PRIORITY_ASYNC_WRITE:
+		return (zfs_vdev_async_write_max_active);
+	case ZIO_PRIORITY_SCRUB:
+		return (zfs_vdev_scrub_max_active);
+	case ZIO_PRIORITY_RESILVER:
+		return (zfs_vdev_resilver_max_active);
+	default:
+		panic("invalid priority %u", p);
+		return (0);
+	}
+}
+
+/*
+ * Bounds of the adaptive max_active of a class.
+ */
+static uint32_t
+vdev_queue_tune_lo(zio_priority_t p)
+{
+	return (MAX(vdev_queue_class_min_active(p), 1));
+}
+
+static uint32_t
+vdev_queue_tune_hi(zio_priority_t p)
+{
+	return (MAX(zfs_vdev_queue_tune_max_active, vdev_queue_tune_lo(p)));
+}
+
+static uint32_t
+vdev_queue_tune_max_active(vdev_queue_t *vq, zio_priority_t p)
+{
+	vdev_queue_tune_t *vqt = &vq->vq_class[p].vqc_tune;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (vqt->vqt_max_active == 0) {
+		uint32_t seed = vdev_queue_static_max_active(p);
+
+		/* vdev_nonrot comes from DKIOCISSOLIDSTATE at open */
+		if (vq->vq_vdev->vdev_nonrot)
+			seed *= 2;
+		vqt->vqt_max_active = MIN(MAX(seed, vdev_queue_tune_lo(p)),
+		    vdev_queue_tune_hi(p));
+	}
+
+	return (vqt->vqt_max_active);
+}
+
+/*
+ * Called for each completed i/o of a queue class, see the comment at
+ * zfs_vdev_queue_tune.
+ */
+static void
+vdev_queue_tune(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_priority_t p = zio->io_priority;
+	vdev_queue_class_t *vqc = &vq->vq_class[p];
+	vdev_queue_tune_t *vqt = &vqc->vqc_tune;
+	uint32_t max_active, lo, hi;
+	hrtime_t avg, target;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (zio->io_error != 0 || zio->io_delay == 0)
+		return;
+
+	max_active = vdev_queue_tune_max_active(vq, p);
+	vqt->vqt_ios++;
+	vqt->vqt_lat_sum += zio->io_delay;
+	if (vqc->vqc_active + 1 >= max_active &&
+	    avl_numnodes(&vqc->vqc_queued_tree) > 0)
+		vqt->vqt_saturated++;
+
+	if (vqt->vqt_ios < MAX(zfs_vdev_queue_tune_window, 1))
+		return;
+
+	avg = vqt->vqt_lat_sum / vqt->vqt_ios;
+	if (vqt->vqt_lat_avg == 0)
+		vqt->vqt_lat_avg = avg;
+	else
+		vqt->vqt_lat_avg = (vqt->vqt_lat_avg * 7 + avg) / 8;
+
+	if (vqt->vqt_lat_floor == 0 || vqt->vqt_lat_avg < vqt->vqt_lat_floor)
+		vqt->vqt_lat_floor = vqt->vqt_lat_avg;
+	else
+		vqt->vqt_lat_floor +=
+		    (vqt->vqt_lat_avg - vqt->vqt_lat_floor) / 64;
+
+	/*
+	 * The scan throttle backs off while sync reads are slower than
+	 * usual, see dsl_scan_throttle().  Publish how much slower, as a
+	 * percentage of the lowest average, on the pool.
+	 */
+	if (p == ZIO_PRIORITY_SYNC_READ && vqt->vqt_lat_floor != 0) {
+		spa_t *spa = vq->vq_vdev->vdev_spa;
+
+		spa->spa_sync_read_lat_pct = (spa->spa_sync_read_lat_pct * 3 +
+		    vqt->vqt_lat_avg * 100 / vqt->vqt_lat_floor) / 4;
+	}
+
+	lo = vdev_queue_tune_lo(p);
+	hi = vdev_queue_tune_hi(p);
+	target = vqt->vqt_lat_floor * zfs_vdev_queue_tune_latency_pct / 100;
+
+	if (vqt->vqt_lat_avg > target && max_active > lo) {
+		vqt->vqt_max_active = MAX(max_active - max_active / 4 - 1, lo);
+		vqt->vqt_shrinks++;
+	} else if (vqt->vqt_lat_avg <= target && max_active < hi &&
+	    vqt->vqt_saturated * 2 > vqt->vqt_ios) {
+		vqt->vqt_max_active = max_active + 1;
+		vqt->vqt_grows++;
+	} else if (max_active > hi) {
+		vqt->vqt_max_active = hi;
+	}
+
+	vqt->vqt_ios = 0;
+	vqt->vqt_saturated = 0;
+	vqt->vqt_lat_sum = 0;
+}
+
+void
+vdev_queue_tune_get(vdev_t *vd, zio_priority_t p, vdev_queue_tune_t *vqt)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	ASSERT3U(p, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+
+	mutex_enter(&vq->vq_lock);
+	(void) vdev_queue_tune_max_active(vq, p);
+	*vqt = vq->vq_class[p].vqc_tune;
+	mutex_exit(&vq->vq_lock);
+}
+
+static int
+vdev_queue_max_async_writes(spa_t *spa, uint32_t max_active)
 {
 	int writes;
 	uint64_t dirty = spa->spa_dsl_pool->dp_dirty_total;
@@ -271,18 +447,20 @@ vdev_queue_max_async_writes(spa_t *spa)
 		zfs_vdev_async_write_active_min_dirty_percent / 100;
 	uint64_t max_bytes =  zfs_dirty_data_max *
 		zfs_vdev_async_write_active_max_dirty_percent / 100;
+	uint32_t min_active = MIN(zfs_vdev_async_write_min_active, max_active);
+
 	/*
 	 * Sync tasks correspond to interactive user actions. To reduce the
 	 * execution time of those actions we push data out as fast as possible.
 	 */
 	if (spa_has_pending_synctask(spa)) {
-		return (zfs_vdev_async_write_max_active);
+		return (max_active);
 	}
 
 	if (dirty < min_bytes)
-		return (zfs_vdev_async_write_min_active);
+		return (min_active);
 	if (dirty > max_bytes)
-		return (zfs_vdev_async_write_max_active);
+		return (max_active);
 
 	/*
 	 * linear interpolation:
@@ -290,35 +468,27 @@ vdev_queue_max_async_writes(spa_t *spa)
 	 * move right by min_bytes
 	 * move up by min_writes
 	 */
-	writes = (dirty - min_bytes) *
-		zfs_vdev_async_write_max_active -
-		zfs_vdev_async_write_min_active /
-		(uint64_t)(
-		(max_bytes - min_bytes) +
-	    zfs_vdev_async_write_min_active);
-	ASSERT3U(writes, >=, zfs_vdev_async_write_min_active);
-	ASSERT3U(writes, <=, zfs_vdev_async_write_max_active);
+	writes = (dirty - min_bytes) * (max_active - min_active) /
+	    (max_bytes - min_bytes) + min_active;
+	ASSERT3U(writes, >=, min_active);
+	ASSERT3U(writes, <=, max_active);
 	return (writes);
 }
 
 static int
-vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
+vdev_queue_class_max_active(vdev_queue_t *vq, zio_priority_t p)
 {
-	switch (p) {
-	case ZIO_PRIORITY_SYNC_READ:
-		return (zfs_vdev_sync_read_max_active);
-	case ZIO_PRIORITY_SYNC_WRITE:
-		return (zfs_vdev_sync_write_max_active);
-	case ZIO_PRIORITY_ASYNC_READ:
-		return (zfs_vdev_async_read_max_active);
-	case ZIO_PRIORITY_ASYNC_WRITE:
-		return (vdev_queue_max_async_writes(spa));
-	case ZIO_PRIORITY_SCRUB:
-		return (zfs_vdev_scrub_max_active);
-	default:
-		panic("invalid priority %u", p);
-		return (0);
-	}
+	spa_t *spa = vq->vq_vdev->vdev_spa;
+	uint32_t max_active;
+
+	if (zfs_vdev_queue_tune)
+		max_active = vdev_queue_tune_max_active(vq, p);
+	else
+		max_active = vdev_queue_static_max_active(p);
+
+	if (p == ZIO_PRIORITY_ASYNC_WRITE)
+		return (vdev_queue_max_async_writes(spa, max_active));
+	return (max_active);
 }
 
 /*
@@ -328,7 +498,6 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 static zio_priority_t
 vdev_queue_class_to_issue(vdev_queue_t *vq)
 {
-	spa_t *spa = vq->vq_vdev->vdev_spa;
 	zio_priority_t p;
 
 	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
@@ -349,7 +518,7 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
 		    vq->vq_class[p].vqc_active <
-		    vdev_queue_class_max_active(spa, p))
+		    vdev_queue_class_max_active(vq, p))
 			return (p);
 	}
 
@@ -508,16 +677,20 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
-	if (aio->io_type == ZIO_TYPE_READ) {
+	/*
+	 * A gang ABD was read into the children's own buffers; freeing it
+	 * leaves those alone and frees only the padding in the gaps.
+	 */
+	if (aio->io_type == ZIO_TYPE_READ && !abd_is_gang(aio->io_abd)) {
 		zio_t *pio;
 		zio_link_t *zl = NULL;
 		while ((pio = zio_walk_parents(aio, &zl)) != NULL) {
-			bcopy((char *)aio->io_data + (pio->io_offset -
-			    aio->io_offset), pio->io_data, pio->io_size);
+			abd_copy_off(pio->io_abd, aio->io_abd,
+			    0, pio->io_offset - aio->io_offset, pio->io_size);
 		}
 	}
 
-	zio_buf_free(aio->io_data, aio->io_size);
+	abd_free(aio->io_abd);
 }
 
 /*
@@ -529,12 +702,104 @@ vdev_queue_agg_io_done(zio_t *aio)
 #define	IO_SPAN(fio, lio) ((lio)->io_offset + (lio)->io_size - (fio)->io_offset)
 #define	IO_GAP(fio, lio) (-IO_SPAN(lio, fio))
 
+/*
+ * The largest i/o vdev_queue_aggregate() may build for the vdev.
+ */
+static uint64_t
+vdev_queue_agg_limit(vdev_queue_t *vq)
+{
+	uint64_t max_xfer = vq->vq_vdev->vdev_max_xfer;
+
+	/*
+	 * Prevent users from setting the aggregation limits larger than
+	 * SPA_MAXBLOCKSIZE.
+	 */
+	if (max_xfer != 0 && zfs_vdev_aggregation_limit_max > 0) {
+		return (MIN(max_xfer, MIN(zfs_vdev_aggregation_limit_max,
+		    SPA_MAXBLOCKSIZE)));
+	}
+	return (MIN(zfs_vdev_aggregation_limit, SPA_MAXBLOCKSIZE));
+}
+
+/*
+ * Build the buffer of an aggregate of the i/os from first to last.  When
+ * none of them overlap, this is a gang ABD of the buffers of the i/os
+ * themselves, with scratch buffers filling any gaps between reads and
+ * zeroes standing in for NODATA writes, so that no data is copied.
+ * Otherwise the aggregate gets a buffer of its own, and writes are copied
+ * into it here while reads are copied out of it as the aggregate is done.
+ */
+static abd_t *
+vdev_queue_agg_abd(vdev_queue_t *vq, zio_t *first, zio_t *last,
+    uint64_t size)
+{
+	avl_tree_t *t = vdev_queue_type_tree(vq, first->io_type);
+	uint64_t next_offset = first->io_offset;
+	zio_t *dio, *nio;
+	abd_t *abd;
+
+	for (dio = first; dio != AVL_NEXT(t, last); dio = AVL_NEXT(t, dio)) {
+		if (dio->io_offset < next_offset)
+			break;
+		next_offset = dio->io_offset + dio->io_size;
+	}
+
+	if (dio != AVL_NEXT(t, last)) {
+		abd = abd_alloc_for_io(size, B_TRUE);
+		for (dio = first; dio != AVL_NEXT(t, last);
+		    dio = AVL_NEXT(t, dio)) {
+			if (dio->io_flags & ZIO_FLAG_NODATA) {
+				ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+				abd_zero_off(abd,
+				    dio->io_offset - first->io_offset,
+				    dio->io_size);
+			} else if (dio->io_type == ZIO_TYPE_WRITE) {
+				abd_copy_off(abd, dio->io_abd,
+				    dio->io_offset - first->io_offset, 0,
+				    dio->io_size);
+			}
+		}
+		return (abd);
+	}
+
+	abd = abd_alloc_gang();
+	next_offset = first->io_offset;
+	nio = first;
+	do {
+		dio = nio;
+		nio = AVL_NEXT(t, dio);
+
+		if (dio->io_offset > next_offset) {
+			uint64_t gap = dio->io_offset - next_offset;
+
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_READ);
+			abd_gang_add(abd, abd_alloc_for_io(gap, B_TRUE),
+			    gap, B_TRUE);
+		}
+
+		if (dio->io_flags & ZIO_FLAG_NODATA) {
+			abd_t *zabd = abd_alloc_for_io(dio->io_size, B_TRUE);
+
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+			abd_zero(zabd, dio->io_size);
+			abd_gang_add(abd, zabd, dio->io_size, B_TRUE);
+		} else {
+			abd_gang_add(abd, dio->io_abd, dio->io_size, B_FALSE);
+		}
+		next_offset = dio->io_offset + dio->io_size;
+	} while (dio != last);
+
+	ASSERT3U(abd->abd_size, ==, size);
+	return (abd);
+}
+
 static zio_t *
 vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 {
 	zio_t *first, *last, *aio, *dio, *mandatory, *nio;
 	uint64_t maxgap = 0;
 	uint64_t size;
+	uint64_t limit;
 	boolean_t stretch = B_FALSE;
 	avl_tree_t *t = vdev_queue_type_tree(vq, zio->io_type);
 	enum zio_flag flags = zio->io_flags & ZIO_FLAG_AGG_INHERIT;
@@ -542,12 +807,7 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	if (zio->io_flags & ZIO_FLAG_DONT_AGGREGATE)
 		return (NULL);
 
-	/*
-	 * Prevent users from setting the zfs_vdev_aggregation_limit
-	 * tuning larger than SPA_MAXBLOCKSIZE.
-	 */
-	zfs_vdev_aggregation_limit =
-	    MIN(zfs_vdev_aggregation_limit, SPA_MAXBLOCKSIZE);
+	limit = vdev_queue_agg_limit(vq);
 
 	first = last = zio;
 
@@ -575,7 +835,7 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	 */
 	while ((dio = AVL_PREV(t, first)) != NULL &&
 	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
-	    IO_SPAN(dio, last) <= zfs_vdev_aggregation_limit &&
+	    IO_SPAN(dio, last) <= limit &&
 	    IO_GAP(dio, first) <= maxgap) {
 		first = dio;
 		if (mandatory == NULL && !(first->io_flags & ZIO_FLAG_OPTIONAL))
@@ -596,7 +856,7 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	 */
 	while ((dio = AVL_NEXT(t, last)) != NULL &&
 	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
-	    IO_SPAN(first, dio) <= zfs_vdev_aggregation_limit &&
+	    IO_SPAN(first, dio) <= limit &&
 	    IO_GAP(last, dio) <= maxgap) {
 		last = dio;
 		if (!(last->io_flags & ZIO_FLAG_OPTIONAL))
@@ -642,10 +902,11 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		return (NULL);
 
 	size = IO_SPAN(first, last);
-	ASSERT3U(size, <=, zfs_vdev_aggregation_limit);
+	ASSERT3U(size, <=, limit);
 
 	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
-	    zio_buf_alloc(size), size, first->io_type, zio->io_priority,
+	    vdev_queue_agg_abd(vq, first, last, size), size, first->io_type,
+	    zio->io_priority,
 	    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
 	    vdev_queue_agg_io_done, NULL);
 	aio->io_timestamp = first->io_timestamp;
@@ -656,16 +917,6 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		nio = AVL_NEXT(t, dio);
 		ASSERT3U(dio->io_type, ==, aio->io_type);
 
-		if (dio->io_flags & ZIO_FLAG_NODATA) {
-			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
-			bzero((char *)aio->io_data + (dio->io_offset -
-			    aio->io_offset), dio->io_size);
-		} else if (dio->io_type == ZIO_TYPE_WRITE) {
-			bcopy(dio->io_data, (char *)aio->io_data +
-			    (dio->io_offset - aio->io_offset),
-			    dio->io_size);
-		}
-
 		zio_add_child(dio, aio);
 		vdev_queue_io_remove(vq, dio);
 		zio_vdev_io_bypass(dio);
@@ -751,7 +1002,8 @@ vdev_queue_io(zio_t *zio)
 	if (zio->io_type == ZIO_TYPE_READ) {
 		if (zio->io_priority != ZIO_PRIORITY_SYNC_READ &&
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_READ &&
-		    zio->io_priority != ZIO_PRIORITY_SCRUB)
+		    zio->io_priority != ZIO_PRIORITY_SCRUB &&
+		    zio->io_priority != ZIO_PRIORITY_RESILVER)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_READ;
 	} else {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
@@ -793,6 +1045,11 @@ vdev_queue_io_done(zio_t *zio)
 	vq->vq_io_complete_ts = gethrtime();
 	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
 
+	if (zfs_vdev_queue_tune)
+		vdev_queue_tune(vq, zio);
+	else if (zio->io_vd->vdev_spa->spa_sync_read_lat_pct != 0)
+		zio->io_vd->vdev_spa->spa_sync_read_lat_pct = 0;
+
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
@@ -813,10 +1070,21 @@ vdev_queue_io_done(zio_t *zio)
  * vq_lock mutex use here, instead we prefer to keep it lock free for
  * performance.
  */
+/*
+ * The number of i/os issued to the device plus those still waiting in the
+ * queue, which is what a mirror balances its reads on.
+ */
 int
 vdev_queue_length(vdev_t *vd)
 {
-	return (avl_numnodes(&vd->vdev_queue.vq_active_tree));
+	vdev_queue_t *vq = &vd->vdev_queue;
+	int len = avl_numnodes(&vq->vq_active_tree);
+	zio_priority_t p;
+
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+		len += avl_numnodes(&vq->vq_class[p].vqc_queued_tree);
+
+	return (len);
 }
 
 uint64_t
@@ -27,8 +27,11 @@
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/abd.h>
 #include <sys/fs/zfs.h>
 #include <sys/fm/fs/zfs.h>
 
@@ -103,7 +106,7 @@ typedef struct raidz_col {
 	uint64_t rc_devidx;		/* child device index for I/O */
 	uint64_t rc_offset;		/* device offset */
 	uint64_t rc_size;		/* I/O size */
-	void *rc_data;			/* I/O data */
+	abd_t *rc_abd;			/* I/O data */
 	void *rc_gdata;			/* used to store the "good" version */
 	int rc_error;			/* I/O error for this device */
 	uint8_t rc_tried;		/* Did we attempt this I/O column? */
@@ -120,7 +123,7 @@ typedef struct raidz_map {
 	uint64_t rm_firstdatacol;	/* First data column/parity count */
 	uint64_t rm_nskip;		/* Skipped sectors for padding */
 	uint64_t rm_skipstart;		/* Column index of padding start */
-	void *rm_datacopy;		/* rm_asize-buffer of copied data */
+	abd_t *rm_abd_copy;		/* rm_asize-buffer of copied data */
 	uintptr_t rm_reports;		/* # of referencing checksum reports */
 	uint8_t	rm_freed;		/* map no longer has referencing ZIO */
 	uint8_t	rm_ecksuminjected;	/* checksum error was injected */
@@ -131,36 +134,13 @@ typedef struct raidz_map {
 #define	VDEV_RAIDZ_Q		1
 #define	VDEV_RAIDZ_R		2
 
-#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
-#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
-
-/*
- * We provide a mechanism to perform the field multiplication operation on a
- * 64-bit value all at once rather than a byte at a time. This works by
- * creating a mask from the top bit in each byte and using that to
- * conditionally apply the XOR of 0x1d.
- */
-#define	VDEV_RAIDZ_64MUL_2(x, mask) \
-{ \
-	(mask) = (x) & 0x8080808080808080ULL; \
-	(mask) = ((mask) << 1) - ((mask) >> 7); \
-	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
-	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
-}
-
-#define	VDEV_RAIDZ_64MUL_4(x, mask) \
-{ \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-}
-
 /*
  * Force reconstruction to use the general purpose method.
  */
 int vdev_raidz_default_to_general;
 
 /* Powers of 2 in the Galois field defined above. */
-static const uint8_t vdev_raidz_pow2[256] = {
+const uint8_t vdev_raidz_pow2[256] = {
 	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
 	0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26,
 	0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9,
@@ -195,7 +175,7 @@ static const uint8_t vdev_raidz_pow2[256] = {
 	0x1b, 0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e, 0x01
 };
 /* Logs of 2 in the Galois field defined above. */
-static const uint8_t vdev_raidz_log2[256] = {
+const uint8_t vdev_raidz_log2[256] = {
 	0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1a, 0xc6,
 	0x03, 0xdf, 0x33, 0xee, 0x1b, 0x68, 0xc7, 0x4b,
 	0x04, 0x64, 0xe0, 0x0e, 0x34, 0x8d, 0xef, 0x81,
@@ -255,22 +235,20 @@ static void
 vdev_raidz_map_free(raidz_map_t *rm)
 {
 	int c;
-	size_t size;
 
 	for (c = 0; c < rm->rm_firstdatacol; c++) {
-		zio_buf_free(rm->rm_col[c].rc_data, rm->rm_col[c].rc_size);
+		abd_free(rm->rm_col[c].rc_abd);
 
 		if (rm->rm_col[c].rc_gdata != NULL)
 			zio_buf_free(rm->rm_col[c].rc_gdata,
 			    rm->rm_col[c].rc_size);
 	}
 
-	size = 0;
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++)
-		size += rm->rm_col[c].rc_size;
+		abd_put(rm->rm_col[c].rc_abd);
 
-	if (rm->rm_datacopy != NULL)
-		zio_buf_free(rm->rm_datacopy, size);
+	if (rm->rm_abd_copy != NULL)
+		abd_free(rm->rm_abd_copy);
 
 	kmem_free(rm, offsetof(raidz_map_t, rm_col[rm->rm_scols]));
 }
@@ -307,7 +285,7 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 	size_t x;
 
 	const char *good = NULL;
-	const char *bad = rm->rm_col[c].rc_data;
+	char *bad;
 
 	if (good_data == NULL) {
 		zfs_ereport_finish_checksum(zcr, NULL, NULL, B_FALSE);
@@ -321,8 +299,9 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 		 * data never changes for a given logical ZIO)
 		 */
 		if (rm->rm_col[0].rc_gdata == NULL) {
-			char *bad_parity[VDEV_RAIDZ_MAXPARITY];
+			abd_t *bad_parity[VDEV_RAIDZ_MAXPARITY];
 			char *buf;
+			uint64_t offset;
 
 			/*
 			 * Set up the rm_col[]s to generate the parity for
@@ -330,15 +309,20 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 			 * replacing them with buffers to hold the result.
 			 */
 			for (x = 0; x < rm->rm_firstdatacol; x++) {
-				bad_parity[x] = rm->rm_col[x].rc_data;
-				rm->rm_col[x].rc_data = rm->rm_col[x].rc_gdata =
+				bad_parity[x] = rm->rm_col[x].rc_abd;
+				rm->rm_col[x].rc_gdata =
 				    zio_buf_alloc(rm->rm_col[x].rc_size);
+				rm->rm_col[x].rc_abd =
+				    abd_get_from_buf(rm->rm_col[x].rc_gdata,
+				    rm->rm_col[x].rc_size);
 			}
 
 			/* fill in the data columns from good_data */
 			buf = (char *)good_data;
 			for (; x < rm->rm_cols; x++) {
-				rm->rm_col[x].rc_data = buf;
+				abd_put(rm->rm_col[x].rc_abd);
+				rm->rm_col[x].rc_abd = abd_get_from_buf(buf,
+				    rm->rm_col[x].rc_size);
 				buf += rm->rm_col[x].rc_size;
 			}
 
@@ -348,13 +332,18 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 			vdev_raidz_generate_parity(rm);
 
 			/* restore everything back to its original state */
-			for (x = 0; x < rm->rm_firstdatacol; x++)
-				rm->rm_col[x].rc_data = bad_parity[x];
+			for (x = 0; x < rm->rm_firstdatacol; x++) {
+				abd_put(rm->rm_col[x].rc_abd);
+				rm->rm_col[x].rc_abd = bad_parity[x];
+			}
 
-			buf = rm->rm_datacopy;
+			offset = 0;
 			for (x = rm->rm_firstdatacol; x < rm->rm_cols; x++) {
-				rm->rm_col[x].rc_data = buf;
-				buf += rm->rm_col[x].rc_size;
+				abd_put(rm->rm_col[x].rc_abd);
+				rm->rm_col[x].rc_abd = abd_get_offset_size(
+				    rm->rm_abd_copy, offset,
+				    rm->rm_col[x].rc_size);
+				offset += rm->rm_col[x].rc_size;
 			}
 		}
 
@@ -369,7 +358,9 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 	}
 
 	/* we drop the ereport if it ends up that the data was good */
+	bad = abd_borrow_buf_copy(rm->rm_col[c].rc_abd, rm->rm_col[c].rc_size);
 	zfs_ereport_finish_checksum(zcr, good, bad, B_TRUE);
+	abd_return_buf(rm->rm_col[c].rc_abd, bad, rm->rm_col[c].rc_size);
 }
 
 /*
@@ -382,7 +373,7 @@ static void
 vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 {
 	size_t c = (size_t)(uintptr_t)arg;
-	caddr_t buf;
+	size_t offset;
 
 	raidz_map_t *rm = zio->io_vsd;
 	size_t size;
@@ -396,7 +387,7 @@ vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 	rm->rm_reports++;
 	ASSERT3U(rm->rm_reports, >, 0);
 
-	if (rm->rm_datacopy != NULL)
+	if (rm->rm_abd_copy != NULL)
 		return;
 
 	/*
@@ -412,17 +403,20 @@ vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++)
 		size += rm->rm_col[c].rc_size;
 
-	buf = rm->rm_datacopy = zio_buf_alloc(size);
+	rm->rm_abd_copy = abd_alloc_linear(size, B_FALSE);
 
-	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+	for (offset = 0, c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
 		raidz_col_t *col = &rm->rm_col[c];
+		abd_t *tmp = abd_get_offset_size(rm->rm_abd_copy, offset,
+		    col->rc_size);
 
-		bcopy(col->rc_data, buf, col->rc_size);
-		col->rc_data = buf;
+		abd_copy(tmp, col->rc_abd, col->rc_size);
+		abd_put(col->rc_abd);
+		col->rc_abd = tmp;
 
-		buf += col->rc_size;
+		offset += col->rc_size;
 	}
-	ASSERT3P(buf - (caddr_t)rm->rm_datacopy, ==, size);
+	ASSERT3U(offset, ==, size);
 }
 
 static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
@@ -451,6 +445,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	/* The starting byte offset on each child vdev. */
 	uint64_t o = (b / dcols) << unit_shift;
 	uint64_t q, r, c, bc, col, acols, scols, coff, devidx, asize, tot;
+	uint64_t off = 0;
 
 	/*
 	 * "Quotient": The number of data sectors for this stripe on all but
@@ -495,7 +490,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	rm->rm_missingdata = 0;
 	rm->rm_missingparity = 0;
 	rm->rm_firstdatacol = nparity;
-	rm->rm_datacopy = NULL;
+	rm->rm_abd_copy = NULL;
 	rm->rm_reports = 0;
 	rm->rm_freed = 0;
 	rm->rm_ecksuminjected = 0;
@@ -511,7 +506,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 		}
 		rm->rm_col[c].rc_devidx = col;
 		rm->rm_col[c].rc_offset = coff;
-		rm->rm_col[c].rc_data = NULL;
+		rm->rm_col[c].rc_abd = NULL;
 		rm->rm_col[c].rc_gdata = NULL;
 		rm->rm_col[c].rc_error = 0;
 		rm->rm_col[c].rc_tried = 0;
@@ -534,13 +529,18 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	ASSERT3U(rm->rm_nskip, <=, nparity);
 
 	for (c = 0; c < rm->rm_firstdatacol; c++)
-		rm->rm_col[c].rc_data = zio_buf_alloc(rm->rm_col[c].rc_size);
+		rm->rm_col[c].rc_abd =
+		    abd_alloc_linear(rm->rm_col[c].rc_size, B_TRUE);
 
-	rm->rm_col[c].rc_data = zio->io_data;
+	rm->rm_col[c].rc_abd = abd_get_offset_size(zio->io_abd, 0,
+	    rm->rm_col[c].rc_size);
+	off = rm->rm_col[c].rc_size;
 
-	for (c = c + 1; c < acols; c++)
-		rm->rm_col[c].rc_data = (char *)rm->rm_col[c - 1].rc_data +
-		    rm->rm_col[c - 1].rc_size;
+	for (c = c + 1; c < acols; c++) {
+		rm->rm_col[c].rc_abd = abd_get_offset_size(zio->io_abd, off,
+		    rm->rm_col[c].rc_size);
+		off += rm->rm_col[c].rc_size;
+	}
 
 	/*
 	 * If all data stored spans all columns, there's a danger that parity
@@ -582,29 +582,78 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	return (rm);
 }
 
+/*
+ * The parity columns are always linear, so the generation and reconstruction
+ * code below walks each data column's ABD a chunk at a time and keeps a
+ * running pointer into the parity buffers.
+ */
+typedef struct raidz_gen_arg {
+	uint8_t *rga_p;
+	uint8_t *rga_q;
+	uint8_t *rga_r;
+} raidz_gen_arg_t;
+
+static int
+vdev_raidz_p_func(void *buf, size_t size, void *private)
+{
+	raidz_gen_arg_t *rga = private;
+
+	vdev_raidz_math_p_add(rga->rga_p, buf, size);
+	rga->rga_p += size;
+
+	return (0);
+}
+
+static int
+vdev_raidz_pq_func(void *buf, size_t size, void *private)
+{
+	raidz_gen_arg_t *rga = private;
+
+	vdev_raidz_math_pq_add(rga->rga_p, rga->rga_q, buf, size, size);
+	rga->rga_p += size;
+	rga->rga_q += size;
+
+	return (0);
+}
+
+static int
+vdev_raidz_pqr_func(void *buf, size_t size, void *private)
+{
+	raidz_gen_arg_t *rga = private;
+
+	vdev_raidz_math_pqr_add(rga->rga_p, rga->rga_q, rga->rga_r, buf,
+	    size, size);
+	rga->rga_p += size;
+	rga->rga_q += size;
+	rga->rga_r += size;
+
+	return (0);
+}
+
 static void
 vdev_raidz_generate_parity_p(raidz_map_t *rm)
 {
-	uint64_t *p, *src, pcount, ccount, i;
+	uint64_t psize, csize;
+	raidz_gen_arg_t rga;
+	uint8_t *p;
+	abd_t *src;
 	int c;
 
-	pcount = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
+	psize = rm->rm_col[VDEV_RAIDZ_P].rc_size;
+	p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		p = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-		ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
+		src = rm->rm_col[c].rc_abd;
+		csize = rm->rm_col[c].rc_size;
 
 		if (c == rm->rm_firstdatacol) {
-			ASSERT(ccount == pcount);
-			for (i = 0; i < ccount; i++, src++, p++) {
-				*p = *src;
-			}
+			ASSERT(csize == psize);
+			abd_copy_to_buf(p, src, csize);
 		} else {
-			ASSERT(ccount <= pcount);
-			for (i = 0; i < ccount; i++, src++, p++) {
-				*p ^= *src;
-			}
+			ASSERT(csize <= psize);
+			rga.rga_p = p;
+			(void) abd_iterate_func(src, 0, csize,
+			    vdev_raidz_p_func, &rga);
 		}
 	}
 }
@@ -612,51 +661,44 @@ vdev_raidz_generate_parity_p(raidz_map_t *rm)
 static void
 vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 {
-	uint64_t *p, *q, *src, pcnt, ccnt, mask, i;
+	uint64_t psize, csize;
+	raidz_gen_arg_t rga;
+	uint8_t *p, *q;
+	abd_t *src;
 	int c;
 
-	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
+	psize = rm->rm_col[VDEV_RAIDZ_P].rc_size;
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 
-	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		p = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-		q = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
+	p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	q = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 
-		ccnt = rm->rm_col[c].rc_size / sizeof (src[0]);
+	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+		src = rm->rm_col[c].rc_abd;
+		csize = rm->rm_col[c].rc_size;
 
 		if (c == rm->rm_firstdatacol) {
-			ASSERT(ccnt == pcnt || ccnt == 0);
-			for (i = 0; i < ccnt; i++, src++, p++, q++) {
-				*p = *src;
-				*q = *src;
-			}
-			for (; i < pcnt; i++, src++, p++, q++) {
-				*p = 0;
-				*q = 0;
-			}
+			ASSERT(csize == psize || csize == 0);
+			abd_copy_to_buf(p, src, csize);
+			bcopy(p, q, csize);
+			bzero(p + csize, psize - csize);
+			bzero(q + csize, psize - csize);
 		} else {
-			ASSERT(ccnt <= pcnt);
+			ASSERT(csize <= psize);
 
 			/*
 			 * Apply the algorithm described above by multiplying
 			 * the previous result and adding in the new value.
+			 * Short columns are treated as though they are full
+			 * of 0s.
 			 */
-			for (i = 0; i < ccnt; i++, src++, p++, q++) {
-				*p ^= *src;
-
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-				*q ^= *src;
-			}
-
-			/*
-			 * Treat short columns as though they are full of 0s.
-			 * Note that there's therefore nothing needed for P.
-			 */
-			for (; i < pcnt; i++, q++) {
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-			}
+			rga.rga_p = p;
+			rga.rga_q = q;
+			(void) abd_iterate_func(src, 0, csize,
+			    vdev_raidz_pq_func, &rga);
+			vdev_raidz_math_pq_add(p + csize, q + csize, NULL, 0,
+			    psize - csize);
 		}
 	}
 }
@@ -664,60 +706,50 @@ vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 static void
 vdev_raidz_generate_parity_pqr(raidz_map_t *rm)
 {
-	uint64_t *p, *q, *r, *src, pcnt, ccnt, mask, i;
+	uint64_t psize, csize;
+	raidz_gen_arg_t rga;
+	uint8_t *p, *q, *r;
+	abd_t *src;
 	int c;
 
-	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
+	psize = rm->rm_col[VDEV_RAIDZ_P].rc_size;
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_R].rc_size);
 
-	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		p = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-		q = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
-		r = rm->rm_col[VDEV_RAIDZ_R].rc_data;
+	p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	q = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
+	r = abd_to_buf(rm->rm_col[VDEV_RAIDZ_R].rc_abd);
 
-		ccnt = rm->rm_col[c].rc_size / sizeof (src[0]);
+	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+		src = rm->rm_col[c].rc_abd;
+		csize = rm->rm_col[c].rc_size;
 
 		if (c == rm->rm_firstdatacol) {
-			ASSERT(ccnt == pcnt || ccnt == 0);
-			for (i = 0; i < ccnt; i++, src++, p++, q++, r++) {
-				*p = *src;
-				*q = *src;
-				*r = *src;
-			}
-			for (; i < pcnt; i++, src++, p++, q++, r++) {
-				*p = 0;
-				*q = 0;
-				*r = 0;
-			}
+			ASSERT(csize == psize || csize == 0);
+			abd_copy_to_buf(p, src, csize);
+			bcopy(p, q, csize);
+			bcopy(p, r, csize);
+			bzero(p + csize, psize - csize);
+			bzero(q + csize, psize - csize);
+			bzero(r + csize, psize - csize);
 		} else {
-			ASSERT(ccnt <= pcnt);
+			ASSERT(csize <= psize);
 
 			/*
 			 * Apply the algorithm described above by multiplying
 			 * the previous result and adding in the new value.
+			 * Short columns are treated as though they are full
+			 * of 0s.
 			 */
-			for (i = 0; i < ccnt; i++, src++, p++, q++, r++) {
-				*p ^= *src;
-
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-				*q ^= *src;
-
-				VDEV_RAIDZ_64MUL_4(*r, mask);
-				*r ^= *src;
-			}
-
-			/*
-			 * Treat short columns as though they are full of 0s.
-			 * Note that there's therefore nothing needed for P.
-			 */
-			for (; i < pcnt; i++, q++, r++) {
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-				VDEV_RAIDZ_64MUL_4(*r, mask);
-			}
+			rga.rga_p = p;
+			rga.rga_q = q;
+			rga.rga_r = r;
+			(void) abd_iterate_func(src, 0, csize,
+			    vdev_raidz_pqr_func, &rga);
+			vdev_raidz_math_pqr_add(p + csize, q + csize,
+			    r + csize, NULL, 0, psize - csize);
 		}
 	}
 }
@@ -744,10 +776,52 @@ vdev_raidz_generate_parity(raidz_map_t *rm)
 	}
 }
 
+static int
+vdev_raidz_reconst_p_func(void *dbuf, void *sbuf, size_t size, void *private)
+{
+	vdev_raidz_math_p_add(dbuf, sbuf, size);
+
+	return (0);
+}
+
+static int
+vdev_raidz_reconst_q_func(void *dbuf, void *sbuf, size_t size, void *private)
+{
+	vdev_raidz_math_q_add(dbuf, sbuf, size, size);
+
+	return (0);
+}
+
+static int
+vdev_raidz_reconst_q_tail_func(void *buf, size_t size, void *private)
+{
+	vdev_raidz_math_q_add(buf, NULL, 0, size);
+
+	return (0);
+}
+
+static int
+vdev_raidz_reconst_mul_func(void *buf, size_t size, void *private)
+{
+	vdev_raidz_math_mul(buf, *(uint8_t *)private, size);
+
+	return (0);
+}
+
+static int
+vdev_raidz_reconst_mul_add_func(void *dbuf, void *sbuf, size_t size,
+    void *private)
+{
+	vdev_raidz_math_mul_add(dbuf, sbuf, *(uint8_t *)private, size);
+
+	return (0);
+}
+
 static int
 vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 {
-	uint64_t *dst, *src, xcount, ccount, count, i;
+	uint64_t xsize, csize;
+	abd_t *dst;
 	int x = tgts[0];
 	int c;
 
@@ -755,29 +829,20 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 	ASSERT(x >= rm->rm_firstdatacol);
 	ASSERT(x < rm->rm_cols);
 
-	xcount = rm->rm_col[x].rc_size / sizeof (src[0]);
-	ASSERT(xcount <= rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]));
-	ASSERT(xcount > 0);
+	xsize = rm->rm_col[x].rc_size;
+	ASSERT(xsize <= rm->rm_col[VDEV_RAIDZ_P].rc_size);
+	ASSERT(xsize > 0);
 
-	src = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-	dst = rm->rm_col[x].rc_data;
-	for (i = 0; i < xcount; i++, dst++, src++) {
-		*dst = *src;
-	}
+	dst = rm->rm_col[x].rc_abd;
+	abd_copy(dst, rm->rm_col[VDEV_RAIDZ_P].rc_abd, xsize);
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		dst = rm->rm_col[x].rc_data;
-
 		if (c == x)
 			continue;
 
-		ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
-		count = MIN(ccount, xcount);
-
-		for (i = 0; i < count; i++, dst++, src++) {
-			*dst ^= *src;
-		}
+		csize = MIN(rm->rm_col[c].rc_size, xsize);
+		(void) abd_iterate_func2(dst, rm->rm_col[c].rc_abd, 0, 0,
+		    csize, vdev_raidz_reconst_p_func, NULL);
 	}
 
 	return (1 << VDEV_RAIDZ_P);
@@ -786,57 +851,45 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 static int
 vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 {
-	uint64_t *dst, *src, xcount, ccount, count, mask, i;
-	uint8_t *b;
+	uint64_t xsize, csize;
+	abd_t *dst, *src;
 	int x = tgts[0];
-	int c, j, exp;
+	int c, exp;
+	uint8_t coeff;
 
 	ASSERT(ntgts == 1);
 
-	xcount = rm->rm_col[x].rc_size / sizeof (src[0]);
-	ASSERT(xcount <= rm->rm_col[VDEV_RAIDZ_Q].rc_size / sizeof (src[0]));
+	xsize = rm->rm_col[x].rc_size;
+	ASSERT(xsize <= rm->rm_col[VDEV_RAIDZ_Q].rc_size);
+
+	dst = rm->rm_col[x].rc_abd;
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		dst = rm->rm_col[x].rc_data;
+		src = rm->rm_col[c].rc_abd;
 
 		if (c == x)
-			ccount = 0;
+			csize = 0;
 		else
-			ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
-
-		count = MIN(ccount, xcount);
+			csize = MIN(rm->rm_col[c].rc_size, xsize);
 
 		if (c == rm->rm_firstdatacol) {
-			for (i = 0; i < count; i++, dst++, src++) {
-				*dst = *src;
-			}
-			for (; i < xcount; i++, dst++) {
-				*dst = 0;
-			}
-
+			abd_copy(dst, src, csize);
+			abd_zero_off(dst, csize, xsize - csize);
 		} else {
-			for (i = 0; i < count; i++, dst++, src++) {
-				VDEV_RAIDZ_64MUL_2(*dst, mask);
-				*dst ^= *src;
-			}
-
-			for (; i < xcount; i++, dst++) {
-				VDEV_RAIDZ_64MUL_2(*dst, mask);
-			}
+			(void) abd_iterate_func2(dst, src, 0, 0, csize,
+			    vdev_raidz_reconst_q_func, NULL);
+			(void) abd_iterate_func(dst, csize, xsize - csize,
+			    vdev_raidz_reconst_q_tail_func, NULL);
 		}
 	}
 
-	src = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
-	dst = rm->rm_col[x].rc_data;
 	exp = 255 - (rm->rm_cols - 1 - x);
+	coeff = vdev_raidz_pow2[exp];
 
-	for (i = 0; i < xcount; i++, dst++, src++) {
-		*dst ^= *src;
-		for (j = 0, b = (uint8_t *)dst; j < 8; j++, b++) {
-			*b = vdev_raidz_exp2(*b, exp);
-		}
-	}
+	(void) abd_iterate_func2(dst, rm->rm_col[VDEV_RAIDZ_Q].rc_abd, 0, 0,
+	    xsize, vdev_raidz_reconst_p_func, NULL);
+	(void) abd_iterate_func(dst, 0, xsize, vdev_raidz_reconst_mul_func,
+	    &coeff);
 
 	return (1 << VDEV_RAIDZ_Q);
 }
@@ -844,9 +897,9 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 static int
 vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 {
-	uint8_t *p, *q, *pxy, *qxy, *xd, *yd, tmp, a, b, aexp, bexp;
-	void *pdata, *qdata;
-	uint64_t xsize, ysize, i;
+	uint8_t *p, *q, *pxy, *qxy, tmp, a, b, aexp, bexp, coeff;
+	abd_t *pdata, *qdata, *xd, *yd;
+	uint64_t xsize, ysize;
 	int x = tgts[0];
 	int y = tgts[1];
 
@@ -864,15 +917,15 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	 * parity so we make those columns appear to be full of zeros by
 	 * setting their lengths to zero.
 	 */
-	pdata = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-	qdata = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
+	pdata = rm->rm_col[VDEV_RAIDZ_P].rc_abd;
+	qdata = rm->rm_col[VDEV_RAIDZ_Q].rc_abd;
 	xsize = rm->rm_col[x].rc_size;
 	ysize = rm->rm_col[y].rc_size;
 
-	rm->rm_col[VDEV_RAIDZ_P].rc_data =
-	    zio_buf_alloc(rm->rm_col[VDEV_RAIDZ_P].rc_size);
-	rm->rm_col[VDEV_RAIDZ_Q].rc_data =
-	    zio_buf_alloc(rm->rm_col[VDEV_RAIDZ_Q].rc_size);
+	rm->rm_col[VDEV_RAIDZ_P].rc_abd =
+	    abd_alloc_linear(rm->rm_col[VDEV_RAIDZ_P].rc_size, B_TRUE);
+	rm->rm_col[VDEV_RAIDZ_Q].rc_abd =
+	    abd_alloc_linear(rm->rm_col[VDEV_RAIDZ_Q].rc_size, B_TRUE);
 	rm->rm_col[x].rc_size = 0;
 	rm->rm_col[y].rc_size = 0;
 
@@ -881,12 +934,12 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	rm->rm_col[x].rc_size = xsize;
 	rm->rm_col[y].rc_size = ysize;
 
-	p = pdata;
-	q = qdata;
-	pxy = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-	qxy = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
-	xd = rm->rm_col[x].rc_data;
-	yd = rm->rm_col[y].rc_data;
+	p = abd_to_buf(pdata);
+	q = abd_to_buf(qdata);
+	pxy = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	qxy = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
+	xd = rm->rm_col[x].rc_abd;
+	yd = rm->rm_col[y].rc_abd;
 
 	/*
 	 * We now have:
@@ -910,24 +963,29 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	aexp = vdev_raidz_log2[vdev_raidz_exp2(a, tmp)];
 	bexp = vdev_raidz_log2[vdev_raidz_exp2(b, tmp)];
 
-	for (i = 0; i < xsize; i++, p++, q++, pxy++, qxy++, xd++, yd++) {
-		*xd = vdev_raidz_exp2(*p ^ *pxy, aexp) ^
-		    vdev_raidz_exp2(*q ^ *qxy, bexp);
+	vdev_raidz_math_p_add(pxy, p, xsize);
+	vdev_raidz_math_p_add(qxy, q, xsize);
 
-		if (i < ysize)
-			*yd = *p ^ *pxy ^ *xd;
-	}
+	abd_zero(xd, xsize);
+	coeff = vdev_raidz_pow2[aexp];
+	(void) abd_iterate_func2(xd, rm->rm_col[VDEV_RAIDZ_P].rc_abd, 0, 0,
+	    xsize, vdev_raidz_reconst_mul_add_func, &coeff);
+	coeff = vdev_raidz_pow2[bexp];
+	(void) abd_iterate_func2(xd, rm->rm_col[VDEV_RAIDZ_Q].rc_abd, 0, 0,
+	    xsize, vdev_raidz_reconst_mul_add_func, &coeff);
 
-	zio_buf_free(rm->rm_col[VDEV_RAIDZ_P].rc_data,
-	    rm->rm_col[VDEV_RAIDZ_P].rc_size);
-	zio_buf_free(rm->rm_col[VDEV_RAIDZ_Q].rc_data,
-	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
+	abd_copy_from_buf(yd, pxy, ysize);
+	(void) abd_iterate_func2(yd, xd, 0, 0, ysize,
+	    vdev_raidz_reconst_p_func, NULL);
+
+	abd_free(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	abd_free(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 
 	/*
 	 * Restore the saved parity data.
 	 */
-	rm->rm_col[VDEV_RAIDZ_P].rc_data = pdata;
-	rm->rm_col[VDEV_RAIDZ_Q].rc_data = qdata;
+	rm->rm_col[VDEV_RAIDZ_P].rc_abd = pdata;
+	rm->rm_col[VDEV_RAIDZ_Q].rc_abd = qdata;
 
 	return ((1 << VDEV_RAIDZ_P) | (1 << VDEV_RAIDZ_Q));
 }
@@ -1214,76 +1272,44 @@ static void
 vdev_raidz_matrix_reconstruct(raidz_map_t *rm, int n, int nmissing,
     int *missing, uint8_t **invrows, const uint8_t *used)
 {
-	int i, j, x, cc, c;
-	uint8_t *src;
-	uint64_t ccount;
-	uint8_t *dst[VDEV_RAIDZ_MAXPARITY];
-	uint64_t dcount[VDEV_RAIDZ_MAXPARITY];
-	uint8_t log = 0;
-	uint8_t val;
-	int ll;
-	uint8_t *invlog[VDEV_RAIDZ_MAXPARITY];
-	uint8_t *p, *pp;
-	size_t psize;
-
-	psize = sizeof (invlog[0][0]) * n * nmissing;
-	p = kmem_alloc(psize, KM_SLEEP);
-
-	for (pp = p, i = 0; i < nmissing; i++) {
-		invlog[i] = pp;
-		pp += n;
-	}
-
-	for (i = 0; i < nmissing; i++) {
-		for (j = 0; j < n; j++) {
-			ASSERT3U(invrows[i][j], !=, 0);
-			invlog[i][j] = vdev_raidz_log2[invrows[i][j]];
-		}
+	int i, j, cc, c;
+	abd_t *src;
+	uint64_t csize;
+	abd_t *dst[VDEV_RAIDZ_MAXPARITY];
+	uint64_t dsize[VDEV_RAIDZ_MAXPARITY];
+	uint8_t coeff;
+
+	for (j = 0; j < nmissing; j++) {
+		cc = missing[j] + rm->rm_firstdatacol;
+		ASSERT3U(cc, >=, rm->rm_firstdatacol);
+		ASSERT3U(cc, <, rm->rm_cols);
+
+		dst[j] = rm->rm_col[cc].rc_abd;
+		dsize[j] = rm->rm_col[cc].rc_size;
+		abd_zero(dst[j], dsize[j]);
 	}
 
+	/*
+	 * Each missing column is the sum of the surviving columns, each
+	 * multiplied by the matching coefficient of its inverse row.
+	 */
 	for (i = 0; i < n; i++) {
 		c = used[i];
 		ASSERT3U(c, <, rm->rm_cols);
 
-		src = rm->rm_col[c].rc_data;
-		ccount = rm->rm_col[c].rc_size;
-		for (j = 0; j < nmissing; j++) {
-			cc = missing[j] + rm->rm_firstdatacol;
-			ASSERT3U(cc, >=, rm->rm_firstdatacol);
-			ASSERT3U(cc, <, rm->rm_cols);
-			ASSERT3U(cc, !=, c);
-
-			dst[j] = rm->rm_col[cc].rc_data;
-			dcount[j] = rm->rm_col[cc].rc_size;
-		}
+		src = rm->rm_col[c].rc_abd;
+		csize = rm->rm_col[c].rc_size;
 
-		ASSERT(ccount >= rm->rm_col[missing[0]].rc_size || i > 0);
-
-		for (x = 0; x < ccount; x++, src++) {
-			if (*src != 0)
-				log = vdev_raidz_log2[*src];
-
-			for (cc = 0; cc < nmissing; cc++) {
-				if (x >= dcount[cc])
-					continue;
-
-				if (*src == 0) {
-					val = 0;
-				} else {
-					if ((ll = log + invlog[cc][i]) >= 255)
-						ll -= 255;
-					val = vdev_raidz_pow2[ll];
-				}
+		for (j = 0; j < nmissing; j++) {
+			ASSERT3U(missing[j] + rm->rm_firstdatacol, !=, c);
+			ASSERT3U(invrows[j][i], !=, 0);
 
-				if (i == 0)
-					dst[cc][x] = val;
-				else
-					dst[cc][x] ^= val;
-			}
+			coeff = invrows[j][i];
+			(void) abd_iterate_func2(dst[j], src, 0, 0,
+			    MIN(csize, dsize[j]),
+			    vdev_raidz_reconst_mul_add_func, &coeff);
 		}
 	}
-
-	kmem_free(p, psize);
 }
 
 static int
@@ -1589,7 +1615,7 @@ vdev_raidz_io_start(zio_t *zio)
 			rc = &rm->rm_col[c];
 			cvd = vd->vdev_child[rc->rc_devidx];
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
 			    vdev_raidz_child_done, rc));
 		}
@@ -1646,7 +1672,7 @@ vdev_raidz_io_start(zio_t *zio)
 		if (c >= rm->rm_firstdatacol || rm->rm_missingdata > 0 ||
 		    (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))) {
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
 			    vdev_raidz_child_done, rc));
 		}
@@ -1667,6 +1693,7 @@ raidz_checksum_error(zio_t *zio, raidz_col_t *rc, void *bad_data)
 	if (!(zio->io_flags & ZIO_FLAG_SPECULATIVE)) {
 		zio_bad_cksum_t zbc;
 		raidz_map_t *rm = zio->io_vsd;
+		void *buf;
 
 		mutex_enter(&vd->vdev_stat_lock);
 		vd->vdev_stat.vs_checksum_errors++;
@@ -1675,9 +1702,11 @@ raidz_checksum_error(zio_t *zio, raidz_col_t *rc, void *bad_data)
 		zbc.zbc_has_cksum = 0;
 		zbc.zbc_injected = rm->rm_ecksuminjected;
 
+		buf = abd_borrow_buf_copy(rc->rc_abd, rc->rc_size);
 		zfs_ereport_post_checksum(zio->io_spa, vd, zio,
-		    rc->rc_offset, rc->rc_size, rc->rc_data, bad_data,
+		    rc->rc_offset, rc->rc_size, buf, bad_data,
 		    &zbc);
+		abd_return_buf(rc->rc_abd, buf, rc->rc_size);
 	}
 }
 
@@ -1726,7 +1755,7 @@ raidz_parity_verify(zio_t *zio, raidz_map_t *rm)
 		if (!rc->rc_tried || rc->rc_error != 0)
 			continue;
 		orig[c] = zio_buf_alloc(rc->rc_size);
-		bcopy(rc->rc_data, orig[c], rc->rc_size);
+		abd_copy_to_buf(orig[c], rc->rc_abd, rc->rc_size);
 	}
 
 	vdev_raidz_generate_parity(rm);
@@ -1735,7 +1764,7 @@ raidz_parity_verify(zio_t *zio, raidz_map_t *rm)
 		rc = &rm->rm_col[c];
 		if (!rc->rc_tried || rc->rc_error != 0)
 			continue;
-		if (bcmp(orig[c], rc->rc_data, rc->rc_size) != 0) {
+		if (abd_cmp_buf(rc->rc_abd, orig[c], rc->rc_size) != 0) {
 			raidz_checksum_error(zio, rc, orig[c]);
 			rc->rc_error = SET_ERROR(ECKSUM);
 			ret++;
@@ -1762,6 +1791,125 @@ vdev_raidz_worst_error(raidz_map_t *rm)
 	return (error);
 }
 
+/*
+ * The silent error count of a RAID-Z child decays by half each
+ * RAIDZ_SILENT_HALFLIFE, so it reflects the recent error rate.
+ */
+#define	RAIDZ_SILENT_HALFLIFE	SEC2NSEC(600)
+
+int zfs_raidz_combrec_hint = B_TRUE;
+
+static uint64_t
+vdev_raidz_silent_decay(vdev_t *cvd, hrtime_t now)
+{
+	uint64_t halflives;
+
+	ASSERT(MUTEX_HELD(&cvd->vdev_stat_lock));
+
+	halflives = (now - cvd->vdev_silent_time) / RAIDZ_SILENT_HALFLIFE;
+	return (halflives >= 64 ? 0 : cvd->vdev_silent_recent >> halflives);
+}
+
+/*
+ * The decayed silent error count of a RAID-Z child, as of now.
+ */
+uint64_t
+vdev_raidz_silent_recent(vdev_t *cvd)
+{
+	uint64_t recent;
+
+	mutex_enter(&cvd->vdev_stat_lock);
+	recent = vdev_raidz_silent_decay(cvd, gethrtime());
+	mutex_exit(&cvd->vdev_stat_lock);
+
+	return (recent);
+}
+
+/*
+ * Column c of a RAID-Z read was found to hold bad data although its child
+ * returned no error.  Make its child the one the next reconstruction of
+ * this vdev tries first, and account the error to it.
+ */
+static void
+vdev_raidz_silent_error(zio_t *zio, int c)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	vdev_t *vd = zio->io_vd;
+	uint64_t devidx = rm->rm_col[c].rc_devidx;
+	vdev_t *cvd = vd->vdev_child[devidx];
+	hrtime_t now = gethrtime();
+
+	vd->vdev_raidz_suspect = devidx + 1;
+
+	mutex_enter(&cvd->vdev_stat_lock);
+	cvd->vdev_silent_recent = vdev_raidz_silent_decay(cvd, now) + 1;
+	cvd->vdev_silent_time = now;
+	cvd->vdev_silent_errors++;
+	mutex_exit(&cvd->vdev_stat_lock);
+}
+
+/*
+ * Before trying every combination of columns, try the one most likely to
+ * be the answer on a vdev with a flaky child: that the child which last
+ * returned bad data did so again.  Returns the reconstruction code on
+ * success, as vdev_raidz_combrec() does, and 0 if the guess was wrong or
+ * there was none to make.
+ */
+static int
+vdev_raidz_combrec_hint(zio_t *zio, int data_errors)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	vdev_t *vd = zio->io_vd;
+	int suspect = vd->vdev_raidz_suspect;
+	raidz_col_t *rc;
+	vdev_t *cvd;
+	void *orig;
+	int c, code;
+
+	if (!zfs_raidz_combrec_hint || suspect == 0)
+		return (0);
+
+	for (c = 0; c < rm->rm_cols; c++) {
+		if (rm->rm_col[c].rc_devidx == suspect - 1)
+			break;
+	}
+
+	/*
+	 * The suspect holds no column of this block, or failed outright.
+	 * A bad parity column alone can't fail the checksum, so one only
+	 * needs trying when data columns are being reconstructed anyway.
+	 */
+	if (c == rm->rm_cols || rm->rm_col[c].rc_error != 0 ||
+	    (c < rm->rm_firstdatacol && data_errors == 0))
+		return (0);
+
+	rc = &rm->rm_col[c];
+	cvd = vd->vdev_child[rc->rc_devidx];
+	orig = zio_buf_alloc(rc->rc_size);
+	abd_copy_to_buf(orig, rc->rc_abd, rc->rc_size);
+
+	code = vdev_raidz_reconstruct(rm, &c, 1);
+	if (raidz_checksum_verify(zio) == 0) {
+		atomic_inc_64(&raidz_corrected[code]);
+		if (rc->rc_tried)
+			raidz_checksum_error(zio, rc, orig);
+		rc->rc_error = SET_ERROR(ECKSUM);
+		vdev_raidz_silent_error(zio, c);
+		mutex_enter(&cvd->vdev_stat_lock);
+		cvd->vdev_hint_hits++;
+		mutex_exit(&cvd->vdev_stat_lock);
+	} else {
+		abd_copy_from_buf(rc->rc_abd, orig, rc->rc_size);
+		mutex_enter(&cvd->vdev_stat_lock);
+		cvd->vdev_hint_misses++;
+		mutex_exit(&cvd->vdev_stat_lock);
+		code = 0;
+	}
+
+	zio_buf_free(orig, rc->rc_size);
+	return (code);
+}
+
 /*
  * Iterate over all combinations of bad data and attempt a reconstruction.
  * Note that the algorithm below is non-optimal because it doesn't take into
@@ -1843,7 +1991,8 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 				ASSERT3S(c, >=, 0);
 				ASSERT3S(c, <, rm->rm_cols);
 				rc = &rm->rm_col[c];
-				bcopy(rc->rc_data, orig[i], rc->rc_size);
+				abd_copy_to_buf(orig[i], rc->rc_abd,
+				    rc->rc_size);
 			}
 
 			/*
@@ -1862,6 +2011,7 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 						raidz_checksum_error(zio, rc,
 						    orig[i]);
 					rc->rc_error = SET_ERROR(ECKSUM);
+					vdev_raidz_silent_error(zio, c);
 				}
 
 				ret = code;
@@ -1874,7 +2024,8 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 			for (i = 0; i < n; i++) {
 				c = tgts[i];
 				rc = &rm->rm_col[c];
-				bcopy(orig[i], rc->rc_data, rc->rc_size);
+				abd_copy_from_buf(rc->rc_abd, orig[i],
+				    rc->rc_size);
 			}
 
 			do {
@@ -2115,7 +2266,7 @@ vdev_raidz_io_done(zio_t *zio)
 				continue;
 			zio_nowait(zio_vdev_child_io(zio, NULL,
 			    vd->vdev_child[rc->rc_devidx],
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
 			    vdev_raidz_child_done, rc));
 		} while (++c < rm->rm_cols);
@@ -2137,7 +2288,8 @@ vdev_raidz_io_done(zio_t *zio)
 		zio->io_error = vdev_raidz_worst_error(rm);
 
 	} else if (total_errors < rm->rm_firstdatacol &&
-	    (code = vdev_raidz_combrec(zio, total_errors, data_errors)) != 0) {
+	    ((code = vdev_raidz_combrec_hint(zio, data_errors)) != 0 ||
+	    (code = vdev_raidz_combrec(zio, total_errors, data_errors)) != 0)) {
 		/*
 		 * If we didn't use all the available parity for the
 		 * combinatorial reconstruction, verify that the remaining
@@ -2195,7 +2347,7 @@ done:
 				continue;
 
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE,
 			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
 			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
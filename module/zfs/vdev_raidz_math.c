@@ -0,0 +1,728 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+
+/*
+ * RAID-Z math implementation selection.
+ *
+ * The scalar implementation below is the original word-at-a-time code
+ * from vdev_raidz.c.  Vector implementations are validated against it and
+ * timed when the module loads; the fastest one becomes the default.
+ */
+
+/*
+ * ==========================================================================
+ * Scalar implementation
+ * ==========================================================================
+ */
+
+static void
+raidz_scalar_p_add(void *pp, const void *sp, uint64_t size)
+{
+	uint64_t *p = pp;
+	const uint64_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (uint64_t); i++)
+		p[i] ^= src[i];
+}
+
+static void
+raidz_scalar_q_add(void *qp, const void *sp, uint64_t csize, uint64_t qsize)
+{
+	uint64_t *q = qp;
+	const uint64_t *src = sp;
+	uint64_t i, mask;
+
+	for (i = 0; i < csize / sizeof (uint64_t); i++) {
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		q[i] ^= src[i];
+	}
+
+	/* Short columns are treated as though they are full of 0s */
+	for (; i < qsize / sizeof (uint64_t); i++)
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+}
+
+static void
+raidz_scalar_pq_add(void *pp, void *qp, const void *sp, uint64_t csize,
+    uint64_t psize)
+{
+	uint64_t *p = pp, *q = qp;
+	const uint64_t *src = sp;
+	uint64_t i, mask;
+
+	for (i = 0; i < csize / sizeof (uint64_t); i++) {
+		p[i] ^= src[i];
+
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		q[i] ^= src[i];
+	}
+
+	for (; i < psize / sizeof (uint64_t); i++)
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+}
+
+static void
+raidz_scalar_pqr_add(void *pp, void *qp, void *rp, const void *sp,
+    uint64_t csize, uint64_t psize)
+{
+	uint64_t *p = pp, *q = qp, *r = rp;
+	const uint64_t *src = sp;
+	uint64_t i, mask;
+
+	for (i = 0; i < csize / sizeof (uint64_t); i++) {
+		p[i] ^= src[i];
+
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		q[i] ^= src[i];
+
+		VDEV_RAIDZ_64MUL_4(r[i], mask);
+		r[i] ^= src[i];
+	}
+
+	for (; i < psize / sizeof (uint64_t); i++) {
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		VDEV_RAIDZ_64MUL_4(r[i], mask);
+	}
+}
+
+static void
+raidz_scalar_mul_add(void *dp, const void *sp, const uint8_t *tbl,
+    uint64_t size)
+{
+	uint8_t *dst = dp;
+	const uint8_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < size; i++)
+		dst[i] ^= tbl[src[i] & 0xf] ^ tbl[16 + (src[i] >> 4)];
+}
+
+static void
+raidz_scalar_mul(void *dp, const uint8_t *tbl, uint64_t size)
+{
+	uint8_t *dst = dp;
+	uint64_t i;
+
+	for (i = 0; i < size; i++)
+		dst[i] = tbl[dst[i] & 0xf] ^ tbl[16 + (dst[i] >> 4)];
+}
+
+static boolean_t
+raidz_scalar_is_supported(void)
+{
+	return (B_TRUE);
+}
+
+static const raidz_impl_ops_t vdev_raidz_scalar_impl = {
+	.p_add = raidz_scalar_p_add,
+	.q_add = raidz_scalar_q_add,
+	.pq_add = raidz_scalar_pq_add,
+	.pqr_add = raidz_scalar_pqr_add,
+	.mul_add = raidz_scalar_mul_add,
+	.mul = raidz_scalar_mul,
+	.is_supported = raidz_scalar_is_supported,
+	.blocksize = sizeof (uint64_t),
+	.name = "scalar"
+};
+
+/*
+ * ==========================================================================
+ * Implementation selection
+ * ==========================================================================
+ */
+
+static const raidz_impl_ops_t *const raidz_all_impls[] = {
+	&vdev_raidz_scalar_impl,
+#if defined(HAVE_SIMD_X86)
+	&vdev_raidz_ssse3_impl,
+	&vdev_raidz_avx2_impl,
+#endif
+};
+
+#define	RAIDZ_IMPL_NUM		ARRAY_SIZE(raidz_all_impls)
+
+static const raidz_impl_ops_t *raidz_supp_impls[RAIDZ_IMPL_NUM];
+static uint32_t raidz_supp_impls_cnt = 0;
+static const raidz_impl_ops_t *raidz_fastest_impl = &vdev_raidz_scalar_impl;
+
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+#define	IMPL_INVALID	(UINT32_MAX - 2)
+
+static uint32_t zfs_vdev_raidz_impl = IMPL_FASTEST;
+static boolean_t raidz_math_initialized = B_FALSE;
+
+static struct {
+	const char *ris_name;
+	uint32_t ris_sel;
+} raidz_impl_selectors[] = {
+	{ "fastest",	IMPL_FASTEST },
+	{ "cycle",	IMPL_CYCLE },
+};
+
+static inline const raidz_impl_ops_t *
+vdev_raidz_math_get_ops(void)
+{
+	uint32_t impl = *(volatile uint32_t *)&zfs_vdev_raidz_impl;
+	static volatile uint32_t cycle = 0;
+
+	if (!raidz_math_initialized)
+		return (&vdev_raidz_scalar_impl);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		return (raidz_fastest_impl);
+	case IMPL_CYCLE:
+		return (raidz_supp_impls[atomic_inc_32_nv(&cycle) %
+		    raidz_supp_impls_cnt]);
+	default:
+		ASSERT3U(impl, <, raidz_supp_impls_cnt);
+		return (raidz_supp_impls[impl]);
+	}
+}
+
+/*
+ * Pick the implementation for a call: vector code only ever sees sizes
+ * which are a multiple of its block size.  All RAID-Z columns are whole
+ * sectors so in practice this only matters for the self test.
+ */
+static inline const raidz_impl_ops_t *
+raidz_ops_for(uint64_t a, uint64_t b)
+{
+	const raidz_impl_ops_t *ops = vdev_raidz_math_get_ops();
+
+	if (((a | b) & (ops->blocksize - 1)) != 0)
+		ops = &vdev_raidz_scalar_impl;
+
+	return (ops);
+}
+
+static void
+raidz_mul_tbl_init(uint8_t *tbl, uint8_t c)
+{
+	int i, lc = vdev_raidz_log2[c];
+
+	for (i = 0; i < 16; i++) {
+		uint8_t lo = i, hi = i << 4;
+		int l;
+
+		if (c == 0 || lo == 0) {
+			tbl[i] = 0;
+		} else {
+			l = lc + vdev_raidz_log2[lo];
+			tbl[i] = vdev_raidz_pow2[l >= 255 ? l - 255 : l];
+		}
+
+		if (c == 0 || hi == 0) {
+			tbl[16 + i] = 0;
+		} else {
+			l = lc + vdev_raidz_log2[hi];
+			tbl[16 + i] = vdev_raidz_pow2[l >= 255 ? l - 255 : l];
+		}
+	}
+	tbl[32] = c;
+}
+
+void
+vdev_raidz_math_p_add(void *p, const void *src, uint64_t size)
+{
+	const raidz_impl_ops_t *ops = raidz_ops_for(size, 0);
+
+	kfpu_begin();
+	ops->p_add(p, src, size);
+	kfpu_end();
+}
+
+void
+vdev_raidz_math_q_add(void *q, const void *src, uint64_t csize,
+    uint64_t qsize)
+{
+	const raidz_impl_ops_t *ops = raidz_ops_for(csize, qsize);
+
+	ASSERT3U(csize, <=, qsize);
+
+	kfpu_begin();
+	ops->q_add(q, src, csize, qsize);
+	kfpu_end();
+}
+
+void
+vdev_raidz_math_pq_add(void *p, void *q, const void *src, uint64_t csize,
+    uint64_t psize)
+{
+	const raidz_impl_ops_t *ops = raidz_ops_for(csize, psize);
+
+	ASSERT3U(csize, <=, psize);
+
+	kfpu_begin();
+	ops->pq_add(p, q, src, csize, psize);
+	kfpu_end();
+}
+
+void
+vdev_raidz_math_pqr_add(void *p, void *q, void *r, const void *src,
+    uint64_t csize, uint64_t psize)
+{
+	const raidz_impl_ops_t *ops = raidz_ops_for(csize, psize);
+
+	ASSERT3U(csize, <=, psize);
+
+	kfpu_begin();
+	ops->pqr_add(p, q, r, src, csize, psize);
+	kfpu_end();
+}
+
+void
+vdev_raidz_math_mul_add(void *dst, const void *src, uint8_t c, uint64_t size)
+{
+	const raidz_impl_ops_t *ops;
+	uint8_t tbl[RAIDZ_MUL_TBL_SIZE];
+
+	if (c == 0)
+		return;
+	if (c == 1) {
+		vdev_raidz_math_p_add(dst, src, size);
+		return;
+	}
+
+	raidz_mul_tbl_init(tbl, c);
+	ops = raidz_ops_for(size, 0);
+
+	kfpu_begin();
+	ops->mul_add(dst, src, tbl, size);
+	kfpu_end();
+}
+
+void
+vdev_raidz_math_mul(void *dst, uint8_t c, uint64_t size)
+{
+	const raidz_impl_ops_t *ops;
+	uint8_t tbl[RAIDZ_MUL_TBL_SIZE];
+
+	if (c == 1)
+		return;
+	if (c == 0) {
+		bzero(dst, size);
+		return;
+	}
+
+	raidz_mul_tbl_init(tbl, c);
+	ops = raidz_ops_for(size, 0);
+
+	kfpu_begin();
+	ops->mul(dst, tbl, size);
+	kfpu_end();
+}
+
+int
+vdev_raidz_impl_set(const char *val)
+{
+	char req_name[32];
+	uint32_t impl = IMPL_INVALID;
+	size_t len;
+	int i;
+
+	if (val == NULL)
+		return (SET_ERROR(EINVAL));
+
+	(void) strlcpy(req_name, val, sizeof (req_name));
+	len = strlen(req_name);
+	while (len > 0 && (req_name[len - 1] == '\n' ||
+	    req_name[len - 1] == ' '))
+		req_name[--len] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(raidz_impl_selectors); i++) {
+		if (strcmp(req_name, raidz_impl_selectors[i].ris_name) == 0) {
+			impl = raidz_impl_selectors[i].ris_sel;
+			break;
+		}
+	}
+
+	for (i = 0; impl == IMPL_INVALID && i < raidz_supp_impls_cnt; i++) {
+		if (strcmp(req_name, raidz_supp_impls[i]->name) == 0)
+			impl = i;
+	}
+
+	if (impl == IMPL_INVALID)
+		return (SET_ERROR(EINVAL));
+
+	atomic_swap_32(&zfs_vdev_raidz_impl, impl);
+	return (0);
+}
+
+int
+vdev_raidz_impl_get(char *buf, size_t size)
+{
+	uint32_t impl = zfs_vdev_raidz_impl;
+	size_t off = 0;
+	const char *fmt;
+	int i;
+
+	if (size == 0)
+		return (SET_ERROR(EINVAL));
+	buf[0] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(raidz_impl_selectors); i++) {
+		fmt = (impl == raidz_impl_selectors[i].ris_sel) ?
+		    "[%s] " : "%s ";
+		off += snprintf(buf + off, size - MIN(off, size), fmt,
+		    raidz_impl_selectors[i].ris_name);
+	}
+
+	for (i = 0; i < raidz_supp_impls_cnt; i++) {
+		fmt = (impl == i) ? "[%s] " : "%s ";
+		off += snprintf(buf + off, size - MIN(off, size), fmt,
+		    raidz_supp_impls[i]->name);
+	}
+
+	if (off > 0 && off <= size)
+		buf[off - 1] = '\0';
+
+	return (0);
+}
+
+/*
+ * ==========================================================================
+ * Self test and benchmark
+ * ==========================================================================
+ */
+
+#define	RAIDZ_TEST_COLS		(VDEV_RAIDZ_MAXPARITY + 2)
+#define	RAIDZ_BENCH_SIZE	(32 * 1024)
+#define	RAIDZ_BENCH_NS		(MSEC2NSEC(1))
+
+static void
+raidz_fill(uint8_t *buf, uint64_t size, uint64_t *seed)
+{
+	uint64_t i, x = *seed;
+
+	for (i = 0; i < size; i++) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = x >> 24;
+	}
+	*seed = x;
+}
+
+/*
+ * Run every primitive of 'ops' over copies of the same random columns as
+ * the scalar code and compare.  'csize' is the size of the short source
+ * column, 'psize' the parity column size.
+ */
+static int
+raidz_impl_verify(const raidz_impl_ops_t *ops, uint8_t **ref, uint8_t **tst,
+    uint64_t csize, uint64_t psize, uint8_t c)
+{
+	const raidz_impl_ops_t *sc = &vdev_raidz_scalar_impl;
+	uint8_t tbl[RAIDZ_MUL_TBL_SIZE];
+	int i, err = 0;
+
+	raidz_mul_tbl_init(tbl, c);
+
+#define	RAIDZ_VERIFY_STEP(step, sc_call, ops_call)			\
+	do {								\
+		for (i = 0; i < RAIDZ_TEST_COLS - 1; i++)		\
+			bcopy(ref[i], tst[i], psize);			\
+		sc_call;						\
+		kfpu_begin();						\
+		ops_call;						\
+		kfpu_end();						\
+		for (i = 0; i < RAIDZ_TEST_COLS - 1; i++) {		\
+			if (bcmp(ref[i], tst[i], psize) != 0) {		\
+				cmn_err(CE_WARN, "vdev_raidz: %s %s "	\
+				    "mismatch (csize %llu psize %llu)",	\
+				    ops->name, step,			\
+				    (u_longlong_t)csize,		\
+				    (u_longlong_t)psize);		\
+				err = SET_ERROR(EIO);			\
+				break;					\
+			}						\
+		}							\
+	} while (0)
+
+	RAIDZ_VERIFY_STEP("p_add",
+	    sc->p_add(ref[0], ref[3], csize),
+	    ops->p_add(tst[0], ref[3], csize));
+	RAIDZ_VERIFY_STEP("q_add",
+	    sc->q_add(ref[1], ref[3], csize, psize),
+	    ops->q_add(tst[1], ref[3], csize, psize));
+	RAIDZ_VERIFY_STEP("pq_add",
+	    sc->pq_add(ref[0], ref[1], ref[3], csize, psize),
+	    ops->pq_add(tst[0], tst[1], ref[3], csize, psize));
+	RAIDZ_VERIFY_STEP("pqr_add",
+	    sc->pqr_add(ref[0], ref[1], ref[2], ref[3], csize, psize),
+	    ops->pqr_add(tst[0], tst[1], tst[2], ref[3], csize, psize));
+	RAIDZ_VERIFY_STEP("mul_add",
+	    sc->mul_add(ref[0], ref[3], tbl, psize),
+	    ops->mul_add(tst[0], ref[3], tbl, psize));
+	RAIDZ_VERIFY_STEP("mul",
+	    sc->mul(ref[1], tbl, psize),
+	    ops->mul(tst[1], tbl, psize));
+
+#undef	RAIDZ_VERIFY_STEP
+
+	return (err);
+}
+
+static int
+raidz_impl_verify_all(const raidz_impl_ops_t *ops, uint64_t seed)
+{
+	static const uint64_t sizes[] = { 512, 4096, 128 * 1024 };
+	uint8_t *ref[RAIDZ_TEST_COLS], *tst[RAIDZ_TEST_COLS];
+	uint64_t bufsize = 128 * 1024;
+	int i, s, err = 0;
+
+	for (i = 0; i < RAIDZ_TEST_COLS; i++) {
+		ref[i] = zio_data_buf_alloc(bufsize);
+		tst[i] = zio_data_buf_alloc(bufsize);
+		raidz_fill(ref[i], bufsize, &seed);
+	}
+
+	for (s = 0; err == 0 && s < ARRAY_SIZE(sizes); s++) {
+		uint8_t tmp[1];
+		uint64_t psize = sizes[s];
+
+		raidz_fill(tmp, 1, &seed);
+
+		/* Full and short data columns */
+		err = raidz_impl_verify(ops, ref, tst, psize, psize, tmp[0]);
+		if (err == 0 && psize > 512)
+			err = raidz_impl_verify(ops, ref, tst, psize - 512,
+			    psize, tmp[0] | 2);
+	}
+
+	for (i = 0; i < RAIDZ_TEST_COLS; i++) {
+		zio_data_buf_free(ref[i], bufsize);
+		zio_data_buf_free(tst[i], bufsize);
+	}
+
+	return (err);
+}
+
+/*
+ * Cross check every supported implementation against the scalar code.
+ * Used by ztest; returns EIO if any implementation disagrees.
+ */
+int
+vdev_raidz_math_selftest(uint64_t seed)
+{
+	int i, err = 0;
+
+	if (seed == 0)
+		seed = 0x9e3779b97f4a7c15ULL;
+
+	for (i = 0; i < raidz_supp_impls_cnt; i++) {
+		int e = raidz_impl_verify_all(raidz_supp_impls[i], seed + i);
+
+		if (e != 0)
+			err = e;
+	}
+
+	return (err);
+}
+
+typedef struct raidz_bench_stat {
+	uint64_t gen;		/* pqr_add, bytes per second */
+	uint64_t rec;		/* mul_add, bytes per second */
+} raidz_bench_stat_t;
+
+static raidz_bench_stat_t raidz_bench_data[RAIDZ_IMPL_NUM];
+static kstat_t *raidz_math_kstat;
+
+static int
+raidz_math_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-17s %-15s %-15s\n",
+	    "implementation", "gen_pqr", "mul_add");
+
+	return (0);
+}
+
+static int
+raidz_math_kstat_data(char *buf, size_t size, void *data)
+{
+	raidz_bench_stat_t *rbs = data;
+	int id = rbs - raidz_bench_data;
+
+	(void) snprintf(buf, size, "%-17s %-15llu %-15llu\n",
+	    raidz_supp_impls[id]->name, (u_longlong_t)rbs->gen,
+	    (u_longlong_t)rbs->rec);
+
+	return (0);
+}
+
+static void *
+raidz_math_kstat_addr(kstat_t *ksp, off_t n)
+{
+	if (n < raidz_supp_impls_cnt)
+		ksp->ks_private = (void *)(raidz_bench_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+static uint64_t
+raidz_bench_rate(uint64_t bytes, uint64_t runs, hrtime_t elapsed)
+{
+	return (elapsed == 0 ? 0 : bytes * runs * NANOSEC / elapsed);
+}
+
+/*
+ * Bytes per second of one primitive of the id'th supported implementation
+ * over size bytes, measured for at least ns: parity 1 to 3 generates P,
+ * PQ or PQR from cols[3] into cols[0..2], parity 0 is the mul_add of
+ * reconstruction.  Returns 0 once id is past the last supported
+ * implementation, otherwise sets *name to its name.
+ */
+uint64_t
+vdev_raidz_impl_bench(uint32_t id, int parity, uint8_t **cols,
+    uint64_t size, hrtime_t ns, const char **name)
+{
+	const raidz_impl_ops_t *ops;
+	uint8_t tbl[RAIDZ_MUL_TBL_SIZE];
+	hrtime_t start, elapsed;
+	uint64_t runs = 0;
+
+	if (id >= raidz_supp_impls_cnt)
+		return (0);
+
+	ops = raidz_supp_impls[id];
+	if (name != NULL)
+		*name = ops->name;
+
+	raidz_mul_tbl_init(tbl, 0x8e);
+
+	kfpu_begin();
+	start = gethrtime();
+	do {
+		switch (parity) {
+		case 1:
+			ops->p_add(cols[0], cols[3], size);
+			break;
+		case 2:
+			ops->pq_add(cols[0], cols[1], cols[3], size, size);
+			break;
+		case 3:
+			ops->pqr_add(cols[0], cols[1], cols[2], cols[3],
+			    size, size);
+			break;
+		default:
+			ops->mul_add(cols[0], cols[3], tbl, size);
+			break;
+		}
+		runs++;
+	} while ((elapsed = gethrtime() - start) < ns);
+	kfpu_end();
+
+	return (raidz_bench_rate(size, runs, elapsed));
+}
+
+static void
+raidz_math_benchmark(uint8_t **cols)
+{
+	const uint64_t size = RAIDZ_BENCH_SIZE;
+	uint64_t best = 0;
+	int i;
+
+	for (i = 0; i < raidz_supp_impls_cnt; i++) {
+		const raidz_impl_ops_t *ops = raidz_supp_impls[i];
+
+		raidz_bench_data[i].gen = vdev_raidz_impl_bench(i, 3, cols,
+		    size, RAIDZ_BENCH_NS, NULL);
+		raidz_bench_data[i].rec = vdev_raidz_impl_bench(i, 0, cols,
+		    size, RAIDZ_BENCH_NS, NULL);
+
+		/*
+		 * Parity generation dominates, reconstruction only matters
+		 * when devices are missing; weigh them accordingly.
+		 */
+		if (3 * raidz_bench_data[i].gen + raidz_bench_data[i].rec >
+		    best) {
+			best = 3 * raidz_bench_data[i].gen +
+			    raidz_bench_data[i].rec;
+			raidz_fastest_impl = ops;
+		}
+	}
+}
+
+void
+vdev_raidz_math_init(void)
+{
+	uint8_t *cols[RAIDZ_TEST_COLS];
+	uint64_t seed = 0x2545f4914f6cdd1dULL;
+	int c, i;
+
+	if (raidz_math_initialized)
+		return;
+
+	raidz_supp_impls_cnt = 0;
+	for (c = 0; c < RAIDZ_IMPL_NUM; c++) {
+		const raidz_impl_ops_t *ops = raidz_all_impls[c];
+
+		if (!ops->is_supported())
+			continue;
+
+		if (ops != &vdev_raidz_scalar_impl &&
+		    raidz_impl_verify_all(ops, seed) != 0)
+			continue;
+
+		raidz_supp_impls[raidz_supp_impls_cnt++] = ops;
+	}
+
+	for (i = 0; i < RAIDZ_TEST_COLS; i++) {
+		cols[i] = zio_data_buf_alloc(RAIDZ_BENCH_SIZE);
+		raidz_fill(cols[i], RAIDZ_BENCH_SIZE, &seed);
+	}
+
+	raidz_math_benchmark(cols);
+
+	for (i = 0; i < RAIDZ_TEST_COLS; i++)
+		zio_data_buf_free(cols[i], RAIDZ_BENCH_SIZE);
+
+	raidz_math_kstat = kstat_create("zfs", 0, "vdev_raidz_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (raidz_math_kstat != NULL) {
+		raidz_math_kstat->ks_data = NULL;
+		raidz_math_kstat->ks_ndata = raidz_supp_impls_cnt;
+		kstat_set_raw_ops(raidz_math_kstat, raidz_math_kstat_headers,
+		    raidz_math_kstat_data, raidz_math_kstat_addr);
+		kstat_install(raidz_math_kstat);
+	}
+
+	raidz_math_initialized = B_TRUE;
+}
+
+void
+vdev_raidz_math_fini(void)
+{
+	if (raidz_math_kstat != NULL) {
+		kstat_delete(raidz_math_kstat);
+		raidz_math_kstat = NULL;
+	}
+}
@@ -0,0 +1,273 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 RAID-Z math.
+ *
+ * The same algorithm as the SSSE3 code on 32-byte %ymm registers.  The
+ * nibble tables are broadcast to both 128-bit halves since vpshufb only
+ * shuffles within a lane.
+ */
+
+#include <sys/types.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(HAVE_SIMD_X86)
+
+typedef struct raidz_v32 {
+	uint8_t b[32];
+} raidz_v32_t;
+
+typedef struct raidz_v16 {
+	uint8_t b[16];
+} raidz_v16_t;
+
+static const raidz_v32_t raidz_avx2_c1d = {{
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+}};
+
+static const raidz_v32_t raidz_avx2_c0f = {{
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+}};
+
+/* x = 2 * x, needs 0x1d in %ymm7, clobbers t */
+#define	RAIDZ_AVX2_MUL2(x, t)				\
+	"vpxor %%" t ", %%" t ", %%" t "\n"		\
+	"vpcmpgtb %%" x ", %%" t ", %%" t "\n"		\
+	"vpand %%ymm7, %%" t ", %%" t "\n"		\
+	"vpaddb %%" x ", %%" x ", %%" x "\n"		\
+	"vpxor %%" t ", %%" x ", %%" x "\n"
+
+static void
+raidz_avx2_p_add(void *pp, const void *sp, uint64_t size)
+{
+	raidz_v32_t *p = pp;
+	const raidz_v32_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[s], %%ymm0\n"
+		    "vpxor %[p], %%ymm0, %%ymm1\n"
+		    "vmovdqu %%ymm1, %[p]\n"
+		    : [p] "+m" (p[i])
+		    : [s] "m" (src[i]));
+	}
+
+	__asm__ __volatile__("vzeroupper");
+}
+
+static void
+raidz_avx2_q_add(void *qp, const void *sp, uint64_t csize, uint64_t qsize)
+{
+	raidz_v32_t *q = qp;
+	const raidz_v32_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < csize / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[c], %%ymm7\n"
+		    "vmovdqu %[q], %%ymm2\n"
+		    RAIDZ_AVX2_MUL2("ymm2", "ymm4")
+		    "vpxor %[s], %%ymm2, %%ymm2\n"
+		    "vmovdqu %%ymm2, %[q]\n"
+		    : [q] "+m" (q[i])
+		    : [s] "m" (src[i]), [c] "m" (raidz_avx2_c1d));
+	}
+
+	for (; i < qsize / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[c], %%ymm7\n"
+		    "vmovdqu %[q], %%ymm2\n"
+		    RAIDZ_AVX2_MUL2("ymm2", "ymm4")
+		    "vmovdqu %%ymm2, %[q]\n"
+		    : [q] "+m" (q[i])
+		    : [c] "m" (raidz_avx2_c1d));
+	}
+
+	__asm__ __volatile__("vzeroupper");
+}
+
+static void
+raidz_avx2_pq_add(void *pp, void *qp, const void *sp, uint64_t csize,
+    uint64_t psize)
+{
+	raidz_v32_t *p = pp, *q = qp;
+	const raidz_v32_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < csize / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[c], %%ymm7\n"
+		    "vmovdqu %[s], %%ymm0\n"
+		    "vmovdqu %[q], %%ymm2\n"
+		    "vpxor %[p], %%ymm0, %%ymm1\n"
+		    RAIDZ_AVX2_MUL2("ymm2", "ymm4")
+		    "vpxor %%ymm0, %%ymm2, %%ymm2\n"
+		    "vmovdqu %%ymm1, %[p]\n"
+		    "vmovdqu %%ymm2, %[q]\n"
+		    : [p] "+m" (p[i]), [q] "+m" (q[i])
+		    : [s] "m" (src[i]), [c] "m" (raidz_avx2_c1d));
+	}
+
+	for (; i < psize / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[c], %%ymm7\n"
+		    "vmovdqu %[q], %%ymm2\n"
+		    RAIDZ_AVX2_MUL2("ymm2", "ymm4")
+		    "vmovdqu %%ymm2, %[q]\n"
+		    : [q] "+m" (q[i])
+		    : [c] "m" (raidz_avx2_c1d));
+	}
+
+	__asm__ __volatile__("vzeroupper");
+}
+
+static void
+raidz_avx2_pqr_add(void *pp, void *qp, void *rp, const void *sp,
+    uint64_t csize, uint64_t psize)
+{
+	raidz_v32_t *p = pp, *q = qp, *r = rp;
+	const raidz_v32_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < csize / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[c], %%ymm7\n"
+		    "vmovdqu %[s], %%ymm0\n"
+		    "vmovdqu %[q], %%ymm2\n"
+		    "vmovdqu %[r], %%ymm3\n"
+		    "vpxor %[p], %%ymm0, %%ymm1\n"
+		    RAIDZ_AVX2_MUL2("ymm2", "ymm4")
+		    RAIDZ_AVX2_MUL2("ymm3", "ymm5")
+		    RAIDZ_AVX2_MUL2("ymm3", "ymm5")
+		    "vpxor %%ymm0, %%ymm2, %%ymm2\n"
+		    "vpxor %%ymm0, %%ymm3, %%ymm3\n"
+		    "vmovdqu %%ymm1, %[p]\n"
+		    "vmovdqu %%ymm2, %[q]\n"
+		    "vmovdqu %%ymm3, %[r]\n"
+		    : [p] "+m" (p[i]), [q] "+m" (q[i]), [r] "+m" (r[i])
+		    : [s] "m" (src[i]), [c] "m" (raidz_avx2_c1d));
+	}
+
+	for (; i < psize / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[c], %%ymm7\n"
+		    "vmovdqu %[q], %%ymm2\n"
+		    "vmovdqu %[r], %%ymm3\n"
+		    RAIDZ_AVX2_MUL2("ymm2", "ymm4")
+		    RAIDZ_AVX2_MUL2("ymm3", "ymm5")
+		    RAIDZ_AVX2_MUL2("ymm3", "ymm5")
+		    "vmovdqu %%ymm2, %[q]\n"
+		    "vmovdqu %%ymm3, %[r]\n"
+		    : [q] "+m" (q[i]), [r] "+m" (r[i])
+		    : [c] "m" (raidz_avx2_c1d));
+	}
+
+	__asm__ __volatile__("vzeroupper");
+}
+
+/*
+ * %ymm2 = c * x for x in %ymm0, with the nibble tables loaded from tbl.
+ * Clobbers %ymm0, %ymm1, %ymm3 and %ymm6.
+ */
+#define	RAIDZ_AVX2_MUL_TBL					\
+	"vmovdqu %[m], %%ymm6\n"				\
+	"vbroadcasti128 %[lo], %%ymm2\n"			\
+	"vbroadcasti128 %[hi], %%ymm3\n"			\
+	"vpsrlw $4, %%ymm0, %%ymm1\n"				\
+	"vpand %%ymm6, %%ymm0, %%ymm0\n"			\
+	"vpand %%ymm6, %%ymm1, %%ymm1\n"			\
+	"vpshufb %%ymm0, %%ymm2, %%ymm2\n"			\
+	"vpshufb %%ymm1, %%ymm3, %%ymm3\n"			\
+	"vpxor %%ymm3, %%ymm2, %%ymm2\n"
+
+static void
+raidz_avx2_mul_add(void *dp, const void *sp, const uint8_t *tbl,
+    uint64_t size)
+{
+	raidz_v32_t *dst = dp;
+	const raidz_v32_t *src = sp;
+	const raidz_v16_t *lo = (const raidz_v16_t *)tbl;
+	const raidz_v16_t *hi = (const raidz_v16_t *)(tbl + 16);
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[s], %%ymm0\n"
+		    RAIDZ_AVX2_MUL_TBL
+		    "vpxor %[d], %%ymm2, %%ymm2\n"
+		    "vmovdqu %%ymm2, %[d]\n"
+		    : [d] "+m" (dst[i])
+		    : [s] "m" (src[i]), [lo] "m" (*lo), [hi] "m" (*hi),
+		    [m] "m" (raidz_avx2_c0f));
+	}
+
+	__asm__ __volatile__("vzeroupper");
+}
+
+static void
+raidz_avx2_mul(void *dp, const uint8_t *tbl, uint64_t size)
+{
+	raidz_v32_t *dst = dp;
+	const raidz_v16_t *lo = (const raidz_v16_t *)tbl;
+	const raidz_v16_t *hi = (const raidz_v16_t *)(tbl + 16);
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (raidz_v32_t); i++) {
+		__asm__ __volatile__(
+		    "vmovdqu %[d], %%ymm0\n"
+		    RAIDZ_AVX2_MUL_TBL
+		    "vmovdqu %%ymm2, %[d]\n"
+		    : [d] "+m" (dst[i])
+		    : [lo] "m" (*lo), [hi] "m" (*hi), [m] "m" (raidz_avx2_c0f));
+	}
+
+	__asm__ __volatile__("vzeroupper");
+}
+
+static boolean_t
+raidz_avx2_is_supported(void)
+{
+	return (zfs_avx2_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_avx2_impl = {
+	.p_add = raidz_avx2_p_add,
+	.q_add = raidz_avx2_q_add,
+	.pq_add = raidz_avx2_pq_add,
+	.pqr_add = raidz_avx2_pqr_add,
+	.mul_add = raidz_avx2_mul_add,
+	.mul = raidz_avx2_mul,
+	.is_supported = raidz_avx2_is_supported,
+	.blocksize = sizeof (raidz_v32_t),
+	.name = "avx2"
+};
+
+#endif /* HAVE_SIMD_X86 */
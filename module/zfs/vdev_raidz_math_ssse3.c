@@ -0,0 +1,261 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSSE3 RAID-Z math.
+ *
+ * Multiplication by 2 is done sixteen bytes at a time: pcmpgtb against
+ * zero gives the bytes with the top bit set, which get 0x1d xored in
+ * after the shift.  Multiplication by an arbitrary constant looks up the
+ * products of the low and high nibbles with pshufb.  Each asm statement
+ * is one whole 16-byte step so no vector state lives across statements.
+ */
+
+#include <sys/types.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(HAVE_SIMD_X86)
+
+typedef struct raidz_v16 {
+	uint8_t b[16];
+} raidz_v16_t;
+
+static const raidz_v16_t raidz_sse_c1d = {{
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+}};
+
+static const raidz_v16_t raidz_sse_c0f = {{
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+}};
+
+/* x = 2 * x, needs 0x1d in %xmm7, clobbers t */
+#define	RAIDZ_SSE_MUL2(x, t)				\
+	"pxor %%" t ", %%" t "\n"			\
+	"pcmpgtb %%" x ", %%" t "\n"			\
+	"pand %%xmm7, %%" t "\n"			\
+	"paddb %%" x ", %%" x "\n"			\
+	"pxor %%" t ", %%" x "\n"
+
+static void
+raidz_ssse3_p_add(void *pp, const void *sp, uint64_t size)
+{
+	raidz_v16_t *p = pp;
+	const raidz_v16_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[s], %%xmm0\n"
+		    "movdqu %[p], %%xmm1\n"
+		    "pxor %%xmm0, %%xmm1\n"
+		    "movdqu %%xmm1, %[p]\n"
+		    : [p] "+m" (p[i])
+		    : [s] "m" (src[i]));
+	}
+}
+
+static void
+raidz_ssse3_q_add(void *qp, const void *sp, uint64_t csize, uint64_t qsize)
+{
+	raidz_v16_t *q = qp;
+	const raidz_v16_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < csize / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[c], %%xmm7\n"
+		    "movdqu %[s], %%xmm0\n"
+		    "movdqu %[q], %%xmm2\n"
+		    RAIDZ_SSE_MUL2("xmm2", "xmm4")
+		    "pxor %%xmm0, %%xmm2\n"
+		    "movdqu %%xmm2, %[q]\n"
+		    : [q] "+m" (q[i])
+		    : [s] "m" (src[i]), [c] "m" (raidz_sse_c1d));
+	}
+
+	for (; i < qsize / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[c], %%xmm7\n"
+		    "movdqu %[q], %%xmm2\n"
+		    RAIDZ_SSE_MUL2("xmm2", "xmm4")
+		    "movdqu %%xmm2, %[q]\n"
+		    : [q] "+m" (q[i])
+		    : [c] "m" (raidz_sse_c1d));
+	}
+}
+
+static void
+raidz_ssse3_pq_add(void *pp, void *qp, const void *sp, uint64_t csize,
+    uint64_t psize)
+{
+	raidz_v16_t *p = pp, *q = qp;
+	const raidz_v16_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < csize / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[c], %%xmm7\n"
+		    "movdqu %[s], %%xmm0\n"
+		    "movdqu %[p], %%xmm1\n"
+		    "movdqu %[q], %%xmm2\n"
+		    "pxor %%xmm0, %%xmm1\n"
+		    RAIDZ_SSE_MUL2("xmm2", "xmm4")
+		    "pxor %%xmm0, %%xmm2\n"
+		    "movdqu %%xmm1, %[p]\n"
+		    "movdqu %%xmm2, %[q]\n"
+		    : [p] "+m" (p[i]), [q] "+m" (q[i])
+		    : [s] "m" (src[i]), [c] "m" (raidz_sse_c1d));
+	}
+
+	for (; i < psize / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[c], %%xmm7\n"
+		    "movdqu %[q], %%xmm2\n"
+		    RAIDZ_SSE_MUL2("xmm2", "xmm4")
+		    "movdqu %%xmm2, %[q]\n"
+		    : [q] "+m" (q[i])
+		    : [c] "m" (raidz_sse_c1d));
+	}
+}
+
+static void
+raidz_ssse3_pqr_add(void *pp, void *qp, void *rp, const void *sp,
+    uint64_t csize, uint64_t psize)
+{
+	raidz_v16_t *p = pp, *q = qp, *r = rp;
+	const raidz_v16_t *src = sp;
+	uint64_t i;
+
+	for (i = 0; i < csize / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[c], %%xmm7\n"
+		    "movdqu %[s], %%xmm0\n"
+		    "movdqu %[p], %%xmm1\n"
+		    "movdqu %[q], %%xmm2\n"
+		    "movdqu %[r], %%xmm3\n"
+		    "pxor %%xmm0, %%xmm1\n"
+		    RAIDZ_SSE_MUL2("xmm2", "xmm4")
+		    RAIDZ_SSE_MUL2("xmm3", "xmm5")
+		    RAIDZ_SSE_MUL2("xmm3", "xmm5")
+		    "pxor %%xmm0, %%xmm2\n"
+		    "pxor %%xmm0, %%xmm3\n"
+		    "movdqu %%xmm1, %[p]\n"
+		    "movdqu %%xmm2, %[q]\n"
+		    "movdqu %%xmm3, %[r]\n"
+		    : [p] "+m" (p[i]), [q] "+m" (q[i]), [r] "+m" (r[i])
+		    : [s] "m" (src[i]), [c] "m" (raidz_sse_c1d));
+	}
+
+	for (; i < psize / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[c], %%xmm7\n"
+		    "movdqu %[q], %%xmm2\n"
+		    "movdqu %[r], %%xmm3\n"
+		    RAIDZ_SSE_MUL2("xmm2", "xmm4")
+		    RAIDZ_SSE_MUL2("xmm3", "xmm5")
+		    RAIDZ_SSE_MUL2("xmm3", "xmm5")
+		    "movdqu %%xmm2, %[q]\n"
+		    "movdqu %%xmm3, %[r]\n"
+		    : [q] "+m" (q[i]), [r] "+m" (r[i])
+		    : [c] "m" (raidz_sse_c1d));
+	}
+}
+
+/*
+ * %xmm2 = c * x for x in %xmm0, with the nibble tables loaded from tbl.
+ * Clobbers %xmm0, %xmm1, %xmm3 and %xmm6.
+ */
+#define	RAIDZ_SSE_MUL_TBL					\
+	"movdqu %[m], %%xmm6\n"					\
+	"movdqu %[lo], %%xmm2\n"				\
+	"movdqu %[hi], %%xmm3\n"				\
+	"movdqa %%xmm0, %%xmm1\n"				\
+	"psrlw $4, %%xmm1\n"					\
+	"pand %%xmm6, %%xmm0\n"					\
+	"pand %%xmm6, %%xmm1\n"					\
+	"pshufb %%xmm0, %%xmm2\n"				\
+	"pshufb %%xmm1, %%xmm3\n"				\
+	"pxor %%xmm3, %%xmm2\n"
+
+static void
+raidz_ssse3_mul_add(void *dp, const void *sp, const uint8_t *tbl,
+    uint64_t size)
+{
+	raidz_v16_t *dst = dp;
+	const raidz_v16_t *src = sp;
+	const raidz_v16_t *lo = (const raidz_v16_t *)tbl;
+	const raidz_v16_t *hi = (const raidz_v16_t *)(tbl + 16);
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[s], %%xmm0\n"
+		    RAIDZ_SSE_MUL_TBL
+		    "movdqu %[d], %%xmm0\n"
+		    "pxor %%xmm2, %%xmm0\n"
+		    "movdqu %%xmm0, %[d]\n"
+		    : [d] "+m" (dst[i])
+		    : [s] "m" (src[i]), [lo] "m" (*lo), [hi] "m" (*hi),
+		    [m] "m" (raidz_sse_c0f));
+	}
+}
+
+static void
+raidz_ssse3_mul(void *dp, const uint8_t *tbl, uint64_t size)
+{
+	raidz_v16_t *dst = dp;
+	const raidz_v16_t *lo = (const raidz_v16_t *)tbl;
+	const raidz_v16_t *hi = (const raidz_v16_t *)(tbl + 16);
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (raidz_v16_t); i++) {
+		__asm__ __volatile__(
+		    "movdqu %[d], %%xmm0\n"
+		    RAIDZ_SSE_MUL_TBL
+		    "movdqu %%xmm2, %[d]\n"
+		    : [d] "+m" (dst[i])
+		    : [lo] "m" (*lo), [hi] "m" (*hi), [m] "m" (raidz_sse_c0f));
+	}
+}
+
+static boolean_t
+raidz_ssse3_is_supported(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_ssse3_impl = {
+	.p_add = raidz_ssse3_p_add,
+	.q_add = raidz_ssse3_q_add,
+	.pq_add = raidz_ssse3_pq_add,
+	.pqr_add = raidz_ssse3_pqr_add,
+	.mul_add = raidz_ssse3_mul_add,
+	.mul = raidz_ssse3_mul,
+	.is_supported = raidz_ssse3_is_supported,
+	.blocksize = sizeof (raidz_v16_t),
+	.name = "ssse3"
+};
+
+#endif /* HAVE_SIMD_X86 */
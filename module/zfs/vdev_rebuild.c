@@ -0,0 +1,474 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_scan.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+
+/*
+ * Sequential rebuild of mirrors.
+ *
+ * A resilver walks every block pointer of the pool and reads what it
+ * finds in the order the block pointers lead it to, which for a large
+ * pool on rotating disks means days of random I/O.  A mirror doesn't
+ * need any of that: each child holds the same bytes at the same offset,
+ * so a new child can be filled by copying every allocated range of the
+ * metaslabs from a healthy child, in offset order and at streaming speed.
+ *
+ * With zfs_rebuild_sequential set, spa_vdev_attach() hands a new child of
+ * a mirror (or a replacing or spare vdev) to the pool's rebuild thread
+ * instead of restarting the resilver.  Once the txgs up to the attach
+ * have synced, the thread copies the allocated space of the top-level
+ * vdev batch by batch, up to zfs_rebuild_batch_bytes of metaslab space at
+ * a time and with I/Os of at most zfs_rebuild_extent_bytes_max.  The data
+ * is copied without checksum verification, so when the rebuild is done
+ * the DTLs of the new children are cleared, the resilver-done processing
+ * can detach the replaced device, and a scrub is started to verify what
+ * was copied (zfs_rebuild_scrub).
+ *
+ * Each batch holds an open tx for the duration of its I/O, which keeps
+ * the open txg from syncing.  Space freed while the batch is in flight
+ * goes through ms_freeingtree, ms_freedtree and ms_defertree, and only
+ * after the sync of the held txg could it be allocated again, so a stale
+ * copy can never land on top of a newer block.  The allocated space of
+ * a batch excludes the free, trimming, freeing and deferred space as
+ * well as the ms_alloctree of every txg: blocks allocated since the
+ * attach are written to all children of the mirror anyway.
+ *
+ * Only one rebuild runs at a time; an attach while it runs, on a RAID-Z
+ * vdev or during a resilver falls back to the resilver.  So does a
+ * rebuild that fails, loses its source or sees its targets change.  The
+ * progress isn't recorded on disk: a rebuild cut short by an export
+ * leaves the DTLs in place, and the import starts a resilver for them.
+ */
+
+/* rebuild new mirror children sequentially instead of resilvering */
+int zfs_rebuild_sequential = 0;
+
+/* largest range copied by a single I/O */
+uint64_t zfs_rebuild_extent_bytes_max = 1 << 20;
+
+/* metaslab space covered by a batch */
+uint64_t zfs_rebuild_batch_bytes = 32 << 20;
+
+/* scrub the pool once a rebuild is done */
+int zfs_rebuild_scrub = 1;
+
+#define	REBUILD_BATCH_SEGS	256
+
+typedef struct rebuild_batch {
+	zio_t		*rb_pio;
+	vdev_t		**rb_targets;
+	int		rb_ntargets;
+} rebuild_batch_t;
+
+typedef struct rebuild_io {
+	rebuild_batch_t	*ri_batch;
+	abd_t		*ri_abd;
+	uint32_t	ri_refs;
+} rebuild_io_t;
+
+static boolean_t
+spa_rebuild_stopping(spa_t *spa)
+{
+	return (spa->spa_rebuild_stop || spa_suspended(spa));
+}
+
+static int
+spa_rebuild_nleaves(vdev_t *vd)
+{
+	int c, n = 0;
+
+	if (vd->vdev_ops->vdev_op_leaf)
+		return (1);
+	for (c = 0; c < vd->vdev_children; c++)
+		n += spa_rebuild_nleaves(vd->vdev_child[c]);
+	return (n);
+}
+
+/*
+ * The leaves missing data are the targets of the rebuild, the first
+ * readable one that isn't is the source.
+ */
+static void
+spa_rebuild_leaves(vdev_t *vd, vdev_t **srcp, vdev_t **targets, int *nt)
+{
+	int c;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		if (!vdev_dtl_empty(vd, DTL_MISSING)) {
+			if (vdev_writeable(vd))
+				targets[(*nt)++] = vd;
+		} else if (*srcp == NULL && vdev_readable(vd)) {
+			*srcp = vd;
+		}
+		return;
+	}
+
+	for (c = 0; c < vd->vdev_children; c++)
+		spa_rebuild_leaves(vd->vdev_child[c], srcp, targets, nt);
+}
+
+static void
+spa_rebuild_io_rele(rebuild_io_t *ri)
+{
+	if (atomic_dec_32_nv(&ri->ri_refs) == 0) {
+		abd_free(ri->ri_abd);
+		kmem_free(ri, sizeof (rebuild_io_t));
+	}
+}
+
+static void
+spa_rebuild_write_done(zio_t *zio)
+{
+	spa_rebuild_io_rele(zio->io_private);
+}
+
+/*
+ * Pass the data read from the source on to every target.  The writes are
+ * children of the batch's root zio, which is still waiting for this read.
+ */
+static void
+spa_rebuild_read_done(zio_t *zio)
+{
+	rebuild_io_t *ri = zio->io_private;
+	rebuild_batch_t *rb = ri->ri_batch;
+	int t;
+
+	if (zio->io_error == 0) {
+		ri->ri_refs = rb->rb_ntargets + 1;
+		for (t = 0; t < rb->rb_ntargets; t++) {
+			zio_nowait(zio_write_phys(rb->rb_pio,
+			    rb->rb_targets[t], zio->io_offset, zio->io_size,
+			    ri->ri_abd, ZIO_CHECKSUM_OFF,
+			    spa_rebuild_write_done, ri, ZIO_PRIORITY_SCRUB,
+			    ZIO_FLAG_CANFAIL, B_FALSE));
+		}
+	} else {
+		ri->ri_refs = 1;
+	}
+	spa_rebuild_io_rele(ri);
+}
+
+/*
+ * Remove the part of [start, end) that rt holds from the window.
+ */
+static void
+spa_rebuild_exclude(range_tree_t *win, range_tree_t *rt, uint64_t start,
+    uint64_t end)
+{
+	uint64_t ostart, osize;
+
+	if (rt == NULL)
+		return;
+
+	while (start < end &&
+	    range_tree_find_in(rt, start, end - start, &ostart, &osize)) {
+		range_tree_clear(win, ostart, osize);
+		start = ostart + osize;
+	}
+}
+
+/*
+ * Take the allocated segments of msp from *offset on, up to
+ * zfs_rebuild_batch_bytes of metaslab space and REBUILD_BATCH_SEGS
+ * segments, and advance *offset past them.  Returns the number of
+ * segments, which is 0 for a window without allocated space.
+ */
+static int
+spa_rebuild_take(spa_t *spa, metaslab_t *msp, uint64_t *offset,
+    range_seg_t *segs, int *errorp)
+{
+	uint64_t maxsize = MAX(zfs_rebuild_extent_bytes_max, SPA_MINBLOCKSIZE);
+	uint64_t msend = msp->ms_start + msp->ms_size;
+	uint64_t start, end, ostart, osize;
+	range_tree_t *win;
+	int n = 0, t;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	metaslab_load_wait(msp);
+	if (!msp->ms_loaded && (*errorp = metaslab_load(msp)) != 0)
+		return (0);
+	msp->ms_selected_txg = spa_syncing_txg(spa);
+
+	/* metaslab_condense() drops ms_lock while ms_tree is frozen */
+	while (msp->ms_condensing) {
+		mutex_exit(&msp->ms_lock);
+		delay(1);
+		mutex_enter(&msp->ms_lock);
+	}
+
+	start = MAX(*offset, msp->ms_start);
+	if (start >= msend)
+		return (0);
+	end = MIN(start + MAX(zfs_rebuild_batch_bytes, maxsize), msend);
+
+	win = range_tree_create(NULL, NULL, &msp->ms_lock);
+	range_tree_add(win, start, end - start);
+	spa_rebuild_exclude(win, msp->ms_tree, start, end);
+	spa_rebuild_exclude(win, msp->ms_trimming, start, end);
+	spa_rebuild_exclude(win, msp->ms_freeingtree, start, end);
+	spa_rebuild_exclude(win, msp->ms_freedtree, start, end);
+	for (t = 0; t < TXG_SIZE; t++)
+		spa_rebuild_exclude(win, msp->ms_alloctree[t], start, end);
+	for (t = 0; t < TXG_DEFER_SIZE; t++)
+		spa_rebuild_exclude(win, msp->ms_defertree[t], start, end);
+
+	*offset = end;
+	while (n < REBUILD_BATCH_SEGS &&
+	    range_tree_find_in(win, start, end - start, &ostart, &osize)) {
+		osize = MIN(osize, maxsize);
+		segs[n].rs_start = ostart;
+		segs[n].rs_end = ostart + osize;
+		start = ostart + osize;
+		*offset = start;
+		n++;
+	}
+	range_tree_vacate(win, NULL, NULL);
+	range_tree_destroy(win);
+
+	return (n);
+}
+
+/*
+ * The rebuild is complete up to spa_rebuild_txg: drop that part of the
+ * targets' DTLs and let the change propagate up the vdev tree.
+ */
+static void
+spa_rebuild_excise(spa_t *spa, vdev_t *tvd, vdev_t **targets, int nt,
+    uint64_t txg)
+{
+	int t;
+
+	for (t = 0; t < nt; t++) {
+		vdev_t *vd = targets[t];
+
+		mutex_enter(&vd->vdev_dtl_lock);
+		range_tree_clear(vd->vdev_dtl[DTL_MISSING], 0,
+		    spa->spa_rebuild_txg);
+		mutex_exit(&vd->vdev_dtl_lock);
+	}
+	vdev_dtl_reassess(tvd, txg, 0, B_FALSE);
+}
+
+/*
+ * Copy the allocated space of the top-level vdev to its children that are
+ * missing data.
+ *
+ * Like a trim pass, the config lock is only held for a batch at a time.
+ * The position is kept as a metaslab index and offset, and the top-level
+ * vdev is looked up again by id and guid for every batch.
+ */
+static int
+spa_rebuild_pass(spa_t *spa, uint64_t *bytesp)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	range_seg_t *segs;
+	uint64_t m = 0, offset = 0;
+	int ntargets = -1;
+	int error = 0;
+
+	segs = kmem_alloc(REBUILD_BATCH_SEGS * sizeof (range_seg_t), KM_SLEEP);
+
+	while (error == 0) {
+		rebuild_batch_t rb;
+		vdev_t *tvd, *src = NULL;
+		metaslab_t *msp;
+		dmu_tx_t *tx;
+		int i, n, nleaves;
+
+		if (spa_rebuild_stopping(spa)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		tx = dmu_tx_create_dd(dp->dp_mos_dir);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		spa_config_enter(spa, SCL_CONFIG | SCL_STATE, FTAG, RW_READER);
+
+		if (spa->spa_rebuild_vdev >= rvd->vdev_children ||
+		    (tvd = rvd->vdev_child[spa->spa_rebuild_vdev])->vdev_guid !=
+		    spa->spa_rebuild_guid) {
+			spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+			dmu_tx_commit(tx);
+			error = SET_ERROR(ENODEV);
+			break;
+		}
+
+		nleaves = spa_rebuild_nleaves(tvd);
+		rb.rb_targets = kmem_alloc(nleaves * sizeof (vdev_t *),
+		    KM_SLEEP);
+		rb.rb_ntargets = 0;
+		spa_rebuild_leaves(tvd, &src, rb.rb_targets, &rb.rb_ntargets);
+		if (ntargets == -1)
+			ntargets = rb.rb_ntargets;
+
+		if (src == NULL || rb.rb_ntargets == 0 ||
+		    rb.rb_ntargets != ntargets) {
+			error = SET_ERROR(ENXIO);
+		} else if (m >= tvd->vdev_ms_count) {
+			spa_rebuild_excise(spa, tvd, rb.rb_targets,
+			    rb.rb_ntargets, dmu_tx_get_txg(tx));
+			kmem_free(rb.rb_targets, nleaves * sizeof (vdev_t *));
+			spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+			dmu_tx_commit(tx);
+			break;
+		}
+		if (error != 0) {
+			kmem_free(rb.rb_targets, nleaves * sizeof (vdev_t *));
+			spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+			dmu_tx_commit(tx);
+			break;
+		}
+
+		msp = tvd->vdev_ms[m];
+		mutex_enter(&msp->ms_lock);
+		n = spa_rebuild_take(spa, msp, &offset, segs, &error);
+		mutex_exit(&msp->ms_lock);
+		if (offset >= msp->ms_start + msp->ms_size) {
+			m++;
+			offset = 0;
+		}
+
+		rb.rb_pio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (i = 0; i < n; i++) {
+			uint64_t size = segs[i].rs_end - segs[i].rs_start;
+			rebuild_io_t *ri;
+
+			ri = kmem_alloc(sizeof (rebuild_io_t), KM_SLEEP);
+			ri->ri_batch = &rb;
+			ri->ri_abd = abd_alloc_for_io(size, B_FALSE);
+			ri->ri_refs = 0;
+			zio_nowait(zio_read_phys(rb.rb_pio, src,
+			    segs[i].rs_start + VDEV_LABEL_START_SIZE, size,
+			    ri->ri_abd, ZIO_CHECKSUM_OFF, spa_rebuild_read_done,
+			    ri, ZIO_PRIORITY_SCRUB, ZIO_FLAG_CANFAIL, B_FALSE));
+			*bytesp += size;
+		}
+		if (error == 0)
+			error = zio_wait(rb.rb_pio);
+		else
+			(void) zio_wait(rb.rb_pio);
+
+		kmem_free(rb.rb_targets, nleaves * sizeof (vdev_t *));
+		spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+		dmu_tx_commit(tx);
+	}
+
+	kmem_free(segs, REBUILD_BATCH_SEGS * sizeof (range_seg_t));
+	return (error);
+}
+
+static void
+spa_rebuild_thread(void *arg)
+{
+	spa_t *spa = arg;
+	uint64_t bytes = 0;
+	hrtime_t start;
+	int error;
+
+	/* the new children's DTLs and the vdev tree are on disk */
+	txg_wait_synced(spa_get_dsl(spa), spa->spa_rebuild_txg);
+
+	start = gethrtime();
+	spa_history_log_internal(spa, "rebuild setup", NULL,
+	    "vdev=%llu txg=%llu", (u_longlong_t)spa->spa_rebuild_vdev,
+	    (u_longlong_t)spa->spa_rebuild_txg);
+
+	error = spa_rebuild_pass(spa, &bytes);
+
+	zfs_dbgmsg("rebuild of %s vdev %llu error=%d bytes=%llu ms=%llu",
+	    spa_name(spa), (u_longlong_t)spa->spa_rebuild_vdev, error,
+	    (u_longlong_t)bytes,
+	    (u_longlong_t)NSEC2MSEC(gethrtime() - start));
+
+	if (error == 0) {
+		spa_history_log_internal(spa, "rebuild done", NULL,
+		    "bytes=%llu", (u_longlong_t)bytes);
+		spa_async_request(spa, SPA_ASYNC_RESILVER_DONE);
+		if (zfs_rebuild_scrub)
+			spa_async_request(spa, SPA_ASYNC_SCRUB);
+	} else if (error != EINTR) {
+		spa_history_log_internal(spa, "rebuild aborted", NULL,
+		    "error=%d bytes=%llu", error, (u_longlong_t)bytes);
+		spa_async_request(spa, SPA_ASYNC_RESILVER);
+	}
+
+	mutex_enter(&spa->spa_rebuild_lock);
+	spa->spa_rebuild_thread = NULL;
+	cv_broadcast(&spa->spa_rebuild_cv);
+	mutex_exit(&spa->spa_rebuild_lock);
+	thread_exit();
+}
+
+/*
+ * Called by spa_vdev_attach() with the config lock held as writer, before
+ * the attach is committed in txg.  Returns B_TRUE if tvd was handed to the
+ * rebuild thread, B_FALSE if the caller still has to start a resilver.
+ */
+boolean_t
+spa_rebuild_start(spa_t *spa, vdev_t *tvd, uint64_t txg)
+{
+	boolean_t started = B_FALSE;
+
+	if (!zfs_rebuild_sequential || tvd->vdev_ops->vdev_op_leaf ||
+	    tvd->vdev_ops == &vdev_raidz_ops ||
+	    dsl_scan_resilvering(spa->spa_dsl_pool))
+		return (B_FALSE);
+
+	mutex_enter(&spa->spa_rebuild_lock);
+	if (spa->spa_rebuild_thread == NULL && !spa->spa_rebuild_stop) {
+		spa->spa_rebuild_vdev = tvd->vdev_id;
+		spa->spa_rebuild_guid = tvd->vdev_guid;
+		spa->spa_rebuild_txg = txg;
+		spa->spa_rebuild_thread = thread_create(NULL, 0,
+		    spa_rebuild_thread, spa, 0, &p0, TS_RUN, minclsyspri);
+		started = B_TRUE;
+	}
+	mutex_exit(&spa->spa_rebuild_lock);
+
+	return (started);
+}
+
+/*
+ * Stop the rebuild thread and wait for it to exit.  Must be called while
+ * the pool still syncs, since every batch waits for a tx.
+ */
+void
+spa_rebuild_stop(spa_t *spa)
+{
+	mutex_enter(&spa->spa_rebuild_lock);
+	if (spa->spa_rebuild_thread != NULL) {
+		spa->spa_rebuild_stop = B_TRUE;
+		while (spa->spa_rebuild_thread != NULL)
+			cv_wait(&spa->spa_rebuild_cv, &spa->spa_rebuild_lock);
+		spa->spa_rebuild_stop = B_FALSE;
+	}
+	mutex_exit(&spa->spa_rebuild_lock);
+}
@@ -0,0 +1,338 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/zio.h>
+
+/*
+ * TRIM (unmap) of free space.
+ *
+ * Flash devices write faster when the controller knows which blocks no
+ * longer hold data, since it then has erased blocks at hand instead of
+ * having to garbage collect on the write path.  ZFS tells it by issuing
+ * DKIOCFREE ioctls for the free space of the pool, either automatically
+ * for the frees of each txg (the "autotrim" pool property) or for all of
+ * the free space at once ("zpool trim").
+ *
+ * With autotrim on, metaslab_sync_done() queues the space it returns to
+ * a loaded metaslab's ms_tree in the metaslab's ms_trimtree as well.
+ * Every zfs_trim_txg_batch txgs spa_trim_auto() starts the pool's trim
+ * thread, which unmaps whatever the loaded metaslabs have queued.  A
+ * manual trim first queues all of the free space of each metaslab,
+ * loading it if necessary.
+ *
+ * The thread takes up to TRIM_BATCH_SEGS segments of a metaslab at a time.
+ * While their ioctls are outstanding the segments are held out of the
+ * allocator, so a block can never be allocated and written to space that
+ * is about to be unmapped.  Segments are split at zfs_trim_extent_bytes_max
+ * and ones smaller than zfs_trim_extent_bytes_min are skipped, as unmapping
+ * them costs more than it gains.  RAID-Z space is translated to the range
+ * of each child that holds it, mirrors pass it on to every child.
+ *
+ * A TRIM is only a hint, so errors are ignored.  A device that doesn't
+ * support it fails the first ioctl with ENOTSUP and is marked vdev_notrim
+ * until it is reopened.
+ */
+
+/* smallest range worth unmapping */
+uint64_t zfs_trim_extent_bytes_min = 32 << 10;
+
+/* largest range unmapped by a single ioctl */
+uint64_t zfs_trim_extent_bytes_max = 128 << 20;
+
+/* txgs between automatic TRIMs */
+uint64_t zfs_trim_txg_batch = 32;
+
+/* bytes/sec of free space unmapped by autotrim, 0 for unlimited */
+uint64_t zfs_trim_rate = 0;
+
+#define	TRIM_BATCH_SEGS		64
+
+/*
+ * Unmap a range of vd, an offset relative to the allocatable space of vd
+ * like that of a DVA, by issuing the matching ioctls to its leaves.
+ */
+static void
+vdev_trim_range(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size)
+{
+	uint64_t c;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		if (vdev_writeable(vd) && !vd->vdev_notrim) {
+			zio_nowait(zio_trim(pio, vd, offset, size, NULL, NULL,
+			    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+			    ZIO_FLAG_DONT_RETRY));
+		}
+		return;
+	}
+
+	if (vd->vdev_ops == &vdev_raidz_ops) {
+		uint64_t dcols = vd->vdev_children;
+		uint64_t ashift = vd->vdev_top->vdev_ashift;
+		uint64_t b0 = offset >> ashift;
+		uint64_t b1 = (offset + size) >> ashift;
+
+		/*
+		 * Sector b of the RAID-Z vdev is row b / dcols of child
+		 * b % dcols, see vdev_raidz_map_alloc().  The sectors of
+		 * child c within [b0, b1) are therefore the rows from
+		 * ceil((b0 - c) / dcols) up to ceil((b1 - c) / dcols).
+		 */
+		for (c = 0; c < dcols; c++) {
+			uint64_t r0 = (b0 + dcols - 1 - c) / dcols;
+			uint64_t r1 = (b1 + dcols - 1 - c) / dcols;
+
+			if (r1 > r0) {
+				vdev_trim_range(pio, vd->vdev_child[c],
+				    r0 << ashift, (r1 - r0) << ashift);
+			}
+		}
+		return;
+	}
+
+	/* mirror, replacing and spare vdevs */
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_trim_range(pio, vd->vdev_child[c], offset, size);
+}
+
+static boolean_t
+spa_trim_stopping(spa_t *spa)
+{
+	return (spa->spa_trim_stop || spa_suspended(spa));
+}
+
+/*
+ * Give back a metaslab that spa_trim_pass() loaded for a manual trim,
+ * provided the configuration hasn't changed since.
+ */
+static void
+spa_trim_release(spa_t *spa, uint64_t c, uint64_t m, metaslab_t *msp)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	spa_config_enter(spa, SCL_CONFIG | SCL_STATE, FTAG, RW_READER);
+	if (c < rvd->vdev_children && m < rvd->vdev_child[c]->vdev_ms_count &&
+	    rvd->vdev_child[c]->vdev_ms[m] == msp) {
+		mutex_enter(&msp->ms_lock);
+		metaslab_trim_done(msp, B_TRUE);
+		mutex_exit(&msp->ms_lock);
+	}
+	spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+}
+
+/*
+ * Unmap the queued free space of every metaslab of the pool, or all of
+ * its free space for a manual trim, at no more than rate bytes/sec.
+ *
+ * The config lock is only held for one batch at a time so that a long
+ * pass doesn't hold up configuration changes.  The position in the pool
+ * is kept as a top-level vdev and metaslab index, and if the metaslab
+ * found there is not the one of the previous batch, the pass carries on
+ * with it as a new metaslab.
+ */
+static void
+spa_trim_pass(spa_t *spa, boolean_t manual, uint64_t rate)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	range_seg_t *segs;
+	metaslab_t *msp = NULL;
+	boolean_t loaded = B_FALSE;
+	uint64_t c = 0, m = 0;
+
+	segs = kmem_alloc(TRIM_BATCH_SEGS * sizeof (range_seg_t), KM_SLEEP);
+
+	while (!spa_trim_stopping(spa)) {
+		uint64_t bytes = 0;
+		clock_t start, end;
+		vdev_t *vd;
+		zio_t *zio;
+		int i, n;
+
+		spa_config_enter(spa, SCL_CONFIG | SCL_STATE, FTAG, RW_READER);
+
+		if (c >= rvd->vdev_children) {
+			spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+			break;
+		}
+
+		vd = rvd->vdev_child[c];
+		if (m >= vd->vdev_ms_count || !vdev_writeable(vd) ||
+		    vd->vdev_removing) {
+			spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+			c++;
+			m = 0;
+			continue;
+		}
+
+		if (vd->vdev_ms[m] != msp) {
+			msp = vd->vdev_ms[m];
+			mutex_enter(&msp->ms_lock);
+			if (manual)
+				(void) metaslab_trim_all(msp, &loaded);
+			else
+				loaded = B_FALSE;
+		} else {
+			mutex_enter(&msp->ms_lock);
+		}
+
+		n = metaslab_trim_take(msp, segs, TRIM_BATCH_SEGS,
+		    zfs_trim_extent_bytes_min,
+		    MAX(zfs_trim_extent_bytes_max, SPA_MINBLOCKSIZE));
+		if (n == 0) {
+			metaslab_trim_done(msp, loaded);
+			mutex_exit(&msp->ms_lock);
+			spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+			msp = NULL;
+			loaded = B_FALSE;
+			m++;
+			continue;
+		}
+		mutex_exit(&msp->ms_lock);
+
+		start = ddi_get_lbolt();
+		zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (i = 0; i < n; i++) {
+			uint64_t size = segs[i].rs_end - segs[i].rs_start;
+
+			vdev_trim_range(zio, vd, segs[i].rs_start, size);
+			bytes += size;
+		}
+		(void) zio_wait(zio);
+
+		mutex_enter(&msp->ms_lock);
+		metaslab_trim_done(msp, B_FALSE);
+		mutex_exit(&msp->ms_lock);
+
+		spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+
+		if (rate != 0) {
+			end = start + (clock_t)(bytes * hz / rate);
+			if (ddi_get_lbolt() < end)
+				delay(end - ddi_get_lbolt());
+		}
+	}
+
+	if (loaded)
+		spa_trim_release(spa, c, m, msp);
+
+	kmem_free(segs, TRIM_BATCH_SEGS * sizeof (range_seg_t));
+}
+
+static void
+spa_trim_thread(void *arg)
+{
+	spa_t *spa = arg;
+	boolean_t manual;
+	uint64_t rate;
+
+	mutex_enter(&spa->spa_trim_lock);
+	do {
+		manual = spa->spa_trim_manual;
+		rate = manual ? spa->spa_trim_rate : zfs_trim_rate;
+		spa->spa_trim_manual = B_FALSE;
+		mutex_exit(&spa->spa_trim_lock);
+
+		spa_trim_pass(spa, manual, rate);
+
+		mutex_enter(&spa->spa_trim_lock);
+	} while (spa->spa_trim_manual && !spa->spa_trim_stop);
+
+	spa->spa_trim_thread = NULL;
+	cv_broadcast(&spa->spa_trim_cv);
+	mutex_exit(&spa->spa_trim_lock);
+	thread_exit();
+}
+
+static void
+spa_trim_dispatch(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa->spa_trim_lock));
+
+	if (spa->spa_trim_thread == NULL && !spa->spa_trim_stop) {
+		spa->spa_trim_thread = thread_create(NULL, 0,
+		    spa_trim_thread, spa, 0, &p0, TS_RUN, minclsyspri);
+	}
+}
+
+/*
+ * Start ("zpool trim") or stop ("zpool trim -s") unmapping all of the
+ * free space of the pool.  A trim requested while one is running starts
+ * over once it is done.
+ */
+int
+spa_trim(spa_t *spa, pool_trim_func_t func, uint64_t rate)
+{
+	if (func >= POOL_TRIM_FUNCS)
+		return (SET_ERROR(ENOTSUP));
+
+	if (func == POOL_TRIM_STOP) {
+		spa_trim_stop(spa);
+		return (0);
+	}
+
+	if (!spa_writeable(spa))
+		return (SET_ERROR(EROFS));
+
+	mutex_enter(&spa->spa_trim_lock);
+	spa->spa_trim_manual = B_TRUE;
+	spa->spa_trim_rate = rate;
+	spa_trim_dispatch(spa);
+	mutex_exit(&spa->spa_trim_lock);
+
+	return (0);
+}
+
+/*
+ * Stop the trim thread and wait for it to exit.  Must be called before
+ * the vdevs are torn down.
+ */
+void
+spa_trim_stop(spa_t *spa)
+{
+	mutex_enter(&spa->spa_trim_lock);
+	spa->spa_trim_manual = B_FALSE;
+	if (spa->spa_trim_thread != NULL) {
+		spa->spa_trim_stop = B_TRUE;
+		while (spa->spa_trim_thread != NULL)
+			cv_wait(&spa->spa_trim_cv, &spa->spa_trim_lock);
+		spa->spa_trim_stop = B_FALSE;
+	}
+	mutex_exit(&spa->spa_trim_lock);
+}
+
+/*
+ * Called at the end of spa_sync(); every zfs_trim_txg_batch txgs, unmap
+ * the space that autotrim has queued since the last time.
+ */
+void
+spa_trim_auto(spa_t *spa, uint64_t txg)
+{
+	if (!spa->spa_autotrim || zfs_trim_txg_batch == 0 ||
+	    txg % zfs_trim_txg_batch != 0)
+		return;
+
+	mutex_enter(&spa->spa_trim_lock);
+	spa_trim_dispatch(spa);
+	mutex_exit(&spa->spa_trim_lock);
+}
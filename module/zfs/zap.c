@@ -51,6 +51,24 @@
 
 int fzap_default_block_shift = 14; /* 16k blocksize */
 
+/* leaves read ahead by a zap_cursor_init_prefetch() cursor */
+int zap_cursor_prefetch_leaves = 8;
+
+/*
+ * Once a fat zap's pointer table outgrows the header block, every lookup
+ * has to hold one of the table's blocks just to find the leaf.  To spare
+ * busy zaps that, recently used table entries are remembered in a small
+ * direct-mapped cache, allocated along with the external table.  Each
+ * slot is a single word packing the leaf blkid, the rest of the table
+ * index as a tag, and a valid bit, so that readers can fill and use it
+ * while sharing zap_rwlock.  It is cleared whenever the table changes,
+ * which only happens with zap_rwlock held as writer.
+ */
+#define	ZAP_PTRTBL_CACHE_SHIFT	8
+#define	ZAP_PTRTBL_CACHE_SIZE	(1 << ZAP_PTRTBL_CACHE_SHIFT)
+#define	ZAP_PTRTBL_CACHE_TAGBITS	23
+#define	ZAP_PTRTBL_CACHE_BLKBITS	(64 - ZAP_PTRTBL_CACHE_TAGBITS - 1)
+
 extern inline zap_phys_t *zap_f_phys(zap_t *zap);
 
 static uint64_t zap_allocate_blocks(zap_t *zap, int nblocks);
@@ -86,6 +104,7 @@ fzap_upgrade(zap_t *zap, dmu_tx_t *tx, zap_flags_t flags)
 
 	mutex_init(&zap->zap_f.zap_num_entries_mtx, 0, 0, 0);
 	zap->zap_f.zap_block_shift = highbit64(zap->zap_dbuf->db_size) - 1;
+	zap->zap_f.zap_ptrtbl_cache = NULL;
 
 	zp = zap_f_phys(zap);
 	/*
@@ -125,6 +144,16 @@ fzap_upgrade(zap_t *zap, dmu_tx_t *tx, zap_flags_t flags)
 	dmu_buf_rele(db, FTAG);
 }
 
+void
+fzap_evict(zap_t *zap)
+{
+	if (zap->zap_f.zap_ptrtbl_cache != NULL) {
+		kmem_free(zap->zap_f.zap_ptrtbl_cache,
+		    ZAP_PTRTBL_CACHE_SIZE * sizeof (uint64_t));
+	}
+	mutex_destroy(&zap->zap_f.zap_num_entries_mtx);
+}
+
 static int
 zap_tryupgradedir(zap_t *zap, dmu_tx_t *tx)
 {
@@ -316,6 +345,17 @@ zap_table_load(zap_t *zap, zap_table_phys_t *tbl, uint64_t idx, uint64_t *valp)
  * Routines for growing the ptrtbl.
  */
 
+static void
+zap_ptrtbl_cache_clear(zap_t *zap)
+{
+	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+
+	if (zap->zap_f.zap_ptrtbl_cache != NULL) {
+		bzero(zap->zap_f.zap_ptrtbl_cache,
+		    ZAP_PTRTBL_CACHE_SIZE * sizeof (uint64_t));
+	}
+}
+
 static void
 zap_ptrtbl_transfer(const uint64_t *src, uint64_t *dst, int n)
 {
@@ -339,6 +379,8 @@ zap_grow_ptrtbl(zap_t *zap, dmu_tx_t *tx)
 	if (zap_f_phys(zap)->zap_ptrtbl.zt_shift >= zap_hashbits(zap) - 2)
 		return (SET_ERROR(ENOSPC));
 
+	zap_ptrtbl_cache_clear(zap);
+
 	if (zap_f_phys(zap)->zap_ptrtbl.zt_numblks == 0) {
 		/*
 		 * We are outgrowing the "embedded" ptrtbl (the one
@@ -565,6 +607,10 @@ zap_get_leaf_byblk(zap_t *zap, uint64_t blkid, dmu_tx_t *tx, krw_t lt,
 static int
 zap_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t *valp)
 {
+	volatile uint64_t *cache;
+	uint64_t tag, ent;
+	int err;
+
 	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
 	if (zap_f_phys(zap)->zap_ptrtbl.zt_numblks == 0) {
@@ -572,10 +618,36 @@ zap_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t *valp)
 		    (1ULL << zap_f_phys(zap)->zap_ptrtbl.zt_shift));
 		*valp = ZAP_EMBEDDED_PTRTBL_ENT(zap, idx);
 		return (0);
-	} else {
-		return (zap_table_load(zap, &zap_f_phys(zap)->zap_ptrtbl,
-		    idx, valp));
 	}
+
+	if ((cache = zap->zap_f.zap_ptrtbl_cache) == NULL) {
+		uint64_t *new = kmem_zalloc(ZAP_PTRTBL_CACHE_SIZE *
+		    sizeof (uint64_t), KM_SLEEP);
+
+		if (atomic_cas_ptr(&zap->zap_f.zap_ptrtbl_cache, NULL,
+		    new) != NULL) {
+			kmem_free(new,
+			    ZAP_PTRTBL_CACHE_SIZE * sizeof (uint64_t));
+		}
+		cache = zap->zap_f.zap_ptrtbl_cache;
+	}
+
+	tag = idx >> ZAP_PTRTBL_CACHE_SHIFT;
+	cache += idx & (ZAP_PTRTBL_CACHE_SIZE - 1);
+	ent = *cache;
+	if ((ent & 1) != 0 &&
+	    ((ent >> 1) & ((1ULL << ZAP_PTRTBL_CACHE_TAGBITS) - 1)) == tag) {
+		*valp = ent >> (ZAP_PTRTBL_CACHE_TAGBITS + 1);
+		return (0);
+	}
+
+	err = zap_table_load(zap, &zap_f_phys(zap)->zap_ptrtbl, idx, valp);
+	if (err == 0 && tag < (1ULL << ZAP_PTRTBL_CACHE_TAGBITS) &&
+	    *valp < (1ULL << ZAP_PTRTBL_CACHE_BLKBITS)) {
+		*cache = (*valp << (ZAP_PTRTBL_CACHE_TAGBITS + 1)) |
+		    (tag << 1) | 1;
+	}
+	return (err);
 }
 
 static int
@@ -584,6 +656,7 @@ zap_set_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t blk, dmu_tx_t *tx)
 	ASSERT(tx != NULL);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
 
+	zap_ptrtbl_cache_clear(zap);
 	if (zap_f_phys(zap)->zap_ptrtbl.zt_blk == 0) {
 		ZAP_EMBEDDED_PTRTBL_ENT(zap, idx) = blk;
 		return (0);
@@ -721,12 +794,26 @@ zap_put_leaf_maybe_grow_ptrtbl(zap_name_t *zn, zap_leaf_t *l,
 
 	zap_put_leaf(l);
 
-	if (leaffull || zap_f_phys(zap)->zap_ptrtbl.zt_nextblk) {
+	/*
+	 * Adds and removes only hold the zap as reader, and lock the leaf
+	 * they modify, so that updates of different leaves can proceed in
+	 * parallel.  A pointer table copy which is already under way is only
+	 * pushed along when we can become the writer without waiting: it is
+	 * not urgent, since zap_expand_leaf() finishes it itself if a leaf
+	 * must split, and waiting would stall every other update of the zap.
+	 */
+	if (!leaffull && zap_f_phys(zap)->zap_ptrtbl.zt_nextblk) {
+		if (zap_tryupgradedir(zap, tx) != 0 &&
+		    zap_f_phys(zap)->zap_ptrtbl.zt_shift == shift)
+			(void) zap_grow_ptrtbl(zap, tx);
+		return;
+	}
+
+	if (leaffull) {
 		int err;
 
 		/*
-		 * We are in the middle of growing the pointer table, or
-		 * this leaf will soon make us grow it.
+		 * This leaf will soon make us grow the pointer table.
 		 */
 		if (zap_tryupgradedir(zap, tx) == 0) {
 			objset_t *os = zap->zap_objset;
@@ -1159,6 +1246,15 @@ zap_lookup_int_key(objset_t *os, uint64_t obj, uint64_t key, uint64_t *valuep)
 	return (zap_lookup(os, obj, name, 8, 1, valuep));
 }
 
+int
+zap_remove_int_key(objset_t *os, uint64_t obj, uint64_t key, dmu_tx_t *tx)
+{
+	char name[20];
+
+	(void) snprintf(name, sizeof (name), "%llx", (longlong_t)key);
+	return (zap_remove(os, obj, name, tx));
+}
+
 int
 zap_increment(objset_t *os, uint64_t obj, const char *name, int64_t delta,
     dmu_tx_t *tx)
@@ -1194,6 +1290,40 @@ zap_increment_int(objset_t *os, uint64_t obj, uint64_t key, int64_t delta,
  * Routines for iterating over the attributes.
  */
 
+/*
+ * Prefetch the leaves following l in hash order, up to
+ * zap_cursor_prefetch_leaves of them, skipping those an earlier call
+ * already prefetched.
+ */
+static void
+fzap_cursor_prefetch(zap_t *zap, zap_cursor_t *zc, zap_leaf_t *l)
+{
+	int shift = zap_f_phys(zap)->zap_ptrtbl.zt_shift;
+	int prefix_len = zap_leaf_phys(l)->l_hdr.lh_prefix_len;
+	int bs = FZAP_BLOCK_SHIFT(zap);
+	uint64_t idx, end, blk, lastblk = l->l_blkid;
+	int n = 0;
+
+	if (zc->zc_prefetch_hash == -1ULL || shift == 0)
+		return;
+
+	end = 1ULL << shift;
+	idx = (zap_leaf_phys(l)->l_hdr.lh_prefix + 1) << (shift - prefix_len);
+	for (; idx < end && n < zap_cursor_prefetch_leaves; idx++) {
+		if (zap_idx_to_blk(zap, idx, &blk) != 0)
+			return;
+		if (blk == lastblk)
+			continue;
+		lastblk = blk;
+		n++;
+		if ((idx << (64 - shift)) < zc->zc_prefetch_hash)
+			continue;
+		dmu_prefetch(zap->zap_objset, zap->zap_object, 0,
+		    blk << bs, 1ULL << bs, ZIO_PRIORITY_ASYNC_READ);
+	}
+	zc->zc_prefetch_hash = (idx < end) ? idx << (64 - shift) : -1ULL;
+}
+
 int
 fzap_cursor_retrieve(zap_t *zap, zap_cursor_t *zc, zap_attribute_t *za)
 {
@@ -1219,6 +1349,8 @@ again:
 		    &zc->zc_leaf);
 		if (err != 0)
 			return (err);
+		if (zc->zc_prefetch)
+			fzap_cursor_prefetch(zap, zc, zc->zc_leaf);
 	} else {
 		rw_enter(&zc->zc_leaf->l_rwlock, RW_READER);
 	}
@@ -36,11 +36,19 @@
 #include <sys/avl.h>
 #include <sys/arc.h>
 #include <sys/dmu_objset.h>
+#include <sys/dsl_dataset.h>
 
 #ifdef _KERNEL
 #include <sys/sunddi.h>
 #endif
 
+/*
+ * Largest size a microzap may grow to before it is upgraded to a fat zap.
+ * Only honored above MZAP_MAX_BLKSZ in datasets which already use large
+ * blocks, whose send streams need large block support anyway.
+ */
+int zap_micro_max_size = MZAP_MAX_BLKSZ;
+
 extern inline mzap_phys_t *zap_m_phys(zap_t *zap);
 
 static int mzap_upgrade(zap_t **zapp,
@@ -175,11 +183,14 @@ zap_name_free(zap_name_t *zn)
 	kmem_free(zn, sizeof (zap_name_t));
 }
 
-zap_name_t *
-zap_name_alloc(zap_t *zap, const char *key, matchtype_t mt)
+/*
+ * Set up zn for a string key.  Returns nonzero if the key can't be
+ * normalized, or mt asks for normalization the zap doesn't do.
+ */
+static int
+zap_name_init_str(zap_name_t *zn, zap_t *zap, const char *key,
+    matchtype_t mt)
 {
-	zap_name_t *zn = kmem_alloc(sizeof (zap_name_t), KM_SLEEP);
-
 	zn->zn_zap = zap;
 	zn->zn_key_intlen = sizeof (*key);
 	zn->zn_key_orig = key;
@@ -201,17 +212,13 @@ zap_name_alloc(zap_t *zap, const char *key, matchtype_t mt)
 		 * what the hash is computed from.
 		 */
 		if (zap_normalize(zap, key, zn->zn_normbuf,
-		    zap->zap_normflags) != 0) {
-			zap_name_free(zn);
-			return (NULL);
-		}
+		    zap->zap_normflags) != 0)
+			return (SET_ERROR(ENOTSUP));
 		zn->zn_key_norm = zn->zn_normbuf;
 		zn->zn_key_norm_numints = strlen(zn->zn_key_norm) + 1;
 	} else {
-		if (mt != 0) {
-			zap_name_free(zn);
-			return (NULL);
-		}
+		if (mt != 0)
+			return (SET_ERROR(ENOTSUP));
 		zn->zn_key_norm = zn->zn_key_orig;
 		zn->zn_key_norm_numints = zn->zn_key_orig_numints;
 	}
@@ -224,13 +231,23 @@ zap_name_alloc(zap_t *zap, const char *key, matchtype_t mt)
 		 * what the matching is based on.  (Not the hash!)
 		 */
 		if (zap_normalize(zap, key, zn->zn_normbuf,
-		    zn->zn_normflags) != 0) {
-			zap_name_free(zn);
-			return (NULL);
-		}
+		    zn->zn_normflags) != 0)
+			return (SET_ERROR(ENOTSUP));
 		zn->zn_key_norm_numints = strlen(zn->zn_key_norm) + 1;
 	}
 
+	return (0);
+}
+
+zap_name_t *
+zap_name_alloc(zap_t *zap, const char *key, matchtype_t mt)
+{
+	zap_name_t *zn = kmem_alloc(sizeof (zap_name_t), KM_SLEEP);
+
+	if (zap_name_init_str(zn, zap, key, mt) != 0) {
+		zap_name_free(zn);
+		return (NULL);
+	}
 	return (zn);
 }
 
@@ -250,6 +267,18 @@ zap_name_alloc_uint64(zap_t *zap, const uint64_t *key, int numints)
 	return (zn);
 }
 
+uint64_t
+zap_get_micro_max_size(objset_t *os)
+{
+	dsl_dataset_t *ds = (os != NULL) ? dmu_objset_ds(os) : NULL;
+	uint64_t max = MIN(zap_micro_max_size, MZAP_MAX_BLKSZ_LARGE);
+
+	if (max <= MZAP_MAX_BLKSZ || ds == NULL ||
+	    !ds->ds_feature_inuse[SPA_FEATURE_LARGE_BLOCKS])
+		return (MZAP_MAX_BLKSZ);
+	return (MIN(max, spa_maxblocksize(dmu_objset_spa(os))));
+}
+
 static void
 mzap_byteswap(mzap_phys_t *buf, size_t size)
 {
@@ -299,28 +328,30 @@ mze_compare(const void *arg1, const void *arg2)
 }
 
 static void
-mze_insert(zap_t *zap, int chunkid, uint64_t hash)
+mze_insert(zap_t *zap, uint16_t chunkid, uint64_t hash)
 {
-	mzap_ent_t *mze;
+	mzap_ent_t mze;
 
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
 
-	mze = kmem_alloc(sizeof (mzap_ent_t), KM_SLEEP);
-	mze->mze_chunkid = chunkid;
-	mze->mze_hash = hash;
-	mze->mze_cd = MZE_PHYS(zap, mze)->mze_cd;
-	ASSERT(MZE_PHYS(zap, mze)->mze_name[0] != 0);
-	avl_add(&zap->zap_m.zap_avl, mze);
+	mze.mze_chunkid = chunkid;
+	mze.mze_hash = hash;
+	mze.mze_cd = MZE_PHYS(zap, &mze)->mze_cd;
+	ASSERT(MZE_PHYS(zap, &mze)->mze_name[0] != 0);
+	zfs_btree_add(&zap->zap_m.zap_tree, &mze);
 }
 
+/*
+ * Find the entry matching zn, and its position in zap_tree.  The entry
+ * and position are only valid until zap_tree is next changed.
+ */
 static mzap_ent_t *
-mze_find(zap_name_t *zn)
+mze_find(zap_name_t *zn, zfs_btree_index_t *idx)
 {
 	mzap_ent_t mze_tofind;
 	mzap_ent_t *mze;
-	avl_index_t idx;
-	avl_tree_t *avl = &zn->zn_zap->zap_m.zap_avl;
+	zfs_btree_t *tree = &zn->zn_zap->zap_m.zap_tree;
 
 	ASSERT(zn->zn_zap->zap_ismicro);
 	ASSERT(RW_LOCK_HELD(&zn->zn_zap->zap_rwlock));
@@ -328,10 +359,11 @@ mze_find(zap_name_t *zn)
 	mze_tofind.mze_hash = zn->zn_hash;
 	mze_tofind.mze_cd = 0;
 
-	mze = avl_find(avl, &mze_tofind, &idx);
+	mze = zfs_btree_find(tree, &mze_tofind, idx);
 	if (mze == NULL)
-		mze = avl_nearest(avl, idx, AVL_AFTER);
-	for (; mze && mze->mze_hash == zn->zn_hash; mze = AVL_NEXT(avl, mze)) {
+		mze = zfs_btree_next(tree, idx, idx);
+	for (; mze && mze->mze_hash == zn->zn_hash;
+	    mze = zfs_btree_next(tree, idx, idx)) {
 		ASSERT3U(mze->mze_cd, ==, MZE_PHYS(zn->zn_zap, mze)->mze_cd);
 		if (zap_match(zn, MZE_PHYS(zn->zn_zap, mze)->mze_name))
 			return (mze);
@@ -345,8 +377,8 @@ mze_find_unused_cd(zap_t *zap, uint64_t hash)
 {
 	mzap_ent_t mze_tofind;
 	mzap_ent_t *mze;
-	avl_index_t idx;
-	avl_tree_t *avl = &zap->zap_m.zap_avl;
+	zfs_btree_index_t idx;
+	zfs_btree_t *tree = &zap->zap_m.zap_tree;
 	uint32_t cd;
 
 	ASSERT(zap->zap_ismicro);
@@ -356,8 +388,9 @@ mze_find_unused_cd(zap_t *zap, uint64_t hash)
 	mze_tofind.mze_cd = 0;
 
 	cd = 0;
-	for (mze = avl_find(avl, &mze_tofind, &idx);
-	    mze && mze->mze_hash == hash; mze = AVL_NEXT(avl, mze)) {
+	for (mze = zfs_btree_find(tree, &mze_tofind, &idx);
+	    mze && mze->mze_hash == hash;
+	    mze = zfs_btree_next(tree, &idx, &idx)) {
 		if (mze->mze_cd != cd)
 			break;
 		cd++;
@@ -367,24 +400,19 @@ mze_find_unused_cd(zap_t *zap, uint64_t hash)
 }
 
 static void
-mze_remove(zap_t *zap, mzap_ent_t *mze)
+mze_remove(zap_t *zap, zfs_btree_index_t *idx)
 {
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
 
-	avl_remove(&zap->zap_m.zap_avl, mze);
-	kmem_free(mze, sizeof (mzap_ent_t));
+	zfs_btree_remove_idx(&zap->zap_m.zap_tree, idx);
 }
 
 static void
 mze_destroy(zap_t *zap)
 {
-	mzap_ent_t *mze;
-	void *avlcookie = NULL;
-
-	while ((mze = avl_destroy_nodes(&zap->zap_m.zap_avl, &avlcookie)))
-		kmem_free(mze, sizeof (mzap_ent_t));
-	avl_destroy(&zap->zap_m.zap_avl);
+	zfs_btree_clear(&zap->zap_m.zap_tree);
+	zfs_btree_destroy(&zap->zap_m.zap_tree);
 }
 
 static zap_t *
@@ -429,24 +457,25 @@ mzap_open(objset_t *os, uint64_t obj, dmu_buf_t *db)
 		goto handle_winner;
 
 	if (zap->zap_ismicro) {
+		zap_name_t *zn = kmem_alloc(sizeof (zap_name_t), KM_SLEEP);
+
 		zap->zap_salt = zap_m_phys(zap)->mz_salt;
 		zap->zap_normflags = zap_m_phys(zap)->mz_normflags;
 		zap->zap_m.zap_num_chunks = db->db_size / MZAP_ENT_LEN - 1;
-		avl_create(&zap->zap_m.zap_avl, mze_compare,
-		    sizeof (mzap_ent_t), offsetof(mzap_ent_t, mze_node));
+		zfs_btree_create(&zap->zap_m.zap_tree, mze_compare,
+		    sizeof (mzap_ent_t));
 
 		for (i = 0; i < zap->zap_m.zap_num_chunks; i++) {
 			mzap_ent_phys_t *mze =
 			    &zap_m_phys(zap)->mz_chunk[i];
 			if (mze->mze_name[0]) {
-				zap_name_t *zn;
-
 				zap->zap_m.zap_num_entries++;
-				zn = zap_name_alloc(zap, mze->mze_name, 0);
+				VERIFY0(zap_name_init_str(zn, zap,
+				    mze->mze_name, 0));
 				mze_insert(zap, i, zn->zn_hash);
-				zap_name_free(zn);
 			}
 		}
+		zap_name_free(zn);
 	} else {
 		zap->zap_salt = zap_f_phys(zap)->zap_salt;
 		zap->zap_normflags = zap_f_phys(zap)->zap_normflags;
@@ -477,7 +506,7 @@ handle_winner:
 	rw_exit(&zap->zap_rwlock);
 	rw_destroy(&zap->zap_rwlock);
 	if (!zap->zap_ismicro)
-		mutex_destroy(&zap->zap_f.zap_num_entries_mtx);
+		fzap_evict(zap);
 	kmem_free(zap, sizeof (zap_t));
 	return (winner);
 }
@@ -542,7 +571,7 @@ zap_lockdir_impl(dmu_buf_t *db, void *tag, dmu_tx_t *tx,
 	if (zap->zap_ismicro && tx && adding &&
 	    zap->zap_m.zap_num_entries == zap->zap_m.zap_num_chunks) {
 		uint64_t newsz = db->db_size + SPA_MINBLOCKSIZE;
-		if (newsz > MZAP_MAX_BLKSZ) {
+		if (newsz > zap_get_micro_max_size(os)) {
 			dprintf("upgrading obj %llu: num_entries=%u\n",
 			    obj, zap->zap_m.zap_num_entries);
 			*zapp = zap;
@@ -627,7 +656,7 @@ mzap_upgrade(zap_t **zapp, void *tag, dmu_tx_t *tx, zap_flags_t flags)
 
 	dprintf("upgrading obj=%llu with %u chunks\n",
 	    zap->zap_object, nchunks);
-	/* XXX destroy the avl later, so we can use the stored hash value */
+	/* XXX destroy the tree later, so we can use the stored hash value */
 	mze_destroy(zap);
 
 	fzap_upgrade(zap, tx, flags);
@@ -715,10 +744,20 @@ int
 zap_create_claim_norm(objset_t *os, uint64_t obj, int normflags,
     dmu_object_type_t ot,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+{
+	return (zap_create_claim_norm_dnsize(os, obj, normflags, ot,
+	    bonustype, bonuslen, 0, tx));
+}
+
+int
+zap_create_claim_norm_dnsize(objset_t *os, uint64_t obj, int normflags,
+    dmu_object_type_t ot, dmu_object_type_t bonustype, int bonuslen,
+    int dnodesize, dmu_tx_t *tx)
 {
 	int err;
 
-	err = dmu_object_claim(os, obj, ot, 0, bonustype, bonuslen, tx);
+	err = dmu_object_claim_dnsize(os, obj, ot, 0, bonustype, bonuslen,
+	    dnodesize, tx);
 	if (err != 0)
 		return (err);
 	mzap_create_impl(os, obj, normflags, 0, tx);
@@ -736,7 +775,16 @@ uint64_t
 zap_create_norm(objset_t *os, int normflags, dmu_object_type_t ot,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
 {
-	uint64_t obj = dmu_object_alloc(os, ot, 0, bonustype, bonuslen, tx);
+	return (zap_create_norm_dnsize(os, normflags, ot, bonustype,
+	    bonuslen, 0, tx));
+}
+
+uint64_t
+zap_create_norm_dnsize(objset_t *os, int normflags, dmu_object_type_t ot,
+    dmu_object_type_t bonustype, int bonuslen, int dnodesize, dmu_tx_t *tx)
+{
+	uint64_t obj = dmu_object_alloc_dnsize(os, ot, 0, bonustype, bonuslen,
+	    dnodesize, tx);
 
 	mzap_create_impl(os, obj, normflags, 0, tx);
 	return (obj);
@@ -783,7 +831,7 @@ zap_evict_sync(void *dbu)
 	if (zap->zap_ismicro)
 		mze_destroy(zap);
 	else
-		mutex_destroy(&zap->zap_f.zap_num_entries_mtx);
+		fzap_evict(zap);
 
 	kmem_free(zap, sizeof (zap_t));
 }
@@ -811,19 +859,24 @@ zap_count(objset_t *os, uint64_t zapobj, uint64_t *count)
  * See also the comment above zap_entry_normalization_conflict().
  */
 static boolean_t
-mzap_normalization_conflict(zap_t *zap, zap_name_t *zn, mzap_ent_t *mze)
+mzap_normalization_conflict(zap_t *zap, zap_name_t *zn, mzap_ent_t *mze,
+    zfs_btree_index_t *idx)
 {
+	zfs_btree_t *tree = &zap->zap_m.zap_tree;
+	zfs_btree_index_t oidx;
 	mzap_ent_t *other;
-	int direction = AVL_BEFORE;
+	boolean_t before = B_TRUE;
 	boolean_t allocdzn = B_FALSE;
 
 	if (zap->zap_normflags == 0)
 		return (B_FALSE);
 
 again:
-	for (other = avl_walk(&zap->zap_m.zap_avl, mze, direction);
+	for (other = before ? zfs_btree_prev(tree, idx, &oidx) :
+	    zfs_btree_next(tree, idx, &oidx);
 	    other && other->mze_hash == mze->mze_hash;
-	    other = avl_walk(&zap->zap_m.zap_avl, other, direction)) {
+	    other = before ? zfs_btree_prev(tree, &oidx, &oidx) :
+	    zfs_btree_next(tree, &oidx, &oidx)) {
 
 		if (zn == NULL) {
 			zn = zap_name_alloc(zap, MZE_PHYS(zap, mze)->mze_name,
@@ -837,8 +890,8 @@ again:
 		}
 	}
 
-	if (direction == AVL_BEFORE) {
-		direction = AVL_AFTER;
+	if (before) {
+		before = B_FALSE;
 		goto again;
 	}
 
@@ -867,6 +920,7 @@ zap_lookup_impl(zap_t *zap, const char *name,
 {
 	int err = 0;
 	mzap_ent_t *mze;
+	zfs_btree_index_t idx;
 	zap_name_t *zn;
 
 	zn = zap_name_alloc(zap, name, mt);
@@ -877,7 +931,7 @@ zap_lookup_impl(zap_t *zap, const char *name,
 		err = fzap_lookup(zn, integer_size, num_integers, buf,
 		    realname, rn_len, ncp);
 	} else {
-		mze = mze_find(zn);
+		mze = mze_find(zn, &idx);
 		if (mze == NULL) {
 			err = SET_ERROR(ENOENT);
 		} else {
@@ -892,7 +946,7 @@ zap_lookup_impl(zap_t *zap, const char *name,
 				    MZE_PHYS(zap, mze)->mze_name, rn_len);
 				if (ncp) {
 					*ncp = mzap_normalization_conflict(zap,
-					    zn, mze);
+					    zn, mze, &idx);
 				}
 			}
 		}
@@ -1010,6 +1064,7 @@ zap_length(objset_t *os, uint64_t zapobj, const char *name,
 	zap_t *zap;
 	int err;
 	mzap_ent_t *mze;
+	zfs_btree_index_t idx;
 	zap_name_t *zn;
 
 	err = zap_lockdir(os, zapobj, NULL, RW_READER, TRUE, FALSE, FTAG, &zap);
@@ -1023,7 +1078,7 @@ zap_length(objset_t *os, uint64_t zapobj, const char *name,
 	if (!zap->zap_ismicro) {
 		err = fzap_length(zn, integer_size, num_integers);
 	} else {
-		mze = mze_find(zn);
+		mze = mze_find(zn, &idx);
 		if (mze == NULL) {
 			err = SET_ERROR(ENOENT);
 		} else {
@@ -1112,6 +1167,7 @@ zap_add_impl(zap_t *zap, const char *key,
 {
 	int err = 0;
 	mzap_ent_t *mze;
+	zfs_btree_index_t idx;
 	const uint64_t *intval = val;
 	zap_name_t *zn;
 
@@ -1132,7 +1188,7 @@ zap_add_impl(zap_t *zap, const char *key,
 		}
 		zap = zn->zn_zap;	/* fzap_add() may change zap */
 	} else {
-		mze = mze_find(zn);
+		mze = mze_find(zn, &idx);
 		if (mze != NULL) {
 			err = SET_ERROR(EEXIST);
 		} else {
@@ -1209,6 +1265,7 @@ zap_update(objset_t *os, uint64_t zapobj, const char *name,
 {
 	zap_t *zap;
 	mzap_ent_t *mze;
+	zfs_btree_index_t idx;
 	const uint64_t *intval = val;
 	zap_name_t *zn;
 	int err;
@@ -1247,7 +1304,7 @@ zap_update(objset_t *os, uint64_t zapobj, const char *name,
 		}
 		zap = zn->zn_zap;	/* fzap_update() may change zap */
 	} else {
-		mze = mze_find(zn);
+		mze = mze_find(zn, &idx);
 		if (mze != NULL) {
             //			ASSERT3U(MZE_PHYS(zap, mze)->mze_value, ==, oldval);
 			MZE_PHYS(zap, mze)->mze_value = *intval;
@@ -1298,6 +1355,7 @@ zap_remove_impl(zap_t *zap, const char *name,
     matchtype_t mt, dmu_tx_t *tx)
 {
 	mzap_ent_t *mze;
+	zfs_btree_index_t idx;
 	zap_name_t *zn;
 	int err = 0;
 
@@ -1307,14 +1365,14 @@ zap_remove_impl(zap_t *zap, const char *name,
 	if (!zap->zap_ismicro) {
 		err = fzap_remove(zn, tx);
 	} else {
-		mze = mze_find(zn);
+		mze = mze_find(zn, &idx);
 		if (mze == NULL) {
 			err = SET_ERROR(ENOENT);
 		} else {
 			zap->zap_m.zap_num_entries--;
 			bzero(&zap_m_phys(zap)->mz_chunk[mze->mze_chunkid],
 			    sizeof (mzap_ent_phys_t));
-			mze_remove(zap, mze);
+			mze_remove(zap, &idx);
 		}
 	}
 	zap_name_free(zn);
@@ -1387,6 +1445,16 @@ zap_cursor_init_serialized(zap_cursor_t *zc, objset_t *os, uint64_t zapobj,
 	zc->zc_serialized = serialized;
 	zc->zc_hash = 0;
 	zc->zc_cd = 0;
+	zc->zc_prefetch = B_FALSE;
+	zc->zc_prefetch_hash = 0;
+}
+
+void
+zap_cursor_init_prefetch(zap_cursor_t *zc, objset_t *os, uint64_t zapobj,
+    uint64_t serialized)
+{
+	zap_cursor_init_serialized(zc, os, zapobj, serialized);
+	zc->zc_prefetch = B_TRUE;
 }
 
 void
@@ -1437,7 +1505,7 @@ int
 zap_cursor_retrieve(zap_cursor_t *zc, zap_attribute_t *za)
 {
 	int err;
-	avl_index_t idx;
+	zfs_btree_index_t idx;
 	mzap_ent_t mze_tofind;
 	mzap_ent_t *mze;
 
@@ -1471,16 +1539,18 @@ zap_cursor_retrieve(zap_cursor_t *zc, zap_attribute_t *za)
 		mze_tofind.mze_hash = zc->zc_hash;
 		mze_tofind.mze_cd = zc->zc_cd;
 
-		mze = avl_find(&zc->zc_zap->zap_m.zap_avl, &mze_tofind, &idx);
+		mze = zfs_btree_find(&zc->zc_zap->zap_m.zap_tree,
+		    &mze_tofind, &idx);
 		if (mze == NULL) {
-			mze = avl_nearest(&zc->zc_zap->zap_m.zap_avl,
-			    idx, AVL_AFTER);
+			mze = zfs_btree_next(&zc->zc_zap->zap_m.zap_tree,
+			    &idx, &idx);
 		}
 		if (mze) {
 			mzap_ent_phys_t *mzep = MZE_PHYS(zc->zc_zap, mze);
 			ASSERT3U(mze->mze_cd, ==, mzep->mze_cd);
 			za->za_normalization_conflict =
-			    mzap_normalization_conflict(zc->zc_zap, NULL, mze);
+			    mzap_normalization_conflict(zc->zc_zap, NULL,
+			    mze, &idx);
 			za->za_integer_length = 8;
 			za->za_num_integers = 1;
 			za->za_first_integer = mzep->mze_value;
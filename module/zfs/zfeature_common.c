@@ -279,4 +279,51 @@ zpool_feature_init(void)
 		"org.illumos:edonr", "edonr",
 	    "Edon-R hash algorithm.",
 	    ZFEATURE_FLAG_PER_DATASET, edonr_deps);
+
+	static const spa_feature_t zstd_deps[] = {
+		SPA_FEATURE_EXTENSIBLE_DATASET,
+		SPA_FEATURE_NONE
+	};
+	zfeature_register(SPA_FEATURE_ZSTD_COMPRESS,
+	    "org.openzfsonosx:zstd_compress", "zstd_compress",
+	    "zstd compression algorithm support.",
+	    ZFEATURE_FLAG_PER_DATASET, zstd_deps);
+
+	static const spa_feature_t encryption_deps[] = {
+		SPA_FEATURE_EXTENSIBLE_DATASET,
+		SPA_FEATURE_NONE
+	};
+	zfeature_register(SPA_FEATURE_ENCRYPTION,
+	    "org.openzfsonosx:encryption", "encryption",
+	    "Dataset level encryption.",
+	    ZFEATURE_FLAG_PER_DATASET, encryption_deps);
+
+	zfeature_register(SPA_FEATURE_LOG_SPACEMAP,
+	    "org.openzfsonosx:log_spacemap", "log_spacemap",
+	    "Log metaslab changes on a space map per top-level vdev and "
+	    "flush them periodically.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, NULL);
+
+	static const spa_feature_t large_dnode_deps[] = {
+		SPA_FEATURE_EXTENSIBLE_DATASET,
+		SPA_FEATURE_NONE
+	};
+	zfeature_register(SPA_FEATURE_LARGE_DNODE,
+	    "org.zfsonlinux:large_dnode", "large_dnode",
+	    "Variable on-disk size of dnodes.",
+	    ZFEATURE_FLAG_PER_DATASET, large_dnode_deps);
+
+	zfeature_register(SPA_FEATURE_ALLOCATION_CLASSES,
+	    "org.openzfsonosx:allocation_classes", "allocation_classes",
+	    "Support for separate allocation classes.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, NULL);
+
+	static const spa_feature_t inline_data_deps[] = {
+		SPA_FEATURE_EXTENSIBLE_DATASET,
+		SPA_FEATURE_NONE
+	};
+	zfeature_register(SPA_FEATURE_INLINE_DATA,
+	    "org.openzfsonosx:inline_data", "inline_data",
+	    "Small file data stored in the dnode bonus buffer.",
+	    ZFEATURE_FLAG_PER_DATASET, inline_data_deps);
 }
@@ -51,6 +51,7 @@
 #include <sys/dnode.h>
 #include <sys/zap.h>
 #include <sys/sa.h>
+#include <sys/atomic.h>
 //#include <acl/acl_common.h>
 
 #define	ALLOW	ACE_ACCESS_ALLOWED_ACE_TYPE
@@ -1240,6 +1241,7 @@ zfs_aclset_common(znode_t *zp, zfs_acl_t *aclp, cred_t *cr, dmu_tx_t *tx)
 		zfs_acl_free(zp->z_acl_cached);
 		zp->z_acl_cached = NULL;
 	}
+	zfs_acl_access_purge(zp);
 
 	/*
 	 * Upgrade needed?
@@ -2233,59 +2235,183 @@ zfs_zaccess_dataset_check(znode_t *zp, uint32_t v4_mode)
 }
 
 /*
- * The primary usage of this function is to loop through all of the
- * ACEs in the znode, determining what accesses of interest (AoI) to
- * the caller are allowed or denied.  The AoI are expressed as bits in
- * the working_mode parameter.  As each ACE is processed, bits covered
- * by that ACE are removed from the working_mode.  This removal
- * facilitates two things.  The first is that when the working mode is
- * empty (= 0), we know we've looked at all the AoI. The second is
- * that the ACE interpretation rules don't allow a later ACE to undo
- * something granted or denied by an earlier ACE.  Removing the
- * discovered access or denial enforces this rule.  At the end of
- * processing the ACEs, all AoI that were found to be denied are
- * placed into the working_mode, giving the caller a mask of denied
- * accesses.  Returns:
- *	0		if all AoI granted
- *	EACCES		if the denied mask is non-zero
- *	other error	if abnormal failure (e.g., IO error)
- *
- * A secondary usage of the function is to determine if any of the
- * AoI are granted.  If an ACE grants any access in
- * the working_mode, we immediately short circuit out of the function.
- * This mode is chosen by setting anyaccess to B_TRUE.  The
- * working_mode is not a denied access mask upon exit if the function
- * is used in this manner.
+ * Per-znode cache of ACL verdicts.  Evaluating an ACL walks every ACE
+ * and may resolve group membership through the identity service, which
+ * adds up when the same caller stats or opens many files in a row.  For
+ * each of a few recent credentials the cache keeps the permissions the
+ * ACL grants and denies outright; anything in neither mask is left to
+ * the privilege check, exactly as an uncached walk would.  Credentials
+ * are immutable, so an entry holds a reference and is matched on the
+ * pointer.  The owner and group are remembered as well, since OWNER@
+ * and GROUP@ entries depend on them.  Group membership is not part of
+ * the credential, though: kauth resolves it, and it can change while the
+ * credential lives on.  A verdict that consulted a group entry therefore
+ * expires after ZFS_ACCESS_CACHE_GROUP_TTL, no later than kauth's own
+ * membership cache would have noticed.  The whole cache is protected by
+ * z_acl_lock and is dropped whenever the ACL or mode is rewritten.
+ */
+#define	ZFS_ACCESS_CACHE_ENTRIES	4
+#define	ZFS_ACCESS_CACHE_GROUP_TTL	SEC_TO_TICK(1)
+
+typedef struct zfs_access_entry {
+	cred_t		*zae_cred;	/* held; NULL if empty */
+	uint64_t	zae_uid;	/* z_uid when evaluated */
+	uint64_t	zae_gid;	/* z_gid when evaluated */
+	uint32_t	zae_allow;	/* permissions granted */
+	uint32_t	zae_deny;	/* permissions denied */
+	clock_t		zae_expires;	/* lbolt it expires at; 0 if never */
+} zfs_access_entry_t;
+
+typedef struct zfs_access_cache {
+	uint32_t		zac_hand;	/* next slot to replace */
+	zfs_access_entry_t	zac_entry[ZFS_ACCESS_CACHE_ENTRIES];
+} zfs_access_cache_t;
+
+int zfs_acl_access_cache = 1;
+
+typedef struct zfs_acl_cache_stats {
+	kstat_named_t zacs_hits;
+	kstat_named_t zacs_misses;
+	kstat_named_t zacs_inserts;
+	kstat_named_t zacs_purges;
+} zfs_acl_cache_stats_t;
+
+static zfs_acl_cache_stats_t zfs_acl_cache_stats = {
+	{ "hits",			KSTAT_DATA_UINT64 },
+	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "inserts",			KSTAT_DATA_UINT64 },
+	{ "purges",			KSTAT_DATA_UINT64 },
+};
+
+#define	ZACSTAT_BUMP(stat) \
+	atomic_inc_64(&zfs_acl_cache_stats.stat.value.ui64)
+
+static kstat_t *zfs_acl_cache_ksp;
+
+static boolean_t
+zfs_acl_access_lookup(znode_t *zp, cred_t *cr, uint32_t *allowp,
+    uint32_t *denyp)
+{
+	zfs_access_cache_t *zac = zp->z_access_cache;
+	zfs_access_entry_t *zae;
+	int i;
+
+	ASSERT(MUTEX_HELD(&zp->z_acl_lock));
+
+	if (zac != NULL) {
+		for (i = 0; i < ZFS_ACCESS_CACHE_ENTRIES; i++) {
+			zae = &zac->zac_entry[i];
+			if (zae->zae_cred == cr &&
+			    zae->zae_uid == zp->z_uid &&
+			    zae->zae_gid == zp->z_gid &&
+			    (zae->zae_expires == 0 ||
+			    ddi_get_lbolt() < zae->zae_expires)) {
+				*allowp = zae->zae_allow;
+				*denyp = zae->zae_deny;
+				ZACSTAT_BUMP(zacs_hits);
+				return (B_TRUE);
+			}
+		}
+	}
+	ZACSTAT_BUMP(zacs_misses);
+	return (B_FALSE);
+}
+
+static void
+zfs_acl_access_enter(znode_t *zp, cred_t *cr, uint32_t allow, uint32_t deny,
+    boolean_t group)
+{
+	zfs_access_cache_t *zac;
+	zfs_access_entry_t *zae;
+
+	ASSERT(MUTEX_HELD(&zp->z_acl_lock));
+
+	if ((zac = zp->z_access_cache) == NULL) {
+		zac = kmem_zalloc(sizeof (zfs_access_cache_t), KM_SLEEP);
+		zp->z_access_cache = zac;
+	}
+
+	zae = &zac->zac_entry[zac->zac_hand++ % ZFS_ACCESS_CACHE_ENTRIES];
+	if (zae->zae_cred != NULL)
+		crfree(zae->zae_cred);
+	crhold(cr);
+	zae->zae_cred = cr;
+	zae->zae_uid = zp->z_uid;
+	zae->zae_gid = zp->z_gid;
+	zae->zae_allow = allow;
+	zae->zae_deny = deny;
+	zae->zae_expires = group ?
+	    MAX(ddi_get_lbolt() + ZFS_ACCESS_CACHE_GROUP_TTL, 1) : 0;
+	ZACSTAT_BUMP(zacs_inserts);
+}
+
+/*
+ * Forget every cached ACL verdict for zp.  The caller holds z_acl_lock,
+ * unless the znode can no longer be reached by anyone else.
+ */
+void
+zfs_acl_access_purge(znode_t *zp)
+{
+	zfs_access_cache_t *zac = zp->z_access_cache;
+	int i;
+
+	if (zac == NULL)
+		return;
+
+	zp->z_access_cache = NULL;
+	for (i = 0; i < ZFS_ACCESS_CACHE_ENTRIES; i++) {
+		if (zac->zac_entry[i].zae_cred != NULL)
+			crfree(zac->zac_entry[i].zae_cred);
+	}
+	kmem_free(zac, sizeof (zfs_access_cache_t));
+	ZACSTAT_BUMP(zacs_purges);
+}
+
+void
+zfs_acl_init(void)
+{
+	zfs_acl_cache_ksp = kstat_create("zfs", 0, "zfs_acl_cache", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zfs_acl_cache_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (zfs_acl_cache_ksp != NULL) {
+		zfs_acl_cache_ksp->ks_data = &zfs_acl_cache_stats;
+		kstat_install(zfs_acl_cache_ksp);
+	}
+}
+
+void
+zfs_acl_fini(void)
+{
+	if (zfs_acl_cache_ksp != NULL) {
+		kstat_delete(zfs_acl_cache_ksp);
+		zfs_acl_cache_ksp = NULL;
+	}
+}
+
+/*
+ * Walk the ACEs of zp on behalf of zfs_zaccess_aces_check(), with
+ * z_acl_lock held and the ACL already read.  Bits are cleared from
+ * working_mode as they are decided, and those denied are collected in
+ * denyp.  With anyaccess set, the first grant clears both masks.  groupp
+ * is set if the answer depended on a group membership check.
  */
 static int
-zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
-    boolean_t anyaccess, cred_t *cr)
+zfs_zaccess_aces_walk(znode_t *zp, zfs_acl_t *aclp, uid_t fowner,
+    uid_t gowner, uint32_t *working_mode, uint32_t *denyp,
+    boolean_t *groupp, boolean_t anyaccess, cred_t *cr)
 {
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
-	zfs_acl_t	*aclp;
-	int		error;
 	uid_t		uid = crgetuid(cr);
 	uint64_t 	who;
 	uint16_t	type, iflags;
 	uint16_t	entry_type;
 	uint32_t	access_mask;
-	uint32_t	deny_mask = 0;
 	zfs_ace_hdr_t	*acep = NULL;
 	boolean_t	checkit;
-	uid_t		gowner;
-	uid_t		fowner;
-
-	zfs_fuid_map_ids(zp, cr, &fowner, &gowner);
-
-	mutex_enter(&zp->z_acl_lock);
 
-	error = zfs_acl_node_read(zp, B_FALSE, &aclp, B_FALSE);
-	if (error != 0) {
-		mutex_exit(&zp->z_acl_lock);
-		return (error);
-	}
-
-	ASSERT(zp->z_acl_cached);
+	*denyp = 0;
+	*groupp = B_FALSE;
 
 	while ((acep = zfs_acl_next_ace(aclp, acep, &who, &access_mask,
                                     &iflags, &type))) {
@@ -2316,6 +2442,7 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 			/*FALLTHROUGH*/
 		case ACE_IDENTIFIER_GROUP:
 			checkit = zfs_groupmember(zfsvfs, who, cr);
+			*groupp = B_TRUE;
 			break;
 		case ACE_EVERYONE:
 			checkit = B_TRUE;
@@ -2333,7 +2460,6 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 					checkit = B_TRUE;
 				break;
 			} else {
-				mutex_exit(&zp->z_acl_lock);
 				return (SET_ERROR(EIO));
 			}
 		}
@@ -2344,14 +2470,15 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 				    znode_t *, zp,
 				    zfs_ace_hdr_t *, acep,
 				    uint32_t, mask_matched);
-				deny_mask |= mask_matched;
+				*denyp |= mask_matched;
 			} else {
 				DTRACE_PROBE3(zfs__ace__allows,
 				    znode_t *, zp,
 				    zfs_ace_hdr_t *, acep,
 				    uint32_t, mask_matched);
 				if (anyaccess) {
-					mutex_exit(&zp->z_acl_lock);
+					*working_mode = 0;
+					*denyp = 0;
 					return (0);
 				}
 			}
@@ -2363,8 +2490,90 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 			break;
 	}
 
+	return (0);
+}
+
+/*
+ * The primary usage of this function is to loop through all of the
+ * ACEs in the znode, determining what accesses of interest (AoI) to
+ * the caller are allowed or denied.  The AoI are expressed as bits in
+ * the working_mode parameter.  As each ACE is processed, bits covered
+ * by that ACE are removed from the working_mode.  This removal
+ * facilitates two things.  The first is that when the working mode is
+ * empty (= 0), we know we've looked at all the AoI. The second is
+ * that the ACE interpretation rules don't allow a later ACE to undo
+ * something granted or denied by an earlier ACE.  Removing the
+ * discovered access or denial enforces this rule.  At the end of
+ * processing the ACEs, all AoI that were found to be denied are
+ * placed into the working_mode, giving the caller a mask of denied
+ * accesses.  Returns:
+ *	0		if all AoI granted
+ *	EACCES		if the denied mask is non-zero
+ *	other error	if abnormal failure (e.g., IO error)
+ *
+ * A secondary usage of the function is to determine if any of the
+ * AoI are granted.  If an ACE grants any access in
+ * the working_mode, we immediately short circuit out of the function.
+ * This mode is chosen by setting anyaccess to B_TRUE.  The
+ * working_mode is not a denied access mask upon exit if the function
+ * is used in this manner.
+ */
+static int
+zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
+    boolean_t anyaccess, cred_t *cr)
+{
+	zfs_acl_t	*aclp;
+	int		error;
+	uint32_t	deny_mask = 0;
+	uint32_t	allow = 0, deny = 0, mode;
+	boolean_t	cacheit, group;
+	uid_t		gowner;
+	uid_t		fowner;
+
+	zfs_fuid_map_ids(zp, cr, &fowner, &gowner);
+
+	mutex_enter(&zp->z_acl_lock);
+
+	/*
+	 * Each permission is decided by the first ACE that matches it, so
+	 * a walk over all of them answers this and any later request from
+	 * the same credential.  The anyaccess probe stops at the first
+	 * grant and is left uncached.
+	 */
+	cacheit = (zfs_acl_access_cache && !anyaccess);
+	if (!cacheit || !zfs_acl_access_lookup(zp, cr, &allow, &deny)) {
+		error = zfs_acl_node_read(zp, B_FALSE, &aclp, B_FALSE);
+		if (error != 0) {
+			mutex_exit(&zp->z_acl_lock);
+			return (error);
+		}
+
+		ASSERT(zp->z_acl_cached);
+
+		mode = cacheit ? ACE_ALL_PERMS : *working_mode;
+		error = zfs_zaccess_aces_walk(zp, aclp, fowner, gowner,
+		    &mode, &deny, &group, anyaccess, cr);
+		if (error != 0) {
+			mutex_exit(&zp->z_acl_lock);
+			return (error);
+		}
+
+		if (cacheit) {
+			allow = ACE_ALL_PERMS & ~(mode | deny);
+			zfs_acl_access_enter(zp, cr, allow, deny, group);
+		} else {
+			*working_mode = mode;
+			deny_mask = deny;
+		}
+	}
+
 	mutex_exit(&zp->z_acl_lock);
 
+	if (cacheit) {
+		deny_mask = *working_mode & deny;
+		*working_mode &= ~(allow | deny);
+	}
+
 	/* Put the found 'denies' back on the working mode */
 	if (deny_mask) {
 		*working_mode |= deny_mask;
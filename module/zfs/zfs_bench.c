@@ -0,0 +1,456 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#include <sys/zfs_context.h>
+#include <sys/zfs_bench.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/rrwlock.h>
+#include <sys/abd.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
+#include <sys/zio_crypt.h>
+#include <sys/vdev_raidz.h>
+#include <zfs_fletcher.h>
+
+/*
+ * Writing a block size to this tunable runs the whole suite at that size;
+ * it reads as zero again once the run is done.
+ */
+int64_t zfs_bench_blocksize = 0;
+
+static kmutex_t zfs_bench_lock;
+static zfs_bench_result_t zfs_bench_data[ZFS_BENCH_RESULTS_MAX];
+static int zfs_bench_count = 0;
+static kstat_t *zfs_bench_kstat;
+
+/* Repeat stmt for at least ns, then set rate to bytes per second */
+#define	ZFS_BENCH_TIME(rate, blksz, ns, stmt)				\
+	do {								\
+		hrtime_t zb_start = gethrtime(), zb_elapsed;		\
+		uint64_t zb_runs = 0;					\
+									\
+		do {							\
+			stmt;						\
+			zb_runs++;					\
+		} while ((zb_elapsed = gethrtime() - zb_start) < (ns));	\
+		(rate) = (blksz) * zb_runs * NANOSEC / zb_elapsed;	\
+	} while (0)
+
+static void
+zfs_bench_add(const char *group, const char *name, const char *op,
+    uint64_t blksz, uint64_t rate)
+{
+	zfs_bench_result_t *zbr;
+
+	ASSERT(MUTEX_HELD(&zfs_bench_lock));
+
+	if (zfs_bench_count >= ZFS_BENCH_RESULTS_MAX)
+		return;
+
+	zbr = &zfs_bench_data[zfs_bench_count++];
+	(void) strlcpy(zbr->zbr_group, group, sizeof (zbr->zbr_group));
+	(void) strlcpy(zbr->zbr_name, name, sizeof (zbr->zbr_name));
+	(void) strlcpy(zbr->zbr_op, op, sizeof (zbr->zbr_op));
+	zbr->zbr_blksz = blksz;
+	zbr->zbr_rate = rate;
+}
+
+/*
+ * Random bytes, or with 'text' set bytes of four random bits each, which
+ * compress to about half their size.
+ */
+static void
+zfs_bench_fill(uint8_t *buf, uint64_t size, uint64_t *seed, boolean_t text)
+{
+	uint64_t i, x = *seed;
+
+	for (i = 0; i < size; i++) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = text ? 'a' + ((x >> 24) & 0xf) : x >> 24;
+	}
+	*seed = x;
+}
+
+static void
+zfs_bench_fletcher_4(uint8_t *data, uint64_t blksz, hrtime_t ns)
+{
+	const char *name;
+	uint64_t rate;
+	uint32_t id;
+
+	for (id = 0; (rate = fletcher_4_impl_bench(id, B_TRUE, data, blksz,
+	    ns, &name)) != 0; id++) {
+		zfs_bench_add("fletcher_4", name, "native", blksz, rate);
+		rate = fletcher_4_impl_bench(id, B_FALSE, data, blksz, ns,
+		    NULL);
+		zfs_bench_add("fletcher_4", name, "byteswap", blksz, rate);
+	}
+}
+
+static void
+zfs_bench_raidz(uint8_t **cols, uint64_t blksz, hrtime_t ns)
+{
+	static const char *ops[] = { "rec_mul_add", "gen_p", "gen_pq",
+	    "gen_pqr" };
+	const char *name;
+	uint64_t rate;
+	uint32_t id;
+	int parity;
+
+	for (id = 0; (rate = vdev_raidz_impl_bench(id, 0, cols, blksz, ns,
+	    &name)) != 0; id++) {
+		zfs_bench_add("raidz", name, ops[0], blksz, rate);
+		for (parity = 1; parity < ARRAY_SIZE(ops); parity++) {
+			rate = vdev_raidz_impl_bench(id, parity, cols, blksz,
+			    ns, NULL);
+			zfs_bench_add("raidz", name, ops[parity], blksz, rate);
+		}
+	}
+}
+
+/* Both rates are in bytes of uncompressed data per second */
+static void
+zfs_bench_compress(uint8_t *text, uint8_t *dst, uint8_t *out,
+    uint64_t blksz, hrtime_t ns)
+{
+	uint64_t rate;
+	size_t csize = blksz;
+	int c;
+
+	for (c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		zio_compress_info_t *ci = &zio_compress_table[c];
+
+		if (ci->ci_compress == NULL)
+			continue;
+
+		ZFS_BENCH_TIME(rate, blksz, ns,
+		    csize = ci->ci_compress(text, dst, blksz, blksz,
+		    ci->ci_level));
+		zfs_bench_add("compress", ci->ci_name, "compress", blksz,
+		    rate);
+
+		if (csize >= blksz || ci->ci_decompress == NULL)
+			continue;
+
+		ZFS_BENCH_TIME(rate, blksz, ns,
+		    (void) ci->ci_decompress(dst, out, csize, blksz,
+		    ci->ci_level));
+		zfs_bench_add("compress", ci->ci_name, "decompress", blksz,
+		    rate);
+	}
+}
+
+static void
+zfs_bench_checksum(uint8_t *data, uint64_t blksz, hrtime_t ns)
+{
+	zio_cksum_salt_t salt;
+	zio_cksum_t zc;
+	uint64_t rate;
+	abd_t *abd;
+	void *tmpl;
+	int c;
+
+	(void) random_get_pseudo_bytes(salt.zcs_bytes,
+	    sizeof (salt.zcs_bytes));
+	abd = abd_get_from_buf(data, blksz);
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		zio_checksum_info_t *ci = &zio_checksum_table[c];
+
+		/* Skip "off" and the aliases used for labels, gangs, ZIL */
+		if (ci->ci_func[0] == NULL || c == ZIO_CHECKSUM_OFF ||
+		    c == ZIO_CHECKSUM_NOPARITY ||
+		    (ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED))
+			continue;
+
+		tmpl = (ci->ci_tmpl_init != NULL) ?
+		    ci->ci_tmpl_init(&salt) : NULL;
+		ZFS_BENCH_TIME(rate, blksz, ns,
+		    ci->ci_func[0](abd, blksz, tmpl, &zc));
+		if (tmpl != NULL)
+			ci->ci_tmpl_free(tmpl);
+
+		zfs_bench_add("checksum", ci->ci_name, "native", blksz, rate);
+	}
+
+	abd_put(abd);
+}
+
+static void
+zfs_bench_crypt(uint8_t *plain, uint8_t *cipher, uint8_t *out,
+    uint64_t blksz, hrtime_t ns)
+{
+	uint8_t iv[ZIO_DATA_IV_LEN], mac[ZIO_DATA_MAC_LEN];
+	zio_crypt_key_t key;
+	uint64_t rate;
+	int c, err;
+
+	for (c = ZIO_CRYPT_AES_128_GCM; c < ZIO_CRYPT_FUNCTIONS; c++) {
+		const char *name = zio_crypt_table[c].ci_name;
+
+		err = 0;
+		if (zio_crypt_key_init(c, &key) != 0)
+			continue;
+
+		if (zio_crypt_generate_iv(iv) == 0) {
+			ZFS_BENCH_TIME(rate, blksz, ns,
+			    err |= zio_do_crypt_data(B_TRUE, &key,
+			    key.zk_salt, iv, mac, blksz, plain, cipher));
+			if (err == 0)
+				zfs_bench_add("crypt", name, "encrypt",
+				    blksz, rate);
+
+			ZFS_BENCH_TIME(rate, blksz, ns,
+			    err |= zio_do_crypt_data(B_FALSE, &key,
+			    key.zk_salt, iv, mac, blksz, out, cipher));
+			if (err == 0)
+				zfs_bench_add("crypt", name, "decrypt",
+				    blksz, rate);
+		}
+
+		zio_crypt_key_destroy(&key);
+	}
+}
+
+/*
+ * Run the suite over blocks of blksz bytes, each test for at least ns (or
+ * ZFS_BENCH_NS_DEFAULT), replacing the results of the previous run.  All
+ * tests run on the calling thread, so the rates are per CPU.
+ */
+int
+zfs_bench_run(uint64_t blksz, hrtime_t ns)
+{
+	uint8_t *bufs[5], *cols[4];
+	uint64_t seed = 0x2545f4914f6cdd1dULL;
+	int i;
+
+	if (blksz < SPA_MINBLOCKSIZE || blksz > SPA_MAXBLOCKSIZE ||
+	    !IS_P2ALIGNED(blksz, SPA_MINBLOCKSIZE))
+		return (SET_ERROR(EINVAL));
+
+	if (ns <= 0)
+		ns = ZFS_BENCH_NS_DEFAULT;
+
+	/* Three parity columns, then random data, then compressible text */
+	for (i = 0; i < 5; i++) {
+		bufs[i] = vmem_alloc(blksz, KM_SLEEP);
+		zfs_bench_fill(bufs[i], blksz, &seed, i == 4);
+	}
+	for (i = 0; i < 4; i++)
+		cols[i] = bufs[i];
+
+	mutex_enter(&zfs_bench_lock);
+	zfs_bench_count = 0;
+
+	zfs_bench_fletcher_4(bufs[3], blksz, ns);
+	zfs_bench_raidz(cols, blksz, ns);
+	zfs_bench_compress(bufs[4], bufs[0], bufs[1], blksz, ns);
+	zfs_bench_checksum(bufs[3], blksz, ns);
+	zfs_bench_crypt(bufs[3], bufs[0], bufs[1], blksz, ns);
+
+	if (zfs_bench_kstat != NULL)
+		zfs_bench_kstat->ks_ndata = zfs_bench_count;
+	mutex_exit(&zfs_bench_lock);
+
+	for (i = 0; i < 5; i++)
+		vmem_free(bufs[i], blksz);
+
+	return (0);
+}
+
+typedef struct zfs_bench_scl {
+	zfs_bench_lock_t zbs_which;
+	spa_t		*zbs_spa;
+	rrmlock_t	*zbs_rrm;
+	kmutex_t	zbs_lock;
+	kcondvar_t	zbs_cv;
+	int		zbs_running;	/* threads not yet done */
+	boolean_t	zbs_stop;
+	uint64_t	zbs_pairs;	/* enter and exit pairs of all */
+} zfs_bench_scl_t;
+
+static void
+zfs_bench_config_lock_thread(void *arg)
+{
+	zfs_bench_scl_t *zbs = arg;
+	uint64_t pairs = 0;
+
+	while (!zbs->zbs_stop) {
+		if (zbs->zbs_which == ZFS_BENCH_LOCK_TEARDOWN) {
+			rrm_enter_read(zbs->zbs_rrm, FTAG);
+			rrm_exit(zbs->zbs_rrm, FTAG);
+		} else {
+			spa_config_enter(zbs->zbs_spa, SCL_ZIO, FTAG,
+			    RW_READER);
+			spa_config_exit(zbs->zbs_spa, SCL_ZIO, FTAG);
+		}
+		pairs++;
+	}
+
+	mutex_enter(&zbs->zbs_lock);
+	zbs->zbs_pairs += pairs;
+	if (--zbs->zbs_running == 0)
+		cv_broadcast(&zbs->zbs_cv);
+	mutex_exit(&zbs->zbs_lock);
+
+	thread_exit();
+}
+
+/*
+ * Take and drop a lock as reader from the given number of threads at once
+ * for at least ns (or ZFS_BENCH_NS_DEFAULT), and return the rate of enter
+ * and exit pairs per second of all of them: SCL_ZIO of a private spa_t of
+ * no pool, as every zio does, or an rrmlock_t set up like the
+ * z_teardown_lock that ZFS_ENTER() takes on every vnode operation.
+ */
+uint64_t
+zfs_bench_lock(zfs_bench_lock_t which, int threads, hrtime_t ns)
+{
+	zfs_bench_scl_t zbs;
+	hrtime_t start, elapsed;
+	int i;
+
+	if (threads <= 0)
+		return (0);
+	if (ns <= 0)
+		ns = ZFS_BENCH_NS_DEFAULT;
+
+	bzero(&zbs, sizeof (zbs));
+	zbs.zbs_which = which;
+	if (which == ZFS_BENCH_LOCK_TEARDOWN) {
+		zbs.zbs_rrm = kmem_zalloc(sizeof (rrmlock_t), KM_SLEEP);
+		rrm_init(zbs.zbs_rrm, B_FALSE);
+	} else {
+		zbs.zbs_spa = kmem_zalloc(sizeof (spa_t), KM_SLEEP);
+		spa_config_lock_init(zbs.zbs_spa);
+	}
+	mutex_init(&zbs.zbs_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zbs.zbs_cv, NULL, CV_DEFAULT, NULL);
+	zbs.zbs_running = threads;
+
+	start = gethrtime();
+	for (i = 0; i < threads; i++) {
+		(void) thread_create(NULL, 0, zfs_bench_config_lock_thread,
+		    &zbs, 0, &p0, TS_RUN, minclsyspri);
+	}
+	delay(MAX(1, NSEC_TO_TICK(ns)));
+
+	mutex_enter(&zbs.zbs_lock);
+	zbs.zbs_stop = B_TRUE;
+	while (zbs.zbs_running != 0)
+		cv_wait(&zbs.zbs_cv, &zbs.zbs_lock);
+	mutex_exit(&zbs.zbs_lock);
+	elapsed = gethrtime() - start;
+
+	cv_destroy(&zbs.zbs_cv);
+	mutex_destroy(&zbs.zbs_lock);
+	if (which == ZFS_BENCH_LOCK_TEARDOWN) {
+		rrm_destroy(zbs.zbs_rrm);
+		kmem_free(zbs.zbs_rrm, sizeof (rrmlock_t));
+	} else {
+		spa_config_lock_destroy(zbs.zbs_spa);
+		kmem_free(zbs.zbs_spa, sizeof (spa_t));
+	}
+
+	return (zbs.zbs_pairs * NANOSEC / elapsed);
+}
+
+/*
+ * Copy out up to max results of the last run, returning their number.
+ */
+int
+zfs_bench_results(zfs_bench_result_t *results, int max)
+{
+	int n;
+
+	mutex_enter(&zfs_bench_lock);
+	n = MIN(max, zfs_bench_count);
+	bcopy(zfs_bench_data, results, n * sizeof (zfs_bench_result_t));
+	mutex_exit(&zfs_bench_lock);
+
+	return (n);
+}
+
+static int
+zfs_bench_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-11s %-17s %-12s %-9s %-15s\n",
+	    "group", "implementation", "operation", "blocksize", "rate");
+
+	return (0);
+}
+
+static int
+zfs_bench_kstat_data(char *buf, size_t size, void *data)
+{
+	zfs_bench_result_t *zbr = data;
+
+	(void) snprintf(buf, size, "%-11s %-17s %-12s %-9llu %-15llu\n",
+	    zbr->zbr_group, zbr->zbr_name, zbr->zbr_op,
+	    (u_longlong_t)zbr->zbr_blksz, (u_longlong_t)zbr->zbr_rate);
+
+	return (0);
+}
+
+static void *
+zfs_bench_kstat_addr(kstat_t *ksp, off_t n)
+{
+	if (n < zfs_bench_count)
+		ksp->ks_private = (void *)(zfs_bench_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+void
+zfs_bench_init(void)
+{
+	mutex_init(&zfs_bench_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	zfs_bench_kstat = kstat_create("zfs", 0, "zfs_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (zfs_bench_kstat != NULL) {
+		zfs_bench_kstat->ks_data = NULL;
+		zfs_bench_kstat->ks_ndata = 0;
+		zfs_bench_kstat->ks_lock = &zfs_bench_lock;
+		kstat_set_raw_ops(zfs_bench_kstat, zfs_bench_kstat_headers,
+		    zfs_bench_kstat_data, zfs_bench_kstat_addr);
+		kstat_install(zfs_bench_kstat);
+	}
+}
+
+void
+zfs_bench_fini(void)
+{
+	if (zfs_bench_kstat != NULL) {
+		kstat_delete(zfs_bench_kstat);
+		zfs_bench_kstat = NULL;
+	}
+
+	mutex_destroy(&zfs_bench_lock);
+}
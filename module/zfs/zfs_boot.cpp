@@ -167,14 +167,32 @@ typedef struct pool_list {
 	IOService		*zfs_hl;
 	IONotifier		*notifier;
 	volatile UInt64		terminating;
+	hrtime_t		start_time;	/* import thread started */
+	hrtime_t		last_disk_time;	/* last disk was probed */
+	uint64_t		probed;		/* disks probed so far */
+	boolean_t		incomplete;	/* waiting on missing vdevs */
 } pool_list_t;
 
+typedef struct zfs_boot_probe {
+	pool_list_t		*pools;
+	IOMedia			*media;
+} zfs_boot_probe_t;
+
 #define ZFS_BOOT_ACTIVE		0x1
 #define ZFS_BOOT_TERMINATING	0x2
 #define ZFS_BOOT_INVALID	0x99
 
 #define ZFS_BOOT_PREALLOC_SET	5
 
+/* Disks whose labels are read at once during boot probing */
+#define	ZFS_BOOT_PROBE_THREADS	8
+
+/*
+ * A pool whose label config names vdevs we have not found is only
+ * imported, degraded, once no new disk has appeared for this long.
+ */
+#define	ZFS_BOOT_INCOMPLETE_WAIT	SEC2NSEC(10)
+
 static ZFSBootDevice *bootdev = 0;
 static pool_list_t *zfs_boot_pool_list = 0;
 
@@ -931,7 +949,9 @@ zfs_boot_label_offset(uint64_t size, int l)
 /*
  * Given an IOMedia, read the label information and return an nvlist
  * describing the configuration, if there is one.  The number of valid
- * labels found will be returned in num_labels when non-NULL.
+ * labels found will be returned in num_labels when non-NULL.  Labels 0
+ * and 1 are adjacent at the front of the device, and 2 and 3 at the
+ * back, so each pair is read with a single IO.
  */
 DSTATIC int
 zfs_boot_read_label(IOService *zfs_hl, IOMedia *media,
@@ -940,7 +960,7 @@ zfs_boot_read_label(IOService *zfs_hl, IOMedia *media,
 	IOMemoryDescriptor *buffer = NULL;
 	uint64_t mediaSize;
 	uint64_t nread = 0;
-	vdev_label_t *label;
+	vdev_label_t *labels, *label;
 	nvlist_t *expected_config = NULL;
 	uint64_t expected_guid = 0, size, labelsize;
 	int l, count = 0;
@@ -958,19 +978,19 @@ zfs_boot_read_label(IOService *zfs_hl, IOMedia *media,
 	labelsize = sizeof (vdev_label_t);
 	size = P2ALIGN_TYPED(mediaSize, labelsize, uint64_t);
 
-	/* Allocate a buffer to read labels into */
-	label = (vdev_label_t*) kmem_alloc(labelsize, KM_SLEEP);
-	if (!label) {
+	/* Allocate a buffer to read a pair of labels into */
+	labels = (vdev_label_t*) kmem_alloc(2 * labelsize, KM_SLEEP);
+	if (!labels) {
 		dprintf("%s couldn't allocate label for read\n", __func__);
 		return (-1);
 	}
 
 	/* Allocate a memory descriptor with the label pointer */
-	buffer = IOMemoryDescriptor::withAddress((void*)label, labelsize,
-	    kIODirectionIn);
+	buffer = IOMemoryDescriptor::withAddress((void*)labels,
+	    2 * labelsize, kIODirectionIn);
 
 	/* Verify buffer was allocated */
-	if (!buffer || (buffer->getLength() != labelsize)) {
+	if (!buffer || (buffer->getLength() != 2 * labelsize)) {
 		dprintf("%s couldn't allocate buffer for read\n", __func__);
 		goto error;
 	}
@@ -982,34 +1002,37 @@ zfs_boot_read_label(IOService *zfs_hl, IOMedia *media,
 		goto error;
 	}
 
-	/* Read all four vdev labels */
+	/* Read all four vdev labels, a pair at a time */
 	for (l = 0; l < VDEV_LABELS; l++) {
 		uint64_t state, guid, txg;
 
-		/* Zero the label buffer */
-		bzero(label, labelsize);
+		if (l % 2 == 0) {
+			/* Zero the label buffer */
+			bzero(labels, 2 * labelsize);
 
-		/* Prepare the buffer for IO */
-		buffer->prepare(kIODirectionIn);
+			/* Prepare the buffer for IO */
+			buffer->prepare(kIODirectionIn);
 
-		/* Read a label from the specified offset */
-		ret = media->IOMedia::read(zfs_hl,
-		    zfs_boot_label_offset(size, l),
-		    buffer, 0, &nread);
+			/* Read two labels from the specified offset */
+			ret = media->IOMedia::read(zfs_hl,
+			    zfs_boot_label_offset(size, l),
+			    buffer, 0, &nread);
 
-		/* Call the buffer completion */
-		buffer->complete();
+			/* Call the buffer completion */
+			buffer->complete();
 
-		/* Skip failed reads, try next label */
-		if (ret != kIOReturnSuccess) {
-			dprintf("%s media->read failed\n", __func__);
-			continue;
+			/* A failed read leaves both labels unreadable */
+			if (ret != kIOReturnSuccess) {
+				dprintf("%s media->read failed\n", __func__);
+				nread = 0;
+			}
 		}
+		label = &labels[l % 2];
 
 		/* Skip incomplete reads, try next label */
-		if (nread < labelsize) {
+		if (nread < (l % 2 + 1) * labelsize) {
 			dprintf("%s nread %llu / %llu\n",
-			    __func__, nread, labelsize);
+			    __func__, nread, (l % 2 + 1) * labelsize);
 			continue;
 		}
 
@@ -1066,7 +1089,7 @@ zfs_boot_read_label(IOService *zfs_hl, IOMedia *media,
 	if (num_labels != NULL)
 		*num_labels = count;
 
-	kmem_free(label, labelsize);
+	kmem_free(labels, 2 * labelsize);
 	buffer->release();
 	*config = expected_config;
 
@@ -1079,9 +1102,9 @@ error:
 		buffer->release();
 		buffer = 0;
 	}
-	if (label) {
-		kmem_free(label, labelsize);
-		label = 0;
+	if (labels) {
+		kmem_free(labels, 2 * labelsize);
+		labels = 0;
 	}
 
 	return (-1);
@@ -1298,11 +1321,13 @@ zfs_boot_probe_disk(pool_list_t *pools, IOMedia *media)
 	 * referenced by /private/var/run/disk/by-id/ paths.
 	 */
 	dprintf("%s: add_config %s\n", __func__, path);
+	mutex_enter(&pools->lock);
 	if (zfs_boot_add_config(pools, path, 1,
 	    num_labels, config) != 0) {
 		printf("%s couldn't add config to pool list\n",
 		    __func__);
 	}
+	mutex_exit(&pools->lock);
 
 out:
 	/* Clean up */
@@ -1656,10 +1681,59 @@ zfs_boot_publish_bootfs(IOService *zfs_hl, pool_list_t *pools)
 	return (0);
 }
 
+DSTATIC void
+zfs_boot_probe_task(void *arg)
+{
+	zfs_boot_probe_t *zbp = (zfs_boot_probe_t*)arg;
+
+	/* Check this IOMedia device for a vdev label */
+	if (!zfs_boot_probe_disk(zbp->pools, zbp->media)) {
+		dprintf("%s couldn't probe disk\n", __func__);
+	}
+	atomic_inc_64(&zbp->pools->probed);
+	kmem_free(zbp, sizeof (zfs_boot_probe_t));
+}
+
+/*
+ * Have all the leaf vdevs in vdev tree nv been found on some disk?
+ * Called with pools->lock held.
+ */
+DSTATIC boolean_t
+zfs_boot_vdevs_present(pool_list_t *pools, nvlist_t *nv)
+{
+	nvlist_t **child;
+	name_entry_t *ne;
+	uint_t c, children;
+	uint64_t guid;
+	char *type;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) == 0) {
+		for (c = 0; c < children; c++) {
+			if (!zfs_boot_vdevs_present(pools, child[c]))
+				return (B_FALSE);
+		}
+		return (B_TRUE);
+	}
+
+	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0 &&
+	    strcmp(type, VDEV_TYPE_HOLE) == 0)
+		return (B_TRUE);
+
+	if (nvlist_lookup_uint64(nv, ZPOOL_CONFIG_GUID, &guid) != 0)
+		return (B_FALSE);
+
+	for (ne = pools->names; ne != NULL; ne = ne->ne_next) {
+		if (ne->ne_guid == guid)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
 DSTATIC void
 zfs_boot_import_thread(void *arg)
 {
-	nvlist_t *configs, *nv, *newnv;
+	nvlist_t *configs, *nv, *newnv, *nvroot;
 	nvpair_t *elem;
 	IOService *zfs_hl = 0;
 	OSSet *disks, *new_set = 0;
@@ -1667,8 +1741,11 @@ zfs_boot_import_thread(void *arg)
 	OSObject *next;
 	IOMedia *media;
 	pool_list_t *pools = (pool_list_t*)arg;
-	uint64_t pool_state;
-	boolean_t pool_imported = B_FALSE;
+	zfs_boot_probe_t *zbp;
+	taskq_t *probe_tq = NULL;
+	uint64_t pool_state, nprobed;
+	hrtime_t phase_start;
+	boolean_t pool_imported = B_FALSE, present;
 	int error = EINVAL;
 
 	/* Verify pool list coult be cast */
@@ -1678,6 +1755,7 @@ zfs_boot_import_thread(void *arg)
 		    arg, "couldn't be cast as pool_list_t*");
 		return;
 	}
+	pools->start_time = gethrtime();
 
 	/* Abort early */
 	if (pools->terminating != ZFS_BOOT_ACTIVE) {
@@ -1692,6 +1770,10 @@ zfs_boot_import_thread(void *arg)
 		goto out_unlocked;
 	}
 
+	/* Labels of newly found disks are read in parallel */
+	probe_tq = taskq_create("zfs_boot_probe", ZFS_BOOT_PROBE_THREADS,
+	    defclsyspri, ZFS_BOOT_PROBE_THREADS, INT_MAX, 0);
+
 	/* Take pool list lock */
 	mutex_enter(&pools->lock);
 
@@ -1708,6 +1790,10 @@ zfs_boot_import_thread(void *arg)
 		/* Check for work */
 		if (pools->disks->getCount() == 0) {
 			dprintf("%s no disks to check\n", __func__);
+			/* Give up waiting for missing vdevs? */
+			if (pools->incomplete && gethrtime() -
+			    pools->last_disk_time >= ZFS_BOOT_INCOMPLETE_WAIT)
+				goto import_locked;
 			goto next_locked;
 		}
 
@@ -1743,6 +1829,8 @@ zfs_boot_import_thread(void *arg)
 		}
 
 		/* Iterate over all disks */
+		phase_start = gethrtime();
+		nprobed = pools->probed;
 		while ((next = iter->getNextObject()) != NULL) {
 			/* Cast each IOMedia object */
 			media = OSDynamicCast(IOMedia, next);
@@ -1759,13 +1847,25 @@ zfs_boot_import_thread(void *arg)
 				continue;
 			}
 
-			/* Check this IOMedia device for a vdev label */
-			if (!zfs_boot_probe_disk(pools, media)) {
-				dprintf("%s couldn't probe disk\n",
-				    __func__);
-				continue;
-			}
+			/*
+			 * Probe each disk on the taskq; 'disks' holds a
+			 * reference on the media until taskq_wait() below.
+			 */
+			zbp = (zfs_boot_probe_t*) kmem_alloc(
+			    sizeof (zfs_boot_probe_t), KM_SLEEP);
+			zbp->pools = pools;
+			zbp->media = media;
+			if (probe_tq == NULL || taskq_dispatch(probe_tq,
+			    zfs_boot_probe_task, zbp, TQ_SLEEP) == 0)
+				zfs_boot_probe_task(zbp);
 		}
+		if (probe_tq != NULL)
+			taskq_wait(probe_tq);
+		pools->last_disk_time = gethrtime();
+		printf("%s: probed %llu disks in %llu ms "
+		    "(%llu ms since start)\n", __func__, pools->probed - nprobed,
+		    NSEC2MSEC(pools->last_disk_time - phase_start),
+		    NSEC2MSEC(pools->last_disk_time - pools->start_time));
 
 		/* Clean up */
 		media = 0;
@@ -1789,6 +1889,8 @@ zfs_boot_import_thread(void *arg)
 			dprintf("%s more disks available, looping\n", __func__);
 			continue;
 		}
+import_locked:
+		pools->incomplete = B_FALSE;
 		/* Release pool list lock */
 		mutex_exit(&pools->lock);
 
@@ -1825,7 +1927,28 @@ zfs_boot_import_thread(void *arg)
 				goto out_unlocked;
 			}
 
+			/*
+			 * Import as soon as every vdev in the config is
+			 * present; only settle for a degraded import once
+			 * no more disks have shown up for a while.
+			 */
+			present = B_FALSE;
+			if (nvlist_lookup_nvlist(nv, ZPOOL_CONFIG_VDEV_TREE,
+			    &nvroot) == 0) {
+				mutex_enter(&pools->lock);
+				present = zfs_boot_vdevs_present(pools, nvroot);
+				mutex_exit(&pools->lock);
+			}
+			if (!present && gethrtime() - pools->last_disk_time <
+			    ZFS_BOOT_INCOMPLETE_WAIT) {
+				dprintf("%s waiting for missing vdevs\n",
+				    __func__);
+				pools->incomplete = B_TRUE;
+				continue;
+			}
+
 			/* Try import */
+			phase_start = gethrtime();
 			newnv = spa_tryimport(nv);
 			nvlist_free(nv);
 			nv = 0;
@@ -1848,6 +1971,10 @@ zfs_boot_import_thread(void *arg)
 
 			dprintf("%s spa_import returned %d\n", __func__,
 			    pool_imported);
+			printf("%s: import %s in %llu ms "
+			    "(%llu ms since start)\n", __func__, pool_imported ? "succeeded" : "failed",
+			    NSEC2MSEC(gethrtime() - phase_start),
+			    NSEC2MSEC(gethrtime() - pools->start_time));
 
 			if (pool_imported) {
 				/* Get bootfs and publish IOMedia */
@@ -1893,6 +2020,9 @@ out_locked:
 	mutex_exit(&pools->lock);
 
 out_unlocked:
+	if (probe_tq != NULL)
+		taskq_destroy(probe_tq);
+
 	/* Cleanup new_set */
 	if (new_set) {
 		new_set->flushCollection();
@@ -2063,6 +2193,10 @@ zfs_boot_init(IOService *zfs_hl)
 	pools->pool_name = pool_name;
 	pools->zfs_hl = zfs_hl;
 
+	/* The notifier is called for existing media before returning */
+	mutex_init(&pools->lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&pools->cv, NULL, CV_DEFAULT, NULL);
+
 	notifier = IOService::addMatchingNotification(
 	    gIOFirstPublishNotification, IOService::serviceMatching(
 	    "IOMediaBSDClient"), zfs_boot_probe_media,
@@ -2074,9 +2208,6 @@ zfs_boot_init(IOService *zfs_hl)
 	}
 	pools->notifier = notifier;
 
-	mutex_init(&pools->lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&pools->cv, NULL, CV_DEFAULT, NULL);
-
 	/* Finally, start the import thread */
 	taskq_dispatch(system_taskq, zfs_boot_import_thread,
 	    (void*)pools, TQ_SLEEP);
@@ -86,7 +86,9 @@
 #include <sys/gfs.h>
 #include <sys/stat.h>
 #include <sys/dmu.h>
+#include <sys/dsl_dataset.h>
 #include <sys/dsl_destroy.h>
+#include <sys/dsl_pool.h>
 
 #include <sys/dsl_deleg.h>
 #include <sys/mount.h>
@@ -128,6 +130,21 @@ typedef struct {
 	avl_node_t	se_node;
 } zfs_snapentry_t;
 
+/*
+ * Listing .zfs/snapshot queues the snapshots it returns to be read in,
+ * so that the lookups which usually follow find them cached.  At most
+ * ZFSCTL_PREFETCH_MAX are queued at once; beyond that they are skipped.
+ */
+#define	ZFSCTL_PREFETCH_THREADS	4
+#define	ZFSCTL_PREFETCH_MAX	64
+
+typedef struct zfsctl_prefetch {
+	char		zp_pool[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t	zp_objsetid;
+} zfsctl_prefetch_t;
+
+static taskq_t *zfsctl_prefetch_taskq;
+
 static int
 snapentry_compare(const void *a, const void *b)
 {
@@ -280,11 +297,17 @@ zfsctl_init(void)
 #ifdef sun
 	VERIFY(gfs_make_opsvec(zfsctl_opsvec) == 0);
 #endif
+	zfsctl_prefetch_taskq = taskq_create("zfs_snapdir_prefetch",
+	    ZFSCTL_PREFETCH_THREADS, minclsyspri, 1, ZFSCTL_PREFETCH_MAX,
+	    TASKQ_PREPOPULATE);
 }
 
 void
 zfsctl_fini(void)
 {
+	taskq_destroy(zfsctl_prefetch_taskq);
+	zfsctl_prefetch_taskq = NULL;
+
 #ifdef sun
 	/*
 	 * Remove vfsctl vnode ops
@@ -1306,9 +1329,14 @@ zfsctl_snapdir_lookup(ap)
 #endif
 	}
 
+	snap = NULL;
+again:
 	mutex_enter(&sdp->sd_lock);
 	search.se_name = (char *)nm;
 	if ((sep = avl_find(&sdp->sd_snaps, &search, &where)) != NULL) {
+		/* Another lookup of this snapshot got here first */
+		if (snap != NULL)
+			dmu_objset_rele(snap, FTAG);
 		*vpp = sep->se_root;
 		VN_HOLD(*vpp);
 		err = traverse(vpp, LK_EXCLUSIVE | LK_RETRY);
@@ -1340,20 +1368,26 @@ zfsctl_snapdir_lookup(ap)
 
 	/*
 	 * The requested snapshot is not currently mounted, look it up.
+	 * This may have to read the snapshot in, so drop sd_lock while
+	 * we do it rather than hold up lookups of the other snapshots.
 	 */
-	err = zfsctl_snapshot_zname(dvp, nm, MAXNAMELEN, snapname);
-	if (err) {
-		mutex_exit(&sdp->sd_lock);
-		ZFS_EXIT(zfsvfs);
-		/*
-		 * handle "ls *" or "?" in a graceful manner,
-		 * forcing EILSEQ to ENOENT.
-		 * Since shell ultimately passes "*" or "?" as name to lookup
-		 */
-		return (err == EILSEQ ? ENOENT : err);
-	}
-	if (dmu_objset_hold(snapname, FTAG, &snap) != 0) {
+	if (snap == NULL) {
 		mutex_exit(&sdp->sd_lock);
+		err = zfsctl_snapshot_zname(dvp, nm, MAXNAMELEN, snapname);
+		if (err) {
+			ZFS_EXIT(zfsvfs);
+			/*
+			 * handle "ls *" or "?" in a graceful manner,
+			 * forcing EILSEQ to ENOENT.
+			 * Since shell ultimately passes "*" or "?" as name
+			 * to lookup
+			 */
+			return (err == EILSEQ ? ENOENT : err);
+		}
+		if (dmu_objset_hold(snapname, FTAG, &snap) == 0)
+			goto again;
+
+		snap = NULL;
 		/* Translate errors and add SAVENAME when needed. */
 		if ((cnp->cn_flags & ISLASTCN) && cnp->cn_nameiop == CREATE) {
 			err = EJUSTRETURN;
@@ -1501,6 +1535,28 @@ zfsctl_shares_lookup(ap)
 }
 #endif
 
+/*
+ * Read in the objset of a snapshot that has just been listed.
+ */
+static void
+zfsctl_snapshot_prefetch(void *arg)
+{
+	zfsctl_prefetch_t *zp = arg;
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	objset_t *os;
+
+	if (dsl_pool_hold(zp->zp_pool, FTAG, &dp) == 0) {
+		if (dsl_dataset_hold_obj(dp, zp->zp_objsetid, FTAG,
+		    &ds) == 0) {
+			(void) dmu_objset_from_ds(ds, &os);
+			dsl_dataset_rele(ds, FTAG);
+		}
+		dsl_pool_rele(dp, FTAG);
+	}
+	kmem_free(zp, sizeof (zfsctl_prefetch_t));
+}
+
 /* ARGSUSED */
 static int
 zfsctl_snapdir_readdir_cb(struct vnode *vp, void *dp, int *eofp,
@@ -1535,6 +1591,19 @@ zfsctl_snapdir_readdir_cb(struct vnode *vp, void *dp, int *eofp,
 
 	*nextp = cookie;
 
+	if (zfsctl_prefetch_taskq != NULL) {
+		zfsctl_prefetch_t *zp;
+
+		zp = kmem_alloc(sizeof (zfsctl_prefetch_t), KM_SLEEP);
+		(void) strlcpy(zp->zp_pool,
+		    spa_name(dmu_objset_spa(zfsvfs->z_os)),
+		    sizeof (zp->zp_pool));
+		zp->zp_objsetid = id;
+		if (taskq_dispatch(zfsctl_prefetch_taskq,
+		    zfsctl_snapshot_prefetch, zp, TQ_NOSLEEP) == 0)
+			kmem_free(zp, sizeof (zfsctl_prefetch_t));
+	}
+
 	ZFS_EXIT(zfsvfs);
 
 	return (0);
@@ -51,6 +51,7 @@
 #include <sys/fs/zfs.h>
 #include <sys/zap.h>
 #include <sys/dmu.h>
+#include <sys/dnode.h>
 #include <sys/atomic.h>
 #include <sys/zfs_ctldir.h>
 #include <sys/zfs_fuid.h>
@@ -58,6 +59,177 @@
 #include <sys/zfs_sa.h>
 #include <sys/dnlc.h>
 #include <sys/extdirent.h>
+#include <sys/btree.h>
+
+/*
+ * Per-directory negative lookup cache.  Each directory remembers a
+ * handful of names that a lookup recently failed to find, so that the
+ * repeated stats of paths that do not exist (compiler header search
+ * paths, say) do not each cost a ZAP lookup once the system name cache
+ * has let go of them.  The whole cache is dropped, and z_seq bumped,
+ * whenever a name is added to the directory.  Only exact-match file
+ * systems are cached: with normalization or case folding a different
+ * spelling could match an existing entry.
+ */
+#define	ZFS_NEGCACHE_ENTRIES	16
+#define	ZFS_NEGCACHE_NAMELEN	48
+
+typedef struct zfs_negcache {
+	uint32_t	znc_hand;	/* next slot to replace */
+	uint32_t	znc_hash[ZFS_NEGCACHE_ENTRIES];	/* 0 if empty */
+	char		znc_name[ZFS_NEGCACHE_ENTRIES][ZFS_NEGCACHE_NAMELEN];
+} zfs_negcache_t;
+
+int zfs_dir_negcache = 1;
+
+typedef struct zfs_negcache_stats {
+	kstat_named_t zncs_hits;
+	kstat_named_t zncs_misses;
+	kstat_named_t zncs_inserts;
+	kstat_named_t zncs_purges;
+} zfs_negcache_stats_t;
+
+static zfs_negcache_stats_t zfs_negcache_stats = {
+	{ "hits",			KSTAT_DATA_UINT64 },
+	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "inserts",			KSTAT_DATA_UINT64 },
+	{ "purges",			KSTAT_DATA_UINT64 },
+};
+
+#define	ZNCSTAT_BUMP(stat) \
+	atomic_inc_64(&zfs_negcache_stats.stat.value.ui64)
+
+static kstat_t *zfs_negcache_ksp;
+
+static uint32_t
+zfs_negcache_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name != '\0')
+		hash = (hash ^ (uint8_t)*name++) * 16777619U;
+	return (hash | 1);
+}
+
+static boolean_t
+zfs_negcache_eligible(znode_t *dzp, const char *name, int flags)
+{
+	return (zfs_dir_negcache && dzp->z_zfsvfs->z_norm == 0 &&
+	    !(flags & FIGNORECASE) &&
+	    strlen(name) < ZFS_NEGCACHE_NAMELEN);
+}
+
+/*
+ * Return B_TRUE if name is known to be absent from dzp.  Otherwise
+ * return B_FALSE, with *seqp set to the z_seq to hand to
+ * zfs_negcache_enter() if the lookup then fails.
+ */
+static boolean_t
+zfs_negcache_lookup(znode_t *dzp, const char *name, uint32_t hash,
+    uint_t *seqp)
+{
+	zfs_negcache_t *znc;
+	boolean_t hit = B_FALSE;
+	int i;
+
+	mutex_enter(&dzp->z_lock);
+	*seqp = dzp->z_seq;
+	if ((znc = dzp->z_negcache) != NULL) {
+		for (i = 0; i < ZFS_NEGCACHE_ENTRIES; i++) {
+			if (znc->znc_hash[i] == hash &&
+			    strcmp(znc->znc_name[i], name) == 0) {
+				hit = B_TRUE;
+				break;
+			}
+		}
+	}
+	mutex_exit(&dzp->z_lock);
+
+	if (hit)
+		ZNCSTAT_BUMP(zncs_hits);
+	else
+		ZNCSTAT_BUMP(zncs_misses);
+	return (hit);
+}
+
+/*
+ * Remember that name is absent from dzp, unless a name has been added
+ * since the lookup which found it missing sampled z_seq.
+ */
+static void
+zfs_negcache_enter(znode_t *dzp, const char *name, uint32_t hash,
+    uint_t seq)
+{
+	zfs_negcache_t *znc = NULL;
+	int i;
+
+	if (dzp->z_negcache == NULL)
+		znc = kmem_zalloc(sizeof (zfs_negcache_t), KM_SLEEP);
+
+	mutex_enter(&dzp->z_lock);
+	if (dzp->z_seq != seq || dzp->z_unlinked) {
+		mutex_exit(&dzp->z_lock);
+		if (znc != NULL)
+			kmem_free(znc, sizeof (zfs_negcache_t));
+		return;
+	}
+	if (dzp->z_negcache == NULL) {
+		dzp->z_negcache = znc;
+		znc = NULL;
+	}
+	i = dzp->z_negcache->znc_hand++ % ZFS_NEGCACHE_ENTRIES;
+	dzp->z_negcache->znc_hash[i] = hash;
+	(void) strlcpy(dzp->z_negcache->znc_name[i], name,
+	    ZFS_NEGCACHE_NAMELEN);
+	mutex_exit(&dzp->z_lock);
+
+	if (znc != NULL)
+		kmem_free(znc, sizeof (zfs_negcache_t));
+	ZNCSTAT_BUMP(zncs_inserts);
+}
+
+/*
+ * Forget every name cached as absent from dzp.  Called when a name is
+ * added to the directory and when the znode is reloaded or freed.
+ */
+void
+zfs_negcache_purge(znode_t *dzp)
+{
+	zfs_negcache_t *znc;
+
+	mutex_enter(&dzp->z_lock);
+	dzp->z_seq++;
+	znc = dzp->z_negcache;
+	dzp->z_negcache = NULL;
+	mutex_exit(&dzp->z_lock);
+
+	if (znc != NULL) {
+		kmem_free(znc, sizeof (zfs_negcache_t));
+		ZNCSTAT_BUMP(zncs_purges);
+	}
+}
+
+void
+zfs_dir_init(void)
+{
+	zfs_negcache_ksp = kstat_create("zfs", 0, "zfs_negcache", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zfs_negcache_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (zfs_negcache_ksp != NULL) {
+		zfs_negcache_ksp->ks_data = &zfs_negcache_stats;
+		kstat_install(zfs_negcache_ksp);
+	}
+}
+
+void
+zfs_dir_fini(void)
+{
+	if (zfs_negcache_ksp != NULL) {
+		kstat_delete(zfs_negcache_ksp);
+		zfs_negcache_ksp = NULL;
+	}
+}
 
 /*
  * zfs_match_find() is used by zfs_dirent_lock() to peform zap lookups
@@ -441,8 +613,17 @@ zfs_dirlook(znode_t *dzp, char *name, vnode_t **vpp, int flags,
 	} else if (zfs_has_ctldir(dzp) && strcmp(name, ZFS_CTLDIR_NAME) == 0) {
 		*vpp = zfsctl_root(dzp);
 	} else {
+		boolean_t negcache = zfs_negcache_eligible(dzp, name, flags);
+		uint32_t hash = 0;
+		uint_t seq = 0;
 		int zf;
 
+		if (negcache) {
+			hash = zfs_negcache_hash(name);
+			if (zfs_negcache_lookup(dzp, name, hash, &seq))
+				return (SET_ERROR(ENOENT));
+		}
+
 		zf = ZEXISTS | ZSHARED;
 		if (flags & FIGNORECASE)
 			zf |= ZCILOOK;
@@ -452,6 +633,8 @@ zfs_dirlook(znode_t *dzp, char *name, vnode_t **vpp, int flags,
 			*vpp = ZTOV(zp);
 			zfs_dirent_unlock(dl);
 			dzp->z_zn_prefetch = B_TRUE; /* enable prefetching */
+		} else if (error == ENOENT && negcache) {
+			zfs_negcache_enter(dzp, name, hash, seq);
 		}
 		rpnp = NULL;
 	}
@@ -897,6 +1080,7 @@ zfs_link_create(zfs_dirlock_t *dl, znode_t *zp, dmu_tx_t *tx, int flag)
 	ASSERT(error == 0);
 
 	dnlc_update(ZTOV(dzp), dl->dl_name, vp);
+	zfs_negcache_purge(dzp);
 
 	return (0);
 }
@@ -1080,6 +1264,70 @@ zfs_dirempty(znode_t *dzp)
 	return (dzp->z_size == 2 && dzp->z_dirlocks == 0);
 }
 
+/*
+ * Number of directory entries whose dnodes zfs_readdir() prefetches at a
+ * time when a stat of every entry is expected.  Zero falls back to one
+ * prefetch per entry as it is returned.
+ */
+int zfs_readdir_dnode_prefetch = 128;
+
+static int
+zfs_dirent_prefetch_compare(const void *x1, const void *x2)
+{
+	uint64_t b1 = *(const uint64_t *)x1;
+	uint64_t b2 = *(const uint64_t *)x2;
+
+	if (b1 < b2)
+		return (-1);
+	if (b1 > b2)
+		return (1);
+	return (0);
+}
+
+/*
+ * Prefetch the dnodes of the next "count" entries of directory dzp,
+ * starting at the serialized cursor "cookie".  Many entries share a dnode
+ * block, so collect the blocks first and issue a single prefetch for each,
+ * in object order, rather than one per entry in hash order.
+ */
+void
+zfs_dirent_prefetch(znode_t *dzp, uint64_t cookie, int count)
+{
+	objset_t *os = dzp->z_zfsvfs->z_os;
+	zap_cursor_t zc;
+	zap_attribute_t *za;
+	zfs_btree_t blocks;
+	zfs_btree_index_t where;
+	uint64_t *blkp;
+	uint64_t blk;
+
+	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+	zfs_btree_create(&blocks, zfs_dirent_prefetch_compare,
+	    sizeof (uint64_t));
+
+	for (zap_cursor_init_serialized(&zc, os, dzp->z_id, cookie);
+	    count > 0 && zap_cursor_retrieve(&zc, za) == 0;
+	    zap_cursor_advance(&zc), count--) {
+		if (za->za_integer_length != 8 || za->za_num_integers != 1)
+			continue;
+		blk = ZFS_DIRENT_OBJ(za->za_first_integer) >>
+		    DNODES_PER_BLOCK_SHIFT;
+		if (zfs_btree_find(&blocks, &blk, &where) == NULL)
+			zfs_btree_add_idx(&blocks, &blk, &where);
+	}
+	zap_cursor_fini(&zc);
+
+	for (blkp = zfs_btree_first(&blocks, &where); blkp != NULL;
+	    blkp = zfs_btree_next(&blocks, &where, &where)) {
+		dmu_prefetch(os, MAX(*blkp << DNODES_PER_BLOCK_SHIFT, 1),
+		    0, 0, 0, ZIO_PRIORITY_ASYNC_READ);
+	}
+
+	zfs_btree_clear(&blocks);
+	zfs_btree_destroy(&blocks);
+	kmem_free(za, sizeof (zap_attribute_t));
+}
+
 int
 zfs_make_xattrdir(znode_t *zp, vattr_t *vap, vnode_t **xvpp, cred_t *cr)
 {
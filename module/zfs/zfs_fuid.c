@@ -397,16 +397,18 @@ zfs_fuid_map_id(zfsvfs_t *zfsvfs, uint64_t fuid,
     cred_t *cr, zfs_fuid_type_t type)
 {
 	uint32_t index = FUID_INDEX(fuid);
+#ifdef sun
 	const char *domain;
+#endif
 	uid_t id;
 
 	if (index == 0)
 		return (fuid);
 
+#ifdef sun
 	domain = zfs_fuid_find_by_idx(zfsvfs, index);
 	ASSERT(domain != NULL);
 
-#ifdef sun
 	if (type == ZFS_OWNER || type == ZFS_ACE_USER) {
 		(void) kidmap_getuidbysid(crgetzone(cr), domain,
 		    FUID_RID(fuid), &id);
@@ -415,6 +417,11 @@ zfs_fuid_map_id(zfsvfs_t *zfsvfs, uint64_t fuid,
 		    FUID_RID(fuid), &id);
 	}
 #else	/* !sun */
+	/*
+	 * Without an idmap service every domain maps to nobody, so there
+	 * is no need to look the domain up, under z_fuid_lock, each time
+	 * a getattr or an ACL check meets an ID from a SID domain.
+	 */
 	id = UID_NOBODY;
 #endif	/* !sun */
 	return (id);
@@ -58,6 +58,7 @@
 #include <sys/priv_impl.h>
 #include <sys/dmu.h>
 #include <sys/dsl_dir.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_prop.h>
 #include <sys/dsl_deleg.h>
@@ -83,6 +84,8 @@
 #include <sys/fm/util.h>
 
 #include <sys/dmu_send.h>
+#include <sys/dmu_sample.h>
+#include <sys/dmu_recompress.h>
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_bookmark.h>
 #include <sys/dsl_userhold.h>
@@ -157,6 +160,8 @@ static int zfs_fill_zplprops_root(uint64_t, nvlist_t *, nvlist_t *,
 								  boolean_t *);
 int zfs_set_prop_nvlist(const char *, zprop_source_t, nvlist_t *, nvlist_t *);
 static int get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp);
+static int get_nvlist_nva(uint64_t nvl, uint64_t size, int iflag,
+    nv_alloc_t *nva, nvlist_t **nvp);
 
 static void
 history_str_free(char *buf)
@@ -573,6 +578,14 @@ zfs_secpolicy_rollback(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
 									  ZFS_DELEG_PERM_ROLLBACK, cr));
 }
 
+/* ARGSUSED */
+static int
+zfs_secpolicy_load_key(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
+{
+	return (zfs_secpolicy_write_perms(zc->zc_name,
+	    ZFS_DELEG_PERM_LOAD_KEY, cr));
+}
+
 /* ARGSUSED */
 static int
 zfs_secpolicy_send(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
@@ -1035,6 +1048,18 @@ zfs_secpolicy_diff(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
 	return (error);
 }
 
+/*
+ * Rewriting blocks with another algorithm is as much as setting the
+ * compression property.
+ */
+/* ARGSUSED */
+static int
+zfs_secpolicy_recompress(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
+{
+	return (zfs_secpolicy_write_perms(zc->zc_name,
+	    zfs_prop_to_name(ZFS_PROP_COMPRESSION), cr));
+}
+
 /*
  * Policy for fault injection.  Requires all privileges.
  */
@@ -1192,6 +1217,16 @@ zfs_secpolicy_tmp_snapshot(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
  */
 static int
 get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
+{
+	return (get_nvlist_nva(nvl, size, iflag, nv_alloc_sleep, nvp));
+}
+
+/*
+ * As get_nvlist(), but unpack with the given allocator.
+ */
+static int
+get_nvlist_nva(uint64_t nvl, uint64_t size, int iflag, nv_alloc_t *nva,
+    nvlist_t **nvp)
 {
 	char *packed;
 	int error;
@@ -1212,7 +1247,7 @@ get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
 		return (SET_ERROR(EFAULT));
 	}
 
-	if ((error = nvlist_unpack(packed, size, &list, 0)) != 0) {
+	if ((error = nvlist_xunpack(packed, size, &list, nva)) != 0) {
 		kmem_free(packed, size);
 		return (error);
 	}
@@ -1267,18 +1302,26 @@ put_nvlist(zfs_cmd_t *zc, nvlist_t *nvl)
 {
 	char *packed = NULL;
 	int error = 0;
-	size_t size;
+	size_t size, bufsize;
 
 	size = fnvlist_size(nvl);
 
 	if (size > zc->zc_nvlist_dst_size) {
 		error = SET_ERROR(ENOMEM);
 	} else {
-		packed = fnvlist_pack(nvl, &size);
+		/*
+		 * We already know the size, so pack into our own buffer
+		 * rather than have nvlist_pack() walk the list to size it
+		 * again.  Zero it so no padding reaches userland unset.
+		 */
+		bufsize = size;
+		packed = kmem_zalloc(bufsize, KM_SLEEP);
+		VERIFY0(nvlist_pack(nvl, &packed, &size, NV_ENCODE_NATIVE,
+		    KM_SLEEP));
 		if (ddi_copyout(packed, (void *)(uintptr_t)zc->zc_nvlist_dst,
 						size, zc->zc_iflags) != 0)
 			error = SET_ERROR(EFAULT);
-		fnvlist_pack_free(packed, size);
+		kmem_free(packed, bufsize);
 	}
 
 	zc->zc_nvlist_dst_size = size;
@@ -1572,21 +1615,63 @@ zfs_ioc_pool_tryimport(zfs_cmd_t *zc)
  * inputs:
  * zc_name              name of the pool
  * zc_cookie            scan func (pool_scan_func_t)
+ * zc_nvlist_src{_size}	optional restrictions of a scrub (ZPOOL_SCAN_*)
  */
 static int
 zfs_ioc_pool_scan(zfs_cmd_t *zc)
 {
+	nvlist_t *opts = NULL, *datasets = NULL;
+	uint64_t min_txg = 0, max_txg = 0;
 	spa_t *spa;
 	int error;
 
-	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+	if (zc->zc_nvlist_src_size != 0) {
+		if (zc->zc_cookie != POOL_SCAN_SCRUB)
+			return (SET_ERROR(ENOTSUP));
+		if ((error = get_nvlist(zc->zc_nvlist_src,
+		    zc->zc_nvlist_src_size, zc->zc_iflags, &opts)) != 0)
+			return (error);
+		(void) nvlist_lookup_uint64(opts, ZPOOL_SCAN_MIN_TXG, &min_txg);
+		(void) nvlist_lookup_uint64(opts, ZPOOL_SCAN_MAX_TXG, &max_txg);
+		(void) nvlist_lookup_nvlist(opts, ZPOOL_SCAN_DATASETS,
+		    &datasets);
+	}
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0) {
+		nvlist_free(opts);
 		return (error);
+	}
 
 	if (zc->zc_cookie == POOL_SCAN_NONE)
 		error = spa_scan_stop(spa);
+	else if (opts != NULL)
+		error = spa_scan_restricted(spa, min_txg, max_txg, datasets);
 	else
 		error = spa_scan(spa, zc->zc_cookie);
 
+	spa_close(spa, FTAG);
+	nvlist_free(opts);
+
+	return (error);
+}
+
+/*
+ * inputs:
+ * zc_name              name of the pool
+ * zc_cookie            trim func (pool_trim_func_t)
+ * zc_obj               rate limit in bytes/sec, 0 for unlimited
+ */
+static int
+zfs_ioc_pool_trim(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	int error;
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+		return (error);
+
+	error = spa_trim(spa, zc->zc_cookie, zc->zc_obj);
+
 	spa_close(spa, FTAG);
 
 	return (error);
@@ -1736,6 +1821,80 @@ zfs_ioc_obj_to_stats(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Most objects looked up by one ZFS_IOC_OBJ_TO_STATS_BATCH call.
+ */
+#define	ZFS_OBJ_TO_STATS_BATCH_MAX	1024
+
+/*
+ * Look up the stats and paths of a batch of objects in one call, for
+ * zfs diff, rather than with one ZFS_IOC_OBJ_TO_STATS per object.
+ *
+ * innvl: {
+ *     "objects" -> uint64 array of object numbers
+ * }
+ *
+ * outnvl: {
+ *     "errors" -> int32 array, 0 or the lookup error of each object
+ *     "stats" -> uint8 array, one zfs_stat_t per object
+ *     "paths" -> string array, "" where the lookup failed
+ * }
+ *
+ * As with ZFS_IOC_OBJ_TO_STATS, the stats are returned even when only
+ * the path could not be found.
+ */
+static int
+zfs_ioc_obj_to_stats_batch(const char *dsname, nvlist_t *innvl,
+    nvlist_t *outnvl)
+{
+	objset_t *os;
+	uint64_t *objs;
+	uint_t count, i;
+	int32_t *errors;
+	zfs_stat_t *stats;
+	char **paths;
+	char *buf;
+	int error;
+
+	if (nvlist_lookup_uint64_array(innvl, "objects", &objs, &count) != 0 ||
+	    count == 0 || count > ZFS_OBJ_TO_STATS_BATCH_MAX)
+		return (SET_ERROR(EINVAL));
+
+	/* XXX reading from objset not owned */
+	if ((error = dmu_objset_hold(dsname, FTAG, &os)) != 0)
+		return (error);
+	if (dmu_objset_type(os) != DMU_OST_ZFS) {
+		dmu_objset_rele(os, FTAG);
+		return (SET_ERROR(EINVAL));
+	}
+
+	errors = kmem_alloc(count * sizeof (int32_t), KM_SLEEP);
+	stats = kmem_zalloc(count * sizeof (zfs_stat_t), KM_SLEEP);
+	paths = kmem_alloc(count * sizeof (char *), KM_SLEEP);
+	buf = kmem_alloc(MAXPATHLEN, KM_SLEEP);
+
+	for (i = 0; i < count; i++) {
+		errors[i] = zfs_obj_to_stats(os, objs[i], &stats[i], buf,
+		    MAXPATHLEN);
+		paths[i] = spa_strdup(errors[i] == 0 ? buf : "");
+	}
+	dmu_objset_rele(os, FTAG);
+
+	fnvlist_add_int32_array(outnvl, "errors", errors, count);
+	fnvlist_add_uint8_array(outnvl, "stats", (uint8_t *)stats,
+	    count * sizeof (zfs_stat_t));
+	fnvlist_add_string_array(outnvl, "paths", paths, count);
+
+	for (i = 0; i < count; i++)
+		spa_strfree(paths[i]);
+	kmem_free(buf, MAXPATHLEN);
+	kmem_free(paths, count * sizeof (char *));
+	kmem_free(stats, count * sizeof (zfs_stat_t));
+	kmem_free(errors, count * sizeof (int32_t));
+
+	return (0);
+}
+
 static int
 zfs_ioc_vdev_add(zfs_cmd_t *zc)
 {
@@ -2216,6 +2375,315 @@ zfs_ioc_snapshot_list_next(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Most datasets returned by one ZFS_IOC_LIST_BATCH call.
+ */
+int zfs_list_batch_max = 1024;
+
+/*
+ * Add the stats and (filtered) properties of os to outnvl under name.
+ */
+static int
+zfs_list_batch_add(objset_t *os, const char *name, nvlist_t *filter,
+    nvlist_t *outnvl)
+{
+	dmu_objset_stats_t stats;
+	nvlist_t *entry, *nv;
+	nvpair_t *pair, *next;
+	int error;
+
+	dmu_objset_fast_stat(os, &stats);
+
+	if ((error = dsl_prop_get_all(os, &nv)) != 0)
+		return (error);
+	dmu_objset_stats(os, nv);
+	/* See zfs_ioc_objset_stats_impl() */
+	if (!stats.dds_inconsistent && dmu_objset_type(os) == DMU_OST_ZVOL) {
+		error = zvol_get_stats(os, nv);
+		if (error == EIO) {
+			nvlist_free(nv);
+			return (error);
+		}
+		VERIFY0(error);
+	}
+
+	/* User and unknown properties are always kept, as in libzfs */
+	for (pair = nvlist_next_nvpair(nv, NULL); filter != NULL &&
+	    pair != NULL; pair = next) {
+		const char *propname = nvpair_name(pair);
+
+		next = nvlist_next_nvpair(nv, pair);
+		if (zfs_name_to_prop(propname) != ZPROP_INVAL &&
+		    !nvlist_exists(filter, propname))
+			fnvlist_remove_nvpair(nv, pair);
+	}
+
+	entry = fnvlist_alloc();
+	fnvlist_add_uint8_array(entry, "stats", (uint8_t *)&stats,
+	    sizeof (stats));
+	fnvlist_add_nvlist(entry, "props", nv);
+	fnvlist_add_nvlist(outnvl, name, entry);
+	fnvlist_free(entry);
+	nvlist_free(nv);
+
+	return (0);
+}
+
+/*
+ * List a batch of the child filesystems or snapshots of fsname, with their
+ * stats and properties, in one call instead of one ZFS_IOC_*_LIST_NEXT
+ * and one property nvlist copyout per dataset.
+ *
+ * innvl: {
+ *     "cursor" -> uint64 (optional, 0 to start listing)
+ *     "count" -> uint64 (optional, most datasets to return)
+ *     (optional) "snapshots" -> list snapshots instead of filesystems
+ *     (optional) "simple" -> snapshot names only, no stats or properties
+ *     (optional) "props" -> { native property names to return }
+ * }
+ *
+ * outnvl: {
+ *     "cursor" -> uint64 (pass back to continue the listing)
+ *     (optional) "done" -> no more datasets after these
+ *     "datasets" -> {
+ *         name -> { "stats" -> dmu_objset_stats_t, "props" -> { ... } }
+ *         ...
+ *     }
+ * }
+ *
+ * Datasets destroyed while the listing is in progress are skipped.
+ */
+static int
+zfs_ioc_list_batch(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	boolean_t snaps, simple, done = B_FALSE;
+	nvlist_t *filter = NULL, *datasets;
+	uint64_t cursor = 0, count = UINT64_MAX, obj, n;
+	objset_t *os, *cos;
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	size_t len;
+	int error;
+
+	snaps = nvlist_exists(innvl, "snapshots");
+	simple = nvlist_exists(innvl, "simple");
+	(void) nvlist_lookup_uint64(innvl, "cursor", &cursor);
+	(void) nvlist_lookup_uint64(innvl, "count", &count);
+	(void) nvlist_lookup_nvlist(innvl, "props", &filter);
+	if (count == 0 || (simple && !snaps))
+		return (SET_ERROR(EINVAL));
+	count = MIN(count, MAX(zfs_list_batch_max, 1));
+
+	(void) strlcpy(name, fsname, sizeof (name));
+	if (strlcat(name, snaps ? "@" : "/", sizeof (name)) >= sizeof (name))
+		return (SET_ERROR(ESRCH));
+	len = strlen(name);
+
+	error = dmu_objset_hold(fsname, FTAG, &os);
+	if (error != 0)
+		return (error == ENOENT ? SET_ERROR(ESRCH) : error);
+	dp = dmu_objset_pool(os);
+
+	datasets = fnvlist_alloc();
+	for (n = 0; n < count; n++) {
+		if (snaps) {
+			error = dmu_snapshot_list_next(os, sizeof (name) - len,
+			    name + len, &obj, &cursor, NULL);
+		} else {
+			do {
+				error = dmu_dir_list_next(os,
+				    sizeof (name) - len, name + len, NULL,
+				    &cursor);
+			} while (error == 0 && dataset_name_hidden(name));
+		}
+		if (error == ENOENT) {
+			done = B_TRUE;
+			error = 0;
+			break;
+		} else if (error != 0) {
+			break;
+		}
+
+		if (simple) {
+			fnvlist_add_boolean(datasets, name);
+			continue;
+		}
+
+		/*
+		 * The pool is held by dmu_objset_hold() above, so the child
+		 * can be opened by object number without a second pool hold.
+		 */
+		if (snaps)
+			error = dsl_dataset_hold_obj(dp, obj, FTAG, &ds);
+		else
+			error = dsl_dataset_hold(dp, name, FTAG, &ds);
+		if (error == ENOENT) {
+			/* We lost a race with destroy; skip it. */
+			error = 0;
+			continue;
+		} else if (error != 0) {
+			break;
+		}
+		error = dmu_objset_from_ds(ds, &cos);
+		if (error == 0)
+			error = zfs_list_batch_add(cos, name, filter, datasets);
+		dsl_dataset_rele(ds, FTAG);
+		if (error != 0)
+			break;
+	}
+	dmu_objset_rele(os, FTAG);
+
+	if (error == 0) {
+		fnvlist_add_uint64(outnvl, "cursor", cursor);
+		if (done)
+			fnvlist_add_boolean(outnvl, "done");
+		fnvlist_add_nvlist(outnvl, "datasets", datasets);
+	}
+	fnvlist_free(datasets);
+	return (error);
+}
+
+/*
+ * Block size and compression histograms of the data blocks of a snapshot,
+ * from a sample of its level 1 indirect blocks, see dmu_sample.c.  Head
+ * datasets change under the walk; monitor them through a fresh snapshot.
+ *
+ * innvl: {
+ *     "rate_ppm" -> uint64 (optional, parts per million of L1 blocks)
+ * }
+ *
+ * outnvl: {
+ *     "rate_ppm", "units", "units_sampled" -> uint64
+ *     "blocks", "embedded", "lsize", "psize", "asize" -> uint64
+ *     "lsize_histogram", "psize_histogram", "asize_histogram" ->
+ *         uint64 array, blocks by power of two from SPA_MINBLOCKSIZE
+ *     "ratio_histogram" -> uint64 array, blocks by lsize/psize
+ *     "compress" -> {
+ *         algorithm name -> uint64 array [blocks, lsize, psize]
+ *         ...
+ *     }
+ * }
+ */
+static int
+zfs_ioc_block_sample(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	dmu_sample_stats_t *dss;
+	uint64_t rate = DMU_SAMPLE_RATE_ALL / 100;
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	int error;
+
+	if (strchr(snapname, '@') == NULL)
+		return (SET_ERROR(EINVAL));
+	(void) nvlist_lookup_uint64(innvl, "rate_ppm", &rate);
+	if (rate == 0)
+		return (SET_ERROR(EINVAL));
+
+	error = dsl_pool_hold(snapname, FTAG, &dp);
+	if (error != 0)
+		return (error);
+	error = dsl_dataset_hold(dp, snapname, FTAG, &ds);
+	if (error != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return (error);
+	}
+	/* As with send, the dataset hold keeps the snapshot around. */
+	dsl_pool_rele(dp, FTAG);
+
+	dss = kmem_alloc(sizeof (*dss), KM_SLEEP);
+	error = dmu_sample_dataset(ds, rate, dss);
+	if (error == 0)
+		dmu_sample_to_nvlist(dss, outnvl);
+	kmem_free(dss, sizeof (*dss));
+	dsl_dataset_rele(ds, FTAG);
+	return (error);
+}
+
+/*
+ * innvl: {
+ *     "compress" -> uint64 (the zio_compress algorithm to rewrite with)
+ *     "age" -> uint64 (optional, txgs a block must have been synced for,
+ *         default 0)
+ *     "budget" -> uint64 (optional, logical bytes of blocks to look at in
+ *         this call, default 64M)
+ *     "object", "offset" -> uint64 (optional, the cursor returned by the
+ *         previous call of a pass)
+ * }
+ *
+ * outnvl: {
+ *     "object", "offset" -> uint64 (where to resume; "object" is 0 once
+ *         the pass is complete)
+ *     "objects", "blocks", "bytes", "rewritten", "rewritten_lsize",
+ *     "rewritten_psize", "skipped_snapshot", "skipped_young",
+ *     "skipped_done", "errors" -> uint64 (see dmu_recompress_stats_t)
+ * }
+ *
+ * See dmu_recompress().
+ */
+static int
+zfs_ioc_recompress(const char *dsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	dmu_recompress_stats_t drs;
+	objset_t *os;
+	spa_t *spa;
+	uint64_t compress, age = 0, budget = 64ULL << 20;
+	uint64_t object = 0, offset = 0;
+	spa_feature_t f;
+	int error;
+
+	if (nvlist_lookup_uint64(innvl, "compress", &compress) != 0)
+		return (SET_ERROR(EINVAL));
+	(void) nvlist_lookup_uint64(innvl, "age", &age);
+	(void) nvlist_lookup_uint64(innvl, "budget", &budget);
+	(void) nvlist_lookup_uint64(innvl, "object", &object);
+	(void) nvlist_lookup_uint64(innvl, "offset", &offset);
+
+	if (compress >= ZIO_COMPRESS_FUNCTIONS ||
+	    compress == ZIO_COMPRESS_INHERIT || compress == ZIO_COMPRESS_ON ||
+	    compress == ZIO_COMPRESS_OFF || compress == ZIO_COMPRESS_EMPTY ||
+	    budget == 0)
+		return (SET_ERROR(EINVAL));
+
+	error = dmu_objset_hold(dsname, FTAG, &os);
+	if (error != 0)
+		return (error);
+
+	/* the same checks as for setting the compression property */
+	spa = dmu_objset_spa(os);
+	f = zio_compress_to_feature(compress);
+	if ((compress == ZIO_COMPRESS_ZLE &&
+	    spa_version(spa) < SPA_VERSION_ZLE_COMPRESSION) ||
+	    (compress == ZIO_COMPRESS_LZ4 &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_LZ4_COMPRESS)) ||
+	    (f != SPA_FEATURE_NONE && !spa_feature_is_enabled(spa, f))) {
+		dmu_objset_rele(os, FTAG);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	if (dmu_objset_type(os) != DMU_OST_ZFS &&
+	    dmu_objset_type(os) != DMU_OST_ZVOL) {
+		dmu_objset_rele(os, FTAG);
+		return (SET_ERROR(EINVAL));
+	}
+	if (dmu_objset_is_snapshot(os)) {
+		dmu_objset_rele(os, FTAG);
+		return (SET_ERROR(EROFS));
+	}
+
+	error = dmu_recompress(os, compress, age, budget, &object, &offset,
+	    &drs);
+	dmu_objset_rele(os, FTAG);
+
+	/* report how far we got even if interrupted */
+	if (error == 0 || error == EINTR) {
+		fnvlist_add_uint64(outnvl, "object", object);
+		fnvlist_add_uint64(outnvl, "offset", offset);
+		dmu_recompress_to_nvlist(&drs, outnvl);
+	}
+	return (error);
+}
+
 static int
 zfs_prop_set_userquota(const char *dsname, nvpair_t *pair)
 {
@@ -3028,6 +3496,7 @@ zfs_fill_zplprops_root(uint64_t spa_vers, nvlist_t *createprops,
  * innvl: {
  *     "type" -> dmu_objset_type_t (int32)
  *     (optional) "props" -> { prop -> value }
+ *     (optional) "hidden_args" -> { "wkeydata" -> value }
  * }
  *
  * outnvl: propname -> error code (int32)
@@ -3038,6 +3507,8 @@ zfs_ioc_create(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
 	int error = 0;
 	zfs_creat_t zct = { 0 };
 	nvlist_t *nvprops = NULL;
+	nvlist_t *hidden_args = NULL;
+	dsl_crypto_params_t *dcp = NULL;
 	void (*cbfunc)(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx);
 	int32_t type32;
 	dmu_objset_type_t type;
@@ -3050,6 +3521,7 @@ zfs_ioc_create(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
 		return (SET_ERROR(EINVAL));
 	type = type32;
 	(void) nvlist_lookup_nvlist(innvl, "props", &nvprops);
+	(void) nvlist_lookup_nvlist(innvl, ZPOOL_HIDDEN_ARGS, &hidden_args);
 
 	switch (type) {
 	case DMU_OST_ZFS:
@@ -3114,9 +3586,17 @@ zfs_ioc_create(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
 		}
 	}
 
+	error = dsl_crypto_params_create_nvlist(nvprops, hidden_args, &dcp);
+	if (error != 0) {
+		nvlist_free(zct.zct_zplprops);
+		return (error);
+	}
+
 	error = dmu_objset_create(fsname, type,
-							  is_insensitive ? DS_FLAG_CI_DATASET : 0, cbfunc, &zct);
+							  is_insensitive ? DS_FLAG_CI_DATASET : 0, dcp,
+							  cbfunc, &zct);
 	nvlist_free(zct.zct_zplprops);
+	dsl_crypto_params_free(dcp);
 
 	/*
 	 * It would be nice to do this atomically.
@@ -3490,6 +3970,56 @@ zfs_ioc_destroy_bookmarks(const char *poolname, nvlist_t *innvl,
 	return (error);
 }
 
+/*
+ * innvl: {
+ *     "hidden_args" -> { "wkeydata" -> value }
+ * }
+ *
+ * outnvl is unused
+ */
+/* ARGSUSED */
+static int
+zfs_ioc_load_key(const char *dsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	dsl_wrapping_key_t *wkey;
+	nvlist_t *hidden_args;
+	uint8_t *wkeydata;
+	uint_t wkeylen;
+	int error;
+
+	if (strchr(dsname, '@') != NULL || strchr(dsname, '%') != NULL)
+		return (SET_ERROR(EINVAL));
+
+	if (nvlist_lookup_nvlist(innvl, ZPOOL_HIDDEN_ARGS,
+	    &hidden_args) != 0 ||
+	    nvlist_lookup_uint8_array(hidden_args, "wkeydata",
+	    &wkeydata, &wkeylen) != 0)
+		return (SET_ERROR(EINVAL));
+
+	error = dsl_wrapping_key_create(wkeydata, wkeylen, &wkey);
+	if (error != 0)
+		return (error);
+
+	error = spa_keystore_load_wkey(dsname, wkey);
+	dsl_wrapping_key_free(wkey);
+
+	return (error);
+}
+
+/*
+ * innvl is unused
+ * outnvl is unused
+ */
+/* ARGSUSED */
+static int
+zfs_ioc_unload_key(const char *dsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	if (strchr(dsname, '@') != NULL || strchr(dsname, '%') != NULL)
+		return (SET_ERROR(EINVAL));
+
+	return (spa_keystore_unload_wkey(dsname));
+}
+
 /*
  * inputs:
  * zc_name		name of dataset to destroy
@@ -3705,6 +4235,20 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			if (ZIO_COMPRESS_IS_ZSTD(intval)) {
+				spa_t *spa;
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa,
+				    zio_compress_to_feature(intval))) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -3763,6 +4307,52 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 		}
 		break;
 
+	case ZFS_PROP_DNODESIZE:
+		/* Dnode sizes above 512 need the feature to be enabled */
+		if (nvpair_value_uint64(pair, &intval) == 0 &&
+		    intval != ZFS_DNSIZE_LEGACY) {
+			spa_t *spa;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa,
+			    SPA_FEATURE_LARGE_DNODE)) {
+				spa_close(spa, FTAG);
+				return (SET_ERROR(ENOTSUP));
+			}
+			spa_close(spa, FTAG);
+		}
+		break;
+
+	case ZFS_PROP_DIRTY_WEIGHT:
+		if (nvpair_value_uint64(pair, &intval) == 0 &&
+		    (intval < ZFS_DIRTY_WEIGHT_MIN ||
+		    intval > ZFS_DIRTY_WEIGHT_MAX))
+			return (SET_ERROR(ERANGE));
+		break;
+
+	case ZFS_PROP_SPECIAL_SMALL_BLOCKS:
+		/* Small blocks only have somewhere to go with the feature */
+		if (nvpair_value_uint64(pair, &intval) == 0 && intval != 0) {
+			spa_t *spa;
+
+			if (intval < SPA_MINBLOCKSIZE ||
+			    intval > SPA_OLD_MAXBLOCKSIZE || !ISP2(intval))
+				return (SET_ERROR(ERANGE));
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa,
+			    SPA_FEATURE_ALLOCATION_CLASSES)) {
+				spa_close(spa, FTAG);
+				return (SET_ERROR(ENOTSUP));
+			}
+			spa_close(spa, FTAG);
+		}
+		break;
+
 	case ZFS_PROP_SHARESMB:
 		if (zpl_earlier_version(dsname, ZPL_VERSION_FUID))
 			return (SET_ERROR(ENOTSUP));
@@ -4018,6 +4608,7 @@ static boolean_t zfs_ioc_recv_inject_err;
  * zc_cleanup_fd	cleanup-on-exit file descriptor
  * zc_action_handle	handle for this guid/ds mapping (or zero on first call)
  * zc_resumable		if data is incomplete assume sender will resume
+ * zc_flags		ZFS_RECV_READAHEAD if stream may be read past its end
  *
  * outputs:
  * zc_cookie		number of bytes read
@@ -4074,6 +4665,7 @@ zfs_ioc_recv(zfs_cmd_t *zc)
         &zc->zc_begin_record, force, zc->zc_resumable, origin, &drc);
     if (error != 0)
         goto out;
+    drc.drc_readahead = !!(zc->zc_flags & ZFS_RECV_READAHEAD);
 
     /*
      * Set properties before we receive the stream so that they are applied
@@ -4260,9 +4852,12 @@ zfs_ioc_recv(zfs_cmd_t *zc)
  * zc_guid	if set, estimate size of stream only.  zc_cookie is ignored.
  *		output size in zc_objset_type.
  * zc_flags	lzc_send_flags
+ * zc_nvlist_src{_size}	optional "exclude_objs" and "exclude_paths" to
+ *		leave out of the stream (see zfs_ioc_send_new)
  *
  * outputs:
  * zc_objset_type	estimated size, if zc_guid is set
+ * zc_cookie	error of the estimate (95% confidence), if zc_guid is set
  */
 static int
 zfs_ioc_send(zfs_cmd_t *zc)
@@ -4320,25 +4915,41 @@ zfs_ioc_send(zfs_cmd_t *zc)
 		}
 
 		error = dmu_send_estimate(tosnap, fromsnap, compressok,
-								  &zc->zc_objset_type);
+		    &zc->zc_objset_type, &zc->zc_cookie);
 
 		if (fromsnap != NULL)
 			dsl_dataset_rele(fromsnap, FTAG);
 		dsl_dataset_rele(tosnap, FTAG);
 		dsl_pool_rele(dp, FTAG);
 	} else {
-		file_t *fp = getf(zc->zc_cookie);
-		if (fp == NULL)
+		nvlist_t *nvl = NULL;
+		dmu_send_filter_t *filter;
+		file_t *fp;
+
+		if (zc->zc_nvlist_src_size != 0 &&
+		    (error = get_nvlist(zc->zc_nvlist_src,
+		    zc->zc_nvlist_src_size, zc->zc_iflags, &nvl)) != 0)
+			return (error);
+		error = dmu_send_filter_create(nvl, &filter);
+		nvlist_free(nvl);
+		if (error != 0)
+			return (error);
+
+		fp = getf(zc->zc_cookie);
+		if (fp == NULL) {
+			dmu_send_filter_destroy(filter);
 			return EBADF;
+		}
 
 		off = fp->f_offset;
 		error = dmu_send_obj(zc->zc_name, zc->zc_sendobj,
 		    zc->zc_fromobj, embedok, large_block_ok, compressok,
-		    zc->zc_cookie, fp->f_vnode, &off);
+		    filter, zc->zc_cookie, fp->f_vnode, &off);
 
 		//if (VOP_SEEK(fp->f_vnode, fp->f_offset, &off, NULL) == 0)
 		fp->f_offset = off;
 		releasef(zc->zc_cookie);
+		dmu_send_filter_destroy(filter);
 
 	}
 	return (error);
@@ -4353,6 +4964,8 @@ zfs_ioc_send(zfs_cmd_t *zc)
  *
  * outputs:
  * zc_cookie	number of bytes written in send stream thus far
+ * zc_sendobj	bytes of data blocks found by the traversal thus far
+ * zc_fromobj	bytes of data blocks read thus far
  */
 static int
 zfs_ioc_send_progress(zfs_cmd_t *zc)
@@ -4388,9 +5001,11 @@ zfs_ioc_send_progress(zfs_cmd_t *zc)
             break;
     }
 
-	if (dsp != NULL)
+	if (dsp != NULL) {
 		zc->zc_cookie = *(dsp->dsa_off);
-	else
+		zc->zc_sendobj = dsp->dsa_traversed_bytes;
+		zc->zc_fromobj = dsp->dsa_read_bytes;
+	} else
 		error = SET_ERROR(ENOENT);
 
 	mutex_exit(&ds->ds_sendstream_lock);
@@ -5239,6 +5854,11 @@ zfs_ioc_space_snaps(const char *lastsnap, nvlist_t *innvl, nvlist_t *outnvl)
  *         presence indicates compressed DRR_WRITE records are permitted
  *     (optional) "resume_object" and "resume_offset" -> (uint64)
  *         if present, resume send stream from specified object and offset.
+ *     (optional) "exclude_objs" -> (uint64 array)
+ *         objects to send as freed, with none of their data
+ *     (optional) "exclude_paths" -> (string array)
+ *         likewise for the files and directories beneath each path,
+ *         relative to the root of the dataset
  * }
  *
  * outnvl is unused
@@ -5257,6 +5877,7 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	boolean_t compressok;
 	uint64_t resumeobj = 0;
 	uint64_t resumeoff = 0;
+	dmu_send_filter_t *filter;
 
 	error = nvlist_lookup_int32(innvl, "fd", &fd);
 	if (error != 0)
@@ -5271,14 +5892,20 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	(void) nvlist_lookup_uint64(innvl, "resume_object", &resumeobj);
 	(void) nvlist_lookup_uint64(innvl, "resume_offset", &resumeoff);
 
-	if ((fp = getf(fd)) == NULL)
+	error = dmu_send_filter_create(innvl, &filter);
+	if (error != 0)
+		return (error);
+
+	if ((fp = getf(fd)) == NULL) {
+		dmu_send_filter_destroy(filter);
 		return (SET_ERROR(EBADF));
+	}
 
 #ifndef __APPLE__
 	off = fp->f_offset;
 #endif
 	error = dmu_send(snapname, fromname, embedok, largeblockok, compressok,
-		fd,	resumeobj, resumeoff, fp->f_vnode, &off);
+		filter, fd,	resumeobj, resumeoff, fp->f_vnode, &off);
 
 #ifndef __APPLE__
 	if (VOP_SEEK(fp->f_vnode, fp->f_offset, &off, NULL) == 0)
@@ -5286,6 +5913,7 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 #endif
 
     releasef(fd);
+	dmu_send_filter_destroy(filter);
 	return (error);
 }
 
@@ -5306,6 +5934,8 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
  *
  * outnvl: {
  *     "space" -> bytes of space (uint64)
+ *     "space_error" -> bytes the estimate may be off by, with 95%
+ *                      confidence (uint64)
  * }
  */
 static int
@@ -5320,7 +5950,7 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	/* LINTED E_FUNC_SET_NOT_USED */
 	boolean_t embedok;
 	boolean_t compressok;
-	uint64_t space;
+	uint64_t space, space_error;
 
 	error = dsl_pool_hold(snapname, FTAG, &dp);
 	if (error != 0)
@@ -5340,16 +5970,15 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	if (error == 0) {
 		if (strchr(fromname, '@') != NULL) {
 			/*
-			 * If from is a snapshot, hold it and use the more
-			 * efficient dmu_send_estimate to estimate send space
-			 * size using deadlists.
+			 * If from is a snapshot, hold it so dmu_send_estimate
+			 * can check that it is an earlier snapshot.
 			 */
 			dsl_dataset_t *fromsnap;
 			error = dsl_dataset_hold(dp, fromname, FTAG, &fromsnap);
 			if (error != 0)
 				goto out;
 			error = dmu_send_estimate(tosnap, fromsnap, compressok,
-			    &space);
+			    &space, &space_error);
 			dsl_dataset_rele(fromsnap, FTAG);
 		} else if (strchr(fromname, '#') != NULL) {
 			/*
@@ -5364,7 +5993,8 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 			if (error != 0)
 				goto out;
 			error = dmu_send_estimate_from_txg(tosnap,
-			    frombm.zbm_creation_txg, compressok, &space);
+			    frombm.zbm_creation_txg, compressok, &space,
+			    &space_error);
 		} else {
 			/*
 			 * from is not properly formatted as a snapshot or
@@ -5375,10 +6005,12 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 		}
 	} else {
 		// If estimating the size of a full send, use dmu_send_estimate
-		error = dmu_send_estimate(tosnap, NULL, compressok, &space);
+		error = dmu_send_estimate(tosnap, NULL, compressok, &space,
+		    &space_error);
 	}
 
 	fnvlist_add_uint64(outnvl, "space", space);
+	fnvlist_add_uint64(outnvl, "space_error", space_error);
 
 out:
 	dsl_dataset_rele(tosnap, FTAG);
@@ -5549,11 +6181,40 @@ zfs_ioctl_init(void)
 	    zfs_ioc_get_bookmarks, zfs_secpolicy_read, DATASET_NAME,
 	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE);
 
+	zfs_ioctl_register("list_batch", ZFS_IOC_LIST_BATCH,
+	    zfs_ioc_list_batch, zfs_secpolicy_read, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE);
+
+	zfs_ioctl_register("block_sample", ZFS_IOC_BLOCK_SAMPLE,
+	    zfs_ioc_block_sample, zfs_secpolicy_read, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE);
+
+	zfs_ioctl_register("obj_to_stats_batch", ZFS_IOC_OBJ_TO_STATS_BATCH,
+	    zfs_ioc_obj_to_stats_batch, zfs_secpolicy_diff, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE);
+
+	zfs_ioctl_register("recompress", ZFS_IOC_RECOMPRESS,
+	    zfs_ioc_recompress, zfs_secpolicy_recompress, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE);
+
+	/* The zpios DMU benchmark, see zpios_osx.c */
+	zfs_ioctl_register("zpios", ZFS_IOC_ZPIOS,
+	    zpios_ioctl, zfs_secpolicy_config, POOL_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE);
+
 	zfs_ioctl_register("destroy_bookmarks", ZFS_IOC_DESTROY_BOOKMARKS,
 	    zfs_ioc_destroy_bookmarks, zfs_secpolicy_destroy_bookmarks,
 	    POOL_NAME,
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_TRUE);
 
+	zfs_ioctl_register("load-key", ZFS_IOC_LOAD_KEY,
+	    zfs_ioc_load_key, zfs_secpolicy_load_key, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_TRUE, B_TRUE);
+
+	zfs_ioctl_register("unload-key", ZFS_IOC_UNLOAD_KEY,
+	    zfs_ioc_unload_key, zfs_secpolicy_load_key, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_TRUE, B_FALSE);
+
 	/* IOCTLS that use the legacy function signature */
 
 	zfs_ioctl_register_legacy(ZFS_IOC_POOL_FREEZE, zfs_ioc_pool_freeze,
@@ -5563,6 +6224,8 @@ zfs_ioctl_init(void)
 							zfs_secpolicy_config, B_TRUE, POOL_CHECK_NONE);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_SCAN,
 								   zfs_ioc_pool_scan);
+	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_TRIM,
+								   zfs_ioc_pool_trim);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_UPGRADE,
 								   zfs_ioc_pool_upgrade);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_VDEV_ADD,
@@ -5938,6 +6601,7 @@ zfsdev_ioctl(dev_t dev, u_long cmd, caddr_t arg,  __unused int xflag, struct pro
 	const zfs_ioc_vec_t *vec;
 	char *saved_poolname = NULL;
 	nvlist_t *innvl = NULL;
+	nv_alloc_t nva = { NULL, NULL };
 
 	vfs_context_t ctx = vfs_context_current();
 	cred_t *cr = vfs_context_ucred(ctx);
@@ -6000,9 +6664,18 @@ zfsdev_ioctl(dev_t dev, u_long cmd, caddr_t arg,  __unused int xflag, struct pro
 	zc->zc_dev = dev;
 
 	zc->zc_iflags = flag & ~FKIOCTL;
+
+	/*
+	 * The input and output nvlists last only as long as the ioctl,
+	 * so draw them from an arena that is released in one go at the
+	 * end.  An unpacked list takes somewhat more than its packed size.
+	 */
+	VERIFY0(nv_alloc_init(&nva, nv_arena_ops,
+	    (size_t)zc->zc_nvlist_src_size * 2));
+
 	if (zc->zc_nvlist_src_size != 0) {
-		error = get_nvlist(zc->zc_nvlist_src, zc->zc_nvlist_src_size,
-		    zc->zc_iflags, &innvl);
+		error = get_nvlist_nva(zc->zc_nvlist_src,
+		    zc->zc_nvlist_src_size, zc->zc_iflags, &nva, &innvl);
 		if (error != 0)
 			goto out;
 	}
@@ -6069,12 +6742,17 @@ zfsdev_ioctl(dev_t dev, u_long cmd, caddr_t arg,  __unused int xflag, struct pro
 			fnvlist_add_string(lognv, ZPOOL_HIST_IOCTL,
 			    vec->zvec_name);
 			if (!nvlist_empty(innvl)) {
+				nvlist_t *lognvl = fnvlist_dup(innvl);
+
+				(void) nvlist_remove_all(lognvl,
+				    ZPOOL_HIDDEN_ARGS);
 				fnvlist_add_nvlist(lognv, ZPOOL_HIST_INPUT_NVL,
-				    innvl);
+				    lognvl);
+				fnvlist_free(lognvl);
 			}
 		}
 
-		outnvl = fnvlist_alloc();
+		VERIFY0(nvlist_xalloc(&outnvl, NV_UNIQUE_NAME, &nva));
 		error = vec->zvec_func(zc->zc_name, innvl, outnvl);
 
 		if (error == 0 && vec->zvec_allow_log &&
@@ -6110,6 +6788,8 @@ zfsdev_ioctl(dev_t dev, u_long cmd, caddr_t arg,  __unused int xflag, struct pro
 
  out:
 	nvlist_free(innvl);
+	if (nva.nva_ops != NULL)
+		nv_alloc_fini(&nva);
 	rc = ddi_copyout(zc, (void *)arg, sizeof (zfs_cmd_t), flag);
 	if (error == 0 && rc != 0) {
 		dprintf("ddi_copyout fault\n");
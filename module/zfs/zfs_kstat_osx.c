@@ -25,12 +25,14 @@
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
+#include <sys/zio_crypt.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
 #include <sys/refcount.h>
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
 #include <sys/dsl_pool.h>
+#include <sys/zfs_lockstat.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <vm/anon.h>
@@ -42,8 +44,13 @@
 #include <sys/kstat_osx.h>
 #include <sys/zfs_ioctl.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
 #include <sys/zap_impl.h>
 #include <sys/zil.h>
+#include <zfs_fletcher.h>
+#include <sys/vdev_raidz.h>
+#include <sys/abd.h>
+#include <sys/zfs_bench.h>
 
 /*
  * In Solaris the tunable are set via /etc/system. Until we have a load
@@ -68,6 +75,13 @@ osx_kstat_t osx_kstat = {
 	{ "create_negatives",			KSTAT_DATA_UINT64 },
 	{ "force_formd_normalized",		KSTAT_DATA_UINT64 },
 	{ "skip_unlinked_drain",		KSTAT_DATA_UINT64 },
+	{ "pagein_readahead",			KSTAT_DATA_UINT64 },
+	{ "reclaim_async",			KSTAT_DATA_UINT64 },
+	{ "reclaim_batch",			KSTAT_DATA_UINT64 },
+	{ "findernotify_interval",		KSTAT_DATA_UINT64 },
+	{ "findernotify_threshold",		KSTAT_DATA_UINT64 },
+	{ "findernotify_sent",			KSTAT_DATA_UINT64 },
+	{ "findernotify_suppressed",		KSTAT_DATA_UINT64 },
 
 	{ "zfs_arc_max",				KSTAT_DATA_UINT64 },
 	{ "zfs_arc_min",				KSTAT_DATA_UINT64 },
@@ -77,9 +91,11 @@ osx_kstat_t osx_kstat = {
 	{ "zfs_arc_shrink_shift",		KSTAT_DATA_UINT64 },
 	{ "zfs_arc_p_min_shift",		KSTAT_DATA_UINT64 },
 	{ "zfs_arc_average_blocksize",	KSTAT_DATA_UINT64 },
+	{ "zfs_arc_free_target",		KSTAT_DATA_UINT64 },
 
 	{ "l2arc_write_max",			KSTAT_DATA_UINT64 },
 	{ "l2arc_write_boost",			KSTAT_DATA_UINT64 },
+	{ "l2arc_write_limit",			KSTAT_DATA_UINT64 },
 	{ "l2arc_headroom",				KSTAT_DATA_UINT64 },
 	{ "l2arc_headroom_boost",		KSTAT_DATA_UINT64 },
 	{ "l2arc_max_block_size",		KSTAT_DATA_UINT64 },
@@ -97,9 +113,16 @@ osx_kstat_t osx_kstat = {
 	{ "async_write_max_active",		KSTAT_DATA_UINT64 },
 	{ "scrub_min_active",			KSTAT_DATA_UINT64 },
 	{ "scrub_max_active",			KSTAT_DATA_UINT64 },
+	{ "resilver_min_active",		KSTAT_DATA_UINT64 },
+	{ "resilver_max_active",		KSTAT_DATA_UINT64 },
+	{ "queue_tune",					KSTAT_DATA_INT64  },
+	{ "queue_tune_window",			KSTAT_DATA_UINT64 },
+	{ "queue_tune_latency_pct",		KSTAT_DATA_UINT64 },
+	{ "queue_tune_max_active",		KSTAT_DATA_UINT64 },
 	{ "async_write_min_dirty_pct",	KSTAT_DATA_INT64  },
 	{ "async_write_max_dirty_pct",	KSTAT_DATA_INT64  },
 	{ "aggregation_limit",			KSTAT_DATA_INT64  },
+	{ "aggregation_limit_max",		KSTAT_DATA_INT64  },
 	{ "read_gap_limit",				KSTAT_DATA_INT64  },
 	{ "write_gap_limit",			KSTAT_DATA_INT64  },
 
@@ -110,12 +133,16 @@ osx_kstat_t osx_kstat = {
 	{"zfs_delay_max_ns",			KSTAT_DATA_INT64  },
 	{"zfs_delay_min_dirty_percent",	KSTAT_DATA_INT64  },
 	{"zfs_delay_scale",				KSTAT_DATA_INT64  },
+	{"zfs_delay_sync_target_ms",	KSTAT_DATA_INT64  },
 	{"spa_asize_inflation",			KSTAT_DATA_INT64  },
 	{"zfs_mdcomp_disable",			KSTAT_DATA_INT64  },
 	{"zfs_prefetch_disable",		KSTAT_DATA_INT64  },
 	{"zfetch_max_streams",			KSTAT_DATA_INT64  },
 	{"zfetch_min_sec_reap",			KSTAT_DATA_INT64  },
 	{"zfetch_array_rd_sz",			KSTAT_DATA_INT64  },
+	{"zfetch_sequential_min",		KSTAT_DATA_INT64  },
+	{"zfetch_max_stride",			KSTAT_DATA_INT64  },
+	{"zfetch_adaptive_distance",		KSTAT_DATA_INT64  },
 	{"zfs_default_bs",				KSTAT_DATA_INT64  },
 	{"zfs_default_ibs",				KSTAT_DATA_INT64  },
 	{"metaslab_aliquot",			KSTAT_DATA_INT64  },
@@ -123,6 +150,7 @@ osx_kstat_t osx_kstat = {
 	{"spa_mode_global",				KSTAT_DATA_INT64  },
 	{"zfs_flags",					KSTAT_DATA_INT64  },
 	{"zfs_txg_timeout",				KSTAT_DATA_INT64  },
+	{"zfs_txg_early_write",			KSTAT_DATA_INT64  },
 	{"zfs_vdev_cache_max",			KSTAT_DATA_INT64  },
 	{"zfs_vdev_cache_size",			KSTAT_DATA_INT64  },
 	{"zfs_vdev_cache_bshift",		KSTAT_DATA_INT64  },
@@ -131,24 +159,64 @@ osx_kstat_t osx_kstat = {
 	{"zfs_no_scrub_io",				KSTAT_DATA_INT64  },
 	{"zfs_no_scrub_prefetch",		KSTAT_DATA_INT64  },
 	{"fzap_default_block_shift",	KSTAT_DATA_INT64  },
+	{"zap_micro_max_size",		KSTAT_DATA_INT64  },
+	{"zap_cursor_prefetch_leaves",	KSTAT_DATA_INT64  },
+	{"zfs_readdir_dnode_prefetch",	KSTAT_DATA_INT64  },
+	{"zfs_dir_negcache",		KSTAT_DATA_INT64  },
 	{"zfs_immediate_write_sz",		KSTAT_DATA_INT64  },
 	{"zfs_read_chunk_size",			KSTAT_DATA_INT64  },
+	{"zfs_rlock_fastpath",			KSTAT_DATA_INT64  },
+	{"zfs_group_commit",			KSTAT_DATA_INT64  },
+	{"zfs_group_commit_window_us",		KSTAT_DATA_INT64  },
+	{"zfs_inline_data_max",			KSTAT_DATA_INT64  },
 	{"zfs_nocacheflush",			KSTAT_DATA_INT64  },
+	{"zfs_nocacheflush_slog",		KSTAT_DATA_INT64  },
 	{"zil_replay_disable",			KSTAT_DATA_INT64  },
+	{"zfs_commit_timeout_pct",		KSTAT_DATA_INT64  },
+	{"zil_maxblocksize",			KSTAT_DATA_INT64  },
+	{"zil_replay_taskqs",			KSTAT_DATA_INT64  },
 	{"metaslab_gang_bang",			KSTAT_DATA_INT64  },
 	{"metaslab_df_alloc_threshold",	KSTAT_DATA_INT64  },
 	{"metaslab_df_free_pct",		KSTAT_DATA_INT64  },
+	{"metaslab_adaptive_alloc",		KSTAT_DATA_INT64  },
+	{"metaslab_adaptive_free_pct",	KSTAT_DATA_INT64  },
+	{"metaslab_adaptive_frag_pct",	KSTAT_DATA_INT64  },
+	{"metaslab_adaptive_latency_ns",	KSTAT_DATA_UINT64  },
+	{"metaslab_latency_bias_pct",	KSTAT_DATA_INT64  },
+	{"metaslab_seq_zone_shift",	KSTAT_DATA_INT64  },
+	{"zfs_uberblock_sync_subset",	KSTAT_DATA_INT64  },
+	{"zfs_embedded_log_metaslabs",		KSTAT_DATA_INT64  },
+	{"zfs_embedded_log_min_ms",		KSTAT_DATA_INT64  },
+	{"zfs_log_spacemaps",			KSTAT_DATA_INT64  },
+	{"zfs_unflushed_log_txg_max",	KSTAT_DATA_UINT64  },
+	{"zfs_min_metaslabs_to_flush",	KSTAT_DATA_UINT64  },
+	{"zfs_keep_log_spacemaps_at_export",	KSTAT_DATA_INT64  },
+	{"zfs_special_class_metadata_reserve_pct",	KSTAT_DATA_INT64  },
+	{"zfs_ddt_cache_max",			KSTAT_DATA_UINT64  },
+	{"zfs_ddt_prune_age",			KSTAT_DATA_UINT64  },
+	{"zfs_ddt_prune_batch",			KSTAT_DATA_INT64  },
+	{"zfs_list_batch_max",			KSTAT_DATA_INT64  },
+	{"zfs_destroy_prefetch_threads",	KSTAT_DATA_INT64  },
+	{"zfs_config_sync_delay_ms",		KSTAT_DATA_INT64  },
+	{"zfs_bench_blocksize",			KSTAT_DATA_INT64  },
 	{"zio_injection_enabled",		KSTAT_DATA_INT64  },
 	{"zvol_immediate_write_sz",		KSTAT_DATA_INT64  },
+	{"zvol_sync_batch",			KSTAT_DATA_INT64  },
 
 	{ "l2arc_noprefetch",			KSTAT_DATA_INT64  },
 	{ "l2arc_feed_again",			KSTAT_DATA_INT64  },
 	{ "l2arc_norw",					KSTAT_DATA_INT64  },
+	{ "l2arc_rebuild_enabled",		KSTAT_DATA_INT64  },
+	{ "l2arc_compress",			KSTAT_DATA_INT64  },
 
 	{"zfs_top_maxinflight",			KSTAT_DATA_INT64  },
 	{"zfs_resilver_delay",			KSTAT_DATA_INT64  },
 	{"zfs_scrub_delay",				KSTAT_DATA_INT64  },
 	{"zfs_scan_idle",				KSTAT_DATA_INT64  },
+	{"zfs_scan_fg_latency_pct",		KSTAT_DATA_INT64  },
+	{"zfs_scan_legacy",				KSTAT_DATA_INT64  },
+	{"zfs_scan_mem_lim_fact",		KSTAT_DATA_INT64  },
+	{"zfs_scan_max_ext_gap",		KSTAT_DATA_INT64  },
 
 	{"zfs_recover",					KSTAT_DATA_INT64  },
 
@@ -158,12 +226,21 @@ osx_kstat_t osx_kstat = {
 	{"zfs_send_corrupt_data",		KSTAT_DATA_UINT64  },
 	{"zfs_send_queue_length",		KSTAT_DATA_UINT64  },
 	{"zfs_recv_queue_length",		KSTAT_DATA_UINT64  },
+	{"zfs_recv_writers",			KSTAT_DATA_INT64  },
+	{"zfs_recv_write_batch",		KSTAT_DATA_INT64  },
+	{"zfs_send_readers",			KSTAT_DATA_INT64  },
+	{"zfs_send_read_window",		KSTAT_DATA_INT64  },
+	{"zfs_send_write_size",			KSTAT_DATA_INT64  },
+	{"zfs_send_estimate_sample_rate",	KSTAT_DATA_INT64  },
+	{"zfs_send_estimate_min_samples",	KSTAT_DATA_INT64  },
 
 	{"zfs_vdev_mirror_rotating_inc",		KSTAT_DATA_UINT64  },
 	{"zfs_vdev_mirror_rotating_seek_inc",	KSTAT_DATA_UINT64  },
 	{"zfs_vdev_mirror_rotating_seek_offset",KSTAT_DATA_UINT64  },
 	{"zfs_vdev_mirror_non_rotating_inc",	KSTAT_DATA_UINT64  },
 	{"zfs_vdev_mirror_non_rotating_seek_inc",KSTAT_DATA_UINT64  },
+	{"zfs_vdev_mirror_rotating_mixed_inc",	KSTAT_DATA_UINT64  },
+	{"zfs_vdev_mirror_ditto_balance",	KSTAT_DATA_UINT64  },
 
 	{"zvol_inhibit_dev",KSTAT_DATA_UINT64  },
 	{"zfs_send_set_freerecords_bit",KSTAT_DATA_UINT64  },
@@ -172,9 +249,70 @@ osx_kstat_t osx_kstat = {
 	{"zfs_send_holes_without_birth_time",KSTAT_DATA_UINT64  },
 
 	{"dbuf_cache_max_bytes",KSTAT_DATA_UINT64  },
+	{"dbuf_cache_adaptive_shift",KSTAT_DATA_INT64  },
+	{"dbuf_evict_user_batch",KSTAT_DATA_INT64  },
+	{"dbuf_evict_user_taskq_pct",KSTAT_DATA_INT64  },
+	{"dmu_object_alloc_chunk_shift",KSTAT_DATA_INT64  },
 
 	{"zfs_vdev_queue_depth_pct",KSTAT_DATA_UINT64  },
 	{"zio_dva_throttle_enabled",KSTAT_DATA_UINT64  },
+	{"zio_ddt_prefetch_enabled",KSTAT_DATA_UINT64  },
+	{"zio_stage_timing_enabled",KSTAT_DATA_UINT64  },
+	{"zio_gang_fit_enabled",KSTAT_DATA_UINT64  },
+
+	{"zfs_fletcher_4_impl",KSTAT_DATA_STRING  },
+	{"zfs_vdev_raidz_impl",KSTAT_DATA_STRING  },
+
+	{"zfs_abd_scatter_enabled",KSTAT_DATA_UINT64  },
+
+	{"zfs_compress_early_abort",KSTAT_DATA_INT64  },
+	{"zfs_compress_abort_streak",KSTAT_DATA_INT64  },
+	{"zfs_compress_abort_retry",KSTAT_DATA_INT64  },
+
+	{"zfs_key_max_salt_uses",KSTAT_DATA_UINT64  },
+
+	{"zfs_trim_extent_bytes_min",KSTAT_DATA_UINT64  },
+	{"zfs_trim_extent_bytes_max",KSTAT_DATA_UINT64  },
+	{"zfs_trim_txg_batch",KSTAT_DATA_UINT64  },
+	{"zfs_trim_rate",KSTAT_DATA_UINT64  },
+	{"zfs_arc_warm",KSTAT_DATA_INT64  },
+	{"zfs_arc_warm_sample",KSTAT_DATA_INT64  },
+	{"zfs_arc_warm_entries",KSTAT_DATA_INT64  },
+	{"zfs_arc_warm_rate",KSTAT_DATA_INT64  },
+	{"zio_taskq_batch_pct",KSTAT_DATA_UINT64  },
+	{"zio_taskq_batch_tpq",KSTAT_DATA_UINT64  },
+	{"zio_taskq_read",KSTAT_DATA_STRING  },
+	{"zio_taskq_write",KSTAT_DATA_STRING  },
+	{"zio_taskq_affine",KSTAT_DATA_INT64  },
+	{"zio_taskq_affine_imbalance",KSTAT_DATA_INT64  },
+	{"zfs_dirty_data_cpu_slack",KSTAT_DATA_UINT64  },
+	{"zfs_arc_sublist_by_cpu",KSTAT_DATA_INT64  },
+	{"zfs_mutex_spin",KSTAT_DATA_INT64  },
+	{"zfs_rebuild_sequential",KSTAT_DATA_INT64  },
+	{"zfs_rebuild_extent_bytes_max",KSTAT_DATA_UINT64  },
+	{"zfs_rebuild_batch_bytes",KSTAT_DATA_UINT64  },
+	{"zfs_rebuild_scrub",KSTAT_DATA_INT64  },
+	{"zfs_free_async",KSTAT_DATA_INT64  },
+	{"zfs_free_max_blocks_limit",KSTAT_DATA_UINT64  },
+	{"zfs_condense_txgs",KSTAT_DATA_INT64  },
+	{"zfs_free_throttle_ms",KSTAT_DATA_INT64  },
+	{"zfs_free_throttle_min_blocks",KSTAT_DATA_INT64  },
+	{"zfs_free_throttle_urgent_pct",KSTAT_DATA_INT64  },
+	{"zio_scan_verify_pct",KSTAT_DATA_UINT64  },
+	{"zio_scan_verify_batch",KSTAT_DATA_UINT64  },
+	{"zfs_resilver_priority",KSTAT_DATA_INT64  },
+	{"zfs_raidz_combrec_hint",KSTAT_DATA_INT64  },
+	{"zfs_vdev_file_nocache",KSTAT_DATA_INT64  },
+	{"zfs_vdev_cache_min_hit_pct",KSTAT_DATA_INT64  },
+	{"zfs_vdev_cache_probe",KSTAT_DATA_INT64  },
+	{"zfs_xattr_sa_rsrc_max",KSTAT_DATA_UINT64  },
+	{"zfs_acl_access_cache",KSTAT_DATA_INT64  },
+	{"zfs_lz4_acceleration",KSTAT_DATA_INT64  },
+	{"zfs_dirty_data_fair",KSTAT_DATA_INT64  },
+	{"zfs_dbuf_stats_dump",KSTAT_DATA_INT64  },
+	{"dbuf_deferred_rmw",KSTAT_DATA_INT64  },
+	{"zfs_recv_read_size",KSTAT_DATA_INT64  },
+	{"zfs_allow_filtered_mount",KSTAT_DATA_INT64  },
 };
 
 
@@ -182,6 +320,11 @@ osx_kstat_t osx_kstat = {
 
 static kstat_t		*osx_kstat_ksp;
 
+static char fletcher_4_impl_str[128];
+static char vdev_raidz_impl_str[128];
+static char zio_taskq_read_str[128];
+static char zio_taskq_write_str[128];
+
 
 static int osx_kstat_update(kstat_t *ksp, int rw)
 {
@@ -199,6 +342,13 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		zfs_vnop_create_negatives = ks->darwin_create_negatives.value.ui64;
 		zfs_vnop_force_formd_normalized_output = ks->darwin_force_formd_normalized.value.ui64;
 		zfs_vnop_skip_unlinked_drain = ks->darwin_skip_unlinked_drain.value.ui64;
+		zfs_vnop_pagein_readahead = ks->darwin_pagein_readahead.value.ui64;
+		zfs_vnop_reclaim_async = ks->darwin_reclaim_async.value.ui64;
+		zfs_vnop_reclaim_batch = ks->darwin_reclaim_batch.value.ui64;
+		zfs_vnop_findernotify_interval =
+		    ks->darwin_findernotify_interval.value.ui64;
+		zfs_vnop_findernotify_threshold =
+		    ks->darwin_findernotify_threshold.value.ui64;
 
 		/* ARC */
 		arc_kstat_update(ksp, rw);
@@ -207,6 +357,7 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		/* L2ARC */
 		l2arc_write_max = ks->l2arc_write_max.value.ui64;
 		l2arc_write_boost = ks->l2arc_write_boost.value.ui64;
+		l2arc_write_limit = ks->l2arc_write_limit.value.ui64;
 		l2arc_headroom = ks->l2arc_headroom.value.ui64;
 		l2arc_headroom_boost = ks->l2arc_headroom_boost.value.ui64;
 		l2arc_max_block_size = ks->l2arc_max_block_size.value.ui64;
@@ -216,6 +367,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		l2arc_noprefetch = ks->l2arc_noprefetch.value.i64;
 		l2arc_feed_again = ks->l2arc_feed_again.value.i64;
 		l2arc_norw = ks->l2arc_norw.value.i64;
+		l2arc_rebuild_enabled = ks->l2arc_rebuild_enabled.value.i64;
+		l2arc_compress = ks->l2arc_compress.value.i64;
 
 		/* vdev_queue */
 
@@ -241,12 +394,26 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_vdev_scrub_min_active.value.ui64;
 		zfs_vdev_scrub_max_active =
 			ks->zfs_vdev_scrub_max_active.value.ui64;
+		zfs_vdev_resilver_min_active =
+			ks->zfs_vdev_resilver_min_active.value.ui64;
+		zfs_vdev_resilver_max_active =
+			ks->zfs_vdev_resilver_max_active.value.ui64;
+		zfs_vdev_queue_tune =
+			ks->zfs_vdev_queue_tune.value.i64;
+		zfs_vdev_queue_tune_window =
+			ks->zfs_vdev_queue_tune_window.value.ui64;
+		zfs_vdev_queue_tune_latency_pct =
+			ks->zfs_vdev_queue_tune_latency_pct.value.ui64;
+		zfs_vdev_queue_tune_max_active =
+			ks->zfs_vdev_queue_tune_max_active.value.ui64;
 		zfs_vdev_async_write_active_min_dirty_percent =
 			ks->zfs_vdev_async_write_active_min_dirty_percent.value.i64;
 		zfs_vdev_async_write_active_max_dirty_percent =
 			ks->zfs_vdev_async_write_active_max_dirty_percent.value.i64;
 		zfs_vdev_aggregation_limit =
 			ks->zfs_vdev_aggregation_limit.value.i64;
+		zfs_vdev_aggregation_limit_max =
+			ks->zfs_vdev_aggregation_limit_max.value.i64;
 		zfs_vdev_read_gap_limit =
 			ks->zfs_vdev_read_gap_limit.value.i64;
 		zfs_vdev_write_gap_limit =
@@ -266,6 +433,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_delay_min_dirty_percent.value.i64;
 		zfs_delay_scale =
 			ks->zfs_delay_scale.value.i64;
+		zfs_delay_sync_target_ms =
+			ks->zfs_delay_sync_target_ms.value.i64;
 		spa_asize_inflation =
 			ks->spa_asize_inflation.value.i64;
 		zfs_mdcomp_disable =
@@ -278,6 +447,12 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfetch_min_sec_reap.value.i64;
 		zfetch_array_rd_sz =
 			ks->zfetch_array_rd_sz.value.i64;
+		zfetch_sequential_min =
+			ks->zfetch_sequential_min.value.i64;
+		zfetch_max_stride =
+			ks->zfetch_max_stride.value.i64;
+		zfetch_adaptive_distance =
+			ks->zfetch_adaptive_distance.value.i64;
 		zfs_default_bs =
 			ks->zfs_default_bs.value.i64;
 		zfs_default_ibs =
@@ -292,6 +467,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_flags.value.i64;
 		zfs_txg_timeout =
 			ks->zfs_txg_timeout.value.i64;
+		zfs_txg_early_write =
+			ks->zfs_txg_early_write.value.i64;
 		zfs_vdev_cache_max =
 			ks->zfs_vdev_cache_max.value.i64;
 		zfs_vdev_cache_size =
@@ -302,24 +479,97 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_no_scrub_prefetch.value.i64;
 		fzap_default_block_shift =
 			ks->fzap_default_block_shift.value.i64;
+		zap_micro_max_size =
+			ks->zap_micro_max_size.value.i64;
+		zap_cursor_prefetch_leaves =
+			ks->zap_cursor_prefetch_leaves.value.i64;
+		zfs_readdir_dnode_prefetch =
+			ks->zfs_readdir_dnode_prefetch.value.i64;
+		zfs_dir_negcache =
+			ks->zfs_dir_negcache.value.i64;
 		zfs_immediate_write_sz =
 			ks->zfs_immediate_write_sz.value.i64;
 		zfs_read_chunk_size =
 			ks->zfs_read_chunk_size.value.i64;
+		zfs_rlock_fastpath =
+			ks->zfs_rlock_fastpath.value.i64;
+		zfs_group_commit =
+			ks->zfs_group_commit.value.i64;
+		zfs_group_commit_window_us =
+			ks->zfs_group_commit_window_us.value.i64;
+		zfs_inline_data_max =
+			ks->zfs_inline_data_max.value.i64;
 		zfs_nocacheflush =
 			ks->zfs_nocacheflush.value.i64;
+		zfs_nocacheflush_slog =
+			ks->zfs_nocacheflush_slog.value.i64;
 		zil_replay_disable =
 			ks->zil_replay_disable.value.i64;
+		zfs_commit_timeout_pct =
+			ks->zfs_commit_timeout_pct.value.i64;
+		zil_maxblocksize =
+			ks->zil_maxblocksize.value.i64;
+		zil_replay_taskqs =
+			ks->zil_replay_taskqs.value.i64;
 		metaslab_gang_bang =
 			ks->metaslab_gang_bang.value.i64;
 		metaslab_df_alloc_threshold =
 			ks->metaslab_df_alloc_threshold.value.i64;
 		metaslab_df_free_pct =
 			ks->metaslab_df_free_pct.value.i64;
+		metaslab_adaptive_alloc =
+			ks->metaslab_adaptive_alloc.value.i64;
+		metaslab_adaptive_free_pct =
+			ks->metaslab_adaptive_free_pct.value.i64;
+		metaslab_adaptive_frag_pct =
+			ks->metaslab_adaptive_frag_pct.value.i64;
+		metaslab_adaptive_latency_ns =
+			ks->metaslab_adaptive_latency_ns.value.ui64;
+		metaslab_latency_bias_pct =
+			ks->metaslab_latency_bias_pct.value.i64;
+		metaslab_seq_zone_shift =
+			ks->metaslab_seq_zone_shift.value.i64;
+		zfs_uberblock_sync_subset =
+			ks->zfs_uberblock_sync_subset.value.i64;
+		zfs_embedded_log_metaslabs =
+			ks->zfs_embedded_log_metaslabs.value.i64;
+		zfs_embedded_log_min_ms =
+			ks->zfs_embedded_log_min_ms.value.i64;
+		zfs_log_spacemaps =
+			ks->zfs_log_spacemaps.value.i64;
+		zfs_unflushed_log_txg_max =
+			ks->zfs_unflushed_log_txg_max.value.ui64;
+		zfs_min_metaslabs_to_flush =
+			ks->zfs_min_metaslabs_to_flush.value.ui64;
+		zfs_keep_log_spacemaps_at_export =
+			ks->zfs_keep_log_spacemaps_at_export.value.i64;
+		zfs_special_class_metadata_reserve_pct =
+			ks->zfs_special_class_metadata_reserve_pct.value.i64;
+		zfs_ddt_cache_max =
+			ks->zfs_ddt_cache_max.value.ui64;
+		zfs_ddt_prune_age =
+			ks->zfs_ddt_prune_age.value.ui64;
+		zfs_ddt_prune_batch =
+			ks->zfs_ddt_prune_batch.value.i64;
+		zfs_list_batch_max =
+			ks->zfs_list_batch_max.value.i64;
+		zfs_destroy_prefetch_threads =
+			ks->zfs_destroy_prefetch_threads.value.i64;
+		zfs_config_sync_delay_ms =
+			ks->zfs_config_sync_delay_ms.value.i64;
+		zfs_bench_blocksize =
+			ks->zfs_bench_blocksize.value.i64;
+		if (zfs_bench_blocksize != 0) {
+			(void) zfs_bench_run(zfs_bench_blocksize, 0);
+			zfs_bench_blocksize = 0;
+			ks->zfs_bench_blocksize.value.i64 = 0;
+		}
 		zio_injection_enabled =
 			ks->zio_injection_enabled.value.i64;
 		zvol_immediate_write_sz =
 			ks->zvol_immediate_write_sz.value.i64;
+		zvol_sync_batch =
+			ks->zvol_sync_batch.value.i64;
 
 		zfs_top_maxinflight =
 			ks->zfs_top_maxinflight.value.i64;
@@ -329,6 +579,14 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_scrub_delay.value.i64;
 		zfs_scan_idle =
 			ks->zfs_scan_idle.value.i64;
+		zfs_scan_fg_latency_pct =
+			ks->zfs_scan_fg_latency_pct.value.i64;
+		zfs_scan_legacy =
+			ks->zfs_scan_legacy.value.i64;
+		zfs_scan_mem_lim_fact =
+			ks->zfs_scan_mem_lim_fact.value.i64;
+		zfs_scan_max_ext_gap =
+			ks->zfs_scan_max_ext_gap.value.i64;
 		zfs_recover =
 			ks->zfs_recover.value.i64;
 
@@ -343,6 +601,20 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_send_queue_length.value.ui64;
 		zfs_recv_queue_length =
 			ks->zfs_recv_queue_length.value.ui64;
+		zfs_recv_writers =
+			ks->zfs_recv_writers.value.i64;
+		zfs_recv_write_batch =
+			ks->zfs_recv_write_batch.value.i64;
+		zfs_send_readers =
+			ks->zfs_send_readers.value.i64;
+		zfs_send_read_window =
+			ks->zfs_send_read_window.value.i64;
+		zfs_send_write_size =
+			ks->zfs_send_write_size.value.i64;
+		zfs_send_estimate_sample_rate =
+			ks->zfs_send_estimate_sample_rate.value.i64;
+		zfs_send_estimate_min_samples =
+			ks->zfs_send_estimate_min_samples.value.i64;
 
 		zfs_vdev_mirror_rotating_inc =
 			ks->zfs_vdev_mirror_rotating_inc.value.ui64;
@@ -354,6 +626,10 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_vdev_mirror_non_rotating_inc.value.ui64;
 		zfs_vdev_mirror_non_rotating_seek_inc =
 			ks->zfs_vdev_mirror_non_rotating_seek_inc.value.ui64;
+		zfs_vdev_mirror_rotating_mixed_inc =
+			ks->zfs_vdev_mirror_rotating_mixed_inc.value.ui64;
+		zfs_vdev_mirror_ditto_balance =
+			ks->zfs_vdev_mirror_ditto_balance.value.ui64;
 
 		zvol_inhibit_dev =
 			ks->zvol_inhibit_dev.value.ui64;
@@ -367,12 +643,136 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 
 		dbuf_cache_max_bytes =
 		    ks->dbuf_cache_max_bytes.value.ui64;
+		dbuf_cache_adaptive_shift =
+		    ks->dbuf_cache_adaptive_shift.value.i64;
+		dbuf_evict_user_batch =
+		    ks->dbuf_evict_user_batch.value.i64;
+		dbuf_evict_user_taskq_pct =
+		    ks->dbuf_evict_user_taskq_pct.value.i64;
+		dmu_object_alloc_chunk_shift =
+		    ks->dmu_object_alloc_chunk_shift.value.i64;
 
 		zfs_vdev_queue_depth_pct =
 		    ks->zfs_vdev_queue_depth_pct.value.ui64;
 
 		zio_dva_throttle_enabled =
 		    (boolean_t) ks->zio_dva_throttle_enabled.value.ui64;
+		zio_ddt_prefetch_enabled =
+		    (boolean_t) ks->zio_ddt_prefetch_enabled.value.ui64;
+		zio_stage_timing_enabled =
+		    (boolean_t) ks->zio_stage_timing_enabled.value.ui64;
+		zio_gang_fit_enabled =
+		    (boolean_t) ks->zio_gang_fit_enabled.value.ui64;
+
+		if (KSTAT_NAMED_STR_PTR(&ks->zfs_fletcher_4_impl) != NULL)
+			(void) fletcher_4_impl_set(
+			    KSTAT_NAMED_STR_PTR(&ks->zfs_fletcher_4_impl));
+
+		if (KSTAT_NAMED_STR_PTR(&ks->zfs_vdev_raidz_impl) != NULL)
+			(void) vdev_raidz_impl_set(
+			    KSTAT_NAMED_STR_PTR(&ks->zfs_vdev_raidz_impl));
+
+		zfs_abd_scatter_enabled =
+		    (boolean_t) ks->zfs_abd_scatter_enabled.value.ui64;
+
+		zfs_compress_early_abort =
+		    ks->zfs_compress_early_abort.value.i64;
+		zfs_compress_abort_streak =
+		    ks->zfs_compress_abort_streak.value.i64;
+		zfs_compress_abort_retry =
+		    ks->zfs_compress_abort_retry.value.i64;
+
+		zfs_key_max_salt_uses =
+		    ks->zfs_key_max_salt_uses.value.ui64;
+
+		zfs_trim_extent_bytes_min =
+		    ks->zfs_trim_extent_bytes_min.value.ui64;
+		zfs_trim_extent_bytes_max =
+		    ks->zfs_trim_extent_bytes_max.value.ui64;
+		zfs_trim_txg_batch =
+		    ks->zfs_trim_txg_batch.value.ui64;
+		zfs_trim_rate =
+		    ks->zfs_trim_rate.value.ui64;
+		zfs_arc_warm =
+		    ks->zfs_arc_warm.value.i64;
+		zfs_arc_warm_sample =
+		    ks->zfs_arc_warm_sample.value.i64;
+		zfs_arc_warm_entries =
+		    ks->zfs_arc_warm_entries.value.i64;
+		zfs_arc_warm_rate =
+		    ks->zfs_arc_warm_rate.value.i64;
+		zio_taskq_batch_pct =
+		    ks->zio_taskq_batch_pct.value.ui64;
+		zio_taskq_batch_tpq =
+		    ks->zio_taskq_batch_tpq.value.ui64;
+		zio_taskq_affine =
+		    ks->zio_taskq_affine.value.i64;
+		zio_taskq_affine_imbalance =
+		    ks->zio_taskq_affine_imbalance.value.i64;
+		zfs_dirty_data_cpu_slack =
+		    ks->zfs_dirty_data_cpu_slack.value.ui64;
+		zfs_arc_sublist_by_cpu =
+		    ks->zfs_arc_sublist_by_cpu.value.i64;
+		zfs_mutex_spin =
+		    ks->zfs_mutex_spin.value.i64;
+		zfs_rebuild_sequential =
+		    ks->zfs_rebuild_sequential.value.i64;
+		zfs_rebuild_extent_bytes_max =
+		    ks->zfs_rebuild_extent_bytes_max.value.ui64;
+		zfs_rebuild_batch_bytes =
+		    ks->zfs_rebuild_batch_bytes.value.ui64;
+		zfs_rebuild_scrub =
+		    ks->zfs_rebuild_scrub.value.i64;
+		zfs_free_async =
+		    ks->zfs_free_async.value.i64;
+		zfs_free_max_blocks_limit =
+		    ks->zfs_free_max_blocks_limit.value.ui64;
+		zfs_condense_txgs =
+		    ks->zfs_condense_txgs.value.i64;
+		zfs_free_throttle_ms =
+		    ks->zfs_free_throttle_ms.value.i64;
+		zfs_free_throttle_min_blocks =
+		    ks->zfs_free_throttle_min_blocks.value.i64;
+		zfs_free_throttle_urgent_pct =
+		    ks->zfs_free_throttle_urgent_pct.value.i64;
+		zio_scan_verify_pct =
+		    ks->zio_scan_verify_pct.value.ui64;
+		zio_scan_verify_batch =
+		    ks->zio_scan_verify_batch.value.ui64;
+		zfs_resilver_priority =
+		    ks->zfs_resilver_priority.value.i64;
+		zfs_raidz_combrec_hint =
+		    ks->zfs_raidz_combrec_hint.value.i64;
+		zfs_vdev_file_nocache =
+		    ks->zfs_vdev_file_nocache.value.i64;
+		zfs_vdev_cache_min_hit_pct =
+		    ks->zfs_vdev_cache_min_hit_pct.value.i64;
+		zfs_vdev_cache_probe =
+		    ks->zfs_vdev_cache_probe.value.i64;
+		zfs_xattr_sa_rsrc_max =
+		    ks->zfs_xattr_sa_rsrc_max.value.ui64;
+		zfs_acl_access_cache =
+		    ks->zfs_acl_access_cache.value.i64;
+		zfs_lz4_acceleration =
+		    ks->zfs_lz4_acceleration.value.i64;
+		zfs_dirty_data_fair =
+		    ks->zfs_dirty_data_fair.value.i64;
+		zfs_dbuf_stats_dump =
+		    ks->zfs_dbuf_stats_dump.value.i64;
+		dbuf_deferred_rmw =
+		    ks->dbuf_deferred_rmw.value.i64;
+		zfs_recv_read_size =
+		    ks->zfs_recv_read_size.value.i64;
+		zfs_allow_filtered_mount =
+		    ks->zfs_allow_filtered_mount.value.i64;
+
+		if (KSTAT_NAMED_STR_PTR(&ks->zio_taskq_read) != NULL)
+			(void) spa_taskq_param_set(ZIO_TYPE_READ,
+			    KSTAT_NAMED_STR_PTR(&ks->zio_taskq_read));
+
+		if (KSTAT_NAMED_STR_PTR(&ks->zio_taskq_write) != NULL)
+			(void) spa_taskq_param_set(ZIO_TYPE_WRITE,
+			    KSTAT_NAMED_STR_PTR(&ks->zio_taskq_write));
 	} else {
 
 		/* kstat READ */
@@ -388,6 +788,17 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		ks->darwin_create_negatives.value.ui64       = zfs_vnop_create_negatives;
 		ks->darwin_force_formd_normalized.value.ui64 = zfs_vnop_force_formd_normalized_output;
 		ks->darwin_skip_unlinked_drain.value.ui64    = zfs_vnop_skip_unlinked_drain;
+		ks->darwin_pagein_readahead.value.ui64       = zfs_vnop_pagein_readahead;
+		ks->darwin_reclaim_async.value.ui64          = zfs_vnop_reclaim_async;
+		ks->darwin_reclaim_batch.value.ui64          = zfs_vnop_reclaim_batch;
+		ks->darwin_findernotify_interval.value.ui64  =
+		    zfs_vnop_findernotify_interval;
+		ks->darwin_findernotify_threshold.value.ui64 =
+		    zfs_vnop_findernotify_threshold;
+		ks->darwin_findernotify_sent.value.ui64      =
+		    vnop_num_findernotify_sent;
+		ks->darwin_findernotify_suppressed.value.ui64 =
+		    vnop_num_findernotify_suppressed;
 
 		/* ARC */
 		arc_kstat_update(ksp, rw);
@@ -396,6 +807,7 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		/* L2ARC */
 		ks->l2arc_write_max.value.ui64               = l2arc_write_max;
 		ks->l2arc_write_boost.value.ui64             = l2arc_write_boost;
+		ks->l2arc_write_limit.value.ui64             = l2arc_write_limit;
 		ks->l2arc_headroom.value.ui64                = l2arc_headroom;
 		ks->l2arc_headroom_boost.value.ui64          = l2arc_headroom_boost;
 		ks->l2arc_max_block_size.value.ui64          = l2arc_max_block_size;
@@ -405,6 +817,9 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		ks->l2arc_noprefetch.value.i64               = l2arc_noprefetch;
 		ks->l2arc_feed_again.value.i64               = l2arc_feed_again;
 		ks->l2arc_norw.value.i64                     = l2arc_norw;
+		ks->l2arc_rebuild_enabled.value.i64 =
+			l2arc_rebuild_enabled;
+		ks->l2arc_compress.value.i64 = l2arc_compress;
 
 		/* vdev_queue */
 		ks->zfs_vdev_max_active.value.ui64 =
@@ -429,12 +844,26 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_vdev_scrub_min_active ;
 		ks->zfs_vdev_scrub_max_active.value.ui64 =
 			zfs_vdev_scrub_max_active ;
+		ks->zfs_vdev_resilver_min_active.value.ui64 =
+			zfs_vdev_resilver_min_active ;
+		ks->zfs_vdev_resilver_max_active.value.ui64 =
+			zfs_vdev_resilver_max_active ;
+		ks->zfs_vdev_queue_tune.value.i64 =
+			zfs_vdev_queue_tune ;
+		ks->zfs_vdev_queue_tune_window.value.ui64 =
+			zfs_vdev_queue_tune_window ;
+		ks->zfs_vdev_queue_tune_latency_pct.value.ui64 =
+			zfs_vdev_queue_tune_latency_pct ;
+		ks->zfs_vdev_queue_tune_max_active.value.ui64 =
+			zfs_vdev_queue_tune_max_active ;
 		ks->zfs_vdev_async_write_active_min_dirty_percent.value.i64 =
 			zfs_vdev_async_write_active_min_dirty_percent ;
 		ks->zfs_vdev_async_write_active_max_dirty_percent.value.i64 =
 			zfs_vdev_async_write_active_max_dirty_percent ;
 		ks->zfs_vdev_aggregation_limit.value.i64 =
 			zfs_vdev_aggregation_limit ;
+		ks->zfs_vdev_aggregation_limit_max.value.i64 =
+			zfs_vdev_aggregation_limit_max ;
 		ks->zfs_vdev_read_gap_limit.value.i64 =
 			zfs_vdev_read_gap_limit ;
 		ks->zfs_vdev_write_gap_limit.value.i64 =
@@ -454,6 +883,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_delay_min_dirty_percent;
 		ks->zfs_delay_scale.value.i64 =
 			zfs_delay_scale;
+		ks->zfs_delay_sync_target_ms.value.i64 =
+			zfs_delay_sync_target_ms;
 		ks->spa_asize_inflation.value.i64 =
 			spa_asize_inflation;
 		ks->zfs_mdcomp_disable.value.i64 =
@@ -466,6 +897,12 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfetch_min_sec_reap;
 		ks->zfetch_array_rd_sz.value.i64 =
 			zfetch_array_rd_sz;
+		ks->zfetch_sequential_min.value.i64 =
+			zfetch_sequential_min;
+		ks->zfetch_max_stride.value.i64 =
+			zfetch_max_stride;
+		ks->zfetch_adaptive_distance.value.i64 =
+			zfetch_adaptive_distance;
 		ks->zfs_default_bs.value.i64 =
 			zfs_default_bs;
 		ks->zfs_default_ibs.value.i64 =
@@ -480,6 +917,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_flags;
 		ks->zfs_txg_timeout.value.i64 =
 			zfs_txg_timeout;
+		ks->zfs_txg_early_write.value.i64 =
+			zfs_txg_early_write;
 		ks->zfs_vdev_cache_max.value.i64 =
 			zfs_vdev_cache_max;
 		ks->zfs_vdev_cache_size.value.i64 =
@@ -490,24 +929,92 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_no_scrub_prefetch;
 		ks->fzap_default_block_shift.value.i64 =
 			fzap_default_block_shift;
+		ks->zap_micro_max_size.value.i64 =
+			zap_micro_max_size;
+		ks->zap_cursor_prefetch_leaves.value.i64 =
+			zap_cursor_prefetch_leaves;
+		ks->zfs_readdir_dnode_prefetch.value.i64 =
+			zfs_readdir_dnode_prefetch;
+		ks->zfs_dir_negcache.value.i64 =
+			zfs_dir_negcache;
 		ks->zfs_immediate_write_sz.value.i64 =
 			zfs_immediate_write_sz;
 		ks->zfs_read_chunk_size.value.i64 =
 			zfs_read_chunk_size;
+		ks->zfs_rlock_fastpath.value.i64 =
+			zfs_rlock_fastpath;
+		ks->zfs_group_commit.value.i64 =
+			zfs_group_commit;
+		ks->zfs_group_commit_window_us.value.i64 =
+			zfs_group_commit_window_us;
+		ks->zfs_inline_data_max.value.i64 =
+			zfs_inline_data_max;
 		ks->zfs_nocacheflush.value.i64 =
 			zfs_nocacheflush;
+		ks->zfs_nocacheflush_slog.value.i64 =
+			zfs_nocacheflush_slog;
 		ks->zil_replay_disable.value.i64 =
 			zil_replay_disable;
+		ks->zfs_commit_timeout_pct.value.i64 =
+			zfs_commit_timeout_pct;
+		ks->zil_maxblocksize.value.i64 =
+			zil_maxblocksize;
+		ks->zil_replay_taskqs.value.i64 =
+			zil_replay_taskqs;
 		ks->metaslab_gang_bang.value.i64 =
 			metaslab_gang_bang;
 		ks->metaslab_df_alloc_threshold.value.i64 =
 			metaslab_df_alloc_threshold;
 		ks->metaslab_df_free_pct.value.i64 =
 			metaslab_df_free_pct;
+		ks->metaslab_adaptive_alloc.value.i64 =
+			metaslab_adaptive_alloc;
+		ks->metaslab_adaptive_free_pct.value.i64 =
+			metaslab_adaptive_free_pct;
+		ks->metaslab_adaptive_frag_pct.value.i64 =
+			metaslab_adaptive_frag_pct;
+		ks->metaslab_adaptive_latency_ns.value.ui64 =
+			metaslab_adaptive_latency_ns;
+		ks->metaslab_latency_bias_pct.value.i64 =
+			metaslab_latency_bias_pct;
+		ks->metaslab_seq_zone_shift.value.i64 =
+			metaslab_seq_zone_shift;
+		ks->zfs_uberblock_sync_subset.value.i64 =
+			zfs_uberblock_sync_subset;
+		ks->zfs_embedded_log_metaslabs.value.i64 =
+			zfs_embedded_log_metaslabs;
+		ks->zfs_embedded_log_min_ms.value.i64 =
+			zfs_embedded_log_min_ms;
+		ks->zfs_log_spacemaps.value.i64 =
+			zfs_log_spacemaps;
+		ks->zfs_unflushed_log_txg_max.value.ui64 =
+			zfs_unflushed_log_txg_max;
+		ks->zfs_min_metaslabs_to_flush.value.ui64 =
+			zfs_min_metaslabs_to_flush;
+		ks->zfs_keep_log_spacemaps_at_export.value.i64 =
+			zfs_keep_log_spacemaps_at_export;
+		ks->zfs_special_class_metadata_reserve_pct.value.i64 =
+			zfs_special_class_metadata_reserve_pct;
+		ks->zfs_ddt_cache_max.value.ui64 =
+			zfs_ddt_cache_max;
+		ks->zfs_ddt_prune_age.value.ui64 =
+			zfs_ddt_prune_age;
+		ks->zfs_ddt_prune_batch.value.i64 =
+			zfs_ddt_prune_batch;
+		ks->zfs_list_batch_max.value.i64 =
+			zfs_list_batch_max;
+		ks->zfs_destroy_prefetch_threads.value.i64 =
+			zfs_destroy_prefetch_threads;
+		ks->zfs_config_sync_delay_ms.value.i64 =
+			zfs_config_sync_delay_ms;
+		ks->zfs_bench_blocksize.value.i64 =
+			zfs_bench_blocksize;
 		ks->zio_injection_enabled.value.i64 =
 			zio_injection_enabled;
 		ks->zvol_immediate_write_sz.value.i64 =
 			zvol_immediate_write_sz;
+		ks->zvol_sync_batch.value.i64 =
+			zvol_sync_batch;
 
 		ks->zfs_top_maxinflight.value.i64 =
 			zfs_top_maxinflight;
@@ -517,6 +1024,14 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_scrub_delay;
 		ks->zfs_scan_idle.value.i64 =
 			zfs_scan_idle;
+		ks->zfs_scan_fg_latency_pct.value.i64 =
+			zfs_scan_fg_latency_pct;
+		ks->zfs_scan_legacy.value.i64 =
+			zfs_scan_legacy;
+		ks->zfs_scan_mem_lim_fact.value.i64 =
+			zfs_scan_mem_lim_fact;
+		ks->zfs_scan_max_ext_gap.value.i64 =
+			zfs_scan_max_ext_gap;
 
 		ks->zfs_recover.value.i64 =
 			zfs_recover;
@@ -532,6 +1047,20 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_send_queue_length;
 		ks->zfs_recv_queue_length.value.ui64 =
 			zfs_recv_queue_length;
+		ks->zfs_recv_writers.value.i64 =
+			zfs_recv_writers;
+		ks->zfs_recv_write_batch.value.i64 =
+			zfs_recv_write_batch;
+		ks->zfs_send_readers.value.i64 =
+			zfs_send_readers;
+		ks->zfs_send_read_window.value.i64 =
+			zfs_send_read_window;
+		ks->zfs_send_write_size.value.i64 =
+			zfs_send_write_size;
+		ks->zfs_send_estimate_sample_rate.value.i64 =
+			zfs_send_estimate_sample_rate;
+		ks->zfs_send_estimate_min_samples.value.i64 =
+			zfs_send_estimate_min_samples;
 
 		ks->zfs_vdev_mirror_rotating_inc.value.ui64 =
 			zfs_vdev_mirror_rotating_inc;
@@ -543,6 +1072,10 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_vdev_mirror_non_rotating_inc;
 		ks->zfs_vdev_mirror_non_rotating_seek_inc.value.ui64 =
 			zfs_vdev_mirror_non_rotating_seek_inc;
+		ks->zfs_vdev_mirror_rotating_mixed_inc.value.ui64 =
+			zfs_vdev_mirror_rotating_mixed_inc;
+		ks->zfs_vdev_mirror_ditto_balance.value.ui64 =
+			zfs_vdev_mirror_ditto_balance;
 
 		ks->zvol_inhibit_dev.value.ui64 =
 			zvol_inhibit_dev;
@@ -555,15 +1088,261 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			send_holes_without_birth_time;
 
 		ks->dbuf_cache_max_bytes.value.ui64 = dbuf_cache_max_bytes;
+		ks->dbuf_cache_adaptive_shift.value.i64 =
+		    dbuf_cache_adaptive_shift;
+		ks->dbuf_evict_user_batch.value.i64 = dbuf_evict_user_batch;
+		ks->dbuf_evict_user_taskq_pct.value.i64 =
+		    dbuf_evict_user_taskq_pct;
+		ks->dmu_object_alloc_chunk_shift.value.i64 =
+		    dmu_object_alloc_chunk_shift;
 
 		ks->zfs_vdev_queue_depth_pct.value.ui64 = zfs_vdev_queue_depth_pct;
 		ks->zio_dva_throttle_enabled.value.ui64 = (uint64_t) zio_dva_throttle_enabled;
+		ks->zio_ddt_prefetch_enabled.value.ui64 =
+		    (uint64_t) zio_ddt_prefetch_enabled;
+		ks->zio_stage_timing_enabled.value.ui64 =
+		    (uint64_t) zio_stage_timing_enabled;
+		ks->zio_gang_fit_enabled.value.ui64 =
+		    (uint64_t) zio_gang_fit_enabled;
+
+		(void) fletcher_4_impl_get(fletcher_4_impl_str,
+		    sizeof (fletcher_4_impl_str));
+		KSTAT_NAMED_STR_PTR(&ks->zfs_fletcher_4_impl) =
+		    fletcher_4_impl_str;
+		KSTAT_NAMED_STR_BUFLEN(&ks->zfs_fletcher_4_impl) =
+		    strlen(fletcher_4_impl_str) + 1;
+
+		(void) vdev_raidz_impl_get(vdev_raidz_impl_str,
+		    sizeof (vdev_raidz_impl_str));
+		KSTAT_NAMED_STR_PTR(&ks->zfs_vdev_raidz_impl) =
+		    vdev_raidz_impl_str;
+		KSTAT_NAMED_STR_BUFLEN(&ks->zfs_vdev_raidz_impl) =
+		    strlen(vdev_raidz_impl_str) + 1;
+
+		ks->zfs_abd_scatter_enabled.value.ui64 =
+		    (uint64_t) zfs_abd_scatter_enabled;
+
+		ks->zfs_compress_early_abort.value.i64 =
+		    zfs_compress_early_abort;
+		ks->zfs_compress_abort_streak.value.i64 =
+		    zfs_compress_abort_streak;
+		ks->zfs_compress_abort_retry.value.i64 =
+		    zfs_compress_abort_retry;
+
+		ks->zfs_key_max_salt_uses.value.ui64 =
+		    zfs_key_max_salt_uses;
+
+		ks->zfs_trim_extent_bytes_min.value.ui64 =
+		    zfs_trim_extent_bytes_min;
+		ks->zfs_trim_extent_bytes_max.value.ui64 =
+		    zfs_trim_extent_bytes_max;
+		ks->zfs_trim_txg_batch.value.ui64 =
+		    zfs_trim_txg_batch;
+		ks->zfs_trim_rate.value.ui64 =
+		    zfs_trim_rate;
+		ks->zfs_arc_warm.value.i64 =
+		    zfs_arc_warm;
+		ks->zfs_arc_warm_sample.value.i64 =
+		    zfs_arc_warm_sample;
+		ks->zfs_arc_warm_entries.value.i64 =
+		    zfs_arc_warm_entries;
+		ks->zfs_arc_warm_rate.value.i64 =
+		    zfs_arc_warm_rate;
+		ks->zio_taskq_batch_pct.value.ui64 =
+		    zio_taskq_batch_pct;
+		ks->zio_taskq_batch_tpq.value.ui64 =
+		    zio_taskq_batch_tpq;
+		ks->zio_taskq_affine.value.i64 =
+		    zio_taskq_affine;
+		ks->zio_taskq_affine_imbalance.value.i64 =
+		    zio_taskq_affine_imbalance;
+		ks->zfs_dirty_data_cpu_slack.value.ui64 =
+		    zfs_dirty_data_cpu_slack;
+		ks->zfs_arc_sublist_by_cpu.value.i64 =
+		    zfs_arc_sublist_by_cpu;
+		ks->zfs_mutex_spin.value.i64 =
+		    zfs_mutex_spin;
+		ks->zfs_rebuild_sequential.value.i64 =
+		    zfs_rebuild_sequential;
+		ks->zfs_rebuild_extent_bytes_max.value.ui64 =
+		    zfs_rebuild_extent_bytes_max;
+		ks->zfs_rebuild_batch_bytes.value.ui64 =
+		    zfs_rebuild_batch_bytes;
+		ks->zfs_rebuild_scrub.value.i64 =
+		    zfs_rebuild_scrub;
+		ks->zfs_free_async.value.i64 =
+		    zfs_free_async;
+		ks->zfs_free_max_blocks_limit.value.ui64 =
+		    zfs_free_max_blocks_limit;
+		ks->zfs_condense_txgs.value.i64 =
+		    zfs_condense_txgs;
+		ks->zfs_free_throttle_ms.value.i64 =
+		    zfs_free_throttle_ms;
+		ks->zfs_free_throttle_min_blocks.value.i64 =
+		    zfs_free_throttle_min_blocks;
+		ks->zfs_free_throttle_urgent_pct.value.i64 =
+		    zfs_free_throttle_urgent_pct;
+		ks->zio_scan_verify_pct.value.ui64 =
+		    zio_scan_verify_pct;
+		ks->zio_scan_verify_batch.value.ui64 =
+		    zio_scan_verify_batch;
+		ks->zfs_resilver_priority.value.i64 =
+		    zfs_resilver_priority;
+		ks->zfs_raidz_combrec_hint.value.i64 =
+		    zfs_raidz_combrec_hint;
+		ks->zfs_vdev_file_nocache.value.i64 =
+		    zfs_vdev_file_nocache;
+		ks->zfs_vdev_cache_min_hit_pct.value.i64 =
+		    zfs_vdev_cache_min_hit_pct;
+		ks->zfs_vdev_cache_probe.value.i64 =
+		    zfs_vdev_cache_probe;
+		ks->zfs_xattr_sa_rsrc_max.value.ui64 =
+		    zfs_xattr_sa_rsrc_max;
+		ks->zfs_acl_access_cache.value.i64 =
+		    zfs_acl_access_cache;
+		ks->zfs_lz4_acceleration.value.i64 =
+		    zfs_lz4_acceleration;
+		ks->zfs_dirty_data_fair.value.i64 =
+		    zfs_dirty_data_fair;
+		ks->zfs_dbuf_stats_dump.value.i64 =
+		    zfs_dbuf_stats_dump;
+		ks->dbuf_deferred_rmw.value.i64 =
+		    dbuf_deferred_rmw;
+		ks->zfs_recv_read_size.value.i64 =
+		    zfs_recv_read_size;
+		ks->zfs_allow_filtered_mount.value.i64 =
+		    zfs_allow_filtered_mount;
+
+		(void) spa_taskq_param_get(ZIO_TYPE_READ,
+		    zio_taskq_read_str, sizeof (zio_taskq_read_str));
+		KSTAT_NAMED_STR_PTR(&ks->zio_taskq_read) =
+		    zio_taskq_read_str;
+		KSTAT_NAMED_STR_BUFLEN(&ks->zio_taskq_read) =
+		    strlen(zio_taskq_read_str) + 1;
+
+		(void) spa_taskq_param_get(ZIO_TYPE_WRITE,
+		    zio_taskq_write_str, sizeof (zio_taskq_write_str));
+		KSTAT_NAMED_STR_PTR(&ks->zio_taskq_write) =
+		    zio_taskq_write_str;
+		KSTAT_NAMED_STR_BUFLEN(&ks->zio_taskq_write) =
+		    strlen(zio_taskq_write_str) + 1;
 	}
 
 	return 0;
 }
 
 
+/*
+ * kstat.zfs.misc.stats_snapshot: the ARC, L2ARC, dbuf cache, prefetch and
+ * vdev cache counters in a single read.  Each read updates and copies all
+ * of their kstats at once, under one lock, and records when in the header
+ * line, so a monitor such as arcstat gets a consistent set of counters
+ * from one sysctl rather than one per field, and can compute its rates
+ * over the exact time between two snapshots.  Each row is
+ * "<kstat>.<name> <value>".
+ */
+typedef struct osx_snapshot_row {
+	char		osr_kstat[KSTAT_STRLEN];
+	kstat_named_t	osr_kn;
+} osx_snapshot_row_t;
+
+static kstat_t **osx_snapshot_sources[] = {
+	&arc_ksp,
+	&zfetch_ksp,
+	&vdc_ksp,
+	&dbuf_stats_cache_kstat,
+	&dbuf_stats_hash_kstat,
+	&dbuf_stats_evict_user_kstat
+};
+
+static kstat_t		*osx_snapshot_ksp;
+static kmutex_t		osx_snapshot_lock;
+static osx_snapshot_row_t *osx_snapshot_rows;
+static uint64_t		osx_snapshot_count;
+static hrtime_t		osx_snapshot_time;
+
+static int
+osx_snapshot_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "hrtime %llu\n",
+	    (u_longlong_t)osx_snapshot_time);
+
+	return (0);
+}
+
+static int
+osx_snapshot_data(char *buf, size_t size, void *data)
+{
+	osx_snapshot_row_t *row = data;
+
+	if (row->osr_kn.data_type == KSTAT_DATA_INT64) {
+		(void) snprintf(buf, size, "%s.%s %lld\n", row->osr_kstat,
+		    row->osr_kn.name, (longlong_t)row->osr_kn.value.i64);
+	} else {
+		(void) snprintf(buf, size, "%s.%s %llu\n", row->osr_kstat,
+		    row->osr_kn.name, (u_longlong_t)row->osr_kn.value.ui64);
+	}
+
+	return (0);
+}
+
+static void *
+osx_snapshot_addr(kstat_t *ksp, off_t n)
+{
+	ASSERT(MUTEX_HELD(&osx_snapshot_lock));
+
+	if (n < 0 || (uint64_t)n >= osx_snapshot_count)
+		return (NULL);
+
+	return (&osx_snapshot_rows[n]);
+}
+
+static int
+osx_snapshot_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *kn;
+	kstat_t *src;
+	uint64_t count = 0, n = 0;
+	int s, i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	for (s = 0; s < ARRAY_SIZE(osx_snapshot_sources); s++) {
+		if ((src = *osx_snapshot_sources[s]) != NULL)
+			count += src->ks_ndata;
+	}
+
+	if (count != osx_snapshot_count) {
+		if (osx_snapshot_rows != NULL) {
+			kmem_free(osx_snapshot_rows, osx_snapshot_count *
+			    sizeof (osx_snapshot_row_t));
+		}
+		osx_snapshot_rows = (count == 0) ? NULL :
+		    kmem_zalloc(count * sizeof (osx_snapshot_row_t), KM_SLEEP);
+		osx_snapshot_count = count;
+	}
+
+	for (s = 0; s < ARRAY_SIZE(osx_snapshot_sources); s++) {
+		if ((src = *osx_snapshot_sources[s]) == NULL)
+			continue;
+		if (src->ks_update != NULL)
+			(void) src->ks_update(src, KSTAT_READ);
+
+		kn = src->ks_data;
+		for (i = 0; i < src->ks_ndata && n < count; i++, n++) {
+			(void) strlcpy(osx_snapshot_rows[n].osr_kstat,
+			    src->ks_name, KSTAT_STRLEN);
+			osx_snapshot_rows[n].osr_kn = kn[i];
+		}
+	}
+	osx_snapshot_time = gethrtime();
+
+	ksp->ks_ndata = n;
+	ksp->ks_data_size = n * sizeof (osx_snapshot_row_t);
+
+	return (0);
+}
 
 int kstat_osx_init(void)
 {
@@ -577,6 +1356,20 @@ int kstat_osx_init(void)
 		kstat_install(osx_kstat_ksp);
 	}
 
+	mutex_init(&osx_snapshot_lock, NULL, MUTEX_DEFAULT, NULL);
+	osx_snapshot_ksp = kstat_create("zfs", 0, "stats_snapshot", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	if (osx_snapshot_ksp != NULL) {
+		osx_snapshot_ksp->ks_lock = &osx_snapshot_lock;
+		osx_snapshot_ksp->ks_data = NULL;
+		osx_snapshot_ksp->ks_ndata = 0;
+		osx_snapshot_ksp->ks_update = osx_snapshot_update;
+		kstat_set_raw_ops(osx_snapshot_ksp, osx_snapshot_headers,
+		    osx_snapshot_data, osx_snapshot_addr);
+		kstat_install(osx_snapshot_ksp);
+	}
+
 	return 0;
 }
 
@@ -586,4 +1379,16 @@ void kstat_osx_fini(void)
         kstat_delete(osx_kstat_ksp);
         osx_kstat_ksp = NULL;
     }
+
+	if (osx_snapshot_ksp != NULL) {
+		kstat_delete(osx_snapshot_ksp);
+		osx_snapshot_ksp = NULL;
+	}
+	if (osx_snapshot_rows != NULL) {
+		kmem_free(osx_snapshot_rows, osx_snapshot_count *
+		    sizeof (osx_snapshot_row_t));
+		osx_snapshot_rows = NULL;
+		osx_snapshot_count = 0;
+	}
+	mutex_destroy(&osx_snapshot_lock);
 }
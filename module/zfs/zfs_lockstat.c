@@ -0,0 +1,129 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zfs_lockstat.h>
+
+/*
+ * The number of times zfs_mutex_enter() retries a held lock before it
+ * blocks.  The pause between retries doubles each time, up to
+ * ZFS_MUTEX_BACKOFF_MAX spin loop iterations.  0 blocks right away.
+ */
+int zfs_mutex_spin = 8;
+
+#define	ZFS_MUTEX_BACKOFF_MAX	64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define	ZFS_SPIN_PAUSE()	__builtin_ia32_pause()
+#else
+#define	ZFS_SPIN_PAUSE()	do { } while (0)
+#endif
+
+/*
+ * Only contended acquisitions are counted; the uncontended ones never
+ * leave zfs_mutex_enter().
+ */
+typedef struct zfs_lockstat {
+	kstat_named_t zls_contended;	/* lock was held on entry */
+	kstat_named_t zls_spin_acquired; /* got it while spinning */
+	kstat_named_t zls_blocked;	/* gave up spinning and slept */
+	kstat_named_t zls_spins;	/* retries, all contended entries */
+	kstat_named_t zls_block_time;	/* ns spent blocked */
+} zfs_lockstat_t;
+
+#define	ZFS_LOCKSTAT_CLASS(name) {				\
+	{ name "_contended",		KSTAT_DATA_UINT64 },	\
+	{ name "_spin_acquired",	KSTAT_DATA_UINT64 },	\
+	{ name "_blocked",		KSTAT_DATA_UINT64 },	\
+	{ name "_spins",		KSTAT_DATA_UINT64 },	\
+	{ name "_block_time",		KSTAT_DATA_UINT64 },	\
+}
+
+static zfs_lockstat_t zfs_lockstats[ZFS_LOCK_CLASSES] = {
+	ZFS_LOCKSTAT_CLASS("dbuf"),
+	ZFS_LOCKSTAT_CLASS("dnode"),
+	ZFS_LOCKSTAT_CLASS("arc_hash"),
+};
+
+#define	ZFS_LOCKSTAT_INCR(zls, stat, val) \
+	atomic_add_64(&(zls)->stat.value.ui64, (val))
+#define	ZFS_LOCKSTAT_BUMP(zls, stat) \
+	ZFS_LOCKSTAT_INCR(zls, stat, 1)
+
+static kstat_t *zfs_lockstat_ksp;
+
+/*
+ * Slow path of zfs_mutex_enter(), for a mutex that was held when we
+ * first tried it.  These locks are held for short stretches, so it is
+ * usually cheaper to wait for the owner to let go than to sleep and be
+ * woken up again.
+ */
+void
+zfs_mutex_enter_contended(kmutex_t *mp, zfs_lock_class_t lc)
+{
+	zfs_lockstat_t *zls = &zfs_lockstats[lc];
+	int spin = zfs_mutex_spin;
+	int backoff = 1;
+	hrtime_t start;
+
+	ASSERT3U(lc, <, ZFS_LOCK_CLASSES);
+	ZFS_LOCKSTAT_BUMP(zls, zls_contended);
+
+	for (int i = 0; i < spin; i++) {
+		for (int j = 0; j < backoff; j++)
+			ZFS_SPIN_PAUSE();
+
+		if (mutex_tryenter(mp)) {
+			ZFS_LOCKSTAT_BUMP(zls, zls_spin_acquired);
+			ZFS_LOCKSTAT_INCR(zls, zls_spins, i + 1);
+			return;
+		}
+		backoff = MIN(backoff << 1, ZFS_MUTEX_BACKOFF_MAX);
+	}
+
+	start = gethrtime();
+	mutex_enter(mp);
+	ZFS_LOCKSTAT_BUMP(zls, zls_blocked);
+	ZFS_LOCKSTAT_INCR(zls, zls_spins, MAX(spin, 0));
+	ZFS_LOCKSTAT_INCR(zls, zls_block_time, gethrtime() - start);
+}
+
+void
+zfs_lockstat_init(void)
+{
+	zfs_lockstat_ksp = kstat_create("zfs", 0, "lockstat", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zfs_lockstats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (zfs_lockstat_ksp != NULL) {
+		zfs_lockstat_ksp->ks_data = zfs_lockstats;
+		kstat_install(zfs_lockstat_ksp);
+	}
+}
+
+void
+zfs_lockstat_fini(void)
+{
+	if (zfs_lockstat_ksp != NULL) {
+		kstat_delete(zfs_lockstat_ksp);
+		zfs_lockstat_ksp = NULL;
+	}
+}
@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 #include <sys/acl.h>
 #include <sys/dmu.h>
+#include <sys/dnode.h>
 #include <sys/spa.h>
 #include <sys/zfs_fuid.h>
 #include <sys/dsl_dataset.h>
@@ -250,6 +251,7 @@ zfs_log_create(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	size_t lrsize;
 	size_t namesize = strlen(name) + 1;
 	size_t fuidsz = 0;
+	int dnodesize;
 
 	if (zil_replaying(zilog, tx))
 		return;
@@ -283,6 +285,8 @@ zfs_log_create(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	lr = (lr_create_t *)&itx->itx_lr;
 	lr->lr_doid = dzp->z_id;
 	lr->lr_foid = zp->z_id;
+	dmu_object_dnsize_from_db(sa_get_db(zp->z_sa_hdl), &dnodesize);
+	LR_FOID_SET_SLOTS(lr->lr_foid, dnodesize >> DNODE_SHIFT);
 	lr->lr_mode = zp->z_mode;
 	if (!IS_EPHEMERAL(zp->z_uid)) {
 		lr->lr_uid = (uint64_t)zp->z_uid;
@@ -474,9 +478,17 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 	immediate_write_sz = (zilog->zl_logbias == ZFS_LOGBIAS_THROUGHPUT)
 	    ? 0 : zfs_immediate_write_sz;
 
+	/*
+	 * Only logbias=latency copies large writes into log blocks on the
+	 * log devices.  With logbias=hybrid they are written in place and
+	 * only their block pointers logged, as without log devices, while
+	 * small writes are still copied into the log.
+	 */
 	slogging = spa_has_slogs(zilog->zl_spa) &&
 	    (zilog->zl_logbias == ZFS_LOGBIAS_LATENCY);
-	if (resid > immediate_write_sz && !slogging && resid <= zp->z_blksz)
+	/* Inline data has no block for an indirect write to point at */
+	if (resid > immediate_write_sz && !slogging &&
+	    !(zp->z_pflags & ZFS_INLINE_DATA))
 		write_state = WR_INDIRECT;
 	else if (ioflag & (FSYNC | FDSYNC))
 		write_state = WR_COPIED;
@@ -493,18 +505,26 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 		ssize_t len;
 
 		/*
-		 * If the write would overflow the largest block then split it.
+		 * An indirect write logs the block pointer of one block, so
+		 * split it at block boundaries.  If a copied write would
+		 * overflow the largest log block then split it too.
 		 */
-		if (write_state != WR_INDIRECT && resid > ZIL_MAX_LOG_DATA)
+		if (write_state == WR_INDIRECT) {
+			uint64_t blksz = zp->z_blksz;
+
+			len = MIN(resid, blksz -
+			    (ISP2(blksz) ? P2PHASE(off, blksz) : off));
+		} else if (resid > ZIL_MAX_LOG_DATA) {
 			len = SPA_OLD_MAXBLOCKSIZE >> 1;
-		else
+		} else {
 			len = resid;
+		}
 
 		itx = zil_itx_create(txtype, sizeof (*lr) +
 		    (write_state == WR_COPIED ? len : 0));
 		lr = (lr_write_t *)&itx->itx_lr;
-		if (write_state == WR_COPIED && dmu_read(zp->z_zfsvfs->z_os,
-		    zp->z_id, off, len, lr + 1, DMU_READ_NO_PREFETCH) != 0) {
+		if (write_state == WR_COPIED && zfs_sa_read_data(zp, off, len,
+		    lr + 1, DMU_READ_NO_PREFETCH) != 0) {
 			zil_itx_destroy(itx);
 			itx = zil_itx_create(txtype, sizeof (*lr));
 			lr = (lr_write_t *)&itx->itx_lr;
@@ -78,6 +78,20 @@
  * and waits on that cv. When a thread unlocks that range it wakes up all
  * writers then all readers before destroying the lock.
  *
+ * Lock-free readers
+ * -----------------
+ * Most files are never written while they are being read, and for them
+ * the tree only serialises readers on z_range_lock.  So while no writer
+ * holds or wants a lock on the znode (z_range_writers is zero) a reader
+ * does not take z_range_lock or enter the tree at all: it just bumps
+ * z_range_readers and re-checks z_range_writers.  A writer bumps
+ * z_range_writers, which sends all new readers to the tree, and then waits
+ * on z_range_cv for z_range_readers to drain before looking at the tree.
+ * The last lock-free reader to leave wakes it.  Setting zfs_rlock_fastpath
+ * to 0 sends every reader to the tree.
+ *
+ * The time spent waiting for ranges is accounted in the "zfs_rlock" kstat.
+ *
  * Append mode writes
  * ------------------
  * Append mode writes need to lock a range at the end of a file.
@@ -97,6 +111,91 @@
 
 #include <sys/zfs_rlock.h>
 
+int zfs_rlock_fastpath = 1;
+
+typedef struct zfs_rlock_stats {
+	kstat_named_t zrs_fast_readers;
+	kstat_named_t zrs_readers;
+	kstat_named_t zrs_writers;
+	kstat_named_t zrs_reader_waits;
+	kstat_named_t zrs_writer_waits;
+	kstat_named_t zrs_drain_waits;
+	kstat_named_t zrs_wait_nsecs;
+} zfs_rlock_stats_t;
+
+static zfs_rlock_stats_t zfs_rlock_stats = {
+	{ "fast_readers",		KSTAT_DATA_UINT64 },
+	{ "readers",			KSTAT_DATA_UINT64 },
+	{ "writers",			KSTAT_DATA_UINT64 },
+	{ "reader_waits",		KSTAT_DATA_UINT64 },
+	{ "writer_waits",		KSTAT_DATA_UINT64 },
+	{ "drain_waits",		KSTAT_DATA_UINT64 },
+	{ "wait_nsecs",			KSTAT_DATA_UINT64 },
+};
+
+#define	ZRSTAT_BUMP(stat) \
+	atomic_inc_64(&zfs_rlock_stats.stat.value.ui64)
+#define	ZRSTAT_INCR(stat, val) \
+	atomic_add_64(&zfs_rlock_stats.stat.value.ui64, (val))
+
+static kstat_t *zfs_rlock_ksp;
+
+/*
+ * Wait on cv under z_range_lock, accounting the time spent.
+ */
+static void
+zfs_range_wait(znode_t *zp, kcondvar_t *cv)
+{
+	hrtime_t start = gethrtime();
+
+	cv_wait(cv, &zp->z_range_lock);
+	ZRSTAT_INCR(zrs_wait_nsecs, gethrtime() - start);
+}
+
+/*
+ * Try to take a reader lock without z_range_lock.  This only succeeds
+ * while no writer holds or waits for a lock on the znode.
+ */
+static boolean_t
+zfs_range_lock_fast(znode_t *zp, rl_t *new)
+{
+	if (!zfs_rlock_fastpath || zp->z_range_writers != 0)
+		return (B_FALSE);
+
+	atomic_inc_32(&zp->z_range_readers);
+	membar_enter();
+	if (zp->z_range_writers == 0) {
+		new->r_fast = B_TRUE;
+		ZRSTAT_BUMP(zrs_fast_readers);
+		return (B_TRUE);
+	}
+
+	/* lost the race with a writer, wake it if we were the last */
+	atomic_dec_32(&zp->z_range_readers);
+	membar_enter();
+	if (zp->z_range_readers == 0) {
+		mutex_enter(&zp->z_range_lock);
+		cv_broadcast(&zp->z_range_cv);
+		mutex_exit(&zp->z_range_lock);
+	}
+	return (B_FALSE);
+}
+
+static void
+zfs_range_unlock_fast(znode_t *zp)
+{
+	membar_exit();
+	if (atomic_dec_32_nv(&zp->z_range_readers) != 0)
+		return;
+
+	membar_enter();
+	if (zp->z_range_writers != 0) {
+		mutex_enter(&zp->z_range_lock);
+		cv_broadcast(&zp->z_range_cv);
+		mutex_exit(&zp->z_range_lock);
+	}
+}
+
 /*
  * Check if a write lock can be grabbed, or wait and recheck until available.
  */
@@ -175,7 +274,8 @@ wait:
 			cv_init(&rl->r_wr_cv, NULL, CV_DEFAULT, NULL);
 			rl->r_write_wanted = B_TRUE;
 		}
-		cv_wait(&rl->r_wr_cv, &zp->z_range_lock);
+		ZRSTAT_BUMP(zrs_writer_waits);
+		zfs_range_wait(zp, &rl->r_wr_cv);
 
 		/* reset to original */
 		new->r_off = off;
@@ -210,6 +310,7 @@ zfs_range_proxify(avl_tree_t *tree, rl_t *rl)
 	proxy->r_proxy = B_TRUE;
 	proxy->r_write_wanted = B_FALSE;
 	proxy->r_read_wanted = B_FALSE;
+	proxy->r_fast = B_FALSE;
 	avl_add(tree, proxy);
 
 	return (proxy);
@@ -239,6 +340,7 @@ zfs_range_split(avl_tree_t *tree, rl_t *rl, uint64_t off)
 	rear->r_proxy = B_TRUE;
 	rear->r_write_wanted = B_FALSE;
 	rear->r_read_wanted = B_FALSE;
+	rear->r_fast = B_FALSE;
 
 	front = zfs_range_proxify(tree, rl);
 	front->r_len = off - rl->r_off;
@@ -264,6 +366,7 @@ zfs_range_new_proxy(avl_tree_t *tree, uint64_t off, uint64_t len)
 	rl->r_proxy = B_TRUE;
 	rl->r_write_wanted = B_FALSE;
 	rl->r_read_wanted = B_FALSE;
+	rl->r_fast = B_FALSE;
 	avl_add(tree, rl);
 }
 
@@ -378,7 +481,8 @@ retry:
 				cv_init(&prev->r_rd_cv, NULL, CV_DEFAULT, NULL);
 				prev->r_read_wanted = B_TRUE;
 			}
-			cv_wait(&prev->r_rd_cv, &zp->z_range_lock);
+			ZRSTAT_BUMP(zrs_reader_waits);
+			zfs_range_wait(zp, &prev->r_rd_cv);
 			goto retry;
 		}
 		if (off + len < prev->r_off + prev->r_len)
@@ -401,7 +505,8 @@ retry:
 				cv_init(&next->r_rd_cv, NULL, CV_DEFAULT, NULL);
 				next->r_read_wanted = B_TRUE;
 			}
-			cv_wait(&next->r_rd_cv, &zp->z_range_lock);
+			ZRSTAT_BUMP(zrs_reader_waits);
+			zfs_range_wait(zp, &next->r_rd_cv);
 			goto retry;
 		}
 		if (off + len <= next->r_off + next->r_len)
@@ -440,9 +545,14 @@ zfs_range_lock(znode_t *zp, uint64_t off, uint64_t len, rl_type_t type)
 	new->r_proxy = B_FALSE;
 	new->r_write_wanted = B_FALSE;
 	new->r_read_wanted = B_FALSE;
+	new->r_fast = B_FALSE;
+
+	if (type == RL_READER && zfs_range_lock_fast(zp, new))
+		return (new);
 
 	mutex_enter(&zp->z_range_lock);
 	if (type == RL_READER) {
+		ZRSTAT_BUMP(zrs_readers);
 		/*
 		 * First check for the usual case of no locks
 		 */
@@ -450,8 +560,20 @@ zfs_range_lock(znode_t *zp, uint64_t off, uint64_t len, rl_type_t type)
 			avl_add(&zp->z_range_avl, new);
 		else
 			zfs_range_lock_reader(zp, new);
-	} else
+	} else {
+		/*
+		 * Keep new readers off the fast path, then wait for those
+		 * already on it to drop their locks.
+		 */
+		ZRSTAT_BUMP(zrs_writers);
+		atomic_inc_32(&zp->z_range_writers);
+		membar_enter();
+		while (zp->z_range_readers != 0) {
+			ZRSTAT_BUMP(zrs_drain_waits);
+			zfs_range_wait(zp, &zp->z_range_cv);
+		}
 		zfs_range_lock_writer(zp, new); /* RL_WRITER or RL_APPEND */
+	}
 	mutex_exit(&zp->z_range_lock);
 	return (new);
 }
@@ -550,12 +672,22 @@ zfs_range_unlock(rl_t *rl)
 	ASSERT(rl->r_type == RL_WRITER || rl->r_type == RL_READER);
 	ASSERT(rl->r_cnt == 1 || rl->r_cnt == 0);
 	ASSERT(!rl->r_proxy);
+
+	if (rl->r_fast) {
+		ASSERT(rl->r_type == RL_READER);
+		zfs_range_unlock_fast(zp);
+		kmem_free(rl, sizeof (rl_t));
+		return;
+	}
+
 	list_create(&free_list, sizeof (rl_t), offsetof(rl_t, rl_node));
 
 	mutex_enter(&zp->z_range_lock);
 	if (rl->r_type == RL_WRITER) {
 		/* writer locks can't be shared or split */
 		avl_remove(&zp->z_range_avl, rl);
+		ASSERT(zp->z_range_writers != 0);
+		atomic_dec_32(&zp->z_range_writers);
 		if (rl->r_write_wanted)
 			cv_broadcast(&rl->r_wr_cv);
 
@@ -626,3 +758,25 @@ zfs_range_compare(const void *arg1, const void *arg2)
 		return (-1);
 	return (0);
 }
+
+void
+zfs_rlock_init(void)
+{
+	zfs_rlock_ksp = kstat_create("zfs", 0, "zfs_rlock", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zfs_rlock_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (zfs_rlock_ksp != NULL) {
+		zfs_rlock_ksp->ks_data = &zfs_rlock_stats;
+		kstat_install(zfs_rlock_ksp);
+	}
+}
+
+void
+zfs_rlock_fini(void)
+{
+	if (zfs_rlock_ksp != NULL) {
+		kstat_delete(zfs_rlock_ksp);
+		zfs_rlock_ksp = NULL;
+	}
+}
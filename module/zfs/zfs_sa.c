@@ -67,6 +67,7 @@ sa_attr_reg_t zfs_attr_table[ZPL_END+1] = {
     {"ZPL_ADDTIME", sizeof (uint64_t) * 2, SA_UINT64_ARRAY, 0},
     {"ZPL_DOCUMENTID", sizeof (uint64_t), SA_UINT64_ARRAY, 0},
 #endif
+	{"ZPL_INLINE_DATA", 0, SA_UINT8_ARRAY, 0},
 	{NULL, 0, 0, 0}
 };
 
@@ -123,6 +124,46 @@ zfs_sa_symlink(znode_t *zp, char *link, int len, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * Read len bytes at off of the data of a regular file, from its inline
+ * data attribute if it has one (see zfs_inline_data_ok()) and from its
+ * blocks otherwise.  Bytes past the end of the inline data read as zeros.
+ * The attribute is only removed once its data is in the blocks (see
+ * zfs_inline_promote()), so readers that don't hold a range lock fall
+ * back to the blocks if they find it gone.
+ */
+int
+zfs_sa_read_data(znode_t *zp, uint64_t off, uint64_t len, void *buf,
+    uint32_t flags)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	int error;
+
+	if (zp->z_pflags & ZFS_INLINE_DATA) {
+		uint64_t end = off + len;
+		char *data;
+		uio_t *auio;
+
+		/*
+		 * sa_lookup_uio() copies from the start of the attribute,
+		 * under the handle lock, and never more than it holds.
+		 */
+		data = kmem_zalloc(end, KM_SLEEP);
+		auio = uio_create(1, 0, UIO_SYSSPACE, UIO_READ);
+		uio_addiov(auio, CAST_USER_ADDR_T(data), end);
+		error = sa_lookup_uio(zp->z_sa_hdl,
+		    SA_ZPL_INLINE_DATA(zfsvfs), auio);
+		uio_free(auio);
+		if (error == 0)
+			bcopy(data + off, buf, len);
+		kmem_free(data, end);
+		if (error != ENOENT)
+			return (error);
+	}
+
+	return (dmu_read(zfsvfs->z_os, zp->z_id, off, len, buf, flags));
+}
+
 void
 zfs_sa_get_scanstamp(znode_t *zp, xvattr_t *xvap)
 {
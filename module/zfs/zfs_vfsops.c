@@ -58,6 +58,7 @@
 
 #include <sys/dsl_prop.h>
 #include <sys/dsl_dataset.h>
+#include <sys/dsl_crypt.h>
 
 #ifndef __APPLE__
 #include <sys/dsl_deleg.h>
@@ -111,6 +112,12 @@
 #ifdef __APPLE__
 unsigned int zfs_vnop_skip_unlinked_drain = 0;
 
+/*
+ * Mount file systems received from a filtered stream ('zfs send -X')
+ * anyway; their directories may then list files that cannot be opened.
+ */
+int zfs_allow_filtered_mount = 0;
+
 int  zfs_module_start(kmod_info_t *ki, void *data);
 int  zfs_module_stop(kmod_info_t *ki, void *data);
 extern int getzfsvfs(const char *dsname, zfsvfs_t **zfvp);
@@ -1199,6 +1206,18 @@ zfsvfs_init(zfsvfs_t *zfsvfs, objset_t *os)
 	return (0);
 }
 
+/*
+ * Release the objset owned by zfsvfs_create() and its key hold.
+ */
+static void
+zfsvfs_disown(zfsvfs_t *zfsvfs, objset_t *os)
+{
+	if (os->os_encrypted)
+		spa_keystore_rele_dsl_key(dmu_objset_spa(os),
+		    dmu_objset_id(os), zfsvfs);
+	dmu_objset_disown(os, zfsvfs);
+}
+
 int
 zfsvfs_create(const char *osname, zfsvfs_t **zfvp)
 {
@@ -1218,6 +1237,17 @@ zfsvfs_create(const char *osname, zfsvfs_t **zfvp)
 		return (error);
 	}
 
+	/* the key of an encrypted filesystem stays loaded while it is in use */
+	if (os->os_encrypted) {
+		error = spa_keystore_hold_dsl_key(dmu_objset_spa(os),
+		    dmu_objset_id(os), zfsvfs);
+		if (error) {
+			dmu_objset_disown(os, zfsvfs);
+			kmem_free(zfsvfs, sizeof (zfsvfs_t));
+			return (error);
+		}
+	}
+
 	zfsvfs->z_vfs = NULL;
 	zfsvfs->z_parent = zfsvfs;
 
@@ -1225,6 +1255,10 @@ zfsvfs_create(const char *osname, zfsvfs_t **zfvp)
 	mutex_init(&zfsvfs->z_lock, NULL, MUTEX_DEFAULT, NULL);
 	list_create(&zfsvfs->z_all_znodes, sizeof (znode_t),
 	    offsetof(znode_t, z_link_node));
+	mutex_init(&zfsvfs->z_reclaim_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zfsvfs->z_reclaim_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zfsvfs->z_reclaim_znodes, sizeof (znode_t),
+	    offsetof(znode_t, z_link_reclaim_node));
 
 	rrm_init(&zfsvfs->z_teardown_lock, B_FALSE);
 	rw_init(&zfsvfs->z_teardown_inactive_lock, NULL, RW_DEFAULT, NULL);
@@ -1242,7 +1276,7 @@ zfsvfs_create(const char *osname, zfsvfs_t **zfvp)
 
 	error = zfsvfs_init(zfsvfs, os);
 	if (error != 0) {
-		dmu_objset_disown(os, zfsvfs);
+		zfsvfs_disown(zfsvfs, os);
 		*zfvp = NULL;
 		kmem_free(zfsvfs, sizeof (zfsvfs_t));
 		return (error);
@@ -1346,10 +1380,14 @@ zfsvfs_free(zfsvfs_t *zfsvfs)
 	//rw_exit(&zfsvfs_lock);
 
 	zfs_fuid_destroy(zfsvfs);
+	dataset_kstats_destroy(&zfsvfs->z_kstat);
 
 	mutex_destroy(&zfsvfs->z_znodes_lock);
 	mutex_destroy(&zfsvfs->z_lock);
 	list_destroy(&zfsvfs->z_all_znodes);
+	mutex_destroy(&zfsvfs->z_reclaim_lock);
+	cv_destroy(&zfsvfs->z_reclaim_cv);
+	list_destroy(&zfsvfs->z_reclaim_znodes);
 	rrm_destroy(&zfsvfs->z_teardown_lock);
 	rw_destroy(&zfsvfs->z_teardown_inactive_lock);
 	rw_destroy(&zfsvfs->z_fuid_lock);
@@ -1421,6 +1459,13 @@ dprintf("%s\n", __func__);
 	if (error)
 		return (error);
 	zfsvfs->z_vfs = vfsp;
+	dataset_kstats_create(&zfsvfs->z_kstat, zfsvfs->z_os);
+
+	if (DS_IS_FILTERED(dmu_objset_ds(zfsvfs->z_os)) &&
+	    !zfs_allow_filtered_mount) {
+		error = SET_ERROR(EPERM);
+		goto out;
+	}
 
 #ifdef illumos
 	/* Initialize the generic filesystem structure. */
@@ -1584,7 +1629,7 @@ dprintf("%s\n", __func__);
 #endif
 out:
 	if (error) {
-		dmu_objset_disown(zfsvfs->z_os, zfsvfs);
+		zfsvfs_disown(zfsvfs, zfsvfs->z_os);
 		zfsvfs_free(zfsvfs);
 	} else {
 		atomic_inc_32(&zfs_active_fs_count);
@@ -2944,6 +2989,12 @@ zfsvfs_teardown(zfsvfs_t *zfsvfs, boolean_t unmounting)
 	if (zfsvfs->z_os)
 		taskq_wait(dsl_pool_vnrele_taskq(dmu_objset_pool(zfsvfs->z_os)));
 
+	/*
+	 * Finish off the znodes whose vnodes have been reclaimed; they
+	 * still hold their SA handles.
+	 */
+	zfs_znode_reclaim_wait(zfsvfs);
+
 	rrm_enter(&zfsvfs->z_teardown_lock, RW_WRITER, FTAG);
 
 	if (!unmounting) {
@@ -3224,7 +3275,7 @@ dprintf("%s\n", __func__);
 		 * Finally release the objset
 		 */
         dprintf("disown\n");
-		dmu_objset_disown(os, zfsvfs);
+		zfsvfs_disown(zfsvfs, os);
 	}
 
     dprintf("OS released\n");
@@ -54,6 +54,7 @@
 #include <sys/fs/zfs.h>
 #include <sys/dmu.h>
 #include <sys/dmu_objset.h>
+#include <sys/dsl_dataset.h>
 #include <sys/spa.h>
 #include <sys/txg.h>
 #include <sys/dbuf.h>
@@ -262,31 +263,32 @@ zfs_close(vnode_t *vp, int flag, int count, offset_t offset, cred_t *cr,
 	return (0);
 }
 
-#if defined(SEEK_HOLE) && defined(SEEK_DATA)
 /*
- * Lseek support for finding holes (cmd == SEEK_HOLE) and
- * data (cmd == SEEK_DATA). "off" is an in/out parameter.
+ * Lseek support for finding holes (hole == B_TRUE) and
+ * data (hole == B_FALSE). "off" is an in/out parameter.
+ * dmu_offset_next() walks the indirect blocks only, the
+ * data itself is never read.
  */
 static int
-zfs_holey_common(struct inode *ip, int cmd, loff_t *off)
+zfs_holey_common(znode_t *zp, boolean_t hole, off_t *off)
 {
-	znode_t	*zp = ITOZ(ip);
 	uint64_t noff = (uint64_t)*off; /* new offset */
 	uint64_t file_sz;
 	int error;
-	boolean_t hole;
 
 	file_sz = zp->z_size;
 	if (noff >= file_sz)  {
 		return (SET_ERROR(ENXIO));
 	}
 
-	if (cmd == SEEK_HOLE)
-		hole = B_TRUE;
-	else
-		hole = B_FALSE;
+	/* Inline data has no holes, only the virtual one at EOF */
+	if (zp->z_pflags & ZFS_INLINE_DATA) {
+		if (hole)
+			*off = file_sz;
+		return (0);
+	}
 
-	error = dmu_offset_next(ZTOZSB(zp)->z_os, zp->z_id, hole, &noff);
+	error = dmu_offset_next(zp->z_zfsvfs->z_os, zp->z_id, hole, &noff);
 
 	if (error == ESRCH)
 		return (SET_ERROR(ENXIO));
@@ -310,24 +312,39 @@ zfs_holey_common(struct inode *ip, int cmd, loff_t *off)
 }
 
 int
-zfs_holey(struct inode *ip, int cmd, loff_t *off)
+zfs_holey(vnode_t *vp, boolean_t hole, off_t *off)
 {
-	znode_t	*zp = ITOZ(ip);
-	zfs_sb_t *zsb = ITOZSB(ip);
+	znode_t	*zp = VTOZ(vp);
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
 	int error;
 
-	ZFS_ENTER(zsb);
+	ZFS_ENTER(zfsvfs);
 	ZFS_VERIFY_ZP(zp);
 
-	error = zfs_holey_common(ip, cmd, off);
+	error = zfs_holey_common(zp, hole, off);
 
-	ZFS_EXIT(zsb);
+	ZFS_EXIT(zfsvfs);
 	return (error);
 }
 
-#endif /* SEEK_HOLE && SEEK_DATA */
-
 #if defined(_KERNEL)
+/*
+ * Return the number of pages of the page list, starting at upl_page,
+ * which are resident (or not) like upl_page is, so that mappedread() and
+ * update_pages() can handle each run with a single copy.
+ */
+static int
+zfs_upl_page_run(upl_page_info_t *pl, int upl_page, int npages)
+{
+	boolean_t valid = (pl != NULL && upl_valid_page(pl, upl_page));
+	int run = 1;
+
+	while (upl_page + run < npages &&
+	    (pl != NULL && upl_valid_page(pl, upl_page + run)) == valid)
+		run++;
+	return (run);
+}
+
 /*
  * When a file is memory mapped, we must keep the IO data synchronized
  * between the DMU cache and the memory mapped pages.  What this means:
@@ -349,6 +366,8 @@ update_pages(vnode_t *vp, int64_t nbytes, struct uio *uio,
     off_t upl_start;
     int upl_size;
     int upl_page;
+    int npages;
+    int run;
     off_t off;
 
     upl_start = uio_offset(uio);
@@ -375,8 +394,12 @@ update_pages(vnode_t *vp, int64_t nbytes, struct uio *uio,
 		return;
 	}
 
-    for (upl_page = 0; len > 0; ++upl_page) {
-        uint64_t bytes = MIN(PAGESIZE - off, len);
+    npages = upl_size / PAGE_SIZE;
+    for (upl_page = 0; len > 0; upl_page += run) {
+        uint64_t bytes;
+
+        run = zfs_upl_page_run(pl, upl_page, npages);
+        bytes = MIN(run * PAGE_SIZE - off, len);
         //uint64_t woff = uio_offset(uio);
         /*
          * We don't want a new page to "appear" in the middle of
@@ -402,10 +425,10 @@ update_pages(vnode_t *vp, int64_t nbytes, struct uio *uio,
                  */
             } else {
                 /*
-                 * page is now in an unknown state so dump it.
+                 * pages are now in an unknown state so dump them.
                  */
-                ubc_upl_abort_range(upl, upl_start, PAGESIZE,
-                                    UPL_ABORT_DUMP_PAGES);
+                ubc_upl_abort_range(upl, upl_page * PAGE_SIZE,
+                                    run * PAGE_SIZE, UPL_ABORT_DUMP_PAGES);
             }
         } else { // !upl_valid_page
 			/*
@@ -413,10 +436,12 @@ update_pages(vnode_t *vp, int64_t nbytes, struct uio *uio,
 			  uio, bytes, tx);
 			*/
             rw_exit(&zp->z_map_lock);
+            /* Keep the uio in step with the pages that follow. */
+            uioskip(uio, bytes);
         }
 
-        vaddr += PAGE_SIZE;
-        upl_start += PAGE_SIZE;
+        vaddr += run * PAGE_SIZE;
+        upl_start += run * PAGE_SIZE;
         len -= bytes;
         off = 0;
         if (error)
@@ -517,6 +542,8 @@ mappedread(vnode_t *vp, int nbytes, struct uio *uio)
     off_t upl_start;
     int upl_size;
     int upl_page;
+    int npages;
+    int run;
     off_t off;
 
 
@@ -546,8 +573,17 @@ mappedread(vnode_t *vp, int nbytes, struct uio *uio)
 		return ENOMEM;
 	}
 
-    for (upl_page = 0; len > 0; ++upl_page) {
-        uint64_t bytes = MIN(PAGE_SIZE - off, len);
+    /*
+     * Copy each run of resident pages with one uiomove(), and read each
+     * run of missing pages with one dmu_read_uio(), rather than going
+     * page by page.
+     */
+    npages = upl_size / PAGE_SIZE;
+    for (upl_page = 0; len > 0; upl_page += run) {
+        uint64_t bytes;
+
+        run = zfs_upl_page_run(pl, upl_page, npages);
+        bytes = MIN(run * PAGE_SIZE - off, len);
         if (pl && upl_valid_page(pl, upl_page)) {
             uio_setrw(uio, UIO_READ);
 
@@ -561,7 +597,7 @@ mappedread(vnode_t *vp, int nbytes, struct uio *uio)
             error = dmu_read_uio(os, zp->z_id, uio, bytes);
         }
 
-        vaddr += PAGE_SIZE;
+        vaddr += run * PAGE_SIZE;
         len -= bytes;
         off = 0;
         if (error)
@@ -603,7 +639,8 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	znode_t		*zp = VTOZ(vp);
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
 	objset_t	*os;
-	ssize_t		n, nbytes;
+	ssize_t		n, nbytes, start_resid;
+	hrtime_t	start = gethrtime();
 	int		error = 0;
 	rl_t		*rl;
 #ifndef __APPLE__
@@ -662,6 +699,7 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	 * Lock the range against changes.
 	 */
 	rl = zfs_range_lock(zp, uio_offset(uio), uio_resid(uio), RL_READER);
+	start_resid = uio_resid(uio);
 
 	/*
 	 * If we are reading past end-of-file we can skip
@@ -675,6 +713,21 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	ASSERT(uio_offset(uio) < zp->z_size);
 	n = MIN(uio_resid(uio), zp->z_size - uio_offset(uio));
 
+	/*
+	 * Inline data is no larger than zfs_inline_data_max, so it is
+	 * copied out in one go.
+	 */
+	if (zp->z_pflags & ZFS_INLINE_DATA) {
+		void *buf = kmem_alloc(n, KM_SLEEP);
+
+		error = zfs_sa_read_data(zp, uio_offset(uio), n, buf,
+		    DMU_READ_PREFETCH);
+		if (error == 0)
+			error = uiomove(buf, n, UIO_READ, uio);
+		kmem_free(buf, n);
+		goto out;
+	}
+
 #ifdef sun
 	if ((uio->uio_extflg == UIO_XUIO) &&
 	    (((xuio_t *)uio)->xu_type == UIOTYPE_ZEROCOPY)) {
@@ -732,12 +785,76 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 out:
 	zfs_range_unlock(rl);
 
+	if (error == 0) {
+		dataset_kstats_update_read(&zfsvfs->z_kstat,
+		    start_resid - uio_resid(uio), gethrtime() - start);
+	}
+
 	ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
 	ZFS_EXIT(zfsvfs);
     if (error) dprintf("zfs_read returning error %d\n", error);
 	return (error);
 }
 
+/*
+ * Let concurrent synchronous writers of a file share one zil_commit(), and
+ * optionally have the committing writer wait this long for more to arrive.
+ */
+int zfs_group_commit = 1;
+int zfs_group_commit_window_us = 0;
+
+/*
+ * Make the log records of a synchronous write to zp stable.  Each writer
+ * takes a ticket once its records are assigned to the log.  A writer
+ * that finds no commit in progress commits for every ticket taken so far,
+ * since all of their records are in the itx lists when it calls
+ * zil_commit().  Writers that arrive meanwhile wait for it.  They return
+ * if their ticket was covered, and otherwise one of them commits for the
+ * rest.  zil_commit() only returns once the records are stable, falling
+ * back to txg_wait_synced() if it has to, so durability is unchanged.
+ */
+static void
+zfs_write_commit(zilog_t *zilog, znode_t *zp)
+{
+	uint64_t ticket, covered;
+	boolean_t saved = B_TRUE;
+
+	if (!zfs_group_commit) {
+		zil_commit(zilog, zp->z_id);
+		return;
+	}
+
+	mutex_enter(&zp->z_lock);
+	ticket = ++zp->z_commit_seq;
+	while (zp->z_commit_done < ticket) {
+		if (zp->z_commit_active) {
+			cv_wait(&zp->z_commit_cv, &zp->z_lock);
+			continue;
+		}
+		zp->z_commit_active = B_TRUE;
+		if (zfs_group_commit_window_us > 0) {
+			(void) cv_timedwait_hires(&zp->z_commit_cv,
+			    &zp->z_lock, USEC2NSEC(zfs_group_commit_window_us),
+			    USEC2NSEC(1), 0);
+		}
+		covered = zp->z_commit_seq;
+		mutex_exit(&zp->z_lock);
+
+		zil_commit(zilog, zp->z_id);
+
+		mutex_enter(&zp->z_lock);
+		ASSERT3U(covered, >=, zp->z_commit_done);
+		zp->z_commit_done = covered;
+		zp->z_commit_active = B_FALSE;
+		cv_broadcast(&zp->z_commit_cv);
+		saved = B_FALSE;
+	}
+	mutex_exit(&zp->z_lock);
+
+	if (saved)
+		ZIL_STAT_BUMP(zil_commit_saved_count);
+}
+
 /*
  * Write the bytes to a file.
  *
@@ -757,6 +874,114 @@ out:
  *	vp - ctime|mtime updated if byte count > 0
  */
 
+/*
+ * Clear the Set-UID/Set-GID bits of zp after a write, if cr is not
+ * privileged and at least one of the execute bits is set.
+ *
+ * Note: we don't call zfs_fuid_map_id() here because
+ * user 0 is not an ephemeral uid.
+ */
+static void
+zfs_write_clear_setid(znode_t *zp, cred_t *cr, dmu_tx_t *tx)
+{
+	mutex_enter(&zp->z_acl_lock);
+	if ((zp->z_mode & (S_IXUSR | (S_IXUSR >> 3) |
+	    (S_IXUSR >> 6))) != 0 &&
+	    (zp->z_mode & (S_ISUID | S_ISGID)) != 0 &&
+	    secpolicy_vnode_setid_retain(ZTOV(zp), cr,
+	    (zp->z_mode & S_ISUID) != 0 && zp->z_uid == 0) != 0) {
+		uint64_t newmode;
+		zp->z_mode &= ~(S_ISUID | S_ISGID);
+		newmode = zp->z_mode;
+		(void) sa_update(zp->z_sa_hdl, SA_ZPL_MODE(zp->z_zfsvfs),
+		    (void *)&newmode, sizeof (uint64_t), tx);
+	}
+	mutex_exit(&zp->z_acl_lock);
+}
+
+/*
+ * Write n bytes at woff from uio to the inline data of zp (see
+ * zfs_inline_data_ok()), in a single transaction.  The whole data is
+ * rewritten as one attribute, so the whole file must be write locked.
+ * bulk holds the count attributes zfs_write() updates after each chunk.
+ */
+static int
+zfs_write_inline(znode_t *zp, uio_t *uio, offset_t woff, ssize_t n,
+    int ioflag, cred_t *cr, sa_bulk_attr_t *bulk, int count,
+    uint64_t *mtime, uint64_t *ctime)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	dsl_dataset_t *ds = dmu_objset_ds(zfsvfs->z_os);
+	uint64_t end = MAX(zp->z_size, woff + n);
+	size_t cbytes;
+	dmu_tx_t *tx;
+	char *buf;
+	int error;
+
+	if (zfsvfs->z_replay && zp->z_replay_eof > end)
+		end = zp->z_replay_eof;
+
+	if (zfs_owner_overquota(zfsvfs, zp, B_FALSE) ||
+	    zfs_owner_overquota(zfsvfs, zp, B_TRUE))
+		return (SET_ERROR(EDQUOT));
+
+	buf = kmem_zalloc(end, KM_SLEEP);
+	if (zp->z_size != 0 && (error = zfs_sa_read_data(zp, 0,
+	    zp->z_size, buf, DMU_READ_NO_PREFETCH)) != 0)
+		goto out;
+	if ((error = uiocopy(buf + woff, n, UIO_WRITE, uio, &cbytes)) != 0)
+		goto out;
+	ASSERT(cbytes == n);
+
+	tx = dmu_tx_create(zfsvfs->z_os);
+	dmu_tx_hold_sa(tx, zp->z_sa_hdl, B_TRUE);
+	dmu_tx_hold_write(tx, zp->z_id, 0, end);
+	zfs_sa_upgrade_txholds(tx, zp);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		goto out;
+	}
+
+	/*
+	 * Size the block for the data now, while the file has none, so
+	 * that zfs_inline_promote() fills a single block.
+	 */
+	zfs_grow_blocksize(zp, MIN(end, zfsvfs->z_max_blksz), tx);
+	if (end > zp->z_size)
+		vnode_pager_setsize(ZTOV(zp), end);
+
+	VERIFY0(sa_update(zp->z_sa_hdl, SA_ZPL_INLINE_DATA(zfsvfs),
+	    buf, end, tx));
+
+	zfs_write_clear_setid(zp, cr, tx);
+	zfs_tstamp_update_setup(zp, CONTENT_MODIFIED, mtime, ctime, B_TRUE);
+	zp->z_size = end;
+	zp->z_pflags |= ZFS_INLINE_DATA;
+	error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
+
+	zfs_log_write(zfsvfs->z_log, tx, TX_WRITE, zp, woff, n, ioflag,
+	    NULL, NULL);
+
+	if (!ds->ds_feature_inuse[SPA_FEATURE_INLINE_DATA]) {
+		mutex_enter(&ds->ds_lock);
+		ds->ds_feature_activation_needed[SPA_FEATURE_INLINE_DATA] =
+		    B_TRUE;
+		mutex_exit(&ds->ds_lock);
+	}
+	dmu_tx_commit(tx);
+
+	if (error == 0) {
+		uioskip(uio, n);
+#ifdef __APPLE__
+		atomic_inc_64(&zp->z_write_gencount);
+#endif
+	}
+out:
+	kmem_free(buf, end);
+	return (error);
+}
+
 /* ARGSUSED */
 int
 zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
@@ -764,6 +989,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	znode_t		*zp = VTOZ(vp);
 	rlim64_t	limit = MAXOFFSET_T;
 	ssize_t		start_resid = uio_resid(uio);
+	hrtime_t	start = gethrtime();
 	ssize_t		tx_bytes;
 	uint64_t	end_size;
 	dmu_tx_t	*tx;
@@ -784,6 +1010,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	int		count = 0;
 	sa_bulk_attr_t	bulk[4];
 	uint64_t	mtime[2], ctime[2];
+	uint64_t	inline_end;
     struct uio *uio_copy = NULL;
 	/*
 	 * Fasttrack empty write
@@ -881,6 +1108,22 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		rl = zfs_range_lock(zp, woff, n, RL_WRITER);
 	}
 
+	/*
+	 * Inline data is rewritten as a whole, and moving it to the file's
+	 * blocks changes their size, so either takes the whole file.
+	 */
+	if ((zp->z_pflags & ZFS_INLINE_DATA) ||
+	    (zp->z_size == 0 && zfs_inline_data_ok(zp, woff + n))) {
+		if (rl->r_len != UINT64_MAX) {
+			zfs_range_unlock(rl);
+			rl = zfs_range_lock(zp, 0, UINT64_MAX, RL_WRITER);
+			if (ioflag & FAPPEND) {
+				woff = zp->z_size;
+				uio_setoffset(uio, woff);
+			}
+		}
+	}
+
 #ifndef __APPLE__
 	if (vn_rlimit_fsize(vp, uio, uio->uio_td)) {
 		zfs_range_unlock(rl);
@@ -903,6 +1146,24 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 
 	end_size = MAX(zp->z_size, woff + n);
 
+	/*
+	 * Small files are written inline while they stay small and are
+	 * not cached; otherwise their data moves to the file's blocks
+	 * and the write goes on from there.
+	 */
+	inline_end = end_size;
+	if (zfsvfs->z_replay && zp->z_replay_eof > inline_end)
+		inline_end = zp->z_replay_eof;
+	if (n > 0 && rl->r_len == UINT64_MAX && (zp->z_size == 0 ||
+	    (zp->z_pflags & ZFS_INLINE_DATA)) &&
+	    zfs_inline_data_ok(zp, inline_end) && !vn_has_cached_data(vp)) {
+		error = zfs_write_inline(zp, uio, woff, n, ioflag, cr,
+		    bulk, count, mtime, ctime);
+		n = 0;
+	} else if ((error = zfs_inline_promote(zp)) != 0) {
+		n = 0;
+	}
+
 	/*
 	 * Write the file in reasonable size chunks.  Each chunk is written
 	 * in a separate transaction; this keeps the intent log records small
@@ -1083,29 +1344,13 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		}
 
 		/*
-		 * Clear Set-UID/Set-GID bits on successful write if not
-		 * privileged and at least one of the excute bits is set.
+		 * Clear Set-UID/Set-GID bits on successful write.
 		 *
 		 * It would be nice to to this after all writes have
 		 * been done, but that would still expose the ISUID/ISGID
 		 * to another app after the partial write is committed.
-		 *
-		 * Note: we don't call zfs_fuid_map_id() here because
-		 * user 0 is not an ephemeral uid.
 		 */
-		mutex_enter(&zp->z_acl_lock);
-		if ((zp->z_mode & (S_IXUSR | (S_IXUSR >> 3) |
-		    (S_IXUSR >> 6))) != 0 &&
-		    (zp->z_mode & (S_ISUID | S_ISGID)) != 0 &&
-		    secpolicy_vnode_setid_retain(vp, cr,
-		    (zp->z_mode & S_ISUID) != 0 && zp->z_uid == 0) != 0) {
-			uint64_t newmode;
-			zp->z_mode &= ~(S_ISUID | S_ISGID);
-			newmode = zp->z_mode;
-			(void) sa_update(zp->z_sa_hdl, SA_ZPL_MODE(zfsvfs),
-			    (void *)&newmode, sizeof (uint64_t), tx);
-		}
-		mutex_exit(&zp->z_acl_lock);
+		zfs_write_clear_setid(zp, cr, tx);
 
 		zfs_tstamp_update_setup(zp, CONTENT_MODIFIED, mtime, ctime,
 		    B_TRUE);
@@ -1123,10 +1368,10 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		/*
 		 * If we are replaying and eof is non zero then force
 		 * the file size to the specified eof. Note, there's no
-		 * concurrency during replay.
+		 * concurrency during replay of any one file.
 		 */
-		if (zfsvfs->z_replay && zfsvfs->z_replay_eof != 0)
-			zp->z_size = zfsvfs->z_replay_eof;
+		if (zfsvfs->z_replay && zp->z_replay_eof != 0)
+			zp->z_size = zp->z_replay_eof;
 
 		error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
 
@@ -1169,7 +1414,10 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 
 	if (ioflag & (FSYNC | FDSYNC) ||
 	    zfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
-		zil_commit(zilog, zp->z_id);
+		zfs_write_commit(zilog, zp);
+
+	dataset_kstats_update_write(&zfsvfs->z_kstat,
+	    start_resid - uio_resid(uio), gethrtime() - start);
 
 	ZFS_EXIT(zfsvfs);
 	return (0);
@@ -1203,7 +1451,7 @@ zfs_get_done(zgd_t *zgd, int error)
 	}
 #endif
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	kmem_free(zgd, sizeof (zgd_t));
 }
@@ -1216,8 +1464,8 @@ static int zil_fault_io = 0;
  * Get data to generate a TX_WRITE intent log record.
  */
 int
-zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
-			 znode_t *zp, rl_t *rl)
+zfs_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio, znode_t *zp, rl_t *rl)
 {
 	zfsvfs_t *zfsvfs = arg;
 	objset_t *os = zfsvfs->z_os;
@@ -1229,8 +1477,9 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 	zgd_t *zgd;
 	int error = 0;
 
-	ASSERT(zio != NULL);
-	ASSERT(size != 0);
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3P(zio, !=, NULL);
+	ASSERT3U(size, !=, 0);
 
 #ifndef __APPLE__
 	/*
@@ -1250,7 +1499,7 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 #endif
 
 	zgd = (zgd_t *)kmem_zalloc(sizeof (zgd_t), KM_SLEEP);
-	zgd->zgd_zilog = zfsvfs->z_log;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zp;
 	zgd->zgd_rl = rl;
 
@@ -1271,7 +1520,7 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 		if (offset >= zp->z_size) {
 			error = SET_ERROR(ENOENT);
 		} else {
-			error = dmu_read(os, object, offset, size, buf,
+			error = zfs_sa_read_data(zp, offset, size, buf,
 			    DMU_READ_NO_PREFETCH);
 		}
 		ASSERT(error == 0 || error == ENOENT);
@@ -1640,6 +1889,7 @@ zfs_create(vnode_t *dvp, char *name, vattr_t *vap, int excl, int mode,
 	void		*vsecp = NULL;
 	int		flag = 0;
 	boolean_t	waited = B_FALSE;
+	boolean_t	attach = B_FALSE;
 
 	/*
 	 * If we have an ephemeral id, ACL, or XVATTR then
@@ -1789,9 +2039,13 @@ top:
 		dmu_tx_commit(tx);
 
 		/*
-		 * OS X - attach the vnode _after_ committing the transaction
+		 * OS X - attach the vnode _after_ committing the transaction,
+		 * and after dropping the directory entry lock below, since
+		 * vnode_create() may have to wait for the system to recycle
+		 * a vnode.  A racing zget waits in zfs_zget_ext() for the
+		 * vnode to be attached.
 		 */
-		zfs_znode_getvnode(zp, zfsvfs);
+		attach = B_TRUE;
 
 	} else {
 		int aflags = (flag & FAPPEND) ? V_APPEND : 0;
@@ -1846,6 +2100,9 @@ out:
 	if (dl)
 		zfs_dirent_unlock(dl);
 
+	if (attach)
+		zfs_znode_getvnode(zp, zfsvfs);
+
 	if (error) {
 		if (zp)
 			VN_RELE(ZTOV(zp));
@@ -2337,13 +2594,15 @@ top:
 	dmu_tx_commit(tx);
 
 	/*
-	 * OS X - attach the vnode _after_ committing the transaction
+	 * OS X - attach the vnode _after_ committing the transaction, and
+	 * without the directory entry lock, as vnode_create() can block
+	 * recycling vnodes.
 	 */
+	zfs_dirent_unlock(dl);
+
 	zfs_znode_getvnode(zp, zfsvfs);
 	*vpp = ZTOV(zp);
 
-	zfs_dirent_unlock(dl);
-
 	if (zfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
 		zil_commit(zilog, 0);
 
@@ -2590,14 +2849,22 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int flags, int *a_nu
 		/*
 		 * Start iteration from the beginning of the directory.
 		 */
-		zap_cursor_init(&zc, os, zp->z_id);
+		zap_cursor_init_prefetch(&zc, os, zp->z_id, 0);
 	} else {
 		/*
 		 * The offset is a serialized cursor.
 		 */
-		zap_cursor_init_serialized(&zc, os, zp->z_id, offset);
+		zap_cursor_init_prefetch(&zc, os, zp->z_id, offset);
 	}
 
+	/*
+	 * Prefetch the dnodes of the first window of entries; the rest are
+	 * prefetched a window at a time as the cursor reaches them.
+	 */
+	if (prefetch && zfs_readdir_dnode_prefetch > 0)
+		zfs_dirent_prefetch(zp, offset <= 3 ? 0 : offset,
+		    zfs_readdir_dnode_prefetch);
+
 	/*
 	 * Get space to change directory entries into fs independent format.
 	 */
@@ -2846,7 +3113,7 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int flags, int *a_nu
 		ASSERT(outcount <= bufsize);
 
 		/* Prefetch znode */
-		if (prefetch)
+		if (prefetch && zfs_readdir_dnode_prefetch <= 0)
 			dmu_prefetch(os, objnum, 0, 0, 0, ZIO_PRIORITY_SYNC_READ);
 
 		/*
@@ -2855,6 +3122,10 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int flags, int *a_nu
 		if (offset > 2 || (offset == 2 && !zfs_show_ctldir(zp))) {
 			zap_cursor_advance(&zc);
 			offset = zap_cursor_serialize(&zc);
+			if (prefetch && zfs_readdir_dnode_prefetch > 0 &&
+			    numdirent % zfs_readdir_dnode_prefetch == 0)
+				zfs_dirent_prefetch(zp, offset,
+				    zfs_readdir_dnode_prefetch);
 		} else {
 			offset += 1;
 		}
@@ -4651,13 +4922,15 @@ top:
 	dmu_tx_commit(tx);
 
 	/*
-	 * OS X - attach the vnode _after_ committing the transaction
+	 * OS X - attach the vnode _after_ committing the transaction, and
+	 * without the directory entry lock, as vnode_create() can block
+	 * recycling vnodes.
 	 */
+	zfs_dirent_unlock(dl);
+
 	zfs_znode_getvnode(zp, zfsvfs);
 	*vpp = ZTOV(zp);
 
-	zfs_dirent_unlock(dl);
-
 	if (zfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
 		zil_commit(zilog, 0);
 
@@ -100,8 +100,31 @@ unsigned int debug_vnop_osx_printf = 0;
 unsigned int zfs_vnop_ignore_negatives = 0;
 unsigned int zfs_vnop_ignore_positives = 0;
 unsigned int zfs_vnop_create_negatives = 1;
+
+/*
+ * Bytes past the end of each pagein to prefetch, so that sequential
+ * faults on a mapped file find their records already cached.
+ */
+uint64_t zfs_vnop_pagein_readahead = 1024 * 1024;
+
+/*
+ * Finder is told about a mount's free space changing at most once every
+ * zfs_vnop_findernotify_interval seconds, and only once it has moved by
+ * more than zfs_vnop_findernotify_threshold bytes since the last event.
+ */
+uint64_t zfs_vnop_findernotify_interval = 32;
+uint64_t zfs_vnop_findernotify_threshold = 1ULL << 20;
+uint64_t vnop_num_findernotify_sent = 0;
+uint64_t vnop_num_findernotify_suppressed = 0;
 #endif
 
+/*
+ * With xattr=sa, resource forks up to this size written in one piece are
+ * kept in the SA with the other xattrs; larger ones, and forks written in
+ * pieces or opened as named streams, live in the hidden xattr directory.
+ */
+uint64_t zfs_xattr_sa_rsrc_max = 8192;
+
 #define	DECLARE_CRED(ap) \
 	cred_t *cr = (cred_t *)vfs_context_ucred((ap)->a_context)
 #define	DECLARE_CONTEXT(ap) \
@@ -230,6 +253,15 @@ zfs_findernotify_callback(mount_t mp, __unused void *arg)
 		ZFS_ENTER_NOERROR(zfsvfs);
 		if (zfsvfs->z_unmounted) goto out;
 
+		/*
+		 * Free space can only have moved if the pool has synced a
+		 * txg since we last looked, so idle mounts cost nothing.
+		 */
+		uint64_t txg;
+		txg = spa_last_synced_txg(dmu_objset_spa(zfsvfs->z_os));
+		if (txg == zfsvfs->z_findernotify_txg) goto out;
+		zfsvfs->z_findernotify_txg = txg;
+
 		/* Check if space usage has changed sufficiently to bother updating */
 		uint64_t refdbytes, availbytes, usedobjs, availobjs;
 		uint64_t delta;
@@ -241,10 +273,12 @@ zfs_findernotify_callback(mount_t mp, __unused void *arg)
 			delta = zfsvfs->z_findernotify_space - availbytes;
 		}
 
-#define ZFS_FINDERNOTIFY_THRESHOLD (1ULL<<20)
-
 		/* Under the limit ? */
-		if (delta <= ZFS_FINDERNOTIFY_THRESHOLD) goto out;
+		if (delta <= zfs_vnop_findernotify_threshold) {
+			if (delta != 0)
+				atomic_inc_64(&vnop_num_findernotify_suppressed);
+			goto out;
+		}
 
 		/* Over threadhold, so we will notify finder, remember the value */
 		zfsvfs->z_findernotify_space = availbytes;
@@ -281,6 +315,7 @@ zfs_findernotify_callback(mount_t mp, __unused void *arg)
 				vnode_getattr(vp, &vattr, kernelctx);
 				// Send event
 				spl_vnode_notify(vp, VNODE_EVENT_ATTRIB, &vattr);
+				atomic_inc_64(&vnop_num_findernotify_sent);
 
 				// Cleanup vp
 				vnode_put(vp);
@@ -312,10 +347,11 @@ zfs_findernotify_thread(void *notused)
 	mutex_enter(&zfs_findernotify_lock);
 	while (!zfs_findernotify_thread_exit) {
 
-		/* Sleep 32 seconds */
+		/* Sleep zfs_vnop_findernotify_interval seconds */
 		CALLB_CPR_SAFE_BEGIN(&cpr);
 		(void) cv_timedwait(&zfs_findernotify_thread_cv,
-							&zfs_findernotify_lock, ddi_get_lbolt() + (hz<<5));
+		    &zfs_findernotify_lock, ddi_get_lbolt() +
+		    hz * MAX(zfs_vnop_findernotify_interval, 1));
 		CALLB_CPR_SAFE_END(&cpr, &zfs_findernotify_lock);
 
 		if (!zfs_findernotify_thread_exit)
@@ -400,6 +436,114 @@ zfs_vnop_close(struct vnop_close_args *ap)
 	return (zfs_close(ap->a_vp, ap->a_fflag, count, offset, cr, ct));
 }
 
+#define	ZFS_COPY_RANGE_CHUNK	(1024 * 1024)
+
+/*
+ * Copy len bytes at soff in svp to doff in dvp through zfs_read() and
+ * zfs_write(), a chunk at a time through a kernel buffer.  When the
+ * destination range starts past its EOF, it already reads as zeros, so
+ * holes in the source are skipped and stay holes in the copy.
+ */
+static int
+zfs_copy_range(struct vnode *svp, uint64_t soff, struct vnode *dvp,
+    uint64_t doff, uint64_t len, uint64_t *copied, cred_t *cr,
+    caller_context_t *ct)
+{
+	znode_t *szp = VTOZ(svp);
+	znode_t *dzp = VTOZ(dvp);
+	zfsvfs_t *zfsvfs = dzp->z_zfsvfs;
+	boolean_t sparse;
+	uint64_t off, next, n;
+	uio_t *uio;
+	void *buf;
+	int error;
+
+	*copied = 0;
+
+	if (!vnode_isreg(svp) || !vnode_isreg(dvp))
+		return (EINVAL);
+	/* Overlapping copies within one file are not supported */
+	if (szp == dzp)
+		return (EINVAL);
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(szp);
+	ZFS_VERIFY_ZP(dzp);
+	error = zfs_zaccess(szp, ACE_READ_DATA, 0, B_FALSE, cr);
+	if (error == 0 && soff < szp->z_size)
+		len = MIN(len, szp->z_size - soff);
+	else
+		len = 0;
+	/* Inline data is not seen by dmu_offset_next(), copy it all */
+	sparse = (doff >= dzp->z_size) &&
+	    !(szp->z_pflags & ZFS_INLINE_DATA);
+	ZFS_EXIT(zfsvfs);
+
+	if (error != 0 || len == 0)
+		return (error);
+
+	buf = kmem_alloc(ZFS_COPY_RANGE_CHUNK, KM_SLEEP);
+
+	while (*copied < len) {
+		off = soff + *copied;
+		n = MIN(len - *copied, ZFS_COPY_RANGE_CHUNK);
+
+		if (sparse) {
+			/*
+			 * dmu_offset_next() syncs out any dirty data of the
+			 * source first, so recent writes are not missed.
+			 */
+			next = off;
+			error = dmu_offset_next(zfsvfs->z_os, szp->z_id,
+			    B_FALSE, &next);
+			if (error == ESRCH) {
+				/* No more data, the rest is a hole */
+				*copied = len;
+				error = 0;
+				break;
+			}
+			if (error == 0 && next > off) {
+				*copied += MIN(next - off, len - *copied);
+				continue;
+			}
+			next = off;
+			if (dmu_offset_next(zfsvfs->z_os, szp->z_id,
+			    B_TRUE, &next) == 0 && next > off)
+				n = MIN(n, next - off);
+			error = 0;
+		}
+
+		uio = uio_create(1, off, UIO_SYSSPACE, UIO_READ);
+		uio_addiov(uio, CAST_USER_ADDR_T(buf), n);
+		error = zfs_read(svp, uio, 0, cr, ct);
+		n -= uio_resid(uio);
+		uio_free(uio);
+		if (error != 0 || n == 0)
+			break;
+
+		uio = uio_create(1, doff + *copied, UIO_SYSSPACE, UIO_WRITE);
+		uio_addiov(uio, CAST_USER_ADDR_T(buf), n);
+		error = zfs_write(dvp, uio, 0, cr, ct);
+		*copied += n - uio_resid(uio);
+		uio_free(uio);
+		if (error != 0)
+			break;
+	}
+
+	kmem_free(buf, ZFS_COPY_RANGE_CHUNK);
+
+	/* A hole at the end of the range still has to extend the copy */
+	if (error == 0 && sparse && *copied > 0) {
+		ZFS_ENTER(zfsvfs);
+		ZFS_VERIFY_ZP(dzp);
+		if (dzp->z_size < doff + *copied)
+			error = zfs_freesp(dzp, doff + *copied, 0, 0, B_TRUE);
+		ZFS_EXIT(zfsvfs);
+	}
+
+	return (error);
+}
+
 int
 zfs_vnop_ioctl(struct vnop_ioctl_args *ap)
 #if 0
@@ -662,6 +806,96 @@ printf("F_CHKCLEAN size %llu ret %d\n", fsize, error);
 			break;
 
 
+		case FSIOC_FIOSEEKHOLE:
+		case FSCTL_FIOSEEKHOLE:
+		case FSIOC_FIOSEEKDATA:
+		case FSCTL_FIOSEEKDATA:
+			dprintf("%s SEEK_HOLE/SEEK_DATA\n", __func__);
+			error = zfs_holey(ap->a_vp,
+			    (IOCBASECMD(ap->a_command) == FSCTL_FIOSEEKHOLE),
+			    (off_t *)ap->a_data);
+			break;
+
+		case F_PUNCHHOLE:
+			dprintf("%s F_PUNCHHOLE\n", __func__);
+		    {
+				fpunchhole_t *fp = (fpunchhole_t *)ap->a_data;
+				uint64_t off, len;
+
+				if (!vnode_isreg(ap->a_vp)) {
+					error = EINVAL;
+					goto out;
+				}
+				if (fp->fp_offset < 0 || fp->fp_length < 0) {
+					error = EINVAL;
+					goto out;
+				}
+				off = fp->fp_offset;
+				len = fp->fp_length;
+
+				/*
+				 * Write back any dirty pages in the range and
+				 * drop them, so nothing maps the freed blocks.
+				 */
+				if (len > 0)
+					(void) ubc_msync(ap->a_vp, trunc_page_64(off),
+					    round_page_64(off + len), NULL,
+					    UBC_PUSHDIRTY | UBC_SYNC | UBC_INVALIDATE);
+
+				ZFS_ENTER(zfsvfs);
+				ZFS_VERIFY_ZP(zp);
+				if (zp->z_pflags &
+				    (ZFS_IMMUTABLE | ZFS_READONLY | ZFS_APPENDONLY)) {
+					error = EPERM;
+				} else if (len > 0 && off < zp->z_size) {
+					/* A punch never extends the file */
+					len = MIN(len, zp->z_size - off);
+					error = zfs_freesp(zp, off, len, FWRITE,
+					    B_TRUE);
+				}
+				ZFS_EXIT(zfsvfs);
+			}
+			break;
+
+		case ZFSIOC_COPY_RANGE:
+		case ZFS_COPY_RANGE:
+			dprintf("%s ZFS_COPY_RANGE\n", __func__);
+		    {
+				zfs_copy_range_t *zcr = (zfs_copy_range_t *)ap->a_data;
+				file_t *src_fp;
+				struct vnode *src_vp;
+
+				if (!(ap->a_fflag & FWRITE)) {
+					error = EBADF;
+					goto out;
+				}
+
+				src_fp = getf(zcr->zcr_src_fd);
+				if (src_fp == NULL) {
+					error = EBADF;
+					goto out;
+				}
+
+				src_vp = getf_vnode(src_fp);
+
+				if ( (error = vnode_getwithref(src_vp)) ) {
+					releasef(zcr->zcr_src_fd);
+					goto out;
+				}
+
+				/* Confirm it is inside our mount */
+				if (((zfsvfs_t *)vfs_fsprivate(vnode_mount((src_vp)))) != zfsvfs)
+					error = EXDEV;
+				else
+					error = zfs_copy_range(src_vp, zcr->zcr_src_off,
+					    ap->a_vp, zcr->zcr_dst_off, zcr->zcr_len,
+					    &zcr->zcr_copied, cr, ct);
+
+				vnode_put(src_vp);
+				releasef(zcr->zcr_src_fd);
+			}
+			break;
+
 		case F_MAKECOMPRESSED:
 			dprintf("%s F_MAKECOMPRESSED\n", __func__);
 			/*
@@ -2014,27 +2248,35 @@ zfs_vnop_pagein(struct vnop_pagein_args *ap)
 		len = newend;
 	}
 	/*
-	 * Fill pages with data from the file.
+	 * Fill pages with data from the file.  Read the whole range at
+	 * once, rather than a page at a time, so that each record is held
+	 * once and the zfetch stream sees the full size of the access.
 	 */
-	while (len > 0) {
-		uint64_t readlen;
+	dprintf("pagein from off 0x%llx into address %p (len 0x%lx)\n",
+			off, vaddr, len);
 
-		readlen = MIN(PAGESIZE, len);
+	error = zfs_sa_read_data(zp, off, len, (void *)vaddr,
+	    DMU_READ_PREFETCH);
+	if (error)
+		printf("zfs_vnop_pagein: dmu_read err %d\n", error);
+	ubc_upl_unmap(upl);
 
-		dprintf("pagein from off 0x%llx len 0x%llx into address %p (len 0x%lx)\n",
-				off, readlen, vaddr, len);
+	/*
+	 * Read ahead of the fault, in whole records.  The VM only hands us
+	 * the pages it wants now, and a run of small faults does not always
+	 * look sequential enough for zfetch to ramp up.
+	 */
+	if (error == 0 && zfs_vnop_pagein_readahead > 0 &&
+	    off + len < file_sz) {
+		uint64_t blksz = zp->z_blksz ? zp->z_blksz : PAGESIZE;
+		uint64_t rastart = roundup(off + len, blksz);
+		uint64_t raend = MIN(file_sz, roundup(off + len +
+		    zfs_vnop_pagein_readahead, blksz));
 
-		error = dmu_read(zp->z_zfsvfs->z_os, zp->z_id, off, readlen,
-		    (void *)vaddr, DMU_READ_PREFETCH);
-		if (error) {
-			printf("zfs_vnop_pagein: dmu_read err %d\n", error);
-			break;
-		}
-		off += readlen;
-		vaddr += readlen;
-		len -= readlen;
+		if (rastart < raend)
+			dmu_prefetch(zfsvfs->z_os, zp->z_id, 0, rastart,
+			    raend - rastart, ZIO_PRIORITY_ASYNC_READ);
 	}
-	ubc_upl_unmap(upl);
 
 	if (!(flags & UPL_NOCOMMIT)) {
 		if (error)
@@ -2201,39 +2443,15 @@ top:
 	}
 
 	va += upl_offset;
-	while (len >= PAGESIZE) {
-		ssize_t sz = PAGESIZE;
-
-		dprintf("pageout: dmu_write off 0x%llx size 0x%lx\n", off, sz);
-
-		dmu_write(zfsvfs->z_os, zp->z_id, off, sz, va, tx);
-		va += sz;
-		off += sz;
-		len -= sz;
-	}
 
 	/*
-	 * The last, possibly partial block needs to have the data zeroed that
-	 * would extend past the size of the file.
+	 * Push the whole range, including the last, possibly partial
+	 * page (len was clipped to the file size above), with a single
+	 * dmu_write() so that each record is dirtied once per pageout
+	 * rather than once per page.
 	 */
-	if (len > 0) {
-		ssize_t sz = len;
-
-		dprintf("pageout: dmu_writeX off 0x%llx size 0x%lx\n", off, sz);
-		dmu_write(zfsvfs->z_os, zp->z_id, off, sz, va, tx);
-
-		va += sz;
-		off += sz;
-		len -= sz;
-
-		/*
-		 * Zero out the remainder of the PAGE that didn't fit within
-		 * the file size.
-		 */
-		//bzero(va, PAGESIZE-sz);
-		//dprintf("zero last 0x%lx bytes.\n", PAGESIZE-sz);
-
-	}
+	dprintf("pageout: dmu_write off 0x%llx size 0x%lx\n", off, len);
+	dmu_write(zfsvfs->z_os, zp->z_id, off, len, va, tx);
 	ubc_upl_unmap(upl);
 
 	if (err == 0) {
@@ -2660,6 +2878,8 @@ zfs_vnop_pageoutv2(struct vnop_pageout_args *ap)
 		    &zp->z_pflags, 8);
 		zfs_tstamp_update_setup(zp, CONTENT_MODIFIED, mtime, ctime,
 		    B_TRUE);
+		error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
+		ASSERT0(error);
 		zfs_log_write(zfsvfs->z_log, tx, TX_WRITE, zp, ap->a_f_offset,
 					  a_size, 0,
 		    NULL, NULL);
@@ -2737,6 +2957,21 @@ zfs_vnop_mmap(struct vnop_mmap_args *ap)
 	zp->z_is_mapped = 1;
 	mutex_exit(&zp->z_lock);
 
+	/*
+	 * Mapped files keep their data in blocks (see zfs_inline_data_ok()),
+	 * where pageout writes it.
+	 */
+	if (zp->z_pflags & ZFS_INLINE_DATA) {
+		rl_t *rl = zfs_range_lock(zp, 0, UINT64_MAX, RL_WRITER);
+		int error = zfs_inline_promote(zp);
+
+		zfs_range_unlock(rl);
+		if (error) {
+			ZFS_EXIT(zfsvfs);
+			return (error);
+		}
+	}
+
 	ZFS_EXIT(zfsvfs);
 	dprintf("-vnop_mmap\n");
 	return (0);
@@ -2917,14 +3152,8 @@ zfs_vnop_reclaim(struct vnop_reclaim_args *ap)
 	 * calls zfs_znode_delete() directly.
 	 * zfs_zinactive() will leave earlier if z_reclaim_reentry is true.
 	 */
-	if (fastpath == B_FALSE) {
-		rw_enter(&zfsvfs->z_teardown_inactive_lock, RW_READER);
-		if (zp->z_sa_hdl == NULL)
-			zfs_znode_free(zp);
-		else
-			zfs_zinactive(zp);
-		rw_exit(&zfsvfs->z_teardown_inactive_lock);
-	}
+	if (fastpath == B_FALSE)
+		zfs_znode_reclaim(zp);
 
 	/* Direct zfs_remove? We are done */
 	if (fastpath == B_TRUE) goto out;
@@ -3088,6 +3317,214 @@ zfs_vnop_pathconf(struct vnop_pathconf_args *ap)
 	return (error);
 }
 
+/*
+ * Whether the hidden xattr directory of zp holds an entry name.  The ZAP
+ * is looked up directly, without instantiating the directory.
+ */
+static boolean_t
+zfs_xattr_dir_has(znode_t *zp, const char *name)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	uint64_t xattr, zoid;
+
+	if (sa_lookup(zp->z_sa_hdl, SA_ZPL_XATTR(zfsvfs), &xattr,
+	    sizeof (xattr)) != 0 || xattr == 0)
+		return (B_FALSE);
+
+	return (zap_lookup(zfsvfs->z_os, xattr, name, 8, 1, &zoid) == 0);
+}
+
+/*
+ * Drop the SA xattr name of zp, if it has one.
+ */
+static void
+zfs_xattr_sa_remove(znode_t *zp, const char *name)
+{
+	ASSERT(RW_WRITE_HELD(&zp->z_xattr_lock));
+
+	if (zp->z_xattr_cached != NULL &&
+	    nvlist_remove(zp->z_xattr_cached, name, DATA_TYPE_BYTE_ARRAY) == 0)
+		(void) zfs_sa_set_xattr(zp);
+}
+
+/*
+ * Move the SA xattr name of zp into a file in its hidden xattr directory,
+ * for a resource fork that is about to be written in pieces or opened as
+ * a named stream, neither of which the SA can serve.
+ */
+static int
+zfs_xattr_sa_to_dir(znode_t *zp, const char *name, cred_t *cr,
+    vfs_context_t ctx)
+{
+	struct vnode *xdvp = NULLVP;
+	struct vnode *xvp = NULLVP;
+	struct uio *auio;
+	uchar_t *nv_value;
+	uint_t nv_size;
+	char *value;
+	int error;
+
+	rw_enter(&zp->z_xattr_lock, RW_READER);
+	if (zp->z_xattr_cached == NULL ||
+	    nvlist_lookup_byte_array(zp->z_xattr_cached, name, &nv_value,
+	    &nv_size) != 0) {
+		rw_exit(&zp->z_xattr_lock);
+		return (0);
+	}
+	value = kmem_alloc(MAX(nv_size, 1), KM_SLEEP);
+	bcopy(nv_value, value, nv_size);
+	rw_exit(&zp->z_xattr_lock);
+
+	if ((error = zfs_get_xattrdir(zp, &xdvp, cr, CREATE_XATTR_DIR)) != 0)
+		goto out;
+
+	error = zfs_obtain_xattr(VTOZ(xdvp), name, zp->z_mode, cr, &xvp, 0);
+	if (error == 0)
+		error = zfs_freesp(VTOZ(xvp), 0, 0, zp->z_mode, TRUE);
+	if (error == 0 && nv_size != 0) {
+		auio = uio_create(1, 0, UIO_SYSSPACE, UIO_WRITE);
+		uio_addiov(auio, CAST_USER_ADDR_T(value), nv_size);
+		error = VNOP_WRITE(xvp, auio, 0, ctx);
+		uio_free(auio);
+	}
+
+	if (error == 0) {
+		rw_enter(&zp->z_xattr_lock, RW_WRITER);
+		zfs_xattr_sa_remove(zp, name);
+		rw_exit(&zp->z_xattr_lock);
+	}
+
+out:
+	kmem_free(value, MAX(nv_size, 1));
+	if (xvp)
+		vnode_put(xvp);
+	if (xdvp)
+		vnode_put(xdvp);
+	return (error);
+}
+
+/*
+ * Read the SA xattr name of zp into uio, from the offset of uio so that a
+ * resource fork can be read in pieces, or return its size in sizep when
+ * uio is NULL.  Returns ENOATTR when zp has no SA xattr of that name.
+ */
+static int
+zfs_xattr_sa_read(znode_t *zp, const char *name, struct uio *uio,
+    size_t *sizep)
+{
+	uint8_t finderinfo[32];
+	uchar_t *nv_value;
+	uint_t nv_size;
+	uint64_t offset;
+
+	ASSERT(RW_LOCK_HELD(&zp->z_xattr_lock));
+
+	if (zp->z_xattr_cached == NULL ||
+	    nvlist_lookup_byte_array(zp->z_xattr_cached, name, &nv_value,
+	    &nv_size) != 0)
+		return (ENOATTR);
+
+	if (uio == NULL) {
+		*sizep = nv_size;
+		return (0);
+	}
+
+	if (bcmp(name, XATTR_RESOURCEFORK_NAME,
+	    sizeof (XATTR_RESOURCEFORK_NAME)) == 0) {
+		offset = uio_offset(uio);
+		if (offset >= nv_size)
+			return (0);
+		return (uiomove((const char *)nv_value + offset,
+		    MIN(nv_size - offset, uio_resid(uio)), UIO_READ, uio));
+	}
+
+	if (uio_resid(uio) < nv_size)
+		return (ERANGE);
+
+	/* Report the real date added in FinderInfo, as the directory does */
+	if (nv_size == sizeof (finderinfo) && bcmp(name,
+	    XATTR_FINDERINFO_NAME, sizeof (XATTR_FINDERINFO_NAME)) == 0) {
+		bcopy(nv_value, finderinfo, sizeof (finderinfo));
+		finderinfo_update(finderinfo, zp);
+		return (uiomove((const char *)finderinfo, sizeof (finderinfo),
+		    UIO_READ, uio));
+	}
+
+	return (uiomove((const char *)nv_value, nv_size, UIO_READ, uio));
+}
+
+/*
+ * Store uio as the SA xattr name of zp.  Each xattr lives in exactly one
+ * of the SA and the hidden xattr directory, so ENOTSUP is returned, with
+ * any SA copy moved or dropped, when it belongs in the directory instead:
+ * it is already there, it is too large for the SA, or it is a resource
+ * fork too large or not written in one piece.
+ */
+static int
+zfs_xattr_sa_write(znode_t *zp, const char *name, struct uio *uio,
+    int flag, cred_t *cr, vfs_context_t ctx)
+{
+	struct vnode *vp = ZTOV(zp);
+	boolean_t rsrc, exists;
+	uchar_t *nv_value;
+	uint_t nv_size;
+	uint64_t size = uio_resid(uio);
+	size_t bytes;
+	char *value;
+	int error;
+
+	rsrc = (bcmp(name, XATTR_RESOURCEFORK_NAME,
+	    sizeof (XATTR_RESOURCEFORK_NAME)) == 0);
+
+	if (rsrc && uio_offset(uio) != 0) {
+		error = zfs_xattr_sa_to_dir(zp, name, cr, ctx);
+		return (error ? error : ENOTSUP);
+	}
+
+	rw_enter(&zp->z_xattr_lock, RW_WRITER);
+
+	exists = (zp->z_xattr_cached != NULL &&
+	    nvlist_lookup_byte_array(zp->z_xattr_cached, name, &nv_value,
+	    &nv_size) == 0);
+
+	if (!exists && zfs_xattr_dir_has(zp, name)) {
+		error = ENOTSUP;
+		goto out;
+	}
+
+	if ((flag & ZNEW) && exists) {
+		error = EEXIST;
+		goto out;
+	}
+
+	if ((flag & ZEXISTS) && !exists) {
+		error = ENOATTR;
+		goto out;
+	}
+
+	if (size > DXATTR_MAX_ENTRY_SIZE ||
+	    (rsrc && size > zfs_xattr_sa_rsrc_max)) {
+		zfs_xattr_sa_remove(zp, name);
+		error = ENOTSUP;
+		goto out;
+	}
+
+	value = kmem_alloc(MAX(size, 1), KM_SLEEP);
+	error = uiocopy((const char *)value, size, UIO_WRITE, uio, &bytes);
+	if (error == 0)
+		error = -zpl_xattr_set_sa(vp, name, value, bytes, flag, cr);
+	kmem_free(value, MAX(size, 1));
+
+	if (error == EFBIG) {
+		zfs_xattr_sa_remove(zp, name);
+		error = ENOTSUP;
+	}
+
+out:
+	rw_exit(&zp->z_xattr_lock);
+	return (error);
+}
+
 int
 zfs_vnop_getxattr(struct vnop_getxattr_args *ap)
 #if 0
@@ -3111,6 +3548,7 @@ zfs_vnop_getxattr(struct vnop_getxattr_args *ap)
 	struct uio *uio = ap->a_uio;
 	pathname_t cn = { 0 };
 	int  error = 0;
+	uint64_t xattr;
 	struct uio *finderinfo_uio = NULL;
 
 	/* dprintf("+getxattr vp %p\n", ap->a_vp); */
@@ -3143,39 +3581,19 @@ zfs_vnop_getxattr(struct vnop_getxattr_args *ap)
 	rw_exit(&zp->z_xattr_lock);
 
 	if (zfsvfs->z_use_sa && zp->z_is_sa) {
-		uint64_t size = uio_resid(uio);
-		char *value;
-
-		if (!size) { /* Lookup size */
-
-			rw_enter(&zp->z_xattr_lock, RW_READER);
-			error = zpl_xattr_get_sa(vp, ap->a_name, NULL, 0);
-			rw_exit(&zp->z_xattr_lock);
-			if (error > 0) {
-				dprintf("ZFS: returning XATTR size %d\n", error);
-				*ap->a_size = error;
-				error = 0;
-				goto out;
-			}
-		}
-
-		value = kmem_alloc(size, KM_SLEEP);
-		if (value) {
-			rw_enter(&zp->z_xattr_lock, RW_READER);
-			error = zpl_xattr_get_sa(vp, ap->a_name, value, size);
-			rw_exit(&zp->z_xattr_lock);
-
-			//dprintf("ZFS: SA XATTR said %d\n", error);
+		rw_enter(&zp->z_xattr_lock, RW_READER);
+		error = zfs_xattr_sa_read(zp, ap->a_name, uio, ap->a_size);
+		rw_exit(&zp->z_xattr_lock);
 
-			if (error > 0) {
-				uiomove((const char*)value, error, 0, uio);
-				error = 0;
-			}
-			kmem_free(value, size);
+		if (error != ENOATTR)
+			goto out;
+	}
 
-			if (error != -ENOENT)
-				goto out;
-		}
+	/* Without an xattr directory, there is nothing more to find */
+	if (sa_lookup(zp->z_sa_hdl, SA_ZPL_XATTR(zfsvfs), &xattr,
+	    sizeof (xattr)) != 0 || xattr == 0) {
+		error = ENOATTR;
+		goto out;
 	}
 
 
@@ -3324,50 +3742,12 @@ zfs_vnop_setxattr(struct vnop_setxattr_args *ap)
 
 	/* Preferentially store the xattr as a SA for better performance */
 	if (zfsvfs->z_use_sa && zfsvfs->z_xattr_sa && zp->z_is_sa) {
-		char *value;
-		uint64_t size;
-
-		rw_enter(&zp->z_xattr_lock, RW_WRITER);
-
-		/* New, expect it to not exist .. */
-		if ((flag & ZNEW) &&
-			(zpl_xattr_get_sa(vp, ap->a_name, NULL, 0) > 0)) {
-			error = EEXIST;
-			rw_exit(&zp->z_xattr_lock);
+		error = zfs_xattr_sa_write(zp, ap->a_name, uio, flag, cr,
+		    ap->a_context);
+		if (error != ENOTSUP)
 			goto out;
-		}
-
-		/* Replace, XATTR must exist .. */
-		if ((flag & ZEXISTS) &&
-			((error = zpl_xattr_get_sa(vp, ap->a_name, NULL, 0)) <= 0) &&
-			error == -ENOENT) {
-			error = ENOATTR;
-			rw_exit(&zp->z_xattr_lock);
-			goto out;
-		}
-
-		size = uio_resid(uio);
-		value = kmem_alloc(size, KM_SLEEP);
-		if (value) {
-			size_t bytes;
-
-			/* Copy in the xattr value */
-			uiocopy((const char *)value, size, UIO_WRITE,
-					uio, &bytes);
-
-			error = zpl_xattr_set_sa(vp, ap->a_name,
-									 value, bytes,
-									 flag, cr);
-			kmem_free(value, size);
-
-			if (error == 0) {
-				rw_exit(&zp->z_xattr_lock);
-				goto out;
-			}
-		}
-		dprintf("ZFS: zpl_xattr_set_sa failed %d\n", error);
-
-		rw_exit(&zp->z_xattr_lock);
+		dprintf("ZFS: setxattr '%s' goes to the xattr dir\n",
+		    ap->a_name);
 	}
 
 	/* Grab the hidden attribute directory vnode. */
@@ -3381,9 +3761,13 @@ zfs_vnop_setxattr(struct vnop_setxattr_args *ap)
 	if (error)
 		goto out;
 
-	/* Write the attribute data. */
+	/*
+	 * Write the attribute data.  A resource fork may be written in
+	 * pieces, so only the first one replaces the old contents.
+	 */
 	ASSERT(uio != NULL);
-	error = zfs_freesp(VTOZ(xvp), 0, 0, VTOZ(vp)->z_mode, TRUE);
+	if (uio_offset(uio) == 0)
+		error = zfs_freesp(VTOZ(xvp), 0, 0, VTOZ(vp)->z_mode, TRUE);
 
     /*
 	 * TODO:
@@ -3522,9 +3906,7 @@ zfs_vnop_listxattr(struct vnop_listxattr_args *ap)
 	};
 #endif
 {
-	DECLARE_CRED(ap);
 	struct vnode *vp = ap->a_vp;
-	struct vnode *xdvp = NULLVP;
 	znode_t  *zp = VTOZ(vp);
 	zfsvfs_t  *zfsvfs = zp->z_zfsvfs;
 	struct uio *uio = ap->a_uio;
@@ -3593,13 +3975,13 @@ zfs_vnop_listxattr(struct vnop_listxattr_args *ap)
 		goto out;  /* all done */
 	}
 
-	/* Grab the hidden attribute directory vnode. */
-	if (zfs_get_xattrdir(zp, &xdvp, cr, 0) != 0) {
-		goto out;
-	}
+	/*
+	 * Walk the ZAP of the hidden attribute directory without
+	 * instantiating its znode and vnode.
+	 */
 	os = zfsvfs->z_os;
 
-	for (zap_cursor_init(&zc, os, VTOZ(xdvp)->z_id);
+	for (zap_cursor_init(&zc, os, xattr);
 	    zap_cursor_retrieve(&zc, &za) == 0; zap_cursor_advance(&zc)) {
 		if (xattr_protected(za.za_name))
 			continue;	 /* skip */
@@ -3642,9 +4024,6 @@ out:
 	if (uio == NULL) {
 		*ap->a_size = size;
 	}
-	if (xdvp) {
-		vnode_put(xdvp);
-	}
 
 	ZFS_EXIT(zfsvfs);
 	if (error) {
@@ -3687,6 +4066,13 @@ zfs_vnop_getnamedstream(struct vnop_getnamedstream_args *ap)
 	    sizeof (XATTR_RESOURCEFORK_NAME)) != 0)
 		goto out;
 
+	/* A stream is a file, so a fork kept in the SA moves out first */
+	if (zfsvfs->z_use_sa && zp->z_is_sa &&
+	    (error = zfs_xattr_sa_to_dir(zp, ap->a_name, cr,
+	    ap->a_context)) != 0)
+		goto out;
+	error = ENOATTR;
+
 	/* Grab the hidden attribute directory vnode. */
 	if (zfs_get_xattrdir(zp, &xdvp, cr, 0) != 0)
 		goto out;
@@ -3769,6 +4155,12 @@ zfs_vnop_makenamedstream(struct vnop_makenamedstream_args *ap)
 		goto out;
 	}
 
+	/* A stream is a file, so a fork kept in the SA moves out first */
+	if (zfsvfs->z_use_sa && zp->z_is_sa &&
+	    (error = zfs_xattr_sa_to_dir(zp, ap->a_name, cr,
+	    ap->a_context)) != 0)
+		goto out;
+
 	/* Grab the hidden attribute directory vnode. */
 	if ((error = zfs_get_xattrdir(zp, &xdvp, cr, CREATE_XATTR_DIR)))
 		goto out;
@@ -4179,7 +4571,8 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 
 		/* Grab znode if required */
 		if (prefetch) {
-			dmu_prefetch(zfsvfs->z_os, objnum, 0, 0);
+			dmu_prefetch(zfsvfs->z_os, objnum, 0, 0, 0,
+			    ZIO_PRIORITY_SYNC_READ);
 			if ((error = zfs_zget(zfsvfs, objnum, &tmp_zp)) == 0) {
 				if (vtype == VNON) {
 					/* SA_LOOKUP? */
@@ -4286,6 +4679,213 @@ update:
 #endif
 
 
+#ifdef WITH_GETATTRLISTBULK
+/*
+ * getattrlistbulk(2) without a vnode per entry: the attributes of entries
+ * whose znodes are not in core are packed straight from their SA bonus
+ * buffers.  Requests we cannot pack this way return ENOTSUP, and xnu
+ * emulates them with vnop_readdir and vnop_getattr.
+ */
+int
+zfs_vnop_getattrlistbulk(struct vnop_getattrlistbulk_args *ap)
+#if 0
+	struct vnop_getattrlistbulk_args {
+		struct vnodeop_desc *a_desc;
+		vnode_t		a_vp;
+		struct attrlist	*a_alist;
+		struct vnode_attr *a_vap;
+		struct uio	*a_uio;
+		void		*a_private;
+		uint64_t	a_options;
+		int32_t		*a_eofflag;
+		int32_t		*a_actualcount;
+		vfs_context_t	a_context;
+	};
+#endif
+{
+	struct vnode *vp = ap->a_vp;
+	struct attrlist *alp = ap->a_alist;
+	struct uio *uio = ap->a_uio;
+	vfs_context_t ctx = ap->a_context;
+	znode_t *zp = VTOZ(vp);
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	objset_t *os;
+	zap_cursor_t zc;
+	zap_attribute_t *za;
+	zfs_bulkattr_t *zba;
+	struct attrlist entattr;
+	attrinfo_t attrinfo;
+	uint64_t offset = (uint64_t)uio_offset(uio);
+	u_int32_t maxsize;
+	u_int32_t attrbufsize;
+	void *attrbufptr;
+	void *attrptr;
+	void *varptr;  /* variable-length storage area */
+	boolean_t user64 = vfs_context_is64bit(ctx);
+	int numdirent = 0;
+	int error = 0;
+
+	*(ap->a_actualcount) = 0;
+	*(ap->a_eofflag) = 0;
+
+	if ((ap->a_options & FSOPT_PACK_INVAL_ATTRS) ||
+	    (alp->commonattr & ~ZFS_ATTR_BULK_CMN_VALID) ||
+	    (alp->dirattr & ~ZFS_ATTR_DIR_VALID) ||
+	    (alp->fileattr & ~ZFS_ATTR_FILE_VALID) ||
+	    (alp->volattr != 0 || alp->forkattr != 0))
+		return (ENOTSUP);
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+	os = zfsvfs->z_os;
+
+	/* .zfs is not a znode, so leave it to the emulation */
+	if (zfs_show_ctldir(zp)) {
+		ZFS_EXIT(zfsvfs);
+		return (ENOTSUP);
+	}
+
+	/*
+	 * Room for the largest entry: the fixed attributes, a name that
+	 * may grow when decomposed, and the padding to 8 bytes.
+	 */
+	maxsize = sizeof (u_int32_t) + getpackedsize(alp, user64) + 8;
+	if (alp->commonattr & ATTR_CMN_NAME)
+		maxsize += 3 * ZAP_MAXNAMELEN + 1;
+	attrbufptr = kmem_alloc(maxsize, KM_SLEEP);
+	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+	zba = kmem_alloc(sizeof (zfs_bulkattr_t), KM_SLEEP);
+
+	/*
+	 * Offsets up to 3 are '.', '..' and '.zfs', which are not
+	 * returned; anything else is a serialized cursor.
+	 */
+	if (offset <= 3)
+		zap_cursor_init(&zc, os, zp->z_id);
+	else
+		zap_cursor_init_serialized(&zc, os, zp->z_id, offset);
+
+	if (zfs_readdir_dnode_prefetch > 0)
+		zfs_dirent_prefetch(zp, offset <= 3 ? 0 : offset,
+		    zfs_readdir_dnode_prefetch);
+
+	while (1) {
+		znode_t *ezp;
+		sa_handle_t *hdl;
+		dmu_buf_t *db;
+		uint64_t objnum;
+
+		if ((error = zap_cursor_retrieve(&zc, za))) {
+			*(ap->a_eofflag) = (error == ENOENT);
+			break;
+		}
+		if (za->za_integer_length != 8 || za->za_num_integers != 1) {
+			error = SET_ERROR(ENXIO);
+			break;
+		}
+		objnum = ZFS_DIRENT_OBJ(za->za_first_integer);
+
+		/*
+		 * A znode in core may have attributes newer than its SA,
+		 * so use it; otherwise read the bonus buffer directly,
+		 * unless the answer turns out to need a znode after all.
+		 */
+		if ((error = dmu_bonus_hold(os, objnum, NULL, &db))) {
+			/* Removed since we read the entry */
+			if (error == ENOENT)
+				goto next;
+			break;
+		}
+		if (dmu_buf_get_user(db) == NULL) {
+			error = sa_handle_get_from_db(os, db, NULL,
+			    SA_HDL_PRIVATE, &hdl);
+			if (error) {
+				dmu_buf_rele(db, NULL);
+				break;
+			}
+			error = zfs_bulkattr_get(zfsvfs, hdl, NULL, alp, ctx,
+			    zba);
+			sa_handle_destroy(hdl);
+		} else {
+			dmu_buf_rele(db, NULL);
+			error = EAGAIN;
+		}
+		if (error == EAGAIN &&
+		    (error = zfs_zget(zfsvfs, objnum, &ezp)) == 0) {
+			error = zfs_bulkattr_get(zfsvfs, ezp->z_sa_hdl, ezp,
+			    alp, ctx, zba);
+			vnode_put(ZTOV(ezp));
+		}
+		if (error == ENOENT)
+			goto next;
+		if (error)
+			break;
+
+		/*
+		 * Directories return no file attributes and everything
+		 * else no directory attributes.
+		 */
+		entattr = *alp;
+		if (S_ISDIR(zba->zba_mode))
+			entattr.fileattr = 0;
+		else
+			entattr.dirattr = 0;
+
+		bzero(attrbufptr, maxsize);
+		attrptr = ((u_int32_t *)attrbufptr) + 1; /* after byte count */
+		varptr = (char *)attrbufptr + sizeof (u_int32_t) +
+		    getpackedsize(&entattr, user64);
+		attrinfo.ai_attrlist = &entattr;
+		attrinfo.ai_attrbufpp = &attrptr;
+		attrinfo.ai_varbufpp = &varptr;
+		attrinfo.ai_varbufend = (char *)attrbufptr + maxsize - 8;
+		attrinfo.ai_context = ctx;
+
+		bulkattrpack(&attrinfo, zfsvfs, zba, za->za_name, objnum,
+		    user64);
+		attrbufsize = roundup((char *)varptr - (char *)attrbufptr, 8);
+
+		/*
+		 * Make sure there's enough buffer space remaining; the
+		 * entry is returned by the next call otherwise, unless
+		 * not even one entry fits.
+		 */
+		if (uio_resid(uio) < 0 ||
+		    attrbufsize > (u_int32_t)uio_resid(uio)) {
+			if (*(ap->a_actualcount) == 0)
+				error = SET_ERROR(ERANGE);
+			break;
+		}
+		*((u_int32_t *)attrbufptr) = attrbufsize;
+		if ((error = uiomove((caddr_t)attrbufptr, attrbufsize,
+		    UIO_READ, uio)))
+			break;
+		*(ap->a_actualcount) += 1;
+
+next:
+		zap_cursor_advance(&zc);
+		offset = zap_cursor_serialize(&zc);
+		if (zfs_readdir_dnode_prefetch > 0 &&
+		    ++numdirent % zfs_readdir_dnode_prefetch == 0)
+			zfs_dirent_prefetch(zp, offset,
+			    zfs_readdir_dnode_prefetch);
+	}
+	zap_cursor_fini(&zc);
+
+	kmem_free(zba, sizeof (zfs_bulkattr_t));
+	kmem_free(za, sizeof (zap_attribute_t));
+	kmem_free(attrbufptr, maxsize);
+
+	if (error == ENOENT)
+		error = 0;
+	ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
+	uio_setoffset(uio, offset);
+
+	ZFS_EXIT(zfsvfs);
+	return (error);
+}
+#endif
+
 #ifdef WITH_SEARCHFS
 int
 zfs_vnop_searchfs(struct vnop_searchfs_args *ap)
@@ -4380,6 +4980,9 @@ struct vnodeopv_entry_desc zfs_dvnodeops_template[] = {
 #ifdef WITH_READDIRATTR
 	{&vnop_readdirattr_desc, (VOPFUNC)zfs_vnop_readdirattr},
 #endif
+#ifdef WITH_GETATTRLISTBULK
+	{&vnop_getattrlistbulk_desc, (VOPFUNC)zfs_vnop_getattrlistbulk},
+#endif
 #ifdef WITH_SEARCHFS
 	{&vnop_searchfs_desc,	(VOPFUNC)zfs_vnop_searchfs},
 #endif
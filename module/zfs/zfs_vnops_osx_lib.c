@@ -260,6 +260,7 @@ zfs_getattr_znode_unlocked(struct vnode *vp, vattr_t *vap)
 			   error, parent, zp->z_pflags );
 		mutex_exit(&zp->z_lock);
 		ZFS_EXIT(zfsvfs);
+		return (error);
 	}
 
 #ifdef VNODE_ATTR_va_addedtime
@@ -622,11 +623,13 @@ zfs_vnop_ioctl_fullfsync(struct vnode *vp, vfs_context_t ct, zfsvfs_t *zfsvfs)
 	return (0);
 }
 
+/*
+ * Translate ZFS pflags to chflags(2) flags.
+ */
 uint32_t
-zfs_getbsdflags(znode_t *zp)
+zfs_pflags_to_bsdflags(uint64_t zflags)
 {
 	uint32_t  bsdflags = 0;
-    uint64_t zflags=zp->z_pflags;
 
 	if (zflags & ZFS_NODUMP)
 		bsdflags |= UF_NODUMP;
@@ -652,6 +655,12 @@ zfs_getbsdflags(znode_t *zp)
 	return (bsdflags);
 }
 
+uint32_t
+zfs_getbsdflags(znode_t *zp)
+{
+	return (zfs_pflags_to_bsdflags(zp->z_pflags));
+}
+
 void
 zfs_setbsdflags(znode_t *zp, uint32_t bsdflags)
 {
@@ -1405,6 +1414,10 @@ int getpackedsize(struct attrlist *alp, boolean_t user64)
         sizeof(timespec_user32_t);
 
 	if ((attrs = alp->commonattr) != 0) {
+		if (attrs & ATTR_CMN_RETURNED_ATTRS)
+			size += sizeof(attribute_set_t);
+		if (attrs & ATTR_CMN_ERROR)
+			size += sizeof(u_int32_t);
 		if (attrs & ATTR_CMN_NAME)
 			size += sizeof(struct attrreference);
 		if (attrs & ATTR_CMN_DEVID)
@@ -1458,7 +1471,6 @@ int getpackedsize(struct attrlist *alp, boolean_t user64)
 		 * ATTR_CMN_GRPUUID
 		 * ATTR_CMN_FULLPATH
 		 * ATTR_CMN_ADDEDTIME
-		 * ATTR_CMN_ERROR
 		 * ATTR_CMN_DATA_PROTECT_FLAGS
 		 */
 	}
@@ -1565,6 +1577,31 @@ nodata:
 
 #define KAUTH_FILE_EXECUTE  (KAUTH_VNODE_ACCESS | KAUTH_VNODE_EXECUTE)
 
+/*
+ * The user access of an object without an ACL, from its owner and mode.
+ */
+static u_int32_t
+getuseraccess_mode(uint64_t obj_uid, uint64_t obj_mode, vfs_context_t ctx)
+{
+	kauth_cred_t	cred = vfs_context_ucred(ctx);
+
+	/* User id 0 (root) always gets access. */
+	if (!vfs_context_suser(ctx)) {
+		return (R_OK | W_OK | X_OK);
+	}
+
+	obj_mode = obj_mode & MODEMASK;
+	if (obj_uid == UNKNOWNUID) {
+		obj_uid = kauth_cred_getuid(cred);
+	}
+	if ((obj_uid == kauth_cred_getuid(cred)) ||
+	    (obj_uid == UNKNOWNUID)) {
+		return (((u_int32_t)obj_mode & S_IRWXU) >> 6);
+	}
+	/* Otherwise, settle for 'others' access. */
+	return ((u_int32_t)obj_mode & S_IRWXO);
+}
+
 /*
  * Compute the same user access value as getattrlist(2)
  */
@@ -1580,31 +1617,15 @@ u_int32_t getuseraccess(znode_t *zp, vfs_context_t ctx)
                       &acl_phys, sizeof (acl_phys));
 
 	if (error || acl_phys.z_acl_count == 0) {
-		kauth_cred_t	cred = vfs_context_ucred(ctx);
 		uint64_t		obj_uid;
 		uint64_t    	obj_mode;
 
-		/* User id 0 (root) always gets access. */
-		if (!vfs_context_suser(ctx)) {
-			return (R_OK | W_OK | X_OK);
-		}
-
         sa_lookup(zp->z_sa_hdl, SA_ZPL_UID(zp->z_zfsvfs),
                   &obj_uid, sizeof (obj_uid));
         sa_lookup(zp->z_sa_hdl, SA_ZPL_MODE(zp->z_zfsvfs),
                   &obj_mode, sizeof (obj_mode));
 
-		//obj_uid = pzp->zp_uid;
-		obj_mode = obj_mode & MODEMASK;
-		if (obj_uid == UNKNOWNUID) {
-			obj_uid = kauth_cred_getuid(cred);
-		}
-		if ((obj_uid == kauth_cred_getuid(cred)) ||
-		    (obj_uid == UNKNOWNUID)) {
-			return (((u_int32_t)obj_mode & S_IRWXU) >> 6);
-		}
-		/* Otherwise, settle for 'others' access. */
-		return ((u_int32_t)obj_mode & S_IRWXO);
+		return (getuseraccess_mode(obj_uid, obj_mode, ctx));
 	}
 	vp = ZTOV(zp);
 	if (vnode_isdir(vp)) {
@@ -1627,6 +1648,360 @@ u_int32_t getuseraccess(znode_t *zp, vfs_context_t ctx)
 
 
 
+/*
+ * Look up "name" in the hidden xattr directory xattr, without creating a
+ * znode for either.
+ */
+static int
+bulkattr_xattr_obj(objset_t *os, uint64_t xattr, const char *name,
+    uint64_t *objp)
+{
+	uint64_t ent;
+	int error;
+
+	error = zap_lookup(os, xattr, name, 8, 1, &ent);
+	if (error == 0)
+		*objp = ZFS_DIRENT_OBJ(ent);
+	return (error);
+}
+
+/*
+ * Gather the attributes in alp for getattrlistbulk(2) from the SA handle
+ * hdl.  zp is the object's znode when it is in core and NULL otherwise;
+ * EAGAIN means the answer needs a znode, and the caller retries with one.
+ * Finder Info and the resource fork are read from the hidden xattr
+ * directory, as commonattrpack() and fileattrpack() do.
+ */
+int
+zfs_bulkattr_get(zfsvfs_t *zfsvfs, sa_handle_t *hdl, znode_t *zp,
+    struct attrlist *alp, vfs_context_t ctx, zfs_bulkattr_t *zba)
+{
+	objset_t *os = zfsvfs->z_os;
+	sa_bulk_attr_t bulk[11];
+	uint64_t obj;
+	int count = 0;
+	int error;
+
+	bzero(zba, sizeof (zfs_bulkattr_t));
+
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_MODE(zfsvfs), NULL,
+	    &zba->zba_mode, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_SIZE(zfsvfs), NULL,
+	    &zba->zba_size, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_LINKS(zfsvfs), NULL,
+	    &zba->zba_links, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_PARENT(zfsvfs), NULL,
+	    &zba->zba_parent, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_UID(zfsvfs), NULL,
+	    &zba->zba_uid, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_GID(zfsvfs), NULL,
+	    &zba->zba_gid, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_FLAGS(zfsvfs), NULL,
+	    &zba->zba_pflags, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_CRTIME(zfsvfs), NULL,
+	    zba->zba_crtime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_MTIME(zfsvfs), NULL,
+	    zba->zba_mtime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_CTIME(zfsvfs), NULL,
+	    zba->zba_ctime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_ATIME(zfsvfs), NULL,
+	    zba->zba_atime, 16);
+	if ((error = sa_bulk_lookup(hdl, bulk, count)) != 0)
+		return (error);
+
+	/* Optional, so not part of the bulk lookup */
+	(void) sa_lookup(hdl, SA_ZPL_XATTR(zfsvfs), &zba->zba_xattr, 8);
+	if (S_ISBLK(zba->zba_mode) || S_ISCHR(zba->zba_mode))
+		(void) sa_lookup(hdl, SA_ZPL_RDEV(zfsvfs), &zba->zba_rdev, 8);
+	sa_object_size(hdl, &zba->zba_blksz, &zba->zba_nblks);
+
+	if (zp == NULL) {
+		zfs_acl_phys_t acl_phys;
+
+		/* Only the znode knows which link a hard link was found by */
+		if (S_ISREG(zba->zba_mode) && zba->zba_links > 1)
+			return (SET_ERROR(EAGAIN));
+
+		if (ATTR_CMN_USERACCESS & alp->commonattr) {
+			/* An ACL needs vnode_authorize(), so a vnode */
+			if (sa_lookup(hdl, SA_ZPL_ZNODE_ACL(zfsvfs), &acl_phys,
+			    sizeof (acl_phys)) == 0 &&
+			    acl_phys.z_acl_count != 0)
+				return (SET_ERROR(EAGAIN));
+			zba->zba_useraccess = getuseraccess_mode(zba->zba_uid,
+			    zba->zba_mode, ctx);
+		}
+	} else {
+		vnode_t *vp = ZTOV(zp);
+
+		/* The cached atime may not have reached the SA yet */
+		zba->zba_atime[0] = zp->z_atime[0];
+		zba->zba_atime[1] = zp->z_atime[1];
+
+		/* Hard links: report the cached parentid, as getattr does */
+		if (((S_ISREG(zba->zba_mode) && zba->zba_links > 1) ||
+		    zp->z_finder_hardlink == TRUE) && zp->z_finder_parentid)
+			zba->zba_parent = zp->z_finder_parentid;
+
+		if (ATTR_CMN_USERACCESS & alp->commonattr)
+			zba->zba_useraccess = getuseraccess(zp, ctx);
+
+		if (vp != NULL && vnode_isdir(vp) &&
+		    vnode_mountedhere(vp) != NULL)
+			zba->zba_mntstatus = DIR_MNTSTATUS_MNTPOINT;
+	}
+
+	if (ATTR_CMN_USERACCESS & alp->commonattr) {
+		/* Also consider READ-ONLY file system. */
+		if (vfs_flags(zfsvfs->z_vfs) & MNT_RDONLY)
+			zba->zba_useraccess &= ~W_OK;
+
+		/* Locked objects are not writable either */
+		if ((zba->zba_pflags & ZFS_IMMUTABLE) &&
+		    (vfs_context_suser(ctx) != 0))
+			zba->zba_useraccess &= ~W_OK;
+	}
+
+	if ((ATTR_CMN_FNDRINFO & alp->commonattr) && zba->zba_xattr != 0 &&
+	    bulkattr_xattr_obj(os, zba->zba_xattr, XATTR_FINDERINFO_NAME,
+	    &obj) == 0 &&
+	    dmu_read(os, obj, 0, sizeof (finderinfo_t), &zba->zba_finderinfo,
+	    DMU_READ_PREFETCH) != 0)
+		bzero(&zba->zba_finderinfo, sizeof (finderinfo_t));
+	/* Shadow ZFS_HIDDEN to Finder Info's invisible bit */
+	if (zba->zba_pflags & ZFS_HIDDEN)
+		zba->zba_finderinfo.fi_flags |=
+		    OSSwapHostToBigConstInt16(kIsInvisible);
+
+	if (((ATTR_FILE_RSRCLENGTH | ATTR_FILE_RSRCALLOCSIZE) &
+	    alp->fileattr) && zba->zba_xattr != 0 &&
+	    bulkattr_xattr_obj(os, zba->zba_xattr, XATTR_RESOURCEFORK_NAME,
+	    &obj) == 0) {
+		sa_handle_t *rhdl;
+
+		if (sa_handle_get(os, obj, NULL, SA_HDL_PRIVATE, &rhdl) == 0) {
+			(void) sa_lookup(rhdl, SA_ZPL_SIZE(zfsvfs),
+			    &zba->zba_rsrcsize, 8);
+			sa_handle_destroy(rhdl);
+		}
+	}
+
+	return (0);
+}
+
+static void *
+bulkattr_timepack(void *attrbufptr, const uint64_t times[2],
+    boolean_t user64)
+{
+	if (user64) {
+		ZFS_TIME_DECODE((timespec_user64_t *)attrbufptr, times);
+		return (((timespec_user64_t *)attrbufptr) + 1);
+	}
+	ZFS_TIME_DECODE((timespec_user32_t *)attrbufptr, times);
+	return (((timespec_user32_t *)attrbufptr) + 1);
+}
+
+/*
+ * Pack one getattrlistbulk(2) entry from zba: the returned attribute set
+ * and error first, then the attributes in bitmap order, as commonattrpack(),
+ * dirattrpack() and fileattrpack() would.  The caller clears the file
+ * attributes of directories and the directory attributes of everything
+ * else from aip's attrlist; they are not returned.
+ */
+void
+bulkattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, const zfs_bulkattr_t *zba,
+    const char *name, uint64_t objnum, boolean_t user64)
+{
+	struct attrlist *alp = aip->ai_attrlist;
+	attrgroup_t commonattr = alp->commonattr;
+	void *attrbufptr;
+	struct mount *mp = zfsvfs->z_vfs;
+	static const uint64_t notime[2] = { 0, 0 };
+	uint64_t parentid;
+	uint64_t allocsize;
+
+	if (ATTR_CMN_RETURNED_ATTRS & commonattr) {
+		attribute_set_t *asp = (attribute_set_t *)*aip->ai_attrbufpp;
+
+		asp->commonattr = commonattr;
+		asp->volattr = 0;
+		asp->dirattr = alp->dirattr;
+		asp->fileattr = alp->fileattr;
+		asp->forkattr = 0;
+		*aip->ai_attrbufpp = asp + 1;
+	}
+	if (ATTR_CMN_ERROR & commonattr) {
+		*((u_int32_t *)*aip->ai_attrbufpp) = 0;
+		*aip->ai_attrbufpp = ((u_int32_t *)*aip->ai_attrbufpp) + 1;
+	}
+	if (ATTR_CMN_NAME & commonattr)
+		nameattrpack(aip, name, strlen(name));
+	attrbufptr = *aip->ai_attrbufpp;
+
+	/*
+	 * On Mac OS X we always export the root directory id as 2
+	 * and its parent as 1
+	 */
+	if (objnum == zfsvfs->z_root)
+		parentid = 1;
+	else if (zba->zba_parent == zfsvfs->z_root)
+		parentid = 2;
+	else
+		parentid = zba->zba_parent;
+	if (objnum == zfsvfs->z_root)
+		objnum = 2;
+
+	if (ATTR_CMN_DEVID & commonattr) {
+		*((dev_t *)attrbufptr) = vfs_statfs(mp)->f_fsid.val[0];
+		attrbufptr = ((dev_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_FSID & commonattr) {
+		*((fsid_t *)attrbufptr) = vfs_statfs(mp)->f_fsid;
+		attrbufptr = ((fsid_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_OBJTYPE & commonattr) {
+		*((fsobj_type_t *)attrbufptr) = IFTOVT((mode_t)zba->zba_mode);
+		attrbufptr = ((fsobj_type_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_OBJTAG & commonattr) {
+		*((fsobj_tag_t *)attrbufptr) = VT_ZFS;
+		attrbufptr = ((fsobj_tag_t *)attrbufptr) + 1;
+	}
+	/*
+	 * Note: ATTR_CMN_OBJID and ATTR_CMN_PAROBJID are lossy (only 32 bits).
+	 */
+	if (ATTR_CMN_OBJID & commonattr) {
+		((fsobj_id_t *)attrbufptr)->fid_objno = (uint32_t)objnum;
+		((fsobj_id_t *)attrbufptr)->fid_generation = 0;
+		attrbufptr = ((fsobj_id_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_OBJPERMANENTID & commonattr) {
+		((fsobj_id_t *)attrbufptr)->fid_objno = (uint32_t)objnum;
+		((fsobj_id_t *)attrbufptr)->fid_generation = 0;
+		attrbufptr = ((fsobj_id_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_PAROBJID & commonattr) {
+		((fsobj_id_t *)attrbufptr)->fid_objno = (uint32_t)parentid;
+		((fsobj_id_t *)attrbufptr)->fid_generation = 0;
+		attrbufptr = ((fsobj_id_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_SCRIPT & commonattr) {
+		*((text_encoding_t *)attrbufptr) = kTextEncodingMacUnicode;
+		attrbufptr = ((text_encoding_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_CRTIME & commonattr)
+		attrbufptr = bulkattr_timepack(attrbufptr, zba->zba_crtime,
+		    user64);
+	if (ATTR_CMN_MODTIME & commonattr)
+		attrbufptr = bulkattr_timepack(attrbufptr, zba->zba_mtime,
+		    user64);
+	if (ATTR_CMN_CHGTIME & commonattr)
+		attrbufptr = bulkattr_timepack(attrbufptr, zba->zba_ctime,
+		    user64);
+	if (ATTR_CMN_ACCTIME & commonattr)
+		attrbufptr = bulkattr_timepack(attrbufptr, zba->zba_atime,
+		    user64);
+	/* legacy attribute -- just pass zero */
+	if (ATTR_CMN_BKUPTIME & commonattr)
+		attrbufptr = bulkattr_timepack(attrbufptr, notime, user64);
+	if (ATTR_CMN_FNDRINFO & commonattr) {
+		bcopy(&zba->zba_finderinfo, attrbufptr, sizeof (finderinfo_t));
+		attrbufptr = (char *)attrbufptr + 32;
+	}
+	if (ATTR_CMN_OWNERID & commonattr) {
+		*((uid_t *)attrbufptr) = zba->zba_uid;
+		attrbufptr = ((uid_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_GRPID & commonattr) {
+		*((gid_t *)attrbufptr) = zba->zba_gid;
+		attrbufptr = ((gid_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_ACCESSMASK & commonattr) {
+		*((u_int32_t *)attrbufptr) = zba->zba_mode;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_FLAGS & commonattr) {
+		u_int32_t flags = zfs_pflags_to_bsdflags(zba->zba_pflags);
+
+		/* Shadow Finder Info's invisible bit to UF_HIDDEN */
+		if (OSSwapBigToHostInt16(zba->zba_finderinfo.fi_flags) &
+		    kIsInvisible)
+			flags |= UF_HIDDEN;
+
+		*((u_int32_t *)attrbufptr) = flags;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_USERACCESS & commonattr) {
+		*((u_int32_t *)attrbufptr) = zba->zba_useraccess;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_FILEID & commonattr) {
+		*((u_int64_t *)attrbufptr) = objnum;
+		attrbufptr = ((u_int64_t *)attrbufptr) + 1;
+	}
+	if (ATTR_CMN_PARENTID & commonattr) {
+		*((u_int64_t *)attrbufptr) = parentid;
+		attrbufptr = ((u_int64_t *)attrbufptr) + 1;
+	}
+
+	if (ATTR_DIR_LINKCOUNT & alp->dirattr) {
+		*((u_int32_t *)attrbufptr) = 1;  /* no dir hard links */
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_DIR_ENTRYCOUNT & alp->dirattr) {
+		/* Don't include '.' and '..' in the number of entries */
+		*((u_int32_t *)attrbufptr) = (u_int32_t)
+		    (zba->zba_size > 2 ? zba->zba_size - 2 : 0);
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_DIR_MOUNTSTATUS & alp->dirattr) {
+		*((u_int32_t *)attrbufptr) = zba->zba_mntstatus;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+
+	allocsize = (uint64_t)512LL * (uint64_t)zba->zba_nblks;
+	if (ATTR_FILE_LINKCOUNT & alp->fileattr) {
+		*((u_int32_t *)attrbufptr) = zba->zba_links;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_TOTALSIZE & alp->fileattr) {
+		*((off_t *)attrbufptr) = zba->zba_size;
+		attrbufptr = ((off_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_ALLOCSIZE & alp->fileattr) {
+		*((off_t *)attrbufptr) = allocsize;
+		attrbufptr = ((off_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_IOBLOCKSIZE & alp->fileattr) {
+		*((u_int32_t *)attrbufptr) =
+		    zba->zba_blksz ? zba->zba_blksz : zfsvfs->z_max_blksz;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_DEVTYPE & alp->fileattr) {
+		*((u_int32_t *)attrbufptr) = (u_int32_t)zba->zba_rdev;
+		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_DATALENGTH & alp->fileattr) {
+		*((off_t *)attrbufptr) = zba->zba_size;
+		attrbufptr = ((off_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_DATAALLOCSIZE & alp->fileattr) {
+		*((off_t *)attrbufptr) = allocsize;
+		attrbufptr = ((off_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_RSRCLENGTH & alp->fileattr) {
+		*((off_t *)attrbufptr) = zba->zba_rsrcsize;
+		attrbufptr = ((off_t *)attrbufptr) + 1;
+	}
+	if (ATTR_FILE_RSRCALLOCSIZE & alp->fileattr) {
+		*((off_t *)attrbufptr) = roundup(zba->zba_rsrcsize, 512);
+		attrbufptr = ((off_t *)attrbufptr) + 1;
+	}
+
+	*aip->ai_attrbufpp = attrbufptr;
+}
+
+
 static unsigned char fingerprint[] = {0xab, 0xcd, 0xef, 0xab, 0xcd, 0xef,
                                       0xab, 0xcd, 0xef, 0xab, 0xcd, 0xef};
 
@@ -67,6 +67,7 @@
 #include <sys/zfs_sa.h>
 #include <sys/zfs_stat.h>
 #include <sys/refcount.h>
+#include <sys/zfeature.h>
 
 #include "zfs_prop.h"
 #include "zfs_comutil.h"
@@ -161,6 +162,7 @@ zfs_znode_cache_constructor(void *buf, void *arg, int kmflags)
 #endif
 
 	list_link_init(&zp->z_link_node);
+	list_link_init(&zp->z_link_reclaim_node);
 
 	mutex_init(&zp->z_lock, NULL, MUTEX_DEFAULT, NULL);
 	rw_init(&zp->z_map_lock, NULL, RW_DEFAULT, NULL);
@@ -172,9 +174,18 @@ zfs_znode_cache_constructor(void *buf, void *arg, int kmflags)
 	mutex_init(&zp->z_range_lock, NULL, MUTEX_DEFAULT, NULL);
 	avl_create(&zp->z_range_avl, zfs_range_compare,
 	    sizeof (rl_t), offsetof(rl_t, r_node));
+	cv_init(&zp->z_range_cv, NULL, CV_DEFAULT, NULL);
+	zp->z_range_readers = 0;
+	zp->z_range_writers = 0;
+	cv_init(&zp->z_commit_cv, NULL, CV_DEFAULT, NULL);
+	zp->z_commit_seq = 0;
+	zp->z_commit_done = 0;
+	zp->z_commit_active = B_FALSE;
 
 	zp->z_dirlocks = NULL;
+	zp->z_negcache = NULL;
 	zp->z_acl_cached = NULL;
+	zp->z_access_cache = NULL;
 	zp->z_xattr_cached = NULL;
 	zp->z_moved = 0;
 	zp->z_fastpath = B_FALSE;
@@ -190,17 +201,25 @@ zfs_znode_cache_destructor(void *buf, void *arg)
 	ASSERT(ZTOV(zp) == NULL);
 	vn_free(ZTOV(zp));
 	ASSERT(!list_link_active(&zp->z_link_node));
+	ASSERT(!list_link_active(&zp->z_link_reclaim_node));
 	mutex_destroy(&zp->z_lock);
 	rw_destroy(&zp->z_map_lock);
 	rw_destroy(&zp->z_parent_lock);
 	rw_destroy(&zp->z_name_lock);
 	mutex_destroy(&zp->z_acl_lock);
 	rw_destroy(&zp->z_xattr_lock);
+	ASSERT0(zp->z_range_readers);
+	ASSERT0(zp->z_range_writers);
+	cv_destroy(&zp->z_range_cv);
+	ASSERT(!zp->z_commit_active);
+	cv_destroy(&zp->z_commit_cv);
 	avl_destroy(&zp->z_range_avl);
 	mutex_destroy(&zp->z_range_lock);
 
 	ASSERT(zp->z_dirlocks == NULL);
+	ASSERT(zp->z_negcache == NULL);
 	ASSERT(zp->z_acl_cached == NULL);
+	ASSERT(zp->z_access_cache == NULL);
 	ASSERT(zp->z_xattr_cached == NULL);
 }
 
@@ -249,6 +268,8 @@ zfs_znode_move_impl(znode_t *ozp, znode_t *nzp)
 		zfs_acl_free(ozp->z_acl_cached);
 		ozp->z_acl_cached = NULL;
 	}
+	zfs_acl_access_purge(ozp);
+	zfs_negcache_purge(ozp);
 
 	sa_set_userp(nzp->z_sa_hdl, nzp);
 
@@ -392,6 +413,9 @@ zfs_znode_init(void)
 		zfs_znode_cache_constructor,
 	    zfs_znode_cache_destructor, NULL, NULL,
 	    NULL, 0);
+	zfs_rlock_init();
+	zfs_dir_init();
+	zfs_acl_init();
 
 	// BGH - dont support move semantics here yet.
 	// zfs_znode_move() requires porting
@@ -408,6 +432,10 @@ zfs_znode_fini(void)
 	zfs_remove_op_tables();
 #endif	/* sun */
 
+	zfs_acl_fini();
+	zfs_dir_fini();
+	zfs_rlock_fini();
+
 	/*
 	 * Cleanup zcache
 	 */
@@ -697,6 +725,7 @@ zfs_znode_alloc(zfsvfs_t *zfsvfs, dmu_buf_t *db, int blksz,
 	zp->z_blksz = blksz;
 	zp->z_seq = 0x7A4653;
 	zp->z_sync_cnt = 0;
+	zp->z_replay_eof = 0;
 
 	zp->z_is_zvol = 0;
 	zp->z_is_mapped = 0;
@@ -918,6 +947,7 @@ zfs_mknode(znode_t *dzp, vattr_t *vap, dmu_tx_t *tx, cred_t *cr,
 	timestruc_t	now;
 	uint64_t	gen, obj;
 	int		bonuslen;
+	int		dnodesize;
 	sa_handle_t	*sa_hdl;
 	dmu_object_type_t obj_type;
 	sa_bulk_attr_t  *sa_attrs;
@@ -931,15 +961,19 @@ zfs_mknode(znode_t *dzp, vattr_t *vap, dmu_tx_t *tx, cred_t *cr,
 		obj = vap->va_nodeid;
 		now = vap->va_ctime;		/* see zfs_replay_create() */
 		gen = vap->va_nblocks;		/* ditto */
+		dnodesize = vap->va_fsid;	/* ditto */
 	} else {
 		obj = 0;
 		gethrestime(&now);
 		gen = dmu_tx_get_txg(tx);
+		dnodesize = dmu_objset_dnodesize(zfsvfs->z_os);
 	}
 
 	obj_type = zfsvfs->z_use_sa ? DMU_OT_SA : DMU_OT_ZNODE;
+	if (obj_type == DMU_OT_ZNODE || dnodesize == 0)
+		dnodesize = DNODE_MIN_SIZE;
 	bonuslen = (obj_type == DMU_OT_SA) ?
-	    DN_MAX_BONUSLEN : ZFS_OLD_ZNODE_PHYS_SIZE;
+	    DN_BONUS_SIZE(dnodesize) : ZFS_OLD_ZNODE_PHYS_SIZE;
 
 	/*
 	 * Create a new DMU object.
@@ -952,25 +986,25 @@ zfs_mknode(znode_t *dzp, vattr_t *vap, dmu_tx_t *tx, cred_t *cr,
 	 */
 	if (vap->va_type == VDIR) {
 		if (zfsvfs->z_replay) {
-			err = zap_create_claim_norm(zfsvfs->z_os, obj,
+			err = zap_create_claim_norm_dnsize(zfsvfs->z_os, obj,
 			    zfsvfs->z_norm, DMU_OT_DIRECTORY_CONTENTS,
-			    obj_type, bonuslen, tx);
+			    obj_type, bonuslen, dnodesize, tx);
 			ASSERT(err == 0);
 		} else {
-			obj = zap_create_norm(zfsvfs->z_os,
+			obj = zap_create_norm_dnsize(zfsvfs->z_os,
 			    zfsvfs->z_norm, DMU_OT_DIRECTORY_CONTENTS,
-			    obj_type, bonuslen, tx);
+			    obj_type, bonuslen, dnodesize, tx);
 		}
 	} else {
 		if (zfsvfs->z_replay) {
-			err = dmu_object_claim(zfsvfs->z_os, obj,
+			err = dmu_object_claim_dnsize(zfsvfs->z_os, obj,
 			    DMU_OT_PLAIN_FILE_CONTENTS, 0,
-			    obj_type, bonuslen, tx);
+			    obj_type, bonuslen, dnodesize, tx);
 			ASSERT(err == 0);
 		} else {
-			obj = dmu_object_alloc(zfsvfs->z_os,
+			obj = dmu_object_alloc_dnsize(zfsvfs->z_os,
 			    DMU_OT_PLAIN_FILE_CONTENTS, 0,
-			    obj_type, bonuslen, tx);
+			    obj_type, bonuslen, dnodesize, tx);
 		}
 	}
 
@@ -1271,6 +1305,8 @@ zfs_xvattr_set(znode_t *zp, xvattr_t *xvap, dmu_tx_t *tx)
 	}
 }
 
+static boolean_t zfs_znode_reclaim_rescue(znode_t *);
+
 int
 zfs_zget_ext(zfsvfs_t *zfsvfs, uint64_t obj_num, znode_t **zpp,
 			 int flags)
@@ -1351,6 +1387,23 @@ again:
 			return (ENOENT);
 		}
 
+		/*
+		 * The vnode was reclaimed but the znode is still waiting on
+		 * the reclaim queue; take it back and give it a new vnode
+		 * rather than waiting for the queue to get to it.
+		 */
+		if (vp == NULL && !(flags & (ZGET_FLAG_WITHOUT_VNODE |
+		    ZGET_FLAG_WITHOUT_VNODE_GET)) &&
+		    zfs_znode_reclaim_rescue(zp)) {
+			mutex_exit(&zp->z_lock);
+			sa_buf_rele(db, NULL);
+			ZFS_OBJ_HOLD_EXIT(zfsvfs, obj_num);
+			zfs_znode_getvnode(zp, zfsvfs);
+			*zpp = zp;
+			getnewvnode_drop_reserve();
+			return (0);
+		}
+
 		mutex_exit(&zp->z_lock);
 		sa_buf_rele(db, NULL);
 		ZFS_OBJ_HOLD_EXIT(zfsvfs, obj_num);
@@ -1485,8 +1538,11 @@ zfs_rezget(znode_t *zp)
 		zfs_acl_free(zp->z_acl_cached);
 		zp->z_acl_cached = NULL;
 	}
+	zfs_acl_access_purge(zp);
 	mutex_exit(&zp->z_acl_lock);
 
+	zfs_negcache_purge(zp);
+
 	dprintf("rezget: %p %p %p\n", zp, zp->z_xattr_lock,
 	    zp->z_xattr_parent);
 
@@ -1635,6 +1691,120 @@ zfs_zinactive(znode_t *zp)
 	zfs_znode_free(zp);
 }
 
+/*
+ * Reclaimed znodes are finished off by a task, zfs_vnop_reclaim_batch at
+ * a time under one hold of z_teardown_inactive_lock, rather than in the
+ * VM's reclaim context.  Set zfs_vnop_reclaim_async to 0 to do the work
+ * inline instead.
+ */
+unsigned int zfs_vnop_reclaim_async = 1;
+unsigned int zfs_vnop_reclaim_batch = 64;
+
+static void
+zfs_znode_reclaim_one(znode_t *zp)
+{
+	if (zp->z_sa_hdl == NULL)
+		zfs_znode_free(zp);
+	else
+		zfs_zinactive(zp);
+}
+
+static void
+zfs_znode_reclaim_drain(void *arg)
+{
+	zfsvfs_t *zfsvfs = arg;
+	znode_t *zp;
+	unsigned int n;
+
+	for (;;) {
+		rw_enter(&zfsvfs->z_teardown_inactive_lock, RW_READER);
+		for (n = 0; n < MAX(zfs_vnop_reclaim_batch, 1); n++) {
+			mutex_enter(&zfsvfs->z_reclaim_lock);
+			zp = list_remove_head(&zfsvfs->z_reclaim_znodes);
+			mutex_exit(&zfsvfs->z_reclaim_lock);
+			if (zp == NULL)
+				break;
+			zfs_znode_reclaim_one(zp);
+		}
+		rw_exit(&zfsvfs->z_teardown_inactive_lock);
+
+		mutex_enter(&zfsvfs->z_reclaim_lock);
+		if (list_is_empty(&zfsvfs->z_reclaim_znodes)) {
+			zfsvfs->z_reclaim_active = B_FALSE;
+			cv_broadcast(&zfsvfs->z_reclaim_cv);
+			mutex_exit(&zfsvfs->z_reclaim_lock);
+			return;
+		}
+		mutex_exit(&zfsvfs->z_reclaim_lock);
+	}
+}
+
+/*
+ * Called by vnop_reclaim once the vnode has been detached from zp.
+ * Queue zp to have its SA handle released (or, if unlinked, to be
+ * removed) by the drain task so that the VM does not wait for it.
+ */
+void
+zfs_znode_reclaim(znode_t *zp)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	boolean_t dispatch = B_FALSE;
+
+	if (!zfs_vnop_reclaim_async || zfsvfs->z_unmounted ||
+	    zfsvfs->z_os == NULL || zp->z_sa_hdl == NULL) {
+		rw_enter(&zfsvfs->z_teardown_inactive_lock, RW_READER);
+		zfs_znode_reclaim_one(zp);
+		rw_exit(&zfsvfs->z_teardown_inactive_lock);
+		return;
+	}
+
+	mutex_enter(&zfsvfs->z_reclaim_lock);
+	list_insert_tail(&zfsvfs->z_reclaim_znodes, zp);
+	if (!zfsvfs->z_reclaim_active) {
+		zfsvfs->z_reclaim_active = B_TRUE;
+		dispatch = B_TRUE;
+	}
+	mutex_exit(&zfsvfs->z_reclaim_lock);
+
+	if (dispatch && taskq_dispatch(dsl_pool_vnrele_taskq(
+	    dmu_objset_pool(zfsvfs->z_os)), zfs_znode_reclaim_drain,
+	    zfsvfs, TQ_NOSLEEP) == 0)
+		zfs_znode_reclaim_drain(zfsvfs);
+}
+
+/*
+ * Wait until every queued reclaim of zfsvfs has been processed.
+ */
+void
+zfs_znode_reclaim_wait(zfsvfs_t *zfsvfs)
+{
+	mutex_enter(&zfsvfs->z_reclaim_lock);
+	while (zfsvfs->z_reclaim_active)
+		cv_wait(&zfsvfs->z_reclaim_cv, &zfsvfs->z_reclaim_lock);
+	ASSERT(list_is_empty(&zfsvfs->z_reclaim_znodes));
+	mutex_exit(&zfsvfs->z_reclaim_lock);
+}
+
+/*
+ * Take zp back off the reclaim queue, for a zget that found it there
+ * before the drain task got to it.  The caller holds the object lock,
+ * so zp cannot be freed under us.
+ */
+static boolean_t
+zfs_znode_reclaim_rescue(znode_t *zp)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	boolean_t rescued = B_FALSE;
+
+	mutex_enter(&zfsvfs->z_reclaim_lock);
+	if (list_link_active(&zp->z_link_reclaim_node)) {
+		list_remove(&zfsvfs->z_reclaim_znodes, zp);
+		rescued = B_TRUE;
+	}
+	mutex_exit(&zfsvfs->z_reclaim_lock);
+	return (rescued);
+}
+
 void
 zfs_znode_free(znode_t *zp)
 {
@@ -1661,12 +1831,15 @@ zfs_znode_free(znode_t *zp)
 		zfs_acl_free(zp->z_acl_cached);
 		zp->z_acl_cached = NULL;
 	}
+	zfs_acl_access_purge(zp);
 
 	if (zp->z_xattr_cached) {
 		nvlist_free(zp->z_xattr_cached);
 		zp->z_xattr_cached = NULL;
 	}
 
+	zfs_negcache_purge(zp);
+
 	kmem_cache_free(znode_cache, zp);
 
 	VFS_RELE(zfsvfs->z_vfs);
@@ -1765,6 +1938,103 @@ zfs_grow_blocksize(znode_t *zp, uint64_t size, dmu_tx_t *tx)
 	dmu_object_size_from_db(sa_get_db(zp->z_sa_hdl), &zp->z_blksz, &dummy);
 }
 
+/*
+ * Largest regular file whose data is kept in its SA bonus buffer, as the
+ * ZPL_INLINE_DATA attribute, rather than in a data block; 0 disables it.
+ */
+int zfs_inline_data_max = 2048;
+
+/*
+ * Room left in the bonus buffer next to inline data for the attributes
+ * that vary between files (ACEs, SA xattrs), so that these don't get
+ * pushed out to a spill block.
+ */
+#define	ZFS_INLINE_DATA_RESERVE	256
+
+/*
+ * Can the data of zp be kept inline once the file is size bytes long?
+ * Only regular files of SA filesystems qualify, and only when the data
+ * fits in the bonus buffer next to their attributes, which takes a dnode
+ * larger than the legacy 512 bytes.  Files that have been mapped keep
+ * their data in blocks, where the pager expects it.
+ */
+boolean_t
+zfs_inline_data_ok(znode_t *zp, uint64_t size)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+
+	if (zfs_inline_data_max <= 0 || size == 0 ||
+	    size > zfs_inline_data_max)
+		return (B_FALSE);
+
+	if (!zp->z_is_sa || !S_ISREG(zp->z_mode) || zp->z_is_mapped ||
+	    (zp->z_pflags & ZFS_XATTR))
+		return (B_FALSE);
+
+	if (!spa_feature_is_enabled(dmu_objset_spa(zfsvfs->z_os),
+	    SPA_FEATURE_INLINE_DATA))
+		return (B_FALSE);
+
+	return (ZFS_SA_BASE_ATTR_SIZE + ZFS_INLINE_DATA_RESERVE + size <=
+	    sa_get_db(zp->z_sa_hdl)->db_size);
+}
+
+/*
+ * Move the inline data of zp to its first block, where it stays from then
+ * on.  The data is written before the attribute is removed, so that
+ * zfs_sa_read_data() always finds it in one place or the other.
+ *
+ * NOTE: this function assumes that the whole file is write locked.
+ */
+int
+zfs_inline_promote(znode_t *zp)
+{
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	uint64_t size = zp->z_size;
+	dmu_tx_t *tx;
+	void *buf = NULL;
+	int error;
+
+	if (!(zp->z_pflags & ZFS_INLINE_DATA))
+		return (0);
+
+	if (size != 0) {
+		buf = kmem_alloc(size, KM_SLEEP);
+		error = zfs_sa_read_data(zp, 0, size, buf,
+		    DMU_READ_NO_PREFETCH);
+		if (error) {
+			kmem_free(buf, size);
+			return (error);
+		}
+	}
+
+	tx = dmu_tx_create(zfsvfs->z_os);
+	dmu_tx_hold_sa(tx, zp->z_sa_hdl, B_TRUE);
+	if (size != 0)
+		dmu_tx_hold_write(tx, zp->z_id, 0, size);
+	zfs_sa_upgrade_txholds(tx, zp);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		if (buf != NULL)
+			kmem_free(buf, size);
+		return (error);
+	}
+
+	if (size != 0)
+		dmu_write(zfsvfs->z_os, zp->z_id, 0, size, buf, tx);
+	VERIFY0(sa_remove(zp->z_sa_hdl, SA_ZPL_INLINE_DATA(zfsvfs), tx));
+	zp->z_pflags &= ~ZFS_INLINE_DATA;
+	VERIFY0(sa_update(zp->z_sa_hdl, SA_ZPL_FLAGS(zfsvfs),
+	    &zp->z_pflags, sizeof (zp->z_pflags), tx));
+
+	dmu_tx_commit(tx);
+
+	if (buf != NULL)
+		kmem_free(buf, size);
+	return (0);
+}
+
 #ifdef sun
 /*
  * This is a dummy interface used when pvn_vplist_dirty() should *not*
@@ -1811,6 +2081,15 @@ zfs_extend(znode_t *zp, uint64_t end)
 		return (0);
 	}
 
+	/*
+	 * Inline data only grows through zfs_write(); here it has to move
+	 * to the file's blocks first.
+	 */
+	if ((error = zfs_inline_promote(zp)) != 0) {
+		zfs_range_unlock(rl);
+		return (error);
+	}
+
 	tx = dmu_tx_create(zfsvfs->z_os);
 	dmu_tx_hold_sa(tx, zp->z_sa_hdl, B_FALSE);
 	zfs_sa_upgrade_txholds(tx, zp);
@@ -1882,6 +2161,19 @@ zfs_free_range(znode_t *zp, uint64_t off, uint64_t len)
 	 */
 	rl = zfs_range_lock(zp, off, len, RL_WRITER);
 
+	/*
+	 * Inline data is only rewritten as a whole, with the whole file
+	 * locked, so punch the hole in its blocks instead.
+	 */
+	if (zp->z_pflags & ZFS_INLINE_DATA) {
+		zfs_range_unlock(rl);
+		rl = zfs_range_lock(zp, 0, UINT64_MAX, RL_WRITER);
+		if ((error = zfs_inline_promote(zp)) != 0) {
+			zfs_range_unlock(rl);
+			return (error);
+		}
+	}
+
 	/*
 	 * Nothing to do if file already at desired length.
 	 */
@@ -1893,17 +2185,13 @@ zfs_free_range(znode_t *zp, uint64_t off, uint64_t len)
 	if (off + len > zp->z_size)
 		len = zp->z_size - off;
 
+	/*
+	 * The file size is unchanged, so the UBC size is left alone.
+	 * Callers punching a hole push and invalidate the range's pages
+	 * before getting here.
+	 */
 	error = dmu_free_long_range(zfsvfs->z_os, zp->z_id, off, len);
 
-	if (error == 0) {
-		/*
-		 * In FreeBSD we cannot free block in the middle of a file,
-		 * but only at the end of a file, so this code path should
-		 * never happen.
-		 */
-		vnode_pager_setsize(ZTOV(zp), off);
-	}
-
 #ifdef _LINUX
 	/*
 	 * Zero partial page cache entries.  This must be done under a
@@ -1970,6 +2258,8 @@ zfs_trunc(znode_t *zp, uint64_t end)
 	int error;
 	sa_bulk_attr_t bulk[2];
 	int count = 0;
+	boolean_t inline_data;
+	void *buf = NULL;
 	/*
 	 * We will change zp_size, lock the whole file.
 	 */
@@ -1983,29 +2273,53 @@ zfs_trunc(znode_t *zp, uint64_t end)
 		return (0);
 	}
 
-	error = dmu_free_long_range(zfsvfs->z_os, zp->z_id, end,  -1);
+	/*
+	 * A file with inline data has no blocks to free; its data attribute
+	 * is cut down to the new length instead, or removed if that is 0.
+	 */
+	inline_data = ((zp->z_pflags & ZFS_INLINE_DATA) != 0);
+	if (inline_data && end != 0) {
+		buf = kmem_alloc(end, KM_SLEEP);
+		error = zfs_sa_read_data(zp, 0, end, buf,
+		    DMU_READ_NO_PREFETCH);
+	} else {
+		error = dmu_free_long_range(zfsvfs->z_os, zp->z_id, end,  -1);
+	}
 	if (error) {
+		if (buf != NULL)
+			kmem_free(buf, end);
 		zfs_range_unlock(rl);
 		return (error);
 	}
 
 	tx = dmu_tx_create(zfsvfs->z_os);
-	dmu_tx_hold_sa(tx, zp->z_sa_hdl, B_FALSE);
+	dmu_tx_hold_sa(tx, zp->z_sa_hdl, inline_data);
 	zfs_sa_upgrade_txholds(tx, zp);
 	dmu_tx_mark_netfree(tx);
 	error = dmu_tx_assign(tx, TXG_WAIT);
 	if (error) {
 		dmu_tx_abort(tx);
+		if (buf != NULL)
+			kmem_free(buf, end);
 		zfs_range_unlock(rl);
 		return (error);
 	}
 
+	if (inline_data && end != 0) {
+		VERIFY0(sa_update(zp->z_sa_hdl, SA_ZPL_INLINE_DATA(zfsvfs),
+		    buf, end, tx));
+		kmem_free(buf, end);
+	} else if (inline_data) {
+		VERIFY0(sa_remove(zp->z_sa_hdl, SA_ZPL_INLINE_DATA(zfsvfs),
+		    tx));
+	}
+
 	zp->z_size = end;
 	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_SIZE(zfsvfs),
 	    NULL, &zp->z_size, sizeof (zp->z_size));
 
 	if (end == 0) {
-		zp->z_pflags &= ~ZFS_SPARSE;
+		zp->z_pflags &= ~(ZFS_SPARSE | ZFS_INLINE_DATA);
 		SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_FLAGS(zfsvfs),
 		    NULL, &zp->z_pflags, 8);
 	}
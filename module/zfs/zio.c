@@ -37,9 +37,11 @@
 #include <sys/zio_impl.h>
 #include <sys/zio_compress.h>
 #include <sys/zio_checksum.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/dsl_scan.h>
 #include <sys/blkptr.h>
 #include <sys/zfeature.h>
 #include <sys/metaslab_impl.h>
@@ -57,6 +59,37 @@ const char *zio_type_name[ZIO_TYPES] = {
 
 boolean_t zio_dva_throttle_enabled = B_TRUE;
 
+/*
+ * Start reading the DDT entries of dedup-ed writes and frees ahead of the
+ * DDT stages; see zio_ddt_prefetch().
+ */
+boolean_t zio_ddt_prefetch_enabled = B_TRUE;
+
+/*
+ * Time each zio's pipeline stages into the pool's "zio_stages" kstat;
+ * see zio_stage_time().
+ */
+boolean_t zio_stage_timing_enabled = B_FALSE;
+
+/*
+ * Size the children of a gang block to the largest free segments of the
+ * normal class instead of splitting it in equal parts; see
+ * zio_write_gang_block().
+ */
+boolean_t zio_gang_fit_enabled = B_TRUE;
+
+/*
+ * Verify the checksums of scrub and resilver reads on a taskq of their
+ * own, with zio_scan_verify_pct percent of the CPUs as threads, instead
+ * of on the read interrupt threads that foreground reads complete on.
+ * Each thread verifies up to zio_scan_verify_batch completed reads per
+ * trip to the queue.  A percentage of 0 verifies them inline; it applies
+ * to pools activated afterwards.  See zio_scan_verify().
+ */
+uint_t zio_scan_verify_pct = 25;
+uint_t zio_scan_verify_batch = 32;
+#define	ZIO_SCAN_VERIFY_BATCH_MAX	64
+
 /*
  * ==========================================================================
  * I/O kmem caches
@@ -200,6 +233,7 @@ zio_init(void)
 	zio_inject_init();
 
 	lz4_init();
+	zstd_init();
 
 }
 
@@ -238,6 +272,7 @@ zio_fini(void)
 	zio_inject_fini();
 
 	lz4_fini();
+	zstd_fini();
 
 #ifdef __APPLE__
 #ifdef _KERNEL
@@ -331,12 +366,18 @@ zio_data_buf_free(void *buf, size_t size)
  * ==========================================================================
  */
 void
-zio_push_transform(zio_t *zio, void *data, uint64_t size, uint64_t bufsize,
+zio_push_transform(zio_t *zio, abd_t *data, uint64_t size, uint64_t bufsize,
 	zio_transform_func_t *transform)
 {
 	zio_transform_t *zt = kmem_alloc(sizeof (zio_transform_t), KM_SLEEP);
 
-	zt->zt_orig_data = zio->io_data;
+	/*
+	 * Ensure that anyone expecting this zio to contain a linear ABD isn't
+	 * going to get a nasty surprise when they try to access the data.
+	 */
+	IMPLY(abd_is_linear(zio->io_abd), abd_is_linear(data));
+
+	zt->zt_orig_abd = zio->io_abd;
 	zt->zt_orig_size = zio->io_size;
 	zt->zt_bufsize = bufsize;
 	zt->zt_transform = transform;
@@ -344,7 +385,7 @@ zio_push_transform(zio_t *zio, void *data, uint64_t size, uint64_t bufsize,
 	zt->zt_next = zio->io_transform_stack;
 	zio->io_transform_stack = zt;
 
-	zio->io_data = data;
+	zio->io_abd = data;
 	zio->io_size = size;
 }
 
@@ -356,12 +397,12 @@ zio_pop_transforms(zio_t *zio)
 	while ((zt = zio->io_transform_stack) != NULL) {
 		if (zt->zt_transform != NULL)
 			zt->zt_transform(zio,
-			    zt->zt_orig_data, zt->zt_orig_size);
+			    zt->zt_orig_abd, zt->zt_orig_size);
 
 		if (zt->zt_bufsize != 0)
-			zio_buf_free(zio->io_data, zt->zt_bufsize);
+			abd_free(zio->io_abd);
 
-		zio->io_data = zt->zt_orig_data;
+		zio->io_abd = zt->zt_orig_abd;
 		zio->io_size = zt->zt_orig_size;
 		zio->io_transform_stack = zt->zt_next;
 
@@ -371,25 +412,45 @@ zio_pop_transforms(zio_t *zio)
 
 /*
  * ==========================================================================
- * I/O transform callbacks for subblocks and decompression
+ * I/O transform callbacks for subblocks, decompression and decryption
  * ==========================================================================
  */
 static void
-zio_subblock(zio_t *zio, void *data, uint64_t size)
+zio_subblock(zio_t *zio, abd_t *data, uint64_t size)
 {
 	ASSERT(zio->io_size > size);
 
 	if (zio->io_type == ZIO_TYPE_READ)
-		bcopy(zio->io_data, data, size);
+		abd_copy(data, zio->io_abd, size);
 }
 
 static void
-zio_decompress(zio_t *zio, void *data, uint64_t size)
+zio_decompress(zio_t *zio, abd_t *data, uint64_t size)
 {
-	if (zio->io_error == 0 &&
-	    zio_decompress_data(BP_GET_COMPRESS(zio->io_bp),
-	    zio->io_data, data, zio->io_size, size) != 0)
-		zio->io_error = SET_ERROR(EIO);
+	if (zio->io_error == 0) {
+		void *tmp = abd_borrow_buf(data, size);
+		int ret = zio_decompress_data(BP_GET_COMPRESS(zio->io_bp),
+		    zio->io_abd, tmp, zio->io_size, size);
+		abd_return_buf_copy(data, tmp, size);
+
+		if (ret != 0)
+			zio->io_error = SET_ERROR(EIO);
+	}
+}
+
+static void
+zio_decrypt(zio_t *zio, abd_t *data, uint64_t size)
+{
+	int ret;
+
+	ASSERT3U(zio->io_size, ==, size);
+
+	if (zio->io_error == 0) {
+		ret = spa_do_crypt_abd(B_FALSE, zio->io_spa, &zio->io_bookmark,
+		    zio->io_bp, size, data, zio->io_abd);
+		if (ret != 0)
+			zio->io_error = ret;
+	}
 }
 
 /*
@@ -433,12 +494,25 @@ zio_unique_parent(zio_t *cio)
 	return (pio);
 }
 
+/*
+ * Most zios only ever have one parent, so the link to the first one is
+ * part of the child and only further parents cost an allocation.
+ */
 void
 zio_add_child(zio_t *pio, zio_t *cio)
 {
-	zio_link_t *zl = kmem_cache_alloc(zio_link_cache, KM_SLEEP);
+	zio_link_t *zl = NULL;
 	int w;
 
+	mutex_enter(&cio->io_lock);
+	if (cio->io_parent_link.zl_child == NULL) {
+		zl = &cio->io_parent_link;
+		zl->zl_child = cio;
+	}
+	mutex_exit(&cio->io_lock);
+	if (zl == NULL)
+		zl = kmem_cache_alloc(zio_link_cache, KM_SLEEP);
+
 	/*
 	 * Logical I/Os can have logical, gang, or vdev children.
 	 * Gang I/Os can have gang or vdev children.
@@ -483,10 +557,17 @@ zio_remove_child(zio_t *pio, zio_t *cio, zio_link_t *zl)
 	pio->io_child_count--;
 	cio->io_parent_count--;
 
+	if (zl == &cio->io_parent_link) {
+		zl->zl_parent = NULL;
+		zl->zl_child = NULL;
+		zl = NULL;
+	}
+
 	mutex_exit(&pio->io_lock);
 	mutex_exit(&cio->io_lock);
 
-	kmem_cache_free(zio_link_cache, zl);
+	if (zl != NULL)
+		kmem_cache_free(zio_link_cache, zl);
 }
 
 static boolean_t
@@ -589,7 +670,7 @@ zio_bookmark_compare(const void *x1, const void *x2)
  */
 static zio_t *
 zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
-    void *data, uint64_t lsize, uint64_t psize, zio_done_func_t *done,
+    abd_t *data, uint64_t lsize, uint64_t psize, zio_done_func_t *done,
     void *private, zio_type_t type, zio_priority_t priority,
     enum zio_flag flags, vdev_t *vd, uint64_t offset,
     const zbookmark_phys_t *zb, enum zio_stage stage, enum zio_stage pipeline)
@@ -648,7 +729,7 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	zio->io_priority = priority;
 	zio->io_vd = vd;
 	zio->io_offset = offset;
-	zio->io_orig_data = zio->io_data = data;
+	zio->io_orig_abd = zio->io_abd = data;
 	zio->io_orig_size = zio->io_size = psize;
 	zio->io_lsize = lsize;
 	zio->io_orig_flags = zio->io_flags = flags;
@@ -662,6 +743,9 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	if (zb != NULL)
 		zio->io_bookmark = *zb;
 
+	/* Children run near the thread that issued the logical I/O */
+	zio->io_issue_cpu = (pio != NULL) ? pio->io_issue_cpu : CPU_SEQID;
+
 	if (pio != NULL) {
 		if (zio->io_logical == NULL)
 			zio->io_logical = pio->io_logical;
@@ -792,7 +876,7 @@ zfs_blkptr_verify(spa_t *spa, const blkptr_t *bp)
 
 zio_t *
 zio_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
-    void *data, uint64_t size, zio_done_func_t *done, void *private,
+    abd_t *data, uint64_t size, zio_done_func_t *done, void *private,
     zio_priority_t priority, enum zio_flag flags, const zbookmark_phys_t *zb)
 {
 	zio_t *zio;
@@ -810,7 +894,7 @@ zio_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
 
 zio_t *
 zio_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
-    void *data, uint64_t lsize, uint64_t psize, const zio_prop_t *zp,
+    abd_t *data, uint64_t lsize, uint64_t psize, const zio_prop_t *zp,
     zio_done_func_t *ready, zio_done_func_t *children_ready,
     zio_done_func_t *physdone, zio_done_func_t *done,
     void *private, zio_priority_t priority, enum zio_flag flags,
@@ -851,7 +935,7 @@ zio_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
 }
 
 zio_t *
-zio_rewrite(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, void *data,
+zio_rewrite(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, abd_t *data,
     uint64_t size, zio_done_func_t *done, void *private,
     zio_priority_t priority, enum zio_flag flags, zbookmark_phys_t *zb)
 {
@@ -911,9 +995,9 @@ zio_free(spa_t *spa, uint64_t txg, const blkptr_t *bp)
 	}
 }
 
-zio_t *
-zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
-    enum zio_flag flags)
+static zio_t *
+zio_free_sync_impl(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
+    enum zio_flag flags, boolean_t async)
 {
 	zio_t *zio;
 	enum zio_stage stage = ZIO_FREE_PIPELINE;
@@ -927,13 +1011,14 @@ zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 
 	metaslab_check_free(spa, bp);
 	arc_freed(spa, bp);
+	dsl_scan_freed(spa, bp);
 
 	/*
 	 * GANG and DEDUP blocks can induce a read (for the gang block header,
 	 * or the DDT), so issue them asynchronously so that this thread is
 	 * not tied up.
 	 */
-	if (BP_IS_GANG(bp) || BP_GET_DEDUP(bp))
+	if (async || BP_IS_GANG(bp) || BP_GET_DEDUP(bp))
 		stage |= ZIO_STAGE_ISSUE_ASYNC;
 
 	zio = zio_create(pio, spa, txg, bp, NULL, BP_GET_PSIZE(bp),
@@ -943,6 +1028,27 @@ zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	return (zio);
 }
 
+zio_t *
+zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
+    enum zio_flag flags)
+{
+	return (zio_free_sync_impl(pio, spa, txg, bp, flags, B_FALSE));
+}
+
+/*
+ * Like zio_free_sync(), but always hand the free to the FREE issue
+ * taskqs rather than doing the metaslab_free() in the calling thread.
+ * Callers freeing many blocks at once (the background destroy) use this
+ * so that the frees of different top-level vdevs, which take different
+ * metaslab locks, proceed in parallel.
+ */
+zio_t *
+zio_free_sync_async(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
+    enum zio_flag flags)
+{
+	return (zio_free_sync_impl(pio, spa, txg, bp, flags, B_TRUE));
+}
+
 zio_t *
 zio_claim(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
     zio_done_func_t *done, void *private, enum zio_flag flags)
@@ -1002,9 +1108,34 @@ zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
 	return (zio);
 }
 
+/*
+ * Unmap (TRIM) a range of a leaf vdev.  The offset is relative to the
+ * start of the allocatable space, like a DVA offset, and skips the front
+ * labels the same way zio_vdev_child_io() does.
+ */
+zio_t *
+zio_trim(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
+    zio_done_func_t *done, void *private, enum zio_flag flags)
+{
+	zio_t *zio;
+
+	ASSERT(vd->vdev_ops->vdev_op_leaf);
+	ASSERT3U(size, !=, 0);
+
+	zio = zio_create(pio, vd->vdev_spa, 0, NULL, NULL, 0, 0, done, private,
+	    ZIO_TYPE_IOCTL, ZIO_PRIORITY_NOW, flags, vd, 0, NULL,
+	    ZIO_STAGE_OPEN, ZIO_IOCTL_PIPELINE);
+
+	zio->io_cmd = DKIOCFREE;
+	zio->io_offset = offset + VDEV_LABEL_START_SIZE;
+	zio->io_size = size;
+
+	return (zio);
+}
+
 zio_t *
 zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
-    void *data, int checksum, zio_done_func_t *done, void *private,
+    abd_t *data, int checksum, zio_done_func_t *done, void *private,
     zio_priority_t priority, enum zio_flag flags, boolean_t labels)
 {
 	zio_t *zio;
@@ -1025,7 +1156,7 @@ zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
 
 zio_t *
 zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
-    void *data, int checksum, zio_done_func_t *done, void *private,
+    abd_t *data, int checksum, zio_done_func_t *done, void *private,
     zio_priority_t priority, enum zio_flag flags, boolean_t labels)
 {
 	zio_t *zio;
@@ -1048,8 +1179,9 @@ zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
 		 * Therefore, we must make a local copy in case the data is
 		 * being written to multiple places in parallel.
 		 */
-		void *wbuf = zio_buf_alloc(size);
-		bcopy(data, wbuf, size);
+		abd_t *wbuf = abd_alloc_sametype(data, size);
+		abd_copy(wbuf, data, size);
+
 		zio_push_transform(zio, wbuf, size, size, NULL);
 	}
 
@@ -1061,7 +1193,7 @@ zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
  */
 zio_t *
 zio_vdev_child_io(zio_t *pio, blkptr_t *bp, vdev_t *vd, uint64_t offset,
-    void *data, uint64_t size, int type, zio_priority_t priority,
+    abd_t *data, uint64_t size, int type, zio_priority_t priority,
     enum zio_flag flags, zio_done_func_t *done, void *private)
 {
 	enum zio_stage pipeline = ZIO_VDEV_CHILD_PIPELINE;
@@ -1126,7 +1258,7 @@ zio_vdev_child_io(zio_t *pio, blkptr_t *bp, vdev_t *vd, uint64_t offset,
 }
 
 zio_t *
-zio_vdev_delegated_io(vdev_t *vd, uint64_t offset, void *data, uint64_t size,
+zio_vdev_delegated_io(vdev_t *vd, uint64_t offset, abd_t *data, uint64_t size,
 	int type, zio_priority_t priority, enum zio_flag flags,
 	zio_done_func_t *done, void *private)
 {
@@ -1187,14 +1319,31 @@ zio_read_bp_init(zio_t *zio)
 	    !(zio->io_flags & ZIO_FLAG_RAW)) {
 		uint64_t psize =
 		    BP_IS_EMBEDDED(bp) ? BPE_GET_PSIZE(bp) : BP_GET_PSIZE(bp);
-		void *cbuf = zio_buf_alloc(psize);
+		zio_push_transform(zio, abd_alloc_sametype(zio->io_abd, psize),
+		    psize, psize, zio_decompress);
+	}
 
-		zio_push_transform(zio, cbuf, psize, psize, zio_decompress);
+	/*
+	 * Decryption has to happen before decompression, so its transform
+	 * is pushed last.  It is done even for ZIO_FLAG_RAW reads so that
+	 * the ARC holds compressed plaintext; only ZIO_FLAG_RAW_ENCRYPT
+	 * (raw send, scrub) gets the ciphertext itself.
+	 */
+	if (BP_IS_ENCRYPTED(bp) &&
+	    zio->io_child_type == ZIO_CHILD_LOGICAL &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_ENCRYPT)) {
+		uint64_t psize = BP_GET_PSIZE(bp);
+		zio_push_transform(zio, abd_alloc_sametype(zio->io_abd, psize),
+		    psize, psize, zio_decrypt);
 	}
 
 	if (BP_IS_EMBEDDED(bp) && BPE_GET_ETYPE(bp) == BP_EMBEDDED_TYPE_DATA) {
+		int psize = BPE_GET_PSIZE(bp);
+		void *data = abd_borrow_buf(zio->io_abd, psize);
+
 		zio->io_pipeline = ZIO_INTERLOCK_PIPELINE;
-		decode_embedded_bp_compressed(bp, zio->io_data);
+		decode_embedded_bp_compressed(bp, data);
+		abd_return_buf_copy(zio->io_abd, data, psize);
 	} else {
 		ASSERT(!BP_IS_EMBEDDED(bp));
 	}
@@ -1254,7 +1403,8 @@ zio_write_bp_init(zio_t *zio)
 
 		if (BP_GET_CHECKSUM(bp) == zp->zp_checksum) {
 			BP_SET_DEDUP(bp, 1);
-			zio->io_pipeline |= ZIO_STAGE_DDT_WRITE;
+			zio->io_pipeline |= ZIO_STAGE_DDT_PREFETCH |
+			    ZIO_STAGE_DDT_WRITE;
 			return (ZIO_PIPELINE_CONTINUE);
 		}
 
@@ -1332,11 +1482,13 @@ zio_write_compress(zio_t *zio)
 	/* If it's a compressed write that is not raw, compress the buffer. */
 	if (compress != ZIO_COMPRESS_OFF && psize == lsize) {
 		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_data, cbuf, lsize);
+		psize = zio_compress_data_adaptive(spa, zp->zp_compress_streak,
+		    compress, zio->io_abd, cbuf, lsize);
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
-		} else if (!zp->zp_dedup && psize <= BPE_PAYLOAD_SIZE &&
+		} else if (!zp->zp_dedup && !zp->zp_encrypt &&
+		    psize <= BPE_PAYLOAD_SIZE &&
 		    zp->zp_level == 0 && !DMU_OT_HAS_FILL(zp->zp_type) &&
 		    spa_feature_is_enabled(spa, SPA_FEATURE_EMBEDDED_DATA)) {
 			encode_embedded_bp_compressed(bp,
@@ -1370,9 +1522,11 @@ zio_write_compress(zio_t *zio)
 				zio_buf_free(cbuf, lsize);
 				psize = lsize;
 			} else {
-				bzero((char *)cbuf + psize, rounded - psize);
+				abd_t *cdata = abd_get_from_buf(cbuf, lsize);
+				abd_take_ownership_of_buf(cdata, B_TRUE);
+				abd_zero_off(cdata, psize, rounded - psize);
 				psize = rounded;
-				zio_push_transform(zio, cbuf,
+				zio_push_transform(zio, cdata,
 				    psize, lsize, NULL);
 			}
 		}
@@ -1439,6 +1593,51 @@ zio_write_compress(zio_t *zio)
 	return (ZIO_PIPELINE_CONTINUE);
 }
 
+/*
+ * ==========================================================================
+ * Encrypt the (possibly compressed) data of an encrypted dataset
+ * ==========================================================================
+ */
+static int
+zio_encrypt(zio_t *zio)
+{
+	zio_prop_t *zp = &zio->io_prop;
+	blkptr_t *bp = zio->io_bp;
+	uint64_t psize = zio->io_size;
+	abd_t *cabd;
+	int ret;
+
+	/* gang members are written from the already encrypted data */
+	if (!zp->zp_encrypt || zio->io_child_type != ZIO_CHILD_LOGICAL)
+		return (ZIO_PIPELINE_CONTINUE);
+
+	ASSERT(!BP_IS_EMBEDDED(bp));
+	ASSERT(!zp->zp_dedup);
+	ASSERT(!zp->zp_nopwrite);
+	ASSERT3U(psize, ==, BP_GET_PSIZE(bp));
+
+	/* a raw receive hands us ciphertext along with its parameters */
+	if (zio->io_flags & ZIO_FLAG_RAW_ENCRYPT) {
+		BP_SET_CRYPT(bp, B_TRUE);
+		zio_crypt_encode_params_bp(bp, zp->zp_salt, zp->zp_iv);
+		zio_crypt_encode_mac_bp(bp, zp->zp_mac);
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	cabd = abd_alloc_sametype(zio->io_abd, psize);
+	ret = spa_do_crypt_abd(B_TRUE, zio->io_spa, &zio->io_bookmark, bp,
+	    psize, zio->io_abd, cabd);
+	if (ret != 0) {
+		abd_free(cabd);
+		zio->io_error = ret;
+		zio->io_pipeline = ZIO_INTERLOCK_PIPELINE;
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	zio_push_transform(zio, cabd, psize, psize, NULL);
+	return (ZIO_PIPELINE_CONTINUE);
+}
+
 static int
 zio_free_bp_init(zio_t *zio)
 {
@@ -1497,8 +1696,13 @@ zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 #ifdef __linux__
 	ASSERT(taskq_empty_ent(&zio->io_tqent));
 #endif
-	spa_taskq_dispatch_ent(spa, t, q, (task_func_t *)__zio_execute, zio,
-	    flags, &zio->io_tqent);
+	zio->io_taskq_type = t;
+	zio->io_taskq_q = q;
+	zio->io_taskq_idx = spa_taskq_select(spa, t, q, zio->io_issue_cpu);
+	zio->io_taskq_timestamp = gethrtime();
+	spa_zio_taskq_dispatched(spa, t, q);
+	spa_taskq_dispatch_ent_on(spa, t, q, zio->io_taskq_idx,
+	    (task_func_t *)__zio_execute, zio, flags, &zio->io_tqent);
 }
 
 static boolean_t
@@ -1601,6 +1805,29 @@ zio_delay_interrupt(zio_t *zio)
  */
 static zio_pipe_stage_t *zio_pipeline[];
 
+/*
+ * Called as the zio enters stage, or with ZIO_STAGE_OPEN once it is done:
+ * charge the time since it entered its previous stage to that stage.  A
+ * stage reentered after waiting for children keeps its clock running.
+ */
+static void
+zio_stage_time(zio_t *zio, enum zio_stage stage)
+{
+	hrtime_t now;
+
+	if (zio->io_stage_timestamp != 0 && stage == zio->io_timed_stage)
+		return;
+
+	now = gethrtime();
+	if (zio->io_stage_timestamp != 0 && zio->io_spa != NULL) {
+		spa_zio_stage_add(zio->io_spa,
+		    highbit64(zio->io_timed_stage) - 1,
+		    now - zio->io_stage_timestamp);
+	}
+	zio->io_stage_timestamp = now;
+	zio->io_timed_stage = stage;
+}
+
 /*
  * zio_execute() is a wrapper around the static function
  * __zio_execute() so that we can force  __zio_execute() to be
@@ -1623,6 +1850,15 @@ __zio_execute(zio_t *zio)
 
 	ASSERT3U(zio->io_queued_timestamp, >, 0);
 
+	/* Account the wait of a zio that zio_taskq_dispatch() queued */
+	if (zio->io_taskq_timestamp != 0) {
+		spa_taskq_started(zio->io_spa, zio->io_taskq_type,
+		    zio->io_taskq_q, zio->io_taskq_idx);
+		spa_zio_taskq_started(zio->io_spa, zio->io_taskq_type,
+		    zio->io_taskq_q, gethrtime() - zio->io_taskq_timestamp);
+		zio->io_taskq_timestamp = 0;
+	}
+
 	while (zio->io_stage < ZIO_STAGE_DONE) {
 		enum zio_stage pipeline = zio->io_pipeline;
 		enum zio_stage stage = zio->io_stage;
@@ -1677,6 +1913,11 @@ __zio_execute(zio_t *zio)
 #endif
 #endif
 
+		if (zio_stage_timing_enabled)
+			zio_stage_time(zio, stage);
+		else
+			zio->io_stage_timestamp = 0;
+
 		zio->io_stage = stage;
 		zio->io_pipeline_trace |= zio->io_stage;
 		rv = zio_pipeline[highbit64(stage) - 1](zio);
@@ -1940,26 +2181,38 @@ zio_resume_wait(spa_t *spa)
  * ==========================================================================
  */
 
+static void
+zio_gang_issue_func_done(zio_t *zio)
+{
+	abd_put(zio->io_abd);
+}
+
 static zio_t *
-zio_read_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_read_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	if (gn != NULL)
 		return (pio);
 
-	return (zio_read(pio, pio->io_spa, bp, data, BP_GET_PSIZE(bp),
-	    NULL, NULL, pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio),
-	    &pio->io_bookmark));
+	return (zio_read(pio, pio->io_spa, bp,
+	    abd_get_offset_size(data, offset, BP_GET_PSIZE(bp)),
+	    BP_GET_PSIZE(bp), zio_gang_issue_func_done, NULL,
+	    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark));
 }
 
 zio_t *
-zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	zio_t *zio;
 
 	if (gn != NULL) {
+		abd_t *gbh_abd =
+		    abd_get_from_buf(gn->gn_gbh, SPA_GANGBLOCKSIZE);
 		zio = zio_rewrite(pio, pio->io_spa, pio->io_txg, bp,
-		    gn->gn_gbh, SPA_GANGBLOCKSIZE, NULL, NULL, pio->io_priority,
-		    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
+		    gbh_abd, SPA_GANGBLOCKSIZE, zio_gang_issue_func_done, NULL,
+		    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio),
+		    &pio->io_bookmark);
 		/*
 		 * As we rewrite each gang header, the pipeline will compute
 		 * a new gang block header checksum for it; but no one will
@@ -1970,8 +2223,13 @@ zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 		 * this is just good hygiene.)
 		 */
 		if (gn != pio->io_gang_leader->io_gang_tree) {
+			abd_t *buf = abd_get_offset_size(data, offset,
+			    BP_GET_PSIZE(bp));
+
 			zio_checksum_compute(zio, BP_GET_CHECKSUM(bp),
-			    data, BP_GET_PSIZE(bp));
+			    buf, BP_GET_PSIZE(bp));
+
+			abd_put(buf);
 		}
 		/*
 		 * If we are here to damage data for testing purposes,
@@ -1981,8 +2239,10 @@ zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 			zio->io_pipeline &= ~ZIO_VDEV_IO_STAGES;
 	} else {
 		zio = zio_rewrite(pio, pio->io_spa, pio->io_txg, bp,
-		    data, BP_GET_PSIZE(bp), NULL, NULL, pio->io_priority,
-		    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
+		    abd_get_offset_size(data, offset, BP_GET_PSIZE(bp)),
+		    BP_GET_PSIZE(bp), zio_gang_issue_func_done, NULL,
+		    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio),
+		    &pio->io_bookmark);
 	}
 
 	return (zio);
@@ -1990,7 +2250,8 @@ zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 
 /* ARGSUSED */
 zio_t *
-zio_free_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_free_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	return (zio_free_sync(pio, pio->io_spa, pio->io_txg, bp,
 	    ZIO_GANG_CHILD_FLAGS(pio)));
@@ -1998,7 +2259,8 @@ zio_free_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 
 /* ARGSUSED */
 zio_t *
-zio_claim_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_claim_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	return (zio_claim(pio, pio->io_spa, pio->io_txg, bp,
 	    NULL, NULL, ZIO_GANG_CHILD_FLAGS(pio)));
@@ -2066,7 +2328,9 @@ zio_gang_tree_assemble(zio_t *gio, blkptr_t *bp, zio_gang_node_t **gnpp)
 	ASSERT(gio->io_gang_leader == gio);
 	ASSERT(BP_IS_GANG(bp));
 
-	zio_nowait(zio_read(gio, gio->io_spa, bp, gn->gn_gbh,
+	abd_t *gbh_abd = abd_get_from_buf(gn->gn_gbh, SPA_GANGBLOCKSIZE);
+
+	zio_nowait(zio_read(gio, gio->io_spa, bp, gbh_abd,
 	    SPA_GANGBLOCKSIZE, zio_gang_tree_assemble_done, gn,
 	    gio->io_priority, ZIO_GANG_CHILD_FLAGS(gio), &gio->io_bookmark));
 }
@@ -2082,13 +2346,16 @@ zio_gang_tree_assemble_done(zio_t *zio)
 	ASSERT(gio == zio_unique_parent(zio));
 	ASSERT(zio->io_child_count == 0);
 
-	if (zio->io_error)
+	if (zio->io_error) {
+		abd_put(zio->io_abd);
 		return;
+	}
 
+	/* this ABD was created from a linear buf in zio_gang_tree_assemble */
 	if (BP_SHOULD_BYTESWAP(bp))
-		byteswap_uint64_array(zio->io_data, zio->io_size);
+		byteswap_uint64_array(abd_to_buf(zio->io_abd), zio->io_size);
 
-	ASSERT(zio->io_data == gn->gn_gbh);
+	ASSERT3P(abd_to_buf(zio->io_abd), ==, gn->gn_gbh);
 	ASSERT(zio->io_size == SPA_GANGBLOCKSIZE);
 	ASSERT(gn->gn_gbh->zg_tail.zec_magic == ZEC_MAGIC);
 
@@ -2098,10 +2365,13 @@ zio_gang_tree_assemble_done(zio_t *zio)
 			continue;
 		zio_gang_tree_assemble(gio, gbp, &gn->gn_child[g]);
 	}
+
+	abd_put(zio->io_abd);
 }
 
 static void
-zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, void *data)
+zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, abd_t *data,
+    uint64_t offset)
 {
 	zio_t *gio = pio->io_gang_leader;
 	zio_t *zio;
@@ -2115,7 +2385,7 @@ zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, void *data)
 	 * If you're a gang header, your data is in gn->gn_gbh.
 	 * If you're a gang member, your data is in 'data' and gn == NULL.
 	 */
-	zio = zio_gang_issue_func[gio->io_type](pio, bp, gn, data);
+	zio = zio_gang_issue_func[gio->io_type](pio, bp, gn, data, offset);
 
 	if (gn != NULL) {
 		ASSERT(gn->gn_gbh->zg_tail.zec_magic == ZEC_MAGIC);
@@ -2124,13 +2394,14 @@ zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, void *data)
 			blkptr_t *gbp = &gn->gn_gbh->zg_blkptr[g];
 			if (BP_IS_HOLE(gbp))
 				continue;
-			zio_gang_tree_issue(zio, gn->gn_child[g], gbp, data);
-			data = (char *)data + BP_GET_PSIZE(gbp);
+			zio_gang_tree_issue(zio, gn->gn_child[g], gbp, data,
+			    offset);
+			offset += BP_GET_PSIZE(gbp);
 		}
 	}
 
 	if (gn == gio->io_gang_tree)
-		ASSERT3P((char *)gio->io_data + gio->io_size, ==, data);
+		ASSERT3U(gio->io_size, ==, offset);
 
 	if (zio != pio)
 		zio_nowait(zio);
@@ -2163,7 +2434,8 @@ zio_gang_issue(zio_t *zio)
 	ASSERT(zio->io_child_type > ZIO_CHILD_GANG);
 
 	if (zio->io_child_error[ZIO_CHILD_GANG] == 0)
-		zio_gang_tree_issue(zio, zio->io_gang_tree, bp, zio->io_data);
+		zio_gang_tree_issue(zio, zio->io_gang_tree, bp, zio->io_abd,
+		    0);
 	else
 		zio_gang_tree_free(&zio->io_gang_tree);
 
@@ -2203,6 +2475,12 @@ zio_write_gang_member_ready(zio_t *zio)
 	mutex_exit(&pio->io_lock);
 }
 
+static void
+zio_write_gang_done(zio_t *zio)
+{
+	abd_put(zio->io_abd);
+}
+
 static int
 zio_write_gang_block(zio_t *pio)
 {
@@ -2213,15 +2491,21 @@ zio_write_gang_block(zio_t *pio)
 	zio_t *zio;
 	zio_gang_node_t *gn, **gnpp;
 	zio_gbh_phys_t *gbh;
+	abd_t *gbh_abd;
 	uint64_t txg = pio->io_txg;
 	uint64_t resid = pio->io_size;
-	uint64_t lsize;
+	uint64_t lsize, maxsize;
 	int copies = gio->io_prop.zp_copies;
 	int gbh_copies = MIN(copies + 1, spa_max_replication(spa));
 	zio_prop_t zp;
 	int g, error;
 
 	int flags = METASLAB_HINTBP_FAVOR | METASLAB_GANG_HEADER;
+
+	/* the third DVA of an encrypted bp holds its salt and IV */
+	if (BP_IS_ENCRYPTED(bp))
+		gbh_copies = MIN(gbh_copies, SPA_DVAS_PER_BP - 1);
+
 	if (pio->io_flags & ZIO_FLAG_IO_ALLOCATING) {
 		ASSERT(pio->io_priority == ZIO_PRIORITY_ASYNC_WRITE);
 		ASSERT(!(pio->io_flags & ZIO_FLAG_NODATA));
@@ -2273,19 +2557,37 @@ zio_write_gang_block(zio_t *pio)
 	gn = zio_gang_node_alloc(gnpp);
 	gbh = gn->gn_gbh;
 	bzero(gbh, SPA_GANGBLOCKSIZE);
+	gbh_abd = abd_get_from_buf(gbh, SPA_GANGBLOCKSIZE);
 
 	/*
 	 * Create the gang header.
 	 */
-	zio = zio_rewrite(pio, spa, txg, bp, gbh, SPA_GANGBLOCKSIZE, NULL, NULL,
-	    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
+	zio = zio_rewrite(pio, spa, txg, bp, gbh_abd, SPA_GANGBLOCKSIZE,
+	    zio_write_gang_done, NULL, pio->io_priority,
+	    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
+
+	/*
+	 * If an equal split would still leave children bigger than any free
+	 * segment of the class, each of them would gang again and the tree
+	 * would end in a fan of tiny leaves.  Instead give each child the
+	 * largest size that is a power-of-three multiple of the biggest free
+	 * segment and still fits, leaving the remainder to the last child, so
+	 * that the subtrees below end in leaves of about that segment's size.
+	 */
+	maxsize = zio_gang_fit_enabled ? metaslab_class_maxsize(mc) : 0;
 
 	/*
 	 * Create and nowait the gang children.
 	 */
 	for (g = 0; resid != 0; resid -= lsize, g++) {
-		lsize = P2ROUNDUP(resid / (SPA_GBH_NBLKPTRS - g),
-		    SPA_MINBLOCKSIZE);
+		int slots = SPA_GBH_NBLKPTRS - g;
+
+		lsize = P2ROUNDUP(resid / slots, SPA_MINBLOCKSIZE);
+		if (maxsize != 0 && slots > 1 && lsize > maxsize) {
+			lsize = maxsize;
+			while (lsize * 3 * slots <= resid)
+				lsize *= 3;
+		}
 		ASSERT(lsize >= SPA_MINBLOCKSIZE && lsize <= resid);
 
 		zp.zp_checksum = gio->io_prop.zp_checksum;
@@ -2296,11 +2598,15 @@ zio_write_gang_block(zio_t *pio)
 		zp.zp_dedup = B_FALSE;
 		zp.zp_dedup_verify = B_FALSE;
 		zp.zp_nopwrite = B_FALSE;
+		zp.zp_encrypt = B_FALSE;
+		zp.zp_compress_streak = NULL;
+		zp.zp_special_smallblk = 0;
 
 		zio_t *cio = zio_write(zio, spa, txg, &gbh->zg_blkptr[g],
-		    (char *)pio->io_data + (pio->io_size - resid), lsize, lsize,
-		    &zp, zio_write_gang_member_ready, NULL, NULL, NULL,
-		    &gn->gn_child[g], pio->io_priority,
+		    abd_get_offset_size(pio->io_abd, pio->io_size - resid,
+		    lsize), lsize, lsize, &zp, zio_write_gang_member_ready,
+		    NULL, NULL, zio_write_gang_done, &gn->gn_child[g],
+		    pio->io_priority,
 		    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
 
 		if (pio->io_flags & ZIO_FLAG_IO_ALLOCATING) {
@@ -2406,6 +2712,30 @@ zio_nop_write(zio_t *zio)
  * Dedup
  * ==========================================================================
  */
+
+/*
+ * Looking a block up in the DDT is a synchronous read of a ZAP leaf when
+ * the entry is not already in memory, and the issue taskq thread running
+ * zio_ddt_write() or zio_ddt_free() waits for it.  Instead, start reading
+ * the leaf here and requeue the zio behind the others waiting in the
+ * taskq.  A batch of dedup writes, or the frees of an async destroy, then
+ * has all of its DDT reads in flight at once, and by the time each zio
+ * comes back around its leaf is usually in the ARC.
+ */
+static int
+zio_ddt_prefetch(zio_t *zio)
+{
+	ASSERT(BP_GET_DEDUP(zio->io_bp));
+	ASSERT(zio->io_child_type == ZIO_CHILD_LOGICAL);
+
+	if (!zio_ddt_prefetch_enabled ||
+	    !ddt_prefetch_entry(zio->io_spa, zio->io_bp))
+		return (ZIO_PIPELINE_CONTINUE);
+
+	zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
+
+	return (ZIO_PIPELINE_STOP);
+}
 static void
 zio_ddt_child_read_done(zio_t *zio)
 {
@@ -2418,10 +2748,10 @@ zio_ddt_child_read_done(zio_t *zio)
 	ddp = ddt_phys_select(dde, bp);
 	if (zio->io_error == 0)
 		ddt_phys_clear(ddp);	/* this ddp doesn't need repair */
-	if (zio->io_error == 0 && dde->dde_repair_data == NULL)
-		dde->dde_repair_data = zio->io_data;
+	if (zio->io_error == 0 && dde->dde_repair_abd == NULL)
+		dde->dde_repair_abd = zio->io_abd;
 	else
-		zio_buf_free(zio->io_data, zio->io_size);
+		abd_free(zio->io_abd);
 	mutex_exit(&pio->io_lock);
 }
 
@@ -2454,7 +2784,8 @@ zio_ddt_read_start(zio_t *zio)
 			ddt_bp_create(ddt->ddt_checksum, &dde->dde_key, ddp,
 			    &blk);
 			zio_nowait(zio_read(zio, zio->io_spa, &blk,
-			    zio_buf_alloc(zio->io_size), zio->io_size,
+			    abd_alloc_for_io(zio->io_size, B_TRUE),
+			    zio->io_size,
 			    zio_ddt_child_read_done, dde, zio->io_priority,
 			    ZIO_DDT_CHILD_FLAGS(zio) | ZIO_FLAG_DONT_PROPAGATE,
 			    &zio->io_bookmark));
@@ -2463,7 +2794,7 @@ zio_ddt_read_start(zio_t *zio)
 	}
 
 	zio_nowait(zio_read(zio, zio->io_spa, bp,
-	    zio->io_data, zio->io_size, NULL, NULL, zio->io_priority,
+	    zio->io_abd, zio->io_size, NULL, NULL, zio->io_priority,
 	    ZIO_DDT_CHILD_FLAGS(zio), &zio->io_bookmark));
 
 	return (ZIO_PIPELINE_CONTINUE);
@@ -2493,8 +2824,9 @@ zio_ddt_read_done(zio_t *zio)
 			zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
 			return (ZIO_PIPELINE_STOP);
 		}
-		if (dde->dde_repair_data != NULL) {
-			bcopy(dde->dde_repair_data, zio->io_data, zio->io_size);
+		if (dde->dde_repair_abd != NULL) {
+			abd_copy(zio->io_abd, dde->dde_repair_abd,
+			    zio->io_size);
 			zio->io_child_error[ZIO_CHILD_DDT] = 0;
 		}
 		ddt_repair_done(ddt, dde);
@@ -2527,7 +2859,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 
 		if (lio != NULL) {
 			return (lio->io_orig_size != zio->io_orig_size ||
-			    bcmp(zio->io_orig_data, lio->io_orig_data,
+			    abd_cmp(zio->io_orig_abd, lio->io_orig_abd,
 			    zio->io_orig_size) != 0);
 		}
 	}
@@ -2548,17 +2880,17 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 
 			/*
 			 * Intuitively, it would make more sense to compare
-			 * io_data than io_orig_data in the raw case since you
+			 * io_abd than io_orig_abd in the raw case since you
 			 * don't want to look at any transformations that have
 			 * happened to the data. However, for raw I/Os the
-			 * data will actually be the same in io_data and
-			 * io_orig_data, so all we have to do is issue this as
+			 * data will actually be the same in io_abd and
+			 * io_orig_abd, so all we have to do is issue this as
 			 * a raw ARC read.
 			 */
 			if (do_raw) {
 				zio_flags |= ZIO_FLAG_RAW;
 				ASSERT3U(zio->io_size, ==, zio->io_orig_size);
-				ASSERT0(bcmp(zio->io_data, zio->io_orig_data,
+				ASSERT0(abd_cmp(zio->io_abd, zio->io_orig_abd,
 				    zio->io_size));
 				ASSERT3P(zio->io_transform_stack, ==, NULL);
 			}
@@ -2569,7 +2901,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 
 			if (error == 0) {
 				if (arc_buf_size(abuf) != zio->io_orig_size ||
-				    bcmp(abuf->b_data, zio->io_orig_data,
+				    abd_cmp_buf(zio->io_orig_abd, abuf->b_data,
 				    zio->io_orig_size) != 0)
 					error = SET_ERROR(EEXIST);
 				arc_buf_destroy(abuf, &abuf);
@@ -2709,6 +3041,27 @@ zio_ddt_write(zio_t *zio)
 		return (ZIO_PIPELINE_CONTINUE);
 	}
 
+	/*
+	 * If the DDT has reached the pool's dedupquota, don't grow it any
+	 * further: a block which has no entry yet is written as an ordinary
+	 * block.  As above, an override bp is tossed and the write restarted.
+	 */
+	if (ddt_phys_total_refcnt(dde) == 0 &&
+	    dde->dde_lead_zio[p] == NULL && ddt_over_quota(spa)) {
+		if (zio->io_bp_override) {
+			zio_pop_transforms(zio);
+			zio->io_stage = ZIO_STAGE_OPEN;
+			zio->io_bp_override = NULL;
+			BP_ZERO(bp);
+		} else {
+			BP_SET_DEDUP(bp, B_FALSE);
+		}
+		zp->zp_dedup = B_FALSE;
+		zio->io_pipeline = ZIO_WRITE_PIPELINE;
+		ddt_exit(ddt);
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
 	ditto_copies = ddt_ditto_copies_needed(ddt, dde, ddp);
 	ASSERT(ditto_copies < SPA_DVAS_PER_BP);
 
@@ -2735,12 +3088,12 @@ zio_ddt_write(zio_t *zio)
 			return (ZIO_PIPELINE_CONTINUE);
 		}
 
-		dio = zio_write(zio, spa, txg, bp, zio->io_orig_data,
+		dio = zio_write(zio, spa, txg, bp, zio->io_orig_abd,
 		    zio->io_orig_size, zio->io_orig_size, &czp, NULL, NULL,
 		    NULL, zio_ddt_ditto_write_done, dde, zio->io_priority,
 		    ZIO_DDT_CHILD_FLAGS(zio), &zio->io_bookmark);
 
-		zio_push_transform(dio, zio->io_data, zio->io_size, 0, NULL);
+		zio_push_transform(dio, zio->io_abd, zio->io_size, 0, NULL);
 		dde->dde_lead_zio[DDT_PHYS_DITTO] = dio;
 	}
 
@@ -2757,13 +3110,13 @@ zio_ddt_write(zio_t *zio)
 		ddt_phys_fill(ddp, bp);
 		ddt_phys_addref(ddp);
 	} else {
-		cio = zio_write(zio, spa, txg, bp, zio->io_orig_data,
+		cio = zio_write(zio, spa, txg, bp, zio->io_orig_abd,
 		    zio->io_orig_size, zio->io_orig_size, zp,
 		    zio_ddt_child_write_ready, NULL, NULL,
 		    zio_ddt_child_write_done, dde, zio->io_priority,
 		    ZIO_DDT_CHILD_FLAGS(zio), &zio->io_bookmark);
 
-		zio_push_transform(cio, zio->io_data, zio->io_size, 0, NULL);
+		zio_push_transform(cio, zio->io_abd, zio->io_size, 0, NULL);
 		dde->dde_lead_zio[p] = cio;
 	}
 
@@ -2798,6 +3151,24 @@ zio_ddt_free(zio_t *zio)
 		if (ddp)
 			ddt_phys_decref(ddp);
 	}
+
+	/*
+	 * A block whose unique entry was pruned has none; it is not shared,
+	 * so free it directly.
+	 */
+	if (dde != NULL && ddt_pruned(spa)) {
+		int p;
+
+		for (p = 0; p < DDT_PHYS_TYPES; p++) {
+			if (dde->dde_phys[p].ddp_phys_birth != 0)
+				break;
+		}
+		if (p == DDT_PHYS_TYPES) {
+			zio->io_pipeline = ZIO_FREE_PIPELINE;
+			if (BP_IS_GANG(bp))
+				zio->io_pipeline |= ZIO_GANG_STAGES;
+		}
+	}
 	ddt_exit(ddt);
 
 	return (ZIO_PIPELINE_CONTINUE);
@@ -2901,7 +3272,7 @@ static int
 zio_dva_allocate(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
-	metaslab_class_t *mc = spa_normal_class(spa);
+	metaslab_class_t *mc;
 	blkptr_t *bp = zio->io_bp;
 	int error;
 	int flags = 0;
@@ -2930,16 +3301,39 @@ zio_dva_allocate(zio_t *zio)
 		flags |= METASLAB_FASTWRITE;
 	}
 
+	/*
+	 * Dedup tables are allocated from the dedup class, and other
+	 * metadata and file data blocks no larger than the dataset's
+	 * special_small_blocks from the special class, when the pool has
+	 * them (see spa_preferred_class()).  Once those vdevs are full the
+	 * block spills back to the normal class, which also handles any
+	 * ganging.  The throttle reservation is always held against the
+	 * normal class.
+	 */
+	mc = spa_preferred_class(spa, zio->io_size, zio->io_prop.zp_type,
+	    zio->io_prop.zp_level, zio->io_prop.zp_special_smallblk);
 	error = metaslab_alloc(spa, mc, zio->io_size, bp,
 	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
 	    &zio->io_alloc_list, zio);
 
+	if (error != 0 && mc != spa_normal_class(spa)) {
+		mc = spa_normal_class(spa);
+		error = metaslab_alloc(spa, mc, zio->io_size, bp,
+		    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
+		    &zio->io_alloc_list, zio);
+	}
+
 	if (error != 0) {
 		spa_dbgmsg(spa, "%s: metaslab allocation failure: zio %p, "
 		    "size %llu, error %d", spa_name(spa), zio, zio->io_size,
 		    error);
-		if (error == ENOSPC && zio->io_size > SPA_MINBLOCKSIZE)
+		if (error == ENOSPC && zio->io_size > SPA_MINBLOCKSIZE) {
+			spa_fragmentation_gang_add(spa, zio->io_size,
+			    metaslab_class_get_space(mc) -
+			    metaslab_class_get_alloc(mc) >
+			    spa_get_slop_space(spa));
 			return (zio_write_gang_block(zio));
+		}
 		zio->io_error = error;
 	}
 
@@ -3012,8 +3406,8 @@ zio_alloc_zil(spa_t *spa, uint64_t txg, blkptr_t *new_bp, blkptr_t *old_bp,
 
 	if (error) {
 		error = metaslab_alloc(spa, spa_normal_class(spa), size,
-		    new_bp, 1, txg, old_bp, METASLAB_HINTBP_AVOID,
-		    &io_alloc_list, NULL);
+		    new_bp, 1, txg, old_bp,
+		    METASLAB_HINTBP_AVOID | METASLAB_ZIL, &io_alloc_list, NULL);
 	}
 	metaslab_trace_fini(&io_alloc_list);
 
@@ -3113,11 +3507,11 @@ zio_vdev_io_start(zio_t *zio)
 	    P2PHASE(zio->io_size, align) != 0) {
 		/* Transform logical writes to be a full physical block size. */
 		uint64_t asize = P2ROUNDUP(zio->io_size, align);
-		char *abuf = zio_buf_alloc(asize);
+		abd_t *abuf = abd_alloc_sametype(zio->io_abd, asize);
 		ASSERT(vd == vd->vdev_top);
 		if (zio->io_type == ZIO_TYPE_WRITE) {
-			bcopy(zio->io_data, abuf, zio->io_size);
-			bzero(abuf + zio->io_size, asize - zio->io_size);
+			abd_copy(abuf, zio->io_abd, zio->io_size);
+			abd_zero_off(abuf, zio->io_size, asize - zio->io_size);
 		}
 		zio_push_transform(zio, abuf, asize, asize, zio_subblock);
 	}
@@ -3247,7 +3641,7 @@ zio_vsd_default_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *ignored)
 {
 	void *buf = zio_buf_alloc(zio->io_size);
 
-	bcopy(zio->io_data, buf, zio->io_size);
+	abd_copy_to_buf(buf, zio->io_abd, zio->io_size);
 
 	zcr->zcr_cbinfo = zio->io_size;
 	zcr->zcr_cbdata = buf;
@@ -3320,6 +3714,12 @@ zio_vdev_io_assess(zio_t *zio)
 	    zio->io_cmd == DKIOCFLUSHWRITECACHE && vd != NULL)
 		vd->vdev_nowritecache = B_TRUE;
 
+	/* Likewise for devices that cannot unmap. */
+	if ((zio->io_error == ENOTSUP || zio->io_error == ENOTTY) &&
+	    zio->io_type == ZIO_TYPE_IOCTL &&
+	    zio->io_cmd == DKIOCFREE && vd != NULL)
+		vd->vdev_notrim = B_TRUE;
+
 	if (zio->io_error)
 		zio->io_pipeline = ZIO_INTERLOCK_PIPELINE;
 
@@ -3391,13 +3791,13 @@ zio_checksum_generate(zio_t *zio)
 		}
 	}
 
-	zio_checksum_compute(zio, checksum, zio->io_data, zio->io_size);
+	zio_checksum_compute(zio, checksum, zio->io_abd, zio->io_size);
 
 	return (ZIO_PIPELINE_CONTINUE);
 }
 
-static int
-zio_checksum_verify(zio_t *zio)
+static void
+zio_checksum_verify_impl(zio_t *zio)
 {
 	zio_bad_cksum_t info;
 	blkptr_t *bp = zio->io_bp;
@@ -3411,7 +3811,7 @@ zio_checksum_verify(zio_t *zio)
 		 * We're either verifying a label checksum, or nothing at all.
 		 */
 		if (zio->io_prop.zp_checksum == ZIO_CHECKSUM_OFF)
-			return (ZIO_PIPELINE_CONTINUE);
+			return;
 
 		ASSERT(zio->io_prop.zp_checksum == ZIO_CHECKSUM_LABEL);
 	}
@@ -3425,10 +3825,122 @@ zio_checksum_verify(zio_t *zio)
 			    zio->io_size, NULL, &info);
 		}
 	}
+}
+
+/*
+ * Verify the queued scan reads in batches of zio_scan_verify_batch, then
+ * send each one on down its pipeline, until the queue is empty.
+ */
+static void
+zio_scan_verify_drain(void *arg)
+{
+	spa_t *spa = arg;
+	zio_t *batch[ZIO_SCAN_VERIFY_BATCH_MAX];
+	uint_t n, i, max;
+
+	max = MAX(1, MIN(zio_scan_verify_batch, ZIO_SCAN_VERIFY_BATCH_MAX));
+
+	mutex_enter(&spa->spa_scan_verify_lock);
+	for (;;) {
+		for (n = 0; n < max; n++) {
+			batch[n] = list_remove_head(&spa->spa_scan_verify_list);
+			if (batch[n] == NULL)
+				break;
+		}
+		if (n == 0)
+			break;
+		mutex_exit(&spa->spa_scan_verify_lock);
+
+		for (i = 0; i < n; i++)
+			zio_checksum_verify_impl(batch[i]);
+		for (i = 0; i < n; i++)
+			zio_execute(batch[i]);
+
+		mutex_enter(&spa->spa_scan_verify_lock);
+	}
+	ASSERT3U(spa->spa_scan_verify_active, >, 0);
+	spa->spa_scan_verify_active--;
+	mutex_exit(&spa->spa_scan_verify_lock);
+}
+
+/*
+ * Queue a scrub or resilver read for zio_scan_verify_drain(), starting
+ * another drain task if the taskq has an idle thread.  If the task can't
+ * be dispatched we drain the queue ourselves, as we would have verified
+ * the read inline anyway.
+ */
+static boolean_t
+zio_scan_verify(zio_t *zio)
+{
+	spa_t *spa = zio->io_spa;
+	boolean_t dispatch = B_FALSE;
+
+	if (spa->spa_scan_verify_taskq == NULL || zio->io_bp == NULL ||
+	    zio->io_child_type != ZIO_CHILD_LOGICAL ||
+	    !(zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER)))
+		return (B_FALSE);
+
+	mutex_enter(&spa->spa_scan_verify_lock);
+	list_insert_tail(&spa->spa_scan_verify_list, zio);
+	if (spa->spa_scan_verify_active < spa->spa_scan_verify_threads) {
+		spa->spa_scan_verify_active++;
+		dispatch = B_TRUE;
+	}
+	mutex_exit(&spa->spa_scan_verify_lock);
+
+	if (dispatch && taskq_dispatch(spa->spa_scan_verify_taskq,
+	    zio_scan_verify_drain, spa, TQ_NOSLEEP) == 0)
+		zio_scan_verify_drain(spa);
+
+	return (B_TRUE);
+}
+
+static int
+zio_checksum_verify(zio_t *zio)
+{
+	if (zio_scan_verify(zio))
+		return (ZIO_PIPELINE_STOP);
+
+	zio_checksum_verify_impl(zio);
 
 	return (ZIO_PIPELINE_CONTINUE);
 }
 
+void
+zio_scan_verify_init(spa_t *spa)
+{
+	uint_t threads;
+
+	mutex_init(&spa->spa_scan_verify_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&spa->spa_scan_verify_list, sizeof (zio_t),
+	    offsetof(zio_t, io_verify_node));
+	spa->spa_scan_verify_active = 0;
+	spa->spa_scan_verify_threads = 0;
+	spa->spa_scan_verify_taskq = NULL;
+
+	if (zio_scan_verify_pct == 0)
+		return;
+
+	threads = MAX(1, MIN(zio_scan_verify_pct, 100) * max_ncpus / 100);
+	spa->spa_scan_verify_threads = threads;
+	spa->spa_scan_verify_taskq = taskq_create("z_scan_verify", threads,
+	    minclsyspri, threads, INT_MAX, TASKQ_PREPOPULATE);
+}
+
+void
+zio_scan_verify_fini(spa_t *spa)
+{
+	if (spa->spa_scan_verify_taskq != NULL) {
+		taskq_wait(spa->spa_scan_verify_taskq);
+		taskq_destroy(spa->spa_scan_verify_taskq);
+		spa->spa_scan_verify_taskq = NULL;
+	}
+
+	ASSERT0(spa->spa_scan_verify_active);
+	list_destroy(&spa->spa_scan_verify_list);
+	mutex_destroy(&spa->spa_scan_verify_lock);
+}
+
 /*
  * Called by RAID-Z to ensure we don't compute the checksum twice.
  */
@@ -3530,7 +4042,7 @@ zio_ready(zio_t *zio)
 		if (BP_IS_GANG(bp)) {
 			zio->io_flags &= ~ZIO_FLAG_NODATA;
 		} else {
-			ASSERT((uintptr_t)zio->io_data < SPA_MAXBLOCKSIZE);
+			ASSERT((uintptr_t)zio->io_abd < SPA_MAXBLOCKSIZE);
 			zio->io_pipeline &= ~ZIO_VDEV_IO_STAGES;
 		}
 	}
@@ -3687,21 +4199,27 @@ zio_done(zio_t *zio)
 			zio_cksum_report_t *zcr = zio->io_cksum_report;
 			uint64_t align = zcr->zcr_align;
 			uint64_t asize = P2ROUNDUP(zio->io_size, align);
-			char *abuf = zio->io_data;
+			abd_t *adata = zio->io_abd;
+			void *abuf;
 
 			if (asize != zio->io_size) {
-				abuf = zio_buf_alloc(asize);
-				bcopy(zio->io_data, abuf, zio->io_size);
-				bzero(abuf+zio->io_size, asize-zio->io_size);
+				adata = abd_alloc_linear(asize, B_TRUE);
+				abd_copy(adata, zio->io_abd, zio->io_size);
+				abd_zero_off(adata, zio->io_size,
+				    asize - zio->io_size);
 			}
 
+			abuf = abd_borrow_buf_copy(adata, asize);
+
 			zio->io_cksum_report = zcr->zcr_next;
 			zcr->zcr_next = NULL;
 			zcr->zcr_finish(zcr, abuf);
 			zfs_ereport_free_checksum(zcr);
 
+			abd_return_buf(adata, abuf, asize);
+
 			if (asize != zio->io_size)
-				zio_buf_free(abuf, asize);
+				abd_free(adata);
 		}
 	}
 
@@ -3904,9 +4422,13 @@ zio_done(zio_t *zio)
 	 * particular zio is no longer discoverable for adoption, and as
 	 * such, cannot acquire any new parents.
 	 */
+	DTRACE_PROBE1(zio__done, zio_t *, zio);
 	if (zio->io_done)
 		zio->io_done(zio);
 
+	if (zio->io_stage_timestamp != 0 && zio_stage_timing_enabled)
+		zio_stage_time(zio, ZIO_STAGE_OPEN);
+
 	mutex_enter(&zio->io_lock);
 	zio->io_state[ZIO_WAIT_DONE] = 1;
 	mutex_exit(&zio->io_lock);
@@ -3942,8 +4464,10 @@ static zio_pipe_stage_t *zio_pipeline[] = {
 	zio_free_bp_init,
 	zio_issue_async,
 	zio_write_compress,
+	zio_encrypt,
 	zio_checksum_generate,
 	zio_nop_write,
+	zio_ddt_prefetch,
 	zio_ddt_read_start,
 	zio_ddt_read_done,
 	zio_ddt_write,
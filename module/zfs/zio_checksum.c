@@ -30,6 +30,7 @@
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/zil.h>
+#include <sys/abd.h>
 #include <zfs_fletcher.h>
 
 /*
@@ -92,12 +93,105 @@
 
 /*ARGSUSED*/
 static void
-zio_checksum_off(const void *buf, uint64_t size,
+zio_checksum_off(abd_t *abd, uint64_t size,
 	const void *ctx_template, zio_cksum_t *zcp)
 {
 	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
 }
 
+/*
+ * The fletcher implementations in zcommon work on linear buffers, which
+ * is what libzfs needs.  These wrappers feed them an ABD a chunk at a time
+ * through their incremental forms.
+ */
+static int
+fletcher_2_incremental_native_cb(void *buf, size_t size, void *arg)
+{
+	fletcher_2_incremental_native(buf, size, arg);
+	return (0);
+}
+
+static int
+fletcher_2_incremental_byteswap_cb(void *buf, size_t size, void *arg)
+{
+	fletcher_2_incremental_byteswap(buf, size, arg);
+	return (0);
+}
+
+static int
+fletcher_4_incremental_native_cb(void *buf, size_t size, void *arg)
+{
+	fletcher_4_incremental_native(buf, size, arg);
+	return (0);
+}
+
+static int
+fletcher_4_incremental_byteswap_cb(void *buf, size_t size, void *arg)
+{
+	fletcher_4_incremental_byteswap(buf, size, arg);
+	return (0);
+}
+
+/*ARGSUSED*/
+void
+abd_fletcher_2_native(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	if (abd_is_linear(abd)) {
+		fletcher_2_native(abd_to_buf(abd), size, ctx_template, zcp);
+		return;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size,
+	    fletcher_2_incremental_native_cb, zcp);
+}
+
+/*ARGSUSED*/
+void
+abd_fletcher_2_byteswap(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	if (abd_is_linear(abd)) {
+		fletcher_2_byteswap(abd_to_buf(abd), size, ctx_template, zcp);
+		return;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size,
+	    fletcher_2_incremental_byteswap_cb, zcp);
+}
+
+/*ARGSUSED*/
+void
+abd_fletcher_4_native(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	if (abd_is_linear(abd)) {
+		fletcher_4_native(abd_to_buf(abd), size, ctx_template, zcp);
+		return;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size,
+	    fletcher_4_incremental_native_cb, zcp);
+}
+
+/*ARGSUSED*/
+void
+abd_fletcher_4_byteswap(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	if (abd_is_linear(abd)) {
+		fletcher_4_byteswap(abd_to_buf(abd), size, ctx_template, zcp);
+		return;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size,
+	    fletcher_4_incremental_byteswap_cb, zcp);
+}
+
 zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	{{NULL, NULL}, NULL, NULL, 0, "inherit"},
 	{{NULL, NULL}, NULL, NULL, 0, "on"},
@@ -109,16 +203,16 @@ zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	{{zio_checksum_SHA256,		zio_checksum_SHA256},
 	    NULL, NULL, ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_EMBEDDED,
 	    "gang_header"},
-	{{fletcher_2_native,		fletcher_2_byteswap},
+	{{abd_fletcher_2_native,	abd_fletcher_2_byteswap},
 	    NULL, NULL, ZCHECKSUM_FLAG_EMBEDDED, "zilog"},
-	{{fletcher_2_native,		fletcher_2_byteswap},
+	{{abd_fletcher_2_native,	abd_fletcher_2_byteswap},
 	    NULL, NULL, 0, "fletcher2"},
-	{{fletcher_4_native,		fletcher_4_byteswap},
+	{{abd_fletcher_4_native,	abd_fletcher_4_byteswap},
 	    NULL, NULL, ZCHECKSUM_FLAG_METADATA, "fletcher4"},
 	{{zio_checksum_SHA256,		zio_checksum_SHA256},
 	    NULL, NULL, ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
 	    ZCHECKSUM_FLAG_NOPWRITE, "sha256"},
-	{{fletcher_4_native,		fletcher_4_byteswap},
+	{{abd_fletcher_4_native,	abd_fletcher_4_byteswap},
 	    NULL, NULL, ZCHECKSUM_FLAG_EMBEDDED, "zilog2"},
 	{{zio_checksum_off,		zio_checksum_off},
 	    NULL, NULL, 0, "noparity"},
@@ -252,7 +346,7 @@ zio_checksum_template_init(enum zio_checksum checksum, spa_t *spa)
  */
 void
 zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
-	void *data, uint64_t size)
+	abd_t *abd, uint64_t size)
 {
 	blkptr_t *bp = zio->io_bp;
 	uint64_t offset = zio->io_offset;
@@ -267,6 +361,8 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 
 	if (ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED) {
 		zio_eck_t *eck;
+		/* embedded checksums only ever cover linear buffers */
+		void *data = abd_to_buf(abd);
 
 		if (checksum == ZIO_CHECKSUM_ZILOG2) {
 			zil_chain_t *zilc = data;
@@ -284,21 +380,31 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 		else
 			bp->blk_cksum = eck->zec_cksum;
 		eck->zec_magic = ZEC_MAGIC;
-		ci->ci_func[0](data, size, spa->spa_cksum_tmpls[checksum],
+		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
 			&cksum);
 		eck->zec_cksum = cksum;
+	} else if (BP_IS_ENCRYPTED(bp)) {
+		/*
+		 * The second half of the checksum of an encrypted block
+		 * holds its MAC (see spa.h), which must be left alone.
+		 */
+		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
+		    &cksum);
+		bp->blk_cksum.zc_word[0] = cksum.zc_word[0];
+		bp->blk_cksum.zc_word[1] = cksum.zc_word[1];
 	} else {
-		ci->ci_func[0](data, size, spa->spa_cksum_tmpls[checksum],
+		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
 		    &bp->blk_cksum);
 	}
 }
 
 int
 zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
-    void *data, uint64_t size, uint64_t offset, zio_bad_cksum_t *info)
+    abd_t *abd, uint64_t size, uint64_t offset, zio_bad_cksum_t *info)
 {
 	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
 	zio_cksum_t actual_cksum, expected_cksum;
+	boolean_t encrypted = B_FALSE;
 	int byteswap;
 
 	if (checksum >= ZIO_CHECKSUM_FUNCTIONS || ci->ci_func[0] == NULL)
@@ -307,18 +413,24 @@ zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
 	zio_checksum_template_init(checksum, spa);
 
 	if (ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED) {
-		zio_eck_t *eck;
+		zio_eck_t eck;
 		zio_cksum_t verifier;
+		size_t eck_offset;
 
 		if (checksum == ZIO_CHECKSUM_ZILOG2) {
-			zil_chain_t *zilc = data;
+			zil_chain_t zilc;
 			uint64_t nused;
 
-			eck = &zilc->zc_eck;
-			if (eck->zec_magic == ZEC_MAGIC)
-				nused = zilc->zc_nused;
-			else if (eck->zec_magic == BSWAP_64(ZEC_MAGIC))
-				nused = BSWAP_64(zilc->zc_nused);
+			abd_copy_to_buf(&zilc, abd, sizeof (zil_chain_t));
+
+			eck = zilc.zc_eck;
+			eck_offset = offsetof(zil_chain_t, zc_eck) +
+			    offsetof(zio_eck_t, zec_cksum);
+
+			if (eck.zec_magic == ZEC_MAGIC)
+				nused = zilc.zc_nused;
+			else if (eck.zec_magic == BSWAP_64(ZEC_MAGIC))
+				nused = BSWAP_64(zilc.zc_nused);
 			else
 				return (SET_ERROR(ECKSUM));
 
@@ -327,7 +439,10 @@ zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
 
 			size = P2ROUNDUP_TYPED(nused, ZIL_MIN_BLKSZ, uint64_t);
 		} else {
-			eck = (zio_eck_t *)((char *)data + size) - 1;
+			eck_offset = size - sizeof (zio_eck_t);
+			abd_copy_to_buf_off(&eck, abd, eck_offset,
+			    sizeof (zio_eck_t));
+			eck_offset += offsetof(zio_eck_t, zec_cksum);
 		}
 
 		if (checksum == ZIO_CHECKSUM_GANG_HEADER)
@@ -337,16 +452,21 @@ zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
 		else
 			verifier = bp->blk_cksum;
 
-		byteswap = (eck->zec_magic == BSWAP_64(ZEC_MAGIC));
+		byteswap = (eck.zec_magic == BSWAP_64(ZEC_MAGIC));
 
 		if (byteswap)
 			byteswap_uint64_array(&verifier, sizeof (zio_cksum_t));
 
-		expected_cksum = eck->zec_cksum;
-		eck->zec_cksum = verifier;
-		ci->ci_func[byteswap](data, size,
+		expected_cksum = eck.zec_cksum;
+
+		abd_copy_from_buf_off(abd, &verifier, eck_offset,
+		    sizeof (zio_cksum_t));
+
+		ci->ci_func[byteswap](abd, size,
 		    spa->spa_cksum_tmpls[checksum], &actual_cksum);
-		eck->zec_cksum = expected_cksum;
+
+		abd_copy_from_buf_off(abd, &expected_cksum, eck_offset,
+		    sizeof (zio_cksum_t));
 
 		if (byteswap) {
 			byteswap_uint64_array(&expected_cksum,
@@ -354,8 +474,9 @@ zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
 		}
 	} else {
 		byteswap = BP_SHOULD_BYTESWAP(bp);
+		encrypted = BP_IS_ENCRYPTED(bp);
 		expected_cksum = bp->blk_cksum;
-		ci->ci_func[byteswap](data, size,
+		ci->ci_func[byteswap](abd, size,
 		    spa->spa_cksum_tmpls[checksum], &actual_cksum);
 	}
 
@@ -368,8 +489,12 @@ zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
 		info->zbc_has_cksum = 1;
 	}
 
-	if (!ZIO_CHECKSUM_EQUAL(actual_cksum, expected_cksum))
+	if (encrypted) {
+		if (!ZIO_CHECKSUM_MAC_EQUAL(actual_cksum, expected_cksum))
+			return (SET_ERROR(ECKSUM));
+	} else if (!ZIO_CHECKSUM_EQUAL(actual_cksum, expected_cksum)) {
 		return (SET_ERROR(ECKSUM));
+	}
 
 	return (0);
 }
@@ -384,10 +509,9 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 	uint64_t size = (bp == NULL ? zio->io_size :
 	    (BP_IS_GANG(bp) ? SPA_GANGBLOCKSIZE : BP_GET_PSIZE(bp)));
 	uint64_t offset = zio->io_offset;
-	void *data = zio->io_data;
 	spa_t *spa = zio->io_spa;
 
-	error = zio_checksum_error_impl(spa, bp, checksum, data, size,
+	error = zio_checksum_error_impl(spa, bp, checksum, zio->io_abd, size,
 	    offset, info);
 	if (error != 0 && zio_injection_enabled && !zio->io_error &&
 	    (error = zio_handle_fault_injection(zio, ECKSUM)) != 0) {
@@ -37,6 +37,25 @@
 #include <sys/zfeature.h>
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
+#include <sys/abd.h>
+
+/*
+ * Early abort of compression for incompressible data.
+ *
+ * Before running one of the expensive compressors (gzip, zstd) on a block,
+ * compress a ZIO_COMPRESS_PROBE_SIZE sample from the middle of it with lz4.
+ * If lz4 cannot save 12.5% on the sample the block is written uncompressed.
+ *
+ * In addition, each objset counts how many of its data blocks in a row
+ * failed to compress.  Once that streak reaches zfs_compress_abort_streak
+ * only every zfs_compress_abort_retry'th block is tried, so that a change
+ * in the data is still noticed.
+ */
+int zfs_compress_early_abort = 1;
+int zfs_compress_abort_streak = 16;
+int zfs_compress_abort_retry = 8;
+
+#define	ZIO_COMPRESS_PROBE_SIZE	4096
 
 /*
  * Compression vectors.
@@ -59,8 +78,36 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{gzip_compress,		gzip_decompress,	9,	"gzip-9"},
 	{zle_compress,		zle_decompress,		64,	"zle"},
 	{lz4_compress_zfs,	lz4_decompress_zfs,	0,	"lz4"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	1,	"zstd-1"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	2,	"zstd-2"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	3,	"zstd-3"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	4,	"zstd-4"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	5,	"zstd-5"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	6,	"zstd-6"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	7,	"zstd-7"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	8,	"zstd-8"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	9,	"zstd-9"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	10,	"zstd-10"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	11,	"zstd-11"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	12,	"zstd-12"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	13,	"zstd-13"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	14,	"zstd-14"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	15,	"zstd-15"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	16,	"zstd-16"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	17,	"zstd-17"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	18,	"zstd-18"},
+	{zstd_compress_zfs,	zstd_decompress_zfs,	19,	"zstd-19"},
 };
 
+spa_feature_t
+zio_compress_to_feature(enum zio_compress c)
+{
+	if (ZIO_COMPRESS_IS_ZSTD(c))
+		return (SPA_FEATURE_ZSTD_COMPRESS);
+
+	return (SPA_FEATURE_NONE);
+}
+
 enum zio_compress
 zio_compress_select(spa_t *spa, enum zio_compress child,
     enum zio_compress parent)
@@ -85,44 +132,155 @@ zio_compress_select(spa_t *spa, enum zio_compress child,
 	return (result);
 }
 
-size_t
-zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
+/*ARGSUSED*/
+static int
+zio_compress_zeroed_cb(void *data, size_t len, void *private)
+{
+	uint64_t *end = (uint64_t *)((char *)data + len);
+	uint64_t *word;
+
+	for (word = data; word < end; word++)
+		if (*word != 0)
+			return (1);
+
+	return (0);
+}
+
+static boolean_t
+zio_compress_is_expensive(enum zio_compress c)
+{
+	return ((c >= ZIO_COMPRESS_GZIP_1 && c <= ZIO_COMPRESS_GZIP_9) ||
+	    ZIO_COMPRESS_IS_ZSTD(c));
+}
+
+/*
+ * Returns B_TRUE if an lz4 pass over a sample of the block suggests it
+ * won't compress.
+ */
+static boolean_t
+zio_compress_probe_fails(abd_t *src, size_t s_len)
+{
+	size_t p_len = ZIO_COMPRESS_PROBE_SIZE;
+	size_t c_len;
+	void *sample, *cbuf;
+
+	sample = zio_buf_alloc(p_len);
+	cbuf = zio_buf_alloc(p_len);
+
+	abd_copy_to_buf_off(sample, src, P2ALIGN(s_len / 2, p_len), p_len);
+	c_len = lz4_compress_zfs(sample, cbuf, p_len, p_len - (p_len >> 3), 0);
+
+	zio_buf_free(cbuf, p_len);
+	zio_buf_free(sample, p_len);
+
+	return (c_len > p_len - (p_len >> 3));
+}
+
+static size_t
+zio_compress_data_impl(enum zio_compress c, abd_t *src, void *dst,
+    size_t s_len)
 {
-	uint64_t *word, *word_end;
 	size_t c_len, d_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
+	void *tmp;
+
+	/* Compress at least 12.5% */
+	d_len = s_len - (s_len >> 3);
+
+	/* No compression algorithms can read from ABDs directly */
+	tmp = abd_borrow_buf_copy(src, s_len);
+	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
+	abd_return_buf(src, tmp, s_len);
+
+	if (c_len > d_len)
+		return (s_len);
+
+	ASSERT3U(c_len, <=, d_len);
+	return (c_len);
+}
 
+size_t
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
+{
 	ASSERT((uint_t)c < ZIO_COMPRESS_FUNCTIONS);
-	ASSERT((uint_t)c == ZIO_COMPRESS_EMPTY || ci->ci_compress != NULL);
+	ASSERT((uint_t)c == ZIO_COMPRESS_EMPTY ||
+	    zio_compress_table[c].ci_compress != NULL);
 
 	/*
 	 * If the data is all zeroes, we don't even need to allocate
 	 * a block for it.  We indicate this by returning zero size.
 	 */
-	word_end = (uint64_t *)((char *)src + s_len);
-	for (word = src; word < word_end; word++)
-		if (*word != 0)
-			break;
-
-	if (word == word_end)
+	if (abd_iterate_func(src, 0, s_len, zio_compress_zeroed_cb, NULL) == 0)
 		return (0);
 
 	if (c == ZIO_COMPRESS_EMPTY)
 		return (s_len);
 
-	/* Compress at least 12.5% */
-	d_len = s_len - (s_len >> 3);
-	c_len = ci->ci_compress(src, dst, s_len, d_len, ci->ci_level);
+	return (zio_compress_data_impl(c, src, dst, s_len));
+}
 
-	if (c_len > d_len)
+/*
+ * Compress data for a write, consulting the early abort heuristic.  The
+ * streak counter belongs to the objset being written; it is NULL for
+ * metadata and dedup writes, whose streaks are not tracked.  Returns
+ * s_len if the data should be written uncompressed.
+ */
+size_t
+zio_compress_data_adaptive(spa_t *spa, uint32_t *streak,
+    enum zio_compress c, abd_t *src, void *dst, size_t s_len)
+{
+	size_t c_len;
+
+	if (!zfs_compress_early_abort)
+		return (zio_compress_data(c, src, dst, s_len));
+
+	ASSERT((uint_t)c < ZIO_COMPRESS_FUNCTIONS);
+	ASSERT((uint_t)c == ZIO_COMPRESS_EMPTY ||
+	    zio_compress_table[c].ci_compress != NULL);
+
+	/* Zero-filled blocks are still worth finding, they become holes. */
+	if (abd_iterate_func(src, 0, s_len, zio_compress_zeroed_cb, NULL) == 0)
+		return (0);
+
+	if (c == ZIO_COMPRESS_EMPTY)
 		return (s_len);
 
-	ASSERT3U(c_len, <=, d_len);
+	if (streak != NULL && zfs_compress_abort_streak > 0 &&
+	    *streak >= zfs_compress_abort_streak &&
+	    (zfs_compress_abort_retry <= 0 ||
+	    (*streak - zfs_compress_abort_streak) %
+	    zfs_compress_abort_retry != 0)) {
+		atomic_inc_32(streak);
+		spa_compress_abort_add(spa, SPA_COMPRESS_ABORT_STREAK);
+		return (s_len);
+	}
+
+	if (zio_compress_is_expensive(c) &&
+	    s_len >= 2 * ZIO_COMPRESS_PROBE_SIZE) {
+		spa_compress_abort_add(spa, SPA_COMPRESS_ABORT_PROBES);
+		if (zio_compress_probe_fails(src, s_len)) {
+			if (streak != NULL)
+				atomic_inc_32(streak);
+			spa_compress_abort_add(spa, SPA_COMPRESS_ABORT_PROBE);
+			return (s_len);
+		}
+	}
+
+	c_len = zio_compress_data_impl(c, src, dst, s_len);
+
+	if (c_len == s_len) {
+		if (streak != NULL)
+			atomic_inc_32(streak);
+		spa_compress_abort_add(spa, SPA_COMPRESS_ABORT_WASTED);
+	} else if (streak != NULL && *streak != 0) {
+		*streak = 0;
+	}
+
 	return (c_len);
 }
 
 int
-zio_decompress_data(enum zio_compress c, void *src, void *dst,
+zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len)
 {
 	zio_compress_info_t *ci = &zio_compress_table[c];
@@ -132,3 +290,14 @@ zio_decompress_data(enum zio_compress c, void *src, void *dst,
 
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
+
+int
+zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
+    size_t s_len, size_t d_len)
+{
+	void *tmp = abd_borrow_buf_copy(src, s_len);
+	int ret = zio_decompress_data_buf(c, tmp, dst, s_len, d_len);
+	abd_return_buf(src, tmp, s_len);
+
+	return (ret);
+}
@@ -0,0 +1,487 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Block level encryption for ZFS.
+ *
+ * Every encryption root has a randomly generated master key which never
+ * changes and is stored on disk wrapped (encrypted) by the user's
+ * wrapping key.  Changing the wrapping key therefore never requires the
+ * data to be rewritten.
+ *
+ * Blocks are encrypted with AES-GCM using a key derived from the master
+ * key and a 32-bit salt with HKDF-SHA256.  The salt is replaced after
+ * zfs_key_max_salt_uses blocks, and every block gets a fresh random
+ * 96-bit IV, so no (key, IV) pair is ever reused in practice.  The salt,
+ * IV and the 128-bit GCM tag are stored in the block pointer (see the
+ * encrypted blkptr_t layout in spa.h), which means the checksum of an
+ * encrypted block is truncated to 128 bits to make room for the tag.
+ *
+ * The ciphers themselves come from the ICP, which uses AES-NI and
+ * PCLMULQDQ when the processor has them.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio.h>
+#include <sys/zio_crypt.h>
+#include <sys/sha2.h>
+#include <sys/crypto/api.h>
+
+zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS] = {
+	{"",			0,	"inherit"},
+	{SUN_CKM_AES_GCM,	32,	"on"},
+	{"",			0,	"off"},
+	{SUN_CKM_AES_GCM,	16,	"aes-128-gcm"},
+	{SUN_CKM_AES_GCM,	24,	"aes-192-gcm"},
+	{SUN_CKM_AES_GCM,	32,	"aes-256-gcm"}
+};
+
+unsigned long zfs_key_max_salt_uses = ZFS_KEY_MAX_SALT_USES_DEFAULT;
+
+/*
+ * HKDF (RFC 5869) with HMAC-SHA256 and an empty info string.  Only a
+ * single block of output is ever needed.
+ */
+static int
+hkdf_sha256(uint8_t *key_material, uint_t km_len, uint8_t *salt,
+    uint_t salt_len, uint8_t *output_key, uint_t out_len)
+{
+	crypto_mechanism_t mech;
+	crypto_key_t key;
+	crypto_data_t in_cd, out_cd;
+	uint8_t prk[SHA256_DIGEST_LENGTH];
+	uint8_t okm[SHA256_DIGEST_LENGTH];
+	uint8_t counter = 1;
+	int ret;
+
+	ASSERT3U(out_len, <=, SHA256_DIGEST_LENGTH);
+
+	mech.cm_type = crypto_mech2id(SUN_CKM_SHA256_HMAC);
+	mech.cm_param = NULL;
+	mech.cm_param_len = 0;
+
+	/* extract: prk = HMAC(salt, key_material) */
+	key.ck_format = CRYPTO_KEY_RAW;
+	key.ck_length = CRYPTO_BYTES2BITS(salt_len);
+	key.ck_data = salt;
+
+	in_cd.cd_format = CRYPTO_DATA_RAW;
+	in_cd.cd_offset = 0;
+	in_cd.cd_length = km_len;
+	in_cd.cd_miscdata = NULL;
+	in_cd.cd_raw.iov_base = (char *)key_material;
+	in_cd.cd_raw.iov_len = km_len;
+
+	out_cd.cd_format = CRYPTO_DATA_RAW;
+	out_cd.cd_offset = 0;
+	out_cd.cd_length = SHA256_DIGEST_LENGTH;
+	out_cd.cd_miscdata = NULL;
+	out_cd.cd_raw.iov_base = (char *)prk;
+	out_cd.cd_raw.iov_len = SHA256_DIGEST_LENGTH;
+
+	ret = crypto_mac(&mech, &in_cd, &key, NULL, &out_cd, NULL);
+	if (ret != CRYPTO_SUCCESS) {
+		ret = SET_ERROR(EIO);
+		goto out;
+	}
+
+	/* expand: okm = T(1) = HMAC(prk, info | 0x01) */
+	key.ck_length = CRYPTO_BYTES2BITS(SHA256_DIGEST_LENGTH);
+	key.ck_data = prk;
+
+	in_cd.cd_length = sizeof (counter);
+	in_cd.cd_raw.iov_base = (char *)&counter;
+	in_cd.cd_raw.iov_len = sizeof (counter);
+
+	out_cd.cd_raw.iov_base = (char *)okm;
+
+	ret = crypto_mac(&mech, &in_cd, &key, NULL, &out_cd, NULL);
+	if (ret != CRYPTO_SUCCESS) {
+		ret = SET_ERROR(EIO);
+		goto out;
+	}
+
+	bcopy(okm, output_key, out_len);
+	ret = 0;
+
+out:
+	bzero(prk, sizeof (prk));
+	bzero(okm, sizeof (okm));
+	return (ret);
+}
+
+/*
+ * Derive the data key for a salt.  The salt is hashed in little endian
+ * byte order so a pool can move between hosts of either byte order.
+ */
+static int
+zio_crypt_derive_key(zio_crypt_key_t *key, uint32_t salt, uint8_t *keydata)
+{
+	uint32_t salt_le = LE_32(salt);
+
+	return (hkdf_sha256(key->zk_master_keydata,
+	    zio_crypt_table[key->zk_crypt].ci_keylen, (uint8_t *)&salt_le,
+	    sizeof (salt_le), keydata, zio_crypt_table[key->zk_crypt].ci_keylen));
+}
+
+static void
+zio_crypt_key_set_current(zio_crypt_key_t *key)
+{
+	key->zk_current_key.ck_format = CRYPTO_KEY_RAW;
+	key->zk_current_key.ck_data = key->zk_current_keydata;
+	key->zk_current_key.ck_length =
+	    CRYPTO_BYTES2BITS(zio_crypt_table[key->zk_crypt].ci_keylen);
+}
+
+/*
+ * Encrypt or decrypt datalen bytes with AES-GCM.  The ciphertext and the
+ * tag are handed to the ICP as one uio so it can write them in one pass.
+ */
+static int
+zio_do_crypt_raw(boolean_t encrypt, crypto_key_t *key, uint8_t *iv,
+    uint8_t *aad, uint_t aadlen, uint8_t *mac, uint_t datalen,
+    uint8_t *plainbuf, uint8_t *cipherbuf)
+{
+	crypto_mechanism_t mech;
+	CK_AES_GCM_PARAMS gcmp;
+	crypto_data_t plain_cd, cipher_cd;
+	struct uio *cipher_uio;
+	int ret;
+
+	cipher_uio = uio_create(2, 0, UIO_SYSSPACE, UIO_WRITE);
+	if (cipher_uio == NULL)
+		return (SET_ERROR(ENOMEM));
+	uio_addiov(cipher_uio, (user_addr_t)cipherbuf, datalen);
+	uio_addiov(cipher_uio, (user_addr_t)mac, ZIO_DATA_MAC_LEN);
+
+	plain_cd.cd_format = CRYPTO_DATA_RAW;
+	plain_cd.cd_offset = 0;
+	plain_cd.cd_length = datalen;
+	plain_cd.cd_miscdata = NULL;
+	plain_cd.cd_raw.iov_base = (char *)plainbuf;
+	plain_cd.cd_raw.iov_len = datalen;
+
+	cipher_cd.cd_format = CRYPTO_DATA_UIO;
+	cipher_cd.cd_offset = 0;
+	cipher_cd.cd_length = datalen + ZIO_DATA_MAC_LEN;
+	cipher_cd.cd_miscdata = NULL;
+	cipher_cd.cd_uio = cipher_uio;
+
+	gcmp.pIv = iv;
+	gcmp.ulIvLen = ZIO_DATA_IV_LEN;
+	gcmp.ulIvBits = CRYPTO_BYTES2BITS(ZIO_DATA_IV_LEN);
+	gcmp.pAAD = aad;
+	gcmp.ulAADLen = aadlen;
+	gcmp.ulTagBits = CRYPTO_BYTES2BITS(ZIO_DATA_MAC_LEN);
+
+	mech.cm_type = crypto_mech2id(SUN_CKM_AES_GCM);
+	mech.cm_param = (char *)&gcmp;
+	mech.cm_param_len = sizeof (CK_AES_GCM_PARAMS);
+
+	if (encrypt) {
+		ret = crypto_encrypt(&mech, &plain_cd, key, NULL,
+		    &cipher_cd, NULL);
+	} else {
+		ret = crypto_decrypt(&mech, &cipher_cd, key, NULL,
+		    &plain_cd, NULL);
+	}
+
+	uio_free(cipher_uio);
+
+	/* a decryption failure means the tag didn't match */
+	if (ret != CRYPTO_SUCCESS)
+		return (SET_ERROR(EIO));
+
+	return (0);
+}
+
+void
+zio_crypt_key_destroy(zio_crypt_key_t *key)
+{
+	rw_destroy(&key->zk_salt_lock);
+	bzero(key, sizeof (zio_crypt_key_t));
+}
+
+/*
+ * Generate a new master key for an encryption root.
+ */
+int
+zio_crypt_key_init(uint64_t crypt, zio_crypt_key_t *key)
+{
+	uint_t keydata_len;
+	int ret;
+
+	ASSERT3U(crypt, <, ZIO_CRYPT_FUNCTIONS);
+	keydata_len = zio_crypt_table[crypt].ci_keylen;
+	ASSERT3U(keydata_len, >, 0);
+
+	bzero(key, sizeof (zio_crypt_key_t));
+	rw_init(&key->zk_salt_lock, NULL, RW_DEFAULT, NULL);
+	key->zk_crypt = crypt;
+
+	ret = random_get_bytes(key->zk_master_keydata, keydata_len);
+	if (ret != 0)
+		goto error;
+
+	ret = random_get_bytes((uint8_t *)&key->zk_guid, sizeof (uint64_t));
+	if (ret != 0)
+		goto error;
+
+	ret = random_get_bytes((uint8_t *)&key->zk_salt, ZIO_DATA_SALT_LEN);
+	if (ret != 0)
+		goto error;
+
+	ret = zio_crypt_derive_key(key, key->zk_salt, key->zk_current_keydata);
+	if (ret != 0)
+		goto error;
+
+	zio_crypt_key_set_current(key);
+
+	return (0);
+
+error:
+	zio_crypt_key_destroy(key);
+	return (ret);
+}
+
+/*
+ * Return the salt to encrypt the next block with, choosing a new one
+ * once the current salt has been used zfs_key_max_salt_uses times.
+ */
+int
+zio_crypt_key_get_salt(zio_crypt_key_t *key, uint32_t *salt)
+{
+	boolean_t salt_change;
+	int ret = 0;
+
+	rw_enter(&key->zk_salt_lock, RW_READER);
+	*salt = key->zk_salt;
+	salt_change = (atomic_inc_64_nv(&key->zk_salt_count) >=
+	    zfs_key_max_salt_uses);
+	rw_exit(&key->zk_salt_lock);
+
+	if (!salt_change)
+		return (0);
+
+	rw_enter(&key->zk_salt_lock, RW_WRITER);
+
+	/* another thread may have beaten us to it */
+	if (key->zk_salt_count >= zfs_key_max_salt_uses) {
+		uint32_t new_salt;
+
+		ret = random_get_bytes((uint8_t *)&new_salt, sizeof (new_salt));
+		if (ret == 0) {
+			ret = zio_crypt_derive_key(key, new_salt,
+			    key->zk_current_keydata);
+		}
+		if (ret == 0) {
+			key->zk_salt = new_salt;
+			key->zk_salt_count = 0;
+		}
+	}
+
+	rw_exit(&key->zk_salt_lock);
+
+	return (ret);
+}
+
+/*
+ * The guid and suite are authenticated along with the wrapped key, so a
+ * wrapped key can't be swapped between encryption roots unnoticed.
+ */
+static void
+zio_crypt_key_wrap_aad(uint64_t crypt, uint64_t guid, uint64_t *aad)
+{
+	aad[0] = LE_64(guid);
+	aad[1] = LE_64(crypt);
+}
+
+int
+zio_crypt_key_wrap(crypto_key_t *cwkey, zio_crypt_key_t *key, uint8_t *iv,
+    uint8_t *mac, uint8_t *keydata_out)
+{
+	uint64_t aad[2];
+	int ret;
+
+	ASSERT3U(cwkey->ck_format, ==, CRYPTO_KEY_RAW);
+
+	ret = zio_crypt_generate_iv(iv);
+	if (ret != 0)
+		return (ret);
+
+	zio_crypt_key_wrap_aad(key->zk_crypt, key->zk_guid, aad);
+
+	return (zio_do_crypt_raw(B_TRUE, cwkey, iv, (uint8_t *)aad,
+	    sizeof (aad), mac, zio_crypt_table[key->zk_crypt].ci_keylen,
+	    key->zk_master_keydata, keydata_out));
+}
+
+/*
+ * Returns EACCES if the wrapping key is wrong.
+ */
+int
+zio_crypt_key_unwrap(crypto_key_t *cwkey, uint64_t crypt, uint64_t guid,
+    uint8_t *keydata, uint8_t *iv, uint8_t *mac, zio_crypt_key_t *key)
+{
+	uint64_t aad[2];
+	int ret;
+
+	ASSERT3U(cwkey->ck_format, ==, CRYPTO_KEY_RAW);
+	ASSERT3U(crypt, <, ZIO_CRYPT_FUNCTIONS);
+	ASSERT3U(zio_crypt_table[crypt].ci_keylen, >, 0);
+
+	bzero(key, sizeof (zio_crypt_key_t));
+	rw_init(&key->zk_salt_lock, NULL, RW_DEFAULT, NULL);
+	key->zk_crypt = crypt;
+	key->zk_guid = guid;
+
+	zio_crypt_key_wrap_aad(crypt, guid, aad);
+
+	ret = zio_do_crypt_raw(B_FALSE, cwkey, iv, (uint8_t *)aad,
+	    sizeof (aad), mac, zio_crypt_table[crypt].ci_keylen,
+	    key->zk_master_keydata, keydata);
+	if (ret != 0) {
+		ret = SET_ERROR(EACCES);
+		goto error;
+	}
+
+	ret = random_get_bytes((uint8_t *)&key->zk_salt, ZIO_DATA_SALT_LEN);
+	if (ret != 0)
+		goto error;
+
+	ret = zio_crypt_derive_key(key, key->zk_salt, key->zk_current_keydata);
+	if (ret != 0)
+		goto error;
+
+	zio_crypt_key_set_current(key);
+
+	return (0);
+
+error:
+	zio_crypt_key_destroy(key);
+	return (ret);
+}
+
+int
+zio_crypt_generate_iv(uint8_t *ivbuf)
+{
+	return (random_get_pseudo_bytes(ivbuf, ZIO_DATA_IV_LEN));
+}
+
+/*
+ * The IV is stored as two little endian integers so that it reads back
+ * the same on a host of the other byte order.
+ */
+void
+zio_crypt_encode_params_bp(blkptr_t *bp, uint32_t salt, uint8_t *iv)
+{
+	uint64_t val64;
+	uint32_t val32;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	bcopy(iv, &val64, sizeof (uint64_t));
+	bcopy(iv + sizeof (uint64_t), &val32, sizeof (uint32_t));
+
+	bp->blk_dva[2].dva_word[0] = ((uint64_t)salt << 32) | LE_32(val32);
+	bp->blk_dva[2].dva_word[1] = LE_64(val64);
+}
+
+void
+zio_crypt_decode_params_bp(const blkptr_t *bp, uint32_t *salt, uint8_t *iv)
+{
+	uint64_t val64;
+	uint32_t val32;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	*salt = (uint32_t)(bp->blk_dva[2].dva_word[0] >> 32);
+
+	val64 = LE_64(bp->blk_dva[2].dva_word[1]);
+	val32 = LE_32((uint32_t)bp->blk_dva[2].dva_word[0]);
+	bcopy(&val64, iv, sizeof (uint64_t));
+	bcopy(&val32, iv + sizeof (uint64_t), sizeof (uint32_t));
+}
+
+void
+zio_crypt_encode_mac_bp(blkptr_t *bp, uint8_t *mac)
+{
+	uint64_t val64;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	bcopy(mac, &val64, sizeof (uint64_t));
+	bp->blk_cksum.zc_word[2] = LE_64(val64);
+	bcopy(mac + sizeof (uint64_t), &val64, sizeof (uint64_t));
+	bp->blk_cksum.zc_word[3] = LE_64(val64);
+}
+
+void
+zio_crypt_decode_mac_bp(const blkptr_t *bp, uint8_t *mac)
+{
+	uint64_t val64;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	val64 = LE_64(bp->blk_cksum.zc_word[2]);
+	bcopy(&val64, mac, sizeof (uint64_t));
+	val64 = LE_64(bp->blk_cksum.zc_word[3]);
+	bcopy(&val64, mac + sizeof (uint64_t), sizeof (uint64_t));
+}
+
+/*
+ * Encrypt (plainbuf -> cipherbuf) or decrypt (cipherbuf -> plainbuf) one
+ * block.  Blocks written with an older salt than the current one need
+ * their data key derived again.
+ */
+int
+zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key, uint32_t salt,
+    uint8_t *iv, uint8_t *mac, uint_t datalen, uint8_t *plainbuf,
+    uint8_t *cipherbuf)
+{
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+	crypto_key_t tmp_ckey, *ckey;
+	int ret;
+
+	rw_enter(&key->zk_salt_lock, RW_READER);
+
+	if (salt == key->zk_salt) {
+		ckey = &key->zk_current_key;
+	} else {
+		ret = zio_crypt_derive_key(key, salt, keydata);
+		if (ret != 0)
+			goto out;
+
+		tmp_ckey.ck_format = CRYPTO_KEY_RAW;
+		tmp_ckey.ck_data = keydata;
+		tmp_ckey.ck_length =
+		    CRYPTO_BYTES2BITS(zio_crypt_table[key->zk_crypt].ci_keylen);
+		ckey = &tmp_ckey;
+	}
+
+	ret = zio_do_crypt_raw(encrypt, ckey, iv, NULL, 0, mac, datalen,
+	    plainbuf, cipherbuf);
+
+out:
+	rw_exit(&key->zk_salt_lock);
+	bzero(keydata, sizeof (keydata));
+	return (ret);
+}
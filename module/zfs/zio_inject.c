@@ -60,6 +60,8 @@ typedef struct inject_handler {
 	zinject_record_t	       zi_record;
 	uint64_t                   *zi_lanes;
 	int                        zi_next_lane;
+	uint64_t                   zi_rand;
+	hrtime_t                   zi_start;
 	list_node_t		           zi_link;
 } inject_handler_t;
 
@@ -399,6 +401,88 @@ spa_handle_ignored_writes(spa_t *spa)
 	rw_exit(&inject_lock);
 }
 
+/*
+ * A small xorshift generator, so that a handler's latency profile is
+ * reproducible from its zi_seed.
+ */
+static uint64_t
+zio_inject_rand(inject_handler_t *handler)
+{
+	uint64_t x = handler->zi_rand;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	handler->zi_rand = x;
+	return (x);
+}
+
+/*
+ * How long an IO occupies one of the handler's lanes. On top of the
+ * fixed zi_timer, a latency profile may add:
+ *
+ *	- zi_jitter: a random extra latency with an exponentially
+ *	  decaying tail (the uniform part below plus a geometrically
+ *	  distributed number of whole zi_jitter units), averaging
+ *	  1.5 * zi_jitter;
+ *	- zi_bandwidth: the transfer time of io_size bytes;
+ *	- zi_qdelay: a cost for every other lane still busy, to model
+ *	  devices that slow down as their queue deepens.
+ *
+ * Called with inject_delay_mtx held.
+ */
+static hrtime_t
+zio_inject_service_time(inject_handler_t *handler, zio_t *zio, hrtime_t now)
+{
+	zinject_record_t *record = &handler->zi_record;
+	hrtime_t service = record->zi_timer;
+
+	ASSERT(MUTEX_HELD(&inject_delay_mtx));
+
+	if (record->zi_jitter != 0) {
+		uint64_t r = zio_inject_rand(handler);
+		int tail = 64 - highbit64(zio_inject_rand(handler));
+
+		service += r % record->zi_jitter +
+		    record->zi_jitter * MIN(tail, 16);
+	}
+
+	if (record->zi_bandwidth != 0)
+		service += zio->io_size * NANOSEC / record->zi_bandwidth;
+
+	if (record->zi_qdelay != 0) {
+		uint64_t busy = 0;
+
+		for (uint64_t i = 0; i < record->zi_nlanes; i++) {
+			if (handler->zi_lanes[i] > now)
+				busy++;
+		}
+		service += busy * record->zi_qdelay;
+	}
+
+	return (service);
+}
+
+/*
+ * Push a completion time that falls inside one of the handler's periodic
+ * stalls (e.g. an SMR drive's garbage collection) out to the stall's end.
+ */
+static hrtime_t
+zio_inject_stall(inject_handler_t *handler, hrtime_t target)
+{
+	zinject_record_t *record = &handler->zi_record;
+	hrtime_t phase;
+
+	if (record->zi_stall_period == 0 || target < handler->zi_start)
+		return (target);
+
+	phase = (target - handler->zi_start) % record->zi_stall_period;
+	if (phase < record->zi_stall_len)
+		target += record->zi_stall_len - phase;
+
+	return (target);
+}
+
 hrtime_t
 zio_handle_io_delay(zio_t *zio)
 {
@@ -506,10 +590,12 @@ zio_handle_io_delay(zio_t *zio)
 		 * each lane will become idle, we use that value to
 		 * determine when this request should complete.
 		 */
-		hrtime_t idle = handler->zi_record.zi_timer + gethrtime();
-		hrtime_t busy = handler->zi_record.zi_timer +
+		hrtime_t now = gethrtime();
+		hrtime_t service = zio_inject_service_time(handler, zio, now);
+		hrtime_t idle = service + now;
+		hrtime_t busy = service +
 		    handler->zi_lanes[handler->zi_next_lane];
-		hrtime_t target = MAX(idle, busy);
+		hrtime_t target = zio_inject_stall(handler, MAX(idle, busy));
 
 		if (min_handler == NULL) {
 			min_handler = handler;
@@ -596,6 +682,14 @@ zio_inject_fault(char *name, int flags, int *id, zinject_record_t *record)
 		 */
 		if (record->zi_nlanes >= UINT16_MAX)
 			return (SET_ERROR(EINVAL));
+
+		/*
+		 * A stall must leave some of each period for IO, or no
+		 * request would ever complete.
+		 */
+		if (record->zi_stall_len >= record->zi_stall_period &&
+		    record->zi_stall_period != 0)
+			return (SET_ERROR(EINVAL));
 	}
 
 	if (!(flags & ZINJECT_NULL)) {
@@ -621,6 +715,10 @@ zio_inject_fault(char *name, int flags, int *id, zinject_record_t *record)
 			handler->zi_lanes = NULL;
 			handler->zi_next_lane = 0;
 		}
+		/* xorshift must not start from zero */
+		handler->zi_rand = record->zi_seed != 0 ?
+		    record->zi_seed : record->zi_guid | 1;
+		handler->zi_start = gethrtime();
 
 		rw_enter(&inject_lock, RW_WRITER);
 
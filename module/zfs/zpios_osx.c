@@ -0,0 +1,814 @@
+/*
+ *  ZPIOS is a heavily modified version of the original PIOS test code.
+ *  It is designed to have the test code running in the kernel against
+ *  ZFS while still being flexibly controled from user space.
+ *
+ *  Copyright (C) 2008-2010 Lawrence Livermore National Security, LLC.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  LLNL-CODE-403049
+ *
+ *  Original PIOS Test Code
+ *  Copyright (C) 2004 Cluster File Systems, Inc.
+ *  Written by Peter Braam <braam@clusterfs.com>
+ *             Atul Vidwansa <atul@clusterfs.com>
+ *             Milind Dumbare <milind@clusterfs.com>
+ *
+ *  ZPIOS is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  ZPIOS is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ZPIOS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * OS X port of module/zpios/pios.c.  Rather than a misc device of its own
+ * the benchmark is run by the ZFS_IOC_ZPIOS ioctl on /dev/zfs, which takes
+ * the zpios_cmd_t as a byte array in the input nvlist and returns the
+ * stats array, the per-operation latency histograms (zpios_lat_t) and the
+ * text log in the output nvlist.
+ *
+ * Besides the write and read phases of the Linux module an optional mixed
+ * phase (DMU_MIXED) runs between them, in which every chunk of the regions
+ * is either read or rewritten, reads making up the requested percentage.
+ *
+ * The pre/post phase upcalls of the Linux module are not supported.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dmu.h>
+#include <sys/txg.h>
+#include <sys/dsl_destroy.h>
+#include <sys/nvpair.h>
+#include <zpios-ctl.h>
+
+#define	OBJ_SIZE		64
+#define	ZPIOS_LOG_SIZE		(32 * 1024)
+
+typedef enum zpios_phase {
+	ZPIOS_PHASE_WRITE,
+	ZPIOS_PHASE_MIXED,
+	ZPIOS_PHASE_READ
+} zpios_phase_t;
+
+typedef struct zpios_region {
+	objset_t	*os;
+	uint64_t	obj;
+	uint64_t	wr_offset;
+	uint64_t	rd_offset;
+	uint64_t	mx_offset;
+	uint64_t	init_offset;
+	uint64_t	max_offset;
+	zpios_stats_t	stats;
+	kmutex_t	lock;
+} zpios_region_t;
+
+struct zpios_run;
+
+typedef struct zpios_thread {
+	struct zpios_run *run;
+	int		thread_no;
+	int		rc;
+	zpios_stats_t	stats;		/* write and read phases */
+	zpios_stats_t	mixed;		/* mixed phase */
+	uint64_t	wr_lat[ZPIOS_LAT_BUCKETS];
+	uint64_t	rd_lat[ZPIOS_LAT_BUCKETS];
+} zpios_thread_t;
+
+typedef struct zpios_run {
+	char		pool[ZPIOS_NAME_SIZE];
+	uint32_t	id;
+	uint64_t	chunk_size;
+	uint32_t	thread_count;
+	uint32_t	region_count;
+	uint64_t	region_size;
+	uint64_t	offset;
+	uint32_t	region_noise;
+	uint32_t	chunk_noise;
+	uint32_t	thread_delay;
+	uint32_t	flags;
+	uint32_t	read_pct;
+	zpios_phase_t	phase;
+	objset_t	*os;
+	zpios_stats_t	stats;
+	zpios_lat_t	*lat;
+	zpios_thread_t	**threads;
+	uint32_t	threads_done;
+	uint32_t	region_next;
+	kmutex_t	lock_work;
+	kmutex_t	lock_ctl;
+	kcondvar_t	cv_ctl;
+	kmutex_t	lock_log;
+	char		*log;
+	size_t		log_len;
+	zpios_region_t	regions[0];
+} zpios_run_t;
+
+static char *zpios_tag = "zpios_tag";
+
+static void
+zpios_print(zpios_run_t *run, const char *format, ...)
+{
+	va_list adx;
+	int n;
+
+	mutex_enter(&run->lock_log);
+	if (run->log_len < ZPIOS_LOG_SIZE - 1) {
+		va_start(adx, format);
+		n = vsnprintf(run->log + run->log_len,
+		    ZPIOS_LOG_SIZE - run->log_len, format, adx);
+		va_end(adx);
+		if (n > 0)
+			run->log_len = MIN(run->log_len + n,
+			    ZPIOS_LOG_SIZE - 1);
+	}
+	mutex_exit(&run->lock_log);
+}
+
+static uint32_t
+zpios_random(void)
+{
+	uint32_t random_int;
+
+	(void) random_get_pseudo_bytes((uint8_t *)&random_int,
+	    sizeof (random_int));
+
+	return (random_int);
+}
+
+static uint64_t
+zpios_dmu_object_create(zpios_run_t *run, objset_t *os)
+{
+	dmu_tx_t *tx;
+	uint64_t obj = 0ULL;
+	int rc;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0, OBJ_SIZE);
+	rc = dmu_tx_assign(tx, TXG_WAIT);
+	if (rc) {
+		zpios_print(run, "dmu_tx_assign() failed: %d\n", rc);
+		dmu_tx_abort(tx);
+		return (obj);
+	}
+
+	obj = dmu_object_alloc(os, DMU_OT_UINT64_OTHER, 0, DMU_OT_NONE, 0, tx);
+	rc = dmu_object_set_blocksize(os, obj, 128ULL << 10, 0, tx);
+	if (rc) {
+		zpios_print(run, "dmu_object_set_blocksize() failed: %d\n",
+		    rc);
+		dmu_tx_abort(tx);
+		return (obj);
+	}
+
+	dmu_tx_commit(tx);
+
+	return (obj);
+}
+
+static int
+zpios_dmu_object_free(zpios_run_t *run, objset_t *os, uint64_t obj)
+{
+	dmu_tx_t *tx;
+	int rc;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_free(tx, obj, 0, DMU_OBJECT_END);
+	rc = dmu_tx_assign(tx, TXG_WAIT);
+	if (rc) {
+		zpios_print(run, "dmu_tx_assign() failed: %d\n", rc);
+		dmu_tx_abort(tx);
+		return (rc);
+	}
+
+	rc = dmu_object_free(os, obj, tx);
+	if (rc) {
+		zpios_print(run, "dmu_object_free() failed: %d\n", rc);
+		dmu_tx_abort(tx);
+		return (rc);
+	}
+
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+static int
+zpios_dmu_setup(zpios_run_t *run)
+{
+	zpios_time_t *t = &(run->stats.cr_time);
+	objset_t *os;
+	char name[32];
+	uint64_t obj = 0ULL;
+	int i, rc = 0, rc2;
+
+	t->start = zpios_timespec_now();
+
+	(void) snprintf(name, 32, "%s/id_%d", run->pool, run->id);
+	rc = dmu_objset_create(name, DMU_OST_OTHER, 0, NULL, NULL, NULL);
+	if (rc) {
+		zpios_print(run, "Error dmu_objset_create(%s, ...) "
+		    "failed: %d\n", name, rc);
+		goto out;
+	}
+
+	rc = dmu_objset_own(name, DMU_OST_OTHER, 0, zpios_tag, &os);
+	if (rc) {
+		zpios_print(run, "Error dmu_objset_own(%s, ...) "
+		    "failed: %d\n", name, rc);
+		goto out_destroy;
+	}
+
+	if (!(run->flags & DMU_FPP)) {
+		obj = zpios_dmu_object_create(run, os);
+		if (obj == 0) {
+			rc = SET_ERROR(EBADF);
+			zpios_print(run, "Error zpios_dmu_"
+			    "object_create() failed, %d\n", rc);
+			dmu_objset_disown(os, zpios_tag);
+			goto out_destroy;
+		}
+	}
+
+	for (i = 0; i < run->region_count; i++) {
+		zpios_region_t *region = &run->regions[i];
+
+		region->os = os;
+		if (run->flags & DMU_FPP) {
+			/* File per process */
+			region->obj = zpios_dmu_object_create(run, os);
+			ASSERT(region->obj > 0); /* XXX - Handle this */
+			region->init_offset = run->offset;
+		} else {
+			/* Single shared file */
+			region->obj = obj;
+			region->init_offset = run->offset * i;
+		}
+		region->wr_offset = region->init_offset;
+		region->rd_offset = region->init_offset;
+		region->mx_offset = region->init_offset;
+		region->max_offset = region->init_offset + run->region_size;
+	}
+
+	run->os = os;
+out_destroy:
+	if (rc) {
+		rc2 = dsl_destroy_head(name);
+		if (rc2)
+			zpios_print(run, "Error dsl_destroy_head"
+			    "(%s, ...) failed: %d\n", name, rc2);
+	}
+out:
+	t->stop  = zpios_timespec_now();
+	t->delta = zpios_timespec_sub(t->stop, t->start);
+
+	return (rc);
+}
+
+static int
+zpios_setup_run(zpios_run_t **runp, const char *pool, zpios_cmd_t *kcmd,
+    uint32_t read_pct, zpios_lat_t *lat)
+{
+	zpios_run_t *run;
+	size_t size;
+	int i, rc;
+
+	size = sizeof (*run) + kcmd->cmd_region_count * sizeof (zpios_region_t);
+	run = vmem_zalloc(size, KM_SLEEP);
+
+	(void) strlcpy(run->pool, pool, ZPIOS_NAME_SIZE);
+	run->id			= kcmd->cmd_id;
+	run->chunk_size		= kcmd->cmd_chunk_size;
+	run->thread_count	= kcmd->cmd_thread_count;
+	run->region_count	= kcmd->cmd_region_count;
+	run->region_size	= kcmd->cmd_region_size;
+	run->offset		= kcmd->cmd_offset;
+	run->region_noise	= kcmd->cmd_region_noise;
+	run->chunk_noise	= kcmd->cmd_chunk_noise;
+	run->thread_delay	= kcmd->cmd_thread_delay;
+	run->flags		= kcmd->cmd_flags;
+	run->read_pct		= read_pct;
+	run->lat		= lat;
+	run->log		= kmem_zalloc(ZPIOS_LOG_SIZE, KM_SLEEP);
+	mutex_init(&run->lock_work, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&run->lock_ctl, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&run->lock_log, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&run->cv_ctl, NULL, CV_DEFAULT, NULL);
+	for (i = 0; i < run->region_count; i++)
+		mutex_init(&run->regions[i].lock, NULL, MUTEX_DEFAULT, NULL);
+
+	run->threads = kmem_zalloc(sizeof (zpios_thread_t *) *
+	    run->thread_count, KM_SLEEP);
+	for (i = 0; i < run->thread_count; i++) {
+		zpios_thread_t *thr;
+
+		thr = kmem_zalloc(sizeof (zpios_thread_t), KM_SLEEP);
+		thr->run = run;
+		thr->thread_no = i;
+		run->threads[i] = thr;
+	}
+
+	*runp = run;
+
+	rc = zpios_dmu_setup(run);
+
+	return (rc);
+}
+
+static int
+zpios_get_work_item(zpios_run_t *run, zpios_region_t **region,
+    uint64_t *offset, uint64_t chunk_size)
+{
+	uint32_t random_int = zpios_random();
+	int i, j, count = 0;
+
+	mutex_enter(&run->lock_work);
+	i = run->region_next;
+
+	while (count < run->region_count) {
+		uint64_t *rw_offset;
+		zpios_time_t *rw_time = NULL;
+
+		j = i % run->region_count;
+		*region = &(run->regions[j]);
+
+		switch (run->phase) {
+		case ZPIOS_PHASE_WRITE:
+			rw_offset = &((*region)->wr_offset);
+			rw_time = &((*region)->stats.wr_time);
+			break;
+		case ZPIOS_PHASE_MIXED:
+			rw_offset = &((*region)->mx_offset);
+			break;
+		default:
+			rw_offset = &((*region)->rd_offset);
+			rw_time = &((*region)->stats.rd_time);
+			break;
+		}
+
+		/* test if region is fully written */
+		if (*rw_offset + chunk_size > (*region)->max_offset) {
+			i++;
+			count++;
+
+			if (rw_time != NULL && rw_time->stop.ts_sec == 0 &&
+			    rw_time->stop.ts_nsec == 0)
+				rw_time->stop = zpios_timespec_now();
+
+			continue;
+		}
+
+		*offset = *rw_offset;
+		*rw_offset += chunk_size;
+
+		/* update ctl structure */
+		if (run->region_noise)
+			run->region_next += random_int % run->region_noise;
+		else
+			run->region_next++;
+
+		mutex_exit(&run->lock_work);
+		return (1);
+	}
+
+	/* nothing left to do */
+	mutex_exit(&run->lock_work);
+
+	return (0);
+}
+
+static void
+zpios_remove_objset(zpios_run_t *run)
+{
+	zpios_time_t *t = &(run->stats.rm_time);
+	zpios_region_t *region;
+	char name[32];
+	int rc = 0, i;
+
+	t->start = zpios_timespec_now();
+
+	(void) snprintf(name, 32, "%s/id_%d", run->pool, run->id);
+
+	if (run->flags & DMU_REMOVE) {
+		for (i = 0; i < run->region_count; i++) {
+			region = &run->regions[i];
+			rc = zpios_dmu_object_free(run, region->os,
+			    region->obj);
+			if (rc)
+				zpios_print(run, "Error removing object "
+				    "%d, %d\n", (int)region->obj, rc);
+
+			/* A single shared object is only freed once */
+			if (!(run->flags & DMU_FPP))
+				break;
+		}
+	}
+
+	dmu_objset_disown(run->os, zpios_tag);
+
+	if (run->flags & DMU_REMOVE) {
+		rc = dsl_destroy_head(name);
+		if (rc)
+			zpios_print(run, "Error dsl_destroy_head"
+			    "(%s, ...) failed: %d\n", name, rc);
+	}
+
+	t->stop  = zpios_timespec_now();
+	t->delta = zpios_timespec_sub(t->stop, t->start);
+}
+
+static void
+zpios_cleanup_run(zpios_run_t *run)
+{
+	int i;
+
+	if (run == NULL)
+		return;
+
+	for (i = 0; i < run->thread_count; i++)
+		kmem_free(run->threads[i], sizeof (zpios_thread_t));
+	kmem_free(run->threads, sizeof (zpios_thread_t *) * run->thread_count);
+
+	for (i = 0; i < run->region_count; i++)
+		mutex_destroy(&run->regions[i].lock);
+
+	cv_destroy(&run->cv_ctl);
+	mutex_destroy(&run->lock_log);
+	mutex_destroy(&run->lock_ctl);
+	mutex_destroy(&run->lock_work);
+	kmem_free(run->log, ZPIOS_LOG_SIZE);
+
+	vmem_free(run, sizeof (*run) +
+	    run->region_count * sizeof (zpios_region_t));
+}
+
+static int
+zpios_dmu_write(zpios_run_t *run, objset_t *os, uint64_t object,
+    uint64_t offset, uint64_t size, const void *buf)
+{
+	dmu_tx_t *tx;
+	int rc, how = TXG_WAIT;
+
+	if (run->flags & DMU_WRITE_NOWAIT)
+		how = TXG_NOWAIT;
+
+	while (1) {
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, object, offset, size);
+		rc = dmu_tx_assign(tx, how);
+
+		if (rc) {
+			if (rc == ERESTART && how == TXG_NOWAIT) {
+				dmu_tx_wait(tx);
+				dmu_tx_abort(tx);
+				continue;
+			}
+			zpios_print(run, "Error in dmu_tx_assign(), %d", rc);
+			dmu_tx_abort(tx);
+			return (rc);
+		}
+		break;
+	}
+
+	dmu_write(os, object, offset, size, buf, tx);
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+static int
+zpios_dmu_read(zpios_run_t *run, objset_t *os, uint64_t object,
+    uint64_t offset, uint64_t size, void *buf)
+{
+	int flags = 0;
+
+	if (run->flags & DMU_READ_NOPF)
+		flags |= DMU_READ_NO_PREFETCH;
+
+	return (dmu_read(os, object, offset, size, buf, flags));
+}
+
+/*
+ * Issue chunks of the current phase until the regions are exhausted.  One
+ * thread is created per worker for every phase and exits when done.
+ */
+static void
+zpios_thread_main(void *arg)
+{
+	zpios_thread_t *thr = arg;
+	zpios_run_t *run = thr->run;
+	zpios_phase_t phase = run->phase;
+	zpios_stats_t *stats;
+	zpios_region_t *region;
+	zpios_time_t t, *thr_time;
+	uint64_t offset, chunk_size;
+	hrtime_t start;
+	boolean_t rd;
+	char *buf;
+	int chunk_noise_tmp = 0;
+	int i, rc = 0;
+
+	if (run->chunk_noise) {
+		chunk_noise_tmp = (zpios_random() % (run->chunk_noise * 2)) -
+		    run->chunk_noise;
+	}
+
+	chunk_size = run->chunk_size + chunk_noise_tmp;
+	buf = (char *)vmem_alloc(chunk_size, KM_SLEEP);
+
+	/* Trivial data verification pattern for now. */
+	if (run->flags & DMU_VERIFY)
+		memset(buf, 'z', chunk_size);
+
+	if (phase == ZPIOS_PHASE_MIXED) {
+		stats = &thr->mixed;
+		thr_time = &stats->wr_time;
+	} else {
+		stats = &thr->stats;
+		thr_time = (phase == ZPIOS_PHASE_WRITE) ?
+		    &stats->wr_time : &stats->rd_time;
+	}
+	thr_time->start = zpios_timespec_now();
+
+	while (zpios_get_work_item(run, &region, &offset, chunk_size)) {
+		if (run->thread_delay)
+			delay(zpios_random() % run->thread_delay);
+
+		if (phase == ZPIOS_PHASE_MIXED)
+			rd = (zpios_random() % 100) < run->read_pct;
+		else
+			rd = (phase == ZPIOS_PHASE_READ);
+
+		t.start = zpios_timespec_now();
+		start = gethrtime();
+		if (rd)
+			rc = zpios_dmu_read(run, region->os, region->obj,
+			    offset, chunk_size, buf);
+		else
+			rc = zpios_dmu_write(run, region->os, region->obj,
+			    offset, chunk_size, buf);
+		start = gethrtime() - start;
+		t.stop  = zpios_timespec_now();
+		t.delta = zpios_timespec_sub(t.stop, t.start);
+
+		if (rc) {
+			zpios_print(run, "IO error while doing %s(): %d\n",
+			    rd ? "dmu_read" : "dmu_write", rc);
+			break;
+		}
+
+		if (rd) {
+			/* Trivial data verification, expensive! */
+			if (run->flags & DMU_VERIFY) {
+				for (i = 0; i < chunk_size; i++) {
+					if (buf[i] != 'z') {
+						zpios_print(run, "IO verify "
+						    "error: %d/%d/%d\n",
+						    (int)region->obj,
+						    (int)offset,
+						    (int)chunk_size);
+						break;
+					}
+				}
+			}
+
+			stats->rd_data += chunk_size;
+			stats->rd_chunks++;
+			stats->rd_time.delta = zpios_timespec_add(
+			    stats->rd_time.delta, t.delta);
+			thr->rd_lat[zpios_lat_bucket(start)]++;
+		} else {
+			stats->wr_data += chunk_size;
+			stats->wr_chunks++;
+			stats->wr_time.delta = zpios_timespec_add(
+			    stats->wr_time.delta, t.delta);
+			thr->wr_lat[zpios_lat_bucket(start)]++;
+		}
+
+		if (phase == ZPIOS_PHASE_MIXED)
+			continue;
+
+		mutex_enter(&region->lock);
+		if (rd) {
+			region->stats.rd_data += chunk_size;
+			region->stats.rd_chunks++;
+			region->stats.rd_time.delta = zpios_timespec_add(
+			    region->stats.rd_time.delta, t.delta);
+
+			/* First time region was accessed */
+			if (region->init_offset == offset)
+				region->stats.rd_time.start = t.start;
+		} else {
+			region->stats.wr_data += chunk_size;
+			region->stats.wr_chunks++;
+			region->stats.wr_time.delta = zpios_timespec_add(
+			    region->stats.wr_time.delta, t.delta);
+
+			/* First time region was accessed */
+			if (region->init_offset == offset)
+				region->stats.wr_time.start = t.start;
+		}
+		mutex_exit(&region->lock);
+	}
+
+	thr_time->stop = zpios_timespec_now();
+	vmem_free(buf, chunk_size);
+
+	mutex_enter(&run->lock_ctl);
+	thr->rc = rc;
+	run->threads_done++;
+	cv_broadcast(&run->cv_ctl);
+	mutex_exit(&run->lock_ctl);
+
+	thread_exit();
+}
+
+static void
+zpios_lat_merge(uint64_t *dst, uint64_t *src)
+{
+	int i;
+
+	for (i = 0; i < ZPIOS_LAT_BUCKETS; i++) {
+		dst[i] += src[i];
+		src[i] = 0;
+	}
+}
+
+/*
+ * Run one phase on all threads and wait for them to finish, then fold
+ * their results into the run.  Returns the first thread error, if any.
+ */
+static int
+zpios_phase_run(zpios_run_t *run, zpios_phase_t phase, zpios_time_t *t)
+{
+	zpios_lat_t *lat = run->lat;
+	zpios_thread_t *thr;
+	int i, rc = 0;
+
+	run->phase = phase;
+	run->threads_done = 0;
+	run->region_next = 0;
+
+	t->start = zpios_timespec_now();
+	for (i = 0; i < run->thread_count; i++)
+		(void) thread_create(NULL, 0, zpios_thread_main,
+		    run->threads[i], 0, &p0, TS_RUN, minclsyspri);
+
+	mutex_enter(&run->lock_ctl);
+	while (run->threads_done < run->thread_count)
+		cv_wait(&run->cv_ctl, &run->lock_ctl);
+	mutex_exit(&run->lock_ctl);
+	t->stop  = zpios_timespec_now();
+	t->delta = zpios_timespec_sub(t->stop, t->start);
+
+	for (i = 0; i < run->thread_count; i++) {
+		thr = run->threads[i];
+
+		if (!rc && thr->rc)
+			rc = thr->rc;
+
+		switch (phase) {
+		case ZPIOS_PHASE_WRITE:
+			zpios_lat_merge(lat->lat_wr, thr->wr_lat);
+			break;
+		case ZPIOS_PHASE_MIXED:
+			lat->lat_mixed.wr_data += thr->mixed.wr_data;
+			lat->lat_mixed.wr_chunks += thr->mixed.wr_chunks;
+			lat->lat_mixed.rd_data += thr->mixed.rd_data;
+			lat->lat_mixed.rd_chunks += thr->mixed.rd_chunks;
+			zpios_lat_merge(lat->lat_mix_wr, thr->wr_lat);
+			zpios_lat_merge(lat->lat_mix_rd, thr->rd_lat);
+			break;
+		default:
+			zpios_lat_merge(lat->lat_rd, thr->rd_lat);
+			break;
+		}
+	}
+
+	return (rc);
+}
+
+static int
+zpios_threads_run(zpios_run_t *run)
+{
+	zpios_time_t *tt = &(run->stats.total_time);
+	int i, rc;
+
+	tt->start = zpios_timespec_now();
+
+	rc = zpios_phase_run(run, ZPIOS_PHASE_WRITE, &run->stats.wr_time);
+	if (rc == 0 && (run->flags & DMU_MIXED))
+		rc = zpios_phase_run(run, ZPIOS_PHASE_MIXED,
+		    &run->lat->lat_mixed.total_time);
+	if (rc == 0)
+		rc = zpios_phase_run(run, ZPIOS_PHASE_READ,
+		    &run->stats.rd_time);
+
+	for (i = 0; i < run->thread_count; i++) {
+		run->stats.wr_data += run->threads[i]->stats.wr_data;
+		run->stats.wr_chunks += run->threads[i]->stats.wr_chunks;
+		run->stats.rd_data += run->threads[i]->stats.rd_data;
+		run->stats.rd_chunks += run->threads[i]->stats.rd_chunks;
+	}
+
+	tt->stop  = zpios_timespec_now();
+	tt->delta = zpios_timespec_sub(tt->stop, tt->start);
+
+	return (rc);
+}
+
+/*
+ * innvl: "cmd" -> uint8 array holding the zpios_cmd_t and its cmd_data_size
+ *        bytes of opaque data, as passed to the Linux ZPIOS_CMD ioctl
+ *        "read_pct" -> uint64, percentage of reads in the DMU_MIXED phase
+ *
+ * outnvl: "stats" -> the zpios_stats_t array, see zpios_do_one_run()
+ *         "latency" -> zpios_lat_t
+ *         "log" -> string, the text log of the run
+ */
+int
+zpios_ioctl(const char *pool, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	zpios_run_t *run = NULL;
+	zpios_stats_t *stats;
+	zpios_cmd_t *kcmd;
+	zpios_lat_t *lat;
+	uint64_t read_pct = 50;
+	uint_t cmd_size;
+	size_t size;
+	int i, n, m, rc;
+
+	if (strlen(pool) >= ZPIOS_NAME_SIZE)
+		return (SET_ERROR(ENAMETOOLONG));
+
+	if (nvlist_lookup_uint8_array(innvl, ZPIOS_NVL_CMD,
+	    (uint8_t **)&kcmd, &cmd_size) != 0 ||
+	    cmd_size < sizeof (zpios_cmd_t) ||
+	    kcmd->cmd_magic != ZPIOS_CMD_MAGIC)
+		return (SET_ERROR(EINVAL));
+
+	if ((!kcmd->cmd_chunk_size) || (!kcmd->cmd_region_size) ||
+	    (!kcmd->cmd_thread_count) || (!kcmd->cmd_region_count))
+		return (SET_ERROR(EINVAL));
+
+	if (!(kcmd->cmd_flags & DMU_WRITE) || !(kcmd->cmd_flags & DMU_READ))
+		return (SET_ERROR(EINVAL));
+
+	if ((kcmd->cmd_flags & (DMU_WRITE_ZC | DMU_READ_ZC)) &&
+	    (kcmd->cmd_flags & DMU_VERIFY))
+		return (SET_ERROR(EINVAL));
+
+	if (kcmd->cmd_chunk_noise >= kcmd->cmd_chunk_size)
+		return (SET_ERROR(EINVAL));
+
+	(void) nvlist_lookup_uint64(innvl, ZPIOS_NVL_READ_PCT, &read_pct);
+	if (read_pct > 100)
+		return (SET_ERROR(EINVAL));
+
+	size = (1 + kcmd->cmd_thread_count + kcmd->cmd_region_count) *
+	    sizeof (zpios_stats_t);
+	if (kcmd->cmd_data_size < size ||
+	    kcmd->cmd_data_size > cmd_size - sizeof (zpios_cmd_t))
+		return (SET_ERROR(ENOSPC));
+
+	lat = kmem_zalloc(sizeof (zpios_lat_t), KM_SLEEP);
+	lat->lat_read_pct = read_pct;
+
+	rc = zpios_setup_run(&run, pool, kcmd, read_pct, lat);
+	if (rc == 0) {
+		rc = zpios_threads_run(run);
+		zpios_remove_objset(run);
+	}
+
+	if (rc == 0) {
+		stats = kmem_zalloc(size, KM_SLEEP);
+		n = 1;
+		m = 1 + kcmd->cmd_thread_count;
+		stats[0] = run->stats;
+
+		for (i = 0; i < kcmd->cmd_thread_count; i++)
+			stats[n+i] = run->threads[i]->stats;
+
+		for (i = 0; i < kcmd->cmd_region_count; i++)
+			stats[m+i] = run->regions[i].stats;
+
+		fnvlist_add_uint8_array(outnvl, ZPIOS_NVL_STATS,
+		    (uint8_t *)stats, size);
+		fnvlist_add_uint8_array(outnvl, ZPIOS_NVL_LATENCY,
+		    (uint8_t *)lat, sizeof (zpios_lat_t));
+		kmem_free(stats, size);
+	}
+
+	fnvlist_add_string(outnvl, ZPIOS_NVL_LOG, run->log);
+	zpios_cleanup_run(run);
+	kmem_free(lat, sizeof (zpios_lat_t));
+
+	return (rc);
+}
@@ -120,6 +120,32 @@ zrl_remove(zrlock_t *zrl)
 	ASSERT3S((int32_t)n, >=, 0);
 }
 
+/*
+ * Like zrl_add(), but fails rather than waiting if the lock is held
+ * exclusively. Returns 1 if the reference was taken.
+ */
+int
+zrl_tryadd(zrlock_t *zrl)
+{
+	uint32_t n = (uint32_t)zrl->zr_refcount;
+
+	while (n != ZRL_LOCKED) {
+		uint32_t cas = atomic_cas_32(
+		    (uint32_t *)&zrl->zr_refcount, n, n + 1);
+		if (cas == n) {
+			ASSERT3S((int32_t)n, >=, 0);
+#ifdef	ZFS_DEBUG
+			zrl->zr_owner = curthread;
+			zrl->zr_caller = __func__;
+#endif
+			return (1);
+		}
+		n = cas;
+	}
+
+	return (0);
+}
+
 int
 zrl_tryenter(zrlock_t *zrl)
 {
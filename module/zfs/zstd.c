@@ -0,0 +1,134 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * ZFS glue for the Zstandard compression library, which is imported under
+ * module/zstd.
+ *
+ * Both the compression and decompression contexts are placed in caller
+ * supplied workspaces (ZSTD_initStatic*Ctx) so the library never calls
+ * an allocator of its own.  Decompression workspaces are all the same
+ * size and come from a kmem cache; compression workspaces depend on the
+ * level and block size and are allocated per call.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+#define	ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+static kmem_cache_t *zstd_dctx_cache;
+static size_t zstd_dctx_size;
+
+size_t
+zstd_compress_zfs(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int level)
+{
+	ZSTD_compressionParameters cparams;
+	ZSTD_CCtx *cctx;
+	size_t wksize, c_len;
+	uint32_t bufsiz;
+	char *dest = d_start;
+	void *wkmem;
+
+	ASSERT(d_len >= sizeof (bufsiz));
+	ASSERT3S(level, >=, 1);
+	ASSERT3S(level, <=, ZIO_ZSTD_LEVEL_MAX);
+
+	cparams = ZSTD_getCParams(level, s_len, 0);
+	wksize = ZSTD_estimateCCtxSize_usingCParams(cparams);
+
+	/*
+	 * The workspace for the higher levels runs to several megabytes.
+	 * Rather than stall the write pipeline waiting for it, store the
+	 * block uncompressed if it cannot be had right away.
+	 */
+	wkmem = kmem_alloc(wksize, KM_NOSLEEP);
+	if (wkmem == NULL)
+		return (s_len);
+
+	cctx = ZSTD_initStaticCCtx(wkmem, wksize);
+	VERIFY(cctx != NULL);
+
+	c_len = ZSTD_compressCCtx(cctx, &dest[sizeof (bufsiz)],
+	    d_len - sizeof (bufsiz), s_start, s_len, level);
+
+	kmem_free(wkmem, wksize);
+
+	/* Output didn't fit in d_len, or some other library error */
+	if (ZSTD_isError(c_len))
+		return (s_len);
+
+	/*
+	 * As with lz4, record the compressed size at the start of the
+	 * buffer so decompression isn't confused by the padding that is
+	 * added to round the block up to the sector size.
+	 */
+	bufsiz = (uint32_t)c_len;
+	*(uint32_t *)dest = BE_32(bufsiz);
+
+	return (bufsiz + sizeof (bufsiz));
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress_zfs(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int level)
+{
+	const char *src = s_start;
+	uint32_t bufsiz = BE_IN32(src);
+	ZSTD_DCtx *dctx;
+	void *wkmem;
+	size_t ret;
+
+	/* invalid compressed buffer size encoded at start */
+	if (bufsiz + sizeof (bufsiz) > s_len)
+		return (1);
+
+	wkmem = kmem_cache_alloc(zstd_dctx_cache, KM_SLEEP);
+	dctx = ZSTD_initStaticDCtx(wkmem, zstd_dctx_size);
+	VERIFY(dctx != NULL);
+
+	ret = ZSTD_decompressDCtx(dctx, d_start, d_len,
+	    &src[sizeof (bufsiz)], bufsiz);
+
+	kmem_cache_free(zstd_dctx_cache, wkmem);
+
+	return (ZSTD_isError(ret) || ret != d_len);
+}
+
+void
+zstd_init(void)
+{
+	zstd_dctx_size = ZSTD_estimateDCtxSize();
+	zstd_dctx_cache = kmem_cache_create("zstd_dctx_cache",
+	    zstd_dctx_size, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zstd_fini(void)
+{
+	if (zstd_dctx_cache) {
+		kmem_cache_destroy(zstd_dctx_cache);
+		zstd_dctx_cache = NULL;
+	}
+}
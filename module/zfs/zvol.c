@@ -63,6 +63,7 @@
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_prop.h>
 #include <sys/dsl_dir.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dkio.h>
 // #include <sys/efi_partition.h>
 #include <sys/byteorder.h>
@@ -91,6 +92,112 @@
 #include "zfs_namecheck.h"
 
 uint64_t zvol_inhibit_dev = 0;
+
+/*
+ * IOKit reads and writes to zvols run asynchronously on zvol_taskq, so
+ * that a zvol can have as many requests in flight as there are threads.
+ */
+uint32_t zvol_threads = 32;
+taskq_t *zvol_taskq;
+
+/*
+ * Synchronous IOKit writes of up to ZVOL_BATCH_MAX bytes are written in
+ * batches: the writes queued on a zvol while the previous batch was being
+ * written share a single tx and a single zil_commit(), and adjacent ones
+ * share log records.  Zero writes each one on its own.
+ */
+int zvol_sync_batch = 1;
+
+#define	ZVOL_BATCH_MAX	(DMU_MAX_ACCESS >> 2)
+
+/*
+ * The minors found by a zvol_create_minors_impl() walk are created on
+ * zvol_minor_taskq, zvol_minor_threads at a time, since owning each
+ * objset and bringing up its IOKit device is mostly spent waiting.  All
+ * the volumes are created before any of their visible snapshots, so that
+ * the volumes can be used as soon as possible after an import.
+ */
+uint32_t zvol_minor_threads = 16;
+static taskq_t *zvol_minor_taskq;
+
+typedef struct zvol_minor_batch {
+	kmutex_t	zmb_lock;
+	kcondvar_t	zmb_cv;
+	uint64_t	zmb_pending;	/* jobs dispatched and not done */
+	list_t		zmb_snaps;	/* snapshot jobs for the second pass */
+} zvol_minor_batch_t;
+
+typedef struct zvol_minor_job {
+	list_node_t	zmj_node;
+	zvol_minor_batch_t *zmj_batch;
+	uint64_t	zmj_snapdev;
+	char		zmj_name[MAXNAMELEN];
+} zvol_minor_job_t;
+
+/*
+ * Progress of minor creation, kstat.zfs.misc.zvol_minors.
+ */
+typedef struct zvol_minor_stats {
+	kstat_named_t	zms_queued;
+	kstat_named_t	zms_pending;
+	kstat_named_t	zms_created;
+	kstat_named_t	zms_existing;
+	kstat_named_t	zms_failed;
+	kstat_named_t	zms_snaps_deferred;
+} zvol_minor_stats_t;
+
+static zvol_minor_stats_t zvol_minor_stats = {
+	{ "queued",		KSTAT_DATA_UINT64 },
+	{ "pending",		KSTAT_DATA_UINT64 },
+	{ "created",		KSTAT_DATA_UINT64 },
+	{ "existing",		KSTAT_DATA_UINT64 },
+	{ "failed",		KSTAT_DATA_UINT64 },
+	{ "snaps_deferred",	KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *zvol_minor_ksp;
+
+#define	ZVOL_MINOR_BUMP(stat) \
+	atomic_inc_64(&zvol_minor_stats.stat.value.ui64)
+
+/*
+ * Per-zvol batching statistics, kstat.zfs.<pool>.misc.zvol<minor>.
+ */
+typedef struct zvol_stats {
+	kstat_named_t	zs_sync_writes;		/* writes through batches */
+	kstat_named_t	zs_batches;		/* txs and commits for them */
+	kstat_named_t	zs_batched_writes;	/* writes sharing a batch */
+	kstat_named_t	zs_merged_writes;	/* logged with adjacent ones */
+} zvol_stats_t;
+
+static const zvol_stats_t zvol_stats_template = {
+	{ "sync_writes",	KSTAT_DATA_UINT64 },
+	{ "batches",		KSTAT_DATA_UINT64 },
+	{ "batched_writes",	KSTAT_DATA_UINT64 },
+	{ "merged_writes",	KSTAT_DATA_UINT64 },
+};
+
+#define	ZVOL_STAT_INCR(zv, stat, val) \
+	atomic_add_64(&(zv)->zv_stats->stat.value.ui64, (val))
+
+/*
+ * A synchronous write waiting on zv_batch_list to be written.
+ */
+typedef struct zvol_sync_write {
+	list_node_t	zsw_node;
+	uint64_t	zsw_offset;	/* position in the volume */
+	uint64_t	zsw_count;
+	struct iomem	*zsw_iomem;
+	int		zsw_error;
+	boolean_t	zsw_done;
+} zvol_sync_write_t;
+
+/* A range of the volume written by a batch, [zbr_start, zbr_end) */
+typedef struct zvol_batch_run {
+	uint64_t	zbr_start;
+	uint64_t	zbr_end;
+} zvol_batch_run_t;
+
 dev_info_t zfs_dip_real = { 0 };
 dev_info_t *zfs_dip = &zfs_dip_real;
 extern int zfs_major;
@@ -109,6 +216,8 @@ static char *zvol_tag = "zvol_tag";
 
 extern kmutex_t zfsdev_state_lock;
 void zvol_register_device(spa_t *spa, zvol_state_t *zv);
+static void zvol_stats_init(zvol_state_t *zv);
+static void zvol_stats_destroy(zvol_state_t *zv);
 
 void *
 zfsdev_get_soft_state(minor_t minor, enum zfs_soft_state_type which)
@@ -148,8 +257,8 @@ extern int zfs_set_prop_nvlist(const char *, zprop_source_t,
 static void zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off,
     uint64_t len, boolean_t sync);
 static int zvol_remove_zv(zvol_state_t *);
-static int zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
-						 znode_t *zp, rl_t *rl);
+static int zvol_get_data(void *arg, lr_write_t *lr, char *buf,
+    struct lwb *lwb, zio_t *zio, znode_t *zp, rl_t *rl);
 // static int zvol_dumpify(zvol_state_t *zv);
 // static int zvol_dump_fini(zvol_state_t *zv);
 // static int zvol_dump_init(zvol_state_t *zv, boolean_t resize);
@@ -508,11 +617,30 @@ zvol_snapdev_hidden(const char *name)
 	return (SET_ERROR(error));
 }
 
+/*
+ * Register the IOKit device of a new minor.  The create process holds
+ * spa_namespace_lock, then needs to call waitForArbitration, but
+ * diskarbitrationd kicks in way early, so wait for the lock to be dropped.
+ */
+static void
+zvol_register_device_impl(zvol_state_t *zv)
+{
+	mutex_enter(&spa_namespace_lock);
+	mutex_exit(&spa_namespace_lock);
+	zvolRegisterDevice(zv);
+}
+
 /*
  * Create a minor node (plus a whole lot more) for the specified volume.
+ *
+ * The objset is owned before zfsdev_state_lock is taken, so that the minors
+ * of different volumes can be created in parallel; a racing create of the
+ * same name fails to own it, or finds the minor once the lock is retaken.
+ * With register_now the IOKit device is registered by the caller's thread,
+ * which must not hold spa_namespace_lock, instead of on spa_zvol_taskq.
  */
-int
-zvol_create_minor_impl(const char *name)
+static int
+zvol_create_minor_common(const char *name, boolean_t register_now)
 {
 	zfs_soft_state_t *zs;
 	zvol_state_t *zv;
@@ -524,30 +652,32 @@ zvol_create_minor_impl(const char *name)
 	dprintf("zvol_create_minor: '%s'\n", name);
 
 	mutex_enter(&zfsdev_state_lock);
-	if (zvol_minor_lookup(name) != NULL) {
-		mutex_exit(&zfsdev_state_lock);
+	zv = zvol_minor_lookup(name);
+	mutex_exit(&zfsdev_state_lock);
+	if (zv != NULL)
 		return (EEXIST);
-	}
 
 	/* On OS X we always check snapdev, for now */
 #ifdef linux
 	if (ignore_snapdev == B_FALSE) {
 #endif
 		error = zvol_snapdev_hidden(name);
-		if (error) {
-			mutex_exit(&zfsdev_state_lock);
+		if (error)
 			return (error);
-		}
 #ifdef linux
 	}
 #endif
 
 	/* lie and say we're read-only */
 	error = dmu_objset_own(name, DMU_OST_ZVOL, B_TRUE, FTAG, &os);
+	if (error)
+		return (error);
 
-	if (error) {
+	mutex_enter(&zfsdev_state_lock);
+	if (zvol_minor_lookup(name) != NULL) {
+		dmu_objset_disown(os, FTAG);
 		mutex_exit(&zfsdev_state_lock);
-		return (error);
+		return (EEXIST);
 	}
 
 	if ((minor = zfsdev_minor_alloc()) == 0) {
@@ -603,9 +733,16 @@ zvol_create_minor_impl(const char *name)
 	mutex_init(&zv->zv_znode.z_range_lock, NULL, MUTEX_DEFAULT, NULL);
 	avl_create(&zv->zv_znode.z_range_avl, zfs_range_compare,
 	    sizeof (rl_t), offsetof(rl_t, r_node));
+	cv_init(&zv->zv_znode.z_range_cv, NULL, CV_DEFAULT, NULL);
 	list_create(&zv->zv_extents, sizeof (zvol_extent_t),
 	    offsetof(zvol_extent_t, ze_node));
 	zv->zv_znode.z_is_zvol = 1;
+	mutex_init(&zv->zv_batch_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zv->zv_batch_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zv->zv_batch_list, sizeof (zvol_sync_write_t),
+	    offsetof(zvol_sync_write_t, zsw_node));
+	zvol_stats_init(zv);
+	dataset_kstats_create(&zv->zv_io_kstats, os);
 
 	/* get and cache the blocksize */
 	error = dmu_object_info(os, ZVOL_OBJ, &doi);
@@ -651,8 +788,12 @@ zvol_create_minor_impl(const char *name)
 
 	/* Register IOKit zvol after disown and unlock */
 	if (error == 0) {
-		// can we still use "os" here since it was disowned
-		zvol_register_device(dmu_objset_spa(os), zv);
+		if (register_now) {
+			zvol_register_device_impl(zv);
+		} else {
+			// can we still use "os" here since it was disowned
+			zvol_register_device(dmu_objset_spa(os), zv);
+		}
 			//error = zvolRegisterDevice(zv);
 		if (error != 0) {
 			dprintf("%s zvolRegisterDevice error %d\n",
@@ -664,6 +805,12 @@ zvol_create_minor_impl(const char *name)
 	return (0);
 }
 
+int
+zvol_create_minor_impl(const char *name)
+{
+	return (zvol_create_minor_common(name, B_FALSE));
+}
+
 
 /*
  * Given a path, return TRUE if path is a ZVOL.
@@ -705,8 +852,14 @@ zvol_remove_zv(zvol_state_t *zv)
 	ddi_remove_minor_node(zfs_dip, NULL);
 #endif
 
+	cv_destroy(&zv->zv_znode.z_range_cv);
 	avl_destroy(&zv->zv_znode.z_range_avl);
 	mutex_destroy(&zv->zv_znode.z_range_lock);
+	zvol_stats_destroy(zv);
+	dataset_kstats_destroy(&zv->zv_io_kstats);
+	list_destroy(&zv->zv_batch_list);
+	cv_destroy(&zv->zv_batch_cv);
+	mutex_destroy(&zv->zv_batch_lock);
 
 	kmem_free(zv, sizeof (zvol_state_t));
 
@@ -799,34 +952,150 @@ __zvol_rename_minor(zvol_state_t *zv, const char *newname)
 #endif
 }
 
+static void zvol_create_minor_task(void *arg);
+
+static void
+zvol_minor_batch_init(zvol_minor_batch_t *zmb)
+{
+	mutex_init(&zmb->zmb_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zmb->zmb_cv, NULL, CV_DEFAULT, NULL);
+	zmb->zmb_pending = 0;
+	list_create(&zmb->zmb_snaps, sizeof (zvol_minor_job_t),
+	    offsetof(zvol_minor_job_t, zmj_node));
+}
+
+static void
+zvol_minor_batch_destroy(zvol_minor_batch_t *zmb)
+{
+	ASSERT0(zmb->zmb_pending);
+	list_destroy(&zmb->zmb_snaps);
+	cv_destroy(&zmb->zmb_cv);
+	mutex_destroy(&zmb->zmb_lock);
+}
+
+static zvol_minor_job_t *
+zvol_minor_job_alloc(zvol_minor_batch_t *zmb, const char *name,
+    uint64_t snapdev)
+{
+	zvol_minor_job_t *zmj;
+
+	zmj = kmem_zalloc(sizeof (zvol_minor_job_t), KM_SLEEP);
+	zmj->zmj_batch = zmb;
+	zmj->zmj_snapdev = snapdev;
+	(void) strlcpy(zmj->zmj_name, name, sizeof (zmj->zmj_name));
+	return (zmj);
+}
+
+static void
+zvol_minor_batch_dispatch(zvol_minor_batch_t *zmb, zvol_minor_job_t *zmj)
+{
+	mutex_enter(&zmb->zmb_lock);
+	zmb->zmb_pending++;
+	mutex_exit(&zmb->zmb_lock);
+
+	ZVOL_MINOR_BUMP(zms_queued);
+	atomic_inc_64(&zvol_minor_stats.zms_pending.value.ui64);
+	if (taskq_dispatch(zvol_minor_taskq, zvol_create_minor_task, zmj,
+	    TQ_SLEEP) == 0)
+		zvol_create_minor_task(zmj);
+}
+
+static void
+zvol_minor_batch_wait(zvol_minor_batch_t *zmb)
+{
+	mutex_enter(&zmb->zmb_lock);
+	while (zmb->zmb_pending != 0)
+		cv_wait(&zmb->zmb_cv, &zmb->zmb_lock);
+	mutex_exit(&zmb->zmb_lock);
+}
+
 /*
- * Mask errors to continue dmu_objset_find() traversal
+ * Queue the snapshots of a volume for the second pass.  Mask errors to
+ * continue dmu_objset_find() traversal.
  */
 static int
-zvol_create_snap_minor_cb(const char *dsname, void *arg)
+zvol_defer_snap_minor_cb(const char *dsname, void *arg)
 {
-	const char *name = (const char *)arg;
+	zvol_minor_job_t *zmj = arg;
+	zvol_minor_batch_t *zmb = zmj->zmj_batch;
+	zvol_minor_job_t *snap;
 
 	/* skip the designated dataset */
-	if (name && strcmp(dsname, name) == 0)
+	if (strcmp(dsname, zmj->zmj_name) == 0)
 		return (0);
 	/* at this point, the dsname should name a snapshot */
 	if (strchr(dsname, '@') == 0) {
-		dprintf("zvol_create_snap_minor_cb(): "
-				"%s is not a shapshot name\n", dsname);
-	} else {
-		(void) zvol_create_minor_impl(dsname);
+		dprintf("zvol_defer_snap_minor_cb(): "
+		    "%s is not a shapshot name\n", dsname);
+		return (0);
 	}
 
+	snap = zvol_minor_job_alloc(zmb, dsname, zmj->zmj_snapdev);
+	mutex_enter(&zmb->zmb_lock);
+	list_insert_tail(&zmb->zmb_snaps, snap);
+	mutex_exit(&zmb->zmb_lock);
+	ZVOL_MINOR_BUMP(zms_snaps_deferred);
+
 	return (0);
 }
 
 /*
- * Mask errors to continue dmu_objset_find() traversal
+ * Create the minor of one volume or snapshot on zvol_minor_taskq.  For a
+ * volume whose snapshots are 'visible', queue those for the second pass.
+ */
+static void
+zvol_create_minor_task(void *arg)
+{
+	zvol_minor_job_t *zmj = arg;
+	zvol_minor_batch_t *zmb = zmj->zmj_batch;
+	objset_t *os;
+	boolean_t is_zvol = B_FALSE;
+	int error;
+
+	/* filesystems are walked too; don't count them as failures */
+	if (dmu_objset_hold(zmj->zmj_name, FTAG, &os) == 0) {
+		is_zvol = (dmu_objset_type(os) == DMU_OST_ZVOL);
+		dmu_objset_rele(os, FTAG);
+	}
+
+	if (is_zvol) {
+		error = zvol_create_minor_common(zmj->zmj_name, B_TRUE);
+		if (error == 0)
+			ZVOL_MINOR_BUMP(zms_created);
+		else if (error == EEXIST)
+			ZVOL_MINOR_BUMP(zms_existing);
+		else if (error != ENODEV)
+			ZVOL_MINOR_BUMP(zms_failed);
+
+		if ((error == 0 || error == EEXIST) &&
+		    zmj->zmj_snapdev == ZFS_SNAPDEV_VISIBLE &&
+		    strchr(zmj->zmj_name, '@') == NULL) {
+			/*
+			 * traverse snapshots only, do not traverse children,
+			 * and skip the 'dsname'
+			 */
+			(void) dmu_objset_find(zmj->zmj_name,
+			    zvol_defer_snap_minor_cb, zmj, DS_FIND_SNAPSHOTS);
+		}
+	}
+
+	kmem_free(zmj, sizeof (zvol_minor_job_t));
+	atomic_dec_64(&zvol_minor_stats.zms_pending.value.ui64);
+
+	mutex_enter(&zmb->zmb_lock);
+	if (--zmb->zmb_pending == 0)
+		cv_broadcast(&zmb->zmb_cv);
+	mutex_exit(&zmb->zmb_lock);
+}
+
+/*
+ * Queue the minor of one dataset found by the walk.  Mask errors to
+ * continue dmu_objset_find() traversal.
  */
 static int
 zvol_create_minors_cb(const char *dsname, void *arg)
 {
+	zvol_minor_batch_t *zmb = arg;
 	uint64_t snapdev;
 	int error;
 
@@ -837,23 +1106,13 @@ zvol_create_minors_cb(const char *dsname, void *arg)
 	/*
 	 * Given the name and the 'snapdev' property, create device minor nodes
 	 * with the linkages to zvols/snapshots as needed.
-	 * If the name represents a zvol, create a minor node for the zvol, then
-	 * check if its snapshots are 'visible', and if so, iterate over the
-	 * snapshots and create device minor nodes for those.
+	 * If the name represents a zvol, a job creates a minor node for the
+	 * zvol, then checks if its snapshots are 'visible', and if so, queues
+	 * the snapshots to have device minor nodes created in the second pass.
 	 */
 	if (strchr(dsname, '@') == 0) {
-		/* create minor for the 'dsname' explicitly */
-		error = zvol_create_minor_impl(dsname);
-		if ((error == 0 || error == EEXIST) &&
-			(snapdev == ZFS_SNAPDEV_VISIBLE)) {
-			/*
-			 * traverse snapshots only, do not traverse children,
-			 * and skip the 'dsname'
-			 */
-			error = dmu_objset_find((char *)dsname,
-									zvol_create_snap_minor_cb, (void *)dsname,
-									DS_FIND_SNAPSHOTS);
-		}
+		zvol_minor_batch_dispatch(zmb,
+		    zvol_minor_job_alloc(zmb, dsname, snapdev));
 	} else {
 		dprintf("zvol_create_minors_cb(): %s is not a zvol name\n",
 				dsname);
@@ -862,6 +1121,17 @@ zvol_create_minors_cb(const char *dsname, void *arg)
 	return (0);
 }
 
+/*
+ * Release an objset owned by zvol_first_open(), along with its key hold.
+ */
+static void
+zvol_disown(objset_t *os)
+{
+	if (os->os_encrypted)
+		spa_keystore_rele_dsl_key(dmu_objset_spa(os),
+		    dmu_objset_id(os), zvol_tag);
+	dmu_objset_disown(os, zvol_tag);
+}
 
 int
 zvol_first_open(zvol_state_t *zv)
@@ -879,18 +1149,28 @@ zvol_first_open(zvol_state_t *zv)
 	if (error)
 		return (error);
 
+	/* an encrypted zvol keeps its key loaded while it is open */
+	if (os->os_encrypted) {
+		error = spa_keystore_hold_dsl_key(dmu_objset_spa(os),
+		    dmu_objset_id(os), zvol_tag);
+		if (error) {
+			dmu_objset_disown(os, zvol_tag);
+			return (error);
+		}
+	}
+
 	zv->zv_objset = os;
 	error = zap_lookup(os, ZVOL_ZAP_OBJ, "size", 8, 1, &volsize);
 	if (error) {
 		ASSERT(error == 0);
-		dmu_objset_disown(os, zvol_tag);
+		zvol_disown(os);
 		zv->zv_objset = NULL;
 		return (error);
 	}
 
 	error = dmu_bonus_hold(os, ZVOL_OBJ, zvol_tag, &zv->zv_dbuf);
 	if (error) {
-		dmu_objset_disown(os, zvol_tag);
+		zvol_disown(os);
 		zv->zv_objset = NULL;
 		return (error);
 	}
@@ -914,7 +1194,7 @@ zvol_first_open(zvol_state_t *zv)
 
   out_owned:
 	if (error) {
-		dmu_objset_disown(os, zvol_tag);
+		zvol_disown(os);
 		zv->zv_objset = NULL;
 	}
 
@@ -930,6 +1210,8 @@ zvol_last_close(zvol_state_t *zv)
 		printf("ZFS: last_close but zv_total_opens==%d\n",
 			   zv->zv_total_opens);
 
+	/* Drain the asynchronous IOKit requests, which use zv_dbuf */
+	taskq_wait(zvol_taskq);
 
 	if (zv->zv_zilog)
 		zil_close(zv->zv_zilog);
@@ -948,7 +1230,7 @@ zvol_last_close(zvol_state_t *zv)
 			txg_wait_synced(dmu_objset_pool(zv->zv_objset), 0);
 		dmu_objset_evict_dbufs(zv->zv_objset);
 
-		dmu_objset_disown(zv->zv_objset, zvol_tag);
+		zvol_disown(zv->zv_objset);
 	}
 	zv->zv_objset = NULL;
 }
@@ -1189,6 +1471,10 @@ zvol_rename_minors_impl(const char *oldname, const char *newname)
  * If the name represents a snapshot, a check is perfromed if the snapshot is
  * 'visible' (which also verifies that the parent is a zvol), and if so,
  * a minor node for that snapshot is created.
+ *
+ * The minors of a dataset scan are created by zvol_minor_taskq in two
+ * passes, the zvols first and then the visible snapshots found for them,
+ * and progress is reported in kstat.zfs.misc.zvol_minors.
  */
 
 static int
@@ -1213,8 +1499,24 @@ zvol_create_minors_impl(const char *name)
 		if (error == 0 && snapdev == ZFS_SNAPDEV_VISIBLE)
 			error = zvol_create_minor_impl(name);
 	} else {
+		zvol_minor_batch_t zmb;
+		zvol_minor_job_t *zmj;
+		hrtime_t start = gethrtime();
+
+		zvol_minor_batch_init(&zmb);
 		error = dmu_objset_find(parent, zvol_create_minors_cb,
-								NULL, DS_FIND_CHILDREN);
+		    &zmb, DS_FIND_CHILDREN);
+		zvol_minor_batch_wait(&zmb);
+
+		while ((zmj = list_head(&zmb.zmb_snaps)) != NULL) {
+			list_remove(&zmb.zmb_snaps, zmj);
+			zvol_minor_batch_dispatch(&zmb, zmj);
+		}
+		zvol_minor_batch_wait(&zmb);
+		zvol_minor_batch_destroy(&zmb);
+
+		dprintf("%s: minors for '%s' took %llu ms\n", __func__, parent,
+		    (u_longlong_t)NSEC2MSEC(gethrtime() - start));
 	}
 
 	kmem_free(parent, MAXPATHLEN);
@@ -1370,14 +1672,7 @@ zvol_task_cb(void *param)
 			zvol_set_snapdev_impl(task->name1, task->snapdev);
 			break;
 		case ZVOL_ASYNC_REGISTER_DEV:
-			/*
-			 * The create process holds spa_namespace, then needs to
-			 * call waitForArbitration. But diskarbitrationd kicks in
-			 * way early,
-			 */
-			mutex_enter(&spa_namespace_lock);
-			mutex_exit(&spa_namespace_lock);
-			zvolRegisterDevice(task->zv);
+			zvol_register_device_impl(task->zv);
 			break;
 		default:
 			VERIFY(0);
@@ -1774,7 +2069,7 @@ zvol_get_done(zgd_t *zgd, int error)
 	zfs_range_unlock(zgd->zgd_rl);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	kmem_free(zgd, sizeof (zgd_t));
 }
@@ -1783,8 +2078,8 @@ zvol_get_done(zgd_t *zgd, int error)
  * Get data to generate a TX_WRITE intent log record.
  */
 static int
-zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
-			  znode_t *zp, rl_t *rl)
+zvol_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio, znode_t *zp, rl_t *rl)
 {
 	zvol_state_t *zv = arg;
 	objset_t *os = zv->zv_objset;
@@ -1796,11 +2091,12 @@ zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 	zgd_t *zgd;
 	int error;
 
-	ASSERT(zio != NULL);
-	ASSERT(size != 0);
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3P(zio, !=, NULL);
+	ASSERT3U(size, !=, 0);
 
 	zgd = kmem_zalloc(sizeof (zgd_t), KM_SLEEP);
-	zgd->zgd_zilog = zv->zv_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_rl = rl;
 	//zgd->zgd_rl = zfs_range_lock(&zv->zv_znode, offset, size, RL_READER);
 
@@ -1849,7 +2145,9 @@ zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
  * zvol_log_write() handles synchronous writes using TX_WRITE ZIL transactions.
  *
  * We store data in the log buffers if it's small enough.
- * Otherwise we will later flush the data out via dmu_sync().
+ * Otherwise we will later flush the data out via dmu_sync().  Only
+ * logbias=latency stores whole blocks in the log buffers when the pool
+ * has log devices.
  */
 ssize_t zvol_immediate_write_sz = 32768;
 
@@ -2300,12 +2598,8 @@ zvol_write(dev_t dev, struct uio *uio, int p)
 	return (error);
 }
 
-/*
- * IOKit read operations will pass IOMemoryDescriptor along here, so
- * that we can call io->writeBytes to read into IOKit zvolumes.
- */
-int
-zvol_read_iokit(zvol_state_t *zv, uint64_t position,
+static int
+zvol_read_iokit_impl(zvol_state_t *zv, uint64_t position,
     uint64_t count, struct iomem *iomem)
 {
 	uint64_t volsize;
@@ -2358,14 +2652,226 @@ zvol_read_iokit(zvol_state_t *zv, uint64_t position,
 	return (error);
 }
 
+/*
+ * IOKit read operations will pass IOMemoryDescriptor along here, so
+ * that we can call io->writeBytes to read into IOKit zvolumes.
+ */
+int
+zvol_read_iokit(zvol_state_t *zv, uint64_t position,
+    uint64_t count, struct iomem *iomem)
+{
+	hrtime_t start = gethrtime();
+	int error;
+
+	error = zvol_read_iokit_impl(zv, position, count, iomem);
+	if (error == 0) {
+		dataset_kstats_update_read(&zv->zv_io_kstats,
+		    MIN(count, zv->zv_volsize - position),
+		    gethrtime() - start);
+	}
+
+	return (error);
+}
+
+
+static void
+zvol_stats_init(zvol_state_t *zv)
+{
+	char name[KSTAT_STRLEN];
+	char kname[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	zv->zv_stats = kmem_alloc(sizeof (zvol_stats_t), KM_SLEEP);
+	bcopy(&zvol_stats_template, zv->zv_stats, sizeof (zvol_stats_t));
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s",
+	    spa_name(dmu_objset_spa(zv->zv_objset)));
+	(void) snprintf(kname, KSTAT_STRLEN, "zvol%u", zv->zv_minor);
+
+	ksp = kstat_create(name, 0, kname, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (zvol_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	zv->zv_kstat = ksp;
+	if (ksp != NULL) {
+		ksp->ks_data = zv->zv_stats;
+		kstat_install(ksp);
+	}
+}
+
+static void
+zvol_stats_destroy(zvol_state_t *zv)
+{
+	if (zv->zv_kstat != NULL)
+		kstat_delete(zv->zv_kstat);
+	kmem_free(zv->zv_stats, sizeof (zvol_stats_t));
+}
 
 /*
- * IOKit write operations will pass IOMemoryDescriptor along here, so
- * that we can call io->readBytes to write into IOKit zvolumes.
+ * Add [start, end) to the sorted, disjoint runs, merging it with the runs
+ * it overlaps or abuts.
+ */
+static void
+zvol_batch_add_run(zvol_batch_run_t *runs, int *nrunsp, uint64_t start,
+    uint64_t end)
+{
+	int nruns = *nrunsp;
+	int i, j;
+
+	for (i = 0; i < nruns && runs[i].zbr_end < start; i++)
+		continue;
+	for (j = i; j < nruns && runs[j].zbr_start <= end; j++) {
+		start = MIN(start, runs[j].zbr_start);
+		end = MAX(end, runs[j].zbr_end);
+	}
+	if (j == i) {
+		/* nothing to merge with, make room for a new run */
+		bcopy(&runs[i], &runs[i + 1], (nruns - i) * sizeof (*runs));
+		nruns++;
+	} else if (j > i + 1) {
+		/* runs i through j - 1 become one */
+		bcopy(&runs[j], &runs[i + 1], (nruns - j) * sizeof (*runs));
+		nruns -= j - i - 1;
+	}
+	runs[i].zbr_start = start;
+	runs[i].zbr_end = end;
+	*nrunsp = nruns;
+}
+
+/*
+ * Write a batch of queued synchronous writes in one tx, logging each run
+ * of adjacent writes once, and commit them with one zil_commit().  The
+ * writes are applied in the order they were queued, so of overlapping
+ * writes the later one wins.
  */
+static void
+zvol_batch_write(zvol_state_t *zv, list_t *batch, int nwrites)
+{
+	zvol_batch_run_t *runs;
+	zvol_sync_write_t *zsw;
+	rl_t **rls;
+	dmu_tx_t *tx;
+	int nruns = 0;
+	int error;
+	int i;
 
-int
-zvol_write_iokit(zvol_state_t *zv, uint64_t position,
+	runs = kmem_alloc(nwrites * sizeof (*runs), KM_SLEEP);
+	rls = kmem_alloc(nwrites * sizeof (*rls), KM_SLEEP);
+	for (zsw = list_head(batch); zsw != NULL; zsw = list_next(batch, zsw)) {
+		zvol_batch_add_run(runs, &nruns, zsw->zsw_offset,
+		    zsw->zsw_offset + zsw->zsw_count);
+	}
+
+	/* The runs are disjoint, so locking them in order can't deadlock. */
+	for (i = 0; i < nruns; i++) {
+		rls[i] = zfs_range_lock(&zv->zv_znode, runs[i].zbr_start,
+		    runs[i].zbr_end - runs[i].zbr_start, RL_WRITER);
+	}
+
+	tx = dmu_tx_create(zv->zv_objset);
+	for (i = 0; i < nruns; i++) {
+		dmu_tx_hold_write(tx, ZVOL_OBJ, runs[i].zbr_start,
+		    runs[i].zbr_end - runs[i].zbr_start);
+	}
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error != 0) {
+		dmu_tx_abort(tx);
+	} else {
+		for (zsw = list_head(batch); zsw != NULL;
+		    zsw = list_next(batch, zsw)) {
+			uint64_t off = 0;
+			uint64_t bytes = zsw->zsw_count;
+
+			zsw->zsw_error = dmu_write_iokit_dbuf(zv->zv_dbuf,
+			    &off, zsw->zsw_offset, &bytes, zsw->zsw_iomem, tx);
+		}
+		for (i = 0; i < nruns; i++) {
+			zvol_log_write(zv, tx, runs[i].zbr_start,
+			    runs[i].zbr_end - runs[i].zbr_start, B_TRUE);
+		}
+		dmu_tx_commit(tx);
+	}
+
+	for (i = 0; i < nruns; i++)
+		zfs_range_unlock(rls[i]);
+
+	if (error == 0)
+		zil_commit(zv->zv_zilog, ZVOL_OBJ);
+
+	for (zsw = list_head(batch); zsw != NULL; zsw = list_next(batch, zsw)) {
+		if (error != 0)
+			zsw->zsw_error = error;
+	}
+
+	ZVOL_STAT_INCR(zv, zs_sync_writes, nwrites);
+	ZVOL_STAT_INCR(zv, zs_batches, 1);
+	if (nwrites > 1)
+		ZVOL_STAT_INCR(zv, zs_batched_writes, nwrites);
+	ZVOL_STAT_INCR(zv, zs_merged_writes, nwrites - nruns);
+
+	kmem_free(rls, nwrites * sizeof (*rls));
+	kmem_free(runs, nwrites * sizeof (*runs));
+}
+
+/*
+ * Queue a synchronous write and wait for a batch to write it.  The first
+ * writer to find no batch in progress writes one, made of everything
+ * queued up to ZVOL_BATCH_MAX bytes, while the writes queued meanwhile
+ * wait to form the next.
+ */
+static int
+zvol_write_batched(zvol_state_t *zv, uint64_t position, uint64_t count,
+    struct iomem *iomem)
+{
+	zvol_sync_write_t zsw;
+
+	zsw.zsw_offset = position;
+	zsw.zsw_count = MIN(count, zv->zv_volsize - position);
+	zsw.zsw_iomem = iomem;
+	zsw.zsw_error = 0;
+	zsw.zsw_done = B_FALSE;
+
+	mutex_enter(&zv->zv_batch_lock);
+	list_insert_tail(&zv->zv_batch_list, &zsw);
+	while (!zsw.zsw_done) {
+		zvol_sync_write_t *next;
+		uint64_t bytes = 0;
+		int nwrites = 0;
+		list_t batch;
+
+		if (zv->zv_batch_active) {
+			cv_wait(&zv->zv_batch_cv, &zv->zv_batch_lock);
+			continue;
+		}
+
+		list_create(&batch, sizeof (zvol_sync_write_t),
+		    offsetof(zvol_sync_write_t, zsw_node));
+		while ((next = list_head(&zv->zv_batch_list)) != NULL &&
+		    (nwrites == 0 ||
+		    bytes + next->zsw_count <= ZVOL_BATCH_MAX)) {
+			list_remove(&zv->zv_batch_list, next);
+			list_insert_tail(&batch, next);
+			bytes += next->zsw_count;
+			nwrites++;
+		}
+		zv->zv_batch_active = B_TRUE;
+		mutex_exit(&zv->zv_batch_lock);
+
+		zvol_batch_write(zv, &batch, nwrites);
+
+		mutex_enter(&zv->zv_batch_lock);
+		while ((next = list_remove_head(&batch)) != NULL)
+			next->zsw_done = B_TRUE;
+		list_destroy(&batch);
+		zv->zv_batch_active = B_FALSE;
+		cv_broadcast(&zv->zv_batch_cv);
+	}
+	mutex_exit(&zv->zv_batch_lock);
+
+	return (zsw.zsw_error);
+}
+
+static int
+zvol_write_iokit_impl(zvol_state_t *zv, uint64_t position,
     uint64_t count, struct iomem *iomem)
 {
 	uint64_t volsize;
@@ -2398,6 +2904,9 @@ zvol_write_iokit(zvol_state_t *zv, uint64_t position,
 	sync = !(zv->zv_flags & ZVOL_WCE) ||
 	    (zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS);
 
+	if (sync && zvol_sync_batch && count <= ZVOL_BATCH_MAX)
+		return (zvol_write_batched(zv, position, count, iomem));
+
 	/* Lock the entire range */
 	rl = zfs_range_lock(&zv->zv_znode, position, count,
 	    RL_WRITER);
@@ -2412,7 +2921,7 @@ zvol_write_iokit(zvol_state_t *zv, uint64_t position,
 		if (bytes > volsize - (position + off))
 			bytes = volsize - (position + off);
 
-		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
+		dmu_tx_hold_write(tx, ZVOL_OBJ, position + off, bytes);
 		error = dmu_tx_assign(tx, TXG_WAIT);
 		if (error) {
 			dmu_tx_abort(tx);
@@ -2425,7 +2934,8 @@ zvol_write_iokit(zvol_state_t *zv, uint64_t position,
 		if (error == 0) {
 			count -= MIN(count,
 			    (DMU_MAX_ACCESS >> 1)) + bytes;
-			zvol_log_write(zv, tx, off, bytes, sync);
+			zvol_log_write(zv, tx, position + off, offset - off,
+			    sync);
 		}
 		dmu_tx_commit(tx);
 
@@ -2440,6 +2950,27 @@ zvol_write_iokit(zvol_state_t *zv, uint64_t position,
 	return (error);
 }
 
+/*
+ * IOKit write operations will pass IOMemoryDescriptor along here, so
+ * that we can call io->readBytes to write into IOKit zvolumes.
+ */
+int
+zvol_write_iokit(zvol_state_t *zv, uint64_t position,
+    uint64_t count, struct iomem *iomem)
+{
+	hrtime_t start = gethrtime();
+	int error;
+
+	error = zvol_write_iokit_impl(zv, position, count, iomem);
+	if (error == 0) {
+		dataset_kstats_update_write(&zv->zv_io_kstats,
+		    MIN(count, zv->zv_volsize - position),
+		    gethrtime() - start);
+	}
+
+	return (error);
+}
+
 int
 zvol_unmap(zvol_state_t *zv, uint64_t off, uint64_t bytes)
 {
@@ -2927,6 +3458,19 @@ zvol_init(void)
 	mutex_init(&zfsdev_state_lock, NULL, MUTEX_DEFAULT, NULL);
 #endif
 	dprintf("zfsdev_state: %p\n", zfsdev_state);
+
+	zvol_taskq = taskq_create("zvol", zvol_threads, maxclsyspri,
+	    zvol_threads * 2, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
+	zvol_minor_taskq = taskq_create("zvol_minor", MAX(zvol_minor_threads,
+	    1), defclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
+
+	zvol_minor_ksp = kstat_create("zfs", 0, "zvol_minors", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zvol_minor_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (zvol_minor_ksp != NULL) {
+		zvol_minor_ksp->ks_data = &zvol_minor_stats;
+		kstat_install(zvol_minor_ksp);
+	}
 	return (0);
 }
 
@@ -2934,6 +3478,12 @@ void
 zvol_fini(void)
 {
 	zvol_remove_minors_impl(NULL);
+	if (zvol_minor_ksp != NULL) {
+		kstat_delete(zvol_minor_ksp);
+		zvol_minor_ksp = NULL;
+	}
+	taskq_destroy(zvol_minor_taskq);
+	taskq_destroy(zvol_taskq);
 #ifdef illumos
 	mutex_destroy(&zfsdev_state_lock);
 #endif
@@ -29,6 +29,14 @@
 
 #define	ZVOL_BSIZE	DEV_BSIZE
 
+/*
+ * The largest read or write we advertise.  Requests are copied to and
+ * from the memory descriptor by the DMU in DMU_MAX_ACCESS / 2 chunks, so
+ * a request of this size is one transaction, and there is no limit on
+ * the number, size or alignment of its segments.
+ */
+#define	ZVOL_MAX_TRANSFER	(DMU_MAX_ACCESS >> 1)
+
 static const char* ZVOL_PRODUCT_NAME_PREFIX = "ZVOL ";
 
 /* Wrapper for zvol_state pointer to IOKit device */
@@ -254,19 +262,27 @@ net_lundman_zfs_zvol_device::attach(IOService* provider)
 
 
 	/*
-	 * Set transfer limits:
-	 *
-	 *  Maximum transfer size (bytes)
-	 *  Maximum transfer block count
-	 *  Maximum transfer block size (bytes)
-	 *  Maximum transfer segment count
-	 *  Maximum transfer segment size (bytes)
-	 *  Minimum transfer segment size (bytes)
-	 *
-	 *  We will need to establish safe defaults for all / per volblocksize
-	 *
-	 *  Example: setProperty(kIOMinimumSegmentAlignmentByteCountKey, 1, 1);
+	 * Set transfer limits.  Without them IOBlockStorageDriver falls back
+	 * to conservative defaults and splits large requests into many small
+	 * ones, each a transaction of its own, and writes that no longer
+	 * cover whole volblocksize blocks have the DMU read the rest of the
+	 * block first.  The data is copied using the memory descriptor, so
+	 * its segments can have any count, size and alignment.
 	 */
+	setProperty(kIOMaximumByteCountReadKey, ZVOL_MAX_TRANSFER, 64);
+	setProperty(kIOMaximumByteCountWriteKey, ZVOL_MAX_TRANSFER, 64);
+	setProperty(kIOMaximumBlockCountReadKey,
+	    ZVOL_MAX_TRANSFER / ZVOL_BSIZE, 64);
+	setProperty(kIOMaximumBlockCountWriteKey,
+	    ZVOL_MAX_TRANSFER / ZVOL_BSIZE, 64);
+	setProperty(kIOMaximumSegmentCountReadKey,
+	    ZVOL_MAX_TRANSFER / PAGE_SIZE, 64);
+	setProperty(kIOMaximumSegmentCountWriteKey,
+	    ZVOL_MAX_TRANSFER / PAGE_SIZE, 64);
+	setProperty(kIOMaximumSegmentByteCountReadKey, ZVOL_MAX_TRANSFER, 64);
+	setProperty(kIOMaximumSegmentByteCountWriteKey, ZVOL_MAX_TRANSFER, 64);
+	setProperty(kIOMinimumSegmentAlignmentByteCountKey, 1, 64);
+	setProperty(kIOMaximumSegmentAddressableBitCountKey, 64, 64);
 
 	/*
 	 * Finally "Generic" type, set as a device property. Tried setting this
@@ -504,26 +520,58 @@ net_lundman_zfs_zvol_device::handleClose(IOService *client,
 
 }
 
+/*
+ * A read or write in flight on zvol_taskq.  The device and its provider
+ * are retained until the request completes, so that they do not go away
+ * underneath it.
+ */
+typedef struct zvol_iokit_io {
+	struct iomem		zi_iomem;
+	zvol_state_t		*zi_zv;
+	IOService		*zi_device;
+	IOService		*zi_provider;
+	IOStorageCompletion	zi_completion;
+	uint64_t		zi_offset;
+	uint64_t		zi_count;
+	boolean_t		zi_read;
+} zvol_iokit_io_t;
+
+static void
+zvol_iokit_io_task(void *arg)
+{
+	zvol_iokit_io_t *zi = (zvol_iokit_io_t *)arg;
+	IOReturn result = kIOReturnSuccess;
+	IOByteCount actualByteCount = zi->zi_count;
+	int error;
+
+	if (zi->zi_read) {
+		error = zvol_read_iokit(zi->zi_zv, zi->zi_offset,
+		    zi->zi_count, &zi->zi_iomem);
+	} else {
+		error = zvol_write_iokit(zi->zi_zv, zi->zi_offset,
+		    zi->zi_count, &zi->zi_iomem);
+	}
+	if (error != 0) {
+		dprintf("Read/Write operation failed: %d\n", error);
+		actualByteCount = 0;
+		result = kIOReturnIOError;
+	}
+
+	zi->zi_iomem.buf->release();
+	zi->zi_provider->release();
+	zi->zi_device->release();
+
+	IOStorage::complete(&zi->zi_completion, result, actualByteCount);
+	kmem_free(zi, sizeof (zvol_iokit_io_t));
+}
+
 IOReturn
 net_lundman_zfs_zvol_device::doAsyncReadWrite(
     IOMemoryDescriptor *buffer, UInt64 block, UInt64 nblks,
     IOStorageAttributes *attributes, IOStorageCompletion *completion)
 {
 	IODirection direction;
-	IOByteCount actualByteCount;
-#if 0
-	struct iomem *iomem = 0;
-	// struct io_context *context = 0;
-#else
-	/*
-	 * XXX Until we implement async IO, an on-stack struct is
-	 * fine. At that point we can embed the buffer in an IO
-	 * context struct with the completion callback, plus list
-	 * pointers to track inflight/completed IOs.
-	 */
-	struct iomem iomem;
-	iomem.buf = NULL;
-#endif
+	zvol_iokit_io_t *zi;
 
 	// Return errors for incoming I/O if we have been terminated.
 	if (isInactive() == true) {
@@ -559,72 +607,31 @@ net_lundman_zfs_zvol_device::doAsyncReadWrite(
 	dprintf("%s offset @block %llu numblocks %llu: blksz %u\n",
 	    direction == kIODirectionIn ? "Read" : "Write",
 	    block, nblks, (ZVOL_BSIZE));
-	// IOLog("getMediaBlockSize is %llu\n",
-	//	m_provider->getMediaBlockSize());
-
-	/* Perform the read or write operation through the transport driver. */
-	actualByteCount = (nblks*(ZVOL_BSIZE));
 
-#if 0
-	if ((iomem = (struct iomem *)kmem_alloc(sizeof (struct iomem),
-	    KM_SLEEP)) == NULL) {
-		dprintf("%s allocation failed\n", __func__);
-		(completion->action)(completion->target, completion->parameter,
-		    kIOReturnSuccess, actualByteCount);
-		return (kIOReturnSuccess);
-	}
-	iomem->buf = buffer;
-#else
-	iomem.buf = buffer;
-#endif
+	zi = (zvol_iokit_io_t *)kmem_alloc(sizeof (zvol_iokit_io_t), KM_SLEEP);
+	zi->zi_iomem.buf = buffer;
+	zi->zi_zv = zv;
+	zi->zi_device = this;
+	zi->zi_provider = m_provider;
+	zi->zi_completion = *completion;
+	zi->zi_offset = block * (ZVOL_BSIZE);
+	zi->zi_count = nblks * (ZVOL_BSIZE);
+	zi->zi_read = (direction == kIODirectionIn);
 
 	/* Make sure we don't go away while the command is being executed */
 	retain();
 	m_provider->retain();
+	buffer->retain();
 
-	if (direction == kIODirectionIn) {
-
-#if 0
-		if (zvol_read_iokit(zv, (block*(ZVOL_BSIZE)),
-		    actualByteCount, iomem)) {
-#else
-		if (zvol_read_iokit(zv, (block*(ZVOL_BSIZE)),
-		    actualByteCount, &iomem)) {
-#endif
-
-			actualByteCount = 0;
-		}
-
-	} else {
-
-#if 0
-		if (zvol_write_iokit(zv, (block*(ZVOL_BSIZE)),
-		    actualByteCount, iomem)) {
-#else
-		if (zvol_write_iokit(zv, (block*(ZVOL_BSIZE)),
-		    actualByteCount, &iomem)) {
-#endif
-			actualByteCount = 0;
-		}
-
-	}
-
-	m_provider->release();
-	release();
-
-#if 0
-	/* If async, this would happen in io_done() */
-	kmem_free(iomem, sizeof (struct iomem));
-#else
-	iomem.buf = NULL; // overkill
-#endif
-
-	if (actualByteCount != nblks*(ZVOL_BSIZE))
-		dprintf("Read/Write operation failed\n");
+	/*
+	 * Hand the request to the zvol taskq and return; the completion is
+	 * called once the read or write is done.  If the taskq cannot take
+	 * it, do the work here instead.
+	 */
+	if (taskq_dispatch(zvol_taskq, zvol_iokit_io_task, zi,
+	    TQ_NOSLEEP) == 0)
+		zvol_iokit_io_task(zi);
 
-	// Call the completion function.
-	(completion->action)(completion->target, completion->parameter,
-	    kIOReturnSuccess, actualByteCount);
 	return (kIOReturnSuccess);
 }
 
@@ -0,0 +1,50 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * The zstd library is built into the kernel against the kernel's headers,
+ * which have no <limits.h>.  It only needs the limits of the integer
+ * types, which the compiler knows.
+ */
+
+#ifndef	_ZSTD_LIMITS_H
+#define	_ZSTD_LIMITS_H
+
+#ifndef	CHAR_BIT
+#define	CHAR_BIT	__CHAR_BIT__
+#endif
+#ifndef	USHRT_MAX
+#define	USHRT_MAX	(__SHRT_MAX__ * 2 + 1)
+#endif
+#ifndef	INT_MAX
+#define	INT_MAX		__INT_MAX__
+#endif
+#ifndef	UINT_MAX
+#define	UINT_MAX	(__INT_MAX__ * 2U + 1U)
+#endif
+#ifndef	ULONG_MAX
+#define	ULONG_MAX	(__LONG_MAX__ * 2UL + 1UL)
+#endif
+#ifndef	ULLONG_MAX
+#define	ULLONG_MAX	(__LONG_LONG_MAX__ * 2ULL + 1ULL)
+#endif
+
+#endif /* _ZSTD_LIMITS_H */
@@ -0,0 +1,36 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * <stdlib.h> for the kernel build of the zstd library.  zstd.c only ever
+ * gives the library contexts placed in workspaces of its own
+ * (ZSTD_initStatic*Ctx), so the library's default allocator is never
+ * called; should it be, the allocation simply fails.
+ */
+
+#ifndef	_ZSTD_STDLIB_H
+#define	_ZSTD_STDLIB_H
+
+#define	malloc(s)	((void)(s), (void *)0)
+#define	calloc(n, s)	((void)(n), (void)(s), (void *)0)
+#define	free(p)		((void)(p))
+
+#endif /* _ZSTD_STDLIB_H */